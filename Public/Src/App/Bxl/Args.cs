@@ -164,6 +164,9 @@ namespace BuildXL
                         OptionHandlerFactory.CreateBoolOption(
                             "alwaysRemoteInjectDetoursFrom32BitProcess",
                             opt => sandboxConfiguration.AlwaysRemoteInjectDetoursFrom32BitProcess = opt),
+                        OptionHandlerFactory.CreateBoolOption(
+                            "answerProbesUnderFullSealsFromManifest",
+                            sign => sandboxConfiguration.AnswerProbesUnderFullSealsFromManifest = sign),
                         OptionHandlerFactory.CreateBoolOption(
                             "analyzeDependencyViolations",
                             opt => { /* DEPRECATED -- DO NOTHING */ }),
@@ -549,6 +552,9 @@ namespace BuildXL
                         OptionHandlerFactory.CreateBoolOption(
                             "kextEnableReportBatching",
                             sign => sandboxConfiguration.KextEnableReportBatching = sign),
+                        OptionHandlerFactory.CreateOption(
+                            "kextReportCoalescingWindowMs",
+                            opt => sandboxConfiguration.KextReportCoalescingWindowMs = CommandLineUtilities.ParseUInt32Option(opt, 0, 100)),
                         OptionHandlerFactory.CreateBoolOption(
                             "measureProcessCpuTimes",
                             sign => sandboxConfiguration.MeasureProcessCpuTimes = sign),
@@ -21,7 +21,6 @@
 #define MIN_SUBST_LENGTH 3
 #define SUBST_START_OFFSET 2
 #define SUBST_SOURCE_LENGTH 65536
-#define GET_PATH_TARGET_OFFSET  8
 #define RUN_IN_SUBST_VERBOSE L"RUN_IN_SUBST_VERBOSE"
 #define RUN_IN_SUBST_VERBOSE_BUFF_SIZE 2
 #define MAPPED_PATH_STRING L"\\??\\"
@@ -280,287 +279,103 @@ static bool ParseSubstSourcesAndTargets(int argc, _TCHAR* argv[], PSUBST_LIST_NO
 // warning C26409: Avoid calling new and delete explicitly, use std::make_unique<T> instead (r.11).
 #pragma warning( disable : 6386 26446 26401 26414 26481 26485 26472 26409 )
 
-// Gets the mapped path for each mapped drive.
+// Gets the path the drive of the given node is substituted for, the way 'subst' lists it, and stores it in the node.
+// Drives that are not defined, or not defined by subst (i.e., not mapped to a "\\??\\" path), have no mapped path.
+// The mapping is read straight from the DOS device namespace, so getting it doesn't launch a 'subst' process.
 // Returns 0 if successful and non-zero if failed.
-static int GetMappedPaths(PSUBST_NODE* pOrderedSubstList)
+static int GetMappedPath(PSUBST_NODE pSubstNode)
 {
-    assert(pOrderedSubstList != nullptr);
-
-    SECURITY_ATTRIBUTES saAttr{};
-    HANDLE g_hChildStd_IN_Rd = NULL;
-    HANDLE g_hChildStd_OUT_Rd = NULL;
-    HANDLE g_hChildStd_OUT_Wr = NULL;
-
-    // Set the bInheritHandle flag so pipe handles are inherited. 
-    saAttr.nLength = sizeof(SECURITY_ATTRIBUTES);
-    saAttr.bInheritHandle = TRUE;
-    saAttr.lpSecurityDescriptor = NULL;
-
-    // Create a pipe for the child process's STDOUT. 
+    assert(pSubstNode != nullptr);
 
-    if (!CreatePipe(&g_hChildStd_OUT_Rd, &g_hChildStd_OUT_Wr, &saAttr, 0))
+    if (pSubstNode->szMappedPath != nullptr)
     {
-        wprintf(L"Error: Could not get MappedDrives: CreatePipe.\r\n");
-        return 1;
+        delete[] pSubstNode->szMappedPath;
+        pSubstNode->szMappedPath = nullptr;
     }
 
-    // Ensure the read handle to the pipe for STDOUT is not inherited
-    if (!SetHandleInformation(g_hChildStd_OUT_Rd, HANDLE_FLAG_INHERIT, 0))
-    {
-        wprintf(L"Error: Could not get MappedDrives: SetHandleInformation.\r\n");
-        return 1;
-    }
+    const TCHAR drive[3] = { pSubstNode->szDriveLetter, L':', L'\0' };
+    auto target = std::vector<TCHAR>(SUBST_SOURCE_LENGTH, 0);
 
-    BOOL bSuccess = FALSE;
-    std::wstring substCommand(L"subst.exe");
-
-    // Set up members of the PROCESS_INFORMATION structure
-    PROCESS_INFORMATION piProcInfo;
-    ZeroMemory(&piProcInfo, sizeof(PROCESS_INFORMATION));
-
-    // Declare process info
-    STARTUPINFO siStartInfo;
-
-    // Set up members of the STARTUPINFO structure. 
-    // This structure specifies the STDIN and STDOUT handles for redirection.
-    ZeroMemory(&siStartInfo, sizeof(STARTUPINFO));
-    siStartInfo.cb = sizeof(STARTUPINFO);
-    siStartInfo.hStdError = g_hChildStd_OUT_Wr;
-    siStartInfo.hStdOutput = g_hChildStd_OUT_Wr;
-    siStartInfo.hStdInput = g_hChildStd_IN_Rd;
-    siStartInfo.dwFlags |= STARTF_USESTDHANDLES;
-
-    // Create the child process. 
-    bSuccess = CreateProcess(NULL,
-        (LPWSTR)substCommand.c_str(), // command line 
-        NULL,     // process security attributes 
-        NULL,     // primary thread security attributes 
-        TRUE,     // handles are inherited 
-        0,       // creation flags 
-        NULL,     // use parent's environment 
-        NULL,     // use parent's current directory 
-        &siStartInfo, // STARTUPINFO pointer 
-        &piProcInfo); // receives PROCESS_INFORMATION
-
-    // If an error occurs...
-    if (!bSuccess)
+    // The first string returned is the current definition of the drive.
+    if (QueryDosDevice(drive, target.data(), SUBST_SOURCE_LENGTH) == 0)
     {
-        wprintf(L"Error: Could not get MappedDrives: CreateProcess.\r\n");
+        const DWORD lastError = GetLastError();
+        if (lastError == ERROR_FILE_NOT_FOUND)
+        {
+            // The drive is not defined.
+            return 0;
+        }
+
+        wprintf(L"Error: Could not get the mapped path of drive %C:. Error: %d\r\n", pSubstNode->szDriveLetter, (int)lastError);
         return 1;
     }
 
-    printVerbose(L"{}", L"Start waiting for subst process in GetMappedPath to complete.");
-    WaitForSingleObject(piProcInfo.hProcess, INFINITE);
-    printVerbose(L"{}", L"Done waiting for subst process in GetMappedPath to complete.");
-
-    // Close handles to the child process and its primary thread
-    CloseHandle(piProcInfo.hProcess);
-    CloseHandle(piProcInfo.hThread);
-
-    // Read output from the child process's pipe for STDOUT
-    // Stop when there is no more data. 
-    bSuccess = FALSE;
-
-    // Close the write end of the pipe before reading from the 
-    // read end of the pipe, to control child process execution.
-    // The pipe is assumed to have enough buffer space to hold the
-    // data the child process has already written to it.
-    if (!CloseHandle(g_hChildStd_OUT_Wr))
+    std::basic_string<TCHAR> mappedPath(target.data());
+    if (mappedPath.rfind(MAPPED_PATH_STRING, 0) != 0)
     {
-        wprintf(L"Error: Could not get MappedDrives: CloseChildHandle.\r\n");
-        return 1;
+        // Not a subst drive (e.g., a volume).
+        return 0;
     }
 
-    DWORD dwRead = 0;
-    auto chBuf = std::vector<char>(SUBST_SOURCE_LENGTH, 0);
-    std::basic_string<TCHAR> mappedPath;
+    // Skip the leading "\\??\\".
+    mappedPath.erase(0, wcslen(MAPPED_PATH_STRING));
+    std::transform(mappedPath.begin(), mappedPath.end(), mappedPath.begin(), [](TCHAR c) { return static_cast<TCHAR>(::towlower(c)); });
 
-    while (true)
+    // make sure there is a trailing '\\'.
+    if (mappedPath.empty() || mappedPath.back() != L'\\')
     {
-        bSuccess = ReadFile(g_hChildStd_OUT_Rd, chBuf.data(), SUBST_SOURCE_LENGTH, &dwRead, NULL);
-
-        // When using CreateProcess everything is fine here
-        // When using CreateProcessWithLogonW bSuccess is FALSE and the pipe seems to be closed
-
-        if (!bSuccess || dwRead == 0)
-        {
-            break;
-        }
-
-        if (dwRead == 0) break;
-        chBuf[dwRead] = L'\0';
-
-        unsigned i = 0;
-
-        while (true)
-        {
-            if (chBuf[i] == L'\0')
-            {
-                break;
-            }
-
-            // Find the drive we are trying to map
-            TCHAR driveLetter = (TCHAR)chBuf[i];
-
-            i += GET_PATH_TARGET_OFFSET;
-            mappedPath.clear();
-
-            while (chBuf[i] != L'\r' && chBuf[i] != L'\0')
-            {
-                mappedPath.push_back(static_cast<TCHAR>(::tolower(chBuf[i])));
-                i++;
-            }
-
-            const wchar_t* ptr = wcsstr(mappedPath.c_str(), MAPPED_PATH_STRING);
-            unsigned mappedPathOffset = 0;
-            if (ptr == mappedPath.c_str())
-            {
-                mappedPathOffset = 4;
-            }
-
-            // Make drive letter uppercase.
-            driveLetter = static_cast<TCHAR>(::_totupper(driveLetter));
-            int substTargetValue = static_cast<int>(driveLetter);
-
-            // The drive letter can be A-Z only.
-            if (substTargetValue < 65 || substTargetValue > 90)
-            {
-                TCHAR dl[2];
-                dl[0] = driveLetter;
-                dl[1] = L'\0';
-                wprintf(L"Error: Invalid target drive letter - %s. Allowed drive letters A-Z.\r\n", dl);
-                return 1;
-            }
-
-            // make sure there is a trailing '\\'.
-            const size_t srcLen = wcslen(mappedPath.c_str());
-            if (mappedPath.back() != L'\\')
-            {
-                mappedPath.push_back(L'\\');
-            }
-
-            if (pOrderedSubstList[substTargetValue - 65] != nullptr)
-            {
-                if (pOrderedSubstList[substTargetValue - 65]->szMappedPath != nullptr)
-                {
-                    delete[] pOrderedSubstList[substTargetValue - 65]->szMappedPath;
-                }
-
-                pOrderedSubstList[substTargetValue - 65]->szMappedPath = new TCHAR[srcLen + 2];
-                wcscpy_s(pOrderedSubstList[substTargetValue - 65]->szMappedPath, srcLen + 2, mappedPath.c_str() + mappedPathOffset); // Skip leading "\\??\\".
-            }
-
-            if (chBuf[i] == L'\0')
-            {
-                break;
-            }
-            else
-            {
-                // Skip the \r char
-                i++;
-                // Skip the \n char
-                i++;
-            }
-        }
-
-        if (chBuf[i])
-        {
-            break;
-        }
+        mappedPath.push_back(L'\\');
     }
 
-    CloseHandle(g_hChildStd_OUT_Rd);
+    pSubstNode->szMappedPath = new TCHAR[mappedPath.size() + 1];
+    wcscpy_s(pSubstNode->szMappedPath, mappedPath.size() + 1, mappedPath.c_str());
 
     return 0;
 }
 #pragma warning( pop )
 
 #pragma warning( push )
-// warning C6386: Buffer overrun while writing to 'chBuf'.
-// warning C26446: Prefer to use gsl::at() instead of unchecked subscript operator (bounds.4).
-// warning C26401: Do not delete a raw pointer that is not an owner<T> (i.11).
-// warning C26414: Move, copy, reassign or reset a local smart pointer 'chBuf' / 'mappedPath' (r.5).
-// warning C26481: Don't use pointer arithmetic. Use span instead (bounds.1).
-// warning C26485: Expression 'dl': No array to pointer decay (bounds.3).
+// warning C26461: The pointer argument 'pSubstNode' for function 'UnmapDrive' can be marked as a pointer to const (con.3).
 // warning C26409: Avoid calling new and delete explicitly, use std::make_unique<T> instead (r.11).
-// warning C26472: Don't use a static_cast for arithmetic conversions. Use brace initialization, gsl::narrow_cast or gsl::narrow (type.1).
-#pragma warning( disable : 6386 26446 26401 26414 26481 26485 26409 26472 )
+#pragma warning( disable : 26461 26409 )
 
-// Start a process and returns if it had error (1) or not (0).
-static int MapUnmapSubstExecute(std::wstring substCommand)
+// Removes the subst of the drive of the given node, like 'subst /D' does: drives that are not defined by subst are left alone.
+// Returns 0 if successful and non-zero if failed.
+static int UnmapDrive(PSUBST_NODE pSubstNode)
 {
-    STARTUPINFO si{};
-    PROCESS_INFORMATION pi{};
-
-    ZeroMemory(&si, sizeof(si));
-    si.cb = sizeof(si);
-    ZeroMemory(&pi, sizeof(pi));
+    SUBST_NODE mappedNode;
+    mappedNode.szDriveLetter = pSubstNode->szDriveLetter;
+    const bool isSubstDrive = GetMappedPath(&mappedNode) == 0 && mappedNode.szMappedPath != nullptr;
+    delete[] mappedNode.szMappedPath;
 
-    // CreateProcessW may modify the command line
-    auto mutableCommandLine = std::make_unique<TCHAR[]>(substCommand.size() + 1);
-    ZeroMemory(mutableCommandLine.get(), sizeof(TCHAR) * (substCommand.size() + 1));
-    _tcscpy_s(mutableCommandLine.get(), substCommand.size() + 1, substCommand.c_str());
-
-    if (!CreateProcess(nullptr, mutableCommandLine.get(), nullptr, nullptr, false, NORMAL_PRIORITY_CLASS, nullptr, nullptr, &si, &pi))
+    if (!isSubstDrive)
     {
-        // Release the mutex
         return 1;
     }
 
-    printVerbose(L"{}", L"Start waiting for process Map/Unmap to complete.");
-    WaitForSingleObject(pi.hProcess, INFINITE);
-    printVerbose(L"{}", L"Done waiting for process Map/Unmap to complete.");
+    const TCHAR drive[3] = { pSubstNode->szDriveLetter, L':', L'\0' };
+    return DefineDosDevice(DDD_REMOVE_DEFINITION, drive, nullptr) ? 0 : 1;
+}
 
-    DWORD exitCode = 0;
-    if (!GetExitCodeProcess(pi.hProcess, &exitCode))
+// Substitutes the drive of the given node for its source directory, like 'subst' does: a drive that is already defined is not
+// redefined. Whether this worked is checked by the caller with GetMappedPath.
+static int MapDrive(PSUBST_NODE pSubstNode)
+{
+    const TCHAR drive[3] = { pSubstNode->szDriveLetter, L':', L'\0' };
+    auto target = std::vector<TCHAR>(MAX_PATH, 0);
+    if (QueryDosDevice(drive, target.data(), MAX_PATH) != 0 || GetLastError() != ERROR_FILE_NOT_FOUND)
     {
-        CloseHandle(pi.hProcess);
-        CloseHandle(pi.hThread);
-        return 1;
+        return 0;
     }
 
-    CloseHandle(pi.hProcess);
-    CloseHandle(pi.hThread);
-
-    if (exitCode != 0)
+    // Skip the trailing '\\', unless the source is the root of a drive.
+    std::wstring source(pSubstNode->szSourceDirectory);
+    if (source.size() > MIN_SUBST_LENGTH)
     {
-        // Release the mutex
-        return 1;
+        source.pop_back();
     }
 
-    return 0;
-}
-#pragma warning( pop )
-
-#pragma warning( push )
-// warning C26461: The pointer argument 'pSubstNode' for function 'UnmapDrive' can be marked as a pointer to const (con.3).
-#pragma warning( disable : 26461 )
-static int UnmapDrive(PSUBST_NODE pSubstNode)
-{
-    int ret = 0;
-
-    std::wstring substCommand(L"subst /D \"");
-    substCommand.push_back(pSubstNode->szDriveLetter);
-    substCommand.push_back(L':');
-    substCommand.append(L"\"");
-
-    ret = MapUnmapSubstExecute(substCommand.c_str());
-
-    return ret;
-}
-
-static int MapDrive(PSUBST_NODE pSubstNode)
-{
-    int ret = 0;
-
-    std::wstring substCommand(L"subst \"");
-    substCommand.push_back(pSubstNode->szDriveLetter);
-    substCommand.push_back(L':');
-    substCommand.append(L"\" \"");
-    substCommand.append(pSubstNode->szSourceDirectory, wcslen(pSubstNode->szSourceDirectory) - 1); // Skip the trailing '\\'.
-    substCommand.append(L"\"");
-
-    ret = MapUnmapSubstExecute(substCommand);
+    DefineDosDevice(0, drive, source.c_str());
 
     return 0;
 }
@@ -852,7 +667,7 @@ static int SubstDrivesAndExecute(int argc, _TCHAR* argv[], PSUBST_LIST_NODE pSub
 
             MapDrive(pListNode);
 
-            GetMappedPaths(pOrderedSubstList);
+            GetMappedPath(pListNode);
 
             if (pListNode->szSourceDirectory != nullptr &&
                 pListNode->szMappedPath != nullptr &&
@@ -74,6 +74,18 @@ namespace BuildXL.ProcessPipExecutor
             return resolvedExpandedPath.Path.Combine(m_context.PathTable, filename);
         }
 
+        /// <summary>
+        /// Whether an earlier resolution found that neither the given directory nor any of its ancestors is a reparse point
+        /// </summary>
+        /// <remarks>
+        /// Only looks at the paths resolved so far: the file system is never queried.
+        /// </remarks>
+        public bool IsKnownWithoutReparsePoints(AbsolutePath directory)
+        {
+            var cachedResult = m_resolvedPathCache.TryGet(directory);
+            return cachedResult.IsFound && cachedResult.Item.Value == directory;
+        }
+
         private bool TryResolvePath(string path, out ExpandedAbsolutePath expandedFinalPath)
         {
             if (!FileUtilities.TryGetFinalPathNameByPath(path, out string finalPathAsString, out _, volumeGuidPath: false))
@@ -2533,6 +2533,13 @@ namespace BuildXL.ProcessPipExecutor
                                 AllowCreateDirectoryForDirectoriesOnPath(directory.Path, processedPaths, false);
                             }
 
+                            // The content of a full seal is known and immutable: probes for anything else under it can be answered from the manifest
+                            if (m_sandboxConfig.AnswerProbesUnderFullSealsFromManifest && kind == SealDirectoryKind.Full && (mask & FileAccessPolicy.AllowWrite) == 0)
+                            {
+                                values |= FileAccessPolicy.ConeIsFullyListed;
+                                AddFullSealContentToManifest(directory);
+                            }
+
                             m_fileAccessManifest.AddScope(directory, mask: mask, values: values);
                             m_remoteSbDataBuilder?.AddDirectoryDependency(directory.Path);
                         }
@@ -2551,6 +2558,11 @@ namespace BuildXL.ProcessPipExecutor
                     AddUnixSpecificSandboxedProcessFileAccessPolicies();
                 }
 
+                if (m_reparsePointResolver != null && EnableFullReparsePointResolving(m_configuration, pip))
+                {
+                    AddKnownPathsWithoutReparsePointsToManifest(pip);
+                }
+
                 m_fileAccessManifest.MonitorChildProcesses = !pip.HasUntrackedChildProcesses;
 
                 if (!string.IsNullOrEmpty(m_detoursFailuresFile))
@@ -2693,6 +2705,43 @@ namespace BuildXL.ProcessPipExecutor
             }
         }
 
+        /// <summary>
+        /// Tells the sandbox which directories of the dependencies of the pip earlier pips found free of reparse points
+        /// (see <see cref="ReparsePointResolver"/>), so it doesn't need to probe them again when resolving paths.
+        /// </summary>
+        private void AddKnownPathsWithoutReparsePointsToManifest(Process pip)
+        {
+            using var directoriesWrapper = Pools.GetAbsolutePathSet();
+            var directories = directoriesWrapper.Instance;
+
+            foreach (FileArtifact dependency in pip.Dependencies)
+            {
+                directories.Add(dependency.Path.GetParent(m_pathTable));
+            }
+
+            foreach (DirectoryArtifact directory in pip.DirectoryDependencies)
+            {
+                directories.Add(directory.Path);
+            }
+
+            foreach (AbsolutePath directory in directories)
+            {
+                if (directory.IsValid && m_reparsePointResolver.IsKnownWithoutReparsePoints(directory))
+                {
+                    m_fileAccessManifest.AddPathWithoutReparsePoints(directory);
+                }
+            }
+        }
+
+        private void AddFullSealContentToManifest(DirectoryArtifact directory)
+        {
+            // The members keep the policy of the sealed directory: they only need to be in the manifest for the sandbox to know they exist
+            foreach (var fileArtifact in m_directoryArtifactContext.ListSealDirectoryContents(directory, out _))
+            {
+                m_fileAccessManifest.AddPath(fileArtifact.Path, mask: FileAccessPolicy.MaskNothing, values: FileAccessPolicy.Deny);
+            }
+        }
+
         private void AddDynamicInputFileAndAncestorsToManifest(FileArtifact file, HashSet<AbsolutePath> allInputPathsUnderSharedOpaques, AbsolutePath sharedOpaqueRoot)
         {
             // Allow reads, but fake times, since this is an input to the pip
@@ -35,6 +35,7 @@ namespace BuildXL.Processes
         [MaybeNull] 
         private readonly SafeFileHandle m_detoursReportHandle;
         private readonly UnicodeEncoding m_encoding;
+        private readonly bool m_useBinaryReports;
 
         /// <nodoc/>
         public static AugmentedManifestReporter Instance = new AugmentedManifestReporter();
@@ -58,6 +59,9 @@ namespace BuildXL.Processes
             Contract.Assert(success);
 
             m_detoursReportHandle = new SafeFileHandle(new IntPtr(handlePtr), ownsHandle: false);
+
+            // CODESYNC: Keep variable name in sync with DetoursServices on the C++ side
+            m_useBinaryReports = Environment.GetEnvironmentVariable("BUILDXL_AUGMENTED_MANIFEST_BINARY_REPORTS") == "1";
         }
 
         /// <summary>
@@ -222,7 +226,14 @@ namespace BuildXL.Processes
                 enumeratePattern,
                 processArgs);
 
-            if (!FileUtilities.TryWriteFileSync(m_detoursReportHandle, m_encoding.GetBytes(access), out int nativeErrorCode))
+            byte[] report = m_encoding.GetBytes(access);
+            if (m_useBinaryReports)
+            {
+                // Detours sends binary reports, so BuildXL expects every report on the pipe to be framed
+                report = BinaryFileAccessReport.CreateTextLineFrame(report);
+            }
+
+            if (!FileUtilities.TryWriteFileSync(m_detoursReportHandle, report, out int nativeErrorCode))
             {
                 // Something didn't go as expected. We cannot let the process continue if we failed at reporting an access
                 throw new NativeWin32Exception(nativeErrorCode, $"Writing augmented file access report failed. Line: {access}");
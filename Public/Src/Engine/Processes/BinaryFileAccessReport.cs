@@ -0,0 +1,231 @@
+﻿// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+using System;
+using System.Text;
+using BuildXL.Native.IO;
+using BuildXL.Utilities.Core;
+using static BuildXL.Utilities.Core.FormattableStringEx;
+
+#nullable enable
+
+namespace BuildXL.Processes
+{
+    /// <summary>
+    /// Low-level parser for the frames Detours sends when <see cref="FileAccessManifest.EnableDetoursBinaryReports"/> is set
+    /// </summary>
+    /// <remarks>
+    /// CODESYNC: Public/Src/Sandbox/Windows/DetoursServices/BinaryReports.h
+    /// Every frame starts with a 32-bit length counting the bytes that follow it, then a 32-bit <see cref="FrameKind"/> and the payload.
+    /// </remarks>
+    internal static class BinaryFileAccessReport
+    {
+        /// <summary>
+        /// Kinds of frames
+        /// </summary>
+        public enum FrameKind : uint
+        {
+            /// <summary>
+            /// A regular UTF-16 report line, including its line terminator
+            /// </summary>
+            TextLine = 1,
+
+            /// <summary>
+            /// A file access record, parsed by <see cref="TryParse"/>
+            /// </summary>
+            FileAccess = 2,
+        }
+
+        /// <summary>
+        /// Size of the length prefix of a frame
+        /// </summary>
+        public const int LengthPrefixSize = sizeof(uint);
+
+        /// <summary>
+        /// Size of the frame header: the length prefix and the kind
+        /// </summary>
+        public const int FrameHeaderSize = LengthPrefixSize + sizeof(uint);
+
+        // Offsets in the fixed-size record that follows the frame header (BinaryFileAccessReport in BinaryReports.h)
+        private const int UsnOffset = 0;
+        private const int ProcessIdOffset = 8;
+        private const int IdOffset = 12;
+        private const int CorrelationIdOffset = 16;
+        private const int RequestedAccessOffset = 20;
+        private const int StatusOffset = 24;
+        private const int ExplicitlyReportedOffset = 28;
+        private const int ErrorOffset = 32;
+        private const int DesiredAccessOffset = 36;
+        private const int ShareModeOffset = 40;
+        private const int CreationDispositionOffset = 44;
+        private const int FlagsAndAttributesOffset = 48;
+        private const int OpenedFileOrDirectoryAttributesOffset = 52;
+        private const int PathIdOffset = 56;
+        private const int OperationLengthOffset = 60;
+        private const int PathLengthOffset = 64;
+        private const int FilterLengthOffset = 68;
+        private const int ProcessArgsLengthOffset = 72;
+
+        /// <summary>
+        /// Size of the fixed-size part of a file access record
+        /// </summary>
+        public const int RecordSize = 76;
+
+        /// <summary>
+        /// Gets the kind of a complete frame (length prefix included)
+        /// </summary>
+        public static FrameKind GetFrameKind(ArraySegment<byte> frame) => (FrameKind)BitConverter.ToUInt32(frame.Array!, frame.Offset + LengthPrefixSize);
+
+        /// <summary>
+        /// Gets the report line carried by a complete <see cref="FrameKind.TextLine"/> frame, without its line terminator
+        /// </summary>
+        public static string GetTextLine(ArraySegment<byte> frame)
+        {
+            var line = Encoding.Unicode.GetString(frame.Array!, frame.Offset + FrameHeaderSize, frame.Count - FrameHeaderSize);
+            return line.TrimEnd('\r', '\n');
+        }
+
+        /// <summary>
+        /// Wraps a UTF-16 report line (including its line terminator) in a <see cref="FrameKind.TextLine"/> frame
+        /// </summary>
+        public static byte[] CreateTextLineFrame(byte[] line)
+        {
+            var frame = new byte[FrameHeaderSize + line.Length];
+            writeUInt32(frame, 0, (uint)(frame.Length - LengthPrefixSize));
+            writeUInt32(frame, LengthPrefixSize, (uint)FrameKind.TextLine);
+            Buffer.BlockCopy(line, 0, frame, FrameHeaderSize, line.Length);
+            return frame;
+
+            static void writeUInt32(byte[] buffer, int offset, uint value)
+            {
+                buffer[offset] = (byte)value;
+                buffer[offset + 1] = (byte)(value >> 8);
+                buffer[offset + 2] = (byte)(value >> 16);
+                buffer[offset + 3] = (byte)(value >> 24);
+            }
+        }
+
+        /// <summary>
+        /// Parses a complete <see cref="FrameKind.FileAccess"/> frame (length prefix included)
+        /// </summary>
+        /// <remarks>
+        /// Paths in binary reports are not escaped, unlike the ones in report lines.
+        /// </remarks>
+        public static bool TryParse(
+            ref ArraySegment<byte> frame,
+            out uint processId,
+            out uint id,
+            out uint correlationId,
+            out ReportedFileOperation operation,
+            out RequestedAccess requestedAccess,
+            out FileAccessStatus status,
+            out bool explicitlyReported,
+            out uint error,
+            out Usn usn,
+            out DesiredAccess desiredAccess,
+            out ShareMode shareMode,
+            out CreationDisposition creationDisposition,
+            out FlagsAndAttributes flagsAndAttributes,
+            out FlagsAndAttributes openedFileOrDirectoryAttributes,
+            out AbsolutePath absolutePath,
+            out string? path,
+            out string? enumeratePattern,
+            out string? processArgs,
+            out string? errorMessage)
+        {
+            operation = ReportedFileOperation.Unknown;
+            requestedAccess = RequestedAccess.None;
+            status = FileAccessStatus.None;
+            processId = error = 0;
+            id = correlationId = 0;
+            usn = default;
+            explicitlyReported = false;
+            desiredAccess = 0;
+            shareMode = ShareMode.FILE_SHARE_NONE;
+            creationDisposition = 0;
+            flagsAndAttributes = 0;
+            openedFileOrDirectoryAttributes = 0;
+            absolutePath = AbsolutePath.Invalid;
+            path = null;
+            enumeratePattern = null;
+            processArgs = null;
+            errorMessage = string.Empty;
+
+            byte[] bytes = frame.Array!;
+            int record = frame.Offset + FrameHeaderSize;
+            if (frame.Count < FrameHeaderSize + RecordSize)
+            {
+                errorMessage = I($"Unexpected binary file access report size. Expected at least {FrameHeaderSize + RecordSize} bytes, received {frame.Count} bytes.");
+                return false;
+            }
+
+            long operationLength = BitConverter.ToUInt32(bytes, record + OperationLengthOffset);
+            long pathLength = BitConverter.ToUInt32(bytes, record + PathLengthOffset);
+            long filterLength = BitConverter.ToUInt32(bytes, record + FilterLengthOffset);
+            long processArgsLength = BitConverter.ToUInt32(bytes, record + ProcessArgsLengthOffset);
+            long expectedSize = FrameHeaderSize + RecordSize + sizeof(char) * (operationLength + pathLength + filterLength + processArgsLength);
+            if (frame.Count != expectedSize)
+            {
+                errorMessage = I($"Unexpected binary file access report size (potentially due to pipe corruption). Expected {expectedSize} bytes, received {frame.Count} bytes.");
+                return false;
+            }
+
+            uint statusValue = BitConverter.ToUInt32(bytes, record + StatusOffset);
+            if (statusValue > (uint)FileAccessStatus.CannotDeterminePolicy)
+            {
+                errorMessage = I($"Unknown file access status '{statusValue}'");
+                return false;
+            }
+
+            uint requestedAccessValue = BitConverter.ToUInt32(bytes, record + RequestedAccessOffset);
+            if (requestedAccessValue > (uint)RequestedAccess.All)
+            {
+                errorMessage = I($"Unknown requested access '{requestedAccessValue}'");
+                return false;
+            }
+
+            usn = new Usn(BitConverter.ToUInt64(bytes, record + UsnOffset));
+            processId = BitConverter.ToUInt32(bytes, record + ProcessIdOffset);
+            id = BitConverter.ToUInt32(bytes, record + IdOffset);
+            correlationId = BitConverter.ToUInt32(bytes, record + CorrelationIdOffset);
+            requestedAccess = (RequestedAccess)requestedAccessValue;
+            status = (FileAccessStatus)statusValue;
+            explicitlyReported = BitConverter.ToUInt32(bytes, record + ExplicitlyReportedOffset) != 0;
+            error = BitConverter.ToUInt32(bytes, record + ErrorOffset);
+            desiredAccess = (DesiredAccess)BitConverter.ToUInt32(bytes, record + DesiredAccessOffset);
+            shareMode = (ShareMode)BitConverter.ToUInt32(bytes, record + ShareModeOffset);
+            creationDisposition = (CreationDisposition)BitConverter.ToUInt32(bytes, record + CreationDispositionOffset);
+            flagsAndAttributes = (FlagsAndAttributes)BitConverter.ToUInt32(bytes, record + FlagsAndAttributesOffset);
+            openedFileOrDirectoryAttributes = (FlagsAndAttributes)BitConverter.ToUInt32(bytes, record + OpenedFileOrDirectoryAttributesOffset);
+            absolutePath = new AbsolutePath(unchecked((int)BitConverter.ToUInt32(bytes, record + PathIdOffset)));
+
+            int offset = record + RecordSize;
+            string operationName = readString(bytes, ref offset, operationLength);
+            if (!FileAccessReportLine.TryGetOperation(operationName, out operation))
+            {
+                // Same as for report lines: don't throw the report out just because this parser wasn't updated after adding a new call
+                operation = ReportedFileOperation.Unknown;
+            }
+
+            path = readString(bytes, ref offset, pathLength);
+            enumeratePattern = readString(bytes, ref offset, filterLength);
+            processArgs = readString(bytes, ref offset, processArgsLength);
+
+            if (requestedAccess != RequestedAccess.Enumerate)
+            {
+                // If the requested access is not enumeration, enumeratePattern does not matter.
+                enumeratePattern = null;
+            }
+
+            return true;
+
+            static string readString(byte[] buffer, ref int offset, long length)
+            {
+                int size = (int)length * sizeof(char);
+                string result = size == 0 ? string.Empty : Encoding.Unicode.GetString(buffer, offset, size);
+                offset += size;
+                return result;
+            }
+        }
+    }
+}
@@ -51,6 +51,11 @@ namespace BuildXL.Processes
         /// </summary>
         private byte[]? m_sealedManifestTreeBlock;
 
+        /// <summary>
+        /// Reparse points known to the build, and paths known to be free of them, with which the sandbox seeds its path resolution caches.
+        /// </summary>
+        private List<(AbsolutePath Path, KnownReparsePointKind Kind, string? Target)>? m_knownReparsePoints;
+
         /// <summary>
         /// Creates an empty instance.
         /// </summary>
@@ -102,6 +107,25 @@ namespace BuildXL.Processes
             AlwaysRemoteInjectDetoursFrom32BitProcess = false;
             UnconditionallyEnableLinuxPTraceSandbox = false;
             IgnoreDeviceIoControlGetReparsePoint = true; // TODO: Change this when customers onboard the feature.
+            EnableLinuxSandboxReportBatching = false;
+            EnableLinuxSandboxSharedAccessCache = false;
+            EnableLinuxSandboxSeccompUserNotifications = false;
+            EnableLinuxSandboxAsyncReporting = false;
+            EnableDetoursReportBatching = false;
+            EnableDetoursBinaryReports = false;
+            EnableDetoursSharedReparsePointCache = false;
+            EnableDetoursSharedManifestSection = false;
+            EnableDetoursPerformanceCounters = false;
+            EnableDetoursAsyncReporting = false;
+            RaiseSandboxHelperThreadPriority = false;
+            EnableDetoursExpectedUsnCache = false;
+            EnableLinuxSandboxSharedMemoryReports = false;
+            EnableDetoursBasicEnumerationInfo = false;
+            EnableDetoursPipelinedRemoteInjection = false;
+            EnableDetoursFileIdPathCache = false;
+            EnableDetoursSharedPluginDecisionCache = false;
+            EnableDetoursVolumeMountPointCache = false;
+            EnableDetoursSystemCallerFilter = false;
         }
 
         private bool GetFlag(FileAccessManifestFlag flag) => (m_fileAccessManifestFlag & flag) != 0;
@@ -376,6 +400,9 @@ namespace BuildXL.Processes
         /// <summary>
         /// Whether BuildXL will use larger NtClose preallocated list.
         /// </summary>
+        /// <remarks>
+        /// Obsolete: the handle overlay map of Detours is lock-free, so NtClose doesn't defer removals to a preallocated list anymore.
+        /// </remarks>
         public bool UseLargeNtClosePreallocatedList
         {
             get => GetFlag(FileAccessManifestFlag.UseLargeNtClosePreallocatedList);
@@ -385,6 +412,9 @@ namespace BuildXL.Processes
         /// <summary>
         /// Whether BuildXL will use extra thread to drain NtClose handle List or clean the cache directly.
         /// </summary>
+        /// <remarks>
+        /// Obsolete: the handle overlay map of Detours is lock-free, so NtClose always removes the overlay directly.
+        /// </remarks>
         public bool UseExtraThreadToDrainNtClose
         {
             get => GetFlag(FileAccessManifestFlag.UseExtraThreadToDrainNtClose);
@@ -536,6 +566,262 @@ namespace BuildXL.Processes
             set => SetExtraFlag(FileAccessManifestExtraFlag.IgnoreDeviceIoControlGetReparsePoint, value);
         }
 
+        /// <summary>
+        /// When enabled, the Linux sandbox coalesces access reports into batches of length-prefixed frames that are written to the reports FIFO
+        /// with a single write, instead of issuing one write per report. Reports are not limited to PIPE_BUF in this mode.
+        /// </summary>
+        /// <remarks>
+        /// Batches are flushed when full and on fork, exec and exit. Reports still pending in a batch are lost if a process is killed by a signal.
+        /// </remarks>
+        public bool EnableLinuxSandboxReportBatching
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.EnableLinuxSandboxReportBatching);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.EnableLinuxSandboxReportBatching, value);
+        }
+
+        /// <summary>
+        /// When enabled, all the processes of a pip running under the Linux sandbox share a single table to avoid
+        /// reporting the same access more than once, instead of each process keeping its own.
+        /// </summary>
+        /// <remarks>
+        /// Accesses are deduplicated per executable, so policies that depend on the process (e.g. allowlists) still see one report per executable.
+        /// </remarks>
+        public bool EnableLinuxSandboxSharedAccessCache
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.EnableLinuxSandboxSharedAccessCache);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.EnableLinuxSandboxSharedAccessCache, value);
+        }
+
+        /// <summary>
+        /// When enabled, the Linux sandbox supervises statically linked processes with seccomp user notifications instead of ptrace stops.
+        /// </summary>
+        /// <remarks>
+        /// This requires Linux 5.6 or later, and is ignored (ptrace is used) when the kernel doesn't support it or Yama restricts ptrace.
+        /// </remarks>
+        public bool EnableLinuxSandboxSeccompUserNotifications
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.EnableLinuxSandboxSeccompUserNotifications);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.EnableLinuxSandboxSeccompUserNotifications, value);
+        }
+
+        /// <summary>
+        /// When enabled, interposed calls under the Linux sandbox only stage a binary record of each access, and a helper thread started in every
+        /// process formats the records and writes them to the reports FIFO. Implies <see cref="EnableLinuxSandboxReportBatching"/>.
+        /// </summary>
+        /// <remarks>
+        /// Staged records are written out before fork, exec and exit, so the ordering guarantees of report batching still hold.
+        /// The helper thread makes every process multithreaded, which some system calls (e.g. unshare with CLONE_NEWUSER) don't allow.
+        /// </remarks>
+        public bool EnableLinuxSandboxAsyncReporting
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.EnableLinuxSandboxAsyncReporting);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.EnableLinuxSandboxAsyncReporting, value);
+        }
+
+        /// <summary>
+        /// When enabled, Detours buffers the reports of each thread and writes them to the report pipe in batches, rather than with one write per report.
+        /// </summary>
+        /// <remarks>
+        /// Buffers are written out when they fill up, when their thread exits, before a child process is created, when the process exits, and periodically.
+        /// Reports still buffered by a process terminated abruptly (e.g. with TerminateProcess) are lost.
+        /// </remarks>
+        public bool EnableDetoursReportBatching
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.EnableDetoursReportBatching);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.EnableDetoursReportBatching, value);
+        }
+
+        /// <summary>
+        /// When enabled, Detours sends every report as a length-prefixed frame, and file accesses as binary records rather than formatted report lines.
+        /// </summary>
+        /// <remarks>
+        /// This saves formatting and escaping in the sandboxed processes, parsing in BuildXL, and about half of the bytes sent over the report pipe.
+        /// The length prefix is the same framing the Linux sandbox uses on its reports FIFO. Reports are always read with the IO completion based pipe reader in this mode.
+        /// </remarks>
+        public bool EnableDetoursBinaryReports
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.EnableDetoursBinaryReports);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.EnableDetoursBinaryReports, value);
+        }
+
+        /// <summary>
+        /// When enabled, the detoured processes of a process tree share the results of reparse point resolution (whether a path is a reparse point,
+        /// and the target of a reparse point) through a shared memory cache created by the root process.
+        /// </summary>
+        /// <remarks>
+        /// Without it, every process of a pip rediscovers the same reparse points. Has no effect when reparse points are ignored.
+        /// </remarks>
+        public bool EnableDetoursSharedReparsePointCache
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.EnableDetoursSharedReparsePointCache);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.EnableDetoursSharedReparsePointCache, value);
+        }
+
+        /// <summary>
+        /// When enabled, detoured processes place the manifest once in a read-only section that their child processes map directly,
+        /// instead of copying the whole manifest into every child process.
+        /// </summary>
+        /// <remarks>
+        /// Child processes use the manifest in place from the section. Worth enabling for pips with large manifests that start many processes.
+        /// </remarks>
+        public bool EnableDetoursSharedManifestSection
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.EnableDetoursSharedManifestSection);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.EnableDetoursSharedManifestSection, value);
+        }
+
+        /// <summary>
+        /// When enabled, detoured processes count the calls to each detoured function, the time stamp counter cycles spent searching policies,
+        /// canonicalizing paths, resolving reparse points and sending reports, and the sizes of the reports they send.
+        /// </summary>
+        /// <remarks>
+        /// The counters are sent once, with the process data of a process when it exits, so <see cref="LogProcessData"/> needs to be enabled as well.
+        /// </remarks>
+        public bool EnableDetoursPerformanceCounters
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.EnableDetoursPerformanceCounters);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.EnableDetoursPerformanceCounters, value);
+        }
+
+        /// <summary>
+        /// When enabled, a dedicated thread of each detoured process writes its reports to the report pipe, so the threads sending reports
+        /// don't block when BuildXL falls behind reading them.
+        /// </summary>
+        /// <remarks>
+        /// Queued reports are written out before a child process is created, when the process exits, and before Detours exits on an error.
+        /// Reports still queued by a process terminated abruptly (e.g. with TerminateProcess) are lost. Combines with <see cref="EnableDetoursReportBatching"/>.
+        /// </remarks>
+        public bool EnableDetoursAsyncReporting
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.EnableDetoursAsyncReporting);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.EnableDetoursAsyncReporting, value);
+        }
+
+        /// <summary>
+        /// When enabled, the threads the sandbox adds to a process to write its reports run at a higher priority than the threads of the process,
+        /// so they keep up with them when all the cores are busy.
+        /// </summary>
+        /// <remarks>
+        /// Applies to the report writer thread of <see cref="EnableDetoursAsyncReporting"/> and to the report flusher thread of
+        /// <see cref="EnableLinuxSandboxAsyncReporting"/>. On Linux, raising the priority of a thread needs CAP_SYS_NICE (or a suitable RLIMIT_NICE):
+        /// without it the flusher keeps the priority of the process.
+        /// </remarks>
+        public bool RaiseSandboxHelperThreadPriority
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.RaiseSandboxHelperThreadPriority);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.RaiseSandboxHelperThreadPriority, value);
+        }
+
+        /// <summary>
+        /// When enabled, Detours remembers the files whose USN it already checked against the USN expected by the manifest, so opening them
+        /// again in the same process doesn't query their USN again.
+        /// </summary>
+        /// <remarks>
+        /// The remembered files are forgotten whenever the process deletes, renames or links a file, or opens a file for write. Changes made
+        /// by other processes, or through handles opened for write earlier, may go unnoticed until then: only enable this for pips whose
+        /// inputs are not modified while they run.
+        /// </remarks>
+        public bool EnableDetoursExpectedUsnCache
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.EnableDetoursExpectedUsnCache);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.EnableDetoursExpectedUsnCache, value);
+        }
+
+        /// <summary>
+        /// When enabled, the processes of a pip running under the Linux sandbox write their reports to a ring in a file mapped by all of them
+        /// and by BuildXL, instead of writing them to the reports FIFO, which then only serves to wake up BuildXL when it is waiting for reports.
+        /// </summary>
+        /// <remarks>
+        /// A process goes back to the FIFO for good when the ring stays full or a report doesn't fit in it.
+        /// </remarks>
+        public bool EnableLinuxSandboxSharedMemoryReports
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.EnableLinuxSandboxSharedMemoryReports);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.EnableLinuxSandboxSharedMemoryReports, value);
+        }
+
+        /// <summary>
+        /// When enabled, Detours turns the wildcard searches of FindFirstFileEx that ask for FindExInfoStandard into FindExInfoBasic ones
+        /// that fetch their entries with large buffers, so the file system neither looks up short names nor gets called once per few entries.
+        /// </summary>
+        /// <remarks>
+        /// Short names are scrubbed from the entries of the enumerations Detours tracks anyway, so what the process sees doesn't change.
+        /// </remarks>
+        public bool EnableDetoursBasicEnumerationInfo
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.EnableDetoursBasicEnumerationInfo);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.EnableDetoursBasicEnumerationInfo, value);
+        }
+
+        /// <summary>
+        /// When enabled, a 32-bit process that asks the top of its process tree to inject a child it can't inject itself sends a request
+        /// carrying an id and gets its completion back through a reply pipe of its own, instead of creating two named events for the request.
+        /// </summary>
+        /// <remarks>
+        /// The requests of several threads of a process can be in flight at once, and the top of the tree goes on reading requests while it injects.
+        /// </remarks>
+        public bool EnableDetoursPipelinedRemoteInjection
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.EnableDetoursPipelinedRemoteInjection);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.EnableDetoursPipelinedRemoteInjection, value);
+        }
+
+        /// <summary>
+        /// When enabled, Detours remembers the path of every file a process opens by id (e.g., through OpenFileById), so opening it by id again
+        /// doesn't need to open the file and query its final path before looking up the policy.
+        /// </summary>
+        /// <remarks>
+        /// Deletions, renames and links made by the process forget all the paths remembered so far. Those made by other processes go unnoticed:
+        /// only enable this for pips whose inputs are not moved around while they run.
+        /// </remarks>
+        public bool EnableDetoursFileIdPathCache
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.EnableDetoursFileIdPathCache);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.EnableDetoursFileIdPathCache, value);
+        }
+
+        /// <summary>
+        /// When enabled, the decisions of the substitute process execution plugin are shared by all the detoured processes of a pip,
+        /// so a child process doesn't call the plugin (nor load it) for a command an ancestor already decided on.
+        /// </summary>
+        /// <remarks>
+        /// Like the decisions memoized by a single process, shared decisions assume that the plugin decides based on its inputs only:
+        /// the command, the arguments, the working directory and the environment.
+        /// </remarks>
+        public bool EnableDetoursSharedPluginDecisionCache
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.EnableDetoursSharedPluginDecisionCache);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.EnableDetoursSharedPluginDecisionCache, value);
+        }
+
+        /// <summary>
+        /// When enabled, Detours answers GetVolumePathNameW from a table of the mount points of the volumes (drive letters and mounted folders),
+        /// instead of letting it query the mount manager for every parent of the path.
+        /// </summary>
+        /// <remarks>
+        /// The table is built again when the mount manager signals a change. When that notification can't be requested, the table is not used.
+        /// </remarks>
+        public bool EnableDetoursVolumeMountPointCache
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.EnableDetoursVolumeMountPointCache);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.EnableDetoursVolumeMountPointCache, value);
+        }
+
+        /// <summary>
+        /// When enabled, Detours doesn't evaluate the policy of the files that some system modules open internally (e.g., the console driver
+        /// opened by kernelbase, the key stores read by the crypto providers, the files read by COM and the shell to initialize).
+        /// The caller is recognized by the return address of the detoured call.
+        /// </summary>
+        /// <remarks>
+        /// Only read-only opens of existing files are filtered, and only for the APIs a module is trusted with. The accesses that are filtered
+        /// are not reported, so only enable this for pips whose outputs don't depend on the files these modules read.
+        /// </remarks>
+        public bool EnableDetoursSystemCallerFilter
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.EnableDetoursSystemCallerFilter);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.EnableDetoursSystemCallerFilter, value);
+        }
+
         /// <summary>
         /// A location for a file where Detours to log failure messages.
         /// </summary>
@@ -546,6 +832,14 @@ namespace BuildXL.Processes
         /// </summary>
         public INamedSemaphore? MessageCountSemaphore { get; private set; }
 
+        /// <summary>
+        /// The shared-memory counter of the sent messages, which the sandbox increments instead of the semaphore when it can map it.
+        /// </summary>
+        /// <remarks>
+        /// Optional: when it can't be created, the sandbox counts messages on <see cref="MessageCountSemaphore"/> only.
+        /// </remarks>
+        public SharedMessageCounter? MessageCounter { get; private set; }
+
         /// <summary>
         /// Directory translator.
         /// </summary>
@@ -581,11 +875,44 @@ namespace BuildXL.Processes
             {
                 MessageCountSemaphore = maybeSemaphore.Result;
                 m_messageCountSemaphoreName = semaphoreName;
+
+                var maybeCounter = SharedMessageCounter.CreateNew(semaphoreName);
+                MessageCounter = maybeCounter.Succeeded ? maybeCounter.Result : null;
             }
 
             return maybeSemaphore.Succeeded;
         }
 
+        /// <summary>
+        /// Counts a message received from the sandbox that the sandbox counted as sent.
+        /// </summary>
+        public void CountReceivedMessage()
+        {
+            if (MessageCounter != null)
+            {
+                MessageCounter.CountReceived();
+            }
+            else
+            {
+                MessageCountSemaphore?.WaitOne(0);
+            }
+        }
+
+        /// <summary>
+        /// Number of messages sent by the sandbox that were not received, as counted by <see cref="CountReceivedMessage"/>.
+        /// </summary>
+        /// <remarks>
+        /// Must only be called once all the sandboxed processes are done. With a shared counter, the semaphore only counts
+        /// the messages of the processes that could not map it, which are never waited for.
+        /// </remarks>
+        public int GetLastMessageCount()
+        {
+            int semaphoreCount = MessageCountSemaphore?.Release() ?? 0;
+            return MessageCounter == null
+                ? semaphoreCount
+                : (int)(semaphoreCount + MessageCounter.Sent - MessageCounter.Received);
+        }
+
         /// <summary>
         /// Unset message count semaphore.
         /// </summary>
@@ -599,6 +926,8 @@ namespace BuildXL.Processes
 
             MessageCountSemaphore?.Dispose();
             MessageCountSemaphore = null;
+            MessageCounter?.Dispose();
+            MessageCounter = null;
             m_messageCountSemaphoreName = null;
         }
 
@@ -642,6 +971,33 @@ namespace BuildXL.Processes
             m_rootNode.AddNodeWithScope(this, path, new FileAccessScope(mask, values), expectedUsn ?? ReportedFileAccess.NoUsn);
         }
 
+        /// <summary>
+        /// Tells the sandbox that neither a path nor any of its ancestors is a reparse point, so it doesn't need to check them when resolving paths
+        /// </summary>
+        public void AddPathWithoutReparsePoints(AbsolutePath path)
+        {
+            Contract.Requires(path.IsValid);
+
+            m_knownReparsePoints ??= new();
+            m_knownReparsePoints.Add((path, KnownReparsePointKind.None, null));
+        }
+
+        /// <summary>
+        /// Tells the sandbox the target of a reparse point known to the build, so it doesn't need to read it when resolving paths
+        /// </summary>
+        /// <remarks>
+        /// The target is the one reported by the file system (for Windows reparse points, their print name), relative or not.
+        /// </remarks>
+        public void AddKnownReparsePoint(AbsolutePath path, ReparsePointType type, string target)
+        {
+            Contract.Requires(path.IsValid);
+            Contract.Requires(type == ReparsePointType.FileSymlink || type == ReparsePointType.DirectorySymlink || type == ReparsePointType.UnixSymlink || type == ReparsePointType.Junction);
+            Contract.RequiresNotNullOrEmpty(target);
+
+            m_knownReparsePoints ??= new();
+            m_knownReparsePoints.Add((path, type == ReparsePointType.Junction ? KnownReparsePointKind.Junction : KnownReparsePointKind.Symlink, target));
+        }
+
         /// <summary> 
         /// Looking up a policy for a path is not allowed before this property becomes true
         /// (which happens once the FAM is serialized)
@@ -737,6 +1093,7 @@ namespace BuildXL.Processes
             public const uint ErrorDumpLocation             = 0xABCDEF03;
             public const uint SubstituteProcessShim         = 0xABCDEF04;
             public const uint ChildProcessesBreakAwayString = 0xABCDEF05;
+            public const uint KnownReparsePoints            = 0xABCDEF06;
             public const uint Flags                         = 0xF1A6B10C;
             public const uint PipId                         = 0xF1A6B10E;
             public const uint DebugOn                       = 0xDB600001;
@@ -1056,6 +1413,26 @@ namespace BuildXL.Processes
             }
         }
 
+        // CODESYNC: DetoursHelpers.cpp :: DecodeKnownReparsePoints, FileAccessManifestParser.cpp :: init
+        private void WriteKnownReparsePointsBlock(BinaryWriter writer)
+        {
+#if DEBUG
+            writer.Write(CheckedCode.KnownReparsePoints);
+#endif
+
+            writer.Write((uint)(m_knownReparsePoints?.Count ?? 0));
+
+            if (m_knownReparsePoints is not null)
+            {
+                foreach ((AbsolutePath path, KnownReparsePointKind kind, string? target) in m_knownReparsePoints)
+                {
+                    writer.Write((uint)kind);
+                    WritePath(writer, path);
+                    WriteChars(writer, target);
+                }
+            }
+        }
+
         private void WriteManifestTreeBlock(BinaryWriter writer)
         {
             if (m_sealedManifestTreeBlock is not null)
@@ -1097,6 +1474,7 @@ namespace BuildXL.Processes
                 WriteReportBlock(writer, setup);
                 WriteDllBlock(writer, setup);
                 WriteSubstituteProcessShimBlock(writer);
+                WriteKnownReparsePointsBlock(writer);
                 WriteManifestTreeBlock(writer);
 
                 return new ArraySegment<byte>(stream.GetBuffer(), 0, (int)stream.Position);
@@ -1282,6 +1660,33 @@ namespace BuildXL.Processes
             AlwaysRemoteInjectDetoursFrom32BitProcess = 0x10,
             UnconditionallyEnableLinuxPTraceSandbox = 0x20,
             IgnoreDeviceIoControlGetReparsePoint = 0x40,
+            EnableLinuxSandboxReportBatching = 0x80,
+            EnableLinuxSandboxSharedAccessCache = 0x100,
+            EnableLinuxSandboxSeccompUserNotifications = 0x200,
+            EnableLinuxSandboxAsyncReporting = 0x400,
+            EnableDetoursReportBatching = 0x800,
+            EnableDetoursBinaryReports = 0x1000,
+            EnableDetoursSharedReparsePointCache = 0x2000,
+            EnableDetoursSharedManifestSection = 0x4000,
+            EnableDetoursPerformanceCounters = 0x8000,
+            EnableDetoursAsyncReporting = 0x10000,
+            RaiseSandboxHelperThreadPriority = 0x20000,
+            EnableDetoursExpectedUsnCache = 0x40000,
+            EnableLinuxSandboxSharedMemoryReports = 0x80000,
+            EnableDetoursBasicEnumerationInfo = 0x100000,
+            EnableDetoursPipelinedRemoteInjection = 0x200000,
+            EnableDetoursFileIdPathCache = 0x400000,
+            EnableDetoursSharedPluginDecisionCache = 0x800000,
+            EnableDetoursVolumeMountPointCache = 0x1000000,
+            EnableDetoursSystemCallerFilter = 0x2000000,
+        }
+
+        // CODESYNC: DataTypes.h
+        private enum KnownReparsePointKind : uint
+        {
+            None = 0,
+            Symlink = 1,
+            Junction = 2,
         }
 
         private readonly struct FileAccessScope
@@ -1722,6 +2127,8 @@ namespace BuildXL.Processes
             /// <nodoc/>
             public static (Node, NormalizedPathString) InternalDeserialize(BinaryReader reader)
             {
+                // Child offsets are relative to the start of the record (see InternalSerialize)
+                long start = reader.BaseStream.Position;
 #if DEBUG
                 uint foodCafe = reader.ReadUInt32(); // "food cafe"
                 Contract.Assert((uint)0xF00DCAFE == foodCafe);
@@ -1733,14 +2140,14 @@ namespace BuildXL.Processes
                 ulong expectedUsnValue = reader.ReadUInt64();
                 uint bucketCount = reader.ReadUInt32();
 
-                int childrenCount = 0;
+                var childOffsets = new List<uint>();
                 for (int i = 0; i < bucketCount; i++)
                 {
                     uint offset = reader.ReadUInt32();
                     // An offset with 0 means no child was stored there
                     if (offset != 0)
                     {
-                        childrenCount++;
+                        childOffsets.Add(offset & ~(uint)FileAccessBucketOffsetFlag.ChainMask);
                     }
                 }
 
@@ -1754,13 +2161,14 @@ namespace BuildXL.Processes
                     node.ExpectedUsn = new Usn(expectedUsnValue);
                     node.m_isPolicyFinalized = true;
 
-                    if (childrenCount > 0)
+                    if (childOffsets.Count > 0)
                     {
-                        node.m_children = new Dictionary<NormalizedPathString, Node>(childrenCount);
+                        node.m_children = new Dictionary<NormalizedPathString, Node>(childOffsets.Count);
                     }
 
-                    for (int i = 0; i < childrenCount; i++)
+                    foreach (uint childOffset in childOffsets)
                     {
+                        reader.BaseStream.Seek(start + childOffset, SeekOrigin.Begin);
                         (Node child, NormalizedPathString childNormalizedPathString) = InternalDeserialize(reader);
                         node.m_children![childNormalizedPathString] = child;
                     }
@@ -1769,7 +2177,26 @@ namespace BuildXL.Processes
                 }
             }
 
+            /// <summary>
+            /// Serializes this node and all the nodes below it.
+            /// </summary>
+            /// <remarks>
+            /// The records of the children of a node are laid out one after the other, and their own children come after all of them.
+            /// A policy search looks at the record of a child right after the buckets of its parent (and at its siblings when following
+            /// a collision chain), so keeping siblings together, rather than each after the whole subtree of the previous one, keeps the
+            /// records a lookup touches at each level close to each other in memory. Consumers only follow the offsets of the buckets,
+            /// so the layout needs no change on their side.
+            /// </remarks>
             public void InternalSerialize(NormalizedPathString normalizedFragment, BinaryWriter writer)
+            {
+                var (start, offsetsStart, bucketCount) = SerializeRecord(normalizedFragment, writer);
+                SerializeChildren(start, offsetsStart, bucketCount, writer);
+            }
+
+            /// <summary>
+            /// Writes the record of this node, with empty buckets. Returns where the record and its buckets start, and the number of buckets.
+            /// </summary>
+            private (long start, long offsetsStart, uint bucketCount) SerializeRecord(NormalizedPathString normalizedFragment, BinaryWriter writer)
             {
                 // always finalize when serializing -- note that this prevents adding additional scopes as before
                 if (!IsPolicyFinalized)
@@ -1818,8 +2245,22 @@ namespace BuildXL.Processes
                         writer.Write(0U);
                     }
 
+                    return (start, offsetsStart, bucketCount);
+                }
+            }
+
+            /// <summary>
+            /// Writes the records of the children of this node one after the other, fills in the buckets of this node (whose record is at
+            /// <paramref name="start"/>), and then writes the children of each child the same way.
+            /// </summary>
+            private void SerializeChildren(long start, long offsetsStart, uint bucketCount, BinaryWriter writer)
+            {
+                unchecked
+                {
                     if (m_children is not null)
                     {
+                        var childRecords = new List<(Node node, long start, long offsetsStart, uint bucketCount)>(m_children.Count);
+
                         // We are now building a simple hash-table with linear chaining for collisions.
                         // The lowest two bits of each record may encoding information about whether a collision chain starts at that point, or continues.
                         uint[] offsets = new uint[bucketCount];
@@ -1845,7 +2286,8 @@ namespace BuildXL.Processes
                             var offset = checked((uint)(writer.BaseStream.Position - start));
                             Contract.Assume((offset & (uint)FileAccessBucketOffsetFlag.ChainMask) == 0);
                             offsets[index] = offset;
-                            child.Value.InternalSerialize(child.Key, writer);
+                            var (childStart, childOffsetsStart, childBucketCount) = child.Value.SerializeRecord(child.Key, writer);
+                            childRecords.Add((child.Value, childStart, childOffsetsStart, childBucketCount));
                         }
 
                         long endPosition = writer.BaseStream.Position;
@@ -1856,6 +2298,11 @@ namespace BuildXL.Processes
                         }
 
                         writer.BaseStream.Seek(endPosition, SeekOrigin.Begin);
+
+                        foreach (var childRecord in childRecords)
+                        {
+                            childRecord.node.SerializeChildren(childRecord.start, childRecord.offsetsStart, childRecord.bucketCount, writer);
+                        }
                     }
                 }
             }
@@ -2058,6 +2505,7 @@ namespace BuildXL.Processes
                     Tuple.Create((short)FileAccessPolicy.OverrideAllowWriteForExistingFiles, "OverrideAllowWriteForExistingFiles"),
                     Tuple.Create((short)FileAccessPolicy.TreatDirectorySymlinkAsDirectory, "DirectorySymlinkAsDirectory"),
                     Tuple.Create((short)FileAccessPolicy.EnableFullReparsePointParsing, "EnableFullReparsePointParsing"),
+                    Tuple.Create((short)FileAccessPolicy.ConeIsFullyListed, "ConeIsFullyListed"),
                     Tuple.Create((short)FileAccessPolicy.ReportAccess, "ReportAccess"),
                     // Note that composite values must appear before their parts.
                     Tuple.Create((short)FileAccessPolicy.ReportAccessIfExistent, "ReportAccessIfExistent"),
@@ -104,6 +104,15 @@ namespace BuildXL.Processes
         /// </summary>
         EnableFullReparsePointParsing = 0x1000,
 
+        /// <summary>
+        /// If set, every path that exists under this scope is in the manifest, and the scope doesn't change while the pip runs.
+        /// </summary>
+        /// <remarks>
+        /// Probes for paths under this scope that are not in the manifest are then answered as absent without looking at the file system,
+        /// unless writes are allowed to them.
+        /// </remarks>
+        ConeIsFullyListed = 0x2000,
+
         /// <summary>
         /// If set, then we will report attempts to access files under this scope, whether they exist or not (combination of <see cref="ReportAccessIfExistent"/>
         /// and <see cref="ReportAccessIfNonexistent"/>).
@@ -18,6 +18,11 @@ namespace BuildXL.Processes.Internal
 {
     internal delegate bool StreamDataReceived(string data);
 
+    /// <summary>
+    /// Callback for a complete frame (including its 32-bit length prefix). The segment is only valid during the call.
+    /// </summary>
+    internal delegate bool FrameReceived(ArraySegment<byte> frame);
+
     internal sealed unsafe class AsyncPipeReader : IAsyncPipeReader, IIOCompletionTarget
     {
         private readonly object m_lock = new ();
@@ -25,6 +30,10 @@ namespace BuildXL.Processes.Internal
 
         private Queue<string> m_messageQueue = new ();
         private readonly StreamDataReceived m_userCallBack;
+        private readonly FrameReceived m_frameCallBack;
+        private byte[] m_frameBuffer;
+        private int m_frameBufferLength;
+        private bool m_stopProcessingFrames;
         private readonly DebugReporter m_debugPipeReporter;
         private bool m_bLastCarriageReturn;
 
@@ -113,6 +122,24 @@ namespace BuildXL.Processes.Internal
             m_debugPipeReporter = debugPipeReporter;
         }
 
+        /// <summary>
+        /// Creates a new AsyncPipeReader for a stream of frames, each made of a 32-bit length (counting the bytes that follow it)
+        /// and the payload. Frames may span several reads, the callback is only invoked for complete frames.
+        /// </summary>
+        public AsyncPipeReader(
+            IAsyncFile file,
+            FrameReceived callback,
+            int bufferSize,
+            int numOfRetriesOnCancel = 0,
+            DebugReporter debugPipeReporter = null)
+            : this(file, (StreamDataReceived)null, Encoding.Unicode, bufferSize, numOfRetriesOnCancel, debugPipeReporter)
+        {
+            Contract.Requires(callback != null);
+
+            m_frameCallBack = callback;
+            m_frameBuffer = new byte[bufferSize * 2];
+        }
+
         public void Dispose()
         {
             bool waitForCompletion = false;
@@ -265,6 +292,11 @@ namespace BuildXL.Processes.Internal
 
             if (byteLen == 0)
             {
+                if (m_frameCallBack != null && m_frameBufferLength > 0)
+                {
+                    m_debugPipeReporter?.Error($"Incomplete frame of {m_frameBufferLength} bytes at the end of the pipe");
+                }
+
                 // We're at EOF, we won't call this function again from here on.
                 lock (m_lock)
                 {
@@ -307,8 +339,15 @@ namespace BuildXL.Processes.Internal
             }
             else
             {
-                int charLen = m_decoder.GetChars(ByteBuffer, 0, byteLen, CharBuffer, 0);
-                GetLinesFromCharBuffers(charLen);
+                if (m_frameCallBack != null)
+                {
+                    GetFramesFromByteBuffer(byteLen);
+                }
+                else
+                {
+                    int charLen = m_decoder.GetChars(ByteBuffer, 0, byteLen, CharBuffer, 0);
+                    GetLinesFromCharBuffers(charLen);
+                }
 
                 // File offset is ignored since we're reading a pipe.
                 m_overlapped = m_file.ReadOverlapped(this, m_byteBufferPtr, m_byteBufferSize, fileOffset: 0);
@@ -409,6 +448,62 @@ namespace BuildXL.Processes.Internal
             FlushMessageQueue();
         }
 
+        private void GetFramesFromByteBuffer(int len)
+        {
+            if (m_stopProcessingFrames)
+            {
+                // Either frame boundaries are lost or the callback failed: just drain the pipe
+                return;
+            }
+
+            if (m_frameBufferLength + len > m_frameBuffer.Length)
+            {
+                Array.Resize(ref m_frameBuffer, Math.Max(m_frameBuffer.Length * 2, m_frameBufferLength + len));
+            }
+
+            Buffer.BlockCopy(ByteBuffer, 0, m_frameBuffer, m_frameBufferLength, len);
+            m_frameBufferLength += len;
+
+            int offset = 0;
+            while (m_frameBufferLength - offset >= sizeof(int))
+            {
+                int frameLength = BitConverter.ToInt32(m_frameBuffer, offset);
+                if (frameLength < 0)
+                {
+                    m_debugPipeReporter?.Error($"Invalid frame length {frameLength}");
+                    m_stopProcessingFrames = true;
+                    return;
+                }
+
+                if (m_frameBufferLength - offset - sizeof(int) < frameLength)
+                {
+                    // The rest of the frame comes with the next reads
+                    break;
+                }
+
+                lock (m_lock)
+                {
+                    if (m_state == State.Stopped || m_state == State.Stopping)
+                    {
+                        return;
+                    }
+
+                    if (!m_frameCallBack(new ArraySegment<byte>(m_frameBuffer, offset, sizeof(int) + frameLength)))
+                    {
+                        // The callback indicated an error state: stop processing.
+                        m_stopProcessingFrames = true;
+                        return;
+                    }
+                }
+
+                offset += sizeof(int) + frameLength;
+            }
+
+            // Keep the beginning of an incomplete frame for the next read
+            Buffer.BlockCopy(m_frameBuffer, offset, m_frameBuffer, 0, m_frameBufferLength - offset);
+            m_frameBufferLength -= offset;
+        }
+
         private void FlushMessageQueue()
         {
             while (true)
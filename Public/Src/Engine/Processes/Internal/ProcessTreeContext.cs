@@ -38,6 +38,11 @@ namespace BuildXL.Processes
     internal sealed class ProcessTreeContext : IDisposable
     {
         private const int BufferSize = 4096;
+
+        // CODESYNC: DetouredProcessInjector::RemoteInjectProcessPipelined
+        private const string PipelinedRequestTag = "P";
+        private const int PipelinedRequestFieldCount = 6;
+
         private IAsyncPipeReader m_injectionRequestReader;
         private bool m_stopping;
 
@@ -219,6 +224,11 @@ namespace BuildXL.Processes
             }
 
             string[] items = data.Split(',');
+            if (items.Length == PipelinedRequestFieldCount && items[0] == PipelinedRequestTag)
+            {
+                return OnPipelinedInjectionRequest(items);
+            }
+
             if (items.Length != 4)
             {
                 ReportFailedInjection(0, "Partial string received.");
@@ -293,6 +303,58 @@ namespace BuildXL.Processes
             return true;
         }
 
+        /// <summary>
+        /// Handles a request of the form P,requestId,requesterProcessId,replyPipe,inheritedHandles,processId (numbers in hex, see EnableDetoursPipelinedRemoteInjection).
+        /// The injection runs on the thread pool, so that the requests of other threads are read meanwhile, and its completion goes to the reply pipe of the requester.
+        /// </summary>
+        private bool OnPipelinedInjectionRequest(string[] items)
+        {
+            if (!ulong.TryParse(items[1], NumberStyles.HexNumber, CultureInfo.InvariantCulture, out ulong requestId)
+                || !uint.TryParse(items[2], NumberStyles.HexNumber, CultureInfo.InvariantCulture, out uint requesterProcessId)
+                || !ulong.TryParse(items[3], NumberStyles.HexNumber, CultureInfo.InvariantCulture, out ulong replyPipe)
+                || !bool.TryParse(items[4], out bool inheritedHandles)
+                || !uint.TryParse(items[5], NumberStyles.HexNumber, CultureInfo.InvariantCulture, out uint processId))
+            {
+                ReportFailedInjection(0, "Partial string received.");
+                return false;
+            }
+
+            Contract.Assume(processId != 0, "Brokered injection request is incorrect -- target process id is 0");
+
+            Task.Run(() =>
+            {
+                lock (Injector)
+                {
+                    if (Injector.IsDisposed)
+                    {
+                        // Stop just called. Ignore the request.
+                        return;
+                    }
+
+                    // Once one injection fails, all others also fail.
+                    uint injectionError = HasDetoursInjectionFailures ? NativeIOConstants.ErrorInvalidFunction : 0;
+                    if (injectionError == 0)
+                    {
+                        injectionError = Injector.Inject(processId, inheritedHandles);
+                        if (injectionError != 0)
+                        {
+                            ReportFailedInjection(processId, injectionError.ToString("X8", CultureInfo.InvariantCulture));
+                        }
+                    }
+
+                    uint completionError = Injector.CompleteRemoteInjection(requesterProcessId, replyPipe, requestId, injectionError);
+                    if (completionError != 0 && injectionError == 0)
+                    {
+                        ReportFailedInjection(
+                            processId,
+                            string.Format(CultureInfo.InvariantCulture, "Cannot complete request {0} of process {1} ({2:X8})", requestId, requesterProcessId, completionError));
+                    }
+                }
+            });
+
+            return true;
+        }
+
         private void ReportFailedInjection(uint processId, string error)
         {
             if (Volatile.Read(ref m_stopping))
@@ -90,6 +90,31 @@ namespace BuildXL.Processes
         /// </summary>
         public uint CreateProcessStatusReturn { get; private set; }
 
+        /// <summary>
+        /// Time spent creating the (suspended) process, in microseconds.
+        /// </summary>
+        public ulong CreateProcessMicroseconds { get; private set; }
+
+        /// <summary>
+        /// Time spent injecting Detours into the process, including retries and remote injection, in microseconds.
+        /// </summary>
+        public ulong InjectionMicroseconds { get; private set; }
+
+        /// <summary>
+        /// Time spent by a local injection rewriting the import table of the process to load the Detours DLL, in microseconds.
+        /// </summary>
+        public ulong DllInjectionMicroseconds { get; private set; }
+
+        /// <summary>
+        /// Time spent by a local injection applying the drive mappings to the process, in microseconds.
+        /// </summary>
+        public ulong DriveMappingMicroseconds { get; private set; }
+
+        /// <summary>
+        /// Time spent by a local injection copying the payload to the process, in microseconds.
+        /// </summary>
+        public ulong PayloadCopyMicroseconds { get; private set; }
+
         /// <summary>
         /// Creates an instance of this class.
         /// </summary>
@@ -109,6 +134,11 @@ namespace BuildXL.Processes
         /// <param name="detoured">Whether the process was detoured.</param>
         /// <param name="error">The last error that this create process sets.</param>
         /// <param name="createProcessStatusReturn">The return status of the detoured CreateProcess function.</param>
+        /// <param name="createProcessMicroseconds">Time spent creating the process.</param>
+        /// <param name="injectionMicroseconds">Time spent injecting Detours into the process.</param>
+        /// <param name="dllInjectionMicroseconds">Time spent by a local injection loading the Detours DLL.</param>
+        /// <param name="driveMappingMicroseconds">Time spent by a local injection applying the drive mappings.</param>
+        /// <param name="payloadCopyMicroseconds">Time spent by a local injection copying the payload.</param>
         public ProcessDetouringStatusData(
             ulong processId,
             uint reportStatus,
@@ -125,7 +155,12 @@ namespace BuildXL.Processes
             uint creationFlags,
             bool detoured,
             uint error,
-            uint createProcessStatusReturn)
+            uint createProcessStatusReturn,
+            ulong createProcessMicroseconds = 0,
+            ulong injectionMicroseconds = 0,
+            ulong dllInjectionMicroseconds = 0,
+            ulong driveMappingMicroseconds = 0,
+            ulong payloadCopyMicroseconds = 0)
         {
             ProcessId = processId;
             ReportStatus = reportStatus;
@@ -143,6 +178,11 @@ namespace BuildXL.Processes
             Detoured = detoured;
             Error = error;
             CreateProcessStatusReturn = createProcessStatusReturn;
+            CreateProcessMicroseconds = createProcessMicroseconds;
+            InjectionMicroseconds = injectionMicroseconds;
+            DllInjectionMicroseconds = dllInjectionMicroseconds;
+            DriveMappingMicroseconds = driveMappingMicroseconds;
+            PayloadCopyMicroseconds = payloadCopyMicroseconds;
         }
 
         /// <nodoc />
@@ -164,7 +204,12 @@ namespace BuildXL.Processes
                 creationFlags: reader.ReadUInt32(),
                 detoured: reader.ReadBoolean(),
                 error: reader.ReadUInt32(),
-                createProcessStatusReturn: reader.ReadUInt32());
+                createProcessStatusReturn: reader.ReadUInt32(),
+                createProcessMicroseconds: reader.ReadUInt64(),
+                injectionMicroseconds: reader.ReadUInt64(),
+                dllInjectionMicroseconds: reader.ReadUInt64(),
+                driveMappingMicroseconds: reader.ReadUInt64(),
+                payloadCopyMicroseconds: reader.ReadUInt64());
         }
 
         /// <nodoc />
@@ -186,6 +231,11 @@ namespace BuildXL.Processes
             writer.Write(Detoured);
             writer.Write(Error);
             writer.Write(CreateProcessStatusReturn);
+            writer.Write(CreateProcessMicroseconds);
+            writer.Write(InjectionMicroseconds);
+            writer.Write(DllInjectionMicroseconds);
+            writer.Write(DriveMappingMicroseconds);
+            writer.Write(PayloadCopyMicroseconds);
         }
     }
 }
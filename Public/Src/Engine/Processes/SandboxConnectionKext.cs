@@ -164,7 +164,7 @@ Use the the following command to load/reload the sandbox kernel extension and fi
                 throw new BuildXLException($"Unable to set sandbox kernel extension failure notification callback handler");
             }
 
-            m_workerThread = new Thread(() => StartReceivingAccessReports(m_sharedMemoryInfo.Address, m_sharedMemoryInfo.Port));
+            m_workerThread = new Thread(() => StartReceivingAccessReports(m_sharedMemoryInfo.Address, m_sharedMemoryInfo.PriorityAddress, m_sharedMemoryInfo.Port));
             m_workerThread.IsBackground = true;
             m_workerThread.Priority = ThreadPriority.Highest;
             m_workerThread.Start();
@@ -206,9 +206,10 @@ Use the the following command to load/reload the sandbox kernel extension and fi
         /// <summary>
         /// Starts listening for reports from the kernel extension on a dedicated thread
         /// </summary>
-        private void StartReceivingAccessReports(ulong address, uint port)
+        private void StartReceivingAccessReports(ulong address, ulong priorityAddress, uint port)
         {
-            Sandbox.AccessReportCallback callback = (Sandbox.AccessReport report, int code) =>
+            int reportSize = Marshal.SizeOf<Sandbox.AccessReport>();
+            Sandbox.AccessReportBatchCallback callback = (IntPtr reports, int count, int code) =>
             {
                 if (code != Sandbox.ReportQueueSuccessCode)
                 {
@@ -219,26 +220,38 @@ Use the the following command to load/reload the sandbox kernel extension and fi
                 // Update last received timestamp
                 Volatile.Write(ref m_lastReportReceivedTimestampTicks, DateTime.UtcNow.Ticks);
 
-                // Remember the latest enqueue time
-                Volatile.Write(ref m_reportQueueLastEnqueueTime, report.Statistics.EnqueueTime);
-
-                // The only way it can happen that no process is found for 'report.PipId' is when that pip is
-                // explicitly terminated (e.g., because it timed out or Ctrl-c was pressed)
-                if (m_pipProcesses.TryGetValue(report.PipId, out var process))
+                for (int i = 0; i < count; i++)
                 {
-                    // if the process is found, its ProcessId must match the RootPid of the report.
-                    if (process.ProcessId != report.RootPid)
-                    {
-                        m_failureCallback?.Invoke(-1, $"Unexpected PID for Pip {report.PipId:X}: Expected {process.ProcessId}, Reported {report.RootPid}");
-                    }
-                    else
-                    {
-                        process.PostAccessReport(report);
-                    }
+                    HandleAccessReport(Marshal.PtrToStructure<Sandbox.AccessReport>(reports + i * reportSize));
                 }
             };
 
-            Sandbox.ListenForFileAccessReports(callback, Marshal.SizeOf<Sandbox.AccessReport>(), address, port);
+            Sandbox.ListenForFileAccessReports(callback, reportSize, address, priorityAddress, port);
+        }
+
+        private void HandleAccessReport(Sandbox.AccessReport report)
+        {
+            // Remember the latest enqueue time. Process lifecycle reports can be handed over ahead of reports enqueued before them
+            // (by other pips), so it must not go back.
+            if (report.Statistics.EnqueueTime > m_reportQueueLastEnqueueTime)
+            {
+                Volatile.Write(ref m_reportQueueLastEnqueueTime, report.Statistics.EnqueueTime);
+            }
+
+            // The only way it can happen that no process is found for 'report.PipId' is when that pip is
+            // explicitly terminated (e.g., because it timed out or Ctrl-c was pressed)
+            if (m_pipProcesses.TryGetValue(report.PipId, out var process))
+            {
+                // if the process is found, its ProcessId must match the RootPid of the report.
+                if (process.ProcessId != report.RootPid)
+                {
+                    m_failureCallback?.Invoke(-1, $"Unexpected PID for Pip {report.PipId:X}: Expected {process.ProcessId}, Reported {report.RootPid}");
+                }
+                else
+                {
+                    process.PostAccessReport(report);
+                }
+            }
         }
 
         /// <inheritdoc />
@@ -65,6 +65,14 @@ namespace BuildXL.Processes
         /// </summary>
         public static readonly string BuildXLTracedProcessPath = "__BUILDXL_TRACED_PATH";
 
+        /// <summary>
+        /// Environment variable containing the path of the file the sandbox keeps its access statistics in, if any.
+        /// </summary>
+        /// <remarks>
+        /// CODESYNC: Public/Src/Sandbox/Linux/common.h (BxlEnvAccessStatisticsPath)
+        /// </remarks>
+        public static readonly string BuildXLAccessStatisticsPathEnvVarName = "__BUILDXL_ACCESS_STATISTICS_PATH";
+
         internal sealed class Info : IDisposable
         {
             /// <summary>
@@ -85,6 +93,7 @@ namespace BuildXL.Processes
                 private int m_completeAccessReportProcessingCounter;
                 private readonly string m_fifoName;
                 private readonly Lazy<SafeFileHandle> m_fifoWriteHandle;
+                private readonly SharedMemoryReportRing.RecordHandler m_postReportRingRecord;
                 
                 // We use these two to synchronize sending a sentinel via the write handle and disposing the read handle. Trying to write to a FIFO with no read handles open
                 // produces an error (a broken pipe)
@@ -114,6 +123,7 @@ namespace BuildXL.Processes
                     );
 
                     IsPrimaryFifoProcessor = m_fifoWriteHandle == info.m_lazyWriteHandle;
+                    m_postReportRingRecord = PostReportRingRecord;
                 }
 
                 internal void Start() => m_workerThread.Start();
@@ -168,6 +178,30 @@ namespace BuildXL.Processes
 
                 private void LogError(string s) => Info.LogError(s);
 
+                /// <summary>
+                /// Posts the reports written to the ring so far, and parks the ring so the next report written to it wakes up this thread.
+                /// </summary>
+                private bool DrainReportRing(SharedMemoryReportRing reportRing, bool waitForReserved)
+                {
+                    do
+                    {
+                        if (!reportRing.Drain(m_postReportRingRecord, waitForReserved))
+                        {
+                            return false;
+                        }
+                    }
+                    while (!reportRing.Park());
+
+                    return true;
+                }
+
+                private void PostReportRingRecord(ReadOnlySpan<byte> payload)
+                {
+                    PooledObjectWrapper<byte[]> messageBytes = ByteArrayPool.GetInstance(payload.Length);
+                    payload.CopyTo(messageBytes.Instance);
+                    m_processingBlock.Post((this, messageBytes, payload.Length), throwOnFullOrComplete: true);
+                }
+
                 /// <summary>
                 /// The method backing the <see cref="m_workerThread"/> thread.
                 /// </summary>
@@ -192,6 +226,10 @@ namespace BuildXL.Processes
                 /// * A note on the secondary FIFO: the processing loop for the secondary FIFO (used to communicate ptrace specific messages) goes through the same flow, with the 
                 ///   caveat that we only initiate the tear down process of the seconday FIFO once the decide to exit the primary FIFO via <see cref="EndOfReportsSentinel"/>. The reason
                 ///   is that we want the secondary FIFO to be alive throughout the lifetime of the first FIFO. 
+                /// * A note on the report ring: when the processes write their reports to <see cref="Info.ReportRing"/>, the primary FIFO only carries the
+                ///   sentinels, the reports of the processes that went back to the FIFO, and <see cref="SharedMemoryReportRing.DoorbellSentinel"/> when the ring got
+                ///   a report after this loop parked it. Whatever is read from the FIFO, the ring is drained first, waiting for the reports reserved so far,
+                ///   so no report written to the ring is left behind when the end of reports sentinel is seen.
                 /// </remarks>
                 private void StartReceivingAccessReports(string fifoName, Lazy<SafeFileHandle> fifoHandle)
                 {
@@ -231,6 +269,33 @@ namespace BuildXL.Processes
                             // decode length
                             int messageLength = BitConverter.ToInt32(messageLengthBytes, startIndex: 0);
 
+                            SharedMemoryReportRing reportRing = IsPrimaryFifoProcessor ? Info.ReportRing : null;
+                            if (reportRing != null)
+                            {
+                                bool drained;
+                                try
+                                {
+                                    drained = DrainReportRing(reportRing, waitForReserved: messageLength != SharedMemoryReportRing.DoorbellSentinel);
+                                }
+                                catch (Exception e)
+                                {
+                                    Analysis.IgnoreException("Will error and exit on LogError");
+                                    LogError($"Could not post the reports of the report ring to the processing block for {fifoName}. Exception details: {e}");
+                                    break;
+                                }
+
+                                if (!drained)
+                                {
+                                    LogError($"The report ring of {fifoName} holds a report that was never completely written.");
+                                    break;
+                                }
+                            }
+
+                            if (messageLength == SharedMemoryReportRing.DoorbellSentinel)
+                            {
+                                continue;
+                            }
+
                             // The process tree we know about so far has completed. We might still
                             // have 'process start' reports to be processed, so we just send this sentinel and let the processing block decide.
                             if (messageLength == NoActiveProcessesSentinel)
@@ -305,6 +370,11 @@ namespace BuildXL.Processes
             internal string SecondaryFifoPath { get; }
             internal string FamPath { get; }
 
+            /// <summary>
+            /// The ring the processes write their reports to instead of the primary FIFO, or null if they write them to the FIFO.
+            /// </summary>
+            internal SharedMemoryReportRing ReportRing { get; }
+
             private readonly ManagedFailureCallback m_failureCallback;
             private readonly bool m_isInTestMode;
 
@@ -341,7 +411,7 @@ namespace BuildXL.Processes
 
             private ReportProcessor GetReportProcessorFor(Lazy<SafeFileHandle> lazyWriteHandle) => lazyWriteHandle == m_lazyWriteHandle ? m_reportProcessor : m_secondaryReportProcessor;
 
-            internal Info(ManagedFailureCallback failureCallback, SandboxedProcessUnix process, string reportsFifoPath, string secondaryFifoPath, string famPath, bool isInTestMode)
+            internal Info(ManagedFailureCallback failureCallback, SandboxedProcessUnix process, string reportsFifoPath, string secondaryFifoPath, string famPath, SharedMemoryReportRing reportRing, bool isInTestMode)
             {
                 m_isInTestMode = isInTestMode;
                 m_failureCallback = failureCallback;
@@ -349,6 +419,7 @@ namespace BuildXL.Processes
                 ReportsFifoPath = reportsFifoPath;
                 SecondaryFifoPath = secondaryFifoPath;
                 FamPath = famPath;
+                ReportRing = reportRing;
 
                 m_activeProcesses = new ConcurrentDictionary<int, byte>();
                 m_activeProcessesChecker = new CancellableTimedAction(
@@ -588,6 +659,8 @@ namespace BuildXL.Processes
                 m_activeProcesses.Clear();
                 Analysis.IgnoreResult(FileUtilities.TryDeleteFile(ReportsFifoPath, retryOnFailure: false));
                 Analysis.IgnoreResult(FileUtilities.TryDeleteFile(FamPath, retryOnFailure: false));
+
+                // Disposed once all the reports were processed, so the receiving thread is done with it
                 if (m_isInTestMode)
                 {
                     // The worker thread should complete in all but most extreme cases.  One such extreme case
@@ -599,6 +672,8 @@ namespace BuildXL.Processes
                     m_reportProcessor.JoinReceivingThread();
                     m_secondaryReportProcessor?.JoinReceivingThread();
                 }
+
+                ReportRing?.Dispose();
             }
 
             /// <summary>
@@ -647,19 +722,53 @@ namespace BuildXL.Processes
                     var path = nextField(restOfMessage, out restOfMessage);
                     Contract.Assert(restOfMessage.IsEmpty);  // We should have reached the end of the message
 
-                    var report = new AccessReport
+                    // A subtree report (e.g., for the content of a renamed directory) packs the reports of several paths that only differ in their path:
+                    // the path field is the root of the subtree followed by a '\0'-separated list of paths relative to it, an empty one being the root itself.
+                    // CODESYNC: Public/Src/Sandbox/Linux/bxl_observer.cpp (BxlObserver::SendSubtreeReports)
+                    int separator = path.IndexOf('\0');
+                    if (separator < 0)
                     {
-                        Pid = (int)pid,
-                        PipId = Process.PipId,
-                        RequestedAccess = (uint)access,
-                        Status = status,
-                        ExplicitLogging = explicitlogging,
-                        Error = err,
-                        Operation = (FileOperation)opCode,
-                        PathOrPipStats = s_encoding.GetBytes(path.ToArray()),
-                        IsDirectory = isDirectory,
-                    };
+                        postReport(s_encoding.GetBytes(path.ToArray()));
+                        return;
+                    }
+
+                    var root = path.Slice(0, separator).ToString();
+                    var relativePaths = path.Slice(separator + 1);
+                    while (true)
+                    {
+                        separator = relativePaths.IndexOf('\0');
+                        var relativePath = separator < 0 ? relativePaths : relativePaths.Slice(0, separator);
+                        postReport(s_encoding.GetBytes(relativePath.IsEmpty ? root : root + "/" + relativePath.ToString()));
+
+                        if (separator < 0)
+                        {
+                            break;
+                        }
+
+                        relativePaths = relativePaths.Slice(separator + 1);
+                    }
 
+                    void postReport(byte[] reportPath)
+                    {
+                        var report = new AccessReport
+                        {
+                            Pid = (int)pid,
+                            PipId = Process.PipId,
+                            RequestedAccess = (uint)access,
+                            Status = status,
+                            ExplicitLogging = explicitlogging,
+                            Error = err,
+                            Operation = (FileOperation)opCode,
+                            PathOrPipStats = reportPath,
+                            IsDirectory = isDirectory,
+                        };
+
+                        postAccessReport(report);
+                    }
+                }
+
+                void postAccessReport(AccessReport report)
+                {
                     // update active processes
                     if (report.Operation == FileOperation.OpProcessStart)
                     {
@@ -844,6 +953,23 @@ namespace BuildXL.Processes
             // create a FIFO (named pipe)
             createNewFifo(fifoPath);
 
+            // The processes write their reports to the ring when they find it; the FIFO is still what the reports are waited on
+            SharedMemoryReportRing reportRing = null;
+            if (fam.EnableLinuxSandboxSharedMemoryReports)
+            {
+                string reportRingPath = SharedMemoryReportRing.GetPath(fifoPath);
+                Analysis.IgnoreResult(FileUtilities.TryDeleteFile(reportRingPath, retryOnFailure: false));
+                try
+                {
+                    reportRing = SharedMemoryReportRing.Create(reportRingPath);
+                    process.LogDebug($"Created report ring at '{reportRingPath}'");
+                }
+                catch (Exception e) when (e is IOException || e is UnauthorizedAccessException)
+                {
+                    process.LogDebug($"Could not create report ring at '{reportRingPath}', reports go to the FIFO: {e.Message}");
+                }
+            }
+
             // Secondary fifo is only used by the ptrace sandbox for now
             if (fam.EnableLinuxPTraceSandbox)
             {
@@ -855,7 +981,7 @@ namespace BuildXL.Processes
             }
 
             // create and save info for this pip
-            var info = new Info(m_failureCallback, process, fifoPath, secondaryFifoPath, famPath, IsInTestMode);
+            var info = new Info(m_failureCallback, process, fifoPath, secondaryFifoPath, famPath, reportRing, IsInTestMode);
             if (!m_pipProcesses.TryAdd(process.PipId, info))
             {
                 throw new BuildXLException($"Process with PidId {process.PipId} already exists");
@@ -450,7 +450,8 @@ namespace BuildXL.Processes
             SafeFileHandle? childHandle = null;
             DetouredProcess detouredProcess = m_detouredProcess!;
 
-            bool useManagedPipeReader = !PipeReaderFactory.ShouldUseLegacyPipeReader();
+            // Only the IO completion based reader understands the framed reports
+            bool useManagedPipeReader = !PipeReaderFactory.ShouldUseLegacyPipeReader() && !m_fileAccessManifest.EnableDetoursBinaryReports;
 
             using (m_reportReaderSemaphore.AcquireSemaphore())
             {
@@ -549,13 +550,21 @@ namespace BuildXL.Processes
                         FileDesiredAccess.GenericRead,
                         ownsHandle: true,
                         kind: FileKind.Pipe);
-                    m_reportReader = new AsyncPipeReader(
-                        reportFile,
-                        reportLineReceivedCallback,
-                        reportEncoding,
-                        m_bufferSize,
-                        numOfRetriesOnCancel: m_numRetriesPipeReadOnCancel,
-                        debugPipeReporter: new AsyncPipeReader.DebugReporter(errorMsg => DebugPipeConnection($"ReportReader: {errorMsg}")));
+                    var debugPipeReporter = new AsyncPipeReader.DebugReporter(errorMsg => DebugPipeConnection($"ReportReader: {errorMsg}"));
+                    m_reportReader = m_fileAccessManifest.EnableDetoursBinaryReports
+                        ? new AsyncPipeReader(
+                            reportFile,
+                            ReportFrameReceived,
+                            m_bufferSize,
+                            numOfRetriesOnCancel: m_numRetriesPipeReadOnCancel,
+                            debugPipeReporter: debugPipeReporter)
+                        : new AsyncPipeReader(
+                            reportFile,
+                            reportLineReceivedCallback,
+                            reportEncoding,
+                            m_bufferSize,
+                            numOfRetriesOnCancel: m_numRetriesPipeReadOnCancel,
+                            debugPipeReporter: debugPipeReporter);
                 }
 
                 m_reportReader.BeginReadLine();
@@ -574,6 +583,15 @@ namespace BuildXL.Processes
             }
         }
 
+        private bool ReportFrameReceived(ArraySegment<byte> frame)
+        {
+            SandboxedProcessFactory.Counters.IncrementCounter(SandboxedProcessFactory.SandboxedProcessCounters.AccessReportCount);
+            using (SandboxedProcessFactory.Counters.StartStopwatch(SandboxedProcessFactory.SandboxedProcessCounters.HandleAccessReportDuration))
+            {
+                return m_reports.ReportFrameReceived(frame);
+            }
+        }
+
         private void DebugPipeConnection(string data) => m_reports.ReportLineReceived($"{(int)ReportType.DebugMessage},{data}");
 
         private static async Task FeedStandardInputAsync(DetouredProcess detouredProcess, TextReader? reader, TaskSourceSlim<bool> stdInTcs)
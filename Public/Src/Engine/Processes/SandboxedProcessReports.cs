@@ -60,7 +60,15 @@ namespace BuildXL.Processes
         /// </summary>
         public int GetLastMessageCount()
         {
-            return m_manifest.MessageCountSemaphore?.Release() ?? 0;
+            return m_manifest.GetLastMessageCount();
+        }
+
+        /// <summary>
+        /// Counts a message received that the sandbox counted as sent (see <see cref="FileAccessManifest.CountReceivedMessage"/>).
+        /// </summary>
+        public void CountReceivedMessage()
+        {
+            m_manifest.CountReceivedMessage();
         }
 
         public INamedSemaphore GetMessageCountSemaphore()
@@ -229,6 +237,46 @@ namespace BuildXL.Processes
             return result;
         }
 
+        /// <summary>
+        /// Callback invoked when a new report frame is received from the native monitoring code, when <see cref="FileAccessManifest.EnableDetoursBinaryReports"/> is set
+        /// <returns>true if the processing should continue. Otherwise false, which should cause exiting of the processing of data.</returns>
+        /// </summary>
+        public bool ReportFrameReceived(ArraySegment<byte> frame)
+        {
+            if (frame.Count < BinaryFileAccessReport.FrameHeaderSize)
+            {
+                MessageProcessingFailure = CreateMessageProcessingFailure(I($"Unexpected report frame of {frame.Count} bytes. Frame header expected."));
+                return false;
+            }
+
+            var kind = BinaryFileAccessReport.GetFrameKind(frame);
+            switch (kind)
+            {
+                case BinaryFileAccessReport.FrameKind.TextLine:
+                    return ReportLineReceived(BinaryFileAccessReport.GetTextLine(frame));
+
+                case BinaryFileAccessReport.FrameKind.FileAccess:
+                    if (m_manifest.MessageCountSemaphore != null)
+                    {
+                        try
+                        {
+                            m_manifest.CountReceivedMessage();
+                        }
+                        catch (Exception ex)
+                        {
+                            MessageProcessingFailure = CreateMessageProcessingFailure(I($"Wait error on semaphore for counting Detours messages: {ex.GetLogEventMessage()}."));
+                            return false;
+                        }
+                    }
+
+                    return ReportFileAccess(ref frame, BinaryFileAccessReport.TryParse);
+
+                default:
+                    MessageProcessingFailure = CreateMessageProcessingFailure(I($"Unexpected report frame kind '{(uint)kind}'."));
+                    return false;
+            }
+        }
+
         /// <summary>
         /// Callback invoked when a new report item is received from the native monitoring code
         /// <returns>true if the processing should continue. Otherwise false, which should cause exiting of the processing of data.</returns>
@@ -277,7 +325,7 @@ namespace BuildXL.Processes
             {
                 try
                 {
-                    m_manifest.MessageCountSemaphore.WaitOne(0);
+                    m_manifest.CountReceivedMessage();
                 }
                 catch (Exception ex)
                 {
@@ -369,6 +417,11 @@ namespace BuildXL.Processes
                 out var detoured,
                 out var error,
                 out var createProcessStatusReturn,
+                out var createProcessMicroseconds,
+                out var injectionMicroseconds,
+                out var dllInjectionMicroseconds,
+                out var driveMappingMicroseconds,
+                out var payloadCopyMicroseconds,
                 out errorMessage))
             {
                 return false;
@@ -390,7 +443,12 @@ namespace BuildXL.Processes
                 creationFlags,
                 detoured,
                 error,
-                createProcessStatusReturn);
+                createProcessStatusReturn,
+                createProcessMicroseconds,
+                injectionMicroseconds,
+                dllInjectionMicroseconds,
+                driveMappingMicroseconds,
+                payloadCopyMicroseconds);
 
             // If there is a listener registered and not a process message and notifications allowed, notify over the interface.
             if (m_detoursEventListener != null && (m_detoursEventListener.GetMessageHandlingFlags() & MessageHandlingFlags.ProcessDetoursStatusNotify) != 0)
@@ -429,6 +487,11 @@ namespace BuildXL.Processes
                 out bool detoured,
                 out uint error,
                 out uint createProcessStatusReturn,
+                out ulong createProcessMicroseconds,
+                out ulong injectionMicroseconds,
+                out ulong dllInjectionMicroseconds,
+                out ulong driveMappingMicroseconds,
+                out ulong payloadCopyMicroseconds,
                 out string errorMessage)
             {
                 reportStatus = 0;
@@ -447,6 +510,11 @@ namespace BuildXL.Processes
                 processId = 0;
                 startApplicationName = default;
                 startCommandLine = default;
+                createProcessMicroseconds = 0;
+                injectionMicroseconds = 0;
+                dllInjectionMicroseconds = 0;
+                driveMappingMicroseconds = 0;
+                payloadCopyMicroseconds = 0;
                 errorMessage = string.Empty;
 
                 var items = line.Split('|');
@@ -457,22 +525,22 @@ namespace BuildXL.Processes
                 // If this assert fires, it indicates that we could not successfully parse (split) the data being
                 // sent from the detour (SendReport.cpp).
                 // Make sure the strings are formatted only when the condition is false.
-                if (items.Length < 16)
+                if (items.Length < 21)
                 {
-                    errorMessage = I($"Unexpected message items (potentially due to pipe corruption). Message '{line}'. Expected >= 12 items, Received {items.Length} items");
+                    errorMessage = I($"Unexpected message items (potentially due to pipe corruption). Message '{line}'. Expected >= 21 items, Received {items.Length} items");
                     return false;
                 }
 
-                if (items.Length == 16)
+                if (items.Length == 21)
                 {
-                    startCommandLine = items[15];
+                    startCommandLine = items[20];
                 }
                 else
                 {
                     System.Text.StringBuilder builder = Pools.GetStringBuilder().Instance;
-                    for (int i = 15; i < items.Length; i++)
+                    for (int i = 20; i < items.Length; i++)
                     {
-                        if (i > 15)
+                        if (i > 20)
                         {
                             builder.Append("|");
                         }
@@ -506,7 +574,12 @@ namespace BuildXL.Processes
                     uint.TryParse(items[11], NumberStyles.None, CultureInfo.InvariantCulture, out creationFlags) &&
                     uint.TryParse(items[12], NumberStyles.None, CultureInfo.InvariantCulture, out uintDetoured) &&
                     uint.TryParse(items[13], NumberStyles.None, CultureInfo.InvariantCulture, out error) &&
-                    uint.TryParse(items[14], NumberStyles.None, CultureInfo.InvariantCulture, out createProcessStatusReturn))
+                    uint.TryParse(items[14], NumberStyles.None, CultureInfo.InvariantCulture, out createProcessStatusReturn) &&
+                    ulong.TryParse(items[15], NumberStyles.None, CultureInfo.InvariantCulture, out createProcessMicroseconds) &&
+                    ulong.TryParse(items[16], NumberStyles.None, CultureInfo.InvariantCulture, out injectionMicroseconds) &&
+                    ulong.TryParse(items[17], NumberStyles.None, CultureInfo.InvariantCulture, out dllInjectionMicroseconds) &&
+                    ulong.TryParse(items[18], NumberStyles.None, CultureInfo.InvariantCulture, out driveMappingMicroseconds) &&
+                    ulong.TryParse(items[19], NumberStyles.None, CultureInfo.InvariantCulture, out payloadCopyMicroseconds))
                 {
                     needsInjection = uintNeedsInjection != 0;
                     isCurrent64BitProcess = uintIsCurrent64BitProcess != 0;
@@ -541,6 +614,9 @@ namespace BuildXL.Processes
                 out var allocatedPoolEntries,
                 out var maxHandleMapEntries,
                 out var handleMapEntries,
+                out var policySearchCacheHits,
+                out var policySearchCacheMisses,
+                out var performanceCounters,
                 out errorMessage))
             {
                 return false;
@@ -557,7 +633,20 @@ namespace BuildXL.Processes
                 finalDetoursHeapSizeInBytes,
                 allocatedPoolEntries,
                 maxHandleMapEntries,
-                handleMapEntries);
+                handleMapEntries,
+                policySearchCacheHits,
+                policySearchCacheMisses);
+
+            if (!string.IsNullOrEmpty(performanceCounters))
+            {
+                Tracing.Logger.Log.LogDetoursPerformanceCounters(
+                    m_loggingContext,
+                    PipSemiStableHash,
+                    PipDescription,
+                    processName,
+                    processId,
+                    performanceCounters);
+            }
 
             if (MaxDetoursHeapSize < unchecked((long)detoursMaxMemHeapSizeInBytes))
             {
@@ -725,7 +814,8 @@ namespace BuildXL.Processes
                 return true;
             }
 
-            if (OperatingSystemHelper.IsWindowsOS)
+            // Binary reports carry unescaped paths
+            if (OperatingSystemHelper.IsWindowsOS && typeof(T) == typeof(string))
             {
                 // CODESYNC: Public/Src/Sandbox/Windows/DetoursServices/SendReport.cpp
                 // Handle escaped \r\n characters in path
@@ -1068,6 +1158,9 @@ namespace BuildXL.Processes
                 out uint allocatedPoolEntries,
                 out ulong maxHandleMapEntries,
                 out ulong handleMapEntries,
+                out ulong policySearchCacheHits,
+                out ulong policySearchCacheMisses,
+                out string performanceCounters,
                 out string errorMessage)
             {
                 processName = default;
@@ -1087,8 +1180,11 @@ namespace BuildXL.Processes
                 allocatedPoolEntries = 0;
                 maxHandleMapEntries = 0L;
                 handleMapEntries = 0L;
+                policySearchCacheHits = 0L;
+                policySearchCacheMisses = 0L;
+                performanceCounters = string.Empty;
 
-                const int NumberOfEntriesInMessage = 24;
+                const int NumberOfEntriesInMessage = 27;
 
                 var items = line.Split('|');
 
@@ -1105,6 +1201,7 @@ namespace BuildXL.Processes
                 }
 
                 processName = items[15];
+                performanceCounters = items[26];
 
                 if (uint.TryParse(items[0], NumberStyles.None, CultureInfo.InvariantCulture, out processId) &&
                     ulong.TryParse(items[1], NumberStyles.None, CultureInfo.InvariantCulture, out var readOperationCount) &&
@@ -1128,7 +1225,9 @@ namespace BuildXL.Processes
                     ulong.TryParse(items[20], NumberStyles.None, CultureInfo.InvariantCulture, out finalDetoursHeapSizeInBytes) &&
                     uint.TryParse(items[21], NumberStyles.None, CultureInfo.InvariantCulture, out allocatedPoolEntries) &&
                     ulong.TryParse(items[22], NumberStyles.None, CultureInfo.InvariantCulture, out maxHandleMapEntries) &&
-                    ulong.TryParse(items[23], NumberStyles.None, CultureInfo.InvariantCulture, out handleMapEntries))
+                    ulong.TryParse(items[23], NumberStyles.None, CultureInfo.InvariantCulture, out handleMapEntries) &&
+                    ulong.TryParse(items[24], NumberStyles.None, CultureInfo.InvariantCulture, out policySearchCacheHits) &&
+                    ulong.TryParse(items[25], NumberStyles.None, CultureInfo.InvariantCulture, out policySearchCacheMisses))
                 {
                     long fileTime = creationHighDateTime;
                     fileTime = fileTime << 32;
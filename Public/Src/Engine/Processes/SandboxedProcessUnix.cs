@@ -62,6 +62,16 @@ namespace BuildXL.Processes
         private readonly IList<Task<AsyncProcessExecutor>> m_ptraceRunners;
         private readonly TaskSourceSlim<bool> m_ptraceRunnersCancellation = TaskSourceSlim.Create<bool>();
 
+        /// <summary>
+        /// The runner subsequent processes requiring ptrace are handed over to, so we don't start a runner for each of them.
+        /// </summary>
+        private AsyncProcessExecutor m_ptraceDaemon;
+
+        /// <summary>
+        /// Statistics file the pip asked the sandbox to keep, passed on to the ptrace runners so that they count tracer stops in it.
+        /// </summary>
+        private readonly string? m_accessStatisticsPath;
+
         /// <summary>
         /// Id of the underlying pip.
         /// </summary>
@@ -189,6 +199,9 @@ namespace BuildXL.Processes
             m_loggingContext = info.LoggingContext;
             m_ptraceRunners = new List<Task<AsyncProcessExecutor>>();
             m_pathCache = new Dictionary<string, PathCacheRecord>();
+            m_accessStatisticsPath = info.EnvironmentVariables?.ContainsKey(SandboxConnectionLinuxDetours.BuildXLAccessStatisticsPathEnvVarName) == true
+                ? info.EnvironmentVariables[SandboxConnectionLinuxDetours.BuildXLAccessStatisticsPathEnvVarName]
+                : null;
 
             if (info.MonitoringConfig is not null && info.MonitoringConfig.MonitoringEnabled)
             {
@@ -897,7 +910,7 @@ namespace BuildXL.Processes
                 {
                     try
                     {
-                        m_reports.GetMessageCountSemaphore().WaitOne(0);
+                        m_reports.CountReceivedMessage();
                     }
                     catch (Exception e)
                     {
@@ -1161,8 +1174,14 @@ namespace BuildXL.Processes
 
         private void StartPTraceRunner(int pid, string path, bool forceAddExecutionPermission)
         {
+            if (m_ptraceDaemon != null && TrySendPTraceAttachRequest(m_ptraceDaemon, pid, path))
+            {
+                return;
+            }
+
             var paths = SandboxConnectionLinuxDetours.GetPaths(RootJailInfo, UniqueName);
-            var args = $"-c {pid} -x {path}";
+            // With -d the runner keeps reading processes to trace from its standard input (see TrySendPTraceAttachRequest)
+            var args = $"-c {pid} -x {path} -d";
             var process = new System.Diagnostics.Process
             {
                 StartInfo = new System.Diagnostics.ProcessStartInfo(PTraceRunnerExecutable.Value, args)
@@ -1171,6 +1190,7 @@ namespace BuildXL.Processes
                     UseShellExecute = false,
                     RedirectStandardError = true,
                     RedirectStandardOutput = true,
+                    RedirectStandardInput = true,
                     WorkingDirectory = Path.GetDirectoryName(PTraceRunnerExecutable.Value)
                 },
                 EnableRaisingEvents = true
@@ -1179,6 +1199,10 @@ namespace BuildXL.Processes
             process.StartInfo.Environment[SandboxConnectionLinuxDetours.BuildXLFamPathEnvVarName] = paths.fam;
             process.StartInfo.Environment[SandboxConnectionLinuxDetours.BuildXLTracedProcessPid] = pid.ToString();
             process.StartInfo.Environment[SandboxConnectionLinuxDetours.BuildXLTracedProcessPath] = path;
+            if (!string.IsNullOrEmpty(m_accessStatisticsPath))
+            {
+                process.StartInfo.Environment[SandboxConnectionLinuxDetours.BuildXLAccessStatisticsPathEnvVarName] = m_accessStatisticsPath;
+            }
 
             var ptraceRunner = new AsyncProcessExecutor
             (
@@ -1192,6 +1216,7 @@ namespace BuildXL.Processes
 
             ptraceRunner.Start();
             m_ptraceRunners.Add(runnerTask(ptraceRunner));
+            m_ptraceDaemon = ptraceRunner;
 
             async Task<AsyncProcessExecutor> runnerTask(AsyncProcessExecutor runner) 
             {
@@ -1222,10 +1247,31 @@ namespace BuildXL.Processes
             }
         }
 
+        /// <summary>
+        /// Asks an already running ptrace runner to trace the given process. Returns false if the runner can't take requests anymore.
+        /// </summary>
+        private bool TrySendPTraceAttachRequest(AsyncProcessExecutor runner, int pid, string path)
+        {
+            try
+            {
+                // CODESYNC: PTraceSandbox::ReadAttachRequests
+                runner.Process.StandardInput.Write($"{pid} {path}\n");
+                runner.Process.StandardInput.Flush();
+                return true;
+            }
+            catch (Exception e) when (e is IOException || e is InvalidOperationException || e is ObjectDisposedException)
+            {
+                // The runner exited: a new one is started for this process
+                LogDebug($"[Pip{PipId}] Failed to send attach request for pid '{pid}' to ptrace runner '{runner.ProcessId}': {e.Message}");
+                return false;
+            }
+        }
+
         private void KillActivePTraceRunners()
         {
             var ptraceRunners = m_ptraceRunners.ToArray();
             m_ptraceRunners.Clear();
+            m_ptraceDaemon = null;
 
             m_ptraceRunnersCancellation.TrySetResult(true);
             foreach (var runner in TaskUtilities.SafeWhenAll(ptraceRunners).GetAwaiter().GetResult())
@@ -0,0 +1,227 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+using System;
+using System.Diagnostics;
+using System.IO;
+using System.IO.MemoryMappedFiles;
+using System.Threading;
+
+#nullable enable
+
+namespace BuildXL.Processes
+{
+    /// <summary>
+    /// Reader of the ring the processes of a pip write their reports to under the Linux sandbox, instead of the reports FIFO
+    /// (see <see cref="FileAccessManifest.EnableLinuxSandboxSharedMemoryReports"/>).
+    /// </summary>
+    /// <remarks>
+    /// The ring is a file mapped by BuildXL and by every process of the pip. Writers reserve records by advancing the tail and publish them
+    /// by setting their state; the reader consumes the published records in order, zeroes them and hands their space back by advancing the head.
+    /// Once the reader finds the ring empty it marks itself idle (see <see cref="Park"/>), and the next writer to publish a record writes
+    /// <see cref="DoorbellSentinel"/> to the FIFO, which is what the reader waits on.
+    /// CODESYNC: Public/Src/Sandbox/Linux/report_ring.hpp
+    /// </remarks>
+    internal sealed unsafe class SharedMemoryReportRing : IDisposable
+    {
+        /// <summary>
+        /// Length of the frame written to the reports FIFO to wake up the reader.
+        /// </summary>
+        public const int DoorbellSentinel = -23;
+
+        /// <summary>
+        /// Bytes of records of a ring: the largest record takes a quarter of them.
+        /// </summary>
+        public const long DefaultCapacity = 4 * 1024 * 1024;
+
+        private const ulong Magic = 0x474E495254505242UL; // "BRPTRING"
+        private const uint Version = 1;
+        private const int HeaderSize = 256;
+        private const int MagicOffset = 0;
+        private const int VersionOffset = 8;
+        private const int CapacityOffset = 16;
+        private const int RecordsOffsetOffset = 24;
+        private const int TailOffset = 64;
+        private const int HeadOffset = 128;
+        private const int ReaderIdleOffset = 192;
+
+        private const int RecordHeaderSize = 8;
+        private const uint RecordReserved = 0;
+        private const uint RecordPublished = 1;
+        private const uint RecordPadding = 2;
+
+        // A record is copied right after it is reserved: one that stays reserved this long belongs to a writer that is gone
+        private static readonly long s_reservedRecordTimeoutTicks = Stopwatch.Frequency * 10;
+
+        private readonly string m_path;
+        private readonly MemoryMappedFile m_file;
+        private readonly MemoryMappedViewAccessor m_view;
+        private readonly byte* m_base;
+        private readonly byte* m_records;
+        private readonly long m_capacity;
+        private long m_head;
+        private bool m_disposed;
+
+        /// <summary>
+        /// Handles the payload of a record, which is only valid for the duration of the call.
+        /// </summary>
+        public delegate void RecordHandler(ReadOnlySpan<byte> payload);
+
+        /// <summary>
+        /// Path of the ring of the pip whose reports FIFO is <paramref name="fifoPath"/>.
+        /// </summary>
+        /// <remarks>
+        /// CODESYNC: Public/Src/Sandbox/Linux/bxl_observer.cpp (InitReportRing)
+        /// </remarks>
+        public static string GetPath(string fifoPath) => fifoPath + ".ring";
+
+        private SharedMemoryReportRing(string path, MemoryMappedFile file, long capacity)
+        {
+            m_path = path;
+            m_file = file;
+            m_capacity = capacity;
+            m_view = file.CreateViewAccessor(0, HeaderSize + capacity);
+
+            byte* pointer = null;
+            m_view.SafeMemoryMappedViewHandle.AcquirePointer(ref pointer);
+            m_base = pointer + m_view.PointerOffset;
+            m_records = m_base + HeaderSize;
+        }
+
+        /// <summary>
+        /// Creates an empty ring of <paramref name="capacity"/> bytes of records (a power of 2) at <paramref name="path"/>.
+        /// </summary>
+        public static SharedMemoryReportRing Create(string path, long capacity = DefaultCapacity)
+        {
+            if (capacity <= 0 || (capacity & (capacity - 1)) != 0)
+            {
+                throw new ArgumentException($"The capacity of a report ring must be a power of 2, not {capacity}", nameof(capacity));
+            }
+
+            // The file is zero-filled: all the records start reserved, and the head and the tail at 0
+            var file = MemoryMappedFile.CreateFromFile(path, FileMode.CreateNew, mapName: null, HeaderSize + capacity);
+            SharedMemoryReportRing ring;
+            try
+            {
+                ring = new SharedMemoryReportRing(path, file, capacity);
+            }
+            catch
+            {
+                file.Dispose();
+                File.Delete(path);
+                throw;
+            }
+
+            *(uint*)(ring.m_base + VersionOffset) = Version;
+            *(long*)(ring.m_base + CapacityOffset) = capacity;
+            *(long*)(ring.m_base + RecordsOffsetOffset) = HeaderSize;
+            *(int*)(ring.m_base + ReaderIdleOffset) = 1;
+
+            // The magic goes last: a process only attaches to a ring that is laid out
+            Volatile.Write(ref *(ulong*)(ring.m_base + MagicOffset), Magic);
+            return ring;
+        }
+
+        /// <summary>
+        /// Calls <paramref name="handler"/> for every published record, in order.
+        /// </summary>
+        /// <remarks>
+        /// With <paramref name="waitForReserved"/>, the records reserved before the call are waited for: everything a process wrote to the ring
+        /// before writing something else to the FIFO is then handled first. Returns false if one of them was never published, in which case
+        /// the ring can't be read any further.
+        /// </remarks>
+        public bool Drain(RecordHandler handler, bool waitForReserved)
+        {
+            long tail = waitForReserved ? Volatile.Read(ref *(long*)(m_base + TailOffset)) : 0;
+            long waitStart = 0;
+            while (true)
+            {
+                long offset = m_head & (m_capacity - 1);
+                byte* record = m_records + offset;
+                uint state = Volatile.Read(ref *(uint*)(record + sizeof(uint)));
+                long size;
+                if (state == RecordPadding)
+                {
+                    size = m_capacity - offset;
+                }
+                else if (state == RecordPublished)
+                {
+                    int length = *(int*)record;
+                    if (length < 0 || offset + RecordHeaderSize + length > m_capacity)
+                    {
+                        return false;
+                    }
+
+                    handler(new ReadOnlySpan<byte>(record + RecordHeaderSize, length));
+                    size = (RecordHeaderSize + length + 7) & ~7L;
+                }
+                else if (m_head < tail)
+                {
+                    // Its writer is still copying it
+                    if (waitStart == 0)
+                    {
+                        waitStart = Stopwatch.GetTimestamp();
+                    }
+                    else if (Stopwatch.GetTimestamp() - waitStart > s_reservedRecordTimeoutTicks)
+                    {
+                        return false;
+                    }
+
+                    Thread.Yield();
+                    continue;
+                }
+                else
+                {
+                    return true;
+                }
+
+                // Writers only reserve space behind the head, which must be zeroed by then
+                new Span<byte>(record, (int)size).Clear();
+                m_head += size;
+                Volatile.Write(ref *(long*)(m_base + HeadOffset), m_head);
+                waitStart = 0;
+            }
+        }
+
+        /// <summary>
+        /// Marks the reader idle once it drained the ring, so the next record published wakes it up. Returns false if a record
+        /// was published in the meantime, in which case the ring must be drained (and parked) again.
+        /// </summary>
+        public bool Park()
+        {
+            // Full fences, so that either the writer of a record sees the reader idle or the reader sees the record
+            Interlocked.Exchange(ref *(int*)(m_base + ReaderIdleOffset), 1);
+            uint state = Volatile.Read(ref *(uint*)(m_records + (m_head & (m_capacity - 1)) + sizeof(uint)));
+            if (state == RecordReserved)
+            {
+                return true;
+            }
+
+            Interlocked.Exchange(ref *(int*)(m_base + ReaderIdleOffset), 0);
+            return false;
+        }
+
+        /// <inheritdoc/>
+        public void Dispose()
+        {
+            if (m_disposed)
+            {
+                return;
+            }
+
+            m_disposed = true;
+            m_view.SafeMemoryMappedViewHandle.ReleasePointer();
+            m_view.Dispose();
+            m_file.Dispose();
+
+            try
+            {
+                File.Delete(m_path);
+            }
+            catch (Exception e) when (e is IOException || e is UnauthorizedAccessException)
+            {
+                // Best effort: the ring is removed along with the rest of the temporary files otherwise
+            }
+        }
+    }
+}
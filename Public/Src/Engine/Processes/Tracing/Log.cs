@@ -511,7 +511,7 @@ namespace BuildXL.Processes.Tracing
             EventLevel = Level.Verbose,
             Keywords = (int)Keywords.Diagnostics,
             EventTask = (int)Tasks.PipExecutor,
-            Message = EventConstants.PipPrefix + "Maximum detours heap size for process in the pip is {maxDetoursHeapSizeInBytes} bytes. The processName '{processName}'. The processId is: {processId}. The manifestSize in bytes is: {manifestSizeInBytes}. The finalDetoursHeapSize in bytes is: {finalDetoursHeapSizeInBytes}. The allocatedPoolEntries is: {allocatedPoolEntries}. The maxHandleMapEntries is: {maxHandleMapEntries}. The handleMapEntries is: {handleMapEntries}.")]
+            Message = EventConstants.PipPrefix + "Maximum detours heap size for process in the pip is {maxDetoursHeapSizeInBytes} bytes. The processName '{processName}'. The processId is: {processId}. The manifestSize in bytes is: {manifestSizeInBytes}. The finalDetoursHeapSize in bytes is: {finalDetoursHeapSizeInBytes}. The allocatedPoolEntries is: {allocatedPoolEntries}. The maxHandleMapEntries is: {maxHandleMapEntries}. The handleMapEntries is: {handleMapEntries}. The policy search cache hits/misses are: {policySearchCacheHits}/{policySearchCacheMisses}.")]
         public abstract void LogDetoursMaxHeapSize(
             LoggingContext context,
             long pipSemiStableHash,
@@ -523,7 +523,24 @@ namespace BuildXL.Processes.Tracing
             ulong finalDetoursHeapSizeInBytes,
             uint allocatedPoolEntries,
             ulong maxHandleMapEntries,
-            ulong handleMapEntries);
+            ulong handleMapEntries,
+            ulong policySearchCacheHits,
+            ulong policySearchCacheMisses);
+
+        [GeneratedEvent(
+            (int)LogEventId.LogDetoursPerformanceCounters,
+            EventGenerators = EventGenerators.LocalOnly,
+            EventLevel = Level.Verbose,
+            Keywords = (int)Keywords.Diagnostics,
+            EventTask = (int)Tasks.PipExecutor,
+            Message = EventConstants.PipPrefix + "Detours performance counters of process '{processName}' ({processId}): {performanceCounters}")]
+        public abstract void LogDetoursPerformanceCounters(
+            LoggingContext context,
+            long pipSemiStableHash,
+            string pipDescription,
+            string processName,
+            uint processId,
+            string performanceCounters);
 
         [GeneratedEvent(
             (int)LogEventId.LogInternalDetoursErrorFileNotEmpty,
@@ -129,6 +129,7 @@ namespace BuildXL.Processes.Tracing
         LogDetoursMaxHeapSize = 2928,
         // Moved to BuildXL.Native
         // MoreBytesWrittenThanBufferSize = 2930,
+        LogDetoursPerformanceCounters = 2931,
 
         //DominoProcessesStart = 4400,
         PipProcessUncacheableAllowlistNotAllowedInDistributedBuilds = 4401,
@@ -6284,6 +6284,7 @@ namespace BuildXL.Scheduler
                             {
                                 ReportQueueSizeMB = m_configuration.Sandbox.KextReportQueueSizeMb,
                                 EnableReportBatching = m_configuration.Sandbox.KextEnableReportBatching,
+                                ReportCoalescingWindowMs = m_configuration.Sandbox.KextReportCoalescingWindowMs,
 #if !PLATFORM_WIN
                                 EnableCatalinaDataPartitionFiltering = OperatingSystemHelperExtension.IsMacWithoutKernelExtensionSupport,
 #endif
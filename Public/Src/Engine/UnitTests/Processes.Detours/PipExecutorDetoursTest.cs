@@ -4232,6 +4232,43 @@ namespace Test.BuildXL.Processes.Detours
             }
         }
 
+        [Fact]
+        public async Task TimestampsBenchmark()
+        {
+            var context = BuildXLContext.CreateInstanceForTesting();
+            var pathTable = context.PathTable;
+
+            using (var tempFiles = new TempFileStorage(canGetFileNames: true, rootPath: TemporaryDirectory))
+            {
+                AbsolutePath workingDirectoryAbsolutePath = AbsolutePath.Create(pathTable, tempFiles.RootDirectory);
+                FileArtifact inputArtifact = WriteFile(pathTable, tempFiles.GetFileName(pathTable, workingDirectoryAbsolutePath, "input"), "Useful data");
+
+                // The test queries the metadata of the input repeatedly and writes the time per query to its output
+                var process = CreateDetourProcess(
+                    context,
+                    pathTable,
+                    tempFiles,
+                    argumentStr: "TimestampsBenchmark",
+                    inputFiles: ReadOnlyArray<FileArtifact>.FromWithoutCopy(inputArtifact),
+                    inputDirectories: ReadOnlyArray<DirectoryArtifact>.Empty,
+                    outputFiles: ReadOnlyArray<FileArtifactWithAttributes>.Empty,
+                    outputDirectories: ReadOnlyArray<DirectoryArtifact>.Empty,
+                    untrackedScopes: ReadOnlyArray<AbsolutePath>.Empty);
+
+                SandboxConfiguration sandboxConfiguration = new SandboxConfiguration
+                {
+                    FileAccessIgnoreCodeCoverage = true,
+                    NormalizeReadTimestamps = true
+                };
+
+                sandboxConfiguration.UnsafeSandboxConfigurationMutable.UnexpectedFileAccessesAreErrors = true;
+                await AssertProcessSucceedsAsync(
+                    context,
+                    sandboxConfiguration,
+                    process);
+            }
+        }
+
         [Fact]
         public async Task TestUseLargeNtClosePreallocatedList()
         {
@@ -8378,6 +8415,97 @@ namespace Test.BuildXL.Processes.Detours
             }
         }
 
+        [Fact]
+        public async Task CallProcessStartupTest()
+        {
+            var context = BuildXLContext.CreateInstanceForTesting();
+            var pathTable = context.PathTable;
+
+            using (var tempFiles = new TempFileStorage(canGetFileNames: true, rootPath: TemporaryDirectory))
+            {
+                // Child processes only decode the path translations if they need them, so give them some they never use
+                var directoriesToTranslate = new List<TranslateDirectoryData>();
+                for (int i = 0; i < 50; i++)
+                {
+                    string fromPath = tempFiles.GetDirectory($"From{i}");
+                    string toPath = tempFiles.GetDirectory($"To{i}");
+                    directoriesToTranslate.Add(new TranslateDirectoryData(
+                        fromPath + @"\<" + toPath + @"\",
+                        AbsolutePath.Create(pathTable, fromPath),
+                        AbsolutePath.Create(pathTable, toPath)));
+                }
+
+                // The test spawns itself repeatedly and writes the average startup time of the child processes to its output
+                var process = CreateDetourProcess(
+                    context,
+                    pathTable,
+                    tempFiles,
+                    argumentStr: "CallProcessStartupTest",
+                    inputFiles: ReadOnlyArray<FileArtifact>.Empty,
+                    inputDirectories: ReadOnlyArray<DirectoryArtifact>.Empty,
+                    outputFiles: ReadOnlyArray<FileArtifactWithAttributes>.Empty,
+                    outputDirectories: ReadOnlyArray<DirectoryArtifact>.Empty,
+                    untrackedScopes: ReadOnlyArray<AbsolutePath>.Empty);
+
+                SandboxedProcessPipExecutionResult result = await RunProcessAsync(
+                    pathTable: pathTable,
+                    ignoreSetFileInformationByHandle: false,
+                    ignoreZwRenameFileInformation: false,
+                    monitorNtCreate: true,
+                    ignoreReparsePoints: false,
+                    disableDetours: false,
+                    context: context,
+                    pip: process,
+                    errorString: out _,
+                    directoriesToTranslate: directoriesToTranslate);
+
+                VerifyNormalSuccess(context, result);
+            }
+        }
+
+        [Theory]
+        [InlineData(false)]
+        [InlineData(true)]
+        public async Task ApiBenchmark(bool disableDetours)
+        {
+            var context = BuildXLContext.CreateInstanceForTesting();
+            var pathTable = context.PathTable;
+
+            using (var tempFiles = new TempFileStorage(canGetFileNames: true, rootPath: TemporaryDirectory))
+            {
+                AbsolutePath workingDirectoryAbsolutePath = AbsolutePath.Create(pathTable, tempFiles.RootDirectory);
+                FileArtifact inputArtifact = WriteFile(pathTable, tempFiles.GetFileName(pathTable, workingDirectoryAbsolutePath, "input"), "Useful data");
+                FileArtifact copyArtifact = FileArtifact.CreateOutputFile(tempFiles.GetFileName(pathTable, workingDirectoryAbsolutePath, "ApiBenchmarkCopy"));
+
+                // The test calls each benchmarked API repeatedly and writes a line per API to its output, comparing
+                // the lines of the runs with and without Detours gives the overhead of the sandbox
+                var process = CreateDetourProcess(
+                    context,
+                    pathTable,
+                    tempFiles,
+                    argumentStr: "ApiBenchmark",
+                    inputFiles: ReadOnlyArray<FileArtifact>.FromWithoutCopy(inputArtifact),
+                    inputDirectories: ReadOnlyArray<DirectoryArtifact>.Empty,
+                    outputFiles: ReadOnlyArray<FileArtifactWithAttributes>.FromWithoutCopy(copyArtifact.WithAttributes()),
+                    outputDirectories: ReadOnlyArray<DirectoryArtifact>.Empty,
+                    untrackedScopes: ReadOnlyArray<AbsolutePath>.Empty);
+
+                SandboxedProcessPipExecutionResult result = await RunProcessAsync(
+                    pathTable: pathTable,
+                    ignoreSetFileInformationByHandle: false,
+                    ignoreZwRenameFileInformation: false,
+                    monitorNtCreate: true,
+                    ignoreReparsePoints: false,
+                    disableDetours: disableDetours,
+                    context: context,
+                    pip: process,
+                    errorString: out _,
+                    unexpectedFileAccessesAreErrors: false);
+
+                VerifyNormalSuccess(context, result);
+            }
+        }
+
         private static Process CreateDetourProcess(
             BuildXLContext context,
             PathTable pathTable,
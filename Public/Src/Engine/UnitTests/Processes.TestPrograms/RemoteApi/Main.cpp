@@ -22,11 +22,26 @@
 //  EnumerateFileOrDirectoryByHandle: Takes a path parameter to open (e.g. C:\directory\) and enumerates members via NtQueryDirectoryFile.
 //                             Returns 0 on success or 1 on failure (note that success is returned if enumeration proceeded, even if no matches were found or if
 //                             the search path turned out to be a file rather than a directory).
+//
+// Batch format (RemoteApi.exe /batch, sent over stdin, all integers are little-endian uint32):
+//   commandCount, threadCount, repetitions, then commandCount commands, each made of
+//   stringCount, then stringCount strings (the command name then its parameters), each made of
+//   length, then length UTF-16 code units.
+// Batches follow each other until the end of stdin. The commands of a batch run repetitions times, on
+// threadCount threads (on the main thread if it is 0 or 1), so detours can be stressed concurrently.
+// Response format (sent over stdout, one line per batch):
+//   Batch,commandCount,results ; results holds a character per command, in batch order: 0 if all its runs
+//   succeeded or 1 if any failed.
 // TODO: These functions should be exposed as a Bond service. For now, we're starting with a trivial text format.
 
 #include "stdafx.h"
 #include "Command.h"
 
+#include <atomic>
+#include <fcntl.h>
+#include <io.h>
+#include <thread>
+
 // warning C6387: 'buffer' could be '0'.
 // warning C26493: Don't use C-style casts (type.4).
 // warning C26426: Global initializer calls a non-constexpr function 'operator new' (i.22).
@@ -152,12 +167,137 @@ static CommandBase const* Commands[] = {
     nullptr
 };
 
+static CommandBase const* FindCommand(std::wstring const& commandName) {
+    for (CommandBase const** c = Commands; *c != nullptr; c++) {
+        if ((*c)->commandName == commandName) {
+            return *c;
+        }
+    }
+
+    return nullptr;
+}
+
+static bool ReadBatchInteger(uint32_t& value) {
+    return fread(&value, sizeof(value), 1, stdin) == 1;
+}
+
+static bool ReadBatchString(std::wstring& value) {
+    uint32_t length = 0;
+    if (!ReadBatchInteger(length)) {
+        return false;
+    }
+
+    value.resize(length);
+    return length == 0 || fread(&value[0], sizeof(wchar_t), length, stdin) == length;
+}
+
+static int RunBatches() {
+    (void)_setmode(_fileno(stdin), _O_BINARY);
+
+    for ( ; ; ) {
+        uint32_t commandCount = 0;
+        if (!ReadBatchInteger(commandCount)) {
+            if (feof(stdin)) {
+                return 0;
+            }
+
+            std::wcerr << L"Stream failure while reading a batch." << std::endl;
+            return 5;
+        }
+
+        uint32_t threadCount = 0;
+        uint32_t repetitions = 0;
+        if (!ReadBatchInteger(threadCount) || !ReadBatchInteger(repetitions)) {
+            std::wcerr << L"Stream failure while reading a batch." << std::endl;
+            return 5;
+        }
+
+        std::vector<std::vector<std::wstring>> parameters(commandCount);
+        std::vector<CommandBase const*> commands(commandCount);
+        for (uint32_t i = 0; i < commandCount; i++) {
+            uint32_t stringCount = 0;
+            if (!ReadBatchInteger(stringCount)) {
+                std::wcerr << L"Stream failure while reading a batch." << std::endl;
+                return 5;
+            }
+
+            if (stringCount == 0) {
+                std::wcerr << L"Bad batch format. Expected a command name followed by zero or more parameters." << std::endl;
+                return 2;
+            }
+
+            parameters[i].resize(stringCount);
+            for (std::wstring& parameter : parameters[i]) {
+                if (!ReadBatchString(parameter)) {
+                    std::wcerr << L"Stream failure while reading a batch." << std::endl;
+                    return 5;
+                }
+            }
+
+            commands[i] = FindCommand(parameters[i][0]);
+            if (commands[i] == nullptr) {
+                std::wcerr << L"Unknown command name. Actual: '" << parameters[i][0] << "'" << std::endl;
+                return 3;
+            }
+
+            if (commands[i]->requiredParameters + 1 != stringCount) {
+                std::wcerr
+                    << L"Wrong number of parameters for " << parameters[i][0]
+                    << L". Expected: " << commands[i]->requiredParameters << " Actual: '" << (stringCount - 1) << "'" << std::endl;
+                return 4;
+            }
+        }
+
+        // Runs are handed out round-robin over the commands, so concurrent threads run different commands
+        std::unique_ptr<std::atomic<bool>[]> failed(new std::atomic<bool>[commandCount]);
+        for (uint32_t i = 0; i < commandCount; i++) {
+            failed[i] = false;
+        }
+
+        const uint64_t runCount = (uint64_t)commandCount * repetitions;
+        std::atomic<uint64_t> nextRun{ 0 };
+        auto runCommands = [&]() {
+            for (uint64_t run = nextRun++; run < runCount; run = nextRun++) {
+                const size_t i = (size_t)(run % commandCount);
+                if (commands[i]->InvokeIfMatches(parameters[i]) != CommandInvocationResult::Success) {
+                    failed[i] = true;
+                }
+            }
+        };
+
+        if (threadCount <= 1) {
+            runCommands();
+        }
+        else {
+            std::vector<std::thread> threads;
+            for (uint32_t t = 0; t < threadCount; t++) {
+                threads.emplace_back(runCommands);
+            }
+
+            for (std::thread& thread : threads) {
+                thread.join();
+            }
+        }
+
+        std::wstring results(commandCount, L'0');
+        for (uint32_t i = 0; i < commandCount; i++) {
+            if (failed[i]) {
+                results[i] = L'1';
+            }
+        }
+
+        std::wcout << L"Batch," << commandCount << L"," << results << std::endl;
+    }
+}
+
 int main(int argc, char **argv)
 {
-    std::ignore = argv; // Unused
+    if (argc == 2 && strcmp(argv[1], "/batch") == 0) {
+        return RunBatches();
+    }
 
     if (argc != 1) {
-        std::wcerr << L"No arguments expected. API commands are expected over stdin." << std::endl;
+        std::wcerr << L"No arguments expected (or /batch). API commands are expected over stdin." << std::endl;
         return 1;
     }
 
@@ -347,6 +347,63 @@ namespace Test.BuildXL.Processes
             XAssert.AreEqual(Content, messages[0]);
         }
 
+        [FactIfSupported(requiresWindowsBasedOperatingSystem: true)]
+        public async Task TestReadFramesAsync()
+        {
+            Pipes.CreateInheritablePipe(
+                Pipes.PipeInheritance.InheritWrite,
+                Pipes.PipeFlags.ReadSideAsync,
+                readHandle: out SafeFileHandle readHandle,
+                writeHandle: out SafeFileHandle writeHandle);
+
+            IAsyncFile readFile = AsyncFileFactory.CreateAsyncFile(
+                readHandle,
+                FileDesiredAccess.GenericRead,
+                ownsHandle: true,
+                kind: FileKind.Pipe);
+
+            var messages = new List<string>();
+
+            using var reader = new AsyncPipeReader(
+                readFile,
+                frame =>
+                {
+                    messages.Add(BinaryFileAccessReport.GetTextLine(frame));
+                    return true;
+                },
+                SandboxedProcessInfo.BufferSize);
+            reader.BeginReadLine();
+
+            // Frames larger than the read buffer, and frames split across writes, must come out whole
+            string bigContent = string.Join(" ", Enumerable.Range(1, 10_000).Select(i => $"{nameof(TestReadFramesAsync)}"));
+            var contents = new[] { "first", bigContent, "third\r\nwith line breaks", "last" };
+            byte[] frames = contents
+                .SelectMany(content => BinaryFileAccessReport.CreateTextLineFrame(Encoding.Unicode.GetBytes(content + "\r\n")))
+                .ToArray();
+
+            Task readTask = Task.Run(async () =>
+            {
+                await reader.WaitUntilEofAsync();
+            });
+
+            Task writeTask = Task.Run(async () =>
+            {
+                const int ChunkSize = 1000;
+                for (int offset = 0; offset < frames.Length; offset += ChunkSize)
+                {
+                    byte[] chunk = frames.Skip(offset).Take(ChunkSize).ToArray();
+                    XAssert.IsTrue(FileUtilities.TryWriteFileSync(writeHandle, chunk, out int _));
+                    await Task.Delay(1);
+                }
+
+                writeHandle.Dispose();
+            });
+
+            await Task.WhenAll(readTask, writeTask);
+
+            XAssert.AreArraysEqual(contents, messages.ToArray(), expectedResult: true);
+        }
+
         private static bool TryWrite(SafeFileHandle handle, string content, out int error)
         {
             byte[] byteContent = Encoding.Unicode.GetBytes(content);
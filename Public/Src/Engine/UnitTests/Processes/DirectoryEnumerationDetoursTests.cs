@@ -4,6 +4,7 @@
 using System.Threading.Tasks;
 using BuildXL.Processes;
 using BuildXL.Utilities.Core;
+using Test.BuildXL.TestUtilities.Xunit;
 using Xunit;
 
 namespace Test.BuildXL.Processes
@@ -343,5 +344,30 @@ namespace Test.BuildXL.Processes
         }
 
         #endregion
+
+        #region Batches
+
+        [Fact]
+        public async Task EnumerateConcurrentlyInBatch()
+        {
+            var pathTable = new PathTable();
+
+            AbsolutePath dirPath = CreateDirectory(pathTable, @"dir");
+            WriteEmptyFile(pathTable, @"dirileA");
+            WriteEmptyFile(pathTable, @"dirileB");
+
+            SandboxedProcessResult result = await RunRemoteApiBatchInSandboxAsync(
+                pathTable,
+                manifest => { manifest.AddScope(dirPath, FileAccessPolicy.MaskNothing, FileAccessPolicy.AllowReadAlways); },
+                threadCount: 4,
+                repetitions: 1000,
+                EnumerateWithFindFirstFileEx(@"dir\*"),
+                EnumerateFileOrDirectoryByHandle(@"dir"));
+
+            string output = await result.StandardOutput.ReadValueAsync();
+            XAssert.AreEqual("Batch,2,00", output.Trim());
+        }
+
+        #endregion
     }
 }
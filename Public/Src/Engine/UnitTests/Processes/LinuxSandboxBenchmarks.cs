@@ -0,0 +1,238 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+using System;
+using System.Collections.Generic;
+using System.IO;
+using System.Linq;
+using System.Text.RegularExpressions;
+using BuildXL.Pips;
+using BuildXL.Pips.Operations;
+using BuildXL.Processes;
+using BuildXL.Utilities.Collections;
+using BuildXL.Utilities.Core;
+using Test.BuildXL.TestUtilities;
+using Test.BuildXL.TestUtilities.Xunit;
+using Xunit;
+using Xunit.Abstractions;
+
+#nullable enable
+
+namespace Test.BuildXL.Processes
+{
+    /// <summary>
+    /// Times the hot paths of the Linux sandboxes: each workload of 'Public/Src/Sandbox/Linux/UnitTests/TestProcesses/BenchmarkProcess/main.cpp'
+    /// runs once without any sandboxing and once under libDetours.so, and the results are written to the test output as ns/op and reports/op.
+    /// The statically linked build of the workloads runs under the ptrace sandbox instead (see <see cref="PTraceBenchmark"/>).
+    /// </summary>
+    /// <remarks>
+    /// These are measurements rather than tests, so they are skipped in regular runs. Reports are counted with
+    /// <see cref="SandboxedProcessFactory.SandboxedProcessCounters.AccessReportCount"/>, which is process-wide: don't run these
+    /// concurrently with other sandboxed process tests. The reports every process sends regardless of the workload (process start,
+    /// loader probes, etc.) are measured with an empty workload and discounted.
+    /// </remarks>
+    [Trait("Category", "QTestSkip")]
+    [Trait("Category", "Performance")]
+    [TestClassIfSupported(requiresLinuxBasedOperatingSystem: true)]
+    public sealed class LinuxSandboxBenchmarks : SandboxedProcessTestBase
+    {
+        private static readonly Regex s_resultRegex = new Regex(@"workload=(?<workload>\S+) ops=(?<ops>\d+) ns=(?<ns>\d+)");
+
+        private ITestOutputHelper TestOutput { get; }
+
+        private string BenchmarkProcessExe => Path.Combine(TestBinRoot, "LinuxTestProcesses", "LinuxBenchmarkProcess");
+
+        private string StaticallyLinkedBenchmarkProcessExe => Path.Combine(TestBinRoot, "LinuxTestProcesses", "LinuxBenchmarkProcessStaticallyLinked");
+
+        private enum SandboxMode
+        {
+            None,
+            Interpose,
+            PTrace,
+        }
+
+        /// <summary>
+        /// The counters of Public/Src/Sandbox/Linux/access_statistics.hpp (PipAccessStatistics) these benchmarks look at.
+        /// </summary>
+        private readonly record struct TracerStatistics(long Stops, long SyscallStops, long StopNs, long CpuNs);
+
+        // CODESYNC: Public/Src/Sandbox/Linux/access_statistics.hpp (PipAccessStatistics)
+        private const ulong AccessStatisticsMagic = 0x53544154534c5842UL;
+        private const int TracerStopsOffset = 112;
+        private const int AccessStatisticsSize = 144;
+
+        public LinuxSandboxBenchmarks(ITestOutputHelper output)
+            : base(output)
+        {
+            RegisterEventSource(global::BuildXL.Processes.ETWLogger.Log);
+            TestOutput = output;
+        }
+
+        [Theory]
+        [InlineData("stat", 200000)]
+        [InlineData("openclose", 200000)]
+        [InlineData("openwrite", 100000)]
+        [InlineData("renametree", 100000)]
+        [InlineData("symlinks", 100000)]
+        [InlineData("forkexec", 200)]
+        [InlineData("forktree", 200)]
+        [InlineData("contention", 400000)]
+        [InlineData("walk", 20)]
+        public void Benchmark(string workload, int operations)
+        {
+            XAssert.IsTrue(File.Exists(BenchmarkProcessExe), $"Benchmark executable '{BenchmarkProcessExe}' not found.");
+
+            using var workingDirectory = new TempFileStorage(canGetFileNames: true);
+            Run(workingDirectory, SandboxMode.None, "-p", "-w", workload);
+
+            // Warm up the file system caches before timing anything
+            Run(workingDirectory, SandboxMode.None, "-w", workload, "-n", operations.ToString());
+
+            var (bareNs, bareOps, _) = Run(workingDirectory, SandboxMode.None, "-w", workload, "-n", operations.ToString());
+            var (_, _, baselineReports) = Run(workingDirectory, SandboxMode.Interpose, "-w", "noop");
+            var (sandboxedNs, sandboxedOps, reports) = Run(workingDirectory, SandboxMode.Interpose, "-w", workload, "-n", operations.ToString());
+
+            double bareNsPerOp = (double)bareNs / bareOps;
+            double sandboxedNsPerOp = (double)sandboxedNs / sandboxedOps;
+            double reportsPerOp = (double)(reports - baselineReports) / sandboxedOps;
+            TestOutput.WriteLine($"{workload}: bare {bareNsPerOp:F0} ns/op, sandboxed {sandboxedNsPerOp:F0} ns/op ({sandboxedNsPerOp / bareNsPerOp:F2}x), {reportsPerOp:F3} reports/op");
+        }
+
+        /// <summary>
+        /// Runs the statically linked workloads bare and under the ptrace sandbox, and writes the tracer stops per second, the latency each
+        /// system call the tracer inspects adds to the workload, the time the tracer spends handling a stop and the CPU the tracers use.
+        /// </summary>
+        /// <remarks>
+        /// The tracer counters are kept by the ptrace runners in a statistics file of the pip (see BxlEnvAccessStatisticsPath).
+        /// The added latency is the difference with the bare run spread over the system call stops, so it includes the context switches.
+        /// </remarks>
+        [Theory]
+        [InlineData("stat", 20000)]
+        [InlineData("openclose", 20000)]
+        [InlineData("openwrite", 20000)]
+        [InlineData("renametree", 20000)]
+        [InlineData("forktree", 100)]
+        public void PTraceBenchmark(string workload, int operations)
+        {
+            XAssert.IsTrue(File.Exists(StaticallyLinkedBenchmarkProcessExe), $"Benchmark executable '{StaticallyLinkedBenchmarkProcessExe}' not found.");
+
+            using var workingDirectory = new TempFileStorage(canGetFileNames: true);
+            string exe = StaticallyLinkedBenchmarkProcessExe;
+            Run(exe, workingDirectory, SandboxMode.None, out _, "-p", "-w", workload);
+            Run(exe, workingDirectory, SandboxMode.None, out _, "-w", workload, "-n", operations.ToString());
+
+            var (bareNs, bareOps, _) = Run(exe, workingDirectory, SandboxMode.None, out _, "-w", workload, "-n", operations.ToString());
+            var (tracedNs, tracedOps, reports) = Run(exe, workingDirectory, SandboxMode.PTrace, out var tracer, "-w", workload, "-n", operations.ToString());
+            XAssert.IsTrue(tracer.Stops > 0, "The ptrace runner counted no stops: the workload may not have been traced.");
+
+            double bareNsPerOp = (double)bareNs / bareOps;
+            double tracedNsPerOp = (double)tracedNs / tracedOps;
+            double stopsPerSecond = tracer.Stops / (tracedNs / 1e9);
+            double addedNsPerSyscall = tracer.SyscallStops > 0 ? (double)(tracedNs - bareNs * tracedOps / bareOps) / tracer.SyscallStops : 0;
+            TestOutput.WriteLine(
+                $"{workload}: bare {bareNsPerOp:F0} ns/op, ptrace {tracedNsPerOp:F0} ns/op ({tracedNsPerOp / bareNsPerOp:F2}x), "
+                + $"{reports / (double)tracedOps:F3} reports/op, {stopsPerSecond:F0} stops/s ({tracer.SyscallStops} of {tracer.Stops} for system calls), "
+                + $"+{addedNsPerSyscall:F0} ns/syscall, {(double)tracer.StopNs / tracer.Stops:F0} ns handling/stop, tracer CPU {tracer.CpuNs / 1e6:F1} ms");
+        }
+
+        private (long ns, long ops, long reports) Run(TempFileStorage workingDirectory, SandboxMode sandbox, params string[] args)
+            => Run(BenchmarkProcessExe, workingDirectory, sandbox, out _, args);
+
+        /// <summary>
+        /// Runs the benchmark process and returns the elapsed time and operation count it printed, and the number of access reports it sent.
+        /// Under the ptrace sandbox, 'tracer' gets what the ptrace runners counted.
+        /// </summary>
+        private (long ns, long ops, long reports) Run(string exe, TempFileStorage workingDirectory, SandboxMode sandbox, out TracerStatistics tracer, params string[] args)
+        {
+            var executable = FileArtifact.CreateSourceFile(AbsolutePath.Create(Context.PathTable, exe));
+            var arguments = new PipDataBuilder(Context.PathTable.StringTable);
+            foreach (var arg in args)
+            {
+                arguments.Add(arg);
+            }
+
+            var pip = new Process(
+                executable,
+                AbsolutePath.Create(Context.PathTable, workingDirectory.RootDirectory),
+                arguments.ToPipData(" ", PipDataFragmentEscaping.NoEscaping),
+                FileArtifact.Invalid,
+                PipData.Invalid,
+                ReadOnlyArray<EnvironmentVariable>.Empty,
+                FileArtifact.Invalid,
+                FileArtifact.Invalid,
+                FileArtifact.Invalid,
+                workingDirectory.GetUniqueDirectory(Context.PathTable),
+                null,
+                null,
+                dependencies: ReadOnlyArray<FileArtifact>.FromWithoutCopy(executable),
+                outputs: ReadOnlyArray<FileArtifactWithAttributes>.Empty,
+                directoryDependencies: ReadOnlyArray<DirectoryArtifact>.Empty,
+                directoryOutputs: ReadOnlyArray<DirectoryArtifact>.Empty,
+                orderDependencies: ReadOnlyArray<PipId>.Empty,
+                untrackedPaths: ReadOnlyArray<AbsolutePath>.Empty,
+                untrackedScopes: ReadOnlyArray<AbsolutePath>.Empty,
+                tags: ReadOnlyArray<StringId>.Empty,
+                successExitCodes: ReadOnlyArray<int>.FromWithoutCopy(0),
+                semaphores: ReadOnlyArray<ProcessSemaphoreInfo>.Empty,
+                provenance: PipProvenance.CreateDummy(Context),
+                toolDescription: StringId.Invalid,
+                additionalTempDirectories: ReadOnlyArray<AbsolutePath>.Empty);
+
+            var processInfo = ToProcessInfo(pip, workingDirectory: workingDirectory.RootDirectory);
+            processInfo.FileAccessManifest.ReportFileAccesses = true;
+            processInfo.FileAccessManifest.MonitorChildProcesses = true;
+            processInfo.FileAccessManifest.FailUnexpectedFileAccesses = false;
+            if (sandbox == SandboxMode.None)
+            {
+                processInfo.SandboxKind = SandboxKind.None;
+            }
+
+            string? statisticsPath = null;
+            if (sandbox == SandboxMode.PTrace)
+            {
+                processInfo.FileAccessManifest.EnableLinuxPTraceSandbox = true;
+
+                statisticsPath = Path.Combine(workingDirectory.GetUniqueDirectory(), "statistics");
+#if NETCOREAPP
+                var environment = new Dictionary<string, string>(processInfo.EnvironmentVariables!.ToDictionary());
+#else
+                var environment = new Dictionary<string, string>(processInfo.EnvironmentVariables!.ToDictionary().ToDictionary(x => x.Key, x => x.Value));
+#endif
+                environment[SandboxConnectionLinuxDetours.BuildXLAccessStatisticsPathEnvVarName] = statisticsPath;
+                processInfo.EnvironmentVariables = BuildParameters.GetFactory().PopulateFromDictionary(environment);
+            }
+
+            long reportsBefore = SandboxedProcessFactory.Counters.GetCounterValue(SandboxedProcessFactory.SandboxedProcessCounters.AccessReportCount);
+            SandboxedProcessResult result;
+            using (var process = StartProcessAsync(processInfo, forceSandboxing: sandbox != SandboxMode.None).GetAwaiter().GetResult())
+            {
+                result = process.GetResultAsync().GetAwaiter().GetResult();
+            }
+
+            long reports = SandboxedProcessFactory.Counters.GetCounterValue(SandboxedProcessFactory.SandboxedProcessCounters.AccessReportCount) - reportsBefore;
+            string stdout = result.StandardOutput!.ReadValueAsync().GetAwaiter().GetResult();
+            XAssert.AreEqual(0, result.ExitCode, $"Benchmark process failed. stdout: {stdout}{System.Environment.NewLine}stderr: {result.StandardError!.ReadValueAsync().GetAwaiter().GetResult()}");
+
+            tracer = statisticsPath != null ? ReadTracerStatistics(statisticsPath) : default;
+
+            var match = s_resultRegex.Match(stdout);
+            return match.Success
+                ? (long.Parse(match.Groups["ns"].Value), long.Parse(match.Groups["ops"].Value), reports)
+                : (0, 0, reports);
+        }
+
+        private static TracerStatistics ReadTracerStatistics(string path)
+        {
+            if (!File.Exists(path))
+            {
+                return default;
+            }
+
+            byte[] bytes = File.ReadAllBytes(path);
+            XAssert.IsTrue(bytes.Length >= AccessStatisticsSize && BitConverter.ToUInt64(bytes, 0) == AccessStatisticsMagic, $"Unexpected statistics file '{path}'.");
+
+            long counter(int index) => (long)BitConverter.ToUInt64(bytes, TracerStopsOffset + index * sizeof(ulong));
+            return new TracerStatistics(Stops: counter(0), SyscallStops: counter(1), StopNs: counter(2), CpuNs: counter(3));
+        }
+    }
+}
@@ -898,6 +898,37 @@ namespace Test.BuildXL.Processes
             }
         }
 
+        [Theory]
+        [InlineData(false, false)]
+        [InlineData(true, false)]
+        [InlineData(true, true)]
+        public void CallTestConcurrentReports(bool batchReports, bool asyncReports)
+        {
+            // CODESYNC: Public/Src/Sandbox/Linux/UnitTests/TestProcesses/TestProcess/main.cpp
+            const int Threads = 8;
+            const int FilesPerThread = 64;
+
+            var result = RunNativeTest(GetNativeTestName(MethodBase.GetCurrentMethod().Name), manifest =>
+            {
+                manifest.EnableLinuxSandboxReportBatching = batchReports;
+                manifest.EnableLinuxSandboxAsyncReporting = asyncReports;
+            });
+
+            var writtenPaths = result.result.FileAccesses
+                .Where(access => access.RequestedAccess.HasFlag(RequestedAccess.Write))
+                .Select(access => access.ManifestPath.ToString(Context.PathTable))
+                .ToHashSet();
+
+            for (int t = 0; t < Threads; t++)
+            {
+                for (int i = 0; i < FilesPerThread; i++)
+                {
+                    var path = Path.Combine(result.rootDirectory, $"concurrent_{t}_{i}");
+                    XAssert.IsTrue(writtenPaths.Contains(path), $"The creation of '{path}' was not reported");
+                }
+            }
+        }
+
         /// <summary>
         /// Some stat tests don't run depending on the glibc version on the machine
         /// </summary>
@@ -919,7 +950,7 @@ namespace Test.BuildXL.Processes
             return functionName.Replace("CallTest", "");
         }
 
-        private (SandboxedProcessResult result, string rootDirectory) RunNativeTest(string testName)
+        private (SandboxedProcessResult result, string rootDirectory) RunNativeTest(string testName, Action<FileAccessManifest> configureManifest = null)
         {
             using var tempFiles = new TempFileStorage(canGetFileNames: true);
             var process = CreateTestProcess(
@@ -937,6 +968,7 @@ namespace Test.BuildXL.Processes
             processInfo.FileAccessManifest.MonitorChildProcesses = true;
             processInfo.FileAccessManifest.FailUnexpectedFileAccesses = false;
             processInfo.FileAccessManifest.EnableLinuxSandboxLogging = true;
+            configureManifest?.Invoke(processInfo.FileAccessManifest);
 
             var result = RunProcess(processInfo).Result;
             
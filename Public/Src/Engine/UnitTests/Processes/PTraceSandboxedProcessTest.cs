@@ -101,6 +101,53 @@ namespace Test.BuildXL.Processes
             XAssert.IsTrue(intersection.Count == expectedAccesses.Count, $"Ptrace sandbox did not report the following accesses: {string.Join("\n", expectedAccesses.Except(intersection).ToList())}");
         }
 
+        [Fact]
+        public async Task DynamicallyLinkedProcessExecutedByTracedProcessIsHandedOffToInterposition()
+        {
+            PrepareStaticallyLinkedProcess(
+                out FileArtifact staticProcessArtifact,
+                out _,
+                out _,
+                out _,
+                out _,
+                out _,
+                out _,
+                out _,
+                out DirectoryArtifact workingDirectory);
+
+            // The statically linked process executes this one, which preloads libDetours from the environment it inherits
+            var workingDirectoryStr = workingDirectory.Path.ToString(Context.PathTable);
+            var dynamicProcessPath = Path.Combine(workingDirectoryStr, "TestProcessDynamicallyLinked");
+            File.Copy(Path.Combine(TestBinRoot, "LinuxTestProcesses", "TestProcessDynamicallyLinked"), dynamicProcessPath);
+
+            var fam = new FileAccessManifest(Context.PathTable);
+            fam.ReportFileAccesses = true;
+            fam.FailUnexpectedFileAccesses = false;
+            fam.ReportUnexpectedFileAccesses = true;
+            fam.EnableLinuxPTraceSandbox = true;
+
+            var info = ToProcessInfo(
+                ToProcess(new Operation[]
+                {
+                    Operation.SpawnExe(Context.PathTable, staticProcessArtifact, arguments: "execdynamic"),
+                }),
+                workingDirectory: workingDirectoryStr,
+                fileAccessManifest: fam);
+
+            var result = await RunProcess(info);
+
+            AssertVerboseEventLogged(ProcessesLogEventId.PTraceSandboxLaunchedForPip);
+
+            // The accesses of the new image are reported by libDetours instead of the tracer, and so is its exit (only once)
+            var testFilePath = Path.Combine(workingDirectoryStr, "testFile.txt");
+            XAssert.IsTrue(
+                result.FileAccesses.Any(fa => fa.Process.Path == dynamicProcessPath && fa.GetPath(Context.PathTable) == testFilePath && fa.RequestedAccess.HasFlag(RequestedAccess.Write)),
+                $"The write of the dynamically linked process to '{testFilePath}' was not reported.");
+
+            var exits = result.FileAccesses.Where(fa => fa.Operation == ReportedFileOperation.ProcessExit && fa.GetPath(Context.PathTable) == dynamicProcessPath).ToList();
+            XAssert.AreEqual(1, exits.Count, $"Expected a single exit of '{dynamicProcessPath}' to be reported.");
+        }
+
         [Fact]
         public async Task SandboxTeardownOnUnobservedRootProcess()
         {
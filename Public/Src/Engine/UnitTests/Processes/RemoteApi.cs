@@ -30,7 +30,7 @@ namespace Test.BuildXL.Processes
         /// <summary>
         /// Runs a sequence of RemoteApi commands in a <see cref="SandboxedProcess" />.
         /// </summary>
-        public static async Task<SandboxedProcessResult> RunInSandboxAsync(
+        public static Task<SandboxedProcessResult> RunInSandboxAsync(
             LoggingContext loggingContext,
             PathTable pathTable,
             string workingDirectory,
@@ -41,6 +41,47 @@ namespace Test.BuildXL.Processes
             Contract.Requires(!string.IsNullOrEmpty(workingDirectory));
             Contract.Requires(populateManifest != null);
 
+            return RunInSandboxAsync(loggingContext, pathTable, workingDirectory, sandboxStorage, populateManifest, string.Empty, GetCommandReader(commands), Encoding.ASCII);
+        }
+
+        /// <summary>
+        /// Runs a batch of RemoteApi commands in a <see cref="SandboxedProcess" />, each of them <paramref name="repetitions"/> times,
+        /// spread over <paramref name="threadCount"/> threads. The standard output holds a line with the results of the batch.
+        /// </summary>
+        public static Task<SandboxedProcessResult> RunBatchInSandboxAsync(
+            LoggingContext loggingContext,
+            PathTable pathTable,
+            string workingDirectory,
+            ISandboxedProcessFileStorage sandboxStorage,
+            Action<FileAccessManifest> populateManifest,
+            int threadCount,
+            int repetitions,
+            params Command[] commands)
+        {
+            Contract.Requires(!string.IsNullOrEmpty(workingDirectory));
+            Contract.Requires(populateManifest != null);
+            Contract.Requires(threadCount >= 0);
+            Contract.Requires(repetitions >= 0);
+
+            return RunInSandboxAsync(loggingContext, pathTable, workingDirectory, sandboxStorage, populateManifest, "/batch", GetBatchReader(commands, threadCount, repetitions), s_batchEncoding);
+        }
+
+        /// <summary>
+        /// Latin-1 maps each character below 256 to the byte of the same value, so a binary batch written as such characters reaches the standard input unchanged.
+        /// </summary>
+        private static readonly Encoding s_batchEncoding = Encoding.GetEncoding(28591);
+
+        private static async Task<SandboxedProcessResult> RunInSandboxAsync(
+            LoggingContext loggingContext,
+            PathTable pathTable,
+            string workingDirectory,
+            ISandboxedProcessFileStorage sandboxStorage,
+            Action<FileAccessManifest> populateManifest,
+            string arguments,
+            TextReader commandReader,
+            Encoding commandEncoding)
+        {
+
             if (!File.Exists(ExecutablePath))
             {
                 throw new BuildXLException("Expected to find RemoteApi.exe at " + ExecutablePath);
@@ -51,7 +92,7 @@ namespace Test.BuildXL.Processes
                 {
                     PipSemiStableHash = 0,
                     PipDescription = "RemoteApi Test",
-                    Arguments = string.Empty,
+                    Arguments = arguments,
                     WorkingDirectory = workingDirectory,
                 };
 
@@ -67,10 +108,10 @@ namespace Test.BuildXL.Processes
             AbsolutePath exeDirectory = AbsolutePath.Create(pathTable, Path.GetDirectoryName(ExecutablePath));
             info.FileAccessManifest.AddScope(exeDirectory, FileAccessPolicy.MaskNothing, FileAccessPolicy.AllowReadAlways);
 
-            using (TextReader commandReader = GetCommandReader(commands))
+            using (commandReader)
             {
                 info.StandardInputReader = commandReader;
-                info.StandardInputEncoding = Encoding.ASCII;
+                info.StandardInputEncoding = commandEncoding;
 
                 // TODO: Maybe watch stdout and validate the command results.
                 using (SandboxedProcess process = await SandboxedProcess.StartAsync(info))
@@ -98,6 +139,35 @@ namespace Test.BuildXL.Processes
             return new StringReader(commandBuffer.ToString());
         }
 
+        private static TextReader GetBatchReader(Command[] commands, int threadCount, int repetitions)
+        {
+            using (var stream = new MemoryStream())
+            {
+                using (var writer = new BinaryWriter(stream, Encoding.Unicode, leaveOpen: true))
+                {
+                    writer.Write((uint)commands.Length);
+                    writer.Write((uint)threadCount);
+                    writer.Write((uint)repetitions);
+
+                    foreach (Command command in commands)
+                    {
+                        string[] strings = command.Parameter2 == null
+                            ? new[] { command.CommandType.ToString("G"), command.Parameter1 }
+                            : new[] { command.CommandType.ToString("G"), command.Parameter1, command.Parameter2 };
+
+                        writer.Write((uint)strings.Length);
+                        foreach (string str in strings)
+                        {
+                            writer.Write((uint)str.Length);
+                            writer.Write(str.ToCharArray());
+                        }
+                    }
+                }
+
+                return new StringReader(s_batchEncoding.GetString(stream.ToArray()));
+            }
+        }
+
         private static string GetRemoteApiExeLocation()
         {
             string currentCodeFolder = Path.GetDirectoryName(AssemblyHelper.GetAssemblyLocation(Assembly.GetExecutingAssembly()));
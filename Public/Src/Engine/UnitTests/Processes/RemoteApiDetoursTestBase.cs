@@ -136,6 +136,28 @@ namespace Test.BuildXL.Processes
                 commands: commands);
         }
 
+        /// <summary>
+        /// Runs a batch of remote file APIs in a Detours sandbox, each of them <paramref name="repetitions"/> times and concurrently on
+        /// <paramref name="threadCount"/> threads. Returns a <see cref="SandboxedProcessResult" /> whose standard output holds the results of the batch.
+        /// </summary>
+        protected Task<SandboxedProcessResult> RunRemoteApiBatchInSandboxAsync(
+            PathTable pathTable,
+            Action<FileAccessManifest> populateManifest,
+            int threadCount,
+            int repetitions,
+            params RemoteApi.Command[] commands)
+        {
+            return RemoteApi.RunBatchInSandboxAsync(
+                LoggingContext,
+                pathTable,
+                workingDirectory: TemporaryDirectory,
+                sandboxStorage: this,
+                populateManifest: populateManifest,
+                threadCount: threadCount,
+                repetitions: repetitions,
+                commands: commands);
+        }
+
         /// <summary>
         /// Expected reported access from <see cref="RemoteApiDetoursTestBase.RunRemoteApiInSandboxAsync" />.
         /// This is a projection of key fields of <see cref="ReportedFileAccess" />.
@@ -6,6 +6,7 @@ using System.Text;
 using BuildXL.Utilities.Core;
 using Test.BuildXL.TestUtilities.Xunit;
 using Xunit;
+using Xunit.Abstractions;
 
 namespace Test.BuildXL.Processes
 {
@@ -18,6 +19,13 @@ namespace Test.BuildXL.Processes
         // CODESYNC: Public\Src\Sandbox\Linux\utils.c
         private const char EnvSeparator = ';';
 
+        private ITestOutputHelper TestOutput { get; }
+
+        public SandboxedLinuxUtilsTest(ITestOutputHelper output)
+        {
+            TestOutput = output;
+        }
+
         [DllImport(LibBxlUtils, EntryPoint = "add_value_to_env_for_test")]
         [return: MarshalAs(UnmanagedType.U1)]
         private static extern bool AddValueToEnv(
@@ -66,6 +74,29 @@ namespace Test.BuildXL.Processes
             [MarshalAs(UnmanagedType.LPStr)] StringBuilder buf1,
             [MarshalAs(UnmanagedType.LPStr)] StringBuilder buf2);
 
+        // CODESYNC: Public\Src\Sandbox\Linux\utils.h (env_edit_kind)
+        public enum EnvEditKind
+        {
+            SetValue = 0,
+            IncludePath = 1,
+            ExcludePath = 2,
+        }
+
+        [DllImport(LibBxlUtils, EntryPoint = "apply_env_edit_for_test")]
+        [return: MarshalAs(UnmanagedType.U1)]
+        private static extern bool ApplyEnvEdit(string[] env,
+            EnvEditKind kind,
+            [MarshalAs(UnmanagedType.LPStr)] string name,
+            [MarshalAs(UnmanagedType.LPStr)] string value,
+            [MarshalAs(UnmanagedType.LPStr)] StringBuilder buf);
+
+        [DllImport(LibBxlUtils, EntryPoint = "benchmark_env_edits_for_test")]
+        private static extern long BenchmarkEnvEdits(string[] env, int iterations, [MarshalAs(UnmanagedType.U1)] bool legacy);
+
+        // CODESYNC: Public\Src\Sandbox\Linux\utils.c
+        private const string BenchmarkDetoursPath = "/bxl/libDetours.so";
+        private const string BenchmarkFamPath = "/bxl/pip.fam";
+
         [Theory]
         // no 'valueToAdd' specified --> no change
         [InlineData("")]
@@ -253,5 +284,71 @@ namespace Test.BuildXL.Processes
             XAssert.AreEqual(expected[2], buffers[2].ToString());
             XAssert.AreEqual(shouldBeSameEnvp, sameEvnp);
         }
+
+        [Theory]
+        // already satisfied --> same envp
+        [InlineData(new[] { "HOME=/User/home", "__BUILDXL_FAM_PATH=/my/fam", null }, EnvEditKind.SetValue, "__BUILDXL_FAM_PATH", "/my/fam", new[] { "HOME=/User/home", "__BUILDXL_FAM_PATH=/my/fam" })]
+        [InlineData(new[] { "HOME=/User/home", "LD_PRELOAD=/before:/my/lib", null }, EnvEditKind.IncludePath, "LD_PRELOAD", "/my/lib", new[] { "HOME=/User/home", "LD_PRELOAD=/before:/my/lib" })]
+        [InlineData(new[] { "HOME=/User/home", "LD_PRELOAD=/before:/my/lib.so", null }, EnvEditKind.ExcludePath, "LD_PRELOAD", "/my/lib", new[] { "HOME=/User/home", "LD_PRELOAD=/before:/my/lib.so" })]
+        [InlineData(new[] { "HOME=/User/home", null }, EnvEditKind.ExcludePath, "LD_PRELOAD", "/my/lib", new[] { "HOME=/User/home" })]
+        // only whole names match
+        [InlineData(new[] { "__BUILDXL_FAM_PATH_OTHER=/x", null }, EnvEditKind.SetValue, "__BUILDXL_FAM_PATH", "/my/fam", new[] { "__BUILDXL_FAM_PATH_OTHER=/x", "__BUILDXL_FAM_PATH=/my/fam" }, false)]
+        // rewriting
+        [InlineData(new[] { "HOME=/User/home", "__BUILDXL_FAM_PATH=/before", null }, EnvEditKind.SetValue, "__BUILDXL_FAM_PATH", "/my/fam", new[] { "HOME=/User/home", "__BUILDXL_FAM_PATH=/my/fam" }, false)]
+        [InlineData(new[] { "HOME=/User/home", "LD_PRELOAD=/before", null }, EnvEditKind.IncludePath, "LD_PRELOAD", "/my/lib", new[] { "HOME=/User/home", "LD_PRELOAD=/before:/my/lib" }, false)]
+        [InlineData(new[] { "HOME=/User/home", "LD_PRELOAD=", null }, EnvEditKind.IncludePath, "LD_PRELOAD", "/my/lib", new[] { "HOME=/User/home", "LD_PRELOAD=/my/lib" }, false)]
+        [InlineData(new[] { "HOME=/User/home", "LD_PRELOAD=/before:/my/lib:/after", null }, EnvEditKind.ExcludePath, "LD_PRELOAD", "/my/lib", new[] { "HOME=/User/home", "LD_PRELOAD=/before:/after" }, false)]
+        [InlineData(new[] { "LD_PRELOAD=/my/lib", "HOME=/User/home", null }, EnvEditKind.ExcludePath, "LD_PRELOAD", "/my/lib", new[] { "LD_PRELOAD=", "HOME=/User/home" }, false)]
+        // adding
+        [InlineData(new[] { "HOME=/User/home", null }, EnvEditKind.SetValue, "__BUILDXL_ROOT_PID", "", new[] { "HOME=/User/home", "__BUILDXL_ROOT_PID=" }, false)]
+        [InlineData(null, EnvEditKind.IncludePath, "LD_PRELOAD", "/my/lib", new[] { "LD_PRELOAD=/my/lib" }, false)]
+        public void TestApplyEnvEdit(string[] envp, EnvEditKind kind, string name, string value, string[] expectedEnvp, bool shouldBeSameEnvp = true)
+        {
+            if (!OperatingSystemHelper.IsLinuxOS)
+            {
+                return;
+            }
+
+            var buffer = new StringBuilder(capacity: 1000);
+
+            bool sameEnvp = ApplyEnvEdit(envp, kind, name, value, buffer);
+            XAssert.AreEqual(shouldBeSameEnvp, sameEnvp);
+
+            var newEnvp = buffer.ToString().Split(EnvSeparator);
+            XAssert.IsTrue(newEnvp.SequenceEqual(expectedEnvp), $"Unexpected environment: {buffer}");
+        }
+
+        [Fact]
+        public void BenchmarkEnvRewriting()
+        {
+            if (!OperatingSystemHelper.IsLinuxOS)
+            {
+                return;
+            }
+
+            // A typical environment of a child process that already has the sandbox variables: nothing needs to change
+            var envp = Enumerable.Range(0, 100).Select(i => $"SOME_VARIABLE_{i}=/some/value/{i}")
+                .Concat(new[]
+                {
+                    $"LD_PRELOAD={BenchmarkDetoursPath}",
+                    $"__BUILDXL_FAM_PATH={BenchmarkFamPath}",
+                    $"__BUILDXL_DETOURS_PATH={BenchmarkDetoursPath}",
+                    "__BUILDXL_ROOT_PID=",
+                    null
+                })
+                .ToArray();
+
+            const int Iterations = 100_000;
+            long legacyNs = BenchmarkEnvEdits(envp, Iterations, legacy: true);
+            long newNs = BenchmarkEnvEdits(envp, Iterations, legacy: false);
+            XAssert.IsTrue(legacyNs >= 0 && newNs >= 0, "The environment was expected to be left untouched");
+
+            // Something has to change: the first exec of a pip
+            var rootEnvp = envp.Take(100).Append(null).ToArray();
+            long rewriteNs = BenchmarkEnvEdits(rootEnvp, Iterations, legacy: false);
+            XAssert.IsTrue(rewriteNs >= 0);
+
+            TestOutput.WriteLine($"Env rewriting per exec: legacy {legacyNs}ns, single pass {newNs}ns (no changes), {rewriteNs}ns (all variables added)");
+        }
     }
 }
@@ -10,7 +10,9 @@ using BuildXL.Utilities.Core;
 using System;
 using System.Collections;
 using System.Collections.Generic;
+using System.IO;
 using System.Linq;
+using System.Text;
 
 namespace Test.BuildXL.Processes
 {
@@ -150,5 +152,139 @@ namespace Test.BuildXL.Processes
             XAssert.AreEqual("*", enumeratePattern);
             XAssert.AreEqual("some args\r\n", processArgs);
         }
+
+        [Fact]
+        public void ParseBinaryFileAccessReport()
+        {
+            // Paths in binary reports are not escaped
+            var frame = CreateBinaryFileAccessFrame("CreateFile", "C:\\foo\r\nbar", filter: "*.txt", processArgs: string.Empty, requestedAccess: (uint)RequestedAccess.Enumerate);
+            XAssert.AreEqual(BinaryFileAccessReport.FrameKind.FileAccess, BinaryFileAccessReport.GetFrameKind(frame));
+
+            var ok = BinaryFileAccessReport.TryParse(
+                ref frame,
+                out var processId,
+                out var id,
+                out var correlationId,
+                out var operation,
+                out var requestedAccess,
+                out var status,
+                out var explicitlyReported,
+                out var error,
+                out var usn,
+                out var desiredAccess,
+                out var shareMode,
+                out var creationDisposition,
+                out var flags,
+                out var openedFileOrDirectoryAttributes,
+                out var absolutePath,
+                out var path,
+                out var enumeratePattern,
+                out var processArgs,
+                out string errorMessage);
+
+            XAssert.IsTrue(ok, errorMessage);
+
+            XAssert.AreEqual(ReportedFileOperation.CreateFile, operation);
+            XAssert.AreEqual(1234u, processId);
+            XAssert.AreEqual(5u, id);
+            XAssert.AreEqual(6u, correlationId);
+            XAssert.AreEqual(RequestedAccess.Enumerate, requestedAccess);
+            XAssert.AreEqual(FileAccessStatus.Allowed, status);
+            XAssert.AreEqual(true, explicitlyReported);
+            XAssert.AreEqual(2u, error);
+            XAssert.AreEqual(new Usn(0x1122334455667788), usn);
+            XAssert.AreEqual(DesiredAccess.GENERIC_READ, desiredAccess);
+            XAssert.AreEqual(ShareMode.FILE_SHARE_READ, shareMode);
+            XAssert.AreEqual(CreationDisposition.OPEN_ALWAYS, creationDisposition);
+            XAssert.AreEqual(FlagsAndAttributes.FILE_ATTRIBUTE_NORMAL, flags);
+            XAssert.AreEqual(FlagsAndAttributes.FILE_ATTRIBUTE_DIRECTORY, openedFileOrDirectoryAttributes);
+            XAssert.AreEqual(new AbsolutePath(42), absolutePath);
+            XAssert.AreEqual("C:\\foo\r\nbar", path);
+            XAssert.AreEqual("*.txt", enumeratePattern);
+            XAssert.AreEqual(string.Empty, processArgs);
+        }
+
+        [Fact]
+        public void ParseTruncatedBinaryFileAccessReportFails()
+        {
+            var frame = CreateBinaryFileAccessFrame("CreateFile", "C:\\foo", filter: string.Empty, processArgs: string.Empty, requestedAccess: (uint)RequestedAccess.Read);
+            frame = new ArraySegment<byte>(frame.Array, frame.Offset, frame.Count - sizeof(char));
+
+            var ok = BinaryFileAccessReport.TryParse(ref frame, out _, out _, out _, out _, out _, out _, out _, out _, out _, out _, out _, out _, out _, out _, out _, out _, out _, out _, out string error);
+            XAssert.IsFalse(ok);
+            XAssert.IsNotNull(error);
+        }
+
+        [Fact]
+        public void ParseBinaryFileAccessReportWithInvalidRequestedAccessFails()
+        {
+            var frame = CreateBinaryFileAccessFrame("CreateFile", "C:\\foo", filter: string.Empty, processArgs: string.Empty, requestedAccess: 12312);
+
+            var ok = BinaryFileAccessReport.TryParse(ref frame, out _, out _, out _, out _, out _, out _, out _, out _, out _, out _, out _, out _, out _, out _, out _, out _, out _, out _, out string error);
+            XAssert.IsFalse(ok, error);
+        }
+
+        [Fact]
+        public void TextLineFrameRoundtrip()
+        {
+            var line = FileAccessReportLine.GetReportLineForAugmentedFileAccess(
+                    ReportedFileOperation.CreateFile,
+                    1234,
+                    RequestedAccess.Write,
+                    FileAccessStatus.Allowed,
+                    0,
+                    Usn.Zero,
+                    DesiredAccess.GENERIC_WRITE,
+                    ShareMode.FILE_SHARE_NONE,
+                    CreationDisposition.CREATE_ALWAYS,
+                    FlagsAndAttributes.FILE_ATTRIBUTE_NORMAL,
+                    FlagsAndAttributes.FILE_ATTRIBUTE_NORMAL,
+                    "C:\\foo\\bar",
+                    enumeratePattern: null,
+                    processArgs: null);
+
+            var frame = new ArraySegment<byte>(BinaryFileAccessReport.CreateTextLineFrame(Encoding.Unicode.GetBytes(line)));
+
+            XAssert.AreEqual(frame.Count - BinaryFileAccessReport.LengthPrefixSize, BitConverter.ToInt32(frame.Array, 0));
+            XAssert.AreEqual(BinaryFileAccessReport.FrameKind.TextLine, BinaryFileAccessReport.GetFrameKind(frame));
+            XAssert.AreEqual(line.TrimEnd('\r', '\n'), BinaryFileAccessReport.GetTextLine(frame));
+        }
+
+        /// <summary>
+        /// Lays out a file access frame the way Detours does (see BinaryReports.h)
+        /// </summary>
+        private static ArraySegment<byte> CreateBinaryFileAccessFrame(string operation, string path, string filter, string processArgs, uint requestedAccess)
+        {
+            using var stream = new MemoryStream();
+            using var writer = new BinaryWriter(stream);
+
+            int size = BinaryFileAccessReport.FrameHeaderSize + BinaryFileAccessReport.RecordSize + sizeof(char) * (operation.Length + path.Length + filter.Length + processArgs.Length);
+            writer.Write((uint)(size - BinaryFileAccessReport.LengthPrefixSize));
+            writer.Write((uint)BinaryFileAccessReport.FrameKind.FileAccess);
+
+            writer.Write(0x1122334455667788UL);                                 // Usn
+            writer.Write(1234u);                                                // ProcessId
+            writer.Write(5u);                                                   // Id
+            writer.Write(6u);                                                   // CorrelationId
+            writer.Write(requestedAccess);                                      // RequestedAccess
+            writer.Write((uint)FileAccessStatus.Allowed);                       // Status
+            writer.Write(1u);                                                   // ExplicitlyReported
+            writer.Write(2u);                                                   // Error
+            writer.Write((uint)DesiredAccess.GENERIC_READ);                     // DesiredAccess
+            writer.Write((uint)ShareMode.FILE_SHARE_READ);                      // ShareMode
+            writer.Write((uint)CreationDisposition.OPEN_ALWAYS);                // CreationDisposition
+            writer.Write((uint)FlagsAndAttributes.FILE_ATTRIBUTE_NORMAL);       // FlagsAndAttributes
+            writer.Write((uint)FlagsAndAttributes.FILE_ATTRIBUTE_DIRECTORY);    // OpenedFileOrDirectoryAttributes
+            writer.Write(42u);                                                  // PathId
+            writer.Write((uint)operation.Length);
+            writer.Write((uint)path.Length);
+            writer.Write((uint)filter.Length);
+            writer.Write((uint)processArgs.Length);
+            writer.Write(Encoding.Unicode.GetBytes(operation + path + filter + processArgs));
+            writer.Flush();
+
+            XAssert.AreEqual(size, (int)stream.Length);
+            return new ArraySegment<byte>(stream.ToArray());
+        }
     }
 }
@@ -3,13 +3,28 @@
 
 #include <algorithm>
 #include "PTraceSandbox.hpp"
+#include <elf.h>
 #include <linux/filter.h>
 #include <linux/seccomp.h>
+#include <poll.h>
+#include <sys/ioctl.h>
 #include <sys/prctl.h>
 #include <sys/ptrace.h>
-#include <sys/reg.h>
+#include <sys/signalfd.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
 
+// Not defined by older kernel headers
+#ifndef SECCOMP_USER_NOTIF_FLAG_CONTINUE
+#define SECCOMP_USER_NOTIF_FLAG_CONTINUE (1UL << 0)
+#endif
+#ifndef __NR_pidfd_open
+#define __NR_pidfd_open 434
+#endif
+#ifndef __NR_pidfd_getfd
+#define __NR_pidfd_getfd 438
+#endif
+
 #define SYSCALL_NAME_TO_NUMBER(name) __NR_##name
 #define SYSCALL_NAME_STRING(name) #name
 
@@ -28,6 +43,24 @@
 // The other "new" variants of the macros in this file achieve the same thing
 #define TRACE_SYSCALL_NEW(name) TRACE_SYSCALL(new##name)
 
+// Same as TRACE_SYSCALL, but the syscall is only traced if its first argument (a file descriptor) is above 2, so writing to stdin/stdout/stderr
+// doesn't stop the tracee. Descriptors are ints, so only the lower 32 bits of the argument are loaded (x64 is little endian).
+#define TRACE_SYSCALL_UNLESS_STDIO(name) \
+        BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, SYSCALL_NAME_TO_NUMBER(name), 0, 4), \
+        BPF_STMT(BPF_LD+BPF_W+BPF_ABS, offsetof(struct seccomp_data, args[0])), \
+        BPF_JUMP(BPF_JMP+BPF_JGT+BPF_K, STDERR_FILENO, 0, 1), \
+        BPF_STMT(BPF_RET+BPF_K, SECCOMP_RET_TRACE), \
+        BPF_STMT(BPF_RET+BPF_K, SECCOMP_RET_ALLOW)
+
+// fcntl is only traced for the commands that duplicate descriptors
+#define TRACE_FCNTL_DUPFD \
+        BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, SYSCALL_NAME_TO_NUMBER(fcntl), 0, 5), \
+        BPF_STMT(BPF_LD+BPF_W+BPF_ABS, offsetof(struct seccomp_data, args[1])), \
+        BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, F_DUPFD, 1, 0), \
+        BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, F_DUPFD_CLOEXEC, 0, 1), \
+        BPF_STMT(BPF_RET+BPF_K, SECCOMP_RET_TRACE), \
+        BPF_STMT(BPF_RET+BPF_K, SECCOMP_RET_ALLOW)
+
 #define HANDLER_FUNCTION(syscallName) void PTraceSandbox::MAKE_HANDLER_FN_NAME(syscallName) ()
 #define HANDLER_FUNCTION_NEW(syscallName) HANDLER_FUNCTION(new##syscallName)
 
@@ -40,12 +73,107 @@
 PTraceSandbox::PTraceSandbox(BxlObserver *bxl)
 {
     m_bxl = bxl;
+    m_pageSize = sysconf(_SC_PAGESIZE);
 }
 
 PTraceSandbox::~PTraceSandbox()
 {
 }
 
+/**
+ * Reads a numeric field (e.g. "Tgid") from /proc/<pid>/status. Returns -1 if the field can't be read.
+ */
+static long ReadProcessStatusField(pid_t pid, const char *field, int base = 10)
+{
+    std::string statusPath = "/proc/" + std::to_string(pid) + "/status";
+    FILE *status = fopen(statusPath.c_str(), "re");
+    if (status == NULL)
+    {
+        return -1;
+    }
+
+    long value = -1;
+    size_t fieldLength = strlen(field);
+    char line[256];
+    while (fgets(line, sizeof(line), status) != NULL)
+    {
+        if (strncmp(line, field, fieldLength) == 0 && line[fieldLength] == ':')
+        {
+            value = strtol(line + fieldLength + 1, NULL, base);
+            break;
+        }
+    }
+
+    fclose(status);
+    return value;
+}
+
+/**
+ * Finds the descriptor of the seccomp listener of a process. Returns -1 if there is none.
+ */
+static int FindListenerFd(pid_t pid)
+{
+    std::string fdDirectory = "/proc/" + std::to_string(pid) + "/fd";
+    DIR *directory = opendir(fdDirectory.c_str());
+    if (directory == NULL)
+    {
+        return -1;
+    }
+
+    int listenerFd = -1;
+    char target[PATH_MAX];
+    struct dirent *entry;
+    while ((entry = readdir(directory)) != NULL)
+    {
+        std::string fdPath = fdDirectory + "/" + entry->d_name;
+        ssize_t length = readlink(fdPath.c_str(), target, sizeof(target) - 1);
+        if (length == -1)
+        {
+            continue;
+        }
+
+        target[length] = '\0';
+        if (strcmp(target, "anon_inode:seccomp notify") == 0)
+        {
+            // A process inheriting filters from an outer sandbox could have several, ours is the latest
+            listenerFd = std::max(listenerFd, atoi(entry->d_name));
+        }
+    }
+
+    closedir(directory);
+    return listenerFd;
+}
+
+bool PTraceSandbox::SupportsUserNotifications()
+{
+    // pidfd_getfd fails with EBADF for an invalid pidfd when it is available. It came after SECCOMP_USER_NOTIF_FLAG_CONTINUE.
+    if (syscall(__NR_pidfd_getfd, -1, 0, 0) != -1 || errno != EBADF)
+    {
+        return false;
+    }
+
+    // With Yama restricting ptrace, the tracer can't read the memory of the tracees: they are not its descendants and (unlike with ptrace) it doesn't attach to them
+    // This runs in the interposed tracee as well, which shouldn't report this access
+    FILE *ptraceScope = m_bxl->real_fopen("/proc/sys/kernel/yama/ptrace_scope", "re");
+    if (ptraceScope != NULL)
+    {
+        int scope = 0;
+        bool restricted = fscanf(ptraceScope, "%d", &scope) != 1 || scope != 0;
+        m_bxl->real_fclose(ptraceScope);
+        if (restricted)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool PTraceSandbox::UseUserNotifications()
+{
+    return m_bxl->IsSeccompUserNotificationEnabled() && SupportsUserNotifications();
+}
+
 int PTraceSandbox::ExecuteWithPTraceSandbox(const char *file, char *const argv[], char *const envp[], const char *fam)
 {
     /**
@@ -59,28 +187,48 @@ int PTraceSandbox::ExecuteWithPTraceSandbox(const char *file, char *const argv[]
     // NOTE: The set of syscalls here are not equivalent to the set of functions that are interposed by the regular sandbox
     // This is expected because not all of the interposed functions map directly to system calls in the kernel.
     // This set should capture all of the file accesses we already observe on the interpose sandbox.
-    struct sock_filter filter[] = {
+    std::vector<struct sock_filter> filter = {
         // This statement loads the syscall number (seccomp_data.nr) into the accumulator
         BPF_STMT(BPF_LD+BPF_W+BPF_ABS, offsetof(struct seccomp_data, nr)),
         // The next set of statements indicates that we should stop the tracee if one of these syscalls are detected
         TRACE_SYSCALL(execveat),
         TRACE_SYSCALL(execve),
-        TRACE_SYSCALL(stat),
-        TRACE_SYSCALL(lstat),
-        TRACE_SYSCALL(fstat),
-        TRACE_SYSCALL_NEW(fstatat),
-        TRACE_SYSCALL(access),
-        TRACE_SYSCALL(faccessat),
+    };
+
+    // Probes are allowed and not reported by every policy of most pips, so they are only traced if the manifest can make them reported
+    if (m_bxl->CanAccessBeReported(
+        (FileAccessPolicy)(FileAccessPolicy_AllowRead | FileAccessPolicy_AllowReadIfNonExistent), FileAccessPolicy_ReportAccess))
+    {
+        filter.insert(filter.end(), {
+            TRACE_SYSCALL(stat),
+            TRACE_SYSCALL(lstat),
+            TRACE_SYSCALL(fstat),
+            TRACE_SYSCALL_NEW(fstatat),
+            TRACE_SYSCALL(access),
+            TRACE_SYSCALL(faccessat),
+        });
+    }
+
+    // Writes on a descriptor only report the file it was opened for: unless the manifest can make that write reported (or check whether
+    // the file existed before, see FileAccessPolicy_OverrideAllowWriteForExistingFiles), the open already told us everything
+    if (m_bxl->CanAccessBeReported(
+        FileAccessPolicy_AllowWrite, (FileAccessPolicy)(FileAccessPolicy_ReportAccess | FileAccessPolicy_OverrideAllowWriteForExistingFiles)))
+    {
+        filter.insert(filter.end(), {
+            TRACE_SYSCALL_UNLESS_STDIO(write),
+            TRACE_SYSCALL_UNLESS_STDIO(writev),
+            TRACE_SYSCALL_UNLESS_STDIO(pwritev),
+            TRACE_SYSCALL_UNLESS_STDIO(pwritev2),
+            TRACE_SYSCALL_UNLESS_STDIO(pwrite64),
+            TRACE_SYSCALL(ftruncate),
+        });
+    }
+
+    filter.insert(filter.end(), {
         TRACE_SYSCALL(creat),
         TRACE_SYSCALL(open),
         TRACE_SYSCALL(openat),
-        TRACE_SYSCALL(write),
-        TRACE_SYSCALL(writev),
-        TRACE_SYSCALL(pwritev),
-        TRACE_SYSCALL(pwritev2),
-        TRACE_SYSCALL(pwrite64),
         TRACE_SYSCALL(truncate),
-        TRACE_SYSCALL(ftruncate),
         TRACE_SYSCALL(rmdir),
         TRACE_SYSCALL(rename),
         TRACE_SYSCALL(renameat),
@@ -111,19 +259,38 @@ int PTraceSandbox::ExecuteWithPTraceSandbox(const char *file, char *const argv[]
         TRACE_SYSCALL(sendfile),
         TRACE_SYSCALL(copy_file_range),
         TRACE_SYSCALL(name_to_handle_at),
-        // NOTE: vfork is explicitly not traced here, see PTraceSandbox::UpdateTraceeTableForExec for more details
-        TRACE_SYSCALL(fork),
-        TRACE_SYSCALL(clone),
+        // These don't report anything, but they can make a descriptor number refer to a different file (see ForgetWriteDescriptors)
+        TRACE_SYSCALL(dup),
+        TRACE_SYSCALL(dup2),
+        TRACE_SYSCALL(dup3),
+        TRACE_FCNTL_DUPFD,
+        // Working directories are cached (see BeginCwdChange)
+        TRACE_SYSCALL(chdir),
+        TRACE_SYSCALL(fchdir),
+        // NOTE: fork/vfork/clone are not traced here: child processes are handled on the ptrace events for their creation (see AttachToProcess)
         // SECCOMP_RET_ALLOW tells seccomp to allow all of the calls that were being filtered above (as opposed to killing them)
         // This would happen if none of the syscall numbers above get matched, and therefore should not stop the tracee
         BPF_STMT(BPF_RET+BPF_K, SECCOMP_RET_ALLOW),
-    };
+    });
 
     struct sock_fprog prog = {
-        .len = (unsigned short) (sizeof(filter)/sizeof(filter[0])),
-        .filter = filter,
+        .len = (unsigned short) filter.size(),
+        .filter = filter.data(),
     };
 
+    bool useUserNotifications = UseUserNotifications();
+    if (useUserNotifications)
+    {
+        // Same filter, but the syscalls are sent to the listener the tracer takes over instead of stopping the tracee for ptrace
+        for (auto &statement : filter)
+        {
+            if (statement.code == (BPF_RET+BPF_K) && statement.k == SECCOMP_RET_TRACE)
+            {
+                statement.k = SECCOMP_RET_USER_NOTIF;
+            }
+        }
+    }
+
     // NOTE: sem_open must be called before we set the seccomp filter
     std::string semaphoreName = "/" + std::to_string(getpid());
     sem_t *semaphoreTracee = sem_open(semaphoreName.c_str(), O_CREAT, 0644, 0);
@@ -133,6 +300,19 @@ int PTraceSandbox::ExecuteWithPTraceSandbox(const char *file, char *const argv[]
         m_bxl->real__exit(-1);
     }
 
+    // With user notifications, the tracer waits on this one for the listener to be ready
+    std::string listenerSemaphoreName = semaphoreName + ListenerSemaphoreSuffix;
+    sem_t *semaphoreListener = NULL;
+    if (useUserNotifications)
+    {
+        semaphoreListener = sem_open(listenerSemaphoreName.c_str(), O_CREAT, 0644, 0);
+        if (semaphoreListener == NULL || semaphoreListener == SEM_FAILED)
+        {
+            BXL_LOG_DEBUG(m_bxl, "[PTrace] sem_open failed with: '%s'", strerror(errno));
+            m_bxl->real__exit(-1);
+        }
+    }
+
     struct timespec ts;
     if (clock_gettime(CLOCK_REALTIME, &ts) == -1)
     {
@@ -146,8 +326,21 @@ int PTraceSandbox::ExecuteWithPTraceSandbox(const char *file, char *const argv[]
     auto semWaitErrno = errno;
 
     // Regardless of whether we timed out or not, close/unlink the semaphore
-    sem_close(semaphoreTracee);
+    // With user notifications, the tracer opened both semaphores by now and we keep using them, but unlinking must happen before the filter is set
+    if (!useUserNotifications || waitResult == -1)
+    {
+        sem_close(semaphoreTracee);
+        if (semaphoreListener != NULL)
+        {
+            sem_close(semaphoreListener);
+        }
+    }
+
     sem_unlink(semaphoreName.c_str());
+    if (useUserNotifications)
+    {
+        sem_unlink(listenerSemaphoreName.c_str());
+    }
 
     if (waitResult == -1)
     {
@@ -164,6 +357,11 @@ int PTraceSandbox::ExecuteWithPTraceSandbox(const char *file, char *const argv[]
         m_bxl->real__exit(-1);
     }
 
+    if (useUserNotifications)
+    {
+        return ExecuteWithUserNotifications(file, argv, envp, &prog, semaphoreTracee, semaphoreListener);
+    }
+
     // Sets the seccomp filter
     // NOTE: Do not run anything other than execve after this statement
     if (prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &prog) == -1) {
@@ -172,226 +370,1004 @@ int PTraceSandbox::ExecuteWithPTraceSandbox(const char *file, char *const argv[]
         m_bxl->real__exit(-1);
     }
 
-    // Finally perform the exec syscall, this call to exec along with the syscalls from the child process should be filtered and reported to the tracer by seccomp
-    return m_bxl->real_execvpe(file, argv, envp);
+    // Finally perform the exec syscall, this call to exec along with the syscalls from the child process should be filtered and reported to the tracer by seccomp
+    return m_bxl->real_execvpe(file, argv, envp);
+}
+
+int PTraceSandbox::ExecuteWithUserNotifications(const char *file, char *const argv[], char *const envp[], struct sock_fprog *prog, sem_t *attached, sem_t *listenerReady)
+{
+    // Sets the seccomp filter, with a listener for its notifications
+    // NOTE: From here on the filtered syscalls block until the tracer answers them, so do not run anything other than execve after this statement
+    int listener = syscall(__NR_seccomp, SECCOMP_SET_MODE_FILTER, SECCOMP_FILTER_FLAG_NEW_LISTENER, prog);
+    if (listener == -1)
+    {
+        BXL_LOG_DEBUG(m_bxl, "seccomp(SECCOMP_SET_MODE_FILTER) with SECCOMP_FILTER_FLAG_NEW_LISTENER failed %d\n", 1);
+        m_bxl->real_printf("seccomp(SECCOMP_SET_MODE_FILTER) with SECCOMP_FILTER_FLAG_NEW_LISTENER failed\n");
+        m_bxl->real__exit(-1);
+    }
+
+    // The tracer takes the listener over with pidfd_getfd, and posts again once it did
+    sem_post(listenerReady);
+    sem_close(listenerReady);
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += 15;
+    auto waitResult = sem_timedwait(attached, &ts);
+    sem_close(attached);
+
+    // The tracer has its own copy of the listener now (and it is close-on-exec anyway)
+    close(listener);
+
+    if (waitResult == -1)
+    {
+        // Without a tracer the filtered syscalls fail with ENOSYS once the listener is closed (writing to stderr included), so there is no way to report this
+        m_bxl->real__exit(-1);
+    }
+
+    return m_bxl->real_execvpe(file, argv, envp);
+}
+
+void PTraceSandbox::AttachToProcess(pid_t traceePid, std::string exe, std::string semaphoreName, int requestFd)
+{
+    if (UseUserNotifications())
+    {
+        AttachWithUserNotifications(traceePid, exe, semaphoreName, requestFd);
+        return;
+    }
+
+    BXL_LOG_DEBUG(m_bxl, "[PTrace] Starting tracer PID '%d' to trace PID '%d'", getpid(), traceePid);
+
+    m_bxl->disable_fd_table();
+    m_bxl->enable_tracee_cwd_cache(true);
+    m_bxl->EnableTracerReportBuffering();
+
+    int signalFd = -1;
+    if (requestFd != -1)
+    {
+        // The tracer is notified of tracee stops with SIGCHLD. Reading it from a descriptor lets us wait for those and for attach requests at the same time.
+        // It must be blocked before the first tracee is attached, so none of them is delivered (and missed) before we wait on the descriptor.
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGCHLD);
+        signalFd = sigprocmask(SIG_BLOCK, &mask, NULL) == -1 ? -1 : signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+        if (signalFd == -1)
+        {
+            BXL_LOG_DEBUG(m_bxl, "[PTrace] signalfd failed with error: '%s'", strerror(errno));
+            _exit(-1);
+        }
+    }
+
+    SeizeTracee(traceePid, exe, semaphoreName);
+    AccessStatistics &statistics = m_bxl->GetAccessStatistics();
+
+    // Main loop that handles signals from the tracees
+    // wait should get signalled from the following:
+    //  1. ptrace event (seccomp, clone, fork, vfork, exit)
+    //  2. syscall-exit-stop, for tracees with a handler waiting for a syscall to return
+    //  3. Child process exited with status code
+    //  4. Child process exited with signal
+    // Handlers never wait for a particular tracee: every tracee moves forward independently of what the others are doing,
+    // and a tracee blocked in the kernel (e.g. the parent of a vfork) can't block the tracer.
+    int status;
+    while (true)
+    {
+        // Passing -1 to waitpid has it wait for a signal from any PID, and __WALL includes the threads of the tracees
+        // The wait call will return the PID of the process that signalled, this should be used as the traceepid
+        // NOTE: this must be done in a single thread, we cannot split this up into separate threads because only the thread that attached the tracee
+        // can issue ptrace commands (and children of a tracee are automatically attached to that same thread)
+        // While attach requests can come in, we only collect the signals that are already there, and wait for more of them (or a request) below
+        m_traceePid = waitpid(-1, &status, __WALL | WNOHANG);
+        if (m_traceePid == 0 && requestFd == -1)
+        {
+            // No tracee is stopped: the reports held back go out before we wait (see EnableTracerReportBuffering)
+            m_bxl->FlushReportBatches();
+            statistics.CountTracerCpu();
+            m_traceePid = waitpid(-1, &status, __WALL);
+        }
+
+        if (m_traceePid == -1 && errno != ECHILD)
+        {
+            // ECHILD indicates that the calling process does not have any more children to wait on
+            // If we don't get this, then we're in an abnormal state, this should be logged
+            std::cerr << "[PTrace] wait returned -1 but did not set errno to ECHILD." << std::endl;
+            _exit(-1);
+        }
+
+        if (m_traceePid <= 0)
+        {
+            m_bxl->FlushReportBatches();
+            statistics.CountTracerCpu(/* force */ requestFd == -1);
+            if (requestFd == -1)
+            {
+                _exit(0);
+            }
+
+            // Nothing to handle until a tracee stops or a new one needs to be attached
+            WaitForTraceeOrRequest(signalFd, requestFd);
+            continue;
+        }
+
+        // Seccomp stops are for the syscalls we inspect; syscall-exit-stops are a second stop for some of them
+        uint64_t stopNs = statistics.Now();
+        HandleTraceeStop(status);
+        statistics.CountTracerStop(status >> 8 == (SIGTRAP | (PTRACE_EVENT_SECCOMP << 8)), stopNs);
+    }
+}
+
+void PTraceSandbox::SeizeTracee(pid_t traceePid, const std::string &exe, const std::string &semaphoreName)
+{
+    // PTRACE_O_TRACESYSGOOD: Sets bit 7 of the signal when delivering a system calls.
+    // PTRACE_O_TRACESECCOMP: Enables ptrace events from seccomp on the child
+    // PTRACE_O_TRACECLONE/FORK/VFORK: Ptrace will signal on clone/fork/vfork before the syscall returns back to the caller
+    // PTRACE_O_TRACEEXIT: ptrace will signal before exit() returns back to the caller.
+    unsigned long options = PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACESECCOMP | PTRACE_O_TRACECLONE | PTRACE_O_TRACEFORK | PTRACE_O_TRACEVFORK | PTRACE_O_TRACEEXIT;
+
+    if (ptrace(PTRACE_SEIZE, traceePid, 0L, options) == -1)
+    {
+        BXL_LOG_DEBUG(m_bxl, "[PTrace] PTRACE_SEIZE failed with error: '%s'", strerror(errno));
+        _exit(-1);
+    }
+
+    // Interrupt the child to verify that the process attached
+    if (ptrace(PTRACE_INTERRUPT, traceePid, 0L, 0L) == -1)
+    {
+        BXL_LOG_DEBUG(m_bxl, "[PTrace] PTRACE_INTERRUPT failed with error: '%s'", strerror(errno));
+        _exit(-1);
+    }
+
+    m_traceePid = traceePid;
+    m_tracees[traceePid] = Tracee { exe };
+
+    // Resume child
+    ResumeTracee(m_traceePid);
+
+    // Attach complete, signal the semaphore for the child to resume
+    sem_t *semaphore = sem_open(semaphoreName.c_str(), O_CREAT, 0644, 0);
+    if (semaphore == NULL)
+    {
+        BXL_LOG_DEBUG(m_bxl, "[PTrace] sem_open failed with: '%s'", strerror(errno));
+        _exit(-1);
+    }
+    sem_post(semaphore); // Increment the semaphore to unblock the traced process
+    sem_close(semaphore);
+}
+
+void PTraceSandbox::WaitForTraceeOrRequest(int signalFd, int &requestFd)
+{
+    struct pollfd pollFds[] = { { signalFd, POLLIN, 0 }, { requestFd, POLLIN, 0 } };
+    if (poll(pollFds, 2, -1) == -1)
+    {
+        if (errno == EINTR)
+        {
+            return;
+        }
+
+        std::cerr << "[PTrace] poll failed with error: '" << strerror(errno) << "'" << std::endl;
+        _exit(-1);
+    }
+
+    if (pollFds[0].revents & POLLIN)
+    {
+        // Several stops may have been signalled by a single SIGCHLD: the caller collects all of them regardless
+        struct signalfd_siginfo info;
+        while (read(signalFd, &info, sizeof(info)) == sizeof(info));
+    }
+
+    if (pollFds[1].revents != 0)
+    {
+        std::vector<AttachRequest> requests;
+        ReadAttachRequests(requestFd, requests);
+        for (const auto &request : requests)
+        {
+            BXL_LOG_DEBUG(m_bxl, "[PTrace] Attaching to PID '%d'", request.pid);
+            SeizeTracee(request.pid, request.exe, "/" + std::to_string(request.pid));
+        }
+    }
+}
+
+void PTraceSandbox::ReadAttachRequests(int &requestFd, std::vector<AttachRequest> &requests)
+{
+    char buffer[4096];
+    ssize_t bytesRead = read(requestFd, buffer, sizeof(buffer));
+    if (bytesRead == -1 && (errno == EINTR || errno == EAGAIN))
+    {
+        return;
+    }
+
+    if (bytesRead <= 0)
+    {
+        // The requester is gone: the tracees we have are the last ones
+        close(requestFd);
+        requestFd = -1;
+        return;
+    }
+
+    m_pendingAttachRequests.append(buffer, bytesRead);
+
+    size_t lineStart = 0;
+    size_t lineEnd;
+    while ((lineEnd = m_pendingAttachRequests.find('\n', lineStart)) != std::string::npos)
+    {
+        std::string line = m_pendingAttachRequests.substr(lineStart, lineEnd - lineStart);
+        lineStart = lineEnd + 1;
+
+        size_t separator = line.find(' ');
+        pid_t pid = atoi(line.c_str());
+        if (pid <= 0)
+        {
+            BXL_LOG_DEBUG(m_bxl, "[PTrace] Ignoring invalid attach request '%s'", line.c_str());
+            continue;
+        }
+
+        requests.push_back({ pid, separator == std::string::npos ? std::string() : line.substr(separator + 1) });
+    }
+
+    m_pendingAttachRequests.erase(0, lineStart);
+}
+
+void PTraceSandbox::HandleTraceeStop(int status)
+{
+    // Handle cases where the child processes has exited
+    if (WIFEXITED(status) || WIFSIGNALED(status))
+    {
+        m_childrenPendingCreation.erase(m_traceePid);
+        return;
+    }
+    else if (!WIFSTOPPED(status))
+    {
+        std::cerr << "[PTrace] wait() returned bad status '" << status << "'" << std::endl;
+        _exit(-1);
+    }
+
+    if (status >> 8 == (SIGTRAP | (PTRACE_EVENT_FORK << 8))
+        || status >> 8 == (SIGTRAP | (PTRACE_EVENT_VFORK << 8))
+        || status >> 8 == (SIGTRAP | (PTRACE_EVENT_CLONE << 8)))
+    {
+        // The child already exists (and is traced) but it doesn't run until we resume it
+        unsigned long childPid = 0;
+        ptrace(PTRACE_GETEVENTMSG, m_traceePid, NULL, &childPid);
+
+        int event = status >> 16;
+        HandleChildProcess(event == PTRACE_EVENT_FORK ? "fork" : (event == PTRACE_EVENT_VFORK ? "vfork" : "clone"), (pid_t)childPid);
+        ResumeTracee(m_traceePid);
+    }
+    else if (status >> 8 == (SIGTRAP | (PTRACE_EVENT_EXIT << 8)))
+    {
+        unsigned long traceeStatus = 0;
+        ptrace(PTRACE_GETEVENTMSG, m_traceePid, NULL, &traceeStatus);
+        BXL_LOG_DEBUG(m_bxl, "[PTrace] Tracee %d exited with exit code '%d'", m_traceePid, WEXITSTATUS(traceeStatus));
+        RemoveFromTraceeTable(/* killed */ WIFSIGNALED(traceeStatus));
+        ptrace(PTRACE_CONT, m_traceePid, NULL, NULL);
+    }
+    else if (status >> 8 == (SIGTRAP | (PTRACE_EVENT_SECCOMP << 8)))
+    {
+        if (FetchRegisters())
+        {
+            HandleSysCallGeneric(GetSyscallNumber());
+        }
+
+        // Unless the handler is waiting for the syscall to return, this resumes the child with PTRACE_CONT to ignore the ptrace-exit-stop for this syscall
+        ResumeTracee(m_traceePid);
+    }
+    else if (WSTOPSIG(status) == (SIGTRAP | 0x80))
+    {
+        // syscall-stop: we only ask for these when a handler waits for a syscall to return
+        auto tracee = m_tracees.find(m_traceePid);
+        if (tracee != m_tracees.end() && tracee->second.onSyscallExit)
+        {
+            // Before Linux 4.8 the seccomp stop happens before the syscall-entry-stop, which then comes first.
+            // On syscall-entry-stops rax holds -ENOSYS.
+            if (FetchRegisters() && (long)ReadArgumentLong(0) != -ENOSYS)
+            {
+                SyscallExitHandler onSyscallExit = tracee->second.onSyscallExit;
+                tracee->second.onSyscallExit = nullptr;
+                (this->*onSyscallExit)(tracee->second.syscallDirfd, tracee->second.syscallPath);
+            }
+        }
+
+        ResumeTracee(m_traceePid);
+    }
+    else if (status >> 16 == PTRACE_EVENT_STOP && m_tracees.find(m_traceePid) == m_tracees.end())
+    {
+        // Initial stop of a new child whose creation event hasn't been seen on its parent yet. HandleChildProcess resumes it.
+        m_childrenPendingCreation.insert(m_traceePid);
+    }
+    else if (!(WSTOPSIG(status) & 0x80))
+    {
+        // This is a signal-delivery-stop, this means that the tracee stopped during signal delivery
+        // We don't care about these events, but when restarting the tracee we must deliver the signal by setting the last argument to ptrace(...)
+        // signal-delivery-stop can be differentiated from sys calls events by checking whether the 7th bit is set on the signal (WSTOPSIG(status) & 0x80)
+        ResumeTracee(m_traceePid, WSTOPSIG(status));
+    }
+    else
+    {
+        ResumeTracee(m_traceePid);
+    }
+}
+
+void PTraceSandbox::AttachWithUserNotifications(pid_t traceePid, std::string exe, std::string semaphoreName, int requestFd)
+{
+    BXL_LOG_DEBUG(m_bxl, "[PTrace] Starting tracer PID '%d' to supervise PID '%d' with seccomp user notifications", getpid(), traceePid);
+    m_useUserNotifications = true;
+    m_bxl->disable_fd_table();
+    m_bxl->EnableTracerReportBuffering();
+
+    TakeOverListener(traceePid, exe, semaphoreName);
+    AccessStatistics &statistics = m_bxl->GetAccessStatistics();
+
+    struct seccomp_notif_sizes sizes;
+    if (syscall(__NR_seccomp, SECCOMP_GET_NOTIF_SIZES, 0, &sizes) == -1)
+    {
+        BXL_LOG_DEBUG(m_bxl, "[PTrace] SECCOMP_GET_NOTIF_SIZES failed with: '%s'", strerror(errno));
+        _exit(-1);
+    }
+
+    // The kernel may use larger structures than the ones we were compiled with
+    std::vector<char> notificationBuffer(std::max((size_t)sizes.seccomp_notif, sizeof(struct seccomp_notif)));
+    std::vector<char> responseBuffer(std::max((size_t)sizes.seccomp_notif_resp, sizeof(struct seccomp_notif_resp)));
+    struct seccomp_notif *notification = (struct seccomp_notif *)notificationBuffer.data();
+    struct seccomp_notif_resp *response = (struct seccomp_notif_resp *)responseBuffer.data();
+    std::vector<struct pollfd> pollFds;
+    std::vector<pid_t> pollPids;
+    std::vector<AttachRequest> requests;
+
+    // Main loop that handles the notifications from the tracees
+    // Tracees are never stopped: only the thread making a filtered syscall waits, and only until we answer its notification
+    while (true)
+    {
+        // The request descriptor comes first (poll ignores it once it is closed), then the listeners and then the exit descriptors
+        pollFds.clear();
+        pollPids.clear();
+        pollFds.push_back({ requestFd, POLLIN, 0 });
+        for (int listenerFd : m_listenerFds)
+        {
+            pollFds.push_back({ listenerFd, POLLIN, 0 });
+        }
+
+        size_t firstExitFd = pollFds.size();
+        for (const auto &process : m_processExitFds)
+        {
+            pollFds.push_back({ process.second, POLLIN, 0 });
+            pollPids.push_back(process.first);
+        }
+
+        int ready = poll(pollFds.data(), pollFds.size(), 0);
+        if (ready == 0)
+        {
+            // Nothing to handle right now: the reports held back go out before we wait (see EnableTracerReportBuffering)
+            m_bxl->FlushReportBatches();
+            statistics.CountTracerCpu();
+            ready = poll(pollFds.data(), pollFds.size(), -1);
+        }
+
+        if (ready == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            std::cerr << "[PTrace] poll failed with error: '" << strerror(errno) << "'" << std::endl;
+            _exit(-1);
+        }
+
+        for (size_t i = 1; i < firstExitFd; i++)
+        {
+            if (!(pollFds[i].revents & POLLIN))
+            {
+                continue;
+            }
+
+            m_listenerFd = pollFds[i].fd;
+            memset(notification, 0, notificationBuffer.size());
+            if (ioctl(m_listenerFd, SECCOMP_IOCTL_NOTIF_RECV, notification) == 0)
+            {
+                uint64_t stopNs = statistics.Now();
+                memset(response, 0, responseBuffer.size());
+                HandleNotification(notification, response);
+
+                // ENOENT means the tracee was killed (or interrupted by a signal) while we handled the notification
+                if (ioctl(m_listenerFd, SECCOMP_IOCTL_NOTIF_SEND, response) == -1 && errno != ENOENT)
+                {
+                    BXL_LOG_DEBUG(m_bxl, "[PTrace] SECCOMP_IOCTL_NOTIF_SEND failed for tracee '%d': '%s'", m_traceePid, strerror(errno));
+                }
+
+                statistics.CountTracerStop(true, stopNs);
+            }
+            else if (errno != EINTR && errno != ENOENT)
+            {
+                std::cerr << "[PTrace] SECCOMP_IOCTL_NOTIF_RECV failed with error: '" << strerror(errno) << "'" << std::endl;
+                _exit(-1);
+            }
+        }
+
+        // Exited processes don't have pending notifications, so their exit is always reported after all their accesses
+        for (size_t i = firstExitFd; i < pollFds.size(); i++)
+        {
+            if (pollFds[i].revents != 0)
+            {
+                RemoveProcess(pollPids[i - firstExitFd]);
+            }
+        }
+
+        // Since Linux 5.8, a listener reports POLLHUP once no process uses its filter anymore. Until then we get killed when the pip is done.
+        for (size_t i = 1; i < firstExitFd; i++)
+        {
+            if (pollFds[i].revents & (POLLHUP | POLLERR))
+            {
+                close(pollFds[i].fd);
+                m_listenerFds.erase(std::find(m_listenerFds.begin(), m_listenerFds.end(), pollFds[i].fd));
+            }
+        }
+
+        if (pollFds[0].revents != 0)
+        {
+            requests.clear();
+            ReadAttachRequests(requestFd, requests);
+            for (const auto &request : requests)
+            {
+                BXL_LOG_DEBUG(m_bxl, "[PTrace] Supervising PID '%d'", request.pid);
+                TakeOverListener(request.pid, request.exe, "/" + std::to_string(request.pid));
+            }
+        }
+
+        if (m_listenerFds.empty() && requestFd == -1)
+        {
+            while (!m_processExitFds.empty())
+            {
+                RemoveProcess(m_processExitFds.begin()->first);
+            }
+
+            m_bxl->FlushReportBatches();
+            statistics.CountTracerCpu(/* force */ true);
+            _exit(0);
+        }
+    }
+}
+
+void PTraceSandbox::TakeOverListener(pid_t traceePid, const std::string &exe, const std::string &semaphoreName)
+{
+    // The tracee sets its filter once we posted this semaphore, and then posts the other one for us to take over the listener
+    std::string listenerSemaphoreName = semaphoreName + ListenerSemaphoreSuffix;
+    sem_t *semaphore = sem_open(semaphoreName.c_str(), O_CREAT, 0644, 0);
+    sem_t *listenerSemaphore = sem_open(listenerSemaphoreName.c_str(), O_CREAT, 0644, 0);
+    if (semaphore == SEM_FAILED || listenerSemaphore == SEM_FAILED)
+    {
+        BXL_LOG_DEBUG(m_bxl, "[PTrace] sem_open failed with: '%s'", strerror(errno));
+        _exit(-1);
+    }
+
+    sem_post(semaphore);
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += 15;
+    auto waitResult = sem_timedwait(listenerSemaphore, &ts);
+    sem_close(listenerSemaphore);
+    if (waitResult == -1)
+    {
+        BXL_LOG_DEBUG(m_bxl, "[PTrace] Tracee '%d' failed to set its seccomp listener within 15 seconds: '%s'", traceePid, strerror(errno));
+        _exit(-1);
+    }
+
+    int pidfd = syscall(__NR_pidfd_open, traceePid, 0);
+    int traceeListenerFd = pidfd == -1 ? -1 : FindListenerFd(traceePid);
+    int listenerFd = traceeListenerFd == -1 ? -1 : syscall(__NR_pidfd_getfd, pidfd, traceeListenerFd, 0);
+    if (listenerFd == -1)
+    {
+        BXL_LOG_DEBUG(m_bxl, "[PTrace] Failed to take over the seccomp listener of tracee '%d': '%s'", traceePid, strerror(errno));
+        _exit(-1);
+    }
+
+    // A process handed off to the interposing sandbox (see HandOffToInterposition) sets a filter of its own to execute a statically linked
+    // image, whose listener takes precedence over the one we had for it
+    auto previousExitFd = m_processExitFds.find(traceePid);
+    if (previousExitFd != m_processExitFds.end())
+    {
+        close(previousExitFd->second);
+    }
+
+    m_listenerFds.push_back(listenerFd);
+    m_traceePid = traceePid;
+    m_tracees[traceePid] = Tracee { exe };
+    m_threadGroups[traceePid] = traceePid;
+    m_processExitFds[traceePid] = pidfd;
+
+    // Attach complete, signal the semaphore for the tracee to exec
+    sem_post(semaphore);
+    sem_close(semaphore);
+}
+
+void PTraceSandbox::HandleNotification(const struct seccomp_notif *notification, struct seccomp_notif_resp *response)
+{
+    // seccomp identifies the thread making the syscall, but accesses are reported for its process (as the interposing sandbox does)
+    m_traceePid = GetThreadGroup(notification->pid);
+    if (m_tracees.find(m_traceePid) == m_tracees.end())
+    {
+        AddProcess(m_traceePid);
+    }
+
+    m_notification = notification;
+    m_syscallPerformed = false;
+    m_syscallReturnValue = 0;
+    HandleSysCallGeneric(notification->data.nr);
+    m_notification = nullptr;
+
+    response->id = notification->id;
+    if (!m_syscallPerformed)
+    {
+        response->flags = SECCOMP_USER_NOTIF_FLAG_CONTINUE;
+    }
+    else if (m_syscallReturnValue < 0)
+    {
+        response->error = m_syscallReturnValue;
+    }
+    else
+    {
+        response->val = m_syscallReturnValue;
+    }
+}
+
+void PTraceSandbox::AddProcess(pid_t pid)
+{
+    // There are no notifications for fork/clone, so the creation of a process is reported when it makes its first filtered syscall
+    // (which is before it reports any access). Processes that never make one are never reported.
+    pid_t parentPid = ReadProcessStatusField(pid, "PPid");
+    m_traceePid = parentPid == -1 ? 0 : parentPid;
+    HandleChildProcess("fork", pid);
+    m_traceePid = pid;
+
+    int pidfd = syscall(__NR_pidfd_open, pid, 0);
+    if (pidfd == -1)
+    {
+        BXL_LOG_DEBUG(m_bxl, "[PTrace] pidfd_open failed for tracee '%d', its exit won't be reported: '%s'", pid, strerror(errno));
+        return;
+    }
+
+    m_processExitFds[pid] = pidfd;
+}
+
+void PTraceSandbox::RemoveProcess(pid_t pid)
+{
+    auto exitFd = m_processExitFds.find(pid);
+    if (exitFd != m_processExitFds.end())
+    {
+        close(exitFd->second);
+        m_processExitFds.erase(exitFd);
+    }
+
+    for (auto thread = m_threadGroups.begin(); thread != m_threadGroups.end();)
+    {
+        thread = thread->second == pid ? m_threadGroups.erase(thread) : std::next(thread);
+    }
+
+    if (m_tracees.find(pid) != m_tracees.end())
+    {
+        BXL_LOG_DEBUG(m_bxl, "[PTrace] Tracee %d exited", pid);
+        m_traceePid = pid;
+        RemoveFromTraceeTable();
+    }
+}
+
+pid_t PTraceSandbox::GetThreadGroup(pid_t tid)
+{
+    auto threadGroup = m_threadGroups.find(tid);
+    if (threadGroup != m_threadGroups.end())
+    {
+        return threadGroup->second;
+    }
+
+    pid_t pid = ReadProcessStatusField(tid, "Tgid");
+    if (pid == -1)
+    {
+        pid = tid;
+    }
+
+    m_threadGroups[tid] = pid;
+    return pid;
+}
+
+long PTraceSandbox::PerformSyscallForTracee(int dirfd, const std::string &path)
+{
+    // Make sure the tracee is still waiting on this notification (i.e., it wasn't killed and its pid reused) before acting on its behalf
+    if (ioctl(m_listenerFd, SECCOMP_IOCTL_NOTIF_ID_VALID, &m_notification->id) == -1)
+    {
+        return -ENOENT;
+    }
+
+    pid_t tid = m_notification->pid;
+
+    // Relative paths are resolved against the working directory (or the descriptor) of the tracee
+    int resolvedDirfd = AT_FDCWD;
+    if (path.empty() || path[0] != '/')
+    {
+        std::string directory = "/proc/" + std::to_string(tid) + (dirfd == AT_FDCWD ? "/cwd" : "/fd/" + std::to_string(dirfd));
+        resolvedDirfd = open(directory.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+        if (resolvedDirfd == -1)
+        {
+            return dirfd != AT_FDCWD && errno == ENOENT ? -EBADF : -errno;
+        }
+    }
+
+    long result;
+    switch (m_notification->data.nr)
+    {
+        case SYSCALL_NAME_TO_NUMBER(mkdir):
+        case SYSCALL_NAME_TO_NUMBER(mkdirat):
+        {
+            mode_t mode = m_notification->data.nr == SYSCALL_NAME_TO_NUMBER(mkdir) ? m_notification->data.args[1] : m_notification->data.args[2];
+
+            // The kernel applies the umask of the calling process (unless the parent directory has a default ACL)
+            long traceeUmask = ReadProcessStatusField(tid, "Umask", 8);
+            mode_t previousUmask = umask(traceeUmask == -1 ? 0022 : (mode_t)traceeUmask);
+            result = mkdirat(resolvedDirfd, path.c_str(), mode) == -1 ? -errno : 0;
+            umask(previousUmask);
+            break;
+        }
+        case SYSCALL_NAME_TO_NUMBER(rmdir):
+            result = unlinkat(resolvedDirfd, path.c_str(), AT_REMOVEDIR) == -1 ? -errno : 0;
+            break;
+        default:
+            result = -ENOSYS;
+            break;
+    }
+
+    if (resolvedDirfd != AT_FDCWD)
+    {
+        close(resolvedDirfd);
+    }
+
+    return result;
+}
+
+void PTraceSandbox::ResumeTracee(pid_t pid, int signal)
+{
+    auto tracee = m_tracees.find(pid);
+    bool waitForSyscallExit = tracee != m_tracees.end() && tracee->second.onSyscallExit;
+    ptrace(waitForSyscallExit ? PTRACE_SYSCALL : PTRACE_CONT, pid, NULL, signal);
+}
+
+void PTraceSandbox::WaitForSyscallExit(SyscallExitHandler onSyscallExit, int dirfd, const std::string &path)
+{
+    if (m_useUserNotifications)
+    {
+        // There are no syscall-exit-stops with user notifications: the syscall is performed here on behalf of the tracee,
+        // which gets its return value, so we know the result before reporting it
+        m_syscallReturnValue = PerformSyscallForTracee(dirfd, path);
+        m_syscallPerformed = true;
+        (this->*onSyscallExit)(dirfd, path);
+        return;
+    }
+
+    auto tracee = m_tracees.find(m_traceePid);
+    if (tracee == m_tracees.end())
+    {
+        // Not expected: every tracee is added on creation. Keep track of it from now on.
+        tracee = m_tracees.emplace(m_traceePid, Tracee { m_bxl->GetProgramPath() }).first;
+    }
+
+    tracee->second.onSyscallExit = onSyscallExit;
+    tracee->second.syscallDirfd = dirfd;
+    tracee->second.syscallPath = path;
+}
+
+void PTraceSandbox::RemoveFromTraceeTable(bool killed)
+{
+    bool interposed = IsInterposedTracee();
+
+    // A tracee can exit in the middle of a syscall (e.g. killed by a signal), so it won't be waiting for it to return anymore
+    auto tracee = m_tracees.find(m_traceePid);
+    if (tracee != m_tracees.end() && tracee->second.onSyscallExit == &PTraceSandbox::EndCwdChange)
+    {
+        EndCwdChange(AT_FDCWD, tracee->second.syscallPath);
+    }
+
+    m_tracees.erase(m_traceePid);
+    m_bxl->forget_tracee_cwd(m_traceePid);
+
+    // libDetours reports the exit of the processes handed off to it, after all their accesses (which a report from here could overtake)
+    if (!interposed || killed)
+    {
+        Handleexit();
+    }
+}
+
+bool PTraceSandbox::FetchRegisters()
+{
+#if defined(__aarch64__)
+    // arm64 has no PTRACE_GETREGS: the general purpose registers are the NT_PRSTATUS register set
+    struct iovec registers = { &m_registers, sizeof(m_registers) };
+    return ptrace(PTRACE_GETREGSET, m_traceePid, NT_PRSTATUS, &registers) != -1;
+#else
+    return ptrace(PTRACE_GETREGS, m_traceePid, NULL, &m_registers) != -1;
+#endif
 }
 
-void PTraceSandbox::AttachToProcess(pid_t traceePid, std::string exe, std::string semaphoreName)
+long PTraceSandbox::GetSyscallNumber()
 {
-    BXL_LOG_DEBUG(m_bxl, "[PTrace] Starting tracer PID '%d' to trace PID '%d'", getpid(), traceePid);
+#if defined(__aarch64__)
+    return m_registers.regs[8];
+#else
+    return m_registers.orig_rax;
+#endif
+}
 
-    // PTRACE_O_TRACESYSGOOD: Sets bit 7 of the signal when delivering a system calls.
-    // PTRACE_O_TRACESECCOMP: Enables ptrace events from seccomp on the child
-    // PTRACE_O_TRACECLONE/FORK/VFORK: Ptrace will signal on clone/fork/vfork before the syscall returns back to the caller
-    // PTRACE_O_TRACEEXIT: ptrace will signal before exit() returns back to the caller.
-    unsigned long options = PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACESECCOMP | PTRACE_O_TRACECLONE | PTRACE_O_TRACEFORK | PTRACE_O_TRACEVFORK | PTRACE_O_TRACEEXIT;
+std::string PTraceSandbox::ReadArgumentString(char *syscall, int argumentIndex, bool nullTerminated, int length)
+{
+    std::string argument;
+    ReadArgumentStrings(syscall, &argumentIndex, &argument, 1, nullTerminated, length);
+    return argument;
+}
 
-    int status;
-    if (ptrace(PTRACE_SEIZE, traceePid, 0L, options) == -1)
+void PTraceSandbox::ReadArgumentStrings(char *syscall, const int argumentIndexes[], std::string arguments[], int count, bool nullTerminated, int length)
+{
+    // We are only interested in reading paths from the arguments so PATH_MAX (+1 for null terminator) should be safe to use here
+    char buffers[MaxArgumentStringsPerRead][PATH_MAX + 1];
+    char *addresses[MaxArgumentStringsPerRead];
+    size_t sizes[MaxArgumentStringsPerRead];
+    struct iovec local[MaxArgumentStringsPerRead];
+    // Each argument spans at most PATH_MAX bytes, so with pages of at least PATH_MAX bytes it is split in at most 2 page-bounded chunks.
+    // With smaller pages we just read less with process_vm_readv, and PTRACE_PEEKTEXT reads the rest.
+    struct iovec remote[MaxArgumentStringsPerRead * 2];
+    int remoteCount = 0;
+
+    if (count > MaxArgumentStringsPerRead)
     {
-        BXL_LOG_DEBUG(m_bxl, "[PTrace] PTRACE_SEIZE failed with error: '%s'", strerror(errno));
-        _exit(-1);
+        count = MaxArgumentStringsPerRead;
     }
 
-    // Interrupt the child to verify that the process attached
-    if (ptrace(PTRACE_INTERRUPT, traceePid, 0L, 0L) == -1)
+    for (int i = 0; i < count; i++)
     {
-        BXL_LOG_DEBUG(m_bxl, "[PTrace] PTRACE_INTERRUPT failed with error: '%s'", strerror(errno));
-        _exit(-1);
-    }
-
-    m_traceePid = traceePid;
-    m_traceeTable.push_back(std::make_tuple(traceePid, exe));
-    m_bxl->disable_fd_table();
-
-    // Resume child
-    ptrace(PTRACE_SYSCALL, m_traceePid, 0, 0);
+        addresses[i] = (char *)ReadArgumentLong(argumentIndexes[i]);
+        sizes[i] = addresses[i] == nullptr ? 0 : (length > 0 ? std::min(length, PATH_MAX) : PATH_MAX);
+
+        // Locally, each argument gets exactly as many bytes as its remote chunks cover
+        int chunkCount = SplitInPages(addresses[i], sizes[i], &remote[remoteCount], 2);
+        local[i].iov_base = buffers[i];
+        local[i].iov_len = 0;
+        for (int j = 0; j < chunkCount; j++)
+        {
+            local[i].iov_len += remote[remoteCount + j].iov_len;
+        }
 
-    // Attach complete, signal the semaphore for the child to resume
-    sem_t *semaphore = sem_open(semaphoreName.c_str(), O_CREAT, 0644, 0);
-    if (semaphore == NULL)
-    {
-        BXL_LOG_DEBUG(m_bxl, "[PTrace] sem_open failed with: '%s'", strerror(errno));
-        _exit(-1);
+        remoteCount += chunkCount;
     }
-    sem_post(semaphore); // Increment the semaphore to unblock the traced process
-    sem_close(semaphore);
 
-    // Main loop that handles signals from the child
-    // wait should get signalled from the following:
-    //  1. ptrace event (seccomp, clone, fork, vfork, exit)
-    //  2. Child process exited with status code
-    //  3. Child process exited with signal
-    while (true)
+    size_t transferred = ReadProcessMemory(local, count, remote, remoteCount);
+
+    // The local buffers are filled in order, so the transferred bytes go to the first arguments
+    for (int i = 0; i < count; i++)
     {
-        // Passing -1 to waitpid has it wait for a signal from any PID
-        // A call to wait is equivalent to waitpid(-1, &status, 0);
-        // The wait call will return the PID of the process that signalled, this should be used as the traceepid
-        // NOTE: this must be done in a single thread, we cannot split this up into separate threads because only the thread that attached the tracee can issue ptrace commands
-        m_traceePid = wait(&status);
+        size_t read = std::min(local[i].iov_len, transferred);
+        transferred -= read;
 
-        if (m_traceePid == -1)
+        if (read < sizes[i] && (!nullTerminated || memchr(buffers[i], '\0', read) == nullptr))
         {
-            // ECHILD indicates that the calling process does not have any more children to wait on
-            // If we don't get this, then we're in an abnormal state, this should be logged
-            if (errno != ECHILD)
+            // The transfer stopped before getting to the end of this argument: a previous argument (or this one) reaches
+            // a page that can't be read, or process_vm_readv is not available. Retry just this argument, and then fall back to
+            // PTRACE_PEEKTEXT, which can read pages process_vm_readv can't (e.g. pages that are not readable by the tracee itself).
+            struct iovec remoteRemainder[2];
+            int remainderCount = SplitInPages(addresses[i] + read, sizes[i] - read, remoteRemainder, 2);
+            struct iovec localRemainder = { buffers[i] + read, 0 };
+            for (int j = 0; j < remainderCount; j++)
             {
-                std::cerr << "[PTrace] wait returned -1 but did not set errno to ECHILD." << std::endl;
-                _exit(-1);
+                localRemainder.iov_len += remoteRemainder[j].iov_len;
             }
 
-            _exit(0);
+            read += ReadProcessMemory(&localRemainder, 1, remoteRemainder, remainderCount);
+
+            if (read < sizes[i] && (!nullTerminated || memchr(buffers[i], '\0', read) == nullptr))
+            {
+                // Without ptrace (user notifications), /proc/pid/mem can still read those pages
+                read += m_useUserNotifications
+                    ? ReadTraceeMemFile(addresses[i] + read, buffers[i] + read, sizes[i] - read)
+                    : PeekTraceeMemory(syscall, argumentIndexes[i], addresses[i] + read, buffers[i] + read, sizes[i] - read, nullTerminated);
+            }
         }
 
-        // Handle cases where the child processes has exited
-        if (WIFEXITED(status) || WIFSIGNALED(status))
+        arguments[i].assign(buffers[i], strnlen(buffers[i], read));
+    }
+}
+
+int PTraceSandbox::SplitInPages(char *address, size_t size, struct iovec *chunks, int maxChunks)
+{
+    // process_vm_readv stops at the first chunk that can't be read, and never transfers part of a chunk. So chunks must
+    // not span pages: otherwise a string that ends right before an unmapped page would fail to be read.
+    int count = 0;
+    while (size > 0 && count < maxChunks)
+    {
+        size_t chunk = std::min(size, m_pageSize - ((uintptr_t)address % m_pageSize));
+        chunks[count].iov_base = address;
+        chunks[count].iov_len = chunk;
+        count++;
+        address += chunk;
+        size -= chunk;
+    }
+
+    return count;
+}
+
+size_t PTraceSandbox::ReadProcessMemory(const struct iovec *local, int localCount, const struct iovec *remote, int remoteCount)
+{
+    if (!m_canReadProcessMemory || remoteCount == 0)
+    {
+        return 0;
+    }
+
+    ssize_t transferred = process_vm_readv(m_traceePid, local, localCount, remote, remoteCount, 0);
+    if (transferred == -1)
+    {
+        if (errno == ENOSYS || errno == EPERM)
         {
-            continue;
+            BXL_LOG_DEBUG(m_bxl, "[PTrace] process_vm_readv is not available, falling back to PTRACE_PEEKTEXT: '%s'", strerror(errno));
+            m_canReadProcessMemory = false;
         }
-        else if (!WIFSTOPPED(status))
+
+        return 0;
+    }
+
+    return transferred;
+}
+
+size_t PTraceSandbox::PeekTraceeMemory(char *syscall, int argumentIndex, char *address, char *buffer, size_t size, bool nullTerminated)
+{
+    size_t read = 0;
+    while (read < size)
+    {
+        // A word can legitimately be -1, so errno is what tells us whether the peek failed
+        errno = 0;
+        long word = ptrace(PTRACE_PEEKTEXT, m_traceePid, address + read, NULL);
+        if (word == -1 && errno != 0)
         {
-            std::cerr << "[PTrace] wait() returned bad status '" << status << "'" << std::endl;
-            _exit(-1);
+            BXL_LOG_DEBUG(m_bxl, "[PTrace] Error occured while executing PTRACE_PEEKTEXT for syscall '%s' argument '%d' : '%s'", syscall, argumentIndex, strerror(errno));
             break;
         }
 
-        // Handle vfork/seccomp
-        if (status >> 8 == (SIGTRAP | (PTRACE_EVENT_VFORK << 8)))
-        {
-            // This case is explicitly skipped, and handled by PTraceSandbox::UpdateTraceeTableForExec
-            ptrace(PTRACE_SYSCALL, m_traceePid, NULL, NULL);
-        }
-        else if (status >> 8 == (SIGTRAP | (PTRACE_EVENT_EXIT << 8)))
-        {
-            unsigned long traceeStatus = 0;
-            ptrace(PTRACE_GETEVENTMSG, m_traceePid, NULL, &traceeStatus);
-            BXL_LOG_DEBUG(m_bxl, "[PTrace] Tracee %d exited with exit code '%d'", m_traceePid, WEXITSTATUS(traceeStatus));
-            RemoveFromTraceeTable();
-            ptrace(PTRACE_SYSCALL, m_traceePid, NULL, NULL);
-        }
-        else if (status >> 8 == (SIGTRAP | (PTRACE_EVENT_SECCOMP << 8)))
-        {
-            long syscallNumber = ptrace(PTRACE_PEEKUSER, m_traceePid, sizeof(long) * ORIG_RAX, NULL);
-            HandleSysCallGeneric(syscallNumber);
+        size_t chunk = std::min(sizeof(long), size - read);
+        memcpy(buffer + read, &word, chunk);
+        read += chunk;
 
-            // We can resume the child with PTRACE_CONT here to ignore the ptrace-exit-stop for this syscall
-            ptrace(PTRACE_CONT, m_traceePid, NULL, NULL);
-        }
-        else if (WIFSTOPPED(status) && !(WSTOPSIG(status) & 0x80))
+        if (nullTerminated && memchr(&word, '\0', chunk) != nullptr)
         {
-            // This is a signal-delivery-stop, this means that the tracee stopped during signal delivery
-            // We don't care about these events, but when restarting the tracee we must deliver the signal by setting the last argument to ptrace(...)
-            // signal-delivery-stop can be differentiated from sys calls events by checking whether the 7th bit is set on the signal (WSTOPSIG(status) & 0x80)
-            ptrace(PTRACE_SYSCALL, m_traceePid, NULL, WSTOPSIG(status));
-        }
-        else
-        {
-            // We can ignore the ptrace-exit-stop for fork/vfork/clone/exit events here
-            ptrace(PTRACE_SYSCALL, m_traceePid, NULL, NULL);
+            break;
         }
     }
-}
 
-void PTraceSandbox::RemoveFromTraceeTable()
-{
-    m_traceeTable.erase(std::remove_if
-    (
-        m_traceeTable.begin(),
-        m_traceeTable.end(),
-        [this](const std::tuple<pid_t, std::string>& item) { return std::get<0>(item) == m_traceePid; }
-    ), m_traceeTable.end());
-
-    Handleexit();
+    return read;
 }
 
-void *PTraceSandbox::GetArgumentAddr(int index)
+size_t PTraceSandbox::ReadTraceeMemFile(char *address, char *buffer, size_t size)
 {
-    long addr = sizeof(long);
+    std::string memPath = "/proc/" + std::to_string(m_traceePid) + "/mem";
+    int memFd = open(memPath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (memFd == -1)
+    {
+        BXL_LOG_DEBUG(m_bxl, "[PTrace] Failed to open '%s': '%s'", memPath.c_str(), strerror(errno));
+        return 0;
+    }
 
-    // Order of first 6 arguments: %rdi, %rsi, %rdx, %rcx, %r8, and %r9
-    switch (index) {
-        case 0: // Return value
-            addr *= RAX;
-            break;
-        case 1:
-            addr *= RDI;
-            break;
-        case 2:
-            addr *= RSI;
-            break;
-        case 3:
-            addr *= RDX;
-            break;
-        case 4:
-            addr *= R10;
-            break;
-        case 5:
-            addr *= R8;
-            break;
-        case 6:
-            addr *= R9;
-            break;
-        default:
-            // Remaining arguments should be on the stack, but for what we need
-            // the above 6 should be good enough and we should never hit this case
-            addr = 0L;
+    // Read page by page, so we get everything up to the first page that can't be read
+    struct iovec chunk;
+    size_t read = 0;
+    while (read < size && SplitInPages(address + read, size - read, &chunk, 1) == 1)
+    {
+        ssize_t chunkRead = pread(memFd, buffer + read, chunk.iov_len, (off_t)(uintptr_t)chunk.iov_base);
+        if (chunkRead <= 0)
+        {
             break;
+        }
+
+        read += chunkRead;
     }
 
-    return (void *)addr;
+    close(memFd);
+    return read;
 }
 
-std::string PTraceSandbox::ReadArgumentString(char *syscall, int argumentIndex, bool nullTerminated, int length)
+size_t PTraceSandbox::ReadTraceeMemory(char *syscall, char *address, char *buffer, size_t size, bool nullTerminated)
 {
-    void *addr = GetArgumentAddr(argumentIndex);
-    // We are only interested in reading paths from the arguments so PATH_MAX (+1 for null terminator) should be safe to use here
-    char argument[PATH_MAX + 1];
-    char *addrRegValue = (char *)ptrace(PTRACE_PEEKUSER, m_traceePid, addr, 0);
-    int currentStringLength = 0;
-
-    while (true)
+    // A page at a time, so that a string that ends right before an unmapped page is still read
+    size_t read = 0;
+    struct iovec remote;
+    while (read < size && SplitInPages(address + read, size - read, &remote, 1) == 1)
     {
-        long addrMemoryLocation = ptrace(PTRACE_PEEKTEXT, m_traceePid, addrRegValue, NULL);
-        if (addrMemoryLocation == -1)
+        struct iovec local = { buffer + read, remote.iov_len };
+        size_t chunkRead = ReadProcessMemory(&local, 1, &remote, 1);
+        if (chunkRead == 0)
         {
-            BXL_LOG_DEBUG(m_bxl, "[PTrace] Error occured while executing PTRACE_PEEKTEXT for syscall '%s' argument '%d' : '%s'", syscall, argumentIndex, strerror(errno));
-            argument[currentStringLength] = '\0';
             break;
         }
 
-        addrRegValue += sizeof(long);
+        read += chunkRead;
+        if (nullTerminated && memchr(buffer + read - chunkRead, '\0', chunkRead) != nullptr)
+        {
+            return read;
+        }
+    }
+
+    if (read < size)
+    {
+        // Same fallbacks as ReadArgumentStrings
+        read += m_useUserNotifications
+            ? ReadTraceeMemFile(address + read, buffer + read, size - read)
+            : PeekTraceeMemory(syscall, /* argumentIndex */ 0, address + read, buffer + read, size - read, nullTerminated);
+    }
 
-        char *currentArgReadChar = (char *)&addrMemoryLocation;
-        bool finishedReadingArgument = false;
+    return read;
+}
 
-        for (int i = 0; i < sizeof(long); i++)
+bool PTraceSandbox::ReadTraceeStringArray(char *syscall, char *array, std::vector<std::string> &strings)
+{
+    // The kernel doesn't take more than MAX_ARG_STRLEN bytes for a string of an exec
+    const size_t maxStringLength = 32 * m_pageSize;
+    char *pointers[64];
+    char buffer[256];
+    while (array != nullptr)
+    {
+        size_t count = ReadTraceeMemory(syscall, array, (char *)pointers, sizeof(pointers), /* nullTerminated */ false) / sizeof(char *);
+        if (count == 0)
         {
-            argument[currentStringLength] = *currentArgReadChar;
-            currentStringLength++;
+            return false;
+        }
 
-            if ((nullTerminated && *currentArgReadChar == '\0') || (length > 0 && currentStringLength == length))
+        for (size_t i = 0; i < count; i++)
+        {
+            if (pointers[i] == nullptr)
             {
-                finishedReadingArgument = true;
-                break;
+                return true;
             }
 
-            currentArgReadChar++;
-        }
+            std::string string;
+            size_t length;
+            do
+            {
+                size_t read = ReadTraceeMemory(syscall, pointers[i] + string.length(), buffer, sizeof(buffer), /* nullTerminated */ true);
+                length = strnlen(buffer, read);
+                string.append(buffer, length);
+            }
+            while (length == sizeof(buffer) && string.length() < maxStringLength);
 
-        if (finishedReadingArgument)
-        {
-            argument[currentStringLength] = '\0';
-            break;
+            strings.push_back(std::move(string));
         }
+
+        array += count * sizeof(char *);
     }
 
-    return std::string(argument);
+    return true;
 }
 
 unsigned long PTraceSandbox::ReadArgumentLong(int argumentIndex)
 {
-    void *addr = GetArgumentAddr(argumentIndex);
-    return ptrace(PTRACE_PEEKUSER, m_traceePid, addr, NULL);
+    if (m_useUserNotifications)
+    {
+        // seccomp decoded the arguments already. There is no return value unless we performed the syscall for the tracee.
+        return argumentIndex >= 1 && argumentIndex <= 6 ? m_notification->data.args[argumentIndex - 1] : m_syscallReturnValue;
+    }
+
+#if defined(__aarch64__)
+    // Arguments are passed in x0-x5, and the return value replaces the first one
+    return argumentIndex >= 1 && argumentIndex <= 6 ? m_registers.regs[argumentIndex - 1] : m_registers.regs[0];
+#else
+    // Order of first 6 arguments: %rdi, %rsi, %rdx, %r10, %r8, and %r9
+    switch (argumentIndex)
+    {
+        case 1:
+            return m_registers.rdi;
+        case 2:
+            return m_registers.rsi;
+        case 3:
+            return m_registers.rdx;
+        case 4:
+            return m_registers.r10;
+        case 5:
+            return m_registers.r8;
+        case 6:
+            return m_registers.r9;
+        default: // Return value
+            return m_registers.rax;
+    }
+#endif
 }
 
 int PTraceSandbox::GetErrno()
@@ -403,6 +1379,12 @@ int PTraceSandbox::GetErrno()
 // Handlers for each syscall
 void PTraceSandbox::HandleSysCallGeneric(int syscallNumber)
 {
+    // libDetours reports the accesses of the processes handed off to it: we only follow their execs (see HandOffToInterposition)
+    if (syscallNumber != SYSCALL_NAME_TO_NUMBER(execve) && syscallNumber != SYSCALL_NAME_TO_NUMBER(execveat) && IsInterposedTracee())
+    {
+        return;
+    }
+
     switch (syscallNumber)
     {
         CHECK_AND_CALL_HANDLER(execveat);
@@ -452,8 +1434,12 @@ void PTraceSandbox::HandleSysCallGeneric(int syscallNumber)
         CHECK_AND_CALL_HANDLER(sendfile);
         CHECK_AND_CALL_HANDLER(copy_file_range);
         CHECK_AND_CALL_HANDLER(name_to_handle_at);
-        CHECK_AND_CALL_HANDLER(fork);
-        CHECK_AND_CALL_HANDLER(clone);
+        CHECK_AND_CALL_HANDLER(dup);
+        CHECK_AND_CALL_HANDLER(dup2);
+        CHECK_AND_CALL_HANDLER(dup3);
+        CHECK_AND_CALL_HANDLER(fcntl);
+        CHECK_AND_CALL_HANDLER(chdir);
+        CHECK_AND_CALL_HANDLER(fchdir);
         default:
             // This should not happen in theory with filtering enabled
             // However if it does occur, we can ignore this syscall and log a message for debugging if necessary
@@ -464,6 +1450,9 @@ void PTraceSandbox::HandleSysCallGeneric(int syscallNumber)
 
 void PTraceSandbox::ReportOpen(std::string path, int oflag, std::string syscallName)
 {
+    // The descriptor this open returns may reuse the number of a closed one
+    ForgetWriteDescriptors();
+
     int status = 0;
     mode_t pathMode = m_bxl->get_mode(path.c_str());
     bool pathExists = pathMode != 0;
@@ -506,46 +1495,102 @@ void PTraceSandbox::ReportCreate(std::string syscallName, int dirfd, const char
     m_bxl->report_access(syscallName.c_str(), event, checkCache);
 }
 
-std::vector<std::tuple<pid_t, std::string>>::iterator PTraceSandbox::FindProcess(pid_t pid)
-{
-    return std::find_if
-    (
-        m_traceeTable.begin(),
-        m_traceeTable.end(),
-        [pid](const std::tuple<pid_t, std::string>& item) { return std::get<0>(item) == pid; }
-    );
-}
-
 void PTraceSandbox::UpdateTraceeTableForExec(std::string exePath)
 {
-    auto maybeProcess = FindProcess(m_traceePid);
-    if (maybeProcess != m_traceeTable.end())
+    // The new image reports its own writes (as it would under the interposing sandbox), and close-on-exec descriptors go away
+    ForgetWriteDescriptors();
+
+    auto maybeProcess = m_tracees.find(m_traceePid);
+    if (maybeProcess != m_tracees.end())
     {
-        std::get<1>(maybeProcess[0]) = exePath;
+        maybeProcess->second.exePath = exePath;
     }
     else
     {
-        // Special case for vfork
-        // When vfork is called, the parent process is suspended until the child calls exec
-        // So if we see a process here that calls exec that wasn't in the table of traced processes
-        // then it is safe to assume that process was likely created by a vfork.
-        // We have special handling for clone and fork so that this does not happen with those.
-        // vfork is treated differently here because the handlers for clone/fork rely on the parent
-        // process continuing to execute after the child process is spawned.
-        // Since the parent is blocked, this will block the waitpid on the tracer which is explicitly waiting on the parent
-        // to avoid reporting accesses before a process creation report is sent.
-        // If this happens, the tracer will be blocked waiting for the parent process to be in SIGSTOP for the next ptrace event,
-        // the parent will be blocked on the child process to execve
-        // and the execve on the child will be blocked by a SIGSTOP from ptrace because the child is automatically traced by ptrace
-        // which ptrace can't handle because it's blocked on the waitpid for the parent.
+        // Every child is added to the table on the ptrace event for its creation (see HandleChildProcess), so this
+        // is not expected. Report the process creation anyway, so the managed side knows about this process.
         IOEvent event(m_traceePid, m_traceePid, /* traceeppid */ 0, ES_EVENT_TYPE_NOTIFY_FORK, ES_ACTION_TYPE_NOTIFY, exePath, std::string(""), exePath, /* mode */ 0, false, /* error */ 0);
         m_bxl->report_access("vfork", event, /* checkCache */ false);
-        m_traceeTable.push_back(std::make_tuple(m_traceePid, exePath));
+        m_tracees[m_traceePid].exePath = exePath;
 
         BXL_LOG_DEBUG(m_bxl, "[PTrace] Added new tracee with PID '%d'", m_traceePid);
     }
 }
 
+bool PTraceSandbox::HandOffToInterposition(char *syscall, const std::string &exePath, int envpArgumentIndex)
+{
+    bool interposeNewImage = false;
+    std::vector<std::string> environment;
+    if (m_bxl->can_interpose(exePath.c_str())
+        && ReadTraceeStringArray(syscall, (char *)ReadArgumentLong(envpArgumentIndex), environment))
+    {
+        // The new image must load libDetours and attach to this pip, as the children of interposed processes do (see BxlObserver::InitEnvEdits).
+        // The interposing sandbox set up the environment of the first process we traced that way, and programs usually pass theirs on.
+        std::vector<const char *> envp;
+        const char *detoursPath = nullptr;
+        const char *famPath = nullptr;
+        for (const auto &variable : environment)
+        {
+            envp.push_back(variable.c_str());
+            if (variable.compare(0, sizeof(BxlEnvDetoursPath), BxlEnvDetoursPath "=") == 0)
+            {
+                detoursPath = variable.c_str() + sizeof(BxlEnvDetoursPath);
+            }
+            else if (variable.compare(0, sizeof(BxlEnvFamPath), BxlEnvFamPath "=") == 0)
+            {
+                famPath = variable.c_str() + sizeof(BxlEnvFamPath);
+            }
+        }
+
+        envp.push_back(nullptr);
+        if (!is_null_or_empty(detoursPath) && !is_null_or_empty(famPath))
+        {
+            // Without a buffer, the edit is only applied if the environment already satisfies it
+            env_edit preload;
+            size_t requiredSize;
+            init_env_edit(&preload, EnvEditIncludePath, "LD_PRELOAD", detoursPath);
+            interposeNewImage = apply_env_edits(envp.data(), &preload, 1, nullptr, 0, &requiredSize) == envp.data();
+        }
+    }
+
+    auto tracee = m_tracees.find(m_traceePid);
+    struct stat image;
+    if (tracee != m_tracees.end() && interposeNewImage != IsInterposedTracee() && stat(exePath.c_str(), &image) == 0)
+    {
+        tracee->second.execPending = true;
+        tracee->second.interposeNewImage = interposeNewImage;
+        tracee->second.execDevice = image.st_dev;
+        tracee->second.execInode = image.st_ino;
+        BXL_LOG_DEBUG(m_bxl, "[PTrace] Tracee '%d' executes '%s': %s", m_traceePid, exePath.c_str(),
+            interposeNewImage ? "handing it off to the interposing sandbox" : "tracing it again");
+    }
+
+    return interposeNewImage;
+}
+
+bool PTraceSandbox::IsInterposedTracee()
+{
+    auto tracee = m_tracees.find(m_traceePid);
+    if (tracee == m_tracees.end())
+    {
+        return false;
+    }
+
+    if (tracee->second.execPending)
+    {
+        // The exec succeeded if the tracee runs the new image now. If it failed, the tracee (and how we follow it) stays the same.
+        tracee->second.execPending = false;
+        std::string exeLink = "/proc/" + std::to_string(m_traceePid) + "/exe";
+        struct stat image;
+        if (stat(exeLink.c_str(), &image) == 0 && image.st_dev == tracee->second.execDevice && image.st_ino == tracee->second.execInode)
+        {
+            tracee->second.interposed = tracee->second.interposeNewImage;
+        }
+    }
+
+    return tracee->second.interposed;
+}
+
 // Syscall Handlers
 HANDLER_FUNCTION(execveat)
 {
@@ -560,6 +1605,13 @@ HANDLER_FUNCTION(execveat)
 
     strcpy(mutableExePath, exePath.c_str());
 
+    // libDetours reports the exec of an interposed process, and the new image, unless that one needs to be traced
+    bool interposed = IsInterposedTracee();
+    if (HandOffToInterposition(SYSCALL_NAME_STRING(execveat), exePath, 4) && interposed)
+    {
+        return;
+    }
+
     UpdateTraceeTableForExec(exePath);
 
     m_bxl->report_exec(SYSCALL_NAME_STRING(execveat), basename(mutableExePath), exePath.c_str(), /* error*/ 0, /* mode */ 0, m_traceePid);
@@ -572,6 +1624,13 @@ HANDLER_FUNCTION(execve)
 
     strcpy(mutableFilePath, file.c_str());
 
+    // libDetours reports the exec of an interposed process, and the new image, unless that one needs to be traced
+    bool interposed = IsInterposedTracee();
+    if (HandOffToInterposition(SYSCALL_NAME_STRING(execve), m_bxl->normalize_path_at(AT_FDCWD, file.c_str(), /* oflags */ 0, m_traceePid), 3) && interposed)
+    {
+        return;
+    }
+
     UpdateTraceeTableForExec(file);
 
     m_bxl->report_exec(SYSCALL_NAME_STRING(execve), basename(mutableFilePath), file.c_str(), /* error*/ 0, /* mode */ 0, m_traceePid);
@@ -645,6 +1704,26 @@ HANDLER_FUNCTION(openat)
     ReportOpen(path, flags, SYSCALL_NAME_STRING(openat));
 }
 
+void PTraceSandbox::HandleReportWriteFd(const char *syscall, int fd)
+{
+    // Every write on a descriptor would report the same access: only the first one is handled
+    uint64_t key = ((uint64_t)(uint32_t)m_traceePid << 32) | (uint32_t)fd;
+    if (m_handledWriteFds.find(key) != m_handledWriteFds.end())
+    {
+        return;
+    }
+
+    HandleReportAccessFd(syscall, fd);
+    m_handledWriteFds.insert(key);
+}
+
+void PTraceSandbox::ForgetWriteDescriptors()
+{
+    // close isn't traced (it is too frequent), so we only notice a descriptor number is reused when it is handed out again: by an open or a dup.
+    // We don't know which number that is (and threads share descriptors), so all of them are forgotten.
+    m_handledWriteFds.clear();
+}
+
 void PTraceSandbox::HandleReportAccessFd(const char *syscall, int fd, es_event_type_t event /*ES_EVENT_TYPE_NOTIFY_WRITE*/)
 {
     auto path = m_bxl->fd_to_path(fd, m_traceePid);
@@ -659,31 +1738,31 @@ void PTraceSandbox::HandleReportAccessFd(const char *syscall, int fd, es_event_t
 HANDLER_FUNCTION(write)
 {
     auto fd = ReadArgumentLong(1);
-    HandleReportAccessFd(SYSCALL_NAME_STRING(write), fd);
+    HandleReportWriteFd(SYSCALL_NAME_STRING(write), fd);
 }
 
 HANDLER_FUNCTION(writev)
 {
     auto fd = ReadArgumentLong(1);
-    HandleReportAccessFd(SYSCALL_NAME_STRING(writev), fd);
+    HandleReportWriteFd(SYSCALL_NAME_STRING(writev), fd);
 }
 
 HANDLER_FUNCTION(pwritev)
 {
     auto fd = ReadArgumentLong(1);
-    HandleReportAccessFd(SYSCALL_NAME_STRING(pwritev), fd);
+    HandleReportWriteFd(SYSCALL_NAME_STRING(pwritev), fd);
 }
 
 HANDLER_FUNCTION(pwritev2)
 {
     auto fd = ReadArgumentLong(1);
-    HandleReportAccessFd(SYSCALL_NAME_STRING(pwritev2), fd);
+    HandleReportWriteFd(SYSCALL_NAME_STRING(pwritev2), fd);
 }
 
 HANDLER_FUNCTION(pwrite64)
 {
     auto fd = ReadArgumentLong(1);
-    HandleReportAccessFd(SYSCALL_NAME_STRING(pwrite64), fd);
+    HandleReportWriteFd(SYSCALL_NAME_STRING(pwrite64), fd);
 }
 
 HANDLER_FUNCTION(truncate)
@@ -703,18 +1782,16 @@ HANDLER_FUNCTION(rmdir)
     auto path = ReadArgumentString(SYSCALL_NAME_STRING(rmdir), 1, /*nullTerminated*/ true);
 
     // See comment about the need to propagate the returned value under HANDLER_FUNCTION(mkdir)
-    int status = 0;
-    ptrace(PTRACE_SYSCALL, m_traceePid, NULL, NULL);
-    waitpid(m_traceePid, &status, 0);
-
-    // We don't want to use the cache since we want to distinguish between creation and deletion of directories
-    m_bxl->report_access(SYSCALL_NAME_STRING(rmdir), ES_EVENT_TYPE_NOTIFY_UNLINK, path.c_str(), m_emptyStr, /*mode*/ S_IFDIR, /* error */ GetErrno(), /*checkCache */ false, m_traceePid);
+    WaitForSyscallExit(&PTraceSandbox::ReportRmdirResult, AT_FDCWD, path);
 }
 
 HANDLER_FUNCTION(rename)
 {
-    auto oldpath = ReadArgumentString(SYSCALL_NAME_STRING(rename), 1, /*nullTerminated*/ true);
-    auto newpath = ReadArgumentString(SYSCALL_NAME_STRING(rename), 2, /*nullTerminated*/ true);
+    const int argumentIndexes[] = { 1, 2 };
+    std::string paths[2];
+    ReadArgumentStrings(SYSCALL_NAME_STRING(rename), argumentIndexes, paths, 2);
+    auto &oldpath = paths[0];
+    auto &newpath = paths[1];
 
     HandleRenameGeneric(SYSCALL_NAME_STRING(rename), AT_FDCWD, oldpath.c_str(), AT_FDCWD, newpath.c_str());
 }
@@ -722,9 +1799,12 @@ HANDLER_FUNCTION(rename)
 HANDLER_FUNCTION(renameat)
 {
     auto olddirfd = ReadArgumentLong(1);
-    auto oldpath = ReadArgumentString(SYSCALL_NAME_STRING(renameat), 2, /*nullTerminated*/ true);
     auto newdirfd = ReadArgumentLong(3);
-    auto newpath = ReadArgumentString(SYSCALL_NAME_STRING(renameat), 4, /*nullTerminated*/ true);
+    const int argumentIndexes[] = { 2, 4 };
+    std::string paths[2];
+    ReadArgumentStrings(SYSCALL_NAME_STRING(renameat), argumentIndexes, paths, 2);
+    auto &oldpath = paths[0];
+    auto &newpath = paths[1];
     
     HandleRenameGeneric(SYSCALL_NAME_STRING(renameat), olddirfd, oldpath.c_str(), newdirfd, newpath.c_str());
 }
@@ -732,9 +1812,12 @@ HANDLER_FUNCTION(renameat)
 HANDLER_FUNCTION(renameat2)
 {
     auto olddirfd = ReadArgumentLong(1);
-    auto oldpath = ReadArgumentString(SYSCALL_NAME_STRING(renameat2), 2, /*nullTerminated*/ true);
     auto newdirfd = ReadArgumentLong(3);
-    auto newpath = ReadArgumentString(SYSCALL_NAME_STRING(renameat2), 4, /*nullTerminated*/ true);
+    const int argumentIndexes[] = { 2, 4 };
+    std::string paths[2];
+    ReadArgumentStrings(SYSCALL_NAME_STRING(renameat2), argumentIndexes, paths, 2);
+    auto &oldpath = paths[0];
+    auto &newpath = paths[1];
     
     HandleRenameGeneric(SYSCALL_NAME_STRING(renameat2), olddirfd, oldpath.c_str(), newdirfd, newpath.c_str());
 }
@@ -745,24 +1828,25 @@ void PTraceSandbox::HandleRenameGeneric(const char *syscall, int olddirfd, const
     string newStr = m_bxl->normalize_path_at(newdirfd, newpath, O_NOFOLLOW, m_traceePid);
 
     mode_t mode = m_bxl->get_mode(oldStr.c_str());    
-    std::vector<std::string> filesAndDirectories;
     
     if (S_ISDIR(mode))
     {
-        bool enumerateResult = m_bxl->EnumerateDirectory(oldStr, /*recursive*/ true, filesAndDirectories);
-        if (enumerateResult)
-        {
-            for (auto fileOrDirectory : filesAndDirectories)
-            {
-                // Source
-                auto mode = m_bxl->get_mode(fileOrDirectory.c_str());
-                m_bxl->report_access(syscall, ES_EVENT_TYPE_NOTIFY_UNLINK, fileOrDirectory.c_str(), mode, O_NOFOLLOW, /* error */ 0, /* checkCache */ true, m_traceePid);
+        // This may move the working directory of any tracee
+        BeginCwdChange();
 
-                // Destination
-                fileOrDirectory.replace(0, oldStr.length(), newStr);
-                ReportOpen(fileOrDirectory, O_CREAT, std::string(syscall));
-            }
-        }
+        std::string destination;
+        std::string syscallName(syscall);
+        m_bxl->EnumerateDirectory(oldStr, /*recursive*/ true, [&](const std::string &fileOrDirectory)
+        {
+            // Source
+            auto mode = m_bxl->get_mode(fileOrDirectory.c_str());
+            m_bxl->report_access(syscall, ES_EVENT_TYPE_NOTIFY_UNLINK, fileOrDirectory.c_str(), mode, O_NOFOLLOW, /* error */ 0, /* checkCache */ true, m_traceePid);
+
+            // Destination
+            destination.assign(newStr).append(fileOrDirectory, oldStr.length(), std::string::npos);
+            ReportOpen(destination, O_CREAT, syscallName);
+            return true;
+        });
     }
     else
     {
@@ -777,8 +1861,11 @@ void PTraceSandbox::HandleRenameGeneric(const char *syscall, int olddirfd, const
 
 HANDLER_FUNCTION(link)
 {
-    auto oldpath = ReadArgumentString(SYSCALL_NAME_STRING(link), 1, /*nullTerminated*/ true);
-    auto newpath = ReadArgumentString(SYSCALL_NAME_STRING(link), 2, /*nullTerminated*/ true);
+    const int argumentIndexes[] = { 1, 2 };
+    std::string paths[2];
+    ReadArgumentStrings(SYSCALL_NAME_STRING(link), argumentIndexes, paths, 2);
+    auto &oldpath = paths[0];
+    auto &newpath = paths[1];
 
     m_bxl->report_access(
         SYSCALL_NAME_STRING(link),
@@ -794,9 +1881,12 @@ HANDLER_FUNCTION(link)
 HANDLER_FUNCTION(linkat)
 {
     auto olddirfd = ReadArgumentLong(1);
-    auto oldpath = ReadArgumentString(SYSCALL_NAME_STRING(linkat), 2, /*nullTerminated*/ true);
     auto newdirfd = ReadArgumentLong(3);
-    auto newpath = ReadArgumentString(SYSCALL_NAME_STRING(linkat), 4, /*nullTerminated*/ true);
+    const int argumentIndexes[] = { 2, 4 };
+    std::string paths[2];
+    ReadArgumentStrings(SYSCALL_NAME_STRING(linkat), argumentIndexes, paths, 2);
+    auto &oldpath = paths[0];
+    auto &newpath = paths[1];
 
     m_bxl->report_access(
         SYSCALL_NAME_STRING(linkat),
@@ -933,12 +2023,7 @@ HANDLER_FUNCTION(mkdir)
     // report since on managed side bxl needs to understand whether the directory creation succeeded.
     // This is used to determine whether a directory was created by the build, which is an input for 
     // optimizations related to computing directory fingerprints in ObserverdInputProcessor
-    int status = 0;
-    ptrace(PTRACE_SYSCALL, m_traceePid, NULL, NULL);
-    waitpid(m_traceePid, &status, 0);
-
-    // We don't want to use the cache since we want to distinguish between creation and deletion of directories
-    ReportCreate(SYSCALL_NAME_STRING(mkdir), AT_FDCWD, path.c_str(), S_IFDIR, GetErrno(), /* checkCache */ false);
+    WaitForSyscallExit(&PTraceSandbox::ReportMkdirResult, AT_FDCWD, path);
 }
 
 HANDLER_FUNCTION(mkdirat)
@@ -947,12 +2032,7 @@ HANDLER_FUNCTION(mkdirat)
     auto path = ReadArgumentString(SYSCALL_NAME_STRING(mkdirat), 2, /*nullTerminated*/ true);
 
     // See comment about the need to propagate the returned value under HANDLER_FUNCTION(mkdir)
-    int status = 0;
-    ptrace(PTRACE_SYSCALL, m_traceePid, NULL, NULL);
-    waitpid(m_traceePid, &status, 0);
-
-    // We don't want to use the cache since we want to distinguish between creation and deletion of directories
-    ReportCreate(SYSCALL_NAME_STRING(mkdirat), dirfd, path.c_str(), S_IFDIR, GetErrno(), /* checkCache */ false);
+    WaitForSyscallExit(&PTraceSandbox::ReportMkdiratResult, dirfd, path);
 }
 
 HANDLER_FUNCTION(mknod)
@@ -1047,29 +2127,33 @@ HANDLER_FUNCTION(name_to_handle_at)
     ReportOpen(pathStr, oflags, SYSCALL_NAME_STRING(name_to_handle_at));
 }
 
-void PTraceSandbox::HandleChildProcess(const char *syscall)
+void PTraceSandbox::ReportMkdirResult(int dirfd, const std::string &path)
 {
-    int status = 0;
-    ptrace(PTRACE_SYSCALL, m_traceePid, NULL, NULL);
-    waitpid(m_traceePid, &status, 0);
+    // We don't want to use the cache since we want to distinguish between creation and deletion of directories
+    ReportCreate(SYSCALL_NAME_STRING(mkdir), dirfd, path.c_str(), S_IFDIR, GetErrno(), /* checkCache */ false);
+}
 
-    if (status >> 8 == (SIGTRAP | (PTRACE_EVENT_CLONE << 8))
-        || status >> 8 == (SIGTRAP | (PTRACE_EVENT_FORK << 8)))
-    {
-        ptrace(PTRACE_SYSCALL, m_traceePid, NULL, NULL);
-        waitpid(m_traceePid, &status, 0);
-    }
-    
-    long childpid = ReadArgumentLong(0);
+void PTraceSandbox::ReportMkdiratResult(int dirfd, const std::string &path)
+{
+    ReportCreate(SYSCALL_NAME_STRING(mkdirat), dirfd, path.c_str(), S_IFDIR, GetErrno(), /* checkCache */ false);
+}
+
+void PTraceSandbox::ReportRmdirResult(int dirfd, const std::string &path)
+{
+    // We don't want to use the cache since we want to distinguish between creation and deletion of directories
+    m_bxl->report_access(SYSCALL_NAME_STRING(rmdir), ES_EVENT_TYPE_NOTIFY_UNLINK, path.c_str(), m_emptyStr, /*mode*/ S_IFDIR, /* error */ GetErrno(), /*checkCache */ false, m_traceePid);
+}
 
+void PTraceSandbox::HandleChildProcess(const char *syscall, pid_t childPid)
+{
     // Find the parent pid for this tracee
-    auto maybeParent = FindProcess(m_traceePid);
+    auto maybeParent = m_tracees.find(m_traceePid);
     std::string exePath;
     
     // Best effort to get the ppid/exe of the tracee here. There's no nice way to do this from outside the process
-    if (maybeParent != m_traceeTable.end())
+    if (maybeParent != m_tracees.end())
     {
-        exePath = std::get<1>(maybeParent[0]);
+        exePath = maybeParent->second.exePath;
     }
     else
     {
@@ -1077,24 +2161,80 @@ void PTraceSandbox::HandleChildProcess(const char *syscall)
         exePath = m_bxl->GetProgramPath();
     }
 
-    IOEvent event(m_traceePid, childpid, /* traceeppid */ 0, ES_EVENT_TYPE_NOTIFY_FORK, ES_ACTION_TYPE_NOTIFY, exePath, std::string(""), exePath, /* mode */ 0, false, /* error */ 0);
-    m_bxl->report_access(syscall, event, /* checkCache */ false);
+    // libDetours reports the children of the processes handed off to it, which are interposed as well
+    bool interposed = IsInterposedTracee();
+    if (!interposed)
+    {
+        IOEvent event(m_traceePid, childPid, /* traceeppid */ 0, ES_EVENT_TYPE_NOTIFY_FORK, ES_ACTION_TYPE_NOTIFY, exePath, std::string(""), exePath, /* mode */ 0, false, /* error */ 0);
+        m_bxl->report_access(syscall, event, /* checkCache */ false);
+    }
 
     // Record the new child tracee
     // When PTRACE_O_TRACEFORK/CLONE/VFORK is set, the child process is automatically ptraced as well
-    m_traceeTable.push_back(std::make_tuple(childpid, exePath));
+    m_tracees[childPid].exePath = exePath;
+    m_tracees[childPid].interposed = interposed;
+
+    BXL_LOG_DEBUG(m_bxl, "[PTrace] Added new tracee with PID '%d'", childPid);
+
+    m_bxl->inherit_tracee_cwd(m_traceePid, childPid);
+
+    // If the child already reached its initial stop, it was waiting for this
+    if (m_childrenPendingCreation.erase(childPid) > 0)
+    {
+        ResumeTracee(childPid);
+    }
+}
+
+HANDLER_FUNCTION(dup)
+{
+    ForgetWriteDescriptors();
+}
+
+HANDLER_FUNCTION(dup2)
+{
+    ForgetWriteDescriptors();
+}
+
+HANDLER_FUNCTION(dup3)
+{
+    ForgetWriteDescriptors();
+}
+
+HANDLER_FUNCTION(fcntl)
+{
+    // Only traced for F_DUPFD and F_DUPFD_CLOEXEC
+    ForgetWriteDescriptors();
+}
+
+void PTraceSandbox::BeginCwdChange()
+{
+    // With user notifications we don't see syscalls returning, and the cache is not used
+    if (m_useUserNotifications)
+    {
+        return;
+    }
+
+    m_cwdChangesInProgress++;
+    m_bxl->enable_tracee_cwd_cache(false);
+    WaitForSyscallExit(&PTraceSandbox::EndCwdChange, AT_FDCWD, m_emptyStr);
+}
 
-    BXL_LOG_DEBUG(m_bxl, "[PTrace] Added new tracee with PID '%d'", childpid);
+void PTraceSandbox::EndCwdChange(int dirfd, const std::string &path)
+{
+    if (--m_cwdChangesInProgress == 0)
+    {
+        m_bxl->enable_tracee_cwd_cache(true);
+    }
 }
 
-HANDLER_FUNCTION(fork)
+HANDLER_FUNCTION(chdir)
 {
-    HandleChildProcess(SYSCALL_NAME_STRING(fork));
+    BeginCwdChange();
 }
 
-HANDLER_FUNCTION(clone)
+HANDLER_FUNCTION(fchdir)
 {
-    HandleChildProcess(SYSCALL_NAME_STRING(clone));
+    BeginCwdChange();
 }
 
 HANDLER_FUNCTION(exit)
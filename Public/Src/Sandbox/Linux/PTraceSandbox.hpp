@@ -3,10 +3,15 @@
 
 #pragma once
 
+#include <sys/user.h>
 #include "bxl_observer.hpp"
 
 typedef void (*HandlerFunction)(void);
 
+struct seccomp_notif;
+struct seccomp_notif_resp;
+struct sock_fprog;
+
 #define MAKE_HANDLER_FN_NAME(syscallName) Handle##syscallName
 #define MAKE_HANDLER_FN_DEF(syscallName) void MAKE_HANDLER_FN_NAME(syscallName) ()
 #define MAKE_HANDLER_FN_DEF_NEW(syscallName) MAKE_HANDLER_FN_DEF(new##syscallName)
@@ -32,8 +37,10 @@ public:
     
     /**
      * Attach the tracer to the provided pid.
+     * If requestFd is not -1, the tracer also attaches the processes it reads attach requests for from it (see ReadAttachRequests),
+     * so tracing a new process doesn't need a new tracer. The tracer then keeps running until requestFd is closed and all the tracees exited.
      */
-    void AttachToProcess(pid_t traceePid, std::string exe, std::string semaphoreName);
+    void AttachToProcess(pid_t traceePid, std::string exe, std::string semaphoreName, int requestFd = -1);
 
     /*
      * @brief Executes the provided child process under the ptrace sandbox
@@ -41,27 +48,190 @@ public:
      */
     int ExecuteWithPTraceSandbox(const char *file, char *const argv[], char *const envp[], const char *fam);
 
+    /**
+     * Whether the tracees are supervised with seccomp user notifications instead of ptrace (see EnableLinuxSandboxSeccompUserNotifications).
+     * The tracee and the tracer make this decision independently, so it must only depend on the FAM and the kernel.
+     */
+    bool UseUserNotifications();
+
 private:
     BxlObserver *m_bxl;
     pid_t m_traceePid = 0;
+    // Cleared if process_vm_readv turns out to be unavailable (e.g. not supported by the kernel), so we only use PTRACE_PEEKTEXT from then on
+    bool m_canReadProcessMemory = true;
+    size_t m_pageSize;
     const char* const m_emptyStr = "";
-    std::vector<std::tuple<pid_t, std::string>> m_traceeTable; // tracee pid, tracee exe path
+
+    // Seccomp user notifications backend (see AttachWithUserNotifications)
+    bool m_useUserNotifications = false;
+    // Listeners taken over from the tracees, and the one the notification being handled came from
+    std::vector<int> m_listenerFds;
+    int m_listenerFd = -1;
+    // Notification for the syscall being handled
+    const struct seccomp_notif *m_notification = nullptr;
+    // Set when a handler performed the syscall being handled on behalf of the tracee: the tracee gets its return value instead of running it
+    bool m_syscallPerformed = false;
+    long m_syscallReturnValue = 0;
+    // Registers of the current tracee, as fetched for the stop being handled (see FetchRegisters)
+    struct user_regs_struct m_registers = {};
+    // Supervised processes, with a pidfd that becomes readable when they exit
+    std::unordered_map<pid_t, int> m_processExitFds;
+    // Process of each thread seen in a notification
+    std::unordered_map<pid_t, pid_t> m_threadGroups;
+
+    // Appended to the name of the semaphore used to synchronize with the tracer, for the one the tracee posts once its listener is ready
+    static constexpr const char *ListenerSemaphoreSuffix = "_listener";
+
+    // Completes the handling of a syscall once it returned, with the arguments saved when it was entered
+    typedef void (PTraceSandbox::*SyscallExitHandler)(int dirfd, const std::string &path);
+
+    // State of a traced process (or thread)
+    struct Tracee
+    {
+        std::string exePath;
+        // Set by handlers that need the result of the syscall the tracee is stopped on (see WaitForSyscallExit).
+        // While set, the tracee is resumed with PTRACE_SYSCALL so it stops again when the syscall returns.
+        SyscallExitHandler onSyscallExit = nullptr;
+        int syscallDirfd = AT_FDCWD;
+        std::string syscallPath;
+        // Set for a process that executed a dynamically linked image preloading libDetours (see HandOffToInterposition): the interposing
+        // sandbox reports its accesses, its children and its exit, so we only follow its execs in case it executes a statically linked image again
+        bool interposed = false;
+        // Set on an exec that changes 'interposed', with the identity of the image: whether the exec succeeded is only known once the tracee
+        // makes its next filtered syscall (see IsInterposedTracee)
+        bool execPending = false;
+        bool interposeNewImage = false;
+        dev_t execDevice = 0;
+        ino_t execInode = 0;
+    };
+
+    std::unordered_map<pid_t, Tracee> m_tracees;
+
+    // Process to attach to, as requested on the request descriptor (see AttachToProcess)
+    struct AttachRequest
+    {
+        pid_t pid;
+        std::string exe;
+    };
+
+    // Attach requests read so far that are not complete yet
+    std::string m_pendingAttachRequests;
+
+    // Automatically attached children whose initial stop arrived before the ptrace event that tells us about their creation.
+    // They stay stopped until their creation is reported, so none of their accesses can be reported before it.
+    std::unordered_set<pid_t> m_childrenPendingCreation;
+
+    // Descriptors (tracee pid in the upper 32 bits, descriptor in the lower ones) a write was already handled for
+    std::unordered_set<uint64_t> m_handledWriteFds;
+
+    // Number of tracees in the middle of a syscall that changes working directories (see BeginCwdChange)
+    int m_cwdChangesInProgress = 0;
+
+    /**
+     * Attaches to the provided pid and signals the semaphore the tracee waits on before setting its filter.
+     */
+    void SeizeTracee(pid_t traceePid, const std::string &exe, const std::string &semaphoreName);
+
+    /**
+     * Handles a signal from wait for the current tracee.
+     */
+    void HandleTraceeStop(int status);
+
+    /**
+     * Waits until a tracee signals (as read from signalFd) or requestFd is readable, and then attaches to the requested processes.
+     */
+    void WaitForTraceeOrRequest(int signalFd, int &requestFd);
+
+    /**
+     * Reads the attach requests available on requestFd, a line for each with the pid of the process and the path to its executable separated by a space.
+     * Once the other end is closed, requestFd is closed and set to -1.
+     */
+    void ReadAttachRequests(int &requestFd, std::vector<AttachRequest> &requests);
+
+    /**
+     * Removes the current pid from the tracee table and reports its exit, unless the interposing sandbox reports it (see Tracee::interposed).
+     * Set 'killed' if the tracee was killed by a signal, in which case the interposing sandbox had no chance to report it.
+     */
+    void RemoveFromTraceeTable(bool killed = false);
 
     /**
-     * Removes the current pid from the tracee table and reports its exit
+     * Resumes a stopped tracee, delivering the given signal. Tracees only stop again on the next seccomp event,
+     * unless a handler is waiting for the current syscall to return.
      */
-    void RemoveFromTraceeTable();
+    void ResumeTracee(pid_t pid, int signal = 0);
 
     /**
-     * Finds the parent process in the tracee table for a given PID.
+     * Calls 'onSyscallExit' with the given arguments when the syscall the current tracee is stopped on returns (e.g. to report its return value),
+     * without blocking the tracer until then.
      */
-    std::vector<std::tuple<pid_t, std::string>>::iterator FindProcess(pid_t pid);
+    void WaitForSyscallExit(SyscallExitHandler onSyscallExit, int dirfd, const std::string &path);
 
     void HandleSysCallGeneric(int syscallNumber);
 
-    void *GetArgumentAddr(int index);
+    /**
+     * Whether the kernel supports seccomp user notifications as used here: SECCOMP_USER_NOTIF_FLAG_CONTINUE (Linux 5.5) and pidfd_getfd (Linux 5.6).
+     */
+    bool SupportsUserNotifications();
+
+    /**
+     * Installs the filter with a listener, hands it over to the tracer and executes the provided process.
+     */
+    int ExecuteWithUserNotifications(const char *file, char *const argv[], char *const envp[], struct sock_fprog *prog, sem_t *attached, sem_t *listenerReady);
+
+    /**
+     * Takes over the listener of the provided pid and handles its notifications, and the ones of its descendants, until all of them exit.
+     * Attach requests on requestFd are handled the same way (see AttachToProcess).
+     */
+    void AttachWithUserNotifications(pid_t traceePid, std::string exe, std::string semaphoreName, int requestFd);
+
+    /**
+     * Synchronizes with the provided pid while it sets its filter (see ExecuteWithUserNotifications) and takes over its listener.
+     */
+    void TakeOverListener(pid_t traceePid, const std::string &exe, const std::string &semaphoreName);
+
+    /**
+     * Runs the handler for a notification and fills in the response for it.
+     */
+    void HandleNotification(const struct seccomp_notif *notification, struct seccomp_notif_resp *response);
+
+    /**
+     * Starts tracking a process seen for the first time, reporting its creation.
+     */
+    void AddProcess(pid_t pid);
+
+    /**
+     * Stops tracking an exited process, reporting its exit.
+     */
+    void RemoveProcess(pid_t pid);
+
+    /**
+     * Returns the process the given thread belongs to.
+     */
+    pid_t GetThreadGroup(pid_t tid);
+
+    /**
+     * Performs the directory syscall being handled (mkdir, mkdirat or rmdir) on behalf of the tracee.
+     * @return The return value of the syscall, or a negative errno
+     */
+    long PerformSyscallForTracee(int dirfd, const std::string &path);
+
+    /*
+     * @brief Reads up to 'size' bytes at 'address' in the tracee through /proc/pid/mem
+     * @return The number of bytes read into 'buffer'
+     */
+    size_t ReadTraceeMemFile(char *address, char *buffer, size_t size);
+
+    /**
+     * Fetches the registers of the current tracee in a single ptrace call, so the syscall number, the arguments and the return value
+     * of the syscall it is stopped on are read from m_registers instead of with a ptrace call each. Must be called on every stop
+     * the registers are read on. Returns false if the registers can't be read (e.g. the tracee was killed).
+     */
+    bool FetchRegisters();
+
+    // Gets the number of the syscall the current tracee is stopped on, from the registers fetched for this stop
+    long GetSyscallNumber();
 
-    // @brief Gets the offset to read an argument at a given index starting from 1 (0 is used for the return value of the function)
+    // @brief Reads the string pointed to by the argument at a given index starting from 1
     std::string ReadArgumentString(char *syscall, int argumentIndex, bool nullTerminated, int length = 0);
     /*
      * @brief Reads an argument string at a given address with ptrace
@@ -71,11 +241,65 @@ private:
      * @return String containing the argument
      */
     unsigned long ReadArgumentLong(int argumentIndex);
+
+    // Maximum number of arguments ReadArgumentStrings can read at once
+    static const int MaxArgumentStringsPerRead = 4;
+
+    /*
+     * @brief Reads the strings pointed to by several arguments (e.g. the old and new paths of a rename) with a single process_vm_readv call
+     * @param argumentIndexes Indexes of the arguments to read (at most MaxArgumentStringsPerRead)
+     * @param arguments Receives the strings, in the same order as argumentIndexes
+     * See ReadArgumentString for the rest of the parameters
+     */
+    void ReadArgumentStrings(char *syscall, const int argumentIndexes[], std::string arguments[], int count, bool nullTerminated = true, int length = 0);
+
+    /*
+     * @brief Splits [address, address + size) in up to maxChunks chunks that don't span pages, for process_vm_readv
+     * @return The number of chunks written to 'chunks'
+     */
+    int SplitInPages(char *address, size_t size, struct iovec *chunks, int maxChunks);
+
+    /*
+     * @brief Reads the tracee memory described by 'remote' into 'local' with process_vm_readv
+     * @return The number of bytes read, which may be less than requested if a chunk can't be read
+     */
+    size_t ReadProcessMemory(const struct iovec *local, int localCount, const struct iovec *remote, int remoteCount);
+
+    /*
+     * @brief Reads up to 'size' bytes at 'address' in the tracee one word at a time with PTRACE_PEEKTEXT, stopping after a null character if nullTerminated is set
+     * @return The number of bytes read into 'buffer'
+     */
+    size_t PeekTraceeMemory(char *syscall, int argumentIndex, char *address, char *buffer, size_t size, bool nullTerminated);
     void ReportOpen(std::string path, int oflag, std::string syscallName);
     void ReportCreate(std::string syscallName, int dirfd, const char *pathname, mode_t mode, long returnValue = 0, bool checkCache = true);
     int GetErrno();
     void UpdateTraceeTableForExec(std::string exePath);
 
+    /**
+     * Called when the current tracee executes 'exePath' with the environment in the argument at 'envpArgumentIndex'. Returns whether
+     * libDetours is going to report the accesses of the new image: it is dynamically linked (and ptrace is not forced for it), and the environment
+     * preloads libDetours and points it to the manifest of the pip. The process is then handed off to the interposing sandbox once the exec
+     * succeeded. The tracer can't detach from it: the seccomp filter stays in place, and its syscalls would fail with ENOSYS without a tracer.
+     */
+    bool HandOffToInterposition(char *syscall, const std::string &exePath, int envpArgumentIndex);
+
+    /**
+     * Whether the current tracee was handed off to the interposing sandbox (see HandOffToInterposition).
+     */
+    bool IsInterposedTracee();
+
+    /*
+     * @brief Reads the null-terminated array of strings at 'envp' in the tracee (e.g. the environment of an exec)
+     * @return Whether the whole array could be read
+     */
+    bool ReadTraceeStringArray(char *syscall, char *envp, std::vector<std::string> &strings);
+
+    /*
+     * @brief Reads up to 'size' bytes at 'address' in the tracee, up to the first page that can't be read (or after a null character if nullTerminated is set)
+     * @return The number of bytes read into 'buffer'
+     */
+    size_t ReadTraceeMemory(char *syscall, char *address, char *buffer, size_t size, bool nullTerminated);
+
     // Handlers
     MAKE_HANDLER_FN_DEF(execveat);
     MAKE_HANDLER_FN_DEF(execve);
@@ -125,10 +349,34 @@ private:
     MAKE_HANDLER_FN_DEF(sendfile);
     MAKE_HANDLER_FN_DEF(copy_file_range);
     MAKE_HANDLER_FN_DEF(name_to_handle_at);
+    MAKE_HANDLER_FN_DEF(dup);
+    MAKE_HANDLER_FN_DEF(dup2);
+    MAKE_HANDLER_FN_DEF(dup3);
+    MAKE_HANDLER_FN_DEF(fcntl);
+    MAKE_HANDLER_FN_DEF(chdir);
+    MAKE_HANDLER_FN_DEF(fchdir);
     MAKE_HANDLER_FN_DEF(exit);
-    MAKE_HANDLER_FN_DEF(fork);
-    MAKE_HANDLER_FN_DEF(clone);
-    void HandleChildProcess(const char *syscall);
+    void HandleChildProcess(const char *syscall, pid_t childPid);
+    void ReportMkdirResult(int dirfd, const std::string &path);
+    void ReportMkdiratResult(int dirfd, const std::string &path);
+    void ReportRmdirResult(int dirfd, const std::string &path);
     void HandleRenameGeneric(const char *syscall, int olddirfd, const char *oldpath, int newdirfd, const char *newpath);
     void HandleReportAccessFd(const char *syscall, int fd, es_event_type_t event = ES_EVENT_TYPE_NOTIFY_WRITE);
+
+    /**
+     * Reports a write on a descriptor, unless a write on it was already handled (see ForgetWriteDescriptors).
+     */
+    void HandleReportWriteFd(const char *syscall, int fd);
+
+    /**
+     * Called for the traced syscalls that may make a descriptor number refer to a different file, so the next write on any descriptor gets reported again.
+     */
+    void ForgetWriteDescriptors();
+
+    /**
+     * Called when the current tracee enters a syscall that may change its working directory (or the path of the one of any tracee).
+     * Working directories are shared by threads, so the cache of working directories is disabled until the syscall returns (see EndCwdChange).
+     */
+    void BeginCwdChange();
+    void EndCwdChange(int dirfd, const std::string &path);
 };
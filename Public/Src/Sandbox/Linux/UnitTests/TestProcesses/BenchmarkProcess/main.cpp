@@ -0,0 +1,477 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Fixed workloads exercising the hot paths of the sandbox. The statically linked build of this file runs them under the
+// ptrace sandbox, the dynamically linked one under interposition. Each run times one workload and prints
+//     workload=<name> ops=<operations> ns=<elapsed nanoseconds>
+// The fixtures a workload needs are created under the working directory with -p, in a separate (unsandboxed) run,
+// so that neither their creation time nor their accesses are attributed to the workload.
+//
+// Usage: LinuxBenchmarkProcess -w <workload> [-n <operations>] [-j <threads>] [-p]
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <iostream>
+#include <linux/limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#define CHECK_RESULT(res, sys) if (res < 0) { perror(#sys); return EXIT_FAILURE; }
+
+static const int ProbedFileCount = 64;
+static const int SymlinkDepth = 16;
+static const int WalkEntryCount = 10000;
+static const int WrittenFileSize = 4096;
+static const int RenameDirCount = 16;
+static const int RenameFilesPerDir = 16;
+static const int RenameDirEvery = 64;
+
+static std::string ProbedFile(int i)
+{
+    return "bench/files/f" + std::to_string(i % ProbedFileCount);
+}
+
+static std::string RenameDir(int dir)
+{
+    return "bench/rename/d" + std::to_string(dir);
+}
+
+static std::string SymlinkChainPath()
+{
+    return "bench/links/l" + std::to_string(SymlinkDepth - 1) + "/file";
+}
+
+static uint64_t NowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int CreateFile(const std::string &path)
+{
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT, 0644);
+    CHECK_RESULT(fd, open);
+    close(fd);
+    return EXIT_SUCCESS;
+}
+
+static int CreateDirectory(const char *path)
+{
+    if (mkdir(path, 0755) == -1 && errno != EEXIST)
+    {
+        perror("mkdir");
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static int Prepare(const std::string &workload)
+{
+    if (CreateDirectory("bench") != EXIT_SUCCESS)
+    {
+        return EXIT_FAILURE;
+    }
+
+    if (workload == "stat" || workload == "openclose" || workload == "contention" || workload == "forktree")
+    {
+        if (CreateDirectory("bench/files") != EXIT_SUCCESS)
+        {
+            return EXIT_FAILURE;
+        }
+
+        for (int i = 0; i < ProbedFileCount; i++)
+        {
+            if (CreateFile(ProbedFile(i)) != EXIT_SUCCESS)
+            {
+                return EXIT_FAILURE;
+            }
+        }
+    }
+    else if (workload == "symlinks")
+    {
+        // bench/links/l<k> -> l<k-1> -> ... -> l0 -> real, and real/file
+        if (CreateDirectory("bench/links") != EXIT_SUCCESS || CreateDirectory("bench/links/real") != EXIT_SUCCESS)
+        {
+            return EXIT_FAILURE;
+        }
+
+        if (CreateFile("bench/links/real/file") != EXIT_SUCCESS)
+        {
+            return EXIT_FAILURE;
+        }
+
+        for (int i = 0; i < SymlinkDepth; i++)
+        {
+            std::string link = "bench/links/l" + std::to_string(i);
+            std::string target = i == 0 ? "real" : "l" + std::to_string(i - 1);
+            if (symlink(target.c_str(), link.c_str()) == -1 && errno != EEXIST)
+            {
+                perror("symlink");
+                return EXIT_FAILURE;
+            }
+        }
+    }
+    else if (workload == "openwrite")
+    {
+        return CreateDirectory("bench/out");
+    }
+    else if (workload == "renametree")
+    {
+        if (CreateDirectory("bench/rename") != EXIT_SUCCESS)
+        {
+            return EXIT_FAILURE;
+        }
+
+        for (int dir = 0; dir < RenameDirCount; dir++)
+        {
+            if (CreateDirectory(RenameDir(dir).c_str()) != EXIT_SUCCESS)
+            {
+                return EXIT_FAILURE;
+            }
+
+            for (int i = 0; i < RenameFilesPerDir; i++)
+            {
+                if (CreateFile(RenameDir(dir) + "/f" + std::to_string(i)) != EXIT_SUCCESS)
+                {
+                    return EXIT_FAILURE;
+                }
+            }
+        }
+    }
+    else if (workload == "walk")
+    {
+        if (CreateDirectory("bench/walk") != EXIT_SUCCESS)
+        {
+            return EXIT_FAILURE;
+        }
+
+        for (int i = 0; i < WalkEntryCount; i++)
+        {
+            if (CreateFile("bench/walk/e" + std::to_string(i)) != EXIT_SUCCESS)
+            {
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static int Stat(long operations)
+{
+    std::vector<std::string> files;
+    for (int i = 0; i < ProbedFileCount; i++)
+    {
+        files.push_back(ProbedFile(i));
+    }
+
+    struct stat buf;
+    for (long i = 0; i < operations; i++)
+    {
+        CHECK_RESULT(stat(files[i % ProbedFileCount].c_str(), &buf), stat);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static int OpenClose(long operations)
+{
+    std::vector<std::string> files;
+    for (int i = 0; i < ProbedFileCount; i++)
+    {
+        files.push_back(ProbedFile(i));
+    }
+
+    for (long i = 0; i < operations; i++)
+    {
+        int fd = open(files[i % ProbedFileCount].c_str(), O_RDONLY);
+        CHECK_RESULT(fd, open);
+        close(fd);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static int OpenWrite(long operations)
+{
+    std::vector<std::string> files;
+    for (int i = 0; i < ProbedFileCount; i++)
+    {
+        files.push_back("bench/out/f" + std::to_string(i));
+    }
+
+    std::vector<char> content(WrittenFileSize, 'x');
+    for (long i = 0; i < operations; i++)
+    {
+        int fd = open(files[i % ProbedFileCount].c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        CHECK_RESULT(fd, open);
+        CHECK_RESULT(write(fd, content.data(), content.size()), write);
+        close(fd);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static int Symlinks(long operations)
+{
+    std::string path = SymlinkChainPath();
+    struct stat buf;
+    for (long i = 0; i < operations; i++)
+    {
+        CHECK_RESULT(stat(path.c_str(), &buf), stat);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static int ForkExec(long operations)
+{
+    // Each process of the chain forks and execs the next one, so 'operations' processes are started one after the other
+    if (operations <= 0)
+    {
+        return EXIT_SUCCESS;
+    }
+
+    pid_t pid = fork();
+    CHECK_RESULT(pid, fork);
+    if (pid == 0)
+    {
+        std::string remaining = std::to_string(operations - 1);
+        execl("/proc/self/exe", "LinuxBenchmarkProcess", "-w", "forkexec", "-n", remaining.c_str(), "-c", (char *)nullptr);
+        perror("execl");
+        _exit(EXIT_FAILURE);
+    }
+
+    int status;
+    CHECK_RESULT(waitpid(pid, &status, 0), waitpid);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : EXIT_FAILURE;
+}
+
+static int ForkTree(long processes)
+{
+    // This process is the root of a binary tree of 'processes' processes, each of which probes a file before exiting
+    struct stat buf;
+    stat(ProbedFile((int)(processes % ProbedFileCount)).c_str(), &buf);
+
+    long remaining = processes - 1;
+    long subtrees[] = { remaining / 2, remaining - remaining / 2 };
+    pid_t children[] = { 0, 0 };
+    for (int i = 0; i < 2; i++)
+    {
+        if (subtrees[i] <= 0)
+        {
+            continue;
+        }
+
+        children[i] = fork();
+        CHECK_RESULT(children[i], fork);
+        if (children[i] == 0)
+        {
+            _exit(ForkTree(subtrees[i]));
+        }
+    }
+
+    int result = EXIT_SUCCESS;
+    for (int i = 0; i < 2; i++)
+    {
+        int status;
+        if (children[i] > 0 && (waitpid(children[i], &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS))
+        {
+            result = EXIT_FAILURE;
+        }
+    }
+
+    return result;
+}
+
+static int RenameTree(long operations)
+{
+    // Files are renamed back and forth within their directory; every RenameDirEvery operations a whole directory is, which the
+    // sandbox reports for every file under it
+    std::vector<bool> fileRenamed(RenameDirCount * RenameFilesPerDir, false);
+    std::vector<bool> dirRenamed(RenameDirCount, false);
+    for (long i = 0; i < operations; i++)
+    {
+        int dir = i % RenameDirCount;
+        std::string dirPath = RenameDir(dir);
+        if (i % RenameDirEvery == RenameDirEvery - 1)
+        {
+            std::string renamedPath = dirPath + ".r";
+            bool renamed = dirRenamed[dir];
+            CHECK_RESULT(rename(renamed ? renamedPath.c_str() : dirPath.c_str(), renamed ? dirPath.c_str() : renamedPath.c_str()), rename);
+            dirRenamed[dir] = !renamed;
+            continue;
+        }
+
+        if (dirRenamed[dir])
+        {
+            dirPath += ".r";
+        }
+
+        int file = (i / RenameDirCount) % RenameFilesPerDir;
+        std::string filePath = dirPath + "/f" + std::to_string(file);
+        std::string renamedPath = filePath + ".r";
+        int index = dir * RenameFilesPerDir + file;
+        bool renamed = fileRenamed[index];
+        CHECK_RESULT(rename(renamed ? renamedPath.c_str() : filePath.c_str(), renamed ? filePath.c_str() : renamedPath.c_str()), rename);
+        fileRenamed[index] = !renamed;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+struct ContentionArgs
+{
+    long operations;
+    int offset;
+    int result;
+};
+
+static void* ContentionThread(void *arg)
+{
+    ContentionArgs *args = (ContentionArgs *)arg;
+    std::vector<std::string> files;
+    for (int i = 0; i < ProbedFileCount; i++)
+    {
+        files.push_back(ProbedFile(i));
+    }
+
+    struct stat buf;
+    args->result = EXIT_SUCCESS;
+    for (long i = 0; i < args->operations; i++)
+    {
+        if (stat(files[(i + args->offset) % ProbedFileCount].c_str(), &buf) == -1)
+        {
+            args->result = EXIT_FAILURE;
+            break;
+        }
+    }
+
+    return nullptr;
+}
+
+static int Contention(long operations, int threads)
+{
+    std::vector<pthread_t> handles(threads);
+    std::vector<ContentionArgs> args(threads);
+    for (int i = 0; i < threads; i++)
+    {
+        args[i] = { operations / threads, i * (ProbedFileCount / threads), EXIT_SUCCESS };
+        if (pthread_create(&handles[i], nullptr, ContentionThread, &args[i]) != 0)
+        {
+            std::cerr << "pthread_create failed" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    int result = EXIT_SUCCESS;
+    for (int i = 0; i < threads; i++)
+    {
+        pthread_join(handles[i], nullptr);
+        result = args[i].result != EXIT_SUCCESS ? args[i].result : result;
+    }
+
+    return result;
+}
+
+static int Walk(long operations)
+{
+    for (long i = 0; i < operations; i++)
+    {
+        DIR *dir = opendir("bench/walk");
+        if (dir == nullptr)
+        {
+            perror("opendir");
+            return EXIT_FAILURE;
+        }
+
+        int entries = 0;
+        while (readdir(dir) != nullptr)
+        {
+            entries++;
+        }
+
+        closedir(dir);
+        if (entries < WalkEntryCount)
+        {
+            std::cerr << "Expected at least " << WalkEntryCount << " entries, found " << entries << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv)
+{
+    int opt;
+    std::string workload;
+    long operations = 100000;
+    int threads = 8;
+    bool prepare = false;
+    bool chained = false;
+
+    while ((opt = getopt(argc, argv, "w:n:j:pc")) != -1)
+    {
+        switch (opt)
+        {
+            case 'w':
+                workload = optarg;
+                break;
+            case 'n':
+                operations = atol(optarg);
+                break;
+            case 'j':
+                threads = atoi(optarg) > 0 ? atoi(optarg) : 1;
+                break;
+            case 'p':
+                prepare = true;
+                break;
+            case 'c':
+                // A process in the middle of a fork+exec chain: don't time it
+                chained = true;
+                break;
+        }
+    }
+
+    if (prepare)
+    {
+        return Prepare(workload);
+    }
+
+    uint64_t start = NowNs();
+    int result;
+    if (workload == "noop")                 result = EXIT_SUCCESS;
+    else if (workload == "stat")            result = Stat(operations);
+    else if (workload == "openclose")       result = OpenClose(operations);
+    else if (workload == "openwrite")       result = OpenWrite(operations);
+    else if (workload == "symlinks")        result = Symlinks(operations);
+    else if (workload == "forkexec")        result = ForkExec(operations);
+    else if (workload == "forktree")        result = ForkTree(operations);
+    else if (workload == "renametree")      result = RenameTree(operations);
+    else if (workload == "contention")      result = Contention(operations, threads);
+    else if (workload == "walk")            result = Walk(operations);
+    else
+    {
+        std::cerr << "Unknown workload '" << workload << "'" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    uint64_t elapsed = NowNs() - start;
+    if (result == EXIT_SUCCESS && !chained)
+    {
+        std::cout << "workload=" << workload << " ops=" << operations << " ns=" << elapsed << std::endl;
+    }
+
+    return result;
+}
@@ -11,6 +11,7 @@
 #include <fcntl.h>
 
 #define STATICALLY_LINKED_PROCESS_NAME "TestProcessStaticallyLinked"
+#define DYNAMICALLY_LINKED_PROCESS_NAME "TestProcessDynamicallyLinked"
 
 // Appends filename to a provided root path
 std::string GetPath(std::string root, std::string filename)
@@ -39,6 +40,14 @@ int main(int argc, char **argv)
     getcwd(cwd, sizeof(cwd));
     std::string workingDir(cwd);
 
+    // If requested, execute the dynamically linked build, which the ptrace sandbox hands off to the interposing sandbox
+    if (argc > 1 && std::string(argv[1]) == "execdynamic")
+    {
+        const char* arguments[] = {"0", nullptr};
+        execv(GetPath(workingDir, DYNAMICALLY_LINKED_PROCESS_NAME).c_str(), const_cast<char* const*>(arguments));
+        return 1;
+    }
+
     unlink(GetPath(workingDir, "unlinkme").c_str());
 
     struct stat statbuf;
@@ -1,10 +1,15 @@
 // Copyright (c) Microsoft. All rights reserved.
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
+#include <atomic>
 #include <errno.h>
+#include <fcntl.h>
 #include <iostream>
+#include <string>
 #include <sys/mman.h>
+#include <thread>
 #include <unistd.h>
+#include <vector>
 #include "syscalltests.hpp"
 
 int TestAnonymousFile()
@@ -32,6 +37,42 @@ int TestAnonymousFile()
     return 0;
 }
 
+// Creates distinct files from several threads at once, so their reports are produced concurrently
+// CODESYNC: Public/Src/Engine/UnitTests/Processes/LinuxSandboxProcessTests.cs
+#define CONCURRENT_REPORTS_THREADS 8
+#define CONCURRENT_REPORTS_FILES_PER_THREAD 64
+int TestConcurrentReports()
+{
+    std::atomic<int> failures(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < CONCURRENT_REPORTS_THREADS; t++)
+    {
+        threads.emplace_back([t, &failures]()
+        {
+            for (int i = 0; i < CONCURRENT_REPORTS_FILES_PER_THREAD; i++)
+            {
+                std::string path = "concurrent_" + std::to_string(t) + "_" + std::to_string(i);
+                int fd = ::open(path.c_str(), O_CREAT | O_WRONLY, 0644);
+                if (fd == -1)
+                {
+                    std::cerr << "open failed with errno " << errno << std::endl;
+                    failures++;
+                    continue;
+                }
+
+                close(fd);
+            }
+        });
+    }
+
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+
+    return failures == 0 ? 0 : 1;
+}
+
 int main(int argc, char **argv)
 {
     int opt;
@@ -55,6 +96,7 @@ int main(int argc, char **argv)
 
     // Function Definitions
     IF_COMMAND(TestAnonymousFile);
+    IF_COMMAND(TestConcurrentReports);
     IF_COMMAND_STR(fork);
     IF_COMMAND_STR(vfork);
     IF_COMMAND_STR(clone);
@@ -0,0 +1,60 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#define BOOST_TEST_MODULE LinuxSandboxTest
+#define _DO_NOT_EXPORT
+
+#include <boost/test/included/unit_test.hpp>
+#include <access_cache.hpp>
+#include <string>
+
+using namespace std;
+
+// AccessCache requires static storage duration
+static AccessCache s_cache;
+
+BOOST_AUTO_TEST_SUITE(AccessCacheTests)
+
+BOOST_AUTO_TEST_CASE(TestLookupAndInsert)
+{
+    BOOST_CHECK(!s_cache.Check(1, "/tmp/file", /* addEntryIfMissing */ false));
+    BOOST_CHECK(!s_cache.Check(1, "/tmp/file", /* addEntryIfMissing */ true));
+    BOOST_CHECK(s_cache.Check(1, "/tmp/file", /* addEntryIfMissing */ false));
+    BOOST_CHECK(s_cache.Check(1, "/tmp/file", /* addEntryIfMissing */ true));
+
+    // Same path with a different key, and a different path with the same key, are different entries
+    BOOST_CHECK(!s_cache.Check(2, "/tmp/file", /* addEntryIfMissing */ false));
+    BOOST_CHECK(!s_cache.Check(1, "/tmp/file2", /* addEntryIfMissing */ false));
+    BOOST_CHECK(!s_cache.Check(1, "", /* addEntryIfMissing */ false));
+
+    BOOST_CHECK(s_cache.GetHits() >= 1);
+    BOOST_CHECK(s_cache.GetMisses() >= 4);
+}
+
+BOOST_AUTO_TEST_CASE(TestManyEntries)
+{
+    const int pathCount = 10000;
+    for (int i = 0; i < pathCount; i++)
+    {
+        BOOST_CHECK(!s_cache.Check(3, ("/many/" + to_string(i)).c_str(), /* addEntryIfMissing */ true));
+    }
+
+    for (int i = 0; i < pathCount; i++)
+    {
+        BOOST_CHECK(s_cache.Check(3, ("/many/" + to_string(i)).c_str(), /* addEntryIfMissing */ false));
+    }
+
+    BOOST_CHECK_EQUAL(s_cache.GetDropped(), 0UL);
+}
+
+BOOST_AUTO_TEST_CASE(TestContexts)
+{
+    BOOST_CHECK(!s_cache.Check(4, "/tmp/context", /* addEntryIfMissing */ true, /* context */ 42));
+    BOOST_CHECK(s_cache.Check(4, "/tmp/context", /* addEntryIfMissing */ false, /* context */ 42));
+
+    // The same pair under another context (or none) is a different entry
+    BOOST_CHECK(!s_cache.Check(4, "/tmp/context", /* addEntryIfMissing */ false, /* context */ 43));
+    BOOST_CHECK(!s_cache.Check(4, "/tmp/context", /* addEntryIfMissing */ false));
+}
+
+BOOST_AUTO_TEST_SUITE_END();
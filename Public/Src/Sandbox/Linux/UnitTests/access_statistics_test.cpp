@@ -0,0 +1,107 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#define BOOST_TEST_MODULE LinuxSandboxTest
+#define _DO_NOT_EXPORT
+
+#include <boost/test/included/unit_test.hpp>
+#include <access_statistics.hpp>
+#include <string.h>
+
+BOOST_AUTO_TEST_SUITE(AccessStatisticsTests)
+
+BOOST_AUTO_TEST_CASE(TestNotMapped)
+{
+    AccessStatistics statistics;
+    BOOST_CHECK(!statistics.IsEnabled());
+    BOOST_CHECK_EQUAL(statistics.Now(), 0);
+
+    // Nothing to update
+    statistics.CountAccess(AccessFamilyOpen);
+    statistics.CountCacheLookup(true);
+    statistics.CountSent(1, 100, statistics.Now());
+    statistics.CountTracerStop(true, statistics.Now());
+    statistics.CountTracerCpu();
+}
+
+BOOST_AUTO_TEST_CASE(TestCounters)
+{
+    PipAccessStatistics shared;
+    memset(&shared, 0, sizeof(shared));
+
+    AccessStatistics statistics;
+    statistics.Use(&shared);
+    BOOST_CHECK(statistics.IsEnabled());
+    BOOST_CHECK_EQUAL(shared.magic.load(), PipAccessStatistics::Magic);
+
+    statistics.CountAccess(AccessFamilyOpen);
+    statistics.CountAccess(AccessFamilyOpen);
+    statistics.CountAccess(AccessFamilyProbe);
+    statistics.CountCacheLookup(true);
+    statistics.CountCacheLookup(false);
+    statistics.CountCacheLookup(false);
+
+    uint64_t start = statistics.Now();
+    BOOST_CHECK(start != 0);
+    statistics.CountSent(3, 300, start);
+    statistics.CountReportFlusherBacklog();
+
+    BOOST_CHECK_EQUAL(shared.accesses[AccessFamilyOpen].load(), 2);
+    BOOST_CHECK_EQUAL(shared.accesses[AccessFamilyProbe].load(), 1);
+    BOOST_CHECK_EQUAL(shared.accesses[AccessFamilyWrite].load(), 0);
+    BOOST_CHECK_EQUAL(shared.cacheHits.load(), 1);
+    BOOST_CHECK_EQUAL(shared.cacheMisses.load(), 2);
+    BOOST_CHECK_EQUAL(shared.reportsSent.load(), 3);
+    BOOST_CHECK_EQUAL(shared.bytesSent.load(), 300);
+    BOOST_CHECK_EQUAL(shared.reportFlusherBacklogs.load(), 1);
+}
+
+BOOST_AUTO_TEST_CASE(TestTracerCounters)
+{
+    PipAccessStatistics shared;
+    memset(&shared, 0, sizeof(shared));
+
+    AccessStatistics statistics;
+    statistics.Use(&shared);
+    statistics.CountTracerStop(true, statistics.Now());
+    statistics.CountTracerStop(false, statistics.Now());
+    statistics.CountTracerStop(true, statistics.Now());
+
+    // Burn some CPU so that it shows in the resource usage of the process
+    volatile uint64_t sum = 0;
+    for (uint64_t i = 0; i < 50000000; i++)
+    {
+        sum += i;
+    }
+
+    statistics.CountTracerCpu(/* force */ true);
+    uint64_t cpuNs = shared.tracerCpuNs.load();
+    BOOST_CHECK(cpuNs > 0);
+
+    // Only the CPU time used since the last call is added, and not until an interval went by
+    statistics.CountTracerCpu();
+    BOOST_CHECK_EQUAL(shared.tracerCpuNs.load(), cpuNs);
+
+    BOOST_CHECK_EQUAL(shared.tracerStops.load(), 3);
+    BOOST_CHECK_EQUAL(shared.tracerSyscallStops.load(), 2);
+}
+
+BOOST_AUTO_TEST_CASE(TestSharedByProcesses)
+{
+    PipAccessStatistics shared;
+    memset(&shared, 0, sizeof(shared));
+
+    // Every process of the pip maps the same statistics: the ones mapping them later keep counting from where they are
+    AccessStatistics first;
+    first.Use(&shared);
+    first.CountAccess(AccessFamilyProcess);
+
+    AccessStatistics second;
+    second.Use(&shared);
+    second.CountAccess(AccessFamilyProcess);
+
+    BOOST_CHECK_EQUAL(shared.magic.load(), PipAccessStatistics::Magic);
+    BOOST_CHECK_EQUAL(shared.accesses[AccessFamilyProcess].load(), 2);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,176 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#define BOOST_TEST_MODULE LinuxSandboxTest
+#define _DO_NOT_EXPORT
+
+#include <boost/test/included/unit_test.hpp>
+#include <debug_log.hpp>
+#include <string.h>
+#include <vector>
+
+using namespace std;
+
+// A debug log in memory owned by the test, the way a process maps its file
+struct TestLog
+{
+    vector<uint64_t> memory = vector<uint64_t>(DebugLog::GetFileSize() / sizeof(uint64_t) + 1);
+    DebugLog log;
+
+    TestLog()
+    {
+        DebugLog::Initialize(memory.data(), 42, "test");
+        log.Use(memory.data());
+    }
+
+    void Write(const char *format, ...)
+    {
+        va_list arguments;
+        va_start(arguments, format);
+        log.Write(42, format, arguments);
+        va_end(arguments);
+    }
+
+    vector<debug_log::Message> Decode()
+    {
+        vector<debug_log::Message> messages;
+        string program;
+        BOOST_REQUIRE(debug_log::Decode((const char *)memory.data(), DebugLog::GetFileSize(), messages, program));
+        BOOST_CHECK_EQUAL(program, "test");
+        return messages;
+    }
+};
+
+BOOST_AUTO_TEST_SUITE(DebugLogTests)
+
+BOOST_AUTO_TEST_CASE(TestConversions)
+{
+    char types[DebugLog::MaxArguments];
+    int count = 0;
+    BOOST_CHECK_EQUAL(debug_log::ParseConversion("%d and", types, count), 2);
+    BOOST_CHECK_EQUAL(debug_log::ParseConversion("%-10lu", types, count), 6);
+    BOOST_CHECK_EQUAL(debug_log::ParseConversion("%.*s", types, count), 4);
+    BOOST_CHECK_EQUAL(debug_log::ParseConversion("%p", types, count), 2);
+    BOOST_CHECK_EQUAL(debug_log::ParseConversion("%5.2f", types, count), 5);
+    BOOST_CHECK_EQUAL(debug_log::ParseConversion("%zd", types, count), 3);
+    BOOST_CHECK_EQUAL(count, 7);
+    BOOST_CHECK_EQUAL(string(types, count), "ilispdl");
+
+    // No argument
+    BOOST_CHECK_EQUAL(debug_log::ParseConversion("%%", types, count), 2);
+    BOOST_CHECK_EQUAL(count, 7);
+
+    // Can't be recorded
+    BOOST_CHECK_EQUAL(debug_log::ParseConversion("%n", types, count), 0);
+    BOOST_CHECK_EQUAL(debug_log::ParseConversion("%ls", types, count), 0);
+    BOOST_CHECK_EQUAL(debug_log::ParseConversion("%Lf", types, count), 0);
+}
+
+BOOST_AUTO_TEST_CASE(TestDeferredFormatting)
+{
+    TestLog log;
+    const DebugLogHeader *header = (const DebugLogHeader *)log.memory.data();
+    const char *nullString = nullptr;
+    uint64_t formatsTail = 0;
+    for (int i = 0; i < 3; i++)
+    {
+        log.Write("[%s:%d] open '%s' (%zu bytes, %.1f%%) -> %s", "cc", 7, "/tmp/a.txt", (size_t)1 << 40, 2.5, nullString);
+
+        // The format is only copied once
+        BOOST_CHECK(header->formatsTail.load() > 0);
+        BOOST_CHECK(i == 0 || header->formatsTail.load() == formatsTail);
+        formatsTail = header->formatsTail.load();
+    }
+
+    log.Write("width [%*d] [%-4s]", 5, 12, "ab");
+    log.Write("no arguments");
+
+    auto messages = log.Decode();
+    BOOST_REQUIRE_EQUAL(messages.size(), 5);
+    for (int i = 0; i < 3; i++)
+    {
+        BOOST_CHECK_EQUAL(messages[i].text, "[cc:7] open '/tmp/a.txt' (1099511627776 bytes, 2.5%) -> (null)");
+        BOOST_CHECK_EQUAL(messages[i].pid, 42);
+    }
+
+    BOOST_CHECK_EQUAL(messages[3].text, "width [   12] [ab  ]");
+    BOOST_CHECK_EQUAL(messages[4].text, "no arguments");
+    BOOST_CHECK(messages[0].timestampNs <= messages[4].timestampNs);
+}
+
+BOOST_AUTO_TEST_CASE(TestUnsupportedFormatsArePreformatted)
+{
+    TestLog log;
+    log.Write("wide %ls", L"string");
+    log.Write("long double %Lf", (long double)1.5);
+
+    auto messages = log.Decode();
+    BOOST_REQUIRE_EQUAL(messages.size(), 2);
+    BOOST_CHECK_EQUAL(messages[0].text, "wide string");
+    BOOST_CHECK_EQUAL(messages[1].text, "long double 1.500000");
+}
+
+BOOST_AUTO_TEST_CASE(TestLongStringsAreTruncated)
+{
+    TestLog log;
+    string path(3 * DebugLog::MaxRecordSize, 'a');
+    log.Write("%s %d", path.c_str(), 7);
+
+    auto messages = log.Decode();
+    BOOST_REQUIRE_EQUAL(messages.size(), 1);
+    BOOST_CHECK(messages[0].text.size() < DebugLog::MaxRecordSize);
+    BOOST_CHECK(messages[0].text.compare(0, 100, path, 0, 100) == 0);
+    BOOST_CHECK_EQUAL(messages[0].text.substr(messages[0].text.size() - 2), " 7");
+}
+
+BOOST_AUTO_TEST_CASE(TestRingKeepsLatestRecords)
+{
+    TestLog log;
+    string filler(1000, 'x');
+    int count = 3 * DebugLog::RecordsCapacity / 1000;
+    for (int i = 0; i < count; i++)
+    {
+        log.Write("%d %s", i, filler.c_str());
+    }
+
+    auto messages = log.Decode();
+    BOOST_REQUIRE(messages.size() > DebugLog::RecordsCapacity / DebugLog::MaxRecordSize);
+    BOOST_CHECK(messages.size() < (size_t)count);
+
+    // In order, without gaps, up to the last one
+    int first = atoi(messages[0].text.c_str());
+    for (size_t i = 0; i < messages.size(); i++)
+    {
+        BOOST_CHECK_EQUAL(atoi(messages[i].text.c_str()), first + (int)i);
+    }
+
+    BOOST_CHECK_EQUAL(first + (int)messages.size(), count);
+}
+
+BOOST_AUTO_TEST_CASE(TestIncompleteRecordsAreSkipped)
+{
+    TestLog log;
+    log.Write("first %d", 1);
+    log.Write("second %d", 2);
+    log.Write("third %d", 3);
+
+    // As if the process had been killed while writing the second record
+    const DebugLogHeader *header = (const DebugLogHeader *)log.memory.data();
+    char *ring = (char *)log.memory.data() + header->recordsOffset;
+    DebugLogRecord *first = (DebugLogRecord *)ring;
+    DebugLogRecord *second = (DebugLogRecord *)(ring + first->length);
+    second->magic.store(0);
+
+    auto messages = log.Decode();
+    BOOST_REQUIRE_EQUAL(messages.size(), 2);
+    BOOST_CHECK_EQUAL(messages[0].text, "first 1");
+    BOOST_CHECK_EQUAL(messages[1].text, "third 3");
+
+    // Not a debug log
+    vector<debug_log::Message> decoded;
+    string program;
+    vector<char> garbage(DebugLog::GetFileSize(), 'g');
+    BOOST_CHECK(!debug_log::Decode(garbage.data(), garbage.size(), decoded, program));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
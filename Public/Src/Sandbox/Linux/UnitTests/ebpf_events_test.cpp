@@ -0,0 +1,165 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#define BOOST_TEST_MODULE LinuxSandboxTest
+#define _DO_NOT_EXPORT
+
+#include <boost/test/included/unit_test.hpp>
+#include <ebpf_events.hpp>
+#include <string.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// A ring buffer laid out the way the kernel maps it, in memory owned by the test: the data pages are mapped twice in a row
+struct FakeRingBuffer
+{
+    static const size_t DataSize = 256;
+
+    unsigned long consumerPosition = 0;
+    unsigned long producerPosition = 0;
+    alignas(8) char data[DataSize * 2] = {};
+
+    // Reserves a sample the way bpf_ringbuf_reserve does, and commits it unless 'busy'. Returns the header of the sample.
+    uint32_t *Produce(const void *sample, uint32_t size, bool busy = false, bool discard = false)
+    {
+        size_t offset = producerPosition & (DataSize - 1);
+        uint32_t header[2] = { size | (busy ? BPF_RINGBUF_BUSY_BIT : 0) | (discard ? BPF_RINGBUF_DISCARD_BIT : 0), 0 };
+        Write(offset, header, sizeof(header));
+        Write(offset + BPF_RINGBUF_HDR_SZ, sample, size);
+        producerPosition += (size + BPF_RINGBUF_HDR_SZ + 7) & ~7UL;
+        return (uint32_t *)&data[offset];
+    }
+
+    void Write(size_t offset, const void *bytes, size_t size)
+    {
+        for (size_t i = 0; i < size; i++)
+        {
+            char byte = ((const char *)bytes)[i];
+            data[(offset + i) % DataSize] = byte;
+            data[(offset + i) % DataSize + DataSize] = byte;
+        }
+    }
+
+    void Register(EbpfRingBuffer &ringBuffer)
+    {
+        ringBuffer.Map(&consumerPosition, &producerPosition, data, DataSize);
+    }
+};
+
+static vector<char> MakeEvent(EbpfOperation operation, int pid, const string &src, const string &dst = "")
+{
+    EbpfAccessEvent event = {};
+    event.operation = operation;
+    event.pid = pid;
+    event.srcPathLength = (uint16_t)src.length();
+    event.dstPathLength = (uint16_t)dst.length();
+
+    vector<char> sample(sizeof(event) + src.length() + dst.length());
+    memcpy(sample.data(), &event, sizeof(event));
+    memcpy(sample.data() + sizeof(event), src.data(), src.length());
+    memcpy(sample.data() + sizeof(event) + src.length(), dst.data(), dst.length());
+    return sample;
+}
+
+static vector<string> ConsumePaths(EbpfRingBuffer &ringBuffer)
+{
+    vector<string> paths;
+    ringBuffer.Consume([&](const void *sample, size_t size)
+    {
+        EbpfAccessEventView view;
+        BOOST_CHECK(EbpfAccessEventView::Parse(sample, size, view));
+        paths.push_back(string(view.srcPath, view.event.srcPathLength) + ">" + string(view.dstPath, view.event.dstPathLength));
+    });
+
+    return paths;
+}
+
+BOOST_AUTO_TEST_SUITE(EbpfEventsTests)
+
+BOOST_AUTO_TEST_CASE(TestConsumeEvents)
+{
+    EbpfRingBuffer ringBuffer;
+    FakeRingBuffer fake;
+    fake.Register(ringBuffer);
+
+    vector<char> open = MakeEvent(EbpfOperationOpen, 42, "/src/main.c");
+    vector<char> rename = MakeEvent(EbpfOperationRename, 43, "/out/a.tmp", "/out/a.o");
+    fake.Produce(open.data(), (uint32_t)open.size());
+    fake.Produce(rename.data(), (uint32_t)rename.size());
+
+    vector<string> paths = ConsumePaths(ringBuffer);
+    BOOST_CHECK_EQUAL(paths.size(), 2);
+    BOOST_CHECK_EQUAL(paths[0], "/src/main.c>");
+    BOOST_CHECK_EQUAL(paths[1], "/out/a.tmp>/out/a.o");
+    BOOST_CHECK_EQUAL(fake.consumerPosition, fake.producerPosition);
+
+    // Nothing left
+    BOOST_CHECK(ConsumePaths(ringBuffer).empty());
+}
+
+BOOST_AUTO_TEST_CASE(TestBusyAndDiscardedSamples)
+{
+    EbpfRingBuffer ringBuffer;
+    FakeRingBuffer fake;
+    fake.Register(ringBuffer);
+
+    vector<char> first = MakeEvent(EbpfOperationStat, 1, "/first");
+    vector<char> discarded = MakeEvent(EbpfOperationStat, 1, "/discarded");
+    vector<char> busy = MakeEvent(EbpfOperationStat, 1, "/busy");
+    vector<char> last = MakeEvent(EbpfOperationStat, 1, "/last");
+    fake.Produce(first.data(), (uint32_t)first.size());
+    fake.Produce(discarded.data(), (uint32_t)discarded.size(), /* busy */ false, /* discard */ true);
+    uint32_t *busyHeader = fake.Produce(busy.data(), (uint32_t)busy.size(), /* busy */ true);
+    fake.Produce(last.data(), (uint32_t)last.size());
+
+    // Consumption stops at the sample still being written, even though the next one is committed
+    vector<string> paths = ConsumePaths(ringBuffer);
+    BOOST_CHECK_EQUAL(paths.size(), 1);
+    BOOST_CHECK_EQUAL(paths[0], "/first>");
+
+    *busyHeader &= ~BPF_RINGBUF_BUSY_BIT;
+    paths = ConsumePaths(ringBuffer);
+    BOOST_CHECK_EQUAL(paths.size(), 2);
+    BOOST_CHECK_EQUAL(paths[0], "/busy>");
+    BOOST_CHECK_EQUAL(paths[1], "/last>");
+}
+
+BOOST_AUTO_TEST_CASE(TestSamplesWrapAround)
+{
+    EbpfRingBuffer ringBuffer;
+    FakeRingBuffer fake;
+    fake.Register(ringBuffer);
+
+    // Every sample takes 56 bytes: the fifth one wraps around the end of the data
+    for (int i = 0; i < 8; i++)
+    {
+        string path = "/file" + to_string(i);
+        vector<char> event = MakeEvent(EbpfOperationOpen, i, path);
+        fake.Produce(event.data(), (uint32_t)event.size());
+
+        vector<string> paths = ConsumePaths(ringBuffer);
+        BOOST_CHECK_EQUAL(paths.size(), 1);
+        BOOST_CHECK_EQUAL(paths[0], path + ">");
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestInvalidEvents)
+{
+    EbpfAccessEventView view;
+    vector<char> event = MakeEvent(EbpfOperationOpen, 1, "/path");
+    BOOST_CHECK(EbpfAccessEventView::Parse(event.data(), event.size(), view));
+
+    // Truncated paths
+    BOOST_CHECK(!EbpfAccessEventView::Parse(event.data(), event.size() - 1, view));
+
+    // Truncated header
+    BOOST_CHECK(!EbpfAccessEventView::Parse(event.data(), sizeof(EbpfAccessEvent) - 1, view));
+
+    // Unknown operation
+    ((EbpfAccessEvent *)event.data())->operation = EbpfOperationCount;
+    BOOST_CHECK(!EbpfAccessEventView::Parse(event.data(), event.size(), view));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,103 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#define BOOST_TEST_MODULE LinuxSandboxTest
+#define _DO_NOT_EXPORT
+
+#include <boost/test/included/unit_test.hpp>
+#include <elf.h>
+#include <elf_probe.hpp>
+#include <string.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Builds a minimal 64-bit ELF image with a single loadable segment covering the whole file and,
+// if 'needed' is not empty, a dynamic section with one DT_NEEDED entry per library
+static vector<unsigned char> BuildImage(bool hasDynamicSection, const vector<string> &needed)
+{
+    string strtab(1, '\0');
+    vector<size_t> offsets;
+    for (const string &library : needed)
+    {
+        offsets.push_back(strtab.size());
+        strtab.append(library).push_back('\0');
+    }
+
+    size_t phnum = hasDynamicSection ? 2 : 1;
+    size_t dynOffset = sizeof(Elf64_Ehdr) + phnum * sizeof(Elf64_Phdr);
+    size_t dynCount = offsets.size() + 2;
+    size_t strtabOffset = dynOffset + dynCount * sizeof(Elf64_Dyn);
+    vector<unsigned char> image(strtabOffset + strtab.size());
+
+    Elf64_Ehdr *header = (Elf64_Ehdr *)image.data();
+    memcpy(header->e_ident, ELFMAG, SELFMAG);
+    header->e_ident[EI_CLASS] = ELFCLASS64;
+    header->e_ident[EI_DATA] = ELFDATA2LSB;
+    header->e_type = ET_EXEC;
+    header->e_phoff = sizeof(Elf64_Ehdr);
+    header->e_phentsize = sizeof(Elf64_Phdr);
+    header->e_phnum = phnum;
+
+    // The segment is loaded at 0x400000, so the string table address is not a file offset
+    const size_t baseAddress = 0x400000;
+    Elf64_Phdr *programHeaders = (Elf64_Phdr *)(image.data() + header->e_phoff);
+    programHeaders[0].p_type = PT_LOAD;
+    programHeaders[0].p_offset = 0;
+    programHeaders[0].p_vaddr = baseAddress;
+    programHeaders[0].p_filesz = image.size();
+
+    if (hasDynamicSection)
+    {
+        programHeaders[1].p_type = PT_DYNAMIC;
+        programHeaders[1].p_offset = dynOffset;
+        programHeaders[1].p_vaddr = baseAddress + dynOffset;
+        programHeaders[1].p_filesz = dynCount * sizeof(Elf64_Dyn);
+
+        Elf64_Dyn *entries = (Elf64_Dyn *)(image.data() + dynOffset);
+        entries[0].d_tag = DT_STRTAB;
+        entries[0].d_un.d_ptr = baseAddress + strtabOffset;
+        for (size_t i = 0; i < offsets.size(); i++)
+        {
+            entries[i + 1].d_tag = DT_NEEDED;
+            entries[i + 1].d_un.d_val = offsets[i];
+        }
+
+        entries[dynCount - 1].d_tag = DT_NULL;
+    }
+
+    memcpy(image.data() + strtabOffset, strtab.data(), strtab.size());
+    return image;
+}
+
+BOOST_AUTO_TEST_SUITE(ElfProbeTests)
+
+BOOST_AUTO_TEST_CASE(TestStaticImage)
+{
+    vector<unsigned char> image = BuildImage(/* hasDynamicSection */ false, {});
+    BOOST_CHECK(is_elf_statically_linked(image.data(), image.size()));
+}
+
+BOOST_AUTO_TEST_CASE(TestDynamicImage)
+{
+    vector<unsigned char> withLibc = BuildImage(/* hasDynamicSection */ true, { "libpthread.so.0", "libc.so.6" });
+    BOOST_CHECK(!is_elf_statically_linked(withLibc.data(), withLibc.size()));
+
+    // A dynamic section without libc can't be interposed either
+    vector<unsigned char> withoutLibc = BuildImage(/* hasDynamicSection */ true, { "libfoo.so" });
+    BOOST_CHECK(is_elf_statically_linked(withoutLibc.data(), withoutLibc.size()));
+}
+
+BOOST_AUTO_TEST_CASE(TestNotElf)
+{
+    const char script[] = "#!/bin/bash\necho hello\n";
+    BOOST_CHECK(!is_elf_statically_linked(script, sizeof(script)));
+
+    // Truncated images must not be read past their end
+    vector<unsigned char> image = BuildImage(/* hasDynamicSection */ false, {});
+    BOOST_CHECK(!is_elf_statically_linked(image.data(), sizeof(Elf64_Ehdr)));
+    BOOST_CHECK(!is_elf_statically_linked(image.data(), 0));
+}
+
+BOOST_AUTO_TEST_SUITE_END();
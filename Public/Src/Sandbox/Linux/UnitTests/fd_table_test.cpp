@@ -0,0 +1,214 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#define BOOST_TEST_MODULE LinuxSandboxTest
+#define _DO_NOT_EXPORT
+
+#include <boost/test/included/unit_test.hpp>
+#include <fd_table.hpp>
+#include <string>
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(FdTableTests)
+
+BOOST_AUTO_TEST_CASE(TestSetAndReset)
+{
+    FdTable table;
+    string path;
+
+    BOOST_CHECK(!table.Get(5, path));
+
+    table.Set(5, "/tmp/file", 9);
+    BOOST_CHECK(table.Get(5, path));
+    BOOST_CHECK_EQUAL(path, "/tmp/file");
+
+    table.Reset(5);
+    BOOST_CHECK(!table.Get(5, path));
+
+    // A longer path replaces the buffer of the entry
+    string longPath(300, 'a');
+    table.Set(5, longPath.c_str(), longPath.length());
+    BOOST_CHECK(table.Get(5, path));
+    BOOST_CHECK_EQUAL(path, longPath);
+}
+
+BOOST_AUTO_TEST_CASE(TestDescriptorsBeyondFirstPage)
+{
+    FdTable table;
+    string path;
+
+    table.Set(20000, "/tmp/high", 9);
+    BOOST_CHECK(table.Get(20000, path));
+    BOOST_CHECK_EQUAL(path, "/tmp/high");
+
+    // Invalid descriptors are never cached
+    table.Set(-1, "/tmp/invalid", 12);
+    BOOST_CHECK(!table.Get(-1, path));
+}
+
+BOOST_AUTO_TEST_CASE(TestResetRangeAndAll)
+{
+    FdTable table;
+    string path;
+
+    table.Set(3, "/tmp/three", 10);
+    table.Set(10, "/tmp/ten", 8);
+    table.Set(5000, "/tmp/fivethousand", 17);
+
+    table.ResetRange(4, ~0u);
+    BOOST_CHECK(table.Get(3, path));
+    BOOST_CHECK(!table.Get(10, path));
+    BOOST_CHECK(!table.Get(5000, path));
+
+    table.ResetAll();
+    BOOST_CHECK(!table.Get(3, path));
+
+    table.Set(3, "/tmp/three", 10);
+    BOOST_CHECK(table.Get(3, path));
+}
+
+BOOST_AUTO_TEST_CASE(TestResetAllSkipsEmptyEntries)
+{
+    FdTable table;
+    uint32_t version, otherVersion;
+    string path;
+
+    table.Set(3, "/tmp/three", 10);
+    table.Set(4, "/tmp/four", 9);
+    table.Reset(4);
+    BOOST_CHECK(table.GetEntryVersion(4, version));
+
+    table.ResetAll();
+    BOOST_CHECK(!table.Get(3, path));
+    BOOST_CHECK(table.GetEntryVersion(4, otherVersion));
+    BOOST_CHECK_EQUAL(version, otherVersion);
+
+    // Nothing left to forget on either of them
+    BOOST_CHECK(table.GetEntryVersion(3, version));
+    table.ResetAll();
+    BOOST_CHECK(table.GetEntryVersion(3, otherVersion));
+    BOOST_CHECK_EQUAL(version, otherVersion);
+}
+
+BOOST_AUTO_TEST_CASE(TestVersions)
+{
+    FdTable table;
+    uint32_t version, otherVersion;
+
+    BOOST_CHECK(!table.GetVersion(6, version));
+
+    table.Set(6, "/tmp/dir", 8);
+    BOOST_CHECK(table.GetVersion(6, version));
+    BOOST_CHECK(table.GetVersion(6, otherVersion));
+    BOOST_CHECK_EQUAL(version, otherVersion);
+
+    // Updating the entry moves the version on, invalidating it leaves no version at all
+    table.Set(6, "/tmp/dir", 8);
+    BOOST_CHECK(table.GetVersion(6, otherVersion));
+    BOOST_CHECK(version != otherVersion);
+
+    table.Reset(6);
+    BOOST_CHECK(!table.GetVersion(6, version));
+}
+
+BOOST_AUTO_TEST_CASE(TestEnumerationReported)
+{
+    FdTable table;
+    int dir, otherDir;
+
+    BOOST_CHECK(!table.IsEnumerationReported(7, &dir));
+
+    table.SetEnumerationReported(7, &dir);
+    BOOST_CHECK(table.IsEnumerationReported(7, &dir));
+    BOOST_CHECK(!table.IsEnumerationReported(7, &otherDir));
+    BOOST_CHECK(!table.IsEnumerationReported(8, &dir));
+
+    // Any invalidation of the descriptor forgets the stream
+    table.Reset(7);
+    BOOST_CHECK(!table.IsEnumerationReported(7, &dir));
+
+    table.SetEnumerationReported(7, &dir);
+    table.ResetRange(0, 10);
+    BOOST_CHECK(!table.IsEnumerationReported(7, &dir));
+
+    table.SetEnumerationReported(7, &dir);
+    table.ResetAll();
+    BOOST_CHECK(!table.IsEnumerationReported(7, &dir));
+}
+
+BOOST_AUTO_TEST_CASE(TestWriteReported)
+{
+    FdTable table;
+    uint32_t version;
+
+    // Nothing cached yet
+    table.SetWriteReported(7, 0);
+    BOOST_CHECK(!table.IsWriteReported(7));
+
+    table.Set(7, "/foo", 4);
+    BOOST_CHECK(table.GetVersion(7, version));
+    table.SetWriteReported(7, version);
+    BOOST_CHECK(table.IsWriteReported(7));
+    BOOST_CHECK(!table.IsWriteReported(8));
+
+    // Any invalidation of the descriptor drops the mark
+    table.Reset(7);
+    BOOST_CHECK(!table.IsWriteReported(7));
+
+    table.Set(7, "/bar", 4);
+    BOOST_CHECK(table.GetVersion(7, version));
+    table.SetWriteReported(7, version);
+    table.ResetRange(0, 10);
+    BOOST_CHECK(!table.IsWriteReported(7));
+
+    // A mark for a version that changed meanwhile is stale right away
+    table.Set(7, "/bar", 4);
+    BOOST_CHECK(table.GetVersion(7, version));
+    table.Reset(7);
+    table.Set(7, "/baz", 4);
+    table.SetWriteReported(7, version);
+    BOOST_CHECK(!table.IsWriteReported(7));
+
+    BOOST_CHECK(table.GetVersion(7, version));
+    table.SetWriteReported(7, version);
+    table.ResetAll();
+    BOOST_CHECK(!table.IsWriteReported(7));
+}
+
+BOOST_AUTO_TEST_CASE(TestNonFile)
+{
+    FdTable table;
+    uint32_t version;
+
+    // Descriptors don't need an entry (or a cached path) to be marked
+    BOOST_CHECK(!table.IsNonFile(7));
+    BOOST_CHECK(table.GetEntryVersion(7, version));
+    table.SetNonFile(7, version);
+    BOOST_CHECK(table.IsNonFile(7));
+    BOOST_CHECK(!table.IsNonFile(8));
+
+    // Any invalidation of the descriptor drops the mark
+    table.Reset(7);
+    BOOST_CHECK(!table.IsNonFile(7));
+
+    BOOST_CHECK(table.GetEntryVersion(7, version));
+    table.SetNonFile(7, version);
+    table.ResetRange(0, 10);
+    BOOST_CHECK(!table.IsNonFile(7));
+
+    // A mark for a version that changed meanwhile is stale right away
+    BOOST_CHECK(table.GetEntryVersion(7, version));
+    table.Reset(7);
+    table.SetNonFile(7, version);
+    BOOST_CHECK(!table.IsNonFile(7));
+
+    BOOST_CHECK(table.GetEntryVersion(7, version));
+    table.SetNonFile(7, version);
+    table.ResetAll();
+    BOOST_CHECK(!table.IsNonFile(7));
+
+    BOOST_CHECK(!table.GetEntryVersion(-1, version));
+}
+
+BOOST_AUTO_TEST_SUITE_END();
@@ -0,0 +1,158 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#define BOOST_TEST_MODULE LinuxSandboxTest
+#define _DO_NOT_EXPORT
+
+#include <boost/test/included/unit_test.hpp>
+#include <io_uring_rings.hpp>
+#include <string.h>
+#include <vector>
+
+using namespace std;
+
+// A submission queue laid out the way the kernel would, in memory owned by the test
+struct FakeRing
+{
+    static const unsigned int Entries = 4;
+
+    struct Queue
+    {
+        unsigned int head;
+        unsigned int tail;
+        unsigned int ringMask;
+        unsigned int array[Entries];
+    } queue = {};
+
+    struct io_uring_sqe sqes[Entries] = {};
+    struct io_uring_params params = {};
+
+    FakeRing(unsigned int flags = 0)
+    {
+        queue.ringMask = Entries - 1;
+        params.flags = flags;
+        params.sq_entries = Entries;
+        params.sq_off.head = offsetof(Queue, head);
+        params.sq_off.tail = offsetof(Queue, tail);
+        params.sq_off.ring_mask = offsetof(Queue, ringMask);
+        params.sq_off.array = offsetof(Queue, array);
+    }
+
+    // Queues an entry the way liburing does: fill the next free entry and publish its index
+    void Push(unsigned char opcode, int fd)
+    {
+        unsigned int index = queue.tail & queue.ringMask;
+        memset(&sqes[index], 0, sizeof(sqes[index]));
+        sqes[index].opcode = opcode;
+        sqes[index].fd = fd;
+        queue.array[index] = index;
+        queue.tail++;
+    }
+
+    void Register(IoUringRings &rings, int fd)
+    {
+        rings.Setup(fd, params);
+        rings.Map(fd, IORING_OFF_SQ_RING, &queue);
+        rings.Map(fd, IORING_OFF_SQES, sqes);
+    }
+};
+
+BOOST_AUTO_TEST_SUITE(IoUringRingsTests)
+
+BOOST_AUTO_TEST_CASE(TestPendingSubmissions)
+{
+    IoUringRings rings;
+    FakeRing ring;
+    ring.Register(rings, 7);
+    BOOST_CHECK(rings.IsRing(7));
+    BOOST_CHECK(!rings.IsRing(8));
+
+    ring.Push(IORING_OP_OPENAT, 10);
+    ring.Push(IORING_OP_WRITE, 11);
+
+    vector<struct io_uring_sqe> submissions;
+    BOOST_CHECK(rings.GetPendingSubmissions(7, 8, submissions));
+    BOOST_CHECK_EQUAL(submissions.size(), 2);
+    BOOST_CHECK_EQUAL(submissions[0].opcode, IORING_OP_OPENAT);
+    BOOST_CHECK_EQUAL(submissions[0].fd, 10);
+    BOOST_CHECK_EQUAL(submissions[1].opcode, IORING_OP_WRITE);
+    BOOST_CHECK_EQUAL(submissions[1].fd, 11);
+
+    // Only as many as the process asks to submit
+    submissions.clear();
+    BOOST_CHECK(rings.GetPendingSubmissions(7, 1, submissions));
+    BOOST_CHECK_EQUAL(submissions.size(), 1);
+    BOOST_CHECK_EQUAL(submissions[0].opcode, IORING_OP_OPENAT);
+}
+
+BOOST_AUTO_TEST_CASE(TestQueueWrapsAround)
+{
+    IoUringRings rings;
+    FakeRing ring;
+    ring.Register(rings, 7);
+
+    // Consume three entries, so the next ones wrap around the end of the queue
+    for (int i = 0; i < 3; i++)
+    {
+        ring.Push(IORING_OP_NOP, -1);
+    }
+
+    ring.queue.head = 3;
+    ring.Push(IORING_OP_STATX, 20);
+    ring.Push(IORING_OP_WRITEV, 21);
+
+    vector<struct io_uring_sqe> submissions;
+    BOOST_CHECK(rings.GetPendingSubmissions(7, 8, submissions));
+    BOOST_CHECK_EQUAL(submissions.size(), 2);
+    BOOST_CHECK_EQUAL(submissions[0].fd, 20);
+    BOOST_CHECK_EQUAL(submissions[1].fd, 21);
+}
+
+BOOST_AUTO_TEST_CASE(TestArrayIndirection)
+{
+    IoUringRings rings;
+    FakeRing ring;
+    ring.Register(rings, 7);
+
+    ring.sqes[2].opcode = IORING_OP_OPENAT;
+    ring.sqes[2].fd = 30;
+    ring.queue.array[0] = 2;
+    ring.queue.array[1] = FakeRing::Entries; // out of range: dropped, like the kernel does
+    ring.queue.tail = 2;
+
+    vector<struct io_uring_sqe> submissions;
+    BOOST_CHECK(rings.GetPendingSubmissions(7, 8, submissions));
+    BOOST_CHECK_EQUAL(submissions.size(), 1);
+    BOOST_CHECK_EQUAL(submissions[0].fd, 30);
+}
+
+BOOST_AUTO_TEST_CASE(TestUninspectableRings)
+{
+    IoUringRings rings;
+    vector<struct io_uring_sqe> submissions;
+
+    // Not a ring
+    BOOST_CHECK(!rings.GetPendingSubmissions(7, 1, submissions));
+
+    // Not mapped yet
+    FakeRing ring;
+    rings.Setup(7, ring.params);
+    ring.Push(IORING_OP_WRITE, 11);
+    BOOST_CHECK(!rings.GetPendingSubmissions(7, 1, submissions));
+
+    // Consumed by a kernel thread
+    FakeRing polled(IORING_SETUP_SQPOLL);
+    polled.Register(rings, 8);
+    polled.Push(IORING_OP_WRITE, 11);
+    BOOST_CHECK(!rings.GetPendingSubmissions(8, 1, submissions));
+
+    // Closed
+    ring.Register(rings, 7);
+    rings.Forget(7);
+    BOOST_CHECK(!rings.IsRing(7));
+    BOOST_CHECK(!rings.GetPendingSubmissions(7, 1, submissions));
+    BOOST_CHECK(rings.IsRing(8));
+    BOOST_CHECK(submissions.empty());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
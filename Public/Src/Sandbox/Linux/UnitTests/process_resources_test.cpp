@@ -0,0 +1,116 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#define BOOST_TEST_MODULE LinuxSandboxTest
+#define _DO_NOT_EXPORT
+
+#include <boost/test/included/unit_test.hpp>
+#include <process_resources.hpp>
+#include <signal.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace resource_files;
+
+BOOST_AUTO_TEST_SUITE(ProcessResourcesTests)
+
+BOOST_AUTO_TEST_CASE(TestFlatKeyedFile)
+{
+    const char *cpuStat = "usage_usec 3500\nuser_usec 2000\nsystem_usec 1500\nnr_periods 0\n";
+    BOOST_CHECK_EQUAL(ParseFlatKeyedValue(cpuStat, "usage_usec"), 3500);
+    BOOST_CHECK_EQUAL(ParseFlatKeyedValue(cpuStat, "user_usec"), 2000);
+    BOOST_CHECK_EQUAL(ParseFlatKeyedValue(cpuStat, "system_usec"), 1500);
+
+    // Only whole keys match
+    BOOST_CHECK_EQUAL(ParseFlatKeyedValue(cpuStat, "usec"), 0);
+    BOOST_CHECK_EQUAL(ParseFlatKeyedValue(cpuStat, "nr_throttled"), 0);
+    BOOST_CHECK_EQUAL(ParseFlatKeyedValue("", "user_usec"), 0);
+}
+
+BOOST_AUTO_TEST_CASE(TestNestedKeyedFile)
+{
+    const char *ioStat =
+        "8:0 rbytes=100 wbytes=200 rios=1 wios=2 dbytes=0 dios=0\n"
+        "8:16 rbytes=1000 wbytes=2000 rios=10 wios=20 dbytes=5 dios=1";
+
+    // Summed over the devices
+    BOOST_CHECK_EQUAL(ParseNestedKeyedSum(ioStat, "rbytes"), 1100);
+    BOOST_CHECK_EQUAL(ParseNestedKeyedSum(ioStat, "wbytes"), 2200);
+    BOOST_CHECK_EQUAL(ParseNestedKeyedSum(ioStat, "rios"), 11);
+    BOOST_CHECK_EQUAL(ParseNestedKeyedSum(ioStat, "wios"), 22);
+
+    // 'bytes' is only part of keys
+    BOOST_CHECK_EQUAL(ParseNestedKeyedSum(ioStat, "bytes"), 0);
+    BOOST_CHECK_EQUAL(ParseNestedKeyedSum("", "rbytes"), 0);
+}
+
+BOOST_AUTO_TEST_CASE(TestUnifiedCGroup)
+{
+    char path[PATH_MAX];
+    BOOST_CHECK(ParseUnifiedCGroup("0::/user.slice/user-1000.slice/session-2.scope\n", path, sizeof(path)));
+    BOOST_CHECK_EQUAL(path, "/user.slice/user-1000.slice/session-2.scope");
+
+    // Hybrid hierarchies list the v1 controllers first
+    BOOST_CHECK(ParseUnifiedCGroup("12:memory:/build\n1:name=systemd:/build\n0::/build\n", path, sizeof(path)));
+    BOOST_CHECK_EQUAL(path, "/build");
+
+    // v1 only
+    BOOST_CHECK(!ParseUnifiedCGroup("12:memory:/build\n10:cpu,cpuacct:/build\n", path, sizeof(path)));
+
+    // Too long
+    char small[4];
+    BOOST_CHECK(!ParseUnifiedCGroup("0::/build\n", small, sizeof(small)));
+}
+
+BOOST_AUTO_TEST_CASE(TestCGroup2MountPoint)
+{
+    char path[PATH_MAX];
+    const char *mountInfo =
+        "22 28 0:21 / /proc rw,nosuid,nodev,noexec,relatime shared:12 - proc proc rw\n"
+        "26 23 0:23 / /sys/fs/cgroup/memory rw,nosuid shared:4 - cgroup cgroup rw,memory\n"
+        "35 24 0:30 / /sys/fs/cgroup/unified rw,nosuid,nodev,noexec,relatime shared:9 master:2 - cgroup2 cgroup2 rw,nsdelegate\n";
+    BOOST_CHECK(ParseCGroup2MountPoint(mountInfo, path, sizeof(path)));
+    BOOST_CHECK_EQUAL(path, "/sys/fs/cgroup/unified");
+
+    BOOST_CHECK(!ParseCGroup2MountPoint("26 23 0:23 / /sys/fs/cgroup/memory rw,nosuid shared:4 - cgroup cgroup rw,memory\n", path, sizeof(path)));
+}
+
+BOOST_AUTO_TEST_CASE(TestSampleProcessTree)
+{
+    PipResourceGroups groups;
+    if (groups.Initialize(nullptr) == PipResourceGroupsUnavailable)
+    {
+        // Neither a delegated cgroup hierarchy nor CAP_NET_ADMIN on this host
+        BOOST_CHECK_EQUAL(groups.Create(1), -ENOTSUP);
+        return;
+    }
+
+    int group = groups.Create(1);
+    BOOST_REQUIRE(group >= 0);
+
+    pid_t child = fork();
+    if (child == 0)
+    {
+        while (true)
+        {
+            pause();
+        }
+    }
+
+    BOOST_CHECK_EQUAL(groups.AddProcess(group, child), 0);
+
+    ProcessResourceUsage usage;
+    BOOST_CHECK_EQUAL(groups.Sample(&group, 1, &usage), 0);
+    BOOST_CHECK_EQUAL(usage.pid, child);
+
+    int unknown = group + 1;
+    BOOST_CHECK_EQUAL(groups.Sample(&unknown, 1, &usage), -EINVAL);
+
+    kill(child, SIGKILL);
+    waitpid(child, nullptr, 0);
+    BOOST_CHECK_EQUAL(groups.Remove(group), 0);
+    BOOST_CHECK_EQUAL(groups.Remove(group), -EINVAL);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,86 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#define BOOST_TEST_MODULE LinuxSandboxTest
+#define _DO_NOT_EXPORT
+
+#include <boost/test/included/unit_test.hpp>
+#include <report_format.hpp>
+#include <chrono>
+#include <climits>
+#include <stdio.h>
+#include <string>
+
+using namespace std;
+
+static void CheckMatchesSnprintf(int maxMessageLength, const char *progname, const int (&fields)[ReportFormatter::FieldCount], const char *path)
+{
+    char expected[512];
+    char actual[512];
+    memset(expected, 'x', sizeof(expected));
+    memset(actual, 'x', sizeof(actual));
+
+    int expectedLength = snprintf(
+        expected, maxMessageLength, "%s|%d|%d|%d|%d|%d|%d|%d|%s\n",
+        progname, fields[0], fields[1], fields[2], fields[3], fields[4], fields[5], fields[6], path);
+    int actualLength = ReportFormatter::Format(actual, maxMessageLength, progname, fields, path);
+
+    BOOST_CHECK_EQUAL(actualLength, expectedLength);
+    BOOST_CHECK(memcmp(actual, expected, sizeof(actual)) == 0);
+}
+
+BOOST_AUTO_TEST_SUITE(ReportFormatTests)
+
+BOOST_AUTO_TEST_CASE(TestMatchesSnprintf)
+{
+    const int fields[ReportFormatter::FieldCount] = { 12345, 2, 1, 0, -2, 17, 1 };
+    CheckMatchesSnprintf(512, "gcc", fields, "/home/user/src/main.c");
+    CheckMatchesSnprintf(512, "", fields, "");
+
+    const int extremes[ReportFormatter::FieldCount] = { INT_MAX, INT_MIN, 0, -1, 9, 10, 1000000000 };
+    CheckMatchesSnprintf(512, "ld", extremes, "/tmp");
+}
+
+BOOST_AUTO_TEST_CASE(TestTruncation)
+{
+    const int fields[ReportFormatter::FieldCount] = { 12345, 2, 1, 0, -2, 17, 1 };
+
+    // Cut in the program name, the fields, the path and the final newline
+    for (int maxMessageLength : { 0, 1, 2, 5, 12, 30, 35, 36, 37 })
+    {
+        CheckMatchesSnprintf(maxMessageLength, "gcc", fields, "/home/user/src/main.c");
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestThroughput)
+{
+    // Not a pass/fail check, timings are too noisy for that: shows the reports per second with both implementations
+    const int iterations = 1000000;
+    const int fields[ReportFormatter::FieldCount] = { 12345, 2, 1, 0, 0, 17, 0 };
+    const char *path = "/home/user/src/project/out/obj/component/file.o";
+    char buffer[512];
+    size_t total = 0;
+
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++)
+    {
+        total += snprintf(buffer, sizeof(buffer), "%s|%d|%d|%d|%d|%d|%d|%d|%s\n",
+            "cc1plus", fields[0] + i, fields[1], fields[2], fields[3], fields[4], fields[5], fields[6], path);
+    }
+
+    auto snprintfTime = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++)
+    {
+        int current[ReportFormatter::FieldCount] = { fields[0] + i, fields[1], fields[2], fields[3], fields[4], fields[5], fields[6] };
+        total -= ReportFormatter::Format(buffer, sizeof(buffer), "cc1plus", current, path);
+    }
+
+    auto formatterTime = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    BOOST_CHECK_EQUAL(total, 0);
+    BOOST_TEST_MESSAGE("snprintf: " << (long)(iterations / snprintfTime) << " reports/s, ReportFormatter: " << (long)(iterations / formatterTime) << " reports/s");
+}
+
+BOOST_AUTO_TEST_SUITE_END();
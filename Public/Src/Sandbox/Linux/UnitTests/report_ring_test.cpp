@@ -0,0 +1,170 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#define BOOST_TEST_MODULE LinuxSandboxTest
+#define _DO_NOT_EXPORT
+
+#include <boost/test/included/unit_test.hpp>
+#include <report_ring.hpp>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// A ring in memory owned by the test, laid out the way the managed side does it
+struct TestRing
+{
+    vector<uint64_t> memory;
+    ReportRing *ring;
+
+    TestRing(uint64_t capacity) : memory((sizeof(ReportRingHeader) + capacity) / sizeof(uint64_t))
+    {
+        ring = ReportRing::Initialize(memory.data(), capacity);
+    }
+
+    ReportRingHeader* Header() { return (ReportRingHeader *)memory.data(); }
+
+    bool Write(const string &payload)
+    {
+        bool ringDoorbell;
+        return ring->TryWrite(payload.data(), payload.length(), ringDoorbell);
+    }
+
+    vector<string> Drain()
+    {
+        vector<string> payloads;
+        ring->Drain([&](const char *payload, size_t length) { payloads.emplace_back(payload, length); });
+        return payloads;
+    }
+};
+
+BOOST_AUTO_TEST_SUITE(ReportRingTests)
+
+BOOST_AUTO_TEST_CASE(TestAttach)
+{
+    TestRing test(4096);
+    BOOST_CHECK(ReportRing::Attach(test.memory.data(), test.memory.size() * sizeof(uint64_t)) == test.ring);
+
+    // Too small for its capacity
+    BOOST_CHECK(ReportRing::Attach(test.memory.data(), sizeof(ReportRingHeader) + 1024) == nullptr);
+
+    // Not laid out
+    vector<uint64_t> zeroes(test.memory.size());
+    BOOST_CHECK(ReportRing::Attach(zeroes.data(), zeroes.size() * sizeof(uint64_t)) == nullptr);
+}
+
+BOOST_AUTO_TEST_CASE(TestRecordsAreReadInOrder)
+{
+    TestRing test(4096);
+    BOOST_CHECK(test.Write("first\n"));
+    BOOST_CHECK(test.Write(""));
+    BOOST_CHECK(test.Write("third\n"));
+
+    auto payloads = test.Drain();
+    BOOST_REQUIRE_EQUAL(payloads.size(), 3);
+    BOOST_CHECK_EQUAL(payloads[0], "first\n");
+    BOOST_CHECK_EQUAL(payloads[1], "");
+    BOOST_CHECK_EQUAL(payloads[2], "third\n");
+    BOOST_CHECK(test.Drain().empty());
+    BOOST_CHECK_EQUAL(test.Header()->head.load(), test.Header()->tail.load());
+}
+
+BOOST_AUTO_TEST_CASE(TestFullRingAndWrapAround)
+{
+    TestRing test(1024);
+    string payload(200, 'a');
+    BOOST_CHECK(test.ring->CanHold(payload.length()));
+    BOOST_CHECK(!test.ring->CanHold(1024));
+
+    // 208 bytes per record: the fifth one doesn't fit
+    for (int i = 0; i < 4; i++)
+    {
+        BOOST_CHECK(test.Write(payload));
+    }
+
+    BOOST_CHECK(!test.Write(payload));
+    BOOST_CHECK_EQUAL(test.Drain().size(), 4);
+
+    // The records that would cross the end of the ring start over at its beginning, after a padding record
+    for (int lap = 0; lap < 10; lap++)
+    {
+        string content = to_string(lap) + payload;
+        BOOST_CHECK(test.Write(content));
+        BOOST_CHECK(test.Write(content));
+        auto payloads = test.Drain();
+        BOOST_REQUIRE_EQUAL(payloads.size(), 2);
+        BOOST_CHECK_EQUAL(payloads[0], content);
+        BOOST_CHECK_EQUAL(payloads[1], content);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestDoorbell)
+{
+    TestRing test(4096);
+    bool ringDoorbell;
+
+    // The reader starts idle: the first writer wakes it up, the next ones don't need to
+    BOOST_CHECK(test.ring->TryWrite("a", 1, ringDoorbell));
+    BOOST_CHECK(ringDoorbell);
+    BOOST_CHECK(test.ring->TryWrite("b", 1, ringDoorbell));
+    BOOST_CHECK(!ringDoorbell);
+
+    // Records published before parking must be drained first
+    BOOST_CHECK(!test.ring->Park());
+    BOOST_CHECK_EQUAL(test.Drain().size(), 2);
+    BOOST_CHECK(test.ring->Park());
+
+    BOOST_CHECK(test.ring->TryWrite("c", 1, ringDoorbell));
+    BOOST_CHECK(ringDoorbell);
+}
+
+BOOST_AUTO_TEST_CASE(TestConcurrentWriters)
+{
+    const int WriterCount = 4;
+    const int RecordsPerWriter = 20000;
+    TestRing test(16 * 1024);
+
+    vector<thread> writers;
+    for (int writer = 0; writer < WriterCount; writer++)
+    {
+        writers.emplace_back([&test, writer]()
+        {
+            for (int i = 0; i < RecordsPerWriter; i++)
+            {
+                // Records of different sizes, so they end up at any offset
+                string payload = to_string(writer) + " " + to_string(i) + " " + string(i % 97, 'x');
+                while (!test.Write(payload))
+                {
+                    this_thread::yield();
+                }
+            }
+        });
+    }
+
+    // Every record is read once, and the ones of each writer in the order it wrote them
+    vector<int> next(WriterCount, 0);
+    int received = 0;
+    bool outOfOrder = false;
+    while (received < WriterCount * RecordsPerWriter)
+    {
+        for (const string &payload : test.Drain())
+        {
+            int writer, index;
+            BOOST_REQUIRE_EQUAL(sscanf(payload.c_str(), "%d %d", &writer, &index), 2);
+            outOfOrder |= next[writer] != index;
+            next[writer] = index + 1;
+            received++;
+        }
+    }
+
+    for (thread &writer : writers)
+    {
+        writer.join();
+    }
+
+    BOOST_CHECK(!outOfOrder);
+    BOOST_CHECK(test.Drain().empty());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,115 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "access_cache.hpp"
+
+// Finalizer from splitmix64, spreads the bits of the running hashes over the whole word
+static inline uint64_t Mix(uint64_t h)
+{
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}
+
+void AccessCache::InitializeSharedTable(void *table, size_t capacity)
+{
+    SharedTableHeader *header = (SharedTableHeader *)table;
+    header->capacity = capacity;
+    header->magic = SharedTableMagic;
+}
+
+bool AccessCache::UseSharedTable(void *table, size_t size, uint64_t seed)
+{
+    SharedTableHeader *header = (SharedTableHeader *)table;
+    if (size < sizeof(SharedTableHeader)
+        || header->magic != SharedTableMagic
+        || header->capacity == 0
+        || (header->capacity & (header->capacity - 1)) != 0
+        || GetSharedTableSize(header->capacity) > size)
+    {
+        return false;
+    }
+
+    entries_ = (Entry *)(header + 1);
+    mask_ = header->capacity - 1;
+    seed_ = seed;
+    return true;
+}
+
+void AccessCache::Fingerprint(uint32_t key, uint64_t context, const char *path, uint64_t &primary, uint64_t &secondary) const
+{
+    // Two independent hashes computed in a single pass: FNV-1a and a multiply-rotate hash.
+    // A false positive would drop a report, so we deliberately use more than 64 bits.
+    // Mix(0) is 0, so a zero context gives the same fingerprints as no context at all.
+    uint64_t h1 = ((0xcbf29ce484222325ULL ^ key) + seed_) ^ Mix(context);
+    uint64_t h2 = ((0x9e3779b97f4a7c15ULL + key) ^ Mix(seed_)) + context;
+    size_t length = 0;
+    for (const unsigned char *c = (const unsigned char *)path; *c != '\0'; c++, length++)
+    {
+        h1 = (h1 ^ *c) * 0x100000001b3ULL;
+        h2 = (h2 + *c) * 0xff51afd7ed558ccdULL;
+        h2 = (h2 << 31) | (h2 >> 33);
+    }
+
+    primary = Mix(h1);
+    secondary = Mix(h2 ^ length);
+
+    // zero is reserved for empty entries
+    primary = primary == 0 ? 1 : primary;
+    secondary = secondary == 0 ? 1 : secondary;
+}
+
+bool AccessCache::Check(uint32_t key, const char *path, bool addEntryIfMissing, uint64_t context)
+{
+    uint64_t primary, secondary;
+    Fingerprint(key, context, path, primary, secondary);
+
+    size_t index = primary & mask_;
+    for (size_t probe = 0; probe < MaxProbes; probe++, index = (index + 1) & mask_)
+    {
+        Entry &entry = entries_[index];
+        uint64_t current = entry.primary.load(std::memory_order_acquire);
+        if (current == 0)
+        {
+            if (!addEntryIfMissing)
+            {
+                misses_.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+
+            if (entry.primary.compare_exchange_strong(current, primary, std::memory_order_acq_rel))
+            {
+                entry.secondary.store(secondary, std::memory_order_release);
+                return false;
+            }
+
+            // Another thread claimed this entry first, 'current' now holds its fingerprint
+        }
+
+        // An entry whose secondary is not published yet is being added concurrently. We treat it as
+        // a different fingerprint: at worst the same pair ends up stored twice.
+        if (current == primary && entry.secondary.load(std::memory_order_acquire) == secondary)
+        {
+            if (!addEntryIfMissing)
+            {
+                hits_.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            return true;
+        }
+    }
+
+    if (addEntryIfMissing)
+    {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+    }
+    else
+    {
+        misses_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    return false;
+}
@@ -0,0 +1,77 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Fixed-capacity set of (event, path) pairs used to avoid sending the same access report more than once.
+ *
+ * Lookups and insertions are lock-free and never allocate: the set is an open-addressing table of
+ * 128-bit fingerprints computed from the event and the path. When the probe window for a fingerprint
+ * is full the insertion is dropped, which only means that access may be reported again.
+ *
+ * By default the table is private to the process. It is not explicitly initialized (so constructing it doesn't
+ * touch its pages): instances must have static storage duration, which guarantees the table starts zeroed.
+ * Alternatively, the cache can operate on a table shared by several processes (see UseSharedTable).
+ */
+class AccessCache
+{
+public:
+    AccessCache() : entries_(localEntries_), mask_(LocalCapacity - 1), seed_(0) { }
+
+    // Returns whether the (key, path) pair is in the cache. If it is not and addEntryIfMissing is true, attempts to add it.
+    // A non-zero context is mixed into the fingerprint: the same pair under different contexts are different entries.
+    bool Check(uint32_t key, const char *path, bool addEntryIfMissing, uint64_t context = 0);
+
+    // Size in bytes of a shared table of the given capacity (a power of 2)
+    static constexpr size_t GetSharedTableSize(size_t capacity) { return sizeof(SharedTableHeader) + capacity * sizeof(Entry); }
+
+    // Initializes a zero-filled block of GetSharedTableSize(capacity) bytes as a shared table
+    static void InitializeSharedTable(void *table, size_t capacity);
+
+    // Switches this cache to a table initialized with InitializeSharedTable, possibly by another process, and
+    // mixes 'seed' into every fingerprint, so processes using different seeds don't see each other's entries.
+    // Returns false (and keeps using the private table) if the memory doesn't look like a shared table.
+    bool UseSharedTable(void *table, size_t size, uint64_t seed);
+
+    // Lookups that found the pair, lookups that did not, and insertions that could not find a free entry
+    uint64_t GetHits() const    { return hits_.load(std::memory_order_relaxed); }
+    uint64_t GetMisses() const  { return misses_.load(std::memory_order_relaxed); }
+    uint64_t GetDropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+    static const size_t LocalCapacity = 1 << 16;
+    static const size_t MaxProbes = 32;
+    static const uint64_t SharedTableMagic = 0x45484341434c5842ULL; // "BXLCACHE"
+
+    // 'primary' is published first and claims the entry, 'secondary' completes the fingerprint.
+    // A zero value means 'not set', fingerprints are never zero.
+    struct Entry
+    {
+        std::atomic<uint64_t> primary;
+        std::atomic<uint64_t> secondary;
+    };
+
+    // Shared tables start with a header, followed by the entries
+    struct SharedTableHeader
+    {
+        uint64_t magic;
+        uint64_t capacity;
+    };
+
+    void Fingerprint(uint32_t key, uint64_t context, const char *path, uint64_t &primary, uint64_t &secondary) const;
+
+    Entry *entries_;
+    size_t mask_;
+    uint64_t seed_;
+    Entry localEntries_[LocalCapacity];
+
+    // Keep the counters away from the entries so updating them doesn't invalidate cached entries on other cores
+    alignas(64) std::atomic<uint64_t> hits_;
+    std::atomic<uint64_t> misses_;
+    std::atomic<uint64_t> dropped_;
+};
@@ -0,0 +1,167 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+#include <sys/resource.h>
+#include <time.h>
+
+/**
+ * Kinds of accesses counted separately in PipAccessStatistics
+ */
+enum AccessFamily
+{
+    AccessFamilyProcess = 0,    // exec, fork and exit
+    AccessFamilyOpen,           // open, create and truncate
+    AccessFamilyWrite,          // writes to the content or the metadata of a file
+    AccessFamilyProbe,          // stat, access, readlink and reads of attributes
+    AccessFamilyEnumerate,      // directory enumerations
+    AccessFamilyNamespace,      // unlink, link and rename
+    AccessFamilyOther,
+    AccessFamilyCount
+};
+
+/**
+ * Counters of the sandbox for a whole pip, laid out in a file that every process of the pip maps and updates.
+ *
+ * The file is zero-filled when created: all the counters start at 0, and the magic is set by the first process to map it.
+ * The layout is read as is by the managed side at the end of the pip, so fields may only be added at the end.
+ */
+struct PipAccessStatistics
+{
+    static constexpr uint64_t Magic = 0x53544154534c5842ULL; // "BXLSTATS"
+
+    std::atomic<uint64_t> magic;
+
+    // Accesses that reached the sandbox, whether or not they ended up checked or reported
+    std::atomic<uint64_t> accesses[AccessFamilyCount];
+
+    // Lookups in the access cache, which spare checking (and reporting) an access again
+    std::atomic<uint64_t> cacheHits;
+    std::atomic<uint64_t> cacheMisses;
+
+    // Reports written to the report pipes, the bytes written, and the time spent writing them (including waiting for the pipe)
+    std::atomic<uint64_t> reportsSent;
+    std::atomic<uint64_t> bytesSent;
+    std::atomic<uint64_t> reportChannelNs;
+
+    // Times a thread found its ring of records full and had to send them itself, because the report flusher fell behind
+    std::atomic<uint64_t> reportFlusherBacklogs;
+
+    // Stops of the tracees the ptrace sandbox handled (ptrace stops or seccomp user notifications), the ones among them for a
+    // system call the tracer inspects, and the time the tracer spent handling them while the tracee waited
+    std::atomic<uint64_t> tracerStops;
+    std::atomic<uint64_t> tracerSyscallStops;
+    std::atomic<uint64_t> tracerStopNs;
+
+    // CPU time (user and system) of the tracers, which add it as they go: they get killed when the pip is done
+    std::atomic<uint64_t> tracerCpuNs;
+};
+
+/**
+ * Updates the PipAccessStatistics of the pip when they are mapped (see Use); otherwise every update is a no-op.
+ */
+class AccessStatistics
+{
+public:
+    // Updates the statistics at 'address', which must point to at least sizeof(PipAccessStatistics) zero-filled or previously used bytes
+    void Use(void *address)
+    {
+        PipAccessStatistics *statistics = (PipAccessStatistics *)address;
+        uint64_t expected = 0;
+        statistics->magic.compare_exchange_strong(expected, PipAccessStatistics::Magic);
+        statistics_ = statistics;
+    }
+
+    bool IsEnabled() const { return statistics_ != nullptr; }
+
+    void CountAccess(AccessFamily family)
+    {
+        if (statistics_ != nullptr)
+        {
+            statistics_->accesses[family].fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    void CountCacheLookup(bool hit)
+    {
+        if (statistics_ != nullptr)
+        {
+            (hit ? statistics_->cacheHits : statistics_->cacheMisses).fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    void CountReportFlusherBacklog()
+    {
+        if (statistics_ != nullptr)
+        {
+            statistics_->reportFlusherBacklogs.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    // 'startNs' is a timestamp obtained from Now() when the tracer got the stop
+    void CountTracerStop(bool syscall, uint64_t startNs)
+    {
+        if (statistics_ != nullptr)
+        {
+            statistics_->tracerStops.fetch_add(1, std::memory_order_relaxed);
+            statistics_->tracerStopNs.fetch_add(Now() - startNs, std::memory_order_relaxed);
+            if (syscall)
+            {
+                statistics_->tracerSyscallStops.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Adds the CPU time the calling process used since the last call. A tracer calls it whenever it goes idle, which only reads
+    // its resource usage every TracerCpuIntervalNs (unless 'force' is set, as it is right before the tracer exits).
+    void CountTracerCpu(bool force = false)
+    {
+        uint64_t now = Now();
+        struct rusage usage;
+        if (statistics_ == nullptr || (!force && now - tracerCpuCountedAtNs_ < TracerCpuIntervalNs) || getrusage(RUSAGE_SELF, &usage) != 0)
+        {
+            return;
+        }
+
+        uint64_t cpuNs = ((uint64_t)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000 + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000;
+        statistics_->tracerCpuNs.fetch_add(cpuNs - tracerCpuNs_, std::memory_order_relaxed);
+        tracerCpuNs_ = cpuNs;
+        tracerCpuCountedAtNs_ = now;
+    }
+
+    // 'startNs' is a timestamp obtained from Now()
+    void CountSent(uint64_t reports, uint64_t bytes, uint64_t startNs)
+    {
+        if (statistics_ != nullptr)
+        {
+            statistics_->reportsSent.fetch_add(reports, std::memory_order_relaxed);
+            statistics_->bytesSent.fetch_add(bytes, std::memory_order_relaxed);
+            statistics_->reportChannelNs.fetch_add(Now() - startNs, std::memory_order_relaxed);
+        }
+    }
+
+    // Monotonic timestamp in nanoseconds, or 0 when the statistics are not mapped (so callers don't pay for the clock)
+    uint64_t Now() const
+    {
+        if (statistics_ == nullptr)
+        {
+            return 0;
+        }
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+    }
+
+private:
+    static constexpr uint64_t TracerCpuIntervalNs = 10000000;
+
+    PipAccessStatistics *statistics_ = nullptr;
+
+    // CPU time of this process already added to 'tracerCpuNs', and when (see CountTracerCpu)
+    uint64_t tracerCpuNs_ = 0;
+    uint64_t tracerCpuCountedAtNs_ = 0;
+};
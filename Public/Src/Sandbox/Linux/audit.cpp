@@ -37,4 +37,30 @@ unsigned int la_objopen(struct link_map *map, Lmid_t lmid, uintptr_t *cookie)
     }
 
     return 0; // disable symbol auditing; to enable, return LA_FLG_BINDTO | LA_FLG_BINDFROM;
-}
\ No newline at end of file
+}
+
+/**
+ * The dynamic linker calls this function when link-map activity starts (objects are being
+ * added or removed) and once the link map is consistent again, e.g., at startup after mapping
+ * the dependencies of the program, and after every dlopen.
+ *
+ * The reports of the objects mapped meanwhile are held back by la_objopen, and sent here all at once.
+ */
+void la_activity(uintptr_t *cookie, unsigned int flag)
+{
+    if (flag == LA_ACT_CONSISTENT)
+    {
+        BxlObserver::GetInstance()->flush_audit_objopen_reports();
+    }
+}
+
+/**
+ * The dynamic linker calls this function after all shared objects have been loaded,
+ * before control is passed to the application.
+ *
+ * Nothing should be pending at this point (see la_activity), but the program must not start before its objects are reported.
+ */
+void la_preinit(uintptr_t *cookie)
+{
+    BxlObserver::GetInstance()->flush_audit_objopen_reports();
+}
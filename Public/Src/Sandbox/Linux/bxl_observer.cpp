@@ -3,10 +3,21 @@
 
 #include <algorithm>
 #include "bxl_observer.hpp"
+#include "elf_probe.hpp"
 #include "IOHandler.hpp"
-#include <stack>
+#include "observer_utilities.hpp"
+#include "sandbox_trace.hpp"
+#include <signal.h>
+#include <sys/file.h>
+#include <sys/mman.h>
 #include <sys/prctl.h>
 #include <sys/wait.h>
+#include <linux/futex.h>
+
+// Not defined by older headers. Older kernels ignore it (see InitProcessCache).
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
 
 static void HandleAccessReport(AccessReport report, int _)
 {
@@ -23,6 +34,22 @@ BxlObserver* BxlObserver::GetInstance()
 
 BxlObserver::BxlObserver()
 {
+#ifdef ENABLE_INTERPOSING
+    // The real functions are looked up on first use, except for the ones a child may call between fork and exec: if the parent is
+    // multithreaded, dlsym is not safe to call there (another thread may have been holding the loader lock when the process forked).
+    const LazySymbol *asyncSignalSafeFunctions[] =
+    {
+        &real__exit, &real_fork, &real_vfork, &real_clone,
+        &real_execve, &real_execv, &real_execvp, &real_execvpe, &real_execl, &real_execlp, &real_execle, &real_fexecve,
+        &real_open, &real_openat, &real_creat, &real_close, &real_write, &real_readlink, &real_dup, &real_dup2, &real_dup3, &real_sem_post,
+    };
+
+    for (const LazySymbol *function : asyncSignalSafeFunctions)
+    {
+        function->Get();
+    }
+#endif
+
     // These environment variables are set by BuildXL if ptrace is in use because the tracer runs in a separate process.
     const char *ptracePid = getenv(BxlPTraceTracedPid);
     bool isPTrace = !is_null_or_empty(ptracePid);
@@ -47,29 +74,29 @@ BxlObserver::BxlObserver()
 
     InitFam(isPTrace ? rootPid_ : getpid());
     InitDetoursLibPath();
+    if (!InitSharedCache())
+    {
+        InitProcessCache();
+    }
 
+    // The semicolon-separated list is only looked at when a process is about to be executed (see IsPTraceForced)
     const char* const forcedprocesses = getenv(BxlPTraceForcedProcessNames);
     if (!is_null_or_empty(forcedprocesses))
     {
         strlcpy(forcedPTraceProcessNamesList_, forcedprocesses, PATH_MAX);
+    }
 
-        // Get the list consuming the semicolon-separated value
-        const char* start = forcedprocesses; 
-        const char* end = forcedprocesses; 
-        while (*end != '\0') 
-        {
-            if (*end == ';') 
-            {
-                forcedPTraceProcessNames_.emplace_back(start, end - start);
-                start = end + 1;
-            }
-
-            end++;
-        }
-        
-        forcedPTraceProcessNames_.emplace_back(start, end - start);
+    const char* const sandboxTracePath = getenv(BxlEnvSandboxTracePath);
+    if (!is_null_or_empty(sandboxTracePath))
+    {
+        strlcpy(sandboxTracePath_, sandboxTracePath, PATH_MAX);
     }
 
+    InitAccessStatistics();
+    InitDebugLog();
+
+    InitEnvEdits();
+
     // FAM must be initialized before the report path can be obtained
     if (CheckEnableLinuxPTraceSandbox(pip_->GetFamExtraFlags()))
     {
@@ -80,6 +107,14 @@ BxlObserver::BxlObserver()
         secondaryReportPath_[reportLength] = '2';
         secondaryReportPath_[reportLength + 1] = '\0';
     }
+
+    InitReportRing();
+
+    // The key destructor flushes the batch of a thread when it exits
+    bool asyncReports = CheckEnableLinuxSandboxAsyncReporting(pip_->GetFamExtraFlags());
+    batchReports_ = (asyncReports || CheckEnableLinuxSandboxReportBatching(pip_->GetFamExtraFlags()))
+        && pthread_key_create(&reportBatchKey_, ReleaseReportBatch) == 0;
+    asyncReports_ = asyncReports && batchReports_;
 }
 
 BxlObserver::~BxlObserver()
@@ -92,6 +127,11 @@ BxlObserver::~BxlObserver()
         messageCountingSemaphore_ = nullptr;
     }
 
+    // Processes that don't go through our exit handler (e.g. ptracerunner) still need their batched reports sent
+    FlushReportBatches();
+
+    // Report pipe descriptors are intentionally left open: exit handlers may still send
+    // reports after this point (see SendExitReport), and the kernel closes them on exit.
     disposed_ = true;
 }
 
@@ -108,6 +148,268 @@ void BxlObserver::InitDetoursLibPath()
     }
 }
 
+void BxlObserver::InitEnvEdits()
+{
+    // Monitored children load the sandbox and attach to this pip
+    init_env_edit(&monitoredEnvEdits_[monitoredEnvEditCount_++], EnvEditIncludePath, "LD_PRELOAD", detoursLibFullPath_);
+    init_env_edit(&monitoredEnvEdits_[monitoredEnvEditCount_++], EnvEditSetValue, BxlEnvFamPath, famPath_);
+    init_env_edit(&monitoredEnvEdits_[monitoredEnvEditCount_++], EnvEditSetValue, BxlEnvDetoursPath, detoursLibFullPath_);
+    init_env_edit(&monitoredEnvEdits_[monitoredEnvEditCount_++], EnvEditSetValue, BxlEnvRootPid, "");
+    init_env_edit(&monitoredEnvEdits_[monitoredEnvEditCount_++], EnvEditSetValue, BxlPTraceForcedProcessNames, forcedPTraceProcessNamesList_);
+
+    // Unmonitored children don't load the sandbox, and must not find anything that could make them attach to it
+    init_env_edit(&unmonitoredEnvEdits_[unmonitoredEnvEditCount_++], EnvEditExcludePath, "LD_PRELOAD", detoursLibFullPath_);
+    init_env_edit(&unmonitoredEnvEdits_[unmonitoredEnvEditCount_++], EnvEditSetValue, BxlEnvFamPath, "");
+    init_env_edit(&unmonitoredEnvEdits_[unmonitoredEnvEditCount_++], EnvEditSetValue, BxlEnvDetoursPath, "");
+    init_env_edit(&unmonitoredEnvEdits_[unmonitoredEnvEditCount_++], EnvEditSetValue, BxlEnvRootPid, "");
+    init_env_edit(&unmonitoredEnvEdits_[unmonitoredEnvEditCount_++], EnvEditSetValue, BxlPTraceForcedProcessNames, "");
+
+    // Monitored children append to the same trace
+    if (sandboxTracePath_[0] != '\0')
+    {
+        init_env_edit(&monitoredEnvEdits_[monitoredEnvEditCount_++], EnvEditSetValue, BxlEnvSandboxTracePath, sandboxTracePath_);
+    }
+
+    if (sharedCacheFd_[0] != '\0')
+    {
+        init_env_edit(&monitoredEnvEdits_[monitoredEnvEditCount_++], EnvEditSetValue, BxlEnvSharedCacheFd, sharedCacheFd_);
+        init_env_edit(&unmonitoredEnvEdits_[unmonitoredEnvEditCount_++], EnvEditSetValue, BxlEnvSharedCacheFd, "");
+    }
+
+    // Monitored children write their own debug logs next to this one
+    if (debugLogDirectory_[0] != '\0')
+    {
+        init_env_edit(&monitoredEnvEdits_[monitoredEnvEditCount_++], EnvEditSetValue, BxlEnvDebugLogDirectory, debugLogDirectory_);
+        init_env_edit(&unmonitoredEnvEdits_[unmonitoredEnvEditCount_++], EnvEditSetValue, BxlEnvDebugLogDirectory, "");
+    }
+
+    // Monitored children count into the same statistics, unmonitored ones are not part of them
+    if (accessStatisticsPath_[0] != '\0')
+    {
+        init_env_edit(&monitoredEnvEdits_[monitoredEnvEditCount_++], EnvEditSetValue, BxlEnvAccessStatisticsPath, accessStatisticsPath_);
+        init_env_edit(&unmonitoredEnvEdits_[unmonitoredEnvEditCount_++], EnvEditSetValue, BxlEnvAccessStatisticsPath, "");
+    }
+}
+
+void BxlObserver::InitAccessStatistics()
+{
+    const char *path = getenv(BxlEnvAccessStatisticsPath);
+    if (is_null_or_empty(path))
+    {
+        return;
+    }
+
+    // The first process of the pip creates the file, zero-filled: the others find it (possibly being extended) and map the same pages.
+    // Only the real functions are called, so the file itself is never reported.
+    int fd = real_open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1)
+    {
+        return;
+    }
+
+    const size_t size = sizeof(PipAccessStatistics);
+    struct stat st;
+    void *statistics = real_fstat(fd, &st) == 0 && (st.st_size >= (off_t)size || real_ftruncate(fd, size) == 0)
+        ? real_mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+        : MAP_FAILED;
+    real_close(fd);
+
+    if (statistics != MAP_FAILED)
+    {
+        statistics_.Use(statistics);
+        strlcpy(accessStatisticsPath_, path, PATH_MAX);
+    }
+}
+
+void BxlObserver::InitDebugLog()
+{
+    const char *directory = getenv(BxlEnvDebugLogDirectory);
+    if (is_null_or_empty(directory))
+    {
+        return;
+    }
+
+    // A file per process (pids may be reused within a build, hence the suffix). Children forked without exec share it:
+    // the mapping is inherited. Only the real functions are called, so the file itself is never reported.
+    char path[PATH_MAX];
+    int fd = -1;
+    for (int attempt = 0; attempt < 16 && fd == -1; attempt++)
+    {
+        snprintf(path, PATH_MAX, "%s/%s.%d.%d" DEBUG_LOG_FILE_EXTENSION, directory, __progname, getpid(), attempt);
+        fd = real_open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (fd == -1 && errno != EEXIST)
+        {
+            return;
+        }
+    }
+
+    if (fd == -1)
+    {
+        return;
+    }
+
+    // The file is zero-filled, and pages are only allocated when touched
+    const size_t size = DebugLog::GetFileSize();
+    void *log = real_ftruncate(fd, size) == 0
+        ? real_mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+        : MAP_FAILED;
+    real_close(fd);
+
+    if (log != MAP_FAILED)
+    {
+        DebugLog::Initialize(log, getpid(), __progname);
+        debugLog_.Use(log);
+        strlcpy(debugLogDirectory_, directory, PATH_MAX);
+    }
+}
+
+void BxlObserver::InitReportRing()
+{
+    if (!CheckEnableLinuxSandboxSharedMemoryReports(pip_->GetFamExtraFlags()))
+    {
+        return;
+    }
+
+    // The managed side creates the ring next to the FIFO and lays it out before the pip starts. Without it, reports go to the FIFO.
+    // CODESYNC: Public/Src/Engine/Processes/SandboxConnectionLinuxDetours.cs (GetPaths)
+    char path[PATH_MAX];
+    if (snprintf(path, PATH_MAX, "%s" REPORT_RING_FILE_SUFFIX, GetReportsPath()) >= PATH_MAX)
+    {
+        return;
+    }
+
+    int fd = real_open(path, O_RDWR | O_CLOEXEC, 0);
+    if (fd == -1)
+    {
+        return;
+    }
+
+    struct stat st;
+    void *ring = real_fstat(fd, &st) == 0 && st.st_size > 0
+        ? real_mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+        : MAP_FAILED;
+    real_close(fd);
+
+    if (ring != MAP_FAILED)
+    {
+        reportRing_ = ReportRing::Attach(ring, st.st_size);
+    }
+}
+
+bool BxlObserver::InitSharedCache()
+{
+    if (!CheckEnableLinuxSandboxSharedAccessCache(pip_->GetFamExtraFlags()))
+    {
+        return false;
+    }
+
+    // The name of the anonymous file is also used to validate an inherited descriptor below
+    const char *tableName = "bxl_access_cache";
+    const size_t capacity = 1 << 20;
+    const size_t tableSize = AccessCache::GetSharedTableSize(capacity);
+
+    // Entries are deduplicated per executable: policies can depend on the process that performs the access
+    uint64_t seed = std::hash<std::string>{}(progFullPath_);
+
+    // The table is an anonymous file created by the root process of the pip, and inherited by
+    // its descendants (the descriptor is not close-on-exec) with the number passed down through ensureEnvs.
+    const char *fdStr = getenv(BxlEnvSharedCacheFd);
+    if (!is_null_or_empty(fdStr))
+    {
+        int fd = atoi(fdStr);
+
+        // Some process in between may have closed the descriptor, and the number reused for something else
+        char procPath[PATH_MAX] = {0};
+        char fdPath[PATH_MAX] = {0};
+        snprintf(procPath, PATH_MAX, "/proc/self/fd/%d", fd);
+        ssize_t length = real_readlink(procPath, fdPath, PATH_MAX - 1);
+        if (length <= 0 || strncmp(fdPath, "/memfd:", 7) != 0 || strncmp(fdPath + 7, tableName, strlen(tableName)) != 0)
+        {
+            return false;
+        }
+
+        void *table = real_mmap(nullptr, tableSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (table == MAP_FAILED)
+        {
+            return false;
+        }
+
+        if (!cache_.UseSharedTable(table, tableSize, seed))
+        {
+            munmap(table, tableSize);
+            return false;
+        }
+
+        strlcpy(sharedCacheFd_, fdStr, sizeof(sharedCacheFd_));
+        return true;
+    }
+
+    if (rootPid_ != getpid())
+    {
+        // Only the root process creates the table. If we got here, the descriptor was lost on the way.
+        return false;
+    }
+
+    // memfd_create is interposed, and this runs while the observer is being constructed
+    int fd = real_memfd_create(tableName, 0);
+    if (fd == -1)
+    {
+        return false;
+    }
+
+    // Anonymous files are zero-filled, and pages are only allocated when touched
+    void *table = ftruncate(fd, tableSize) == 0
+        ? real_mmap(nullptr, tableSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+        : MAP_FAILED;
+    if (table == MAP_FAILED)
+    {
+        real_close(fd);
+        return false;
+    }
+
+    AccessCache::InitializeSharedTable(table, capacity);
+    cache_.UseSharedTable(table, tableSize, seed);
+    snprintf(sharedCacheFd_, sizeof(sharedCacheFd_), "%d", fd);
+    return true;
+}
+
+void BxlObserver::InitProcessCache()
+{
+    // Same seed as InitSharedCache
+    uint64_t seed = std::hash<std::string>{}(progFullPath_);
+    const size_t tableSize = AccessCache::GetSharedTableSize(ProcessCacheCapacity);
+    void *address = (void *)ProcessCacheAddress;
+
+    // The first one to get here maps the table. Kernels older than 4.17 don't know MAP_FIXED_NOREPLACE and take the address as a hint,
+    // so a table mapped anywhere else means the address is taken as well.
+    void *table = real_mmap(address, tableSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if (table == address)
+    {
+        AccessCache::InitializeSharedTable(table, ProcessCacheCapacity);
+        cache_.UseSharedTable(table, tableSize, seed);
+        return;
+    }
+
+    if (table != MAP_FAILED)
+    {
+        munmap(table, tableSize);
+    }
+    else if (errno != EEXIST)
+    {
+        return;
+    }
+
+    // Something is mapped at the address, and it may not be our table (or even be readable): look at it without faulting
+    constexpr size_t headerSize = AccessCache::GetSharedTableSize(0);
+    char header[headerSize];
+    struct iovec local = { header, headerSize };
+    struct iovec remote = { address, headerSize };
+    if (process_vm_readv(getpid(), &local, 1, &remote, 1, 0) == (ssize_t)headerSize)
+    {
+        cache_.UseSharedTable(address, tableSize, seed);
+    }
+}
+
 void BxlObserver::InitFam(pid_t pid)
 {
     // read FAM env var
@@ -122,24 +424,29 @@ void BxlObserver::InitFam(pid_t pid)
     // Store the value for future uses, as the environment might be cleared by the running process
     strlcpy(famPath_, famPath, PATH_MAX);
 
-    // read FAM
-    FILE *famFile = real_fopen(famPath_, "rb");
-    if (!famFile)
+    // map FAM. Every process of the pip does this on startup, and manifests of large pips take tens of megabytes:
+    // the policy tree is used in place from a read-only mapping of the file, so all the processes of the pip share
+    // the pages of the page cache instead of each reading and holding a copy of its own.
+    // The managed side writes the manifest before starting the pip and only deletes it once the pip is done.
+    int famFd = real_open(famPath_, O_RDONLY | O_CLOEXEC, 0);
+    if (famFd == -1)
     {
         _fatal("Could not open file '%s'; errno: %d", famPath_, errno);
     }
 
-    fseek(famFile, 0, SEEK_END);
-    long famLength = ftell(famFile);
-    rewind(famFile);
+    off_t famLength = lseek(famFd, 0, SEEK_END);
+    void *famPayload = famLength > 0 ? real_mmap(nullptr, famLength, PROT_READ, MAP_SHARED, famFd, 0) : MAP_FAILED;
+    if (famPayload == MAP_FAILED)
+    {
+        _fatal("Could not map file '%s'; errno: %d", famPath_, errno);
+    }
 
-    char *famPayload = (char *)malloc(famLength);
-    real_fread(famPayload, famLength, 1, famFile);
-    real_fclose(famFile);
+    real_close(famFd);
 
-    // create SandboxedPip (which parses FAM and throws on error)
-    pip_ = shared_ptr<SandboxedPip>(new SandboxedPip(pid, famPayload, famLength));
-    free(famPayload);
+    // create SandboxedPip (which parses FAM and throws on error). The mapping is never released: reports may still be sent
+    // from exit handlers after the destructor of the observer ran.
+    pip_ = shared_ptr<SandboxedPip>(new SandboxedPip(pid, (const char *)famPayload, famLength, /* copyPayload */ false));
+    seed_resolved_paths();
 
     // create sandbox
     sandbox_ = new Sandbox(0, Configuration::DetoursLinuxSandboxType);
@@ -157,28 +464,116 @@ void BxlObserver::InitFam(pid_t pid)
     sandboxLoggingEnabled_ = CheckEnableLinuxSandboxLogging(pip_->GetFamExtraFlags());
 }
 
-void BxlObserver::Init()
+std::atomic<uint64_t>* BxlObserver::OpenMessageCounter()
+{
+    // The managed side creates the page next to the semaphore, under the same name (see SharedMessageCounter.cs)
+    char path[PATH_MAX];
+    if (snprintf(path, sizeof(path), "/dev/shm%s.count", pip_->GetInternalDetoursErrorNotificationFile()) >= (int)sizeof(path))
+    {
+        return nullptr;
+    }
+
+    int fd = real_open(path, O_RDWR | O_CLOEXEC, 0);
+    if (fd == -1)
+    {
+        return nullptr;
+    }
+
+    void *counter = real_mmap(nullptr, sizeof(std::atomic<uint64_t>), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    real_close(fd);
+    return counter == MAP_FAILED ? nullptr : (std::atomic<uint64_t> *)counter;
+}
+
+void BxlObserver::CountSentReports(int count)
+{
+    if (count <= 0)
+    {
+        return;
+    }
+
+    GetMessageCountingSemaphore();
+
+    if (messageCounter_ != nullptr)
+    {
+        // Only the value at the end of the pip matters: the write of the reports orders nothing here
+        messageCounter_->fetch_add(count, std::memory_order_relaxed);
+        return;
+    }
+
+    for (int i = 0; messageCountingSemaphore_ != nullptr && i < count; i++)
+    {
+        if (real_sem_post(messageCountingSemaphore_) != 0)
+        {
+            // something went wrong with the semaphore, we shouldn't call LOG_DEBUG here because it will just come back to this function
+            // we also don't want to call _fatal because that will fail the pip.
+            // instead log the error to stdout (this could be promoted to stderr in the future when this feature is stable)
+            real_fprintf(stdout, "posting to buildxl message counting semaphore failed with errno: %d\n", errno);
+            break;
+        }
+    }
+}
+
+void BxlObserver::GetMessageCountingSemaphore()
 {
-    // If message counting is enabled, open the associated semaphore (this should already be created by the managed side)
-    if (CheckCheckDetoursMessageCount(pip_->GetFamFlags()))
+    int state = messageCountingSemaphoreState_.load(std::memory_order_acquire);
+    if (state == SemaphoreOpened)
     {
-        // Setting initializingSemaphore_ will communicate to the interpose layer to not interpose any libc functions called inside sem_open
-        initializingSemaphore_ = true;
-        messageCountingSemaphore_ = real_sem_open(pip_->GetInternalDetoursErrorNotificationFile(), O_CREAT, 0644, 0);
+        return;
+    }
 
-        if (messageCountingSemaphore_ == SEM_FAILED)
+    if (state == SemaphoreNotOpened && messageCountingSemaphoreState_.compare_exchange_strong(state, SemaphoreOpening))
+    {
+        // If message counting is enabled, open the associated semaphore (this should already be created by the managed side)
+        if (CheckCheckDetoursMessageCount(pip_->GetFamFlags()))
         {
-            // we'll log a message here, but this won't fail the pip until this feature is tested more thorougly
-            real_fprintf(stdout, "BuildXL injected message: File access monitoring failed to open message counting semaphore '%s' with errno: '%d'. You should rerun this build, or contact the BuildXL team if the issue persists across multiple builds.", pip_->GetInternalDetoursErrorNotificationFile(), errno);
+            // Other threads wait for this one, so a signal handler must not get to report in the meantime
+            sigset_t allSignals, previousSignals;
+            sigfillset(&allSignals);
+            pthread_sigmask(SIG_BLOCK, &allSignals, &previousSignals);
+
+            // The shared counter takes an atomic add per report instead of a sem_post: the semaphore is only a fallback
+            messageCounter_ = OpenMessageCounter();
+
+            // Setting initializingSemaphore_ will communicate to the interpose layer to not interpose any libc functions called inside sem_open
+            initializingSemaphore_ = true;
+            sem_t *semaphore = messageCounter_ != nullptr
+                ? nullptr
+                : real_sem_open(pip_->GetInternalDetoursErrorNotificationFile(), O_CREAT, 0644, 0);
+
+            if (semaphore == SEM_FAILED)
+            {
+                // we'll log a message here, but this won't fail the pip until this feature is tested more thorougly
+                real_fprintf(stdout, "BuildXL injected message: File access monitoring failed to open message counting semaphore '%s' with errno: '%d'. You should rerun this build, or contact the BuildXL team if the issue persists across multiple builds.", pip_->GetInternalDetoursErrorNotificationFile(), errno);
+                semaphore = nullptr;
+            }
+
+            messageCountingSemaphore_ = semaphore;
+            initializingSemaphore_ = false;
+            pthread_sigmask(SIG_SETMASK, &previousSignals, nullptr);
         }
 
-        initializingSemaphore_ = false;
+        messageCountingSemaphoreState_.store(SemaphoreOpened, std::memory_order_release);
+        return;
+    }
+
+    // Another thread is opening it
+    while (messageCountingSemaphoreState_.load(std::memory_order_acquire) != SemaphoreOpened)
+    {
+        sched_yield();
     }
 }
 
 void BxlObserver::LogDebug(pid_t pid, const char *fmt, ...)
 {
-    if (LogDebugEnabled())
+    if (debugLog_.IsEnabled())
+    {
+        // Formatted offline by debuglogdecoder
+        va_list args;
+        va_start(args, fmt);
+        debugLog_.Write(pid, fmt, args);
+        va_end(args);
+    }
+    else if (LogDebugEnabled())
     {
         // Build an access report that represents the debug message
         AccessReport debugReport = 
@@ -206,8 +601,9 @@ void BxlObserver::LogDebug(pid_t pid, const char *fmt, ...)
 
         // Sanitize the debug message so we don't confuse the parser on managed code:
         // Pipes (|) are used to delimit the message parts and we expect one line (\n) per report, so
-        // replace those occurrences with something else.
-        for (int i = 0 ; i < MAXPATHLEN; i++)
+        // replace those occurrences with something else. Only the part vsnprintf wrote needs it, the rest is zeroed.
+        int messageLength = numWritten < 0 ? 0 : std::min(numWritten, MAXPATHLEN - 1);
+        for (int i = 0 ; i < messageLength; i++)
         {
             if (debugReport.path[i] == '|')
             {
@@ -226,7 +622,7 @@ void BxlObserver::LogDebug(pid_t pid, const char *fmt, ...)
 
 // Checks whether cache contains (event, path) pair and returns the result of this check.
 // If the pair is not in cache and addEntryIfMissing is true, attempts to add the pair to cache.
-bool BxlObserver::CheckCache(es_event_type_t event, const string &path, bool addEntryIfMissing)
+bool BxlObserver::CheckCache(es_event_type_t event, const char *path, bool addEntryIfMissing)
 {
     // coalesce some similar events
     es_event_type_t key;
@@ -252,48 +648,62 @@ bool BxlObserver::CheckCache(es_event_type_t event, const string &path, bool add
         case ES_EVENT_TYPE_NOTIFY_ACCESS:
         case ES_EVENT_TYPE_NOTIFY_STAT:
             key = ES_EVENT_TYPE_NOTIFY_STAT;
+            break;
 
         default:
             key = event;
             break;
     }
 
-    // This code could possibly be executing from an interrupt routine or from who knows where,
-    // so to avoid deadlocks it's essential to never block here indefinitely.
-    if (!cacheMtx_.try_lock_for(chrono::milliseconds(1)))
-    {
-        return false; // failed to acquire mutex -> forget about it
-    }
-
-    // ============================== in the critical section ================================
-
-    // make sure the mutex is released by the end
-    shared_ptr<timed_mutex> sp(&cacheMtx_, [](timed_mutex *mtx) { mtx->unlock(); });
-
-    unordered_map<es_event_type_t, unordered_set<string>>::iterator it = cache_.find(key);
-    if (it == cache_.end())
-    {
-        if (addEntryIfMissing) 
-        {
-            unordered_set<string> set;
-            set.insert(path);
-            cache_.insert(make_pair(key, set));
-        }
-
-        return false;
-    }
+    // The cache is lock-free, so this is safe to call from an interrupt routine or from who knows where
+    return cache_.Check(key, path, addEntryIfMissing);
+}
 
-    if (addEntryIfMissing) 
-    {
-        return !it->second.insert(path).second;
-    }
-    else 
-    {
-        return (it->second.find(path) != it->second.end());
+// The kinds of accesses the statistics of the pip are broken down by (see access_statistics.hpp)
+static AccessFamily GetAccessFamily(es_event_type_t eventType)
+{
+    switch (eventType)
+    {
+        case ES_EVENT_TYPE_AUTH_EXEC:
+        case ES_EVENT_TYPE_NOTIFY_EXEC:
+        case ES_EVENT_TYPE_NOTIFY_FORK:
+        case ES_EVENT_TYPE_NOTIFY_EXIT:
+            return AccessFamilyProcess;
+        case ES_EVENT_TYPE_NOTIFY_OPEN:
+        case ES_EVENT_TYPE_NOTIFY_CREATE:
+        case ES_EVENT_TYPE_NOTIFY_TRUNCATE:
+            return AccessFamilyOpen;
+        case ES_EVENT_TYPE_NOTIFY_WRITE:
+        case ES_EVENT_TYPE_NOTIFY_SETTIME:
+        case ES_EVENT_TYPE_NOTIFY_SETMODE:
+        case ES_EVENT_TYPE_NOTIFY_SETOWNER:
+        case ES_EVENT_TYPE_AUTH_SETOWNER:
+        case ES_EVENT_TYPE_NOTIFY_UTIMES:
+        case ES_EVENT_TYPE_NOTIFY_SETFLAGS:
+        case ES_EVENT_TYPE_NOTIFY_SETEXTATTR:
+        case ES_EVENT_TYPE_NOTIFY_SETATTRLIST:
+        case ES_EVENT_TYPE_NOTIFY_SETACL:
+        case ES_EVENT_TYPE_NOTIFY_DELETEEXTATTR:
+            return AccessFamilyWrite;
+        case ES_EVENT_TYPE_NOTIFY_STAT:
+        case ES_EVENT_TYPE_NOTIFY_ACCESS:
+        case ES_EVENT_TYPE_NOTIFY_READLINK:
+        case ES_EVENT_TYPE_NOTIFY_GETATTRLIST:
+        case ES_EVENT_TYPE_NOTIFY_GETEXTATTR:
+        case ES_EVENT_TYPE_NOTIFY_LISTEXTATTR:
+            return AccessFamilyProbe;
+        case ES_EVENT_TYPE_NOTIFY_READDIR:
+            return AccessFamilyEnumerate;
+        case ES_EVENT_TYPE_NOTIFY_UNLINK:
+        case ES_EVENT_TYPE_NOTIFY_LINK:
+        case ES_EVENT_TYPE_NOTIFY_RENAME:
+            return AccessFamilyNamespace;
+        default:
+            return AccessFamilyOther;
     }
 }
 
-bool BxlObserver::IsCacheHit(es_event_type_t event, const string &path, const string &secondPath)
+bool BxlObserver::IsCacheHit(es_event_type_t event, const char *path, const char *secondPath)
 {
     // (1) IMPORTANT           : never do any of this stuff after this object has been disposed!
     //     WHY                 : because the cache date structure is invalid at that point.
@@ -301,7 +711,7 @@ bool BxlObserver::IsCacheHit(es_event_type_t event, const string &path, const st
     //                           global BxlObserver singleton instance can already be disposed.
     // (2) never cache FORK, EXEC, EXIT and events that take 2 paths
     if (disposed_ ||
-        secondPath.length() > 0 ||
+        secondPath[0] != '\0' ||
         event == ES_EVENT_TYPE_NOTIFY_FORK ||
         event == ES_EVENT_TYPE_NOTIFY_EXEC ||
         event == ES_EVENT_TYPE_NOTIFY_EXIT)
@@ -309,7 +719,62 @@ bool BxlObserver::IsCacheHit(es_event_type_t event, const string &path, const st
         return false;
     }
 
-    return CheckCache(event, path, /* addEntryIfMissing */ false);
+    bool hit = CheckCache(event, path, /* addEntryIfMissing */ false);
+    statistics_.CountCacheLookup(hit);
+    return hit;
+}
+
+// Folds a value into a probe cache context (the hash_combine step from boost)
+static inline uint64_t CombineProbeContext(uint64_t context, uint64_t value)
+{
+    return context ^ (value + 0x9e3779b97f4a7c15ULL + (context << 6) + (context >> 2));
+}
+
+bool BxlObserver::is_probe_cache_hit(es_event_type_t eventType, int dirfd, const char *pathname, int oflags, uint64_t &context, pid_t associatedPid)
+{
+    context = 0;
+
+    // The working directory and descriptors of other processes (the ptrace sandbox) are not tracked
+    if (disposed_ || eventType != ES_EVENT_TYPE_NOTIFY_STAT || pathname == nullptr || pathname[0] == '\0' || (associatedPid != 0 && associatedPid != getpid()))
+    {
+        return false;
+    }
+
+    // What the raw path is resolved against: nothing for absolute paths, otherwise the working directory or the entry of dirfd in the descriptor table.
+    // A descriptor we don't have a cached path for has no version to key on, so such probes are not cached.
+    uint64_t directory = 0;
+    if (pathname[0] != '/')
+    {
+        uint32_t version;
+        if (dirfd == AT_FDCWD)
+        {
+            directory = (1ULL << 63) | cwdGeneration_.load(std::memory_order_acquire);
+        }
+        else if (useFdTable_ && fdTable_.GetVersion(dirfd, version))
+        {
+            directory = ((uint64_t)(uint32_t)dirfd << 32) | version;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    // Symlinks are resolved as part of the normalization, so anything that invalidates resolved paths invalidates probes as well
+    context = CombineProbeContext(context, directory);
+    context = CombineProbeContext(context, resolvedPathsGeneration_.load(std::memory_order_acquire));
+    context = CombineProbeContext(context, (uint32_t)oflags);
+    context = context == 0 ? 1 : context;
+
+    return probeCache_.Check(eventType, pathname, /* addEntryIfMissing */ false, context);
+}
+
+void BxlObserver::add_probe_cache_entry(es_event_type_t eventType, uint64_t context, const char *pathname, AccessCheckResult &check, int error)
+{
+    if (context != 0 && error == 0 && !should_deny(check))
+    {
+        probeCache_.Check(eventType, pathname, /* addEntryIfMissing */ true, context);
+    }
 }
 
 bool BxlObserver::Send(const char *buf, size_t bufsiz, bool useSecondaryPipe, bool countReport)
@@ -325,48 +790,822 @@ bool BxlObserver::Send(const char *buf, size_t bufsiz, bool useSecondaryPipe, bo
         _fatal("Cannot atomically send a buffer whose size (%ld) is greater than PIPE_BUF (%d)", bufsiz, PIPE_BUF);
     }
 
+    // update the message counter whenever a report is sent
+    // We update the message counter before sending the report because we could hit a race condition where
+    // the message is received by the managed side but we haven't yet incremented the counter if we do it after sending the message.
+    // If the message fails to send, the code below will write to stderr and exit with a bad exit code causing the pip to fail anyways.
+    // So it doesn't matter if we increment the counter but fail to send a message.
+    CountSentReports(countReport ? 1 : 0);
+
+    uint64_t startNs = statistics_.Now();
+    if (!useSecondaryPipe && WriteFramesToReportRing(buf, bufsiz) == bufsiz)
+    {
+        statistics_.CountSent(countReport ? 1 : 0, bufsiz, startNs);
+        return true;
+    }
+
+    int logFd = GetReportFd(useSecondaryPipe);
+    ssize_t numWritten = real_write(logFd, buf, bufsiz);
+    if (numWritten < bufsiz)
+    {
+        _fatal("Wrote only %ld bytes out of %ld", numWritten, bufsiz);
+    }
+
+    statistics_.CountSent(countReport ? 1 : 0, bufsiz, startNs);
+    return true;
+}
+
+int BxlObserver::GetReportFd(bool useSecondaryPipe)
+{
     const char *reportsPath = useSecondaryPipe ? GetSecondaryReportsPath() : GetReportsPath();
-    int logFd = real_open(reportsPath, O_WRONLY | O_APPEND, 0);
-    if (logFd == -1)
+    int fd = GetCachedFd(useSecondaryPipe ? 1 : 0, reportsPath, O_WRONLY | O_APPEND | O_CLOEXEC);
+    if (fd == -1)
     {
         _fatal("Could not open file '%s'; errno: %d", reportsPath, errno);
     }
 
-    // update message counting semaphore whenever a report is sent
-    // We update the message counting semaphore before sending the report because we could hit a race condition where
-    // the message is received by the managed side but we haven't yet incremented the counter if we do it after sending the message.
-    // If the message fails to send, the code below will write to stderr and exit with a bad exit code causing the pip to fail anyways.
-    // So it doesn't matter if we increment the counter but fail to send a message.
-    if (messageCountingSemaphore_ != nullptr && countReport)
+    return fd;
+}
+
+int BxlObserver::GetCachedFd(int slotIndex, const char *path, int flags)
+{
+    std::atomic<uint64_t> &slot = reportFds_[slotIndex];
+    uint64_t pid = (uint32_t)getpid();
+    uint64_t current = slot.load();
+
+    while (true)
+    {
+        // A descriptor opened by this process can be reused. One whose pid doesn't match was inherited through fork/clone:
+        // we don't close it (with CLONE_FILES the parent still owns it), it is closed on exec anyway because of O_CLOEXEC
+        if (current != NoReportFd && (current >> 32) == pid)
+        {
+            return (int)(uint32_t)current;
+        }
+
+        int fd = real_open(path, flags, 0644);
+        if (fd == -1)
+        {
+            return -1;
+        }
+
+        // A handle was opened for our own internal purposes. That
+        // could have reused a fd where we missed a close, 
+        // so reset that entry in the fd table. The fd table is gone if we
+        // are reporting from an exit handler after the destructor ran.
+        if (!disposed_)
+        {
+            reset_fd_table_entry(fd);
+        }
+
+        if (slot.compare_exchange_strong(current, (pid << 32) | (uint32_t)fd))
+        {
+            return fd;
+        }
+
+        // Another thread stored a descriptor first, 'current' now holds it
+        real_close(fd);
+    }
+}
+
+BxlObserver::ReportBatch* BxlObserver::GetReportBatch()
+{
+    ReportBatch *batch = (ReportBatch *)pthread_getspecific(reportBatchKey_);
+    if (batch != nullptr)
+    {
+        return batch;
+    }
+
+    // Reuse a batch released by a thread that exited, or allocate a new one
+    for (ReportBatch *candidate = reportBatches_.load(); candidate != nullptr; candidate = candidate->next)
+    {
+        bool inUse = false;
+        if (candidate->inUse.compare_exchange_strong(inUse, true))
+        {
+            batch = candidate;
+            break;
+        }
+    }
+
+    if (batch == nullptr)
+    {
+        void *memory = malloc(sizeof(ReportBatch));
+        if (memory == nullptr)
+        {
+            return nullptr;
+        }
+
+        batch = new (memory) ReportBatch();
+
+        // Without a ring, reports from this thread are batched synchronously
+        if (asyncReports_)
+        {
+            batch->records = (char *)malloc(ReportRecordsCapacity);
+        }
+
+        batch->next = reportBatches_.load();
+        while (!reportBatches_.compare_exchange_weak(batch->next, batch));
+    }
+
+    pthread_setspecific(reportBatchKey_, batch);
+    return batch;
+}
+
+bool BxlObserver::TryLockReportBatch(ReportBatch *batch)
+{
+    // We don't wait forever: the batch may be held by the very same thread if we got here from a signal handler
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(1);
+    while (batch->busy.test_and_set(std::memory_order_acquire))
+    {
+        if (std::chrono::steady_clock::now() > deadline)
+        {
+            return false;
+        }
+
+        sched_yield();
+    }
+
+    return true;
+}
+
+void BxlObserver::ReleaseReportBatch(void *batch)
+{
+    ReportBatch *reportBatch = (ReportBatch *)batch;
+    BxlObserver *bxl = BxlObserver::GetInstance();
+    if (bxl->TryLockReportBatch(reportBatch))
+    {
+        bxl->FlushReportBatch(reportBatch);
+        reportBatch->busy.clear(std::memory_order_release);
+    }
+
+    reportBatch->inUse = false;
+}
+
+bool BxlObserver::AppendToReportBatch(const AccessReport &report, bool countReport, bool flush)
+{
+    const int PrefixLength = sizeof(uint);
+    ReportBatch *batch = GetReportBatch();
+    if (batch == nullptr || !TryLockReportBatch(batch))
+    {
+        // No batch is available (out of memory, or we are re-entering from a signal handler): send this report on its own.
+        return SendUnbatchedReport(report, countReport);
+    }
+
+    pid_t pid = getpid();
+    if (batch->pid != pid)
+    {
+        // The batch was inherited through fork/clone: its content belongs to the parent (which will send it)
+        // and the descriptor is not ours to use (see GetReportFd)
+        batch->pid = pid;
+        batch->fd = -1;
+        batch->length = 0;
+        batch->countedReports = 0;
+    }
+
+    bool result = true;
+    int available = ReportBatchCapacity - batch->length - PrefixLength;
+    int reportSize = BuildReport(&batch->buffer[batch->length + PrefixLength], available, report, report.path);
+    if (reportSize >= available)
+    {
+        // The report doesn't fit in what is left of the batch. Send the batch and build the report again
+        // at the beginning of the buffer: a single report always fits in an empty batch.
+        result = FlushReportBatch(batch);
+        available = ReportBatchCapacity - PrefixLength;
+        reportSize = BuildReport(&batch->buffer[PrefixLength], available, report, report.path);
+    }
+
+    memcpy(&batch->buffer[batch->length], &reportSize, PrefixLength);
+    batch->length += PrefixLength + reportSize;
+    batch->countedReports += countReport ? 1 : 0;
+
+    if (flush)
+    {
+        result &= FlushReportBatch(batch);
+    }
+
+    batch->busy.clear(std::memory_order_release);
+    return result;
+}
+
+bool BxlObserver::SendUnbatchedReport(const AccessReport &report, bool countReport)
+{
+    // The path is bounded by MAXPATHLEN, so PIPE_BUF on top of that is enough for the rest of the fields
+    const int PrefixLength = sizeof(uint);
+    char buffer[PIPE_BUF + MAXPATHLEN];
+    int reportSize = BuildReport(&buffer[PrefixLength], sizeof(buffer) - PrefixLength, report, report.path);
+    memcpy(buffer, &reportSize, PrefixLength);
+
+    int fd = real_open(GetReportsPath(), O_WRONLY | O_APPEND | O_CLOEXEC, 0);
+    if (fd == -1)
+    {
+        _fatal("Could not open file '%s'; errno: %d", GetReportsPath(), errno);
+    }
+
+    bool result = SendFrames(fd, buffer, reportSize + PrefixLength, countReport ? 1 : 0);
+    real_close(fd);
+    return result;
+}
+
+bool BxlObserver::FlushReportBatch(ReportBatch *batch)
+{
+    const int PrefixLength = sizeof(uint);
+    bool result = true;
+
+    // Turn the staged records into frames, sending the frames whenever the batch fills up
+    uint64_t tail = batch->recordsTail.load(std::memory_order_relaxed);
+    uint64_t head = batch->records == nullptr ? tail : batch->recordsHead.load(std::memory_order_acquire);
+    while (tail < head)
+    {
+        size_t offset = tail & (ReportRecordsCapacity - 1);
+        const ReportRecord *record = (const ReportRecord *)&batch->records[offset];
+        if (record->length == 0)
+        {
+            tail += ReportRecordsCapacity - offset;
+            continue;
+        }
+
+        // BuildReport only looks at these fields, and takes the path separately
+        AccessReport report;
+        report.operation = record->operation;
+        report.pid = record->pid;
+        report.requestedAccess = record->requestedAccess;
+        report.status = record->status;
+        report.reportExplicitly = record->reportExplicitly;
+        report.error = record->error;
+        report.isDirectory = record->isDirectory;
+        const char *path = (const char *)(record + 1);
+
+        int available = ReportBatchCapacity - batch->length - PrefixLength;
+        int reportSize = BuildReport(&batch->buffer[batch->length + PrefixLength], available, report, path);
+        if (reportSize >= available)
+        {
+            // See AppendToReportBatch
+            result &= WriteReportFrames(batch);
+            available = ReportBatchCapacity - PrefixLength;
+            reportSize = BuildReport(&batch->buffer[PrefixLength], available, report, path);
+        }
+
+        memcpy(&batch->buffer[batch->length], &reportSize, PrefixLength);
+        batch->length += PrefixLength + reportSize;
+        batch->countedReports += record->countReport ? 1 : 0;
+
+        // The record was copied out, so its space can be reused
+        tail += record->length;
+        batch->recordsTail.store(tail, std::memory_order_release);
+    }
+
+    return result & WriteReportFrames(batch);
+}
+
+bool BxlObserver::WriteReportFrames(ReportBatch *batch)
+{
+    if (batch->length == 0)
+    {
+        return true;
+    }
+
+    int fd = batch->fd.load();
+    if (fd == -1)
+    {
+        fd = real_open(GetReportsPath(), O_WRONLY | O_APPEND | O_CLOEXEC, 0);
+        if (fd == -1)
+        {
+            _fatal("Could not open file '%s'; errno: %d", GetReportsPath(), errno);
+        }
+
+        // See GetReportFd
+        if (!disposed_)
+        {
+            reset_fd_table_entry(fd);
+        }
+
+        batch->fd = fd;
+    }
+
+    bool result = SendFrames(fd, batch->buffer, batch->length, batch->countedReports);
+    batch->length = 0;
+    batch->countedReports = 0;
+
+    return result;
+}
+
+bool BxlObserver::SendFrames(int fd, const char *buf, size_t bufsiz, int countedReports)
+{
+    // See Send for why the counter is updated before writing
+    CountSentReports(countedReports);
+
+    // Only the primary pipe is ever given frames. Whatever didn't make it to the ring goes to the pipe.
+    uint64_t ringStartNs = statistics_.Now();
+    size_t ringWritten = WriteFramesToReportRing(buf, bufsiz);
+    if (ringWritten == bufsiz)
+    {
+        statistics_.CountSent(countedReports, bufsiz, ringStartNs);
+        return true;
+    }
+
+    buf += ringWritten;
+    bufsiz -= ringWritten;
+
+    // Writes bigger than PIPE_BUF are not atomic and can get interleaved with other writers. Every process writing batches
+    // to the pipe takes an exclusive lock on it while writing, so frames from different writers never get mixed up.
+    // Signals are blocked meanwhile so a handler on this thread cannot try to report while we hold the lock.
+    sigset_t allSignals, previousSignals;
+    sigfillset(&allSignals);
+    pthread_sigmask(SIG_BLOCK, &allSignals, &previousSignals);
+
+    uint64_t startNs = statistics_.Now();
+    while (flock(fd, LOCK_EX) == -1 && errno == EINTR);
+
+    size_t totalWritten = 0;
+    while (totalWritten < bufsiz)
+    {
+        ssize_t numWritten = real_write(fd, buf + totalWritten, bufsiz - totalWritten);
+        if (numWritten == -1 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (numWritten <= 0)
+        {
+            _fatal("Wrote only %ld bytes out of %ld", totalWritten, bufsiz);
+        }
+
+        totalWritten += numWritten;
+    }
+
+    flock(fd, LOCK_UN);
+    statistics_.CountSent(countedReports, bufsiz, startNs);
+    pthread_sigmask(SIG_SETMASK, &previousSignals, nullptr);
+
+    return true;
+}
+
+size_t BxlObserver::WriteFramesToReportRing(const char *buf, size_t bufsiz)
+{
+    if (reportRing_ == nullptr || reportRingAbandoned_.load(std::memory_order_relaxed))
+    {
+        return 0;
+    }
+
+    const int PrefixLength = sizeof(uint);
+    size_t written = 0;
+    bool ringDoorbell = false;
+    while (written + PrefixLength <= bufsiz)
+    {
+        uint length;
+        memcpy(&length, &buf[written], PrefixLength);
+        if (!WriteToReportRing(&buf[written + PrefixLength], length, ringDoorbell))
+        {
+            // The rest goes to the pipe, and so does everything this process reports from now on
+            reportRingAbandoned_ = true;
+            break;
+        }
+
+        written += PrefixLength + length;
+    }
+
+    if (ringDoorbell)
+    {
+        RingReportDoorbell();
+    }
+
+    return written;
+}
+
+bool BxlObserver::WriteToReportRing(const char *payload, size_t length, bool &ringDoorbell)
+{
+    if (!reportRing_->CanHold(length))
+    {
+        return false;
+    }
+
+    // A full ring means the reader is busy draining it: wait for it, the way a write to a full pipe would
+    bool doorbell;
+    std::chrono::steady_clock::time_point start;
+    for (int attempt = 0; !reportRing_->TryWrite(payload, length, doorbell); attempt++)
+    {
+        if (attempt == 0)
+        {
+            start = std::chrono::steady_clock::now();
+        }
+        else if (std::chrono::steady_clock::now() - start > ReportRingFullTimeout)
+        {
+            return false;
+        }
+
+        sched_yield();
+    }
+
+    ringDoorbell |= doorbell;
+    return true;
+}
+
+void BxlObserver::RingReportDoorbell()
+{
+    // The reader waits on the primary pipe once it drained the ring. The sentinel is small enough to be written atomically,
+    // but it must not land in the middle of a batch written by a process that went back to the pipe (see SendFrames).
+    int fd = GetReportFd(/* useSecondaryPipe */ false);
+    sigset_t allSignals, previousSignals;
+    sigfillset(&allSignals);
+    pthread_sigmask(SIG_BLOCK, &allSignals, &previousSignals);
+    while (flock(fd, LOCK_EX) == -1 && errno == EINTR);
+
+    int sentinel = ReportRingDoorbellSentinel;
+    ssize_t numWritten;
+    while ((numWritten = real_write(fd, &sentinel, sizeof(sentinel))) == -1 && errno == EINTR);
+
+    flock(fd, LOCK_UN);
+    pthread_sigmask(SIG_SETMASK, &previousSignals, nullptr);
+
+    if (numWritten != sizeof(sentinel))
+    {
+        _fatal("Could not wake up the reader of the report ring; errno: %d", errno);
+    }
+}
+
+void BxlObserver::report_audit_objopen(const char *fullpath)
+{
+    IOEvent event(ES_EVENT_TYPE_NOTIFY_OPEN, ES_ACTION_TYPE_NOTIFY, fullpath, progFullPath_, S_IFREG);
+    AccessReportGroup report;
+    create_access("la_objopen", event, report, /* checkCache */ true);
+
+    // Held back reports are only sent once the loader is done, so a report without a buffer to wait in is sent right away
+    if (report.firstReport.shouldReport && !AppendAuditReport(report.firstReport))
+    {
+        SendReport(report.firstReport);
+    }
+
+    if (report.secondReport.shouldReport && !AppendAuditReport(report.secondReport))
+    {
+        SendReport(report.secondReport);
+    }
+}
+
+bool BxlObserver::AppendAuditReport(const AccessReport &report)
+{
+    const int PrefixLength = sizeof(uint);
+    pid_t pid = getpid();
+    if (auditReportsPid_ != pid)
+    {
+        // The frames were inherited through fork: the parent sends them
+        auditReportsPid_ = pid;
+        auditReportsLength_ = 0;
+    }
+
+    if (auditReports_ == nullptr)
+    {
+        auditReports_ = (char *)malloc(ReportBatchCapacity);
+        if (auditReports_ == nullptr)
+        {
+            return false;
+        }
+    }
+
+    int available = ReportBatchCapacity - auditReportsLength_ - PrefixLength;
+    int reportSize = BuildReport(&auditReports_[auditReportsLength_ + PrefixLength], available, report, report.path);
+    if (reportSize >= available)
+    {
+        // See AppendToReportBatch
+        flush_audit_objopen_reports();
+        available = ReportBatchCapacity - PrefixLength;
+        reportSize = BuildReport(&auditReports_[PrefixLength], available, report, report.path);
+    }
+
+    memcpy(&auditReports_[auditReportsLength_], &reportSize, PrefixLength);
+    auditReportsLength_ += PrefixLength + reportSize;
+    return true;
+}
+
+void BxlObserver::flush_audit_objopen_reports()
+{
+    if (auditReportsLength_ == 0 || auditReportsPid_ != getpid())
+    {
+        return;
+    }
+
+    SendCountedFrames(auditReports_, auditReportsLength_);
+    auditReportsLength_ = 0;
+}
+
+bool BxlObserver::AppendTracerReport(const AccessReport &report)
+{
+    const int PrefixLength = sizeof(uint);
+    if (tracerReports_ == nullptr)
+    {
+        tracerReports_ = (char *)malloc(ReportBatchCapacity);
+        if (tracerReports_ == nullptr)
+        {
+            return false;
+        }
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    if (tracerReportsLength_ == 0)
+    {
+        tracerReportsSince_ = now;
+    }
+
+    int available = ReportBatchCapacity - tracerReportsLength_ - PrefixLength;
+    int reportSize = BuildReport(&tracerReports_[tracerReportsLength_ + PrefixLength], available, report, report.path);
+    if (reportSize >= available)
+    {
+        // See AppendToReportBatch
+        FlushTracerReports();
+        tracerReportsSince_ = now;
+        available = ReportBatchCapacity - PrefixLength;
+        reportSize = BuildReport(&tracerReports_[PrefixLength], available, report, report.path);
+    }
+
+    memcpy(&tracerReports_[tracerReportsLength_], &reportSize, PrefixLength);
+    tracerReportsLength_ += PrefixLength + reportSize;
+
+    // A tracer that keeps getting stops is never idle: don't hold reports back for longer than the flusher would (see ReportFlusher)
+    if (std::chrono::duration_cast<std::chrono::microseconds>(now - tracerReportsSince_).count() >= ReportFlushIntervalUs)
+    {
+        FlushTracerReports();
+    }
+
+    return true;
+}
+
+void BxlObserver::FlushTracerReports()
+{
+    if (tracerReportsLength_ == 0)
+    {
+        return;
+    }
+
+    SendCountedFrames(tracerReports_, tracerReportsLength_);
+    tracerReportsLength_ = 0;
+}
+
+void BxlObserver::SendCountedFrames(const char *frames, size_t length)
+{
+    int fd = GetReportFd(/* useSecondaryPipe */ false);
+
+    // With report batching every writer locks the pipe (see SendFrames), so all the frames can go out in one write. Otherwise,
+    // other processes rely on the atomicity of writes of up to PIPE_BUF bytes, so we split the frames in chunks of at most that size.
+    size_t maxChunk = batchReports_ ? length : PIPE_BUF;
+    size_t start = 0;
+    while (start < length)
+    {
+        size_t end = start;
+        int countedReports = 0;
+        while (end < length)
+        {
+            uint frameSize;
+            memcpy(&frameSize, &frames[end], sizeof(uint));
+            if (end > start && end + sizeof(uint) + frameSize - start > maxChunk)
+            {
+                break;
+            }
+
+            end += sizeof(uint) + frameSize;
+            countedReports++;
+        }
+
+        SendFrames(fd, &frames[start], end - start, countedReports);
+        start = end;
+    }
+}
+
+void BxlObserver::FlushReportBatches()
+{
+    FlushTracerReports();
+    if (!batchReports_)
+    {
+        return;
+    }
+
+    pid_t pid = getpid();
+    ReportBatch *ownBatch = (ReportBatch *)pthread_getspecific(reportBatchKey_);
+    for (ReportBatch *batch = reportBatches_.load(); batch != nullptr; batch = batch->next)
+    {
+        // Batches owned by another process were inherited through fork and
+        // belong to threads that don't exist in this process
+        if (batch->pid != pid || (batch->length == 0 && batch->recordsHead.load() == batch->recordsTail.load()))
+        {
+            continue;
+        }
+
+        // The flusher may be holding a batch for as long as a write to the pipe takes, and we can't let this go before its reports are sent.
+        // Only this thread's batch may be held by this very thread (a signal handler interrupted it), and then we must not wait.
+        if (asyncReports_ && batch->records != nullptr && (batch != ownBatch || !batch->staging.load()))
+        {
+            DrainReportBatch(batch);
+        }
+        else if (TryLockReportBatch(batch))
+        {
+            FlushReportBatch(batch);
+            batch->busy.clear(std::memory_order_release);
+        }
+    }
+}
+
+void BxlObserver::DrainReportBatch(ReportBatch *batch)
+{
+    // Blocking signals while holding the batch means no signal handler can end up waiting for it on this same thread, so it is fine to wait for it here
+    sigset_t allSignals, previousSignals;
+    sigfillset(&allSignals);
+    pthread_sigmask(SIG_BLOCK, &allSignals, &previousSignals);
+
+    while (batch->busy.test_and_set(std::memory_order_acquire))
+    {
+        sched_yield();
+    }
+
+    FlushReportBatch(batch);
+    batch->busy.clear(std::memory_order_release);
+    pthread_sigmask(SIG_SETMASK, &previousSignals, nullptr);
+}
+
+bool BxlObserver::StageReport(const AccessReport &report, bool countReport)
+{
+    ReportBatch *batch = GetReportBatch();
+    if (batch == nullptr || batch->records == nullptr || batch->staging.load(std::memory_order_relaxed))
+    {
+        // No ring for this thread (out of memory), or a signal handler interrupted this thread while staging a record
+        return AppendToReportBatch(report, countReport, /* flush */ false);
+    }
+
+    batch->staging.store(true, std::memory_order_relaxed);
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+
+    pid_t pid = getpid();
+    if (batch->pid != pid)
+    {
+        // The batch was inherited through fork/clone (see AppendToReportBatch). The flusher of the parent may have been holding it,
+        // but no other thread of this process knows about it yet.
+        batch->busy.clear(std::memory_order_relaxed);
+        batch->pid = pid;
+        batch->fd = -1;
+        batch->length = 0;
+        batch->countedReports = 0;
+        batch->recordsTail = 0;
+        batch->recordsHead = 0;
+    }
+
+    EnsureReportFlusher();
+
+    size_t pathLength = strnlen(report.path, MAXPATHLEN - 1);
+    uint32_t recordLength = (sizeof(ReportRecord) + pathLength + 1 + 7) & ~7;
+    uint64_t head = batch->recordsHead.load(std::memory_order_relaxed);
+    size_t offset = head & (ReportRecordsCapacity - 1);
+    size_t padding = offset + recordLength > ReportRecordsCapacity ? ReportRecordsCapacity - offset : 0;
+
+    // When the ring is full, the flusher is falling behind: make room ourselves
+    if (head + padding + recordLength - batch->recordsTail.load(std::memory_order_acquire) > ReportRecordsCapacity)
+    {
+        statistics_.CountReportFlusherBacklog();
+        do
+        {
+            DrainReportBatch(batch);
+        } while (head + padding + recordLength - batch->recordsTail.load(std::memory_order_acquire) > ReportRecordsCapacity);
+    }
+
+    if (padding > 0)
+    {
+        ((ReportRecord *)&batch->records[offset])->length = 0;
+        head += padding;
+        offset = 0;
+    }
+
+    ReportRecord *record = (ReportRecord *)&batch->records[offset];
+    record->length = recordLength;
+    record->countReport = countReport;
+    record->operation = report.operation;
+    record->pid = report.pid;
+    record->requestedAccess = report.requestedAccess;
+    record->status = report.status;
+    record->reportExplicitly = report.reportExplicitly;
+    record->error = report.error;
+    record->isDirectory = report.isDirectory;
+    memcpy(record + 1, report.path, pathLength);
+    ((char *)(record + 1))[pathLength] = '\0';
+
+    // Sequentially consistent, so either the flusher sees this record before going idle or we see it idle below (see ReportFlusher)
+    batch->recordsHead.store(head + recordLength, std::memory_order_seq_cst);
+
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    batch->staging.store(false, std::memory_order_relaxed);
+
+    if (reportFlusherIdle_.load() != 0 && reportFlusherIdle_.exchange(0) != 0)
+    {
+        syscall(SYS_futex, &reportFlusherIdle_, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+    }
+
+    return true;
+}
+
+void BxlObserver::EnsureReportFlusher()
+{
+    pid_t pid = getpid();
+    pid_t flusherPid = reportFlusherPid_.load(std::memory_order_relaxed);
+    if (flusherPid == pid || !reportFlusherPid_.compare_exchange_strong(flusherPid, pid))
+    {
+        return;
+    }
+
+    reportFlusherIdle_ = 0;
+
+    // The flusher inherits our signal mask: it must not take signals meant for the threads of the process
+    sigset_t allSignals, previousSignals;
+    sigfillset(&allSignals);
+    pthread_sigmask(SIG_BLOCK, &allSignals, &previousSignals);
+
+    pthread_attr_t attributes;
+    pthread_t flusher;
+    pthread_attr_init(&attributes);
+    pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+    pthread_attr_setstacksize(&attributes, 256 * 1024);
+    if (pthread_create(&flusher, &attributes, ReportFlusher, this) != 0)
+    {
+        // Records are still sent when a ring fills up, and before fork, exec and exit
+        LOG_DEBUG("Failed to start the report flusher thread, errno: %d", errno);
+    }
+
+    pthread_attr_destroy(&attributes);
+    pthread_sigmask(SIG_SETMASK, &previousSignals, nullptr);
+}
+
+void* BxlObserver::ReportFlusher(void *observer)
+{
+    BxlObserver *bxl = (BxlObserver *)observer;
+    pid_t pid = getpid();
+
+    // Best effort: without CAP_SYS_NICE (or a suitable RLIMIT_NICE) the flusher keeps the priority of the process
+    if (CheckRaiseSandboxHelperThreadPriority(bxl->pip_->GetFamExtraFlags()))
+    {
+        setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), ReportFlusherNice);
+    }
+
+    while (true)
+    {
+        bool pending = false;
+        for (ReportBatch *batch = bxl->reportBatches_.load(); batch != nullptr; batch = batch->next)
+        {
+            if (batch->pid == pid && batch->records != nullptr && batch->recordsHead.load(std::memory_order_acquire) != batch->recordsTail.load())
+            {
+                bxl->DrainReportBatch(batch);
+            }
+        }
+
+        // Announce we are going idle, and only then check for records one last time: a thread staging a record
+        // either sees the flag and wakes us up, or staged it before the check (see StageReport)
+        bxl->reportFlusherIdle_.store(1);
+        for (ReportBatch *batch = bxl->reportBatches_.load(); batch != nullptr && !pending; batch = batch->next)
+        {
+            pending = batch->pid == pid && batch->records != nullptr && batch->recordsHead.load() != batch->recordsTail.load();
+        }
+
+        if (pending)
+        {
+            bxl->reportFlusherIdle_ = 0;
+            continue;
+        }
+
+        while (bxl->reportFlusherIdle_.load() != 0)
+        {
+            syscall(SYS_futex, &bxl->reportFlusherIdle_, FUTEX_WAIT_PRIVATE, 1, nullptr, nullptr, 0);
+        }
+
+        // Let a few more records pile up, so we send them in fewer writes and don't need to be woken up for each of them
+        usleep(ReportFlushIntervalUs);
+    }
+
+    return nullptr;
+}
+
+void BxlObserver::reset_report_fds(unsigned int first, unsigned int last)
+{
+    uint64_t pid = (uint32_t)getpid();
+    for (auto &slot : reportFds_)
     {
-        auto result = real_sem_post(messageCountingSemaphore_);
-        if (result != 0)
+        uint64_t cached = slot.load();
+        uint32_t fd = (uint32_t)cached;
+        if (cached != NoReportFd && (cached >> 32) == pid && fd >= first && fd <= last)
         {
-            // something went wrong with the semaphore, we shouldn't call LOG_DEBUG here because it will just come back to this function
-            // we also don't want to call _fatal because that will fail the pip.
-            // instead log the error to stdout (this could be promoted to stderr in the future when this feature is stable)
-            real_fprintf(stdout, "posting to buildxl message counting semaphore failed with errno: %d\n", errno);
+            slot.compare_exchange_strong(cached, NoReportFd);
         }
     }
 
-    ssize_t numWritten = real_write(logFd, buf, bufsiz);
-    if (numWritten < bufsiz)
+    for (ReportBatch *batch = reportBatches_.load(); batch != nullptr; batch = batch->next)
     {
-        _fatal("Wrote only %ld bytes out of %ld", numWritten, bufsiz);
+        int fd = batch->fd.load();
+        if (batch->pid == getpid() && fd != -1 && (unsigned int)fd >= first && (unsigned int)fd <= last)
+        {
+            batch->fd.compare_exchange_strong(fd, -1);
+        }
     }
-
-    // A handle was opened for our own internal purposes. That
-    // could have reused a fd where we missed a close, 
-    // so reset that entry in the fd table
-    reset_fd_table_entry(logFd);
-
-    real_close(logFd);
-
-    return true;
 }
 
 bool BxlObserver::SendExitReport(pid_t pid)
 {
+    if (!disposed_)
+    {
+        LOG_DEBUG("Access cache: %lu hits, %lu misses, %lu dropped", cache_.GetHits(), cache_.GetMisses(), cache_.GetDropped());
+        LOG_DEBUG("Resolved paths cache: %lu hits, %lu misses", resolvedPathsHits_.load(), resolvedPathsMisses_.load());
+    }
+
     IOHandler handler(sandbox_);
     handler.SetProcess(process_);
     AccessReport report;
@@ -396,10 +1635,6 @@ bool BxlObserver::SendReport(const AccessReport &report, bool isDebugMessage, bo
         return true;
     }
 
-    const int PrefixLength = sizeof(uint);
-    char buffer[PIPE_BUF] = {0};
-    int maxMessageLength = PIPE_BUF - PrefixLength;
-    int reportSize = BuildReport(&buffer[PrefixLength], maxMessageLength, report, report.path);
     // CODESYNC: Public/Src/Engine/Processes/SandboxedProcessUnix.cs
     bool shouldCountReportType = 
         report.operation != FileOperation::kOpProcessStart
@@ -407,6 +1642,40 @@ bool BxlObserver::SendReport(const AccessReport &report, bool isDebugMessage, bo
         && report.operation != FileOperation::kOpProcessTreeCompleted
         && report.operation != FileOperation::kOpDebugMessage;
 
+    if (bufferTracerReports_ && !useSecondaryPipe)
+    {
+        if (shouldCountReportType && AppendTracerReport(report))
+        {
+            return true;
+        }
+
+        // Reports that don't count go out right away, after the ones held back
+        FlushTracerReports();
+    }
+
+    if (batchReports_ && !useSecondaryPipe)
+    {
+        // The managed side tracks active processes based on process start and exit reports, so those
+        // cannot be held back. All the pending reports of this process need to go out before its exit report.
+        bool isExit = report.operation == FileOperation::kOpProcessExit;
+        if (isExit)
+        {
+            FlushReportBatches();
+        }
+
+        // A child reports its own start as well (see HandleForkOrCloneReporting): the report from its parent already told the managed side
+        // about the process, so this one only needs to go out before the other reports of the child, and can share a write with them.
+        bool flush = isExit || (report.operation == FileOperation::kOpProcessStart && report.pid != getpid());
+        return asyncReports_ && !flush
+            ? StageReport(report, shouldCountReportType)
+            : AppendToReportBatch(report, shouldCountReportType, flush);
+    }
+
+    const int PrefixLength = sizeof(uint);
+    char buffer[PIPE_BUF] = {0};
+    int maxMessageLength = PIPE_BUF - PrefixLength;
+    int reportSize = BuildReport(&buffer[PrefixLength], maxMessageLength, report, report.path);
+
     if (reportSize >= maxMessageLength)
     {
         // For debug messages it is fine to truncate the message, otherwise, this is a problem and we must fail
@@ -435,6 +1704,160 @@ bool BxlObserver::SendReport(const AccessReport &report, bool isDebugMessage, bo
     return Send(buffer, std::min(reportSize + PrefixLength, PIPE_BUF), useSecondaryPipe, shouldCountReportType);
 }
 
+bool BxlObserver::SendSubtreeReports(const std::vector<AccessReportGroup> &reports, const std::string &sourceRoot, const std::string &destinationRoot)
+{
+    const std::string *roots[] = { &sourceRoot, &destinationRoot };
+    const int PrefixLength = sizeof(uint);
+
+    // Frames bigger than PIPE_BUF are only safe when every writer locks the pipe, which batching writers do (see SendFrames)
+    const size_t capacity = batchReports_ ? ReportBatchCapacity : PIPE_BUF;
+
+    // The reports of a tree operation alternate between a few kinds (source and destination, file and directory),
+    // so a frame is kept open for each kind seen so far
+    SubtreeFrame frames[MaxPendingSubtreeFrames];
+    int frameCount = 0;
+    bool result = true;
+
+    for (const AccessReportGroup &group : reports)
+    {
+        for (const AccessReport *report : { &group.firstReport, &group.secondReport })
+        {
+            if (!report->shouldReport)
+            {
+                continue;
+            }
+
+            // Find the root the path is under
+            size_t pathLength = strlen(report->path);
+            int rootIndex = -1;
+            for (int i = 0; i < 2 && rootIndex == -1; i++)
+            {
+                size_t rootLength = roots[i]->length();
+                if (rootLength > 0 && pathLength >= rootLength && memcmp(report->path, roots[i]->c_str(), rootLength) == 0
+                    && (pathLength == rootLength || report->path[rootLength] == '/'))
+                {
+                    rootIndex = i;
+                }
+            }
+
+            if (rootIndex == -1 || report->operation == FileOperation::kOpProcessTreeCompleted)
+            {
+                result &= SendReport(*report);
+                continue;
+            }
+
+            const char *relativePath = report->path + std::min(pathLength, roots[rootIndex]->length() + 1);
+            size_t entryLength = 1 + strlen(relativePath);
+
+            SubtreeFrame *frame = nullptr;
+            for (int i = 0; i < frameCount && frame == nullptr; i++)
+            {
+                const AccessReport &first = frames[i].first;
+                if (frames[i].rootIndex == rootIndex
+                    && first.operation == report->operation
+                    && first.pid == report->pid
+                    && first.requestedAccess == report->requestedAccess
+                    && first.status == report->status
+                    && first.reportExplicitly == report->reportExplicitly
+                    && first.error == report->error
+                    && first.isDirectory == report->isDirectory)
+                {
+                    frame = &frames[i];
+                }
+            }
+
+            // The newline ending the frame must fit too
+            if (frame != nullptr && frame->content.length() + entryLength + 1 > capacity)
+            {
+                result &= SendSubtreeFrame(*frame);
+            }
+
+            if (frame == nullptr)
+            {
+                if (frameCount == MaxPendingSubtreeFrames)
+                {
+                    for (int i = 0; i < frameCount; i++)
+                    {
+                        result &= SendSubtreeFrame(frames[i]);
+                    }
+
+                    frameCount = 0;
+                }
+
+                frame = &frames[frameCount++];
+                frame->rootIndex = rootIndex;
+                frame->content.reserve(capacity);
+                frame->content.assign(PrefixLength, '\0');
+                frame->count = 0;
+            }
+
+            if (frame->count == 0)
+            {
+                // Everything but the newline ending the report, with the root in place of the path
+                char header[PIPE_BUF];
+                int headerLength = BuildReport(header, sizeof(header), *report, roots[rootIndex]->c_str()) - 1;
+                if (headerLength >= (int)sizeof(header) - 1 || PrefixLength + headerLength + entryLength + 1 > capacity)
+                {
+                    // The root is too long to pack anything under it
+                    frame->content.resize(PrefixLength);
+                    result &= SendReport(*report);
+                    continue;
+                }
+
+                frame->first = *report;
+                frame->content.append(header, headerLength);
+            }
+
+            frame->content.push_back('\0');
+            frame->content.append(relativePath);
+            frame->count++;
+        }
+    }
+
+    for (int i = 0; i < frameCount; i++)
+    {
+        result &= SendSubtreeFrame(frames[i]);
+    }
+
+    return result;
+}
+
+bool BxlObserver::SendSubtreeFrame(SubtreeFrame &frame)
+{
+    const int PrefixLength = sizeof(uint);
+    if (frame.count == 0)
+    {
+        return true;
+    }
+
+    // A single report goes in the regular format
+    if (frame.count == 1)
+    {
+        frame.content.resize(PrefixLength);
+        frame.count = 0;
+        return SendReport(frame.first);
+    }
+
+    frame.content.push_back('\n');
+    uint reportSize = frame.content.length() - PrefixLength;
+    memcpy(&frame.content[0], &reportSize, PrefixLength);
+
+    // CODESYNC: Public/Src/Engine/Processes/SandboxedProcessUnix.cs (see SendReport)
+    int countedReports = frame.first.operation != FileOperation::kOpProcessStart
+        && frame.first.operation != FileOperation::kOpProcessExit
+        && frame.first.operation != FileOperation::kOpDebugMessage
+        ? frame.count
+        : 0;
+
+    // The reports of this process sent so far go first
+    FlushReportBatches();
+    bool result = SendFrames(GetReportFd(/* useSecondaryPipe */ false), frame.content.data(), frame.content.length(), countedReports);
+    frame.content.resize(PrefixLength);
+    frame.count = 0;
+
+    return result;
+}
+
 void BxlObserver::report_exec(const char *syscallName, const char *procName, const char *file, int error, mode_t mode, pid_t associatedPid)
 {
     if (IsMonitoringChildProcesses())
@@ -447,57 +1870,127 @@ void BxlObserver::report_exec(const char *syscallName, const char *procName, con
 
 void BxlObserver::report_exec_args(pid_t pid)
 {
-    if (IsReportingProcessArgs())
+    if (!IsReportingProcessArgs())
     {
-        char path[PATH_MAX] = { 0 };
-        int maxSize = PIPE_BUF + sizeof(uint) - 1;
-        char cmdLineBuffer[maxSize] = { 0 };
-        std::string cmdLine;
-        bool firstArg = true;
+        return;
+    }
 
-        // /proc/<pid>/cmdline has a set of arguments separated by the null terminator
-        snprintf(path, PATH_MAX, "/proc/%d/cmdline", pid);
+    // /proc/<pid>/cmdline has a set of arguments separated by the null terminator
+    char path[PATH_MAX] = { 0 };
+    snprintf(path, PATH_MAX, "/proc/%d/cmdline", pid);
 
-        int fd = open(path, O_RDONLY);
-        int bytesRead = read(fd, cmdLineBuffer, maxSize);
-        char *end = cmdLineBuffer + bytesRead;
+    int fd = real_open(path, O_RDONLY | O_CLOEXEC, 0);
+    if (fd == -1)
+    {
+        return;
+    }
 
-        for (char *currentArg = cmdLineBuffer; currentArg < end; )
-        {
-            if (firstArg)
-            {
-                firstArg = false;
-            }
-            else
-            {
-                cmdLine.append(" ");
-            }
-            cmdLine.append(currentArg);
+    std::string cmdLine;
+    char chunk[PIPE_BUF];
+    ssize_t bytesRead;
+    while ((bytesRead = read(fd, chunk, sizeof(chunk))) > 0 || (bytesRead == -1 && errno == EINTR))
+    {
+        cmdLine.append(chunk, bytesRead > 0 ? bytesRead : 0);
+    }
 
-            // Increment currentArg until the next null character is reached
-            while(*currentArg++);
-        }
-        close(fd);
+    real_close(fd);
 
-        AccessReport report =
+    std::vector<const char *> args;
+    for (size_t offset = 0; offset < cmdLine.length(); offset += strlen(&cmdLine[offset]) + 1)
+    {
+        args.push_back(&cmdLine[offset]);
+    }
+
+    args.push_back(nullptr);
+    report_exec_args(pid, args.data());
+}
+
+void BxlObserver::report_exec_args(pid_t pid, const char *const argv[])
+{
+    if (!IsReportingProcessArgs())
+    {
+        return;
+    }
+
+    if (argv == nullptr)
+    {
+        report_exec_args(pid);
+        return;
+    }
+
+    AccessReport report =
+    {
+        .operation        = kOpProcessCommandLine,
+        .pid              = pid,
+        .rootPid          = pip_->GetProcessId(),
+        .requestedAccess  = (int) RequestedAccess::Read,
+        .status           = FileAccessStatus::FileAccessStatus_Allowed,
+        .reportExplicitly = (int) ReportLevel::Report,
+        .error            = 0,
+        .pipId            = pip_->GetPipId(),
+        .path             = {0},
+        .stats            = {0},
+        .isDirectory      = 0,
+        .shouldReport     = true,
+    };
+
+    // The command line goes where BuildReport puts the path: last, right before the newline that ends the report.
+    // Build everything else first, so the arguments can be copied straight into the frame.
+    const int PrefixLength = sizeof(uint);
+    char header[PIPE_BUF];
+    int headerLength = BuildReport(header, sizeof(header), report, "") - 1;
+
+    size_t argsLength = 0;
+    for (int i = 0; argv[i] != nullptr; i++)
+    {
+        argsLength += (i == 0 ? 0 : 1) + strlen(argv[i]);
+    }
+
+    // Frames bigger than PIPE_BUF are only safe when every writer locks the pipe, which batching writers do (see SendFrames).
+    // Otherwise the command line is truncated so the report can be written atomically.
+    if (!batchReports_)
+    {
+        argsLength = std::min(argsLength, (size_t)(PIPE_BUF - PrefixLength - headerLength - 1));
+    }
+
+    uint reportSize = headerLength + argsLength + 1;
+    char *frame = (char *)malloc(PrefixLength + reportSize);
+    if (frame == nullptr)
+    {
+        _fatal("Could not allocate %u bytes to report the command line of process %d", reportSize, pid);
+    }
+
+    memcpy(frame, &reportSize, PrefixLength);
+    memcpy(frame + PrefixLength, header, headerLength);
+
+    char *args = frame + PrefixLength + headerLength;
+    size_t written = 0;
+    for (int i = 0; argv[i] != nullptr && written < argsLength; i++)
+    {
+        if (i > 0)
         {
-            .operation        = kOpProcessCommandLine,
-            .pid              = pid,
-            .rootPid          = pip_->GetProcessId(),
-            .requestedAccess  = (int) RequestedAccess::Read,
-            .status           = FileAccessStatus::FileAccessStatus_Allowed,
-            .reportExplicitly = (int) ReportLevel::Report,
-            .error            = 0,
-            .pipId            = pip_->GetPipId(),
-            .path             = {0},
-            .stats            = {0},
-            .isDirectory      = 0,
-            .shouldReport     = true,
-        };
+            args[written++] = ' ';
+        }
 
-        strlcpy(report.path, cmdLine.c_str(), sizeof(report.path));
-        SendReport(report, /* isDebugMessage */ false, /* useSecondaryPipe */ false);
+        size_t length = std::min(strlen(argv[i]), argsLength - written);
+        memcpy(args + written, argv[i], length);
+        written += length;
     }
+
+    args[written] = '\n';
+
+    // The reports of this process sent so far go first
+    FlushReportBatches();
+    if (batchReports_)
+    {
+        SendFrames(GetReportFd(/* useSecondaryPipe */ false), frame, PrefixLength + reportSize, /* countedReports */ 1);
+    }
+    else
+    {
+        Send(frame, PrefixLength + reportSize, /* useSecondaryPipe */ false, /* countReport */ true);
+    }
+
+    free(frame);
 }
 
 void BxlObserver::report_access(const char *syscallName, es_event_type_t eventType, const char *reportPath, const char *secondPath, mode_t mode, int error, bool checkCache, pid_t associatedPid)
@@ -534,7 +2027,8 @@ AccessCheckResult BxlObserver::create_access(const char *syscallName, es_event_t
 AccessCheckResult BxlObserver::create_access_internal(const char *syscallName, es_event_type_t eventType, const char *reportPath, const char *secondPath, AccessReportGroup &reportGroup, mode_t mode, bool checkCache, pid_t associatedPid)
 {
     secondPath = secondPath == nullptr ? empty_str_ : secondPath;  
-    if (checkCache && IsCacheHit(eventType, std::move(std::string(reportPath)), std::move(std::string(secondPath))))
+    statistics_.CountAccess(GetAccessFamily(eventType));
+    if (checkCache && IsCacheHit(eventType, reportPath, secondPath))
     {
         return sNotChecked;
     }
@@ -556,7 +2050,7 @@ AccessCheckResult BxlObserver::create_access_internal(const char *syscallName, e
         : std::string(progFullPath_);
 
     IOEvent event(associatedPid == 0 ? getpid() : associatedPid, 0, getppid(), eventType, ES_ACTION_TYPE_NOTIFY, std::move(std::string(reportPath)), std::move(std::string(secondPath)), std::move(execPath), mode, false);
-    return create_access(syscallName, event, reportGroup, /* checkCache */ false /* because already checked cache above */);
+    return check_access(syscallName, event, reportGroup, /* checkCache */ false /* because already checked cache above */);
 }
 
 void BxlObserver::report_access(const char *syscallName, IOEvent &event, bool checkCache)
@@ -567,10 +2061,16 @@ void BxlObserver::report_access(const char *syscallName, IOEvent &event, bool ch
 }
 
 AccessCheckResult BxlObserver::create_access(const char *syscallName, IOEvent &event, AccessReportGroup &reportGroup, bool checkCache)
+{
+    statistics_.CountAccess(GetAccessFamily(event.GetEventType()));
+    return check_access(syscallName, event, reportGroup, checkCache);
+}
+
+AccessCheckResult BxlObserver::check_access(const char *syscallName, IOEvent &event, AccessReportGroup &reportGroup, bool checkCache)
 {
     es_event_type_t eventType = event.GetEventType();
     
-    if (checkCache && IsCacheHit(eventType, event.GetSrcPath(), event.GetDstPath()))
+    if (checkCache && IsCacheHit(eventType, event.GetSrcPath().c_str(), event.GetDstPath().c_str()))
     {
         return sNotChecked;
     }
@@ -589,14 +2089,29 @@ AccessCheckResult BxlObserver::create_access(const char *syscallName, IOEvent &e
     {
         IOHandler handler(sandbox_);
         handler.SetProcess(process_);
-        result = handler.CheckAccessAndBuildReport(event, reportGroup);
+        if (sandboxTracePath_[0] == '\0')
+        {
+            result = handler.CheckAccessAndBuildReport(event, reportGroup);
+        }
+        else
+        {
+            struct timespec start, end;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            result = handler.CheckAccessAndBuildReport(event, reportGroup);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+
+            uint64_t startNs = (uint64_t)start.tv_sec * 1000000000 + start.tv_nsec;
+            uint64_t endNs = (uint64_t)end.tv_sec * 1000000000 + end.tv_nsec;
+            TraceAccess(syscallName, event, startNs, endNs - startNs);
+        }
+
         accessShouldBeBlocked = result.ShouldDenyAccess() && IsFailingUnexpectedAccesses();
         if (!accessShouldBeBlocked) 
         {
             // This access won't be blocked, so let's cache it.
             // We populate cache even if checkCache is false, but this should be ok.
             // We cache event types that are always a miss in IsCacheHit, but this also shoulld be fine.
-            CheckCache(eventType, event.GetSrcPath(), /* addEntryIfMissing */ true);
+            CheckCache(eventType, event.GetSrcPath().c_str(), /* addEntryIfMissing */ true);
         }
     }
 
@@ -607,6 +2122,44 @@ AccessCheckResult BxlObserver::create_access(const char *syscallName, IOEvent &e
     return result;
 }
 
+void BxlObserver::TraceAccess(const char *syscallName, const IOEvent &event, uint64_t timestampNs, uint64_t checkNs)
+{
+    int fd = GetCachedFd(SandboxTraceFdSlot, sandboxTracePath_, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return;
+    }
+
+    SandboxTraceRecord header = {};
+    header.magic = SANDBOX_TRACE_RECORD_MAGIC;
+    header.eventType = (uint32_t)event.GetEventType();
+    header.mode = (uint32_t)event.GetMode();
+    header.pid = event.GetPid();
+    header.childPid = event.GetChildPid();
+    header.parentPid = event.GetParentPid();
+    header.syscallNameLength = (uint16_t)strnlen(syscallName, UINT16_MAX);
+    header.srcPathLength = (uint16_t)std::min(event.GetSrcPath().length(), (size_t)UINT16_MAX);
+    header.dstPathLength = (uint16_t)std::min(event.GetDstPath().length(), (size_t)UINT16_MAX);
+    header.executablePathLength = (uint16_t)std::min(event.GetExecutablePathLength(), (size_t)UINT16_MAX);
+    header.timestampNs = timestampNs;
+    header.checkNs = checkNs;
+
+    size_t length = sizeof(header) + header.syscallNameLength + header.srcPathLength + header.dstPathLength + header.executablePathLength;
+    header.length = (uint32_t)((length + 7) & ~7);
+
+    // A single write per record, so records of concurrent writers don't get mixed up
+    std::string record;
+    record.reserve(header.length);
+    record.append((const char *)&header, sizeof(header));
+    record.append(syscallName, header.syscallNameLength);
+    record.append(event.GetSrcPath(), 0, header.srcPathLength);
+    record.append(event.GetDstPath(), 0, header.dstPathLength);
+    record.append(event.GetExecutablePath(), header.executablePathLength);
+    record.resize(header.length, '\0');
+
+    real_write(fd, record.data(), record.length());
+}
+
 void BxlObserver::report_access(const char *syscallName, es_event_type_t eventType, const char *pathname, mode_t mode, int flags, int error, bool checkCache, pid_t associatedPid)
 {
     // If the path is null or if we can't normalize it, we have no meaningful way of reporting this access
@@ -616,6 +2169,12 @@ void BxlObserver::report_access(const char *syscallName, es_event_type_t eventTy
         return;
     }
 
+    uint64_t probeContext = 0;
+    if (checkCache && is_probe_cache_hit(eventType, AT_FDCWD, pathname, flags, probeContext, associatedPid))
+    {
+        return;
+    }
+
     auto normalized = normalize_path(pathname, flags, associatedPid);
     if (normalized.length() == 0) 
     {
@@ -623,7 +2182,11 @@ void BxlObserver::report_access(const char *syscallName, es_event_type_t eventTy
         return;
     }
 
-    report_access_internal(syscallName, eventType, normalized.c_str(), /*secondPath*/ nullptr , mode, error, checkCache, associatedPid);
+    AccessReportGroup report;
+    AccessCheckResult check = create_access_internal(syscallName, eventType, normalized.c_str(), /*secondPath*/ nullptr, report, mode, checkCache, associatedPid);
+    report.SetErrno(error);
+    SendReport(report);
+    add_probe_cache_entry(eventType, probeContext, pathname, check, error);
 }
 
 AccessCheckResult BxlObserver::create_access(const char *syscallName, es_event_type_t eventType, const char *pathname, AccessReportGroup &reportGroup, mode_t mode, int flags, bool checkCache, pid_t associatedPid)
@@ -653,20 +2216,56 @@ void BxlObserver::report_access_fd(const char *syscallName, es_event_type_t even
 
 AccessCheckResult BxlObserver::create_access_fd(const char *syscallName, es_event_type_t eventType, int fd, AccessReportGroup &report, pid_t associatedPid)
 {   
+    // Writes on a descriptor whose write was already checked and allowed would only produce a report the access cache drops:
+    // skip the mode and path lookups altogether. The version is read before checking, so a descriptor closed or reused meanwhile
+    // is not marked (see FdTable::SetWriteReported).
+    uint32_t version, entryVersion;
+    bool trackKind = useFdTable_ && associatedPid == 0;
+    if (trackKind && fdTable_.IsNonFile(fd))
+    {
+        return sNotChecked;
+    }
+
+    bool trackWrite = trackKind && eventType == ES_EVENT_TYPE_NOTIFY_WRITE;
+    if (trackWrite && fdTable_.IsWriteReported(fd))
+    {
+        return sNotChecked;
+    }
+
+    trackKind = trackKind && fdTable_.GetEntryVersion(fd, entryVersion);
+    trackWrite = trackWrite && fdTable_.GetVersion(fd, version);
+
     mode_t mode = get_mode(fd);
 
     // If this file descriptor is a non-file (e.g., a pipe, or socket, etc.) then we don't care about it
     if (is_non_file(mode))
     {
+        // Inherited descriptors (e.g., the stdout and stderr pipes) are only classified here, at their first access
+        if (trackKind)
+        {
+            fdTable_.SetNonFile(fd, entryVersion);
+        }
+
         return sNotChecked; 
     }
 
     std::string fullpath = fd_to_path(fd, associatedPid);
 
     // Only reports when fd_to_path succeeded.
-    return fullpath.length() > 0
-        ? create_access_internal(syscallName, eventType, fullpath.c_str(), /* secondPath */ nullptr, report, mode, /* checkCache */ true, associatedPid)
-        : sNotChecked;
+    if (fullpath.length() == 0)
+    {
+        return sNotChecked;
+    }
+
+    AccessCheckResult check = create_access_internal(syscallName, eventType, fullpath.c_str(), /* secondPath */ nullptr, report, mode, /* checkCache */ true, associatedPid);
+
+    // Denied writes are not marked, so they keep being denied
+    if (trackWrite && !should_deny(check))
+    {
+        fdTable_.SetWriteReported(fd, version);
+    }
+
+    return check;
 }
 
 bool BxlObserver::is_non_file(const mode_t mode)
@@ -750,10 +2349,17 @@ AccessCheckResult BxlObserver::create_access_at(const char *syscallName, es_even
 
 void BxlObserver::report_access_at(const char *syscallName, es_event_type_t eventType, int dirfd, const char *pathname, int flags, bool getModeWithFd, pid_t associatedPid, int error)
 {
+    uint64_t probeContext = 0;
+    if (is_probe_cache_hit(eventType, dirfd, pathname, flags, probeContext, associatedPid))
+    {
+        return;
+    }
+
     AccessReportGroup report;
-    create_access_at(syscallName, eventType, dirfd, pathname, report, flags, getModeWithFd, associatedPid);
+    AccessCheckResult check = create_access_at(syscallName, eventType, dirfd, pathname, report, flags, getModeWithFd, associatedPid);
     report.SetErrno(error);
     SendReport(report);
+    add_probe_cache_entry(eventType, probeContext, pathname, check, error);
 }
 
 void BxlObserver::report_firstAllowWriteCheck(const char *fullPath)
@@ -784,6 +2390,47 @@ void BxlObserver::report_firstAllowWriteCheck(const char *fullPath)
     AccessCheckResult result(RequestedAccess::Write, fileExists ? ResultAction::Deny : ResultAction::Allow, ReportLevel::Report);
 }
 
+// Probes a candidate of a PATH search that was already reported (see resolve_filename_with_path)
+static int lstat_without_reporting(const char *path, struct stat *buf)
+{
+#if (__GLIBC__ == 2 && __GLIBC_MINOR__ < 33)
+    return BxlObserver::GetInstance()->real___lxstat(1, path, buf);
+#else
+    return BxlObserver::GetInstance()->real_lstat(path, buf);
+#endif
+}
+
+bool BxlObserver::resolve_filename_with_path(const char *filename, mode_t &mode, std::string &path)
+{
+    const char *envPath = getenv("PATH");
+    if (envPath == nullptr)
+    {
+        envPath = "/usr/bin";
+    }
+
+    // An empty entry (which stands for the working directory) shows up as a leading or trailing ':' or as '::'
+    bool cacheable = !disposed_ && *filename != '\0' && strchr(filename, '/') == nullptr && envPath[0] == '/';
+    for (const char *separator = strchr(envPath, ':'); cacheable && separator != nullptr; separator = strchr(separator + 1, ':'))
+    {
+        cacheable = separator[1] == '/';
+    }
+
+    if (!cacheable)
+    {
+        return resolve_filename_with_env(filename, mode, path);
+    }
+
+    uint64_t context = std::hash<std::string>{}(envPath) | 1;
+    if (cache_.Check(PathSearchCacheKey, filename, /* addEntryIfMissing */ false, context))
+    {
+        return resolve_filename_with_env(filename, mode, path, lstat_without_reporting);
+    }
+
+    bool result = resolve_filename_with_env(filename, mode, path);
+    cache_.Check(PathSearchCacheKey, filename, /* addEntryIfMissing */ true, context);
+    return result;
+}
+
 bool BxlObserver::check_and_report_process_requires_ptrace(int fd)
 {
     return check_and_report_process_requires_ptrace(fd_to_path(fd).c_str());
@@ -792,13 +2439,51 @@ bool BxlObserver::check_and_report_process_requires_ptrace(int fd)
 bool BxlObserver::IsPTraceForced(const char *path)
 {
     // 1. Get the last component of the path (i.e., the program name)
-    if (forcedPTraceProcessNames_.size() == 0) 
+    if (forcedPTraceProcessNamesList_[0] == '\0') 
+    {
+        return false;
+    }
+    
+    // 2. Look for it in the semicolon-separated list
+    const char *progname = basename((char*)path);
+    size_t prognameLength = strlen(progname);
+    const char *name = forcedPTraceProcessNamesList_;
+    while (true)
+    {
+        const char *end = strchrnul(name, ';');
+        if ((size_t)(end - name) == prognameLength && strncmp(name, progname, prognameLength) == 0)
+        {
+            return true;
+        }
+
+        if (*end == '\0')
+        {
+            return false;
+        }
+
+        name = end + 1;
+    }
+}
+
+bool BxlObserver::IsTraced()
+{
+    int fd = real_open("/proc/self/status", O_RDONLY | O_CLOEXEC, 0);
+    if (fd == -1)
+    {
+        return false;
+    }
+
+    char status[4096];
+    ssize_t length = read(fd, status, sizeof(status) - 1);
+    real_close(fd);
+    if (length <= 0)
     {
         return false;
     }
-    
-    char *progname = basename((char*)path);
-    return std::find(forcedPTraceProcessNames_.begin(), forcedPTraceProcessNames_.end(), std::string(progname)) != forcedPTraceProcessNames_.end();
+
+    status[length] = '\0';
+    const char *tracerPid = strstr(status, "\nTracerPid:");
+    return tracerPid != nullptr && atoi(tracerPid + sizeof("\nTracerPid:") - 1) != 0;
 }
 
 bool BxlObserver::check_and_report_process_requires_ptrace(const char *path)
@@ -808,6 +2493,13 @@ bool BxlObserver::check_and_report_process_requires_ptrace(const char *path)
         return false;
     }
 
+    if (IsTraced())
+    {
+        // The ptrace sandbox handed this process off to us and still follows its execs: it takes the new image back if it needs to be traced,
+        // and another tracer couldn't attach to it anyway. With seccomp user notifications there is no tracer, and a new listener takes over.
+        return false;
+    }
+
     if (IsPTraceForced(path) || CheckUnconditionallyEnableLinuxPTraceSandbox(pip_->GetFamExtraFlags()))
     {
         // Allow this process to be traced by the tracer process.
@@ -836,37 +2528,7 @@ bool BxlObserver::check_and_report_process_requires_ptrace(const char *path)
         return true;
     }
 
-    // Stat the path to get the last modified time of the path
-    // We need to do this because the executable file could be changed in between this stat and the previous stat
-    // If it was changed (has a different modified time), then we should run the check on it once more
-    struct stat statbuf;
-#if (__GLIBC__ == 2 && __GLIBC_MINOR__ < 33)
-        real___lxstat(1, path, &statbuf);
-#else
-        real_lstat(path, &statbuf);
-#endif
-
-    std::string key = std::to_string(statbuf.st_mtim.tv_sec);
-    key.append(":");
-    key.append(path);
-
-    auto maybeProcess = std::find_if(
-        ptraceRequiredProcessCache_.begin(),
-        ptraceRequiredProcessCache_.end(),
-        [key](const std::pair<std::string, bool>& item) { return item.first == key; }
-    );
-
-    bool requiresPtrace;
-    if (maybeProcess != ptraceRequiredProcessCache_.end())
-    {
-        // Already checked this process
-        requiresPtrace = maybeProcess->second;
-    }
-    else
-    {
-        requiresPtrace = is_statically_linked(path) || contains_capabilities(path);
-        ptraceRequiredProcessCache_.push_back(std::make_pair(key, requiresPtrace));
-    }
+    bool requiresPtrace = requires_ptrace(path);
 
     if (requiresPtrace)
     {
@@ -897,6 +2559,11 @@ bool BxlObserver::check_and_report_process_requires_ptrace(const char *path)
     return requiresPtrace;
 }
 
+bool BxlObserver::can_interpose(const char *path)
+{
+    return !IsPTraceForced(path) && !CheckUnconditionallyEnableLinuxPTraceSandbox(pip_->GetFamExtraFlags()) && !requires_ptrace(path);
+}
+
 void BxlObserver::set_ptrace_permissions()
 {
     // This should happen before sending a kOpProcessRequiresPtrace report to bxl because it will signal bxl to launch the tracer.
@@ -909,77 +2576,60 @@ void BxlObserver::set_ptrace_permissions()
     }
 }
 
-// Executes objdump against the provided path to determine whether the binary is statically linked.
-bool BxlObserver::is_statically_linked(const char *path)
-{
-    char *args[] = {"", "-p", (char *)path, NULL};
-    std::string result = execute_and_pipe_stdout(path, "/usr/bin/objdump", args);
-
-    // Objdump should be able to dump the headers for any binary
-    // If it doesn't show this output, then the file does not exist, or is not a binary
-    std::string objDumpExeFound = "Program Header:";
-    // This output confirms that the dynamic section in objdump contains libc
-    std::string objDumpOutput = "NEEDED               libc.so.";
-
-    return result.find(objDumpExeFound) != std::string::npos && result.find(objDumpOutput) == std::string::npos;
-}
-
-bool BxlObserver::contains_capabilities(const char *path)
-{
-    char *args[] = {"", (char *)path, NULL};
-    std::string result = execute_and_pipe_stdout(path, "/usr/sbin/getcap", args);
-
-    return !result.empty();
-}
-
-std::string BxlObserver::execute_and_pipe_stdout(const char *path, const char *process, char *const args[])
+// Inspects the executable in-process (ELF program headers and file capabilities).
+// Results are cached by file identity and modified time, so a binary that is replaced gets inspected again.
+bool BxlObserver::requires_ptrace(const char *path)
 {
-    std::string result;
-    int pipefd[2];
-    char mutablePath[PATH_MAX];
-
-    pipe(pipefd);
-
-    pid_t objDumpChild = real_fork();
-
-    if (objDumpChild == 0)
+    int error = errno;
+    int fd = real_open(path, O_RDONLY | O_CLOEXEC, 0);
+    if (fd == -1)
     {
-        // Child process to execute objdump
-        real_close(pipefd[0]);    // close reading end in the child
-        real_dup2(pipefd[1], 1);  // send stdout to the pipe
-        real_dup2(pipefd[1], 2);  // send stderr to the pipe
-        real_close(pipefd[1]);    // this descriptor is no longer needed
-
-        char *envp[] = { NULL};
+        // If we can't read the file we can't tell, and the exec is most likely going to fail anyway
+        errno = error;
+        return false;
+    }
 
-        real_execvpe(process, args, envp);
+    struct stat statbuf;
+#if (__GLIBC__ == 2 && __GLIBC_MINOR__ < 33)
+    int statResult = real___fxstat(1, fd, &statbuf);
+#else
+    int statResult = real_fstat(fd, &statbuf);
+#endif
 
-        real__exit(1); // If exec was successful then we should never reach this
+    if (statResult != 0 || !S_ISREG(statbuf.st_mode))
+    {
+        real_close(fd);
+        errno = error;
+        return false;
     }
-    else
+
+    ExecutableId id = { statbuf.st_dev, statbuf.st_ino, statbuf.st_mtim };
+    auto maybeProcess = ptraceRequiredProcessCache_.find(id);
+    if (maybeProcess != ptraceRequiredProcessCache_.end())
     {
-        char buffer[4096];
-        real_close(pipefd[1]);  // close the write end of the pipe in the parent
+        // Already checked this executable
+        real_close(fd);
+        errno = error;
+        return maybeProcess->second;
+    }
 
-        while (true)
+    bool requiresPtrace = false;
+    if (statbuf.st_size > 0)
+    {
+        void *image = real_mmap(nullptr, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (image != MAP_FAILED)
         {
-            auto bytesRead = read(pipefd[0], buffer, sizeof(buffer)-1);
-            if (bytesRead == 0)
-            {
-                break;
-            }
-
-            buffer[bytesRead] = '\0';
-            result.append(buffer);
+            requiresPtrace = is_elf_statically_linked(image, statbuf.st_size);
+            munmap(image, statbuf.st_size);
         }
-
-        // We need to waitpid on the child to allow the OS to release resources for a terminated child
-        // We don't care about the result of the objdump process here, just need to waitpid to ensure proper cleanup
-        int status;
-        waitpid(objDumpChild, &status, 0);
     }
 
-    return result;
+    requiresPtrace = requiresPtrace || has_file_capabilities(fd);
+    real_close(fd);
+
+    ptraceRequiredProcessCache_.emplace(id, requiresPtrace);
+    errno = error;
+    return requiresPtrace;
 }
 
 void BxlObserver::disable_fd_table()
@@ -1005,48 +2655,72 @@ ssize_t BxlObserver::read_path_for_fd(int fd, char *buf, size_t bufsiz, pid_t as
 
 void BxlObserver::reset_fd_table_entry(int fd)
 {
-    if (fd >= 0 && fd < MAX_FD)
+    fdTable_.Reset(fd);
+}
+
+void BxlObserver::reset_fd_table_range(unsigned int first, unsigned int last)
+{
+    fdTable_.ResetRange(first, last);
+}
+
+void BxlObserver::set_non_file_fd(int fd)
+{
+    // The descriptor was just created: forget whatever was cached for a descriptor that had the same number
+    uint32_t version;
+    fdTable_.Reset(fd);
+    if (useFdTable_ && fdTable_.GetEntryVersion(fd, version))
     {
-        fdTable_[fd] = empty_str_;
+        fdTable_.SetNonFile(fd, version);
     }
 }
 
 void BxlObserver::reset_fd_table()
 {
-    for (int i = 0; i < MAX_FD; i++)
-    {
-        fdTable_[i] = empty_str_;
-    }
+    fdTable_.ResetAll();
 }
 
-std::string BxlObserver::fd_to_path(int fd, pid_t associatedPid)
+void BxlObserver::inherit_parent_state(pid_t parentPid, bool sharesFileTable)
 {
-    char path[PATH_MAX] = {0};
+    reset_fd_table();
 
-    // ignore if fd is out of range
-    if (fd < 0 || fd >= MAX_FD)
+    // The cache may have been busy in another thread of the parent at the time of the fork: that thread doesn't exist here
+    cwdCacheBusy_.store(false, std::memory_order_release);
+    invalidate_cwd();
+
+    if (sharesFileTable)
     {
-        read_path_for_fd(fd, path, PATH_MAX, associatedPid);
-        return path;
+        // The descriptors are still the parent's: it may close them at any time
+        return;
     }
 
-    if (useFdTable_)
+    uint64_t pid = (uint32_t)getpid();
+    for (auto &slot : reportFds_)
     {
-        // check the file descriptor table
-        if (fdTable_[fd].length() > 0)
+        uint64_t cached = slot.load();
+        if (cached != NoReportFd && (cached >> 32) == (uint32_t)parentPid)
         {
-            return fdTable_[fd];
+            slot.compare_exchange_strong(cached, (pid << 32) | (uint32_t)cached);
         }
     }
+}
+
+std::string BxlObserver::fd_to_path(int fd, pid_t associatedPid)
+{
+    std::string cachedPath;
+    if (useFdTable_ && fdTable_.Get(fd, cachedPath))
+    {
+        return cachedPath;
+    }
 
     // read from the filesystem and update the file descriptor table
+    char path[PATH_MAX] = {0};
     ssize_t result = read_path_for_fd(fd, path, PATH_MAX, associatedPid);
     if (result != -1)
     {
         // Only cache if read_path_for_fd succeeded.
         if (useFdTable_)
         {
-            fdTable_[fd] = path;
+            fdTable_.Set(fd, path, strnlen(path, PATH_MAX));
         }
     }
 
@@ -1070,6 +2744,50 @@ void BxlObserver::report_intermediate_symlinks(const char *pathname, pid_t assoc
     resolve_path(fullPath, /* followFinalSymlink */ true, associatedPid);
 }
 
+bool BxlObserver::cached_realpath(const char *path, char *resolved)
+{
+    if (disposed_ || path == nullptr || path[0] == '\0')
+    {
+        return false;
+    }
+
+    int error = errno;
+    relative_to_absolute(path, AT_FDCWD, /* associatedPid */ 0, resolved);
+    if (!resolve_path(resolved, /* followFinalSymlink */ true, getpid(), /* cacheOnly */ true))
+    {
+        errno = error;
+        return false;
+    }
+
+    // Lexical leftovers the walk doesn't canonicalize (a trailing slash or a final '.' or '..') are left to realpath
+    size_t length = strlen(resolved);
+    const char *lastComponent = strrchr(resolved, '/') + 1;
+    if ((length > 1 && resolved[length - 1] == '/') || strcmp(lastComponent, ".") == 0 || strcmp(lastComponent, "..") == 0)
+    {
+        errno = error;
+        return false;
+    }
+
+    // Another process may have changed the filesystem since the components were cached
+    auto statPath = [this](const char *pathToStat, struct stat *statbuf)
+    {
+#if (__GLIBC__ == 2 && __GLIBC_MINOR__ < 33)
+        return real___xstat(1, pathToStat, statbuf);
+#else
+        return real_stat(pathToStat, statbuf);
+#endif
+    };
+
+    struct stat pathStat, resolvedStat;
+    bool sameFile = statPath(path, &pathStat) == 0
+        && statPath(resolved, &resolvedStat) == 0
+        && pathStat.st_dev == resolvedStat.st_dev
+        && pathStat.st_ino == resolvedStat.st_ino;
+
+    errno = error;
+    return sameFile;
+}
+
 std::string BxlObserver::normalize_path_at(int dirfd, const char *pathname, int oflags, pid_t associatedPid)
 {
     // Observe that dirfd is assumed to point to a directory file descriptor. Under that assumption, it is safe to call fd_to_path for it.
@@ -1092,6 +2810,35 @@ std::string BxlObserver::normalize_path_at(int dirfd, const char *pathname, int
     return fullPath;
 }
 
+char *BxlObserver::get_cwd(char *fullpath, size_t size)
+{
+    uint64_t generation = cwdGeneration_.load(std::memory_order_acquire);
+    if (!cwdCacheEnabled_ || cwdCacheBusy_.exchange(true, std::memory_order_acquire))
+    {
+        return getcwd(fullpath, size);
+    }
+
+    char *result = fullpath;
+    if (cwdCacheLength_ != 0 && cwdCacheGeneration_ == generation && cwdCacheLength_ < size)
+    {
+        memcpy(fullpath, cwdCache_, cwdCacheLength_ + 1);
+    }
+    else if ((result = getcwd(fullpath, size)) != NULL)
+    {
+        // If the directory changed since 'generation' was read, the generation moved on as well and this entry won't be used
+        size_t length = strlen(fullpath);
+        if (length > 0 && length < sizeof(cwdCache_))
+        {
+            memcpy(cwdCache_, fullpath, length + 1);
+            cwdCacheLength_ = length;
+            cwdCacheGeneration_ = generation;
+        }
+    }
+
+    cwdCacheBusy_.store(false, std::memory_order_release);
+    return result;
+}
+
 void BxlObserver::relative_to_absolute(const char *pathname, int dirfd, int associatedPid, char *fullpath)
 {
     size_t len = 0;
@@ -1142,13 +2889,125 @@ static char* find_prev_slash(char *pStr)
     return pStr;
 }
 
+// readlink, memoized for the paths visited by resolve_path
+ssize_t BxlObserver::cached_readlink(const char *path, char *buf, size_t bufsiz, pid_t associatedPid)
+{
+    // The ptrace sandbox resolves paths on behalf of its tracees, and we don't see their changes to the filesystem.
+    // After disposal the cache is gone.
+    bool useCache = !disposed_ && (associatedPid == 0 || associatedPid == getpid());
+    if (!useCache)
+    {
+        return real_readlink(path, buf, bufsiz);
+    }
+
+    uint64_t generation = resolvedPathsGeneration_.load(std::memory_order_acquire);
+    ssize_t result;
+    if (lookup_resolved_path(path, generation, buf, bufsiz, result))
+    {
+        return result;
+    }
+
+    resolvedPathsMisses_++;
+    result = real_readlink(path, buf, bufsiz);
+    int error = errno;
+
+    // EINVAL means the path exists but is not a symlink. Missing paths are not cached: they may be created by other processes.
+    // The result is dropped if the cache was invalidated while we were calling readlink.
+    if ((result != -1 || error == EINVAL) && resolvedPathsMtx_.try_lock())
+    {
+        if (resolvedPathsMapGeneration_ == generation && resolvedPathsGeneration_.load(std::memory_order_acquire) == generation)
+        {
+            if (resolvedPaths_.size() >= MaxResolvedPaths)
+            {
+                resolvedPaths_.clear();
+            }
+
+            resolvedPaths_.emplace(path, result == -1 ? std::string() : std::string(buf, result));
+        }
+
+        resolvedPathsMtx_.unlock();
+    }
+
+    errno = error;
+    return result;
+}
+
+// Looks up the readlink result of the given path in the cache, as of the given generation. Returns false if the path is not in it (or the cache is busy).
+bool BxlObserver::lookup_resolved_path(const char *path, uint64_t generation, char *buf, size_t bufsiz, ssize_t &result)
+{
+    if (!resolvedPathsMtx_.try_lock())
+    {
+        return false;
+    }
+
+    if (resolvedPathsMapGeneration_ != generation)
+    {
+        resolvedPaths_.clear();
+        resolvedPathsMapGeneration_ = generation;
+    }
+
+    auto it = resolvedPaths_.find(path);
+    if (it == resolvedPaths_.end())
+    {
+        resolvedPathsMtx_.unlock();
+        return false;
+    }
+
+    result = -1;
+    if (it->second.empty())
+    {
+        errno = EINVAL;
+    }
+    else
+    {
+        result = std::min(it->second.length(), bufsiz);
+        memcpy(buf, it->second.data(), result);
+    }
+
+    resolvedPathsMtx_.unlock();
+    resolvedPathsHits_++;
+    return true;
+}
+
+void BxlObserver::seed_resolved_paths()
+{
+    std::lock_guard<std::mutex> lock(resolvedPathsMtx_);
+    pip_->ForEachKnownReparsePoint([this](KnownReparsePointKind kind, const char *path, const char *target)
+    {
+        if (kind != KnownReparsePointKind_None)
+        {
+            if (resolvedPaths_.size() < MaxResolvedPaths)
+            {
+                resolvedPaths_.emplace(path, target);
+            }
+
+            return;
+        }
+
+        // The ancestors of the path are not symlinks either
+        string prefix(path);
+        for (size_t length = 1; length <= prefix.length() && resolvedPaths_.size() < MaxResolvedPaths; length++)
+        {
+            if (length == prefix.length() || prefix[length] == '/')
+            {
+                resolvedPaths_.emplace(prefix.substr(0, length), string());
+            }
+        }
+    });
+}
+
+void BxlObserver::invalidate_resolved_paths()
+{
+    resolvedPathsGeneration_.fetch_add(1, std::memory_order_acq_rel);
+}
+
 // resolve any intermediate directory symlinks
-void BxlObserver::resolve_path(char *fullpath, bool followFinalSymlink, pid_t associatedPid)
+bool BxlObserver::resolve_path(char *fullpath, bool followFinalSymlink, pid_t associatedPid, bool cacheOnly)
 {
     if (fullpath == nullptr || fullpath[0] != '/')
     {
         LOG_DEBUG("Tried to resolve a string that is not an absolute path: %s", fullpath == nullptr ? "<NULL>" : fullpath);
-        return;
+        return false;
     }
 
     unordered_set<string> visited;
@@ -1193,8 +3052,21 @@ void BxlObserver::resolve_path(char *fullpath, bool followFinalSymlink, pid_t as
         if (*pFullpath == '/' || (*pFullpath == '\0' && followFinalSymlink))
         {
             *pFullpath = '\0';
-            nReadlinkBuf = real_readlink(fullpath, readlinkBuf, PATH_MAX);
+            bool known = true;
+            if (cacheOnly)
+            {
+                known = lookup_resolved_path(fullpath, resolvedPathsGeneration_.load(std::memory_order_acquire), readlinkBuf, PATH_MAX, nReadlinkBuf);
+            }
+            else
+            {
+                nReadlinkBuf = cached_readlink(fullpath, readlinkBuf, PATH_MAX, associatedPid);
+            }
+
             *pFullpath = ch;
+            if (!known)
+            {
+                return false;
+            }
         }
 
         // if not a symlink --> either continue or exit if at the end of the path
@@ -1217,7 +3089,18 @@ void BxlObserver::resolve_path(char *fullpath, bool followFinalSymlink, pid_t as
         // report readlink for the current path
         *pFullpath = '\0';
         // break if the same symlink has already been visited (breaks symlink loops)
-        if (!visited.insert(fullpath).second) break;
+        if (!visited.insert(fullpath).second)
+        {
+            if (cacheOnly)
+            {
+                // realpath fails with ELOOP: let it do so
+                *pFullpath = ch;
+                return false;
+            }
+
+            break;
+        }
+
         report_access_internal("_readlink", ES_EVENT_TYPE_NOTIFY_READLINK, fullpath, /* secondPath */ (const char *)nullptr, /* mode */ 0, /* error */ 0, /* checkCache */ true, associatedPid);
         *pFullpath = ch;
 
@@ -1238,96 +3121,182 @@ void BxlObserver::resolve_path(char *fullpath, bool followFinalSymlink, pid_t as
         pFullpath = find_prev_slash(pFullpath);
         strcpy(++pFullpath, readlinkBuf);
     }
+
+    return true;
 }
 
-char** BxlObserver::ensure_env_value_with_log(char *const envp[], char const *envName, char const *envValue)
+// The environment built by ensureEnvs only needs to live until exec copies it, so each thread keeps a buffer
+// for it that only grows: after the first exec of a thread, rewriting the environment doesn't allocate.
+namespace
 {
-    char **newEnvp = ensure_env_value(envp, envName, envValue);
-    if (newEnvp != envp)
+    struct EnvBuffer
     {
-        LOG_DEBUG("envp has been modified with %s added to %s", envValue, envName);
-    }
+        void *data = nullptr;
+        size_t size = 0;
 
-    return newEnvp;
+        ~EnvBuffer() { free(data); }
+    };
+
+    thread_local EnvBuffer t_envBuffer;
 }
 
 // Propagate the environment needed for sandbox initialization
 char** BxlObserver::ensureEnvs(char *const envp[])
 {
-    if (!IsMonitoringChildProcesses())
-    {
-        char **newEnvp = remove_path_from_LDPRELOAD(envp, detoursLibFullPath_);
-        newEnvp = ensure_env_value(newEnvp, BxlEnvFamPath, "");
-        newEnvp = ensure_env_value(newEnvp, BxlEnvDetoursPath, "");
-        newEnvp = ensure_env_value(newEnvp, BxlEnvRootPid, "");
-        newEnvp = ensure_env_value(newEnvp, BxlPTraceForcedProcessNames, "");
-        return newEnvp;
-    }
-    else
+    // We are about to exec, which discards any report still pending in a batch
+    FlushReportBatches();
+
+    bool monitorChildren = IsMonitoringChildProcesses();
+    const env_edit *edits = monitorChildren ? monitoredEnvEdits_ : unmonitoredEnvEdits_;
+    int editCount = monitorChildren ? monitoredEnvEditCount_ : unmonitoredEnvEditCount_;
+
+    size_t requiredSize = 0;
+    char **newEnvp = apply_env_edits(envp, edits, editCount, t_envBuffer.data, t_envBuffer.size, &requiredSize);
+    if (newEnvp == nullptr)
     {
-        char **newEnvp = ensure_paths_included_in_env(envp, LD_PRELOAD_ENV_VAR_PREFIX, detoursLibFullPath_, NULL);
-        if (newEnvp != envp)
+        void *data = realloc(t_envBuffer.data, requiredSize);
+        if (data == nullptr)
         {
-            LOG_DEBUG("envp has been modified with %s added to %s", detoursLibFullPath_, "LD_PRELOAD");
+            return (char**)envp;
         }
 
-        newEnvp = ensure_env_value_with_log(newEnvp, BxlEnvFamPath, famPath_);
-        newEnvp = ensure_env_value_with_log(newEnvp, BxlEnvDetoursPath, detoursLibFullPath_);
-        newEnvp = ensure_env_value(newEnvp, BxlEnvRootPid, "");
-        newEnvp = ensure_env_value_with_log(newEnvp, BxlPTraceForcedProcessNames, forcedPTraceProcessNamesList_);
+        t_envBuffer.data = data;
+        t_envBuffer.size = requiredSize;
+        newEnvp = apply_env_edits(envp, edits, editCount, t_envBuffer.data, t_envBuffer.size, &requiredSize);
+    }
 
-        return newEnvp;
+    if (newEnvp != envp && monitorChildren)
+    {
+        LOG_DEBUG("envp has been modified to propagate the sandbox (%s) to child processes", detoursLibFullPath_);
     }
+
+    return newEnvp;
 }
 
-bool BxlObserver::EnumerateDirectory(std::string rootDirectory, bool recursive, std::vector<std::string>& filesAndDirectories)
+bool BxlObserver::EnumerateDirectory(const std::string &rootDirectory, bool recursive, EnumerationCallback callback, void *context)
 {
-    std::stack<std::string> directoriesToEnumerate;
-    DIR *dir;
-    struct dirent *ent;
+    int fd = real_openat(AT_FDCWD, rootDirectory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC, 0);
+    if (fd == -1)
+    {
+        LOG_DEBUG("[BxlObserver::EnumerateDirectory] open failed on '%s' with errno %d\n", rootDirectory.c_str(), errno);
+        return false;
+    }
+
+    if (!callback(rootDirectory, context))
+    {
+        real_close(fd);
+        return true;
+    }
 
-    filesAndDirectories.clear();
-    directoriesToEnumerate.push(rootDirectory);
-    filesAndDirectories.push_back(rootDirectory);
+    // A single path is grown and shrunk as the enumeration goes down and up the tree, and a single buffer is reused
+    // for reading the entries of every directory, so enumerating a large tree doesn't allocate per entry
+    std::string path(rootDirectory);
+    path.reserve(PATH_MAX);
+    std::vector<char> buffer(EnumerationBufferSize);
+    bool stopped = false;
 
-    while (!directoriesToEnumerate.empty())
+    return EnumerateDirectoryAt(fd, path, recursive, buffer, callback, context, stopped);
+}
+
+bool BxlObserver::EnumerateDirectoryAt(int dirfd, std::string &path, bool recursive, std::vector<char> &buffer, EnumerationCallback callback, void *context, bool &stopped)
+{
+    // Subdirectories are only descended into once all the entries of this directory are read, so the buffer can be reused
+    std::vector<std::string> subdirectories;
+    bool succeeded = true;
+    size_t pathLength = path.length();
+
+    while (!stopped)
     {
-        auto currentDirectory = directoriesToEnumerate.top();
-        directoriesToEnumerate.pop();
+        long bytesRead = syscall(SYS_getdents64, dirfd, buffer.data(), buffer.size());
+        if (bytesRead == 0)
+        {
+            break;
+        }
 
-        dir = real_opendir(currentDirectory.c_str());
+        if (bytesRead < 0)
+        {
+            LOG_DEBUG("[BxlObserver::EnumerateDirectory] getdents64 failed on '%s' with errno %d\n", path.c_str(), errno);
+            succeeded = false;
+            break;
+        }
 
-        if (dir != NULL)
+        for (long offset = 0; offset < bytesRead && !stopped;)
         {
-            while ((ent = real_readdir(dir)) != NULL)
-            {
-                std::string fileOrDirectory(ent->d_name);
-                if (fileOrDirectory == "." || fileOrDirectory == "..")
-                {
-                    continue;
-                }
+            const struct dirent64 *entry = (const struct dirent64 *)(buffer.data() + offset);
+            offset += entry->d_reclen;
 
-                std::string fullPath = currentDirectory + "/" + fileOrDirectory;
+            const char *name = entry->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+            {
+                continue;
+            }
 
-                // NOTE: d_type is supported on these filesystems as of 2022 which should cover all BuildXL cases: Btrfs, ext2, ext3, and ext4
-                if (ent->d_type == DT_DIR && recursive)
-                {
-                    // DT_DIR = Directory
-                    directoriesToEnumerate.push(fullPath);
-                }
+            path.push_back('/');
+            path.append(name);
+            stopped = !callback(path, context);
+            path.resize(pathLength);
 
-                filesAndDirectories.push_back(fullPath);
+            // NOTE: d_type is supported on these filesystems as of 2022 which should cover all BuildXL cases: Btrfs, ext2, ext3, and ext4
+            if (entry->d_type == DT_DIR && recursive)
+            {
+                subdirectories.emplace_back(name);
             }
+        }
+    }
+
+    for (size_t i = 0; i < subdirectories.size() && succeeded && !stopped; i++)
+    {
+        path.push_back('/');
+        path.append(subdirectories[i]);
 
-            real_closedir(dir);
+        int fd = real_openat(dirfd, subdirectories[i].c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC, 0);
+        if (fd == -1)
+        {
+            LOG_DEBUG("[BxlObserver::EnumerateDirectory] open failed on '%s' with errno %d\n", path.c_str(), errno);
+            succeeded = false;
         }
         else
         {
-            // Something went wrong with opendir
-            LOG_DEBUG("[BxlObserver::EnumerateDirectory] opendir failed on '%s' with errno %d\n", currentDirectory, errno);
-            return false;
+            succeeded = EnumerateDirectoryAt(fd, path, recursive, buffer, callback, context, stopped);
         }
+
+        path.resize(pathLength);
     }
 
-    return true;
+    real_close(dirfd);
+    return succeeded;
+}
+
+// Whether any policy in the manifest tree rooted at the given record lacks the allowing flags or has any of the reporting ones
+static bool ManifestHasPolicy(PCManifestRecord record, FileAccessPolicy allowingPolicy, FileAccessPolicy reportingPolicy)
+{
+    for (FileAccessPolicy policy : { record->GetConePolicy(), record->GetNodePolicy() })
+    {
+        if ((policy & allowingPolicy) != allowingPolicy || (policy & reportingPolicy) != 0)
+        {
+            return true;
+        }
+    }
+
+    for (ManifestRecord::BucketCountType i = 0; i < record->BucketCount; i++)
+    {
+        PCManifestRecord child = record->GetChildRecord(i);
+        if (child != nullptr && ManifestHasPolicy(child, allowingPolicy, reportingPolicy))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool BxlObserver::CanAccessBeReported(FileAccessPolicy allowingPolicy, FileAccessPolicy reportingPolicy) const
+{
+    if (!pip_ || CheckReportAllFileAccesses(pip_->GetFamFlags()))
+    {
+        return true;
+    }
+
+    // Unexpected accesses are only reported when the access is denied, which can't happen if every policy allows it
+    return ManifestHasPolicy(pip_->GetManifestRecord(), allowingPolicy, reportingPolicy);
 }
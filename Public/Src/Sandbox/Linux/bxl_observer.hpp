@@ -13,9 +13,13 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <limits.h>
+#include <pthread.h>
 #include <semaphore.h>
 #include <stddef.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/sendfile.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/syscall.h>
 #include <sys/time.h>
@@ -26,12 +30,20 @@
 
 #include <ostream>
 #include <sstream>
+#include <atomic>
 #include <chrono>
 #include <mutex>
 #include <unordered_set>
 #include <unordered_map>
 #include <vector>
 
+#include "access_cache.hpp"
+#include "access_statistics.hpp"
+#include "debug_log.hpp"
+#include "fd_table.hpp"
+#include "io_uring_rings.hpp"
+#include "report_format.hpp"
+#include "report_ring.hpp"
 #include "Sandbox.hpp"
 #include "SandboxedPip.hpp"
 #include "utils.h"
@@ -86,15 +98,60 @@ static const char GLIBC_23[] = "GLIBC_2.3";
  * An exact version must be passed as an argument here or else dlvsym will return NULL (this means the latest version cannot be passed all the time).
  * 
  * To check what version of a libc function a binary is using, dump it with the following command: objdump -t </path/to/binary> | grep <function_name>
+ *
+ * The real functions are looked up on their first call rather than when the observer is constructed: most processes only call a few
+ * of them, and looking all of them up was a noticeable part of the startup cost of short-lived processes.
  */
 #ifdef ENABLE_INTERPOSING
+    /**
+     * Symbol from the next object in the lookup order (RTLD_NEXT), looked up on first use.
+     */
+    class LazySymbol
+    {
+    public:
+        LazySymbol(const char *name, const char *version = nullptr) : name_(name), version_(version) { }
+
+        // Returns the address of the symbol, or nullptr if it doesn't exist
+        void *Get() const
+        {
+            void *address = address_.load(std::memory_order_acquire);
+            if (address == nullptr)
+            {
+                // Threads racing here just look the symbol up more than once. Missing symbols are looked up on every call, but those are never called.
+                address = version_ == nullptr ? dlsym(RTLD_NEXT, name_) : dlvsym(RTLD_NEXT, name_, version_);
+                address_.store(address, std::memory_order_release);
+            }
+
+            return address;
+        }
+
+    private:
+        const char *name_;
+        const char *version_;
+        mutable std::atomic<void *> address_ = { nullptr };
+    };
+
+    template<typename TFn>
+    class RealFunction : public LazySymbol
+    {
+    public:
+        using LazySymbol::LazySymbol;
+
+        template<typename ...TArgs> decltype(auto) operator()(TArgs&& ...args) const
+        {
+            return ((TFn)Get())(std::forward<TArgs>(args)...);
+        }
+
+        explicit operator bool() const { return Get() != nullptr; }
+    };
+
     #define GEN_FN_DEF_REAL(ret, name, ...)                                         \
         typedef ret (*fn_real_##name)(__VA_ARGS__);                                 \
-        const fn_real_##name real_##name = (fn_real_##name)dlsym(RTLD_NEXT, #name);
+        const RealFunction<fn_real_##name> real_##name { #name };
 
     #define GEN_FN_DEF_REAL_VERSIONED(version, ret, name, ...)                      \
         typedef ret (*fn_real_##name)(__VA_ARGS__);                                 \
-        const fn_real_##name real_##name = (fn_real_##name)dlvsym(RTLD_NEXT, #name, version);
+        const RealFunction<fn_real_##name> real_##name { #name, version };
 
     #define MAKE_BODY(B) \
         B \
@@ -229,6 +286,9 @@ public:
     }
 };
 
+// Called with every path enumerated by BxlObserver::EnumerateDirectory. Returns false to stop the enumeration.
+typedef bool (*EnumerationCallback)(const std::string &path, void *context);
+
 /**
  * Singleton class responsible for reporting accesses.
  *
@@ -250,49 +310,260 @@ private:
     char progFullPath_[PATH_MAX];
     char detoursLibFullPath_[PATH_MAX];
     char famPath_[PATH_MAX];
-    char forcedPTraceProcessNamesList_[PATH_MAX];
+    char forcedPTraceProcessNamesList_[PATH_MAX] = {0};
     char secondaryReportPath_[PATH_MAX];
+    char sharedCacheFd_[16] = {0};
+
+    // Changes ensureEnvs makes to the environment of child processes, depending on whether they are monitored. Computed once (see InitEnvEdits).
+    static const int MaxSandboxEnvEdits = 10;
+    env_edit monitoredEnvEdits_[MaxSandboxEnvEdits];
+    int monitoredEnvEditCount_ = 0;
+    env_edit unmonitoredEnvEdits_[MaxSandboxEnvEdits];
+    int unmonitoredEnvEditCount_ = 0;
+
+    AccessCache cache_;
+
+    // The audit library and the interposing library each have their own observer (they are separate shared objects, and the audit one lives
+    // in a link map namespace of its own), but they share an address space. Unless the table of the pip is shared (see InitSharedCache),
+    // the first of them to start maps a table for cache_ at this address and the other one finds it there, so what the loader maps
+    // is not reported again by interposed calls, and the other way around (see InitProcessCache). The address is below 2^39, so it
+    // is valid with any virtual address size, and far from where executables, the heap and shared libraries get mapped.
+    static const uintptr_t ProcessCacheAddress = 0x3a00000000;
+    static const uint32_t PathSearchCacheKey = ES_EVENT_TYPE_LAST;
+    static const size_t ProcessCacheCapacity = 1 << 16;
+
+    // Stat-like probes that were reported and allowed, keyed by the path as given to the syscall rather than the normalized one, so repeated probes
+    // skip normalization altogether. The context of an entry captures everything the raw path is resolved against (see is_probe_cache_hit),
+    // so entries never need to be removed: they just stop matching. Private to the process, since it is relative to its working directory and descriptors.
+    AccessCache probeCache_;
+    std::atomic<uint64_t> cwdGeneration_ = { 0 };
+
+    // The working directory of this process as of generation cwdCacheGeneration_ of cwdGeneration_, so relative paths are made absolute
+    // without a getcwd syscall (see get_cwd). Guarded by cwdCacheBusy_, which is only ever try-locked: when the cache is busy we just call getcwd.
+    // Disabled once the process shares its working directory with a child process (clone with CLONE_FS), whose changes we don't see,
+    // and without interposing (the audit library), where changes of the working directory are not seen at all.
+    std::atomic<bool> cwdCacheBusy_ = { false };
+#ifdef ENABLE_INTERPOSING
+    bool cwdCacheEnabled_ = true;
+#else
+    bool cwdCacheEnabled_ = false;
+#endif
+    uint64_t cwdCacheGeneration_ = 0;
+    size_t cwdCacheLength_ = 0; // 0 when nothing is cached
+    char cwdCache_[PATH_MAX];
+
+    // Cache of readlink results for the path prefixes visited by resolve_path: maps a path to its symlink target,
+    // or to an empty string if the path exists but is not a symlink. Cleared by operations that can change that (see invalidate_resolved_paths).
+    // Access is non-blocking (try_lock): when the cache is busy we just call readlink. Invalidation only bumps
+    // resolvedPathsGeneration_ (so it never blocks, e.g. in a forked child), and the map is cleared on its next use.
+    static const size_t MaxResolvedPaths = 4096;
+    std::mutex resolvedPathsMtx_;
+    std::unordered_map<std::string, std::string> resolvedPaths_;
+    uint64_t resolvedPathsMapGeneration_ = 0;
+    std::atomic<uint64_t> resolvedPathsGeneration_ = { 0 };
+    std::atomic<uint64_t> resolvedPathsHits_ = { 0 };
+    std::atomic<uint64_t> resolvedPathsMisses_ = { 0 };
+
+    // Working directories of the processes traced by this one (the ptrace sandbox), so we don't read /proc/<pid>/cwd for every relative path.
+    // Only the tracer uses it: it is single threaded, and keeps the cache valid as its tracees change directories (see PTraceSandbox).
+    bool cacheTraceeCwds_ = false;
+    std::unordered_map<pid_t, std::string> traceeCwds_;
 
-    std::timed_mutex cacheMtx_;
-    std::unordered_map<es_event_type_t, std::unordered_set<std::string>> cache_;
-
-    // In a typical case, a process will not have more than 1024 open file descriptors at a time.
-    // File descriptors start at 3 (1 and 2 are reserved for stdout and stderr).
     // Whenever a new file descriptor is created, the smallest available positive integer is assigned to it. 
     // Whenever a file descriptor is closed, its value is returned to the pool and will be used for new ones.
-    // Setting the size of this table to 1024 should accommodate most of the common cases.
-    // File descriptors can be greater than 1024, and if that happens we just won't cache their paths.
-    static const int MAX_FD = 1024;
-    std::string fdTable_[MAX_FD];
+    // The table grows on demand (see FdTable), so processes with thousands of open descriptors are covered as well.
+    FdTable fdTable_;
     const char* const empty_str_ = "";
     bool useFdTable_ = true;
+
+    // The io_uring instances of this process, so the accesses submitted through them can be reported (see IoUringRings)
+    IoUringRings ioUringRings_;
     bool sandboxLoggingEnabled_ = false;
 
     std::shared_ptr<SandboxedPip> pip_;
     std::shared_ptr<SandboxedProcess> process_;
     Sandbox *sandbox_;
 
-    // Cache for processes requiring ptrace in the form <timestamp>:<path>
-    std::vector<std::pair<std::string, bool>> ptraceRequiredProcessCache_;
-    std::vector<std::string> forcedPTraceProcessNames_;
+    // Cache for executables requiring ptrace, keyed by file identity and modified time
+    struct ExecutableId
+    {
+        dev_t dev;
+        ino_t ino;
+        struct timespec mtime;
+
+        bool operator==(const ExecutableId &other) const
+        {
+            return dev == other.dev && ino == other.ino && mtime.tv_sec == other.mtime.tv_sec && mtime.tv_nsec == other.mtime.tv_nsec;
+        }
+    };
 
-    // Message counting
+    struct ExecutableIdHash
+    {
+        size_t operator()(const ExecutableId &id) const
+        {
+            size_t hash = std::hash<uint64_t>()((uint64_t)id.dev);
+            hash = hash * 31 + std::hash<uint64_t>()((uint64_t)id.ino);
+            hash = hash * 31 + std::hash<uint64_t>()((uint64_t)id.mtime.tv_sec);
+            return hash * 31 + std::hash<uint64_t>()((uint64_t)id.mtime.tv_nsec);
+        }
+    };
+
+    std::unordered_map<ExecutableId, bool, ExecutableIdHash> ptraceRequiredProcessCache_;
+
+    // Report pipe descriptors (primary and secondary) and the descriptor of the sandbox trace, lazily opened and kept open for the lifetime of the process.
+    // Each slot packs the pid that opened the descriptor in the upper 32 bits and the descriptor in the lower 32 bits, so a
+    // child created with fork/clone can tell the descriptor was inherited from its parent and open its own.
+    static const uint64_t NoReportFd = UINT64_MAX;
+    static const int SandboxTraceFdSlot = 2;
+    std::atomic<uint64_t> reportFds_[3] = { {NoReportFd}, {NoReportFd}, {NoReportFd} };
+
+    // Path of the trace of checked accesses (see sandbox_trace.hpp), empty when accesses are not traced
+    char sandboxTracePath_[PATH_MAX] = {0};
+
+    // Statistics of the pip, shared by all its processes (see InitAccessStatistics). Updates are no-ops when they are not mapped.
+    char accessStatisticsPath_[PATH_MAX] = {0};
+    AccessStatistics statistics_;
+
+    // Binary log the debug messages are written to instead of being reported (see InitDebugLog), when the directory is set
+    char debugLogDirectory_[PATH_MAX] = {0};
+    DebugLog debugLog_;
+
+    // Ring the reports meant for the primary pipe are written to instead, when the managed side created one (see InitReportRing).
+    // A process that had to fall back to the pipe keeps using it, so reports written to the two never get reordered.
+    static constexpr std::chrono::milliseconds ReportRingFullTimeout = std::chrono::milliseconds(1000);
+    ReportRing *reportRing_ = nullptr;
+    std::atomic<bool> reportRingAbandoned_ = { false };
+
+    // Report batching (see CheckEnableLinuxSandboxReportBatching). Each thread appends length-prefixed report frames to its own batch,
+    // which is written to the primary pipe with a single write when it fills up, and before fork, exec and exit.
+    // Batches are allocated once and never freed, so they can still be flushed from exit handlers after the destructor ran.
+    static const size_t ReportBatchCapacity = 64 * 1024;
+    struct ReportBatch
+    {
+        ReportBatch *next = nullptr;            // next batch in reportBatches_, immutable once published
+        std::atomic<bool> inUse = { true };     // whether a live thread owns this batch
+        std::atomic_flag busy = ATOMIC_FLAG_INIT;
+        pid_t pid = 0;                          // process owning the content of the batch and the descriptor below
+        std::atomic<int> fd = { -1 };           // private descriptor, so flock also excludes other threads of this process
+        size_t length = 0;
+        int countedReports = 0;                 // number of reports in the batch that count towards the message counting semaphore
+        char buffer[ReportBatchCapacity];
+
+        // Asynchronous reporting only (see StageReport)
+        char *records = nullptr;                // ring of ReportRecordsCapacity bytes
+        std::atomic<uint64_t> recordsHead = { 0 };  // bytes ever staged, only updated by the owner thread
+        std::atomic<uint64_t> recordsTail = { 0 };  // bytes ever turned into frames, only updated while holding 'busy'
+        std::atomic<bool> staging = { false };  // set while the owner thread stages a record, so a signal handler doesn't stage another one on top of it
+    };
+    bool batchReports_ = false;
+    pthread_key_t reportBatchKey_;
+    std::atomic<ReportBatch*> reportBatches_ = { nullptr };
+
+    // Asynchronous reporting (see CheckEnableLinuxSandboxAsyncReporting). Interposed calls only copy the fields of a report into a
+    // binary record in the ring of their batch, and a helper thread (the flusher) formats them into the frames of the batch and sends them.
+    // Records are turned into frames before anything else in the batch is sent, so reports still reach the pipe before fork, exec and exit.
+    static const size_t ReportRecordsCapacity = 64 * 1024;     // must be a power of 2
+    static const int ReportFlushIntervalUs = 1000;             // how long the flusher lets records pile up after being woken up
+    static const int ReportFlusherNice = -5;                   // nice value of the flusher with CheckRaiseSandboxHelperThreadPriority
+    struct ReportRecord
+    {
+        uint32_t length;                        // bytes taken in the ring, path included, a multiple of 8. Zero pads the ring up to its end.
+        bool countReport;
+        FileOperation operation;
+        pid_t pid;
+        DWORD requestedAccess;
+        DWORD status;
+        uint reportExplicitly;
+        DWORD error;
+        uint isDirectory;
+        // Followed by the null-terminated path
+    };
+    bool asyncReports_ = false;
+    std::atomic<pid_t> reportFlusherPid_ = { 0 };   // process the flusher thread runs in: children start their own
+    std::atomic<int> reportFlusherIdle_ = { 0 };    // futex the flusher waits on when there is nothing to send
+
+    // Frames of the la_objopen reports the audit library holds back while the loader maps objects (see flush_audit_objopen_reports).
+    // The loader invokes the audit callbacks with its lock held, so they are never called concurrently.
+    char *auditReports_ = nullptr;                  // ReportBatchCapacity bytes, allocated on first use
+    size_t auditReportsLength_ = 0;                 // every frame held back is a counted report
+    pid_t auditReportsPid_ = 0;
+
+    // Frames of the reports the ptrace tracer holds back (see EnableTracerReportBuffering). Only the tracer thread reports.
+    bool bufferTracerReports_ = false;
+    char *tracerReports_ = nullptr;                 // ReportBatchCapacity bytes, allocated on first use
+    size_t tracerReportsLength_ = 0;                // every frame held back is a counted report
+    std::chrono::steady_clock::time_point tracerReportsSince_;  // when the oldest frame held back was added
+
+    // Message counting. The counter is opened on the first report that counts (see GetMessageCountingSemaphore),
+    // so processes that never report an access don't pay for it. Reports are counted on the shared counter page when the
+    // managed side created one, and on the semaphore otherwise.
+    static const int SemaphoreNotOpened = 0;
+    static const int SemaphoreOpening = 1;
+    static const int SemaphoreOpened = 2;
+    std::atomic<uint64_t> *messageCounter_ = nullptr;
     sem_t *messageCountingSemaphore_ = nullptr;
+    std::atomic<int> messageCountingSemaphoreState_ = { SemaphoreNotOpened };
     bool initializingSemaphore_ = false;
 
     void InitFam(pid_t pid);
     void InitDetoursLibPath();
+    bool InitSharedCache();
+    void InitProcessCache();
+    void InitAccessStatistics();
+    void InitDebugLog();
+    void InitReportRing();
+    void InitEnvEdits();
     bool Send(const char *buf, size_t bufsiz, bool useSecondaryPipe, bool countReport);
-    bool IsCacheHit(es_event_type_t event, const string &path, const string &secondPath);
-    bool CheckCache(es_event_type_t event, const string &path, bool addEntryIfMissing);
-    char** ensure_env_value_with_log(char *const envp[], char const *envName, const char *envValue);
+    // Opens the message counter (or the semaphore, see OpenMessageCounter) on first use
+    void GetMessageCountingSemaphore();
+    std::atomic<uint64_t>* OpenMessageCounter();
+    void CountSentReports(int count);
+    int GetReportFd(bool useSecondaryPipe);
+    int GetCachedFd(int slotIndex, const char *path, int flags);
+    void TraceAccess(const char *syscallName, const IOEvent &event, uint64_t timestampNs, uint64_t checkNs);
+    // A subtree frame being filled (see SendSubtreeReports). 'content' holds the length prefix, the report fields and the root,
+    // followed by the relative paths appended so far.
+    static const int MaxPendingSubtreeFrames = 8;
+    struct SubtreeFrame
+    {
+        AccessReport first;                     // first report packed in the frame, sent as is when no other report joins it
+        int rootIndex;
+        int count;
+        std::string content;
+    };
+
+    bool SendSubtreeFrame(SubtreeFrame &frame);
+    ReportBatch* GetReportBatch();
+    bool TryLockReportBatch(ReportBatch *batch);
+    bool AppendToReportBatch(const AccessReport &report, bool countReport, bool flush);
+    bool FlushReportBatch(ReportBatch *batch);
+    void DrainReportBatch(ReportBatch *batch);
+    bool WriteReportFrames(ReportBatch *batch);
+    bool StageReport(const AccessReport &report, bool countReport);
+    bool SendUnbatchedReport(const AccessReport &report, bool countReport);
+    void EnsureReportFlusher();
+    static void* ReportFlusher(void *);
+    bool SendFrames(int fd, const char *buf, size_t bufsiz, int countedReports);
+    size_t WriteFramesToReportRing(const char *buf, size_t bufsiz);
+    bool WriteToReportRing(const char *payload, size_t length, bool &ringDoorbell);
+    void RingReportDoorbell();
+    bool AppendAuditReport(const AccessReport &report);
+    bool AppendTracerReport(const AccessReport &report);
+    void FlushTracerReports();
+    void SendCountedFrames(const char *frames, size_t length);
+    static void ReleaseReportBatch(void *batch);
+    bool IsCacheHit(es_event_type_t event, const char *path, const char *secondPath);
+    bool CheckCache(es_event_type_t event, const char *path, bool addEntryIfMissing);
     void report_access_internal(const char *syscallName, es_event_type_t eventType, const char *reportPath, const char *secondPath = nullptr, mode_t mode = 0, int error = 0, bool checkCache = true, pid_t associatedPid = 0);
     AccessCheckResult create_access_internal(const char *syscallName, es_event_type_t eventType, const char *reportPath, const char *secondPath, AccessReportGroup &reportGroup, mode_t mode = 0, bool checkCache = true, pid_t associatedPid = 0);
+    AccessCheckResult check_access(const char *syscallName, IOEvent &event, AccessReportGroup &reportGroup, bool checkCache);
     ssize_t read_path_for_fd(int fd, char *buf, size_t bufsiz, pid_t associatedPid = 0);
 
     bool IsMonitoringChildProcesses() const { return !pip_ || CheckMonitorChildProcesses(pip_->GetFamFlags()); }
     bool IsPTraceEnabled() const { return pip_ && (CheckEnableLinuxPTraceSandbox(pip_->GetFamExtraFlags()) || CheckUnconditionallyEnableLinuxPTraceSandbox(pip_->GetFamExtraFlags())); }
     bool IsPTraceForced(const char *path);
+    // Whether this process is being traced, which a process the ptrace sandbox handed off to us still is (see PTraceSandbox::HandOffToInterposition)
+    bool IsTraced();
     bool IsReportingProcessArgs() const { return !pip_ || CheckReportProcessArgs(pip_->GetFamFlags()); }
 
     inline bool IsValid() const             { return sandbox_ != NULL; }
@@ -328,18 +599,32 @@ private:
     }
 
     void relative_to_absolute(const char *pathname, int dirfd, int associatedPid, char *fullPath);
-    void resolve_path(char *fullpath, bool followFinalSymlink, pid_t associatedPid);
+    // Resolves the symlinks in an absolute path (in place), reporting them. With cacheOnly, paths are only looked up in the cache of
+    // resolved paths (no readlink is called), and false is returned as soon as one is not in it (or a symlink loop is found).
+    bool resolve_path(char *fullpath, bool followFinalSymlink, pid_t associatedPid, bool cacheOnly = false);
+    ssize_t cached_readlink(const char *path, char *buf, size_t bufsiz, pid_t associatedPid);
+    bool lookup_resolved_path(const char *path, uint64_t generation, char *buf, size_t bufsiz, ssize_t &result);
+    // Fills the cache of resolved paths with the symlinks the manifest knows about, and the paths it knows are free of them
+    void seed_resolved_paths();
     
     // Builds the report to be sent over the FIFO in the given buffer
     inline int BuildReport(char* buffer, int maxMessageLength, const AccessReport &report, const char *path)
     {
         // Note: when adding new fields, always leave 'path' as the last component of this message
         // This is for the sake of the arithmetic when truncating debug messages, where this assumption is made (see SendReport). 
-        return snprintf(
-            buffer, maxMessageLength, "%s|%d|%d|%d|%d|%d|%d|%d|%s\n",
-            __progname, report.pid <= 0 ? getpid() : report.pid, report.requestedAccess, report.status, report.reportExplicitly, report.error, report.operation, report.isDirectory, path);
+        const int fields[ReportFormatter::FieldCount] =
+        {
+            report.pid <= 0 ? getpid() : report.pid, report.requestedAccess, report.status, report.reportExplicitly, report.error, report.operation, report.isDirectory
+        };
+
+        return ReportFormatter::Format(buffer, maxMessageLength, __progname, fields, path);
     }
 
+    // Size of the buffer directory entries are read into when enumerating a directory
+    static const size_t EnumerationBufferSize = 32 * 1024;
+
+    bool EnumerateDirectoryAt(int dirfd, std::string &path, bool recursive, std::vector<char> &buffer, EnumerationCallback callback, void *context, bool &stopped);
+
     static BxlObserver *sInstance;
     static AccessCheckResult sNotChecked;
 
@@ -350,8 +635,9 @@ private:
 public:
     static BxlObserver* GetInstance();
 
-    // Performs additional initialization tasks after the static instance is initally constructed.
-    void Init();
+    // Opens the message counting semaphore, if message counting is enabled and it isn't open yet. Children can't open it
+    // between fork and exec (sem_open is not async-signal-safe), so this needs to be called before a process is forked.
+    void OpenMessageCountingSemaphore() { GetMessageCountingSemaphore(); }
     bool IsPerformingInit()
     {
         return initializingSemaphore_;
@@ -359,10 +645,24 @@ public:
 
     bool SendReport(const AccessReport &report, bool isDebugMessage = false, bool useSecondaryPipe = false);
     bool SendReport(const AccessReportGroup &report);
+    // Sends the reports of an operation on a whole directory tree (e.g., renaming a directory). Reports on paths under one of the given roots
+    // that only differ in their path are packed into subtree frames, where the path field is the root followed by a null-separated
+    // list of paths relative to it (CODESYNC: Public/Src/Engine/Processes/SandboxConnectionLinuxDetours.cs).
+    bool SendSubtreeReports(const std::vector<AccessReportGroup> &reports, const std::string &sourceRoot, const std::string &destinationRoot);
     // Specialization for the exit report event. 
     // We may need to send an exit report on exit handlers after destructors
     // have been called. This method avoids accessing shared structures.
     bool SendExitReport(pid_t pid = 0);
+    // Writes out the pending batched reports of every thread of this process. Needs to be called
+    // before the address space is replaced (exec) or duplicated (fork), and on exit. This includes the reports held back by the tracer.
+    void FlushReportBatches();
+    // Has the counted reports of this process held back, and sent in as few writes as possible when FlushReportBatches is called,
+    // when the buffer fills up, or when the oldest one waited for ReportFlushIntervalUs. Reports that don't count (process starts
+    // and exits, which the managed side tracks processes with) send the ones held back before them. Only meant for the ptrace
+    // tracer, which reports from a single thread and knows when it is idle (see PTraceSandbox::AttachToProcess).
+    void EnableTracerReportBuffering() { bufferTracerReports_ = true; }
+    // Statistics of the pip, for the tracer to count its stops in (see CountTracerStop)
+    AccessStatistics& GetAccessStatistics() { return statistics_; }
     char** ensureEnvs(char *const envp[]);
 
     const char* GetProgramPath() { return progFullPath_; }
@@ -371,15 +671,29 @@ public:
     const char* GetDetoursLibPath() { return detoursLibFullPath_; }
 
     void report_exec(const char *syscallName, const char *procName, const char *file, int error, mode_t mode = 0, pid_t associatedPid = 0);
+    // Reports the command line of the given process, as its arguments joined by spaces. Reads it from /proc/<pid>/cmdline,
+    // for when the argument vector is not at hand.
     void report_exec_args(pid_t pid);
-    void report_audit_objopen(const char *fullpath)
-    {
-        IOEvent event(ES_EVENT_TYPE_NOTIFY_OPEN, ES_ACTION_TYPE_NOTIFY, fullpath, progFullPath_, S_IFREG);
-        report_access("la_objopen", event, /* checkCache */ true);
-    }
+
+    // Reports the given argument vector as the command line of the given process, without going through /proc. The
+    // command line is only limited by PIPE_BUF when reports are not batched. Falls back to /proc if 'argv' is null.
+    void report_exec_args(pid_t pid, const char *const argv[]);
+
+    // Reports an object mapped by the loader. The report is held back until flush_audit_objopen_reports is called.
+    void report_audit_objopen(const char *fullpath);
+
+    // Sends the held back la_objopen reports, in as few writes as possible. The audit library calls this when the loader
+    // is done mapping objects: before handing control to the program, and after every dlopen.
+    void flush_audit_objopen_reports();
 
     void report_intermediate_symlinks(const char *pathname, pid_t associatedPid);
 
+    // Resolves 'path' like realpath does into 'resolved' (PATH_MAX bytes), without calling readlink, if every component of it is in the
+    // cache of resolved paths. The symlinks on the way are reported, like report_intermediate_symlinks does. The cache only sees the
+    // changes this process makes to the filesystem (see invalidate_resolved_paths), so the result is only used if it and 'path' are
+    // still the same file, which costs two stats instead of a readlink per component. Returns false (errno untouched) otherwise.
+    bool cached_realpath(const char *path, char *resolved);
+
     // Removes detours path from LD_PRELOAD from the given environment and returns the modified environment
     inline char** RemoveLDPreloadFromEnv(char *const envp[])
     { 
@@ -411,20 +725,105 @@ public:
     // and the write is allowed by policy
     void report_firstAllowWriteCheck(const char *fullPath);
 
+    // Resolves the file given to execvp and friends against PATH, like resolve_filename_with_env, reporting the probes on the candidates.
+    // The search is remembered in the access cache, keyed by the file name and the value of PATH: the candidates that come after a search
+    // with the same name and PATH are still probed (the result always reflects the filesystem), but without going through the sandbox,
+    // because those probes were already reported. With a shared table this holds for every process of the pip running the same program.
+    // Searches through relative PATH entries depend on the working directory and are never remembered.
+    bool resolve_filename_with_path(const char *filename, mode_t &mode, std::string &path);
+
     // Checks and reports when a process that requires ptrace is about to be executed
     bool check_and_report_process_requires_ptrace(const char *path);
     bool check_and_report_process_requires_ptrace(int fd);
-    bool is_statically_linked(const char *path);
-    bool contains_capabilities(const char *path);
-    std::string execute_and_pipe_stdout(const char *path, const char *process, char *const args[]);
+    bool requires_ptrace(const char *path);
+    // Whether a process executing 'path' can be left to the interposing sandbox, i.e., it doesn't require ptrace and ptrace is not forced for it
+    bool can_interpose(const char *path);
     void set_ptrace_permissions();
 
+    // Forgets all cached readlink results. Needs to be called after any operation that may create, remove or move a symlink or a directory.
+    void invalidate_resolved_paths();
+
+    // Needs to be called after the working directory of the process changes, so relative paths are not resolved against the previous one
+    void invalidate_cwd() { cwdGeneration_.fetch_add(1, std::memory_order_acq_rel); }
+
+    // Needs to be called before creating a process that shares the working directory of this one: its changes are not seen by this process
+    void disable_cwd_cache() { cwdCacheEnabled_ = false; }
+
+    // getcwd, remembered until the working directory changes (see cwdCache_)
+    char *get_cwd(char *fullpath, size_t size);
+
+    // Whether the given stat-like probe was already reported (see probeCache_). Otherwise, sets 'context' to the value
+    // to pass to add_probe_cache_entry once the probe is reported, or to 0 if the probe can't be cached.
+    bool is_probe_cache_hit(es_event_type_t eventType, int dirfd, const char *pathname, int oflags, uint64_t &context, pid_t associatedPid = 0);
+
+    // Remembers a reported probe. Only probes that succeeded and were not denied are remembered: missing paths may be created by other processes.
+    void add_probe_cache_entry(es_event_type_t eventType, uint64_t context, const char *pathname, AccessCheckResult &check, int error);
+
+    // Enables or disables caching the working directories of tracees. Either way, the cache starts empty.
+    void enable_tracee_cwd_cache(bool enable)
+    {
+        cacheTraceeCwds_ = enable;
+        traceeCwds_.clear();
+    }
+
+    // A child starts in the working directory of its parent
+    void inherit_tracee_cwd(pid_t parentPid, pid_t childPid)
+    {
+        auto parentCwd = traceeCwds_.find(parentPid);
+        if (cacheTraceeCwds_ && parentCwd != traceeCwds_.end())
+        {
+            std::string cwd = parentCwd->second;
+            traceeCwds_[childPid] = std::move(cwd);
+        }
+        else
+        {
+            traceeCwds_.erase(childPid);
+        }
+    }
+
+    void forget_tracee_cwd(pid_t pid) { traceeCwds_.erase(pid); }
+
     // Clears the specified entry on the file descriptor table
     void reset_fd_table_entry(int fd);
     
+    // Clears the entries in [first, last] on the file descriptor table
+    void reset_fd_table_range(unsigned int first, unsigned int last);
+
     // Clears the entire file descriptor table
     void reset_fd_table();
 
+    // Called in a child process right after fork/clone. Forgets the state that belongs to the parent without writing to the
+    // memory inherited from it unless needed, and takes over the report descriptors the parent opened if the child got a copy
+    // of its descriptors (no CLONE_FILES), so the child doesn't open the report pipe again.
+    void inherit_parent_state(pid_t parentPid, bool sharesFileTable);
+
+    // Marks a descriptor the process just created as not being a file (a pipe, a socket, an anonymous file...),
+    // so accesses on it are discarded without looking it up. The mark is cleared with the rest of its entry.
+    void set_non_file_fd(int fd);
+
+    // Whether the given descriptor is known not to be a file (see set_non_file_fd)
+    bool is_non_file_fd(int fd) { return useFdTable_ && fdTable_.IsNonFile(fd); }
+
+    // Whether the enumeration of the given directory stream was already reported. readdir and friends
+    // report at the first call on a stream, the entry for its descriptor is cleared by closedir.
+    bool is_enumeration_reported(DIR *dirp) { return useFdTable_ && fdTable_.IsEnumerationReported(dirfd(dirp), dirp); }
+
+    // Marks the enumeration of the given directory stream as reported. Denied accesses are not marked, so they keep being denied.
+    void set_enumeration_reported(DIR *dirp, AccessCheckResult &check)
+    {
+        if (useFdTable_ && !should_deny(check))
+        {
+            fdTable_.SetEnumerationReported(dirfd(dirp), dirp);
+        }
+    }
+
+    // Forgets the cached report pipe descriptors that fall in [first, last]. Called when the traced process
+    // closes (or dups over) descriptors, so the next report opens the pipe again instead of writing to whatever reuses that fd.
+    void reset_report_fds(unsigned int first, unsigned int last);
+    void reset_report_fd(int fd) { if (fd >= 0) reset_report_fds(fd, fd); }
+
+    IoUringRings& io_uring_rings() { return ioUringRings_; }
+
     // Disables the FD table. Cannot be re-enabled for the remainder of the sandbox lifetime.
     void disable_fd_table();
     
@@ -442,11 +841,30 @@ public:
     // Checks whether a given path is an anonymous file (a file that lives in RAM and only exists until all references to that file are dropped)
     bool is_anonymous_file(string path);
 
-    // Enumerates a specified directory
-    bool EnumerateDirectory(std::string rootDirectory, bool recursive, std::vector<std::string>& filesAndDirectories);
+    // Enumerates a specified directory, calling the callback with the path of the directory itself and then of every file and directory
+    // under it, until the callback returns false. The path given to the callback is only valid during the call.
+    // Returns false if a directory could not be read (the callback may have been called for some of the entries already).
+    bool EnumerateDirectory(const std::string &rootDirectory, bool recursive, EnumerationCallback callback, void *context);
+
+    // Same as above, with any callable taking the path (e.g., a lambda)
+    template <typename Callback>
+    bool EnumerateDirectory(const std::string &rootDirectory, bool recursive, const Callback &callback)
+    {
+        return EnumerateDirectory(rootDirectory, recursive, [](const std::string &path, void *context) { return (*(const Callback *)context)(path); }, (void *)&callback);
+    }
 
     const char* getFamPath() const { return famPath_; };
 
+    // Whether statically linked processes are supervised with seccomp user notifications instead of ptrace stops (see PTraceSandbox)
+    bool IsSeccompUserNotificationEnabled() const { return pip_ && CheckEnableLinuxSandboxSeccompUserNotifications(pip_->GetFamExtraFlags()); }
+
+    /**
+     * Whether checking an access could produce a report (or a denial) for this pip, given the policy flags that allow the access and
+     * the ones that make it reported. This is only false when the manifest doesn't ask for all accesses to be reported and every
+     * policy in it allows the access without reporting it, so accesses of that kind don't need to be observed at all (see PTraceSandbox).
+     */
+    bool CanAccessBeReported(FileAccessPolicy allowingPolicy, FileAccessPolicy reportingPolicy) const;
+
     inline bool LogDebugEnabled()
     {
         if (pip_ == NULL)
@@ -456,7 +874,7 @@ public:
             return false;
         }
 
-        return sandboxLoggingEnabled_;
+        return sandboxLoggingEnabled_ || debugLog_.IsEnabled();
     }
 
     void LogDebug(pid_t pid, const char *fmt, ...);
@@ -495,16 +913,33 @@ public:
     {
         if (associatedPid == 0)
         {
-            return getcwd(fullpath, size);
+            return get_cwd(fullpath, size);
         }
         else
         {
+            if (cacheTraceeCwds_)
+            {
+                auto cwd = traceeCwds_.find(associatedPid);
+                if (cwd != traceeCwds_.end() && cwd->second.length() < size)
+                {
+                    memcpy(fullpath, cwd->second.c_str(), cwd->second.length() + 1);
+                    return fullpath;
+                }
+            }
+
             char linkPath[100] = {0};
             sprintf(linkPath, "/proc/%d/cwd", associatedPid);
-            if (real_readlink(linkPath, fullpath, size) == -1)
+            ssize_t length = real_readlink(linkPath, fullpath, size);
+            if (length == -1)
             {
                 return NULL;
             }
+
+            if (cacheTraceeCwds_ && (size_t)length < size)
+            {
+                fullpath[length] = '\0';
+                traceeCwds_[associatedPid].assign(fullpath, length);
+            }
             
             return fullpath;
         }
@@ -605,6 +1040,8 @@ public:
     GEN_FN_DEF(int, truncate64, const char *path, off_t length);
     GEN_FN_DEF(int, ftruncate64, int fd, off_t length);
     GEN_FN_DEF(int, rmdir, const char *pathname);
+    GEN_FN_DEF(int, chdir, const char *path);
+    GEN_FN_DEF(int, fchdir, int fd);
     GEN_FN_DEF(int, rename, const char *, const char *);
     GEN_FN_DEF(int, renameat, int olddirfd, const char *oldpath, int newdirfd, const char *newpath);
     GEN_FN_DEF(int, renameat2, int olddirfd, const char *oldpath, int newdirfd, const char *newpath, unsigned int flags);
@@ -650,6 +1087,13 @@ public:
     GEN_FN_DEF(int, dup, int oldfd);
     GEN_FN_DEF(int, dup2, int oldfd, int newfd);
     GEN_FN_DEF(int, dup3, int oldfd, int newfd, int flags);
+    GEN_FN_DEF(int, pipe, int pipefd[2]);
+    GEN_FN_DEF(int, pipe2, int pipefd[2], int flags);
+    GEN_FN_DEF(int, socket, int domain, int type, int protocol);
+    GEN_FN_DEF(int, socketpair, int domain, int type, int protocol, int sv[2]);
+    GEN_FN_DEF(int, memfd_create, const char *name, unsigned int flags);
+    GEN_FN_DEF(void *, mmap, void *addr, size_t length, int prot, int flags, int fd, off_t offset);
+    GEN_FN_DEF(int, mprotect, void *addr, size_t length, int prot);
     GEN_FN_DEF(int, scandir, const char * dirp, struct dirent *** namelist, int (*filter)(const struct dirent *), int (*compar)(const struct dirent **, const struct dirent **));
     GEN_FN_DEF(int, scandir64, const char * dirp, struct dirent64 *** namelist, int (*filter)(const struct dirent64  *), int (*compar)(const dirent64 **, const dirent64 **));
     GEN_FN_DEF(int, scandirat, int dirfd, const char * dirp, struct dirent *** namelist, int (*filter)(const struct dirent *), int (*compar)(const struct dirent **, const struct dirent **));
@@ -13,4 +13,17 @@
 #define BxlPTraceTracedPid "__BUILDXL_TRACED_PID"
 #define BxlPTraceTracedPath "__BUILDXL_TRACED_PATH"
 
+// Not set by BuildXL: the root process of a pip passes it down to its children
+#define BxlEnvSharedCacheFd "__BUILDXL_SHARED_CACHE_FD"
+
+// Not set by BuildXL: when set (to a file path), the accesses checked by the sandbox are recorded there for sandboxtracereplay (see sandbox_trace.hpp)
+#define BxlEnvSandboxTracePath "__BUILDXL_SANDBOX_TRACE_PATH"
+
+// Not set by BuildXL yet: when set (to a file path), every process of the pip counts its accesses and reports there (see access_statistics.hpp)
+#define BxlEnvAccessStatisticsPath "__BUILDXL_ACCESS_STATISTICS_PATH"
+
+// Not set by BuildXL yet: when set (to a directory), every process of the pip writes its debug messages to a binary log there
+// instead of sending them as reports (see debug_log.hpp)
+#define BxlEnvDebugLogDirectory "__BUILDXL_DEBUG_LOG_DIRECTORY"
+
 #endif //COMMON_H
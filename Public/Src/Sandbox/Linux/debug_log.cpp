@@ -0,0 +1,532 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <algorithm>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include "debug_log.hpp"
+
+static inline size_t AlignUp(size_t length)
+{
+    return (length + 7) & ~(size_t)7;
+}
+
+size_t DebugLog::GetFileSize()
+{
+    return AlignUp(sizeof(DebugLogHeader)) + FormatsCapacity + RecordsCapacity;
+}
+
+void DebugLog::Initialize(void *address, pid_t pid, const char *program)
+{
+    DebugLogHeader *header = (DebugLogHeader *)address;
+    header->version = DEBUG_LOG_VERSION;
+    header->pid = pid;
+    strncpy(header->program, program == nullptr ? "" : program, sizeof(header->program) - 1);
+    header->formatsOffset = AlignUp(sizeof(DebugLogHeader));
+    header->formatsCapacity = FormatsCapacity;
+    header->recordsOffset = header->formatsOffset + FormatsCapacity;
+    header->recordsCapacity = RecordsCapacity;
+    header->formatsTail = 0;
+    header->recordsTail = 0;
+
+    // Set last, so a log whose header isn't complete is not decoded
+    __atomic_store_n(&header->magic, DEBUG_LOG_MAGIC, __ATOMIC_RELEASE);
+}
+
+uint32_t DebugLog::Intern(const char *format, const FormatSlot *&slot)
+{
+    // Formats are literals: their address identifies them
+    size_t index = (size_t)((((uintptr_t)format >> 3) * 0x9E3779B97F4A7C15ULL) >> 32) % FormatSlots;
+    for (int probe = 0; probe < FormatSlots; probe++)
+    {
+        FormatSlot &candidate = formats_[(index + probe) % FormatSlots];
+        const char *current = candidate.format.load(std::memory_order_acquire);
+        if (current == nullptr && candidate.format.compare_exchange_strong(current, format))
+        {
+            // This thread copies the format to the table. Until it's done, other threads (or a signal handler interrupting
+            // this one) format their message right away rather than wait.
+            int typeCount = 0;
+            bool supported = true;
+            for (const char *percent = strchr(format, '%'); percent != nullptr; percent = strchr(percent, '%'))
+            {
+                size_t specLength = debug_log::ParseConversion(percent, candidate.types, typeCount);
+                if (specLength == 0)
+                {
+                    supported = false;
+                    break;
+                }
+
+                percent += specLength;
+            }
+
+            size_t formatLength = strlen(format);
+            size_t entryLength = AlignUp(sizeof(DebugLogFormat) + typeCount + formatLength);
+            uint64_t offset = supported && formatLength <= UINT16_MAX
+                ? header_->formatsTail.fetch_add(entryLength, std::memory_order_relaxed)
+                : header_->formatsCapacity;
+            if (offset + entryLength > header_->formatsCapacity)
+            {
+                candidate.id.store(UnsupportedFormat, std::memory_order_release);
+                return DebugLogPreformatted;
+            }
+
+            char *table = (char *)header_ + header_->formatsOffset;
+            DebugLogFormat *entry = (DebugLogFormat *)(table + offset);
+            entry->argumentCount = (uint16_t)typeCount;
+            entry->formatLength = (uint16_t)formatLength;
+            memcpy((char *)(entry + 1), candidate.types, typeCount);
+            memcpy((char *)(entry + 1) + typeCount, format, formatLength);
+            entry->length.store((uint32_t)entryLength, std::memory_order_release);
+
+            candidate.argumentCount = (uint8_t)typeCount;
+            candidate.id.store((uint32_t)offset + 1, std::memory_order_release);
+            slot = &candidate;
+            return (uint32_t)offset;
+        }
+
+        if (current == format)
+        {
+            uint32_t id = candidate.id.load(std::memory_order_acquire);
+            if (id == PendingFormat || id == UnsupportedFormat)
+            {
+                return DebugLogPreformatted;
+            }
+
+            slot = &candidate;
+            return id - 1;
+        }
+    }
+
+    // Too many formats
+    return DebugLogPreformatted;
+}
+
+void DebugLog::Write(pid_t pid, const char *format, va_list arguments)
+{
+    if (header_ == nullptr)
+    {
+        return;
+    }
+
+    alignas(8) char buffer[MaxRecordSize];
+    DebugLogRecord *record = (DebugLogRecord *)buffer;
+    size_t length = sizeof(DebugLogRecord);
+
+    const FormatSlot *slot = nullptr;
+    uint32_t formatId = Intern(format, slot);
+    if (formatId == DebugLogPreformatted)
+    {
+        char *text = buffer + length + sizeof(uint32_t);
+        size_t available = MaxRecordSize - length - sizeof(uint32_t);
+        int written = vsnprintf(text, available, format, arguments);
+        uint32_t textLength = written < 0 ? 0 : (uint32_t)((size_t)written < available ? written : available - 1);
+        memcpy(buffer + length, &textLength, sizeof(textLength));
+        length += sizeof(textLength) + textLength;
+    }
+    else
+    {
+        for (int i = 0; i < slot->argumentCount; i++)
+        {
+            uint64_t value = 0;
+            switch (slot->types[i])
+            {
+                case DebugLogInt:
+                    value = (uint64_t)(int64_t)va_arg(arguments, int);
+                    break;
+                case DebugLogLong:
+                    value = (uint64_t)va_arg(arguments, long);
+                    break;
+                case DebugLogPointer:
+                    value = (uint64_t)(uintptr_t)va_arg(arguments, void *);
+                    break;
+                case DebugLogDouble:
+                {
+                    double number = va_arg(arguments, double);
+                    memcpy(&value, &number, sizeof(value));
+                    break;
+                }
+                case DebugLogString:
+                {
+                    // Leave room for the arguments that follow (8 bytes each at most) and the padding
+                    const char *string = va_arg(arguments, const char *);
+                    size_t reserved = length + sizeof(uint32_t) + 8 * (slot->argumentCount - i - 1) + 8;
+                    size_t available = reserved < MaxRecordSize ? MaxRecordSize - reserved : 0;
+                    uint32_t stringLength = string == nullptr ? UINT32_MAX : (uint32_t)strnlen(string, available);
+                    memcpy(buffer + length, &stringLength, sizeof(stringLength));
+                    length += sizeof(stringLength);
+                    if (string != nullptr)
+                    {
+                        memcpy(buffer + length, string, stringLength);
+                        length += stringLength;
+                    }
+
+                    continue;
+                }
+            }
+
+            memcpy(buffer + length, &value, sizeof(value));
+            length += sizeof(value);
+        }
+    }
+
+    length = AlignUp(length);
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    record->length = (uint32_t)length;
+    record->timestampNs = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+    record->pid = pid;
+    record->tid = (pid_t)syscall(SYS_gettid);
+    record->formatId = formatId;
+    record->reserved = 0;
+    Append(buffer, length);
+}
+
+void DebugLog::Append(const char *record, size_t length)
+{
+    // Records don't wrap around the end of the ring: one that doesn't fit its end starts over at its beginning
+    uint64_t capacity = header_->recordsCapacity;
+    uint64_t tail = header_->recordsTail.load(std::memory_order_relaxed);
+    uint64_t position;
+    do
+    {
+        uint64_t offset = tail % capacity;
+        position = offset + length > capacity ? tail + (capacity - offset) : tail;
+    } while (!header_->recordsTail.compare_exchange_weak(tail, position + length, std::memory_order_relaxed));
+
+    // The slot may still hold a record from the previous lap: invalidate it before overwriting it, and only
+    // validate the new one once it is complete, so a process killed halfway doesn't leave a garbled record behind
+    char *ring = (char *)header_ + header_->recordsOffset;
+    DebugLogRecord *destination = (DebugLogRecord *)(ring + position % capacity);
+    destination->magic.store(0, std::memory_order_relaxed);
+    destination->position = position;
+    destination->length = (uint32_t)length;
+    memcpy((char *)destination + offsetof(DebugLogRecord, timestampNs), record + offsetof(DebugLogRecord, timestampNs),
+           length - offsetof(DebugLogRecord, timestampNs));
+    destination->magic.store(DEBUG_LOG_RECORD_MAGIC, std::memory_order_release);
+}
+
+namespace debug_log
+{
+    static bool AddType(char type, char *types, int &typeCount)
+    {
+        if (typeCount == DebugLog::MaxArguments)
+        {
+            return false;
+        }
+
+        types[typeCount++] = type;
+        return true;
+    }
+
+    size_t ParseConversion(const char *spec, char *types, int &typeCount)
+    {
+        const char *current = spec + 1;
+        if (*current == '%')
+        {
+            return 2;
+        }
+
+        // Flags, width and precision
+        while (*current != '\0' && strchr("-+ #0'", *current) != nullptr)
+        {
+            current++;
+        }
+
+        for (int part = 0; part < 2; part++)
+        {
+            if (part == 1)
+            {
+                if (*current != '.')
+                {
+                    break;
+                }
+
+                current++;
+            }
+
+            if (*current == '*')
+            {
+                if (!AddType(DebugLogInt, types, typeCount))
+                {
+                    return 0;
+                }
+
+                current++;
+            }
+            else
+            {
+                while (*current >= '0' && *current <= '9')
+                {
+                    current++;
+                }
+            }
+        }
+
+        // Length modifiers: all the integers wider than int are 64 bits wide
+        bool isLong = false;
+        if (*current == 'h')
+        {
+            current += current[1] == 'h' ? 2 : 1;
+        }
+        else if (*current == 'l')
+        {
+            isLong = true;
+            current += current[1] == 'l' ? 2 : 1;
+        }
+        else if (*current == 'z' || *current == 'j' || *current == 't')
+        {
+            isLong = true;
+            current++;
+        }
+
+        char type;
+        switch (*current)
+        {
+            case 'd': case 'i': case 'u': case 'x': case 'X': case 'o':
+                type = isLong ? DebugLogLong : DebugLogInt;
+                break;
+            case 'c':
+                type = DebugLogInt;
+                break;
+            case 'p':
+                type = DebugLogPointer;
+                break;
+            case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+                type = DebugLogDouble;
+                break;
+            case 's':
+                type = DebugLogString;
+                break;
+            default:
+                // '%n', '%m', long doubles ('L') and anything else
+                return 0;
+        }
+
+        // Wide characters and strings
+        if (isLong && (type == DebugLogString || *current == 'c'))
+        {
+            return 0;
+        }
+
+        return AddType(type, types, typeCount) ? (size_t)(current - spec) + 1 : 0;
+    }
+
+    template <typename T> static void AppendFormatted(std::string &text, const char *spec, const int *stars, int starCount, T value)
+    {
+        char buffer[512];
+        int length = starCount == 0 ? snprintf(buffer, sizeof(buffer), spec, value)
+            : starCount == 1 ? snprintf(buffer, sizeof(buffer), spec, stars[0], value)
+            : snprintf(buffer, sizeof(buffer), spec, stars[0], stars[1], value);
+        if (length < 0)
+        {
+            return;
+        }
+
+        if ((size_t)length < sizeof(buffer))
+        {
+            text.append(buffer, length);
+            return;
+        }
+
+        std::vector<char> large(length + 1);
+        starCount == 0 ? snprintf(large.data(), large.size(), spec, value)
+            : starCount == 1 ? snprintf(large.data(), large.size(), spec, stars[0], value)
+            : snprintf(large.data(), large.size(), spec, stars[0], stars[1], value);
+        text.append(large.data(), length);
+    }
+
+    // Formats the message of 'format' with the arguments in the 'length' bytes at 'arguments'
+    static void FormatMessage(const char *format, size_t formatLength, const char *arguments, size_t length, std::string &text)
+    {
+        std::string formatString(format, formatLength);
+        const char *current = formatString.c_str();
+        const char *end = arguments + length;
+        while (*current != '\0')
+        {
+            const char *percent = strchr(current, '%');
+            if (percent == nullptr)
+            {
+                text.append(current);
+                return;
+            }
+
+            text.append(current, percent - current);
+
+            char types[DebugLog::MaxArguments];
+            int typeCount = 0;
+            size_t specLength = ParseConversion(percent, types, typeCount);
+            if (specLength == 0 || specLength >= 64)
+            {
+                text.append("<unsupported format>");
+                return;
+            }
+
+            current = percent + specLength;
+            if (typeCount == 0)
+            {
+                text.append("%");
+                continue;
+            }
+
+            char spec[64];
+            memcpy(spec, percent, specLength);
+            spec[specLength] = '\0';
+
+            // All the types but the last one are '*' widths and precisions
+            int stars[2];
+            for (int i = 0; i < typeCount - 1; i++)
+            {
+                uint64_t star;
+                if (end - arguments < (ptrdiff_t)sizeof(star))
+                {
+                    text.append("<truncated>");
+                    return;
+                }
+
+                memcpy(&star, arguments, sizeof(star));
+                arguments += sizeof(star);
+                stars[i] = (int)(int64_t)star;
+            }
+
+            int starCount = typeCount - 1;
+            char type = types[typeCount - 1];
+            if (type == DebugLogString)
+            {
+                uint32_t stringLength;
+                if (end - arguments < (ptrdiff_t)sizeof(stringLength))
+                {
+                    text.append("<truncated>");
+                    return;
+                }
+
+                memcpy(&stringLength, arguments, sizeof(stringLength));
+                arguments += sizeof(stringLength);
+                if (stringLength == UINT32_MAX)
+                {
+                    AppendFormatted(text, spec, stars, starCount, "(null)");
+                    continue;
+                }
+
+                if (end - arguments < (ptrdiff_t)stringLength)
+                {
+                    text.append("<truncated>");
+                    return;
+                }
+
+                std::string string(arguments, stringLength);
+                arguments += stringLength;
+                AppendFormatted(text, spec, stars, starCount, string.c_str());
+                continue;
+            }
+
+            uint64_t value;
+            if (end - arguments < (ptrdiff_t)sizeof(value))
+            {
+                text.append("<truncated>");
+                return;
+            }
+
+            memcpy(&value, arguments, sizeof(value));
+            arguments += sizeof(value);
+            switch (type)
+            {
+                case DebugLogInt:
+                    AppendFormatted(text, spec, stars, starCount, (int)(int64_t)value);
+                    break;
+                case DebugLogLong:
+                    AppendFormatted(text, spec, stars, starCount, (long)value);
+                    break;
+                case DebugLogPointer:
+                    AppendFormatted(text, spec, stars, starCount, (void *)(uintptr_t)value);
+                    break;
+                case DebugLogDouble:
+                {
+                    double number;
+                    memcpy(&number, &value, sizeof(number));
+                    AppendFormatted(text, spec, stars, starCount, number);
+                    break;
+                }
+            }
+        }
+    }
+
+    static void DecodeRecord(const DebugLogHeader *header, const char *content, uint64_t formatsTail, const DebugLogRecord *record, std::string &text)
+    {
+        const char *arguments = (const char *)(record + 1);
+        size_t length = record->length - sizeof(DebugLogRecord);
+        if (record->formatId == DebugLogPreformatted)
+        {
+            uint32_t textLength;
+            if (length < sizeof(textLength))
+            {
+                return;
+            }
+
+            memcpy(&textLength, arguments, sizeof(textLength));
+            text.assign(arguments + sizeof(textLength), std::min((size_t)textLength, length - sizeof(textLength)));
+            return;
+        }
+
+        const char *table = content + header->formatsOffset;
+        const DebugLogFormat *entry = (const DebugLogFormat *)(table + record->formatId);
+        uint32_t entryLength = record->formatId + sizeof(DebugLogFormat) <= formatsTail ? entry->length.load(std::memory_order_acquire) : 0;
+        if (entryLength == 0 || record->formatId + entryLength > formatsTail ||
+            sizeof(DebugLogFormat) + entry->argumentCount + entry->formatLength > entryLength)
+        {
+            text.assign("<unknown format>");
+            return;
+        }
+
+        FormatMessage((const char *)(entry + 1) + entry->argumentCount, entry->formatLength, arguments, length, text);
+    }
+
+    bool Decode(const char *content, size_t size, std::vector<Message> &messages, std::string &program)
+    {
+        const DebugLogHeader *header = (const DebugLogHeader *)content;
+        if (size < sizeof(DebugLogHeader) || header->magic != DEBUG_LOG_MAGIC || header->version != DEBUG_LOG_VERSION ||
+            header->formatsOffset + header->formatsCapacity > size || header->recordsOffset + header->recordsCapacity > size ||
+            header->recordsCapacity < sizeof(DebugLogRecord))
+        {
+            return false;
+        }
+
+        program.assign(header->program, strnlen(header->program, sizeof(header->program)));
+        uint64_t formatsTail = std::min(header->formatsTail.load(), header->formatsCapacity);
+        uint64_t capacity = header->recordsCapacity;
+        uint64_t tail = header->recordsTail.load();
+        const char *ring = content + header->recordsOffset;
+
+        // Only the last lap of the ring is still there. Records that were never completed (or were written over), and the
+        // ends of the ring no record fitted in, are skipped by looking for the next record written where it's found.
+        uint64_t position = AlignUp(tail > capacity ? tail - capacity : 0);
+        while (position + sizeof(DebugLogRecord) <= tail)
+        {
+            uint64_t offset = position % capacity;
+            if (offset + sizeof(DebugLogRecord) > capacity)
+            {
+                position += capacity - offset;
+                continue;
+            }
+
+            const DebugLogRecord *record = (const DebugLogRecord *)(ring + offset);
+            if (record->position != position || record->magic.load(std::memory_order_acquire) != DEBUG_LOG_RECORD_MAGIC ||
+                record->length < sizeof(DebugLogRecord) || record->length % 8 != 0 || offset + record->length > capacity ||
+                position + record->length > tail)
+            {
+                position += 8;
+                continue;
+            }
+
+            Message message = { record->timestampNs, record->pid, record->tid, std::string() };
+            DecodeRecord(header, content, formatsTail, record, message.text);
+            messages.push_back(std::move(message));
+            position += record->length;
+        }
+
+        return true;
+    }
+}
@@ -0,0 +1,147 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <atomic>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+/**
+ * Binary log of the debug messages of the sandbox (LOG_DEBUG), written when BxlEnvDebugLogDirectory is set and decoded
+ * offline by debuglogdecoder. Otherwise every message is formatted, sanitized and sent as a report through the report
+ * pipe, which slows down the pip enough to change what is being debugged.
+ *
+ * Every process that loads the sandbox maps a file of its own in that directory. Children forked without exec keep
+ * writing to the file of their parent (the mapping is shared), which is why records carry a pid. The file holds:
+ *  - the header below,
+ *  - a table of the formats of the messages, each one copied once along with the types of its arguments,
+ *  - a ring of records, each one the id of a format followed by the raw arguments (the contents of strings are copied).
+ * Messages are only formatted by the decoder. The ring keeps the latest records: the oldest ones are overwritten.
+ */
+#define DEBUG_LOG_MAGIC 0x474F4C42444C5842ULL // "BXLDBLOG"
+#define DEBUG_LOG_VERSION 1
+#define DEBUG_LOG_RECORD_MAGIC 0x43455244 // "DREC"
+#define DEBUG_LOG_FILE_EXTENSION ".bxldbg"
+
+struct DebugLogHeader
+{
+    uint64_t magic;
+    uint32_t version;
+    int32_t pid;
+    char program[64];
+    uint64_t formatsOffset;             // from the start of the file
+    uint64_t formatsCapacity;
+    uint64_t recordsOffset;
+    uint64_t recordsCapacity;
+    std::atomic<uint64_t> formatsTail;  // bytes of the table taken
+    std::atomic<uint64_t> recordsTail;  // bytes ever taken in the ring: the position of the next record
+};
+
+// Entry of the table of formats, followed by the types of the arguments and the format (not null-terminated).
+// The id of a format is the offset of its entry in the table.
+struct DebugLogFormat
+{
+    std::atomic<uint32_t> length;       // bytes taken by the entry, padding included; set last
+    uint16_t argumentCount;
+    uint16_t formatLength;
+};
+
+// Record of the ring, followed by its arguments. Integers, pointers and doubles take 8 bytes; strings take their
+// length (4 bytes, UINT32_MAX for a null string) followed by their contents. Records are padded to a multiple of 8 bytes.
+struct DebugLogRecord
+{
+    uint64_t position;                  // where the record was written in the ring, which tells it apart from older ones
+    uint32_t length;                    // bytes taken by the record, arguments and padding included
+    std::atomic<uint32_t> magic;        // set last
+    uint64_t timestampNs;               // CLOCK_MONOTONIC
+    int32_t pid;
+    int32_t tid;
+    uint32_t formatId;                  // DebugLogPreformatted for messages formatted right away (a single string argument)
+    uint32_t reserved;
+};
+
+static_assert(sizeof(DebugLogRecord) % 8 == 0, "Records must stay 8-byte aligned");
+
+// Types of the arguments of a format, one per argument (including the ones of '*' widths and precisions)
+enum DebugLogArgumentType : char
+{
+    DebugLogInt = 'i',                  // int (and char)
+    DebugLogLong = 'l',                 // long, long long, size_t and the like
+    DebugLogPointer = 'p',
+    DebugLogDouble = 'd',
+    DebugLogString = 's',
+};
+
+static const uint32_t DebugLogPreformatted = UINT32_MAX;
+
+/**
+ * Writes the debug messages of this process to a mapped debug log (see Use); when there is none, writing is a no-op.
+ */
+class DebugLog
+{
+public:
+    static const size_t FormatsCapacity = 64 * 1024;
+    static const size_t RecordsCapacity = 4 * 1024 * 1024;
+    static const int MaxArguments = 16;
+    static const size_t MaxRecordSize = 2048;
+
+    // Bytes taken by a debug log
+    static size_t GetFileSize();
+
+    // Lays out an empty debug log in the GetFileSize() bytes at 'address' (e.g., a zero-filled file just mapped)
+    static void Initialize(void *address, pid_t pid, const char *program);
+
+    // Writes to the debug log at 'address', laid out by Initialize
+    void Use(void *address) { header_ = (DebugLogHeader *)address; }
+
+    bool IsEnabled() const { return header_ != nullptr; }
+
+    // Writes a record for the message 'format' with 'arguments'.
+    // 'format' must outlive the process (e.g., a literal): records refer to it by address until it is copied to the table.
+    void Write(pid_t pid, const char *format, va_list arguments);
+
+private:
+    // Formats seen by this process, by address: the types of their arguments and their id in the table
+    static const int FormatSlots = 512;
+    static const uint32_t PendingFormat = 0;
+    static const uint32_t UnsupportedFormat = UINT32_MAX;
+
+    struct FormatSlot
+    {
+        std::atomic<const char *> format;
+        std::atomic<uint32_t> id;       // offset in the table + 1, PendingFormat or UnsupportedFormat
+        uint8_t argumentCount;
+        char types[MaxArguments];
+    };
+
+    // Id of the entry of 'format' in the table, or DebugLogPreformatted if the message must be formatted right away
+    uint32_t Intern(const char *format, const FormatSlot *&slot);
+    void Append(const char *record, size_t length);
+
+    DebugLogHeader *header_ = nullptr;
+    FormatSlot formats_[FormatSlots] = {};
+};
+
+namespace debug_log
+{
+    // Length of the conversion specification at 'spec' (which starts with '%'), whose argument types are appended to 'types'
+    // (at most MaxArguments in total). Returns 0 for conversions that can't be recorded (e.g., '%n' or wide strings).
+    size_t ParseConversion(const char *spec, char *types, int &typeCount);
+
+    // A decoded record
+    struct Message
+    {
+        uint64_t timestampNs;
+        pid_t pid;
+        pid_t tid;
+        std::string text;
+    };
+
+    // Decodes the records of the debug log in the 'size' bytes at 'content', oldest first. Returns false if it is not a debug log.
+    bool Decode(const char *content, size_t size, std::vector<Message> &messages, std::string &program);
+}
@@ -0,0 +1,75 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <algorithm>
+#include <fstream>
+#include <inttypes.h>
+#include <iostream>
+#include <iterator>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "debug_log.hpp"
+
+struct DecodedMessage
+{
+    debug_log::Message message;
+    const std::string *program;
+};
+
+static bool ReadFile(const char *path, std::vector<char> &content)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        return false;
+    }
+
+    content.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return true;
+}
+
+// Decodes the debug logs written by the sandbox (see debug_log.hpp) and prints their messages, merged in the order they were written
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " <debug log>..." << std::endl;
+        return 1;
+    }
+
+    // Programs are referred to by the messages: the vector must not reallocate
+    std::vector<std::string> programs(argc - 1);
+    std::vector<DecodedMessage> messages;
+    int result = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        std::vector<char> content;
+        std::vector<debug_log::Message> decoded;
+        if (!ReadFile(argv[i], content) || !debug_log::Decode(content.data(), content.size(), decoded, programs[i - 1]))
+        {
+            std::cerr << "Could not decode debug log '" << argv[i] << "'" << std::endl;
+            result = 1;
+            continue;
+        }
+
+        for (debug_log::Message &message : decoded)
+        {
+            messages.push_back({ std::move(message), &programs[i - 1] });
+        }
+    }
+
+    std::stable_sort(messages.begin(), messages.end(), [](const DecodedMessage &left, const DecodedMessage &right)
+    {
+        return left.message.timestampNs < right.message.timestampNs;
+    });
+
+    for (const DecodedMessage &decoded : messages)
+    {
+        printf("%" PRIu64 ".%09" PRIu64 " %s:%d:%d %s\n", decoded.message.timestampNs / 1000000000, decoded.message.timestampNs % 1000000000,
+            decoded.program->c_str(), decoded.message.pid, decoded.message.tid, decoded.message.text.c_str());
+    }
+
+    return result;
+}
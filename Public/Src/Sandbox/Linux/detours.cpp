@@ -11,6 +11,8 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <atomic>
+#include <mutex>
 #include <dlfcn.h>
 #include <unistd.h>
 #include <gnu/lib-names.h>
@@ -22,6 +24,7 @@
 #include <sys/sysmacros.h>
 #include <sys/fcntl.h>
 #include <sys/xattr.h>
+#include <vector>
 
 #include "bxl_observer.hpp"
 #include "observer_utilities.hpp"
@@ -38,9 +41,19 @@ static int get_errno_from_result(result_t<int> result)
 }
 
 INTERPOSE(int, statx, int dirfd, const char * pathname, int flags, unsigned int mask, struct statx * statxbuf)({
+    uint64_t probeContext;
+    if (bxl->is_probe_cache_hit(ES_EVENT_TYPE_NOTIFY_STAT, dirfd, pathname, /* oflags */ 0, probeContext))
+    {
+        return bxl->fwd_statx(dirfd, pathname, flags, mask, statxbuf).restore();
+    }
+
     AccessReportGroup report;
     auto check = bxl->create_access_at(__func__, ES_EVENT_TYPE_NOTIFY_STAT, dirfd, pathname, report);
-    return bxl->check_fwd_and_report_statx(report, check, ERROR_RETURN_VALUE, dirfd, pathname, flags, mask, statxbuf);
+    int result = bxl->check_fwd_and_report_statx(report, check, ERROR_RETURN_VALUE, dirfd, pathname, flags, mask, statxbuf);
+    int error = errno;
+    bxl->add_probe_cache_entry(ES_EVENT_TYPE_NOTIFY_STAT, probeContext, pathname, check, result == 0 ? 0 : error);
+    errno = error;
+    return result;
 })
 
 
@@ -84,32 +97,61 @@ INTERPOSE(int, scandirat64, int dirfd, const char * dirp,
     return bxl->check_fwd_and_report_scandirat64(report, check, ERROR_RETURN_VALUE, dirfd, dirp, namelist, filter, compar);
 })
 
+// Enumerating a directory is reported once per stream: the managed side only cares about the directory being enumerated
 INTERPOSE(struct dirent *, readdir, DIR *dirp)
 ({
+    if (bxl->is_enumeration_reported(dirp))
+    {
+        return bxl->fwd_readdir(dirp).restore();
+    }
+
     AccessReportGroup report;
     auto check = bxl->create_access_fd(__func__, ES_EVENT_TYPE_NOTIFY_READDIR, dirfd(dirp), report);
-    return bxl->check_fwd_and_report_readdir(report, check, (struct dirent *)NULL, dirp);
+    struct dirent * returnValue = bxl->check_fwd_and_report_readdir(report, check, (struct dirent *)NULL, dirp);
+    bxl->set_enumeration_reported(dirp, check);
+    return returnValue;
 })
 
 INTERPOSE(struct dirent64 *, readdir64, DIR *dirp)
 ({
+    if (bxl->is_enumeration_reported(dirp))
+    {
+        return bxl->fwd_readdir64(dirp).restore();
+    }
+
     AccessReportGroup report;
     auto check = bxl->create_access_fd(__func__, ES_EVENT_TYPE_NOTIFY_READDIR, dirfd(dirp), report);
-    return bxl->check_fwd_and_report_readdir64(report, check, (struct dirent64 *)NULL, dirp);
+    struct dirent64 * returnValue = bxl->check_fwd_and_report_readdir64(report, check, (struct dirent64 *)NULL, dirp);
+    bxl->set_enumeration_reported(dirp, check);
+    return returnValue;
 })
 
 INTERPOSE(int, readdir_r, DIR *dirp, struct dirent *entry, struct dirent **result)
 ({
+    if (bxl->is_enumeration_reported(dirp))
+    {
+        return bxl->fwd_readdir_r(dirp, entry, result).restore();
+    }
+
     AccessReportGroup report;
     auto check = bxl->create_access_fd(__func__, ES_EVENT_TYPE_NOTIFY_READDIR, dirfd(dirp), report);
-    return bxl->check_fwd_and_report_readdir_r(report, check, ERROR_RETURN_VALUE, dirp, entry, result);
+    int returnValue = bxl->check_fwd_and_report_readdir_r(report, check, ERROR_RETURN_VALUE, dirp, entry, result);
+    bxl->set_enumeration_reported(dirp, check);
+    return returnValue;
 })
 
 INTERPOSE(int, readdir64_r, DIR *dirp, struct dirent64 *entry, struct dirent64 **result)
 ({
+    if (bxl->is_enumeration_reported(dirp))
+    {
+        return bxl->fwd_readdir64_r(dirp, entry, result).restore();
+    }
+
     AccessReportGroup report;
     auto check = bxl->create_access_fd(__func__, ES_EVENT_TYPE_NOTIFY_READDIR, dirfd(dirp), report);
-    return bxl->check_fwd_and_report_readdir64_r(report, check, ERROR_RETURN_VALUE, dirp, entry, result);
+    int returnValue = bxl->check_fwd_and_report_readdir64_r(report, check, ERROR_RETURN_VALUE, dirp, entry, result);
+    bxl->set_enumeration_reported(dirp, check);
+    return returnValue;
 })
 
 INTERPOSE(void, _exit, int status)({
@@ -128,7 +170,7 @@ static void report_child_process(const char *syscall, BxlObserver *bxl, pid_t ch
     bxl->report_access(syscall, event);
 }
 
-static void HandleForkOrCloneReporting(const char *syscall, BxlObserver *bxl, pid_t forkOrCloneChildPidResult)
+static void HandleForkOrCloneReporting(const char *syscall, BxlObserver *bxl, pid_t forkOrCloneChildPidResult, bool sharesFileTable = false)
 {
     // We report process creation for both parent and child cases. These generates two reports, but we actually need both to avoid some race conditions:
     // - Process creation is reported on the child to guarantee that we see the process creation arriving as a report line before
@@ -139,12 +181,14 @@ static void HandleForkOrCloneReporting(const char *syscall, BxlObserver *bxl, pi
     //   seen the child process creation report yet. In this case we'll send an EOM sentinel to the FIFO that we want to arrive *after* the process creation report, so we can actually be
     //   sure whether we can tear down the FIFO (if we reported on the child only, we could detect that the parent process is not alive anymore and send the sentinel only to get the process
     //   start report - reported by the child - after we decided that no more messages should arrive).
+    // Since the report from the parent is the one that keeps the process count right, the report from the child is not sent right away
+    // when reports are batched: it shares a write with the next reports of the child. Very often the child only execs, so forking
+    // costs it no syscall beyond that write.
     if (forkOrCloneChildPidResult == 0)
     {
-        // Clear the file descriptor table when we are in the child process
-        // File descriptors are unique to a process, so this cache needs to be invalidated on the child
-        bxl->reset_fd_table();
-        report_child_process(syscall, bxl, getpid(), getppid());
+        pid_t parentPid = getppid();
+        bxl->inherit_parent_state(parentPid, sharesFileTable);
+        report_child_process(syscall, bxl, getpid(), parentPid);
     }
     else
     {
@@ -160,7 +204,31 @@ static int ret_fd(int fd, BxlObserver *bxl)
     return fd;
 }
 
+static int ret_dup_fd(int oldfd, int newfd, BxlObserver *bxl)
+{
+    // A duplicate refers to the same open file description: if the original is known not to be a file, neither is the duplicate
+    if (newfd != -1 && bxl->is_non_file_fd(oldfd))
+    {
+        bxl->set_non_file_fd(newfd);
+    }
+
+    return newfd;
+}
+
+static int ret_non_file_fd(int fd, BxlObserver *bxl)
+{
+    if (fd != -1)
+    {
+        bxl->set_non_file_fd(fd);
+    }
+
+    return fd;
+}
+
 INTERPOSE(pid_t, fork, void)({
+    // Reports made before the fork should reach the pipe before any report from the child
+    bxl->FlushReportBatches();
+    bxl->OpenMessageCountingSemaphore();
     result_t<pid_t> childPid = bxl->fwd_fork();
 
     HandleForkOrCloneReporting(__func__, bxl, childPid.get());
@@ -175,6 +243,8 @@ INTERPOSE(pid_t, vfork, void)({
     // including returning from the interpose callback.
     // On the other hand, vfork is almost obsolete at this point and has been removed from the POSIX.1-2008 already.
     // Modern Linux distributions should be able to call fork directly with none or minimal perf differences. 
+    bxl->FlushReportBatches();
+    bxl->OpenMessageCountingSemaphore();
     result_t<pid_t> childPid = bxl->fwd_fork();
 
     HandleForkOrCloneReporting(__func__, bxl, childPid.get());
@@ -190,12 +260,24 @@ INTERPOSE(int, clone, int (*fn)(void *), void *child_stack, int flags, void *arg
     pid_t *ctid = va_arg(args, pid_t*);
     va_end(args);
 
+    if (!(flags & CLONE_THREAD))
+    {
+        bxl->FlushReportBatches();
+        bxl->OpenMessageCountingSemaphore();
+
+        // Neither process would see the other change the working directory they share (the child runs 'fn' and never returns here)
+        if (flags & CLONE_FS)
+        {
+            bxl->disable_cwd_cache();
+        }
+    }
+
     result_t<int> result = bxl->fwd_clone(fn, child_stack, flags, arg, ptid, newtls, ctid);
     
     // We don't want to report any process creation if clone was asked to create a new thread (and not a new process)
     if (!(flags & CLONE_THREAD))
     {
-        HandleForkOrCloneReporting(__func__, bxl, result.get());
+        HandleForkOrCloneReporting(__func__, bxl, result.get(), (flags & CLONE_FILES) != 0);
     }
 
     return result.restore();
@@ -283,7 +365,7 @@ INTERPOSE(int, execvp, const char *file, char *const argv[])({
 
     mode_t mode = 0;
     std::string pathname;
-    auto path_resolution_result = resolve_filename_with_env(file, mode, pathname);
+    auto path_resolution_result = bxl->resolve_filename_with_path(file, mode, pathname);
 
     if (path_resolution_result)
     {
@@ -312,7 +394,7 @@ INTERPOSE(int, execvpe, const char *file, char *const argv[], char *const envp[]
 
     mode_t mode = 0;
     std::string pathname;
-    auto path_resolution_result = resolve_filename_with_env(file, mode, pathname);
+    auto path_resolution_result = bxl->resolve_filename_with_path(file, mode, pathname);
 
     // If the path couldn't be resolved, then the exec will likely fail anyways
     if (path_resolution_result)
@@ -380,7 +462,7 @@ INTERPOSE(int, execlp, const char *file, const char *arg, ...)({
 
     mode_t mode = 0;
     std::string pathname;
-    auto path_resolution_result = resolve_filename_with_env(file, mode, pathname);
+    auto path_resolution_result = bxl->resolve_filename_with_path(file, mode, pathname);
 
     if (path_resolution_result)
     {
@@ -744,7 +826,9 @@ INTERPOSE(ssize_t, pwrite64, int fd, const void *buf, size_t count, off_t offset
 INTERPOSE(int, remove, const char *pathname)({
     AccessReportGroup report;
     auto check = bxl->create_access(__func__, ES_EVENT_TYPE_NOTIFY_UNLINK, pathname, report, /*mode*/0, O_NOFOLLOW);
-    return bxl->check_fwd_and_report_remove(report, check, ERROR_RETURN_VALUE, pathname);
+    int result = bxl->check_fwd_and_report_remove(report, check, ERROR_RETURN_VALUE, pathname);
+    bxl->invalidate_resolved_paths();
+    return result;
 })
 
 INTERPOSE(int, truncate, const char *path, off_t length)({
@@ -767,54 +851,350 @@ INTERPOSE(int, ftruncate64, int fd, off_t length)({
     return ftruncate(fd, length);
 })
 
+#if defined(SYS_mmap) && defined(SYS_mprotect) && defined(SYS_munmap)
+// Shared mappings of a file that are not writable (yet), but whose descriptor was open for writing, so mprotect can make them writable.
+// The write is reported by the mprotect that does, if any.
+struct MprotectableSharedMapping
+{
+    uintptr_t start;
+    uintptr_t end;
+    char path[PATH_MAX];
+};
+
+static const int MaxMprotectableSharedMappings = 16;
+static MprotectableSharedMapping s_mprotectableSharedMappings[MaxMprotectableSharedMappings];
+static std::atomic<int> s_mprotectableSharedMappingCount { 0 };
+static std::mutex s_mprotectableSharedMappingsLock;
+
+static bool is_open_for_writing(int fd)
+{
+    // fcntl is interposed (and variadic), go straight to the kernel
+    int old = errno;
+    long flags = syscall(SYS_fcntl, fd, F_GETFL);
+    errno = old;
+    return flags != -1 && (flags & O_ACCMODE) != O_RDONLY;
+}
+
+static bool remember_mprotectable_shared_mapping(void *addr, size_t length, const std::string &path)
+{
+    std::lock_guard<std::mutex> lock(s_mprotectableSharedMappingsLock);
+    int count = s_mprotectableSharedMappingCount.load();
+    if (count == MaxMprotectableSharedMappings || path.length() >= PATH_MAX)
+    {
+        return false;
+    }
+
+    MprotectableSharedMapping &mapping = s_mprotectableSharedMappings[count];
+    mapping.start = (uintptr_t)addr;
+    mapping.end = (uintptr_t)addr + length;
+    memcpy(mapping.path, path.c_str(), path.length() + 1);
+    s_mprotectableSharedMappingCount = count + 1;
+    return true;
+}
+
+// Forgets the mappings that overlap [addr, addr + length): their address range is unmapped or reused
+static void forget_mprotectable_shared_mappings(void *addr, size_t length)
+{
+    if (s_mprotectableSharedMappingCount.load() == 0)
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(s_mprotectableSharedMappingsLock);
+    int count = s_mprotectableSharedMappingCount.load();
+    for (int i = count - 1; i >= 0; i--)
+    {
+        if (s_mprotectableSharedMappings[i].start < (uintptr_t)addr + length && (uintptr_t)addr < s_mprotectableSharedMappings[i].end)
+        {
+            s_mprotectableSharedMappings[i] = s_mprotectableSharedMappings[--count];
+        }
+    }
+
+    s_mprotectableSharedMappingCount = count;
+}
+
+// Copies the path of a mapping that overlaps [addr, addr + length) into 'path'. Returns false if there is none.
+static bool find_mprotectable_shared_mapping(void *addr, size_t length, char (&path)[PATH_MAX])
+{
+    std::lock_guard<std::mutex> lock(s_mprotectableSharedMappingsLock);
+    for (int i = 0; i < s_mprotectableSharedMappingCount.load(); i++)
+    {
+        if (s_mprotectableSharedMappings[i].start < (uintptr_t)addr + length && (uintptr_t)addr < s_mprotectableSharedMappings[i].end)
+        {
+            strlcpy(path, s_mprotectableSharedMappings[i].path, PATH_MAX);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Only shared mappings of a file write to it (when the mapping is written to, or msync'ed). Writable ones are reported as
+// a write on the descriptor when they are created, which the fd table makes a one-time cost per descriptor. Read-only ones
+// on a descriptor open for writing are remembered, in case mprotect makes them writable.
+// Allocators call mmap for anonymous memory, sometimes while holding their own locks (see readlink below), so every
+// other mapping is forwarded as a raw syscall before the observer is touched.
+INTERPOSE_SOMETIMES(
+    void *,
+    mmap,
+    if (flags & MAP_FIXED) {
+        forget_mprotectable_shared_mappings(addr, length);
+    }
+    if (fd == -1 || (flags & MAP_ANONYMOUS) || (flags & MAP_TYPE) == MAP_PRIVATE || (!(prot & PROT_WRITE) && !is_open_for_writing(fd))) {
+        return (void *)syscall(SYS_mmap, addr, length, prot, flags, fd, offset);
+    },
+    void *addr, size_t length, int prot, int flags, int fd, off_t offset)(
+{
+    // The queues of an io_uring instance are shared with the kernel. They are not files, but we need to know where they are.
+    if (bxl->io_uring_rings().IsRing(fd))
+    {
+        void *result = bxl->real_mmap(addr, length, prot, flags, fd, offset);
+        if (result != MAP_FAILED)
+        {
+            int error = errno;
+            bxl->io_uring_rings().Map(fd, offset, result);
+            errno = error;
+        }
+
+        return result;
+    }
+
+    if (!(prot & PROT_WRITE))
+    {
+        void *result = bxl->real_mmap(addr, length, prot, flags, fd, offset);
+        int error = errno;
+        std::string path;
+        if (result != MAP_FAILED && !BxlObserver::is_non_file(bxl->get_mode(fd)) && !(path = bxl->fd_to_path(fd)).empty()
+            && !remember_mprotectable_shared_mapping(result, length, path))
+        {
+            // No room to remember the mapping: report the write it may do right away
+            bxl->report_access_fd(__func__, ES_EVENT_TYPE_NOTIFY_WRITE, fd, /* error */ 0);
+        }
+
+        errno = error;
+        return result;
+    }
+
+    AccessReportGroup report;
+    auto check = bxl->create_access_fd(__func__, ES_EVENT_TYPE_NOTIFY_WRITE, fd, report);
+    return bxl->check_fwd_and_report_mmap(report, check, MAP_FAILED, addr, length, prot, flags, fd, offset);
+})
+
+// Not through INTERPOSE: that would get the observer before mmap gets to short-circuit
+DLL_EXPORT void *mmap64(void *addr, size_t length, int prot, int flags, int fd, off64_t offset)
+{
+    return mmap(addr, length, prot, flags, fd, offset);
+}
+
+// Same as mmap: only gets the observer when a remembered mapping becomes writable
+DLL_EXPORT int mprotect(void *addr, size_t length, int prot)
+{
+    char path[PATH_MAX];
+    if (!(prot & PROT_WRITE) || s_mprotectableSharedMappingCount.load() == 0 || !find_mprotectable_shared_mapping(addr, length, path))
+    {
+        return syscall(SYS_mprotect, addr, length, prot);
+    }
+
+    BxlObserver *bxl = BxlObserver::GetInstance();
+    AccessReportGroup report;
+    auto check = bxl->create_access(__func__, ES_EVENT_TYPE_NOTIFY_WRITE, path, report);
+    int result = bxl->check_fwd_and_report_mprotect(report, check, ERROR_RETURN_VALUE, addr, length, prot);
+
+    // Reported once. A denied mapping stays read-only, so it keeps being checked.
+    if (!bxl->should_deny(check))
+    {
+        int error = errno;
+        forget_mprotectable_shared_mappings(addr, length);
+        errno = error;
+    }
+
+    return result;
+}
+
+DLL_EXPORT int munmap(void *addr, size_t length)
+{
+    forget_mprotectable_shared_mappings(addr, length);
+    return syscall(SYS_munmap, addr, length);
+}
+#endif
+
+#if defined(__x86_64__) && defined(SYS_io_uring_setup) && defined(SYS_io_uring_enter)
+// glibc has no io_uring wrappers: programs set up and drive their rings through syscall(2), which is interposed to see them.
+// syscall is called for anything from futexes to gettid, often from allocators and thread libraries holding their own
+// locks, so every other call is forwarded straight to the kernel, without the observer and without going through libc.
+static long forward_syscall(long number, long arg1, long arg2, long arg3, long arg4, long arg5, long arg6)
+{
+    long result;
+    register long r10 __asm__("r10") = arg4;
+    register long r8 __asm__("r8") = arg5;
+    register long r9 __asm__("r9") = arg6;
+    __asm__ volatile (
+        "syscall"
+        : "=a"(result)
+        : "a"(number), "D"(arg1), "S"(arg2), "d"(arg3), "r"(r10), "r"(r8), "r"(r9)
+        : "rcx", "r11", "memory");
+
+    // Same convention as syscall(2)
+    if (result < 0 && result > -4096)
+    {
+        errno = -result;
+        return -1;
+    }
+
+    return result;
+}
+
+// Reports the accesses queued on an io_uring instance that io_uring_enter is about to submit. The accesses are only reported,
+// not blocked: the kernel performs them asynchronously. Entries on registered files (IOSQE_FIXED_FILE) carry an index into
+// the files registered with the ring instead of a descriptor, so they can't be resolved and are skipped.
+static void report_io_uring_submissions(BxlObserver *bxl, int ringFd, unsigned int toSubmit)
+{
+    std::vector<struct io_uring_sqe> submissions;
+    if (!bxl->io_uring_rings().GetPendingSubmissions(ringFd, toSubmit, submissions))
+    {
+        return;
+    }
+
+    for (const struct io_uring_sqe &sqe : submissions)
+    {
+        if (sqe.flags & IOSQE_FIXED_FILE)
+        {
+            continue;
+        }
+
+        switch (sqe.opcode)
+        {
+            case IORING_OP_OPENAT:
+            case IORING_OP_OPENAT2:
+            {
+                const char *pathname = (const char *)sqe.addr;
+                if (pathname == nullptr)
+                {
+                    break;
+                }
+
+                // openat2 takes a struct open_how, whose first field holds the open flags
+                uint64_t oflags = sqe.open_flags;
+                if (sqe.opcode == IORING_OP_OPENAT2 && sqe.addr2 != 0)
+                {
+                    memcpy(&oflags, (const void *)sqe.addr2, sizeof(oflags));
+                }
+
+                std::string pathStr = bxl->normalize_path_at(sqe.fd, pathname);
+                AccessReportGroup report;
+                CreateFileOpen(bxl, pathStr, (int)oflags, report);
+                bxl->SendReport(report);
+                break;
+            }
+            case IORING_OP_STATX:
+            {
+                if (sqe.addr != 0)
+                {
+                    int oflags = (sqe.statx_flags & AT_SYMLINK_NOFOLLOW) ? O_NOFOLLOW : 0;
+                    bxl->report_access_at("io_uring_enter", ES_EVENT_TYPE_NOTIFY_STAT, sqe.fd, (const char *)sqe.addr, oflags);
+                }
+
+                break;
+            }
+            case IORING_OP_WRITE:
+            case IORING_OP_WRITEV:
+            case IORING_OP_WRITE_FIXED:
+                bxl->report_access_fd("io_uring_enter", ES_EVENT_TYPE_NOTIFY_WRITE, sqe.fd, /* error */ 0);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+DLL_EXPORT long syscall(long number, ...)
+{
+    // Like syscall(2), always take six arguments: the ones the call doesn't have are ignored by the kernel
+    va_list args;
+    va_start(args, number);
+    long arg1 = va_arg(args, long);
+    long arg2 = va_arg(args, long);
+    long arg3 = va_arg(args, long);
+    long arg4 = va_arg(args, long);
+    long arg5 = va_arg(args, long);
+    long arg6 = va_arg(args, long);
+    va_end(args);
+
+    if (number == SYS_io_uring_setup)
+    {
+        long result = forward_syscall(number, arg1, arg2, arg3, arg4, arg5, arg6);
+        if (result >= 0)
+        {
+            int error = errno;
+            BxlObserver *bxl = BxlObserver::GetInstance();
+            const struct io_uring_params *params = (const struct io_uring_params *)arg2;
+            BXL_LOG_DEBUG(bxl, "io_uring instance set up on descriptor %ld (flags: 0x%x)", result, params->flags);
+
+            bxl->set_non_file_fd((int)result);
+            bxl->io_uring_rings().Setup((int)result, *params);
+            errno = error;
+        }
+
+        return result;
+    }
+
+    if (number == SYS_io_uring_enter && arg2 > 0)
+    {
+        int error = errno;
+        report_io_uring_submissions(BxlObserver::GetInstance(), (int)arg1, (unsigned int)arg2);
+        errno = error;
+    }
+
+    return forward_syscall(number, arg1, arg2, arg3, arg4, arg5, arg6);
+}
+#endif
+
 INTERPOSE(int, rmdir, const char *pathname)({
     AccessReportGroup report;
     // We need to know all the rmdir attempts so we can identify which failed/succeeded, so don't use the cache
     // This is so we can track directory creation/deletion flow. Using the cache lumps all these operations into one report line
     auto check = bxl->create_access(__func__, ES_EVENT_TYPE_NOTIFY_UNLINK, pathname, report, /* mode */ 0, /* flags */ 0 , /* checkCache */ false);
 
-    return bxl->check_fwd_and_report_rmdir(report, check, ERROR_RETURN_VALUE, pathname);
+    int result = bxl->check_fwd_and_report_rmdir(report, check, ERROR_RETURN_VALUE, pathname);
+    bxl->invalidate_resolved_paths();
+    return result;
 })
 
-static AccessCheckResult handle_renameat(BxlObserver *bxl, int olddirfd, const char *oldpath, int newdirfd, const char *newpath, std::vector<AccessReportGroup> &accessesToReport)
+static AccessCheckResult handle_renameat(BxlObserver *bxl, int olddirfd, const char *oldpath, int newdirfd, const char *newpath, std::vector<AccessReportGroup> &accessesToReport, string &oldStr, string &newStr)
 {
-    string oldStr = bxl->normalize_path_at(olddirfd, oldpath, O_NOFOLLOW);
-    string newStr = bxl->normalize_path_at(newdirfd, newpath, O_NOFOLLOW);
+    oldStr = bxl->normalize_path_at(olddirfd, oldpath, O_NOFOLLOW);
+    newStr = bxl->normalize_path_at(newdirfd, newpath, O_NOFOLLOW);
 
     mode_t mode = bxl->get_mode(oldStr.c_str());    
     AccessCheckResult check = AccessCheckResult::Invalid();
-    std::vector<std::string> filesAndDirectories;
 
     if (S_ISDIR(mode))
     {
-        bool enumerateResult = bxl->EnumerateDirectory(oldStr, /*recursive*/true, filesAndDirectories);
-        if (enumerateResult)
+        // __func__ would name the lambda below
+        const char *syscallName = __func__;
+        std::string destination;
+        bool enumerateResult = bxl->EnumerateDirectory(oldStr, /*recursive*/true, [&](const std::string &fileOrDirectory)
         {
-            // reserve all the content for both source and destination
-            accessesToReport.reserve(filesAndDirectories.size() * 2);
-
-            for (auto fileOrDirectory : filesAndDirectories)
-            {
-                // Access check for the source file
-                AccessReportGroup sourceReport;
-                check = bxl->create_access(__func__, ES_EVENT_TYPE_NOTIFY_UNLINK, fileOrDirectory.c_str(), sourceReport, /*mode*/ 0, O_NOFOLLOW);
-                accessesToReport.emplace_back(sourceReport);
-
-                // Access check for the destination file
-                fileOrDirectory.replace(0, oldStr.length(), newStr);
-                AccessReportGroup targetReport;
-                check = AccessCheckResult::Combine(check, CreateFileOpen(bxl, fileOrDirectory, O_CREAT | O_WRONLY, targetReport));
-                accessesToReport.emplace_back(targetReport);
-
-                // If access is denied to any of the files in the enumeration, we can break the loop right away here because check_and_fwd_renameat will also fail
-                if (bxl->should_deny(check))
-                {
-                    break;
-                }
-            }
-        }
-        else
+            // Access check for the source file
+            AccessReportGroup sourceReport;
+            check = bxl->create_access(syscallName, ES_EVENT_TYPE_NOTIFY_UNLINK, fileOrDirectory.c_str(), sourceReport, /*mode*/ 0, O_NOFOLLOW);
+            accessesToReport.emplace_back(sourceReport);
+
+            // Access check for the destination file
+            destination.assign(newStr).append(fileOrDirectory, oldStr.length(), std::string::npos);
+            AccessReportGroup targetReport;
+            check = AccessCheckResult::Combine(check, CreateFileOpen(bxl, destination, O_CREAT | O_WRONLY, targetReport));
+            accessesToReport.emplace_back(targetReport);
+
+            // If access is denied to any of the files in the enumeration, we can stop right away here because check_and_fwd_renameat will also fail
+            return !bxl->should_deny(check);
+        });
+
+        if (!enumerateResult)
         {
+            // Drop whatever was checked before the enumeration failed
+            accessesToReport.clear();
+
             // TODO: [pgunasekara] Remove this case when we're certain the enumeration logic above is solid
             AccessReportGroup report;
             IOEvent event(ES_EVENT_TYPE_NOTIFY_RENAME, ES_ACTION_TYPE_NOTIFY, oldStr, bxl->GetProgramPath(), mode, false, newStr);
@@ -837,7 +1217,9 @@ static AccessCheckResult handle_renameat(BxlObserver *bxl, int olddirfd, const c
 
 INTERPOSE(int, renameat, int olddirfd, const char *oldpath, int newdirfd, const char *newpath)({
     std::vector<AccessReportGroup> accessesToReport;
-    AccessCheckResult check = handle_renameat(bxl, olddirfd, oldpath, newdirfd, newpath, accessesToReport);
+    string oldStr;
+    string newStr;
+    AccessCheckResult check = handle_renameat(bxl, olddirfd, oldpath, newdirfd, newpath, accessesToReport, oldStr, newStr);
     result_t<int> result(ERROR_RETURN_VALUE, EPERM);;
     
     if (bxl->should_deny(check))
@@ -849,11 +1231,13 @@ INTERPOSE(int, renameat, int olddirfd, const char *oldpath, int newdirfd, const
     else 
     {
         result = bxl->fwd_renameat(olddirfd, oldpath, newdirfd, newpath);
-        for (auto access : accessesToReport)
+        bxl->invalidate_resolved_paths();
+        for (auto &access : accessesToReport)
         {
             access.SetErrno(get_errno_from_result(result));
-            bxl->SendReport(access);
         }
+
+        bxl->SendSubtreeReports(accessesToReport, oldStr, newStr);
     }
 
     return result.restore();
@@ -861,7 +1245,9 @@ INTERPOSE(int, renameat, int olddirfd, const char *oldpath, int newdirfd, const
 
 INTERPOSE(int, renameat2, int olddirfd, const char *oldpath, int newdirfd, const char *newpath, unsigned int flags)({
     std::vector<AccessReportGroup> accessesToReport;
-    AccessCheckResult check = handle_renameat(bxl, olddirfd, oldpath, newdirfd, newpath, accessesToReport);
+    string oldStr;
+    string newStr;
+    AccessCheckResult check = handle_renameat(bxl, olddirfd, oldpath, newdirfd, newpath, accessesToReport, oldStr, newStr);
     result_t<int> result(ERROR_RETURN_VALUE, EPERM);;
     
     if (bxl->should_deny(check))
@@ -873,11 +1259,13 @@ INTERPOSE(int, renameat2, int olddirfd, const char *oldpath, int newdirfd, const
     else 
     {
         result = bxl->fwd_renameat2(olddirfd, oldpath, newdirfd, newpath, flags);
-        for (auto access : accessesToReport)
+        bxl->invalidate_resolved_paths();
+        for (auto &access : accessesToReport)
         {
             access.SetErrno(get_errno_from_result(result));
-            bxl->SendReport(access);
         }
+
+        bxl->SendSubtreeReports(accessesToReport, oldStr, newStr);
     }
 
     return result.restore();
@@ -895,7 +1283,9 @@ INTERPOSE(int, link, const char *path1, const char *path2)({
         bxl->normalize_path(path1, O_NOFOLLOW).c_str(),
         bxl->normalize_path(path2, O_NOFOLLOW).c_str(),
         report);
-    return bxl->check_fwd_and_report_link(report, check, ERROR_RETURN_VALUE, path1, path2);
+    int result = bxl->check_fwd_and_report_link(report, check, ERROR_RETURN_VALUE, path1, path2);
+    bxl->invalidate_resolved_paths();
+    return result;
 })
 
 INTERPOSE(int, linkat, int fd1, const char *name1, int fd2, const char *name2, int flag)({
@@ -906,7 +1296,9 @@ INTERPOSE(int, linkat, int fd1, const char *name1, int fd2, const char *name2, i
         bxl->normalize_path_at(fd1, name1, O_NOFOLLOW).c_str(),
         bxl->normalize_path_at(fd2, name2, O_NOFOLLOW).c_str(),
         report);
-    return bxl->check_fwd_and_report_linkat(report, check, ERROR_RETURN_VALUE, fd1, name1, fd2, name2, flag);
+    int result = bxl->check_fwd_and_report_linkat(report, check, ERROR_RETURN_VALUE, fd1, name1, fd2, name2, flag);
+    bxl->invalidate_resolved_paths();
+    return result;
 })
 
 INTERPOSE(int, unlink, const char *path)({
@@ -917,7 +1309,9 @@ INTERPOSE(int, unlink, const char *path)({
     
     AccessReportGroup report;
     auto check = bxl->create_access(__func__, ES_EVENT_TYPE_NOTIFY_UNLINK, path, report, /*mode*/ 0, O_NOFOLLOW);
-    return bxl->check_fwd_and_report_unlink(report, check, ERROR_RETURN_VALUE, path);
+    int result = bxl->check_fwd_and_report_unlink(report, check, ERROR_RETURN_VALUE, path);
+    bxl->invalidate_resolved_paths();
+    return result;
 })
 
 INTERPOSE(int, unlinkat, int dirfd, const char *path, int flags)({
@@ -929,21 +1323,27 @@ INTERPOSE(int, unlinkat, int dirfd, const char *path, int flags)({
     AccessReportGroup report;
     int oflags = (flags & AT_REMOVEDIR) ? 0 : O_NOFOLLOW;
     auto check = bxl->create_access_at(__func__, ES_EVENT_TYPE_NOTIFY_UNLINK, dirfd, path, report, oflags);
-    return bxl->check_fwd_and_report_unlinkat(report, check, ERROR_RETURN_VALUE, dirfd, path, flags);
+    int result = bxl->check_fwd_and_report_unlinkat(report, check, ERROR_RETURN_VALUE, dirfd, path, flags);
+    bxl->invalidate_resolved_paths();
+    return result;
 })
 
 INTERPOSE(int, symlink, const char *target, const char *linkPath)({
     IOEvent event(ES_EVENT_TYPE_NOTIFY_CREATE, ES_ACTION_TYPE_NOTIFY, bxl->normalize_path(linkPath, O_NOFOLLOW), bxl->GetProgramPath(), S_IFLNK);
     AccessReportGroup report;
     auto check = bxl->create_access(__func__, event, report);
-    return bxl->check_fwd_and_report_symlink(report, check, ERROR_RETURN_VALUE, target, linkPath);
+    int result = bxl->check_fwd_and_report_symlink(report, check, ERROR_RETURN_VALUE, target, linkPath);
+    bxl->invalidate_resolved_paths();
+    return result;
 })
 
 INTERPOSE(int, symlinkat, const char *target, int dirfd, const char *linkPath)({
     IOEvent event(ES_EVENT_TYPE_NOTIFY_CREATE, ES_ACTION_TYPE_NOTIFY, bxl->normalize_path_at(dirfd, linkPath, O_NOFOLLOW), bxl->GetProgramPath(), S_IFLNK);
     AccessReportGroup report;
     auto check = bxl->create_access(__func__, event, report);
-    return bxl->check_fwd_and_report_symlinkat(report, check, ERROR_RETURN_VALUE, target, dirfd, linkPath);
+    int result = bxl->check_fwd_and_report_symlinkat(report, check, ERROR_RETURN_VALUE, target, dirfd, linkPath);
+    bxl->invalidate_resolved_paths();
+    return result;
 })
 
 INTERPOSE_SOMETIMES(
@@ -989,6 +1389,26 @@ INTERPOSE(char *, realpath, const char *path, char *resolved_path)({
     // NOTE: Since this isn't a write operation, it shouldn't be an issue that we can't block this call.
     // NOTE: There's no need for a corresponding interception in the PTrace sandbox, as this is not a syscall,
     //       (the function will call the readlink syscall which we do intercept).
+
+    // When every component of the path is in the cache of resolved paths, the symlinks were reported while resolving it
+    // and realpath (which calls readlink on every component) doesn't need to be called.
+    char cachedPath[PATH_MAX];
+    if (bxl->cached_realpath(path, cachedPath))
+    {
+        char *cachedResult = resolved_path != nullptr ? resolved_path : (char *)malloc(PATH_MAX);
+        if (cachedResult != nullptr)
+        {
+            strcpy(cachedResult, cachedPath);
+            bxl->report_access(__func__, ES_EVENT_TYPE_NOTIFY_STAT, path);
+            if (strcmp(path, cachedResult) != 0)
+            {
+                bxl->report_access(__func__, ES_EVENT_TYPE_NOTIFY_STAT, cachedResult);
+            }
+
+            return cachedResult;
+        }
+    }
+
     char *result = bxl->fwd_realpath(path, resolved_path).restore();
     
     if (path == nullptr) 
@@ -1045,6 +1465,19 @@ INTERPOSE(DIR*, fdopendir, int fd)({
     return bxl->check_fwd_and_report_fdopendir(report, check, (DIR*)NULL, fd);
 })
 
+// Changing directories is not an access we report, but relative paths probed afterwards resolve differently (see is_probe_cache_hit)
+INTERPOSE(int, chdir, const char *path)({
+    result_t<int> result = bxl->fwd_chdir(path);
+    bxl->invalidate_cwd();
+    return result.restore();
+})
+
+INTERPOSE(int, fchdir, int fd)({
+    result_t<int> result = bxl->fwd_fchdir(fd);
+    bxl->invalidate_cwd();
+    return result.restore();
+})
+
 INTERPOSE(int, utime, const char *filename, const struct utimbuf *times)({
     AccessReportGroup report;
     auto check = bxl->create_access(__func__, ES_EVENT_TYPE_NOTIFY_SETTIME, filename, report);
@@ -1315,6 +1748,8 @@ INTERPOSE(int, name_to_handle_at, int dirfd, const char *pathname, struct file_h
 
 INTERPOSE(int, close, int fd) ({ 
     bxl->reset_fd_table_entry(fd);
+    bxl->io_uring_rings().Forget(fd);
+    bxl->reset_report_fd(fd);
     return bxl->fwd_close(fd).restore();
 })
 
@@ -1329,7 +1764,7 @@ INTERPOSE(int, closedir, DIR *dirp) ({
 })
 
 INTERPOSE(int, dup, int fd) ({ 
-    return ret_fd(bxl->real_dup(fd), bxl);    
+    return ret_dup_fd(fd, ret_fd(bxl->real_dup(fd), bxl), bxl);    
     // Sometimes useful (for debugging) to interpose without access checking:
     // return bxl->fwd_dup(fd).restore();     
 })
@@ -1338,8 +1773,10 @@ INTERPOSE(int, dup2, int oldfd, int newfd)({
     // If the file descriptor newfd was previously open, it is closed
     // before being reused; the close is performed silently, so we should reset the fd table.
     bxl->reset_fd_table_entry(newfd);
+    bxl->reset_report_fd(newfd);
+    bxl->io_uring_rings().Forget(newfd);
 
-    return bxl->real_dup2(oldfd, newfd); 
+    return ret_dup_fd(oldfd, bxl->real_dup2(oldfd, newfd), bxl); 
     // Sometimes useful (for debugging) to interpose without access checking:
     // return bxl->fwd_dup2(oldfd, newfd).restore();  
 })
@@ -1348,28 +1785,91 @@ INTERPOSE(int, dup3, int oldfd, int newfd, int flags)({
     // If the file descriptor newfd was previously open, it is closed
     // before being reused; the close is performed silently, so we should reset the fd table.
     bxl->reset_fd_table_entry(newfd);
+    bxl->reset_report_fd(newfd);
+    bxl->io_uring_rings().Forget(newfd);
 
-    return bxl->real_dup3(oldfd, newfd, flags); 
+    return ret_dup_fd(oldfd, bxl->real_dup3(oldfd, newfd, flags), bxl); 
     // Sometimes useful (for debugging) to interpose without access checking:
     //return bxl->fwd_dup3(oldfd, newfd).restore();  
 })
 
+// Descriptors that are not files are never reported: classifying them when they are created spares
+// the fstat the first access on each of them would otherwise need
+INTERPOSE(int, pipe, int pipefd[2])({
+    int result = bxl->real_pipe(pipefd);
+    if (result == 0)
+    {
+        ret_non_file_fd(pipefd[0], bxl);
+        ret_non_file_fd(pipefd[1], bxl);
+    }
+
+    return result;
+})
+
+INTERPOSE(int, pipe2, int pipefd[2], int flags)({
+    int result = bxl->real_pipe2(pipefd, flags);
+    if (result == 0)
+    {
+        ret_non_file_fd(pipefd[0], bxl);
+        ret_non_file_fd(pipefd[1], bxl);
+    }
+
+    return result;
+})
+
+INTERPOSE(int, socket, int domain, int type, int protocol)({
+    return ret_non_file_fd(bxl->real_socket(domain, type, protocol), bxl);
+})
+
+INTERPOSE(int, socketpair, int domain, int type, int protocol, int sv[2])({
+    int result = bxl->real_socketpair(domain, type, protocol, sv);
+    if (result == 0)
+    {
+        ret_non_file_fd(sv[0], bxl);
+        ret_non_file_fd(sv[1], bxl);
+    }
+
+    return result;
+})
+
+// Anonymous files are regular files, but their accesses are never reported either (see BxlObserver::is_anonymous_file)
+INTERPOSE(int, memfd_create, const char *name, unsigned int flags)({
+    return ret_non_file_fd(bxl->real_memfd_create(name, flags), bxl);
+})
+
+#ifdef SYS_close_range
+#ifndef CLOSE_RANGE_CLOEXEC
+#define CLOSE_RANGE_CLOEXEC (1U << 2)
+#endif
+
+// Not every glibc we build against declares close_range, so we forward it as a raw syscall
+INTERPOSE(int, close_range, unsigned int first, unsigned int last, int flags)({
+    // With CLOSE_RANGE_CLOEXEC descriptors are only marked close-on-exec, not closed
+    if (!(flags & CLOSE_RANGE_CLOEXEC))
+    {
+        bxl->reset_fd_table_range(first, last);
+        bxl->reset_report_fds(first, last);
+    }
+
+    return syscall(SYS_close_range, first, last, flags);
+})
+#endif
+
 static void report_exit(int exitCode, void *args)
 {
     BxlObserver::GetInstance()->SendExitReport();
 }
 
-// invoked by the loader when our shared library is dynamically loaded into a new host process
-void __attribute__ ((constructor)) _bxl_linux_sandbox_init(void)
+// invoked by the loader when our shared library is dynamically loaded into a new host process.
+// glibc passes the arguments of main to constructors, so the command line can be reported without reading it from /proc.
+void __attribute__ ((constructor)) _bxl_linux_sandbox_init(int argc, char **argv, char **envp)
 {
     // set up an on-exit handler
     on_exit(report_exit, NULL);
 
-    BxlObserver::GetInstance()->Init();
-
     // report that a new process has been created 
     BxlObserver::GetInstance()->report_access("__init__", ES_EVENT_TYPE_NOTIFY_EXEC, BxlObserver::GetInstance()->GetProgramPath());
-    BxlObserver::GetInstance()->report_exec_args(getpid());
+    BxlObserver::GetInstance()->report_exec_args(getpid(), argv);
 }
 
 // ==========================
@@ -0,0 +1,70 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <string.h>
+#include "ebpf_events.hpp"
+
+bool EbpfAccessEventView::Parse(const void *sample, size_t size, EbpfAccessEventView &view)
+{
+    if (size < sizeof(EbpfAccessEvent))
+    {
+        return false;
+    }
+
+    memcpy(&view.event, sample, sizeof(EbpfAccessEvent));
+    if (view.event.operation >= EbpfOperationCount
+        || size < sizeof(EbpfAccessEvent) + view.event.srcPathLength + view.event.dstPathLength)
+    {
+        return false;
+    }
+
+    view.srcPath = (const char *)sample + sizeof(EbpfAccessEvent);
+    view.dstPath = view.srcPath + view.event.srcPathLength;
+    return true;
+}
+
+void EbpfRingBuffer::Map(void *consumerPage, const void *producerPage, const void *data, size_t dataSize)
+{
+    consumerPosition_ = (volatile unsigned long *)consumerPage;
+    producerPosition_ = (const volatile unsigned long *)producerPage;
+    data_ = (const char *)data;
+    mask_ = dataSize - 1;
+}
+
+size_t EbpfRingBuffer::Consume(const std::function<void(const void *sample, size_t size)> &consume)
+{
+    if (data_ == nullptr)
+    {
+        return 0;
+    }
+
+    size_t consumed = 0;
+    unsigned long consumerPosition = __atomic_load_n(consumerPosition_, __ATOMIC_ACQUIRE);
+    unsigned long producerPosition = __atomic_load_n(producerPosition_, __ATOMIC_ACQUIRE);
+    while (consumerPosition < producerPosition)
+    {
+        // Every sample starts with a header: its length, and whether it is still being written or was discarded
+        const uint32_t *header = (const uint32_t *)(data_ + (consumerPosition & mask_));
+        uint32_t length = __atomic_load_n(header, __ATOMIC_ACQUIRE);
+        if (length & BPF_RINGBUF_BUSY_BIT)
+        {
+            break;
+        }
+
+        uint32_t sampleSize = length & ~(BPF_RINGBUF_BUSY_BIT | BPF_RINGBUF_DISCARD_BIT);
+        if (!(length & BPF_RINGBUF_DISCARD_BIT))
+        {
+            consume((const char *)header + BPF_RINGBUF_HDR_SZ, sampleSize);
+            consumed++;
+        }
+
+        // Samples are 8-byte aligned, header included
+        consumerPosition += (sampleSize + BPF_RINGBUF_HDR_SZ + 7) & ~7UL;
+
+        // Hand the space back to the producers once the sample is processed
+        __atomic_store_n(consumerPosition_, consumerPosition, __ATOMIC_RELEASE);
+        producerPosition = __atomic_load_n(producerPosition_, __ATOMIC_ACQUIRE);
+    }
+
+    return consumed;
+}
@@ -0,0 +1,86 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <functional>
+#include <linux/bpf.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Accesses observed by eBPF programs attached to the syscalls of a pip, as an alternative to interposing libc (which misses static
+ * binaries and raw syscalls) and to ptrace (which stops the process on every traced syscall).
+ *
+ * The programs write one EbpfAccessEvent per syscall into a BPF ring buffer (BPF_MAP_TYPE_RINGBUF), directly followed by its paths,
+ * none of them null-terminated: the source path, then the destination path (for renames and links). The layout is shared with the
+ * programs, so it only uses fixed-size fields and may only be extended at the end.
+ */
+enum EbpfOperation : uint32_t
+{
+    EbpfOperationOpen = 0,      // open, openat, openat2, creat
+    EbpfOperationStat,          // stat, lstat, statx, access, faccessat
+    EbpfOperationReadlink,
+    EbpfOperationExec,          // execve, execveat
+    EbpfOperationFork,          // fork, vfork, clone: childPid is set
+    EbpfOperationExit,
+    EbpfOperationUnlink,        // unlink, unlinkat, rmdir
+    EbpfOperationRename,        // rename, renameat, renameat2
+    EbpfOperationLink,          // link, linkat, symlink, symlinkat
+    EbpfOperationMkdir,
+    EbpfOperationCount
+};
+
+struct EbpfAccessEvent
+{
+    uint32_t operation;         // EbpfOperation
+    int32_t pid;
+    int32_t parentPid;
+    int32_t childPid;
+    int32_t flags;              // the open flags, for opens
+    int32_t error;              // errno of the syscall, 0 when it succeeded
+    uint32_t mode;              // mode of the source path, when the program could read it
+    uint16_t srcPathLength;
+    uint16_t dstPathLength;
+    uint64_t timestampNs;       // bpf_ktime_get_ns, when the syscall returned
+};
+
+static_assert(sizeof(EbpfAccessEvent) % 8 == 0, "Events must stay 8-byte aligned");
+
+/**
+ * An EbpfAccessEvent read from the ring buffer, with its paths. The paths point into the ring buffer: they are only valid
+ * until the callback that received the event returns.
+ */
+struct EbpfAccessEventView
+{
+    EbpfAccessEvent event;
+    const char *srcPath;
+    const char *dstPath;
+
+    // Reads the event in a sample of the ring buffer. Returns false if the sample is not a valid event.
+    static bool Parse(const void *sample, size_t size, EbpfAccessEventView &view);
+};
+
+/**
+ * Consumer side of a BPF ring buffer, over the regions mmap'ed from the map: the consumer position (read-write), and the producer
+ * position followed by the data pages (read-only). The kernel maps the data pages twice in a row, so a sample that wraps around
+ * the end of the data is contiguous in the mapping.
+ *
+ * Samples are consumed in the order they were reserved. A sample that is still being written stops the consumption, and samples
+ * discarded by the programs are skipped. Only one thread may consume a ring buffer.
+ */
+class EbpfRingBuffer
+{
+public:
+    // 'dataSize' is the size of the map (max_entries), a power of 2
+    void Map(void *consumerPage, const void *producerPage, const void *data, size_t dataSize);
+
+    // Calls 'consume' for every sample available, and releases them. Returns the number of samples consumed.
+    size_t Consume(const std::function<void(const void *sample, size_t size)> &consume);
+
+private:
+    volatile unsigned long *consumerPosition_ = nullptr;
+    const volatile unsigned long *producerPosition_ = nullptr;
+    const char *data_ = nullptr;
+    size_t mask_ = 0;
+};
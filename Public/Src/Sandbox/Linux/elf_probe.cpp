@@ -0,0 +1,135 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <elf.h>
+#include <endian.h>
+#include <string.h>
+#include <sys/xattr.h>
+#include "elf_probe.hpp"
+
+#define LIBC_SONAME_PREFIX "libc.so."
+
+// Whether [offset, offset + length) is within an image of the given size
+static inline bool in_bounds(size_t size, size_t offset, size_t length)
+{
+    return offset <= size && length <= size - offset;
+}
+
+template <typename Ehdr, typename Phdr, typename Dyn>
+static bool is_statically_linked(const unsigned char *image, size_t size)
+{
+    if (!in_bounds(size, 0, sizeof(Ehdr)))
+    {
+        return false;
+    }
+
+    const Ehdr *header = (const Ehdr *)image;
+    if (header->e_phnum == 0
+        || header->e_phentsize != sizeof(Phdr)
+        || !in_bounds(size, header->e_phoff, (size_t)header->e_phnum * sizeof(Phdr)))
+    {
+        return false;
+    }
+
+    const Phdr *programHeaders = (const Phdr *)(image + header->e_phoff);
+    const Phdr *dynamic = nullptr;
+    for (int i = 0; i < header->e_phnum; i++)
+    {
+        if (programHeaders[i].p_type == PT_DYNAMIC)
+        {
+            dynamic = &programHeaders[i];
+            break;
+        }
+    }
+
+    if (dynamic == nullptr)
+    {
+        // No dynamic section: nothing is loaded with the binary
+        return true;
+    }
+
+    if (!in_bounds(size, dynamic->p_offset, dynamic->p_filesz))
+    {
+        return false;
+    }
+
+    // DT_STRTAB is a virtual address: find the loadable segment that contains it to get at the file contents
+    const Dyn *entries = (const Dyn *)(image + dynamic->p_offset);
+    size_t entryCount = dynamic->p_filesz / sizeof(Dyn);
+    const char *strtab = nullptr;
+    size_t strtabSize = 0;
+    for (size_t i = 0; i < entryCount && entries[i].d_tag != DT_NULL; i++)
+    {
+        if (entries[i].d_tag != DT_STRTAB)
+        {
+            continue;
+        }
+
+        size_t address = entries[i].d_un.d_ptr;
+        for (int j = 0; j < header->e_phnum; j++)
+        {
+            const Phdr &segment = programHeaders[j];
+            if (segment.p_type == PT_LOAD
+                && address >= segment.p_vaddr
+                && address - segment.p_vaddr < segment.p_filesz
+                && in_bounds(size, segment.p_offset, segment.p_filesz))
+            {
+                strtab = (const char *)image + segment.p_offset + (address - segment.p_vaddr);
+                strtabSize = segment.p_filesz - (address - segment.p_vaddr);
+                break;
+            }
+        }
+
+        break;
+    }
+
+    if (strtab == nullptr)
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < entryCount && entries[i].d_tag != DT_NULL; i++)
+    {
+        if (entries[i].d_tag == DT_NEEDED
+            && in_bounds(strtabSize, entries[i].d_un.d_val, sizeof(LIBC_SONAME_PREFIX) - 1)
+            && memcmp(strtab + entries[i].d_un.d_val, LIBC_SONAME_PREFIX, sizeof(LIBC_SONAME_PREFIX) - 1) == 0)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool is_elf_statically_linked(const void *image, size_t size)
+{
+    const unsigned char *ident = (const unsigned char *)image;
+    if (!in_bounds(size, 0, EI_NIDENT) || memcmp(ident, ELFMAG, SELFMAG) != 0)
+    {
+        return false;
+    }
+
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+    if (ident[EI_DATA] != ELFDATA2LSB)
+#else
+    if (ident[EI_DATA] != ELFDATA2MSB)
+#endif
+    {
+        return false;
+    }
+
+    switch (ident[EI_CLASS])
+    {
+        case ELFCLASS64:
+            return is_statically_linked<Elf64_Ehdr, Elf64_Phdr, Elf64_Dyn>(ident, size);
+        case ELFCLASS32:
+            return is_statically_linked<Elf32_Ehdr, Elf32_Phdr, Elf32_Dyn>(ident, size);
+        default:
+            return false;
+    }
+}
+
+bool has_file_capabilities(int fd)
+{
+    return fgetxattr(fd, "security.capability", nullptr, 0) > 0;
+}
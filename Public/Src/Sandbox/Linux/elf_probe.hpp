@@ -0,0 +1,14 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <stddef.h>
+
+// Returns whether the given image of a file is an ELF executable that doesn't dynamically link libc, and therefore can't be interposed.
+// This matches what 'objdump -p' tells us: the file has program headers, and none of the DT_NEEDED entries of its dynamic section is libc.so.*
+// Files that are not ELF images (or are malformed, or for a different byte order) are not considered statically linked.
+bool is_elf_statically_linked(const void *image, size_t size);
+
+// Returns whether the file open on the given descriptor has file capabilities (the security.capability extended attribute, as shown by getcap)
+bool has_file_capabilities(int fd);
@@ -0,0 +1,311 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <stdlib.h>
+#include <string.h>
+#include "fd_table.hpp"
+
+FdTable::Entry* FdTable::GetEntry(int fd) const
+{
+    if (fd < 0 || (size_t)fd >= PageSize * MaxPages)
+    {
+        return nullptr;
+    }
+
+    Page *page = pages_[fd / PageSize].load(std::memory_order_acquire);
+    return page == nullptr ? nullptr : &page->entries[fd % PageSize];
+}
+
+FdTable::Entry* FdTable::GetOrCreateEntry(int fd)
+{
+    if (fd < 0 || (size_t)fd >= PageSize * MaxPages)
+    {
+        return nullptr;
+    }
+
+    std::atomic<Page *> &slot = pages_[fd / PageSize];
+    Page *page = slot.load(std::memory_order_acquire);
+    if (page == nullptr)
+    {
+        // calloc gives us zeroed entries: even sequence, no path
+        Page *newPage = (Page *)calloc(1, sizeof(Page));
+        if (newPage == nullptr)
+        {
+            return nullptr;
+        }
+
+        if (slot.compare_exchange_strong(page, newPage, std::memory_order_acq_rel))
+        {
+            page = newPage;
+        }
+        else
+        {
+            // Another thread installed the page first, 'page' now points to it
+            free(newPage);
+        }
+    }
+
+    return &page->entries[fd % PageSize];
+}
+
+char* FdTable::Allocate(size_t size)
+{
+    if (size > ArenaChunkSize)
+    {
+        return nullptr;
+    }
+
+    while (true)
+    {
+        ArenaChunk *chunk = arena_.load(std::memory_order_acquire);
+        if (chunk != nullptr)
+        {
+            size_t offset = chunk->used.fetch_add(size);
+            if (offset + size <= ArenaChunkSize)
+            {
+                return &chunk->data[offset];
+            }
+        }
+
+        // The current chunk is exhausted. The remainder of it is just wasted.
+        ArenaChunk *newChunk = (ArenaChunk *)malloc(sizeof(ArenaChunk));
+        if (newChunk == nullptr)
+        {
+            return nullptr;
+        }
+
+        newChunk->used = size;
+        if (arena_.compare_exchange_strong(chunk, newChunk, std::memory_order_acq_rel))
+        {
+            return &newChunk->data[0];
+        }
+
+        free(newChunk);
+    }
+}
+
+bool FdTable::Get(int fd, std::string &path) const
+{
+    Entry *entry = GetEntry(fd);
+    if (entry == nullptr)
+    {
+        return false;
+    }
+
+    uint32_t sequence = entry->sequence.load(std::memory_order_acquire);
+    uint32_t length = entry->length.load(std::memory_order_acquire);
+    if ((sequence & 1) != 0 || length == 0)
+    {
+        return false;
+    }
+
+    path.assign(entry->buffer.load(std::memory_order_acquire), length);
+
+    // If the entry changed while we were copying, what we read may be a mix of two paths
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return entry->sequence.load(std::memory_order_relaxed) == sequence;
+}
+
+bool FdTable::GetVersion(int fd, uint32_t &version) const
+{
+    Entry *entry = GetEntry(fd);
+    if (entry == nullptr)
+    {
+        return false;
+    }
+
+    // The sequence number is the version: it moves on every update and invalidation
+    version = entry->sequence.load(std::memory_order_acquire);
+    return (version & 1) == 0 && entry->length.load(std::memory_order_acquire) != 0;
+}
+
+void FdTable::Set(int fd, const char *path, size_t length)
+{
+    Entry *entry = GetOrCreateEntry(fd);
+    if (entry == nullptr || length == 0)
+    {
+        return;
+    }
+
+    uint32_t sequence = entry->sequence.load(std::memory_order_acquire);
+    if ((sequence & 1) != 0 || !entry->sequence.compare_exchange_strong(sequence, sequence + 1, std::memory_order_acquire))
+    {
+        return;
+    }
+
+    if (entry->capacity < length)
+    {
+        // Round up to a power of two (at least 64), so an entry reallocates its buffer only a few times
+        uint32_t capacity = 64;
+        while (capacity < length)
+        {
+            capacity *= 2;
+        }
+
+        char *buffer = Allocate(capacity);
+        if (buffer != nullptr)
+        {
+            entry->buffer.store(buffer, std::memory_order_release);
+            entry->capacity = capacity;
+        }
+    }
+
+    if (entry->capacity >= length)
+    {
+        memcpy(entry->buffer.load(std::memory_order_relaxed), path, length);
+        entry->length.store(length, std::memory_order_release);
+    }
+
+    // Release the entry. If it was invalidated meanwhile, the sequence number moved on and the
+    // path we just wrote may be stale: drop it.
+    uint32_t locked = sequence + 1;
+    if (!entry->sequence.compare_exchange_strong(locked, sequence + 2, std::memory_order_release))
+    {
+        entry->length.store(0, std::memory_order_release);
+        uint32_t current = entry->sequence.load(std::memory_order_acquire);
+        while ((current & 1) != 0 && !entry->sequence.compare_exchange_weak(current, current + 1, std::memory_order_release));
+    }
+}
+
+bool FdTable::IsEnumerationReported(int fd, const void *dir) const
+{
+    Entry *entry = GetEntry(fd);
+    return entry != nullptr && entry->enumeratedDir.load(std::memory_order_acquire) == dir;
+}
+
+void FdTable::SetEnumerationReported(int fd, const void *dir)
+{
+    Entry *entry = GetOrCreateEntry(fd);
+    if (entry != nullptr)
+    {
+        entry->enumeratedDir.store(dir, std::memory_order_release);
+    }
+}
+
+bool FdTable::IsWriteReported(int fd) const
+{
+    Entry *entry = GetEntry(fd);
+    if (entry == nullptr)
+    {
+        return false;
+    }
+
+    // A zeroed entry never matches: caching a path moves the sequence number past 0
+    uint32_t sequence = entry->sequence.load(std::memory_order_acquire);
+    return (sequence & 1) == 0
+        && entry->length.load(std::memory_order_acquire) != 0
+        && entry->writeReportedVersion.load(std::memory_order_acquire) == sequence;
+}
+
+void FdTable::SetWriteReported(int fd, uint32_t version)
+{
+    Entry *entry = GetEntry(fd);
+    if (entry != nullptr)
+    {
+        entry->writeReportedVersion.store(version, std::memory_order_release);
+    }
+}
+
+bool FdTable::GetEntryVersion(int fd, uint32_t &version) const
+{
+    if (fd < 0 || (size_t)fd >= PageSize * MaxPages)
+    {
+        return false;
+    }
+
+    // Entries that don't exist yet start zeroed
+    Entry *entry = GetEntry(fd);
+    version = entry == nullptr ? 0 : entry->sequence.load(std::memory_order_acquire);
+    return (version & 1) == 0;
+}
+
+bool FdTable::IsNonFile(int fd) const
+{
+    Entry *entry = GetEntry(fd);
+    if (entry == nullptr)
+    {
+        return false;
+    }
+
+    // Marks are stored as version + 1, which is odd, so a zeroed entry never matches
+    uint32_t sequence = entry->sequence.load(std::memory_order_acquire);
+    return (sequence & 1) == 0 && entry->nonFileVersion.load(std::memory_order_acquire) == sequence + 1;
+}
+
+void FdTable::SetNonFile(int fd, uint32_t version)
+{
+    Entry *entry = GetOrCreateEntry(fd);
+    if (entry != nullptr)
+    {
+        entry->nonFileVersion.store(version + 1, std::memory_order_release);
+    }
+}
+
+void FdTable::Invalidate(Entry &entry)
+{
+    // Adding 2 keeps the parity: a writer holding the entry will notice the change when releasing it
+    entry.enumeratedDir.store(nullptr, std::memory_order_release);
+    entry.length.store(0, std::memory_order_release);
+    entry.sequence.fetch_add(2, std::memory_order_acq_rel);
+}
+
+void FdTable::Reset(int fd)
+{
+    Entry *entry = GetEntry(fd);
+    if (entry != nullptr)
+    {
+        Invalidate(*entry);
+    }
+}
+
+void FdTable::ResetRange(unsigned int first, unsigned int last)
+{
+    if (first > last)
+    {
+        return;
+    }
+
+    size_t end = last >= PageSize * MaxPages ? PageSize * MaxPages - 1 : last;
+    for (size_t fd = first; fd <= end; fd++)
+    {
+        Page *page = pages_[fd / PageSize].load(std::memory_order_acquire);
+        if (page == nullptr)
+        {
+            // Skip to the beginning of the next page
+            fd = (fd / PageSize + 1) * PageSize - 1;
+            continue;
+        }
+
+        Invalidate(page->entries[fd % PageSize]);
+    }
+}
+
+void FdTable::ResetAll()
+{
+    for (size_t i = 0; i < MaxPages; i++)
+    {
+        Page *page = pages_[i].load(std::memory_order_acquire);
+        if (page == nullptr)
+        {
+            continue;
+        }
+
+        for (Entry &entry : page->entries)
+        {
+            // Entries that hold nothing are only read, so the pages of the table a forked child inherits
+            // are not copied unless they hold something to forget
+            uint32_t sequence = entry.sequence.load(std::memory_order_relaxed);
+            if ((sequence & 1) == 0
+                && entry.length.load(std::memory_order_relaxed) == 0
+                && entry.enumeratedDir.load(std::memory_order_relaxed) == nullptr
+                && entry.nonFileVersion.load(std::memory_order_relaxed) != sequence + 1)
+            {
+                continue;
+            }
+
+            entry.enumeratedDir.store(nullptr, std::memory_order_release);
+            entry.length.store(0, std::memory_order_release);
+            entry.sequence.store((entry.sequence.load(std::memory_order_relaxed) | 1) + 1, std::memory_order_release);
+        }
+    }
+}
@@ -0,0 +1,113 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+/**
+ * Cache of file descriptor to path mappings, so we don't need to call readlink on /proc/self/fd for every access on a descriptor.
+ *
+ * The table has two levels: pages of PageSize descriptors are allocated on demand, so processes with many open
+ * descriptors are covered without paying for them in processes that only use a few. Paths are copied into buffers
+ * owned by each entry and carved out of a per-process arena. Buffers are only replaced when a longer path
+ * needs to be stored, and are never freed, so a reader racing with a writer never touches released memory.
+ *
+ * Every entry is guarded by a sequence number (a seqlock): it is odd while a writer is updating the entry, and
+ * changes on every invalidation. Readers never block, they just treat a concurrent update as a miss.
+ *
+ * Entries also remember the directory stream (DIR*) on the descriptor whose enumeration was already reported,
+ * so a readdir loop is reported once rather than once per entry. Invalidating an entry forgets it.
+ *
+ * Likewise, entries remember the version of the cached path whose write was already checked and allowed, so
+ * repeated writes on a descriptor (e.g., a putc loop) skip the path lookup and the access check. Any invalidation
+ * moves the sequence number on, which makes the remembered version stale without touching it.
+ *
+ * The same way, entries remember whether their descriptor is not a file (a pipe, a socket, an anonymous file...),
+ * so accesses on it are discarded without an fstat.
+ */
+class FdTable
+{
+public:
+    // Copies the cached path for the given descriptor into 'path'. Returns false if there is no cached path.
+    bool Get(int fd, std::string &path) const;
+
+    // Caches the path for the given descriptor. Best effort: the path is not cached if the entry is being updated concurrently.
+    void Set(int fd, const char *path, size_t length);
+
+    // Gets a version of the cached path for the given descriptor, which changes whenever the entry is updated or invalidated.
+    // Returns false if there is no cached path.
+    bool GetVersion(int fd, uint32_t &version) const;
+
+    // Invalidates the cached path for the given descriptor
+    void Reset(int fd);
+
+    // Whether the enumeration of the given directory stream, open on the given descriptor, was marked as reported
+    bool IsEnumerationReported(int fd, const void *dir) const;
+
+    // Marks the enumeration of the given directory stream as reported, until the entry for its descriptor is invalidated
+    void SetEnumerationReported(int fd, const void *dir);
+
+    // Whether a write on the given descriptor was marked as checked and allowed, and its entry didn't change since
+    bool IsWriteReported(int fd) const;
+
+    // Marks writes on the given descriptor as checked and allowed, for the given version of its cached path (see GetVersion).
+    // The mark is dropped as soon as the entry changes, including when it already changed since 'version' was read.
+    void SetWriteReported(int fd, uint32_t version);
+
+    // Gets a version of the entry for the given descriptor, whether it caches a path or not. Returns false if the entry is being updated.
+    bool GetEntryVersion(int fd, uint32_t &version) const;
+
+    // Whether the given descriptor was marked as not being a file, and its entry didn't change since
+    bool IsNonFile(int fd) const;
+
+    // Marks the given descriptor as not being a file, for the given version of its entry (see GetEntryVersion).
+    // The mark is dropped as soon as the entry changes, including when it already changed since 'version' was read.
+    void SetNonFile(int fd, uint32_t version);
+
+    // Invalidates the cached paths for all descriptors in [first, last]
+    void ResetRange(unsigned int first, unsigned int last);
+
+    // Invalidates all entries. Entries locked by a writer that doesn't exist anymore (e.g., a thread of the parent
+    // process in a forked child) are released, so this must not race with writers of this process. Entries that
+    // hold nothing are left untouched, so this doesn't write to memory still shared with a parent process.
+    void ResetAll();
+
+private:
+    static const size_t PageSize = 1024;
+    static const size_t MaxPages = 1024;
+    static const size_t ArenaChunkSize = 64 * 1024;
+
+    struct Entry
+    {
+        std::atomic<uint32_t> sequence;
+        std::atomic<uint32_t> length;
+        std::atomic<char *> buffer;
+        std::atomic<const void *> enumeratedDir;
+        std::atomic<uint32_t> writeReportedVersion;
+        std::atomic<uint32_t> nonFileVersion;
+        uint32_t capacity;
+    };
+
+    struct Page
+    {
+        Entry entries[PageSize];
+    };
+
+    struct ArenaChunk
+    {
+        std::atomic<size_t> used;
+        char data[ArenaChunkSize];
+    };
+
+    Entry* GetEntry(int fd) const;
+    Entry* GetOrCreateEntry(int fd);
+    char* Allocate(size_t size);
+    static void Invalidate(Entry &entry);
+
+    std::atomic<Page *> pages_[MaxPages] = {};
+    std::atomic<ArenaChunk *> arena_ = { nullptr };
+};
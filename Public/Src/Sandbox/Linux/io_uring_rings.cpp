@@ -0,0 +1,138 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <string.h>
+#include "io_uring_rings.hpp"
+
+IoUringRings::Ring* IoUringRings::Find(int fd)
+{
+    for (int i = 0; i < ringCount_; i++)
+    {
+        if (rings_[i].fd == fd)
+        {
+            return &rings_[i];
+        }
+    }
+
+    return nullptr;
+}
+
+void IoUringRings::Setup(int fd, const struct io_uring_params &params)
+{
+    std::lock_guard<std::mutex> lock(lock_);
+    Ring *ring = Find(fd);
+    if (ring == nullptr)
+    {
+        if (ringCount_ == MaxRings)
+        {
+            // Too many rings: submissions on this one are not inspected
+            return;
+        }
+
+        ring = &rings_[ringCount_++];
+    }
+
+    ring->fd = fd;
+    ring->flags = params.flags;
+    ring->entries = params.sq_entries;
+    ring->offsets = params.sq_off;
+    ring->queue = nullptr;
+    ring->sqes = nullptr;
+
+#ifdef IORING_SETUP_NO_MMAP
+    // The process provided the memory of the ring itself: the queues are in the region given for the rings
+    if (params.flags & IORING_SETUP_NO_MMAP)
+    {
+        ring->queue = (char *)params.cq_off.user_addr;
+        ring->sqes = (char *)params.sq_off.user_addr;
+    }
+#endif
+}
+
+bool IoUringRings::IsRing(int fd)
+{
+    std::lock_guard<std::mutex> lock(lock_);
+    return Find(fd) != nullptr;
+}
+
+void IoUringRings::Map(int fd, off_t offset, void *address)
+{
+    std::lock_guard<std::mutex> lock(lock_);
+    Ring *ring = Find(fd);
+    if (ring == nullptr)
+    {
+        return;
+    }
+
+    // With IORING_FEAT_SINGLE_MMAP the completion queue shares the mapping of the submission queue, which is all we need
+    if (offset == IORING_OFF_SQ_RING)
+    {
+        ring->queue = (char *)address;
+    }
+    else if (offset == IORING_OFF_SQES)
+    {
+        ring->sqes = (char *)address;
+    }
+}
+
+void IoUringRings::Forget(int fd)
+{
+    std::lock_guard<std::mutex> lock(lock_);
+    Ring *ring = Find(fd);
+    if (ring != nullptr)
+    {
+        *ring = rings_[--ringCount_];
+    }
+}
+
+bool IoUringRings::GetPendingSubmissions(int fd, unsigned int toSubmit, std::vector<struct io_uring_sqe> &submissions)
+{
+    std::lock_guard<std::mutex> lock(lock_);
+    Ring *ring = Find(fd);
+    if (ring == nullptr || ring->queue == nullptr || ring->sqes == nullptr || (ring->flags & IORING_SETUP_SQPOLL))
+    {
+        return false;
+    }
+
+    // The process moves the tail when it queues entries, the kernel moves the head when it consumes them
+    unsigned int head = __atomic_load_n((unsigned int *)(ring->queue + ring->offsets.head), __ATOMIC_ACQUIRE);
+    unsigned int tail = __atomic_load_n((unsigned int *)(ring->queue + ring->offsets.tail), __ATOMIC_ACQUIRE);
+    unsigned int mask = *(unsigned int *)(ring->queue + ring->offsets.ring_mask);
+    unsigned int pending = tail - head;
+    if (pending > ring->entries)
+    {
+        return false;
+    }
+
+    bool hasArray = true;
+#ifdef IORING_SETUP_NO_SQARRAY
+    // Without the indirection array, entries are consumed in the order they are laid out
+    hasArray = !(ring->flags & IORING_SETUP_NO_SQARRAY);
+#endif
+
+    size_t sqeSize = sizeof(struct io_uring_sqe);
+#ifdef IORING_SETUP_SQE128
+    if (ring->flags & IORING_SETUP_SQE128)
+    {
+        sqeSize *= 2;
+    }
+#endif
+
+    const unsigned int *array = (const unsigned int *)(ring->queue + ring->offsets.array);
+    for (unsigned int i = 0; i < pending && i < toSubmit; i++)
+    {
+        unsigned int position = (head + i) & mask;
+        unsigned int index = hasArray ? array[position] : position;
+        if (index >= ring->entries)
+        {
+            // The kernel drops invalid entries as well
+            continue;
+        }
+
+        struct io_uring_sqe sqe;
+        memcpy(&sqe, ring->sqes + (size_t)index * sqeSize, sizeof(sqe));
+        submissions.push_back(sqe);
+    }
+
+    return true;
+}
@@ -0,0 +1,59 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <linux/io_uring.h>
+#include <mutex>
+#include <sys/types.h>
+#include <vector>
+
+/**
+ * The io_uring instances of a process, so the submissions queued on them can be inspected before the kernel consumes them.
+ *
+ * File accesses submitted through io_uring don't go through any interposed libc function: the process writes submission
+ * queue entries (SQEs) into memory it shares with the kernel, and io_uring_enter tells the kernel to consume them.
+ * Reading the queue right before io_uring_enter lets the observer report those accesses without getting in the way.
+ *
+ * A ring is known once its descriptor is returned by io_uring_setup (which also gives the layout of the submission queue)
+ * and the queue and the entries are mapped by the process. Rings set up with IORING_SETUP_SQPOLL are consumed by a kernel
+ * thread without io_uring_enter, so their submissions can't be inspected.
+ */
+class IoUringRings
+{
+public:
+    // Remembers the ring just set up on the given descriptor, with the parameters filled in by the kernel
+    void Setup(int fd, const struct io_uring_params &params);
+
+    // Whether the given descriptor is a ring set up by this process
+    bool IsRing(int fd);
+
+    // Remembers where the process mapped a region of the given ring (the offset is one of the IORING_OFF_* values)
+    void Map(int fd, off_t offset, void *address);
+
+    // Forgets the ring on the given descriptor, if any
+    void Forget(int fd);
+
+    // Copies the submissions queued on the ring of the given descriptor and not consumed by the kernel yet, up to 'toSubmit'
+    // of them, into 'submissions'. Returns false if the descriptor is not a ring, or its queue can't be inspected.
+    bool GetPendingSubmissions(int fd, unsigned int toSubmit, std::vector<struct io_uring_sqe> &submissions);
+
+private:
+    static const int MaxRings = 16;
+
+    struct Ring
+    {
+        int fd;
+        unsigned int flags;
+        unsigned int entries;
+        struct io_sqring_offsets offsets;
+        char *queue;
+        char *sqes;
+    };
+
+    Ring* Find(int fd);
+
+    Ring rings_[MaxRings] = {};
+    int ringCount_ = 0;
+    std::mutex lock_;
+};
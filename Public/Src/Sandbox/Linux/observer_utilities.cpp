@@ -6,7 +6,7 @@
 #include <string.h>
 #include <limits.h>
 
-bool resolve_filename_with_env(const char *filename, mode_t &mode, std::string &path)
+bool resolve_filename_with_env(const char *filename, mode_t &mode, std::string &path, lstat_function lstatFunction)
 {
     mode = 0;
 
@@ -44,29 +44,37 @@ bool resolve_filename_with_env(const char *filename, mode_t &mode, std::string &
         root_path = env_path_str.substr(start, pos-start);
         start = pos + 1; /*+1 to account for the delimiter ':'*/
 
-        if (check_if_path_exists(root_path, filename, path, mode))
+        if (check_if_path_exists(root_path, filename, path, mode, lstatFunction))
         {
             return true;
         }
     }
 
     root_path = env_path_str.substr(start);
-    return check_if_path_exists(root_path, filename, path, mode);
+    return check_if_path_exists(root_path, filename, path, mode, lstatFunction);
 }
 
-bool check_if_path_exists(std::string root, std::string filename, std::string &path, mode_t &mode)
+bool check_if_path_exists(std::string root, std::string filename, std::string &path, mode_t &mode, lstat_function lstatFunction)
 {
     std::string finalPath = root + "/" + filename;
     struct stat buf;
+    int result;
 
-    // Call the interposed stat instead of the real one here so we can report it back to the managed layer
+    if (lstatFunction != nullptr)
+    {
+        result = lstatFunction(finalPath.c_str(), &buf);
+    }
+    else
+    {
+        // Call the interposed stat instead of the real one here so we can report it back to the managed layer
 #if (__GLIBC__ == 2 && __GLIBC_MINOR__ < 33)
-    mode = __lxstat(1, finalPath.c_str(), &buf) == 0
+        result = __lxstat(1, finalPath.c_str(), &buf);
 #else
-    mode = lstat(finalPath.c_str(), &buf) == 0
+        result = lstat(finalPath.c_str(), &buf);
 #endif
-        ? buf.st_mode
-        : 0;
+    }
+
+    mode = result == 0 ? buf.st_mode : 0;
 
     if (mode != 0)
     {
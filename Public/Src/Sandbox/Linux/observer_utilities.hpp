@@ -8,12 +8,16 @@
 #include <stdarg.h>
 #include <cstddef>
 
+// Stats a path without following a final symlink, like lstat
+typedef int (*lstat_function)(const char *path, struct stat *buf);
+
 // Resolves a provided filename against the environment by checking if it exists by using stat
 // This closely follows the logic used by glibc: https://codebrowser.dev/glibc/glibc/posix/execvpe.c.html
-bool resolve_filename_with_env(const char *filename, mode_t &mode, std::string &path);
+// Candidates are probed with 'lstatFunction' if given, otherwise with the (interposed, so reported) lstat.
+bool resolve_filename_with_env(const char *filename, mode_t &mode, std::string &path, lstat_function lstatFunction = nullptr);
 
 // Appends filename to root, checks if it exists by calling stat and then sets path if it does exist
-bool check_if_path_exists(std::string root, std::string filename, std::string &path, mode_t &mode);
+bool check_if_path_exists(std::string root, std::string filename, std::string &path, mode_t &mode, lstat_function lstatFunction = nullptr);
 
 // An example on how to parse variadic args where this code was derived from can be found here: https://github.com/bminor/glibc/blob/master/posix/execl.c
 // Parses the arguement count of a variable set of arguments passed to a function
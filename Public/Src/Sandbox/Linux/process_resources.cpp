@@ -0,0 +1,739 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <linux/genetlink.h>
+#include <linux/netlink.h>
+#include <linux/taskstats.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "process_resources.hpp"
+
+// Upper bound of the number of processes sampled in the process tree of a pip (taskstats only)
+#define MAX_SAMPLED_PROCESS_TREE_SIZE (16 * 1024)
+
+// Large enough for the files of a cgroup sampled, and for a netlink reply
+#define SAMPLE_BUFFER_SIZE 4096
+#define MOUNTINFO_BUFFER_SIZE (256 * 1024)
+
+namespace resource_files
+{
+    // Start of the line of 'content' that begins with 'key' followed by 'separator', or null
+    static const char* FindKey(const char *content, const char *key, char separator, const char **lineEnd)
+    {
+        size_t keyLength = strlen(key);
+        const char *line = content;
+        while (line != nullptr && *line != '\0')
+        {
+            const char *end = strchr(line, '\n');
+            if (end == nullptr)
+            {
+                end = line + strlen(line);
+            }
+
+            if ((size_t)(end - line) > keyLength && strncmp(line, key, keyLength) == 0 && line[keyLength] == separator)
+            {
+                *lineEnd = end;
+                return line + keyLength + 1;
+            }
+
+            line = *end == '\0' ? nullptr : end + 1;
+        }
+
+        return nullptr;
+    }
+
+    uint64_t ParseFlatKeyedValue(const char *content, const char *key)
+    {
+        const char *end;
+        const char *value = FindKey(content, key, ' ', &end);
+        return value == nullptr ? 0 : strtoull(value, nullptr, 10);
+    }
+
+    uint64_t ParseNestedKeyedSum(const char *content, const char *key)
+    {
+        // Lines look like '8:0 rbytes=1 wbytes=2 rios=3 wios=4 dbytes=0 dios=0'
+        size_t keyLength = strlen(key);
+        uint64_t sum = 0;
+        const char *position = content;
+        while ((position = strstr(position, key)) != nullptr)
+        {
+            bool startsField = position == content || position[-1] == ' ';
+            position += keyLength;
+            if (startsField && *position == '=')
+            {
+                sum += strtoull(position + 1, nullptr, 10);
+            }
+        }
+
+        return sum;
+    }
+
+    bool ParseUnifiedCGroup(const char *content, char *path, size_t pathSize)
+    {
+        const char *end;
+        const char *value = FindKey(content, "0:", ':', &end);
+        if (value == nullptr || *value != '/' || (size_t)(end - value) >= pathSize)
+        {
+            return false;
+        }
+
+        memcpy(path, value, end - value);
+        path[end - value] = '\0';
+        return true;
+    }
+
+    bool ParseCGroup2MountPoint(const char *content, char *path, size_t pathSize)
+    {
+        // Lines look like '35 24 0:30 / /sys/fs/cgroup rw,nosuid shared:9 - cgroup2 cgroup2 rw', the mount point being the
+        // fifth field and the file system type the one after the '-' (the optional fields before it vary in number)
+        const char *line = content;
+        while (line != nullptr && *line != '\0')
+        {
+            const char *end = strchr(line, '\n');
+            if (end == nullptr)
+            {
+                end = line + strlen(line);
+            }
+
+            const char *separator = strstr(line, " - cgroup2 ");
+            if (separator != nullptr && separator < end)
+            {
+                const char *mountPoint = line;
+                for (int field = 0; field < 4 && mountPoint != nullptr; field++)
+                {
+                    mountPoint = strchr(mountPoint, ' ');
+                    mountPoint = mountPoint == nullptr ? nullptr : mountPoint + 1;
+                }
+
+                const char *mountPointEnd = mountPoint == nullptr ? nullptr : strchr(mountPoint, ' ');
+                if (mountPointEnd != nullptr && mountPointEnd < separator && (size_t)(mountPointEnd - mountPoint) < pathSize)
+                {
+                    memcpy(path, mountPoint, mountPointEnd - mountPoint);
+                    path[mountPointEnd - mountPoint] = '\0';
+                    return true;
+                }
+            }
+
+            line = *end == '\0' ? nullptr : end + 1;
+        }
+
+        return false;
+    }
+}
+
+using namespace resource_files;
+
+// Reads the file 'fd' from its start into 'buffer' (null terminated, truncated to its size), returns false if it can't be read
+static bool ReadFromStart(int fd, char *buffer, size_t size)
+{
+    if (fd == -1)
+    {
+        return false;
+    }
+
+    // Files of /proc and of cgroups are read in one go, unless they are larger than a page
+    size_t length = 0;
+    while (length < size - 1)
+    {
+        ssize_t read = pread(fd, buffer + length, size - 1 - length, length);
+        if (read < 0)
+        {
+            return false;
+        }
+
+        if (read == 0)
+        {
+            break;
+        }
+
+        length += read;
+    }
+
+    buffer[length] = '\0';
+    return true;
+}
+
+static bool ReadFile(const char *path, char *buffer, size_t size)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    bool success = ReadFromStart(fd, buffer, size);
+    if (fd != -1)
+    {
+        close(fd);
+    }
+
+    return success;
+}
+
+static int WriteFile(const char *path, const char *content)
+{
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return -errno;
+    }
+
+    int result = write(fd, content, strlen(content)) < 0 ? -errno : 0;
+    close(fd);
+    return result;
+}
+
+static int OpenInGroup(const char *group, const char *file)
+{
+    char path[PATH_MAX];
+    if (snprintf(path, sizeof(path), "%s/%s", group, file) >= (int)sizeof(path))
+    {
+        return -1;
+    }
+
+    return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+PipResourceGroups::~PipResourceGroups()
+{
+    for (Group &group : groups_)
+    {
+        CloseFiles(group);
+    }
+
+    if (netlink_ != -1)
+    {
+        close(netlink_);
+    }
+}
+
+PipResourceGroupsMode PipResourceGroups::Initialize(const char *root)
+{
+    std::lock_guard<std::mutex> lock(lock_);
+    mode_ = PipResourceGroupsUnavailable;
+    root_[0] = '\0';
+
+    // mountinfo has a line per mount, which can be many more than fit in a page (e.g., in containers)
+    std::vector<char> buffer(MOUNTINFO_BUFFER_SIZE);
+    char mountPoint[PATH_MAX];
+    char cgroup[PATH_MAX];
+    if (root != nullptr && *root != '\0')
+    {
+        snprintf(root_, sizeof(root_), "%s", root);
+    }
+    else if (ReadFile("/proc/self/mountinfo", buffer.data(), buffer.size()) && ParseCGroup2MountPoint(buffer.data(), mountPoint, sizeof(mountPoint)) &&
+             ReadFile("/proc/self/cgroup", buffer.data(), buffer.size()) && ParseUnifiedCGroup(buffer.data(), cgroup, sizeof(cgroup)))
+    {
+        snprintf(root_, sizeof(root_), "%s%s", mountPoint, strcmp(cgroup, "/") == 0 ? "" : cgroup);
+    }
+
+    if (root_[0] != '\0')
+    {
+        // Enable the controllers one by one, so the ones that aren't delegated don't prevent enabling the others.
+        // 'cpu.stat' is there without the cpu controller, 'memory.*' and 'io.stat' are only there with theirs.
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/cgroup.subtree_control", root_);
+        for (const char *controller : { "+cpu", "+memory", "+io" })
+        {
+            WriteFile(path, controller);
+        }
+
+        // The hierarchy is only delegated if the build may create cgroups (and move processes into them)
+        snprintf(path, sizeof(path), "%s/bxl.%d.probe", root_, getpid());
+        if (mkdir(path, 0755) == 0 || errno == EEXIST)
+        {
+            rmdir(path);
+            mode_ = PipResourceGroupsCGroup;
+            return mode_;
+        }
+    }
+
+    root_[0] = '\0';
+    if (ResolveTaskstatsFamily())
+    {
+        // Querying taskstats needs CAP_NET_ADMIN: check with this process
+        ProcessResourceUsage usage = {};
+        mode_ = PipResourceGroupsTaskstats;
+        if (QueryTaskstats(getpid(), usage) != 0)
+        {
+            mode_ = PipResourceGroupsUnavailable;
+        }
+    }
+
+    return mode_;
+}
+
+PipResourceGroups::Group* PipResourceGroups::Find(int group)
+{
+    return group >= 0 && group < (int)groups_.size() && groups_[group].used ? &groups_[group] : nullptr;
+}
+
+void PipResourceGroups::CloseFiles(Group &group)
+{
+    for (int *fd : { &group.cpuStat, &group.memoryCurrent, &group.memoryPeak, &group.ioStat })
+    {
+        if (*fd != -1)
+        {
+            close(*fd);
+            *fd = -1;
+        }
+    }
+}
+
+int PipResourceGroups::Create(uint64_t pipId)
+{
+    std::lock_guard<std::mutex> lock(lock_);
+    if (mode_ == PipResourceGroupsUnavailable)
+    {
+        return -ENOTSUP;
+    }
+
+    Group group;
+    group.used = true;
+    if (mode_ == PipResourceGroupsCGroup)
+    {
+        // Named after this process too, so builds sharing the delegated hierarchy don't collide
+        if (snprintf(group.path, sizeof(group.path), "%s/bxl.%d.%016" PRIx64, root_, getpid(), pipId) >= (int)sizeof(group.path))
+        {
+            return -ENAMETOOLONG;
+        }
+
+        if (mkdir(group.path, 0755) != 0 && errno != EEXIST)
+        {
+            return -errno;
+        }
+
+        group.cpuStat = OpenInGroup(group.path, "cpu.stat");
+        group.memoryCurrent = OpenInGroup(group.path, "memory.current");
+        group.memoryPeak = OpenInGroup(group.path, "memory.peak"); // Linux 5.19+
+        group.ioStat = OpenInGroup(group.path, "io.stat");
+    }
+
+    for (int handle = 0; handle < (int)groups_.size(); handle++)
+    {
+        if (!groups_[handle].used)
+        {
+            groups_[handle] = group;
+            return handle;
+        }
+    }
+
+    groups_.push_back(group);
+    return (int)groups_.size() - 1;
+}
+
+int PipResourceGroups::AddProcess(int handle, pid_t pid)
+{
+    std::lock_guard<std::mutex> lock(lock_);
+    Group *group = Find(handle);
+    if (group == nullptr)
+    {
+        return -EINVAL;
+    }
+
+    if (mode_ == PipResourceGroupsCGroup)
+    {
+        char path[PATH_MAX];
+        char content[32];
+        snprintf(path, sizeof(path), "%s/cgroup.procs", group->path);
+        snprintf(content, sizeof(content), "%d", pid);
+        int result = WriteFile(path, content);
+        if (result != 0)
+        {
+            return result;
+        }
+    }
+
+    if (group->root == 0)
+    {
+        group->root = pid;
+    }
+
+    return 0;
+}
+
+int PipResourceGroups::Sample(const int *groups, int count, ProcessResourceUsage *usages)
+{
+    std::lock_guard<std::mutex> lock(lock_);
+    int result = 0;
+    for (int i = 0; i < count; i++)
+    {
+        memset(&usages[i], 0, sizeof(usages[i]));
+        Group *group = Find(groups[i]);
+        int sampleResult = group == nullptr
+            ? -EINVAL
+            : (mode_ == PipResourceGroupsCGroup ? SampleCGroup(*group, usages[i]) : SampleTaskstats(*group, usages[i]));
+        if (sampleResult != 0)
+        {
+            result = sampleResult;
+        }
+    }
+
+    return result;
+}
+
+int PipResourceGroups::SampleCGroup(const Group &group, ProcessResourceUsage &usage)
+{
+    char buffer[SAMPLE_BUFFER_SIZE];
+    usage.pid = group.root;
+
+    if (!ReadFromStart(group.cpuStat, buffer, sizeof(buffer)))
+    {
+        return -EIO;
+    }
+
+    usage.userTime = ParseFlatKeyedValue(buffer, "user_usec") / 1000;
+    usage.systemTime = ParseFlatKeyedValue(buffer, "system_usec") / 1000;
+
+    // The memory and io controllers may not be delegated: their counters are left at 0 then
+    if (ReadFromStart(group.memoryCurrent, buffer, sizeof(buffer)))
+    {
+        usage.rss = strtoull(buffer, nullptr, 10);
+    }
+
+    if (ReadFromStart(group.memoryPeak, buffer, sizeof(buffer)))
+    {
+        usage.peak_rss = strtoull(buffer, nullptr, 10);
+    }
+
+    if (ReadFromStart(group.ioStat, buffer, sizeof(buffer)))
+    {
+        usage.diskio_bytesRead = ParseNestedKeyedSum(buffer, "rbytes");
+        usage.diskio_bytesWritten = ParseNestedKeyedSum(buffer, "wbytes");
+        usage.diskio_readops = ParseNestedKeyedSum(buffer, "rios");
+        usage.diskio_writeops = ParseNestedKeyedSum(buffer, "wios");
+    }
+
+    return 0;
+}
+
+// Queues the pids listed in 'path' (a /proc/<pid>/task/<tid>/children file), which may be larger than the read buffer
+static void QueueChildren(const char *path, std::vector<pid_t> &pids)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return;
+    }
+
+    char buffer[SAMPLE_BUFFER_SIZE];
+    pid_t pid = 0;
+    ssize_t length;
+    while ((length = read(fd, buffer, sizeof(buffer))) > 0)
+    {
+        for (ssize_t i = 0; i < length; i++)
+        {
+            if (buffer[i] >= '0' && buffer[i] <= '9')
+            {
+                pid = pid * 10 + (buffer[i] - '0');
+            }
+            else if (pid != 0)
+            {
+                if (pids.size() < MAX_SAMPLED_PROCESS_TREE_SIZE)
+                {
+                    pids.push_back(pid);
+                }
+
+                pid = 0;
+            }
+        }
+    }
+
+    if (pid != 0 && pids.size() < MAX_SAMPLED_PROCESS_TREE_SIZE)
+    {
+        pids.push_back(pid);
+    }
+
+    close(fd);
+}
+
+int PipResourceGroups::SampleTaskstats(const Group &group, ProcessResourceUsage &usage)
+{
+    usage.pid = group.root;
+    if (group.root == 0)
+    {
+        return 0;
+    }
+
+    // Walk the process tree breadth first; a process can have children forked by any of its threads
+    treePids_.clear();
+    treePids_.push_back(group.root);
+    char path[PATH_MAX];
+    for (size_t next = 0; next < treePids_.size(); next++)
+    {
+        pid_t pid = treePids_[next];
+        if (QueryTaskstats(pid, usage) != 0)
+        {
+            // The process exited: its children (if any) were reparented and are not part of the tree anymore
+            continue;
+        }
+
+        snprintf(path, sizeof(path), "/proc/%d/task", pid);
+        DIR *tasks = opendir(path);
+        if (tasks == nullptr)
+        {
+            continue;
+        }
+
+        struct dirent *task;
+        while ((task = readdir(tasks)) != nullptr)
+        {
+            if (task->d_name[0] != '.')
+            {
+                snprintf(path, sizeof(path), "/proc/%d/task/%s/children", pid, task->d_name);
+                QueueChildren(path, treePids_);
+            }
+        }
+
+        closedir(tasks);
+    }
+
+    return 0;
+}
+
+// Appends an attribute to the netlink message 'header', which is followed by 'capacity' bytes
+static bool AppendAttribute(struct nlmsghdr *header, size_t capacity, uint16_t type, const void *data, uint16_t size)
+{
+    size_t offset = NLMSG_ALIGN(header->nlmsg_len);
+    if (offset + NLA_HDRLEN + NLA_ALIGN(size) > capacity)
+    {
+        return false;
+    }
+
+    struct nlattr *attribute = (struct nlattr *)((char *)header + offset);
+    attribute->nla_type = type;
+    attribute->nla_len = NLA_HDRLEN + size;
+    memcpy((char *)attribute + NLA_HDRLEN, data, size);
+    header->nlmsg_len = offset + NLA_ALIGN(attribute->nla_len);
+    return true;
+}
+
+// Finds the attribute 'type' among the attributes in the 'length' bytes at 'attributes'
+static const struct nlattr* FindAttribute(const char *attributes, size_t length, uint16_t type)
+{
+    size_t offset = 0;
+    while (offset + NLA_HDRLEN <= length)
+    {
+        const struct nlattr *attribute = (const struct nlattr *)(attributes + offset);
+        if (attribute->nla_len < NLA_HDRLEN || offset + attribute->nla_len > length)
+        {
+            return nullptr;
+        }
+
+        if ((attribute->nla_type & NLA_TYPE_MASK) == type)
+        {
+            return attribute;
+        }
+
+        offset += NLA_ALIGN(attribute->nla_len);
+    }
+
+    return nullptr;
+}
+
+struct GenericNetlinkMessage
+{
+    struct nlmsghdr header;
+    struct genlmsghdr generic;
+    char attributes[256];
+};
+
+// Sends a generic netlink request and receives its reply in 'reply'. Returns the length of the attributes of the reply, or -errno.
+static int Transact(int socket, GenericNetlinkMessage &request, char *reply, size_t replySize, const char **attributes)
+{
+    if (send(socket, &request, request.header.nlmsg_len, 0) < 0)
+    {
+        return -errno;
+    }
+
+    while (true)
+    {
+        ssize_t length = recv(socket, reply, replySize, 0);
+        if (length < 0)
+        {
+            return -errno;
+        }
+
+        struct nlmsghdr *header = (struct nlmsghdr *)reply;
+        if (!NLMSG_OK(header, (size_t)length))
+        {
+            return -EIO;
+        }
+
+        if (header->nlmsg_seq != request.header.nlmsg_seq)
+        {
+            // Reply to an earlier request that timed out
+            continue;
+        }
+
+        if (header->nlmsg_type == NLMSG_ERROR)
+        {
+            struct nlmsgerr *error = (struct nlmsgerr *)NLMSG_DATA(header);
+            return error->error != 0 ? error->error : -EIO;
+        }
+
+        size_t offset = NLMSG_HDRLEN + GENL_HDRLEN;
+        if (header->nlmsg_len < offset)
+        {
+            return -EIO;
+        }
+
+        *attributes = reply + offset;
+        return (int)(header->nlmsg_len - offset);
+    }
+}
+
+bool PipResourceGroups::ResolveTaskstatsFamily()
+{
+    if (netlink_ == -1)
+    {
+        netlink_ = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_GENERIC);
+        struct sockaddr_nl address = {};
+        address.nl_family = AF_NETLINK;
+        if (netlink_ == -1 || bind(netlink_, (struct sockaddr *)&address, sizeof(address)) != 0)
+        {
+            if (netlink_ != -1)
+            {
+                close(netlink_);
+                netlink_ = -1;
+            }
+
+            return false;
+        }
+
+        // Don't let a sample hang on a kernel that doesn't answer
+        struct timeval timeout = { 1, 0 };
+        setsockopt(netlink_, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    }
+
+    GenericNetlinkMessage request = {};
+    request.header.nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN);
+    request.header.nlmsg_type = GENL_ID_CTRL;
+    request.header.nlmsg_flags = NLM_F_REQUEST;
+    request.header.nlmsg_seq = ++netlinkSequence_;
+    request.generic.cmd = CTRL_CMD_GETFAMILY;
+    request.generic.version = 1;
+    AppendAttribute(&request.header, sizeof(request), CTRL_ATTR_FAMILY_NAME, TASKSTATS_GENL_NAME, sizeof(TASKSTATS_GENL_NAME));
+
+    char reply[SAMPLE_BUFFER_SIZE];
+    const char *attributes;
+    int length = Transact(netlink_, request, reply, sizeof(reply), &attributes);
+    const struct nlattr *family = length < 0 ? nullptr : FindAttribute(attributes, length, CTRL_ATTR_FAMILY_ID);
+    if (family == nullptr || family->nla_len < NLA_HDRLEN + sizeof(uint16_t))
+    {
+        return false;
+    }
+
+    memcpy(&taskstatsFamily_, (const char *)family + NLA_HDRLEN, sizeof(uint16_t));
+    return true;
+}
+
+int PipResourceGroups::QueryTaskstats(pid_t pid, ProcessResourceUsage &usage)
+{
+    GenericNetlinkMessage request = {};
+    request.header.nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN);
+    request.header.nlmsg_type = taskstatsFamily_;
+    request.header.nlmsg_flags = NLM_F_REQUEST;
+    request.header.nlmsg_seq = ++netlinkSequence_;
+    request.generic.cmd = TASKSTATS_CMD_GET;
+    request.generic.version = TASKSTATS_GENL_VERSION;
+    uint32_t tgid = pid;
+    AppendAttribute(&request.header, sizeof(request), TASKSTATS_CMD_ATTR_TGID, &tgid, sizeof(tgid));
+
+    char reply[SAMPLE_BUFFER_SIZE];
+    const char *attributes;
+    int length = Transact(netlink_, request, reply, sizeof(reply), &attributes);
+    if (length < 0)
+    {
+        return length;
+    }
+
+    // The statistics of the whole thread group are nested in TASKSTATS_TYPE_AGGR_TGID
+    const struct nlattr *aggregate = FindAttribute(attributes, length, TASKSTATS_TYPE_AGGR_TGID);
+    const struct nlattr *statistics = aggregate == nullptr
+        ? nullptr
+        : FindAttribute((const char *)aggregate + NLA_HDRLEN, aggregate->nla_len - NLA_HDRLEN, TASKSTATS_TYPE_STATS);
+    if (statistics == nullptr)
+    {
+        return -EIO;
+    }
+
+    // Older kernels send a shorter structure: the fields they don't have are left at 0
+    struct taskstats stats = {};
+    size_t size = statistics->nla_len - NLA_HDRLEN;
+    memcpy(&stats, (const char *)statistics + NLA_HDRLEN, size < sizeof(stats) ? size : sizeof(stats));
+
+    usage.userTime += stats.ac_utime / 1000;
+    usage.systemTime += stats.ac_stime / 1000;
+    usage.diskio_readops += stats.read_syscalls;
+    usage.diskio_bytesRead += stats.read_bytes;
+    usage.diskio_writeops += stats.write_syscalls;
+    usage.diskio_bytesWritten += stats.write_bytes;
+    usage.peak_rss += stats.hiwater_rss * 1024;
+
+    // taskstats only has the peak of the resident set size
+    char path[64];
+    char statm[256];
+    snprintf(path, sizeof(path), "/proc/%d/statm", pid);
+    if (ReadFile(path, statm, sizeof(statm)))
+    {
+        char *residentPages = strchr(statm, ' ');
+        if (residentPages != nullptr)
+        {
+            usage.rss += strtoull(residentPages + 1, nullptr, 10) * sysconf(_SC_PAGESIZE);
+        }
+    }
+
+    return 0;
+}
+
+int PipResourceGroups::Remove(int handle)
+{
+    std::lock_guard<std::mutex> lock(lock_);
+    Group *group = Find(handle);
+    if (group == nullptr)
+    {
+        return -EINVAL;
+    }
+
+    CloseFiles(*group);
+    int result = mode_ == PipResourceGroupsCGroup && rmdir(group->path) != 0 ? -errno : 0;
+    *group = Group();
+    return result;
+}
+
+static PipResourceGroups g_pipResourceGroups;
+
+int InitializePipResourceGroups(const char *root)
+{
+    return g_pipResourceGroups.Initialize(root);
+}
+
+int CreatePipResourceGroup(uint64_t pipId)
+{
+    return g_pipResourceGroups.Create(pipId);
+}
+
+int AddProcessToPipResourceGroup(int group, pid_t pid)
+{
+    return g_pipResourceGroups.AddProcess(group, pid);
+}
+
+int RemovePipResourceGroup(int group)
+{
+    return g_pipResourceGroups.Remove(group);
+}
+
+int GetPipResourceUsageSnapshots(const int *groups, int count, ProcessResourceUsage *buffers, long bufferSize)
+{
+    if (sizeof(ProcessResourceUsage) != bufferSize)
+    {
+        fprintf(stderr, "ERROR: Wrong size of ProcessResourceUsage buffer; expected %zu, received %ld\n", sizeof(ProcessResourceUsage), bufferSize);
+        return -EINVAL;
+    }
+
+    return g_pipResourceGroups.Sample(groups, count, buffers);
+}
@@ -0,0 +1,140 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <limits.h>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <vector>
+
+#include "utils.h"
+
+// Codesync with Process.cs and MacOs/Interop/Posix/process.h (times are in milliseconds, like the rest of the Linux interop)
+typedef struct {
+    double startTime;
+    double exitTime;
+    unsigned long systemTime;
+    unsigned long userTime;
+    unsigned long diskio_readops;
+    unsigned long diskio_bytesRead;
+    unsigned long diskio_writeops;
+    unsigned long diskio_bytesWritten;
+    unsigned long rss;
+    unsigned long peak_rss;
+    char *name;
+    int pid;
+} ProcessResourceUsage;
+
+// How the resource usage of pips is sampled (see PipResourceGroups::Initialize)
+enum PipResourceGroupsMode
+{
+    PipResourceGroupsUnavailable = 0,
+    PipResourceGroupsCGroup,
+    PipResourceGroupsTaskstats,
+};
+
+/**
+ * Parsing of the files the samples are read from, which only depends on their format.
+ */
+namespace resource_files
+{
+    // Value of the line 'key value' of a flat keyed file (e.g., 'user_usec' in cpu.stat), or 0 when the key is missing
+    uint64_t ParseFlatKeyedValue(const char *content, const char *key);
+
+    // Sum over all the lines (devices) of the values 'key=value' of a nested keyed file (e.g., 'rbytes' in io.stat)
+    uint64_t ParseNestedKeyedSum(const char *content, const char *key);
+
+    // Path of the cgroup v2 of a process given the content of /proc/<pid>/cgroup (the '0::<path>' line), or false if none
+    bool ParseUnifiedCGroup(const char *content, char *path, size_t pathSize);
+
+    // Mount point of the cgroup v2 hierarchy given the content of /proc/self/mountinfo, or false if it isn't mounted
+    bool ParseCGroup2MountPoint(const char *content, char *path, size_t pathSize);
+}
+
+/**
+ * Groups the processes of each pip so the resource usage of the whole process tree of the pip can be sampled at once.
+ *
+ * When the cgroup v2 hierarchy is delegated to the build (i.e., the build can create cgroups under its root), every pip gets
+ * a cgroup of its own and a sample takes a few reads of files kept open: 'cpu.stat', 'memory.current', 'memory.peak'
+ * and 'io.stat'. Those count the processes of the pip that already exited as well. Processes forked by a process of the
+ * pip stay in its cgroup, so only the root process of the pip needs to be added (as early as possible: processes it forks
+ * before being added are missed).
+ *
+ * Otherwise the usage of every process of the tree is queried with netlink taskstats (which needs CAP_NET_ADMIN): the
+ * processes that exited are missed then. When neither is available, the caller keeps sampling /proc itself.
+ */
+class PipResourceGroups
+{
+public:
+    PipResourceGroups() = default;
+    ~PipResourceGroups();
+
+    PipResourceGroups(const PipResourceGroups&) = delete;
+    PipResourceGroups& operator=(const PipResourceGroups&) = delete;
+
+    // Picks how pips are sampled. 'root' is a cgroup v2 directory delegated to the build, or null for the cgroup of this process.
+    PipResourceGroupsMode Initialize(const char *root);
+
+    PipResourceGroupsMode GetMode() const { return mode_; }
+
+    // Creates the group of a pip, and returns its handle (>= 0) or -errno
+    int Create(uint64_t pipId);
+
+    // Adds a process (and the processes it forks from now on) to a group. Returns 0 or -errno.
+    int AddProcess(int group, pid_t pid);
+
+    // Samples 'count' groups at once into 'usages'. Returns 0, or -errno of the last sample that failed (the others are still taken).
+    int Sample(const int *groups, int count, ProcessResourceUsage *usages);
+
+    // Removes a group; the cgroup of a pip is only removed once all its processes exited. Returns 0 or -errno.
+    int Remove(int group);
+
+private:
+    struct Group
+    {
+        bool used = false;
+        char path[PATH_MAX] = {};
+        pid_t root = 0;
+
+        // Files of the cgroup sampled, left open so sampling doesn't have to resolve them again (-1 when not available)
+        int cpuStat = -1;
+        int memoryCurrent = -1;
+        int memoryPeak = -1;
+        int ioStat = -1;
+    };
+
+    Group* Find(int group);
+    void CloseFiles(Group &group);
+
+    int SampleCGroup(const Group &group, ProcessResourceUsage &usage);
+    int SampleTaskstats(const Group &group, ProcessResourceUsage &usage);
+    int QueryTaskstats(pid_t pid, ProcessResourceUsage &usage);
+
+    bool ResolveTaskstatsFamily();
+
+    PipResourceGroupsMode mode_ = PipResourceGroupsUnavailable;
+    char root_[PATH_MAX] = {};
+
+    // Netlink socket and generic netlink family of taskstats
+    int netlink_ = -1;
+    uint16_t taskstatsFamily_ = 0;
+    uint32_t netlinkSequence_ = 0;
+
+    // Groups by handle; handles of removed groups are reused
+    std::vector<Group> groups_;
+    std::vector<pid_t> treePids_;
+    std::mutex lock_;
+};
+
+// Interop, on a process-wide instance
+
+DLL_EXPORT int InitializePipResourceGroups(const char *root);
+DLL_EXPORT int CreatePipResourceGroup(uint64_t pipId);
+DLL_EXPORT int AddProcessToPipResourceGroup(int group, pid_t pid);
+DLL_EXPORT int RemovePipResourceGroup(int group);
+
+// Takes the samples of 'count' groups at once, 'buffers' must hold 'count' entries of 'bufferSize' bytes
+DLL_EXPORT int GetPipResourceUsageSnapshots(const int *groups, int count, ProcessResourceUsage *buffers, long bufferSize);
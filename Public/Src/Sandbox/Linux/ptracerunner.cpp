@@ -30,6 +30,8 @@ bool verifyargs(BxlObserver *bxl, pid_t traceepid, std::string exe)
 /**
  * The PTraceDaemon will launch this runner with a PID.
  * An instance of PTraceSandbox will then be created to trace the process tree starting from the root pid.
+ * With -d, the runner also traces the processes BuildXL writes to its standard input later on (see PTraceSandbox::ReadAttachRequests),
+ * so a single runner is started for all the processes of a pip that require ptrace.
  */
 int main(int argc, char **argv)
 {
@@ -37,9 +39,10 @@ int main(int argc, char **argv)
     pid_t traceepid;
     std::string exe;
     std::string semaphoreName = "/";
-    
+    int requestFd = -1;
+
     // Parse arguments
-    while((opt = getopt(argc, argv, "cx")) != -1)
+    while((opt = getopt(argc, argv, "cxd")) != -1)
     {
         switch (opt)
         {
@@ -51,6 +54,10 @@ int main(int argc, char **argv)
                 // -x <path to statically linked executable>
                 exe = std::string(argv[optind]);
                 break;
+            case 'd':
+                // -d: read attach requests from stdin until it is closed
+                requestFd = STDIN_FILENO;
+                break;
         }
     }
 
@@ -72,7 +79,7 @@ int main(int argc, char **argv)
 
     semaphoreName.append(std::to_string(traceepid));
 
-    sandbox.AttachToProcess(traceepid, exe, semaphoreName);
+    sandbox.AttachToProcess(traceepid, exe, semaphoreName, requestFd);
 
     _exit(0);
 }
\ No newline at end of file
@@ -0,0 +1,103 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * Formats the text reports sent to the managed side (see BxlObserver::BuildReport):
+ *
+ *     <progname>|<pid>|<requestedAccess>|<status>|<reportExplicitly>|<error>|<operation>|<isDirectory>|<path>\n
+ *
+ * This is the hottest formatting path of the sandbox, so it doesn't go through snprintf: integers are converted by hand
+ * and the strings are copied with memcpy. The output and the return value match the ones of snprintf with the format
+ * "%s|%d|%d|%d|%d|%d|%d|%d|%s\n": at most maxMessageLength - 1 characters are written, followed by a null terminator,
+ * and the length of the whole report is returned, so callers can tell when it didn't fit.
+ */
+class ReportFormatter
+{
+public:
+    static const int FieldCount = 7;
+
+    static int Format(char *buffer, int maxMessageLength, const char *progname, const int (&fields)[FieldCount], const char *path)
+    {
+        // Every field takes at most 11 characters (sign included) plus the separator
+        char fieldsText[FieldCount * 12];
+        int fieldsLength = 0;
+        for (int i = 0; i < FieldCount; i++)
+        {
+            fieldsText[fieldsLength++] = '|';
+            fieldsLength += FormatInt(&fieldsText[fieldsLength], fields[i]);
+        }
+
+        fieldsText[fieldsLength++] = '|';
+
+        size_t prognameLength = strlen(progname);
+        size_t pathLength = strlen(path);
+        size_t length = prognameLength + fieldsLength + pathLength + 1;
+        if (maxMessageLength <= 0)
+        {
+            return (int)length;
+        }
+
+        Writer writer(buffer, maxMessageLength - 1);
+        writer.Append(progname, prognameLength);
+        writer.Append(fieldsText, fieldsLength);
+        writer.Append(path, pathLength);
+        writer.Append("\n", 1);
+        buffer[writer.Written()] = '\0';
+
+        return (int)length;
+    }
+
+    // Writes the decimal representation of the given value (not null-terminated). Returns the number of characters written.
+    static int FormatInt(char *buffer, int value)
+    {
+        // Work on the magnitude as unsigned, so INT_MIN doesn't overflow
+        uint32_t magnitude = value < 0 ? 0u - (uint32_t)value : (uint32_t)value;
+        char digits[10];
+        int digitCount = 0;
+        do
+        {
+            digits[digitCount++] = (char)('0' + magnitude % 10);
+            magnitude /= 10;
+        } while (magnitude != 0);
+
+        int length = 0;
+        if (value < 0)
+        {
+            buffer[length++] = '-';
+        }
+
+        while (digitCount > 0)
+        {
+            buffer[length++] = digits[--digitCount];
+        }
+
+        return length;
+    }
+
+private:
+    // Copies into a bounded buffer, dropping whatever doesn't fit
+    class Writer
+    {
+    public:
+        Writer(char *buffer, size_t capacity) : buffer_(buffer), capacity_(capacity), written_(0) {}
+
+        void Append(const char *text, size_t length)
+        {
+            size_t toCopy = length < capacity_ - written_ ? length : capacity_ - written_;
+            memcpy(buffer_ + written_, text, toCopy);
+            written_ += toCopy;
+        }
+
+        size_t Written() const { return written_; }
+
+    private:
+        char *buffer_;
+        size_t capacity_;
+        size_t written_;
+    };
+};
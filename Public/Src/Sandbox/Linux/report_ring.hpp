@@ -0,0 +1,210 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * Ring of report frames in a file that the managed side creates for a pip and every process of the pip maps
+ * (see CheckEnableLinuxSandboxSharedMemoryReports). Writing a report to it takes no system call, unlike writing it to the
+ * reports FIFO, and bursts are not throttled by the capacity of the pipe.
+ *
+ * Writers reserve a record by advancing 'tail', copy the payload of the frame into it and then publish it by setting its state.
+ * Records never wrap around: one that doesn't fit before the end of the ring is preceded by a padding record.
+ * The reader (the managed side) consumes the published records in order, zeroes them and hands their space back by advancing 'head'.
+ *
+ * The FIFO is still what the reader waits on. Once it finds the ring empty it marks itself idle, and the next writer to publish
+ * a record clears that mark and writes ReportRingDoorbellSentinel to the FIFO. The reader also drains the ring before handling
+ * anything else read from the FIFO, waiting for the records reserved so far, so a frame a process had to send through the FIFO
+ * still goes after the ones it wrote to the ring.
+ *
+ * CODESYNC: Public/Src/Engine/Processes/SharedMemoryReportRing.cs
+ */
+#define REPORT_RING_MAGIC 0x474E495254505242ULL // "BRPTRING"
+#define REPORT_RING_VERSION 1
+#define REPORT_RING_FILE_SUFFIX ".ring"
+
+// Length of the frame written to the FIFO to wake up the reader (the FIFO sentinels of the managed side are negative as well)
+static const int ReportRingDoorbellSentinel = -23;
+
+struct ReportRingHeader
+{
+    uint64_t magic;
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t capacity;                              // bytes of records, a power of 2
+    uint64_t recordsOffset;                         // from the start of the file
+    alignas(64) std::atomic<uint64_t> tail;         // bytes ever reserved by writers
+    alignas(64) std::atomic<uint64_t> head;         // bytes ever handed back by the reader
+    alignas(64) std::atomic<uint32_t> readerIdle;
+};
+
+static_assert(sizeof(ReportRingHeader) == 256, "The layout is shared with the managed side");
+
+// Header of a record, followed by the payload of the frame. Records are padded to a multiple of 8 bytes.
+struct ReportRingRecord
+{
+    uint32_t length;                                // bytes of payload
+    std::atomic<uint32_t> state;                    // set last
+};
+
+enum ReportRingRecordState : uint32_t
+{
+    ReportRingRecordReserved = 0,
+    ReportRingRecordPublished = 1,
+    ReportRingRecordPadding = 2,                    // the rest of the ring up to its end is to be skipped
+};
+
+class ReportRing
+{
+public:
+    // Returns the ring laid out by the managed side in the 'size' bytes at 'address', or nullptr if they don't hold one
+    static ReportRing* Attach(void *address, size_t size)
+    {
+        ReportRingHeader *header = (ReportRingHeader *)address;
+        if (address == nullptr || size < sizeof(ReportRingHeader)
+            || header->magic != REPORT_RING_MAGIC
+            || header->version != REPORT_RING_VERSION
+            || header->capacity == 0
+            || (header->capacity & (header->capacity - 1)) != 0
+            || header->recordsOffset < sizeof(ReportRingHeader)
+            || header->recordsOffset + header->capacity > size)
+        {
+            return nullptr;
+        }
+
+        return (ReportRing *)address;
+    }
+
+    // Lays out an empty ring of 'capacity' bytes of records at 'address', like the managed side does (for tests)
+    static ReportRing* Initialize(void *address, uint64_t capacity)
+    {
+        memset(address, 0, sizeof(ReportRingHeader) + capacity);
+        ReportRingHeader *header = (ReportRingHeader *)address;
+        header->magic = REPORT_RING_MAGIC;
+        header->version = REPORT_RING_VERSION;
+        header->capacity = capacity;
+        header->recordsOffset = sizeof(ReportRingHeader);
+        header->readerIdle = 1;
+        return (ReportRing *)address;
+    }
+
+    // Whether a payload of 'length' bytes can ever be written. Larger frames go through the FIFO.
+    bool CanHold(size_t length) const
+    {
+        return RecordSize(length) <= Header()->capacity / 4;
+    }
+
+    /**
+     * Copies the 'length' bytes of 'payload' into a new record and publishes it. Returns false if the ring is full.
+     * When the reader is idle, 'ringDoorbell' is set to true and the caller must wake it up.
+     */
+    bool TryWrite(const char *payload, size_t length, bool &ringDoorbell)
+    {
+        ReportRingHeader *header = Header();
+        const uint64_t capacity = header->capacity;
+        const uint64_t recordSize = RecordSize(length);
+        ringDoorbell = false;
+
+        uint64_t tail = header->tail.load(std::memory_order_relaxed);
+        uint64_t offset, needed;
+        do
+        {
+            offset = tail & (capacity - 1);
+            needed = capacity - offset < recordSize ? capacity - offset + recordSize : recordSize;
+
+            // Acquire: the reader zeroed the records it handed back
+            if (tail + needed - header->head.load(std::memory_order_acquire) > capacity)
+            {
+                return false;
+            }
+        }
+        while (!header->tail.compare_exchange_weak(tail, tail + needed, std::memory_order_relaxed));
+
+        if (needed != recordSize)
+        {
+            ReportRingRecord *padding = RecordAt(offset);
+            padding->length = (uint32_t)(capacity - offset - sizeof(ReportRingRecord));
+            padding->state.store(ReportRingRecordPadding, std::memory_order_release);
+            offset = 0;
+        }
+
+        ReportRingRecord *record = RecordAt(offset);
+        memcpy((char *)record + sizeof(ReportRingRecord), payload, length);
+        record->length = (uint32_t)length;
+
+        // Sequentially consistent, so that either this writer sees the reader idle or the reader sees the record (see Park)
+        record->state.store(ReportRingRecordPublished, std::memory_order_seq_cst);
+        ringDoorbell = header->readerIdle.load(std::memory_order_seq_cst) == 1 && header->readerIdle.exchange(0) == 1;
+        return true;
+    }
+
+    /**
+     * Calls 'callback(payload, length)' for every published record, in order, and returns the number of records read.
+     * This is what the managed side does; it is only used by tests here.
+     */
+    template <class TCallback> size_t Drain(TCallback callback)
+    {
+        ReportRingHeader *header = Header();
+        const uint64_t capacity = header->capacity;
+        uint64_t head = header->head.load(std::memory_order_relaxed);
+        size_t count = 0;
+        while (true)
+        {
+            uint64_t offset = head & (capacity - 1);
+            ReportRingRecord *record = RecordAt(offset);
+            uint32_t state = record->state.load(std::memory_order_acquire);
+            uint64_t size;
+            if (state == ReportRingRecordPadding)
+            {
+                size = capacity - offset;
+            }
+            else if (state == ReportRingRecordPublished)
+            {
+                callback((const char *)record + sizeof(ReportRingRecord), (size_t)record->length);
+                size = RecordSize(record->length);
+                count++;
+            }
+            else
+            {
+                return count;
+            }
+
+            memset(record, 0, size);
+            head += size;
+            header->head.store(head, std::memory_order_release);
+        }
+    }
+
+    // Marks the reader idle once it drained the ring. Returns false if a record was published in the meantime, in which
+    // case the reader must drain the ring again (only used by tests, see Drain).
+    bool Park()
+    {
+        ReportRingHeader *header = Header();
+        header->readerIdle.store(1, std::memory_order_seq_cst);
+        uint64_t head = header->head.load(std::memory_order_relaxed);
+        if (RecordAt(head & (header->capacity - 1))->state.load(std::memory_order_seq_cst) == ReportRingRecordReserved)
+        {
+            return true;
+        }
+
+        header->readerIdle.store(0, std::memory_order_seq_cst);
+        return false;
+    }
+
+private:
+    ReportRing() = delete;
+
+    ReportRingHeader* Header() const { return (ReportRingHeader *)this; }
+
+    ReportRingRecord* RecordAt(uint64_t offset) const
+    {
+        return (ReportRingRecord *)((char *)this + Header()->recordsOffset + offset);
+    }
+
+    static uint64_t RecordSize(size_t length) { return (sizeof(ReportRingRecord) + length + 7) & ~(uint64_t)7; }
+};
@@ -0,0 +1,37 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Binary trace of the accesses checked by the observer, recorded when BxlEnvSandboxTracePath is set, and replayed
+ * offline by sandboxtracereplay against the file access manifest of the pip.
+ *
+ * The trace is a sequence of records, appended by every process of the pip with a single write each. A record is
+ * the fixed-size header below followed by its strings, none of them null-terminated, in this order: the name of
+ * the interposed call, the source path, the destination path and the executable path of the event.
+ * Records are padded to a multiple of 8 bytes.
+ */
+#define SANDBOX_TRACE_RECORD_MAGIC 0x52545842 // "BXTR"
+
+struct SandboxTraceRecord
+{
+    uint32_t magic;
+    uint32_t length;                // bytes taken by the record, strings and padding included
+    uint32_t eventType;             // es_event_type_t
+    uint32_t mode;
+    int32_t pid;
+    int32_t childPid;
+    int32_t parentPid;
+    uint16_t syscallNameLength;
+    uint16_t srcPathLength;
+    uint16_t dstPathLength;
+    uint16_t executablePathLength;
+    uint32_t reserved;
+    uint64_t timestampNs;           // CLOCK_MONOTONIC, when the check started
+    uint64_t checkNs;               // time spent checking the access against the manifest and building its reports
+};
+
+static_assert(sizeof(SandboxTraceRecord) % 8 == 0, "Records must stay 8-byte aligned");
@@ -0,0 +1,230 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <chrono>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "bxl_observer.hpp"
+#include "IOHandler.hpp"
+#include "Sandbox.hpp"
+#include "sandbox_trace.hpp"
+
+struct ReplayedEvent
+{
+    std::string syscallName;
+    IOEvent event;
+    uint64_t recordedCheckNs;
+};
+
+struct ReplayStatistics
+{
+    uint64_t count = 0;
+    uint64_t recordedNs = 0;
+    uint64_t replayedNs = 0;
+};
+
+static bool ReadFile(const char *path, std::vector<char> &content)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        return false;
+    }
+
+    content.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return true;
+}
+
+// Process lifecycle events track and untrack processes in the sandbox, so they can't be replayed repeatedly: they are skipped
+static bool IsReplayable(es_event_type_t eventType)
+{
+    switch (eventType)
+    {
+        case ES_EVENT_TYPE_AUTH_EXEC:
+        case ES_EVENT_TYPE_NOTIFY_EXEC:
+        case ES_EVENT_TYPE_NOTIFY_FORK:
+        case ES_EVENT_TYPE_NOTIFY_EXIT:
+            return false;
+        default:
+            return true;
+    }
+}
+
+static bool ReadTrace(const std::vector<char> &trace, std::vector<ReplayedEvent> &events, uint64_t &skipped)
+{
+    size_t offset = 0;
+    while (offset + sizeof(SandboxTraceRecord) <= trace.size())
+    {
+        SandboxTraceRecord header;
+        memcpy(&header, &trace[offset], sizeof(header));
+
+        size_t stringsLength = (size_t)header.syscallNameLength + header.srcPathLength + header.dstPathLength + header.executablePathLength;
+        if (header.magic != SANDBOX_TRACE_RECORD_MAGIC || header.length < sizeof(header) + stringsLength || offset + header.length > trace.size())
+        {
+            std::cerr << "Invalid trace record at offset " << offset << std::endl;
+            return false;
+        }
+
+        const char *strings = &trace[offset + sizeof(header)];
+        std::string syscallName(strings, header.syscallNameLength);
+        strings += header.syscallNameLength;
+        std::string srcPath(strings, header.srcPathLength);
+        strings += header.srcPathLength;
+        std::string dstPath(strings, header.dstPathLength);
+        strings += header.dstPathLength;
+        std::string executablePath(strings, header.executablePathLength);
+        offset += header.length;
+
+        if (!IsReplayable((es_event_type_t)header.eventType))
+        {
+            skipped++;
+            continue;
+        }
+
+        events.push_back({
+            std::move(syscallName),
+            IOEvent(header.pid, header.childPid, header.parentPid, (es_event_type_t)header.eventType, ES_ACTION_TYPE_NOTIFY,
+                std::move(srcPath), std::move(dstPath), std::move(executablePath), (mode_t)header.mode),
+            header.checkNs
+        });
+    }
+
+    return true;
+}
+
+/**
+ * Replays a trace recorded by the observer (see sandbox_trace.hpp) through the policy search, access checking and report creation
+ * of the sandbox, against the file access manifest of the pip, without running the pip. For each interposed call, prints the number
+ * of checks replayed and the average time a check took when recorded and when replayed:
+ *
+ *     sandboxtracereplay -f <file access manifest> -t <trace> [-i <iterations>]
+ *
+ * Output lines: TraceReplay,<call>,<checks>,<recorded ns/check>,<replayed ns/check>
+ *
+ * Checking a write under a policy that overrides allowed writes for existing files makes the observer send a report to the pip
+ * (see PolicyResult::AllowWrite), so the observer of this process is pointed at the manifest, and the reports path it names must be writable.
+ */
+int main(int argc, char **argv)
+{
+    int opt;
+    const char *famPath = nullptr;
+    const char *tracePath = nullptr;
+    int iterations = 1;
+
+    while ((opt = getopt(argc, argv, "f:t:i:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'f':
+                famPath = optarg;
+                break;
+            case 't':
+                tracePath = optarg;
+                break;
+            case 'i':
+                iterations = atoi(optarg);
+                break;
+        }
+    }
+
+    if (famPath == nullptr || tracePath == nullptr || iterations <= 0)
+    {
+        std::cerr << "Usage: " << argv[0] << " -f <file access manifest> -t <trace> [-i <iterations>]" << std::endl;
+        return 1;
+    }
+
+    std::vector<char> fam;
+    if (!ReadFile(famPath, fam))
+    {
+        std::cerr << "Could not read file '" << famPath << "'" << std::endl;
+        return 1;
+    }
+
+    std::vector<char> trace;
+    if (!ReadFile(tracePath, trace))
+    {
+        std::cerr << "Could not read file '" << tracePath << "'" << std::endl;
+        return 1;
+    }
+
+    std::vector<ReplayedEvent> events;
+    uint64_t skipped = 0;
+    if (!ReadTrace(trace, events, skipped))
+    {
+        return 1;
+    }
+
+    // In case the observer is needed (see above)
+    setenv(BxlEnvFamPath, famPath, /* overwrite */ 1);
+
+    pid_t pid = getpid();
+    auto pip = std::shared_ptr<SandboxedPip>(new SandboxedPip(pid, fam.data(), fam.size()));
+
+    int reportsPathLength;
+    const char *reportsPath = pip->GetReportsPath(&reportsPathLength);
+    int reportsFd = open(reportsPath, O_WRONLY | O_APPEND | O_NONBLOCK);
+    if (reportsFd == -1)
+    {
+        std::cerr << "Warning: the reports path '" << reportsPath << "' can't be written to: checking writes allowed only to files that don't exist yet will fail" << std::endl;
+    }
+    else
+    {
+        close(reportsFd);
+    }
+
+    Sandbox sandbox(0, Configuration::DetoursLinuxSandboxType);
+    if (!sandbox.TrackRootProcess(pip))
+    {
+        std::cerr << "Could not track the root process" << std::endl;
+        return 1;
+    }
+
+    auto process = sandbox.FindTrackedProcess(pid);
+
+    std::map<std::string, ReplayStatistics> statistics;
+    for (int i = 0; i < iterations; i++)
+    {
+        for (const ReplayedEvent &replayed : events)
+        {
+            auto start = std::chrono::steady_clock::now();
+            IOHandler handler(&sandbox);
+            handler.SetProcess(process);
+            AccessReportGroup reportGroup;
+            handler.CheckAccessAndBuildReport(replayed.event, reportGroup);
+            auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+
+            ReplayStatistics &callStatistics = statistics[replayed.syscallName];
+            callStatistics.count++;
+            callStatistics.recordedNs += replayed.recordedCheckNs;
+            callStatistics.replayedNs += elapsed.count();
+        }
+    }
+
+    ReplayStatistics total;
+    for (const auto &entry : statistics)
+    {
+        const ReplayStatistics &callStatistics = entry.second;
+        std::cout << "TraceReplay," << entry.first << "," << callStatistics.count << ","
+            << callStatistics.recordedNs / callStatistics.count << "," << callStatistics.replayedNs / callStatistics.count << std::endl;
+
+        total.count += callStatistics.count;
+        total.recordedNs += callStatistics.recordedNs;
+        total.replayedNs += callStatistics.replayedNs;
+    }
+
+    if (total.count > 0)
+    {
+        std::cout << "TraceReplay,Total," << total.count << "," << total.recordedNs / total.count << "," << total.replayedNs / total.count << std::endl;
+    }
+
+    std::cout << "TraceReplay,Skipped," << skipped << std::endl;
+    return 0;
+}
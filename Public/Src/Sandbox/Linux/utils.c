@@ -6,6 +6,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include "utils.h"
 
 #define PATH_SEP_CHAR ':'
@@ -410,6 +411,222 @@ char** remove_path_from_LDPRELOAD(const char *const envp[], const char *path)
     return (char**)envp;
 }
 
+void init_env_edit(env_edit *edit, env_edit_kind kind, const char *name, const char *value)
+{
+    edit->kind = kind;
+    edit->name = name;
+    edit->nameLength = strlen(name);
+    edit->value = value;
+    edit->valueLength = strlen(value);
+}
+
+// Returns the value of 'kvp' if it is an assignment to the variable of 'edit', and NULL otherwise
+static const char* env_edit_match(const char *kvp, const env_edit *edit)
+{
+    return kvp[0] == edit->name[0] && strncmp(kvp, edit->name, edit->nameLength) == 0 && kvp[edit->nameLength] == '='
+        ? kvp + edit->nameLength + 1
+        : NULL;
+}
+
+// Returns the first separator in 'list', or its terminating null character
+static const char* find_path_separator(const char *list)
+{
+    while (*list != '\0' && *list != PATH_SEP_CHAR) list++;
+    return list;
+}
+
+// Whether 'value' is one of the colon-separated values in 'list'
+static bool env_list_contains(const char *list, const char *value, size_t valueLength)
+{
+    while (true)
+    {
+        const char *end = find_path_separator(list);
+        if ((size_t)(end - list) == valueLength && memcmp(list, value, valueLength) == 0)
+        {
+            return true;
+        }
+
+        if (*end == '\0')
+        {
+            return false;
+        }
+
+        list = end + 1;
+    }
+}
+
+// Whether the variable with value 'current' must be rewritten to satisfy 'edit'. '*length' is set to an upper bound
+// of the length of the new "name=value" string.
+static bool env_edit_needed(const char *current, const env_edit *edit, size_t *length)
+{
+    size_t currentLength = strlen(current);
+    switch (edit->kind)
+    {
+        case EnvEditSetValue:
+            *length = edit->nameLength + 1 + edit->valueLength;
+            return currentLength != edit->valueLength || memcmp(current, edit->value, currentLength) != 0;
+        case EnvEditIncludePath:
+            *length = edit->nameLength + 1 + currentLength + 1 + edit->valueLength;
+            return edit->valueLength > 0 && !env_list_contains(current, edit->value, edit->valueLength);
+        case EnvEditExcludePath:
+            *length = edit->nameLength + 1 + currentLength;
+            return edit->valueLength > 0 && env_list_contains(current, edit->value, edit->valueLength);
+        default:
+            return false;
+    }
+}
+
+// Writes "name=value" for 'edit' into 'dst', given the current value of the variable (NULL if it isn't set). Returns the end of the written string.
+static char* env_edit_write(char *dst, const char *current, const env_edit *edit)
+{
+    memcpy(dst, edit->name, edit->nameLength);
+    dst += edit->nameLength;
+    *dst++ = '=';
+
+    if (edit->kind == EnvEditSetValue || current == NULL)
+    {
+        memcpy(dst, edit->value, edit->valueLength);
+        dst += edit->valueLength;
+    }
+    else if (edit->kind == EnvEditIncludePath)
+    {
+        size_t currentLength = strlen(current);
+        memcpy(dst, current, currentLength);
+        dst += currentLength;
+        if (currentLength > 0 && current[currentLength - 1] != PATH_SEP_CHAR)
+        {
+            *dst++ = PATH_SEP_CHAR;
+        }
+
+        memcpy(dst, edit->value, edit->valueLength);
+        dst += edit->valueLength;
+    }
+    else
+    {
+        // Copy every value but the excluded one, keeping the remaining ones colon-separated
+        bool first = true;
+        while (true)
+        {
+            const char *end = find_path_separator(current);
+            size_t length = end - current;
+            if (length != edit->valueLength || memcmp(current, edit->value, length) != 0)
+            {
+                if (!first)
+                {
+                    *dst++ = PATH_SEP_CHAR;
+                }
+
+                memcpy(dst, current, length);
+                dst += length;
+                first = false;
+            }
+
+            if (*end == '\0')
+            {
+                break;
+            }
+
+            current = end + 1;
+        }
+    }
+
+    *dst++ = '\0';
+    return dst;
+}
+
+char** apply_env_edits(const char *const envp[], const env_edit *edits, int editCount, void *buf, size_t bufSize, size_t *requiredSize)
+{
+    if (editCount > MAX_ENV_EDITS)
+    {
+        editCount = MAX_ENV_EDITS;
+    }
+
+    // Single scan: find out whether anything needs to change and how much space the result takes
+    unsigned int found = 0;
+    bool changed = false;
+    size_t envCount = 0;
+    size_t stringsSize = 0;
+    for (const char *const *pEnv = envp; pEnv && *pEnv; pEnv++, envCount++)
+    {
+        for (int i = 0; i < editCount; i++)
+        {
+            const char *current = env_edit_match(*pEnv, &edits[i]);
+            if (current != NULL)
+            {
+                size_t length;
+                found |= 1u << i;
+                if (env_edit_needed(current, &edits[i], &length))
+                {
+                    changed = true;
+                    stringsSize += length + 1;
+                }
+
+                break;
+            }
+        }
+    }
+
+    size_t addedCount = 0;
+    for (int i = 0; i < editCount; i++)
+    {
+        if ((found & (1u << i)) == 0 && edits[i].kind != EnvEditExcludePath && (edits[i].kind == EnvEditSetValue || edits[i].valueLength > 0))
+        {
+            changed = true;
+            addedCount++;
+            stringsSize += edits[i].nameLength + 1 + edits[i].valueLength + 1;
+        }
+    }
+
+    if (!changed)
+    {
+        return (char**)envp;
+    }
+
+    size_t size = (envCount + addedCount + 1) * sizeof(char*) + stringsSize;
+    if (size > bufSize)
+    {
+        *requiredSize = size;
+        return NULL;
+    }
+
+    char **newenvp = (char **)buf;
+    char *strings = (char *)(newenvp + envCount + addedCount + 1);
+    size_t n = 0;
+    for (const char *const *pEnv = envp; pEnv && *pEnv; pEnv++)
+    {
+        newenvp[n] = (char *)*pEnv;
+        for (int i = 0; i < editCount; i++)
+        {
+            const char *current = env_edit_match(*pEnv, &edits[i]);
+            if (current != NULL)
+            {
+                size_t length;
+                if (env_edit_needed(current, &edits[i], &length))
+                {
+                    newenvp[n] = strings;
+                    strings = env_edit_write(strings, current, &edits[i]);
+                }
+
+                break;
+            }
+        }
+
+        n++;
+    }
+
+    for (int i = 0; i < editCount; i++)
+    {
+        if ((found & (1u << i)) == 0 && edits[i].kind != EnvEditExcludePath && (edits[i].kind == EnvEditSetValue || edits[i].valueLength > 0))
+        {
+            newenvp[n++] = strings;
+            strings = env_edit_write(strings, NULL, &edits[i]);
+        }
+    }
+
+    newenvp[n] = NULL; // Last element of envp[] should be a null pointer.
+    return newenvp;
+}
+
 // ======================= for testing ========================
 
 const bool add_value_to_env_for_test(const char *src, const char *value_to_add, const char *envPrefix, char *buf)
@@ -459,3 +676,69 @@ const void scrub_ld_preload_for_test(const char *src, const char *value_to_scrub
         strcpy(buf, src);
     }
 }
+
+const bool apply_env_edit_for_test(const char *const envp[], int kind, const char *name, const char *value, char *buf)
+{
+    env_edit edit;
+    init_env_edit(&edit, (env_edit_kind)kind, name, value);
+
+    char envBuffer[4096];
+    size_t requiredSize;
+    char **result = apply_env_edits(envp, &edit, 1, envBuffer, sizeof(envBuffer), &requiredSize);
+    if (result == NULL)
+    {
+        *buf = '\0';
+        return false;
+    }
+
+    copy_result_to_buf_for_test(result, buf);
+    return result == (char**)envp;
+}
+
+// CODESYNC: SandboxedLinuxUtilsTest.cs
+#define BENCHMARK_DETOURS_PATH "/bxl/libDetours.so"
+#define BENCHMARK_FAM_PATH "/bxl/pip.fam"
+
+/**
+ * Returns the average time (in nanoseconds) it takes to make to 'envp' the changes ensureEnvs makes when child processes are monitored,
+ * either with apply_env_edits or (when 'legacy' is true) with the chain of ensure_* calls.
+ * The legacy functions leak the environments they allocate, so that mode returns -1 if 'envp' doesn't already have every change.
+ */
+const long benchmark_env_edits_for_test(const char *const envp[], int iterations, bool legacy)
+{
+    env_edit edits[4];
+    init_env_edit(&edits[0], EnvEditIncludePath, "LD_PRELOAD", BENCHMARK_DETOURS_PATH);
+    init_env_edit(&edits[1], EnvEditSetValue, "__BUILDXL_FAM_PATH", BENCHMARK_FAM_PATH);
+    init_env_edit(&edits[2], EnvEditSetValue, "__BUILDXL_DETOURS_PATH", BENCHMARK_DETOURS_PATH);
+    init_env_edit(&edits[3], EnvEditSetValue, "__BUILDXL_ROOT_PID", "");
+
+    static char envBuffer[1 << 20];
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < iterations; i++)
+    {
+        if (legacy)
+        {
+            char **result = ensure_paths_included_in_env(envp, "LD_PRELOAD=", BENCHMARK_DETOURS_PATH, NULL);
+            result = ensure_env_value((const char *const *)result, "__BUILDXL_FAM_PATH", BENCHMARK_FAM_PATH);
+            result = ensure_env_value((const char *const *)result, "__BUILDXL_DETOURS_PATH", BENCHMARK_DETOURS_PATH);
+            result = ensure_env_value((const char *const *)result, "__BUILDXL_ROOT_PID", "");
+            if (result != (char**)envp)
+            {
+                return -1;
+            }
+        }
+        else
+        {
+            size_t requiredSize;
+            if (apply_env_edits(envp, edits, 4, envBuffer, sizeof(envBuffer), &requiredSize) == NULL)
+            {
+                return -1;
+            }
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    long elapsed = (end.tv_sec - start.tv_sec) * 1000000000L + (end.tv_nsec - start.tv_nsec);
+    return iterations > 0 ? elapsed / iterations : 0;
+}
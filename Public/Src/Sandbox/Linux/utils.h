@@ -1,6 +1,10 @@
 // Copyright (c) Microsoft Corporation.
 // Licensed under the MIT License.
 
+#pragma once
+
+#include <stddef.h>
+
 #ifdef __cplusplus
 #define DLL_EXPORT extern "C"
 #else
@@ -85,6 +89,47 @@ DLL_EXPORT const char* scrub_ld_preload(const char *src, const char *value_to_sc
  */
 DLL_EXPORT char** remove_path_from_LDPRELOAD(const char *const envp[], const char *path);
 
+// Kinds of changes apply_env_edits can make to an environment variable
+typedef enum
+{
+    // The variable must be set to the given value
+    EnvEditSetValue,
+    // The given value must be one of the colon-separated values of the variable (it is appended when missing)
+    EnvEditIncludePath,
+    // The given value must not be one of the colon-separated values of the variable
+    EnvEditExcludePath,
+} env_edit_kind;
+
+// A change to make to an environment variable. Lengths are computed once by init_env_edit, so applying an edit doesn't need to.
+typedef struct
+{
+    env_edit_kind kind;
+    const char *name;
+    size_t nameLength;
+    const char *value;
+    size_t valueLength;
+} env_edit;
+
+// Maximum number of edits apply_env_edits can take at once
+#define MAX_ENV_EDITS 32
+
+/**
+ * Initializes 'edit'. 'name' is the name of the variable (without '='). Both strings must outlive the edit.
+ */
+DLL_EXPORT void init_env_edit(env_edit *edit, env_edit_kind kind, const char *name, const char *value);
+
+/**
+ * Applies 'edits' (at most MAX_ENV_EDITS, on distinct variables) to 'envp' without allocating memory.
+ *
+ * If 'envp' already satisfies every edit, 'envp' itself is returned: this only takes a single scan of 'envp'.
+ * Otherwise the new environment is written to 'buf' (the array of pointers followed by the contents of the modified
+ * variables; unmodified variables point into 'envp') and 'buf' is returned. Variables set by an edit but missing
+ * from 'envp' are appended. Whenever a variable appears more than once, every occurrence is edited.
+ *
+ * If 'bufSize' is not enough to hold the new environment, NULL is returned and the required size is stored in 'requiredSize'.
+ */
+DLL_EXPORT char** apply_env_edits(const char *const envp[], const env_edit *edits, int editCount, void *buf, size_t bufSize, size_t *requiredSize);
+
 // Test wrappers to make p-invoke easier.
 
 DLL_EXPORT const bool add_value_to_env_for_test(const char *src, const char *value_to_add, const char *envPrefix, char *buf);
@@ -92,4 +137,6 @@ DLL_EXPORT const bool ensure_env_value_for_test(const char *const envp[], char c
 DLL_EXPORT const bool ensure_2_paths_included_in_env_for_test(const char *const envp[], char const *envPrefix, const char *path0, const char *path1, char *buf);
 DLL_EXPORT const bool ensure_1_path_included_in_env_for_test(const char *const envp[], char const *envPrefix, const char *path, char *buf);
 DLL_EXPORT const void scrub_ld_preload_for_test(const char *src, const char *value_to_scrub, char *buf);
-DLL_EXPORT const bool remove_path_from_LDPRELOAD_for_test(const char *const envp[], char *path, char *buf0, char *buf1, char *buf2);
\ No newline at end of file
+DLL_EXPORT const bool remove_path_from_LDPRELOAD_for_test(const char *const envp[], char *path, char *buf0, char *buf1, char *buf2);
+DLL_EXPORT const bool apply_env_edit_for_test(const char *const envp[], int kind, const char *name, const char *value, char *buf);
+DLL_EXPORT const long benchmark_env_edits_for_test(const char *const envp[], int iterations, bool legacy);
\ No newline at end of file
@@ -6,6 +6,7 @@
 
 #include <EndpointSecurity/EndpointSecurity.h>
 #include <Foundation/Foundation.h>
+#include <vector>
 
 class ESClient final
 {
@@ -18,11 +19,17 @@ private:
     dispatch_queue_t eventQueue_ = nullptr;
     xpc_connection_t build_host_ = nullptr;
 
+    std::vector<es_event_type_t> events_;
+    bool subscribed_ = false;
+
 public:
 
-    ESClient(dispatch_queue_t event_queue, pid_t host_pid, xpc_endpoint_t endpoint, es_event_type_t *events, uint32_t event_count);
+    ESClient(dispatch_queue_t event_queue, pid_t host_pid, xpc_endpoint_t endpoint, es_event_type_t *events, uint32_t event_count, bool subscribed = true);
     ~ESClient();
 
+    // Subscribes to (or unsubscribes from) the events of this client, so that ES doesn't deliver events no running pip needs
+    bool SetSubscribed(bool subscribed);
+
     int TearDown(xpc_object_t remote = nullptr, xpc_object_t reply = nullptr);
 };
 
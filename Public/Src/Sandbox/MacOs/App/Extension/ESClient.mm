@@ -8,7 +8,7 @@
 #include "IOEvent.hpp"
 #include "XPCConstants.hpp"
 
-ESClient::ESClient(dispatch_queue_t event_queue, pid_t host_pid, xpc_endpoint_t endpoint, es_event_type_t *events, uint32_t event_count)
+ESClient::ESClient(dispatch_queue_t event_queue, pid_t host_pid, xpc_endpoint_t endpoint, es_event_type_t *events, uint32_t event_count, bool subscribed)
 {
     assert(event_queue != nullptr);
     assert(endpoint != nullptr);
@@ -16,6 +16,7 @@ ESClient::ESClient(dispatch_queue_t event_queue, pid_t host_pid, xpc_endpoint_t
 
     host_pid_ = host_pid;
     eventQueue_ = event_queue;
+    events_.assign(events, events + event_count);
     build_host_ = xpc_connection_create_from_endpoint(endpoint);
 
     xpc_connection_set_event_handler(build_host_, ^(xpc_object_t message)
@@ -30,10 +31,10 @@ ESClient::ESClient(dispatch_queue_t event_queue, pid_t host_pid, xpc_endpoint_t
     xpc_connection_resume(build_host_);
     
     /*
-        Remark: XPC Event transfer happens within the ES callback here, this adds latency. The ES documentation mentions that an
-                event message can be processed asynchronously through instantly responding (allowing it) and then copying them out
-                using es_retain_message(), to then store and sort them using the appropriate event sequence number `seq_num` -
-                maintaining order is important. This could help alleviate losing events due to ES backpressure!
+        Remark: AUTH events are always allowed, so they are responded to right away instead of after the build host replies, and
+                the ES callback only serializes the event and hands it over to XPC. The callback never touches the message after it
+                returns, so there is no need to retain it. Events are sent in the order ES delivers them, and XPC keeps the
+                messages of a connection in order, so the build host receives them in sequence without sorting by `seq_num`.
      
                 Additionally, ES now offers es_mute_path(...) and a path blacklist could be created that mutes events from processes
                 from this list on setup to avoid tons of events being captured if the system is subscribed to a lot of events, e.g.
@@ -44,28 +45,28 @@ ESClient::ESClient(dispatch_queue_t event_queue, pid_t host_pid, xpc_endpoint_t
     
     es_new_client_result_t result = es_new_client(&client_, ^(es_client_t *c, const es_message_t *message)
     {
-        pid_t pid = audit_token_to_pid(message->process->audit_token);
-        if (host_pid_ == pid || getppid() == pid || getpid() == pid)
+        if (message->action_type == ES_ACTION_TYPE_AUTH)
         {
-            if (message->action_type == ES_ACTION_TYPE_AUTH)
+            switch(message->event_type)
             {
-                switch(message->event_type)
+                case ES_EVENT_TYPE_AUTH_OPEN:
                 {
-                    case ES_EVENT_TYPE_AUTH_OPEN:
-                    {
-                        // Currently the ES client allows every flag based event without exception
-                        es_respond_flags_result(client_,message, 0x7fffffff, false);
-                        break;
-                    }
-                    default:
-                    {
-                        // Currently the ES client allows every auth based event without exception
-                        es_respond_auth_result(client_, message, ES_AUTH_RESULT_ALLOW, false);
-                        break;
-                    }
+                    // Currently the ES client allows every flag based event without exception
+                    es_respond_flags_result(client_,message, 0x7fffffff, false);
+                    break;
+                }
+                default:
+                {
+                    // Currently the ES client allows every auth based event without exception
+                    es_respond_auth_result(client_, message, ES_AUTH_RESULT_ALLOW, false);
+                    break;
                 }
             }
+        }
 
+        pid_t pid = audit_token_to_pid(message->process->audit_token);
+        if (host_pid_ == pid || getppid() == pid || getpid() == pid)
+        {
             es_mute_process(client_, &message->process->audit_token);
             return;
         }
@@ -73,13 +74,10 @@ ESClient::ESClient(dispatch_queue_t event_queue, pid_t host_pid, xpc_endpoint_t
         IOEvent event(message);
         size_t msg_length = IOEvent::max_size();
         char msg[msg_length];
-
-        omemorystream oms(msg, sizeof(msg));
-        oms << event;
+        size_t size = event.Serialize(msg, sizeof(msg));
 
         xpc_object_t xpc_payload = xpc_dictionary_create(NULL, NULL, 0);
-        xpc_dictionary_set_string(xpc_payload, IOEventKey, msg);
-        xpc_dictionary_set_uint64(xpc_payload, IOEventLengthKey, event.Size());
+        xpc_dictionary_set_data(xpc_payload, IOEventKey, msg, size);
 
         xpc_connection_send_message_with_reply(build_host_, xpc_payload, eventQueue_, ^(xpc_object_t response)
         {
@@ -91,26 +89,11 @@ ESClient::ESClient(dispatch_queue_t event_queue, pid_t host_pid, xpc_endpoint_t
                 switch (status)
                 {
                     case xpc_response_mute_process:
-                    case xpc_response_auth:
                     {
+                        // AUTH events were already responded to, only muting is left to do ('message' must not be used here)
                         if (client_)
                         {
-                            switch(message->event_type)
-                            {
-                                case ES_EVENT_TYPE_AUTH_OPEN:
-                                    es_respond_flags_result(client_,message, 0x7fffffff, false);
-                                    break;
-                                default:
-                                    es_respond_auth_result(client_, message, ES_AUTH_RESULT_ALLOW, false);
-                                    break;
-                            }
-                            
-                            if (status == xpc_response_mute_process)
-                            {
-                                es_mute_process(client_, event.GetProcessAuditToken());
-                            }
-                            
-                            break;
+                            es_mute_process(client_, event.GetProcessAuditToken());
                         }
                         break;
                     }
@@ -135,6 +118,8 @@ ESClient::ESClient(dispatch_queue_t event_queue, pid_t host_pid, xpc_endpoint_t
                 }
             }
         });
+
+        xpc_release(xpc_payload);
     });
 
     /*
@@ -155,16 +140,52 @@ ESClient::ESClient(dispatch_queue_t event_queue, pid_t host_pid, xpc_endpoint_t
         exit(EXIT_FAILURE);
     }
 
-    es_return_t subscribe_result = es_subscribe(client_, (es_event_type_t *)events, event_count);
-    if (subscribe_result != ES_RETURN_SUCCESS)
+    for (const char *path : es_muted_executables_)
+    {
+        if (es_mute_path_literal(client_, path) != ES_RETURN_SUCCESS)
+        {
+            log_debug("Failed muting executable: %{public}s", path);
+        }
+    }
+
+    for (const char *prefix : es_muted_executable_prefixes_)
+    {
+        if (es_mute_path_prefix(client_, prefix) != ES_RETURN_SUCCESS)
+        {
+            log_debug("Failed muting executables under: %{public}s", prefix);
+        }
+    }
+
+    if (subscribed && !SetSubscribed(true))
     {
-        log_error("Failed subscribing to the EndpointSecurity backend: %d", subscribe_result);
         exit(EXIT_FAILURE);
     }
 
     log_debug("Successfully initialized an EndpointSecurity client, tracking: %d event(s).", event_count);
 }
 
+bool ESClient::SetSubscribed(bool subscribed)
+{
+    if (client_ == nullptr || subscribed == subscribed_)
+    {
+        return true;
+    }
+
+    es_return_t result = subscribed
+        ? es_subscribe(client_, events_.data(), (uint32_t)events_.size())
+        : es_unsubscribe(client_, events_.data(), (uint32_t)events_.size());
+
+    if (result != ES_RETURN_SUCCESS)
+    {
+        log_error("Failed %s the EndpointSecurity backend: %d", subscribed ? "subscribing to" : "unsubscribing from", result);
+        return false;
+    }
+
+    subscribed_ = subscribed;
+    log_debug("EndpointSecurity client %s %zu event(s).", subscribed ? "subscribed to" : "unsubscribed from", events_.size());
+    return true;
+}
+
 int ESClient::TearDown(xpc_object_t remote, xpc_object_t reply)
 {
     if (client_ != nullptr)
@@ -184,6 +205,7 @@ int ESClient::TearDown(xpc_object_t remote, xpc_object_t reply)
         }
 
         client_ = nullptr;
+        subscribed_ = false;
 
         if (remote && reply)
         {
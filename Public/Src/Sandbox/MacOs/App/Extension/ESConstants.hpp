@@ -70,6 +70,44 @@ const es_event_type_t es_read_events_[] =
 //    ES_EVENT_TYPE_AUTH_READLINK,
 };
 
+/*
+
+ Events of processes running these executables are muted in every ES client right away, so that they never reach the build host.
+ These are system daemons that constantly access files on their own behalf and can never be part of a process tree being built.
+
+ */
+
+const char *es_muted_executables_[] =
+{
+    "/sbin/launchd",
+    "/usr/libexec/logd",
+    "/usr/libexec/syspolicyd",
+    "/usr/libexec/trustd",
+    "/usr/sbin/cfprefsd",
+    "/usr/sbin/distnoted",
+    "/usr/sbin/notifyd",
+    "/usr/sbin/securityd",
+    "/System/Library/Frameworks/CoreServices.framework/Frameworks/Metadata.framework/Versions/A/Support/mds",
+    "/System/Library/Frameworks/CoreServices.framework/Frameworks/Metadata.framework/Versions/A/Support/mds_stores",
+    "/System/Library/Frameworks/CoreServices.framework/Frameworks/Metadata.framework/Versions/A/Support/mdworker",
+    "/System/Library/Frameworks/CoreServices.framework/Frameworks/Metadata.framework/Versions/A/Support/mdworker_shared",
+};
+
+/*
+
+ Same as above, for all the executables under these directories (Spotlight, Finder, browsers, etc.)
+
+ */
+
+const char *es_muted_executable_prefixes_[] =
+{
+    "/System/Library/CoreServices/",
+    "/Applications/Safari.app/",
+    "/Applications/Google Chrome.app/",
+    "/Applications/Firefox.app/",
+    "/Applications/Microsoft Edge.app/",
+};
+
 /*
  
  When testing the ES sandbox on the CI VM's only two cores are available and hence a maximum of four ES clients can be instantiated
@@ -4,6 +4,8 @@
 #ifndef XPCConstants_h
 #define XPCConstants_h
 
+#include <stdint.h>
+
 enum XPCCommands : unsigned int
 {
     xpc_response_error = 0,
@@ -19,6 +21,25 @@ enum XPCCommands : unsigned int
     xpc_get_es_connection,
     xpc_set_es_connection,
     xpc_kill_es_connection,
+
+    xpc_set_es_subscriptions,
+
+    xpc_set_detours_event_ring,
+    xpc_drain_detours_event_ring,
+};
+
+/*
+ 
+ Groups of EndpointSecurity events, as a bitmask sent with 'xpc_set_es_subscriptions': the extension only subscribes to the groups
+ needed by the pips currently running. Process lifetime and exit events are always subscribed to, as process tracking depends on them.
+ 
+ */
+
+enum ESEventGroups : uint64_t
+{
+    es_event_group_none   = 0,
+    es_event_group_writes = 1 << 0,
+    es_event_group_reads  = 1 << 1,
 };
 
 #endif /* XPCConstants_h */
@@ -22,14 +22,17 @@ ESClient *spammy_client = nullptr;
         DISPATCH_QUEUE_SERIAL, QOS_CLASS_USER_INTERACTIVE, -1 \
     ));
 
-#define INIT(client, queue, events) {\
+#define INIT(client, queue, events, subscribed) {\
     int count = sizeof(events) / sizeof(events[0]); \
-    client = count > 0 ? new ESClient(queue, (pid_t)host_pid, es_endpoint, (es_event_type_t *)events, count) : nullptr; \
+    client = count > 0 ? new ESClient(queue, (pid_t)host_pid, es_endpoint, (es_event_type_t *)events, count, subscribed) : nullptr; \
 }
 
 #define TEAR_DOWN(client) \
     if (client != nullptr) client->TearDown(peer, reply);
 
+#define SUBSCRIBE(client, subscribed) \
+    if (client != nullptr && !client->SetSubscribed(subscribed)) success = false;
+
 int main(void)
 {
     // One consumer queue per event bucket and client
@@ -84,18 +87,19 @@ int main(void)
                                     es_endpoint = xpc_dictionary_get_value(message, "connection");
                                     uint64_t host_pid = xpc_dictionary_get_uint64(message, "host_pid");
 
-                                    INIT(lifetime_client, es_lifetime_event_queue, es_lifetime_events_)
-                                    INIT(exit_client, es_exit_event_queue, es_exit_events_)
-                                    INIT(write_client, es_write_event_queue, es_write_events_)
-                                    INIT(read_client, es_read_event_queue, es_read_events_)
+                                    // File events are only subscribed to once a pip needing them starts (see xpc_set_es_subscriptions)
+                                    INIT(lifetime_client, es_lifetime_event_queue, es_lifetime_events_, true)
+                                    INIT(exit_client, es_exit_event_queue, es_exit_events_, true)
+                                    INIT(write_client, es_write_event_queue, es_write_events_, false)
+                                    INIT(read_client, es_read_event_queue, es_read_events_, false)
 /*
  
  When testing the ES sandbox on the CI VM's only two cores are available and hence a maximum of four ES clients can be instantiated (OS constraint).
  To reduce backpressure, more clients should be created and the events bucketed by their 'amount reported', this needs to be dynamically encoded
  depending on the host CPU configuration.
  
-                                    INIT(probe_client, es_probe_event_queue, es_probe_events_)
-                                    INIT(spammy_client, es_spammy_event_queue, es_spammy_events_)
+                                    INIT(probe_client, es_probe_event_queue, es_probe_events_, false)
+                                    INIT(spammy_client, es_spammy_event_queue, es_spammy_events_, false)
  */
                                 }
 
@@ -131,6 +135,21 @@ int main(void)
                                 es_endpoint = nullptr;
                                 break;
                             }
+                            case xpc_set_es_subscriptions:
+                            {
+                                // The union of the event groups needed by the pips currently running in the build host
+                                uint64_t groups = xpc_dictionary_get_uint64(message, "subscriptions");
+                                bool success = true;
+
+                                SUBSCRIBE(write_client, (groups & es_event_group_writes) != 0)
+                                SUBSCRIBE(read_client, (groups & es_event_group_reads) != 0)
+
+                                xpc_object_t reply = xpc_dictionary_create_reply(message);
+                                xpc_dictionary_set_uint64(reply, "response", success ? xpc_response_success : xpc_response_failure);
+                                xpc_connection_send_message(peer, reply);
+
+                                break;
+                            }
                         }
                     }
                 }
@@ -2,7 +2,7 @@
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
 #include "Detours.hpp"
-#include "MemoryStreams.hpp"
+#include "IOEventRing.hpp"
 #include "PathCacheEntry.hpp"
 #include "Trie.hpp"
 #include "XPCConstants.hpp"
@@ -11,6 +11,8 @@
 
 static std::once_flag InitializeOpenPathCache;
 static std::once_flag InitializeWritePathCache;
+static std::once_flag InitializeExecutablePathCache;
+static std::once_flag InitializeResolvedPathCache;
 static std::once_flag InitializeXPC;
 
 static xpc_connection_t bxl_connection = nullptr;
@@ -26,6 +28,75 @@ char *bxl_realpath(const char* file_name, char* buffer)
     return result;
 }
 
+#pragma mark Resolved Path Cache
+
+// The resolved path and the mode of an absolute path, as of the generation of the cache it was resolved in
+struct ResolvedPathCacheEntry final
+{
+    PathCacheEntry resolved;
+    mode_t mode;
+    uint64_t generation;
+
+    ResolvedPathCacheEntry(const char *path, mode_t mode, uint64_t generation)
+        : resolved(path, strlen(path)), mode(mode), generation(generation) {}
+};
+
+// Resolving a path issues a lookup per path component and most events of a process are about paths under the same few
+// directories, so the resolved paths and modes of the absolute paths reported so far are remembered. Interposed calls that
+// can change what a path resolves to bump the generation, which makes all the entries cached before it stale. Relative
+// paths depend on the working directory and are never cached.
+static Trie<ResolvedPathCacheEntry> *resolvedPaths_;
+static std::atomic<uint64_t> resolvedPathsGeneration_(0);
+
+inline void invalidate_resolved_paths()
+{
+    resolvedPathsGeneration_++;
+}
+
+// Returns nullptr if 'path' is not absolute or can't be resolved, in which case the caller resolves it on its own
+std::shared_ptr<ResolvedPathCacheEntry> get_resolved_path(const char *path)
+{
+    if (path == nullptr || path[0] != '/')
+    {
+        return nullptr;
+    }
+
+    std::call_once(InitializeResolvedPathCache, []()
+    {
+        resolvedPaths_ = Trie<ResolvedPathCacheEntry>::createPathTrie();
+    });
+
+    uint64_t generation = resolvedPathsGeneration_.load();
+    std::shared_ptr<ResolvedPathCacheEntry> entry = resolvedPaths_->get(path);
+    if (entry != nullptr && entry->generation == generation)
+    {
+        return entry;
+    }
+
+    char resolved[PATH_MAX + 1] = { '\0' };
+    if (bxl_realpath(path, resolved) == nullptr || strlen(resolved) >= PATH_MAX)
+    {
+        return nullptr;
+    }
+
+    struct stat s;
+    entry.reset(new ResolvedPathCacheEntry(resolved, stat(resolved, &s) == 0 ? s.st_mode : 0, generation));
+    resolvedPaths_->replace(path, entry);
+    return entry;
+}
+
+inline void resolve_path(const char *path, char *buffer)
+{
+    std::shared_ptr<ResolvedPathCacheEntry> entry = get_resolved_path(path);
+    if (entry != nullptr)
+    {
+        memcpy(buffer, entry->resolved.GetPath(), entry->resolved.GetPathLength() + 1);
+        return;
+    }
+
+    bxl_realpath(path, buffer);
+}
+
 int setup_xpc()
 {
     char queue_name[PATH_MAX] = { '\0' };
@@ -103,12 +174,91 @@ inline void handle_xpc_setup()
     }
 }
 
+#pragma mark Event Ring
+
+// The ring the events of this process are written to instead of being sent through XPC (see IOEventRing), and the process it was
+// set up for: a forked child shares the memory of the ring of its parent, so it sets up its own. If the ring can't be set up, the
+// events of the process are sent through XPC.
+static std::atomic<IOEventRing *> eventRing_(nullptr);
+static std::atomic<pid_t> eventRingPid_(0);
+static std::mutex eventRingLock_;
+
+IOEventRing* setup_event_ring()
+{
+    size_t size = IOEventRing::RequiredSize();
+    void *memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON, -1, 0);
+    if (memory == MAP_FAILED)
+    {
+        return nullptr;
+    }
+
+    IOEventRing *ring = IOEventRing::Create(memory);
+
+    xpc_object_t shmem = xpc_shmem_create(memory, size);
+    xpc_object_t xpc_payload = xpc_dictionary_create(NULL, NULL, 0);
+    xpc_dictionary_set_uint64(xpc_payload, "command", xpc_set_detours_event_ring);
+    xpc_dictionary_set_value(xpc_payload, IOEventRingKey, shmem);
+
+    xpc_object_t response = xpc_connection_send_message_with_reply_sync(bxl_connection, xpc_payload);
+    uint64_t status = xpc_get_type(response) == XPC_TYPE_DICTIONARY ? xpc_dictionary_get_uint64(response, "response") : xpc_response_error;
+
+    xpc_release(response);
+    xpc_release(xpc_payload);
+    xpc_release(shmem);
+
+    if (status != xpc_response_success)
+    {
+        munmap(memory, size);
+        return nullptr;
+    }
+
+    return ring;
+}
+
+inline IOEventRing* get_event_ring()
+{
+    pid_t pid = getpid();
+    if (eventRingPid_.load(std::memory_order_acquire) != pid)
+    {
+        std::lock_guard<std::mutex> lock(eventRingLock_);
+        if (eventRingPid_.load() != pid)
+        {
+            eventRing_ = setup_event_ring();
+            eventRingPid_.store(pid, std::memory_order_release);
+        }
+    }
+
+    return eventRing_.load(std::memory_order_relaxed);
+}
+
+// Wakes up the sandbox once it stopped reading the ring
+inline void ring_doorbell()
+{
+    xpc_object_t xpc_payload = xpc_dictionary_create(NULL, NULL, 0);
+    xpc_dictionary_set_uint64(xpc_payload, "command", xpc_drain_detours_event_ring);
+    xpc_connection_send_message(bxl_connection, xpc_payload);
+    xpc_release(xpc_payload);
+}
+
 inline mode_t get_mode(const char *path) 
 {
+    std::shared_ptr<ResolvedPathCacheEntry> entry = get_resolved_path(path);
+    if (entry != nullptr)
+    {
+        return entry->mode;
+    }
+
     struct stat s;
     return stat(path, &s) == 0 ? s.st_mode : 0;    
 }
 
+// Process lifetime events are sent synchronously: since the messages of a connection are delivered in order, a reply
+// also guarantees that all the events sent before by the process have been received, e.g., before it exits or execs.
+inline bool must_send_synchronously(es_event_type_t type)
+{
+    return type == ES_EVENT_TYPE_NOTIFY_EXEC || type == ES_EVENT_TYPE_NOTIFY_FORK || type == ES_EVENT_TYPE_NOTIFY_EXIT;
+}
+
 inline void send_to_sandbox(IOEvent &event, es_event_type_t type = ES_EVENT_TYPE_LAST, bool force_xpc_init = false, bool resolve_paths = true)
 {
     if (event.IsPlistEvent() || event.IsDirectorySpecialCharacterEvent())
@@ -130,25 +280,47 @@ inline void send_to_sandbox(IOEvent &event, es_event_type_t type = ES_EVENT_TYPE
     if (resolve_paths)
     {
         char src_resolved[PATH_MAX + 1] = { '\0' };
-        bxl_realpath(event.GetEventPath(SRC_PATH), src_resolved);
+        resolve_path(event.GetEventPath(SRC_PATH), src_resolved);
         event.SetEventPath(src_resolved, SRC_PATH);
 
         char dst_resolved[PATH_MAX + 1] = { '\0' };
-        bxl_realpath(event.GetEventPath(DST_PATH), dst_resolved);
+        resolve_path(event.GetEventPath(DST_PATH), dst_resolved);
         event.SetEventPath(dst_resolved, DST_PATH);
     }
 
     size_t msg_length = IOEvent::max_size();
     char msg[msg_length];
+    size_t size = event.Serialize(msg, sizeof(msg));
 
-    omemorystream oms(msg, sizeof(msg));
-    oms << event;
+    if (!must_send_synchronously(type))
+    {
+        IOEventRing *ring = get_event_ring();
+        bool ringDoorbell = false;
+        if (ring != nullptr && ring->TryWrite(msg, size, &ringDoorbell))
+        {
+            if (ringDoorbell)
+            {
+                ring_doorbell();
+            }
 
+            return;
+        }
+    }
+
+    // The sandbox drains the ring before handling any message, so the events written to it so far are handled before this one
     xpc_object_t xpc_payload = xpc_dictionary_create(NULL, NULL, 0);
-    xpc_dictionary_set_string(xpc_payload, IOEventKey, msg);
-    xpc_dictionary_set_uint64(xpc_payload, IOEventLengthKey, event.Size());
+    xpc_dictionary_set_data(xpc_payload, IOEventKey, msg, size);
+
+    if (!must_send_synchronously(type))
+    {
+        // Delivery errors are reported to the event handler of the connection, which aborts
+        xpc_connection_send_message(bxl_connection, xpc_payload);
+        xpc_release(xpc_payload);
+        return;
+    }
 
     xpc_object_t response = xpc_connection_send_message_with_reply_sync(bxl_connection, xpc_payload);
+    xpc_release(xpc_payload);
     xpc_type_t xpc_type = xpc_get_type(response);
 
     uint64_t status = xpc_response_error;
@@ -185,11 +357,47 @@ inline void send_to_sandbox(IOEvent &event, es_event_type_t type = ES_EVENT_TYPE
 
 #pragma mark Path Utilities
 
-inline std::string get_executable_path(pid_t pid)
+// Executable paths resolved so far, keyed by pid so a forked child doesn't pick up the path of its parent.
+// The entry of a process is dropped when it execs (see bxl_execve).
+static Trie<PathCacheEntry> *executablePaths_;
+
+#define UNKNOWN_PROCESS_PATH "/unknown-process"
+
+inline std::shared_ptr<PathCacheEntry> resolve_executable_path(pid_t pid)
+{
+    std::shared_ptr<PathCacheEntry> entry(new PathCacheEntry(pid, /* isPid */ true));
+    if (entry->GetPathLength() == 0)
+    {
+        entry.reset(new PathCacheEntry(UNKNOWN_PROCESS_PATH, strlen(UNKNOWN_PROCESS_PATH)));
+    }
+
+    return entry;
+}
+
+// Only resolves the path of 'pid' the first time it is asked for, all the events of a process report the same executable
+inline std::shared_ptr<PathCacheEntry> get_executable_path(pid_t pid)
+{
+    std::call_once(InitializeExecutablePathCache, []()
+    {
+        executablePaths_ = Trie<PathCacheEntry>::createUintTrie();
+    });
+
+    std::shared_ptr<PathCacheEntry> entry = executablePaths_->get(pid);
+    if (entry == nullptr)
+    {
+        entry = resolve_executable_path(pid);
+        executablePaths_->insert(pid, entry);
+    }
+
+    return entry;
+}
+
+inline void invalidate_executable_path(pid_t pid)
 {
-    char fullpath[PATH_MAX] = { '\0' };
-    int success = proc_pidpath(pid, (void *) fullpath, PATH_MAX);
-    return success > 0 ? fullpath : "/unknown-process";
+    if (executablePaths_ != nullptr)
+    {
+        executablePaths_->remove(pid);
+    }
 }
 
 #pragma mark Spawn / Fork Family Functions
@@ -302,6 +510,7 @@ int bxl_execve(const char *path, char *const argv[], char *const envp[])
 {
     // Sending the event has to happen prior to the execve call as it only ever returns on error
     EXEC_EVENT_CONSTRUCTOR(path)
+    invalidate_executable_path(getpid());
     char *interpose = get_env_interposing_entry(envp);
     char **new_env = extend_env_with_interposing_lib(envp, interpose);
 
@@ -363,7 +572,7 @@ int bxl_open(const char *path, int oflag)
 
         std::shared_ptr<PathCacheEntry> entry(new PathCacheEntry(path, 0));
         openedPaths_->insert(path, entry);
-        IOEvent event(getpid(), 0, getppid(), type, ES_ACTION_TYPE_NOTIFY, path, "", get_executable_path(getpid()), get_mode(path));
+        IOEvent event(getpid(), 0, getppid(), type, ES_ACTION_TYPE_NOTIFY, path, "", get_executable_path(getpid())->GetPath(), get_mode(path));
         send_to_sandbox(event);
     }
 
@@ -407,6 +616,7 @@ DYLD_INTERPOSE(bxl_readlink, readlink)
 int bxl_link(const char *src, const char *dst)
 {
     int result = link(src, dst);
+    invalidate_resolved_paths();
     DEFAULT_EVENT_CONSTRUCTOR(ES_EVENT_TYPE_NOTIFY_LINK, src, dst, true)
 }
 DYLD_INTERPOSE(bxl_link, link)
@@ -414,6 +624,7 @@ DYLD_INTERPOSE(bxl_link, link)
 int bxl_symlink(const char *path1, const char *path2)
 {
     int result = symlink(path1, path2);
+    invalidate_resolved_paths();
     DEFAULT_EVENT_CONSTRUCTOR_NO_RESOLVE(ES_EVENT_TYPE_NOTIFY_CREATE, path1, path2, true, true)
 }
 DYLD_INTERPOSE(bxl_symlink, symlink)
@@ -421,6 +632,7 @@ DYLD_INTERPOSE(bxl_symlink, symlink)
 int bxl_unlink(const char *path)
 {
     int result = unlink(path);
+    invalidate_resolved_paths();
     DEFAULT_EVENT_CONSTRUCTOR_NO_RESOLVE(ES_EVENT_TYPE_NOTIFY_UNLINK, path, "", true, true)
 }
 DYLD_INTERPOSE(bxl_unlink, unlink)
@@ -481,6 +693,7 @@ DYLD_INTERPOSE(bxl_chflags, chflags)
 int bxl_chmod(const char *path, mode_t mode)
 {
     int result = chmod(path, mode);
+    invalidate_resolved_paths();
     DEFAULT_EVENT_CONSTRUCTOR(ES_EVENT_TYPE_NOTIFY_SETMODE, path, "", true)
 }
 DYLD_INTERPOSE(bxl_chmod, chmod)
@@ -518,6 +731,7 @@ DYLD_INTERPOSE(bxl_acl_get_link_np, acl_get_link_np)
 int bxl_rename(const char *src, const char *dst)
 {
     int result = rename(src, dst);
+    invalidate_resolved_paths();
     DEFAULT_EVENT_CONSTRUCTOR(ES_EVENT_TYPE_NOTIFY_RENAME, src, dst, false)
 }
 DYLD_INTERPOSE(bxl_rename, rename)
@@ -525,6 +739,7 @@ DYLD_INTERPOSE(bxl_rename, rename)
 int bxl_exchangedata(const char * path1, const char * path2, unsigned int options)
 {
     int result = exchangedata(path1, path2, options);
+    invalidate_resolved_paths();
     DEFAULT_EVENT_CONSTRUCTOR(ES_EVENT_TYPE_NOTIFY_EXCHANGEDATA, path1, path2, false)
 }
 DYLD_INTERPOSE(bxl_exchangedata, exchangedata)
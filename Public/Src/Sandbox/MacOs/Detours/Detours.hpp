@@ -13,6 +13,7 @@
 #include <sys/clonefile.h>
 #include <sys/fcntl.h>
 #include <sys/fsgetpath.h>
+#include <sys/mman.h>
 
 #include <EndpointSecurity/EndpointSecurity.h>
 
@@ -26,7 +27,7 @@
 
 #define DEFAULT_EVENT_CONSTRUCTOR(type, src, dst, mode) \
     int old_errno = errno; \
-    IOEvent event(getpid(), 0, getppid(), type, ES_ACTION_TYPE_NOTIFY, src, dst, get_executable_path(getpid()), mode); \
+    IOEvent event(getpid(), 0, getppid(), type, ES_ACTION_TYPE_NOTIFY, src, dst, get_executable_path(getpid())->GetPath(), mode); \
     send_to_sandbox(event, type); \
     errno = old_errno; \
     return result;
@@ -34,25 +35,25 @@
 #define DEFAULT_EVENT_CONSTRUCTOR_NO_RESOLVE(type, src, dst, mode, report) \
     int old_errno = errno; \
     if (report) { \
-        IOEvent event(getpid(), 0, getppid(), type, ES_ACTION_TYPE_NOTIFY, src, dst, get_executable_path(getpid()), mode); \
+        IOEvent event(getpid(), 0, getppid(), type, ES_ACTION_TYPE_NOTIFY, src, dst, get_executable_path(getpid())->GetPath(), mode); \
         send_to_sandbox(event, type, false, false); \
     } \
     errno = old_errno; \
     return result;
 
 #define EXEC_EVENT_CONSTRUCTOR(path) \
-    IOEvent event(getpid(), 0, getppid(), ES_EVENT_TYPE_NOTIFY_EXEC, ES_ACTION_TYPE_NOTIFY, path, "", get_executable_path(getpid()), /* mode */ 0); \
+    IOEvent event(getpid(), 0, getppid(), ES_EVENT_TYPE_NOTIFY_EXEC, ES_ACTION_TYPE_NOTIFY, path, "", get_executable_path(getpid())->GetPath(), /* mode */ 0); \
     send_to_sandbox(event, ES_EVENT_TYPE_NOTIFY_EXEC, true);\
 
 #define EXIT_EVENT_CONSTRUCTOR() \
-    IOEvent event(getpid(), 0, getppid(), ES_EVENT_TYPE_NOTIFY_EXIT, ES_ACTION_TYPE_NOTIFY, "", "", get_executable_path(getpid()), /*mode*/ 0); \
+    IOEvent event(getpid(), 0, getppid(), ES_EVENT_TYPE_NOTIFY_EXIT, ES_ACTION_TYPE_NOTIFY, "", "", get_executable_path(getpid())->GetPath(), /*mode*/ 0); \
     send_to_sandbox(event, ES_EVENT_TYPE_NOTIFY_EXIT);
 
 #define FORK_EVENT_CONSTRUCTOR(result, child_pid, pid, ppid, cmp) \
     int old_errno = errno; \
     if (result cmp 0) { \
-        std::string fullpath = get_executable_path(*child_pid); \
-        IOEvent event(pid, *child_pid, ppid, ES_EVENT_TYPE_NOTIFY_FORK, ES_ACTION_TYPE_NOTIFY, "", "", fullpath, /*mode*/ 0); \
+        /* a pid can be reused by a child, so its path is always resolved */ \
+        IOEvent event(pid, *child_pid, ppid, ES_EVENT_TYPE_NOTIFY_FORK, ES_ACTION_TYPE_NOTIFY, "", "", resolve_executable_path(*child_pid)->GetPath(), /*mode*/ 0); \
         send_to_sandbox(event, ES_EVENT_TYPE_NOTIFY_FORK); \
     } \
     errno = old_errno; \
@@ -60,7 +61,7 @@
 
 #define STAT_EVENT_CONSTRUCTOR(type, src) \
     int old_errno = errno; \
-    IOEvent event(getpid(), 0, getppid(), type, ES_ACTION_TYPE_NOTIFY, src, "", get_executable_path(getpid()), s->st_mode); \
+    IOEvent event(getpid(), 0, getppid(), type, ES_ACTION_TYPE_NOTIFY, src, "", get_executable_path(getpid())->GetPath(), s->st_mode); \
     send_to_sandbox(event, type); \
     errno = old_errno; \
     return result;
@@ -70,9 +71,9 @@
     if (success == 0) { \
         bool reported = trackedPaths_->get(path) != nullptr; \
         if (!reported) { \
-            std::shared_ptr<PathCacheEntry> entry(new PathCacheEntry(fildes)); \
+            std::shared_ptr<PathCacheEntry> entry(new PathCacheEntry(path, strlen(path))); \
             trackedPaths_->insert(path, entry); \
-            IOEvent event(getpid(), 0, getppid(), ES_EVENT_TYPE_NOTIFY_WRITE, ES_ACTION_TYPE_NOTIFY, path, dst, get_executable_path(getpid()), get_mode(path)); \
+            IOEvent event(getpid(), 0, getppid(), ES_EVENT_TYPE_NOTIFY_WRITE, ES_ACTION_TYPE_NOTIFY, path, dst, get_executable_path(getpid())->GetPath(), get_mode(path)); \
             send_to_sandbox(event, ES_EVENT_TYPE_NOTIFY_WRITE); \
         } \
     } \
@@ -13,4 +13,19 @@
 #define GET_RUSAGE_ERROR    103
 #define RUNTIME_ERROR       -1
 
+/*!
+ * Returns a send right to the host port, obtained once: 'mach_host_self' adds a reference to the port every time it is called.
+ */
+static inline host_t GetHostPort(void)
+{
+    static host_t host = MACH_PORT_NULL;
+    if (host == MACH_PORT_NULL)
+    {
+        // Racing callers get the same port; the extra reference they add is never given back, like the one kept here
+        host = mach_host_self();
+    }
+
+    return host;
+}
+
 #endif /* Dependencies_h */
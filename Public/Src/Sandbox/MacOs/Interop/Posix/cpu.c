@@ -11,31 +11,19 @@ int GetCpuLoadInfo(CpuLoadInfo *buffer, long bufferSize)
         return KERN_MEMORY_ERROR;
     }
 
-    mach_msg_type_number_t cpuInfoCount;
-    processor_info_array_t cpuInfo;
-    natural_t numberOfLogicalCores = 0U;
-    
-    unsigned long totalUserTime = 0;
-    unsigned long totalSystemTime = 0;
-    unsigned long totalIdleTime = 0;
-    
-    kern_return_t error = host_processor_info(mach_host_self(), PROCESSOR_CPU_LOAD_INFO, &numberOfLogicalCores, &cpuInfo, &cpuInfoCount);
+    // The host-wide load already aggregates the load numbers of all logical cores, and needs no array to be allocated
+    host_cpu_load_info_data_t cpuLoad;
+    mach_msg_type_number_t count = HOST_CPU_LOAD_INFO_COUNT;
+
+    kern_return_t error = host_statistics(GetHostPort(), HOST_CPU_LOAD_INFO, (host_info_t)&cpuLoad, &count);
     if(error != KERN_SUCCESS)
     {
         return error;
     }
-    
-    // Iterate over all logical cores and aggregate load numbers
-    for(natural_t i = 0; i < numberOfLogicalCores; ++i)
-    {
-        totalUserTime += cpuInfo[(CPU_STATE_MAX * i) + CPU_STATE_USER] + cpuInfo[(CPU_STATE_MAX * i) + CPU_STATE_NICE];
-        totalSystemTime += cpuInfo[(CPU_STATE_MAX * i) + CPU_STATE_SYSTEM];
-        totalIdleTime += cpuInfo[(CPU_STATE_MAX * i) + CPU_STATE_IDLE];
-    }
-    
-    buffer->systemTime = totalSystemTime;
-    buffer->userTime = totalUserTime;
-    buffer->idleTime = totalIdleTime;
-    
+
+    buffer->systemTime = cpuLoad.cpu_ticks[CPU_STATE_SYSTEM];
+    buffer->userTime = cpuLoad.cpu_ticks[CPU_STATE_USER] + cpuLoad.cpu_ticks[CPU_STATE_NICE];
+    buffer->idleTime = cpuLoad.cpu_ticks[CPU_STATE_IDLE];
+
     return KERN_SUCCESS;
 }
@@ -1,15 +1,32 @@
 // Copyright (c) Microsoft. All rights reserved.
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
+#include <copyfile.h>
+#include <dispatch/dispatch.h>
 #include <fcntl.h>
+#include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/attr.h>
+#include <sys/clonefile.h>
 #include <sys/errno.h>
 #include <sys/mount.h>
+#include <sys/param.h>
 #include <sys/stat.h>
+#include <sys/vnode.h>
 #include <unistd.h>
 
 #include "io.h"
 
+// Number of paths a single worker of 'StatFiles' stats in a row
+#define STAT_FILES_CHUNK_SIZE 64
+
+// Number of entries 'EnumerateDirectoryWithAttributes' hands to its handler at once
+#define DIRECTORY_ENTRIES_CHUNK_SIZE 128
+
+// Size of the buffer 'getattrlistbulk' fills
+#define ATTRIBUTE_BUFFER_SIZE (128 * 1024)
+
 static int CallStat(const char *path, bool followSymlink, struct stat *result)
 {
     int ret;
@@ -88,6 +105,199 @@ int StatFileDescriptor(intptr_t fd, StatBuffer *statBuffer, long bufferSize)
     return result;
 }
 
+int StatFiles(const char **paths, int count, bool followSymlink, StatBuffer *statBuffers, int *errors, long bufferSize)
+{
+    if (sizeof(StatBuffer) != bufferSize)
+    {
+        printf("ERROR: Wrong size of StatBuffer buffer; expected %ld, received %ld\n", sizeof(StatBuffer), bufferSize);
+        return RUNTIME_ERROR;
+    }
+
+    if (count <= 0)
+    {
+        return 0;
+    }
+
+    // Chunks of paths are handed to the threads of a global queue, so the metadata I/O of different paths overlaps
+    size_t numChunks = (count + STAT_FILES_CHUNK_SIZE - 1) / STAT_FILES_CHUNK_SIZE;
+    dispatch_apply(numChunks, dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^(size_t chunk)
+    {
+        int end = MIN(count, (int)((chunk + 1) * STAT_FILES_CHUNK_SIZE));
+        for (int i = (int)(chunk * STAT_FILES_CHUNK_SIZE); i < end; i++)
+        {
+            struct stat fileStat;
+            if (CallStat(paths[i], followSymlink, &fileStat) == 0)
+            {
+                ConvertStatToStatBuffer(&fileStat, &statBuffers[i]);
+                errors[i] = 0;
+            }
+            else
+            {
+                errors[i] = errno;
+            }
+        }
+    });
+
+    return 0;
+}
+
+static uint16_t ObjectTypeToFileType(fsobj_type_t objectType)
+{
+    switch (objectType)
+    {
+        case VREG:  return S_IFREG;
+        case VDIR:  return S_IFDIR;
+        case VLNK:  return S_IFLNK;
+        case VBLK:  return S_IFBLK;
+        case VCHR:  return S_IFCHR;
+        case VFIFO: return S_IFIFO;
+        case VSOCK: return S_IFSOCK;
+        default:    return 0;
+    }
+}
+
+// Parses one entry of a buffer filled by 'getattrlistbulk' (see the attributes 'EnumerateDirectoryWithAttributes' requests)
+static void ParseDirectoryEntry(const char *entry, DirectoryEntry *result)
+{
+    // Attributes follow the entry length and the set of returned attributes, in the order of the attribute bits,
+    // except for ATTR_CMN_ERROR which comes first; attributes that were not returned take no space
+    const char *field = entry + sizeof(uint32_t);
+    attribute_set_t returned = *(attribute_set_t *)field;
+    field += sizeof(attribute_set_t);
+
+    memset(result, 0, offsetof(DirectoryEntry, d_name));
+
+    if (returned.commonattr & ATTR_CMN_ERROR)
+    {
+        result->d_error = *(uint32_t *)field;
+        field += sizeof(uint32_t);
+    }
+
+    if (returned.commonattr & ATTR_CMN_NAME)
+    {
+        attrreference_t nameRef = *(attrreference_t *)field;
+        const char *name = field + nameRef.attr_dataoffset;
+        size_t length = strnlen(name, MIN(nameRef.attr_length, MAXNAMLEN));
+        memcpy(result->d_name, name, length);
+        result->d_name[length] = '\0';
+        result->d_namlen = (uint16_t)length;
+        field += sizeof(attrreference_t);
+    }
+    else
+    {
+        result->d_name[0] = '\0';
+    }
+
+    if (returned.commonattr & ATTR_CMN_OBJTYPE)
+    {
+        result->st_mode |= ObjectTypeToFileType(*(fsobj_type_t *)field);
+        field += sizeof(fsobj_type_t);
+    }
+
+    if (returned.commonattr & ATTR_CMN_MODTIME)
+    {
+        struct timespec modificationTime = *(struct timespec *)field;
+        result->st_mtimespec      = modificationTime.tv_sec;
+        result->st_mtimespec_nsec = modificationTime.tv_nsec;
+        field += sizeof(struct timespec);
+    }
+
+    if (returned.commonattr & ATTR_CMN_ACCESSMASK)
+    {
+        result->st_mode |= (*(uint32_t *)field) & ~S_IFMT;
+        field += sizeof(uint32_t);
+    }
+
+    if (returned.commonattr & ATTR_CMN_FILEID)
+    {
+        result->d_ino = *(uint64_t *)field;
+        field += sizeof(uint64_t);
+    }
+
+    if (returned.fileattr & ATTR_FILE_DATALENGTH)
+    {
+        result->st_size = *(off_t *)field;
+        field += sizeof(off_t);
+    }
+}
+
+int EnumerateDirectoryWithAttributes(const char *path, DirectoryEntriesHandler handler, long entrySize)
+{
+    if (sizeof(DirectoryEntry) != entrySize)
+    {
+        printf("ERROR: Wrong size of DirectoryEntry buffer; expected %ld, received %ld\n", sizeof(DirectoryEntry), entrySize);
+        return RUNTIME_ERROR;
+    }
+
+    int fd;
+    while ((fd = open(path, O_RDONLY | O_DIRECTORY)) < 0 && errno == EINTR);
+    if (fd < 0)
+    {
+        return RUNTIME_ERROR;
+    }
+
+    struct attrlist attributes = {0};
+    attributes.bitmapcount = ATTR_BIT_MAP_COUNT;
+    attributes.commonattr  = ATTR_CMN_RETURNED_ATTRS | ATTR_CMN_ERROR | ATTR_CMN_NAME | ATTR_CMN_OBJTYPE |
+                             ATTR_CMN_MODTIME | ATTR_CMN_ACCESSMASK | ATTR_CMN_FILEID;
+    attributes.fileattr    = ATTR_FILE_DATALENGTH;
+
+    char *attributeBuffer   = (char *)malloc(ATTRIBUTE_BUFFER_SIZE);
+    DirectoryEntry *entries = (DirectoryEntry *)malloc(DIRECTORY_ENTRIES_CHUNK_SIZE * sizeof(DirectoryEntry));
+
+    int result = 0;
+    int error  = 0;
+    if (attributeBuffer == NULL || entries == NULL)
+    {
+        result = RUNTIME_ERROR;
+        error  = ENOMEM;
+    }
+
+    bool proceed = true;
+    while (result == 0 && proceed)
+    {
+        int numEntries = getattrlistbulk(fd, &attributes, attributeBuffer, ATTRIBUTE_BUFFER_SIZE, 0);
+        if (numEntries < 0)
+        {
+            if (errno == EINTR) continue;
+
+            result = RUNTIME_ERROR;
+            error  = errno;
+            break;
+        }
+
+        if (numEntries == 0)
+        {
+            break;
+        }
+
+        const char *entry = attributeBuffer;
+        int numParsed = 0;
+        for (int i = 0; i < numEntries && proceed; i++)
+        {
+            ParseDirectoryEntry(entry, &entries[numParsed++]);
+            entry += *(uint32_t *)entry;
+
+            if (numParsed == DIRECTORY_ENTRIES_CHUNK_SIZE || i == numEntries - 1)
+            {
+                proceed   = handler(entries, numParsed);
+                numParsed = 0;
+            }
+        }
+    }
+
+    free(entries);
+    free(attributeBuffer);
+    close(fd);
+
+    if (error != 0)
+    {
+        errno = error;
+    }
+
+    return result;
+}
+
 intptr_t Open(const char *path, int32_t flags, int32_t mode)
 {
     int result;
@@ -95,6 +305,33 @@ intptr_t Open(const char *path, int32_t flags, int32_t mode)
     return result;
 }
 
+int CloneOrCopyFile(const char *source, const char *destination, bool followSymlink)
+{
+    // A clone gets the timestamps, permissions and extended attributes of its source along with its data blocks
+    int result = clonefile(source, destination, followSymlink ? 0 : CLONE_NOFOLLOW);
+    if (result == 0 || (errno != ENOTSUP && errno != EXDEV))
+    {
+        return result;
+    }
+
+    // Not an APFS volume, or not the same one: copy the data and the metadata
+    copyfile_flags_t flags = COPYFILE_ALL | COPYFILE_EXCL | (followSymlink ? 0 : COPYFILE_NOFOLLOW_SRC);
+    if (copyfile(source, destination, NULL, flags) == 0)
+    {
+        return 0;
+    }
+
+    // Don't leave a partial copy behind
+    int error = errno;
+    if (error != EEXIST)
+    {
+        unlink(destination);
+    }
+
+    errno = error;
+    return RUNTIME_ERROR;
+}
+
 int SetAttributeList(const char *path, uint commonAttr, struct timespec spec, bool followSymLink)
 {
     struct attrlist attributes = {0};
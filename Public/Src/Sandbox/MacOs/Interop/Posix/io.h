@@ -4,6 +4,7 @@
 #ifndef io_h
 #define io_h
 
+#include <sys/dirent.h>
 #include "Dependencies.h"
 
 #define STD_ERROR_CODE -1
@@ -28,6 +29,23 @@ typedef struct {
     int64_t st_birthtimespec_nsec;   /* Time of birth (or creation) - nsec */
 } StatBuffer;
 
+typedef struct {
+    uint64_t d_ino;                   /* Inode number */
+    uint16_t st_mode;                 /* File type and mode */
+    uint16_t d_namlen;                /* Length of 'd_name', in bytes, not including the terminating null character */
+    int32_t d_error;                  /* Error the attributes of this entry could not be retrieved with (0 if none) */
+    int64_t st_size;                  /* Total size, in bytes (0 for anything but regular files) */
+    int64_t st_mtimespec;             /* Time of last modification */
+    int64_t st_mtimespec_nsec;        /* Time of last modification - nsec */
+    char d_name[MAXNAMLEN + 1];       /* Entry name (UTF-8, null-terminated) */
+} DirectoryEntry;
+
+/*!
+ * Receives the next 'count' entries of a directory enumeration.
+ * @result Whether the enumeration should go on.
+ */
+typedef bool (*DirectoryEntriesHandler)(const DirectoryEntry *entries, int count);
+
 /*!
  * Returns information about a file specified by the given path.
  * @param path Location of the file
@@ -47,6 +65,29 @@ int StatFile(const char *path, bool followSymlink, StatBuffer *statBuffer, long
 */
 int StatFileDescriptor(intptr_t fd, StatBuffer *statBuffer, long bufferSize);
 
+/*!
+ * Returns information about the files specified by the given paths, stat-ing them concurrently.
+ * @param paths Locations of the files
+ * @param count Number of elements of 'paths', 'statBuffers' and 'errors'
+ * @param followSymlink Whether to follow symlinks, if true, then use 'stat', otherwise use 'lstat'
+ * @param statBuffers Buffers where the information about each file is stored
+ * @param errors Where the errno of each failed call (or 0 for each successful one) is stored
+ * @param bufferSize Allocated size of one 'StatBuffer' struct
+ * @result 0 when the information about every file was requested (each file has its own error code in 'errors'), error code otherwise.
+*/
+int StatFiles(const char **paths, int count, bool followSymlink, StatBuffer *statBuffers, int *errors, long bufferSize);
+
+/*!
+ * Enumerates the entries of the given directory, together with their types, sizes, modification times and inode numbers,
+ * using 'getattrlistbulk' (which returns the attributes of many entries per call, sparing a 'stat' per entry).
+ * The entries are handed to 'handler' in chunks, in the order the file system returns them ('.' and '..' excluded).
+ * @param path Location of the directory
+ * @param handler Receives the entries
+ * @param entrySize Size of the 'DirectoryEntry' struct the caller expects
+ * @result 0 on success (including when 'handler' stopped the enumeration), error code otherwise.
+*/
+int EnumerateDirectoryWithAttributes(const char *path, DirectoryEntriesHandler handler, long entrySize);
+
 /*!
  * Opens file specified by path.
  * @param path Given path to open
@@ -56,6 +97,17 @@ int StatFileDescriptor(intptr_t fd, StatBuffer *statBuffer, long bufferSize);
 */
 intptr_t Open(const char *path, int32_t flags, int32_t mode);
 
+/*!
+ * Makes 'destination' a copy of 'source', including its timestamps, permissions and extended attributes.
+ * The copy is a clone sharing the data blocks of 'source' (see 'clonefile') when both are on the same APFS volume,
+ * and a plain copy otherwise.
+ * @param source Location of the file to copy
+ * @param destination Location of the copy, which must not exist
+ * @param followSymlink Whether to copy the target of 'source' when it is a symlink (instead of the symlink itself)
+ * @result 0 on success, error code otherwise.
+*/
+int CloneOrCopyFile(const char *source, const char *destination, bool followSymlink);
+
 ssize_t SafeReadLink(const char *path, char *buffer, size_t bufferSize);
 
 int SetTimeStampsForFilePath(const char *path, bool followSymlink, StatBuffer buffer);
@@ -11,19 +11,26 @@ int GetRamUsageInfo(RamUsageInfo *buffer, long bufferSize)
         return RUNTIME_ERROR;
     }
 
-    vm_size_t page_size;
+    // The page size never changes
+    static vm_size_t page_size = 0;
     kern_return_t error;
 
-    error = host_page_size(mach_host_self(), &page_size);
-    if(error != KERN_SUCCESS)
+    if (page_size == 0)
     {
-        return GET_PAGE_SIZE_ERROR;
+        vm_size_t size;
+        error = host_page_size(GetHostPort(), &size);
+        if(error != KERN_SUCCESS)
+        {
+            return GET_PAGE_SIZE_ERROR;
+        }
+
+        page_size = size;
     }
 
     natural_t count = HOST_VM_INFO64_COUNT;
     struct vm_statistics64 stats;
 
-    error = host_statistics64(mach_host_self(), HOST_VM_INFO64, (host_info64_t)&stats, &count);
+    error = host_statistics64(GetHostPort(), HOST_VM_INFO64, (host_info64_t)&stats, &count);
     if (error != KERN_SUCCESS)
     {
         return GET_VM_STATS_ERROR;
@@ -44,6 +51,45 @@ int GetRamUsageInfo(RamUsageInfo *buffer, long bufferSize)
 
 int GetMemoryPressureLevel(int *level)
 {
+    // Resolving the name is what makes sysctlbyname expensive, so it is only done once
+    static int mib[CTL_MAXNAME];
+    static size_t mibLength = 0;
+
+    if (mibLength == 0)
+    {
+        size_t length = CTL_MAXNAME;
+        int result = sysctlnametomib("kern.memorystatus_vm_pressure_level", mib, &length);
+        if (result != 0)
+        {
+            return result;
+        }
+
+        mibLength = length;
+    }
+
     size_t length = sizeof(int);
-    return sysctlbyname("kern.memorystatus_vm_pressure_level", level, &length, NULL, 0);
+    return sysctl(mib, (u_int)mibLength, level, &length, NULL, 0);
+}
+
+int GetSystemResourceSnapshot(SystemResourceSnapshot *buffer, long bufferSize)
+{
+    if (sizeof(SystemResourceSnapshot) != bufferSize)
+    {
+        printf("ERROR: Wrong size of SystemResourceSnapshot buffer; expected %ld, received %ld\n", sizeof(SystemResourceSnapshot), bufferSize);
+        return RUNTIME_ERROR;
+    }
+
+    int error = GetCpuLoadInfo(&buffer->cpu, sizeof(CpuLoadInfo));
+    if (error != KERN_SUCCESS)
+    {
+        return error;
+    }
+
+    error = GetRamUsageInfo(&buffer->ram, sizeof(RamUsageInfo));
+    if (error != KERN_SUCCESS)
+    {
+        return error;
+    }
+
+    return GetMemoryPressureLevel(&buffer->memoryPressureLevel);
 }
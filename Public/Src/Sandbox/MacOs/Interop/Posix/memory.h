@@ -6,6 +6,7 @@
 
 #include <sys/sysctl.h>
 #include "Dependencies.h"
+#include "cpu.h"
 
 #define GET_PAGE_SIZE_ERROR     101
 #define GET_VM_STATS_ERROR      102
@@ -23,7 +24,20 @@ typedef struct {
     uint64_t internal;
 } RamUsageInfo;
 
+// Everything the resource monitors of the host sample at once
+typedef struct {
+    CpuLoadInfo cpu;
+    RamUsageInfo ram;
+    int memoryPressureLevel;
+} SystemResourceSnapshot;
+
 int GetRamUsageInfo(RamUsageInfo *buffer, long bufferSize);
 int GetMemoryPressureLevel(int *level);
 
+/*!
+ * Fills 'buffer' like 'GetCpuLoadInfo', 'GetRamUsageInfo' and 'GetMemoryPressureLevel' would, in a single call.
+ * @result KERN_SUCCESS on success, the error code of the first call that failed otherwise.
+ */
+int GetSystemResourceSnapshot(SystemResourceSnapshot *buffer, long bufferSize);
+
 #endif /* memory_h */
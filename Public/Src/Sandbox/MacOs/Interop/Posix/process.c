@@ -7,6 +7,7 @@
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/param.h>
 #include <sys/sysctl.h>
 #include <unistd.h>
 
@@ -14,52 +15,115 @@
 
 void DumpThreadState(void);
 
-static int ProcessTreeResourceUsage(pid_t pid, const rlim_t max_proc_count, ProcessResourceUsage *buffer, bool includeChildren)
+// Upper bound of the number of processes sampled in a process tree, in case RLIMIT_NPROC is unlimited
+#define MAX_SAMPLED_PROCESS_TREE_SIZE (16 * 1024)
+
+// Pids of the process tree being sampled, in breadth-first order. The buffer only grows, and is reused by all
+// the samples taken by the same thread, so sampling doesn't allocate after the first time.
+static __thread pid_t *t_treePids = NULL;
+static __thread size_t t_treePidsCapacity = 0;
+
+static bool EnsureTreePidsCapacity(size_t capacity)
 {
-    rusage_info_current rusage;
-    if (proc_pid_rusage(pid, RUSAGE_INFO_CURRENT, (void **)&rusage) != 0)
+    if (capacity <= t_treePidsCapacity)
+    {
+        return true;
+    }
+
+    pid_t *pids = (pid_t *) realloc(t_treePids, capacity * sizeof(pid_t));
+    if (pids == NULL)
+    {
+        return false;
+    }
+
+    t_treePids = pids;
+    t_treePidsCapacity = capacity;
+    return true;
+}
+
+static void AddProcessResourceUsage(const rusage_info_current *rusage, ProcessResourceUsage *buffer)
+{
+    buffer->systemTime += rusage->ri_system_time;
+    buffer->userTime += rusage->ri_user_time;
+
+    buffer->diskio_bytesRead += rusage->ri_diskio_bytesread;
+    buffer->diskio_bytesWritten += rusage->ri_diskio_byteswritten;
+
+    buffer->rss += rusage->ri_resident_size;
+}
+
+// Walks the process tree breadth first (the root usage is passed in, as the caller already sampled it).
+// The children of a process that can't be sampled anymore are skipped, like the process itself.
+static int ProcessTreeResourceUsage(pid_t pid, const rusage_info_current *rootUsage, size_t maxProcessCount, ProcessResourceUsage *buffer, bool includeChildren)
+{
+    AddProcessResourceUsage(rootUsage, buffer);
+    if (!includeChildren)
+    {
+        return KERN_SUCCESS;
+    }
+
+    if (!EnsureTreePidsCapacity(maxProcessCount))
     {
         return GET_RUSAGE_ERROR;
     }
-    
-    buffer->systemTime += rusage.ri_system_time;
-    buffer->userTime += rusage.ri_user_time;
-    
-    buffer->diskio_bytesRead += rusage.ri_diskio_bytesread;
-    buffer->diskio_bytesWritten += rusage.ri_diskio_byteswritten;
-    
-    buffer->rss += rusage.ri_resident_size;
-    
+
     bool success = true;
-    if (includeChildren)
+    size_t count = 0;
+    size_t next = 0;
+    pid_t parent = pid;
+
+    while (true)
     {
-        pid_t child_pids[max_proc_count];
-        int child_count = proc_listchildpids(pid, child_pids, (int) max_proc_count);
-        
-        for (int i = 0; i < child_count; i++)
+        // Queue the children of 'parent'. The size of the buffer is expected in bytes, the number of pids is returned.
+        if (count < maxProcessCount)
+        {
+            int childCount = proc_listchildpids(parent, t_treePids + count, (int) ((maxProcessCount - count) * sizeof(pid_t)));
+            if (childCount > 0)
+            {
+                count += MIN((size_t) childCount, maxProcessCount - count);
+            }
+        }
+
+        // The next queued process that can still be sampled is the next parent
+        bool sampled = false;
+        while (!sampled && next < count)
         {
-            int child_pid = child_pids[i];
-            success &= (ProcessTreeResourceUsage(child_pid, max_proc_count, buffer, includeChildren) == 0);
+            parent = t_treePids[next++];
+
+            rusage_info_current rusage;
+            sampled = proc_pid_rusage(parent, RUSAGE_INFO_CURRENT, (void **)&rusage) == 0;
+            if (sampled)
+            {
+                AddProcessResourceUsage(&rusage, buffer);
+            }
+            else
+            {
+                success = false;
+            }
+        }
+
+        if (!sampled)
+        {
+            break;
         }
     }
-    
+
     return success ? KERN_SUCCESS : GET_RUSAGE_ERROR;
 }
 
-int GetProcessResourceUsageSnapshot(pid_t pid, ProcessResourceUsage *buffer, long bufferSize, bool includeChildProcesses)
-{
-    if (sizeof(ProcessResourceUsage) != bufferSize)
-    {
-        printf("ERROR: Wrong size of ProcessResourceUsage buffer; expected %ld, received %ld\n", sizeof(ProcessResourceUsage), bufferSize);
-        return GET_RUSAGE_ERROR;
-    }
+typedef struct {
+    size_t maxProcessCount;
+    double timebaseFactor;
+} SnapshotContext;
 
+static int InitializeSnapshotContext(SnapshotContext *context)
+{
     struct rlimit rl;
     if (getrlimit(RLIMIT_NPROC, &rl) != 0)
     {
         return GET_RUSAGE_ERROR;
     }
-    
+
     mach_timebase_info_data_t timebase;
     kern_return_t ret = mach_timebase_info(&timebase);
     uint32_t numer = 1, denom = 1;
@@ -70,6 +134,15 @@ int GetProcessResourceUsageSnapshot(pid_t pid, ProcessResourceUsage *buffer, lon
         denom = timebase.denom;
     }
 
+    context->maxProcessCount = rl.rlim_cur == RLIM_INFINITY || rl.rlim_cur > MAX_SAMPLED_PROCESS_TREE_SIZE
+        ? MAX_SAMPLED_PROCESS_TREE_SIZE
+        : (size_t) rl.rlim_cur;
+    context->timebaseFactor = (((double) numer) / denom) / NSEC_PER_SEC;
+    return KERN_SUCCESS;
+}
+
+static int ProcessResourceUsageSnapshot(const SnapshotContext *context, pid_t pid, ProcessResourceUsage *buffer, bool includeChildProcesses)
+{
     rusage_info_current rusage;
     if (proc_pid_rusage(pid, RUSAGE_INFO_CURRENT, (void **)&rusage) != 0)
     {
@@ -77,16 +150,46 @@ int GetProcessResourceUsageSnapshot(pid_t pid, ProcessResourceUsage *buffer, lon
     }
 
     uint64_t absoluteTime = mach_absolute_time();
-    double factor = (((double) numer) / denom) / NSEC_PER_SEC;
 
-    buffer->startTime = ((long)rusage.ri_proc_start_abstime - (long)absoluteTime) * factor;
+    buffer->startTime = ((long)rusage.ri_proc_start_abstime - (long)absoluteTime) * context->timebaseFactor;
     buffer->exitTime = rusage.ri_proc_exit_abstime != 0
-        ? (((long)rusage.ri_proc_exit_abstime - (long)absoluteTime) * factor)
+        ? (((long)rusage.ri_proc_exit_abstime - (long)absoluteTime) * context->timebaseFactor)
         : 0;
-    
+
     buffer->peak_rss = 0; // Not supported on macOS
-    
-    return ProcessTreeResourceUsage(pid, rl.rlim_cur, buffer, includeChildProcesses);
+
+    return ProcessTreeResourceUsage(pid, &rusage, context->maxProcessCount, buffer, includeChildProcesses);
+}
+
+int GetProcessResourceUsageSnapshot(pid_t pid, ProcessResourceUsage *buffer, long bufferSize, bool includeChildProcesses)
+{
+    return GetProcessResourceUsageSnapshots(&pid, 1, buffer, bufferSize, includeChildProcesses);
+}
+
+int GetProcessResourceUsageSnapshots(const pid_t *pids, int count, ProcessResourceUsage *buffers, long bufferSize, bool includeChildProcesses)
+{
+    if (sizeof(ProcessResourceUsage) != bufferSize)
+    {
+        printf("ERROR: Wrong size of ProcessResourceUsage buffer; expected %ld, received %ld\n", sizeof(ProcessResourceUsage), bufferSize);
+        return GET_RUSAGE_ERROR;
+    }
+
+    SnapshotContext context;
+    if (InitializeSnapshotContext(&context) != KERN_SUCCESS)
+    {
+        return GET_RUSAGE_ERROR;
+    }
+
+    int result = KERN_SUCCESS;
+    for (int i = 0; i < count; i++)
+    {
+        if (ProcessResourceUsageSnapshot(&context, pids[i], &buffers[i], includeChildProcesses) != KERN_SUCCESS)
+        {
+            result = GET_RUSAGE_ERROR;
+        }
+    }
+
+    return result;
 }
 
 static CoreDumpConfiguration *dump_config = NULL;
@@ -24,6 +24,10 @@ typedef struct {
 
 int GetProcessResourceUsageSnapshot(pid_t pid, ProcessResourceUsage *buffer, long bufferSize, bool includeChildProcesses);
 
+// Takes the snapshots of 'count' processes at once, 'buffers' must hold 'count' entries of 'bufferSize' bytes.
+// Fails if any of the snapshots fails; the others are still taken.
+int GetProcessResourceUsageSnapshots(const pid_t *pids, int count, ProcessResourceUsage *buffers, long bufferSize, bool includeChildProcesses);
+
 typedef struct {
     char *outputPath;
 } CoreDumpConfiguration;
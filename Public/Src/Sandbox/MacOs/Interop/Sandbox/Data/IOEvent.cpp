@@ -252,83 +252,85 @@ const bool IOEvent::IsDirectorySpecialCharacterEvent() const
 
 const size_t IOEvent::Size() const
 {
-    return
-        std::to_string(pid_).length() +
-        std::to_string(cpid_).length() +
-        std::to_string(ppid_).length() +
-        std::to_string(eventType_).length() +
-        std::to_string(actionType_).length() +
-        std::to_string(mode_).length() +
-        std::to_string(modified_).length() +
-        executable_.length() + (executable_.length() > 0 ? 1 : 0) +
-        src_path_.length() + (src_path_.length() > 0 ? 1 : 0) +
-        dst_path_.length() + (dst_path_.length() > 0 ? 1 : 0) +
-        std::to_string(error_).length() +
-        8; // 8 delimiters + 1 per string (if string is present)
+    return sizeof(IOEventHeader) + executable_.length() + src_path_.length() + dst_path_.length();
 }
 
-omemorystream& operator<<(omemorystream &os, const IOEvent &event)
+size_t IOEvent::Serialize(char *buffer, size_t bufferSize) const
 {
-    os
-    << event.pid_                   << "|"
-    << event.cpid_                  << "|"
-    << event.ppid_                  << "|"
-    << event.eventType_             << "|"
-    << event.actionType_            << "|"
-    << event.mode_                  << "|"
-    << event.modified_              << "|"
-    << event.error_                 << "|"
-    ;
-
-    if (event.executable_.size() > 0)
+    size_t size = Size();
+    if (size > bufferSize)
     {
-        os << event.executable_ << "|";
+        return 0;
     }
 
-    if (event.src_path_.size() > 0)
+    IOEventHeader header =
     {
-        os << event.src_path_ << "|";
+        .pid              = pid_,
+        .cpid             = cpid_,
+        .ppid             = ppid_,
+        .oppid            = oppid_,
+        .eventType        = (uint32_t) eventType_,
+        .actionType       = (uint32_t) actionType_,
+        .mode             = (uint32_t) mode_,
+        .error            = (uint32_t) error_,
+        .modified         = modified_ ? 1u : 0u,
+        .executableLength = (uint32_t) executable_.length(),
+        .srcPathLength    = (uint32_t) src_path_.length(),
+        .dstPathLength    = (uint32_t) dst_path_.length(),
+    };
+
+    char *marker = buffer;
+    memcpy(marker, &header, sizeof(header));
+    marker += sizeof(header);
+
+    memcpy(marker, executable_.data(), header.executableLength);
+    marker += header.executableLength;
+
+    memcpy(marker, src_path_.data(), header.srcPathLength);
+    marker += header.srcPathLength;
+
+    memcpy(marker, dst_path_.data(), header.dstPathLength);
+
+    return size;
+}
+
+bool IOEvent::Deserialize(const char *buffer, size_t size)
+{
+    if (buffer == nullptr || size < sizeof(IOEventHeader))
+    {
+        return false;
     }
 
-    if (event.dst_path_.size() > 0)
+    IOEventHeader header;
+    memcpy(&header, buffer, sizeof(header));
+
+    // Compare lengths one by one so that malformed lengths can't overflow the sum
+    size_t remaining = size - sizeof(header);
+    if (header.executableLength > remaining ||
+        header.srcPathLength > remaining - header.executableLength ||
+        header.dstPathLength != remaining - header.executableLength - header.srcPathLength)
     {
-        os << event.dst_path_ << "|";
+        return false;
     }
 
-    return os;
-}
+    pid_        = header.pid;
+    cpid_       = header.cpid;
+    ppid_       = header.ppid;
+    oppid_      = header.oppid;
+    eventType_  = (es_event_type_t) header.eventType;
+    actionType_ = (es_action_type_t) header.actionType;
+    mode_       = (mode_t) header.mode;
+    error_      = header.error;
+    modified_   = header.modified != 0;
 
-std::istream& operator>>(std::istream &is, es_event_type_t &t)
-{
-    unsigned int value = 0;
-    is >> value;
-    t = (es_event_type_t) value;
-    return is;
-}
+    const char *marker = buffer + sizeof(header);
+    executable_.assign(marker, header.executableLength);
+    marker += header.executableLength;
 
-std::istream& operator>>(std::istream &is, es_action_type_t &t)
-{
-    unsigned int value = 0;
-    is >> value;
-    t = (es_action_type_t) value;
-    return is;
-}
+    src_path_.assign(marker, header.srcPathLength);
+    marker += header.srcPathLength;
 
-imemorystream& operator>>(imemorystream &is, IOEvent &event)
-{
-    is
-    >> event.pid_
-    >> event.cpid_
-    >> event.ppid_
-    >> event.eventType_
-    >> event.actionType_
-    >> event.mode_
-    >> event.modified_
-    >> event.error_
-    >> event.executable_
-    >> event.src_path_
-    >> event.dst_path_
-    ;
+    dst_path_.assign(marker, header.dstPathLength);
 
-    return is;
+    return true;
 }
@@ -16,8 +16,6 @@
 #include <bsm/libbsm.h>
 #endif
 
-#include "MemoryStreams.hpp"
-
 #define SRC_PATH 0
 #define DST_PATH 1
 
@@ -49,13 +47,28 @@ enum class ProcessCallbackResult
 };
 
 #define IOEventKey "IOEvent"
-#define IOEventLengthKey "IOEvent::Length"
+
+/*!
+ * Fixed-size part of the binary encoding of an IOEvent (see 'IOEvent::Serialize'); it is directly followed
+ * by the executable, source and destination paths, which are not 0-terminated.
+ */
+typedef struct {
+    pid_t pid;
+    pid_t cpid;
+    pid_t ppid;
+    pid_t oppid;
+    uint32_t eventType;
+    uint32_t actionType;
+    uint32_t mode;
+    uint32_t error;
+    uint32_t modified;
+    uint32_t executableLength;
+    uint32_t srcPathLength;
+    uint32_t dstPathLength;
+} IOEventHeader;
 
 struct IOEvent final
 {
-    friend omemorystream& operator<<(omemorystream &os, const IOEvent &event);
-    friend imemorystream& operator>>(imemorystream &is, IOEvent &event);
-
 private:
 
     pid_t pid_;
@@ -92,24 +105,24 @@ public:
             es_action_type_t action,
             std::string src,
             std::string dst,
-            const std::string exec,
+            std::string exec,
             mode_t mode,
             bool modified = false,
             uint error = 0)
-    : pid_(pid), cpid_(cpid), ppid_(ppid), oppid_(ppid), eventType_(type), actionType_(action), src_path_(src), dst_path_(dst), executable_(exec), 
-        mode_(mode), modified_(modified), error_(error)
+    : pid_(pid), cpid_(cpid), ppid_(ppid), oppid_(ppid), eventType_(type), actionType_(action), src_path_(std::move(src)), dst_path_(std::move(dst)),
+        executable_(std::move(exec)), mode_(mode), modified_(modified), error_(error)
     {
     }
 
     IOEvent(es_event_type_t type,
             es_action_type_t action,
             std::string src,
-            const std::string exec,
+            std::string exec,
             mode_t mode,
             bool modified = false,
             std::string dest = "",
             uint error = 0)
-    : IOEvent(getpid(), 0, getppid(), type, action, src, dest, exec, mode, modified, error)
+    : IOEvent(getpid(), 0, getppid(), type, action, std::move(src), std::move(dest), std::move(exec), mode, modified, error)
     {
     }
 
@@ -118,6 +131,7 @@ public:
     inline const pid_t GetChildPid() const { return cpid_; }
     inline const pid_t GetOriginalParentPid() const { return oppid_; }
     inline const char* GetExecutablePath() const { return executable_.c_str(); }
+    inline const size_t GetExecutablePathLength() const { return executable_.length(); }
 
     inline const audit_token_t* GetProcessAuditToken() const { return &auditToken_; }
     inline const es_event_type_t GetEventType() const { return eventType_; }
@@ -129,16 +143,12 @@ public:
     inline const uint GetError() const { return error_; }
 
     inline const char* GetEventPath(int index = SRC_PATH) const { return (index == SRC_PATH ? src_path_ : dst_path_).c_str(); }
-    inline void SetEventPath(char *value, int index = SRC_PATH)
+    inline const size_t GetEventPathLength(int index = SRC_PATH) const { return (index == SRC_PATH ? src_path_ : dst_path_).length(); }
+
+    /*! Overwrites a path in place, reusing the storage of the old one when it is large enough. */
+    inline void SetEventPath(const char *value, int index = SRC_PATH)
     {
-        if (index == SRC_PATH)
-        {
-            src_path_ = std::string(value);
-        }
-        else
-        {
-            dst_path_ = std::string(value);
-        }
+        (index == SRC_PATH ? src_path_ : dst_path_).assign(value);
     }
 
     inline const mode_t GetMode() const { return mode_; }
@@ -148,17 +158,24 @@ public:
     const bool IsPlistEvent() const;
     const bool IsDirectorySpecialCharacterEvent() const;
 
+    /*! Number of bytes 'Serialize' writes for this event */
     const size_t Size() const;
 
+    /*!
+     * Writes the binary encoding of this event ('IOEventHeader' followed by the paths) to 'buffer'.
+     * Returns the number of bytes written, or 0 if 'bufferSize' is too small.
+     */
+    size_t Serialize(char *buffer, size_t bufferSize) const;
+
+    /*!
+     * Reads an event written by 'Serialize' from 'buffer'.
+     * Returns false if 'size' does not match the encoding found in 'buffer'.
+     */
+    bool Deserialize(const char *buffer, size_t size);
+
     static inline const size_t max_size()
     {
-        // IMPORTANT: Keep this in sync with the de- and serialization logic in the implementation file (IOEvent.cpp), especially Size()!
-        return (3 * std::to_string(PID_MAX).length()) +   // Pids
-               (3 * std::to_string(USHRT_MAX).length()) + // Type + Action + Mode
-               std::to_string(true).length() +            // Modified
-               std::to_string(UINT_MAX).length() +        // error
-               (3 * PATH_MAX) +                           // Executable, src and dst paths
-               10;                                        // Delimiters
+        return sizeof(IOEventHeader) + (3 * PATH_MAX); // Executable, src and dst paths
     }
 };
 
@@ -0,0 +1,200 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef IOEventRing_h
+#define IOEventRing_h
+
+#include <atomic>
+#include <new>
+#include <stdint.h>
+#include <string.h>
+
+#define IOEventRingKey "IOEventRing"
+
+/*!
+ * A ring of serialized IOEvents in memory shared between an interposed process, whose threads write the events it observes,
+ * and the sandbox, which reads them.  This spares every event an XPC message; XPC is only used to set up the ring, to wake
+ * up the sandbox when it stopped reading the ring, and for the events the process waits for (see Detours.cpp).
+ *
+ * Slots have a fixed size.  A writer claims the next slot by advancing 'tail_', copies the event into it and then publishes
+ * it by setting the sequence number of the slot; the reader consumes the published slots in order and hands each one back
+ * to the writers by moving its sequence number one lap ahead.  Events that don't fit in a slot, or that find the ring full,
+ * are sent through XPC instead: the sandbox drains the ring before handling any XPC message of the process, so the events
+ * of a thread are still handled in the order they were written.
+ *
+ * Once the reader finds the ring empty it marks itself idle, and the next writer to publish an event clears that mark and
+ * rings the doorbell (an XPC message) to have the sandbox read the ring again.
+ */
+class IOEventRing final
+{
+public:
+
+    static const uint64_t kMagic = 0x474E495254564549ULL; // "IEVTRING"
+    static const uint32_t kSlotCount = 256;
+    static const uint32_t kSlotDataSize = 1012;
+
+private:
+
+    struct Slot
+    {
+        std::atomic<uint64_t> sequence;
+        uint32_t size;
+        char data[kSlotDataSize];
+    };
+
+    uint64_t magic_;
+    uint32_t slotCount_;
+    uint32_t slotSize_;
+
+    /*! Position of the next slot to be claimed by a writer */
+    alignas(64) std::atomic<uint64_t> tail_;
+
+    /*! Position of the next slot to be read; only used by the reader */
+    alignas(64) uint64_t head_;
+
+    /*! Set by the reader when it stops reading the ring, cleared by the writer that rings the doorbell */
+    std::atomic<uint32_t> readerIdle_;
+
+    alignas(64) Slot slots_[kSlotCount];
+
+    IOEventRing()
+    {
+        magic_ = kMagic;
+        slotCount_ = kSlotCount;
+        slotSize_ = sizeof(Slot);
+        tail_ = 0;
+        head_ = 0;
+        readerIdle_ = 1;
+
+        for (uint32_t i = 0; i < kSlotCount; i++)
+        {
+            slots_[i].sequence = i;
+            slots_[i].size = 0;
+        }
+    }
+
+    inline bool IsPublished(uint64_t position) const
+    {
+        return slots_[position % kSlotCount].sequence.load(std::memory_order_acquire) == position + 1;
+    }
+
+public:
+
+    IOEventRing(const IOEventRing&) = delete;
+    IOEventRing& operator=(const IOEventRing&) = delete;
+
+    /*! Number of bytes of shared memory a ring takes */
+    static constexpr size_t RequiredSize() { return sizeof(IOEventRing); }
+
+    /*! Lays out an empty ring in 'memory', which must be at least 'RequiredSize()' bytes long and suitably aligned (e.g., page aligned) */
+    static IOEventRing* Create(void *memory)
+    {
+        return new (memory) IOEventRing();
+    }
+
+    /*!
+     * Returns the ring laid out in the 'size' bytes at 'memory' by 'Create' (in another process), or nullptr
+     * if they don't hold a ring of the same layout.
+     */
+    static IOEventRing* Attach(void *memory, size_t size)
+    {
+        IOEventRing *ring = (IOEventRing *)memory;
+        if (memory == nullptr || size < RequiredSize() ||
+            ring->magic_ != kMagic || ring->slotCount_ != kSlotCount || ring->slotSize_ != sizeof(Slot))
+        {
+            return nullptr;
+        }
+
+        return ring;
+    }
+
+#pragma mark Writers
+
+    /*!
+     * Copies the 'size' bytes of 'event' into the next free slot and publishes it.  Returns false when the event doesn't fit in
+     * a slot or the ring is full, in which case the caller sends the event through XPC.
+     *
+     * When the reader is idle, '*ringDoorbell' is set to true and the caller must wake the reader up.
+     */
+    bool TryWrite(const char *event, size_t size, bool *ringDoorbell)
+    {
+        *ringDoorbell = false;
+        if (size > kSlotDataSize)
+        {
+            return false;
+        }
+
+        uint64_t position = tail_.load(std::memory_order_relaxed);
+        Slot *slot;
+        while (true)
+        {
+            slot = &slots_[position % kSlotCount];
+            int64_t lap = (int64_t)(slot->sequence.load(std::memory_order_acquire) - position);
+            if (lap == 0)
+            {
+                // the slot is free --> claim it (on failure 'position' is reloaded)
+                if (tail_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (lap < 0)
+            {
+                // the slot still holds the event written a lap ago --> the ring is full
+                return false;
+            }
+            else
+            {
+                // another writer claimed the slot first
+                position = tail_.load(std::memory_order_relaxed);
+            }
+        }
+
+        memcpy(slot->data, event, size);
+        slot->size = (uint32_t)size;
+
+        // sequentially consistent, so that either this writer sees the reader idle or the reader sees the event (see 'Park')
+        slot->sequence.store(position + 1, std::memory_order_seq_cst);
+        *ringDoorbell = readerIdle_.load(std::memory_order_seq_cst) == 1 && readerIdle_.exchange(0) == 1;
+        return true;
+    }
+
+#pragma mark Reader
+
+    /*! Calls 'callback(event, size)' for every published event, in order, and returns the number of events read */
+    template <class TCallback> size_t Drain(TCallback callback)
+    {
+        size_t count = 0;
+        while (IsPublished(head_))
+        {
+            Slot *slot = &slots_[head_ % kSlotCount];
+            size_t size = slot->size <= kSlotDataSize ? slot->size : 0;
+            callback((const char *)slot->data, size);
+
+            // hand the slot back to the writers, one lap ahead
+            slot->sequence.store(head_ + kSlotCount, std::memory_order_release);
+            head_++;
+            count++;
+        }
+
+        return count;
+    }
+
+    /*!
+     * Marks the reader idle once it drained the ring.  Returns false if an event was published in the meantime without the
+     * doorbell being rung for it, in which case the reader must drain the ring (and park) again.
+     */
+    bool Park()
+    {
+        readerIdle_.store(1, std::memory_order_seq_cst);
+        if (slots_[head_ % kSlotCount].sequence.load(std::memory_order_seq_cst) != head_ + 1)
+        {
+            return true;
+        }
+
+        readerIdle_.store(0, std::memory_order_seq_cst);
+        return false;
+    }
+};
+
+#endif /* IOEventRing_h */
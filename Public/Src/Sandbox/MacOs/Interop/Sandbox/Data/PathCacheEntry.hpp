@@ -23,17 +23,21 @@ public:
         buffer_.length = length;
     }
 
+    /*!
+     * Resolves the path of the file descriptor 'identifier' or, if 'isPid' is true, the executable path of the process
+     * 'identifier'. The path is empty if it could not be resolved.
+     */
     PathCacheEntry(int identifier, bool isPid = false)
     {
         assert(identifier > 0);
 
-        if (!isPid)
-        {
-            assert(fcntl(identifier, F_GETPATH, buffer_.data) != -1);
-        }
-        else
+        bool resolved = isPid
+            ? proc_pidpath(identifier, (void *)buffer_.data, PATH_MAX) > 0
+            : fcntl(identifier, F_GETPATH, buffer_.data) != -1;
+
+        if (!resolved)
         {
-            assert(proc_pidpath(identifier, (void *)buffer_.data, PATH_MAX) > 0);
+            buffer_.data[0] = '\0';
         }
 
         buffer_.length = strlen(buffer_.data);
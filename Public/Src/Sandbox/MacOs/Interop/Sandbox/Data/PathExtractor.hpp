@@ -4,20 +4,24 @@
 #ifndef PathExtractor_h
 #define PathExtractor_h
 
-#include <vector>
+#include <string>
 #include <EndpointSecurity/EndpointSecurity.h>
 
+/*!
+ * Builds the path of an ES file or string token directly into the string it hands out, so extracting a path
+ * allocates at most once.
+ */
 class PathExtractor final
 {
 
 private:
 
-    std::vector<char> buffer_;
+    std::string buffer_;
 
     PathExtractor(const char *data, const size_t length)
     {
         assert(length < PATH_MAX);
-        buffer_.insert(buffer_.begin(), data, data + length);
+        buffer_.assign(data, length);
     }
 
 public:
@@ -26,11 +30,7 @@ public:
     PathExtractor(es_string_token_t token) : PathExtractor(token.data, token.length) {}
     PathExtractor(es_file_t *file) : PathExtractor(file->path.data, file->path.length) {}
 
-    ~PathExtractor()
-    {
-        buffer_.clear();
-        std::vector<char>().swap(buffer_);
-    }
+    ~PathExtractor() = default;
 
     // Creates a PathInfo that concatenates directory and filename with a directory seperator char into a buffer
     PathExtractor(es_file_t *file, es_string_token_t token)
@@ -42,18 +42,20 @@ public:
         size_t totalLength = fileLength + tokenLength + (filePathIsRootOnly ? 0 : 1);
 
         assert(totalLength < PATH_MAX);
-        buffer_.insert(buffer_.begin(), file->path.data, file->path.data + fileLength);
+        buffer_.reserve(totalLength);
+        buffer_.assign(file->path.data, fileLength);
 
         if (!filePathIsRootOnly)
         {
             buffer_.push_back('/');
         }
 
-        buffer_.insert(buffer_.end(), token.data, token.data + tokenLength);
+        buffer_.append(token.data, tokenLength);
     }
 
-    inline const std::string Path() { return std::string(buffer_.begin(), buffer_.end()); }
-    inline const size_t PathLength() { return buffer_.size(); }
+    /*! Hands out the extracted path; this extractor must not be used afterwards. */
+    inline std::string Path() { return std::move(buffer_); }
+    inline const size_t PathLength() const { return buffer_.size(); }
 };
 
 #endif /* PathExtractor_h */
@@ -0,0 +1,78 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef ReportCacheRecord_hpp
+#define ReportCacheRecord_hpp
+
+#include <atomic>
+#include "BuildXLSandboxShared.hpp"
+#include "PolicySearch.h"
+
+/*!
+ * A cache record where we keep track of the already reported accesses to a given path of a pip
+ * (the user space counterpart of the kext's 'CacheRecord').
+ *
+ * Also remembers the policy cursor found for the path, so accessing the same path again doesn't
+ * search the file access manifest again.
+ */
+class ReportCacheRecord final
+{
+private:
+
+    /*! Policy found for the path (points into the manifest of the pip, which outlives this record) */
+    PolicySearchCursor cursor_;
+
+    /*! A bitwise disjunction of reported accesses (a 'RequestedAccess' value) */
+    std::atomic<uint32_t> requestedAccess_;
+
+    // Probe implies Lookup, Read implies Probe (and, transitively, Lookup)
+    inline static RequestedAccess implies(RequestedAccess access)
+    {
+        RequestedAccess result = RequestedAccess::None;
+
+        if (HasAllFlags(access, RequestedAccess::Probe))
+        {
+            result |= RequestedAccess::Lookup;
+        }
+
+        if (HasAllFlags(access, RequestedAccess::Read))
+        {
+            result |= RequestedAccess::Lookup | RequestedAccess::Probe;
+        }
+
+        return result;
+    }
+
+public:
+
+    ReportCacheRecord() = delete;
+    ReportCacheRecord(const PolicySearchCursor &cursor) : cursor_(cursor), requestedAccess_((uint32_t)RequestedAccess::None) {}
+    ~ReportCacheRecord() = default;
+
+    inline const PolicySearchCursor& GetCursor() const { return cursor_; }
+
+    /*!
+     * Atomically:
+     *   (1) determines if the given 'access' should be deemed a cache hit, and
+     *   (2) if not, updates this record so that subsequently, the same 'access' becomes a cache hit.
+     *
+     * @return Whether 'access' was a cache hit.
+     */
+    bool CheckAndUpdate(RequestedAccess access)
+    {
+        uint32_t accessToAdd = (uint32_t)(access | implies(access));
+        uint32_t oldAccess = requestedAccess_.load();
+        do
+        {
+            // It's a cache hit if we've previously seen all the requested accesses.
+            if (HasAllFlags((RequestedAccess)oldAccess, access))
+            {
+                return true;
+            }
+        } while (!requestedAccess_.compare_exchange_weak(oldAccess, oldAccess | accessToAdd));
+
+        return false;
+    }
+};
+
+#endif /* ReportCacheRecord_hpp */
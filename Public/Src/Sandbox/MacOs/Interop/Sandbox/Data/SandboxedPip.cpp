@@ -6,17 +6,37 @@
 
 #pragma mark SandboxedPip Implementation
 
+// Beyond this many paths, accesses to new paths are not cached anymore
+#define kMaxReportCacheEntries (64 * 1024)
+
+// A stripe of the directory cursor cache that gets this many directories is cleared
+#define kMaxDirectoryCursorsPerStripe 1024
+
 SandboxedPip::SandboxedPip(pid_t pid, const char *payload, size_t length)
+    : SandboxedPip(pid, payload, length, /* copyPayload */ true)
+{
+}
+
+SandboxedPip::SandboxedPip(pid_t pid, const char *payload, size_t length, bool copyPayload)
 {
     log_debug("Initializing with pid (%d) from: %{public}s", pid, __FUNCTION__);
 
-    payload_ = (char *) malloc(length);
-    if (payload == NULL)
+    ownsPayload_ = copyPayload;
+    if (copyPayload)
     {
-        throw BuildXLException("Could not allocate memory for FAM payload storage!");
+        payload_ = (char *) malloc(length);
+        if (payload_ == NULL)
+        {
+            throw BuildXLException("Could not allocate memory for FAM payload storage!");
+        }
+
+        memcpy(payload_, payload, length);
+    }
+    else
+    {
+        payload_ = (char *) payload;
     }
 
-    memcpy(payload_, payload, length);
     fam_.init((BYTE*)payload_, length);
 
     if (fam_.HasErrors())
@@ -27,10 +47,78 @@ SandboxedPip::SandboxedPip(pid_t pid, const char *payload, size_t length)
 
     processId_ = pid;
     processTreeCount_ = 1;
+
+    reportCache_ = Trie<ReportCacheRecord>::createPathTrie();
+    if (reportCache_ == nullptr)
+    {
+        throw BuildXLException("Could not create Trie for the report cache!");
+    }
+
+    reportCacheHits_ = 0;
+    reportCacheMisses_ = 0;
 }
 
 SandboxedPip::~SandboxedPip()
 {
-    log_debug("Releasing pip object (%#llX) - freed from %{public}s", GetPipId(),  __FUNCTION__);
-    free(payload_);
+    log_debug("Releasing pip object (%#llX) - freed from %{public}s; report cache: %u paths, %llu hits, %llu misses",
+              GetPipId(), __FUNCTION__, reportCache_->getCount(), GetReportCacheHits(), GetReportCacheMisses());
+    delete reportCache_;
+    if (ownsPayload_)
+    {
+        free(payload_);
+    }
+}
+
+std::shared_ptr<ReportCacheRecord> SandboxedPip::ReportCacheGetOrAdd(const char *path, const PolicySearchCursor &cursor)
+{
+    if (reportCache_->getCount() >= kMaxReportCacheEntries)
+    {
+        return reportCache_->get(path);
+    }
+
+    return reportCache_->getOrAdd(path, std::make_shared<ReportCacheRecord>(cursor));
+}
+
+uint64_t SandboxedPip::HashDirectoryPath(const char *path, size_t length)
+{
+    // 64-bit FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash = (hash ^ (uint64_t)(unsigned char)path[i]) * 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+bool SandboxedPip::DirectoryCursorTryGet(const char *path, size_t length, PolicySearchCursor &cursor)
+{
+    uint64_t hash = HashDirectoryPath(path, length);
+    DirectoryCursorStripe &stripe = directoryCursors_[(hash >> 32) % kDirectoryCursorStripeCount];
+
+    std::lock_guard<std::mutex> lock(stripe.lock);
+    auto result = stripe.entries.find(hash);
+    if (result == stripe.entries.end() || result->second.path.compare(0, std::string::npos, path, length) != 0)
+    {
+        return false;
+    }
+
+    cursor = result->second.cursor;
+    return true;
+}
+
+void SandboxedPip::DirectoryCursorAdd(const char *path, size_t length, const PolicySearchCursor &cursor)
+{
+    uint64_t hash = HashDirectoryPath(path, length);
+    DirectoryCursorStripe &stripe = directoryCursors_[(hash >> 32) % kDirectoryCursorStripeCount];
+
+    std::lock_guard<std::mutex> lock(stripe.lock);
+    if (stripe.entries.size() >= kMaxDirectoryCursorsPerStripe)
+    {
+        stripe.entries.clear();
+    }
+
+    DirectoryCursorEntry &entry = stripe.entries[hash];
+    entry.path.assign(path, length);
+    entry.cursor = cursor;
 }
@@ -6,6 +6,12 @@
 
 #include "BuildXLSandboxShared.hpp"
 #include "FileAccessManifestParser.hpp"
+#include "ReportCacheRecord.hpp"
+#include "Trie.hpp"
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
 
 /*!
  * Represents the root of the process tree being tracked.
@@ -29,16 +35,57 @@ private:
     /*! File access manifest payload bytes */
     char *payload_;
 
+    /*! Whether 'payload_' was allocated by this pip (otherwise it is owned by the creator of the pip) */
+    bool ownsPayload_;
+
     /*! File access manifest (contains pointers into the 'payload_' byte array */
     FileAccessManifestParseResult fam_;
 
     /*! Number of processses in this pip's process tree */
     std::atomic<int> processTreeCount_;
 
+    /*!
+     * Maps every path accessed by this pip to a 'ReportCacheRecord' object (which contains the accesses
+     * to that path already reported, and the policy of that path).
+     */
+    Trie<ReportCacheRecord> *reportCache_;
+
+    /*! Number of accesses found in / missing from 'reportCache_' */
+    std::atomic<uint64_t> reportCacheHits_;
+    std::atomic<uint64_t> reportCacheMisses_;
+
+    /*!
+     * Policy search cursors of the directories accessed by this pip, keyed by a hash of their path (see 'DirectoryCursorTryGet').
+     * Split into stripes, each with its own lock, so threads looking up different directories rarely contend.
+     */
+    static const size_t kDirectoryCursorStripeCount = 16;
+
+    struct DirectoryCursorEntry
+    {
+        std::string path;
+        PolicySearchCursor cursor;
+    };
+
+    struct alignas(64) DirectoryCursorStripe
+    {
+        std::mutex lock;
+        std::unordered_map<uint64_t, DirectoryCursorEntry> entries;
+    };
+
+    DirectoryCursorStripe directoryCursors_[kDirectoryCursorStripeCount];
+
+    static uint64_t HashDirectoryPath(const char *path, size_t length);
+
 public:
 
     SandboxedPip() = delete;
     SandboxedPip(pid_t pid, const char *payload, size_t length);
+
+    /*!
+     * When 'copyPayload' is false, the manifest is used in place: the payload must outlive the pip and not change
+     * (e.g., a read-only mapping of the manifest file, shared by every process of the pip).
+     */
+    SandboxedPip(pid_t pid, const char *payload, size_t length, bool copyPayload);
     ~SandboxedPip();
 
     /*! Process id of the root process of this pip. */
@@ -71,6 +118,9 @@ public:
 
     inline const char* GetInternalDetoursErrorNotificationFile() const { return fam_.GetInternalDetoursErrorNotificationFile(); }
 
+    /*! Calls 'callback(kind, path, target)' for every reparse point the manifest knows about (see FileAccessManifestParseResult). */
+    template <class TCallback> void ForEachKnownReparsePoint(TCallback callback) const { fam_.ForEachKnownReparsePoint(callback); }
+
 
 #pragma mark Process Tree Tracking
 
@@ -79,6 +129,34 @@ public:
 
     /*! Atomically dencrements this pip's process tree size and returns the size before decrement. */
     inline const int DecrementProcessTreeCount()                       { return --processTreeCount_; }
+
+#pragma mark Report Cache
+
+    /*!
+     * Looks up the 'ReportCacheRecord' associated with a given path, creating one with the given policy 'cursor'
+     * if there is none yet. Returns nullptr if the path can't be cached (e.g., it contains non-ascii
+     * characters) or the cache is full.
+     */
+    std::shared_ptr<ReportCacheRecord> ReportCacheGetOrAdd(const char *path, const PolicySearchCursor &cursor);
+
+    /*! Looks up the 'ReportCacheRecord' associated with a given path. Returns nullptr if there is none. */
+    inline std::shared_ptr<ReportCacheRecord> ReportCacheGet(const char *path) { return reportCache_->get(path); }
+
+    inline void CountReportCacheHit()                                  { reportCacheHits_++; }
+    inline void CountReportCacheMiss()                                 { reportCacheMisses_++; }
+    inline uint64_t GetReportCacheHits() const                         { return reportCacheHits_; }
+    inline uint64_t GetReportCacheMisses() const                       { return reportCacheMisses_; }
+
+#pragma mark Directory Cursor Cache
+
+    /*!
+     * Gets the cursor resulting from searching the directory at the first 'length' characters of 'path' from the root of
+     * the manifest, if it was cached. Searches of the paths under that directory can resume from it.
+     */
+    bool DirectoryCursorTryGet(const char *path, size_t length, PolicySearchCursor &cursor);
+
+    /*! Caches the cursor resulting from searching the directory at the first 'length' characters of 'path' from the root of the manifest */
+    void DirectoryCursorAdd(const char *path, size_t length, const PolicySearchCursor &cursor);
 };
 
 #endif /* SandboxedPip_hpp */
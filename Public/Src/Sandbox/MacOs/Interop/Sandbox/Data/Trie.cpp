@@ -19,36 +19,43 @@ Node<T>::Node(uint numChildren)
     record_ = nullptr;
     childrenLength_ = numChildren;
 
-    children_ = (Node **) malloc(numChildren * sizeof(Node *));
-    if (children_)
+    std::atomic<Node*> *children = this->children();
+    for (int i = 0; i < childrenLength_; i++)
     {
-        for (int i = 0; i < childrenLength_; i++)
-        {
-            children_[i] = nullptr;
-        }
+        new (&children[i]) std::atomic<Node*>(nullptr);
     }
 }
 
 template <typename T>
 Node<T>::~Node()
 {
-    if (children_)
-    {
-        for (int i = 0; i < childrenLength_; i++)
-        {
-            children_[i] = nullptr;
-        }
-
-        free(children_);
-        children_ = nullptr;
-    }
-
     if (record_ != nullptr) record_.reset();
 
     if (length() == s_uintNodeChildrenCount) --s_numUintNodes;
     else if (length() == s_pathNodeChildrenCount) --s_numPathNodes;
 }
 
+template <typename T>
+Node<T>* Node<T>::create(uint numChildren)
+{
+    static_assert(sizeof(Node) % alignof(std::atomic<Node*>) == 0, "children must be aligned right after the node");
+
+    void *memory = nullptr;
+    if (posix_memalign(&memory, s_cacheLineSize, sizeof(Node) + numChildren * sizeof(std::atomic<Node*>)) != 0)
+    {
+        return nullptr;
+    }
+
+    return new (memory) Node(numChildren);
+}
+
+template <typename T>
+void Node<T>::destroy(Node *node)
+{
+    node->~Node();
+    free(node);
+}
+
 // ================================== class Trie ==================================
 
 template <typename T>
@@ -56,7 +63,7 @@ Trie<T>::Trie(TrieKind kind)
 {
     kind_ = kind;
     root_ = createNode();
-    if (root_->children_ == nullptr)
+    if (root_ == nullptr)
     {
         throw BuildXLException("Trie creation failed as no root node could be allocated!");
     }
@@ -67,7 +74,7 @@ Trie<T>::~Trie()
 {
     traverse(/*computeKey*/ false, /*callbackArgs*/ nullptr, [](Trie<T>*, void*, uint64_t, Node<T> *node)
     {
-        delete node;
+        Node<T>::destroy(node);
     });
 
     root_ = nullptr;
@@ -75,24 +82,19 @@ Trie<T>::~Trie()
 }
 
 template <typename T>
-bool Trie<T>::findChildNode(Node<T> *node, int idx, bool createIfMissing)
+Node<T>* Trie<T>::findChildNode(Node<T> *node, int idx, bool createIfMissing)
 {
     if (idx < 0 || idx >= node->length())
     {
-        return false;
+        return nullptr;
     }
 
-    bool childNodeExists = node->children()[idx] != nullptr;
-
-    if (childNodeExists)
-    {
-        return true;
-    }
+    std::atomic<Node<T>*> &child = node->children()[idx];
+    Node<T> *childNode = child.load(std::memory_order_acquire);
 
-    // child is missing
-    if (!createIfMissing)
+    if (childNode != nullptr || !createIfMissing)
     {
-        return false;
+        return childNode;
     }
 
     Node<T>* newNode = createNode();
@@ -100,38 +102,39 @@ bool Trie<T>::findChildNode(Node<T> *node, int idx, bool createIfMissing)
     // This should never happen except if we run out of memory.
     if (newNode == nullptr)
     {
-        return false;
+        return nullptr;
     }
 
-    // TODO: Make thread safe!
-    node->children()[idx] = newNode;
+    // Another thread may have created the same child in the meantime, in which case its node is kept
+    if (!child.compare_exchange_strong(childNode, newNode, std::memory_order_acq_rel, std::memory_order_acquire))
+    {
+        Node<T>::destroy(newNode);
+        return childNode;
+    }
 
-    return true;
+    return newNode;
 }
 
 template <typename T>
 TrieResult Trie<T>::makeSentinel(Node<T> *node, std::shared_ptr<T> record)
 {
     // if this is a sentinel node --> nothing to do
-    if (node->record_ != nullptr)
+    if (std::atomic_load(&node->record_) != nullptr)
     {
         return kTrieResultAlreadyExists;
     }
 
-    std::shared_ptr<T> newRecord = record;
-    if (newRecord == nullptr)
+    if (record == nullptr)
     {
         return kTrieResultAlreadyExists;
     }
 
-    if (node->record_ != nullptr)
+    std::shared_ptr<T> expected = nullptr;
+    if (!std::atomic_compare_exchange_strong(&node->record_, &expected, record))
     {
-        newRecord.reset();
         return kTrieResultAlreadyExists;
     }
 
-    // TODO: Make thread safe!
-    node->record_ = newRecord;
     int oldCount = (++size_);
     triggerOnChange(oldCount, oldCount + 1);
 
@@ -141,7 +144,7 @@ TrieResult Trie<T>::makeSentinel(Node<T> *node, std::shared_ptr<T> record)
 template <typename T>
 std::shared_ptr<T> Trie<T>::get(Node<T> *node)
 {
-    return node != nullptr ? node->record_ : nullptr;
+    return node != nullptr ? std::atomic_load(&node->record_) : nullptr;
 }
 
 template <typename T>
@@ -151,7 +154,7 @@ std::shared_ptr<T> Trie<T>::getOrAdd(Node<T> *node, std::shared_ptr<T> record, T
     auto sentinelResult = makeSentinel(node, record);
     if (result) *result = sentinelResult;
 
-    return node->record_;
+    return std::atomic_load(&node->record_);
 }
 
 template <typename T>
@@ -162,19 +165,16 @@ TrieResult Trie<T>::replace(Node<T> *node, const std::shared_ptr<T> value)
         return kTrieResultFailure;
     }
 
-    std::shared_ptr<T> previousValue = node->record_;
+    std::shared_ptr<T> previousValue = std::atomic_exchange(&node->record_, value);
 
     if (previousValue != nullptr)
     {
-        node->record_ = value;
         previousValue.reset();
 
         return kTrieResultReplaced;
     }
     else
     {
-        node->record_ = value;
-
         int oldCount = (++size_);
         triggerOnChange(oldCount, oldCount + 1);
 
@@ -190,9 +190,9 @@ TrieResult Trie<T>::insert(Node<T> *node, const std::shared_ptr<T> value)
         return kTrieResultFailure;
     }
 
-    if (node->record_ != nullptr) return kTrieResultAlreadyExists;
+    std::shared_ptr<T> expected = nullptr;
+    if (!std::atomic_compare_exchange_strong(&node->record_, &expected, value)) return kTrieResultAlreadyExists;
 
-    node->record_ = value;
     int oldCount = (++size_);
     triggerOnChange(oldCount, oldCount + 1);
 
@@ -202,16 +202,14 @@ TrieResult Trie<T>::insert(Node<T> *node, const std::shared_ptr<T> value)
 template <typename T>
 TrieResult Trie<T>::remove(Node<T> *node)
 {
-    if (node == nullptr || node->record_ == nullptr)
+    if (node == nullptr || std::atomic_load(&node->record_) == nullptr)
     {
         return kTrieResultAlreadyEmpty;
     }
 
-
-    if (node->record_ != nullptr)
+    // Only the thread that takes the record out accounts for it, so concurrent removals don't both decrement the size
+    if (std::atomic_exchange(&node->record_, std::shared_ptr<T>(nullptr)) != nullptr)
     {
-        node->record_.reset();
-
         int oldCount = (--size_);
         triggerOnChange(oldCount, oldCount - 1);
 
@@ -536,11 +534,11 @@ Node<T>* Trie<T>::findPathNode(const char *path, bool createIfMissing)
     while ((ch = *path++) != '\0')
     {
         int idx = s_char2idx<T>[ch];
-        if (!findChildNode(currNode, idx, createIfMissing))
+        currNode = findChildNode(currNode, idx, createIfMissing);
+        if (currNode == nullptr)
         {
             return nullptr;
         }
-        currNode = currNode->children()[idx];
     }
 
     return currNode;
@@ -557,13 +555,12 @@ Node<T>* Trie<T>::findUintNode(uint64_t key, bool createIfMissing)
 
         int lsd = key % 10;
 
-        if (!findChildNode(currNode, lsd, createIfMissing))
+        currNode = findChildNode(currNode, lsd, createIfMissing);
+        if (currNode == nullptr)
         {
             return nullptr;
         }
 
-        currNode = currNode->children()[lsd];
-
         if (key < 10)
         {
             break;
@@ -604,7 +601,7 @@ void Trie<T>::forEach(void *callbackArgs, for_each_fn callback)
     traverse(/*computeKey*/ kind_ == kUintTrie, /*callbackArgs*/ &state, [](Trie<T> *me, void *s, uint64_t key, Node<T> *node)
     {
         State *state = (State*)s;
-        std::shared_ptr<T> record = node->record_;
+        std::shared_ptr<T> record = std::atomic_load(&node->record_);
         if (record)
         {
             state->callback(state->args, key, record);
@@ -620,7 +617,7 @@ void Trie<T>::removeMatching(void *filterArgs, filter_fn filter)
     traverse(/*computeKey*/ false, /*callbackArgs*/ &state, [](Trie<T> *me, void *s, uint64_t, Node<T> *node)
     {
         State *state = (State*)s;
-        std::shared_ptr<T> record = node->record_;
+        std::shared_ptr<T> record = std::atomic_load(&node->record_);
         if (record)
         {
             if (state->filter(state->args, record))
@@ -676,7 +673,7 @@ void Trie<T>::traverse(bool computeKey, void *callbackArgs, traverse_fn callback
         Node<T> *curr = pop(&stack);
         for (int i = 0; i < curr->length(); ++i)
         {
-            push(&stack, curr->children()[i], computeKey ? (i * pow10<T>(depth) + key) : 0, depth + 1);
+            push(&stack, curr->children()[i].load(std::memory_order_acquire), computeKey ? (i * pow10<T>(depth) + key) : 0, depth + 1);
         }
 
         // the callback may deallocate 'curr' node, hence this must be the last statement in this loop
@@ -689,6 +686,7 @@ void Trie<T>::traverse(bool computeKey, void *callbackArgs, traverse_fn callback
 #ifndef MAC_DETOURS
     #include "SandboxedProcess.hpp"
     template class Trie<SandboxedProcess>;
+    template class Trie<ReportCacheRecord>;
 #else
     #include "PathCacheEntry.hpp"
     template class Trie<PathCacheEntry>;
@@ -9,6 +9,7 @@
 #include <atomic>
 #include <memory>
 #include <limits.h>
+#include <new>
 #include <sys/types.h>
 
 template <typename T> class Trie;
@@ -16,6 +17,9 @@ template <typename T> class Trie;
 /*!
  * A node in a Trie.
  * Only accessible to its friend class Trie.
+ *
+ * A node and the pointers to its children are a single allocation, aligned to a cache line: looking up a child
+ * doesn't go through another pointer, and the record and the first children share the first cache line of the node.
  */
 template <typename T>
 class Node final
@@ -29,7 +33,7 @@ private:
 
     /*!
      * The value 65 is chosen so that all ASCII characters between 32 (' ') and 122 ('z')
-     * get a unique entry in the 'children_' array.  The formula for mapping a character
+     * get a unique entry in the children array.  The formula for mapping a character
      * ch to an array index is:
      *
      *   toupper(ch) - 32
@@ -39,20 +43,27 @@ private:
     /*! For 10 digits */
     static const uint s_uintNodeChildrenCount = 10;
 
-    /*! Arbitrary value */
+    static const size_t s_cacheLineSize = 64;
+
+    /*! Arbitrary value. Only accessed through the atomic operations for shared pointers. */
     std::shared_ptr<T> record_;
 
-    /*! The length of the 'children_' array (i.e., the the number of allocated nodes) */
+    /*! The length of the children array (i.e., the the number of possible children) */
     uint childrenLength_;
 
-    /*! Pre-allocated pointers to all possible children nodes. */
-    Node **children_;
+    uint length() const { return childrenLength_; }
+
+    /*!
+     * Pre-allocated pointers to all possible children nodes, laid out right after the node. A child is only ever set
+     * once (while the trie is alive nodes are never removed), so readers don't need any lock.
+     */
+    std::atomic<Node*>* children() const { return (std::atomic<Node*>*)(this + 1); }
 
-    uint length()     const { return childrenLength_; }
-    Node** children() const { return children_; }
+    static Node* create(uint numChildren);
+    static void destroy(Node *node);
 
-    static Node* createUintNode() { return new Node(s_uintNodeChildrenCount); }
-    static Node* createPathNode() { return new Node(s_pathNodeChildrenCount); }
+    static Node* createUintNode() { return create(s_uintNodeChildrenCount); }
+    static Node* createPathNode() { return create(s_pathNodeChildrenCount); }
 
 public:
 
@@ -138,16 +149,18 @@ private:
     void triggerOnChange(int oldCount, int newCount) const;
 
     /*!
-     * Checks if a child node of 'node' exists at position 'idx'.
+     * Returns the child node of 'node' at position 'idx'.
      * If no such child node exists and 'createIfMissing' is true,
      * a new child node is created and saved at position 'idx'.
      *
+     * When several threads create the same child concurrently, only one of the new nodes is saved and returned to all of them.
+     *
      * @param node The parent node.  Must not be null.
-     * @param idx Must be between 0 (inclusive) and 'node.length()' (exclusive); otherwise this method returns false.
+     * @param idx Must be between 0 (inclusive) and 'node.length()' (exclusive); otherwise this method returns NULL.
      * @param createIfMissing When true, this method creates a new child node at position 'idx' if one doesn't already exist.
-     * @result True IFF 'node' contains a child node at position 'idx' after this method returns.
+     * @result The child node at position 'idx', or NULL if there is none after this method returns.
      */
-    bool findChildNode(Node<T> *node, int idx, bool createIfMissing);
+    Node<T>* findChildNode(Node<T> *node, int idx, bool createIfMissing);
 
     /*!
      * Ensures that 'node' has its 'record_' field set to a non-null value.
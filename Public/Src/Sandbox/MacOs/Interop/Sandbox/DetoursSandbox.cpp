@@ -4,8 +4,24 @@
 #include "BuildXLSandboxShared.hpp"
 #include "BuildXLException.hpp"
 #include "DetoursSandbox.hpp"
+#include "IOEventRing.hpp"
 #include "XPCConstants.hpp"
 
+#include <sys/mman.h>
+
+void DetoursSandbox::HandleEvent(void *sandbox, const char *msg, size_t msg_length)
+{
+    IOEvent event;
+    if (event.Deserialize(msg, msg_length))
+    {
+        eventCallback_(sandbox, const_cast<const IOEvent &>(event), hostPid_, IOEventBacking::Interposing);
+    }
+    else
+    {
+        log_error("Dropping malformed IOEvent of %zu bytes", msg_length);
+    }
+}
+
 DetoursSandbox::DetoursSandbox(pid_t host_pid, process_callback callback, void *sandbox, xpc_connection_t bridge)
 {
     assert(callback != nullptr && bridge != nullptr);
@@ -27,24 +43,79 @@ DetoursSandbox::DetoursSandbox(pid_t host_pid, process_callback callback, void *
         xpc_type_t type = xpc_get_type(peer);
         if (type != XPC_TYPE_ERROR)
         {
+            // The ring the interposed process writes most of its events to, once it set one up (see IOEventRing)
+            __block IOEventRing *ring = nullptr;
+            __block void *ringMemory = nullptr;
+            __block size_t ringSize = 0;
+
+            void (^drainRing)(void) = ^()
+            {
+                if (ring != nullptr)
+                {
+                    ring->Drain([&](const char *msg, size_t msg_length) { HandleEvent(sandbox, msg, msg_length); });
+                }
+            };
+
+            void (^releaseRing)(void) = ^()
+            {
+                if (ringMemory != nullptr)
+                {
+                    munmap(ringMemory, ringSize);
+                }
+
+                ring = nullptr;
+                ringMemory = nullptr;
+                ringSize = 0;
+            };
+
             xpc_connection_set_event_handler((xpc_connection_t) peer, ^(xpc_object_t message)
             {
                 xpc_type_t type = xpc_get_type(message);
                 if (type == XPC_TYPE_DICTIONARY)
                 {
-                    const char *msg = xpc_dictionary_get_string(message, IOEventKey);
-                    const uint64_t msg_length = xpc_dictionary_get_uint64(message, IOEventLengthKey);
+                    // The events written to the ring before this message was sent come first
+                    drainRing();
 
-                    imemorystream ims(msg, msg_length);
-                    ims.imbue(std::locale(ims.getloc(), new PipeDelimiter));
-                    IOEvent event;
-                    ims >> event;
-
-                    eventCallback_(sandbox, const_cast<const IOEvent &>(event), hostPid_, IOEventBacking::Interposing);
+                    uint64_t response = xpc_response_success;
+                    uint64_t command = xpc_dictionary_get_uint64(message, "command");
+                    if (command == xpc_set_detours_event_ring)
+                    {
+                        // A process sets up a new ring after a vfork, as its child did so in the same address space
+                        releaseRing();
+
+                        xpc_object_t shmem = xpc_dictionary_get_value(message, IOEventRingKey);
+                        ringSize = shmem != nullptr ? xpc_shmem_map(shmem, &ringMemory) : 0;
+                        ring = IOEventRing::Attach(ringMemory, ringSize);
+                        if (ring == nullptr)
+                        {
+                            log_error("Could not map the event ring of %zu bytes, expected %zu bytes", ringSize, IOEventRing::RequiredSize());
+                            releaseRing();
+                            response = xpc_response_failure;
+                        }
+                    }
+                    else if (command == xpc_drain_detours_event_ring)
+                    {
+                        // Wait for the doorbell again, unless more events were written in the meantime
+                        while (ring != nullptr && !ring->Park())
+                        {
+                            drainRing();
+                        }
+                    }
+                    else
+                    {
+                        size_t msg_length = 0;
+                        const char *msg = (const char *) xpc_dictionary_get_data(message, IOEventKey, &msg_length);
+                        HandleEvent(sandbox, msg, msg_length);
+                    }
 
+                    // Only the messages the interposed process waits for expect a reply
                     xpc_object_t reply = xpc_dictionary_create_reply(message);
-                    xpc_dictionary_set_uint64(reply, "response", xpc_response_success);
-                    xpc_connection_send_message((xpc_connection_t) peer, reply);
+                    if (reply != nullptr)
+                    {
+                        xpc_dictionary_set_uint64(reply, "response", response);
+                        xpc_connection_send_message((xpc_connection_t) peer, reply);
+                        xpc_release(reply);
+                    }
                 }
                 else if (type == XPC_TYPE_ERROR)
                 {
@@ -56,6 +127,10 @@ DetoursSandbox::DetoursSandbox(pid_t host_pid, process_callback callback, void *
                     else if (message == XPC_ERROR_CONNECTION_INVALID)
                     {
                         log_debug("XPC connection invalid: %{public}s", desc);
+
+                        // The process is gone: handle what it wrote to the ring last
+                        drainRing();
+                        releaseRing();
                     }
                 }
             });
@@ -20,6 +20,9 @@ private:
     xpc_connection_t xpc_bridge_ = nullptr;
     xpc_connection_t detours_ = nullptr;
 #endif
+
+    /*! Hands the serialized IOEvent in 'msg' to the event callback */
+    void HandleEvent(void *sandbox, const char *msg, size_t msg_length);
     
 public:
     
@@ -34,15 +34,19 @@ EndpointSecuritySandbox::EndpointSecuritySandbox(pid_t host_pid, process_callbac
                 xpc_type_t type = xpc_get_type(message);
                 if (type == XPC_TYPE_DICTIONARY)
                 {
-                    const char *msg = xpc_dictionary_get_string(message, IOEventKey);
-                    const uint64_t msg_length = xpc_dictionary_get_uint64(message, IOEventLengthKey);
+                    size_t msg_length = 0;
+                    const char *msg = (const char *) xpc_dictionary_get_data(message, IOEventKey, &msg_length);
 
-                    imemorystream ims(msg, msg_length);
-                    ims.imbue(std::locale(ims.getloc(), new PipeDelimiter));
                     IOEvent event;
-                    ims >> event;
-
-                    ProcessCallbackResult result = eventCallback_ != nullptr ? eventCallback_(sandbox, const_cast<const IOEvent &>(event), hostPid_, IOEventBacking::EndpointSecurity) : ProcessCallbackResult::Done;
+                    ProcessCallbackResult result = ProcessCallbackResult::Done;
+                    if (!event.Deserialize(msg, msg_length))
+                    {
+                        log_error("Dropping malformed IOEvent of %zu bytes", msg_length);
+                    }
+                    else if (eventCallback_ != nullptr)
+                    {
+                        result = eventCallback_(sandbox, const_cast<const IOEvent &>(event), hostPid_, IOEventBacking::EndpointSecurity);
+                    }
 
                     uint64_t response = xpc_response_error;
                     switch (result)
@@ -115,6 +119,65 @@ EndpointSecuritySandbox::EndpointSecuritySandbox(pid_t host_pid, process_callbac
     }
 }
 
+void EndpointSecuritySandbox::UpdateSubscriptions(uint64_t groups, int delta)
+{
+    const std::lock_guard<std::mutex> lock(subscriptionsLock_);
+
+    uint64_t subscriptions = 0;
+    for (int i = 0; i < kEventGroupCount; i++)
+    {
+        if (groups & (1ULL << i))
+        {
+            pipsPerEventGroup_[i] += delta;
+        }
+
+        if (pipsPerEventGroup_[i] > 0)
+        {
+            subscriptions |= 1ULL << i;
+        }
+    }
+
+    if (subscriptions == subscriptions_)
+    {
+        return;
+    }
+
+    bool growing = (subscriptions & ~subscriptions_) != 0;
+    subscriptions_ = subscriptions;
+
+    xpc_object_t post = xpc_dictionary_create(NULL, NULL, 0);
+    xpc_dictionary_set_uint64(post, "command", xpc_set_es_subscriptions);
+    xpc_dictionary_set_uint64(post, "subscriptions", subscriptions);
+
+    if (growing)
+    {
+        // The pip that needs the new events is about to run: wait for the extension to subscribe to them
+        xpc_object_t response = xpc_connection_send_message_with_reply_sync(xpc_bridge_, post);
+        if (xpc_get_type(response) != XPC_TYPE_DICTIONARY ||
+            xpc_dictionary_get_uint64(response, "response") != xpc_response_success)
+        {
+            log_error("Failed subscribing to the EndpointSecurity event groups %#llx - sandboxing is no longer reliable!", subscriptions);
+        }
+
+        xpc_release(response);
+    }
+    else
+    {
+        // Messages of a connection are handled in order, so a later subscription can't be undone by this one
+        xpc_connection_send_message_with_reply(xpc_bridge_, post, NULL, ^(xpc_object_t response)
+        {
+            if (xpc_get_type(response) != XPC_TYPE_DICTIONARY ||
+                xpc_dictionary_get_uint64(response, "response") != xpc_response_success)
+            {
+                log_error("Failed unsubscribing from the EndpointSecurity event groups not in %#llx", subscriptions);
+            }
+        });
+    }
+
+    xpc_release(post);
+    log_debug("EndpointSecurity event groups subscribed to: %#llx", subscriptions);
+}
+
 EndpointSecuritySandbox::~EndpointSecuritySandbox()
 {
     xpc_object_t post = xpc_dictionary_create(NULL, NULL, 0);
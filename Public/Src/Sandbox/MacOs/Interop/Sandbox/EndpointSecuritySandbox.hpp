@@ -6,6 +6,8 @@
 
 #include "IOEvent.hpp"
 
+#include <mutex>
+
 class EndpointSecuritySandbox final
 {
 
@@ -19,6 +21,16 @@ private:
     xpc_connection_t xpc_bridge_ = nullptr;
     xpc_connection_t es_connection_ = nullptr;
 #endif
+
+    /*! Number of event groups in ESEventGroups (one bit each) */
+    static const int kEventGroupCount = 2;
+
+    /*! Number of running pips needing each group of events, and the groups the extension is currently subscribed to */
+    std::mutex subscriptionsLock_;
+    int pipsPerEventGroup_[kEventGroupCount] = { 0 };
+    uint64_t subscriptions_ = 0;
+
+    void UpdateSubscriptions(uint64_t groups, int delta);
     
 public:
     
@@ -28,6 +40,15 @@ public:
 #if __APPLE__
     EndpointSecuritySandbox(pid_t host_pid, process_callback callback, void *sandbox, xpc_connection_t bridge);
 #endif
+
+    /*!
+     * A pip needing the given groups of events (see ESEventGroups) started.  Returns once the extension is subscribed to them,
+     * so that none of the events of the pip are missed.
+     */
+    void AddSubscriptions(uint64_t groups)      { UpdateSubscriptions(groups, 1); }
+
+    /*! A pip needing the given groups of events ended: the extension stops receiving the ones no other running pip needs. */
+    void RemoveSubscriptions(uint64_t groups)   { UpdateSubscriptions(groups, -1); }
 };
 
 #endif /* EndpointSecuritySandbox_hpp */
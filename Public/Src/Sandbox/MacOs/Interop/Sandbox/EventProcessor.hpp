@@ -23,14 +23,8 @@ static ProcessCallbackResult _process_event(Sandbox *sandbox, const IOEvent &eve
 
     bool isInterposedEvent = backing == IOEventBacking::Interposing;
 
-    bool ppid_found = sandbox->GetAllowlistedPidMap().find(event.GetParentPid()) != sandbox->GetAllowlistedPidMap().end();
-    bool original_ppid_found = sandbox->GetAllowlistedPidMap().find(event.GetOriginalParentPid()) != sandbox->GetAllowlistedPidMap().end();
-
-    size_t msg_length = IOEvent::max_size();
-    char msg[msg_length];
-
-    omemorystream oms(msg, sizeof(msg));
-    oms << event;
+    bool ppid_found = sandbox->GetAllowlistedPidMap().Contains(event.GetParentPid());
+    bool original_ppid_found = sandbox->GetAllowlistedPidMap().Contains(event.GetOriginalParentPid());
 
     if (isInterposedEvent || (ppid_found || original_ppid_found))
     {
@@ -44,12 +38,12 @@ static ProcessCallbackResult _process_event(Sandbox *sandbox, const IOEvent &eve
             // the posix_spawn* call returns, we have to manually add a fork event here if the parent of the binary in question is
             // already being tracked.
 
-            if (event.GetEventType() == ES_EVENT_TYPE_NOTIFY_FORK && !sandbox->GetForceForkedPidMap().empty())
+            if (event.GetEventType() == ES_EVENT_TYPE_NOTIFY_FORK && !sandbox->GetForceForkedPidMap().IsEmpty())
             {
-                auto it = sandbox->GetForceForkedPidMap().find(event.GetChildPid());
-                if (it != sandbox->GetForceForkedPidMap().end())
+                pid_t forcedParentPid;
+                if (sandbox->GetForceForkedPidMap().TryGet(event.GetChildPid(), &forcedParentPid))
                 {
-                    if (it->first == event.GetChildPid() && it->second == event.GetPid())
+                    if (forcedParentPid == event.GetPid())
                     {
                         sandbox->RemoveProcessPid(sandbox->GetForceForkedPidMap(), event.GetChildPid());
 
@@ -72,7 +66,7 @@ static ProcessCallbackResult _process_event(Sandbox *sandbox, const IOEvent &eve
                     log_debug("Forced fork event for child PID(%d) and PPID(%d) with path: %{public}s",
                               fork_event.GetChildPid(), fork_event.GetPid(), fork_event.GetExecutablePath());
 
-                    sandbox->GetForceForkedPidMap().emplace(fork_event.GetChildPid(), fork_event.GetPid());
+                    sandbox->SetProcessPidPair(sandbox->GetForceForkedPidMap(), fork_event.GetChildPid(), fork_event.GetPid());
                     handler.HandleEvent(fork_event);
                 }
             }
@@ -105,12 +99,8 @@ static ProcessCallbackResult _process_event(Sandbox *sandbox, const IOEvent &eve
         else
         {
             // TODO: Delete
-            size_t msg_length = IOEvent::max_size();
-            char msg[msg_length];
-
-            omemorystream oms(msg, sizeof(msg));
-            oms << event;
-            log_debug("Not tracked: %{public}.*s",(int) event.Size(), msg);
+            log_debug("Not tracked: PID(%d), PPID(%d), type(%d), path: %{public}s, executable: %{public}s",
+                      event.GetPid(), event.GetParentPid(), event.GetEventType(), event.GetEventPath(SRC_PATH), event.GetExecutablePath());
         }
 
         if (event.GetActionType() == ES_ACTION_TYPE_AUTH)
@@ -146,6 +136,12 @@ static ProcessCallbackResult process_event(void *handle, const IOEvent event, pi
     if (sandbox->IsRunningHybrid())
     {
         dispatch_async(sandbox->GetHybridQueue(), ^{
+            // The hybrid queue is serial, so the merger is only ever used by one thread at a time
+            if (event.GetPid() != host && sandbox->GetHybridEventMerger().IsDuplicate(event, backing))
+            {
+                return;
+            }
+
             // TODO: We can't mute processes when merging ES and detours events asynchronously without introducing some async callback
             _process_event(sandbox, event, host, backing);
         });
@@ -21,7 +21,23 @@ PolicySearchCursor AccessHandler::FindManifestRecord(const char *absolutePath, s
     const char *pathWithoutRootSentinel = absolutePath + 1;
 
     size_t len = pathLength == -1 ? strlen(pathWithoutRootSentinel) : pathLength;
-    return FindFileAccessPolicyInTreeEx(GetPip()->GetManifestRecord(), pathWithoutRootSentinel, len);
+
+    // Most accesses are to files in directories other files were accessed in: resume from the cursor of the directory,
+    // so only the last component of the path needs to be searched
+    size_t parentLength = GetParentPathLengthForPolicySearch(pathWithoutRootSentinel, len);
+    if (parentLength == 0)
+    {
+        return FindFileAccessPolicyInTreeEx(GetPip()->GetManifestRecord(), pathWithoutRootSentinel, len);
+    }
+
+    PolicySearchCursor parentCursor;
+    if (!GetPip()->DirectoryCursorTryGet(pathWithoutRootSentinel, parentLength, parentCursor))
+    {
+        parentCursor = FindFileAccessPolicyInTreeEx(GetPip()->GetManifestRecord(), pathWithoutRootSentinel, parentLength);
+        GetPip()->DirectoryCursorAdd(pathWithoutRootSentinel, parentLength, parentCursor);
+    }
+
+    return FindFileAccessPolicyInTreeEx(parentCursor, pathWithoutRootSentinel + parentLength + 1, len - parentLength - 1);
 }
 
 void AccessHandler::SetProcessPath(AccessReport *report)
@@ -48,7 +64,6 @@ ReportResult AccessHandler::CreateReportFileOpAccess(FileOperation operation,
     accessReport.stats              = {0};
     accessReport.isDirectory        = isDirectory;
     accessReport.shouldReport       = checkResult.ShouldReport();
-    std::fill_n(accessReport.path, MAXPATHLEN, 0);
 
     assert(strlen(policyResult.Path()) > 0);
     strlcpy(accessReport.path, policyResult.Path(), sizeof(accessReport.path));
@@ -76,7 +91,6 @@ bool AccessHandler::CreateReportProcessTreeCompleted(pid_t processId, AccessRepo
     accessReport.stats            = {0};
     accessReport.isDirectory      = 0;
     accessReport.shouldReport     = true;
-    std::fill_n(accessReport.path, MAXPATHLEN, 0);
 
     SetProcessPath(&accessReport);
 
@@ -96,7 +110,6 @@ bool AccessHandler::CreateReportProcessExited(pid_t childPid, AccessReport &acce
     accessReport.stats            = {0};
     accessReport.isDirectory      = 0;
     accessReport.shouldReport     = true;
-    std::fill_n(accessReport.path, MAXPATHLEN, 0);
 
     SetProcessPath(&accessReport);
 
@@ -116,7 +129,6 @@ bool AccessHandler::CreateReportChildProcessSpawned(pid_t childPid, AccessReport
     accessReport.stats              = {0};
     accessReport.isDirectory        = 0;
     accessReport.shouldReport       = true;
-    std::fill_n(accessReport.path, MAXPATHLEN, 0);
 
     SetProcessPath(&accessReport);
     assert(strlen(accessReport.path) > 0);
@@ -169,11 +181,45 @@ AccessCheckResult AccessHandler::CheckAndCreateReportInternal(FileOperation oper
                                                         uint error,
                                                         AccessReport &accessToReport)
 {
-    PolicyResult policy = PolicyForPath(IgnoreDataPartitionPrefix(path));
+    const char *absolutePath = IgnoreDataPartitionPrefix(path);
+
+#if __APPLE__
+    // 1: reuse the policy found the last time this path was accessed, if any
+    std::shared_ptr<ReportCacheRecord> cacheRecord = GetPip()->ReportCacheGet(absolutePath);
+    if (cacheRecord == nullptr)
+    {
+        cacheRecord = GetPip()->ReportCacheGetOrAdd(absolutePath, FindManifestRecord(absolutePath));
+    }
+
+    PolicyResult policy = cacheRecord != nullptr
+        ? PolicyResult(GetPip()->GetFamFlags(), GetPip()->GetFamExtraFlags(), absolutePath, cacheRecord->GetCursor())
+        : PolicyForPath(absolutePath);
+#else
+    // The Linux sandbox deduplicates its reports before they get here (see AccessCache)
+    PolicyResult policy = PolicyForPath(absolutePath);
+#endif
+
     AccessCheckResult result = AccessCheckResult::Invalid();
     checker(policy, isDir, &result);
 
     CreateReportFileOpAccess(operation, policy, result, pid, (uint)isDir, error, accessToReport);
 
+#if __APPLE__
+    // 2: skip the report if the same access was already reported for this pip. Writes are always reported,
+    //    so the order in which outputs are created, written and removed is kept.
+    if (accessToReport.shouldReport && cacheRecord != nullptr && !HasAnyFlags((int)result.Access, (int)RequestedAccess::Write))
+    {
+        if (cacheRecord->CheckAndUpdate(result.Access))
+        {
+            GetPip()->CountReportCacheHit();
+            accessToReport.shouldReport = false;
+        }
+        else
+        {
+            GetPip()->CountReportCacheMiss();
+        }
+    }
+#endif
+
     return result;
 }
@@ -57,7 +57,8 @@ protected:
      * Template for checking and creating a file access report. The report is created but not sent
      * to managed BuildXL.
      *
-     * The key used for looking up if the operation was already reported is "<operation>,<path>".
+     * On macOS, accesses already reported for the pip are looked up by path (see 'SandboxedPip::ReportCacheGetOrAdd'),
+     * and 'accessToReport.shouldReport' is cleared for the ones found.
      *
      * @param operation Operation to be executed
      * @param path Absolute path against which the operation is to be executed
@@ -2,8 +2,18 @@
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
 #include <IOKit/kext/KextManager.h>
+#include <algorithm>
+#include <sched.h>
+#include <unordered_map>
+#include <vector>
 #include "KextSandbox.hpp"
 
+// Maximum number of reports handed to the managed side at once
+#define kAccessReportBatchSize 64
+
+// Number of times the listener yields, checking for more reports, before blocking on the mach port
+#define kSpinIterationsBeforeWait 64
+
 class AutoRelease
 {
 private:
@@ -21,6 +31,108 @@ public:
     }
 };
 
+/**
+ * The priority reports dequeued by the listener (see PriorityReportHeader), held back until the reports that must go before them
+ * were dequeued from the report queue.
+ */
+class PriorityReports
+{
+private:
+    typedef struct {
+        PriorityReportHeader header;
+        AccessReport report;
+    } PendingReport;
+
+    std::vector<PendingReport> pending_;
+
+    /*! Reports dequeued from the report queue so far, by pip (pips are forgotten once their process tree completed) */
+    std::unordered_map<pipid_t, uint64_t> dequeuedPipReports_;
+
+    /*! Entries dequeued from the report queue so far */
+    uint64_t dequeuedEntries_ = 0;
+
+    bool IsReady(const PendingReport &pending) const
+    {
+        if (dequeuedEntries_ >= pending.header.precedingEntries)
+        {
+            return true;
+        }
+
+        auto dequeued = dequeuedPipReports_.find(pending.report.pipId);
+        uint64_t dequeuedPipReports = dequeued != dequeuedPipReports_.end() ? dequeued->second : 0;
+        return dequeuedPipReports >= pending.header.precedingPipReports;
+    }
+
+public:
+
+    /*! Dequeues all the entries available in 'queue', using 'entry' (kMaxReportQueueEntrySize bytes) as a buffer. Returns false for bogus entries. */
+    bool Dequeue(IODataQueueMemory *queue, char *entry)
+    {
+        while (IODataQueueDataAvailable(queue))
+        {
+            uint32_t entrySize = kMaxReportQueueEntrySize;
+            kern_return_t result = IODataQueueDequeue(queue, entry, &entrySize);
+            if (result != kIOReturnSuccess || entrySize <= sizeof(PriorityReportHeader))
+            {
+                log_error("Received bogus priority access report: Error Code: %#X, entry size: %d", result, entrySize);
+                return false;
+            }
+
+            pending_.emplace_back();
+            PendingReport &pending = pending_.back();
+            memcpy(&pending.header, entry, sizeof(PriorityReportHeader));
+            if (!ExpandAccessReport(entry + sizeof(PriorityReportHeader), entrySize - sizeof(PriorityReportHeader), &pending.report))
+            {
+                log_error("Priority AccessReport size mismatch :: entry size: %d", entrySize);
+                pending_.pop_back();
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    /*! Records that 'report' was dequeued from the report queue */
+    void OnReportDequeued(const AccessReport &report) { dequeuedPipReports_[report.pipId]++; }
+
+    /*! Records that an entry was dequeued from the report queue */
+    void OnEntryDequeued() { dequeuedEntries_++; }
+
+    /*! Calls 'handOver' with the reports that are no longer held back, in the order they were dequeued (for each pip) */
+    template <typename THandOver>
+    void Release(THandOver handOver)
+    {
+        if (pending_.empty())
+        {
+            return;
+        }
+
+        // The reports of a pip stay in order: the ones following a report held back are held back as well
+        std::vector<pipid_t> heldBackPips;
+        size_t kept = 0;
+        for (size_t i = 0; i < pending_.size(); i++)
+        {
+            PendingReport &pending = pending_[i];
+            bool isHeldBack = std::find(heldBackPips.begin(), heldBackPips.end(), pending.report.pipId) != heldBackPips.end();
+            if (isHeldBack || !IsReady(pending))
+            {
+                if (!isHeldBack) heldBackPips.push_back(pending.report.pipId);
+                if (kept != i) pending_[kept] = pending;
+                kept++;
+                continue;
+            }
+
+            handOver(pending.report);
+            if (pending.report.operation == kOpProcessTreeCompleted)
+            {
+                dequeuedPipReports_.erase(pending.report.pipId);
+            }
+        }
+
+        pending_.resize(kept);
+    }
+};
+
 extern "C"
 {
 #pragma mark Private forward declarations
@@ -137,6 +249,18 @@ extern "C"
                 continue;
             }
             memoryInfo->address = address;
+
+            // The priority queue notifies the port of the report queue
+            size = 0;
+            address = 0;
+            result = IOConnectMapMemory(info.connection, PriorityFileAccessReporting, mach_task_self(), &address, &size, kIOMapAnywhere);
+            if (result != KERN_SUCCESS)
+            {
+                log_error("%s", "Failed mapping priority shared memory region");
+                memoryInfo->error = KEXT_SHARED_MEMORY_CREATION_ERROR;
+                continue;
+            }
+            memoryInfo->priorityAddress = address;
         }
         while(false);
 
@@ -167,6 +291,11 @@ extern "C"
             IOConnectUnmapMemory(info.connection, FileAccessReporting, memoryInfo.port, memoryInfo.address);
         }
 
+        if (memoryInfo.priorityAddress != 0)
+        {
+            IOConnectUnmapMemory(info.connection, PriorityFileAccessReporting, mach_task_self(), memoryInfo.priorityAddress);
+        }
+
         if (MACH_PORT_VALID(memoryInfo.port))
         {
             mach_port_destroy(mach_task_self(), memoryInfo.port);
@@ -258,6 +387,37 @@ extern "C"
         return true;
     }
 
+    bool SendPipStateChanges(PipStateChangedRequest *requests, int count, int *processedCount, KextConnectionInfo info)
+    {
+        *processedCount = 0;
+        if (info.connection == IO_OBJECT_NULL || count <= 0 || count > kMaxPipStateChangesPerBatch)
+        {
+            return false;
+        }
+
+        for (int i = 0; i < count; i++)
+        {
+            requests[i].clientPid = getpid();
+        }
+
+        uint64_t processed = 0;
+        uint32_t outputCount = 1;
+        kern_return_t result = IOConnectCallMethod(info.connection, kIpcActionPipStateChangedBatch,
+                                                   NULL, 0,
+                                                   requests, count * sizeof(PipStateChangedRequest),
+                                                   &processed, &outputCount,
+                                                   NULL, NULL);
+        *processedCount = (int)processed;
+        if (result != KERN_SUCCESS)
+        {
+            log_error("Failed calling SendPipStateChanges through IPC interface with error code: %#X for request %d of %d", result, *processedCount, count);
+            return false;
+        }
+
+        log_debug("SendPipStateChanges succeeded for %d requests", count);
+        return true;
+    }
+
     bool CheckForDebugMode(bool *isDebugModeEnabled, KextConnectionInfo info)
     {
         if (info.connection == IO_OBJECT_NULL)
@@ -314,14 +474,14 @@ extern "C"
 
 #pragma mark Monitoring
 
-    bool IntrospectKernelExtension(KextConnectionInfo info, IntrospectResponse *result)
+    bool IntrospectKernelExtension(KextConnectionInfo info, IntrospectResponse *result, bool includePips)
     {
         if (info.connection == IO_OBJECT_NULL)
         {
             return false;
         }
 
-        IntrospectRequest request;
+        IntrospectRequest request = { .includePips = (int8_t)(includePips ? 1 : 0) };
         size_t resultSize = sizeof(IntrospectResponse);
         kern_return_t status = IOConnectCallStructMethod(info.connection, kIpcActionIntrospect,
                                                          &request, sizeof(IntrospectRequest),
@@ -329,63 +489,184 @@ extern "C"
         return status == KERN_SUCCESS;
     }
 
+    bool MapKextCounters(KextConnectionInfo info, const AllCounters **counters)
+    {
+        if (info.connection == IO_OBJECT_NULL)
+        {
+            return false;
+        }
+
+        mach_vm_size_t size = 0;
+        mach_vm_address_t address = 0;
+        kern_return_t result = IOConnectMapMemory(info.connection, SharedCounters, mach_task_self(), &address, &size, kIOMapAnywhere | kIOMapReadOnly);
+        if (result != KERN_SUCCESS || size < sizeof(AllCounters))
+        {
+            log_error("Failed mapping the counters of the kernel extension, error: %#X", result);
+            if (result == KERN_SUCCESS) IOConnectUnmapMemory(info.connection, SharedCounters, mach_task_self(), address);
+            return false;
+        }
+
+        *counters = (const AllCounters *)address;
+        return true;
+    }
+
+    void UnmapKextCounters(KextConnectionInfo info, const AllCounters *counters)
+    {
+        if (info.connection != IO_OBJECT_NULL && counters != nullptr)
+        {
+            IOConnectUnmapMemory(info.connection, SharedCounters, mach_task_self(), (mach_vm_address_t)counters);
+        }
+    }
+
 #pragma mark IOSharedDataQueue consumer code
 
     /**
-     * Call this function once only from a dedicated thread and pass a valid C# delegate callback, the address to
-     * the shared memory region and a valid mach port.
+     * Spins for a little while, checking if the queues are getting new reports, so a sustained stream of reports
+     * doesn't make the listener go through a mach port wakeup for each of them.
      */
-    __cdecl void ListenForFileAccessReports(AccessReportCallback callback, long accessReportSize, mach_vm_address_t address, mach_port_t port)
+    static bool SpinUntilDataAvailable(IODataQueueMemory *queue, IODataQueueMemory *priorityQueue)
+    {
+        for (int i = 0; i < kSpinIterationsBeforeWait; i++)
+        {
+            if (IODataQueueDataAvailable(priorityQueue) || IODataQueueDataAvailable(queue))
+            {
+                return true;
+            }
+
+            sched_yield();
+        }
+
+        return false;
+    }
+
+    /**
+     * Call this function once only from a dedicated thread and pass a valid C# delegate callback, the addresses of
+     * the shared memory regions of the report queue and of the priority queue, and a valid mach port.
+     *
+     * Reports are dequeued in batches of up to kAccessReportBatchSize and handed to the callback together,
+     * so crossing into managed code happens once per batch instead of once per report. The priority queue is
+     * checked first, and its reports join a batch as soon as the reports that must go before them did.
+     */
+    __cdecl void ListenForFileAccessReports(AccessReportBatchCallback callback, long accessReportSize, mach_vm_address_t address,
+                                            mach_vm_address_t priorityAddress, mach_port_t port)
     {
         if (sizeof(AccessReport) != accessReportSize)
         {
             log_error("Wrong size of the AccessReport buffer: expected %ld, received %ld",
                       sizeof(AccessReport), accessReportSize);
-            if (callback != NULL) callback(AccessReport{}, KEXT_WRONG_BUFFER_SIZE);
+            if (callback != NULL) callback(NULL, 0, KEXT_WRONG_BUFFER_SIZE);
             return;
         }
 
-        if (callback == NULL || address == 0 || !MACH_PORT_VALID(port))
+        if (callback == NULL || address == 0 || priorityAddress == 0 || !MACH_PORT_VALID(port))
         {
             if (callback != NULL)
             {
-                callback(AccessReport{}, REPORT_QUEUE_CONNECTION_ERROR);
+                callback(NULL, 0, REPORT_QUEUE_CONNECTION_ERROR);
             }
             return;
         }
 
         log_debug("Listening for data on shared queue from process: %d", getpid());
 
+        // Only accessed by this thread, and reused once the callback returns
+        AccessReport *batch = new AccessReport[kAccessReportBatchSize];
+        char *entry = new char[kMaxReportQueueEntrySize];
+        int count = 0;
+
+        PriorityReports priorityReports;
+        auto handOverPriorityReport = [&](const AccessReport &report)
+        {
+            batch[count] = report;
+            batch[count].stats.dequeueTime = GetMachAbsoluteTime();
+            if (++count == kAccessReportBatchSize)
+            {
+                callback(batch, count, REPORT_QUEUE_SUCCESS);
+                count = 0;
+            }
+        };
+
         IODataQueueMemory *queue = (IODataQueueMemory *)address;
+        IODataQueueMemory *priorityQueue = (IODataQueueMemory *)priorityAddress;
         do
         {
-            while (IODataQueueDataAvailable(queue))
+            do
             {
-                AccessReport report;
-                uint32_t reportSize = sizeof(report);
-
-                kern_return_t result = IODataQueueDequeue(queue, &report, &reportSize);
-
-                if (result != kIOReturnSuccess)
+                if (!priorityReports.Dequeue(priorityQueue, entry))
                 {
-                    log_error("Received bogus access report: PID(%d) PIP(%#llX) Error Code: %#X", report.rootPid, report.pipId, result);
-                    callback(AccessReport{}, REPORT_QUEUE_DEQUEUE_ERROR);
+                    if (count > 0) callback(batch, count, REPORT_QUEUE_SUCCESS);
+                    callback(NULL, 0, REPORT_QUEUE_DEQUEUE_ERROR);
+                    delete[] entry;
+                    delete[] batch;
                     return;
                 }
 
-                if (reportSize != sizeof(report))
+                priorityReports.Release(handOverPriorityReport);
+
+                // Bounded, so the priority queue is checked again even while the report queue never runs dry
+                for (int numEntries = 0; numEntries < kAccessReportBatchSize && IODataQueueDataAvailable(queue); numEntries++)
                 {
-                    log_error("AccessReport size mismatch :: reported: %d, expected: %ld", reportSize, sizeof(report));
-                    callback(AccessReport{}, REPORT_QUEUE_DEQUEUE_ERROR);
-                    continue;
+                    uint32_t entrySize = kMaxReportQueueEntrySize;
+                    kern_return_t result = IODataQueueDequeue(queue, entry, &entrySize);
+
+                    if (result != kIOReturnSuccess)
+                    {
+                        log_error("Received bogus access report: Error Code: %#X", result);
+                        if (count > 0) callback(batch, count, REPORT_QUEUE_SUCCESS);
+                        callback(NULL, 0, REPORT_QUEUE_DEQUEUE_ERROR);
+                        delete[] entry;
+                        delete[] batch;
+                        return;
+                    }
+
+                    priorityReports.OnEntryDequeued();
+
+                    // An entry holds the compact forms of one or more reports (see CompactAccessReport), one after the other:
+                    // the kext sends the reports of a pip together when coalescing them
+                    uint32_t offset = 0;
+                    while (offset < entrySize)
+                    {
+                        uint32_t reportSize = CompactAccessReportSize(entry + offset, entrySize - offset);
+
+                        AccessReport *report = &batch[count];
+                        if (reportSize == 0 || !ExpandAccessReport(entry + offset, reportSize, report))
+                        {
+                            log_error("AccessReport size mismatch :: entry size: %d, offset: %d, expected report size: (%ld, %ld]",
+                                      entrySize, offset, kCompactAccessReportHeaderSize, kCompactAccessReportMaxSize);
+                            if (count > 0) callback(batch, count, REPORT_QUEUE_SUCCESS);
+                            callback(NULL, 0, REPORT_QUEUE_DEQUEUE_ERROR);
+                            count = 0;
+                            break;
+                        }
+
+                        report->stats.dequeueTime = GetMachAbsoluteTime();
+                        priorityReports.OnReportDequeued(*report);
+                        offset += reportSize;
+
+                        if (++count == kAccessReportBatchSize)
+                        {
+                            callback(batch, count, REPORT_QUEUE_SUCCESS);
+                            count = 0;
+                        }
+                    }
                 }
 
-                report.stats.dequeueTime = GetMachAbsoluteTime();
-                callback(report, REPORT_QUEUE_SUCCESS);
+                // The reports just dequeued may be the ones some priority reports were held back for
+                priorityReports.Release(handOverPriorityReport);
+
+                if (count > 0)
+                {
+                    callback(batch, count, REPORT_QUEUE_SUCCESS);
+                    count = 0;
+                }
             }
+            while (SpinUntilDataAvailable(queue, priorityQueue));
         }
         while (IODataQueueWaitForAvailableData(queue, port) == kIOReturnSuccess);
 
+        delete[] entry;
+        delete[] batch;
+
         log_debug("Exiting ListenForFileAccessReports for PID (%d)", getpid());
     }
 
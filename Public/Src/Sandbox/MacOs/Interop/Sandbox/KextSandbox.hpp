@@ -26,6 +26,7 @@ typedef struct {
     int error;
     mach_vm_address_t address;
     mach_port_t port;
+    mach_vm_address_t priorityAddress;
 } KextSharedMemoryInfo;
 
 extern "C"
@@ -47,15 +48,46 @@ extern "C"
      */
     bool UpdateCurrentResourceUsage(uint cpuUsageBasisPoints, uint ramUsageBasisPoints, KextConnectionInfo info);
 
+    /*!
+     * Sends up to 'kMaxPipStateChangesPerBatch' pip state changes in a single call to the kernel extension, instead of one
+     * call each. 'clientPid' is filled in for every request; 'payload' must point at the FAM of a started pip until the
+     * call returns. The requests are processed in order and processing stops at the first one that fails:
+     * 'processedCount' receives the number of requests that succeeded.
+     */
+    bool SendPipStateChanges(PipStateChangedRequest *requests, int count, int *processedCount, KextConnectionInfo info);
+
     typedef void (__cdecl *FailureNotificationCallback)(void *, IOReturn);
     bool SetFailureNotificationHandler(FailureNotificationCallback callback, KextConnectionInfo info);
 
-    __cdecl void ListenForFileAccessReports(AccessReportCallback callback, long accessReportSize, mach_vm_address_t address, mach_port_t port);
+    /*!
+     * Receives the reports dequeued during one wakeup of the listener: 'count' contiguous reports starting at 'reports'.
+     * The reports are only valid for the duration of the call. On errors, 'reports' is NULL and 'count' is 0.
+     */
+    typedef void (__cdecl *AccessReportBatchCallback)(const AccessReport *reports, int count, int error);
+
+    /*!
+     * Hands the reports of the report queue at 'address' and of the priority queue at 'priorityAddress' (see PriorityReportHeader)
+     * over to 'callback' until the queues are torn down. Priority reports are handed over as soon as the reports that must go
+     * before them were.
+     */
+    __cdecl void ListenForFileAccessReports(AccessReportBatchCallback callback, long accessReportSize, mach_vm_address_t address,
+                                            mach_vm_address_t priorityAddress, mach_port_t port);
 
     uint64_t GetMachAbsoluteTime(void);
     __cdecl void KextVersionString(char *version, int size);
 
-    bool IntrospectKernelExtension(KextConnectionInfo info, IntrospectResponse *result);
+    /*!
+     * Fetches the state of the kernel extension. Pass false for 'includePips' to only fetch the sandbox-wide
+     * counters, which is much cheaper for the kernel extension when many processes are tracked.
+     */
+    bool IntrospectKernelExtension(KextConnectionInfo info, IntrospectResponse *result, bool includePips = true);
+
+    /*!
+     * Maps the sandbox-wide counters of the kernel extension read-only into this process. The mapped counters
+     * are live, reading them doesn't call into the kernel extension. Unmap them with 'UnmapKextCounters'.
+     */
+    bool MapKextCounters(KextConnectionInfo info, const AllCounters **counters);
+    void UnmapKextCounters(KextConnectionInfo info, const AllCounters *counters);
 };
 
 bool KEXT_SendPipStarted(const pid_t processId, pipid_t pipId, const char *const famBytes, int famBytesLength, KextConnectionInfo info);
@@ -5,6 +5,10 @@
 #include "IOHandler.hpp"
 #include "Sandbox.hpp"
 
+#if __APPLE__
+#include "XPCConstants.hpp"
+#endif
+
 static Sandbox* sandbox;
 
 extern "C"
@@ -177,6 +181,17 @@ Sandbox::~Sandbox()
 #endif
 }
 
+#if __APPLE__
+/*! The groups of EndpointSecurity events (see ESEventGroups) the accesses of 'pip' are checked against */
+static uint64_t EventGroupsNeededBy(const std::shared_ptr<SandboxedPip> &pip)
+{
+    // The accesses of pips without file access monitoring are never checked (see AccessHandler::TryInitializeWithTrackedProcess)
+    return CheckDisableDetours(pip->GetFamFlags())
+        ? es_event_group_none
+        : es_event_group_writes | es_event_group_reads;
+}
+#endif
+
 std::shared_ptr<SandboxedProcess> Sandbox::FindTrackedProcess(pid_t pid)
 {
     return trackedProcesses_->get(pid);
@@ -217,6 +232,13 @@ bool Sandbox::TrackRootProcess(std::shared_ptr<SandboxedPip> pip)
         else
         {
             bool insertedNew = result == TrieResult::kTrieResultInserted;
+#if __APPLE__
+            if (insertedNew && es_ != nullptr)
+            {
+                es_->AddSubscriptions(EventGroupsNeededBy(pip));
+            }
+#endif
+
             log_debug("Tracking root process PID(%d), PipId: %#llX, tree size: %d, path: %{public}s, code: %d",
                       pid, pip->GetPipId(), pip->GetTreeSize(), process->GetPath(), result);
 
@@ -297,9 +319,15 @@ bool Sandbox::UntrackProcess(pid_t pid, std::shared_ptr<SandboxedProcess> proces
     // remove the mapping for 'pid'
     auto removeResult = trackedProcesses_->remove(pid);
     bool removedExisting = removeResult == TrieResult::kTrieResultRemoved;
-    if (removedExisting)
+    if (removedExisting && process->GetPip()->DecrementProcessTreeCount() == 0)
     {
-        process->GetPip()->DecrementProcessTreeCount();
+#if __APPLE__
+        // last process of the pip --> the events it needed may no longer be needed by anyone
+        if (es_ != nullptr)
+        {
+            es_->RemoveSubscriptions(EventGroupsNeededBy(process->GetPip()));
+        }
+#endif
     }
 
     std::shared_ptr<SandboxedPip> pip = process->GetPip();
@@ -14,7 +14,12 @@
 #include "Trie.hpp"
 
 #include <signal.h>
-#include <map>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
 
 #define SB_WRONG_BUFFER_SIZE    0x8
 #define SB_INSTANCE_ERROR       0x16
@@ -43,6 +48,173 @@ extern "C"
 bool Sandbox_SendPipStarted(const pid_t pid, pipid_t pipId, const char *const famBytes, int famBytesLength);
 bool Sandbox_SendPipProcessTerminated(pipid_t pipId, pid_t pid);
 
+/*!
+ * A pid -> pid map that can be read and updated concurrently.
+ *
+ * The map is split into shards, each with its own reader/writer lock, so that lookups (which happen for every
+ * observed event) never wait for each other and only rarely wait for updates.
+ */
+class ConcurrentPidMap final
+{
+private:
+
+    static const size_t kShardCount = 16;
+
+    struct Shard
+    {
+        std::shared_mutex lock;
+        std::unordered_map<pid_t, pid_t> pids;
+    };
+
+    Shard shards_[kShardCount];
+    std::atomic<size_t> count_{0};
+
+    inline Shard& ShardFor(pid_t pid) { return shards_[(size_t)pid % kShardCount]; }
+
+public:
+
+    inline bool Contains(pid_t pid)
+    {
+        Shard &shard = ShardFor(pid);
+        const std::shared_lock<std::shared_mutex> lock(shard.lock);
+        return shard.pids.find(pid) != shard.pids.end();
+    }
+
+    /*! Stores the pid mapped to 'pid' to 'value' and returns true if there is one. */
+    inline bool TryGet(pid_t pid, pid_t *value)
+    {
+        Shard &shard = ShardFor(pid);
+        const std::shared_lock<std::shared_mutex> lock(shard.lock);
+        auto it = shard.pids.find(pid);
+        if (it == shard.pids.end())
+        {
+            return false;
+        }
+
+        *value = it->second;
+        return true;
+    }
+
+    /*! Maps 'pid' to 'value' unless 'pid' is already mapped; returns whether a new mapping was added. */
+    inline bool Emplace(pid_t pid, pid_t value)
+    {
+        Shard &shard = ShardFor(pid);
+        const std::unique_lock<std::shared_mutex> lock(shard.lock);
+        bool inserted = shard.pids.emplace(pid, value).second;
+        if (inserted)
+        {
+            count_++;
+        }
+
+        return inserted;
+    }
+
+    /*! Removes the mapping of 'pid'; returns whether there was one. */
+    inline bool Remove(pid_t pid)
+    {
+        Shard &shard = ShardFor(pid);
+        const std::unique_lock<std::shared_mutex> lock(shard.lock);
+        bool removed = shard.pids.erase(pid) == 1;
+        if (removed)
+        {
+            count_--;
+        }
+
+        return removed;
+    }
+
+    inline bool IsEmpty() const { return count_ == 0; }
+};
+
+/*!
+ * Drops the file access events that are observed twice when running hybrid, once through EndpointSecurity and once
+ * through the interposing library.
+ *
+ * The events of each pid seen in the last 'kMergeWindowMs' are remembered by (event type, path) along with the source they
+ * came from. An event matching a remembered one from the other source is a duplicate: the first one has already been
+ * handed to the access checks, so the second one is dropped before any policy is evaluated. Process lifecycle and auth
+ * events are never merged, as the process tracking of each source depends on them.
+ *
+ * Not thread-safe: only used from the serial hybrid event queue.
+ */
+class HybridEventMerger final
+{
+private:
+
+    static const int kMergeWindowMs = 250;
+    static const size_t kMaxPendingEventsPerPid = 64;
+
+    struct PendingEvent
+    {
+        es_event_type_t type;
+        std::string path;
+        IOEventBacking backing;
+        std::chrono::steady_clock::time_point time;
+    };
+
+    std::unordered_map<pid_t, std::deque<PendingEvent>> pending_;
+
+    static inline bool IsMergeable(const IOEvent &event)
+    {
+        if (event.GetActionType() != ES_ACTION_TYPE_NOTIFY)
+        {
+            return false;
+        }
+
+        switch (event.GetEventType())
+        {
+            case ES_EVENT_TYPE_NOTIFY_FORK:
+            case ES_EVENT_TYPE_NOTIFY_EXEC:
+            case ES_EVENT_TYPE_NOTIFY_EXIT:
+                return false;
+            default:
+                return true;
+        }
+    }
+
+public:
+
+    /*! Returns true if 'event' was already observed through the other source; otherwise remembers it. */
+    inline bool IsDuplicate(const IOEvent &event, IOEventBacking backing)
+    {
+        if (event.GetEventType() == ES_EVENT_TYPE_NOTIFY_EXIT)
+        {
+            pending_.erase(event.GetPid());
+            return false;
+        }
+
+        if (!IsMergeable(event))
+        {
+            return false;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        std::deque<PendingEvent> &events = pending_[event.GetPid()];
+        while (!events.empty() && now - events.front().time > std::chrono::milliseconds(kMergeWindowMs))
+        {
+            events.pop_front();
+        }
+
+        for (auto it = events.begin(); it != events.end(); ++it)
+        {
+            if (it->backing != backing && it->type == event.GetEventType() && it->path == event.GetSrcPath())
+            {
+                // Each event has at most one duplicate
+                events.erase(it);
+                return true;
+            }
+        }
+
+        if (events.size() == kMaxPendingEventsPerPid)
+        {
+            events.pop_front();
+        }
+
+        events.push_back({ event.GetEventType(), event.GetSrcPath(), backing, now });
+        return false;
+    }
+};
+
 class Sandbox final
 {
     
@@ -53,11 +225,11 @@ private:
 #if __APPLE__
     dispatch_queue_t hybird_event_queue_;
     xpc_connection_t xpc_bridge_ = nullptr;
-    std::mutex access_mutex;
+    HybridEventMerger hybridEventMerger_;
 #endif
     
-    std::map<pid_t, pid_t> allowlistedPids_;
-    std::map<pid_t, pid_t> forceForkedPids_;
+    ConcurrentPidMap allowlistedPids_;
+    ConcurrentPidMap forceForkedPids_;
     
     Trie<SandboxedProcess> *trackedProcesses_ = nullptr;
     AccessReportCallback accessReportCallback_ = nullptr;
@@ -76,32 +248,20 @@ public:
 #if __APPLE__
     inline const bool IsRunningHybrid() const { return configuration_ == Configuration::HybridSandboxType; }
     inline const dispatch_queue_t GetHybridQueue() const { return hybird_event_queue_; }
+    inline HybridEventMerger& GetHybridEventMerger() { return hybridEventMerger_; }
 #endif
     
-    inline std::map<pid_t, pid_t>& GetAllowlistedPidMap() { return allowlistedPids_; }
-    inline std::map<pid_t, pid_t>& GetForceForkedPidMap() { return forceForkedPids_; }
+    inline ConcurrentPidMap& GetAllowlistedPidMap() { return allowlistedPids_; }
+    inline ConcurrentPidMap& GetForceForkedPidMap() { return forceForkedPids_; }
     
-    inline const bool SetProcessPidPair(std::map<pid_t, pid_t>& map, pid_t pid, pid_t ppid)
+    inline const bool SetProcessPidPair(ConcurrentPidMap& map, pid_t pid, pid_t ppid)
     {
-#if __APPLE__
-        const std::lock_guard<std::mutex> lock(access_mutex);
-#endif
-        return map.emplace(pid, ppid).second;
+        return map.Emplace(pid, ppid);
     }
     
-    inline const bool RemoveProcessPid(std::map<pid_t, pid_t>& map, pid_t pid)
+    inline const bool RemoveProcessPid(ConcurrentPidMap& map, pid_t pid)
     {
-#if __APPLE__
-        const std::lock_guard<std::mutex> lock(access_mutex);
-#endif
-        
-        auto result = map.find(pid);
-        if (result != map.end())
-        {
-            return (map.erase(pid) == 1);
-        }
-        
-        return false;
+        return map.Remove(pid);
     }
     
     inline const void SetAccessReportCallback(AccessReportCallback callback) { accessReportCallback_ = callback; }
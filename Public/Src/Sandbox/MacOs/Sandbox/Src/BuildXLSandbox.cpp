@@ -10,6 +10,7 @@
 #include "Stopwatch.hpp"
 #include "SysCtl.hpp"
 #include "TrustedBsdHandler.hpp"
+#include "Zone.hpp"
 
 #define LogVerbose(format, ...) log_verbose(g_bxl_verbose_logging, format, __VA_ARGS__)
 #define super IOService
@@ -28,7 +29,8 @@ static KextConfig sDefaultConfig =
         .cpuUsageBlock     = 0,
         .cpuUsageWakeup    = 0,
         .minAvailableRamMB = 0
-    }
+    },
+    .reportCoalescingWindowMs = 0,
 };
 
 bool BuildXLSandbox::init(OSDictionary *dictionary)
@@ -51,13 +53,24 @@ bool BuildXLSandbox::init(OSDictionary *dictionary)
         return false;
     }
 
+    countersMemory_ = IOBufferMemoryDescriptor::withOptions(kIODirectionOutIn | kIOMemoryKernelUserShared,
+                                                            round_page(sizeof(AllCounters)),
+                                                            PAGE_SIZE);
+    if (!countersMemory_)
+    {
+        return false;
+    }
+
+    counters_ = (AllCounters *)countersMemory_->getBytesNoCopy();
     ResetCounters();
-    resourceManager_ = ResourceManager::create(&counters_.resourceCounters);
+
+    resourceManager_ = ResourceManager::create(&counters_->resourceCounters);
     if (!resourceManager_)
     {
         return false;
     }
 
+    adaptiveReportQueueSizeMB_ = kSharedDataQueueSizeDefault;
     Configure(&sDefaultConfig);
     if (!InitializeTries())
     {
@@ -80,6 +93,10 @@ void BuildXLSandbox::free(void)
     OSSafeReleaseNULL(resourceManager_);
     OSSafeReleaseNULL(trackedProcesses_);
     OSSafeReleaseNULL(connectedClients_);
+    OSSafeReleaseNULL(manifestTrees_);
+
+    counters_ = nullptr;
+    OSSafeReleaseNULL(countersMemory_);
 
     bxl_sysctl_unregister();
 
@@ -167,6 +184,14 @@ bool BuildXLSandbox::InitializeTries()
         return false;
     }
 
+    manifestTrees_ = Trie::createUintTrie();
+    if (!manifestTrees_)
+    {
+        return false;
+    }
+
+    bzero((void *)trackedPidFilter_, sizeof(trackedPidFilter_));
+
     bool callbackInstalled = trackedProcesses_->onChange(this, [](void *data, int oldCount, int newCount)
     {
         BuildXLSandbox *me = (BuildXLSandbox*)data;
@@ -250,7 +275,7 @@ kern_return_t BuildXLSandbox::InitializeListeners()
 
 void BuildXLSandbox::UninitializeListeners()
 {
-    counters_ = {0};
+    ResetCounters();
 
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wdeprecated"
@@ -288,6 +313,7 @@ void BuildXLSandbox::OnLastClientDisconnected()
     // re-initialize tries to force deallocation of trie nodes
     OSSafeReleaseNULL(trackedProcesses_);
     OSSafeReleaseNULL(connectedClients_);
+    OSSafeReleaseNULL(manifestTrees_);
     InitializeTries();
 }
 
@@ -296,6 +322,7 @@ void BuildXLSandbox::Configure(const KextConfig *config)
     EnterMonitor
 
     config_ = *config;
+    autoSizeReportQueue_ = config_.reportQueueSizeMB == 0;
 
     if (resourceManager_)
     {
@@ -307,11 +334,42 @@ void BuildXLSandbox::Configure(const KextConfig *config)
     {
         config_.reportQueueSizeMB = kSharedDataQueueSizeDefault;
     }
+
+    if (config_.reportCoalescingWindowMs > kReportCoalescingWindowMaxMs)
+    {
+        config_.reportCoalescingWindowMs = kReportCoalescingWindowMaxMs;
+    }
 }
 
 UInt32 BuildXLSandbox::GetReportQueueEntryCount()
 {
-    return (config_.reportQueueSizeMB * 1024 * 1024) / sizeof(AccessReport);
+    uint sizeMB = autoSizeReportQueue_ ? adaptiveReportQueueSizeMB_ : config_.reportQueueSizeMB;
+    return (sizeMB * 1024 * 1024) / sizeof(AccessReport);
+}
+
+void BuildXLSandbox::AdaptReportQueueSize(pid_t clientPid, const QueueStats &stats)
+{
+    if (!autoSizeReportQueue_ || stats.capacityBytes == 0)
+    {
+        return;
+    }
+
+    uint fillPercent = (uint)(((uint64_t)stats.highWaterMarkBytes * 100) / stats.capacityBytes);
+    uint sizeMB = adaptiveReportQueueSizeMB_;
+
+    if (stats.numStalls > 0 || fillPercent >= kReportQueueGrowThresholdPercent)
+    {
+        sizeMB = min(sizeMB * 2, kSharedDataQueueSizeMax);
+    }
+    else if (fillPercent < kReportQueueShrinkThresholdPercent)
+    {
+        sizeMB = max(sizeMB / 2, kSharedDataQueueSizeMin);
+    }
+
+    LogVerbose("Report queue of client PID(%d) :: high-water mark: %d%% of %d KB, #stalls: %d -> next queues: %d MB (was %d MB)",
+               clientPid, fillPercent, stats.capacityBytes / 1024, stats.numStalls, sizeMB, adaptiveReportQueueSizeMB_);
+
+    adaptiveReportQueueSizeMB_ = sizeMB;
 }
 
 ClientInfo* BuildXLSandbox::GetClientInfo(pid_t clientPid)
@@ -328,7 +386,7 @@ IOReturn BuildXLSandbox::AllocateNewClient(pid_t clientPid)
         .entryCount     = GetReportQueueEntryCount(),
         .entrySize      = sizeof(AccessReport),
         .enableBatching = config_.enableReportBatching,
-        .counters       = &counters_.reportCounters
+        .counters       = &counters_->reportCounters
     });
     AutoRelease _(client);
 
@@ -354,6 +412,15 @@ IOReturn BuildXLSandbox::DeallocateClient(pid_t clientPid)
 {
     EnterMonitor
 
+    // keep the client alive past its removal: the processes it left behind are found through it
+    ClientInfo *client = GetClientInfo(clientPid);
+    if (client != nullptr)
+    {
+        client->retain();
+        AdaptReportQueueSize(clientPid, client->getQueueStats());
+    }
+    AutoRelease _(client);
+
     auto removeResult = connectedClients_->remove(clientPid);
 
     if (removeResult == Trie::TrieResult::kTrieResultFailure ||
@@ -375,13 +442,20 @@ IOReturn BuildXLSandbox::DeallocateClient(pid_t clientPid)
         log_debug("Deallocating client PID(%d)", clientPid);
 
         // Make sure to also cleanup any remaining tracked process objects as the client could have exited abnormally (crashed)
-        // and we don't want those objects to stay around any longer
-        trackedProcesses_->removeMatching(&clientPid, [](void *data, const OSObject *value)
+        // and we don't want those objects to stay around any longer.  Only the processes of this client are visited
+        // (instead of every tracked process), and a pid is only untracked if it is still mapped to the process of this client.
+        if (client != nullptr)
         {
-            pid_t cid = *static_cast<pid_t*>(data);
-            SandboxedProcess *process = OSDynamicCast(SandboxedProcess, value);
-            return process != nullptr && process->getPip()->getClientPid() == cid;
-        });
+            client->forEachTrackedProcess(this, [](void *data, uint64_t pid, const OSObject *process)
+            {
+                BuildXLSandbox *me = static_cast<BuildXLSandbox*>(data);
+                if (me->trackedProcesses_->removeIfEqual(pid, process) == Trie::TrieResult::kTrieResultRemoved)
+                {
+                    // the filter must only count the processes that are still tracked
+                    me->RemoveFromTrackedPidFilter((pid_t)pid);
+                }
+            });
+        }
 
         return kIOReturnSuccess;
     }
@@ -412,8 +486,53 @@ IOMemoryDescriptor* const BuildXLSandbox::GetReportQueueMemoryDescriptor(pid_t c
         : nullptr;
 }
 
+IOMemoryDescriptor* const BuildXLSandbox::GetPriorityReportQueueMemoryDescriptor(pid_t clientPid)
+{
+    EnterMonitor
+
+    ClientInfo *client = GetClientInfo(clientPid);
+    return client != nullptr
+        ? client->getPriorityMemoryDescriptor()
+        : nullptr;
+}
+
+IOMemoryDescriptor* const BuildXLSandbox::GetCountersMemoryDescriptor()
+{
+    if (countersMemory_ != nullptr)
+    {
+        countersMemory_->retain();
+    }
+
+    return countersMemory_;
+}
+
 bool const BuildXLSandbox::SendAccessReport(AccessReport &report, SandboxedPip *pip, const CacheRecord *cacheRecord)
 {
+    bool isPriorityReport = IsPriorityReport(report.operation);
+    if (pip->isReportCoalescingEnabled())
+    {
+        if (!isPriorityReport)
+        {
+            AddTimeStampToAccessReport(&report, enqueueTime);
+            bool success = pip->coalesceReport(report, /*flush*/ false);
+
+            log_error_or_debug(
+                g_bxl_verbose_logging, !success,
+                "Coalesced ClientPID(%d), PID(%d), Root PID(%d), PIP(%#llX), Operation: %s, Path: %s, Status: %d",
+                pip->getClientPid(), report.pid, report.rootPid, report.pipId, OpNames[report.operation], report.path, report.status);
+
+            return success;
+        }
+
+        // The reports held back before a process lifecycle report are sent ahead of it, so the client doesn't wait for the coalescing window.
+        // Nothing a child process does can be among them when it starts, so its start report doesn't need to go after them, and fork
+        // storms don't keep closing the coalescing window of their pip.
+        if (report.operation != kOpProcessStart && !pip->flushCoalescedReports())
+        {
+            return false;
+        }
+    }
+
     Stopwatch stopwatch;
 
     pid_t clientPid = pip->getClientPid();
@@ -431,7 +550,18 @@ bool const BuildXLSandbox::SendAccessReport(AccessReport &report, SandboxedPip *
 
     AddTimeStampToAccessReport(&report, enqueueTime);
 
-    bool success = client->enqueueReport({.report = report, .cacheRecord = cacheRecord});
+    // Priority reports must be dequeued after the reports of their pip enqueued so far (see PriorityReportHeader)
+    bool success = client->enqueueReport(
+    {
+        .report              = report,
+        .cacheRecord         = cacheRecord,
+        .precedingPipReports = isPriorityReport ? pip->getNumQueuedReports() : 0,
+    });
+
+    if (success && !isPriorityReport)
+    {
+        pip->addQueuedReports(1);
+    }
 
     Timespan reportFileAccessDuration  = stopwatch.lap();
     Counters()->reportFileAccess      += reportFileAccessDuration;
@@ -445,17 +575,141 @@ bool const BuildXLSandbox::SendAccessReport(AccessReport &report, SandboxedPip *
     return success;
 }
 
+bool BuildXLSandbox::SendCoalescedReports(void *sandbox, SandboxedPip *pip, const char *reports, uint32_t size, uint reportCount)
+{
+    BuildXLSandbox *me = (BuildXLSandbox *)sandbox;
+    Stopwatch stopwatch;
+
+    pid_t clientPid = pip->getClientPid();
+    ClientInfo *client = me->GetClientInfo(clientPid);
+
+    Timespan getClientInfoDuration  = stopwatch.lap();
+    me->Counters()->getClientInfo  += getClientInfoDuration;
+    pip->Counters()->getClientInfo += getClientInfoDuration;
+
+    if (client == nullptr)
+    {
+        log_error("No client info found for PID(%d), dropping %d coalesced reports", clientPid, reportCount);
+        return false;
+    }
+
+    bool success = client->enqueueReports(reports, size, reportCount);
+    if (success)
+    {
+        pip->addQueuedReports(reportCount);
+    }
+
+    Timespan reportFileAccessDuration  = stopwatch.lap();
+    me->Counters()->reportFileAccess  += reportFileAccessDuration;
+    pip->Counters()->reportFileAccess += reportFileAccessDuration;
+
+    log_error_or_debug(
+        g_bxl_verbose_logging, !success,
+        "Enqueued %d coalesced reports of ClientPID(%d), Root PID(%d), PIP(%#llX), Size: %d, Sent: %d",
+        reportCount, clientPid, pip->getProcessId(), pip->getPipId(), size, success);
+
+    return success;
+}
+
+static uint64_t HashManifestTree(const BYTE *tree, size_t size)
+{
+    // 64-bit FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash = (hash ^ tree[i]) * 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+Buffer* BuildXLSandbox::ShareManifestTree(void *sandbox, const BYTE *tree, size_t size)
+{
+    BuildXLSandbox *me = (BuildXLSandbox *)sandbox;
+    uint64_t hash = HashManifestTree(tree, size);
+
+    Monitor monitor(me->lock_);
+
+    Buffer *shared = me->manifestTrees_->getAs<Buffer>(hash);
+    if (shared != nullptr && shared->getSize() == size && memcmp(shared->getBytes(), tree, size) == 0)
+    {
+        shared->retain();
+        return shared;
+    }
+
+    // Drop the trees no pip uses any more (removeMatching retains every record while filtering it,
+    // so a tree only 'manifestTrees_' holds on to has a retain count of 2 there)
+    me->manifestTrees_->removeMatching(nullptr, [](void *, const OSObject *value)
+    {
+        return value->getRetainCount() <= 2;
+    });
+
+    Buffer *copy = Buffer::create(size);
+    if (copy == nullptr)
+    {
+        log_error("Could not allocate %ld bytes for a manifest tree", size);
+        return nullptr;
+    }
+
+    memcpy(copy->getBytes(), tree, size);
+
+    // On a hash collision with a tree still in use, this tree is simply not shared
+    if (me->manifestTrees_->get(hash) == nullptr)
+    {
+        me->manifestTrees_->insert(hash, copy);
+    }
+
+    LogVerbose("Added manifest tree %#llX (%ld bytes), %d trees kept", hash, size, me->manifestTrees_->getCount());
+    return copy;
+}
+
 SandboxedProcess* BuildXLSandbox::FindTrackedProcess(pid_t pid)
 {
     // NOTE: this has to be very fast when we are not tracking any processes (i.e., trackedProcesses_ is empty)
     //       because this is called on every single file access any process makes
+    if (*TrackedPidFilterBucket(pid) == 0)
+    {
+        return nullptr;
+    }
+
     return trackedProcesses_->getAs<SandboxedProcess>(pid);
 }
 
+static OSObject* CreatePooledProcess()
+{
+    return SandboxedProcess::createUnassigned();
+}
+
 bool BuildXLSandbox::TrackRootProcess(SandboxedPip *pip)
 {
     pid_t pid = pip->getProcessId();
 
+    if (config_.reportCoalescingWindowMs > 0 &&
+        !pip->enableReportCoalescing(config_.reportCoalescingWindowMs, SendCoalescedReports, this))
+    {
+        log_error("Could not enable report coalescing for PID(%d)", pid);
+        return false;
+    }
+
+    if (g_bxl_process_pool_size > 0 &&
+        !pip->enableProcessPool(g_bxl_process_pool_size, CreatePooledProcess))
+    {
+        log_error("Could not enable the process pool for PID(%d)", pid);
+        return false;
+    }
+
+    // the pip is about to start accessing files: make room for its cache records, trie nodes and reports up front
+    if (g_bxl_zone_reserve_count > 0)
+    {
+        Zone::reserveAll(g_bxl_zone_reserve_count);
+    }
+
+    if (!pip->shareManifestTree(ShareManifestTree, this))
+    {
+        log_error("Could not share the manifest tree of PID(%d)", pid);
+        return false;
+    }
+
     SandboxedProcess *process = SandboxedProcess::create(pid, pip);
     AutoRelease _(process);
 
@@ -470,7 +724,12 @@ bool BuildXLSandbox::TrackRootProcess(SandboxedPip *pip)
     int numAttempts = 0;
     while (++numAttempts <= 3)
     {
+        AddToTrackedPidFilter(pid);
         auto result = trackedProcesses_->insert(pid, process);
+        if (result != Trie::TrieResult::kTrieResultInserted)
+        {
+            RemoveFromTrackedPidFilter(pid);
+        }
 
         if (result == Trie::TrieResult::kTrieResultAlreadyExists)
         {
@@ -488,6 +747,15 @@ bool BuildXLSandbox::TrackRootProcess(SandboxedPip *pip)
         else
         {
             bool insertedNew = result == Trie::TrieResult::kTrieResultInserted;
+            if (insertedNew)
+            {
+                ClientInfo *client = GetClientInfo(pip->getClientPid());
+                if (client != nullptr)
+                {
+                    client->trackProcess(pid, process);
+                }
+            }
+
             log_error_or_debug(g_bxl_verbose_logging,
                                !insertedNew,
                                "Tracking root process PID(%d) for ClientId(%d), PipId: %#llX, tree size: %d, path: %s, code: %d",
@@ -515,7 +783,18 @@ bool BuildXLSandbox::TrackChildProcess(pid_t childPid, SandboxedProcess *parentP
 {
     SandboxedPip *pip = parentProcess->getPip();
 
-    SandboxedProcess *childProcess = SandboxedProcess::create(childPid, pip);
+    // in a fork storm the pool saves every fork an allocation; it is refilled in the background
+    SandboxedProcess *childProcess = OSDynamicCast(SandboxedProcess, pip->takePooledProcess());
+    if (childProcess != nullptr)
+    {
+        childProcess->assign(childPid, pip);
+        pip->Counters()->numForksFromPool++;
+    }
+    else
+    {
+        childProcess = SandboxedProcess::create(childPid, pip);
+    }
+
     AutoRelease _(childProcess);
 
     if (childProcess == nullptr)
@@ -523,8 +802,13 @@ bool BuildXLSandbox::TrackChildProcess(pid_t childPid, SandboxedProcess *parentP
         return false;
     }
 
-    Trie::TrieResult getOrAddResult;
+    Trie::TrieResult getOrAddResult = Trie::TrieResult::kTrieResultFailure;
+    AddToTrackedPidFilter(childPid);
     OSObject *newValue = trackedProcesses_->getOrAdd(childPid, childProcess, ProcessFactory, &getOrAddResult);
+    if (getOrAddResult != Trie::TrieResult::kTrieResultInserted)
+    {
+        RemoveFromTrackedPidFilter(childPid);
+    }
     SandboxedProcess *existingProcess = OSDynamicCast(SandboxedProcess, newValue);
 
     // Operation getOrAdd failed:
@@ -566,6 +850,13 @@ bool BuildXLSandbox::TrackChildProcess(pid_t childPid, SandboxedProcess *parentP
         // copy the path from the parent process (because the child process always starts out as a fork of the parent)
         childProcess->setPath(parentProcess->getPath());
         pip->incrementProcessTreeCount();
+
+        ClientInfo *client = GetClientInfo(pip->getClientPid());
+        if (client != nullptr)
+        {
+            client->trackProcess(childPid, childProcess);
+        }
+
         LogVerbose("Track entry %d -> %d :: ClientId: %d, PipId: %#llX, New tree size: %d",
                    childPid, pip->getProcessId(), pip->getClientPid(),
                    pip->getPipId(), pip->getTreeSize());
@@ -587,7 +878,14 @@ bool BuildXLSandbox::UntrackProcess(pid_t pid, SandboxedProcess *process)
     bool removedExisting = removeResult == Trie::TrieResult::kTrieResultRemoved;
     if (removedExisting)
     {
+        RemoveFromTrackedPidFilter(pid);
         process->getPip()->decrementProcessTreeCount();
+
+        ClientInfo *client = GetClientInfo(process->getPip()->getClientPid());
+        if (client != nullptr)
+        {
+            client->untrackProcess(pid, process);
+        }
     }
     SandboxedPip *pip = process->getPip();
     log_error_or_debug(g_bxl_verbose_logging,
@@ -612,14 +910,14 @@ static int BytesInAMegabyte = 1024 * 1024;
 
 #define COUNT_AND_SIZE(cls) { .count = cls::metaClass->getInstanceCount(), .size = (double)sizeof(cls) }
 
-IntrospectResponse BuildXLSandbox::Introspect() const
+IntrospectResponse BuildXLSandbox::Introspect(bool includePips) const
 {
     EnterMonitor
 
     IntrospectResponse result
     {
         .numAttachedClients  = connectedClients_->getCount(),
-        .counters            = counters_,
+        .counters            = *counters_,
         .memory              =
         {
             .totalAllocatedBytes = Alloc::numCurrentlyAllocatedBytes(),
@@ -632,10 +930,17 @@ IntrospectResponse BuildXLSandbox::Introspect() const
         .pips                = {0}
     };
 
+    Zone::getAllCounters(result.memory.zones);
+
     ReportCounters *reportCounters = &result.counters.reportCounters;
     reportCounters->freeListSizeMB =
         (sizeof(ConcurrentSharedDataQueue::ElemPayload)) * reportCounters->freeListNodeCount.count() * 1.0 / BytesInAMegabyte;
 
+    if (!includePips)
+    {
+        return result;
+    }
+
     Trie *proc2children = Trie::createUintTrie();
     AutoRelease _(proc2children);
 
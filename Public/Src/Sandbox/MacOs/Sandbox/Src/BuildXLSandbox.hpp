@@ -4,13 +4,13 @@
 #ifndef BuildXLSandbox_hpp
 #define BuildXLSandbox_hpp
 
+#include <IOKit/IOBufferMemoryDescriptor.h>
 #include <IOKit/IOService.h>
 #include <sys/kauth.h>
 
 #include "AutoRelease.hpp"
 #include "Listeners.hpp"
 #include "BuildXLSandboxShared.hpp"
-#include "ConcurrentDictionary.hpp"
 #include "ClientInfo.hpp"
 #include "ResourceManager.hpp"
 #include "SandboxedProcess.hpp"
@@ -22,6 +22,15 @@
 #endif
 
 #define kSharedDataQueueSizeMax 2048
+#define kSharedDataQueueSizeMin 16
+
+// Must be a power of 2
+#define kTrackedPidFilterSize 4096
+
+// When the queue of a client got at least (less than) this full, the queues of the next clients are twice (half) as big
+#define kReportQueueGrowThresholdPercent   75
+#define kReportQueueShrinkThresholdPercent 25
+#define kReportCoalescingWindowMaxMs 100
 
 #define AddTimeStampToAccessReport(report, struct_property)\
 do { (report)->stats.struct_property = mach_absolute_time(); }while(0);
@@ -39,7 +48,13 @@ private:
     struct mac_policy_ops buildxlPolicyOps_;
     struct mac_policy_conf policyConfiguration_;
 
-    AllCounters counters_;
+    /*!
+     * Sandbox-wide counters. They live at the start of a page-aligned buffer of their own ('countersMemory_'),
+     * which clients map read-only (see 'GetCountersMemoryDescriptor'), so reading them is a memory load
+     * rather than a call into this kernel extension.
+     */
+    IOBufferMemoryDescriptor *countersMemory_;
+    AllCounters *counters_;
 
     /*!
      * A dictionary (PID -> ClientInfo*) keeping track of connected clients.
@@ -54,6 +69,20 @@ private:
      */
     KextConfig config_;
 
+    /*!
+     * Whether the client left the size of report queues to this extension ('reportQueueSizeMB' configured to 0),
+     * in which case queues are 'adaptiveReportQueueSizeMB_' big.
+     */
+    bool autoSizeReportQueue_;
+
+    /*!
+     * Size of the next report queues when they are sized automatically, adapted every time a client disconnects
+     * according to how far behind it fell (see 'AdaptReportQueueSize').
+     */
+    uint adaptiveReportQueueSizeMB_;
+
+    void AdaptReportQueueSize(pid_t clientPid, const QueueStats &stats);
+
     /*!
      * Used for managing fork throttling.
      *
@@ -82,6 +111,27 @@ private:
      */
     Trie *trackedProcesses_;
 
+    /*!
+     * Number of pids in 'trackedProcesses_' per bucket ('pid' modulo kTrackedPidFilterSize).
+     *
+     * The count of a bucket is incremented before a pid is added to 'trackedProcesses_' and decremented after it
+     * was removed, so it never under-counts: a bucket with no count proves that a pid is not tracked, which lets the
+     * callbacks of untracked processes (the vast majority) return without walking 'trackedProcesses_'.
+     */
+    volatile SInt16 trackedPidFilter_[kTrackedPidFilterSize];
+
+    /*!
+     * Keeps the hash --> Buffer* mapping of the manifest trees of the tracked pips (see 'ShareManifestTree').
+     *
+     * Consecutive pips of a build mostly come with the same manifest tree, so each distinct tree is kept only once.
+     * A tree is dropped once the pips using it are gone.  Guarded by 'lock_'.
+     */
+    Trie *manifestTrees_;
+
+    inline volatile SInt16* TrackedPidFilterBucket(pid_t pid) { return &trackedPidFilter_[(uint32_t)pid & (kTrackedPidFilterSize - 1)]; }
+    inline void AddToTrackedPidFilter(pid_t pid)              { OSIncrementAtomic16(TrackedPidFilterBucket(pid)); }
+    inline void RemoveFromTrackedPidFilter(pid_t pid)         { OSDecrementAtomic16(TrackedPidFilterBucket(pid)); }
+
     ClientInfo* GetClientInfo(pid_t clientPid);
 
     void InitializePolicyStructures();
@@ -110,14 +160,24 @@ public:
     IOReturn InitializeListeners();
     void UninitializeListeners();
 
-    AllCounters* Counters()           { return &counters_; }
+    AllCounters* Counters()           { return counters_; }
     ResourceManager* ResourceManger() { return resourceManager_; }
 
     inline void ResetCounters()
     {
-        counters_ = {0};
+        if (counters_ != nullptr)
+        {
+            *counters_ = {0};
+        }
     }
 
+    /*!
+     * Returns the memory descriptor of the page holding the sandbox-wide counters.
+     *
+     * NOTE: the descriptor is retained, the caller is responsible for releasing it.
+     */
+    IOMemoryDescriptor* const GetCountersMemoryDescriptor();
+
     /*!
      * Sets the notification port for the shared data queue for the client process 'pid'.
      */
@@ -130,11 +190,30 @@ public:
      */
     IOMemoryDescriptor* const GetReportQueueMemoryDescriptor(pid_t pid);
 
+    /*!
+     * Returns a newly allocated memory descriptor of the queue of process lifecycle reports for the client process 'pid'.
+     *
+     * NOTE: the caller is responsible for releasing the returned object.
+     */
+    IOMemoryDescriptor* const GetPriorityReportQueueMemoryDescriptor(pid_t pid);
+
     /*!
      * Send the access report to only one queue using the round robin strategy
      */
     bool const SendAccessReport(AccessReport &report, SandboxedPip *pip, const CacheRecord *cacheRecord);
 
+    /*!
+     * Sends the reports coalesced by 'pip' to its client, as a single entry of the client's report queue
+     * (a 'CoalescedReportsSender', 'sandbox' being this object).
+     */
+    static bool SendCoalescedReports(void *sandbox, SandboxedPip *pip, const char *reports, uint32_t size, uint reportCount);
+
+    /*!
+     * Returns the buffer of 'manifestTrees_' holding the same bytes as 'tree', adding one if none does
+     * (a 'ManifestTreeSharer', 'sandbox' being this object).
+     */
+    static Buffer* ShareManifestTree(void *sandbox, const BYTE *tree, size_t size);
+
 #pragma mark Client Failure Notification Mapping
 
     /*!
@@ -184,8 +263,11 @@ public:
 
     /*!
      * Introspect the current state of the sandbox.
+     *
+     * Collecting pips walks all the tracked processes; when 'includePips' is false,
+     * only the sandbox-wide counters are returned (and 'numReportedPips' is 0).
      */
-    IntrospectResponse Introspect() const;
+    IntrospectResponse Introspect(bool includePips = true) const;
 };
 
 #endif /* BuildXLSandbox_hpp */
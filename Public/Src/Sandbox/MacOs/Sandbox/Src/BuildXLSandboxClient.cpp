@@ -131,6 +131,28 @@ IOReturn BuildXLSandboxClient::clientMemoryForType(UInt32 type, IOOptionBits *op
             LogVerbose("Descriptor set for pid (%d)", pid);
             return kIOReturnSuccess;
         }
+        case PriorityFileAccessReporting:
+        {
+            // Notifications of this queue go to the port registered for 'FileAccessReporting'
+            pid_t pid = proc_selfpid();
+            *options = 0;
+            *memory = sandbox_->GetPriorityReportQueueMemoryDescriptor(pid);
+            if (*memory == nullptr)
+            {
+                log_error("%s", "Priority descriptor creation failed!");
+                return kIOReturnVMError;
+            }
+
+            LogVerbose("Priority descriptor set for pid (%d)", pid);
+            return kIOReturnSuccess;
+        }
+        case SharedCounters:
+        {
+            // Clients only ever read the counters
+            *options = kIOMapReadOnly;
+            *memory = sandbox_->GetCountersMemoryDescriptor();
+            return *memory != nullptr ? kIOReturnSuccess : kIOReturnVMError;
+        }
         default:
             return kIOReturnBadArgument;
     }
@@ -188,6 +210,14 @@ IOExternalMethodDispatch BuildXLSandboxClient::ipcMethods[kSandboxMethodCount] =
         .checkScalarOutputCount   = 0,
         .checkStructureOutputSize = sizeof(IntrospectResponse)
     },
+    // kIpcActionPipStateChangedBatch
+    {
+        .function                 = (IOExternalMethodAction) &BuildXLSandboxClient::sPipStatesChanged,
+        .checkScalarInputCount    = 0,
+        .checkStructureInputSize  = kIOUCVariableStructureSize,
+        .checkScalarOutputCount   = 1,
+        .checkStructureOutputSize = 0
+    },
 };
 
 IOReturn BuildXLSandboxClient::externalMethod(uint32_t selector, IOExternalMethodArguments *arguments,
@@ -249,7 +279,8 @@ IOReturn BuildXLSandboxClient::sIntrospectHandler(BuildXLSandboxClient *target,
         return kIOReturnNoMemory;
     }
 
-    IntrospectResponse result = target->sandbox_->Introspect();
+    const IntrospectRequest *request = (const IntrospectRequest *)args->structureInput;
+    IntrospectResponse result = target->sandbox_->Introspect(request == nullptr || request->includePips != 0);
     IOByteCount bytesWritten = outMemDesc->writeBytes(0, &result, sizeof(result));
 
     outMemDesc->complete();
@@ -262,6 +293,38 @@ IOReturn BuildXLSandboxClient::sPipStateChanged(BuildXLSandboxClient *target, vo
     return target->PipStateChanged((PipStateChangedRequest *)arguments->structureInput);
 }
 
+// Processes several pip state changes in order, stopping at the first one that fails. The only scalar output is the
+// number of requests processed successfully, so the client knows which one failed.
+IOReturn BuildXLSandboxClient::sPipStatesChanged(BuildXLSandboxClient *target, void *reference, IOExternalMethodArguments *arguments)
+{
+    uint32_t size = arguments->structureInputSize;
+    uint32_t count = size / sizeof(PipStateChangedRequest);
+    arguments->scalarOutput[0] = 0;
+
+    if (arguments->structureInput == nullptr || count == 0 || count > kMaxPipStateChangesPerBatch || size % sizeof(PipStateChangedRequest) != 0)
+    {
+        return kIOReturnBadArgument;
+    }
+
+    const char *requests = (const char *)arguments->structureInput;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        // The structure input is not guaranteed to be aligned for PipStateChangedRequest
+        PipStateChangedRequest request;
+        memcpy(&request, requests + i * sizeof(PipStateChangedRequest), sizeof(request));
+
+        IOReturn result = target->PipStateChanged(&request);
+        if (result != kIOReturnSuccess)
+        {
+            return result;
+        }
+
+        arguments->scalarOutput[0] = i + 1;
+    }
+
+    return kIOReturnSuccess;
+}
+
 IOReturn BuildXLSandboxClient::PipStateChanged(PipStateChangedRequest *data)
 {
     if (data == nullptr)
@@ -56,6 +56,7 @@ protected:
     // MacSanboxClient IPC function pairs for ipcMethods dispatch table
 
     static IOReturn sPipStateChanged              (BuildXLSandboxClient *target, void *ref, IOExternalMethodArguments *args);
+    static IOReturn sPipStatesChanged             (BuildXLSandboxClient *target, void *ref, IOExternalMethodArguments *args);
     static IOReturn sDebugCheck                   (BuildXLSandboxClient *target, void *ref, IOExternalMethodArguments *args);
     static IOReturn sConfigure                    (BuildXLSandboxClient *target, void *ref, IOExternalMethodArguments *args);
     static IOReturn sUpdateResourceUsage          (BuildXLSandboxClient *target, void *ref, IOExternalMethodArguments *args);
@@ -53,6 +53,7 @@ typedef enum {
     kIpcActionUpdateResourceUsage,
     kIpcActionSetupFailureNotificationHandler,
     kIpcActionIntrospect,
+    kIpcActionPipStateChangedBatch,
     kSandboxMethodCount
 } IpcAction;
 
@@ -104,6 +105,15 @@ public:
        if (g_bxl_enable_counters) OSDecrementAtomic(&count_);
 #else
         --count_;
+#endif
+    }
+
+    void operator+= (uint32_t amount)
+    {
+#if MAC_OS_SANDBOX
+       if (g_bxl_enable_counters) OSAddAtomic(amount, &count_);
+#else
+        count_ += amount;
 #endif
     }
 } Counter;
@@ -146,11 +156,16 @@ typedef struct {
     SandboxAction action;
 } PipStateChangedRequest;
 
+// The most requests a kIpcActionPipStateChangedBatch call takes. Keeps the structure input small enough for
+// IOKit to pass it inline (the FAM of a started pip is not part of it: it is read from the memory of the client).
+#define kMaxPipStateChangesPerBatch 64
+
 typedef struct {
     basis_points cpuUsage;
     uint availableRamMB;
     uint numTrackedProcesses;
     uint numBlockedProcesses;
+    DurationCounter forkWaitTime;
 } ResourceCounters;
 
 typedef struct {
@@ -159,6 +174,12 @@ typedef struct {
     Counter freeListNodeCount;
     double freeListSizeMB;
     Counter numCoalescedReports;
+    Counter numReportQueueStalls;
+    DurationCounter reportQueueStallTime;
+    Counter numMultiReportEntries;
+
+    // The fullest any report queue got since the counters were last reset (the queues may be read concurrently, so this is approximate)
+    uint reportQueueHighWaterMarkKB;
 } ReportCounters;
 
 typedef struct {
@@ -166,11 +187,51 @@ typedef struct {
     double size;
 } CountAndSize;
 
+// The fixed-size zones the objects the kext allocates the most are allocated from (see Zone)
+typedef enum {
+    kZoneNodeFast,
+    kZoneNodeLight,
+    kZoneCacheRecord,
+    kZoneSandboxedProcess,
+    kZoneReportPayload,
+    kZoneReportQueueElem,
+    kZoneCount
+} ZoneId;
+
+inline const char* ZoneName(ZoneId id)
+{
+    switch (id)
+    {
+        case kZoneNodeFast:         return "NodeFast";
+        case kZoneNodeLight:        return "NodeLight";
+        case kZoneCacheRecord:      return "CacheRecord";
+        case kZoneSandboxedProcess: return "SandboxedProcess";
+        case kZoneReportPayload:    return "ReportPayload";
+        case kZoneReportQueueElem:  return "ReportQueueElem";
+        default:                    return "?";
+    }
+}
+
+typedef struct {
+    uint elemSize;
+    uint numSlabs;
+
+    // Elements carved out of the slabs, whether they are in use or free
+    uint numElems;
+    uint numInUse;
+    Counter numAllocations;
+
+    // Allocations served by the element the current CPU freed last, without going to the free list of the zone
+    Counter numCpuCacheHits;
+    Counter numSlabAllocationFailures;
+} ZoneCounters;
+
 typedef struct mcas_ {
     int64_t totalAllocatedBytes;
     CountAndSize fastNodes;
     CountAndSize lightNodes;
     CountAndSize cacheRecords;
+    ZoneCounters zones[kZoneCount];
 } MemoryCountsAndSizes;
 
 typedef struct ac_ {
@@ -184,11 +245,53 @@ typedef struct ac_ {
     ResourceCounters resourceCounters;
     ReportCounters reportCounters;
     Counter numHardLinkRetries;
+    Counter numHardLinkLookupsSkipped;
+    Counter numRepeatedChecksSkipped;
     Counter numForks;
+    Counter numForksFromPool;
     Counter numCacheHits;
     Counter numCacheMisses;
 } AllCounters;
 
+#pragma mark Callback latencies
+
+// The kernel callbacks (and queue operations) whose latencies are recorded (see CallbackLatencyScope)
+typedef enum {
+    kLatencyFileOpListener,
+    kLatencyVNodeListener,
+    kLatencyVNodeCheckLookupPre,
+    kLatencyVNodeCheckReadlink,
+    kLatencyVNodeCheckExec,
+    kLatencyProcNotifyExit,
+    kLatencyCredLabelUpdateExecve,
+    kLatencyProcCheckFork,
+    kLatencyCredLabelAssociateFork,
+    kLatencyVNodeCheckCreate,
+    kLatencyVNodeCheckWrite,
+    kLatencyVNodeCheckClone,
+    kLatencyReportEnqueue,
+    kLatencyCallbackCount
+} LatencyCallback;
+
+// Bucket i counts the calls that took [2^i, 2^(i+1)) nanoseconds. The first bucket also counts the calls that took
+// less than a nanosecond, the last one the calls that took longer than it covers.
+#define kLatencyBucketCount 32
+
+typedef struct {
+    uint32_t buckets[kLatencyBucketCount];
+} LatencyHistogram;
+
+// Exposed by the kext through the 'kern.bxl_callback_latencies' sysctl
+typedef struct {
+    LatencyHistogram callbacks[kLatencyCallbackCount];
+} CallbackLatencies;
+
+inline int LatencyBucket(uint64_t nanos)
+{
+    int bucket = nanos == 0 ? 0 : 63 - __builtin_clzll(nanos);
+    return bucket < kLatencyBucketCount ? bucket : kLatencyBucketCount - 1;
+}
+
 typedef struct rt_ {
     percent cpuUsageBlock;
     percent cpuUsageWakeup;
@@ -205,13 +308,17 @@ typedef struct {
     bool enableReportBatching;
     ResourceThresholds resourceThresholds;
     bool enableCatalinaDataPartitionFiltering;
+
+    // When not 0, the reports of a pip are held for up to this many milliseconds and sent together (see SandboxedPip::coalesceReport)
+    uint reportCoalescingWindowMs;
 } KextConfig;
 
 #define kMaxReportedPips 30
 #define kMaxReportedChildProcesses 20
 
 typedef struct {
-    int8_t placeholder;
+    // When 0, only the sandbox-wide counters are returned: the tracked processes are not walked to collect pips
+    int8_t includePips;
 } IntrospectRequest;
 
 typedef struct {
@@ -241,6 +348,12 @@ typedef struct {
 
 typedef enum {
     FileAccessReporting,
+
+    // The queue of process lifecycle reports of a client (see PriorityReportHeader), which shares the notification port of 'FileAccessReporting'
+    PriorityFileAccessReporting,
+
+    // Not a queue: the page holding the sandbox-wide 'AllCounters', which clients can map read-only
+    SharedCounters,
 } ReportQueueType;
 
 typedef struct {
@@ -286,6 +399,98 @@ typedef struct {
     bool shouldReport;
 } AccessReport;
 
+#pragma mark Compact access reports
+
+// Access reports go through the shared report queue compacted: the fields preceding the path and the ones following it
+// come first, then only the bytes of the path up to its terminating null character, instead of the whole MAXPATHLEN buffer.
+// The path of a kOpProcessTreeCompleted report holds the pip completion stats, so it is always sent whole.
+#define kAccessReportPathOffset        offsetof(AccessReport, path)
+#define kAccessReportSuffixOffset      offsetof(AccessReport, stats)
+#define kAccessReportSuffixSize        (sizeof(AccessReport) - kAccessReportSuffixOffset)
+#define kCompactAccessReportHeaderSize (kAccessReportPathOffset + kAccessReportSuffixSize)
+#define kCompactAccessReportMaxSize    (kCompactAccessReportHeaderSize + MAXPATHLEN)
+
+// Writes the compact form of a report to 'buffer', which must hold kCompactAccessReportMaxSize bytes. Returns the size of the compact report.
+inline uint32_t CompactAccessReport(const AccessReport &report, char *buffer)
+{
+    size_t pathSize = report.operation == kOpProcessTreeCompleted
+        ? MAXPATHLEN
+        : strnlen(report.path, MAXPATHLEN - 1) + 1;
+
+    const char *bytes = (const char *)&report;
+    memcpy(buffer, bytes, kAccessReportPathOffset);
+    memcpy(buffer + kAccessReportPathOffset, bytes + kAccessReportSuffixOffset, kAccessReportSuffixSize);
+    memcpy(buffer + kCompactAccessReportHeaderSize, report.path, pathSize);
+
+    if (report.operation != kOpProcessTreeCompleted)
+    {
+        // A path filling the whole buffer is truncated by one character rather than sent without its terminating null character
+        buffer[kCompactAccessReportHeaderSize + pathSize - 1] = '\0';
+    }
+
+    return (uint32_t)(kCompactAccessReportHeaderSize + pathSize);
+}
+
+// Reports coalesced by the kext go through the shared report queue as a single entry: their compact forms one after the other.
+// An entry never exceeds this size.
+#define kMaxReportQueueEntrySize (16 * 1024)
+
+// Returns the size of the compact report at the start of 'buffer', which holds 'size' bytes, or 0 if 'buffer' doesn't start with a whole compact report.
+inline uint32_t CompactAccessReportSize(const char *buffer, uint32_t size)
+{
+    if (size <= kCompactAccessReportHeaderSize)
+    {
+        return 0;
+    }
+
+    FileOperation operation;
+    memcpy(&operation, buffer + offsetof(AccessReport, operation), sizeof(operation));
+
+    size_t pathSize = operation == kOpProcessTreeCompleted
+        ? MAXPATHLEN
+        : strnlen(buffer + kCompactAccessReportHeaderSize, size - kCompactAccessReportHeaderSize) + 1;
+
+    size_t reportSize = kCompactAccessReportHeaderSize + pathSize;
+    return reportSize <= size ? (uint32_t)reportSize : 0;
+}
+
+// Reads a report from its compact form. Returns false if 'size' is not the size of a compact report.
+inline bool ExpandAccessReport(const char *buffer, uint32_t size, AccessReport *report)
+{
+    if (size <= kCompactAccessReportHeaderSize || size > kCompactAccessReportMaxSize)
+    {
+        return false;
+    }
+
+    char *bytes = (char *)report;
+    memcpy(bytes, buffer, kAccessReportPathOffset);
+    memcpy(bytes + kAccessReportSuffixOffset, buffer + kAccessReportPathOffset, kAccessReportSuffixSize);
+    memcpy(report->path, buffer + kCompactAccessReportHeaderSize, size - kCompactAccessReportHeaderSize);
+    return true;
+}
+
+#pragma mark Priority reports
+
+// Process lifecycle reports don't wait behind the file accesses in the report queue of their client: they go through
+// a small queue of their own (PriorityFileAccessReporting), which the client drains first, so how soon a pip is seen
+// to complete doesn't depend on how many accesses other pips reported in the meantime.
+// An entry of that queue is this header followed by the compact report. The client holds the report back until it
+// dequeued the reports that must go before it: all the reports its pip sent through the report queue before it,
+// or, failing that, all the entries of the report queue sent before it (e.g., when the kext dropped some reports of
+// the pip as duplicates after counting them).
+typedef struct {
+    uint64_t precedingPipReports;   // reports of the same pip sent through the report queue before this one
+    uint64_t precedingEntries;      // entries of the report queue sent before this one
+} PriorityReportHeader;
+
+#define kMaxPriorityReportQueueEntrySize (sizeof(PriorityReportHeader) + kCompactAccessReportMaxSize)
+
+// Whether a report goes through the priority queue
+inline bool IsPriorityReport(FileOperation operation)
+{
+    return operation == kOpProcessStart || operation == kOpProcessExit || operation == kOpProcessTreeCompleted;
+}
+
 // Some IOEvents may result in a pair of reports (the typical case is an operation that involves a source and a 
 // destination). To avoid allocations related to arrays/vectors, an AccessReportGroup is used, representing
 // one or two access reports that need to be reported to managed BuildXL. Therefore, an access report group 
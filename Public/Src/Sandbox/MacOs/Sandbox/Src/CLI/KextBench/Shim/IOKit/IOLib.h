@@ -0,0 +1,344 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef Shim_IOLib_h
+#define Shim_IOLib_h
+
+/*!
+ * User-space stand-ins for the parts of IOKit and libkern that the data structures of the kernel extension use
+ * (OSObject, atomics, IONew/IODelete, IOKit locks, kernel threads, CPU numbers), so that KextBench can build those data
+ * structures from the very same sources and measure them outside of a loaded kext.
+ *
+ * The 'Shim' directory goes first in the header search paths of KextBench: the kext sources include these headers
+ * instead of the ones of Kernel.framework, and fall back to the SDK for the user-space IOKit headers that exist there
+ * (e.g., IODataQueueShared.h, OSMessageNotification.h).  Only what those data structures need is provided.
+ *
+ * Locks and compare-and-swap operations record how often they were contended (see 'g_shim_counters').
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <mach/mach_types.h>
+#include <mach/mach_time.h>
+#include <IOKit/IOTypes.h>
+#include <IOKit/IOReturn.h>
+#include <libkern/OSTypes.h>
+
+// liblfds includes this header from C sources, for the assert it gets from <assert.h>
+#ifdef __cplusplus
+
+#pragma mark Contention counters
+
+typedef struct {
+    /*! Lock acquisitions that found the lock taken (and had to wait for it) */
+    volatile uint64_t numContendedLocks;
+
+    /*! Compare-and-swap operations that failed because the value had changed */
+    volatile uint64_t numFailedCompareAndSwaps;
+} ShimCounters;
+
+extern ShimCounters g_shim_counters;
+
+#pragma mark Atomics (libkern/OSAtomic.h)
+
+template <class T>
+static inline SInt32 OSAddAtomic(SInt32 amount, volatile T *address)
+{
+    static_assert(sizeof(T) == sizeof(SInt32), "OSAddAtomic works on 32-bit values");
+    return __atomic_fetch_add((volatile SInt32 *)address, amount, __ATOMIC_SEQ_CST);
+}
+
+template <class T>
+static inline SInt64 OSAddAtomic64(SInt64 amount, volatile T *address)
+{
+    static_assert(sizeof(T) == sizeof(SInt64), "OSAddAtomic64 works on 64-bit values");
+    return __atomic_fetch_add((volatile SInt64 *)address, amount, __ATOMIC_SEQ_CST);
+}
+
+template <class T>
+static inline SInt32 OSIncrementAtomic(volatile T *address) { return OSAddAtomic(1, address); }
+
+template <class T>
+static inline SInt32 OSDecrementAtomic(volatile T *address) { return OSAddAtomic(-1, address); }
+
+template <class T>
+static inline Boolean OSCompareAndSwap(UInt32 oldValue, UInt32 newValue, volatile T *address)
+{
+    static_assert(sizeof(T) == sizeof(UInt32), "OSCompareAndSwap works on 32-bit values");
+    if (__atomic_compare_exchange_n((volatile UInt32 *)address, &oldValue, newValue, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+    {
+        return true;
+    }
+
+    __atomic_fetch_add(&g_shim_counters.numFailedCompareAndSwaps, 1, __ATOMIC_RELAXED);
+    return false;
+}
+
+template <class T>
+static inline Boolean OSCompareAndSwapPtr(const void *oldValue, const void *newValue, T *address)
+{
+    static_assert(sizeof(T) == sizeof(void *), "OSCompareAndSwapPtr works on pointers");
+    void *expected = (void *)oldValue;
+    if (__atomic_compare_exchange_n((void * volatile *)address, &expected, (void *)newValue, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+    {
+        return true;
+    }
+
+    __atomic_fetch_add(&g_shim_counters.numFailedCompareAndSwaps, 1, __ATOMIC_RELAXED);
+    return false;
+}
+
+#pragma mark OSObject (libkern/c++/OSObject.h)
+
+/*!
+ * Reference counted like its libkern counterpart: created with a count of 1, freed by the last 'release'.
+ */
+class OSObject
+{
+private:
+
+    mutable volatile SInt32 retainCount_;
+
+protected:
+
+    virtual ~OSObject() {}
+
+    virtual void free() { delete this; }
+
+public:
+
+    OSObject() : retainCount_(1) {}
+
+    virtual bool init() { return true; }
+
+    int getRetainCount() const { return retainCount_; }
+
+    void retain() const { __atomic_fetch_add(&retainCount_, 1, __ATOMIC_RELAXED); }
+
+    void release() const
+    {
+        if (__atomic_fetch_sub(&retainCount_, 1, __ATOMIC_ACQ_REL) == 1)
+        {
+            const_cast<OSObject *>(this)->free();
+        }
+    }
+};
+
+// Run-time type information stands in for the meta classes of libkern: the sources still declare and define them
+#define OSDeclareCommonStructors(className) \
+    private:                                \
+    typedef className self_type
+
+#define OSDeclareDefaultStructors(className) \
+    OSDeclareCommonStructors(className);     \
+    public:                                  \
+    className() {}                           \
+    protected:                               \
+    virtual ~className() {}
+
+#define OSDeclareAbstractStructors(className) \
+    OSDeclareCommonStructors(className);      \
+    protected:                                \
+    className() {}                            \
+    virtual ~className() {}
+
+#define OSDefineMetaClassAndStructors(className, superclassName)
+#define OSDefineMetaClassAndAbstractStructors(className, superclassName)
+
+#define OSDynamicCast(type, inst) dynamic_cast<type *>(inst)
+
+#define OSSafeReleaseNULL(inst) do { if ((inst) != nullptr) (inst)->release(); (inst) = nullptr; } while (0)
+
+#pragma mark Memory (IOKit/IOLib.h)
+
+// Like the zones kalloc serves these sizes from, large blocks are aligned enough for the cache line isolation of liblfds
+static inline void *IOMalloc(size_t size)
+{
+    void *result = nullptr;
+    return posix_memalign(&result, size >= 128 ? 128 : 16, size) == 0 ? result : nullptr;
+}
+
+static inline void IOFree(void *address, size_t size) { ::free(address); }
+
+static inline void *IOMallocAligned(size_t size, size_t alignment)
+{
+    void *result = nullptr;
+    return posix_memalign(&result, alignment > sizeof(void *) ? alignment : sizeof(void *), size) == 0 ? result : nullptr;
+}
+
+static inline void IOFreeAligned(void *address, size_t size) { ::free(address); }
+
+#define IONew(type, count)              ((type *)IOMalloc(sizeof(type) * (count)))
+#define IODelete(ptr, type, count)      IOFree((ptr), sizeof(type) * (count))
+
+static inline void IOSleep(unsigned milliseconds) { usleep(milliseconds * 1000); }
+
+// The kext runs on x86_64 Macs, where absolute time is in nanoseconds (Stopwatch relies on it)
+static inline uint64_t ShimAbsoluteTimeNs()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+#define mach_absolute_time ShimAbsoluteTimeNs
+
+#pragma mark Locks (IOKit/IOLocks.h)
+
+#ifndef THREAD_INTERRUPTIBLE
+#define THREAD_UNINT            0
+#define THREAD_INTERRUPTIBLE    1
+#define THREAD_ABORTSAFE        2
+#endif
+
+#ifndef THREAD_AWAKENED
+#define THREAD_AWAKENED         0
+#endif
+
+typedef int wait_result_t;
+
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t wakeup;
+} IOLock;
+
+typedef struct {
+    pthread_mutex_t mutex;
+} IORecursiveLock;
+
+typedef struct {
+    pthread_rwlock_t rwlock;
+} IORWLock;
+
+static inline void ShimLockMutex(pthread_mutex_t *mutex)
+{
+    if (pthread_mutex_trylock(mutex) != 0)
+    {
+        __atomic_fetch_add(&g_shim_counters.numContendedLocks, 1, __ATOMIC_RELAXED);
+        pthread_mutex_lock(mutex);
+    }
+}
+
+static inline IOLock *IOLockAlloc()
+{
+    IOLock *lock = IONew(IOLock, 1);
+    if (lock != nullptr)
+    {
+        pthread_mutex_init(&lock->mutex, nullptr);
+        pthread_cond_init(&lock->wakeup, nullptr);
+    }
+
+    return lock;
+}
+
+static inline void IOLockFree(IOLock *lock)
+{
+    pthread_cond_destroy(&lock->wakeup);
+    pthread_mutex_destroy(&lock->mutex);
+    IODelete(lock, IOLock, 1);
+}
+
+static inline void IOLockLock(IOLock *lock)   { ShimLockMutex(&lock->mutex); }
+static inline void IOLockUnlock(IOLock *lock) { pthread_mutex_unlock(&lock->mutex); }
+
+// Every event of a lock shares its condition variable: sleepers re-check what they wait for, as they do in the kernel
+static inline int IOLockSleep(IOLock *lock, void *event, UInt32 interType)
+{
+    pthread_cond_wait(&lock->wakeup, &lock->mutex);
+    return THREAD_AWAKENED;
+}
+
+static inline void IOLockWakeup(IOLock *lock, void *event, bool oneThread)
+{
+    pthread_cond_broadcast(&lock->wakeup);
+}
+
+static inline IORecursiveLock *IORecursiveLockAlloc()
+{
+    IORecursiveLock *lock = IONew(IORecursiveLock, 1);
+    if (lock != nullptr)
+    {
+        pthread_mutexattr_t attributes;
+        pthread_mutexattr_init(&attributes);
+        pthread_mutexattr_settype(&attributes, PTHREAD_MUTEX_RECURSIVE);
+        pthread_mutex_init(&lock->mutex, &attributes);
+        pthread_mutexattr_destroy(&attributes);
+    }
+
+    return lock;
+}
+
+static inline void IORecursiveLockFree(IORecursiveLock *lock)
+{
+    pthread_mutex_destroy(&lock->mutex);
+    IODelete(lock, IORecursiveLock, 1);
+}
+
+static inline void IORecursiveLockLock(IORecursiveLock *lock)   { ShimLockMutex(&lock->mutex); }
+static inline void IORecursiveLockUnlock(IORecursiveLock *lock) { pthread_mutex_unlock(&lock->mutex); }
+
+static inline IORWLock *IORWLockAlloc()
+{
+    IORWLock *lock = IONew(IORWLock, 1);
+    if (lock != nullptr)
+    {
+        pthread_rwlock_init(&lock->rwlock, nullptr);
+    }
+
+    return lock;
+}
+
+static inline void IORWLockFree(IORWLock *lock)
+{
+    pthread_rwlock_destroy(&lock->rwlock);
+    IODelete(lock, IORWLock, 1);
+}
+
+static inline void IORWLockRead(IORWLock *lock)
+{
+    if (pthread_rwlock_tryrdlock(&lock->rwlock) != 0)
+    {
+        __atomic_fetch_add(&g_shim_counters.numContendedLocks, 1, __ATOMIC_RELAXED);
+        pthread_rwlock_rdlock(&lock->rwlock);
+    }
+}
+
+static inline void IORWLockWrite(IORWLock *lock)
+{
+    if (pthread_rwlock_trywrlock(&lock->rwlock) != 0)
+    {
+        __atomic_fetch_add(&g_shim_counters.numContendedLocks, 1, __ATOMIC_RELAXED);
+        pthread_rwlock_wrlock(&lock->rwlock);
+    }
+}
+
+static inline void IORWLockUnlock(IORWLock *lock) { pthread_rwlock_unlock(&lock->rwlock); }
+
+#pragma mark Threads (kern/thread.h)
+
+typedef void (*thread_continue_t)(void *parameter, wait_result_t result);
+
+/*! Starts a detached thread running 'continuation'. '*newThread' is only there to be deallocated. */
+kern_return_t kernel_thread_start(thread_continue_t continuation, void *parameter, thread_t *newThread);
+
+static inline void thread_deallocate(thread_t thread) {}
+
+/*! Stands for the calling thread, whose id 'thread_tid' returns (the only way the kext sources use it) */
+static inline thread_t current_thread() { return (thread_t)0; }
+
+uint64_t thread_tid(thread_t thread);
+
+#pragma mark CPUs (kern/cpu_number.h)
+
+/*! Threads stand in for CPUs: every thread gets a number of its own, as if it never moved to another CPU */
+int cpu_number();
+
+#endif /* __cplusplus */
+
+#endif /* Shim_IOLib_h */
@@ -0,0 +1,46 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef Shim_IOMemoryDescriptor_h
+#define Shim_IOMemoryDescriptor_h
+
+#include <IOKit/IOLib.h>
+
+/*!
+ * A mapping of memory that is already in the address space of the process: its address is the one described.
+ */
+class IOMemoryMap : public OSObject
+{
+private:
+
+    IOVirtualAddress address_;
+    IOByteCount length_;
+
+public:
+
+    IOMemoryMap(IOVirtualAddress address, IOByteCount length) : address_(address), length_(length) {}
+
+    IOVirtualAddress getVirtualAddress() { return address_; }
+    IOByteCount getLength()              { return length_; }
+};
+
+/*!
+ * Describes memory owned by someone else (e.g., an IOSharedDataQueue), which must outlive the descriptor and its maps.
+ */
+class IOMemoryDescriptor : public OSObject
+{
+private:
+
+    void *address_;
+    IOByteCount length_;
+
+public:
+
+    IOMemoryDescriptor(void *address, IOByteCount length) : address_(address), length_(length) {}
+
+    IOByteCount getLength() const { return length_; }
+
+    IOMemoryMap *map(IOOptionBits options = 0) { return new IOMemoryMap((IOVirtualAddress)address_, length_); }
+};
+
+#endif /* Shim_IOMemoryDescriptor_h */
@@ -0,0 +1,10 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef Shim_IOService_h
+#define Shim_IOService_h
+
+// The kext sources only include this header for OSObject (see IOLib.h)
+#include <IOKit/IOLib.h>
+
+#endif /* Shim_IOService_h */
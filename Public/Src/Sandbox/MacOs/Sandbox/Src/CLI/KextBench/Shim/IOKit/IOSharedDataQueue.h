@@ -0,0 +1,46 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef Shim_IOSharedDataQueue_h
+#define Shim_IOSharedDataQueue_h
+
+#include <IOKit/IOLib.h>
+#include <IOKit/IOMemoryDescriptor.h>
+#include <IOKit/IODataQueueShared.h>
+
+/*!
+ * A single-producer queue laid out in memory exactly like its IOKit counterpart, so that the client side of the SDK
+ * (IODataQueueDequeue and friends, see IODataQueueClient.h) can consume it.  Producers must be serialized by the caller.
+ *
+ * No notification is sent when data is enqueued: consumers poll the queue (see IODataQueueDataAvailable).
+ */
+class IOSharedDataQueue : public OSObject
+{
+private:
+
+    IODataQueueMemory *dataQueue_;
+    UInt32 queueSize_;
+    UInt32 allocatedSize_;
+
+    IOSharedDataQueue() : dataQueue_(nullptr), queueSize_(0), allocatedSize_(0) {}
+
+    bool initWithCapacity(UInt32 size);
+
+protected:
+
+    void free() override;
+
+public:
+
+    /*! Enqueues an entry of 'dataSize' bytes. Returns false when the queue does not have room for it. */
+    Boolean enqueue(void *data, UInt32 dataSize);
+
+    /*! A new descriptor of the memory shared with consumers, which the caller releases */
+    IOMemoryDescriptor *getMemoryDescriptor();
+
+    void setNotificationPort(mach_port_t port) {}
+
+    static IOSharedDataQueue *withCapacity(UInt32 size);
+};
+
+#endif /* Shim_IOSharedDataQueue_h */
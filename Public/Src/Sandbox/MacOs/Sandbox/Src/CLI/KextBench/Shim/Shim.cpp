@@ -0,0 +1,168 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <IOKit/IOLib.h>
+#include <IOKit/IOSharedDataQueue.h>
+
+ShimCounters g_shim_counters = {};
+
+#pragma mark Threads
+
+typedef struct {
+    thread_continue_t continuation;
+    void *parameter;
+} ThreadStart;
+
+kern_return_t kernel_thread_start(thread_continue_t continuation, void *parameter, thread_t *newThread)
+{
+    ThreadStart *start = IONew(ThreadStart, 1);
+    if (start == nullptr)
+    {
+        return KERN_RESOURCE_SHORTAGE;
+    }
+
+    *start = { .continuation = continuation, .parameter = parameter };
+
+    pthread_t thread;
+    int error = pthread_create(&thread, nullptr, [](void *arg) -> void*
+                               {
+                                   ThreadStart start = *(ThreadStart *)arg;
+                                   IODelete((ThreadStart *)arg, ThreadStart, 1);
+                                   start.continuation(start.parameter, THREAD_AWAKENED);
+                                   return nullptr;
+                               },
+                               start);
+    if (error != 0)
+    {
+        IODelete(start, ThreadStart, 1);
+        return KERN_FAILURE;
+    }
+
+    pthread_detach(thread);
+    *newThread = (thread_t)0;
+    return KERN_SUCCESS;
+}
+
+uint64_t thread_tid(thread_t thread)
+{
+    uint64_t tid = 0;
+    pthread_threadid_np(nullptr, &tid);
+    return tid;
+}
+
+#pragma mark CPUs
+
+static volatile int s_numThreadsWithCpuNumber = 0;
+
+int cpu_number()
+{
+    static thread_local int number = __atomic_fetch_add(&s_numThreadsWithCpuNumber, 1, __ATOMIC_RELAXED);
+    return number;
+}
+
+#pragma mark IOSharedDataQueue
+
+IOSharedDataQueue* IOSharedDataQueue::withCapacity(UInt32 size)
+{
+    IOSharedDataQueue *instance = new IOSharedDataQueue;
+    if (!instance->initWithCapacity(size))
+    {
+        instance->release();
+        instance = nullptr;
+    }
+
+    return instance;
+}
+
+bool IOSharedDataQueue::initWithCapacity(UInt32 size)
+{
+    if (size == 0 || size > UINT32_MAX - DATA_QUEUE_MEMORY_HEADER_SIZE)
+    {
+        return false;
+    }
+
+    UInt32 pageSize = (UInt32)getpagesize();
+    allocatedSize_ = (size + DATA_QUEUE_MEMORY_HEADER_SIZE + pageSize - 1) & ~(pageSize - 1);
+    dataQueue_ = (IODataQueueMemory *)IOMalloc(allocatedSize_);
+    if (dataQueue_ == nullptr)
+    {
+        return false;
+    }
+
+    bzero(dataQueue_, allocatedSize_);
+    queueSize_ = size;
+    dataQueue_->queueSize = size;
+    return true;
+}
+
+void IOSharedDataQueue::free()
+{
+    if (dataQueue_ != nullptr)
+    {
+        IOFree(dataQueue_, allocatedSize_);
+        dataQueue_ = nullptr;
+    }
+
+    OSObject::free();
+}
+
+IOMemoryDescriptor* IOSharedDataQueue::getMemoryDescriptor()
+{
+    return new IOMemoryDescriptor(dataQueue_, allocatedSize_);
+}
+
+// Same protocol as IOSharedDataQueue::enqueue in xnu: an entry that doesn't fit before the end of the queue goes at
+// its start, and the size written where it would have gone tells the consumer to wrap around.
+Boolean IOSharedDataQueue::enqueue(void *data, UInt32 dataSize)
+{
+    const UInt32 entrySize = dataSize + DATA_QUEUE_ENTRY_HEADER_SIZE;
+    if (dataSize > UINT32_MAX - DATA_QUEUE_ENTRY_HEADER_SIZE)
+    {
+        return false;
+    }
+
+    // Acquire: the consumer is done with the entries before 'head'
+    UInt32 head = __atomic_load_n(&dataQueue_->head, __ATOMIC_ACQUIRE);
+    UInt32 tail = __atomic_load_n(&dataQueue_->tail, __ATOMIC_RELAXED);
+    UInt32 newTail;
+    IODataQueueEntry *entry;
+
+    if (tail >= head)
+    {
+        if (entrySize <= queueSize_ - tail)
+        {
+            entry = (IODataQueueEntry *)((UInt8 *)dataQueue_->queue + tail);
+            newTail = tail + entrySize;
+        }
+        else if (head > entrySize)
+        {
+            entry = (IODataQueueEntry *)dataQueue_->queue;
+            if (queueSize_ - tail >= DATA_QUEUE_ENTRY_HEADER_SIZE)
+            {
+                ((IODataQueueEntry *)((UInt8 *)dataQueue_->queue + tail))->size = dataSize;
+            }
+
+            newTail = entrySize;
+        }
+        else
+        {
+            return false;
+        }
+    }
+    else if (head - tail > entrySize)
+    {
+        entry = (IODataQueueEntry *)((UInt8 *)dataQueue_->queue + tail);
+        newTail = tail + entrySize;
+    }
+    else
+    {
+        return false;
+    }
+
+    entry->size = dataSize;
+    memcpy(&entry->data, data, dataSize);
+
+    // Release: the consumer reads the entry once it sees the new tail
+    __atomic_store_n(&dataQueue_->tail, newTail, __ATOMIC_RELEASE);
+    return true;
+}
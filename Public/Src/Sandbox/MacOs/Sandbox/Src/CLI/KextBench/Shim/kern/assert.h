@@ -0,0 +1,9 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef Shim_kern_assert_h
+#define Shim_kern_assert_h
+
+#include <assert.h>
+
+#endif /* Shim_kern_assert_h */
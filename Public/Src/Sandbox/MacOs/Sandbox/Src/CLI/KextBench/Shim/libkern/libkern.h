@@ -0,0 +1,14 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef Shim_libkern_h
+#define Shim_libkern_h
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+// Declares wcslen (with C linkage) before stdafx-mac-kext.h declares it again, and before it defines wprintf away
+#include <wchar.h>
+
+#endif /* Shim_libkern_h */
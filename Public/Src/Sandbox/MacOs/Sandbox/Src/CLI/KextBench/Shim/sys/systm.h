@@ -0,0 +1,10 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef Shim_systm_h
+#define Shim_systm_h
+
+// Included by SysCtl.hpp, whose sysctls KextBench defines as plain globals
+#include <sys/types.h>
+
+#endif /* Shim_systm_h */
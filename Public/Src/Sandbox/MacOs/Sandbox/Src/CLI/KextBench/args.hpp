@@ -0,0 +1,59 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include "arg_parse.hpp"
+
+// Define config (name, type, default-value) tuples
+#define ALL_ARGS(m)                                \
+  m(help,              bool,   false)              \
+  m(benchmarks,        string, "path,uint,queue")  \
+  m(paths,             string, "")                 \
+  m(num_paths,         int,    200000)             \
+  m(max_threads,       int,    8)                  \
+  m(num_reports,       int,    1000000)            \
+  m(queue_size_mb,     int,    16)                 \
+  m(consumer_delay_us, int,    0)
+
+GEN_CONFIG_DECL(ALL_ARGS)
+
+void ConfigureArgs() {
+    Config::argMeta(kArg_help)
+        ->LongName("help")
+        ->ShortName("h")
+        ->Description("Print help and exit.");
+
+    Config::argMeta(kArg_benchmarks)
+        ->LongName("benchmarks")
+        ->ShortName("b")
+        ->Description("Comma-separated benchmarks to run: 'path' (path tries of CacheRecords, fast and light), 'uint' (uint tries, as used for tracked processes), 'queue' (ConcurrentSharedDataQueue, with and without batching).");
+
+    Config::argMeta(kArg_paths)
+        ->LongName("paths")
+        ->ShortName("p")
+        ->Description("File with the paths to replay, one per line (e.g., the accesses reported for a build). Paths are generated when not specified.");
+
+    Config::argMeta(kArg_num_paths)
+        ->LongName("num-paths")
+        ->ShortName("n")
+        ->Description("Number of paths to generate when no path file is specified.");
+
+    Config::argMeta(kArg_max_threads)
+        ->LongName("max-threads")
+        ->ShortName("t")
+        ->Description("Every benchmark runs with 1, 2, 4, ... threads up to this many.");
+
+    Config::argMeta(kArg_num_reports)
+        ->LongName("num-reports")
+        ->ShortName("r")
+        ->Description("Number of reports the producers of the 'queue' benchmark enqueue in total.");
+
+    Config::argMeta(kArg_queue_size_mb)
+        ->LongName("queue-size-mb")
+        ->ShortName("q")
+        ->Description("Size of the shared report queue of the 'queue' benchmark, in MB (see 'reportQueueSizeMB' of the kext).");
+
+    Config::argMeta(kArg_consumer_delay_us)
+        ->LongName("consumer-delay-us")
+        ->ShortName("d")
+        ->Description("Time the consumer of the 'queue' benchmark spends on every entry it dequeues, to emulate a client falling behind.");
+}
@@ -0,0 +1,483 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Measures the data structures of the kernel extension in user space: they are built from the very same sources as the
+// kext, against the stand-ins of the 'Shim' directory for the IOKit and libkern facilities they use.
+
+#include <IOKit/IODataQueueClient.h>
+
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Alloc.hpp"
+#include "CacheRecord.hpp"
+#include "ConcurrentSharedDataQueue.hpp"
+#include "Trie.hpp"
+#include "Zone.hpp"
+
+#include "args.hpp"
+
+using namespace std;
+
+GEN_CONFIG_DEF(ALL_ARGS)
+
+// The sysctls of the kext (see SysCtl.cpp), with their default values. Counters must be on for the queue statistics.
+int g_bxl_verbose_logging           = 0;
+int g_bxl_enable_cache              = 1;
+int g_bxl_enable_counters           = 1;
+int g_bxl_enable_light_trie         = 1;
+int g_bxl_enable_vnode_cache        = 1;
+int g_bxl_disable_cache_min_entries = 20000;
+int g_bxl_disable_cache_max_hit_pct = 20;
+int g_bxl_disable_cache_max_kb      = 64 * 1024;
+int g_bxl_process_pool_size         = 16;
+int g_bxl_zone_reserve_count        = 256;
+
+os_log_t logger = os_log_create("com.microsoft.buildxl.kextbench", "Logger");
+
+#pragma mark Measurements
+
+typedef chrono::steady_clock Clock;
+
+/*! Operations done by the threads of a benchmark phase, how long they took and how contended they were */
+class Measurement
+{
+private:
+
+    Clock::time_point start_;
+    ShimCounters counters_;
+
+public:
+
+    Measurement() : start_(Clock::now()), counters_(g_shim_counters) {}
+
+    void print(const string &benchmark, const char *phase, int numThreads, uint64_t numOps) const
+    {
+        double seconds = chrono::duration<double>(Clock::now() - start_).count();
+        double perThousandOps = numOps == 0 ? 0 : 1000.0 / numOps;
+        cout << left << setw(22) << benchmark << setw(10) << phase << right
+             << setw(4) << numThreads << " threads"
+             << setw(12) << numOps << " ops"
+             << fixed << setprecision(3)
+             << setw(10) << (seconds == 0 ? 0 : numOps / seconds / 1000000) << " Mops/s"
+             << setprecision(1)
+             << setw(9) << (numOps == 0 ? 0 : seconds * 1e9 / numOps) << " ns/op"
+             << setprecision(2)
+             << setw(9) << (g_shim_counters.numFailedCompareAndSwaps - counters_.numFailedCompareAndSwaps) * perThousandOps << " CAS failures/1k"
+             << setw(9) << (g_shim_counters.numContendedLocks - counters_.numContendedLocks) * perThousandOps << " contended locks/1k"
+             << endl;
+    }
+};
+
+/*! Runs 'body(threadIndex)' on 'numThreads' threads, all started at once, and waits for them to finish */
+template <class TBody>
+static void RunThreads(int numThreads, TBody body)
+{
+    volatile bool go = false;
+    vector<thread> threads;
+    for (int i = 0; i < numThreads; i++)
+    {
+        threads.emplace_back([&go, &body, i]()
+        {
+            while (!go) this_thread::yield();
+            body(i);
+        });
+    }
+
+    go = true;
+    for (thread &t : threads) t.join();
+}
+
+static vector<int> ThreadCounts(int maxThreads)
+{
+    vector<int> counts;
+    for (int count = 1; count < maxThreads; count *= 2) counts.push_back(count);
+    counts.push_back(maxThreads < 1 ? 1 : maxThreads);
+    return counts;
+}
+
+#pragma mark Path sets
+
+static bool ReadPaths(const string &file, vector<string> &paths)
+{
+    ifstream input(file);
+    if (!input)
+    {
+        return false;
+    }
+
+    string line;
+    while (getline(input, line))
+    {
+        if (!line.empty() && line.size() < MAXPATHLEN) paths.push_back(line);
+    }
+
+    return true;
+}
+
+// A source tree of a few projects, with deep and narrow directories like the ones builds access
+static vector<string> GeneratePaths(int count)
+{
+    static const char *extensions[] = { ".cpp", ".hpp", ".h", ".cs", ".o", ".json" };
+
+    mt19937 random(42);
+    vector<string> paths;
+    while (paths.size() < (size_t)count)
+    {
+        stringstream dir;
+        dir << "/Users/bxl/src/project" << random() % 16;
+        int depth = 2 + random() % 7;
+        for (int level = 0; level < depth; level++)
+        {
+            dir << "/dir" << random() % (level < 2 ? 8 : 32);
+        }
+
+        int numFiles = 1 + random() % 32;
+        for (int i = 0; i < numFiles && paths.size() < (size_t)count; i++)
+        {
+            paths.push_back(dir.str() + "/file" + to_string(i) + extensions[random() % 6]);
+        }
+    }
+
+    return paths;
+}
+
+#pragma mark Tries
+
+static OSObject* CacheRecordFactory(void *data)
+{
+    return CacheRecord::create();
+}
+
+static void PrintTrieMemory(const string &benchmark, Trie *trie, int64_t allocatedBytesBefore, size_t valueSize)
+{
+    uint count = trie->getCount();
+    if (count == 0)
+    {
+        return;
+    }
+
+    int64_t allocatedBytes = Alloc::numCurrentlyAllocatedBytes() - allocatedBytesBefore;
+    cout << left << setw(22) << benchmark << setw(10) << "memory" << right
+         << setw(12) << count << " entries"
+         << setw(10) << trie->getNodeCount() << " nodes"
+         << fixed << setprecision(1)
+         << setw(9) << (double)trie->getNodesMemorySize() / count << " node bytes/entry"
+         << setw(9) << (double)(trie->getNodesMemorySize() + (uint64_t)count * valueSize) / count << " bytes/entry with values"
+         << setw(9) << (double)allocatedBytes / count << " Alloc::New bytes/entry (child arrays)"
+         << endl;
+}
+
+/*!
+ * Every thread looks up every path in the path cache of a pip, starting at a different offset, the way concurrent processes
+ * of a pip access the same files: the first lookup of a path inserts its CacheRecord.  Then every thread checks an access to
+ * every path against its record, as AccessHandler does for each access.
+ */
+static void BenchPathTrie(const vector<string> &paths, int numThreads, bool light)
+{
+    g_bxl_enable_light_trie = light;
+    string benchmark = light ? "path-trie/light" : "path-trie/fast";
+    const size_t numPaths = paths.size();
+
+    int64_t allocatedBytesBefore = Alloc::numCurrentlyAllocatedBytes();
+    Trie *trie = Trie::createPathTrie();
+    if (trie == nullptr)
+    {
+        error("%s", "Could not create a path trie");
+        return;
+    }
+
+    Measurement insert;
+    RunThreads(numThreads, [&](int t)
+    {
+        for (size_t i = 0, offset = t * numPaths / numThreads; i < numPaths; i++)
+        {
+            trie->getOrAdd(paths[(offset + i) % numPaths].c_str(), nullptr, CacheRecordFactory);
+        }
+    });
+    insert.print(benchmark, "getOrAdd", numThreads, numPaths * numThreads);
+
+    static const RequestedAccess accesses[] = { RequestedAccess::Lookup, RequestedAccess::Probe, RequestedAccess::Read, RequestedAccess::Write };
+    Measurement check;
+    RunThreads(numThreads, [&](int t)
+    {
+        for (size_t i = 0, offset = t * numPaths / numThreads; i < numPaths; i++)
+        {
+            size_t index = (offset + i) % numPaths;
+            CacheRecord *record = trie->getAs<CacheRecord>(paths[index].c_str());
+            AccessCheckResult result(accesses[(index + t) % 4], ResultAction::Allow, ReportLevel::Report);
+            if (record != nullptr) record->CheckAndUpdate(&result);
+        }
+    });
+    check.print(benchmark, "check", numThreads, numPaths * numThreads);
+
+    PrintTrieMemory(benchmark, trie, allocatedBytesBefore, sizeof(CacheRecord));
+    OSSafeReleaseNULL(trie);
+}
+
+/*!
+ * Every thread inserts, looks up and removes keys of its own, the way processes are tracked by pid: keys are dense,
+ * and the threads work on neighbouring ranges.
+ */
+static void BenchUintTrie(int numKeys, int numThreads, bool light)
+{
+    g_bxl_enable_light_trie = light;
+    string benchmark = light ? "uint-trie/light" : "uint-trie/fast";
+    const uint64_t firstKey = 1000;
+    const int keysPerThread = numKeys / numThreads;
+    const uint64_t numOps = (uint64_t)keysPerThread * numThreads;
+
+    CacheRecord *value = CacheRecord::create();
+    int64_t allocatedBytesBefore = Alloc::numCurrentlyAllocatedBytes();
+    Trie *trie = Trie::createUintTrie();
+    if (trie == nullptr || value == nullptr)
+    {
+        error("%s", "Could not create a uint trie");
+        OSSafeReleaseNULL(trie);
+        OSSafeReleaseNULL(value);
+        return;
+    }
+
+    Measurement insert;
+    RunThreads(numThreads, [&](int t)
+    {
+        for (int i = 0; i < keysPerThread; i++) trie->insert(firstKey + (uint64_t)i * numThreads + t, value);
+    });
+    insert.print(benchmark, "insert", numThreads, numOps);
+    PrintTrieMemory(benchmark, trie, allocatedBytesBefore, 0);
+
+    Measurement get;
+    RunThreads(numThreads, [&](int t)
+    {
+        for (int i = 0; i < keysPerThread; i++) trie->get(firstKey + (uint64_t)i * numThreads + t);
+    });
+    get.print(benchmark, "get", numThreads, numOps);
+
+    Measurement remove;
+    RunThreads(numThreads, [&](int t)
+    {
+        for (int i = 0; i < keysPerThread; i++) trie->remove(firstKey + (uint64_t)i * numThreads + t);
+    });
+    remove.print(benchmark, "remove", numThreads, numOps);
+
+    OSSafeReleaseNULL(trie);
+    OSSafeReleaseNULL(value);
+}
+
+#pragma mark Report queue
+
+static IODataQueueMemory* MapQueue(IOMemoryDescriptor *memory, IOMemoryMap *&map)
+{
+    map = memory != nullptr ? memory->map() : nullptr;
+    OSSafeReleaseNULL(memory);
+    return map != nullptr ? (IODataQueueMemory *)map->getVirtualAddress() : nullptr;
+}
+
+/*!
+ * The producers enqueue reports of accesses to the paths of the path set, as the listeners of the kext do on behalf of
+ * the sandboxed processes, while a consumer dequeues them from the shared memory the way the client does (see KextSandbox.cpp).
+ */
+static void BenchReportQueue(const vector<string> &paths, const Config &cfg, int numThreads, bool batching)
+{
+    string benchmark = batching ? "queue/batching" : "queue/locking";
+    ReportCounters counters = {};
+    ConcurrentSharedDataQueue *queue = ConcurrentSharedDataQueue::create(
+    {
+        .entryCount     = (uint)(((uint64_t)cfg.queue_size_mb * 1024 * 1024) / sizeof(AccessReport)),
+        .entrySize      = sizeof(AccessReport),
+        .enableBatching = batching,
+        .counters       = &counters
+    });
+    if (queue == nullptr)
+    {
+        error("%s", "Could not create the report queue");
+        return;
+    }
+
+    IOMemoryMap *queueMap = nullptr, *priorityQueueMap = nullptr;
+    IODataQueueMemory *reports = MapQueue(queue->getMemoryDescriptor(), queueMap);
+    IODataQueueMemory *priorityReports = MapQueue(queue->getPriorityMemoryDescriptor(), priorityQueueMap);
+    if (reports == nullptr || priorityReports == nullptr)
+    {
+        error("%s", "Could not map the report queues");
+        OSSafeReleaseNULL(queueMap);
+        OSSafeReleaseNULL(priorityQueueMap);
+        OSSafeReleaseNULL(queue);
+        return;
+    }
+
+    const uint64_t reportsPerThread = cfg.num_reports / numThreads;
+    const uint64_t numReports = reportsPerThread * numThreads;
+    volatile uint64_t numDequeued = 0;
+    volatile bool stop = false;
+    thread consumer([&]()
+    {
+        vector<char> entry(kMaxReportQueueEntrySize);
+        while (!stop)
+        {
+            bool dequeued = false;
+            for (IODataQueueMemory *memory : { priorityReports, reports })
+            {
+                while (IODataQueueDataAvailable(memory))
+                {
+                    uint32_t entrySize = (uint32_t)entry.size();
+                    if (IODataQueueDequeue(memory, entry.data(), &entrySize) != kIOReturnSuccess) break;
+                    numDequeued++;
+                    dequeued = true;
+                    if (cfg.consumer_delay_us > 0) usleep(cfg.consumer_delay_us);
+                }
+            }
+
+            if (!dequeued) this_thread::yield();
+        }
+    });
+
+    Measurement enqueue;
+    RunThreads(numThreads, [&](int t)
+    {
+        AccessReport report = {};
+        report.operation       = kOpKAuthReadFile;
+        report.pid             = 1000 + t;
+        report.rootPid         = 1000;
+        report.requestedAccess = (DWORD)RequestedAccess::Read;
+        report.pipId           = 0x1234;
+        for (uint64_t i = 0; i < reportsPerThread; i++)
+        {
+            strlcpy(report.path, paths[(t + i * numThreads) % paths.size()].c_str(), sizeof(report.path));
+            queue->enqueueReport({ .report = report, .cacheRecord = nullptr, .precedingPipReports = 0 });
+        }
+    });
+    enqueue.print(benchmark, "enqueue", numThreads, numReports);
+
+    // With batching, reports are still on their way to the shared queue when the producers are done, and entries
+    // of the shared queue may hold several reports: wait for every report to be sent and every entry to be dequeued
+    auto deadline = Clock::now() + chrono::seconds(30);
+    while (counters.totalNumSent.count() + counters.numCoalescedReports.count() < numReports && Clock::now() < deadline)
+    {
+        this_thread::yield();
+    }
+
+    while ((IODataQueueDataAvailable(reports) || IODataQueueDataAvailable(priorityReports)) && Clock::now() < deadline)
+    {
+        this_thread::yield();
+    }
+
+    stop = true;
+    consumer.join();
+    enqueue.print(benchmark, "delivered", numThreads, counters.totalNumSent.count());
+
+    ConcurrentSharedDataQueue::QueueStats stats = queue->getStats();
+    cout << left << setw(22) << benchmark << setw(10) << "queue" << right
+         << setw(12) << counters.numReportQueueStalls.count() << " stalls"
+         << setw(9) << counters.reportQueueStallTime.duration().millis() << " ms stalled"
+         << setw(9) << stats.highWaterMarkBytes / 1024 << " KB high water mark (of " << stats.capacityBytes / 1024 << " KB)"
+         << setw(9) << counters.freeListNodeCount.count() << " free list nodes"
+         << setw(12) << numDequeued << " entries dequeued"
+         << endl;
+
+    OSSafeReleaseNULL(queueMap);
+    OSSafeReleaseNULL(priorityQueueMap);
+    OSSafeReleaseNULL(queue);
+}
+
+#pragma mark Zones
+
+/*! How much of every zone the benchmarks run so far used, and how often the CPU caches of the zones served an allocation */
+static void PrintZones(const string &benchmark)
+{
+    ZoneCounters zones[kZoneCount];
+    Zone::getAllCounters(zones);
+    for (int i = 0; i < kZoneCount; i++)
+    {
+        ZoneCounters &zone = zones[i];
+        if (zone.numAllocations.count() == 0)
+        {
+            continue;
+        }
+
+        cout << left << setw(22) << benchmark << setw(10) << "zone" << right
+             << setw(18) << ZoneName((ZoneId)i)
+             << setw(12) << zone.numAllocations.count() << " allocations"
+             << fixed << setprecision(1)
+             << setw(9) << zone.numCpuCacheHits.count() * 100.0 / zone.numAllocations.count() << "% from CPU caches"
+             << setw(10) << zone.numElems << " elements (" << zone.numInUse << " in use)"
+             << setw(9) << (double)zone.numElems * zone.elemSize / (1024 * 1024) << " MB in " << zone.numSlabs << " slabs"
+             << endl;
+    }
+}
+
+int main(int argc, const char * argv[])
+{
+    ConfigureArgs();
+
+    Config cfg;
+    if (!cfg.parse(argc, argv))
+    {
+        printf("\nUsage:\n\n");
+        cfg.printUsage();
+        exit(1);
+    }
+
+    if (cfg.help)
+    {
+        cfg.printUsage();
+        exit(0);
+    }
+
+    vector<string> paths;
+    if (!cfg.paths.empty())
+    {
+        if (!ReadPaths(cfg.paths, paths) || paths.empty())
+        {
+            error("Could not read any path from '%s'", cfg.paths.c_str());
+            exit(1);
+        }
+    }
+    else
+    {
+        paths = GeneratePaths(cfg.num_paths);
+    }
+
+    info("%zu paths, up to %d threads", paths.size(), cfg.max_threads);
+
+    stringstream benchmarks(cfg.benchmarks);
+    string benchmark;
+    while (getline(benchmarks, benchmark, ','))
+    {
+        for (int numThreads : ThreadCounts(cfg.max_threads))
+        {
+            if (benchmark == "path")
+            {
+                BenchPathTrie(paths, numThreads, /*light*/ false);
+                BenchPathTrie(paths, numThreads, /*light*/ true);
+            }
+            else if (benchmark == "uint")
+            {
+                BenchUintTrie((int)paths.size(), numThreads, /*light*/ false);
+                BenchUintTrie((int)paths.size(), numThreads, /*light*/ true);
+            }
+            else if (benchmark == "queue")
+            {
+                BenchReportQueue(paths, cfg, numThreads, /*batching*/ false);
+                BenchReportQueue(paths, cfg, numThreads, /*batching*/ true);
+            }
+            else
+            {
+                error("Unknown benchmark '%s'", benchmark.c_str());
+                exit(1);
+            }
+        }
+
+        PrintZones(benchmark);
+        cout << endl;
+    }
+
+    return 0;
+}
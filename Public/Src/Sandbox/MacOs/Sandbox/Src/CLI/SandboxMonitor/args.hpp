@@ -11,6 +11,8 @@
   m(stacked,     bool,   false)                \
   m(no_header,   bool,   false)                \
   m(interactive, bool,   false)                \
+  m(pips_every,  int,    1)                    \
+  m(latencies,   bool,   false)                \
   m(ps_fmt,      string, "%cpu,%mem,ucomm")
 
 GEN_CONFIG_DECL(ALL_ARGS)
@@ -45,7 +47,17 @@ void ConfigureArgs() {
         ->LongName("interactive")
         ->ShortName("i")
         ->Description("Runs the monitor continuously until interrupted.");
+
+    Config::argMeta(kArg_pips_every)
+        ->LongName("pips-every")
+        ->ShortName("pe")
+        ->Description("Refresh pips and processes only every this many updates (0 for never); the other updates only fetch the counters, which is much cheaper for the kernel extension.");
     
+    Config::argMeta(kArg_latencies)
+        ->LongName("latencies")
+        ->ShortName("l")
+        ->Description("Print the latency histograms of the kernel callbacks (recorded only while counters are enabled, see 'kern.bxl_enable_counters').");
+
     Config::argMeta(kArg_ps_fmt)
         ->LongName("ps-fmt")
         ->ShortName("f")
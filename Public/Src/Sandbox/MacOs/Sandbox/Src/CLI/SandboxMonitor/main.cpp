@@ -12,6 +12,7 @@
 #include <string>
 #include <sstream>
 #include <ncurses.h>
+#include <sys/sysctl.h>
 
 #import "args.hpp"
 #import "ps.hpp"
@@ -86,6 +87,92 @@ string renderCountAndSize(CountAndSize cnt)
     return str.str();
 }
 
+// Elements in use out of those carved out of the slabs of every zone, and the share of the allocations the CPU caches served
+string renderZones(const MemoryCountsAndSizes &memory)
+{
+    stringstream str;
+    for (int i = 0; i < kZoneCount; i++)
+    {
+        ZoneCounters zone = memory.zones[i];
+        if (i > 0) str << ", ";
+        str << ZoneName((ZoneId)i) << ": " << zone.numInUse << "/" << zone.numElems
+            << " (" << renderBytesAsMebabytes((double)zone.numElems * zone.elemSize)
+            << ", " << renderDouble(PERCENT(zone.numCpuCacheHits.count(), zone.numAllocations.count() - zone.numCpuCacheHits.count())) << "% CPU cache)";
+    }
+
+    return str.str();
+}
+
+static const char *kLatencyCallbackNames[kLatencyCallbackCount] =
+{
+    "FileOpListener",
+    "VNodeListener",
+    "VNodeCheckLookupPre",
+    "VNodeCheckReadlink",
+    "VNodeCheckExec",
+    "ProcNotifyExit",
+    "CredLabelUpdateExecve",
+    "ProcCheckFork",
+    "CredLabelAssociateFork",
+    "VNodeCheckCreate",
+    "VNodeCheckWrite",
+    "VNodeCheckClone",
+    "ReportEnqueue",
+};
+
+// The upper bound of a latency bucket, in microseconds
+string renderLatencyBucket(int bucket)
+{
+    stringstream str;
+    str << "<" << renderDouble((double)(2ull << bucket) / 1000) << "us";
+    return str.str();
+}
+
+// For every callback that was called: the number of calls, and the buckets of the median, the 99th percentile and the slowest call
+void renderCallbackLatencies(stringstream &output)
+{
+    CallbackLatencies latencies;
+    size_t size = sizeof(latencies);
+    if (sysctlbyname("kern.bxl_callback_latencies", &latencies, &size, NULL, 0) != 0 || size != sizeof(latencies))
+    {
+        output << "Latencies  :: not available" << endl;
+        return;
+    }
+
+    output << "Latencies  :: #Calls, P50 / P99 / Max" << endl;
+    for (int i = 0; i < kLatencyCallbackCount; i++)
+    {
+        const LatencyHistogram &histogram = latencies.callbacks[i];
+        uint64_t count = 0;
+        for (int b = 0; b < kLatencyBucketCount; b++)
+        {
+            count += histogram.buckets[b];
+        }
+
+        if (count == 0)
+        {
+            continue;
+        }
+
+        int p50 = -1, p99 = -1, slowest = 0;
+        uint64_t seen = 0;
+        for (int b = 0; b < kLatencyBucketCount; b++)
+        {
+            seen += histogram.buckets[b];
+            if (p50 == -1 && seen * 2 >= count) p50 = b;
+            if (p99 == -1 && seen * 100 >= count * 99) p99 = b;
+            if (histogram.buckets[b] > 0) slowest = b;
+        }
+
+        output << "    " << left << setw(24) << kLatencyCallbackNames[i] << right
+               << count << ", "
+               << renderLatencyBucket(p50) << " / "
+               << renderLatencyBucket(p99) << " / "
+               << renderLatencyBucket(slowest)
+               << endl;
+    }
+}
+
 string to_string(Counter cnt)         { return to_string(cnt.count()); }
 string to_string(DurationCounter cnt) { return renderCounterMicros(cnt); }
 string to_string(string str)          { return str; }
@@ -104,6 +191,7 @@ vector<vector<HeaderColumn<Tuple>>> getStackedHeaders(const Config &cfg)
             {   7, "PipPID",  to_getter(t.pip.pid) },
             {   6, "#Proc",   to_getter(t.pip.treeSize) },
             {   6, "#Forks",  to_getter(t.pip.counters.numForks) },
+            {   6, "#FPool",  to_getter(t.pip.counters.numForksFromPool) },
             {   8, "#C+",     to_getter(t.pip.counters.numCacheHits) },
             {   8, "#C-",     to_getter(t.pip.counters.numCacheMisses) },
             {   8, "#C",      to_getter(t.pip.cacheSize) },
@@ -288,6 +376,18 @@ int main(int argc, const char * argv[])
 
     int loopCount = 0;
     int exitCode = 0;
+
+    // What was rendered for the pips the last time they were refreshed
+    string renderedProcesses;
+    uint numPips = 0;
+
+    // The counters of the kext are mapped into this process, so updates that don't refresh the pips
+    // don't need to introspect the kext: they reuse the last response with up-to-date counters
+    const AllCounters *sharedCounters = nullptr;
+    bool countersMapped = MapKextCounters(info, &sharedCounters);
+    IntrospectResponse response;
+
+    uint32_t lastTotalNumSent = 0;
     do
     {
         if (loopCount++ > 0)
@@ -311,14 +411,36 @@ int main(int argc, const char * argv[])
             output << "(" << loopCount << ")" << endl;
         }
 
-        IntrospectResponse response;
-        if (!IntrospectKernelExtension(info, &response))
+        // Collecting the pips is the expensive part of an introspection for the kext, and rendering them runs 'ps'
+        // for every process, so they are only refreshed every 'pips_every' updates
+        bool refreshPips = cfg.pips_every > 0 && (loopCount - 1) % cfg.pips_every == 0;
+
+        if (refreshPips || !countersMapped || loopCount == 1)
         {
-            error("%s", "Failed to introspect sandbox kernel extension");
-            exitCode = 1;
-            break;
+            if (!IntrospectKernelExtension(info, &response, refreshPips))
+            {
+                error("%s", "Failed to introspect sandbox kernel extension");
+                exitCode = 1;
+                break;
+            }
+        }
+        else
+        {
+            response.counters = *sharedCounters;
         }
 
+        if (refreshPips)
+        {
+            stringstream processes;
+            renderProcesses(&cfg, &renderer, &response, &processes);
+            renderedProcesses = processes.str();
+            numPips = response.numReportedPips;
+        }
+
+        uint32_t totalNumSent = response.counters.reportCounters.totalNumSent.count();
+        uint32_t numSentSinceLastUpdate = loopCount > 1 ? totalNumSent - lastTotalNumSent : 0;
+        lastTotalNumSent = totalNumSent;
+
         // render header
         if (!cfg.no_header)
         {
@@ -340,6 +462,7 @@ int main(int argc, const char * argv[])
             output << "Config     :: "
                    << "Catalina Data Partition filtering: " << (kextCfg->enableCatalinaDataPartitionFiltering ? "YES" : "NO")
                    << ", Report Queue Size: " << kextCfg->reportQueueSizeMB << " MB"
+                   << ", Report Coalescing Window: " << kextCfg->reportCoalescingWindowMs << " ms"
                    << endl;
             output << "Thresholds :: "
                    << "Min Available RAM: " << thresholds->minAvailableRamMB << " MB"
@@ -358,9 +481,16 @@ int main(int argc, const char * argv[])
             output << "Reports    :: "
                    << "#Queued: " << to_string(response.counters.reportCounters.numQueued)
                    << ", Total: " << to_string(response.counters.reportCounters.totalNumSent)
+                   << " (+" << numSentSinceLastUpdate << ")"
                    << ", #HardLink retries: " << to_string(response.counters.numHardLinkRetries)
+                   << " (" << to_string(response.counters.numHardLinkLookupsSkipped) << " without a lookup)"
+                   << ", #RepeatedChecksSkipped: " << to_string(response.counters.numRepeatedChecksSkipped)
                    << ", #CoalescedReports: " << to_string(response.counters.reportCounters.numCoalescedReports)
                    << " (" << renderDouble(PERCENT(response.counters.reportCounters.numCoalescedReports.count(), response.counters.reportCounters.totalNumSent.count())) << "%)"
+                   << ", #QueueStalls: " << to_string(response.counters.reportCounters.numReportQueueStalls)
+                   << ", StallTime: " << response.counters.reportCounters.reportQueueStallTime.duration().millis() << " ms"
+                   << ", #MultiReportEntries: " << to_string(response.counters.reportCounters.numMultiReportEntries)
+                   << ", QueueHighWaterMark: " << response.counters.reportCounters.reportQueueHighWaterMarkKB << " KB"
                    << endl;
             output << "Memory     :: "
                    << "FastTrieNodes: " << renderCountAndSize(response.memory.fastNodes)
@@ -370,19 +500,28 @@ int main(int argc, const char * argv[])
                    << " (" << renderDouble(response.counters.reportCounters.freeListSizeMB) << " MB)"
                    << ", IONew allocations: " << renderBytesAsMebabytes(response.memory.totalAllocatedBytes)
                    << endl;
+            output << "Zones      :: " << renderZones(response.memory) << endl;
             output << "Processes  :: #Client: " << response.numAttachedClients
-                   << ", #Pips: " << response.numReportedPips
+                   << ", #Pips: " << numPips
                    << ", Available RAM: " << counters->availableRamMB << " MB"
                    << ", CPU usage: " << renderDouble(counters->cpuUsage.value / 100.0) << "%"
                    << ", #Processes [active: " << to_string(counters->numTrackedProcesses)
                    << ", blocked: " << to_string(counters->numBlockedProcesses) << "]"
+                   << ", Avg(ForkWait): " << renderCounter(counters->forkWaitTime)
                    << endl
                    << endl;
+
+            if (cfg.latencies)
+            {
+                renderCallbackLatencies(output);
+                output << endl;
+            }
+
             output << renderer.RenderHeader() << endl;
         }
 
         // render processes
-        renderProcesses(&cfg, &renderer, &response, &output);
+        output << renderedProcesses;
 
         // print to stdout
         if (cfg.interactive)
@@ -391,6 +530,11 @@ int main(int argc, const char * argv[])
 
     } while (cfg.interactive && !g_interrupted);
 
+    if (countersMapped)
+    {
+        UnmapKextCounters(info, sharedCounters);
+    }
+
     DeinitializeKextConnection(info);
 
     return exitCode;
@@ -2,12 +2,13 @@
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
 #include "CacheRecord.hpp"
-#include "Monitor.hpp"
 
 #define super OSObject
 
 OSDefineMetaClassAndStructors(CacheRecord, OSObject)
 
+BXLDefineZoneAllocated(CacheRecord, kZoneCacheRecord);
+
 CacheRecord* CacheRecord::create()
 {
     CacheRecord *instance = new CacheRecord;
@@ -29,33 +30,10 @@ bool CacheRecord::init()
         return false;
     }
 
-    lock_ = BXLLockAlloc();
-    if (lock_ == nullptr)
-    {
-        return false;
-    }
-
-    requestedAccess_ = RequestedAccess::None;
+    requestedAccess_ = (UInt32)RequestedAccess::None;
     return true;
 }
 
-void CacheRecord::free()
-{
-    if (lock_ != nullptr)
-    {
-        BXLLockFree(lock_);
-        lock_ = nullptr;
-    }
-
-    super::free();
-}
-
-bool CacheRecord::Check(const AccessCheckResult *result) const
-{
-    // It's a cache hit if we've previously seen all the requested accesses.
-    return HasAllFlags(requestedAccess_, result->Access);
-}
-
 static const RequestedAccess LookupProbe     = RequestedAccess::Lookup | RequestedAccess::Probe;
 static const RequestedAccess LookupProbeRead = LookupProbe | RequestedAccess::Read;
 static const RequestedAccess ReadWrite       = RequestedAccess::Read | RequestedAccess::Write;
@@ -121,27 +99,26 @@ bool CacheRecord::HasStrongerRequestedAccess(RequestedAccess access, int *outCac
         HasAnyFlags(cachedAccess, (int)accessesThatImplyGiveAccess);
 }
 
-void CacheRecord::Update(const AccessCheckResult *result)
+bool CacheRecord::CheckAndUpdate(const AccessCheckResult *checkResult)
 {
     // Update requested access:
     //   - whenever Probe is seen, add Lookup as well;
     //   - whenever Read is seen, add Probe and Lookup as well;
     //   - whenever Write is seen, add Read, Probe, and Lookup as well.
-    RequestedAccess access = result->Access;
-    requestedAccess_ |= access | implies(access);
-}
+    RequestedAccess access = checkResult->Access;
+    UInt32 accessToAdd = (UInt32)(access | implies(access));
 
-bool CacheRecord::CheckAndUpdate(const AccessCheckResult *checkResult)
-{
-    bool isHit;
-    BXLLockLock(lock_);
+    UInt32 oldAccess;
+    do
     {
-        isHit = Check(checkResult);
-        if (!isHit)
+        oldAccess = requestedAccess_;
+
+        // It's a cache hit if we've previously seen all the requested accesses.
+        if (HasAllFlags((RequestedAccess)oldAccess, access))
         {
-            Update(checkResult);
+            return true;
         }
-    }
-    BXLLockUnlock(lock_);
-    return isHit;
+    } while (!OSCompareAndSwap(oldAccess, oldAccess | accessToAdd, &requestedAccess_));
+
+    return false;
 }
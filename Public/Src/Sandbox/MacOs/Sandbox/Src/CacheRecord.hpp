@@ -8,7 +8,7 @@
 #include <IOKit/IOLib.h>
 #include "BuildXLSandboxShared.hpp"
 #include "FileAccessHelpers.h"
-#include "BXLLocks.hpp"
+#include "Zone.hpp"
 
 #define CacheRecord BXL_CLASS(CacheRecord)
 
@@ -21,35 +21,22 @@ private:
 
     OSDeclareDefaultStructors(CacheRecord)
 
-    BXLLock *lock_;
-
-    /*!
-     * A bitwise disjunction of reported accesses.
-     */
-    RequestedAccess requestedAccess_;
-    
     /*!
-     * Determines if the given 'checkResult' should be deemed a cache hit (and thus not reported).
+     * A bitwise disjunction of reported accesses (a 'RequestedAccess' value).
      *
-     * It is a cache hit if this cache record's 'Access' property already contains all the
-     * requested accesses contained in the given 'checkResult' ('checkResult.RequestedAccess' field).
+     * It is a single word, so it is updated with a compare-and-swap loop rather than under a lock.
      */
-    bool Check(const AccessCheckResult *checkResult) const;
-    
-    /*!
-     * Updates this record w.r.t. a given 'checkResult' (so that subsequently, given the same
-     * 'checkResult', 'Check' returns True)
-     */
-    void Update(const AccessCheckResult *checkResult);
+    volatile UInt32 requestedAccess_;
+
+    BXLDeclareZoneAllocated(CacheRecord)
 
 protected:
 
     bool init() override;
-    void free() override;
 
 public:
     
-    inline RequestedAccess Access() const  { return requestedAccess_; }
+    inline RequestedAccess Access() const  { return (RequestedAccess)requestedAccess_; }
 
     bool HasStrongerRequestedAccess(RequestedAccess access, int *outCacheAccess = nullptr) const;
     
@@ -50,12 +50,19 @@ bool ClientInfo::init(const InitArgs& args)
         return false;
     }
 
+    trackedProcesses_ = Trie::createUintTrie();
+    if (trackedProcesses_ == nullptr)
+    {
+        return false;
+    }
+
     return true;
 }
 
 void ClientInfo::free()
 {
     OSSafeReleaseNULL(queue_);
+    OSSafeReleaseNULL(trackedProcesses_);
 
     if (lock_)
     {
@@ -102,6 +109,15 @@ IOMemoryDescriptor* ClientInfo::getMemoryDescriptor()
         : nullptr;
 }
 
+IOMemoryDescriptor* ClientInfo::getPriorityMemoryDescriptor()
+{
+    EnterMonitor
+
+    return !frozen_ && queue_
+        ? queue_->getPriorityMemoryDescriptor()
+        : nullptr;
+}
+
 bool ClientInfo::setFailureNotificationHandler(OSAsyncReference64 ref, OSObject *client)
 {
     EnterMonitor
@@ -118,3 +134,37 @@ bool ClientInfo::enqueueReport(const EnqueueArgs &args)
 
     return queue_ && queue_->enqueueReport(args);
 }
+
+bool ClientInfo::enqueueReports(const char *reports, uint32_t size, uint reportCount)
+{
+    frozen_ = true;
+
+    return queue_ && queue_->enqueueReports(reports, size, reportCount);
+}
+
+QueueStats ClientInfo::getQueueStats()
+{
+    EnterMonitor
+
+    return queue_ != nullptr ? queue_->getStats() : QueueStats{0};
+}
+
+void ClientInfo::trackProcess(pid_t pid, const OSObject *process)
+{
+    // a race means someone else just associated a different process with 'pid' --> retry until ours is the last one
+    Trie::TrieResult result;
+    do
+    {
+        result = trackedProcesses_->replace(pid, process);
+    } while (result == Trie::TrieResult::kTrieResultRace);
+}
+
+void ClientInfo::untrackProcess(pid_t pid, const OSObject *process)
+{
+    trackedProcesses_->removeIfEqual(pid, process);
+}
+
+void ClientInfo::forEachTrackedProcess(void *callbackArgs, Trie::for_each_fn callback)
+{
+    trackedProcesses_->forEach(callbackArgs, callback);
+}
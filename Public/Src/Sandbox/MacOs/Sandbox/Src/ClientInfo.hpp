@@ -8,9 +8,11 @@
 #include "CacheRecord.hpp"
 #include "ConcurrentSharedDataQueue.hpp"
 #include "Monitor.hpp"
+#include "Trie.hpp"
 
 typedef ConcurrentSharedDataQueue::EnqueueArgs EnqueueArgs;
 typedef ConcurrentSharedDataQueue::InitArgs InitArgs;
+typedef ConcurrentSharedDataQueue::QueueStats QueueStats;
 
 #define ClientInfo BXL_CLASS(ClientInfo)
 
@@ -45,6 +47,14 @@ private:
      */
     bool frozen_;
 
+    /*!
+     * The processes currently tracked on behalf of this client (pid -> SandboxedProcess).
+     *
+     * Mirrors the entries of the sandbox-wide tracked processes that belong to the pips of this client, so that
+     * when the client goes away the processes it left behind are found without walking every tracked process.
+     */
+    Trie *trackedProcesses_;
+
     /*!
      * Initializes this object, following the OSObject pattern.
      *
@@ -82,6 +92,13 @@ public:
      */
     IOMemoryDescriptor* getMemoryDescriptor();
 
+    /*!
+     * Returns the memory descriptor of the priority queue of the underlying shared data queue (see PriorityReportHeader).
+     *
+     * @result a newly allocated memory descriptor.  The caller is responsible for releasing it.
+     */
+    IOMemoryDescriptor* getPriorityMemoryDescriptor();
+
     /*!
      * Sets the failure notification async callback handle for the underlying shared data queue.
      *
@@ -96,6 +113,33 @@ public:
      */
     bool enqueueReport(const EnqueueArgs &args);
 
+    /*!
+     * Enqueues 'reportCount' compact reports (see CompactAccessReport) as one entry of the underlying shared data queue.
+     *
+     * @result indicates success.
+     */
+    bool enqueueReports(const char *reports, uint32_t size, uint reportCount);
+
+    /*!
+     * Returns the fill level statistics of the underlying shared data queue (all 0 if there is no queue).
+     */
+    QueueStats getQueueStats();
+
+    /*!
+     * Records that 'process' is tracked on behalf of this client as 'pid' (replacing any previous process with that pid).
+     */
+    void trackProcess(pid_t pid, const OSObject *process);
+
+    /*!
+     * Forgets 'pid', unless it has since been associated with a process other than 'process'.
+     */
+    void untrackProcess(pid_t pid, const OSObject *process);
+
+    /*!
+     * Invokes 'callback' for every process currently tracked on behalf of this client.
+     */
+    void forEachTrackedProcess(void *callbackArgs, Trie::for_each_fn callback);
+
 #pragma mark Static Methods
 
     /*! Static factory method, following the OSObject pattern */
@@ -4,8 +4,13 @@
 #include <IOKit/IOMemoryDescriptor.h>
 #include <IOKit/IODataQueueShared.h>
 #include "Alloc.hpp"
+#if !KEXT_BENCH
 #include "BuildXLSandboxClient.hpp"
+#endif
 #include "ConcurrentSharedDataQueue.hpp"
+#include "Monitor.hpp"
+#include "Stopwatch.hpp"
+#include "Zone.hpp"
 
 #define super OSObject
 
@@ -13,6 +18,31 @@ OSDefineMetaClassAndStructors(ConcurrentSharedDataQueue, OSObject)
 
 typedef ConcurrentSharedDataQueue::ElemPayload ElemPayload;
 
+// How long a report may wait for the client to make room in a full shared IO queue before the queue is considered broken
+#define kReportQueueMaxStallMs 30000
+
+// Number of the biggest entries the priority queue can hold: process lifecycle reports are few, and the client drains them first
+#define kPriorityReportQueueEntryCount 1024
+
+// Shared by all the queues: the free list of a queue keeps the elements it used at hand, and the zones make the
+// elements of a queue that goes away (i.e., of a client that detached) available to the queues of the next clients
+static Zone s_payloadZone(kZoneReportPayload, sizeof(ElemPayload), alignof(ElemPayload));
+static Zone s_queueElemZone(kZoneReportQueueElem, sizeof(QueueElem), alignof(QueueElem));
+
+static ElemPayload* newPayload()             { return (ElemPayload *)s_payloadZone.allocate(sizeof(ElemPayload)); }
+static void deletePayload(ElemPayload *p)    { s_payloadZone.deallocate(p, sizeof(ElemPayload)); }
+
+static QueueElem* newQueueElem()             { return (QueueElem *)s_queueElemZone.allocate(sizeof(QueueElem)); }
+static void deleteQueueElem(QueueElem *e)    { s_queueElemZone.deallocate(e, sizeof(QueueElem)); }
+
+static uint s_backoffIntervalsMs[] = {1, 2, 4, 8, 16, 32, 64};
+static uint s_backoffIntervalsLen = sizeof(s_backoffIntervalsMs) / sizeof(s_backoffIntervalsMs[0]);
+
+static uint getBackoffIntervalMs(uint backoffCounter)
+{
+    return s_backoffIntervalsMs[backoffCounter < s_backoffIntervalsLen ? backoffCounter : s_backoffIntervalsLen - 1];
+}
+
 static ElemPayload* getValue(QueueElem *e)            { return (ElemPayload*)LFDS711_QUEUE_UMM_GET_VALUE_FROM_ELEMENT(*e); }
 static void setValue(QueueElem *e, ElemPayload *p)    { LFDS711_QUEUE_UMM_SET_VALUE_IN_ELEMENT(*e, p); }
 
@@ -22,8 +52,8 @@ static void setValue(FreeListElem *e, ElemPayload *p) { LFDS711_FREELIST_SET_VAL
 static void deallocateFreeListElem(FreeListElem *elem)
 {
     ElemPayload *payload = getValue(elem);
-    Alloc::Delete<QueueElem>(payload->queueElem, 1);
-    Alloc::Delete<ElemPayload>(payload, 1);
+    deleteQueueElem(payload->queueElem);
+    deletePayload(payload);
 }
 
 QueueElem* ConcurrentSharedDataQueue::allocateElem(const EnqueueArgs &args)
@@ -40,16 +70,16 @@ QueueElem* ConcurrentSharedDataQueue::allocateElem(const EnqueueArgs &args)
     else
     {
         reportCounters_->freeListNodeCount++;
-        payload = Alloc::New<ElemPayload>(1);
+        payload = newPayload();
         if (payload == nullptr)
         {
             return nullptr;
         }
 
-        payload->queueElem = Alloc::New<QueueElem>(1);
+        payload->queueElem = newQueueElem();
         if (payload->queueElem == nullptr)
         {
-            Alloc::Delete<ElemPayload>(payload, 1);
+            deletePayload(payload);
             return nullptr;
         }
 
@@ -62,6 +92,7 @@ QueueElem* ConcurrentSharedDataQueue::allocateElem(const EnqueueArgs &args)
     // set the actual payload bytes
     payload->report = args.report;
     payload->cacheRecord = args.cacheRecord;
+    payload->precedingPipReports = args.precedingPipReports;
     if (payload->cacheRecord)
     {
         payload->cacheRecord->retain();
@@ -108,6 +139,8 @@ bool ConcurrentSharedDataQueue::init(const InitArgs& args)
 
     drainingDone_                 = false;
     unrecoverableFailureOccurred_ = false;
+    stalled_                      = false;
+    numSentEntries_               = 0;
     reportCounters_               = args.counters;
     enableBatching_               = args.enableBatching;
 
@@ -123,6 +156,33 @@ bool ConcurrentSharedDataQueue::init(const InitArgs& args)
         return false;
     }
 
+    IOMemoryDescriptor *queueMemory = queue_->getMemoryDescriptor();
+    queueMap_ = queueMemory != nullptr ? queueMemory->map() : nullptr;
+    OSSafeReleaseNULL(queueMemory);
+    if (queueMap_ == nullptr)
+    {
+        return false;
+    }
+
+    priorityLock_ = BXLRecursiveLockAlloc();
+    if (priorityLock_ == nullptr)
+    {
+        return false;
+    }
+
+    priorityQueue_ = IOSharedDataQueue::withCapacity((kMaxPriorityReportQueueEntrySize + DATA_QUEUE_ENTRY_HEADER_SIZE) * kPriorityReportQueueEntryCount);
+    if (priorityQueue_ == nullptr)
+    {
+        return false;
+    }
+
+    stats_ =
+    {
+        .capacityBytes      = ((IODataQueueMemory *)queueMap_->getVirtualAddress())->queueSize,
+        .highWaterMarkBytes = 0,
+        .numStalls          = 0,
+    };
+
     freeList_ = Alloc::New<FreeList>(1);
     if (freeList_ == nullptr)
     {
@@ -135,7 +195,7 @@ bool ConcurrentSharedDataQueue::init(const InitArgs& args)
         return false;
     }
 
-    QueueElem *dummy = Alloc::New<QueueElem>(1); // this is dealocated in lfds711_queue_umm_cleanup()
+    QueueElem *dummy = newQueueElem(); // this is dealocated in lfds711_queue_umm_cleanup()
     if (dummy == nullptr)
     {
         return false;
@@ -183,7 +243,7 @@ void ConcurrentSharedDataQueue::free()
         while (lfds711_queue_umm_dequeue(pendingReports_, &e)) releaseElem(e);
         lfds711_queue_umm_cleanup(pendingReports_, [](Queue *q, QueueElem *e, lfds711_misc_flag flag)
                                   {
-                                      Alloc::Delete<QueueElem>(e, 1);
+                                      deleteQueueElem(e);
                                   });
 
         Alloc::Delete<Queue>(pendingReports_, 1);
@@ -215,8 +275,16 @@ void ConcurrentSharedDataQueue::free()
         lock_ = nullptr;
     }
 
+    if (priorityLock_ != nullptr)
+    {
+        BXLRecursiveLockFree(priorityLock_);
+        priorityLock_ = nullptr;
+    }
+
     OSSafeReleaseNULL(consumerThread_);
+    OSSafeReleaseNULL(queueMap_);
     OSSafeReleaseNULL(queue_);
+    OSSafeReleaseNULL(priorityQueue_);
 
     super::free();
 }
@@ -235,6 +303,9 @@ void ConcurrentSharedDataQueue::setNotificationPort(mach_port_t port)
     EnterMonitor
 
     queue_->setNotificationPort(port);
+
+    Monitor priorityMonitor(priorityLock_);
+    priorityQueue_->setNotificationPort(port);
 }
 
 IOMemoryDescriptor* ConcurrentSharedDataQueue::getMemoryDescriptor()
@@ -244,6 +315,13 @@ IOMemoryDescriptor* ConcurrentSharedDataQueue::getMemoryDescriptor()
     return queue_->getMemoryDescriptor();
 }
 
+IOMemoryDescriptor* ConcurrentSharedDataQueue::getPriorityMemoryDescriptor()
+{
+    Monitor priorityMonitor(priorityLock_);
+
+    return priorityQueue_->getMemoryDescriptor();
+}
+
 void ConcurrentSharedDataQueue::setClientAsyncFailureHandle(OSAsyncReference64 ref, OSObject* client)
 {
     EnterMonitor
@@ -260,24 +338,33 @@ IOReturn ConcurrentSharedDataQueue::InvokeAsyncFailureHandle(IOReturn status)
 {
     EnterMonitor
 
+#if !KEXT_BENCH
     if (asyncFailureHandle_ != nullptr)
     {
         BuildXLSandboxClient *client = OSDynamicCast(BuildXLSandboxClient, asyncFailureHandle_->userClient);
         return client->SendAsyncResult(asyncFailureHandle_->ref, status);
     }
+#endif
 
     return kIOReturnError;
 }
 
 bool ConcurrentSharedDataQueue::enqueueReport(const EnqueueArgs &args)
 {
+    CallbackLatencyScope latency(kLatencyReportEnqueue);
+
     if (unrecoverableFailureOccurred_)
     {
         return false;
     }
 
-    return enableBatching_
-        ? enqueueWithBatching(args)
+    if (enableBatching_)
+    {
+        return enqueueWithBatching(args);
+    }
+
+    return IsPriorityReport(args.report.operation)
+        ? sendPriorityReport(args.report, args.precedingPipReports)
         : enqueueWithLocking(args);
 }
 
@@ -288,15 +375,48 @@ bool ConcurrentSharedDataQueue::enqueueWithLocking(const EnqueueArgs &args)
     return sendReport(args.report);
 }
 
+bool ConcurrentSharedDataQueue::enqueueReports(const char *reports, uint32_t size, uint reportCount)
+{
+    CallbackLatencyScope latency(kLatencyReportEnqueue);
+
+    if (unrecoverableFailureOccurred_)
+    {
+        return false;
+    }
+
+    EnterMonitor
+
+    return sendEntry(reports, size, reportCount);
+}
+
 bool ConcurrentSharedDataQueue::sendReport(const AccessReport &report)
 {
-    bool sent = queue_->enqueue((void*)&report, sizeof(AccessReport));
+    uint32_t compactReportSize = CompactAccessReport(report, compactReport_);
+    return sendEntry(compactReport_, compactReportSize, 1);
+}
+
+bool ConcurrentSharedDataQueue::sendPriorityReport(const AccessReport &report, uint64_t precedingPipReports)
+{
+    Monitor priorityMonitor(priorityLock_);
+
+    PriorityReportHeader header =
+    {
+        .precedingPipReports = precedingPipReports,
+        .precedingEntries    = numSentEntries_,
+    };
+
+    memcpy(priorityEntry_, &header, sizeof(header));
+    uint32_t entrySize = (uint32_t)sizeof(header) + CompactAccessReport(report, priorityEntry_ + sizeof(header));
+
+    bool sent = priorityQueue_->enqueue((void *)priorityEntry_, entrySize);
     if (!sent)
     {
-        log_error("Could not send data to shared queue from TID(%lld)", thread_tid(current_thread()));
-        drainingDone_ = true;
-        unrecoverableFailureOccurred_ = true;
-        InvokeAsyncFailureHandle(kIOReturnNoMemory);
+        sent = waitAndResendEntry(priorityQueue_, priorityEntry_, entrySize);
+    }
+
+    if (!sent)
+    {
+        onSendFailed();
     }
     else
     {
@@ -306,10 +426,123 @@ bool ConcurrentSharedDataQueue::sendReport(const AccessReport &report)
     return sent;
 }
 
+void ConcurrentSharedDataQueue::onSendFailed()
+{
+    log_error("Could not send data to shared queue from TID(%lld)", thread_tid(current_thread()));
+    drainingDone_ = true;
+    unrecoverableFailureOccurred_ = true;
+    InvokeAsyncFailureHandle(kIOReturnNoMemory);
+}
+
+bool ConcurrentSharedDataQueue::sendEntry(const char *entry, uint32_t entrySize, uint reportCount)
+{
+    bool sent = queue_->enqueue((void *)entry, entrySize);
+    if (!sent)
+    {
+        sent = waitAndResendEntry(queue_, entry, entrySize);
+    }
+
+    if (!sent)
+    {
+        onSendFailed();
+    }
+    else
+    {
+        numSentEntries_++;
+        reportCounters_->totalNumSent += reportCount;
+        if (reportCount > 1)
+        {
+            reportCounters_->numMultiReportEntries++;
+        }
+
+        updateHighWaterMark();
+    }
+
+    return sent;
+}
+
+void ConcurrentSharedDataQueue::updateHighWaterMark()
+{
+    // The client moves 'head' as it dequeues, so this is a snapshot: it can only overestimate how much the client has yet to dequeue
+    const IODataQueueMemory *memory = (const IODataQueueMemory *)queueMap_->getVirtualAddress();
+    UInt32 head = memory->head;
+    UInt32 tail = memory->tail;
+    uint32_t fillBytes = tail >= head ? tail - head : stats_.capacityBytes - head + tail;
+
+    if (fillBytes > stats_.highWaterMarkBytes)
+    {
+        stats_.highWaterMarkBytes = fillBytes;
+
+        uint32_t fillKB = fillBytes / 1024;
+        if (fillKB > reportCounters_->reportQueueHighWaterMarkKB)
+        {
+            reportCounters_->reportQueueHighWaterMarkKB = fillKB;
+        }
+    }
+}
+
+ConcurrentSharedDataQueue::QueueStats ConcurrentSharedDataQueue::getStats()
+{
+    EnterMonitor
+
+    return stats_;
+}
+
+bool ConcurrentSharedDataQueue::waitAndResendEntry(IOSharedDataQueue *queue, const char *entry, uint32_t entrySize)
+{
+    // Only a full shared IO queue throttles producers (and tells how big the queues of the next clients should be)
+    bool isReportQueue = queue == queue_;
+
+    Stopwatch stopwatch;
+    reportCounters_->numReportQueueStalls++;
+    if (isReportQueue)
+    {
+        stats_.numStalls++;
+        stalled_ = true;
+    }
+
+    bool sent = false;
+    uint stallMs = 0;
+    for (uint backoffCounter = 0; !sent && !drainingDone_ && stallMs < kReportQueueMaxStallMs; ++backoffCounter)
+    {
+        uint backoffMs = getBackoffIntervalMs(backoffCounter);
+        IOSleep(/*milliseconds*/ backoffMs);
+        stallMs += backoffMs;
+        sent = queue->enqueue((void *)entry, entrySize);
+    }
+
+    if (isReportQueue)
+    {
+        stalled_ = false;
+    }
+
+    reportCounters_->reportQueueStallTime += stopwatch.lap();
+    return sent;
+}
+
+void ConcurrentSharedDataQueue::waitWhileStalled()
+{
+    if (!stalled_)
+    {
+        return;
+    }
+
+    Stopwatch stopwatch;
+    for (uint backoffCounter = 0; stalled_ && !unrecoverableFailureOccurred_; ++backoffCounter)
+    {
+        IOSleep(/*milliseconds*/ getBackoffIntervalMs(backoffCounter));
+    }
+
+    reportCounters_->reportQueueStallTime += stopwatch.lap();
+}
+
 bool ConcurrentSharedDataQueue::enqueueWithBatching(const EnqueueArgs &args)
 {
     LFDS711_MISC_MAKE_VALID_ON_CURRENT_LOGICAL_CORE_INITS_COMPLETED_BEFORE_NOW_ON_ANY_OTHER_LOGICAL_CORE;
 
+    // Throttle the producer rather than queuing up reports the client can't keep up with
+    waitWhileStalled();
+
     QueueElem *elem = allocateElem(args);
     if (elem == nullptr)
     {
@@ -322,9 +555,6 @@ bool ConcurrentSharedDataQueue::enqueueWithBatching(const EnqueueArgs &args)
     return true;
 }
 
-static uint s_backoffIntervalsMs[] = {1, 2, 4, 8, 16, 32, 64};
-static uint s_backoffIntervalsLen = sizeof(s_backoffIntervalsMs) / sizeof(s_backoffIntervalsMs[0]);
-
 void ConcurrentSharedDataQueue::drainQueue()
 {
     if (!enableBatching_)
@@ -340,8 +570,7 @@ void ConcurrentSharedDataQueue::drainQueue()
         QueueElem *elem;
         if (!lfds711_queue_umm_dequeue(pendingReports_, &elem) || elem == nullptr)
         {
-            uint backoffIndex = backoffCounter < s_backoffIntervalsLen ? backoffCounter : s_backoffIntervalsLen - 1;
-            IOSleep(/*milliseconds*/ s_backoffIntervalsMs[backoffIndex]);
+            IOSleep(/*milliseconds*/ getBackoffIntervalMs(backoffCounter));
             ++backoffCounter;
             continue;
         }
@@ -350,16 +579,20 @@ void ConcurrentSharedDataQueue::drainQueue()
         reportCounters_->numQueued--;
         ElemPayload *payload = getValue(elem);
 
-        if (payload->cacheRecord == nullptr)
+        if (payload->cacheRecord != nullptr &&
+            payload->cacheRecord->HasStrongerRequestedAccess((RequestedAccess)payload->report.requestedAccess))
         {
-            sendReport(payload->report);
+            reportCounters_->numCoalescedReports++;
         }
-        else if (payload->cacheRecord->HasStrongerRequestedAccess((RequestedAccess)payload->report.requestedAccess))
+        else if (IsPriorityReport(payload->report.operation))
         {
-            reportCounters_->numCoalescedReports++;
+            // Sent once the reports enqueued before it were, so it counts them among the entries the client must dequeue first
+            sendPriorityReport(payload->report, payload->precedingPipReports);
         }
         else
         {
+            // Coalesced reports are enqueued to the shared IO queue by other threads (see 'enqueueReports')
+            EnterMonitor
             sendReport(payload->report);
         }
 
@@ -8,6 +8,7 @@
 #include <IOKit/IOSharedDataQueue.h>
 #include <IOKit/OSMessageNotification.h>
 #include "BuildXLSandboxShared.hpp"
+#include "CacheRecord.hpp"
 #include "Thread.hpp"
 
 extern "C" {
@@ -50,6 +51,9 @@ public:
 
         /*! May be NULL */
         const CacheRecord *cacheRecord;
+
+        /*! For priority reports (see IsPriorityReport): the reports of the same pip enqueued before this one */
+        uint64_t precedingPipReports;
     } EnqueueArgs;
 
     typedef struct {
@@ -57,16 +61,51 @@ public:
         FreeListElem freeListElem;
         AccessReport report;
         const CacheRecord *cacheRecord;
+        uint64_t precedingPipReports;
     } ElemPayload;
 
+    /*! How full the shared IO queue got, i.e., how far behind its client fell */
+    typedef struct {
+        uint32_t capacityBytes;
+        uint32_t highWaterMarkBytes;
+        uint32_t numStalls;
+    } QueueStats;
+
 private:
 
     /*! Backing queue */
     IOSharedDataQueue *queue_;
 
+    /*! Kernel mapping of the memory of 'queue_', from which its fill level is read */
+    IOMemoryMap *queueMap_;
+
+    /*! Fill level statistics of 'queue_', only updated in the critical section */
+    QueueStats stats_;
+
     /*! Recursive lock used for synchronization */
     BXLRecursiveLock *lock_;
 
+    /*!
+     * Queue of the process lifecycle reports (see PriorityReportHeader), which the client drains before 'queue_'.
+     * It has a lock of its own, so these reports are not held up by a producer waiting for room in 'queue_'.
+     */
+    IOSharedDataQueue *priorityQueue_;
+
+    /*! Lock guarding 'priorityQueue_' and 'priorityEntry_' */
+    BXLRecursiveLock *priorityLock_;
+
+    /*! Where priority reports are laid out before being enqueued to 'priorityQueue_' */
+    char priorityEntry_[kMaxPriorityReportQueueEntrySize];
+
+    /*! Number of entries enqueued to 'queue_' so far, only updated in the critical section */
+    volatile uint64_t numSentEntries_;
+
+    /*!
+     * Where reports are compacted before being enqueued to the shared IO queue (see CompactAccessReport).
+     * Reports are only ever sent in the critical section, so a single buffer is enough.
+     */
+    char compactReport_[kCompactAccessReportMaxSize];
+
     /*! A pointer to an async failure handle */
     ClientAsyncHandle *asyncFailureHandle_;
 
@@ -117,13 +156,28 @@ private:
 
     /*!
      * Indicates if an unrecoverable error has occured. This happens when the sandbox was not able to successfully
-     * enqueue an access report message. There is no logic to recover from this and mostly indicates that either a)
-     * the report queue size is to small for the amount of transfered reports or b) the number of connections to the
-     * sandbox kernel connection and with it the number of threads draining the report queues in user space are not
-     * sufficient. After this occures, the extension has to be reloaded!
+     * enqueue an access report message, even after waiting for the client to make room in the shared IO queue for
+     * kReportQueueMaxStallMs. It mostly indicates that either a) the report queue size is to small for the amount of
+     * transfered reports or b) the client stopped draining its report queue. After this occures, the extension has to be reloaded!
      */
     volatile bool unrecoverableFailureOccurred_;
 
+    /*!
+     * Set while a report is waiting for the client to make room in the shared IO queue.  When batching is enabled,
+     * producers wait as well while this is set, instead of growing 'pendingReports_' without bounds.
+     */
+    volatile bool stalled_;
+
+    /*!
+     * Called when the shared IO queue is full: keeps trying to enqueue the entry, backing off, until the client
+     * makes room for it or kReportQueueMaxStallMs have elapsed.  This blocks the producer, throttling the
+     * processes whose accesses are reported down to the pace of the client.
+     */
+    bool waitAndResendEntry(IOSharedDataQueue *queue, const char *entry, uint32_t entrySize);
+
+    /*! Blocks the calling producer while the shared IO queue is stalled (see 'stalled_'). */
+    void waitWhileStalled();
+
     QueueElem* allocateElem(const EnqueueArgs &args);
     void releaseElem(QueueElem *elem);
 
@@ -141,6 +195,25 @@ private:
      */
     bool sendReport(const AccessReport &report);
 
+    /*!
+     * Enters the priority lock and enqueues 'report' to the priority queue, preceded by the number of reports of its pip
+     * ('precedingPipReports') and of entries of the shared IO queue that must be dequeued first.
+     */
+    bool sendPriorityReport(const AccessReport &report, uint64_t precedingPipReports);
+
+    /*! Handles a failure to enqueue to a shared IO queue, which can't be recovered from */
+    void onSendFailed();
+
+    /*!
+     * Enqueues an entry made of 'reportCount' compact reports to the shared IO queue.
+     *
+     * IMPORTANT: same as 'sendReport', synchronization is the responsibility of the callers.
+     */
+    bool sendEntry(const char *entry, uint32_t entrySize, uint reportCount);
+
+    /*! Records the current fill level of the shared IO queue in 'stats_' if it is the highest so far. Must be called in the critical section. */
+    void updateHighWaterMark();
+
     /*!
      * Initializes this object, following the OSObject pattern.
      *
@@ -157,16 +230,32 @@ public:
 
     /*!
      * Enters monitor then delegates to IOSharedDataQueue::enqueue.
+     *
+     * Priority reports (see IsPriorityReport) go to the priority queue instead, in order with the reports enqueued before them when
+     * batching is enabled.
      */
     bool enqueueReport(const EnqueueArgs &args);
 
+    /*!
+     * Enters monitor then enqueues 'reports', which holds the compact forms of 'reportCount' reports
+     * (see CompactAccessReport) one after the other, as a single entry of the shared IO queue.
+     *
+     * The entry is enqueued right away, even when batching is enabled: the reports were already held back by their sender.
+     */
+    bool enqueueReports(const char *reports, uint32_t size, uint reportCount);
+
     /*!
      * Returns the number of currently enqueued elements.
      */
     long long getCount() const;
 
     /*!
-     * Enters monitor then delegates to IOSharedDataQueue::setNotificationPort
+     * Enters monitor then returns the fill level statistics of the shared IO queue.
+     */
+    QueueStats getStats();
+
+    /*!
+     * Enters monitor then delegates to IOSharedDataQueue::setNotificationPort, for both the shared IO queue and the priority queue
      */
     void setNotificationPort(mach_port_t port);
 
@@ -175,6 +264,11 @@ public:
      */
     IOMemoryDescriptor *getMemoryDescriptor();
 
+    /*!
+     * Enters the priority lock then delegates to IOSharedDataQueue::getMemoryDescriptor of the priority queue
+     */
+    IOMemoryDescriptor *getPriorityMemoryDescriptor();
+
     /*!
      * Enters monitor then tries to set an async failure handle for the client owning the queue
      */
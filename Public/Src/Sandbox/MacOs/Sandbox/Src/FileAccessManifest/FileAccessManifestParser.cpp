@@ -115,7 +115,7 @@ const char *CheckValidUnixManifestTreeRoot(PCManifestRecord node)
     return nullptr;
 }
 
-bool FileAccessManifestParseResult::init(const BYTE *payload, size_t payloadSize)
+bool FileAccessManifestParseResult::init(const BYTE *payload, size_t payloadSize, PCManifestRecord sharedRoot)
 {
     if (payloadSize == 0 || payload == nullptr) return true;
 
@@ -188,7 +188,18 @@ bool FileAccessManifestParseResult::init(const BYTE *payload, size_t payloadSize
             }
         }
 
-        root_ = Parse<PCManifestRecord>(payloadCursor);
+        // CODESYNC: FileAccessManifest.cs :: WriteKnownReparsePointsBlock
+        knownReparsePoints_ = ParseAndAdvancePointer<PCManifestKnownReparsePoints>(payloadCursor);
+        if (HasErrors()) continue;
+        knownReparsePointEntries_ = payloadCursor;
+        for (uint32_t i = 0; i < knownReparsePoints_->Count; i++)
+        {
+            ParseUint32(payloadCursor);        // kind
+            SkipOverCharArray(payloadCursor);  // path
+            SkipOverCharArray(payloadCursor);  // target
+        }
+
+        root_ = sharedRoot != nullptr ? sharedRoot : Parse<PCManifestRecord>(payloadCursor);
         error_ = root_->CheckValid();
         if (HasErrors()) continue;
 
@@ -22,6 +22,8 @@ private:
     PCManifestReport report_;
     PCManifestDllBlock dllBlock_;
     PCManifestSubstituteProcessExecutionShim shim_;
+    PCManifestKnownReparsePoints knownReparsePoints_ = nullptr;
+    const BYTE *knownReparsePointEntries_ = nullptr;
     PCManifestRecord root_;
     const char *error_;
 
@@ -39,11 +41,39 @@ private:
         return result;
     }
 
+    // Reads a string written by FileAccessManifest.WriteChars into 'buffer' (the characters are expected to be ASCII).
+    // Returns false, but still moves past the string, if it doesn't fit.
+    static bool ReadUtf16String(const BYTE *&cursor, char *buffer, size_t bufferSize)
+    {
+        uint32_t length = *(const uint32_t *)cursor;
+        cursor += sizeof(uint32_t);
+        const BYTE *chars = cursor;
+        cursor += sizeof(char16_t) * length;
+        if (length >= bufferSize)
+        {
+            return false;
+        }
+
+        for (uint32_t i = 0; i < length; i++)
+        {
+            buffer[i] = static_cast<char>(chars[i * sizeof(char16_t)]);
+        }
+
+        buffer[length] = '\0';
+        return true;
+    }
+
 public:
 
     FileAccessManifestParseResult() {}
 
-    bool init(const BYTE *payload, size_t payloadSize);
+    /*!
+     * Parses the manifest 'payload' holds.
+     *
+     * When 'sharedRoot' is given, 'payload' only holds what precedes the manifest tree (which comes last in a manifest),
+     * and the tree is the one starting at 'sharedRoot' (trees only hold offsets relative to their own records).
+     */
+    bool init(const BYTE *payload, size_t payloadSize, PCManifestRecord sharedRoot = nullptr);
 
     inline bool IsValid() const                                   { return error_ == nullptr; }
     inline bool HasErrors() const                                 { return !IsValid(); }
@@ -62,6 +92,28 @@ public:
     inline const char* GetProcessPath(int *length) const { return GetReportsPath(length); }
     inline const char* GetInternalDetoursErrorNotificationFile() const { return internalDetoursErrorNotificationFile_; }
 
+    /*!
+     * Calls 'callback(kind, path, target)' for every reparse point known to the build, and every path known to be free of them
+     * (with KnownReparsePointKind_None and an empty target). Entries that don't fit in PATH_MAX are skipped.
+     */
+    template <class TCallback> void ForEachKnownReparsePoint(TCallback callback) const
+    {
+        const BYTE *cursor = knownReparsePointEntries_;
+        char path[PATH_MAX];
+        char target[PATH_MAX];
+        for (uint32_t i = 0; knownReparsePoints_ != nullptr && i < knownReparsePoints_->Count; i++)
+        {
+            KnownReparsePointKind kind = static_cast<KnownReparsePointKind>(*(const uint32_t *)cursor);
+            cursor += sizeof(uint32_t);
+            bool fits = ReadUtf16String(cursor, path, PATH_MAX);
+            fits &= ReadUtf16String(cursor, target, PATH_MAX);
+            if (fits && path[0] != '\0')
+            {
+                callback(kind, path, target);
+            }
+        }
+    }
+
     // Debugging helper
     static void PrintManifestTree(PCManifestRecord node, const int indent = 0, const int index = 0);
 };
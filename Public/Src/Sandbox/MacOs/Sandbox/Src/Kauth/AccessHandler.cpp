@@ -157,7 +157,11 @@ void AccessHandler::LogAccessDenied(const char *path,
 
 PolicyResult AccessHandler::PolicyForPath(const char *absolutePath)
 {
-    PolicySearchCursor cursor = FindManifestRecord(absolutePath);
+    return PolicyForPath(absolutePath, FindManifestRecord(absolutePath));
+}
+
+PolicyResult AccessHandler::PolicyForPath(const char *absolutePath, PolicySearchCursor cursor)
+{
     if (!cursor.IsValid())
     {
         log_error("Invalid policy cursor for path '%s'", absolutePath);
@@ -224,6 +228,21 @@ static bool VNodeMatchesPath(vnode_t vp, vfs_context_t ctx, const char *path)
     return result;
 }
 
+bool AccessHandler::LastLookedUpPathMatches(vnode_t vp, vfs_context_t ctx, const char *lastLookupPath)
+{
+    // the checks that follow a lookup mostly hit the same vnode: only the first one looks the path up
+    bool matches;
+    if (GetPip()->getLastLookedUpVnodeMatch(vp, &matches))
+    {
+        sandbox_->Counters()->numHardLinkLookupsSkipped++;
+        return matches;
+    }
+
+    matches = VNodeMatchesPath(vp, ctx, lastLookupPath);
+    GetPip()->setLastLookedUpVnodeMatch(vp, matches);
+    return matches;
+}
+
 const char* AccessHandler::IgnoreCatalinaDataPartitionPrefix(const char* path)
 {
     if (!sandbox_->GetConfig().enableCatalinaDataPartitionFiltering)
@@ -256,10 +275,11 @@ bool AccessHandler::CheckAccess(vnode_t vp,
         notAllowed &&                                               // access is denied for current policy
         (lastLookupPath = GetPip()->getLastLookedUpPath()) &&       // we remembered a path that was last looked up
         strncmp(lastLookupPath, policy->Path(), MAXPATHLEN) != 0 && // that path is different from the policy path
-        VNodeMatchesPath(vp, ctx, lastLookupPath))                  // both paths point to the same vnode
+        LastLookedUpPathMatches(vp, ctx, lastLookupPath))           // both paths point to the same vnode
     {
         // update policy and check again
         sandbox_->Counters()->numHardLinkRetries++;
+        GetPip()->Counters()->numHardLinkRetries++;
 
         *policy = PolicyForPath(IgnoreCatalinaDataPartitionPrefix(lastLookupPath));
         checker(*policy, isDir, result);
@@ -280,12 +300,59 @@ AccessCheckResult AccessHandler::CheckAndReportInternal(FileOperation operation,
 {    
     Stopwatch stopwatch;
 
+    size_t pathLength = strnlen(path, MAXPATHLEN);
+    bool checksVnode = vp != nullptr && ctx != nullptr;
+    bool isDirChecked = checksVnode ? vnode_isdir(vp) : isDir;
+
+    // 0: the listeners triggered by one access mostly check the same path one after the other (see 'LastCheck')
+    LastCheck *lastCheck = (LastCheck *)GetPip()->getLastCheckBuffer(sizeof(LastCheck));
+    bool isLastCheckedPath =
+        lastCheck != nullptr &&
+        lastCheck->pathLength == pathLength &&
+        memcmp(lastCheck->path, path, pathLength) == 0;
+
+    if (isLastCheckedPath &&
+        lastCheck->isResultReusable &&
+        lastCheck->checker == checker &&
+        lastCheck->isDir == isDirChecked)
+    {
+        AccessCheckResult lastResult(lastCheck->resultAccess, lastCheck->resultAction, lastCheck->resultLevel, lastCheck->resultValidity);
+
+        // a reported access was recorded in the cache, so it would be a cache hit (unless caching got disabled since)
+        if (!lastResult.ShouldReport() || !GetPip()->isCachingDisabled())
+        {
+            sandbox_->Counters()->numRepeatedChecksSkipped++;
+            GetPip()->Counters()->numRepeatedChecksSkipped++;
+            if (lastResult.ShouldReport())
+            {
+                GetPip()->Counters()->numCacheHits++;
+            }
+
+            return lastResult;
+        }
+    }
+
     // 1: check operation against given policy
-    PolicyResult policy = PolicyForPath(IgnoreCatalinaDataPartitionPrefix(path));
+    const char *policyPath = IgnoreCatalinaDataPartitionPrefix(path);
+    PolicySearchCursor cursor;
+    if (isLastCheckedPath)
+    {
+        cursor                    = PolicySearchCursor(lastCheck->cursorRecord);
+        cursor.Level              = lastCheck->cursorLevel;
+        cursor.SearchWasTruncated = lastCheck->cursorSearchWasTruncated;
+    }
+    else
+    {
+        cursor = FindManifestRecord(policyPath);
+    }
+
+    PolicyResult policy = PolicyForPath(policyPath, cursor);
     AccessCheckResult result = AccessCheckResult::Invalid();
-    if (vp != nullptr && ctx != nullptr)
+    bool policyUpdated = false;
+    if (checksVnode)
     {
-        CheckAccess(vp, ctx, checker, &policy, &result);
+        // a result obtained with the policy of the last looked up path depends on more than 'path', so it is not reused
+        policyUpdated = CheckAccess(vp, ctx, checker, &policy, &result);
     }
     else
     {
@@ -295,7 +362,35 @@ AccessCheckResult AccessHandler::CheckAndReportInternal(FileOperation operation,
     Timespan checkPolicyDuration       = stopwatch.lap();
     GetPip()->Counters()->checkPolicy += checkPolicyDuration;
     sandbox_->Counters()->checkPolicy += checkPolicyDuration;
-    
+
+    // the record is filled before the access is reported, so the cache lookup below decides whether the result can be reused
+    bool canRecord = lastCheck != nullptr && cursor.IsValid() && pathLength > 0 && pathLength < MAXPATHLEN;
+    bool isAllowed = !policyUpdated && result.GetFileAccessStatus() == FileAccessStatus_Allowed;
+    if (canRecord)
+    {
+        if (!isLastCheckedPath)
+        {
+            memcpy(lastCheck->path, path, pathLength);
+            lastCheck->path[pathLength]         = '\0';
+            lastCheck->pathLength               = pathLength;
+            lastCheck->cursorRecord             = cursor.Record;
+            lastCheck->cursorLevel              = cursor.Level;
+            lastCheck->cursorSearchWasTruncated = cursor.SearchWasTruncated;
+        }
+
+        lastCheck->checker          = checker;
+        lastCheck->isDir            = isDirChecked;
+        lastCheck->isResultReusable = isAllowed && !result.ShouldReport();
+        lastCheck->resultAccess     = result.Access;
+        lastCheck->resultAction     = result.Result;
+        lastCheck->resultLevel      = result.Level;
+        lastCheck->resultValidity   = result.Validity;
+    }
+    else if (lastCheck != nullptr)
+    {
+        lastCheck->pathLength = 0;
+    }
+
     // 2: skip if this access should not be reported
     if (!result.ShouldReport())
     {
@@ -306,6 +401,11 @@ AccessCheckResult AccessHandler::CheckAndReportInternal(FileOperation operation,
     CacheRecord *cacheRecord = GetPip()->cacheLookup(path);
     bool cacheHit = cacheRecord != nullptr && cacheRecord->CheckAndUpdate(&result);
 
+    if (canRecord)
+    {
+        lastCheck->isResultReusable = isAllowed && cacheRecord != nullptr;
+    }
+
     Timespan cacheLookupDuration       = stopwatch.lap();
     sandbox_->Counters()->cacheLookup += cacheLookupDuration;
     GetPip()->Counters()->cacheLookup += cacheLookupDuration;
@@ -46,6 +46,34 @@ private:
         }
     }
 
+    /*!
+     * What a thread last checked in 'CheckAndReportInternal', kept in a buffer of the pip owned by that thread (see 'SandboxedPip::getLastCheckBuffer').
+     *
+     * A single access usually triggers several listeners one after the other on the same thread (opening a file triggers both the vnode and
+     * the fileop listeners, for instance), and they all check the same path.  Remembering the last check spares the later ones the manifest
+     * search, and, when they make the same check, the cache lookup too.  The policy of a path and the result of a check against it only depend
+     * on the path, so the record is only ever replaced, never invalidated.
+     */
+    typedef struct {
+        /*! Manifest search cursor for 'path' */
+        const ManifestRecord *cursorRecord;
+        size_t cursorLevel;
+        bool cursorSearchWasTruncated;
+
+        /*! The check last made against 'path', and whether it was allowed and either not to be reported or recorded in the cache */
+        CheckFunc checker;
+        bool isDir;
+        bool isResultReusable;
+        RequestedAccess resultAccess;
+        ResultAction resultAction;
+        ReportLevel resultLevel;
+        PathValidity resultValidity;
+
+        /*! Length of 'path' (0 while nothing was checked) */
+        size_t pathLength;
+        char path[MAXPATHLEN];
+    } LastCheck;
+
     const char *IgnoreCatalinaDataPartitionPrefix(const char* path);
     const char *kCatalinaDataPartitionPrefix = "/System/Volumes/Data/";
     const size_t kAdjustedCatalinaPrefixLength = strlen("/System/Volumes/Data");
@@ -88,6 +116,12 @@ protected:
      */
     bool CheckAccess(vnode_t vp, vfs_context_t ctx, CheckFunc checker, PolicyResult *policy, AccessCheckResult *result);
 
+    /*!
+     * Whether 'lastLookupPath', the last path looked up by the current thread, resolves to vnode 'vp'.
+     * The answer is remembered along with the path, so the path is only looked up again once the thread looks up another one.
+     */
+    bool LastLookedUpPathMatches(vnode_t vp, vfs_context_t ctx, const char *lastLookupPath);
+
     /*!
      * Template for checking and reporting file accesses.
      *
@@ -165,6 +199,9 @@ public:
 
     PolicyResult PolicyForPath(const char *absolutePath);
 
+    /*! The policy for 'absolutePath', whose manifest record 'cursor' points to (see 'FindManifestRecord') */
+    PolicyResult PolicyForPath(const char *absolutePath, PolicySearchCursor cursor);
+
     bool ReportProcessTreeCompleted();
     bool ReportProcessExited(pid_t childPid);
     bool ReportChildProcessSpawned(pid_t childPid);
@@ -16,6 +16,12 @@ int FileOpHandler::HandleFileOpEvent(const kauth_cred_t credential,
     vfs_context_t ctx = vfs_context_create(nullptr);
     vnode_t vp = nullptr;
 
+    if (action == KAUTH_FILEOP_RENAME || action == KAUTH_FILEOP_LINK || action == KAUTH_FILEOP_EXCHANGE)
+    {
+        // paths of the vnodes checked so far may have changed
+        GetPip()->invalidateVNodeCache();
+    }
+
     switch (action)
     {
         case KAUTH_FILEOP_RENAME:
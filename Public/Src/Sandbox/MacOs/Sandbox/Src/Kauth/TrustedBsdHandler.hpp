@@ -13,6 +13,9 @@ public:
     TrustedBsdHandler(BuildXLSandbox *sandbox)
         : AccessHandler(sandbox) { }
 
+    /*! The pip of the tracked process (must only be called after having successfully initialized this handler) */
+    SandboxedPip* GetTrackedPip() const { return GetPip(); }
+
     int HandleLookup(const char *path);
 
     int HandleReadVnode(vnode_t vnode, FileOperation operationToReport, bool isVnodeDir);
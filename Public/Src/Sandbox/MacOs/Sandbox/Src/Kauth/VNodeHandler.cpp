@@ -124,8 +124,9 @@ bool ConstructVNodeActionString(kauth_action_t action,
     return true;
 }
 
-static kauth_action_t KAUTH_VNODE_PROBE_FLAGS = KAUTH_VNODE_READ_ATTRIBUTES | KAUTH_VNODE_READ_EXTATTRIBUTES | KAUTH_VNODE_READ_SECURITY;
+static constexpr kauth_action_t KAUTH_VNODE_PROBE_FLAGS = KAUTH_VNODE_READ_ATTRIBUTES | KAUTH_VNODE_READ_EXTATTRIBUTES | KAUTH_VNODE_READ_SECURITY;
 
+// The order of 's_handlers' and 's_handlerFlags' must match
 static FlagsToCheckFunc s_handlers[]
 {
     {
@@ -150,7 +151,46 @@ static FlagsToCheckFunc s_handlers[]
     }
 };
 
-static int s_handlersCount = sizeof(s_handlers)/sizeof(s_handlers[0]);
+static constexpr kauth_action_t s_handlerFlags[]
+{
+    KAUTH_VNODE_PROBE_FLAGS,
+    KAUTH_VNODE_EXECUTE,
+    KAUTH_VNODE_READ_DATA,
+    KAUTH_VNODE_GENERIC_WRITE_BITS
+};
+
+static constexpr int s_handlersCount = sizeof(s_handlerFlags)/sizeof(s_handlerFlags[0]);
+static_assert(sizeof(s_handlers)/sizeof(s_handlers[0]) == s_handlersCount, "every handler must have its flags in s_handlerFlags");
+
+// All the flags any handler applies to are below this bit
+static constexpr int kActionIndexBits = 14;
+static_assert(((KAUTH_VNODE_PROBE_FLAGS | KAUTH_VNODE_EXECUTE | KAUTH_VNODE_READ_DATA | KAUTH_VNODE_GENERIC_WRITE_BITS) >> kActionIndexBits) == 0,
+              "handler flags must fit in the action dispatch table index");
+
+/**
+ * Maps the low 'kActionIndexBits' bits of an action to the set of handlers that apply to it (bit i set means
+ * s_handlers[i] applies), so that an event only costs one lookup to find its checks.  Computed at compile time.
+ */
+struct ActionDispatchTable
+{
+    uint8_t handlers[1 << kActionIndexBits];
+
+    constexpr ActionDispatchTable() : handlers()
+    {
+        for (int action = 0; action < (1 << kActionIndexBits); action++)
+        {
+            for (int i = 0; i < s_handlersCount; i++)
+            {
+                if ((action & s_handlerFlags[i]) != 0)
+                {
+                    handlers[action] |= (uint8_t)(1 << i);
+                }
+            }
+        }
+    }
+};
+
+static constexpr ActionDispatchTable s_actionDispatchTable;
 
 int VNodeHandler::HandleVNodeEvent(const kauth_cred_t credential,
                                    const void *idata,
@@ -160,6 +200,21 @@ int VNodeHandler::HandleVNodeEvent(const kauth_cred_t credential,
                                    const vnode_t dvp,
                                    const uintptr_t arg3)
 {
+    uint8_t handlers = s_actionDispatchTable.handlers[action & ((1 << kActionIndexBits) - 1)];
+    if (handlers == 0)
+    {
+        // no check applies to this action
+        return KAUTH_RESULT_DEFER;
+    }
+
+    // the same actions on the same vnode are checked (and reported) the same way every time
+    int vnodeCacheGeneration = GetPip()->getVNodeCacheGeneration();
+    if (GetPip()->vnodeCacheLookup(vp, action))
+    {
+        GetPip()->Counters()->numCacheHits++;
+        return KAUTH_RESULT_DEFER;
+    }
+
     int len = MAXPATHLEN;
     char path[MAXPATHLEN] = {0};
 
@@ -172,10 +227,10 @@ int VNodeHandler::HandleVNodeEvent(const kauth_cred_t credential,
     bool shouldDeny = false;
 
     // even after the first match we have to continue looping because multiple flags can be set in a single action
-    for (int i = 0; i < s_handlersCount; i++)
+    for (int i = 0; handlers != 0; i++, handlers >>= 1)
     {
         // skip over handlers that don't apply
-        if (!HasAnyFlags(action, s_handlers[i].flags))
+        if ((handlers & 1) == 0)
         {
             continue;
         }
@@ -194,6 +249,7 @@ int VNodeHandler::HandleVNodeEvent(const kauth_cred_t credential,
     }
     else
     {
+        GetPip()->vnodeCacheUpdate(vp, action, vnodeCacheGeneration);
         return KAUTH_RESULT_DEFER;
     }
 }
@@ -4,6 +4,7 @@
 #include "Listeners.hpp"
 #include "FileOpHandler.hpp"
 #include "SandboxedPip.hpp"
+#include "Stopwatch.hpp"
 #include "TrustedBsdHandler.hpp"
 #include "VNodeHandler.hpp"
 
@@ -15,8 +16,14 @@ int RELEVANT_KAUTH_VNODE_BITS =
 #pragma mark Scope FileOperation Callbacks
 
 void *Listeners::g_dispatcher = nullptr;
+volatile SInt32 Listeners::g_renameGeneration = 0;
 
-static int ComputeAbsolutePath(struct vnode *vp, const char *const relPath, size_t relPathLen, char *resultBuf, int resultBufLen)
+/*!
+ * When 'pip' is provided, the absolute path of 'vp' is looked up in its directory path cache first (and cached when missing),
+ * so that computing the paths of several entries of the same directory only calls vn_getpath once.
+ */
+static int ComputeAbsolutePath(struct vnode *vp, const char *const relPath, size_t relPathLen, char *resultBuf, int resultBufLen,
+                               SandboxedPip *pip = nullptr)
 {
     assert(vp != nullptr);
     assert(relPath != nullptr);
@@ -25,11 +32,23 @@ static int ComputeAbsolutePath(struct vnode *vp, const char *const relPath, size
     assert(resultBufLen > 0);
 
     // compute full path by getting the absolute path of 'vp' and appending the relative path 'relPath'
+    // the generation must be read before the path is computed, so that a concurrent rename makes the cached path stale
+    int generation = Listeners::g_renameGeneration;
+
     int len = resultBufLen;
     int err = 0;
-    if ((err = vn_getpath(vp, resultBuf, &len)) != 0)
+    if (pip == nullptr || !pip->dirPathCacheLookup(vp, generation, resultBuf, &len))
     {
-        return err;
+        len = resultBufLen;
+        if ((err = vn_getpath(vp, resultBuf, &len)) != 0)
+        {
+            return err;
+        }
+
+        if (pip != nullptr)
+        {
+            pip->dirPathCacheUpdate(vp, generation, resultBuf, len);
+        }
     }
 
     if (relPathLen > 0)
@@ -64,8 +83,15 @@ int Listeners::buildxl_file_op_listener(kauth_cred_t credential,
                                        uintptr_t arg2,
                                        uintptr_t arg3)
 {
+    CallbackLatencyScope latency(kLatencyFileOpListener);
+
     BuildXLSandbox *sandbox = OSDynamicCast(BuildXLSandbox, reinterpret_cast<OSObject *>(idata));
 
+    if (action == KAUTH_FILEOP_RENAME || action == KAUTH_FILEOP_EXCHANGE)
+    {
+        OSIncrementAtomic(&g_renameGeneration);
+    }
+
     FileOpHandler fileOpHandler = FileOpHandler(sandbox);
     if (!fileOpHandler.TryInitializeWithTrackedProcess(proc_selfpid()))
     {
@@ -85,6 +111,8 @@ int Listeners::buildxl_vnode_listener(kauth_cred_t credential,
                                      uintptr_t arg2,
                                      uintptr_t arg3)
 {
+    CallbackLatencyScope latency(kLatencyVNodeListener);
+
     /**
      * Skip processing event if:
      * (1) KAUTH_VNODE_ACCESS bit is set (request is advisory rather than authoritative)
@@ -118,6 +146,8 @@ int Listeners::mpo_vnode_check_lookup_pre(kauth_cred_t cred,
                                           // this is supposed to be pathlen, but it appears to be wrong, so don't use
                                           size_t _)
 {
+    CallbackLatencyScope latency(kLatencyVNodeCheckLookupPre);
+
     do
     {
         TrustedBsdHandler handler = TrustedBsdHandler((BuildXLSandbox*)g_dispatcher);
@@ -128,7 +158,7 @@ int Listeners::mpo_vnode_check_lookup_pre(kauth_cred_t cred,
 
         size_t pathlen = strnlen(path, MAXPATHLEN);
         char fullpath[MAXPATHLEN] = {0};
-        int errorCode = ComputeAbsolutePath(dvp, path, pathlen, fullpath, sizeof(fullpath));
+        int errorCode = ComputeAbsolutePath(dvp, path, pathlen, fullpath, sizeof(fullpath), handler.GetTrackedPip());
         if (errorCode != 0)
         {
             log_error("Could not get vnode path, error code: %#X", errorCode);
@@ -143,6 +173,8 @@ int Listeners::mpo_vnode_check_lookup_pre(kauth_cred_t cred,
 
 int Listeners::mpo_vnode_check_readlink(kauth_cred_t cred, struct vnode *vp, struct label *label)
 {
+    CallbackLatencyScope latency(kLatencyVNodeCheckReadlink);
+
     TrustedBsdHandler handler = TrustedBsdHandler((BuildXLSandbox*)g_dispatcher);
     if (!handler.TryInitializeWithTrackedProcess(proc_selfpid()))
     {
@@ -176,12 +208,16 @@ int Listeners::mpo_vnode_check_exec(kauth_cred_t cred,
                                     void *macpolicyattr,
                                     size_t macpolicyattrlen)
 {
+    CallbackLatencyScope latency(kLatencyVNodeCheckExec);
+
     handle_exec(proc_selfpid(), vp);
     return KERN_SUCCESS;
 }
 
 void Listeners::mpo_proc_notify_exit(proc_t proc)
 {
+    CallbackLatencyScope latency(kLatencyProcNotifyExit);
+
     pid_t pid = proc_pid(proc);
     TrustedBsdHandler handler = TrustedBsdHandler((BuildXLSandbox*)g_dispatcher);
     if (handler.TryInitializeWithTrackedProcess(pid))
@@ -204,6 +240,8 @@ int Listeners::mpo_cred_label_update_execve(kauth_cred_t old_cred,
                                             size_t macpolicyattrlen,
                                             int *disjointp)
 {
+    CallbackLatencyScope latency(kLatencyCredLabelUpdateExecve);
+
     // this 'mpo_cred_label_update_execve' handler can be called both upon 'vfork' and upon 'exec',
     // which is why which we have to handle both 'fork' and 'exec' here. 
     mpo_cred_label_associate_fork(old_cred, p);
@@ -213,6 +251,8 @@ int Listeners::mpo_cred_label_update_execve(kauth_cred_t old_cred,
 
 int Listeners::mpo_proc_check_fork(kauth_cred_t cred, struct proc *proc)
 {
+    CallbackLatencyScope latency(kLatencyProcCheckFork);
+
     pid_t pid = proc_selfpid();
     TrustedBsdHandler handler = TrustedBsdHandler((BuildXLSandbox*)g_dispatcher);
     if (handler.TryInitializeWithTrackedProcess(pid))
@@ -226,6 +266,8 @@ int Listeners::mpo_proc_check_fork(kauth_cred_t cred, struct proc *proc)
 
 void Listeners::mpo_cred_label_associate_fork(kauth_cred_t cred, proc_t proc)
 {
+    CallbackLatencyScope latency(kLatencyCredLabelAssociateFork);
+
     TrustedBsdHandler handler = TrustedBsdHandler((BuildXLSandbox*)g_dispatcher);
     if (handler.TryInitializeWithTrackedProcess(proc_ppid(proc)))
     {
@@ -240,12 +282,14 @@ int Listeners::mpo_vnode_check_create(kauth_cred_t cred,
                                       struct componentname *cnp,
                                       struct vnode_attr *vap)
 {
+    CallbackLatencyScope latency(kLatencyVNodeCheckCreate);
+
     TrustedBsdHandler handler = TrustedBsdHandler((BuildXLSandbox*)g_dispatcher);
     if (handler.TryInitializeWithTrackedProcess(proc_selfpid()))
     {
         // compute full path by getting the absolute path of 'dvp' and appending the component name provided by 'cnp'
         char path[MAXPATHLEN] = {0};
-        ComputeAbsolutePath(dvp, cnp->cn_nameptr, cnp->cn_namelen, path, sizeof(path));
+        ComputeAbsolutePath(dvp, cnp->cn_nameptr, cnp->cn_namelen, path, sizeof(path), handler.GetTrackedPip());
         bool isDir = vap->va_type == VDIR;
         bool isSymlink = vap->va_type == VLNK;
         return handler.HandleVNodeCreateEvent(path, isDir, isSymlink);
@@ -259,6 +303,8 @@ int Listeners::mpo_vnode_check_write(kauth_cred_t active_cred,
                                      struct vnode *vp,
                                      struct label *label)
 {
+    CallbackLatencyScope latency(kLatencyVNodeCheckWrite);
+
     TrustedBsdHandler handler = TrustedBsdHandler((BuildXLSandbox*)g_dispatcher);
     if (!handler.TryInitializeWithTrackedProcess(proc_selfpid()))
     {
@@ -276,6 +322,8 @@ int Listeners::mpo_vnode_check_clone(kauth_cred_t cred,
                                      struct label *label,
                                      struct componentname *cnp)
 {
+    CallbackLatencyScope latency(kLatencyVNodeCheckClone);
+
     TrustedBsdHandler handler = TrustedBsdHandler((BuildXLSandbox*)g_dispatcher);
     if (!handler.TryInitializeWithTrackedProcess(proc_selfpid()))
     {
@@ -26,6 +26,10 @@ public:
     // a member function pointer poses more challenges and unreadable syntax so we go with a direct void pointer instead!
     static void *g_dispatcher;
 
+    // Incremented whenever a file or directory is renamed (by any process), which may change the paths of directory vnodes:
+    // the directory paths cached by pips under a previous value are not used (see SandboxedPip::dirPathCacheLookup)
+    static volatile SInt32 g_renameGeneration;
+
     static int buildxl_file_op_listener(kauth_cred_t credential,
                                        void *idata,
                                        kauth_action_t action,
@@ -2,6 +2,7 @@
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
 #include "ResourceManager.hpp"
+#include "Stopwatch.hpp"
 
 #define super OSObject
 
@@ -37,6 +38,11 @@ bool ResourceManager::init(ResourceCounters *counters)
 
     counters_ = counters;
 
+    smoothedCpuUsage_ = {0};
+    isCpuUsageHigh_   = false;
+    nextTicket_       = 0;
+    servedTicket_     = 0;
+
     procBarrier_ = BXLLockAlloc();
     if (procBarrier_ == nullptr)
     {
@@ -68,16 +74,11 @@ static bool isBelowThreshold(basis_points value, percent threshold)
     return value.value < threshold.value * 100;
 }
 
-static bool shouldThrottle(basis_points value, percent threshold)
-{
-    return isThresholdValid(threshold) && !isBelowThreshold(value, threshold);
-}
-
 inline bool ResourceManager::shouldThrottleProcesses() const
 {
     return
         counters_->availableRamMB < thresholds_.minAvailableRamMB ||
-        shouldThrottle(counters_->cpuUsage, thresholds_.cpuUsageBlock);
+        isCpuUsageHigh_;
 }
 
 inline bool ResourceManager::IsProcessThrottlingEnabled() const
@@ -93,17 +94,38 @@ void ResourceManager::UpdateNumTrackedProcesses(uint newCount)
     OSCompareAndSwap(oldCount, newCount, &counters_->numTrackedProcesses);
     if (newCount < oldCount)
     {
-        wakeupBlockedProcesses(/* justOne */ newCount == oldCount - 1);
+        wakeupBlockedProcesses();
     }
 }
 
+// Weight of the previous average when a new CPU usage sample comes in (the new sample gets the remaining weight)
+#define kCpuUsageSmoothingWeightPct 50
+
 void ResourceManager::UpdateCpuUsage(basis_points cpuUsage)
 {
     basis_points oldCpuUsage = counters_->cpuUsage;
     OSCompareAndSwap(oldCpuUsage.value, cpuUsage.value, &counters_->cpuUsage.value);
-    if (isBelowThreshold(cpuUsage, thresholds_.GetCpuUsageForWakeup()))
+
+    // single spikes or drops alone should not flip the throttling decision
+    smoothedCpuUsage_.value =
+        (smoothedCpuUsage_.value * kCpuUsageSmoothingWeightPct + cpuUsage.value * (100 - kCpuUsageSmoothingWeightPct)) / 100;
+
+    if (!isThresholdValid(thresholds_.cpuUsageBlock))
+    {
+        isCpuUsageHigh_ = false;
+    }
+    else if (isCpuUsageHigh_)
     {
-        wakeupBlockedProcesses(/* justOne */ true);
+        isCpuUsageHigh_ = !isBelowThreshold(smoothedCpuUsage_, thresholds_.GetCpuUsageForWakeup());
+    }
+    else
+    {
+        isCpuUsageHigh_ = !isBelowThreshold(smoothedCpuUsage_, thresholds_.cpuUsageBlock);
+    }
+
+    if (!isCpuUsageHigh_)
+    {
+        wakeupBlockedProcesses();
     }
 }
 
@@ -113,7 +135,7 @@ void ResourceManager::UpdateAvailableRam(uint availableRamMB)
     OSCompareAndSwap(oldRam, availableRamMB, &counters_->availableRamMB);
     if (availableRamMB > oldRam)
     {
-        wakeupBlockedProcesses(/* justOne */ true);
+        wakeupBlockedProcesses();
     }
 }
 
@@ -124,23 +146,32 @@ void ResourceManager::WaitForCpu()
         return;
     }
     
-    if (shouldThrottleProcesses())
+    if (shouldThrottleProcesses() || counters_->numBlockedProcesses > 0)
     {
+        Stopwatch stopwatch;
+
         BXLLockLock(procBarrier_);
-        while (shouldThrottleProcesses())
+        uint ticket = nextTicket_++;
+        OSIncrementAtomic(&counters_->numBlockedProcesses);
+        while (shouldThrottleProcesses() || ticket != servedTicket_)
         {
-            OSIncrementAtomic(&counters_->numBlockedProcesses);
             BXLLockSleep(procBarrier_, this, THREAD_INTERRUPTIBLE);
-            OSDecrementAtomic(&counters_->numBlockedProcesses);
         }
+        servedTicket_++;
+        OSDecrementAtomic(&counters_->numBlockedProcesses);
         BXLLockUnlock(procBarrier_);
+
+        // let the holder of the next ticket check whether it may go too
+        wakeupBlockedProcesses();
+
+        counters_->forkWaitTime += stopwatch.lap();
     }
 }
 
-void ResourceManager::wakeupBlockedProcesses(bool justOne)
+void ResourceManager::wakeupBlockedProcesses()
 {
     if (procBarrier_ != nullptr && counters_->numBlockedProcesses > 0 && !shouldThrottleProcesses())
     {
-        BXLLockWakeup(procBarrier_, this, justOne);
+        BXLLockWakeup(procBarrier_, this, /*oneThread*/ false);
     }
 }
@@ -28,6 +28,22 @@ private:
     BXLLock *procBarrier_;
     ResourceThresholds thresholds_;
 
+    /*! Exponentially weighted moving average of the CPU usage samples received so far */
+    basis_points smoothedCpuUsage_;
+
+    /*!
+     * Whether CPU usage is considered too high.  Set when the smoothed CPU usage reaches the blocking
+     * threshold and cleared only once it drops below the wakeup threshold.
+     */
+    bool isCpuUsageHigh_;
+
+    /*!
+     * Blocked processes are let through in the order in which they arrived: each takes the next ticket
+     * and waits until its ticket is served (and throttling is over).  Protected by 'procBarrier_'.
+     */
+    uint nextTicket_;
+    uint servedTicket_;
+
     /*!
      * Shared counters (with all other clients) for counting the number of active/pending/blocked processes.
      *
@@ -36,17 +52,15 @@ private:
     ResourceCounters *counters_;
 
     /*!
-     * Wakes up one or more blocked processes if the throttling condition
-     * (see 'shouldThrottleProcesses') is not met any longer.
-     *
-     * @param justOne Whether to wake up one or all blocked processes.
+     * Wakes up all blocked processes if the throttling condition (see 'shouldThrottleProcesses') is not
+     * met any longer.  All of them must be woken up because only the one holding the next ticket may proceed.
      */
-    void wakeupBlockedProcesses(bool justOne);
+    void wakeupBlockedProcesses();
 
     /*!
      * Returns whether the condition for throttling processes is met, which is:
-     *   - current CPU usage is greater or equal than the cpu usage threshold, AND
-     *   - current number of tracked processes is greater or equal than the tracked processes threshold.
+     *   - current available RAM is below the min available RAM threshold, OR
+     *   - CPU usage is considered too high (see 'isCpuUsageHigh_').
      */
     bool shouldThrottleProcesses() const;
 
@@ -88,7 +102,8 @@ public:
     void UpdateAvailableRam(uint availableRamMB);
 
     /*!
-     * Blocks the current thread if 'IsProcessThrottlingEnabled()' and 'ShouldThrottleProcesses()' are both true.
+     * Blocks the current thread if 'IsProcessThrottlingEnabled()' and 'ShouldThrottleProcesses()' are both true,
+     * or if other threads are already blocked (so that threads are let through in the order in which they came).
      *
      * The blocked thread will be awakened whenever that condition changes.
      *
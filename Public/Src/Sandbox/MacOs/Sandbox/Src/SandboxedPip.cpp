@@ -1,6 +1,10 @@
 // Copyright (c) Microsoft. All rights reserved.
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
+#include <kern/clock.h>
+#include "Alloc.hpp"
+#include "AutoRelease.hpp"
+#include "Monitor.hpp"
 #include "SandboxedPip.hpp"
 
 #define super OSObject
@@ -16,12 +20,37 @@ bool SandboxedPip::init(pid_t clientPid, pid_t processPid, Buffer *payload)
 
     clientPid_        = clientPid;
     payload_          = payload;
+    manifestTree_     = nullptr;
     processId_        = processPid;
     processTreeCount_ = 1;
+    numQueuedReports_ = 0;
     counters_         = {0};
     disableCaching_   = !g_bxl_enable_cache;
     cacheCallCnt_     = 0;
 
+    vnodeCacheGeneration_ = 0;
+    bzero(vnodeCache_, sizeof(vnodeCache_));
+    bzero(dirPathCache_, sizeof(dirPathCache_));
+
+    coalescedReports_     = nullptr;
+    coalescedReportsSize_ = 0;
+    numCoalescedReports_  = 0;
+    coalescingWindowMs_   = 0;
+    coalescingTimer_      = nullptr;
+
+    bzero(processPool_, sizeof(processPool_));
+    processPoolSize_      = 0;
+    numPooledProcesses_   = 0;
+    processPoolCursor_    = 0;
+    processRecordFactory_ = nullptr;
+    processPoolRefill_    = nullptr;
+
+    lock_ = BXLRecursiveLockAlloc();
+    if (lock_ == nullptr)
+    {
+        return false;
+    }
+
     payload_->retain();
 
     fam_.init((BYTE*)payload_->getBytes(), payload_->getSize());
@@ -43,6 +72,12 @@ bool SandboxedPip::init(pid_t clientPid, pid_t processPid, Buffer *payload)
     {
         return false;
     }
+
+    lastCheck_ = ThreadLocal::create();
+    if (!lastCheck_)
+    {
+        return false;
+    }
     
     return true;
 }
@@ -58,8 +93,48 @@ void SandboxedPip::free()
             pathCache_->getCount(), lastPathLookup_->getCount());
     }
 
+    if (coalescingTimer_ != nullptr)
+    {
+        // The timer doesn't retain this object, so wait for it to finish in case it is just firing
+        thread_call_cancel_wait(coalescingTimer_);
+        thread_call_free(coalescingTimer_);
+        coalescingTimer_ = nullptr;
+    }
+
+    if (processPoolRefill_ != nullptr)
+    {
+        // Like the coalescing timer, the refill doesn't retain this object
+        thread_call_cancel_wait(processPoolRefill_);
+        thread_call_free(processPoolRefill_);
+        processPoolRefill_ = nullptr;
+    }
+
+    for (uint i = 0; i < processPoolSize_; i++)
+    {
+        OSSafeReleaseNULL(processPool_[i]);
+    }
+
+    if (coalescedReports_ != nullptr)
+    {
+        if (numCoalescedReports_ > 0)
+        {
+            log_error("Dropping %d coalesced reports of PID(%d)", numCoalescedReports_, processId_);
+        }
+
+        Alloc::Delete<char>(coalescedReports_, kMaxReportQueueEntrySize);
+        coalescedReports_ = nullptr;
+    }
+
+    if (lock_ != nullptr)
+    {
+        BXLRecursiveLockFree(lock_);
+        lock_ = nullptr;
+    }
+
     OSSafeReleaseNULL(payload_);
+    OSSafeReleaseNULL(manifestTree_);
     OSSafeReleaseNULL(lastPathLookup_);
+    OSSafeReleaseNULL(lastCheck_);
     OSSafeReleaseNULL(pathCache_);
     OSSafeReleaseNULL(oldPathCache_);
     super::free();
@@ -85,6 +160,49 @@ SandboxedPip* SandboxedPip::create(pid_t clientPid, pid_t processPid, Buffer *pa
     return instance;
 }
 
+bool SandboxedPip::shareManifestTree(ManifestTreeSharer sharer, void *sharerContext)
+{
+    // The manifest tree comes last in a manifest
+    const BYTE *payload = (const BYTE *)payload_->getBytes();
+    size_t treeOffset   = (const BYTE *)fam_.GetManifestRootNode() - payload;
+    size_t treeSize     = payload_->getSize() - treeOffset;
+
+    Buffer *tree = sharer(sharerContext, payload + treeOffset, treeSize);
+    AutoRelease _t(tree);
+    if (tree == nullptr)
+    {
+        return false;
+    }
+
+    // Only keep what precedes the tree (which is what is specific to this pip, like its id)
+    Buffer *header = Buffer::create(treeOffset);
+    AutoRelease _h(header);
+    if (header == nullptr)
+    {
+        return false;
+    }
+
+    memcpy(header->getBytes(), payload, treeOffset);
+
+    FileAccessManifestParseResult fam;
+    if (!fam.init((const BYTE *)header->getBytes(), treeOffset, (PCManifestRecord)tree->getBytes()))
+    {
+        log_error("Could not parse shared FileAccessManifest: %s", fam.Error());
+        return false;
+    }
+
+    header->retain();
+    tree->retain();
+
+    OSSafeReleaseNULL(payload_);
+    OSSafeReleaseNULL(manifestTree_);
+    payload_      = header;
+    manifestTree_ = tree;
+    fam_          = fam;
+
+    return true;
+}
+
 PipInfo SandboxedPip::introspect()
 {
     return
@@ -100,6 +218,165 @@ PipInfo SandboxedPip::introspect()
     };
 }
 
+bool SandboxedPip::enableReportCoalescing(uint windowMs, CoalescedReportsSender sender, void *senderContext)
+{
+    coalescingTimer_ = thread_call_allocate(OnCoalescingWindowExpired, this);
+    if (coalescingTimer_ == nullptr)
+    {
+        return false;
+    }
+
+    coalescedReports_ = Alloc::New<char>(kMaxReportQueueEntrySize);
+    if (coalescedReports_ == nullptr)
+    {
+        return false;
+    }
+
+    coalescingWindowMs_            = windowMs;
+    coalescedReportsSender_        = sender;
+    coalescedReportsSenderContext_ = senderContext;
+    return true;
+}
+
+bool SandboxedPip::coalesceReport(const AccessReport &report, bool flush)
+{
+    EnterMonitor
+
+    bool success = true;
+    if (coalescedReportsSize_ + kCompactAccessReportMaxSize > kMaxReportQueueEntrySize)
+    {
+        success = flushCoalescedReportsLocked();
+    }
+
+    bool wasEmpty = numCoalescedReports_ == 0;
+    coalescedReportsSize_ += CompactAccessReport(report, coalescedReports_ + coalescedReportsSize_);
+    numCoalescedReports_++;
+
+    if (flush)
+    {
+        success = flushCoalescedReportsLocked() && success;
+    }
+    else if (wasEmpty)
+    {
+        uint64_t deadline;
+        clock_interval_to_deadline(coalescingWindowMs_, kMillisecondScale, &deadline);
+        thread_call_enter_delayed(coalescingTimer_, deadline);
+    }
+
+    return success;
+}
+
+bool SandboxedPip::flushCoalescedReports()
+{
+    EnterMonitor
+
+    return flushCoalescedReportsLocked();
+}
+
+bool SandboxedPip::flushCoalescedReportsLocked()
+{
+    if (numCoalescedReports_ == 0)
+    {
+        return true;
+    }
+
+    bool success = coalescedReportsSender_(coalescedReportsSenderContext_, this, coalescedReports_, coalescedReportsSize_, numCoalescedReports_);
+
+    // the timer may still be pending when the reports are flushed before their window expires
+    thread_call_cancel(coalescingTimer_);
+
+    coalescedReportsSize_ = 0;
+    numCoalescedReports_  = 0;
+    return success;
+}
+
+void SandboxedPip::OnCoalescingWindowExpired(thread_call_param_t pip, thread_call_param_t)
+{
+    ((SandboxedPip *)pip)->flushCoalescedReports();
+}
+
+bool SandboxedPip::enableProcessPool(uint size, ProcessRecordFactory factory)
+{
+    if (size == 0)
+    {
+        return true;
+    }
+
+    processPoolRefill_ = thread_call_allocate(OnProcessPoolLow, this);
+    if (processPoolRefill_ == nullptr)
+    {
+        return false;
+    }
+
+    processPoolSize_      = min(size, kMaxProcessPoolSize);
+    processRecordFactory_ = factory;
+
+    // the root process is about to start: fill the pool before it forks
+    thread_call_enter(processPoolRefill_);
+    return true;
+}
+
+OSObject* SandboxedPip::takePooledProcess()
+{
+    if (processPoolSize_ == 0)
+    {
+        return nullptr;
+    }
+
+    OSObject *record = nullptr;
+    UInt32 start = (UInt32)OSIncrementAtomic(&processPoolCursor_);
+    for (uint i = 0; i < processPoolSize_ && record == nullptr; i++)
+    {
+        OSObject **slot = &processPool_[(start + i) % processPoolSize_];
+        OSObject *candidate = *slot;
+        if (candidate != nullptr && OSCompareAndSwapPtr(candidate, nullptr, slot))
+        {
+            record = candidate;
+        }
+    }
+
+    // OSDecrementAtomic returns the count before decrementing it
+    if (record == nullptr || OSDecrementAtomic(&numPooledProcesses_) <= (SInt32)processPoolSize_ / 2 + 1)
+    {
+        thread_call_enter(processPoolRefill_);
+    }
+
+    return record;
+}
+
+void SandboxedPip::refillProcessPool()
+{
+    for (uint i = 0; i < processPoolSize_; i++)
+    {
+        if (processPool_[i] != nullptr)
+        {
+            continue;
+        }
+
+        OSObject *record = processRecordFactory_();
+        if (record == nullptr)
+        {
+            log_error("Could not refill the process pool of PID(%d)", processId_);
+            return;
+        }
+
+        // the refill may run on several threads at once when it is entered while running
+        if (OSCompareAndSwapPtr(nullptr, record, &processPool_[i]))
+        {
+            OSIncrementAtomic(&numPooledProcesses_);
+        }
+        else
+        {
+            OSSafeReleaseNULL(record);
+        }
+    }
+}
+
+void SandboxedPip::OnProcessPoolLow(thread_call_param_t pip, thread_call_param_t)
+{
+    ((SandboxedPip *)pip)->refillProcessPool();
+}
+
 bool SandboxedPip::RefreshDisableCaching()
 {
     if (!disableCaching_)
@@ -127,15 +404,170 @@ bool SandboxedPip::RefreshDisableCaching()
     return disableCaching_;
 }
 
+static inline VNodeCacheEntry* VNodeCacheEntryFor(VNodeCacheEntry *cache, vnode_t vp)
+{
+    // vnodes are allocated from a zone, so the lowest bits of their addresses carry little information
+    return &cache[((uintptr_t)vp >> 8) % kVNodeCacheSize];
+}
+
+static inline DirPathCacheEntry* DirPathCacheEntryFor(DirPathCacheEntry *cache, vnode_t vp)
+{
+    return &cache[((uintptr_t)vp >> 8) % kDirPathCacheSize];
+}
+
+bool SandboxedPip::vnodeCacheLookup(vnode_t vp, kauth_action_t action)
+{
+    if (!g_bxl_enable_vnode_cache || disableCaching_)
+    {
+        return false;
+    }
+
+    VNodeCacheEntry *entry = VNodeCacheEntryFor(vnodeCache_, vp);
+    UInt32 seq = entry->seq;
+    if (seq & 1)
+    {
+        // being updated
+        return false;
+    }
+
+    OSMemoryBarrier();
+    bool hit =
+        entry->vp == vp &&
+        entry->vid == vnode_vid(vp) &&
+        entry->generation == vnodeCacheGeneration_ &&
+        (action & ~entry->actions) == 0;
+    OSMemoryBarrier();
+
+    // the entry must not have changed while it was being read
+    return hit && entry->seq == seq;
+}
+
+void SandboxedPip::vnodeCacheUpdate(vnode_t vp, kauth_action_t action, int generation)
+{
+    if (!g_bxl_enable_vnode_cache || disableCaching_ || generation != vnodeCacheGeneration_)
+    {
+        return;
+    }
+
+    VNodeCacheEntry *entry = VNodeCacheEntryFor(vnodeCache_, vp);
+    UInt32 seq = entry->seq;
+    if ((seq & 1) || !OSCompareAndSwap(seq, seq + 1, &entry->seq))
+    {
+        // someone else is updating this entry --> don't bother
+        return;
+    }
+
+    uint32_t vid = vnode_vid(vp);
+    if (entry->vp == vp && entry->vid == vid && entry->generation == generation)
+    {
+        entry->actions |= action;
+    }
+    else
+    {
+        entry->vp         = vp;
+        entry->vid        = vid;
+        entry->generation = generation;
+        entry->actions    = action;
+    }
+
+    OSMemoryBarrier();
+    entry->seq = seq + 2;
+}
+
+bool SandboxedPip::dirPathCacheLookup(vnode_t dvp, int generation, char *buffer, int *length)
+{
+    if (!g_bxl_enable_vnode_cache)
+    {
+        return false;
+    }
+
+    DirPathCacheEntry *entry = DirPathCacheEntryFor(dirPathCache_, dvp);
+    UInt32 seq = entry->seq;
+    if (seq & 1)
+    {
+        // being updated
+        return false;
+    }
+
+    OSMemoryBarrier();
+    int pathLength = entry->length;
+    bool hit =
+        entry->vp == dvp &&
+        entry->vid == vnode_vid(dvp) &&
+        entry->generation == generation &&
+        pathLength > 0 && pathLength <= *length;
+
+    if (hit)
+    {
+        memcpy(buffer, entry->path, pathLength);
+    }
+    OSMemoryBarrier();
+
+    // the entry must not have changed while it was being read (the copied path may be torn otherwise)
+    if (!hit || entry->seq != seq)
+    {
+        return false;
+    }
+
+    *length = pathLength;
+    return true;
+}
+
+void SandboxedPip::dirPathCacheUpdate(vnode_t dvp, int generation, const char *path, int length)
+{
+    if (!g_bxl_enable_vnode_cache || length <= 0 || length > MAXPATHLEN)
+    {
+        return;
+    }
+
+    DirPathCacheEntry *entry = DirPathCacheEntryFor(dirPathCache_, dvp);
+    UInt32 seq = entry->seq;
+    if ((seq & 1) || !OSCompareAndSwap(seq, seq + 1, &entry->seq))
+    {
+        // someone else is updating this entry --> don't bother
+        return;
+    }
+
+    entry->vp         = dvp;
+    entry->vid        = vnode_vid(dvp);
+    entry->generation = generation;
+    entry->length     = length;
+    memcpy(entry->path, path, length);
+
+    OSMemoryBarrier();
+    entry->seq = seq + 2;
+}
+
 # define PCT(a, b) (int)(((a) * 1.0) / ((a) + (b)) * 100)
 
 inline bool SandboxedPip::ShouldDisableCaching()
 {
     return
-        // above the min_entries threshold
-        pathCache_->getCount() > g_bxl_disable_cache_min_entries &&
-        // below the max_hit_pct threshold
-        PCT(counters_.numCacheHits, counters_.numCacheMisses) < g_bxl_disable_cache_max_hit_pct;
+        (
+            // above the min_entries threshold
+            pathCache_->getCount() > g_bxl_disable_cache_min_entries &&
+            // below the max_hit_pct threshold
+            PCT(counters_.numCacheHits, counters_.numCacheMisses) < g_bxl_disable_cache_max_hit_pct
+        ) ||
+        // above the memory budget
+        IsPathCacheOverBudget();
+}
+
+inline bool SandboxedPip::IsPathCacheOverBudget()
+{
+    if (g_bxl_disable_cache_max_kb <= 0)
+    {
+        return false;
+    }
+
+    uint64_t cacheSize = pathCache_->getNodesMemorySize() + (uint64_t)pathCache_->getCount() * sizeof(CacheRecord);
+    if (cacheSize <= (uint64_t)g_bxl_disable_cache_max_kb * 1024)
+    {
+        return false;
+    }
+
+    log_verbose(g_bxl_verbose_logging, "Disabling caching for PID(%d): its cache occupies %lluKB", processId_, cacheSize / 1024);
+    return true;
 }
 
 #undef super
@@ -7,10 +7,13 @@
 #include <IOKit/IOLib.h>
 #include <IOKit/IOService.h>
 #include <IOKit/IOSharedDataQueue.h>
+#include <kern/thread_call.h>
+#include <sys/kauth.h>
 #include <sys/proc.h>
 #include <sys/vnode.h>
 
 #include "AutoIncDec.hpp"
+#include "BXLLocks.hpp"
 #include "BuildXLSandboxShared.hpp"
 #include "CacheRecord.hpp"
 #include "FileAccessManifestParser.hpp"
@@ -21,6 +24,61 @@
 
 #define SandboxedPip BXL_CLASS(SandboxedPip)
 
+#define kVNodeCacheSize 64
+#define kDirPathCacheSize 8
+#define kMaxProcessPoolSize 64
+
+/*!
+ * Remembers the KAUTH vnode actions that were already checked (and allowed) for a vnode.
+ *
+ * A vnode is identified by its pointer together with its vid, which changes every time the vnode is recycled.
+ * Entries are written under a sequence number that is odd while the entry is being updated, so that readers
+ * never lock and simply treat an entry that changed under them as a miss.
+ */
+typedef struct {
+    volatile UInt32 seq;
+    int generation;
+    vnode_t vp;
+    uint32_t vid;
+    kauth_action_t actions;
+} VNodeCacheEntry;
+
+/*!
+ * Remembers the absolute path of a directory vnode another path was recently looked up in.
+ *
+ * Like for 'VNodeCacheEntry', a vnode is identified by its pointer together with its vid, and entries are
+ * written under a sequence number so that readers never lock.
+ */
+typedef struct {
+    volatile UInt32 seq;
+    int generation;
+    vnode_t vp;
+    uint32_t vid;
+
+    /*! Length of 'path' including its terminating null character (same as the length returned by vn_getpath) */
+    int length;
+    char path[MAXPATHLEN];
+} DirPathCacheEntry;
+
+class SandboxedPip;
+
+/*!
+ * Sends the coalesced reports of a pip ('reports' holds 'reportCount' compact reports, one after the other) to its client.
+ */
+typedef bool (*CoalescedReportsSender)(void *context, SandboxedPip *pip, const char *reports, uint32_t size, uint reportCount);
+
+/*!
+ * Returns a buffer holding the same 'size' bytes as 'tree' (a file access manifest tree), possibly shared with other pips.
+ * The caller is responsible for releasing the returned buffer.
+ */
+typedef Buffer* (*ManifestTreeSharer)(void *context, const BYTE *tree, size_t size);
+
+/*!
+ * Creates a process record for the process pool of a pip (see 'SandboxedPip::enableProcessPool').
+ * The record must not retain any pip.  The caller is responsible for releasing the returned object.
+ */
+typedef OSObject* (*ProcessRecordFactory)();
+
 /*!
  * Represents the root of the process tree being tracked.
  *
@@ -43,15 +101,21 @@ private:
     /*! Process id of the root process of this pip. */
     pid_t processId_;
 
-    /*! File access manifest payload bytes */
+    /*! File access manifest payload bytes (only the ones preceding the manifest tree once 'manifestTree_' is set) */
     Buffer *payload_;
 
-    /*! File access manifest (contains pointers into the 'payload_' byte array */
+    /*! Manifest tree bytes, shared with the other pips whose manifests have the same tree (see 'shareManifestTree') */
+    Buffer *manifestTree_;
+
+    /*! File access manifest (contains pointers into the 'payload_' and 'manifestTree_' byte arrays */
     FileAccessManifestParseResult fam_;
 
     /*! Number of processses in this pip's process tree */
     int processTreeCount_;
 
+    /*! Number of reports of this pip enqueued to the report queue of its client so far (priority reports excluded) */
+    volatile SInt64 numQueuedReports_;
+
     /*!
      * Maps every accessed path to a 'CacheRecord' object (which contains caching information regarding that path).
      * IMPORTANT: increment/decrement cacheCallCnt_ around every use.
@@ -70,12 +134,100 @@ private:
      */
     bool disableCaching_;
 
+    /*! Direct-mapped cache of the vnode actions checked so far, which spares path construction for repeated actions. */
+    VNodeCacheEntry vnodeCache_[kVNodeCacheSize];
+
+    /*! Direct-mapped cache of the paths of the directory vnodes looked up in, which spares vn_getpath for lookups in the same directory. */
+    DirPathCacheEntry dirPathCache_[kDirPathCacheSize];
+
+    /*!
+     * Entries of 'vnodeCache_' created before this was last incremented are ignored.
+     * Incremented whenever a path may start designating a different vnode (a rename, for example).
+     */
+    int vnodeCacheGeneration_;
+
     /*! A thread-local storage for remembering the last looked up path by every thread. */
     ThreadLocal *lastPathLookup_;
 
+    /*!
+     * What a thread last looked up, kept in 'lastPathLookup_' as an OSData holding this header followed by the looked up path (0-terminated).
+     * Only the thread owning a record ever reads or updates it, so it is updated in place.
+     *
+     * The header remembers the vnode the path was last compared to, so that the vnode checks following a lookup (e.g., open, then read)
+     * don't look the path up again to tell if it is a hard link to the vnode being checked. The vnode is not retained: its vid tells it
+     * apart from a recycled one.
+     */
+    typedef struct {
+        vnode_t checkedVnode;
+        uint32_t checkedVid;
+        bool matches;
+    } LookupRecord;
+
+    LookupRecord* getLookupRecord() const
+    {
+        OSData *record = OSDynamicCast(OSData, lastPathLookup_->get());
+        return record != nullptr ? (LookupRecord *)record->getBytesNoCopy() : nullptr;
+    }
+
+    /*! A thread-local storage for what every thread last checked (see 'getLastCheckBuffer'). */
+    ThreadLocal *lastCheck_;
+
     /*! Various counters.  IMPORTANT: counters may be globally disabled so no logic may rely on their values. */
     AllCounters counters_;
 
+    /*! Guards the coalesced reports */
+    BXLRecursiveLock *lock_;
+
+    /*!
+     * When report coalescing is enabled (see 'enableReportCoalescing'), the compact forms of the reports of this pip
+     * accumulate here, and are sent to the client together, as one entry of its report queue.
+     */
+    char *coalescedReports_;
+
+    /*! Size of the reports held by 'coalescedReports_' */
+    uint32_t coalescedReportsSize_;
+
+    /*! Number of reports held by 'coalescedReports_' */
+    uint numCoalescedReports_;
+
+    /*! How long reports may be held in 'coalescedReports_' */
+    uint coalescingWindowMs_;
+
+    /*! Flushes 'coalescedReports_' once the coalescing window of the oldest report held there expires */
+    thread_call_t coalescingTimer_;
+
+    CoalescedReportsSender coalescedReportsSender_;
+    void *coalescedReportsSenderContext_;
+
+    /*! Sends the coalesced reports, if any. Must be called in the critical section. */
+    bool flushCoalescedReportsLocked();
+
+    static void OnCoalescingWindowExpired(thread_call_param_t pip, thread_call_param_t);
+
+    /*!
+     * Process records preallocated for the children of this pip, so that tracking a forked process doesn't allocate
+     * (see 'takePooledProcess').  Slots are emptied and refilled with compare-and-swap, so forking never locks.
+     */
+    OSObject *processPool_[kMaxProcessPoolSize];
+
+    /*! Number of slots of 'processPool_' in use (0 when the process pool is disabled) */
+    uint processPoolSize_;
+
+    /*! Number of records currently held by 'processPool_' */
+    volatile SInt32 numPooledProcesses_;
+
+    /*! Where the next 'takePooledProcess' starts looking, so that concurrent forks don't race for the same slot */
+    volatile SInt32 processPoolCursor_;
+
+    ProcessRecordFactory processRecordFactory_;
+
+    /*! Refills 'processPool_', off the fork path, once half of it was taken */
+    thread_call_t processPoolRefill_;
+
+    void refillProcessPool();
+
+    static void OnProcessPoolLow(thread_call_param_t pip, thread_call_param_t);
+
     static OSObject* CacheRecordFactory(void *)
     {
         return CacheRecord::create();
@@ -137,14 +289,31 @@ public:
     /*! Size in bytes of each node in the 'pathCache' dictionary. */
     uint getPathCacheNodeSize() { AutoIncDec cnt(&cacheCallCnt_); return pathCache_->getNodeSize(); }
 
+    /*! Approximate size in bytes of all the nodes of the 'pathCache' dictionary. */
+    uint64_t getPathCacheNodesMemorySize() { AutoIncDec cnt(&cacheCallCnt_); return pathCache_->getNodesMemorySize(); }
+
     /*!
      * Uses a thread-local storage to save a given path as the last path that was looked up on the current thread.
      */
     void setLastLookedUpPath(const char *path)
     {
-        const OSSymbol *pathSym = OSSymbol::withCString(path);
-        lastPathLookup_->insert(pathSym);
-        OSSafeReleaseNULL(pathSym);
+        size_t pathLength = strnlen(path, MAXPATHLEN - 1);
+        OSData *record = OSData::withCapacity((unsigned int)(sizeof(LookupRecord) + pathLength + 1));
+        LookupRecord header = { .checkedVnode = nullptr, .checkedVid = 0, .matches = false };
+        if (record == nullptr ||
+            !record->appendBytes(&header, sizeof(header)) ||
+            !record->appendBytes(path, (unsigned int)pathLength) ||
+            !record->appendByte(0, 1))
+        {
+            // better no path than the one of an earlier lookup
+            lastPathLookup_->remove();
+        }
+        else
+        {
+            lastPathLookup_->insert(record);
+        }
+
+        OSSafeReleaseNULL(record);
     }
 
     /*!
@@ -154,10 +323,68 @@ public:
      */
     const char* getLastLookedUpPath()
     {
-        OSSymbol *value = OSDynamicCast(OSSymbol, lastPathLookup_->get());
-        return value != nullptr ? value->getCStringNoCopy() : nullptr;
+        LookupRecord *record = getLookupRecord();
+        return record != nullptr ? (const char *)(record + 1) : nullptr;
     }
 
+    /*!
+     * Returns whether the last path looked up by the current thread was already compared to vnode 'vp' (see 'setLastLookedUpVnodeMatch'),
+     * in which case 'matches' is set to whether that path resolved to 'vp'.
+     */
+    bool getLastLookedUpVnodeMatch(vnode_t vp, bool *matches)
+    {
+        LookupRecord *record = getLookupRecord();
+        if (record == nullptr || record->checkedVnode != vp || record->checkedVid != vnode_vid(vp))
+        {
+            return false;
+        }
+
+        *matches = record->matches;
+        return true;
+    }
+
+    /*!
+     * Remembers whether the last path looked up by the current thread resolves to vnode 'vp', until the thread looks up another path.
+     */
+    void setLastLookedUpVnodeMatch(vnode_t vp, bool matches)
+    {
+        LookupRecord *record = getLookupRecord();
+        if (record != nullptr)
+        {
+            record->checkedVnode = vp;
+            record->checkedVid   = vnode_vid(vp);
+            record->matches      = matches;
+        }
+    }
+
+    /*!
+     * Returns a buffer of 'size' bytes owned by the current thread, zero-filled when the thread first asks for it, in which
+     * the thread keeps what it last checked.  Only the current thread ever uses the buffer, so it is updated in place.
+     * Every call must ask for the same 'size'.  Returns nullptr if the buffer can't be allocated.
+     */
+    void* getLastCheckBuffer(unsigned int size)
+    {
+        OSData *buffer = OSDynamicCast(OSData, lastCheck_->get());
+        if (buffer == nullptr)
+        {
+            buffer = OSData::withCapacity(size);
+            if (buffer == nullptr || !buffer->appendByte(0, size))
+            {
+                OSSafeReleaseNULL(buffer);
+                return nullptr;
+            }
+
+            lastCheck_->insert(buffer);
+            OSSafeReleaseNULL(buffer);
+            buffer = OSDynamicCast(OSData, lastCheck_->get());
+        }
+
+        return buffer != nullptr ? buffer->getBytesNoCopy() : nullptr;
+    }
+
+    /*! Whether caching was dynamically disabled for this pip, in which case every access is reported. */
+    bool isCachingDisabled() const { return disableCaching_; }
+
     /*! Information about this pip that can be queried from user space */
     PipInfo introspect();
 
@@ -172,6 +399,14 @@ public:
     /*! Atomically dencrements this pip's process tree size and returns the size before decrement. */
     int decrementProcessTreeCount() { return OSDecrementAtomic(&processTreeCount_); }
 
+#pragma mark Report Ordering
+
+    /*! Number of reports of this pip enqueued to the report queue of its client so far, which its priority reports must follow (see PriorityReportHeader) */
+    uint64_t getNumQueuedReports() const { return (uint64_t)numQueuedReports_; }
+
+    /*! Atomically adds 'count' to the number of reports of this pip enqueued to the report queue of its client. */
+    void addQueuedReports(uint count) { OSAddAtomic64(count, &numQueuedReports_); }
+
 #pragma mark Report Caching
 
     /*!
@@ -205,6 +440,80 @@ public:
         }
     }
 
+    /*! Generation to pass to 'vnodeCacheUpdate'; must be read before the access to cache is checked. */
+    int getVNodeCacheGeneration() const { return vnodeCacheGeneration_; }
+
+    /*! Makes all the vnode actions remembered so far be checked again. */
+    void invalidateVNodeCache() { OSIncrementAtomic(&vnodeCacheGeneration_); }
+
+    /*! Returns true if all the actions from 'action' were already checked and allowed for 'vp'. */
+    bool vnodeCacheLookup(vnode_t vp, kauth_action_t action);
+
+    /*!
+     * Remembers that 'action' was checked and allowed for 'vp'.
+     * Nothing is remembered if the generation changed since 'generation' was obtained.
+     */
+    void vnodeCacheUpdate(vnode_t vp, kauth_action_t action, int generation);
+
+    /*!
+     * Copies the cached absolute path of the directory vnode 'dvp' into 'buffer', which holds '*length' bytes,
+     * and sets '*length' to the length of the path (including its terminating null character).
+     *
+     * Paths cached under a different 'generation' are ignored (see 'Listeners::g_renameGeneration').
+     *
+     * @result False if the path of 'dvp' is not cached (or doesn't fit in 'buffer'), in which case 'buffer' may have been overwritten.
+     */
+    bool dirPathCacheLookup(vnode_t dvp, int generation, char *buffer, int *length);
+
+    /*! Remembers that 'path' (of 'length' bytes, as returned by vn_getpath) is the absolute path of the directory vnode 'dvp'. */
+    void dirPathCacheUpdate(vnode_t dvp, int generation, const char *path, int length);
+
+#pragma mark Manifest Sharing
+
+    /*!
+     * Replaces the manifest tree of this pip with the one 'sharer' returns for it, and drops the copy this pip
+     * received with its manifest.  Must be called before this pip is tracked.
+     */
+    bool shareManifestTree(ManifestTreeSharer sharer, void *sharerContext);
+
+#pragma mark Report Coalescing
+
+    /*!
+     * Makes the reports of this pip be held for up to 'windowMs' milliseconds and then sent by 'sender' together.
+     * Must be called before any report of this pip is sent.
+     */
+    bool enableReportCoalescing(uint windowMs, CoalescedReportsSender sender, void *senderContext);
+
+    /*! Whether the reports of this pip should go through 'coalesceReport'. */
+    bool isReportCoalescingEnabled() const { return coalescedReports_ != nullptr; }
+
+    /*!
+     * Holds 'report' back until the coalescing window expires, the reports held so far fill a report queue entry,
+     * or 'flush' is true (which sends all the reports held, this one included, right away).
+     *
+     * @result False if sending the reports held so far failed.
+     */
+    bool coalesceReport(const AccessReport &report, bool flush);
+
+    /*! Sends the reports held so far, if any. */
+    bool flushCoalescedReports();
+
+#pragma mark Process Pool
+
+    /*!
+     * Makes this pip keep up to 'size' records created by 'factory' at hand for its child processes (see 'takePooledProcess').
+     * Must be called before this pip is tracked.
+     */
+    bool enableProcessPool(uint size, ProcessRecordFactory factory);
+
+    /*!
+     * Takes a record from the process pool, which is refilled in the background.
+     *
+     * @result A record created by the factory given to 'enableProcessPool', or nullptr if the pool is empty (or disabled).
+     *         The caller is responsible for releasing the returned object.
+     */
+    OSObject* takePooledProcess();
+
 #pragma mark Static Methods
 
     /*! Factory method. The caller is responsible for releasing the returned object. */
@@ -214,6 +523,7 @@ private:
 
     bool RefreshDisableCaching();
     inline bool ShouldDisableCaching();
+    inline bool IsPathCacheOverBudget();
 };
 
 #endif /* SandboxedPip_hpp */
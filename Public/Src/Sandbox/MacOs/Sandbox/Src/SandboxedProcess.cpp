@@ -7,6 +7,8 @@
 
 OSDefineMetaClassAndStructors(SandboxedProcess, OSObject)
 
+BXLDefineZoneAllocated(SandboxedProcess, kZoneSandboxedProcess);
+
 SandboxedProcess* SandboxedProcess::create(pid_t processId, SandboxedPip *pip)
 {
     SandboxedProcess *instance = new SandboxedProcess;
@@ -21,26 +23,52 @@ SandboxedProcess* SandboxedProcess::create(pid_t processId, SandboxedPip *pip)
     return instance;
 }
 
+SandboxedProcess* SandboxedProcess::createUnassigned()
+{
+    SandboxedProcess *instance = new SandboxedProcess;
+    if (instance != nullptr)
+    {
+        if (!instance->initUnassigned())
+        {
+            OSSafeReleaseNULL(instance);
+        }
+    }
+
+    return instance;
+}
+
 bool SandboxedProcess::init(pid_t processId, SandboxedPip *pip)
+{
+    if (!initUnassigned() || pip == nullptr)
+    {
+        return false;
+    }
+
+    assign(processId, pip);
+    return true;
+}
+
+bool SandboxedProcess::initUnassigned()
 {
     if (!super::init())
     {
         return false;
     }
 
-    pip_ = pip;
-    id_  = processId;
+    pip_ = nullptr;
+    id_  = 0;
 
     bzero(path_, sizeof(path_));
     pathLength_ = 0;
 
-    if (pip_ == nullptr)
-    {
-        return false;
-    }
+    return true;
+}
 
+void SandboxedProcess::assign(pid_t processId, SandboxedPip *pip)
+{
+    pip_ = pip;
+    id_  = processId;
     pip_->retain();
-    return true;
 }
 
 void SandboxedProcess::free()
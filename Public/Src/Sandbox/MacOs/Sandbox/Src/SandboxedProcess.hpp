@@ -5,6 +5,7 @@
 #define SandboxedProcess_hpp
 
 #include "SandboxedPip.hpp"
+#include "Zone.hpp"
 
 #define SandboxedProcess BXL_CLASS(SandboxedProcess)
 
@@ -37,6 +38,10 @@ private:
 
     bool init(pid_t processId, SandboxedPip *pip);
 
+    bool initUnassigned();
+
+    BXLDeclareZoneAllocated(SandboxedProcess)
+
 protected:
 
     void free() override;
@@ -61,6 +66,12 @@ public:
     /*! An alternative to 'setPath': returns a buffer to which the caller can set the path. */
     char* getPathBuffer()                                { return path_; }
 
+    /*!
+     * Makes a record created by 'createUnassigned' represent the process 'processId' of 'pip'.
+     * Must be called once, before the record is tracked.
+     */
+    void assign(pid_t processId, SandboxedPip *pip);
+
 #pragma mark Static Methods
 
     /*!
@@ -71,6 +82,12 @@ public:
      * If new object cannot not be created, nullptr is returned.
      */
     static SandboxedProcess* create(pid_t processId, SandboxedPip *pip);
+
+    /*!
+     * Creates a record that doesn't belong to any pip yet (see 'assign'), for the process pools of pips
+     * (see 'SandboxedPip::takePooledProcess').  Such a record doesn't retain any pip until it is assigned.
+     */
+    static SandboxedProcess* createUnassigned();
 };
 
 #endif /* SandboxedProcess_hpp */
@@ -2,6 +2,7 @@
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
 #include "SysCtl.hpp"
+#include "Stopwatch.hpp"
 
 #if DEBUG
 int g_bxl_verbose_logging = 1;
@@ -12,11 +13,21 @@ int g_bxl_verbose_logging = 0;
 int g_bxl_enable_cache = 1;
 int g_bxl_enable_counters = 1;	
 int g_bxl_enable_light_trie = 1;
+int g_bxl_enable_vnode_cache = 1;
 
 // for caching to be disabled for a pip, it must have at least 20000 entries and no more than 20% cache hit rate
 int g_bxl_disable_cache_min_entries = 20000;
 int g_bxl_disable_cache_max_hit_pct = 20;
 
+// regardless of its hit rate, caching is disabled for a pip whose cache grows above 64MB
+int g_bxl_disable_cache_max_kb = 64 * 1024;
+
+// every pip keeps 16 process records at hand for its child processes, so that forking doesn't allocate
+int g_bxl_process_pool_size = 16;
+
+// when a pip starts, every allocation zone is grown to have at least 256 free elements, so its first accesses don't add slabs
+int g_bxl_zone_reserve_count = 256;
+
 SYSCTL_INT(_kern,                               // parent
            OID_AUTO,                            // oid
            bxl_enable_counters,                 // name
@@ -49,6 +60,14 @@ SYSCTL_INT(_kern,
            g_bxl_enable_light_trie,
            "Enable/Disable light trie implementation (slighly slower, but uses way less memory)");
 
+SYSCTL_INT(_kern,
+           OID_AUTO,
+           bxl_enable_vnode_cache,
+           CTLFLAG_RW,
+           &g_bxl_enable_vnode_cache,
+           g_bxl_enable_vnode_cache,
+           "Enable/Disable skipping the checks of vnode actions that were already allowed for a vnode");
+
 SYSCTL_INT(_kern,
            OID_AUTO,
            bxl_disable_cache_min_entries,
@@ -65,14 +84,59 @@ SYSCTL_INT(_kern,
            g_bxl_disable_cache_max_hit_pct,
            "For pip caching to be disabled, its cache hit rate must be less than this percent");
 
+SYSCTL_INT(_kern,
+           OID_AUTO,
+           bxl_disable_cache_max_kb,
+           CTLFLAG_RW,
+           &g_bxl_disable_cache_max_kb,
+           g_bxl_disable_cache_max_kb,
+           "Pip caching is disabled once its cache occupies more than this many kilobytes (0 means no limit)");
+
+SYSCTL_INT(_kern,
+           OID_AUTO,
+           bxl_process_pool_size,
+           CTLFLAG_RW,
+           &g_bxl_process_pool_size,
+           g_bxl_process_pool_size,
+           "Number of process records every pip preallocates for its child processes (0 disables the pool, at most 64)");
+
+SYSCTL_INT(_kern,
+           OID_AUTO,
+           bxl_zone_reserve_count,
+           CTLFLAG_RW,
+           &g_bxl_zone_reserve_count,
+           g_bxl_zone_reserve_count,
+           "Number of free elements every allocation zone (trie nodes, cache records, ...) is grown to when a pip starts (0 disables it)");
+
+static int bxl_callback_latencies_handler(struct sysctl_oid *oidp, void *arg1, int arg2, struct sysctl_req *req)
+{
+    // The histograms are updated concurrently: readers get a snapshot where each bucket is consistent, which is all they need
+    return SYSCTL_OUT(req, &g_bxl_callback_latencies, sizeof(g_bxl_callback_latencies));
+}
+
+SYSCTL_PROC(_kern,
+            OID_AUTO,
+            bxl_callback_latencies,
+            CTLTYPE_OPAQUE | CTLFLAG_RD | CTLFLAG_LOCKED,
+            nullptr,
+            0,
+            &bxl_callback_latencies_handler,
+            "S,CallbackLatencies",
+            "Latency histograms of the kernel callbacks (see CallbackLatencies)");
+
 void bxl_sysctl_register()
 {
     sysctl_register_oid(&sysctl__kern_bxl_enable_counters);
     sysctl_register_oid(&sysctl__kern_bxl_verbose_logging);
     sysctl_register_oid(&sysctl__kern_bxl_enable_cache);
     sysctl_register_oid(&sysctl__kern_bxl_enable_light_trie);
+    sysctl_register_oid(&sysctl__kern_bxl_enable_vnode_cache);
     sysctl_register_oid(&sysctl__kern_bxl_disable_cache_min_entries);
     sysctl_register_oid(&sysctl__kern_bxl_disable_cache_max_hit_pct);
+    sysctl_register_oid(&sysctl__kern_bxl_disable_cache_max_kb);
+    sysctl_register_oid(&sysctl__kern_bxl_process_pool_size);
+    sysctl_register_oid(&sysctl__kern_bxl_zone_reserve_count);
+    sysctl_register_oid(&sysctl__kern_bxl_callback_latencies);
 }
 
 void bxl_sysctl_unregister()
@@ -81,6 +145,11 @@ void bxl_sysctl_unregister()
     sysctl_unregister_oid(&sysctl__kern_bxl_verbose_logging);
     sysctl_unregister_oid(&sysctl__kern_bxl_enable_cache);
     sysctl_unregister_oid(&sysctl__kern_bxl_enable_light_trie);
+    sysctl_unregister_oid(&sysctl__kern_bxl_enable_vnode_cache);
     sysctl_unregister_oid(&sysctl__kern_bxl_disable_cache_min_entries);
     sysctl_unregister_oid(&sysctl__kern_bxl_disable_cache_max_hit_pct);
+    sysctl_unregister_oid(&sysctl__kern_bxl_disable_cache_max_kb);
+    sysctl_unregister_oid(&sysctl__kern_bxl_process_pool_size);
+    sysctl_unregister_oid(&sysctl__kern_bxl_zone_reserve_count);
+    sysctl_unregister_oid(&sysctl__kern_bxl_callback_latencies);
 }
@@ -13,8 +13,12 @@ extern int g_bxl_enable_counters;
 extern int g_bxl_verbose_logging;
 extern int g_bxl_enable_cache;
 extern int g_bxl_enable_light_trie;
+extern int g_bxl_enable_vnode_cache;
 extern int g_bxl_disable_cache_min_entries;
 extern int g_bxl_disable_cache_max_hit_pct;
+extern int g_bxl_disable_cache_max_kb;
+extern int g_bxl_process_pool_size;
+extern int g_bxl_zone_reserve_count;
 
 void bxl_sysctl_register();
 void bxl_sysctl_unregister();
@@ -3,6 +3,8 @@
 
 #include "Stopwatch.hpp"
 
+CallbackLatencies g_bxl_callback_latencies = {};
+
 void Stopwatch::reset()
 {
     start_ = lastLap_ = time();
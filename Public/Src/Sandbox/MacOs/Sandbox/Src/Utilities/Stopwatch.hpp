@@ -30,4 +30,32 @@ public:
     Timespan lap();
 };
 
+extern CallbackLatencies g_bxl_callback_latencies;
+
+/*!
+ * Records the time between its construction and its destruction in the latency histogram of a callback.
+ * Like the other counters, nothing is recorded when counters are disabled.
+ */
+class CallbackLatencyScope
+{
+private:
+    LatencyCallback callback_;
+    bool enabled_;
+    uint64_t start_;
+
+public:
+
+    CallbackLatencyScope(LatencyCallback callback)
+        : callback_(callback), enabled_(g_bxl_enable_counters), start_(enabled_ ? mach_absolute_time() : 0) {}
+
+    ~CallbackLatencyScope()
+    {
+        if (enabled_)
+        {
+            uint64_t nanos = mach_absolute_time() - start_;
+            OSIncrementAtomic((volatile SInt32 *)&g_bxl_callback_latencies.callbacks[callback_].buckets[LatencyBucket(nanos)]);
+        }
+    }
+};
+
 #endif /* Stopwatch_hpp */
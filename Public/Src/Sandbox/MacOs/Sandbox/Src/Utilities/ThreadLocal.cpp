@@ -32,6 +32,9 @@ bool ThreadLocal::init()
         return false;
     }
 
+    bzero(slots_, sizeof(slots_));
+    overflowed_ = false;
+
     dict_ = Trie::createUintTrie();
     if (dict_ == nullptr)
     {
@@ -43,6 +46,11 @@ bool ThreadLocal::init()
 
 void ThreadLocal::free()
 {
+    for (int i = 0; i < kThreadLocalSlotCount; i++)
+    {
+        OSSafeReleaseNULL(slots_[i].value);
+    }
+
     if (dict_)
     {
         OSSafeReleaseNULL(dict_);
@@ -51,23 +59,98 @@ void ThreadLocal::free()
     super::free();
 }
 
+ThreadLocal::Slot* ThreadLocal::findSlot(uint64_t tid, bool claim) const
+{
+    // thread ids are handed out sequentially, so their lowest bits spread them well enough
+    for (int i = 0; i < kThreadLocalSlotProbeCount; i++)
+    {
+        Slot *slot = const_cast<Slot*>(&slots_[(tid + i) & (kThreadLocalSlotCount - 1)]);
+        uint64_t owner = slot->tid;
+        if (owner == tid)
+        {
+            return slot;
+        }
+
+        if (owner == 0)
+        {
+            if (!claim)
+            {
+                // slots are claimed in probing order, so the current thread doesn't own any of the following ones
+                return nullptr;
+            }
+
+            if (OSCompareAndSwap64(0, tid, &slot->tid))
+            {
+                return slot;
+            }
+
+            // someone else just claimed it --> it may have been the current thread's only chance, keep probing
+        }
+    }
+
+    return nullptr;
+}
+
 #pragma mark count/insert/remove/get methods
 
+uint ThreadLocal::getCount()
+{
+    uint count = 0;
+    for (int i = 0; i < kThreadLocalSlotCount; i++)
+    {
+        if (slots_[i].value != nullptr) count++;
+    }
+
+    return count + dict_->getCount();
+}
+
 bool ThreadLocal::insert(const OSObject *value)
 {
-    auto result = dict_->replace(self_tid(), value);
-    return
-        result == Trie::TrieResult::kTrieResultInserted ||
-        result == Trie::TrieResult::kTrieResultReplaced;
+    uint64_t tid = self_tid();
+    Slot *slot = findSlot(tid, /*claim*/ true);
+    if (slot == nullptr)
+    {
+        overflowed_ = true;
+        auto result = dict_->replace(tid, value);
+        return
+            result == Trie::TrieResult::kTrieResultInserted ||
+            result == Trie::TrieResult::kTrieResultReplaced;
+    }
+
+    // only the current thread ever writes to its slot
+    OSObject *previousValue = slot->value;
+    value->retain();
+    slot->value = const_cast<OSObject*>(value);
+    OSSafeReleaseNULL(previousValue);
+    return true;
 }
 
 bool ThreadLocal::remove()
 {
-    auto result = dict_->remove(self_tid());
-    return result == Trie::TrieResult::kTrieResultRemoved;
+    uint64_t tid = self_tid();
+    Slot *slot = findSlot(tid, /*claim*/ false);
+    if (slot == nullptr)
+    {
+        auto result = overflowed_ ? dict_->remove(tid) : Trie::TrieResult::kTrieResultAlreadyEmpty;
+        return result == Trie::TrieResult::kTrieResultRemoved;
+    }
+
+    // the slot stays claimed: the current thread is likely to insert a value again
+    OSObject *previousValue = slot->value;
+    slot->value = nullptr;
+    bool removed = previousValue != nullptr;
+    OSSafeReleaseNULL(previousValue);
+    return removed;
 }
 
 OSObject* ThreadLocal::get() const
 {
-    return dict_->get(self_tid());
+    uint64_t tid = self_tid();
+    Slot *slot = findSlot(tid, /*claim*/ false);
+    if (slot != nullptr)
+    {
+        return slot->value;
+    }
+
+    return overflowed_ ? dict_->get(tid) : nullptr;
 }
@@ -10,8 +10,19 @@
 
 #define ThreadLocal BXL_CLASS(ThreadLocal)
 
+// Must be a power of 2
+#define kThreadLocalSlotCount 32
+
+// How many consecutive slots a thread looks at for its own (or for a free one to claim) before falling back to the dictionary
+#define kThreadLocalSlotProbeCount 4
+
 /*!
- * A straightforward wrapper around a concurrent dictionary that uses current thread's id as the implicit key.
+ * A thread-local value storage that uses current thread's id as the implicit key.
+ *
+ * Threads claim a slot of a small table the first time they insert a value and keep it for the lifetime of this object:
+ * a slot is only ever written by the thread owning it, so getting and setting the value of the current thread doesn't
+ * lock and doesn't walk a dictionary.  Slots are padded to a cache line so that threads using their values concurrently
+ * don't contend.  Threads that find no free slot keep their values in a concurrent dictionary instead.
  */
 class ThreadLocal : public OSObject
 {
@@ -19,9 +30,23 @@ class ThreadLocal : public OSObject
 
 private:
 
-    /* backing dictionary */
+    typedef struct alignas(64) {
+        /*! Id of the thread owning this slot (0 while the slot is free) */
+        volatile uint64_t tid;
+        OSObject *value;
+    } Slot;
+
+    Slot slots_[kThreadLocalSlotCount];
+
+    /*! Set once a thread had to keep its value in 'dict_' because it found no free slot */
+    volatile bool overflowed_;
+
+    /* backing dictionary, for the values of the threads without a slot */
     Trie *dict_;
 
+    /*! Returns the slot owned by the current thread, claiming a free one if 'claim' is true; nullptr if there is none */
+    Slot* findSlot(uint64_t tid, bool claim) const;
+
     static uint64_t self_tid()
     {
         return thread_tid(current_thread());
@@ -46,7 +71,7 @@ public:
     /*!
      * @return Number of entries in this collection
      */
-    uint getCount() { return dict_->getCount(); }
+    uint getCount();
 
     /*!
      * @return Number of nodes in the underlying dictionary.
@@ -2,7 +2,6 @@
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
 #include "Trie.hpp"
-#include "Monitor.hpp"
 
 #define super OSObject
 
@@ -35,12 +34,6 @@ bool Trie::init(TrieKind kind)
     onChangeData_ = nullptr;
     onChangeCallback_ = nullptr;
 
-    lock_ = BXLRecursiveLockAlloc();
-    if (!lock_)
-    {
-        return false;
-    }
-
     root_ = createNode(0);
     if (root_ == nullptr)
     {
@@ -57,8 +50,6 @@ void Trie::free()
                  OSSafeReleaseNULL(n);
              });
 
-    BXLRecursiveLockFree(lock_);
-    lock_ = nullptr;
     root_ = nullptr;
     size_ = 0;
     nodeCount_ = 0;
@@ -188,6 +179,30 @@ Trie::TrieResult Trie::remove(Node *node)
     }
 }
 
+Trie::TrieResult Trie::removeIfEqual(Node *node, const OSObject *expected)
+{
+    if (node == nullptr || node->record_ == nullptr)
+    {
+        return kTrieResultAlreadyEmpty;
+    }
+
+    OSObject *previousValue = const_cast<OSObject*>(expected);
+
+    if (OSCompareAndSwapPtr(previousValue, nullptr, &node->record_))
+    {
+        // we updated record_ --> release previous value and decrease size
+        OSSafeReleaseNULL(previousValue);
+        int oldCount = OSDecrementAtomic(&size_);
+        triggerOnChange(oldCount, oldCount - 1);
+        return kTrieResultRemoved;
+    }
+    else
+    {
+        // a different record is associated with 'node' --> declare race and do nothing
+        return kTrieResultRace;
+    }
+}
+
 /*
  * Code used to generate this array:
 
@@ -482,7 +497,7 @@ Node* Trie::findPathNode(const char *path, bool createIfMissing)
         {
             return nullptr;
         }
-        currNode = currNode->findChild(idx, createIfMissing, lock_, &outNewNodeCreated);
+        currNode = currNode->findChild(idx, createIfMissing, &outNewNodeCreated);
         if (currNode == nullptr)
         {
             return nullptr;
@@ -509,7 +524,7 @@ Node* Trie::findUintNode(uint64_t key, bool createIfMissing)
     while (true)
     {
         int lsd = key % 10;
-        currNode = currNode->findChild(lsd, createIfMissing, lock_, &outNewNodeCreated);
+        currNode = currNode->findChild(lsd, createIfMissing, &outNewNodeCreated);
         if (!currNode)
         {
             return nullptr;
@@ -563,20 +578,22 @@ void Trie::forEach(void *callbackArgs, for_each_fn callback)
              });
 }
 
-void Trie::removeMatching(void *filterArgs, filter_fn filter)
+void Trie::removeMatching(void *filterArgs, filter_fn filter, for_each_fn onRemoved)
 {
-    typedef struct { filter_fn filter; void *args; Trie *me; } State;
-    State state = { .filter = filter, .args = filterArgs, .me = this };
-    traverse(/*computeKey*/ false, /*callbackArgs*/ &state, [](void *s, uint64_t, Node *node)
+    typedef struct { filter_fn filter; for_each_fn onRemoved; void *args; Trie *me; } State;
+    State state = { .filter = filter, .onRemoved = onRemoved, .args = filterArgs, .me = this };
+    traverse(/*computeKey*/ onRemoved != nullptr && isUintTrie(), /*callbackArgs*/ &state, [](void *s, uint64_t key, Node *node)
              {
                  State *state = (State*)s;
                  OSObject *record = node->record_;
                  if (record)
                  {
                      record->retain();
-                     if (state->filter(state->args, record))
+                     if (state->filter(state->args, record) &&
+                         state->me->remove(node) == kTrieResultRemoved &&
+                         state->onRemoved != nullptr)
                      {
-                         state->me->remove(node);
+                         state->onRemoved(state->args, key, record);
                      }
                      record->release();
                  }
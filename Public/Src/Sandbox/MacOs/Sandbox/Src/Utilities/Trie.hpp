@@ -15,8 +15,8 @@
  * Only 2 types of keys are allowed: (1) an unsigned integer, and (2) an ascii path.
  *
  * Additionally, two different implementations are provided: fast and light.  The former
- * is lock-free and fast but has a potentially huge memory footprint; the latter has a
- * much smaller memory footprint, is not lock-free, but still has good performance.
+ * is fast but has a potentially huge memory footprint; the latter has a
+ * much smaller memory footprint and is slightly slower.  Both are lock-free.
  *
  * Each node in a tree can be assigned a record which must be a pointer to an arbitrary OSObject.
  * Once an OSObject is added to a trie, it is automatically retained by the trie; once it is removed,
@@ -81,9 +81,6 @@ private:
     /*! Payload for the 'onChangeCallback_' function */
     void *onChangeData_;
 
-    /*! Used only when modifying a node's list of children */
-    BXLRecursiveLock *lock_;
-
     /*! Initialized a new Trie.  The return value indicates the success of the operation. */
     bool init(TrieKind kind);
 
@@ -164,6 +161,13 @@ private:
      */
     TrieResult remove(Node *node);
 
+    /*!
+     * Same as 'remove', except that the record associated with 'node' is removed ONLY if it is 'expected'.
+     *
+     * If a different record is currently associated with 'node', returns 'kTrieResultRace' and does nothing.
+     */
+    TrieResult removeIfEqual(Node *node, const OSObject *expected);
+
     /*! Calls 'callback' for every node in the trie during a pre-order traversal. */
     void traverse(bool computeKey, void *callbackArgs, traverse_fn callback);
 
@@ -232,9 +236,19 @@ public:
     uint getNodeCount() { return nodeCount_; }
 
     /*!
-     * Returns the size in bytes of each node in this tree.
+     * Returns the size in bytes of each node in this tree, including the array of children of fast nodes.
      */
-    uint getNodeSize() { return isLightTrie() ? sizeof(NodeLight) : sizeof(NodeFast); }
+    uint getNodeSize()
+    {
+        return isLightTrie() ? sizeof(NodeLight) :
+               sizeof(NodeFast) + sizeof(Node*) * (isUintTrie() ? Node::s_uintNodeMaxKey : Node::s_pathNodeMaxKey);
+    }
+
+    /*!
+     * Returns the approximate number of bytes occupied by the nodes of this tree (excluding the values stored in them).
+     */
+    uint64_t getNodesMemorySize() { return (uint64_t)nodeCount_ * getNodeSize(); }
+
     /*!
      * Callback to be invoked every time the size of this tree changes.
      */
@@ -250,8 +264,10 @@ public:
 
     /*!
      * Removes all the entries matching a given filter.
+     *
+     * When provided, 'onRemoved' is called (with 'filterArgs') for every entry this call actually removed.
      */
-    void removeMatching(void *filterArgs, filter_fn filter);
+    void removeMatching(void *filterArgs, filter_fn filter, for_each_fn onRemoved = nullptr);
 
 #pragma mark Methods for 'path' keys
 
@@ -329,6 +345,11 @@ public:
         return remove(findExistingNodeForUint(key));
     }
 
+    TrieResult removeIfEqual(uint64_t key, const OSObject *expected)
+    {
+        return removeIfEqual(findExistingNodeForUint(key), expected);
+    }
+
 #pragma mark Static factory methods
 
     static Trie* createUintTrie() { return create(kUintTrie); }
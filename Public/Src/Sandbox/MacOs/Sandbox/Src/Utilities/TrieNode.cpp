@@ -2,44 +2,105 @@
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
 #include "Alloc.hpp"
-#include "Monitor.hpp"
 #include "TrieNode.hpp"
 
 OSDefineMetaClassAndAbstractStructors(Node, OSObject)
 OSDefineMetaClassAndStructors(NodeLight, Node)
 OSDefineMetaClassAndStructors(NodeFast, Node)
 
+BXLDefineZoneAllocated(NodeLight, kZoneNodeLight);
+BXLDefineZoneAllocated(NodeFast, kZoneNodeFast);
+
 uint Node::s_numUintNodes = 0;
 uint Node::s_numPathNodes = 0;
 
-typedef struct Stack {
+typedef struct StackFrame {
     Node *node;
-    Stack *next;
     uint32_t depth;
     uint64_t key;
-} Stack;
-
-static void push(Stack **stack, Node *node, uint64_t path, uint32_t depth)
+} StackFrame;
+
+/*!
+ * Stack of the nodes left to visit by a traversal.
+ *
+ * Frames are allocated in chunks, so that a traversal (and in particular freeing a whole trie when a pip
+ * or a client goes away) doesn't allocate and deallocate once per visited node.  The last chunk that
+ * went empty is kept around, so a stack growing and shrinking around a chunk boundary doesn't thrash.
+ */
+class Stack
 {
-    if (node == nullptr) return;
+private:
 
-    Stack *top = Alloc::New<Stack>(1);
-    top->node  = node;
-    top->next  = *stack;
-    top->key   = path;
-    top->depth = depth;
+    static const uint s_chunkLength = 256;
 
-    *stack = top;
-}
+    typedef struct Chunk {
+        Chunk *prev;
+        uint count;
+        StackFrame frames[s_chunkLength];
+    } Chunk;
 
-static Node* pop(Stack **stack)
-{
-    Stack *top = *stack;
-    *stack = top->next;
-    Node *node = top->node;
-    Alloc::Delete<Stack>(top, 1);
-    return node;
-}
+    Chunk *top_   = nullptr;
+    Chunk *spare_ = nullptr;
+
+public:
+
+    ~Stack()
+    {
+        while (top_ != nullptr)
+        {
+            Chunk *prev = top_->prev;
+            Alloc::Delete<Chunk>(top_, 1);
+            top_ = prev;
+        }
+
+        if (spare_ != nullptr)
+        {
+            Alloc::Delete<Chunk>(spare_, 1);
+        }
+    }
+
+    bool isEmpty() const
+    {
+        return top_ == nullptr || top_->count == 0;
+    }
+
+    void push(Node *node, uint64_t key, uint32_t depth)
+    {
+        if (node == nullptr) return;
+
+        if (top_ == nullptr || top_->count == s_chunkLength)
+        {
+            Chunk *chunk = spare_ != nullptr ? spare_ : Alloc::New<Chunk>(1);
+            spare_ = nullptr;
+
+            chunk->prev  = top_;
+            chunk->count = 0;
+            top_ = chunk;
+        }
+
+        StackFrame *frame = &top_->frames[top_->count++];
+        frame->node  = node;
+        frame->depth = depth;
+        frame->key   = key;
+    }
+
+    StackFrame pop()
+    {
+        StackFrame frame = top_->frames[--top_->count];
+        if (top_->count == 0 && top_->prev != nullptr)
+        {
+            if (spare_ != nullptr)
+            {
+                Alloc::Delete<Chunk>(spare_, 1);
+            }
+
+            spare_ = top_;
+            top_ = top_->prev;
+        }
+
+        return frame;
+    }
+};
 
 static uint64_t s_pow10[] =
 {
@@ -117,72 +178,72 @@ void NodeLight::free()
     Node::free();
 }
 
-NodeLight* NodeLight::findChild(uint key,
-                                bool createIfMissing,
-                                BXLRecursiveLock *maybeNullLock,
-                                BXLRecursiveLock *nonNullLock,
-                                bool *outNewNodeCreated)
+Node* NodeLight::findChild(uint key, bool createIfMissing, bool *outNewNodeCreated)
 {
-    Monitor __monitor(maybeNullLock); // this will only acquire the lock if lock is not null
-
     *outNewNodeCreated = false;
 
-    NodeLight *prev = nullptr;
-    NodeLight *curr = children_;
-    while (curr != nullptr && curr->key_ != key)
+    // Nodes are only ever appended to the list of children (and never unlinked while the trie is alive),
+    // so the list can be walked without a lock and a new node published with a single CAS on the last link.
+    NodeLight *newNode = nullptr;
+    NodeLight **link = &children_;
+    while (true)
     {
-        prev = curr;
-        curr = curr->next_;
-    }
+        NodeLight *curr = *link;
+        if (curr != nullptr)
+        {
+            if (curr->key_ == key)
+            {
+                // found it --> release 'newNode' in case we created it for nothing
+                OSSafeReleaseNULL(newNode);
+                return curr;
+            }
+
+            link = &curr->next_;
+            continue;
+        }
 
-    if (curr != nullptr)
-    {
-        // found it
-        assert(curr->key_ == key);
-        return curr;
-    }
-    else if (!createIfMissing)
-    {
-        // didn't find it and shouldn't create it
-        return nullptr;
-    }
-    else if (maybeNullLock == nullptr)
-    {
-        // didn't find it and didn't acquire lock --> must do it all over again with a lock
-        return findChild(key, createIfMissing, nonNullLock, nonNullLock, outNewNodeCreated);
-    }
-    else
-    {
-        // didn't find it and we are holding the lock -> create a new node and link it
-        NodeLight *newNode = NodeLight::create(key);
-        *outNewNodeCreated = newNode != nullptr;
-        if (prev != nullptr)
+        if (!createIfMissing)
         {
-            prev->next_ = newNode;
+            // didn't find it and shouldn't create it
+            return nullptr;
         }
-        else
+
+        if (newNode == nullptr)
+        {
+            newNode = NodeLight::create(key);
+
+            // This should never happen except if we run out of memory.
+            if (newNode == nullptr)
+            {
+                return nullptr;
+            }
+        }
+
+        if (OSCompareAndSwapPtr(nullptr, newNode, link))
         {
-            assert(children_ == nullptr);
-            children_ = newNode;
+            *outNewNodeCreated = true;
+            return newNode;
         }
-        return newNode;
+
+        // someone else appended a sibling first --> keep looking from that sibling on
     }
 }
 
 void NodeLight::traverse(bool computeKey, void *callbackArgs, traverse_fn callback)
 {
-    Stack *stack = nullptr;
-    push(&stack, this, /*key*/ 0, /*depth*/ 0);
-    while (stack != nullptr)
+    Stack stack;
+    stack.push(this, /*key*/ 0, /*depth*/ 0);
+    while (!stack.isEmpty())
     {
-        uint64_t key = stack->key;
-        uint32_t depth = stack->depth;
+        StackFrame frame = stack.pop();
+        uint64_t key = frame.key;
+        uint32_t depth = frame.depth;
 
-        NodeLight *toVisit = (NodeLight*)pop(&stack);
+        NodeLight *toVisit = (NodeLight*)frame.node;
         NodeLight *curr = toVisit->children_;
         while (curr)
         {
-            push(&stack, curr, computeKey ? (curr->key_ * pow10(depth) + key) : 0, depth + 1);
+            stack.push(curr, computeKey ? (curr->key_ * pow10(depth) + key) : 0, depth + 1);
             curr = curr->next_;
         }
 
@@ -249,7 +310,7 @@ void NodeFast::free()
     Node::free();
 }
 
-Node* NodeFast::findChild(uint key, bool createIfMissing, BXLRecursiveLock *lock, bool *outNewNodeCreated)
+Node* NodeFast::findChild(uint key, bool createIfMissing, bool *outNewNodeCreated)
 {
     *outNewNodeCreated = false;
 
@@ -293,17 +354,18 @@ Node* NodeFast::findChild(uint key, bool createIfMissing, BXLRecursiveLock *lock
 
 void NodeFast::traverse(bool computeKey, void *callbackArgs, traverse_fn callback)
 {
-    Stack *stack = nullptr;
-    push(&stack, this, /*key*/ 0, /*depth*/ 0);
-    while (stack != nullptr)
+    Stack stack;
+    stack.push(this, /*key*/ 0, /*depth*/ 0);
+    while (!stack.isEmpty())
     {
-        uint64_t key = stack->key;
-        uint32_t depth = stack->depth;
+        StackFrame frame = stack.pop();
+        uint64_t key = frame.key;
+        uint32_t depth = frame.depth;
 
-        NodeFast *curr = (NodeFast*)pop(&stack);
+        NodeFast *curr = (NodeFast*)frame.node;
         for (int i = 0; i < curr->length(); ++i)
         {
-            push(&stack, curr->children()[i], computeKey ? (i * pow10(depth) + key) : 0, depth + 1);
+            stack.push(curr->children()[i], computeKey ? (i * pow10(depth) + key) : 0, depth + 1);
         }
 
         // the callback may deallocate 'curr' node, hence this must be the last statement in this loop
@@ -7,7 +7,7 @@
 #include <IOKit/IOLib.h>
 #include <IOKit/IOService.h>
 #include "BuildXLSandboxShared.hpp"
-#include "BXLLocks.hpp"
+#include "Zone.hpp"
 
 #define Node BXL_CLASS(Node)
 #define NodeLight BXL_CLASS(NodeLight)
@@ -54,10 +54,9 @@ protected:
      *
      * @param key Must be between 0 (inclusive) and 'node.maxKey_' (exclusive); otherwise this method returns NULL
      * @param createIfMissing When true, this method creates a new child node at position 'idx' if one doesn't already exist.
-     * @param lock A lock unique to the parent tree to use when needed.
      * @result True IFF this node contains a child node with key 'key' after this method returns.
      */
-    virtual Node* findChild(uint key, bool createIfMissing, BXLRecursiveLock *lock, bool *outNewNodeCreated) = 0;
+    virtual Node* findChild(uint key, bool createIfMissing, bool *outNewNodeCreated) = 0;
 
     /*! Calls 'callback' for every node in the tree rooted in this node (the traversal is pre-order) */
     virtual void traverse(bool computeKey, void *callbackArgs, traverse_fn callback) = 0;
@@ -91,24 +90,17 @@ private:
     /*! Pointer to the first child node */
     NodeLight *children_;
 
-    NodeLight* findChild(uint key,
-                         bool createIfMissing,
-                         BXLRecursiveLock *maybeNulllock,
-                         BXLRecursiveLock *nonNullLock,
-                         bool *outNewNodeCreated);
-
     bool init(uint key);
 
+    BXLDeclareZoneAllocated(NodeLight)
+
 public:
 
     static NodeLight* create(uint key);
 
 protected:
 
-    Node* findChild(uint key, bool createIfMissing, BXLRecursiveLock *lock, bool *outNewNodeCreated) override
-    {
-        return findChild(key, createIfMissing, nullptr, lock, outNewNodeCreated);
-    }
+    Node* findChild(uint key, bool createIfMissing, bool *outNewNodeCreated) override;
 
     void traverse(bool computeKey, void *callbackArgs, traverse_fn callback) override;
 
@@ -135,6 +127,8 @@ private:
 
     static NodeFast* create(uint numChildren);
 
+    BXLDeclareZoneAllocated(NodeFast)
+
 public:
 
     static NodeFast* createUintNode() { return create(s_uintNodeMaxKey); }
@@ -142,7 +136,7 @@ public:
 
 protected:
 
-    Node* findChild(uint key, bool createIfMissing, BXLRecursiveLock *lock, bool *outNewNodeCreated) override;
+    Node* findChild(uint key, bool createIfMissing, bool *outNewNodeCreated) override;
     void traverse(bool computeKey, void *callbackArgs, traverse_fn callback) override;
     void free() override;
 };
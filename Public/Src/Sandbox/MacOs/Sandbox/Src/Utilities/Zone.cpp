@@ -0,0 +1,214 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include "Zone.hpp"
+
+#if !KEXT_BENCH
+// Exported by com.apple.kpi.unsupported
+extern "C" int cpu_number(void);
+#endif
+
+Zone *Zone::s_zones[kZoneCount] = {0};
+
+static size_t roundUp(size_t size, size_t alignment) { return (size + alignment - 1) & ~(alignment - 1); }
+
+Zone::Zone(ZoneId id, size_t elemSize, size_t elemAlignment) : id_(id)
+{
+    // a free element holds the free list element that links it
+    size_t alignment = elemAlignment > sizeof(void *) ? elemAlignment : sizeof(void *);
+    elemSize_        = roundUp(elemSize > sizeof(lfds711_freelist_element) ? elemSize : sizeof(lfds711_freelist_element), alignment);
+    firstElemOffset_ = roundUp(sizeof(Slab), alignment);
+    slabAlignment_   = alignment;
+    elemsPerSlab_    = elemSize_ + firstElemOffset_ <= kSlabSize ? (uint)((kSlabSize - firstElemOffset_) / elemSize_) : 1;
+
+    slabs_     = nullptr;
+    numSlabs_  = 0;
+    numInUse_  = 0;
+    counters_  = {0};
+    counters_.elemSize = (uint)elemSize_;
+    bzero(cpuSlots_, sizeof(cpuSlots_));
+
+    growLock_ = IOLockAlloc();
+    lfds711_freelist_init_valid_on_current_logical_core(&freeList_, nullptr, 0, nullptr);
+
+    s_zones[id_] = this;
+}
+
+Zone::~Zone()
+{
+    s_zones[id_] = nullptr;
+
+    if (numInUse_ != 0)
+    {
+        // someone still points into the slabs: leak them rather than free memory that is in use
+        log_error("Zone %d still has %d elements in use: its %d slabs are not freed", id_, numInUse_, numSlabs_);
+        return;
+    }
+
+    // the elements are part of the slabs, there is nothing to do for each of them
+    lfds711_freelist_cleanup(&freeList_, nullptr);
+
+    while (slabs_ != nullptr)
+    {
+        Slab *next = slabs_->next;
+        IOFreeAligned(slabs_, firstElemOffset_ + elemsPerSlab_ * elemSize_);
+        slabs_ = next;
+    }
+
+    if (growLock_ != nullptr)
+    {
+        IOLockFree(growLock_);
+        growLock_ = nullptr;
+    }
+}
+
+void Zone::push(void *elem)
+{
+    lfds711_freelist_element *freeListElem = (lfds711_freelist_element *)elem;
+    LFDS711_FREELIST_SET_VALUE_IN_ELEMENT(*freeListElem, elem);
+    lfds711_freelist_push(&freeList_, freeListElem, nullptr);
+}
+
+void* Zone::pop()
+{
+    lfds711_freelist_element *freeListElem = nullptr;
+    return lfds711_freelist_pop(&freeList_, &freeListElem, nullptr)
+        ? LFDS711_FREELIST_GET_VALUE_FROM_ELEMENT(*freeListElem)
+        : nullptr;
+}
+
+char* Zone::addSlab()
+{
+    Slab *slab = (Slab *)IOMallocAligned(firstElemOffset_ + elemsPerSlab_ * elemSize_, slabAlignment_);
+    if (slab == nullptr)
+    {
+        counters_.numSlabAllocationFailures++;
+        return nullptr;
+    }
+
+    slab->next = slabs_;
+    slabs_     = slab;
+
+    // counted before its elements can be allocated, so that there are never more elements in use than elements
+    OSIncrementAtomic(&numSlabs_);
+
+    char *first = (char *)slab + firstElemOffset_;
+    for (uint i = 1; i < elemsPerSlab_; i++)
+    {
+        push(first + i * elemSize_);
+    }
+
+    return first;
+}
+
+void* Zone::allocate(size_t size)
+{
+    if (size > elemSize_)
+    {
+        return IOMalloc(size);
+    }
+
+    CpuSlot *slot = &cpuSlots_[cpu_number() % kCpuSlotCount];
+    void *elem    = slot->elem;
+    if (elem != nullptr && OSCompareAndSwapPtr(elem, nullptr, &slot->elem))
+    {
+        counters_.numCpuCacheHits++;
+    }
+    else if ((elem = pop()) == nullptr)
+    {
+        IOLockLock(growLock_);
+
+        // another thread may have added a slab while this one waited for the lock
+        elem = pop();
+        if (elem == nullptr)
+        {
+            elem = addSlab();
+        }
+
+        IOLockUnlock(growLock_);
+
+        if (elem == nullptr)
+        {
+            return nullptr;
+        }
+    }
+
+    OSIncrementAtomic(&numInUse_);
+    counters_.numAllocations++;
+    return elem;
+}
+
+void Zone::deallocate(void *elem, size_t size)
+{
+    if (elem == nullptr)
+    {
+        return;
+    }
+
+    if (size > elemSize_)
+    {
+        IOFree(elem, size);
+        return;
+    }
+
+    OSDecrementAtomic(&numInUse_);
+
+    CpuSlot *slot = &cpuSlots_[cpu_number() % kCpuSlotCount];
+    if (slot->elem == nullptr && OSCompareAndSwapPtr(nullptr, elem, &slot->elem))
+    {
+        return;
+    }
+
+    push(elem);
+}
+
+bool Zone::reserve(uint numFree)
+{
+    bool success = true;
+
+    IOLockLock(growLock_);
+    while (success && numElems() - (uint)numInUse_ < numFree)
+    {
+        char *first = addSlab();
+        if (first == nullptr)
+        {
+            success = false;
+        }
+        else
+        {
+            push(first);
+        }
+    }
+    IOLockUnlock(growLock_);
+
+    return success;
+}
+
+void Zone::reserveAll(uint numFree)
+{
+    for (int i = 0; i < kZoneCount; i++)
+    {
+        if (s_zones[i] != nullptr && !s_zones[i]->reserve(numFree))
+        {
+            log_error("Could not reserve %d free elements in zone %d", numFree, i);
+        }
+    }
+}
+
+void Zone::getAllCounters(ZoneCounters *counters)
+{
+    for (int i = 0; i < kZoneCount; i++)
+    {
+        const Zone *zone = s_zones[i];
+        if (zone == nullptr)
+        {
+            counters[i] = {0};
+            continue;
+        }
+
+        counters[i]           = zone->counters_;
+        counters[i].numSlabs  = (uint)zone->numSlabs_;
+        counters[i].numElems  = zone->numElems();
+        counters[i].numInUse  = (uint)zone->numInUse_;
+    }
+}
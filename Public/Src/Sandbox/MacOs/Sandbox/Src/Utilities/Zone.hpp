@@ -0,0 +1,129 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef Zone_hpp
+#define Zone_hpp
+
+#include <IOKit/IOLib.h>
+#include "BuildXLSandboxShared.hpp"
+
+extern "C" {
+#include "liblfds711.h"
+}
+
+/*!
+ * A fixed-size allocator for the objects the kext allocates and frees at a high rate: trie nodes, cache records,
+ * process records and the elements of the report queues.
+ *
+ * Elements are carved out of slabs of a few pages that go back to the system only when the zone is destroyed (i.e.,
+ * when the kext is unloaded, which can't happen while any of its objects is alive), so a freed element can be reused
+ * right away, and the lock-free free list of the zone can read a popped element without checking it wasn't freed.
+ *
+ * On top of the free list, every CPU has a slot for one free element: a freed element goes to the slot of the CPU that
+ * freed it, and the next allocation on that CPU takes it from there without touching the shared top of the free list.
+ * The slots are only a cache: a thread may move to another CPU between reading its CPU number and using the slot,
+ * which is harmless because slots are only updated with compare-and-swap.
+ *
+ * The element a zone hands out is raw memory, like the one of IOMalloc: use 'BXLDeclareZoneAllocated' to allocate
+ * the instances of a class from a zone.
+ *
+ * xnu doesn't let kexts create zones of their own (zinit is not part of any KPI), hence this.
+ */
+class Zone
+{
+private:
+
+    typedef struct Slab {
+        Slab *next;
+    } Slab;
+
+    typedef struct {
+        void * volatile elem;
+    } __attribute__((aligned(64))) CpuSlot;
+
+    static const uint kCpuSlotCount = 32;
+
+    static const size_t kSlabSize = 16 * 1024;
+
+    /*! The zones that were constructed, for introspection and pre-warming */
+    static Zone *s_zones[kZoneCount];
+
+    struct lfds711_freelist_state freeList_;
+
+    CpuSlot cpuSlots_[kCpuSlotCount];
+
+    const ZoneId id_;
+
+    /*! The size of an element, rounded up to its alignment */
+    size_t elemSize_;
+
+    /*! Where the first element of a slab starts, after the header of the slab */
+    size_t firstElemOffset_;
+
+    size_t slabAlignment_;
+
+    uint elemsPerSlab_;
+
+    /*! Serializes adding slabs, so that threads that all find the free list empty don't all add one */
+    IOLock *growLock_;
+
+    /*! Only updated while holding 'growLock_' */
+    Slab *slabs_;
+
+    volatile SInt32 numSlabs_;
+
+    volatile SInt32 numInUse_;
+
+    ZoneCounters counters_;
+
+    void push(void *elem);
+
+    void* pop();
+
+    /*! Must be called while holding 'growLock_'. Adds a slab, puts all its elements but the first one in the free list and returns that one. */
+    char* addSlab();
+
+    uint numElems() const { return (uint)numSlabs_ * elemsPerSlab_; }
+
+public:
+
+    Zone(ZoneId id, size_t elemSize, size_t elemAlignment);
+
+    ~Zone();
+
+    /*!
+     * Returns a free element, or nullptr if there was none and no slab could be added.
+     * A 'size' larger than the elements of this zone (e.g., for a subclass of the class of the zone) is allocated with IOMalloc.
+     */
+    void* allocate(size_t size);
+
+    /*! Returns 'elem', allocated by 'allocate' with the same 'size', to this zone */
+    void deallocate(void *elem, size_t size);
+
+    /*! Adds slabs until this zone has at least 'numFree' free elements. Returns false if a slab could not be allocated. */
+    bool reserve(uint numFree);
+
+#pragma mark Static Methods
+
+    /*! Makes every zone hold at least 'numFree' free elements, so that a pip that just started doesn't have to add slabs */
+    static void reserveAll(uint numFree);
+
+    /*! Fills 'counters' (of length 'kZoneCount') with the usage of every zone. The counters of a zone this binary doesn't have are zeroes. */
+    static void getAllCounters(ZoneCounters *counters);
+};
+
+/*!
+ * Makes the operators new and delete of a class allocate its instances from a zone of its own (defined with
+ * 'BXLDefineZoneAllocated' in the source file of the class) instead of kalloc.
+ */
+#define BXLDeclareZoneAllocated(className)                                                      \
+    private:                                                                                    \
+    static Zone s_zone;                                                                         \
+    public:                                                                                     \
+    static void* operator new(size_t size)              { return s_zone.allocate(size); }       \
+    static void operator delete(void *mem, size_t size) { s_zone.deallocate(mem, size); }
+
+#define BXLDefineZoneAllocated(className, zoneId) \
+    Zone className::s_zone(zoneId, sizeof(className), alignof(className))
+
+#endif /* Zone_hpp */
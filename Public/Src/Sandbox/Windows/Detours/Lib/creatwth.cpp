@@ -292,6 +292,153 @@ static inline DWORD PadToDwordPtr(DWORD dw)
     return (dw + 7) & ~7u;
 }
 
+#if BUILDXL_DETOURS
+//////////////////////////////////////////////////////////////////////////////
+//
+// Cache of what UpdateImports32/64 learn about the executable of a target process.
+//
+// Processes launch the same few tools over and over, and an image is mapped at the
+// same base in all the processes of a boot session. So once the section headers and
+// the import directory of an image have been read from a target process, they are
+// remembered, together with the offset at which the new import table was allocated,
+// and the next injection of the same image skips re-reading them from remote memory
+// and searching for free memory near the image. The DOS and NT headers are always
+// read: they identify the image (base, magic, size, timestamp) and get rewritten.
+//
+typedef struct _DETOUR_IMPORTS_CACHE_KEY
+{
+    PBYTE   pbModule;
+    WORD    wMagic;
+    LONG    lfanew;
+    DWORD   cbImage;
+    DWORD   dwTimeDateStamp;
+    DWORD   dwImportsRva;
+    DWORD   cbImports;
+    DWORD   dwIatRva;
+} DETOUR_IMPORTS_CACHE_KEY;
+
+typedef struct _DETOUR_IMPORTS_CACHE_ENTRY
+{
+    DETOUR_IMPORTS_CACHE_KEY    key;
+    DWORD                       dwFileSize;
+    IMAGE_DATA_DIRECTORY        iat;        // IAT directory after a missing one was assigned
+    DWORD                       obNewIid;   // Offset from the module of the last new import table
+    PBYTE                       pbImports;  // Copy of the original import descriptors
+    ULONG                       nLastUse;
+} DETOUR_IMPORTS_CACHE_ENTRY;
+
+static const DWORD c_nImportsCacheEntries = 16;
+static DETOUR_IMPORTS_CACHE_ENTRY s_rImportsCache[c_nImportsCacheEntries];
+static ULONG s_nImportsCacheClock = 0;
+static SRWLOCK s_importsCacheLock = SRWLOCK_INIT;
+
+static inline BOOL IsSameImportsCacheKey(const DETOUR_IMPORTS_CACHE_KEY& a, const DETOUR_IMPORTS_CACHE_KEY& b)
+{
+    return a.pbModule == b.pbModule &&
+        a.wMagic == b.wMagic &&
+        a.lfanew == b.lfanew &&
+        a.cbImage == b.cbImage &&
+        a.dwTimeDateStamp == b.dwTimeDateStamp &&
+        a.dwImportsRva == b.dwImportsRva &&
+        a.cbImports == b.cbImports &&
+        a.dwIatRva == b.dwIatRva;
+}
+
+// Copies the cached data of the image into the out parameters; pbImports must hold key.cbImports bytes.
+static BOOL FindCachedImports(const DETOUR_IMPORTS_CACHE_KEY& key,
+                              PDWORD pdwFileSize,
+                              PIMAGE_DATA_DIRECTORY piat,
+                              PDWORD pobNewIid,
+                              PBYTE pbImports)
+{
+    BOOL fFound = FALSE;
+
+    AcquireSRWLockShared(&s_importsCacheLock);
+    for (DWORD i = 0; i < c_nImportsCacheEntries; i++) {
+        DETOUR_IMPORTS_CACHE_ENTRY& entry = s_rImportsCache[i];
+        if (entry.key.pbModule != NULL && IsSameImportsCacheKey(entry.key, key)) {
+            *pdwFileSize = entry.dwFileSize;
+            *piat = entry.iat;
+            *pobNewIid = entry.obNewIid;
+            if (key.cbImports != 0) {
+                CopyMemory(pbImports, entry.pbImports, key.cbImports);
+            }
+            InterlockedExchange((LONG*)&entry.nLastUse, (LONG)InterlockedIncrement((LONG*)&s_nImportsCacheClock));
+            fFound = TRUE;
+            break;
+        }
+    }
+    ReleaseSRWLockShared(&s_importsCacheLock);
+
+    return fFound;
+}
+
+// Remembers the data of the image, replacing the least recently used entry when the cache is full.
+static VOID AddCachedImports(const DETOUR_IMPORTS_CACHE_KEY& key,
+                             DWORD dwFileSize,
+                             const IMAGE_DATA_DIRECTORY& iat,
+                             DWORD obNewIid,
+                             const BYTE* pbImports)
+{
+    PBYTE pbCopy = NULL;
+    if (key.cbImports != 0) {
+        pbCopy = new BYTE [key.cbImports];
+        if (pbCopy == NULL) {
+            return;
+        }
+        CopyMemory(pbCopy, pbImports, key.cbImports);
+    }
+
+    AcquireSRWLockExclusive(&s_importsCacheLock);
+    DETOUR_IMPORTS_CACHE_ENTRY* pVictim = &s_rImportsCache[0];
+    for (DWORD i = 0; i < c_nImportsCacheEntries; i++) {
+        DETOUR_IMPORTS_CACHE_ENTRY& entry = s_rImportsCache[i];
+        if (entry.key.pbModule == NULL || IsSameImportsCacheKey(entry.key, key)) {
+            pVictim = &entry;
+            break;
+        }
+        if (entry.nLastUse < pVictim->nLastUse) {
+            pVictim = &entry;
+        }
+    }
+
+    PBYTE pbOld = pVictim->pbImports;
+    pVictim->key = key;
+    pVictim->dwFileSize = dwFileSize;
+    pVictim->iat = iat;
+    pVictim->obNewIid = obNewIid;
+    pVictim->pbImports = pbCopy;
+    pVictim->nLastUse = (ULONG)InterlockedIncrement((LONG*)&s_nImportsCacheClock);
+    ReleaseSRWLockExclusive(&s_importsCacheLock);
+
+    if (pbOld != NULL) {
+        delete[] pbOld;
+    }
+}
+
+// Allocates the new import table where it was allocated in the previous process running the same image, if that memory is free.
+static PBYTE AllocateAtCachedOffset(HANDLE hProcess, PBYTE pbModule, DWORD obNewIid, DWORD cbAlloc)
+{
+    if (obNewIid == 0) {
+        return NULL;
+    }
+
+    PBYTE pbAddress = pbModule + obNewIid;
+    PBYTE pbAlloc = (PBYTE)VirtualAllocEx(hProcess, pbAddress, cbAlloc,
+                                          MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    if (pbAlloc != pbAddress) {
+        if (pbAlloc != NULL) {
+            VirtualFreeEx(hProcess, pbAlloc, 0, MEM_RELEASE);
+        }
+        return NULL;
+    }
+
+    DETOUR_TRACE(("[%p..%p] Allocated for import table at the cached offset.\n",
+                  pbAlloc, pbAlloc + cbAlloc));
+    return pbAlloc;
+}
+#endif // BUILDXL_DETOURS
+
 //////////////////////////////////////////////////////////////////////////////
 //
 // For 32-bit Detours, only the function UpdateImports32 exists because we
@@ -953,6 +953,7 @@ struct DetourOperation
     PBYTE               pbTarget;
     PDETOUR_TRAMPOLINE  pTrampoline;
     ULONG               dwPerm;
+    BOOL                fSharesPages;   // Target pages made writable by an earlier operation.
 };
 
 static BOOL                 s_fIgnoreTooSmall       = FALSE;
@@ -964,6 +965,31 @@ static PVOID *              s_ppPendingError        = NULL;
 static DetourThread *       s_pPendingThreads       = NULL;
 static DetourOperation *    s_pPendingOperations    = NULL;
 
+const ULONG_PTR DETOUR_TARGET_PAGE_SIZE = 0x1000;   // Smallest page size, protection changes cover whole pages.
+
+// Most targets live in a couple of modules, and many of them share code pages.
+// Finds a pending attach that already made all the pages of the target writable,
+// so the protection of these pages is changed (and restored) only once per transaction.
+static DetourOperation * detour_find_operation_sharing_pages(PBYTE pbTarget, ULONG cbTarget)
+{
+    const ULONG_PTR cbPage = DETOUR_TARGET_PAGE_SIZE;
+    ULONG_PTR pbFirst = (ULONG_PTR)pbTarget & ~(cbPage - 1);
+    ULONG_PTR pbLast = ((ULONG_PTR)pbTarget + cbTarget - 1) & ~(cbPage - 1);
+
+    for (DetourOperation *o = s_pPendingOperations; o != NULL; o = o->pNext) {
+        if (o->fIsRemove || o->fSharesPages) {
+            continue;
+        }
+
+        ULONG_PTR pbOpFirst = (ULONG_PTR)o->pbTarget & ~(cbPage - 1);
+        ULONG_PTR pbOpLast = ((ULONG_PTR)o->pbTarget + o->pTrampoline->cbRestore - 1) & ~(cbPage - 1);
+        if (pbOpFirst <= pbFirst && pbLast <= pbOpLast) {
+            return o;
+        }
+    }
+    return NULL;
+}
+
 //////////////////////////////////////////////////////////////////////////////
 //
 
@@ -1028,8 +1054,10 @@ LONG WINAPI DetourTransactionAbort()
     for (DetourOperation *o = s_pPendingOperations; o != NULL;) {
         // We don't care if this fails, because the code is still accessible.
         DWORD dwOld;
-        VirtualProtect(o->pbTarget, o->pTrampoline->cbRestore,
-                       o->dwPerm, &dwOld);
+        if (!o->fSharesPages) {
+            VirtualProtect(o->pbTarget, o->pTrampoline->cbRestore,
+                           o->dwPerm, &dwOld);
+        }
 
         if (!o->fIsRemove) {
             if (o->pTrampoline) {
@@ -1293,9 +1321,15 @@ LONG WINAPI DetourTransactionCommitEx(PVOID **pppFailedPointer)
     HANDLE hProcess = GetCurrentProcess();
     for (DetourOperation *o = s_pPendingOperations; o != NULL;) {
         // We don't care if this fails, because the code is still accessible.
+        // Shared pages are restored and flushed at once by the (older, thus later in the list) operation that unprotected them.
         DWORD dwOld;
-        VirtualProtect(o->pbTarget, o->pTrampoline->cbRestore, o->dwPerm, &dwOld);
-        FlushInstructionCache(hProcess, o->pbTarget, o->pTrampoline->cbRestore);
+        if (!o->fSharesPages) {
+            VirtualProtect(o->pbTarget, o->pTrampoline->cbRestore, o->dwPerm, &dwOld);
+
+            PBYTE pbFirst = (PBYTE)((ULONG_PTR)o->pbTarget & ~(DETOUR_TARGET_PAGE_SIZE - 1));
+            PBYTE pbLimit = (PBYTE)(((ULONG_PTR)o->pbTarget + o->pTrampoline->cbRestore + DETOUR_TARGET_PAGE_SIZE - 1) & ~(DETOUR_TARGET_PAGE_SIZE - 1));
+            FlushInstructionCache(hProcess, pbFirst, pbLimit - pbFirst);
+        }
 
         if (o->fIsRemove && o->pTrampoline) {
             detour_free_trampoline(o->pTrampoline);
@@ -1696,7 +1730,11 @@ LONG WINAPI DetourAttachEx(PVOID *ppPointer,
 #endif // DETOURS_ARM
 
     DWORD dwOld = 0;
-    if (!VirtualProtect(pbTarget, cbTarget, PAGE_EXECUTE_READWRITE, &dwOld)) {
+    DetourOperation *oSharing = detour_find_operation_sharing_pages(pbTarget, cbTarget);
+    if (oSharing != NULL) {
+        dwOld = oSharing->dwPerm;
+    }
+    else if (!VirtualProtect(pbTarget, cbTarget, PAGE_EXECUTE_READWRITE, &dwOld)) {
         DETOUR_TRACE_ERROR(L"VirtualProtect(%p) failed: %d\n",
             pbTarget, GetLastError());
         error = GetLastError();
@@ -1729,6 +1767,7 @@ LONG WINAPI DetourAttachEx(PVOID *ppPointer,
     o->pTrampoline = pTrampoline;
     o->pbTarget = pbTarget;
     o->dwPerm = dwOld;
+    o->fSharesPages = (oSharing != NULL);
     o->pNext = s_pPendingOperations;
     s_pPendingOperations = o;
 
@@ -1874,6 +1913,7 @@ LONG WINAPI DetourDetach(PVOID *ppPointer,
     o->pTrampoline = pTrampoline;
     o->pbTarget = pbTarget;
     o->dwPerm = dwOld;
+    o->fSharesPages = FALSE;
     o->pNext = s_pPendingOperations;
     s_pPendingOperations = o;
 
@@ -12,6 +12,7 @@
 // BuildXL-specific changes (forked from MSR version):
 //  - Support for detouring 32-bit from 64-bit (without UpdImports)
 //  - ETW tracing (see tracing.cpp).
+//  - Caching of the image data read from the target process (see FindCachedImports).
 
 // UpdateImports32 aka UpdateImports64
 static BOOL UPDATE_IMPORTS_XX(HANDLE hProcess,
@@ -22,6 +23,9 @@ static BOOL UPDATE_IMPORTS_XX(HANDLE hProcess,
 {
     BOOL fSucceeded = FALSE;
     BYTE * pbNew = NULL;
+#if BUILDXL_DETOURS
+    BYTE * pbImports = NULL;
+#endif
 
     PBYTE pbModule = (PBYTE)hModule;
 
@@ -36,6 +40,12 @@ static BOOL UPDATE_IMPORTS_XX(HANDLE hProcess,
             delete[] pbNew;
             pbNew = NULL;
         }
+#if BUILDXL_DETOURS
+        if (pbImports != NULL) {
+            delete[] pbImports;
+            pbImports = NULL;
+        }
+#endif
         return fSucceeded;
     }
 
@@ -74,6 +84,30 @@ static BOOL UPDATE_IMPORTS_XX(HANDLE hProcess,
 
     // Find the size of the mapped file.
     DWORD dwFileSize = 0;
+#if BUILDXL_DETOURS
+    DETOUR_IMPORTS_CACHE_KEY key;
+    ZeroMemory(&key, sizeof(key));
+    key.pbModule = pbModule;
+    key.wMagic = inh.OptionalHeader.Magic;
+    key.lfanew = idh.e_lfanew;
+    key.cbImage = inh.OptionalHeader.SizeOfImage;
+    key.dwTimeDateStamp = inh.FileHeader.TimeDateStamp;
+    key.dwImportsRva = inh.IMPORT_DIRECTORY.VirtualAddress;
+    key.cbImports = inh.IMPORT_DIRECTORY.VirtualAddress != 0 ? inh.IMPORT_DIRECTORY.Size : 0;
+    key.dwIatRva = inh.IAT_DIRECTORY.VirtualAddress;
+
+    pbImports = new BYTE [key.cbImports + 1];
+    if (pbImports == NULL) {
+        DETOUR_TRACE(("new BYTE [cbImports] failed.\n"));
+        goto finish;
+    }
+
+    DWORD obCachedIid = 0;
+    BOOL fCached = FindCachedImports(key, &dwFileSize, &inh.IAT_DIRECTORY, &obCachedIid, pbImports);
+    DETOUR_TRACE(("Image data %s\n", fCached ? "cached" : "not cached"));
+
+    if (!fCached) {
+#endif // BUILDXL_DETOURS
     DWORD dwSec = idh.e_lfanew +
         FIELD_OFFSET(IMAGE_NT_HEADERS_XX, OptionalHeader) +
         inh.FileHeader.SizeOfOptionalHeader;
@@ -111,6 +145,18 @@ static BOOL UPDATE_IMPORTS_XX(HANDLE hProcess,
             dwFileSize = ish.PointerToRawData + ish.SizeOfRawData;
         }
     }
+#if BUILDXL_DETOURS
+    // Read the existing IIDs.
+    if (key.cbImports != 0 &&
+        !ReadProcessMemory(hProcess,
+                           pbModule + inh.IMPORT_DIRECTORY.VirtualAddress,
+                           pbImports,
+                           key.cbImports, NULL)) {
+        DETOUR_TRACE_ERROR(L"ReadProcessMemory(imports) failed: %d\n", GetLastError());
+        goto finish;
+    }
+    } // !fCached
+#endif // BUILDXL_DETOURS
     DETOUR_TRACE(("dwFileSize = %08x\n", dwFileSize));
 
 #if IGNORE_CHECKSUMS
@@ -167,7 +213,14 @@ static BOOL UPDATE_IMPORTS_XX(HANDLE hProcess,
     DETOUR_TRACE(("pbBase = %p\n", pbBase));
 
 	// Allocate space in the PE file for moving the IIDs.
+#if BUILDXL_DETOURS
+    PBYTE pbNewIid = fCached ? AllocateAtCachedOffset(hProcess, pbModule, obCachedIid, cbNew) : NULL;
+    if (pbNewIid == NULL) {
+        pbNewIid = FindAndAllocateNearBase(hProcess, pbBase, cbNew);
+    }
+#else
 	PBYTE pbNewIid = FindAndAllocateNearBase(hProcess, pbBase, cbNew);
+#endif // BUILDXL_DETOURS
     if (pbNewIid == NULL) {
         DETOUR_TRACE(("FindAndAllocateNearBase failed.\n"));
         goto finish;
@@ -189,6 +242,9 @@ static BOOL UPDATE_IMPORTS_XX(HANDLE hProcess,
 
 		// Read existing IIDs into the in-memory buffer, but place them past
 		// the space for the IIDs of the to-be injected DLLs.
+#if BUILDXL_DETOURS
+        CopyMemory(pbNew + obRem, pbImports, key.cbImports);
+#else
         if (!ReadProcessMemory(hProcess,
                                pbModule + inh.IMPORT_DIRECTORY.VirtualAddress,
                                pbNew + obRem,
@@ -196,7 +252,15 @@ static BOOL UPDATE_IMPORTS_XX(HANDLE hProcess,
             DETOUR_TRACE_ERROR(L"ReadProcessMemory(imports) failed: %d\n", GetLastError());
             goto finish;
         }
+#endif // BUILDXL_DETOURS
+    }
+
+#if BUILDXL_DETOURS
+    // Remember the image data (before the import directory is moved below) for the next process running the same image.
+    if (!fCached || obBase != obCachedIid) {
+        AddCachedImports(key, dwFileSize, inh.IAT_DIRECTORY, obBase, pbImports);
     }
+#endif // BUILDXL_DETOURS
 
     PIMAGE_IMPORT_DESCRIPTOR piid = (PIMAGE_IMPORT_DESCRIPTOR)pbNew;
     DWORD_XX *pt;
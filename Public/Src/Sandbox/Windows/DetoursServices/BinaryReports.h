@@ -0,0 +1,57 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Layout of the reports sent to BuildXL when EnableDetoursBinaryReports is set.
+//
+// Every report is a frame: a 32-bit length counting the bytes that follow it (the same framing the Linux sandbox uses
+// on its reports FIFO), then a 32-bit ReportFrameKind and the payload. All integers are little-endian.
+//  - ReportFrameKind_TextLine: the payload is a regular UTF-16 report line, including its line terminator.
+//  - ReportFrameKind_FileAccess: the payload is a BinaryFileAccessReport, followed by the operation name, the path,
+//    the enumeration filter and the process arguments, as UTF-16 without null terminators. Paths are not escaped.
+//
+// CODESYNC: Public/Src/Engine/Processes/BinaryFileAccessReport.cs
+
+enum ReportFrameKind : uint32_t
+{
+    ReportFrameKind_TextLine = 1,
+    ReportFrameKind_FileAccess = 2,
+};
+
+struct ReportFrameHeader
+{
+    uint32_t Length;
+    uint32_t Kind;
+};
+
+struct BinaryFileAccessReport
+{
+    uint64_t Usn;
+    uint32_t ProcessId;
+    uint32_t Id;
+    uint32_t CorrelationId;
+    uint32_t RequestedAccess;
+    uint32_t Status;
+    uint32_t ExplicitlyReported;
+    uint32_t Error;
+    uint32_t DesiredAccess;
+    uint32_t ShareMode;
+    uint32_t CreationDisposition;
+    uint32_t FlagsAndAttributes;
+    uint32_t OpenedFileOrDirectoryAttributes;
+    uint32_t PathId;
+
+    // In characters
+    uint32_t OperationLength;
+    uint32_t PathLength;
+    uint32_t FilterLength;
+    uint32_t ProcessArgsLength;
+};
+
+static_assert(sizeof(ReportFrameHeader) == 8, "The managed parser relies on this layout");
+static_assert(sizeof(BinaryFileAccessReport) == 76, "The managed parser relies on this layout");
+static_assert(offsetof(BinaryFileAccessReport, PathId) == 56, "The managed parser relies on this layout");
@@ -2,6 +2,93 @@
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
 #include "CanonicalizedPath.h"
+#include "DetoursPerformanceCounters.h"
+
+// Number of canonicalizations each thread remembers. Tools tend to pass the same few paths over and over.
+static const size_t s_canonicalizationCacheSize = 8;
+
+// Longest noncanonical path that gets cached, so the cache of a thread stays small
+static const size_t s_maxCachedPathLength = MAX_PATH;
+
+// Incremented whenever the current directory changes (see Detoured_SetCurrentDirectoryW). GetFullPathName resolves relative paths
+// against the current directory, so a cached canonicalization is only valid for the generation it was computed with.
+static volatile LONG s_currentDirectoryGeneration = 0;
+
+struct CanonicalizationCacheEntry {
+    LONG Generation = 0;
+    ULONG LastUse = 0;
+    std::wstring NoncanonicalPath;
+    CanonicalizedPath Path;
+};
+
+// The canonicalizations of a thread, evicted in LRU order. Only the owning thread uses it, so it needs no locking.
+struct CanonicalizationCache {
+    ULONG Clock = 0;
+    CanonicalizationCacheEntry Entries[s_canonicalizationCacheSize];
+};
+
+static __declspec(thread) CanonicalizationCache* gt_canonicalizationCache = nullptr;
+
+static CanonicalizationCache* GetThreadCanonicalizationCache()
+{
+    if (gt_canonicalizationCache == nullptr)
+    {
+        gt_canonicalizationCache = new CanonicalizationCache();
+    }
+
+    return gt_canonicalizationCache;
+}
+
+static bool TryGetCachedCanonicalization(CanonicalizationCache* cache, LONG generation, wchar_t const* noncanonicalPath, CanonicalizedPath& path)
+{
+    for (CanonicalizationCacheEntry& entry : cache->Entries)
+    {
+        if (!entry.Path.IsNull() && entry.Generation == generation && entry.NoncanonicalPath.compare(noncanonicalPath) == 0)
+        {
+            entry.LastUse = ++cache->Clock;
+            path = entry.Path;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void AddCachedCanonicalization(CanonicalizationCache* cache, LONG generation, wchar_t const* noncanonicalPath, CanonicalizedPath const& path)
+{
+    // Replace the least recently used entry, or an entry of an older generation, which can't be used anymore
+    CanonicalizationCacheEntry* victim = &cache->Entries[0];
+    for (CanonicalizationCacheEntry& entry : cache->Entries)
+    {
+        if (entry.Path.IsNull() || entry.Generation != generation)
+        {
+            victim = &entry;
+            break;
+        }
+
+        if (entry.LastUse < victim->LastUse)
+        {
+            victim = &entry;
+        }
+    }
+
+    victim->Generation = generation;
+    victim->LastUse = ++cache->Clock;
+    victim->NoncanonicalPath.assign(noncanonicalPath);
+    victim->Path = path;
+}
+
+void CanonicalizedPath::InvalidateCurrentDirectory()
+{
+    InterlockedIncrement(&s_currentDirectoryGeneration);
+}
+
+void CanonicalizedPath::ReleaseThreadCache()
+{
+    CanonicalizationCache* cache = gt_canonicalizationCache;
+    gt_canonicalizationCache = nullptr;
+    delete cache;
+}
 
 // Applies GetFullPathnameW to 'path'. This function should not be used on \\?\ or \??\ style paths.
 static DWORD GetFullPath(__in PCWSTR path, std::wstring& fullPath)
@@ -54,6 +141,8 @@ static DWORD GetFullPath(__in PCWSTR path, std::wstring& fullPath)
 }
 
 CanonicalizedPath CanonicalizedPath::Canonicalize(wchar_t const* noncanonicalPath) {
+    HotPathTimer timer(DetoursHotPath::Canonicalization);
+
     PathType pathType;
     std::wstring fullPath;
     if (IsWin32NtPathName(noncanonicalPath)) {
@@ -74,6 +163,16 @@ CanonicalizedPath CanonicalizedPath::Canonicalize(wchar_t const* noncanonicalPat
         // Note that even non-drive-letter devices like \\.\nul, \\.\Harddisk0Partition1, etc. can safely become nul and Harddisk0Partition1 respectively; 
         // imagine the manifest tree root as implicitly \??\ (the session's DosDevices namespace).
 
+        // The generation is read before calling GetFullPath: if the current directory changes meanwhile, the result is cached for a stale generation
+        // and never used.
+        LONG const generation = s_currentDirectoryGeneration;
+        CanonicalizationCache* cache = wcslen(noncanonicalPath) <= s_maxCachedPathLength ? GetThreadCanonicalizationCache() : nullptr;
+
+        CanonicalizedPath cachedPath;
+        if (cache != nullptr && TryGetCachedCanonicalization(cache, generation, noncanonicalPath, cachedPath)) {
+            return cachedPath;
+        }
+
         DWORD error = GetFullPath(noncanonicalPath, fullPath);
         if (error != ERROR_SUCCESS) {
             return CanonicalizedPath();
@@ -81,20 +180,50 @@ CanonicalizedPath CanonicalizedPath::Canonicalize(wchar_t const* noncanonicalPat
 
         // Note that GetFullPath("nul") == "\\.\nul" (similar for other classic devices), so we check for the local device type after that step.
         pathType = IsLocalDevicePathName(fullPath.c_str()) ? PathType::LocalDevice : PathType::Win32;
+
+        if (cache != nullptr) {
+            CanonicalizedPath path(pathType, std::move(fullPath));
+            AddCachedCanonicalization(cache, generation, noncanonicalPath, path);
+            return path;
+        }
     }
 
     return CanonicalizedPath(pathType, std::move(fullPath));
 }
 
+CanonicalizedPath CanonicalizedPath::Canonicalize(wchar_t const* noncanonicalPath, size_t length) {
+    assert(noncanonicalPath);
+
+    // Like the null-terminated version would, stop at an embedded null character
+    length = wcsnlen(noncanonicalPath, length);
+
+    if (length >= 4 && IsWin32NtPathName(noncanonicalPath)) {
+        // See Canonicalize above: the path is used as is
+        HotPathTimer timer(DetoursHotPath::Canonicalization);
+        return CanonicalizedPath(PathType::Win32Nt, noncanonicalPath, length);
+    }
+
+    std::wstring terminatedPath(noncanonicalPath, length);
+    return Canonicalize(terminatedPath.c_str());
+}
+
 CanonicalizedPath CanonicalizedPath::Extend(wchar_t const* additionalComponents, size_t* extensionStartIndex) const {
+    assert(additionalComponents);
+    return Extend(additionalComponents, wcslen(additionalComponents), extensionStartIndex);
+}
+
+CanonicalizedPath CanonicalizedPath::Extend(wchar_t const* additionalComponents, size_t additionalComponentsLength, size_t* extensionStartIndex) const {
     assert(additionalComponents);
     assert(!IsNull() && m_value);
-    while (IsDirectorySeparator(additionalComponents[0])) {
+    while (additionalComponentsLength > 0 && IsDirectorySeparator(additionalComponents[0])) {
         additionalComponents++;
+        additionalComponentsLength--;
     }
 
-    std::wstring extended{};
-    extended.reserve(wcslen(additionalComponents) + Length() + 1);
+    // This path is already canonical, so the extended path is built in place in its final storage, with a single allocation for the string
+    std::shared_ptr<std::wstring> extendedValue = std::make_shared<std::wstring>();
+    std::wstring& extended = *extendedValue;
+    extended.reserve(additionalComponentsLength + Length() + 1);
     extended.append(*m_value);
 
     if (!extended.empty() && !IsDirectorySeparator(extended.back())) {
@@ -105,9 +234,9 @@ CanonicalizedPath CanonicalizedPath::Extend(wchar_t const* additionalComponents,
         *extensionStartIndex = extended.size();
     }
 
-    extended.append(additionalComponents);
+    extended.append(additionalComponents, additionalComponentsLength);
 
-    return CanonicalizedPath(Type, std::move(extended));
+    return CanonicalizedPath(Type, std::move(extendedValue));
 }
 
 wchar_t const* CanonicalizedPath::GetLastComponent() const {
@@ -26,7 +26,10 @@ struct CanonicalizedPath {
     CanonicalizedPath(const CanonicalizedPath& other) = default;
     CanonicalizedPath& operator=(const CanonicalizedPath&) = default;
 
-    CanonicalizedPath Extend(wchar_t const* additionalComponents, size_t* extensionStartIndex = nullptr) const;
+    CanonicalizedPath Extend(wchar_t const* additionalComponents, size_t* extensionStartIndex = nullptr) const;
+
+    // Same as Extend, for components given as a counted string (not necessarily null-terminated).
+    CanonicalizedPath Extend(wchar_t const* additionalComponents, size_t additionalComponentsLength, size_t* extensionStartIndex) const;
     CanonicalizedPath RemoveLastComponent() const;
 
     bool IsNull() const { return Type == PathType::Null; }
@@ -59,8 +62,20 @@ struct CanonicalizedPath {
     wchar_t const* GetLastComponent() const;
 
     // Attempts to canonicalize the given path. On failure, returns a path with IsNull() == true.
+    // The most recent canonicalizations of each thread are cached, so canonicalizing the same path again is cheap and shares its storage.
     static CanonicalizedPath Canonicalize(wchar_t const* noncanonicalPath);
 
+    // Same as Canonicalize, for a counted string (not necessarily null-terminated), such as the buffer of a UNICODE_STRING.
+    // An NT path (\??\) is used as is, so its characters are copied once, straight into the storage of the result. Any
+    // other path needs GetFullPathName, which takes a null-terminated string, so it is canonicalized from a copy.
+    static CanonicalizedPath Canonicalize(wchar_t const* noncanonicalPath, size_t length);
+
+    // Invalidates the cached canonicalizations, which depend on the current directory. Must be called whenever the current directory changes.
+    static void InvalidateCurrentDirectory();
+
+    // Releases the canonicalization cache of the calling thread, if any. Must be called when the thread exits.
+    static void ReleaseThreadCache();
+
     PathType Type;
 
 private:
@@ -70,5 +85,10 @@ private:
         : Type(type), m_value(std::make_shared<std::wstring>(std::move(value)))
     { }
 
+    // Private constructor for Extend, which builds the path string in place.
+    CanonicalizedPath(PathType type, std::shared_ptr<std::wstring>&& value)
+        : Type(type), m_value(std::move(value))
+    { }
+
     std::shared_ptr<std::wstring> m_value;
 };
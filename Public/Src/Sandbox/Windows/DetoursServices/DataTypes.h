@@ -109,6 +109,25 @@ inline bool CheckReportAnyAccess(FileAccessManifestFlag flags, bool accessDenied
     m(AlwaysRemoteInjectDetoursFrom32BitProcess,        0x10) \
     m(UnconditionallyEnableLinuxPTraceSandbox,          0x20) \
     m(IgnoreDeviceIoControlGetReparsePoint,             0x40) \
+    m(EnableLinuxSandboxReportBatching,                 0x80) \
+    m(EnableLinuxSandboxSharedAccessCache,             0x100) \
+    m(EnableLinuxSandboxSeccompUserNotifications,      0x200) \
+    m(EnableLinuxSandboxAsyncReporting,                0x400) \
+    m(EnableDetoursReportBatching,                     0x800) \
+    m(EnableDetoursBinaryReports,                     0x1000) \
+    m(EnableDetoursSharedReparsePointCache,           0x2000) \
+    m(EnableDetoursSharedManifestSection,             0x4000) \
+    m(EnableDetoursPerformanceCounters,               0x8000) \
+    m(EnableDetoursAsyncReporting,                   0x10000) \
+    m(RaiseSandboxHelperThreadPriority,              0x20000) \
+    m(EnableDetoursExpectedUsnCache,                 0x40000) \
+    m(EnableLinuxSandboxSharedMemoryReports,         0x80000) \
+    m(EnableDetoursBasicEnumerationInfo,            0x100000) \
+    m(EnableDetoursPipelinedRemoteInjection,        0x200000) \
+    m(EnableDetoursFileIdPathCache,                 0x400000) \
+    m(EnableDetoursSharedPluginDecisionCache,       0x800000) \
+    m(EnableDetoursVolumeMountPointCache,          0x1000000) \
+    m(EnableDetoursSystemCallerFilter,             0x2000000) \
 
 enum class FileAccessManifestExtraFlag {
     FOR_ALL_FAM_EXTRA_FLAGS(GEN_FAM_FLAG_ENUM_NAME_VALUE)
@@ -171,6 +190,10 @@ enum FileAccessPolicy
     // If set, full reparse point tracking should be done for this path/file
     FileAccessPolicy_EnableFullReparsePointParsing = 0x1000,
 
+    // If set, every path that exists under this scope is in the manifest, and the scope doesn't change while the pip runs:
+    // probes for paths under this scope that are not in the manifest can be answered as absent without looking at the file system.
+    FileAccessPolicy_ConeIsFullyListed = 0x2000,
+
     // If set, then we will report all attempts to access files under this scope (whether existent or not).
     // BuildXL uses this information to discover dynamic dependencies, such as #include-ed files.
     FileAccessPolicy_ReportAccess = FileAccessPolicy_ReportAccessIfNonExistent | FileAccessPolicy_ReportAccessIfExistent,
@@ -631,6 +654,35 @@ typedef struct ManifestSubstituteProcessExecutionShim_t
 } ManifestSubstituteProcessExecutionShim_t;
 typedef const ManifestSubstituteProcessExecutionShim_t * PCManifestSubstituteProcessExecutionShim;
 
+// CODESYNC: FileAccessManifest.cs :: KnownReparsePointKind
+enum KnownReparsePointKind
+{
+    KnownReparsePointKind_None = 0,     // Neither the path nor any of its ancestors is a reparse point
+    KnownReparsePointKind_Symlink = 1,
+    KnownReparsePointKind_Junction = 2,
+};
+
+// ==========================================================================
+// == ManifestKnownReparsePoints
+// ==========================================================================
+typedef struct ManifestKnownReparsePoints_t
+{
+    GENERATE_TAG("ManifestKnownReparsePoints", 0xABCDEF06)
+
+    typedef uint32_t    CountType;
+    CountType           Count;
+
+    // Followed by Count entries, each a uint32_t KnownReparsePointKind and 2 WriteChars strings: the path and the target
+    // of the reparse point (empty for KnownReparsePointKind_None).
+
+    /// There are no variable-length members, so the length of this struct can be determined using sizeof.
+    size_t GetSize() const noexcept
+    {
+        return sizeof(ManifestKnownReparsePoints_t);
+    }
+} ManifestKnownReparsePoints_t;
+typedef const ManifestKnownReparsePoints_t * PCManifestKnownReparsePoints;
+
 // ==========================================================================
 // == ManifestRecord
 // ==========================================================================
@@ -3,11 +3,13 @@
 
 #include "stdafx.h"
 
+#include "BinaryReports.h"
 #include "globals.h"
 #include "DebuggingHelpers.h"
 #include "FileAccessHelpers.h"
 #include "DetoursServices.h"
 #include "DetoursHelpers.h"
+#include "SendReport.h"
 #include "buildXL_mem.h"
 
 using std::unique_ptr;
@@ -123,6 +125,8 @@ void HandleDetoursInjectionAndCommunicationErrors(int errorCode, LPCWSTR eventLo
 
     if (HardExitOnErrorInDetours())
     {
+        // Reports queued so far still go out before the process exits
+        FlushQueuedReports();
         exit(errorCode);
     }
 }
@@ -140,14 +144,25 @@ void Dbg(PCWSTR format, ...)
         return;
     }
 
-    std::wstring report = DebugStringFormat(L"%d,", ReportType::ReportType_DebugMessage);
+    // With binary reports, the line goes out as a text frame: leave room for the frame header, filled in once the length of the line is known
+    size_t headerLength = EnableDetoursBinaryReports() ? sizeof(ReportFrameHeader) / sizeof(wchar_t) : 0; // in characters
+    std::wstring report(headerLength, L'\0');
+    report.append(DebugStringFormat(L"%d,", ReportType::ReportType_DebugMessage));
     report.append(resultArgs);
     report.append(L"\r\n");
 
+    if (headerLength > 0)
+    {
+        ReportFrameHeader header;
+        header.Length = (uint32_t)(sizeof(wchar_t) * report.length() - sizeof(header.Length));
+        header.Kind = ReportFrameKind_TextLine;
+        memcpy(&report[0], &header, sizeof(header));
+    }
+
     PCWSTR buffer = report.c_str();
 
 #if SUPER_VERBOSE
-    fputws(buffer, stderr);
+    fputws(buffer + headerLength, stderr);
 #endif
 
     OVERLAPPED overlapped;
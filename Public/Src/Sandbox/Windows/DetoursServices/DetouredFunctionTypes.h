@@ -348,6 +348,14 @@ typedef BOOL (WINAPI *RemoveDirectoryA_t)(
     __in  LPCSTR lpPathName
     );
 
+typedef BOOL (WINAPI *SetCurrentDirectoryW_t)(
+    __in  LPCWSTR lpPathName
+    );
+
+typedef BOOL (WINAPI *SetCurrentDirectoryA_t)(
+    __in  LPCSTR lpPathName
+    );
+
 typedef BOOL (WINAPI *DecryptFileW_t)(
     __in        LPCWSTR lpFileName,
     __reserved  DWORD dwReserved
@@ -5,14 +5,22 @@
 
 #include "DetouredFunctions.h"
 #include "DetouredScope.h"
+#include "DetoursPerformanceCounters.h"
+#include "ExpectedUsnCache.h"
+#include "FileIdPathCache.h"
 #include "HandleOverlay.h"
 #include "MetadataOverrides.h"
 #include "ResolvedPathCache.h"
 #include "SendReport.h"
+#include "SharedReparsePointCache.h"
 #include "StringOperations.h"
 #include "SubstituteProcessExecution.h"
+#include "SystemCallerFilter.h"
 #include "UnicodeConverter.h"
+#include "VolumeMountPointCache.h"
+#include "WriteAccessReportCache.h"
 
+#include <intrin.h>
 #include <Pathcch.h>
 
 using std::map;
@@ -43,6 +51,24 @@ static bool IgnoreFullReparsePointResolvingForPath(const PolicyResult& policyRes
     return IgnoreFullReparsePointResolving() && !policyResult.EnableFullReparsePointParsing();
 }
 
+// Deletions, renames and links may change files: the reports of earlier opens for write, the USNs checked and the paths of the files opened by id
+// so far no longer hold
+static void InvalidateFileAccessCaches()
+{
+    WriteAccessReportCache::GetInstance()->Invalidate();
+    ExpectedUsnCache::GetInstance()->Invalidate();
+    FileIdPathCache::GetInstance()->Invalidate();
+}
+
+// Writes may change the file opened as well, so the USNs checked so far no longer hold
+static void InvalidateExpectedUsnsIfWriting(AccessCheckResult const& accessCheck)
+{
+    if ((accessCheck.Access & RequestedAccess::Write) == RequestedAccess::Write)
+    {
+        ExpectedUsnCache::GetInstance()->Invalidate();
+    }
+}
+
 /// <summary>
 /// Given a policy result, get the level of the file path where the path should start to be checked for reparse points.
 /// d: is level 0, d:\a is level 1, etc...
@@ -56,22 +82,31 @@ static size_t GetLevelToEnableFullReparsePointParsing(const PolicyResult& policy
 }
 
 /// <summary>
-/// Checks if a file is a reparse point by calling <code>GetFileAttributesW</code>.
+/// Gets the attributes and the reparse point tag of an open file, querying only <code>FileAttributeTagInfo</code>.
 /// </summary>
-static bool IsReparsePoint(_In_ LPCWSTR lpFileName, _In_ HANDLE hFile)
+static bool TryGetAttributeTagInfo(_In_ HANDLE hFile, _Out_ FILE_ATTRIBUTE_TAG_INFO& attributeTagInfo)
 {
     DWORD lastError = GetLastError();
-    if (hFile != INVALID_HANDLE_VALUE)
+    BOOL result = hFile != INVALID_HANDLE_VALUE
+        && GetFileInformationByHandleEx(hFile, FileAttributeTagInfo, &attributeTagInfo, sizeof(attributeTagInfo));
+
+    SetLastError(lastError);
+    return result != FALSE;
+}
+
+/// <summary>
+/// Checks if a file is a reparse point from its handle if it is open, or by calling <code>GetFileAttributesW</code> otherwise.
+/// </summary>
+static bool IsReparsePoint(_In_ LPCWSTR lpFileName, _In_ HANDLE hFile)
+{
+    FILE_ATTRIBUTE_TAG_INFO attributeTagInfo;
+    if (TryGetAttributeTagInfo(hFile, attributeTagInfo))
     {
-        BY_HANDLE_FILE_INFORMATION fileInfo;
-        BOOL result = GetFileInformationByHandle(hFile, &fileInfo);
-        if (result)
-        {
-            SetLastError(lastError);
-            return (fileInfo.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) != 0;
-        }
+        return (attributeTagInfo.FileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) != 0;
     }
 
+    DWORD lastError = GetLastError();
+
     DWORD attributes;
     bool result = lpFileName != nullptr
         && ((attributes = GetFileAttributesW(lpFileName)) != INVALID_FILE_ATTRIBUTES)
@@ -83,10 +118,16 @@ static bool IsReparsePoint(_In_ LPCWSTR lpFileName, _In_ HANDLE hFile)
 }
 
 /// <summary>
-/// Gets reparse point type of a file name by querying <code>dwReserved0</code> field of <code>WIN32_FIND_DATA</code>.
+/// Gets reparse point type of a file from its handle if it is open, or by querying <code>dwReserved0</code> field of <code>WIN32_FIND_DATA</code> otherwise.
 /// </summary>
 static DWORD GetReparsePointType(_In_ LPCWSTR lpFileName, _In_ HANDLE hFile)
 {
+    FILE_ATTRIBUTE_TAG_INFO attributeTagInfo;
+    if (TryGetAttributeTagInfo(hFile, attributeTagInfo))
+    {
+        return (attributeTagInfo.FileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) != 0 ? attributeTagInfo.ReparseTag : 0;
+    }
+
     DWORD ret = 0;
     DWORD lastError = GetLastError();
 
@@ -133,16 +174,119 @@ static bool AccessReparsePointTarget(
     return !FlagsAndAttributesContainReparsePointFlag(dwFlagsAndAttributes) && IsReparsePoint(lpFileName, hFile);
 }
 
+/// <summary>
+/// Whether the given drive letter names a local volume, as opposed to a subst drive or a mapped network drive, whose files have a final path under another root.
+/// </summary>
+static bool IsLocalVolumeDrive(wchar_t driveLetter)
+{
+    // Per drive letter: 0 if not known yet, 1 for a local volume, 2 otherwise. Racing threads compute the same answer.
+    static volatile LONG s_driveKinds[26] = { 0 };
+
+    wchar_t upperDriveLetter = towupper(driveLetter);
+    if (upperDriveLetter < L'A' || upperDriveLetter > L'Z')
+    {
+        return false;
+    }
+
+    volatile LONG* driveKind = &s_driveKinds[upperDriveLetter - L'A'];
+    if (*driveKind == 0)
+    {
+        wchar_t drive[] = { upperDriveLetter, L':', L'\0' };
+        wchar_t target[MAX_PATH];
+        bool isLocalVolume = QueryDosDeviceW(drive, target, MAX_PATH) != 0 && wcsncmp(target, L"\\Device\\HarddiskVolume", 22) == 0;
+        InterlockedExchange(driveKind, isLocalVolume ? 1 : 2);
+    }
+
+    return *driveKind == 1;
+}
+
+/// <summary>
+/// Tries to get the final full path of a handle from the overlay registered when the handle was opened.
+/// </summary>
+/// <remarks>
+/// The path a handle was opened with is its final path when neither the path nor its parent contain reparse points, which the
+/// resolved path cache knows when the path was checked for the policy of an earlier access (and forgets when the path is moved or deleted).
+/// Handles that were not seen opened, paths with short names, and paths on subst or network drives need <code>GetFinalPathNameByHandleW</code>.
+/// </remarks>
+static bool TryGetFinalPathFromHandleOverlay(_In_ HANDLE hFile, _Inout_ wstring& fullPath)
+{
+    // Without full reparse point resolution, or when renames are not tracked, the cache can't tell
+    if (IgnoreReparsePoints() || IgnoreZwRenameFileInformation() || IgnoreSetFileInformationByHandle())
+    {
+        return false;
+    }
+
+    HandleOverlayRef overlay = TryLookupHandleOverlay(hFile);
+    if (overlay == nullptr || overlay->Type == HandleType::Find || overlay->Renamed || IgnoreFullReparsePointResolvingForPath(*overlay->Policy))
+    {
+        return false;
+    }
+
+    const CanonicalizedPath& path = overlay->Policy->GetCanonicalizedPath();
+    if (path.IsNull() || path.Type == PathType::LocalDevice)
+    {
+        return false;
+    }
+
+    const wchar_t* pathWithoutPrefix = path.GetPathStringWithoutTypePrefix();
+    if (wcslen(pathWithoutPrefix) < 3
+        || pathWithoutPrefix[1] != L':'
+        || pathWithoutPrefix[2] != L'\\'
+        || wcschr(pathWithoutPrefix, L'~') != nullptr
+        || !IsLocalVolumeDrive(pathWithoutPrefix[0]))
+    {
+        return false;
+    }
+
+    CanonicalizedPath parent = path.RemoveLastComponent();
+    if (parent.IsNull())
+    {
+        return false;
+    }
+
+    auto isReparsePoint = ResolvedPathCache::Instance().GetResolvingCheckResult(pathWithoutPrefix);
+    if (!isReparsePoint.Found
+        || isReparsePoint.Value
+        || !ResolvedPathCache::Instance().IsPathWithoutReparsePoints(parent.GetPathStringWithoutTypePrefix()))
+    {
+        return false;
+    }
+
+    // In the same form GetFinalPathNameByHandleW returns it
+    fullPath.assign(L"\\\\?\\").append(pathWithoutPrefix);
+    return true;
+}
+
+/// <summary>
+/// Records that the file or directory of the given handle was renamed through the handle, so its overlay no longer has its path.
+/// </summary>
+static void MarkHandleOverlayRenamed(_In_ HANDLE hFile)
+{
+    HandleOverlayRef overlay = TryLookupHandleOverlay(hFile);
+    if (overlay != nullptr)
+    {
+        overlay->Renamed = true;
+    }
+}
+
 /// <summary>
 /// Gets the final full path by handle.
 /// </summary>
 /// <remarks>
 /// This function encapsulates calls to <code>GetFinalPathNameByHandleW</code> and allocates memory as needed.
+/// The path is taken from the handle overlay instead when it is known to be final (see TryGetFinalPathFromHandleOverlay).
 /// </remarks>
 static DWORD DetourGetFinalPathByHandle(_In_ HANDLE hFile, _Inout_ wstring& fullPath)
 {
+    if (TryGetFinalPathFromHandleOverlay(hFile, fullPath))
+    {
+        return ERROR_SUCCESS;
+    }
+
     // First, try with a fixed-sized buffer which should be good enough for all practical cases.
-    wchar_t wszBuffer[MAX_PATH];
+    // The final path of a file under a subst drive or a mapped device is its real path, which is often longer than MAX_PATH
+    // (that is why the drive got mapped), so the buffer leaves room for those: retrying with a bigger buffer is another call into the kernel.
+    wchar_t wszBuffer[4 * MAX_PATH];
     DWORD nBufferLength = std::extent<decltype(wszBuffer)>::value;
 
     DWORD result = GetFinalPathNameByHandleW(hFile, wszBuffer, nBufferLength, FILE_NAME_NORMALIZED);
@@ -196,7 +340,14 @@ static void PathCache_Invalidate(const std::wstring& path, bool isDirectory, con
         return;
     }
 
+    EnsureKnownReparsePointsDecoded();
+
     ResolvedPathCache::Instance().Invalidate(path, isDirectory);
+
+    if (g_pSharedReparsePointCache != nullptr)
+    {
+        g_pSharedReparsePointCache->Invalidate(path, isDirectory);
+    }
 }
 
 static const Possible<std::pair<std::wstring, DWORD>> PathCache_GetResolvedPathAndType(const std::wstring& path, const PolicyResult& policyResult)
@@ -208,7 +359,19 @@ static const Possible<std::pair<std::wstring, DWORD>> PathCache_GetResolvedPathA
         return p;
     }
 
-    return ResolvedPathCache::Instance().GetResolvedPathAndType(path);
+    EnsureKnownReparsePointsDecoded();
+
+    auto result = ResolvedPathCache::Instance().GetResolvedPathAndType(path);
+    if (!result.Found
+        && g_pSharedReparsePointCache != nullptr
+        && g_pSharedReparsePointCache->TryGetResolvedPathAndType(path, result.Value.first, result.Value.second))
+    {
+        // Another process of the tree resolved this reparse point already
+        ResolvedPathCache::Instance().InsertResolvedPathWithType(path, result.Value.first, result.Value.second);
+        result.Found = true;
+    }
+
+    return result;
 }
 
 static bool PathCache_InsertResolvedPathWithType(const std::wstring& path, std::wstring& resolved, DWORD reparsePointType, const PolicyResult& policyResult)
@@ -218,6 +381,11 @@ static bool PathCache_InsertResolvedPathWithType(const std::wstring& path, std::
         return true;
     }
 
+    if (g_pSharedReparsePointCache != nullptr)
+    {
+        g_pSharedReparsePointCache->InsertResolvedPathWithType(path, resolved, reparsePointType);
+    }
+
     return ResolvedPathCache::Instance().InsertResolvedPathWithType(path, resolved, reparsePointType);
 }
 
@@ -230,7 +398,19 @@ static const Possible<bool> PathCache_GetResolvingCheckResult(const std::wstring
         return p;
     }
 
-    return ResolvedPathCache::Instance().GetResolvingCheckResult(path);
+    EnsureKnownReparsePointsDecoded();
+
+    auto result = ResolvedPathCache::Instance().GetResolvingCheckResult(path);
+    if (!result.Found
+        && g_pSharedReparsePointCache != nullptr
+        && g_pSharedReparsePointCache->TryGetResolvingCheckResult(path, result.Value))
+    {
+        // Another process of the tree checked this path already
+        ResolvedPathCache::Instance().InsertResolvingCheckResult(path, result.Value);
+        result.Found = true;
+    }
+
+    return result;
 }
 
 static bool PathCache_InsertResolvingCheckResult(const std::wstring& path, bool result, const PolicyResult& policyResult)
@@ -240,9 +420,36 @@ static bool PathCache_InsertResolvingCheckResult(const std::wstring& path, bool
         return true;
     }
 
+    if (g_pSharedReparsePointCache != nullptr)
+    {
+        g_pSharedReparsePointCache->InsertResolvingCheckResult(path, result);
+    }
+
     return ResolvedPathCache::Instance().InsertResolvingCheckResult(path, result);
 }
 
+static bool PathCache_IsPathWithoutReparsePoints(const std::wstring& path, const PolicyResult& policyResult)
+{
+    if (IgnoreReparsePoints() || IgnoreFullReparsePointResolvingForPath(policyResult))
+    {
+        return false;
+    }
+
+    EnsureKnownReparsePointsDecoded();
+
+    return ResolvedPathCache::Instance().IsPathWithoutReparsePoints(path);
+}
+
+static bool PathCache_InsertPathWithoutReparsePoints(const std::wstring& path, const PolicyResult& policyResult)
+{
+    if (IgnoreReparsePoints() || IgnoreFullReparsePointResolvingForPath(policyResult))
+    {
+        return true;
+    }
+
+    return ResolvedPathCache::Instance().InsertPathWithoutReparsePoints(path);
+}
+
 static bool PathCache_InsertResolvedPaths(
     const std::wstring& path,
     bool preserveLastReparsePointInPath,
@@ -358,6 +565,8 @@ static void SetTargetNameFromReparseData(_In_ PREPARSE_DATA_BUFFER pReparseDataB
 static bool TryGetReparsePointTarget(_In_ const wstring& path, _In_ HANDLE hInput, _Inout_ wstring& target, const PolicyResult& policyResult)
 {
     bool isReparsePoint;
+    FILE_ATTRIBUTE_TAG_INFO attributeTagInfo;
+    bool isReparsePointTagKnown = false;
     auto result = PathCache_GetResolvingCheckResult(path, policyResult);
     if (result.Found)
     {
@@ -365,8 +574,17 @@ static bool TryGetReparsePointTarget(_In_ const wstring& path, _In_ HANDLE hInpu
     }
     else
     {
-        isReparsePoint = IsReparsePoint(path.c_str(), hInput);
-        PathCache_InsertResolvingCheckResult(path, isReparsePoint, policyResult);
+        // With an open handle, the query telling whether the file is a reparse point also tells its type
+        isReparsePointTagKnown = TryGetAttributeTagInfo(hInput, attributeTagInfo);
+        isReparsePoint = isReparsePointTagKnown
+            ? (attributeTagInfo.FileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) != 0
+            : IsReparsePoint(path.c_str(), INVALID_HANDLE_VALUE);
+        if (!PathCache_InsertResolvingCheckResult(path, isReparsePoint, policyResult))
+        {
+#if MEASURE_REPARSEPOINT_RESOLVING_IMPACT
+            InterlockedIncrement(&g_shouldResolveReparsePointCacheDroppedInsertCount);
+#endif // MEASURE_REPARSEPOINT_RESOLVING_IMPACT
+        }
     }
 
     if (!isReparsePoint)
@@ -401,6 +619,12 @@ static bool TryGetReparsePointTarget(_In_ const wstring& path, _In_ HANDLE hInpu
         goto Success;
     }
 
+    if (isReparsePointTagKnown && !IsActionableReparsePointType(attributeTagInfo.ReparseTag))
+    {
+        // No need to read the reparse data of a reparse point that is not followed
+        goto Error;
+    }
+
     hFile = hInput != INVALID_HANDLE_VALUE
         ? hInput
         : CreateFileW(
@@ -480,6 +704,36 @@ Epilogue:
     return status;
 }
 
+/// <summary>
+/// Counts the atoms of the deepest ancestor of a path known to be free of reparse points, looking from the parent upwards.
+/// </summary>
+/// <remarks>
+/// Paths under the same directory share all their ancestors, so once one of them is checked, checking another one
+/// only needs to look at the atoms below their deepest common ancestor.
+/// </remarks>
+static size_t CountAtomsOfDeepestAncestorWithoutReparsePoints(_In_ const std::vector<std::wstring>& atoms, _In_ const PolicyResult& policyResult)
+{
+    wstring ancestor;
+    std::vector<size_t> ancestorLengths;
+    for (size_t i = 0; i + 1 < atoms.size(); i++)
+    {
+        ancestor.append(atoms[i]);
+        ancestorLengths.push_back(ancestor.length());
+        ancestor.append(L"\\");
+    }
+
+    for (size_t count = ancestorLengths.size(); count > 0; count--)
+    {
+        ancestor.resize(ancestorLengths[count - 1]);
+        if (PathCache_IsPathWithoutReparsePoints(ancestor, policyResult))
+        {
+            return count;
+        }
+    }
+
+    return 0;
+}
+
 /// <summary>
 /// Checks if Detours should resolve all reparse points contained in a path.
 /// </summary>
@@ -499,6 +753,8 @@ static bool ShouldResolveReparsePointsInPath(
         return false;
     }
 
+    HotPathTimer timer(DetoursHotPath::ReparsePointResolution);
+
     if (IgnoreFullReparsePointResolvingForPath(policyResult))
     {
         return AccessReparsePointTarget(path.GetPathString(), dwFlagsAndAttributes, INVALID_HANDLE_VALUE);
@@ -519,6 +775,10 @@ static bool ShouldResolveReparsePointsInPath(
         return result.Value;
     }
 
+#if MEASURE_REPARSEPOINT_RESOLVING_IMPACT
+    InterlockedIncrement(&g_shouldResolveReparsePointCacheMissCount);
+#endif // MEASURE_REPARSEPOINT_RESOLVING_IMPACT
+
     std::vector<std::wstring> atoms;
     int err = TryDecomposePath(path.GetPathStringWithoutTypePrefix(), atoms);
     if (err != 0)
@@ -531,13 +791,25 @@ static bool ShouldResolveReparsePointsInPath(
     wstring resolver;
     size_t level = 0;
     size_t levelToEnforceReparsePointParsingFrom = GetLevelToEnableFullReparsePointParsing(policyResult);
+
+    // Ancestors free of reparse points are only known when all their atoms are checked
+    bool checksAllAtoms = levelToEnforceReparsePointParsingFrom == 0;
+    size_t atomsKnownWithoutReparsePoints = checksAllAtoms ? CountAtomsOfDeepestAncestorWithoutReparsePoints(atoms, policyResult) : 0;
     for(auto iter = atoms.begin(); iter != atoms.end(); iter++)
     {
         resolver.append(*iter);
 
-        if (level >= levelToEnforceReparsePointParsingFrom && TryGetReparsePointTarget(resolver, INVALID_HANDLE_VALUE, target, policyResult))
+        if (level >= levelToEnforceReparsePointParsingFrom && level >= atomsKnownWithoutReparsePoints)
         {
-            return true;
+            if (TryGetReparsePointTarget(resolver, INVALID_HANDLE_VALUE, target, policyResult))
+            {
+                return true;
+            }
+
+            if (checksAllAtoms && iter + 1 != atoms.end())
+            {
+                PathCache_InsertPathWithoutReparsePoints(resolver, policyResult);
+            }
         }
 
         level++;
@@ -1227,7 +1499,7 @@ static bool EnforceReparsePointAccess(
 
 static inline bool PathContainedInPathTranslations(wstring path, bool canonicalize = false)
 {
-    if (path.empty())
+    if (path.empty() || !EnsurePathTranslationsDecoded())
     {
         return false;
     }
@@ -1269,6 +1541,7 @@ static bool ResolveAllReparsePointsAndEnforceAccess(
     const bool enforceAccessForResolvedPath = true,
     const bool preserveLastReparsePointInPath = false)
 {
+    HotPathTimer timer(DetoursHotPath::ReparsePointResolution);
     bool success = true;
     auto normalized = std::make_unique<wchar_t[]>(_MAX_EXTENDED_PATH_LENGTH);
     const wchar_t* input = (wchar_t*)path.GetPathStringWithoutTypePrefix();
@@ -1502,6 +1775,7 @@ static bool EnforceChainOfReparsePointAccesses(
         return true;
     }
 
+    HotPathTimer timer(DetoursHotPath::ReparsePointResolution);
 
     bool cached = true;
     const Possible<ResolvedPathCacheEntries> cachedEntries = PathCache_GetResolvedPaths(
@@ -1595,17 +1869,21 @@ static bool EnforceChainOfReparsePointAccesses(
 /// <summary>
 /// Enforces allowed accesses for all paths leading to and including the target of a reparse point for non CreateFile-like functions.
 /// </summary>
+/// <remarks>
+/// The canonicalized path is the path of the operation context. Callers have it at hand from the policy result of the operation,
+/// so it is not canonicalized again. Callers that already probed the path and found a reparse point pass 'isKnownReparsePoint', so it is not probed again.
+/// </remarks>
 static bool EnforceChainOfReparsePointAccessesForNonCreateFile(
     const FileOperationContext& fileOperationContext,
+    const CanonicalizedPath& canonicalPath,
     const PolicyResult& policyResult,
     const bool enforceAccess = true,
-    const bool isCreateDirectory = false)
+    const bool isCreateDirectory = false,
+    const bool isKnownReparsePoint = false)
 {
     if (!IgnoreNonCreateFileReparsePoints() && !IgnoreReparsePoints())
     {
-        CanonicalizedPath canonicalPath = CanonicalizedPath::Canonicalize(fileOperationContext.NoncanonicalPath);
-
-        if (IsReparsePoint(canonicalPath.GetPathString(), INVALID_HANDLE_VALUE))
+        if (isKnownReparsePoint || IsReparsePoint(canonicalPath.GetPathString(), INVALID_HANDLE_VALUE))
         {
             bool accessResult = EnforceChainOfReparsePointAccesses(
                 canonicalPath,
@@ -1716,9 +1994,105 @@ static bool AdjustOperationContextAndPolicyResultWithFullyResolvedPath(
     return true;
 }
 
+/// <summary>
+/// Validates the deletion of an entry of a directory being moved and, if there is a target, the creation of the entry at the target.
+/// </summary>
+static bool ValidateMoveDirectoryEntry(
+    _In_      LPCWSTR                  sourceContext,
+    _In_      LPCWSTR                  destinationContext,
+    _In_opt_  LPCWSTR                  lpNewFileName,
+    _In_      const wstring&           sourceDirectory,
+    _In_      const wstring&           targetDirectory,
+    _In_      const PolicyResult&      policyResult,
+    _In_      wstring                  file,
+    _In_      DWORD                    fileAttributes,
+    _Inout_   vector<ReportData>&      filesAndDirectoriesToReport)
+{
+    // Validate deletion of source.
+    wstring normalizedSourceFile = NormalizePath(file);
+    FileOperationContext sourceOpContext = FileOperationContext(
+        sourceContext,
+        DELETE,
+        0,
+        OPEN_EXISTING,
+        // We are interested in knowing whether the source path is a directory, so make sure
+        // we reflect that in the report
+        FILE_ATTRIBUTE_NORMAL | (fileAttributes & FILE_ATTRIBUTE_DIRECTORY),
+        normalizedSourceFile.c_str());
+
+    PolicyResult sourcePolicyResult;
+    if (!sourcePolicyResult.Initialize(normalizedSourceFile.c_str()))
+    {
+        sourcePolicyResult.ReportIndeterminatePolicyAndSetLastError(sourceOpContext);
+        return false;
+    }
+
+    AccessCheckResult sourceAccessCheck = sourcePolicyResult.CheckWriteAccess();
+
+    if (sourceAccessCheck.ShouldDenyAccess())
+    {
+        DWORD denyError = sourceAccessCheck.DenialError();
+        ReportIfNeeded(sourceAccessCheck, sourceOpContext, sourcePolicyResult, denyError);
+        sourceAccessCheck.SetLastErrorToDenialError();
+        return false;
+    }
+
+    PathCache_Invalidate(sourcePolicyResult.GetCanonicalizedPath().GetPathStringWithoutTypePrefix(), fileAttributes & FILE_ATTRIBUTE_DIRECTORY, policyResult);
+
+    filesAndDirectoriesToReport.push_back(ReportData(sourceAccessCheck, sourceOpContext, sourcePolicyResult));
+
+    // Validate creation of target.
+
+    if (lpNewFileName != NULL)
+    {
+        file.replace(0, sourceDirectory.length(), targetDirectory);
+
+        wstring normalizedTargetFile = NormalizePath(file);
+
+        FileOperationContext destinationOpContext = FileOperationContext(
+            destinationContext,
+            GENERIC_WRITE,
+            0,
+            CREATE_ALWAYS,
+            // We are interested in knowing whether the source path is a directory, so make sure
+            // we reflect that in the report
+            FILE_ATTRIBUTE_NORMAL | (fileAttributes & FILE_ATTRIBUTE_DIRECTORY),
+            normalizedTargetFile.c_str());
+        destinationOpContext.Correlate(sourceOpContext);
+
+        PolicyResult destPolicyResult;
+
+        if (!destPolicyResult.Initialize(normalizedTargetFile.c_str()))
+        {
+            destPolicyResult.ReportIndeterminatePolicyAndSetLastError(destinationOpContext);
+            return false;
+        }
+
+        AccessCheckResult destAccessCheck = (fileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0
+            ? destPolicyResult.CheckCreateDirectoryAccess()
+            : destPolicyResult.CheckWriteAccess();
+
+        if (destAccessCheck.ShouldDenyAccess())
+        {
+            // We report the destination access here since we are returning early. Otherwise it is deferred until post-read.
+            DWORD denyError = destAccessCheck.DenialError();
+            ReportIfNeeded(destAccessCheck, destinationOpContext, destPolicyResult, denyError);
+            destAccessCheck.SetLastErrorToDenialError();
+            return false;
+        }
+
+        filesAndDirectoriesToReport.push_back(ReportData(destAccessCheck, destinationOpContext, destPolicyResult));
+    }
+
+    return true;
+}
+
 /// <summary>
 /// Validates move directory by validating proper deletion for all source files and proper creation for all target files.
 /// </summary>
+/// <remarks>
+/// Entries are validated as the directory is enumerated, so a denied entry stops the enumeration.
+/// </remarks>
 static bool ValidateMoveDirectory(
     _In_      LPCWSTR                  sourceContext,
     _In_      LPCWSTR                  destinationContext,
@@ -1728,8 +2102,6 @@ static bool ValidateMoveDirectory(
 {
     DWORD error = GetLastError();
 
-    vector<std::pair<wstring, DWORD>> filesAndDirectories;
-
     DWORD directoryAttributes = GetFileAttributesW(lpExistingFileName);
     bool isDirectory = (directoryAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0 && (directoryAttributes & FILE_ATTRIBUTE_REPARSE_POINT) == 0;
 
@@ -1739,12 +2111,6 @@ static bool ValidateMoveDirectory(
         return true;
     }
 
-    if (!EnumerateDirectory(lpExistingFileName, L"*", true, true, filesAndDirectories))
-    {
-        SetLastError(error);
-        return false;
-    }
-
     wstring sourceDirectory(lpExistingFileName);
 
     if (sourceDirectory.back() != L'\\')
@@ -1767,87 +2133,37 @@ static bool ValidateMoveDirectory(
     PolicyResult policyResult;
     policyResult.Initialize(lpExistingFileName);
 
-    for (auto entry : filesAndDirectories)
-    {
-        const std::pair<wstring, DWORD>& elem = entry;
-        wstring file = elem.first;
-        const DWORD& fileAttributes = elem.second;
-
-        // Validate deletion of source.
-        wstring normalizedSourceFile = NormalizePath(file);
-        FileOperationContext sourceOpContext = FileOperationContext(
-            sourceContext,
-            DELETE,
-            0,
-            OPEN_EXISTING,
-            // We are interested in knowing whether the source path is a directory, so make sure
-            // we reflect that in the report
-            FILE_ATTRIBUTE_NORMAL | (fileAttributes & FILE_ATTRIBUTE_DIRECTORY),
-            normalizedSourceFile.c_str());
-
-        PolicyResult sourcePolicyResult;
-        if (!sourcePolicyResult.Initialize(normalizedSourceFile.c_str()))
-        {
-            sourcePolicyResult.ReportIndeterminatePolicyAndSetLastError(sourceOpContext);
-            return false;
-        }
-
-        AccessCheckResult sourceAccessCheck = sourcePolicyResult.CheckWriteAccess();
-
-        if (sourceAccessCheck.ShouldDenyAccess())
-        {
-            DWORD denyError = sourceAccessCheck.DenialError();
-            ReportIfNeeded(sourceAccessCheck, sourceOpContext, sourcePolicyResult, denyError);
-            sourceAccessCheck.SetLastErrorToDenialError();
-            return false;
-        }
-
-        PathCache_Invalidate(sourcePolicyResult.GetCanonicalizedPath().GetPathStringWithoutTypePrefix(), fileAttributes & FILE_ATTRIBUTE_DIRECTORY, policyResult);
-
-        filesAndDirectoriesToReport.push_back(ReportData(sourceAccessCheck, sourceOpContext, sourcePolicyResult));
-
-        // Validate creation of target.
-
-        if (lpNewFileName != NULL)
+    bool validated = true;
+    bool enumerated = EnumerateDirectory(
+        lpExistingFileName,
+        L"*",
+        true,
+        true,
+        [&](const wstring& file, DWORD fileAttributes)
         {
-            file.replace(0, sourceDirectory.length(), targetDirectory);
-
-            wstring normalizedTargetFile = NormalizePath(file);
-
-            FileOperationContext destinationOpContext = FileOperationContext(
+            validated = ValidateMoveDirectoryEntry(
+                sourceContext,
                 destinationContext,
-                GENERIC_WRITE,
-                0,
-                CREATE_ALWAYS,
-                // We are interested in knowing whether the source path is a directory, so make sure
-                // we reflect that in the report
-                FILE_ATTRIBUTE_NORMAL | (fileAttributes & FILE_ATTRIBUTE_DIRECTORY),
-                normalizedTargetFile.c_str());
-            destinationOpContext.Correlate(sourceOpContext);
-
-            PolicyResult destPolicyResult;
-
-            if (!destPolicyResult.Initialize(normalizedTargetFile.c_str()))
-            {
-                destPolicyResult.ReportIndeterminatePolicyAndSetLastError(destinationOpContext);
-                return false;
-            }
-
-            AccessCheckResult destAccessCheck = (fileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0
-                ? destPolicyResult.CheckCreateDirectoryAccess()
-                : destPolicyResult.CheckWriteAccess();
+                lpNewFileName,
+                sourceDirectory,
+                targetDirectory,
+                policyResult,
+                file,
+                fileAttributes,
+                filesAndDirectoriesToReport);
+            return validated;
+        });
 
-            if (destAccessCheck.ShouldDenyAccess())
-            {
-                // We report the destination access here since we are returning early. Otherwise it is deferred until post-read.
-                DWORD denyError = destAccessCheck.DenialError();
-                ReportIfNeeded(destAccessCheck, destinationOpContext, destPolicyResult, denyError);
-                destAccessCheck.SetLastErrorToDenialError();
-                return false;
-            }
+    if (!validated)
+    {
+        // The last error was set for the denied entry
+        return false;
+    }
 
-            filesAndDirectoriesToReport.push_back(ReportData(destAccessCheck, destinationOpContext, destPolicyResult));
-        }
+    if (!enumerated)
+    {
+        SetLastError(error);
+        return false;
     }
 
     SetLastError(error);
@@ -2142,6 +2458,8 @@ NTSTATUS HandleFileRenameInformation(
     }
 
     // Writes are destructive. Before doing a move we ensure that write access is definitely allowed to the source (delete) and destination (write).
+    InvalidateFileAccessCaches();
+
     AccessCheckResult sourceAccessCheck = sourcePolicyResult.CheckWriteAccess();
     sourceOpContext.OpenedFileOrDirectoryAttributes = fileOrDirectoryAttribute;
 
@@ -2189,6 +2507,10 @@ NTSTATUS HandleFileRenameInformation(
     {
         lastError = GetLastError();
     }
+    else
+    {
+        MarkHandleOverlayRenamed(FileHandle);
+    }
 
     DWORD ntError = RtlNtStatusToDosError(result);
 
@@ -2285,6 +2607,8 @@ NTSTATUS HandleFileLinkInformation(
         return FALSE;
     }
 
+    InvalidateFileAccessCaches();
+
     AccessCheckResult targetAccessCheck = targetPolicyResult.CheckWriteAccess();
     // Hard links can only be created on files
     targetOpContext.OpenedFileOrDirectoryAttributes = GetAttributesForFileOrDirectory(false);
@@ -2389,6 +2713,8 @@ NTSTATUS HandleFileDispositionInformation(
         return DETOURS_STATUS_ACCESS_DENIED;
     }
 
+    InvalidateFileAccessCaches();
+
     AccessCheckResult sourceAccessCheck = sourcePolicyResult.CheckWriteAccess();
     sourceOpContext.OpenedFileOrDirectoryAttributes = GetAttributesForFileOrDirectory(false);
 
@@ -2479,6 +2805,8 @@ NTSTATUS HandleFileModeInformation(
         return DETOURS_STATUS_ACCESS_DENIED;
     }
 
+    InvalidateFileAccessCaches();
+
     AccessCheckResult sourceAccessCheck = sourcePolicyResult.CheckWriteAccess();
     IsHandleOrPathToDirectory(FileHandle, sourcePath.c_str(), false, /*ref*/ sourceOpContext.OpenedFileOrDirectoryAttributes);
 
@@ -2685,6 +3013,8 @@ NTSTATUS NTAPI Detoured_ZwSetInformationFile(
     _In_  ULONG                  Length,
     _In_  FILE_INFORMATION_CLASS FileInformationClass)
 {
+    COUNT_DETOURED_CALL(ZwSetInformationFile);
+
     // if this is not an enabled case that we are covering, just call the Real_Function.
     FILE_INFORMATION_CLASS_EXTRA fileInformationClassExtra = (FILE_INFORMATION_CLASS_EXTRA)FileInformationClass;
 
@@ -2742,50 +3072,12 @@ NTSTATUS NTAPI Detoured_ZwSetInformationFile(
 
 static bool ShouldBreakawayFromJob(const CanonicalizedPath& fullApplicationPath, _Inout_opt_ LPWSTR lpCommandLine)
 {
-    if (g_breakawayChildProcesses->empty() || fullApplicationPath.IsNull())
+    if (g_breakawayChildProcessCount == 0 || fullApplicationPath.IsNull())
     {
         return false;
     }
 
-    std::wstring imageName(fullApplicationPath.GetLastComponent());
-    for (auto it = g_breakawayChildProcesses->begin(); it != g_breakawayChildProcesses->end(); ++it)
-    {
-        if (AreEqualCaseInsensitively(it->ProcessName, imageName))
-        {
-            if (it->RequiredCommandLineArgsSubstring.empty())
-            {
-#if SUPER_VERBOSE
-                Dbg(L"Allowing process to breakaway from job object. Image name: '%s'", imageName.c_str());
-#endif
-                return true;
-            }
-
-            std::wstring command;
-            std::wstring commandArgs;
-            FindApplicationNameFromCommandLine(lpCommandLine, command, commandArgs);
-            if (it->CommandLineArgsSubstringContainmentIgnoreCase)
-            {
-                if (std::search(commandArgs.begin(), commandArgs.end(), it->RequiredCommandLineArgsSubstring.begin(), it->RequiredCommandLineArgsSubstring.end(), [](wchar_t c1, wchar_t c2) {
-                    return std::towlower(c1) == std::towlower(c2);
-                    }) != commandArgs.end())
-                {
-#if SUPER_VERBOSE
-                    Dbg(L"Allowing process to breakaway from job object. Image name: '%s' | Command line args: '%s'.", imageName.c_str(), commandArgs.c_str());
-#endif
-                    return true;
-                }
-            }
-            else if (commandArgs.find(it->RequiredCommandLineArgsSubstring) != std::wstring::npos)
-            {
-#if SUPER_VERBOSE
-                Dbg(L"Allowing process to breakaway from job object. Image name: '%s' | Command line args: '%s'.", imageName.c_str(), commandArgs.c_str());
-#endif
-                return true;
-            }
-        }
-    }
-
-    return false;
+    return IsBreakawayChildProcess(std::wstring(fullApplicationPath.GetLastComponent()), lpCommandLine);
 }
 
 IMPLEMENTED(Detoured_CreateProcessW)
@@ -2801,7 +3093,10 @@ BOOL WINAPI Detoured_CreateProcessW(
     _In_        LPSTARTUPINFOW        lpStartupInfo,
     _Out_       LPPROCESS_INFORMATION lpProcessInformation)
 {
+    COUNT_DETOURED_CALL(CreateProcessW);
+
     bool injectedShim = false;
+    EnsureShimProcessMatchesDecoded();
     BOOL ret = MaybeInjectSubstituteProcessShim(
         lpApplicationName,
         lpCommandLine,
@@ -2892,12 +3187,16 @@ BOOL WINAPI Detoured_CreateProcessW(
             return FALSE;
         }
 
-        if (!EnforceChainOfReparsePointAccessesForNonCreateFile(operationContext, policyResult))
+        if (!EnforceChainOfReparsePointAccessesForNonCreateFile(operationContext, policyResult.GetCanonicalizedPath(), policyResult))
         {
             return FALSE;
         }
     }
 
+    // Buffered and queued reports of this process must reach BuildXL before any report from the child
+    FlushReportBuffers();
+    FlushQueuedReports();
+
     bool retryCreateProcess = true;
     unsigned retryCount = 0;
 
@@ -2983,6 +3282,8 @@ BOOL WINAPI Detoured_CreateProcessA(
     _In_        LPSTARTUPINFOA        lpStartupInfo,
     _Out_       LPPROCESS_INFORMATION lpProcessInformation)
 {
+    COUNT_DETOURED_CALL(CreateProcessA);
+
     // Note that we only do Real_CreateProcessA
     // for the case of not doing child processes.
     // Otherwise this converts to CreateProcessW
@@ -3081,6 +3382,17 @@ static bool TryGetUsn(
 // If we are not attached this is not App use of RAM but the OS proess startup side of the world.
 extern bool g_isAttached;
 
+// Whether the report of an allowed open for write access would be the same as one this process already sent since the last
+// deletion, rename or link, and can be skipped (see WriteAccessReportCache).
+static bool IsWriteOpenAlreadyReported(AccessCheckResult const& accessCheck, FileOperationContext const& opContext, PolicyResult const& policyResult, DWORD error, USN usn = -1)
+{
+    return accessCheck.ShouldReport()
+        && accessCheck.Result == ResultAction::Allow
+        && (accessCheck.Access & RequestedAccess::Write) == RequestedAccess::Write
+        && error == ERROR_SUCCESS
+        && !WriteAccessReportCache::GetInstance()->TryRegister(accessCheck, opContext, policyResult, error, usn);
+}
+
 IMPLEMENTED(Detoured_CreateFileW)
 HANDLE WINAPI Detoured_CreateFileW(
     _In_     LPCWSTR               lpFileName,
@@ -3091,6 +3403,7 @@ HANDLE WINAPI Detoured_CreateFileW(
     _In_     DWORD                 dwFlagsAndAttributes,
     _In_opt_ HANDLE                hTemplateFile)
 {
+    COUNT_DETOURED_CALL(CreateFileW);
     DetouredScope scope;
 
     // The are potential complication here: How to handle a call to CreateFile with the FILE_FLAG_OPEN_REPARSE_POINT?
@@ -3137,6 +3450,11 @@ HANDLE WINAPI Detoured_CreateFileW(
         error = GetLastError();
         accessCheck = policyResult.CheckWriteAccess();
 
+        if ((dwFlagsAndAttributes & FILE_FLAG_DELETE_ON_CLOSE) != 0)
+        {
+            InvalidateFileAccessCaches();
+        }
+
         if (ForceReadOnlyForRequestedReadWrite() && accessCheck.Result != ResultAction::Allow)
         {
             // If ForceReadOnlyForRequestedReadWrite() is true, then we allow read for requested read-write access so long as the tool is allowed to read.
@@ -3245,6 +3563,16 @@ HANDLE WINAPI Detoured_CreateFileW(
         reportUsn = handle != INVALID_HANDLE_VALUE && policyResult.ReportUsnAfterOpen();
         bool checkUsn = handle != INVALID_HANDLE_VALUE && policyResult.GetExpectedUsn() != -1;
 
+        // A file opened again without write access, already checked against the same expected USN, doesn't need to be queried again
+        bool cacheUsn = checkUsn && !reportUsn && EnableDetoursExpectedUsnCache() && !WantsWriteAccess(dwDesiredAccess);
+        if (cacheUsn && ExpectedUsnCache::GetInstance()->IsChecked(policyResult.GetCanonicalizedPath().GetPathString(), policyResult.GetExpectedUsn()))
+        {
+            CountDetoursEvent(DetoursEvent::ExpectedUsnCacheHit);
+            usn = policyResult.GetExpectedUsn();
+            checkUsn = false;
+            cacheUsn = false;
+        }
+
         DWORD getUsnError = ERROR_SUCCESS;
         if ((reportUsn || checkUsn) && !TryGetUsn(handle, /* inout */ usn, /* inout */ getUsnError))
         {
@@ -3275,6 +3603,10 @@ HANDLE WINAPI Detoured_CreateFileW(
                 policyResult.GetCanonicalizedPath().GetPathString(), usn, policyResult.GetExpectedUsn());
             unexpectedUsn = true;
         }
+        else if (cacheUsn)
+        {
+            ExpectedUsnCache::GetInstance()->Register(policyResult.GetCanonicalizedPath().GetPathString(), usn);
+        }
     }
 
     // ReportUsnAfterOpen implies reporting.
@@ -3324,7 +3656,9 @@ HANDLE WINAPI Detoured_CreateFileW(
         }
     }
 
-    if (shouldReportAccessCheck)
+    InvalidateExpectedUsnsIfWriting(accessCheck);
+
+    if (shouldReportAccessCheck && !IsWriteOpenAlreadyReported(accessCheck, opContext, policyResult, error, usn))
     {
         ReportIfNeeded(accessCheck, opContext, policyResult, error, usn);
     }
@@ -3371,6 +3705,7 @@ HANDLE WINAPI Detoured_CreateFileW(
 IMPLEMENTED(Detoured_CloseHandle)
 BOOL WINAPI Detoured_CloseHandle(_In_ HANDLE handle)
 {
+    COUNT_DETOURED_CALL(CloseHandle);
     DetouredScope scope;
 
     if (scope.Detoured_IsDisabled() || IsNullOrInvalidHandle(handle))
@@ -3380,7 +3715,7 @@ BOOL WINAPI Detoured_CloseHandle(_In_ HANDLE handle)
 
     // Make sure the handle is closed after the object is removed from the map.
     // This way the handle will never be assigned to a another object before removed from the table.
-    CloseHandleOverlay(handle , true);
+    CloseHandleOverlay(handle);
 
     return Real_CloseHandle(handle);
 }
@@ -3395,6 +3730,8 @@ HANDLE WINAPI Detoured_CreateFileA(
     _In_     DWORD                 dwFlagsAndAttributes,
     _In_opt_ HANDLE                hTemplateFile)
 {
+    COUNT_DETOURED_CALL(CreateFileA);
+
     {
         DetouredScope scope;
         if (scope.Detoured_IsDisabled() || IsNullOrEmptyA(lpFileName))
@@ -3421,6 +3758,44 @@ HANDLE WINAPI Detoured_CreateFileA(
         hTemplateFile);
 }
 
+/// <summary>
+/// Answers GetVolumePathNameW from the mount points of the volumes (see EnableDetoursVolumeMountPointCache), for full paths on a drive.
+/// </summary>
+/// <remarks>
+/// Like GetVolumePathNameW, the result is the prefix of the full path of the file up to the deepest mount point it is under, with a trailing separator.
+/// Subst drives, network paths, device paths and buffers that are too small are left to GetVolumePathNameW.
+/// </remarks>
+static bool TryGetVolumePathNameFromMountPointCache(
+    _In_  LPCWSTR lpszFileName,
+    _Out_ LPWSTR  lpszVolumePathName,
+    _In_  DWORD   cchBufferLength)
+{
+    if (lpszFileName == nullptr || lpszFileName[0] == L'\0' || lpszVolumePathName == nullptr)
+    {
+        return false;
+    }
+
+    wchar_t buffer[MAX_PATH];
+    DWORD length = GetFullPathNameW(lpszFileName, ARRAYSIZE(buffer), buffer, nullptr);
+    if (length == 0 || length >= ARRAYSIZE(buffer) || length < 2 || buffer[1] != L':' || (length > 2 && !IsDirectorySeparator(buffer[2])))
+    {
+        return false;
+    }
+
+    wstring fullPath(buffer, length);
+    size_t mountPointLength;
+    if (!VolumeMountPointCache::GetInstance()->TryGetMountPoint(fullPath, mountPointLength) || mountPointLength + 2 > cchBufferLength)
+    {
+        return false;
+    }
+
+    wmemcpy(lpszVolumePathName, fullPath.c_str(), mountPointLength);
+    lpszVolumePathName[mountPointLength] = L'\\';
+    lpszVolumePathName[mountPointLength + 1] = L'\0';
+    CountDetoursEvent(DetoursEvent::VolumePathAnsweredFromMountPointCache);
+    return true;
+}
+
 // Detoured_GetVolumePathNameW
 //
 // There's no need to check lpszFileName for null because we are not applying
@@ -3436,17 +3811,26 @@ BOOL WINAPI Detoured_GetVolumePathNameW(
     _In_  DWORD   cchBufferLength
     )
 {
+    COUNT_DETOURED_CALL(GetVolumePathNameW);
+
     // The reason for this scope check is that GetVolumePathNameW calls many other detoured APIs.
     // We do not need to have any reports for file accesses from these APIs, because thay are not what the application called.
     // (It was purely inserted by us.)
 
     DetouredScope scope;
+    if (EnableDetoursVolumeMountPointCache() && TryGetVolumePathNameFromMountPointCache(lpszFileName, lpszVolumePathName, cchBufferLength))
+    {
+        SetLastError(ERROR_SUCCESS);
+        return TRUE;
+    }
+
     return Real_GetVolumePathNameW(lpszFileName, lpszVolumePathName, cchBufferLength);
 }
 
 IMPLEMENTED(Detoured_GetFileAttributesW)
 DWORD WINAPI Detoured_GetFileAttributesW(_In_  LPCWSTR lpFileName)
 {
+    COUNT_DETOURED_CALL(GetFileAttributesW);
     DetouredScope scope;
     if (scope.Detoured_IsDisabled() || IsNullOrEmptyW(lpFileName) || IsSpecialDeviceName(lpFileName))
     {
@@ -3471,11 +3855,20 @@ DWORD WINAPI Detoured_GetFileAttributesW(_In_  LPCWSTR lpFileName)
     DWORD attributes = INVALID_FILE_ATTRIBUTES;
     DWORD error = ERROR_SUCCESS;
 
-    attributes = Real_GetFileAttributesW(lpFileName);
-
-    if (attributes == INVALID_FILE_ATTRIBUTES)
+    bool parentExists = false;
+    if (policyResult.IsKnownToBeAbsent(parentExists))
     {
-        error = GetLastError();
+        CountDetoursEvent(DetoursEvent::ProbeAnsweredFromManifest);
+        error = parentExists ? ERROR_FILE_NOT_FOUND : ERROR_PATH_NOT_FOUND;
+    }
+    else
+    {
+        attributes = Real_GetFileAttributesW(lpFileName);
+
+        if (attributes == INVALID_FILE_ATTRIBUTES)
+        {
+            error = GetLastError();
+        }
     }
 
     // Now we can make decisions based on the file's existence and type.
@@ -3500,6 +3893,8 @@ DWORD WINAPI Detoured_GetFileAttributesW(_In_  LPCWSTR lpFileName)
 IMPLEMENTED(Detoured_GetFileAttributesA)
 DWORD WINAPI Detoured_GetFileAttributesA(_In_  LPCSTR lpFileName)
 {
+    COUNT_DETOURED_CALL(GetFileAttributesA);
+
     {
         DetouredScope scope;
         if (scope.Detoured_IsDisabled() || IsNullOrEmptyA(lpFileName))
@@ -3519,6 +3914,7 @@ BOOL WINAPI Detoured_GetFileAttributesExW(
     _In_  GET_FILEEX_INFO_LEVELS fInfoLevelId,
     _Out_ LPVOID                 lpFileInformation)
 {
+    COUNT_DETOURED_CALL(GetFileAttributesExW);
     DetouredScope scope;
     if (scope.Detoured_IsDisabled() || IsNullOrEmptyW(lpFileName) || IsSpecialDeviceName(lpFileName))
     {
@@ -3538,13 +3934,24 @@ BOOL WINAPI Detoured_GetFileAttributesExW(
 
     DWORD error = ERROR_SUCCESS;
     BOOL querySucceeded = TRUE;
-    // We could be clever and avoid calling this when already doomed to failure. However:
-    // - Unlike CreateFile, this query can't interfere with other processes
-    // - We want lpFileInformation to be zeroed according to whatever policy GetFileAttributesEx has.
-    querySucceeded = Real_GetFileAttributesExW(lpFileName, fInfoLevelId, lpFileInformation);
-    if (!querySucceeded)
+    bool parentExists = false;
+    if (policyResult.IsKnownToBeAbsent(parentExists))
     {
-        error = GetLastError();
+        // The path is not in a cone fully listed by the manifest, so there is nothing to query
+        CountDetoursEvent(DetoursEvent::ProbeAnsweredFromManifest);
+        querySucceeded = FALSE;
+        error = parentExists ? ERROR_FILE_NOT_FOUND : ERROR_PATH_NOT_FOUND;
+    }
+    else
+    {
+        // We could be clever and avoid calling this when already doomed to failure. However:
+        // - Unlike CreateFile, this query can't interfere with other processes
+        // - We want lpFileInformation to be zeroed according to whatever policy GetFileAttributesEx has.
+        querySucceeded = Real_GetFileAttributesExW(lpFileName, fInfoLevelId, lpFileInformation);
+        if (!querySucceeded)
+        {
+            error = GetLastError();
+        }
     }
 
     WIN32_FILE_ATTRIBUTE_DATA* fileStandardInfo = (fInfoLevelId == GetFileExInfoStandard && lpFileInformation != nullptr) ?
@@ -3594,6 +4001,8 @@ BOOL WINAPI Detoured_GetFileAttributesExA(
     _In_  GET_FILEEX_INFO_LEVELS fInfoLevelId,
     _Out_ LPVOID                 lpFileInformation)
 {
+    COUNT_DETOURED_CALL(GetFileAttributesExA);
+
     {
         DetouredScope scope;
         if (scope.Detoured_IsDisabled() || IsNullOrEmptyA(lpFileName))
@@ -3628,6 +4037,8 @@ BOOL WINAPI Detoured_CopyFileW(
     _In_ BOOL bFailIfExists
     )
 {
+    COUNT_DETOURED_CALL(CopyFileW);
+
     // Don't duplicate complex access-policy logic between CopyFileEx and CopyFile.
     // This forwarder is identical to the internal implementation of CopyFileExW
     // so it should be safe to always forward at our level.
@@ -3646,6 +4057,8 @@ BOOL WINAPI Detoured_CopyFileA(
     _In_ LPCSTR lpNewFileName,
     _In_ BOOL   bFailIfExists)
 {
+    COUNT_DETOURED_CALL(CopyFileA);
+
     {
         DetouredScope scope;
         if (scope.Detoured_IsDisabled() || IsNullOrEmptyA(lpExistingFileName) || IsNullOrEmptyA(lpNewFileName))
@@ -3674,6 +4087,7 @@ BOOL WINAPI Detoured_CopyFileExW(
     _In_opt_ LPBOOL             pbCancel,
     _In_     DWORD              dwCopyFlags)
 {
+    COUNT_DETOURED_CALL(CopyFileExW);
     DetouredScope scope;
     if (scope.Detoured_IsDisabled() ||
         IsNullOrEmptyW(lpExistingFileName) ||
@@ -3725,7 +4139,7 @@ BOOL WINAPI Detoured_CopyFileExW(
     }
 
     // When COPY_FILE_COPY_SYMLINK is specified, then no need to enforce chain of symlink accesses.
-    if (!copySymlink && !EnforceChainOfReparsePointAccessesForNonCreateFile(sourceOpContext, sourcePolicyResult))
+    if (!copySymlink && !EnforceChainOfReparsePointAccessesForNonCreateFile(sourceOpContext, sourcePolicyResult.GetCanonicalizedPath(), sourcePolicyResult))
     {
         return FALSE;
     }
@@ -3761,7 +4175,13 @@ BOOL WINAPI Detoured_CopyFileExW(
         // but the destination of the copy is a symlink, then enforce chain of reparse point.
         // For example, if we copy a concrete file f to an existing symlink s pointing to g, then
         // if g exists, then g will be modified, but if g doesn't exist, then g will be created.
-        if (!EnforceChainOfReparsePointAccessesForNonCreateFile(destinationOpContext, sourcePolicyResult))
+        if (!EnforceChainOfReparsePointAccessesForNonCreateFile(
+            destinationOpContext,
+            destPolicyResult.GetCanonicalizedPath(),
+            sourcePolicyResult,
+            /*enforceAccess*/ true,
+            /*isCreateDirectory*/ false,
+            /*isKnownReparsePoint*/ true))
         {
             return FALSE;
         }
@@ -3815,6 +4235,8 @@ BOOL WINAPI Detoured_CopyFileExA(
     _In_opt_ LPBOOL             pbCancel,
     _In_     DWORD              dwCopyFlags)
 {
+    COUNT_DETOURED_CALL(CopyFileExA);
+
     {
         DetouredScope scope;
         if (scope.Detoured_IsDisabled() || IsNullOrEmptyA(lpExistingFileName) || IsNullOrEmptyA(lpNewFileName))
@@ -3852,6 +4274,8 @@ BOOL WINAPI Detoured_MoveFileW(
     _In_ LPCWSTR lpExistingFileName,
     _In_ LPCWSTR lpNewFileName)
 {
+    COUNT_DETOURED_CALL(MoveFileW);
+
     return Detoured_MoveFileWithProgressW(
         lpExistingFileName,
         lpNewFileName,
@@ -3865,6 +4289,8 @@ BOOL WINAPI Detoured_MoveFileA(
     _In_ LPCSTR lpExistingFileName,
     _In_ LPCSTR lpNewFileName)
 {
+    COUNT_DETOURED_CALL(MoveFileA);
+
     {
         DetouredScope scope;
         if (scope.Detoured_IsDisabled() || IsNullOrEmptyA(lpExistingFileName) || IsNullOrEmptyA(lpNewFileName))
@@ -3892,6 +4318,8 @@ BOOL WINAPI Detoured_MoveFileExW(
     _In_opt_ LPCWSTR lpNewFileName,
     _In_     DWORD   dwFlags)
 {
+    COUNT_DETOURED_CALL(MoveFileExW);
+
     return Detoured_MoveFileWithProgressW(
         lpExistingFileName,
         lpNewFileName,
@@ -3906,6 +4334,8 @@ BOOL WINAPI Detoured_MoveFileExA(
     _In_opt_  LPCSTR lpNewFileName,
     _In_      DWORD  dwFlags)
 {
+    COUNT_DETOURED_CALL(MoveFileExA);
+
     {
         DetouredScope scope;
         if (scope.Detoured_IsDisabled() || IsNullOrEmptyA(lpExistingFileName) || IsNullOrEmptyA(lpNewFileName))
@@ -3947,6 +4377,7 @@ BOOL WINAPI Detoured_MoveFileWithProgressW(
     _In_opt_  LPVOID             lpData,
     _In_      DWORD              dwFlags)
 {
+    COUNT_DETOURED_CALL(MoveFileWithProgressW);
     DetouredScope scope;
     if (scope.Detoured_IsDisabled()
         || IsNullOrEmptyW(lpExistingFileName)
@@ -4025,6 +4456,8 @@ BOOL WINAPI Detoured_MoveFileWithProgressW(
 
     // Writes are destructive. Before doing a move we ensure that write access is definitely allowed to the source (read and delete) and destination (write).
 
+    InvalidateFileAccessCaches();
+
     AccessCheckResult sourceAccessCheck = sourcePolicyResult.CheckWriteAccess();
 
     if (sourceAccessCheck.ShouldDenyAccess())
@@ -4099,6 +4532,10 @@ BOOL WINAPI Detoured_MoveFileWithProgressW(
     {
         error = GetLastError();
     }
+    else
+    {
+        MarkHandleOverlayRenamed(hFile);
+    }
 
     ReportIfNeeded(sourceAccessCheck, sourceOpContext, sourcePolicyResult, error);
     ReportIfNeeded(destAccessCheck, destinationOpContext, destPolicyResult, error);
@@ -4124,6 +4561,8 @@ BOOL WINAPI Detoured_MoveFileWithProgressA(
     _In_opt_ LPVOID             lpData,
     _In_     DWORD              dwFlags)
 {
+    COUNT_DETOURED_CALL(MoveFileWithProgressA);
+
     {
         DetouredScope scope;
         if (scope.Detoured_IsDisabled() || IsNullOrEmptyA(lpExistingFileName))
@@ -4155,10 +4594,13 @@ BOOL WINAPI Detoured_ReplaceFileW(
     __reserved LPVOID  lpExclude,
     __reserved LPVOID  lpReserved)
 {
+    COUNT_DETOURED_CALL(ReplaceFileW);
+
     auto path = CanonicalizedPath::Canonicalize(lpReplacedFileName);
     PolicyResult policyResult;
     policyResult.Initialize(lpReplacedFileName);
     PathCache_Invalidate(path.GetPathStringWithoutTypePrefix(), false, policyResult);
+    InvalidateFileAccessCaches();
 
     // TODO:implement detours logic
     return Real_ReplaceFileW(
@@ -4178,6 +4620,8 @@ BOOL WINAPI Detoured_ReplaceFileA(
     __reserved  LPVOID lpExclude,
     __reserved  LPVOID lpReserved)
 {
+    COUNT_DETOURED_CALL(ReplaceFileA);
+
     {
         DetouredScope scope;
         if (scope.Detoured_IsDisabled()
@@ -4270,6 +4714,7 @@ static AccessCheckResult DeleteFileSafeProbe(AccessCheckResult writeAccessCheck,
 IMPLEMENTED(Detoured_DeleteFileW)
 BOOL WINAPI Detoured_DeleteFileW(_In_ LPCWSTR lpFileName)
 {
+    COUNT_DETOURED_CALL(DeleteFileW);
     DetouredScope scope;
     if (scope.Detoured_IsDisabled() ||
         IsNullOrEmptyW(lpFileName) ||
@@ -4303,6 +4748,8 @@ BOOL WINAPI Detoured_DeleteFileW(_In_ LPCWSTR lpFileName)
         return FALSE;
     }
 
+    InvalidateFileAccessCaches();
+
     AccessCheckResult accessCheck = policyResult.CheckWriteAccess();
 
     if (accessCheck.ShouldDenyAccess())
@@ -4351,6 +4798,8 @@ BOOL WINAPI Detoured_DeleteFileW(_In_ LPCWSTR lpFileName)
 IMPLEMENTED(Detoured_DeleteFileA)
 BOOL WINAPI Detoured_DeleteFileA(_In_ LPCSTR lpFileName)
 {
+    COUNT_DETOURED_CALL(DeleteFileA);
+
     {
         DetouredScope scope;
         if (scope.Detoured_IsDisabled() || IsNullOrEmptyA(lpFileName))
@@ -4369,6 +4818,7 @@ BOOL WINAPI Detoured_CreateHardLinkW(
     _In_       LPCWSTR               lpExistingFileName,
     __reserved LPSECURITY_ATTRIBUTES lpSecurityAttributes)
 {
+    COUNT_DETOURED_CALL(CreateHardLinkW);
     DetouredScope scope;
     if (scope.Detoured_IsDisabled() ||
         IsNullOrEmptyW(lpFileName) ||
@@ -4423,6 +4873,8 @@ BOOL WINAPI Detoured_CreateHardLinkW(
     destinationOpContext.OpenedFileOrDirectoryAttributes = sourceOpContext.OpenedFileOrDirectoryAttributes;
 
     // Only attempt the call if the write is allowed (prevent sneaky side effects).
+    InvalidateFileAccessCaches();
+
     AccessCheckResult destAccessCheck = destPolicyResult.CheckWriteAccess();
     if (destAccessCheck.ShouldDenyAccess())
     {
@@ -4475,6 +4927,8 @@ BOOL WINAPI Detoured_CreateHardLinkA(
     __reserved LPSECURITY_ATTRIBUTES lpSecurityAttributes
     )
 {
+    COUNT_DETOURED_CALL(CreateHardLinkA);
+
     {
         DetouredScope scope;
         if (scope.Detoured_IsDisabled() || IsNullOrEmptyA(lpFileName) || IsNullOrEmptyA(lpExistingFileName))
@@ -4500,6 +4954,7 @@ BOOLEAN WINAPI Detoured_CreateSymbolicLinkW(
     _In_ LPCWSTR lpTargetFileName,
     _In_ DWORD   dwFlags)
 {
+    COUNT_DETOURED_CALL(CreateSymbolicLinkW);
     DetouredScope scope;
     if (scope.Detoured_IsDisabled() ||
         IgnoreReparsePoints() ||
@@ -4545,6 +5000,8 @@ BOOLEAN WINAPI Detoured_CreateSymbolicLinkW(
     }
 
     // Check for write access on the symlink.
+    InvalidateFileAccessCaches();
+
     AccessCheckResult accessCheckSrc = policyResultSrc.CheckWriteAccess();
     accessCheckSrc = AccessCheckResult::Combine(accessCheckSrc, policyResultSrc.CheckSymlinkCreationAccess());
 
@@ -4584,6 +5041,8 @@ BOOLEAN WINAPI Detoured_CreateSymbolicLinkA(
     _In_ LPCSTR lpTargetFileName,
     _In_ DWORD  dwFlags)
 {
+    COUNT_DETOURED_CALL(CreateSymbolicLinkA);
+
     {
         DetouredScope scope;
         if (scope.Detoured_IsDisabled() || IsNullOrEmptyA(lpSymlinkFileName) || IsNullOrEmptyA(lpTargetFileName))
@@ -4608,6 +5067,8 @@ HANDLE WINAPI Detoured_FindFirstFileW(
     _In_  LPCWSTR            lpFileName,
     _Out_ LPWIN32_FIND_DATAW lpFindFileData)
 {
+    COUNT_DETOURED_CALL(FindFirstFileW);
+
     // FindFirstFileExW is a strict superset. This line is essentially the same as the FindFirstFileW thunk in \minkernel\kernelbase\filefind.c
     return Detoured_FindFirstFileExW(lpFileName, FindExInfoStandard, lpFindFileData, FindExSearchNameMatch, NULL, 0);
 }
@@ -4617,6 +5078,8 @@ HANDLE WINAPI Detoured_FindFirstFileA(
     _In_   LPCSTR             lpFileName,
     _Out_  LPWIN32_FIND_DATAA lpFindFileData)
 {
+    COUNT_DETOURED_CALL(FindFirstFileA);
+
     // TODO:replace with Detoured_FindFirstFileW below
     return Real_FindFirstFileA(
         lpFileName,
@@ -4668,6 +5131,18 @@ HANDLE WINAPI ReportFindFirstFileExWAccesses(
         return INVALID_HANDLE_VALUE;
     }
 
+    // The entries of a wildcard search that succeeds are all scrubbed of their short names: the first one below and the others by FindNextFile,
+    // through the overlay of the handle (a search that is denied returns no entry). The short names need not be looked up in the first place then,
+    // and the entries can be fetched in larger batches. Which entries match doesn't change: the file system matches the filter against short names
+    // regardless of the info level.
+    if (EnableDetoursBasicEnumerationInfo()
+        && fInfoLevelId == FindExInfoStandard
+        && PathContainsWildcard(canonicalizedPathIncludingFilter.GetLastComponent()))
+    {
+        fInfoLevelId = FindExInfoBasic;
+        dwAdditionalFlags |= FIND_FIRST_EX_LARGE_FETCH;
+    }
+
     DWORD error = ERROR_SUCCESS;
     HANDLE searchHandle = Real_FindFirstFileExW(lpFileName, fInfoLevelId, lpFindFileData, fSearchOp, lpSearchFilter, dwAdditionalFlags);
     error = GetLastError();
@@ -4820,6 +5295,8 @@ HANDLE WINAPI Detoured_FindFirstFileExW(
     __reserved LPVOID             lpSearchFilter,
     _In_       DWORD              dwAdditionalFlags)
 {
+    COUNT_DETOURED_CALL(FindFirstFileExW);
+
     if (ShouldUseLargeEnumerationBuffer())
     {
         dwAdditionalFlags |= FIND_FIRST_EX_LARGE_FETCH;
@@ -4848,6 +5325,8 @@ HANDLE WINAPI Detoured_FindFirstFileExA(
     __reserved LPVOID             lpSearchFilter,
     _In_       DWORD              dwAdditionalFlags)
 {
+    COUNT_DETOURED_CALL(FindFirstFileExA);
+
     // TODO: Note that we can't simply forward to FindFirstFileW here after a unicode conversion.
     // The output value differs too - WIN32_FIND_DATA{A, W}
 
@@ -4870,6 +5349,7 @@ BOOL WINAPI Detoured_FindNextFileW(
     _In_  HANDLE             hFindFile,
     _Out_ LPWIN32_FIND_DATAW lpFindFileData)
 {
+    COUNT_DETOURED_CALL(FindNextFileW);
     DetouredScope scope;
     DWORD error = ERROR_SUCCESS;
     BOOL result = Real_FindNextFileW(hFindFile, lpFindFileData);
@@ -4889,23 +5369,39 @@ BOOL WINAPI Detoured_FindNextFileW(
     HandleOverlayRef overlay = TryLookupHandleOverlay(hFindFile);
     if (overlay != nullptr)
     {
-        FileOperationContext fileOperationContext = FileOperationContext::CreateForRead(L"FindNextFile", overlay->Policy.GetCanonicalizedPath().GetPathString());
-
+        // The policy of each entry is found by resuming the policy search from the cursor of the directory, see GetPolicyForSubpath
         wchar_t const* enumeratedComponent = &lpFindFileData->cFileName[0];
-        PolicyResult filePolicyResult = overlay->Policy.GetPolicyForSubpath(enumeratedComponent);
+        PolicyResult filePolicyResult = overlay->Policy->GetPolicyForSubpath(enumeratedComponent);
 
-        if (!AdjustOperationContextAndPolicyResultWithFullyResolvedPath(fileOperationContext, overlay->Policy, true))
+        // Resolving the directory only depends on the directory, so it is done for the first entry FindNextFile returns only.
+        // From then on overlay->Policy is the policy of the resolved directory, whose path is the one reports are made against.
+        if (!overlay->EnumeratedDirectoryResolved)
         {
-            return FALSE;
+            FileOperationContext directoryOperationContext = FileOperationContext::CreateForRead(L"FindNextFile", overlay->Policy->GetCanonicalizedPath().GetPathString());
+            PolicyResult directoryPolicyResult = *overlay->Policy;
+            if (!AdjustOperationContextAndPolicyResultWithFullyResolvedPath(directoryOperationContext, directoryPolicyResult, true))
+            {
+                return FALSE;
+            }
+
+            overlay->Policy = std::make_shared<const PolicyResult>(directoryPolicyResult);
+            overlay->OverrideTimestamps = directoryPolicyResult.ShouldOverrideTimestamps(overlay->AccessCheck);
+            overlay->EnumeratedDirectoryResolved = true;
         }
 
         FileReadContext readContext;
         readContext.Existence = FileExistence::Existent;
         readContext.OpenedDirectory = IsDirectoryFromAttributes(lpFindFileData->dwFileAttributes, false);
-        fileOperationContext.OpenedFileOrDirectoryAttributes = lpFindFileData->dwFileAttributes;
 
         AccessCheckResult accessCheck = filePolicyResult.CheckReadAccess(RequestedReadAccess::EnumerationProbe, readContext);
-        ReportIfNeeded(accessCheck, fileOperationContext, filePolicyResult, result ? ERROR_SUCCESS : error);
+
+        // Most entries of an enumeration are not reported, so the report context is only built for the ones that are
+        if (accessCheck.ShouldReport())
+        {
+            FileOperationContext fileOperationContext = FileOperationContext::CreateForRead(L"FindNextFile", overlay->Policy->GetCanonicalizedPath().GetPathString());
+            fileOperationContext.OpenedFileOrDirectoryAttributes = lpFindFileData->dwFileAttributes;
+            ReportIfNeeded(accessCheck, fileOperationContext, filePolicyResult, result ? ERROR_SUCCESS : error);
+        }
 
         if (filePolicyResult.ShouldOverrideTimestamps(accessCheck))
         {
@@ -4937,6 +5433,8 @@ BOOL WINAPI Detoured_FindNextFileA(
     _In_  HANDLE             hFindFile,
     _Out_ LPWIN32_FIND_DATAA lpFindFileData)
 {
+    COUNT_DETOURED_CALL(FindNextFileA);
+
     // TODO:replace with the same logic as Detoured_FindNextFileW
     // Note that we can't simply forward to FindFirstFileW here after a unicode conversion.
     // The output value differs too - WIN32_FIND_DATA{A, W}
@@ -4952,6 +5450,7 @@ BOOL WINAPI Detoured_GetFileInformationByHandleEx(
     _Out_ LPVOID                    lpFileInformation,
     _In_  DWORD                     dwBufferSize)
 {
+    COUNT_DETOURED_CALL(GetFileInformationByHandleEx);
     DetouredScope scope;
 
     DWORD error = ERROR_SUCCESS;
@@ -4963,7 +5462,8 @@ BOOL WINAPI Detoured_GetFileInformationByHandleEx(
 
     error = GetLastError();
 
-    if (scope.Detoured_IsDisabled() || IsNullOrInvalidHandle(hFile) || fileInformationClass != FileBasicInfo || lpFileInformation == nullptr)
+    // There are no timestamps to override if the query failed
+    if (scope.Detoured_IsDisabled() || !result || IsNullOrInvalidHandle(hFile) || fileInformationClass != FileBasicInfo || lpFileInformation == nullptr)
     {
         return result;
     }
@@ -4971,22 +5471,13 @@ BOOL WINAPI Detoured_GetFileInformationByHandleEx(
     assert(fileInformationClass == FileBasicInfo);
     FILE_BASIC_INFO* fileBasicInfo = (FILE_BASIC_INFO*)lpFileInformation;
 
-    HandleOverlayRef overlay = TryLookupHandleOverlay(hFile);
-    if (overlay != nullptr)
-    {
-        if (overlay->Policy.ShouldOverrideTimestamps(overlay->AccessCheck))
-        {
-#if SUPER_VERBOSE
-            Dbg(L"GetFileInformationByHandleEx: Overriding timestamps for %s", overlay->Policy.GetCanonicalizedPath().GetPathString());
-#endif // SUPER_VERBOSE
-            OverrideTimestampsForInputFile(fileBasicInfo);
-        }
-    }
-    else
+    // The decision was made when the handle was opened. Handles without an overlay conservatively don't get their timestamps overridden.
+    if (ShouldOverrideTimestampsForHandle(hFile))
     {
 #if SUPER_VERBOSE
-        Dbg(L"GetFileInformationByHandleEx: Failed to find a handle overlay for policy information; conservatively not overriding timestamps");
+        Dbg(L"GetFileInformationByHandleEx: Overriding timestamps for handle 0x%p", hFile);
 #endif // SUPER_VERBOSE
+        OverrideTimestampsForInputFile(fileBasicInfo);
     }
 
     SetLastError(error);
@@ -4996,13 +5487,14 @@ BOOL WINAPI Detoured_GetFileInformationByHandleEx(
 IMPLEMENTED(Detoured_FindClose)
 BOOL WINAPI Detoured_FindClose(_In_ HANDLE handle)
 {
+    COUNT_DETOURED_CALL(FindClose);
     DetouredScope scope;
 
     DWORD error = ERROR_SUCCESS;
 
     // Make sure the handle is closed after the object is removed from the map.
     // This way the handle will never be assigned to a another object before removed from the table.
-    CloseHandleOverlay(handle, true);
+    CloseHandleOverlay(handle);
 
     BOOL result = Real_FindClose(handle);
     error = GetLastError();
@@ -5021,33 +5513,26 @@ BOOL WINAPI Detoured_GetFileInformationByHandle(
     _In_  HANDLE                       hFile,
     _Out_ LPBY_HANDLE_FILE_INFORMATION lpFileInformation)
 {
+    COUNT_DETOURED_CALL(GetFileInformationByHandle);
     DetouredScope scope;
 
     DWORD error = ERROR_SUCCESS;
     BOOL result = Real_GetFileInformationByHandle(hFile, lpFileInformation);
     error = GetLastError();
 
-    if (scope.Detoured_IsDisabled() || IsNullOrInvalidHandle(hFile) || lpFileInformation == nullptr)
+    // There are no timestamps to override if the query failed
+    if (scope.Detoured_IsDisabled() || !result || IsNullOrInvalidHandle(hFile) || lpFileInformation == nullptr)
     {
         return result;
     }
 
-    HandleOverlayRef overlay = TryLookupHandleOverlay(hFile);
-    if (overlay != nullptr)
-    {
-        if (overlay->Policy.ShouldOverrideTimestamps(overlay->AccessCheck))
-        {
-#if SUPER_VERBOSE
-            Dbg(L"GetFileInformationByHandle: Overriding timestamps for %s", overlay->Policy.GetCanonicalizedPath().GetPathString());
-#endif // SUPER_VERBOSE
-            OverrideTimestampsForInputFile(lpFileInformation);
-        }
-    }
-    else
+    // The decision was made when the handle was opened. Handles without an overlay conservatively don't get their timestamps overridden.
+    if (ShouldOverrideTimestampsForHandle(hFile))
     {
 #if SUPER_VERBOSE
-        Dbg(L"GetFileInformationByHandle: Failed to find a handle overlay for policy information; conservatively not overriding timestamps");
+        Dbg(L"GetFileInformationByHandle: Overriding timestamps for handle 0x%p", hFile);
 #endif // SUPER_VERBOSE
+        OverrideTimestampsForInputFile(lpFileInformation);
     }
 
     SetLastError(error);
@@ -5077,6 +5562,8 @@ static BOOL DeleteUsingSetFileInformationByHandle(
         return FALSE;
     }
 
+    InvalidateFileAccessCaches();
+
     AccessCheckResult sourceAccessCheck = sourcePolicyResult.CheckWriteAccess();
     IsHandleOrPathToDirectory(hFile, fullPath.c_str(), false, /*ref*/ sourceOpContext.OpenedFileOrDirectoryAttributes);
 
@@ -5136,6 +5623,8 @@ static BOOL RenameUsingSetFileInformationByHandle(
         return FALSE;
     }
 
+    InvalidateFileAccessCaches();
+
     AccessCheckResult sourceAccessCheck = sourcePolicyResult.CheckWriteAccess();
 
     if (sourceAccessCheck.ShouldDenyAccess())
@@ -5251,6 +5740,8 @@ BOOL WINAPI Detoured_SetFileInformationByHandle(
     _In_ LPVOID                    lpFileInformation,
     _In_ DWORD                     dwBufferSize)
 {
+    COUNT_DETOURED_CALL(SetFileInformationByHandle);
+
     bool isDisposition =
         FileInformationClass == FILE_INFO_BY_HANDLE_CLASS::FileDispositionInfo
         || FileInformationClass == FILE_INFO_BY_HANDLE_CLASS::FileDispositionInfoEx;
@@ -5354,6 +5845,8 @@ HANDLE WINAPI Detoured_OpenFileMappingW(
     _In_ BOOL    bInheritHandle,
     _In_ LPCWSTR lpName)
 {
+    COUNT_DETOURED_CALL(OpenFileMappingW);
+
     // TODO:implement detours logic
     return Real_OpenFileMappingW(
         dwDesiredAccess,
@@ -5366,6 +5859,8 @@ HANDLE WINAPI Detoured_OpenFileMappingA(
     _In_  BOOL   bInheritHandle,
     _In_  LPCSTR lpName)
 {
+    COUNT_DETOURED_CALL(OpenFileMappingA);
+
     {
         DetouredScope scope;
         if (scope.Detoured_IsDisabled() || IsNullOrEmptyA(lpName))
@@ -5394,6 +5889,8 @@ UINT WINAPI Detoured_GetTempFileNameW(
     _In_  UINT    uUnique,
     _Out_ LPTSTR  lpTempFileName)
 {
+    COUNT_DETOURED_CALL(GetTempFileNameW);
+
     // TODO:implement detours logic
     return Real_GetTempFileNameW(
         lpPathName,
@@ -5408,6 +5905,8 @@ UINT WINAPI Detoured_GetTempFileNameA(
     _In_  UINT   uUnique,
     _Out_ LPSTR  lpTempFileName)
 {
+    COUNT_DETOURED_CALL(GetTempFileNameA);
+
     // TODO:implement detours logic
     return Real_GetTempFileNameA(
         lpPathName,
@@ -5503,6 +6002,7 @@ BOOL WINAPI Detoured_CreateDirectoryW(
     _In_     LPCWSTR               lpPathName,
     _In_opt_ LPSECURITY_ATTRIBUTES lpSecurityAttributes)
 {
+    COUNT_DETOURED_CALL(CreateDirectoryW);
     DetouredScope scope;
     if (scope.Detoured_IsDisabled() ||
         IsNullOrEmptyW(lpPathName) ||
@@ -5590,6 +6090,8 @@ BOOL WINAPI Detoured_CreateDirectoryA(
     _In_     LPCSTR                lpPathName,
     _In_opt_ LPSECURITY_ATTRIBUTES lpSecurityAttributes)
 {
+    COUNT_DETOURED_CALL(CreateDirectoryA);
+
     {
         DetouredScope scope;
         if (scope.Detoured_IsDisabled() || IsNullOrEmptyA(lpPathName))
@@ -5611,6 +6113,8 @@ BOOL WINAPI Detoured_CreateDirectoryExW(
     _In_     LPCWSTR               lpNewDirectory,
     _In_opt_ LPSECURITY_ATTRIBUTES lpSecurityAttributes)
 {
+    COUNT_DETOURED_CALL(CreateDirectoryExW);
+
     // TODO:implement detours logic
     return Real_CreateDirectoryExW(
         lpTemplateDirectory,
@@ -5623,6 +6127,8 @@ BOOL WINAPI Detoured_CreateDirectoryExA(
     _In_     LPCSTR                lpNewDirectory,
     _In_opt_ LPSECURITY_ATTRIBUTES lpSecurityAttributes)
 {
+    COUNT_DETOURED_CALL(CreateDirectoryExA);
+
     {
         DetouredScope scope;
         if (scope.Detoured_IsDisabled() ||
@@ -5646,6 +6152,7 @@ BOOL WINAPI Detoured_CreateDirectoryExA(
 IMPLEMENTED(Detoured_RemoveDirectoryW)
 BOOL WINAPI Detoured_RemoveDirectoryW(_In_ LPCWSTR lpPathName)
 {
+    COUNT_DETOURED_CALL(RemoveDirectoryW);
     DetouredScope scope;
     if (scope.Detoured_IsDisabled() ||
         IsNullOrEmptyW(lpPathName) ||
@@ -5674,6 +6181,8 @@ BOOL WINAPI Detoured_RemoveDirectoryW(_In_ LPCWSTR lpPathName)
         return FALSE;
     }
 
+    InvalidateFileAccessCaches();
+
     AccessCheckResult accessCheck = policyResult.CheckWriteAccess();
     opContext.OpenedFileOrDirectoryAttributes = FILE_ATTRIBUTE_DIRECTORY;
 
@@ -5719,6 +6228,8 @@ BOOL WINAPI Detoured_RemoveDirectoryW(_In_ LPCWSTR lpPathName)
 IMPLEMENTED(Detoured_RemoveDirectoryA)
 BOOL WINAPI Detoured_RemoveDirectoryA(_In_ LPCSTR lpPathName)
 {
+    COUNT_DETOURED_CALL(RemoveDirectoryA);
+
     {
         DetouredScope scope;
         if (scope.Detoured_IsDisabled() || IsNullOrEmptyA(lpPathName))
@@ -5731,10 +6242,43 @@ BOOL WINAPI Detoured_RemoveDirectoryA(_In_ LPCSTR lpPathName)
     return Detoured_RemoveDirectoryW(pathName);
 }
 
+// Changing the current directory is not a file access, but canonicalizations of relative paths cached before the change are stale.
+// They are invalidated even when the scope is disabled: BuildXL code itself doesn't change directories, but the cache is shared.
+IMPLEMENTED(Detoured_SetCurrentDirectoryW)
+BOOL WINAPI Detoured_SetCurrentDirectoryW(_In_ LPCWSTR lpPathName)
+{
+    COUNT_DETOURED_CALL(SetCurrentDirectoryW);
+
+    BOOL result = Real_SetCurrentDirectoryW(lpPathName);
+    if (result)
+    {
+        CanonicalizedPath::InvalidateCurrentDirectory();
+    }
+
+    return result;
+}
+
+IMPLEMENTED(Detoured_SetCurrentDirectoryA)
+BOOL WINAPI Detoured_SetCurrentDirectoryA(_In_ LPCSTR lpPathName)
+{
+    COUNT_DETOURED_CALL(SetCurrentDirectoryA);
+
+    // SetCurrentDirectoryA doesn't go through SetCurrentDirectoryW, so it needs its own invalidation
+    BOOL result = Real_SetCurrentDirectoryA(lpPathName);
+    if (result)
+    {
+        CanonicalizedPath::InvalidateCurrentDirectory();
+    }
+
+    return result;
+}
+
 BOOL WINAPI Detoured_DecryptFileW(
     _In_       LPCWSTR lpFileName,
     __reserved DWORD dwReserved)
 {
+    COUNT_DETOURED_CALL(DecryptFileW);
+
     // TODO:implement detours logic
     return Real_DecryptFileW(
         lpFileName,
@@ -5745,6 +6289,8 @@ BOOL WINAPI Detoured_DecryptFileA(
     _In_       LPCSTR lpFileName,
     __reserved DWORD dwReserved)
 {
+    COUNT_DETOURED_CALL(DecryptFileA);
+
     {
         DetouredScope scope;
         if (scope.Detoured_IsDisabled() || IsNullOrEmptyA(lpFileName))
@@ -5763,12 +6309,16 @@ BOOL WINAPI Detoured_DecryptFileA(
 
 BOOL WINAPI Detoured_EncryptFileW(_In_ LPCWSTR lpFileName)
 {
+    COUNT_DETOURED_CALL(EncryptFileW);
+
     // TODO:implement detours logic
     return Real_EncryptFileW(lpFileName);
 }
 
 BOOL WINAPI Detoured_EncryptFileA(_In_ LPCSTR lpFileName)
 {
+    COUNT_DETOURED_CALL(EncryptFileA);
+
     {
         DetouredScope scope;
         if (scope.Detoured_IsDisabled() || IsNullOrEmptyA(lpFileName))
@@ -5786,6 +6336,8 @@ DWORD WINAPI Detoured_OpenEncryptedFileRawW(
     _In_  ULONG   ulFlags,
     _Out_ PVOID*  pvContext)
 {
+    COUNT_DETOURED_CALL(OpenEncryptedFileRawW);
+
     // TODO:implement detours logic
     return Real_OpenEncryptedFileRawW(
         lpFileName,
@@ -5798,6 +6350,8 @@ DWORD WINAPI Detoured_OpenEncryptedFileRawA(
     _In_  ULONG  ulFlags,
     _Out_ PVOID* pvContext)
 {
+    COUNT_DETOURED_CALL(OpenEncryptedFileRawA);
+
     {
         DetouredScope scope;
         if (scope.Detoured_IsDisabled() || IsNullOrEmptyA(lpFileName))
@@ -5829,6 +6383,8 @@ HANDLE WINAPI Detoured_OpenFileById(
     _In_opt_ LPSECURITY_ATTRIBUTES lpSecurityAttributes,
     _In_     DWORD                 dwFlags)
 {
+    COUNT_DETOURED_CALL(OpenFileById);
+
     // TODO:implement detours logic
     return Real_OpenFileById(
         hFile,
@@ -5846,6 +6402,8 @@ DWORD WINAPI Detoured_GetFinalPathNameByHandleA(
     _In_  DWORD cchFilePath,
     _In_  DWORD dwFlags)
 {
+    COUNT_DETOURED_CALL(GetFinalPathNameByHandleA);
+
     unique_ptr<wchar_t[]> wideFilePathBuffer(new wchar_t[cchFilePath]);
     DWORD err = Detoured_GetFinalPathNameByHandleW(hFile, wideFilePathBuffer.get(), cchFilePath, dwFlags);
 
@@ -5907,6 +6465,7 @@ DWORD WINAPI Detoured_GetFinalPathNameByHandleW(
     _In_  DWORD  cchFilePath,
     _In_  DWORD  dwFlags)
 {
+    COUNT_DETOURED_CALL(GetFinalPathNameByHandleW);
     DetouredScope scope;
 
     if (scope.Detoured_IsDisabled() || IgnoreGetFinalPathNameByHandle())
@@ -5981,6 +6540,7 @@ NTSTATUS NTAPI Detoured_NtQueryDirectoryFile(
     _In_opt_ PUNICODE_STRING        FileName,
     _In_     BOOLEAN                RestartScan)
 {
+    COUNT_DETOURED_CALL(NtQueryDirectoryFile);
     DetouredScope scope;
     LPCWSTR directoryName = nullptr;
     wstring filter;
@@ -5992,25 +6552,25 @@ NTSTATUS NTAPI Detoured_NtQueryDirectoryFile(
 
     if (!noDetour)
     {
-        // Check for enumeration. The default for us is true,
-        // but if the FileName parameter is present and is not
-        // a wild card, we'll set it to false.
-        if (FileName != nullptr)
-        {
-            filter.assign(FileName->Buffer, (size_t)(FileName->Length / sizeof(wchar_t)));
-            isEnumeration = PathContainsWildcard(filter.c_str());
-        }
-
-        // See if the handle is known
+        // See if the handle is known. Once its enumeration is settled, the following buffers of a big enumeration
+        // are returned as they are, without building anything.
         overlay = TryLookupHandleOverlay(FileHandle);
-        
         if (overlay == nullptr || overlay->EnumerationHasBeenReported)
         {
             noDetour = true;
         }
         else
         {
-            canonicalizedDirectoryPath = overlay->Policy.GetCanonicalizedPath();
+            // Check for enumeration. The default for us is true,
+            // but if the FileName parameter is present and is not
+            // a wild card, we'll set it to false.
+            if (FileName != nullptr)
+            {
+                filter.assign(FileName->Buffer, (size_t)(FileName->Length / sizeof(wchar_t)));
+                isEnumeration = PathContainsWildcard(filter.c_str());
+            }
+
+            canonicalizedDirectoryPath = overlay->Policy->GetCanonicalizedPath();
             directoryName = canonicalizedDirectoryPath.GetPathString();
 
             if (_wcsicmp(directoryName, L"\\\\.\\MountPointManager") == 0 ||
@@ -6076,7 +6636,7 @@ NTSTATUS NTAPI Detoured_NtQueryDirectoryFile(
             //       given a policy flag for allowing enumeration, we'd apply it globally anyway.
             // TODO: Should include the wildcard in enumeration reports, so that directory enumeration assertions can be more precise.
 
-            PolicyResult directoryPolicyResult = overlay->Policy;
+            PolicyResult directoryPolicyResult = *overlay->Policy;
             FileOperationContext fileOperationContext = FileOperationContext::CreateForRead(L"NtQueryDirectoryFile", directoryName);
             fileOperationContext.OpenedFileOrDirectoryAttributes = FILE_ATTRIBUTE_DIRECTORY;
 
@@ -6100,8 +6660,10 @@ NTSTATUS NTAPI Detoured_NtQueryDirectoryFile(
                 directoryAccessCheck.Level = ReportLevel::Report;
             }
 
-            // Remember that we already enumerated this directory if successful
-            overlay->EnumerationHasBeenReported = NT_SUCCESS(result) && directoryAccessCheck.ShouldReport();
+            // Remember that we already enumerated this directory if successful.
+            // When the policy doesn't report enumerations and not all accesses are reported, no later call on this handle can report
+            // anything either, whatever its filter: don't resolve the directory again for each of the following buffers.
+            overlay->EnumerationHasBeenReported = NT_SUCCESS(result) && (directoryAccessCheck.ShouldReport() || !reportDirectoryEnumeration);
 
             // We can report the status for directory now.
             ReportIfNeeded(directoryAccessCheck, fileOperationContext, directoryPolicyResult, (DWORD)(NT_SUCCESS(result) ? ERROR_SUCCESS : result), -1, filter.c_str());
@@ -6127,6 +6689,7 @@ NTSTATUS NTAPI Detoured_ZwQueryDirectoryFile(
     _In_opt_ PUNICODE_STRING        FileName,
     _In_     BOOLEAN                RestartScan)
 {
+    COUNT_DETOURED_CALL(ZwQueryDirectoryFile);
     DetouredScope scope;
     LPCWSTR directoryName = nullptr;
     wstring filter;
@@ -6139,16 +6702,8 @@ NTSTATUS NTAPI Detoured_ZwQueryDirectoryFile(
 
     if (!noDetour)
     {
-        // Check for enumeration. The default for us is true,
-        // but if the FileName parameter is present and is not
-        // a wild card, we'll set it to false.
-        if (FileName != nullptr)
-        {
-            filter.assign(FileName->Buffer, (size_t)(FileName->Length / sizeof(wchar_t)));
-            isEnumeration = PathContainsWildcard(filter.c_str());
-        }
-
-        // See if the handle is known
+        // See if the handle is known. Once its enumeration is settled, the following buffers of a big enumeration
+        // are returned as they are, without building anything.
         overlay = TryLookupHandleOverlay(FileHandle);
         if (overlay == nullptr || overlay->EnumerationHasBeenReported)
         {
@@ -6156,7 +6711,16 @@ NTSTATUS NTAPI Detoured_ZwQueryDirectoryFile(
         }
         else
         {
-            canonicalizedDirectoryPath = overlay->Policy.GetCanonicalizedPath();
+            // Check for enumeration. The default for us is true,
+            // but if the FileName parameter is present and is not
+            // a wild card, we'll set it to false.
+            if (FileName != nullptr)
+            {
+                filter.assign(FileName->Buffer, (size_t)(FileName->Length / sizeof(wchar_t)));
+                isEnumeration = PathContainsWildcard(filter.c_str());
+            }
+
+            canonicalizedDirectoryPath = overlay->Policy->GetCanonicalizedPath();
             directoryName = canonicalizedDirectoryPath.GetPathString();
 
             if (_wcsicmp(directoryName, L"\\\\.\\MountPointManager") == 0 ||
@@ -6221,7 +6785,7 @@ NTSTATUS NTAPI Detoured_ZwQueryDirectoryFile(
             //       Since enumeration has historically not been understood or reported at all, this is a fine incremental move -
             //       given a policy flag for allowing enumeration, we'd apply it globally anyway.
             // TODO: Should include the wildcard in enumeration reports, so that directory enumeration assertions can be more precise.
-            PolicyResult directoryPolicyResult = overlay->Policy;
+            PolicyResult directoryPolicyResult = *overlay->Policy;
             FileOperationContext fileOperationContext = FileOperationContext::CreateForRead(L"ZwQueryDirectoryFile", directoryName);
             fileOperationContext.OpenedFileOrDirectoryAttributes = FILE_ATTRIBUTE_DIRECTORY;
 
@@ -6245,11 +6809,13 @@ NTSTATUS NTAPI Detoured_ZwQueryDirectoryFile(
                 directoryAccessCheck.Level = ReportLevel::Report;
             }
 
-            // Remember that we already enumerated this directory if successful
-            overlay->EnumerationHasBeenReported = NT_SUCCESS(result) && directoryAccessCheck.ShouldReport();
+            // Remember that we already enumerated this directory if successful.
+            // When the policy doesn't report enumerations and not all accesses are reported, no later call on this handle can report
+            // anything either, whatever its filter: don't resolve the directory again for each of the following buffers.
+            overlay->EnumerationHasBeenReported = NT_SUCCESS(result) && (directoryAccessCheck.ShouldReport() || !reportDirectoryEnumeration);
 
             // We can report the status for directory now.
-            ReportIfNeeded(directoryAccessCheck, fileOperationContext, overlay->Policy, (DWORD)(NT_SUCCESS(result) ? ERROR_SUCCESS : result));
+            ReportIfNeeded(directoryAccessCheck, fileOperationContext, *overlay->Policy, (DWORD)(NT_SUCCESS(result) ? ERROR_SUCCESS : result));
         }
     }
 
@@ -6265,6 +6831,28 @@ static bool PathFromObjectAttributesViaId(POBJECT_ATTRIBUTES objectAttributes, U
 
     DWORD lastError = GetLastError();
 
+    // Ids are relative to the volume of the root directory. Only the id itself is in the name then, which is what the cache is keyed by.
+    const BYTE* fileId = objectAttributes->ObjectName != nullptr ? reinterpret_cast<const BYTE*>(objectAttributes->ObjectName->Buffer) : nullptr;
+    size_t fileIdLength = objectAttributes->ObjectName != nullptr ? objectAttributes->ObjectName->Length : 0;
+    FILE_ID_INFO rootIdInfo;
+    bool useFileIdPathCache = EnableDetoursFileIdPathCache()
+        && objectAttributes->RootDirectory != nullptr
+        && fileId != nullptr
+        && (fileIdLength == sizeof(LONGLONG) || fileIdLength == sizeof(FILE_ID_128))
+        && GetFileInformationByHandleEx(objectAttributes->RootDirectory, FileIdInfo, &rootIdInfo, sizeof(rootIdInfo));
+
+    if (useFileIdPathCache)
+    {
+        wstring cachedPath;
+        if (FileIdPathCache::GetInstance()->TryGetPath(rootIdInfo.VolumeSerialNumber, fileId, fileIdLength, cachedPath))
+        {
+            CountDetoursEvent(DetoursEvent::FileIdPathCacheHit);
+            path = CanonicalizedPath::Canonicalize(cachedPath.c_str());
+            SetLastError(lastError);
+            return true;
+        }
+    }
+
     // Tool wants to open file by id, then that file is assumed to exist.
     // Unfortunately, we need to open a handle to get the file path.
     // Try open a handle with Read access.
@@ -6301,6 +6889,11 @@ static bool PathFromObjectAttributesViaId(POBJECT_ATTRIBUTES objectAttributes, U
     NtClose(hFile);
     path = CanonicalizedPath::Canonicalize(fullPath.c_str());
 
+    if (useFileIdPathCache)
+    {
+        FileIdPathCache::GetInstance()->Register(rootIdInfo.VolumeSerialNumber, fileId, fileIdLength, fullPath);
+    }
+
     SetLastError(lastError);
 
     return true;
@@ -6326,24 +6919,25 @@ static bool PathFromObjectAttributes(POBJECT_ATTRIBUTES objectAttributes, ULONG
     {
         overlay = TryLookupHandleOverlay(objectAttributes->RootDirectory);
         // If root directory is specified, we better know about it by know -- ignore unknown relative paths
-        if (overlay == nullptr || overlay->Policy.GetCanonicalizedPath().IsNull())
+        if (overlay == nullptr || overlay->Policy->GetCanonicalizedPath().IsNull())
         {
             return false;
         }
     }
 
-    // Convert the ObjectName (buffer with a size) to be null-terminated.
-    wstring name(objectAttributes->ObjectName->Buffer, (size_t)(objectAttributes->ObjectName->Length / sizeof(wchar_t)));
+    // The ObjectName is a counted buffer, not null-terminated. It is used in place: its characters only get copied into the resulting path.
+    PCWSTR name = objectAttributes->ObjectName->Buffer;
+    size_t nameLength = name == nullptr ? 0 : wcsnlen(name, (size_t)(objectAttributes->ObjectName->Length / sizeof(wchar_t)));
 
     if (overlay != nullptr)
     {
         // If there is no 'name' set (name is empty), just use the canonicalized path. Otherwise need to extend,
         // so '\' is appended to the canonicalized path and then the name is appended.
-        path = name.empty() ? overlay->Policy.GetCanonicalizedPath() : overlay->Policy.GetCanonicalizedPath().Extend(name.c_str());
+        path = nameLength == 0 ? overlay->Policy->GetCanonicalizedPath() : overlay->Policy->GetCanonicalizedPath().Extend(name, nameLength, /* extensionStartIndex */ nullptr);
     }
     else
     {
-        path = CanonicalizedPath::Canonicalize(name.c_str());
+        path = CanonicalizedPath::Canonicalize(name == nullptr ? L"" : name, nameLength);
     }
 
     // Nt* functions require an NT-style path syntax. Opening 'C:\foo' will fail with STATUS_OBJECT_PATH_SYNTAX_BAD;
@@ -6411,6 +7005,34 @@ static bool CheckIfNtCreateFileOptionsExcludeOpeningFiles(ULONG createOptions)
     return (createOptions & FILE_DIRECTORY_FILE) != 0;
 }
 
+/// <summary>
+/// Whether an open comes straight from a system module trusted with the API (see SystemCallerFilter.h), so its policy needs no evaluation.
+/// </summary>
+/// <remarks>
+/// Opens that may write, create or delete are never filtered: their policy is enforced whoever the caller is.
+/// </remarks>
+static bool IsOpenFromTrustedSystemCaller(
+    const void*        returnAddress,
+    SystemCallerApi    api,
+    ACCESS_MASK        desiredAccess,
+    POBJECT_ATTRIBUTES objectAttributes,
+    ULONG              createDisposition,
+    ULONG              createOptions)
+{
+    if (!EnableDetoursSystemCallerFilter()
+        || objectAttributes == nullptr
+        || createDisposition != FILE_OPEN
+        || WantsWriteAccess(desiredAccess)
+        || CheckIfNtCreateMayDeleteFile(createOptions, desiredAccess)
+        || !IsTrustedSystemCaller(returnAddress, api, objectAttributes->ObjectName, objectAttributes->RootDirectory))
+    {
+        return false;
+    }
+
+    CountDetoursEvent(DetoursEvent::TrustedSystemCallerOpen);
+    return true;
+}
+
 IMPLEMENTED(Detoured_ZwCreateFile)
 NTSTATUS NTAPI Detoured_ZwCreateFile(
     _Out_    PHANDLE            FileHandle,
@@ -6425,6 +7047,7 @@ NTSTATUS NTAPI Detoured_ZwCreateFile(
     _In_opt_ PVOID              EaBuffer,
     _In_     ULONG              EaLength)
 {
+    COUNT_DETOURED_CALL(ZwCreateFile);
     DetouredScope scope;
 
     // As a performance workaround, neuter the FILE_RANDOM_ACCESS hint (even if Detoured_IsDisabled() and there's another detoured API higher on the stack).
@@ -6437,6 +7060,7 @@ NTSTATUS NTAPI Detoured_ZwCreateFile(
     if (scope.Detoured_IsDisabled() ||
         !MonitorZwCreateOpenQueryFile() ||
         ObjectAttributes == nullptr ||
+        IsOpenFromTrustedSystemCaller(_ReturnAddress(), SystemCallerApi::ZwCreateFile, DesiredAccess, ObjectAttributes, CreateDisposition, CreateOptions) ||
         !PathFromObjectAttributes(ObjectAttributes, FileAttributes, CreateOptions, path) ||
         IsSpecialDeviceName(path.GetPathString()))
     {
@@ -6493,6 +7117,11 @@ NTSTATUS NTAPI Detoured_ZwCreateFile(
         error = GetLastError();
         accessCheck = policyResult.CheckWriteAccess();
 
+        if ((CreateOptions & FILE_DELETE_ON_CLOSE) != 0)
+        {
+            InvalidateFileAccessCaches();
+        }
+
         // Note: The MonitorNtCreateFile() flag is temporary until OSG (we too) fixes all newly discovered dependencies.
         if (accessCheck.Result != ResultAction::Allow && !MonitorNtCreateFile())
         {
@@ -6686,7 +7315,9 @@ NTSTATUS NTAPI Detoured_ZwCreateFile(
         }
     }
 
-    if (shouldReportAccessCheck)
+    InvalidateExpectedUsnsIfWriting(accessCheck);
+
+    if (shouldReportAccessCheck && !IsWriteOpenAlreadyReported(accessCheck, opContext, policyResult, RtlNtStatusToDosError(result)))
     {
         ReportIfNeeded(accessCheck, opContext, policyResult, RtlNtStatusToDosError(result));
     }
@@ -6731,6 +7362,7 @@ NTSTATUS NTAPI Detoured_NtCreateFile(
     _In_opt_ PVOID              EaBuffer,
     _In_     ULONG              EaLength)
 {
+    COUNT_DETOURED_CALL(NtCreateFile);
     DetouredScope scope;
 
     // As a performance workaround, neuter the FILE_RANDOM_ACCESS hint (even if Detoured_IsDisabled() and there's another detoured API higher on the stack).
@@ -6742,6 +7374,7 @@ NTSTATUS NTAPI Detoured_NtCreateFile(
 
     if (scope.Detoured_IsDisabled() ||
         ObjectAttributes == nullptr ||
+        IsOpenFromTrustedSystemCaller(_ReturnAddress(), SystemCallerApi::NtCreateFile, DesiredAccess, ObjectAttributes, CreateDisposition, CreateOptions) ||
         !PathFromObjectAttributes(ObjectAttributes, FileAttributes, CreateOptions, path) ||
         IsSpecialDeviceName(path.GetPathString()))
     {
@@ -6803,6 +7436,11 @@ NTSTATUS NTAPI Detoured_NtCreateFile(
         error = GetLastError();
         accessCheck = policyResult.CheckWriteAccess();
 
+        if ((CreateOptions & FILE_DELETE_ON_CLOSE) != 0)
+        {
+            InvalidateFileAccessCaches();
+        }
+
         // Note: The MonitorNtCreateFile() flag is temporary until OSG (we too) fixes all newly discovered dependencies.
         if (accessCheck.Result != ResultAction::Allow && !MonitorNtCreateFile())
         {
@@ -7002,7 +7640,9 @@ NTSTATUS NTAPI Detoured_NtCreateFile(
         }
     }
 
-    if (shouldReportAccessCheck)
+    InvalidateExpectedUsnsIfWriting(accessCheck);
+
+    if (shouldReportAccessCheck && !IsWriteOpenAlreadyReported(accessCheck, opContext, policyResult, RtlNtStatusToDosError(result)))
     {
         ReportIfNeeded(accessCheck, opContext, policyResult, RtlNtStatusToDosError(result));
     }
@@ -7044,6 +7684,14 @@ NTSTATUS NTAPI Detoured_ZwOpenFile(
     _In_  ULONG              ShareAccess,
     _In_  ULONG              OpenOptions)
 {
+    COUNT_DETOURED_CALL(ZwOpenFile);
+
+    // Forwarding to the ZwCreateFile detour hides the caller of ZwOpenFile, so it is recognized here
+    if (IsOpenFromTrustedSystemCaller(_ReturnAddress(), SystemCallerApi::ZwOpenFile, DesiredAccess, ObjectAttributes, FILE_OPEN, OpenOptions))
+    {
+        return Real_ZwOpenFile(FileHandle, DesiredAccess, ObjectAttributes, IoStatusBlock, ShareAccess, OpenOptions & ~FILE_RANDOM_ACCESS);
+    }
+
     return Detoured_ZwCreateFile(
         FileHandle,
         DesiredAccess,
@@ -7068,12 +7716,19 @@ NTSTATUS NTAPI Detoured_NtOpenFile(
     _In_  ULONG              ShareAccess,
     _In_  ULONG              OpenOptions)
 {
+    COUNT_DETOURED_CALL(NtOpenFile);
+
     // We don't EnterLoggingScope for NtOpenFile or NtCreateFile for two reasons:
     // - Of course these get called.
     // - It's hard to predict library loads (e.g. even by a statically linked CRT), which complicates testing of other call logging.
 
     // NtOpenFile is just a handy shortcut for NtCreateFile (with creation-specific parameters omitted).
     // We forward to the NtCreateFile detour here in order to have a single implementation.
+    // That hides the caller of NtOpenFile from the NtCreateFile detour, so a trusted system caller is recognized here.
+    if (IsOpenFromTrustedSystemCaller(_ReturnAddress(), SystemCallerApi::NtOpenFile, DesiredAccess, ObjectAttributes, FILE_OPEN, OpenOptions))
+    {
+        return Real_NtOpenFile(FileHandle, DesiredAccess, ObjectAttributes, IoStatusBlock, ShareAccess, OpenOptions & ~FILE_RANDOM_ACCESS);
+    }
 
     return Detoured_NtCreateFile(
         FileHandle,
@@ -7093,6 +7748,8 @@ NTSTATUS NTAPI Detoured_NtOpenFile(
 IMPLEMENTED(Detoured_NtClose)
 NTSTATUS NTAPI Detoured_NtClose(_In_ HANDLE handle)
 {
+    COUNT_DETOURED_CALL(NtClose);
+
 #if MEASURE_DETOURED_NT_CLOSE_IMPACT
     InterlockedIncrement(&g_ntCloseHandeCount);
 #endif // MEASURE_DETOURED_NT_CLOSE_IMPACT
@@ -7104,9 +7761,10 @@ NTSTATUS NTAPI Detoured_NtClose(_In_ HANDLE handle)
     // would AV. As a workaround, we just don't check it here (there's no harm in
     // dropping a handle overlay when trying to close the handle, anyway).
     //
-    // Make sure the handle is closed after the object is marked for removal from the map.
-    // This way the handle will never be assigned to a another object before removed from the map
-    // (whenever the map is accessed, the closed handle list is drained).
+    // Make sure the handle is closed after the object is removed from the map.
+    // This way the handle will never be assigned to a another object before removed from the map.
+    // The map is lock-free and removing an overlay doesn't touch the heap, so this is safe even when NtClose
+    // is called while holding the OS heap lock.
 
     if (!IsNullOrInvalidHandle(handle))
     {
@@ -7116,16 +7774,7 @@ NTSTATUS NTAPI Detoured_NtClose(_In_ HANDLE handle)
             // This is to make sure the behaviour for Windows builds is not altered.
             // Also if the NtCreateFile is no monitored, the map should not grow significantly. The other cases where it is updated -
             // for example CreateFileW, the map is updated by the CloseFile detoured API.
-            if (UseExtraThreadToDrainNtClose())
-            {
-                AddClosedHandle(handle);
-            }
-            else
-            {
-                // Just remove the handle from the table directly.
-                // Pass true for recursiveCall, since we don't have anything in the handle drain list and call to drain it is not needed.
-                CloseHandleOverlay(handle, true);
-            }
+            CloseHandleOverlay(handle);
         }
     }
 
@@ -7139,6 +7788,8 @@ BOOL WINAPI Detoured_CreatePipe(
     _In_opt_       LPSECURITY_ATTRIBUTES lpPipeAttributes,
     _In_           DWORD                 nSize)
 {
+    COUNT_DETOURED_CALL(CreatePipe);
+
     // The reason for this scope check is that CreatePipe calls many other detoured APIs, e.g., NtOpenFile, and we do not want to have any reports
     // for file accesses from those APIs (they are not what the application calls).
     DetouredScope scope;
@@ -7164,6 +7815,7 @@ BOOL WINAPI Detoured_DeviceIoControl(
   _Out_               LPOVERLAPPED lpOverlapped
 )
 {
+    COUNT_DETOURED_CALL(DeviceIoControl);
     DetouredScope scope;
 
     auto result = Real_DeviceIoControl(
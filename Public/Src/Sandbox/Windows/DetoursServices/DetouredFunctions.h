@@ -405,6 +405,16 @@ BOOL WINAPI Detoured_RemoveDirectoryA(
     __in  LPCSTR lpPathName
     );
 
+// See SetCurrentDirectory on MSDN: https://docs.microsoft.com/en-us/windows/win32/api/winbase/nf-winbase-setcurrentdirectory
+BOOL WINAPI Detoured_SetCurrentDirectoryW(
+    __in  LPCWSTR lpPathName
+    );
+
+// See SetCurrentDirectory on MSDN: https://docs.microsoft.com/en-us/windows/win32/api/winbase/nf-winbase-setcurrentdirectory
+BOOL WINAPI Detoured_SetCurrentDirectoryA(
+    __in  LPCSTR lpPathName
+    );
+
 // See DecryptFile on MSDN: http://msdn.microsoft.com/en-us/library/windows/desktop/aa363903(v=vs.85).aspx
 BOOL WINAPI Detoured_DecryptFileW(
     __in        LPCWSTR lpFileName,
@@ -6,6 +6,7 @@ using namespace std;
 #include "DetouredProcessInjector.h"
 #include "DetoursHelpers.h"
 #include "DeviceMap.h"
+#include <algorithm>
 #include <iomanip>
 #include "buildXL_mem.h"
 
@@ -43,9 +44,18 @@ void DetouredProcessInjector::Clear()
     _reportPipe.reset();
     _payload.reset(nullptr);
     _payloadSize = 0;
+    if (_payloadView != nullptr)
+    {
+        UnmapViewOfFile(_payloadView);
+        _payloadView = nullptr;
+    }
+
+    _payloadSection.reset();
     _otherHandles.clear();
     _dllX64.clear();
     _dllX86.clear();
+    _payloadWrapper.reset(nullptr);
+    _payloadWrapperSize = 0;
 }
 
 // Initialize object with the payload wrapper that has the following data:
@@ -54,6 +64,9 @@ void DetouredProcessInjector::Clear()
 // uint64_t handles - handles passed from the parent.
 //                    There must be c_minHandleCount handles there.
 // payload
+// When the handle count has c_payloadInSectionFlag, the payload is replaced by:
+// uint64_t section - a handle to the read-only section holding the payload
+// uint32_t payloadSize - the size of the payload at the start of the section
 bool DetouredProcessInjector::Init(LPCBYTE payloadWrapper, std::wstring& errorMessage, _Out_ LPCBYTE* payload, _Out_ uint32_t& payloadSize)
 {
     errorMessage = L"";
@@ -92,7 +105,8 @@ bool DetouredProcessInjector::Init(LPCBYTE payloadWrapper, std::wstring& errorMe
     size -= 2 * sizeof(uint32_t);
 
     // Copy known handles
-    uint32_t handleCount = *data;
+    uint32_t handleCount = *data & ~c_payloadInSectionFlag;
+    bool payloadInSection = (*data & c_payloadInSectionFlag) != 0;
     data++;
 
     if (!(handleCount >= c_minHandleCount && size >= handleCount * sizeof(uint64_t)))
@@ -129,8 +143,34 @@ bool DetouredProcessInjector::Init(LPCBYTE payloadWrapper, std::wstring& errorMe
         }
     }
 
+    if (payloadInSection)
+    {
+        if (size != sizeof(uint64_t) + sizeof(uint32_t))
+        {
+            errorMessage = L"Payload has incorrect section reference size: ";
+            errorMessage += std::to_wstring(size);
+
+            return false;
+        }
+
+        // Map the payload in place: nothing to copy, and the process can pass the same section to its own children
+        _payloadSection.reset(Uint64ToHandle(*handles));
+        _payloadSize = *reinterpret_cast<const uint32_t *>(handles + 1);
+        _payloadView = reinterpret_cast<LPCBYTE>(MapViewOfFile(_payloadSection.get(), FILE_MAP_READ, 0, 0, _payloadSize));
+        if (_payloadView == nullptr)
+        {
+            errorMessage = L"Failed to map the payload section (error code: ";
+            errorMessage += std::to_wstring(GetLastError());
+            errorMessage += L")";
+
+            return false;
+        }
+
+        *payload = _payloadView;
+        payloadSize = _payloadSize;
+    }
     // Copy payload immediately only if this process is not WOW64 process.
-    if (!s_isWow64Process)
+    else if (!s_isWow64Process)
     {
         _payloadSize = size;
 
@@ -194,7 +234,7 @@ void DetouredProcessInjector::Init(
 
 void DetouredProcessInjector::SetPayload(LPCBYTE payload, uint32_t payloadSize)
 {
-    if (_payload.get() != nullptr)
+    if (_payload.get() != nullptr || _payloadView != nullptr)
     {
         // Payload can be set only once.
         return;
@@ -234,11 +274,12 @@ void DetouredProcessInjector::SetHandles(uint32_t otherHandleCount, PHANDLE othe
     }
 }
 
-DWORD DetouredProcessInjector::LocalInjectProcess(HANDLE processHandle, bool inheritedHandles)
+DWORD DetouredProcessInjector::LocalInjectProcess(HANDLE processHandle, bool inheritedHandles, ProcessDetouringTimings* timings)
 {
     LockGuard lock(_injectorLock);
 
     // Install detours
+    uint64_t phaseStart = ProcessDetouringTimings::Now();
     LPCSTR dll = isWow64Process(processHandle) ? _dllX86.data() : _dllX64.data();
     if (!DetourUpdateProcessWithDll(processHandle, &dll, 1))
     {
@@ -248,6 +289,12 @@ DWORD DetouredProcessInjector::LocalInjectProcess(HANDLE processHandle, bool inh
         return err;
     }
 
+    if (timings != nullptr)
+    {
+        timings->DllInjectionMicroseconds = ProcessDetouringTimings::MicrosecondsSince(phaseStart);
+        phaseStart = ProcessDetouringTimings::Now();
+    }
+
     if (_mapDirectory.isValid() && !ApplyMapping(processHandle, _mapDirectory.get()))
     {
         DWORD err = GetLastError();
@@ -258,14 +305,29 @@ DWORD DetouredProcessInjector::LocalInjectProcess(HANDLE processHandle, bool inh
         return err;
     }
 
-    // Allocate space for the payload wrapper.
-    uint32_t size = WrapperSize();
-    std::unique_ptr<unsigned char[]> payloadWrapper = make_unique<unsigned char[]>(size);
+    if (timings != nullptr)
+    {
+        timings->DriveMappingMicroseconds = ProcessDetouringTimings::MicrosecondsSince(phaseStart);
+        phaseStart = ProcessDetouringTimings::Now();
+    }
+
+    // A payload that came from a section is always passed on the same way, there is no copy of it to inject
+    bool payloadInSection = _payloadView != nullptr || (_sharePayloadThroughSection && _payloadSize > 0 && EnsurePayloadSection());
+
+    // The wrapper of the previous injection is reused as long as its layout is the same: the handles can change, but not their count
+    uint32_t size = WrapperSize(payloadInSection);
+    bool reuseWrapper = _payloadWrapper != nullptr && _payloadWrapperSize == size && _payloadWrapperInSection == payloadInSection;
+    if (!reuseWrapper)
+    {
+        _payloadWrapper = make_unique<unsigned char[]>(size);
+        _payloadWrapperSize = size;
+        _payloadWrapperInSection = payloadInSection;
+    }
 
     // Write sizes
-    uint32_t *sizes = reinterpret_cast<uint32_t *>(payloadWrapper.get());
+    uint32_t *sizes = reinterpret_cast<uint32_t *>(_payloadWrapper.get());
     *sizes++ = size;
-    *sizes++ = static_cast<uint32_t>(c_minHandleCount + _otherHandles.size());
+    *sizes++ = static_cast<uint32_t>(c_minHandleCount + _otherHandles.size()) | (payloadInSection ? c_payloadInSectionFlag : 0);
 
     // Write handles
     uint64_t *handles = reinterpret_cast<uint64_t *>(sizes);
@@ -281,24 +343,177 @@ DWORD DetouredProcessInjector::LocalInjectProcess(HANDLE processHandle, bool inh
         }
     }
 
-    // Copy payload
-    errno_t memcpyerror = memcpy_s(handles, _payloadSize, _payload.get(), _payloadSize);
-    if (memcpyerror != 0)
+    if (payloadInSection)
+    {
+        // Reference the payload section
+        uint64_t section = inheritedHandles ? HandleToUint64(_payloadSection.get()) : DuplicateHandleToUint64(processHandle, _payloadSection.get());
+        if (section == HandleToUint64(INVALID_HANDLE_VALUE))
+        {
+            DWORD err = GetLastError();
+            Dbg(L"DetouredProcessInjector::LocalInjectProcess: Failed to duplicate the payload section handle (error code: 0x%08x)", (int)err);
+            return err;
+        }
+
+        *handles++ = section;
+        *reinterpret_cast<uint32_t *>(handles) = _payloadSize;
+    }
+    else if (!reuseWrapper)
     {
-        Dbg(L"DetouredProcessInjector::LocalInjectProcess: Failed to do memcpy (error code: 0x%08x)", (int)memcpyerror);
-        return ERROR_PARTIAL_COPY;
+        // Copy payload
+        errno_t memcpyerror = memcpy_s(handles, _payloadSize, _payload.get(), _payloadSize);
+        if (memcpyerror != 0)
+        {
+            Dbg(L"DetouredProcessInjector::LocalInjectProcess: Failed to do memcpy (error code: 0x%08x)", (int)memcpyerror);
+            _payloadWrapper.reset(nullptr);
+            return ERROR_PARTIAL_COPY;
+        }
     }
 
-    if (!DetourCopyPayloadToProcess(processHandle, _payloadGuid, payloadWrapper.get(), size))
+    if (!DetourCopyPayloadToProcess(processHandle, _payloadGuid, _payloadWrapper.get(), size))
     {
         DWORD err = GetLastError();
         Dbg(L"DetouredProcessInjector::LocalInjectProcess: Failed to copy payload to process (error code: 0x%08x)", (int)err);
         return err;
     }
 
+    if (timings != nullptr)
+    {
+        timings->PayloadCopyMicroseconds = ProcessDetouringTimings::MicrosecondsSince(phaseStart);
+    }
+
     return ERROR_SUCCESS;
 }
 
+bool DetouredProcessInjector::EnsurePayloadSection()
+{
+    if (_payloadSection.isValid())
+    {
+        return true;
+    }
+
+    SECURITY_ATTRIBUTES attributes = { sizeof(SECURITY_ATTRIBUTES), nullptr, TRUE };
+    unique_handle<nullptr> section(CreateFileMappingW(INVALID_HANDLE_VALUE, &attributes, PAGE_READWRITE, 0, _payloadSize, nullptr));
+    if (!section.isValid())
+    {
+        Dbg(L"DetouredProcessInjector::EnsurePayloadSection: Failed to create the payload section, copying the payload instead (error code: 0x%08x)", (int)GetLastError());
+        return false;
+    }
+
+    void* view = MapViewOfFile(section.get(), FILE_MAP_WRITE, 0, 0, _payloadSize);
+    if (view == nullptr)
+    {
+        Dbg(L"DetouredProcessInjector::EnsurePayloadSection: Failed to map the payload section, copying the payload instead (error code: 0x%08x)", (int)GetLastError());
+        return false;
+    }
+
+    memcpy_s(view, _payloadSize, _payload.get(), _payloadSize);
+    UnmapViewOfFile(view);
+
+    // Only hand out a read-only handle, so no process of the tree can alter the payload of the others
+    HANDLE readOnlySection;
+    if (!DuplicateHandle(GetCurrentProcess(), section.get(), GetCurrentProcess(), &readOnlySection, FILE_MAP_READ, TRUE, 0))
+    {
+        Dbg(L"DetouredProcessInjector::EnsurePayloadSection: Failed to create a read-only payload section handle, copying the payload instead (error code: 0x%08x)", (int)GetLastError());
+        return false;
+    }
+
+    _payloadSection.reset(readOnlySection);
+    return true;
+}
+
+// A pipelined remote injection waiting for its completion
+struct PendingRemoteInjection
+{
+    uint64_t RequestId;
+    DWORD Error;
+    bool Completed;
+    PendingRemoteInjection* Next;
+};
+
+// The reply pipe of this process, created along with the thread reading it when the first pipelined remote injection is requested.
+// The completion thread hands every completion it reads over to the thread waiting for it, through s_remoteInjectionCompleted.
+static INIT_ONCE s_remoteInjectionChannelInit = INIT_ONCE_STATIC_INIT;
+static HANDLE s_remoteInjectionReplyRead = INVALID_HANDLE_VALUE;
+static HANDLE s_remoteInjectionReplyWrite = INVALID_HANDLE_VALUE;
+static SRWLOCK s_remoteInjectionLock = SRWLOCK_INIT;
+static CONDITION_VARIABLE s_remoteInjectionCompleted = CONDITION_VARIABLE_INIT;
+static PendingRemoteInjection* s_pendingRemoteInjections = nullptr;
+static bool s_remoteInjectionChannelBroken = false;
+static volatile LONG64 s_lastRemoteInjectionRequestId = 0;
+
+static bool ReadRemoteInjectionCompletion(RemoteInjectionCompletion& completion)
+{
+    BYTE* buffer = reinterpret_cast<BYTE*>(&completion);
+    DWORD totalRead = 0;
+    while (totalRead < sizeof(RemoteInjectionCompletion))
+    {
+        DWORD bytesRead;
+        if (!ReadFile(s_remoteInjectionReplyRead, buffer + totalRead, sizeof(RemoteInjectionCompletion) - totalRead, &bytesRead, nullptr) || bytesRead == 0)
+        {
+            return false;
+        }
+
+        totalRead += bytesRead;
+    }
+
+    return true;
+}
+
+static DWORD WINAPI RemoteInjectionCompletionThreadProc(LPVOID)
+{
+    RemoteInjectionCompletion completion;
+    while (ReadRemoteInjectionCompletion(completion))
+    {
+        AcquireSRWLockExclusive(&s_remoteInjectionLock);
+        for (PendingRemoteInjection* pending = s_pendingRemoteInjections; pending != nullptr; pending = pending->Next)
+        {
+            if (pending->RequestId == completion.RequestId)
+            {
+                pending->Error = completion.Error;
+                pending->Completed = true;
+                break;
+            }
+        }
+
+        ReleaseSRWLockExclusive(&s_remoteInjectionLock);
+        WakeAllConditionVariable(&s_remoteInjectionCompleted);
+    }
+
+    // This process holds the write end, so this only happens if the pipe is broken: the waiting threads must not wait for their timeout
+    Dbg(L"RemoteInjectionCompletionThreadProc: Failed to read from the reply pipe (error code: 0x%08x)", (int)GetLastError());
+    AcquireSRWLockExclusive(&s_remoteInjectionLock);
+    s_remoteInjectionChannelBroken = true;
+    ReleaseSRWLockExclusive(&s_remoteInjectionLock);
+    WakeAllConditionVariable(&s_remoteInjectionCompleted);
+    return 0;
+}
+
+static BOOL CALLBACK InitializeRemoteInjectionChannel(PINIT_ONCE, PVOID, PVOID*)
+{
+    // Not inheritable: the injector of the top of the process tree duplicates the write end out of this process
+    if (!CreatePipe(&s_remoteInjectionReplyRead, &s_remoteInjectionReplyWrite, nullptr, 0))
+    {
+        Dbg(L"InitializeRemoteInjectionChannel: Failed to create the reply pipe (error code: 0x%08x), injections are requested with events", (int)GetLastError());
+        s_remoteInjectionReplyRead = INVALID_HANDLE_VALUE;
+        s_remoteInjectionReplyWrite = INVALID_HANDLE_VALUE;
+        return TRUE;
+    }
+
+    HANDLE thread = CreateThread(nullptr, 0, RemoteInjectionCompletionThreadProc, nullptr, 0, nullptr);
+    if (thread == nullptr)
+    {
+        Dbg(L"InitializeRemoteInjectionChannel: Failed to create the completion thread (error code: 0x%08x), injections are requested with events", (int)GetLastError());
+        CloseHandle(s_remoteInjectionReplyRead);
+        CloseHandle(s_remoteInjectionReplyWrite);
+        s_remoteInjectionReplyRead = INVALID_HANDLE_VALUE;
+        s_remoteInjectionReplyWrite = INVALID_HANDLE_VALUE;
+        return TRUE;
+    }
+
+    CloseHandle(thread);
+    return TRUE;
+}
+
 DWORD DetouredProcessInjector::RemoteInjectProcess(HANDLE processHandle, bool inheritedHandles) const
 {
     DWORD processId = GetProcessId(processHandle);
@@ -316,6 +531,15 @@ DWORD DetouredProcessInjector::RemoteInjectProcess(HANDLE processHandle, bool in
         return ERROR_INVALID_FUNCTION;
     }
 
+    if (EnableDetoursPipelinedRemoteInjection())
+    {
+        InitOnceExecuteOnce(&s_remoteInjectionChannelInit, InitializeRemoteInjectionChannel, nullptr, nullptr);
+        if (s_remoteInjectionReplyWrite != INVALID_HANDLE_VALUE)
+        {
+            return RemoteInjectProcessPipelined(processId, inheritedHandles);
+        }
+    }
+
     LARGE_INTEGER counter = { { 0 } };
     long long unsigned timeValue = QueryPerformanceCounter(&counter) ? counter.QuadPart : GetTickCount64();
 
@@ -420,6 +644,131 @@ DWORD DetouredProcessInjector::RemoteInjectProcess(HANDLE processHandle, bool in
     return result;
 }
 
+DWORD DetouredProcessInjector::RemoteInjectProcessPipelined(DWORD processId, bool inheritedHandles) const
+{
+    PendingRemoteInjection pending = {};
+    pending.RequestId = static_cast<uint64_t>(InterlockedIncrement64(&s_lastRemoteInjectionRequestId));
+
+    // The request (P,<request id>,<requester process id>,<reply pipe>,<True/False>,<process id>\r\n) is a line like the ones
+    // of RemoteInjectProcess, which tells it apart by its field count: 1+1+16+1+8+1+16+1+5+1+8+2 = 61 characters, 62 with the terminating null.
+    wchar_t request[62];
+    int charsWritten = swprintf_s(request, 62, L"P,%016llx,%08lx,%016llx,%s,%08lx\r\n",
+        (long long unsigned)pending.RequestId, GetCurrentProcessId(), (long long unsigned)HandleToUint64(s_remoteInjectionReplyWrite),
+        inheritedHandles ? L"True" : L"False", processId);
+
+    assert(charsWritten != -1);
+
+    // Registered before the request is sent, since its completion may be read before WriteFile returns
+    AcquireSRWLockExclusive(&s_remoteInjectionLock);
+    pending.Next = s_pendingRemoteInjections;
+    s_pendingRemoteInjections = &pending;
+    ReleaseSRWLockExclusive(&s_remoteInjectionLock);
+
+    OVERLAPPED overlapped;
+    ZeroMemory(&overlapped, sizeof(OVERLAPPED));
+    overlapped.Offset = 0xFFFFFFFF;
+    overlapped.OffsetHigh = 0xFFFFFFFF;
+    DWORD bytesWritten;
+
+    if (!WriteFile(_remoteInjectorPipe.get(), request, charsWritten * sizeof(wchar_t), &bytesWritten, &overlapped))
+    {
+        DWORD error = GetLastError();
+        std::wstring errorMsg = DebugStringFormat(L"DetouredProcessInjector::RemoteInjectProcessPipelined: Failed to write to pipe for requesting process injection for process id %d (error code: 0x%08x)", (int)processId, (int)error);
+        Dbg(errorMsg.c_str());
+        HandleDetoursInjectionAndCommunicationErrors(DETOURS_PIPE_WRITE_ERROR_3, errorMsg.c_str(), DETOURS_WINDOWS_LOG_MESSAGE_3);
+    }
+
+    // If for some reason there is no timeout passed using the FileAccessManifest, wait for 10 min.
+    ULONGLONG timeoutMs = (g_injectionTimeoutInMinutes < 10 ? 10 : g_injectionTimeoutInMinutes) * 60000ULL;
+    ULONGLONG startWait = GetTickCount64();
+
+    AcquireSRWLockExclusive(&s_remoteInjectionLock);
+    while (!pending.Completed && !s_remoteInjectionChannelBroken)
+    {
+        ULONGLONG waited = GetTickCount64() - startWait;
+        if (waited >= timeoutMs)
+        {
+            break;
+        }
+
+        SleepConditionVariableSRW(&s_remoteInjectionCompleted, &s_remoteInjectionLock, static_cast<DWORD>(timeoutMs - waited), 0);
+    }
+
+    PendingRemoteInjection** link = &s_pendingRemoteInjections;
+    while (*link != &pending)
+    {
+        link = &(*link)->Next;
+    }
+
+    *link = pending.Next;
+    ReleaseSRWLockExclusive(&s_remoteInjectionLock);
+
+    if (!pending.Completed)
+    {
+        if (s_remoteInjectionChannelBroken)
+        {
+            Dbg(L"DetouredProcessInjector::RemoteInjectProcessPipelined: The reply pipe broke while requesting process injection for process id %d", (int)processId);
+            return ERROR_BROKEN_PIPE;
+        }
+
+        Dbg(L"DetouredProcessInjector::RemoteInjectProcessPipelined: Timeout requesting process injection for process id %d", (int)processId);
+        return WAIT_TIMEOUT;
+    }
+
+    if (pending.Error != ERROR_SUCCESS)
+    {
+        Dbg(L"DetouredProcessInjector::RemoteInjectProcessPipelined: Remote injection failed for process id %d, error: 0x%08X", (int)processId, (int)pending.Error);
+        return ERROR_INVALID_FUNCTION;
+    }
+
+    return ERROR_SUCCESS;
+}
+
+DWORD DetouredProcessInjector::CompleteRemoteInjection(DWORD requesterProcessId, uint64_t replyPipe, uint64_t requestId, DWORD error)
+{
+    RemoteInjectionCompletion completion = { requestId, error, 0 };
+    LockGuard lock(_replyPipesLock);
+
+    // A cached pipe that can't be written to belongs to a requester that exited, whose process id may have been reused since: it is duplicated again
+    DWORD lastError = ERROR_SUCCESS;
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        auto cached = std::find_if(_replyPipes.begin(), _replyPipes.end(), [&](const RemoteInjectionReplyPipe& pipe)
+        {
+            return pipe.RequesterProcessId == requesterProcessId && pipe.ReplyPipe == replyPipe;
+        });
+
+        if (cached == _replyPipes.end())
+        {
+            unique_handle<nullptr> requester(OpenProcess(PROCESS_DUP_HANDLE, FALSE, requesterProcessId));
+            HANDLE handle;
+            if (!requester.isValid()
+                || !DuplicateHandle(requester.get(), Uint64ToHandle(replyPipe), GetCurrentProcess(), &handle, 0, FALSE, DUPLICATE_SAME_ACCESS))
+            {
+                lastError = GetLastError();
+                Dbg(L"DetouredProcessInjector::CompleteRemoteInjection: Failed to duplicate the reply pipe of process id %d (error code: 0x%08x)", (int)requesterProcessId, (int)lastError);
+                return lastError;
+            }
+
+            _replyPipes.push_back({ requesterProcessId, replyPipe, handle });
+            cached = _replyPipes.end() - 1;
+        }
+
+        DWORD bytesWritten;
+        if (WriteFile(cached->Handle, &completion, sizeof(completion), &bytesWritten, nullptr) && bytesWritten == sizeof(completion))
+        {
+            return ERROR_SUCCESS;
+        }
+
+        lastError = GetLastError();
+        CloseHandle(cached->Handle);
+        _replyPipes.erase(cached);
+    }
+
+    Dbg(L"DetouredProcessInjector::CompleteRemoteInjection: Failed to write to the reply pipe of process id %d (error code: 0x%08x)", (int)requesterProcessId, (int)lastError);
+    return lastError;
+}
+
 DetouredProcessInjector *WINAPI DetouredProcessInjector_Create(const GUID &payloadGuid,
     HANDLE remoteInterjectorPipe, HANDLE reportPipe,
     LPCSTR dllX86, LPCSTR dllX64,
@@ -465,3 +814,14 @@ DWORD WINAPI DetouredProcessInjector_Inject(DetouredProcessInjector *injector, D
 
     return injector->LocalInjectProcess(processHandle.get(), false);
 }
+
+DWORD WINAPI DetouredProcessInjector_CompleteRemoteInjection(DetouredProcessInjector *injector, DWORD requesterProcessId, uint64_t replyPipe, uint64_t requestId, DWORD error)
+{
+    if (injector == nullptr || !injector->IsValid())
+    {
+        Dbg(L"DetouredProcessInjector_CompleteRemoteInjection: Injector is not valid");
+        return ERROR_INVALID_FUNCTION;
+    }
+
+    return injector->CompleteRemoteInjection(requesterProcessId, replyPipe, requestId, error);
+}
@@ -9,6 +9,42 @@ using std::unique_ptr;
 using std::vector;
 using std::string;
 
+// Durations, in microseconds, of the phases of creating a detoured process (see ReportProcessDetouringStatus)
+struct ProcessDetouringTimings
+{
+    uint64_t CreateProcessMicroseconds = 0;
+    // The whole injection, including retries and the round trip of a remote injection
+    uint64_t InjectionMicroseconds = 0;
+    // The phases of a local injection
+    uint64_t DllInjectionMicroseconds = 0;
+    uint64_t DriveMappingMicroseconds = 0;
+    uint64_t PayloadCopyMicroseconds = 0;
+
+    static inline uint64_t Now()
+    {
+        LARGE_INTEGER counter;
+        QueryPerformanceCounter(&counter);
+        return static_cast<uint64_t>(counter.QuadPart);
+    }
+
+    static inline uint64_t MicrosecondsSince(uint64_t start)
+    {
+        static const uint64_t s_frequency = []() { LARGE_INTEGER frequency; QueryPerformanceFrequency(&frequency); return static_cast<uint64_t>(frequency.QuadPart); }();
+        return (Now() - start) * 1000000 / s_frequency;
+    }
+};
+
+// Completion of a pipelined remote injection (see RemoteInjectProcessPipelined), written by the injector of the
+// top of the process tree to the reply pipe of the process that requested it
+struct RemoteInjectionCompletion
+{
+    uint64_t RequestId;
+    uint32_t Error;
+    uint32_t Reserved;
+};
+
+static_assert(sizeof(RemoteInjectionCompletion) == 16, "Completions are read from the reply pipe whole");
+
 // This class does drive mapping and injection of payload and DLL into
 // a process. It may do it directly or remotely. The remote injection
 // is required when a WOW64 process creates a child. Exact conditions
@@ -34,12 +70,21 @@ private:
 
     static const uint32_t c_buildxlInjectorTag = 0xD031B09E;      // DOMIno BONE
 
+    // Set in the handle count of a payload wrapper whose payload is in a section (see LocalInjectProcess)
+    static const uint32_t c_payloadInSectionFlag = 0x80000000;
+
     // We own these handles
     unique_handle<INVALID_HANDLE_VALUE> _mapDirectory;
     unique_handle<INVALID_HANDLE_VALUE> _remoteInjectorPipe;
     unique_handle<INVALID_HANDLE_VALUE> _reportPipe;
     unique_ptr<unsigned char[]> _payload = nullptr;
     uint32_t _payloadSize = 0;
+
+    // Read-only section holding the payload, shared by all the processes of the tree that got the payload from it.
+    // When the payload came from the section, _payloadView is where it is mapped and _payload is empty.
+    unique_handle<nullptr> _payloadSection;
+    LPCBYTE _payloadView = nullptr;
+    bool _sharePayloadThroughSection = false;
     vector<HANDLE> _otherHandles;
     string _dllX86;
     string _dllX64;
@@ -47,8 +92,26 @@ private:
     bool _alwaysRemoteInjectFromWow64Process = false;
     bool _initialized = false;
 
+    // The payload wrapper of the previous local injection. Only the handles in it differ from one child process to the next,
+    // so the payload is copied into it once instead of once per child process.
+    unique_ptr<unsigned char[]> _payloadWrapper = nullptr;
+    uint32_t _payloadWrapperSize = 0;
+    bool _payloadWrapperInSection = false;
+
     CRITICAL_SECTION _injectorLock;
 
+    // The reply pipes of the processes that requested pipelined remote injections, duplicated into this process
+    // the first time each of them is completed (see CompleteRemoteInjection)
+    struct RemoteInjectionReplyPipe
+    {
+        DWORD RequesterProcessId;
+        uint64_t ReplyPipe;
+        HANDLE Handle;
+    };
+
+    vector<RemoteInjectionReplyPipe> _replyPipes;
+    CRITICAL_SECTION _replyPipesLock;
+
     class LockGuard
     {
     private:
@@ -104,16 +167,41 @@ private:
 #pragma warning( pop )
 
     // Given all data, compute the size of the wrapped payload
-    uint32_t inline WrapperSize() const
+    uint32_t inline WrapperSize(bool payloadInSection) const
     {
-        // The data must contain the size, handle count, the handles, and the payload
-        return static_cast<uint32_t>(2 * sizeof(uint32_t) + (c_minHandleCount + _otherHandles.size()) * sizeof(uint64_t) + _payloadSize);
+        // The data must contain the size, handle count, the handles, and the payload (or the section holding it and its size)
+        return static_cast<uint32_t>(2 * sizeof(uint32_t) + (c_minHandleCount + _otherHandles.size()) * sizeof(uint64_t)
+            + (payloadInSection ? sizeof(uint64_t) + sizeof(uint32_t) : _payloadSize));
+    }
+
+    // Creates the section holding the payload, if it doesn't exist yet. Returns whether the section can be used.
+    bool EnsurePayloadSection();
+
+    HANDLE OtherHandle(size_t index) const { return index < _otherHandles.size() ? _otherHandles[index] : INVALID_HANDLE_VALUE; }
+
+    // Sets the other handle at the given index, unless it is set already (e.g. by the parent process)
+    void SetOtherHandle(size_t index, HANDLE handle)
+    {
+        LockGuard lock(_injectorLock);
+        if (_otherHandles.size() <= index)
+        {
+            _otherHandles.resize(index + 1, INVALID_HANDLE_VALUE);
+        }
+
+        if (_otherHandles[index] == INVALID_HANDLE_VALUE || _otherHandles[index] == nullptr)
+        {
+            _otherHandles[index] = handle;
+        }
     }
 
 
     // Clear the object (free memory, etc.)
     void Clear();
 
+    // Asks for the remote injection with a request that is completed through the reply pipe of this process,
+    // so that the requests of several threads are in flight at once and no event is created for each of them
+    DWORD RemoteInjectProcessPipelined(DWORD processId, bool inheritedHandles) const;
+
 public:
     // Check if the process is wow64
     static bool isWow64Process(HANDLE processHandle);
@@ -122,10 +210,22 @@ public:
     DetouredProcessInjector(const GUID &payloadGuid) : _tag(c_buildxlInjectorTag), _payloadGuid(payloadGuid)
     {
         InitializeCriticalSection(&_injectorLock);
+        InitializeCriticalSection(&_replyPipesLock);
     }
 
     ~DetouredProcessInjector()
     {
+        if (_payloadView != nullptr)
+        {
+            UnmapViewOfFile(_payloadView);
+        }
+
+        for (const RemoteInjectionReplyPipe& replyPipe : _replyPipes)
+        {
+            CloseHandle(replyPipe.Handle);
+        }
+
+        DeleteCriticalSection(&_replyPipesLock);
         DeleteCriticalSection(&_injectorLock);
     }
 
@@ -149,6 +249,12 @@ public:
         _alwaysRemoteInjectFromWow64Process = alwaysRemoteInjectFromWow64Process;
     }
 
+    // When set, the payload is placed once in a read-only section that child processes map, instead of being copied into each of them
+    void inline SetSharePayloadThroughSection(bool sharePayloadThroughSection)
+    {
+        _sharePayloadThroughSection = sharePayloadThroughSection;
+    }
+
     // Set "other" handles. These are duplicated if needed.
     void SetHandles(uint32_t otherHandleCount, PHANDLE otherHandles);
 
@@ -164,29 +270,42 @@ public:
     HANDLE MapDirectory() const { return _mapDirectory.get(); }
     HANDLE RemoteInjectorPipe() const { return _remoteInjectorPipe.get(); }
     HANDLE ReportPipe() const { return _reportPipe.get(); }
-    LPCBYTE Payload() const { return _payload.get(); }
+    LPCBYTE Payload() const { return _payloadView != nullptr ? _payloadView : _payload.get(); }
     uint32_t PayloadSize() const { return _payloadSize; }
     uint32_t OtherHandleCount() const { return static_cast<uint32_t>(_otherHandles.size()); }
     const HANDLE *OtherHandles() const { return _otherHandles.data(); }
     bool IsInitialized() { return _initialized; }
 
+    // The sections of the caches shared by a process tree are passed down as the other handles, each one at its own index.
+    // Indices without a section hold INVALID_HANDLE_VALUE.
+    //   0 - the shared reparse point cache (see SharedReparsePointCache.h)
+    //   1 - the shared plugin decision cache (see SubstituteProcessExecution.cpp)
+    HANDLE SharedReparsePointCacheSection() const { return OtherHandle(0); }
+    void SetSharedReparsePointCacheSection(HANDLE section) { SetOtherHandle(0, section); }
+    HANDLE SharedPluginDecisionCacheSection() const { return OtherHandle(1); }
+    void SetSharedPluginDecisionCacheSection(HANDLE section) { SetOtherHandle(1, section); }
+
     // This method will inject the data stored in the object into the specified process.
     //   processHandle - the process to inject
     //   inheritedHandles - when true, all handles are inherited.
     //                      When false, none or only some handles
     //                      are inherited. The handles stored in
     //                      the object need to be duplicated.
-    DWORD LocalInjectProcess(HANDLE processHandle, bool inheritedHandles);
+    //   timings - when not null, receives the durations of the injection phases
+    DWORD LocalInjectProcess(HANDLE processHandle, bool inheritedHandles, ProcessDetouringTimings* timings = nullptr);
     // This method will ask for the remote injection
     DWORD RemoteInjectProcess(HANDLE processHandle, bool inheritedHandles) const;
 
+    // Writes the completion of the pipelined remote injection 'requestId' to the reply pipe 'replyPipe' of the process that requested it
+    DWORD CompleteRemoteInjection(DWORD requesterProcessId, uint64_t replyPipe, uint64_t requestId, DWORD error);
+
     // Do either local or remote injection, depending on bitness of the
     // injector and injectee processes.
-    DWORD InjectProcess(HANDLE processHandle, bool inheritedHandles)
+    DWORD InjectProcess(HANDLE processHandle, bool inheritedHandles, ProcessDetouringTimings* timings = nullptr)
     {
         return NeedRemoteInjection(processHandle)
             ? RemoteInjectProcess(processHandle, inheritedHandles)
-            : LocalInjectProcess(processHandle, inheritedHandles);
+            : LocalInjectProcess(processHandle, inheritedHandles, timings);
     }
 
     // No default constructor, no copies
@@ -13,10 +13,13 @@
 #include "DeviceMap.h"
 #include "CanonicalizedPath.h"
 #include "PolicyResult.h"
-#include <list>
+#include "PathTranslator.h"
+#include "ResolvedPathCache.h"
 #include <string>
 #include <stdio.h>
 #include <stack>
+#include <mutex>
+#include <unordered_map>
 
 using std::unique_ptr;
 using std::basic_string;
@@ -35,7 +38,7 @@ void TranslateFilePath(_In_ const std::wstring& inFileName, _Out_ std::wstring&
 {
     outFileName.assign(inFileName);
 
-    if (g_pManifestTranslatePathTuples->empty())
+    if (!EnsurePathTranslationsDecoded())
     {
         // Nothing to translate.
         return;
@@ -47,108 +50,40 @@ void TranslateFilePath(_In_ const std::wstring& inFileName, _Out_ std::wstring&
         return;
     }
 
+    // The translation of a path never changes during the lifetime of the process. Debug translations are never memoized, so they get logged.
+    PathTranslator* translator = PathTranslator::GetInstance();
+    if (!debug && translator->TryGetCachedTranslation(inFileName, outFileName))
+    {
+        return;
+    }
+
     CanonicalizedPath canonicalizedPath = CanonicalizedPath::Canonicalize(inFileName.c_str());
-    std::wstring tempStr(canonicalizedPath.GetPathString());
 
     // If the canonicalized string is null or empty, just return. No need to do anything.
-    if (tempStr.empty() || tempStr.c_str() == nullptr)
+    if (canonicalizedPath.IsNull() || canonicalizedPath.Length() == 0)
     {
         return;
     }
 
+    PCPathChar canonicalizedPathString = canonicalizedPath.GetPathString();
+
     const std::wstring prefix(L"\\??\\");
-    bool hasPrefix = !tempStr.compare(0, prefix.size(), prefix);
+    bool hasPrefix = !wcsncmp(canonicalizedPathString, prefix.c_str(), prefix.size());
 
     const std::wstring prefixNt(L"\\\\?\\");
-    bool hasPrefixNt = !tempStr.compare(0, prefixNt.size(), prefixNt);
-
-    tempStr.assign(canonicalizedPath.GetPathStringWithoutTypePrefix());
+    bool hasPrefixNt = !wcsncmp(canonicalizedPathString, prefixNt.c_str(), prefixNt.size());
 
-    bool translated = false;
-    bool needsTranslation = true;
+    std::wstring tempStr(canonicalizedPath.GetPathStringWithoutTypePrefix());
 
     if (debug)
     {
         Dbg(L"TranslateFilePath-0: initial: '%s'", tempStr.c_str());
     }
 
-    std::list<TranslatePathTuple*> manifestTranslatePathTuples(g_pManifestTranslatePathTuples->begin(), g_pManifestTranslatePathTuples->end());
-
-    while (needsTranslation)
-    {
-        needsTranslation = false;
-        size_t longestPath = 0;
-        std::list<TranslatePathTuple*>::iterator replacementIt;
-
-        std::wstring lowCaseFinalPath(tempStr);
-        for (basic_string<wchar_t>::iterator p = lowCaseFinalPath.begin();
-            p != lowCaseFinalPath.end(); ++p) {
-            *p = towlower(*p);
-        }
-
-        // Find the longest path that can be used for translation from the g_pManifestTranslatePathTuples list.
-        // Note: The g_pManifestTranslatePathTuples always comes canonicalized from the managed code.
-        for (std::list<TranslatePathTuple*>::iterator it = manifestTranslatePathTuples.begin(); it != manifestTranslatePathTuples.end(); ++it)
-        {
-            TranslatePathTuple* tpTuple = *it;
-            const std::wstring& lowCaseTargetPath = tpTuple->GetFromPath();
-            size_t targetLen = lowCaseTargetPath.length();
-            bool mayBeDirectoryPath = false;
-
-            int comp = lowCaseFinalPath.compare(0, targetLen, lowCaseTargetPath);
-            if (debug)
-            {
-                Dbg(L"TranslateFilePath-.5: comparing: '%ws' and %ws", lowCaseFinalPath.c_str(), lowCaseTargetPath.c_str());
-            }
-
-            if (comp != 0)
-            {
-                // The path to be translated can be a directory path that does not have trailing '\\'.
-
-                if (lowCaseFinalPath.back() != L'\\'
-                    && lowCaseTargetPath.back() == L'\\'
-                    && lowCaseFinalPath.length() == (targetLen - 1))
-                {
-                    std::wstring lowCaseFinalPathWithBs = lowCaseFinalPath + L'\\';
-                    comp = lowCaseFinalPathWithBs.compare(0, targetLen, lowCaseTargetPath);
-                    mayBeDirectoryPath = true;
-                }
-            }
-
-            if (comp == 0)
-            {
-                if (longestPath < targetLen)
-                {
-                    replacementIt = it;
-                    longestPath = !mayBeDirectoryPath ? targetLen : targetLen - 1;
-                    translated = true;
-                    needsTranslation = true;
-                }
-            }
-        }
-
-        // Translate using the longest translation path.
-        if (needsTranslation)
-        {
-            TranslatePathTuple* replacementTuple = *replacementIt;
-
-            std::wstring t(replacementTuple->GetToPath());
-            t.append(tempStr, longestPath);
-
-            if (debug)
-            {
-                Dbg(
-                    L"TranslateFilePath-1: from: '%s', to '%s' (used mapping: '%s' --> '%s')",
-                    tempStr.c_str(),
-                    t.c_str(),
-                    replacementTuple->GetFromPath().c_str(),
-                    replacementTuple->GetToPath().c_str());
-            }
-
-            tempStr.assign(t);
-            manifestTranslatePathTuples.erase(replacementIt);
-        }
-    }
+    // Find the longest path that can be used for translation, repeatedly (see PathTranslator).
+    // Note: The translations always come canonicalized from the managed code.
+    std::wstring translatedPath;
+    bool translated = translator->Translate(tempStr, translatedPath, debug);
 
     if (translated)
     {
@@ -168,13 +103,109 @@ void TranslateFilePath(_In_ const std::wstring& inFileName, _Out_ std::wstring&
             }
         }
 
-        outFileName.append(tempStr);
+        outFileName.append(translatedPath);
 
         if (debug)
         {
             Dbg(L"TranslateFilePath-2: final: '%s' --> '%s'", inFileName.c_str(), outFileName.c_str());
         }
     }
+
+    if (!debug)
+    {
+        translator->AddCachedTranslation(inFileName, translated, outFileName);
+    }
+}
+
+/// The special case rules that apply to this process, compiled by InitSpecialCaseRules.
+///
+/// The kind of the process and the flags of the manifest never change during its lifetime, so which rules apply is decided
+/// once, instead of on every access that takes the policy path.
+struct SpecialCaseRules
+{
+    // Extension of the files the tool running in this process may access whatever the manifest says, or nullptr
+    PCWSTR ToolExtension = nullptr;
+    bool MatchesRCTempFiles = false;
+    bool MatchesMtTempFiles = false;
+
+    bool IgnoresCodeCoverage = false;
+};
+
+static SpecialCaseRules s_specialCaseRules;
+
+FinalPathComponent::FinalPathComponent(PCWSTR path, size_t pathLength)
+{
+    size_t segmentLength[3] = {};
+    int colons = 0;
+    for (size_t i = pathLength; i > 0 && !IsDirectorySeparator(path[i - 1]); i--)
+    {
+        const PathChar c = path[i - 1];
+        Length++;
+        if (c == L':')
+        {
+            colons++;
+        }
+        else if (colons < 3)
+        {
+            segmentLength[colons]++;
+        }
+
+        if (c == L'.' && ExtensionLength == 0)
+        {
+            ExtensionLength = Length;
+        }
+    }
+
+    // Same as IsPathToNamedStream
+    IsNamedStream = colons == 2
+        ? segmentLength[1] > 0 && segmentLength[2] > 0
+        : colons == 1 && segmentLength[0] > 0 && segmentLength[1] > 0;
+}
+
+bool FinalPathComponent::HasExtension(PCWSTR path, size_t pathLength, PCWSTR extension) const
+{
+    return ExtensionLength == pathlen(extension) && HasSuffix(path, pathLength, extension);
+}
+
+void InitSpecialCaseRules()
+{
+    switch (GetProcessKind())
+    {
+    case SpecialProcessKind::Csc:
+    case SpecialProcessKind::Cvtres:
+    case SpecialProcessKind::Resonexe:
+        // Some tools emit temporary files into the same directory
+        // as the final output file.
+        s_specialCaseRules.ToolExtension = L".tmp";
+        break;
+
+    case SpecialProcessKind::RC:
+        // The native resource compiler (RC) emits temporary files into the same
+        // directory as the final output file.
+        s_specialCaseRules.MatchesRCTempFiles = true;
+        break;
+
+    case SpecialProcessKind::Mt:
+        // The Mt tool emits temporary files into the same directory as the final output file.
+        s_specialCaseRules.MatchesMtTempFiles = true;
+        break;
+
+    case SpecialProcessKind::CCCheck:
+    case SpecialProcessKind::CCDocGen:
+    case SpecialProcessKind::CCRefGen:
+    case SpecialProcessKind::CCRewrite:
+        // The cc-line of tools like to find pdb files by using the pdb path embedded in a dll/exe.
+        // If the dll/exe was built with different roots, then this results in somewhat random file accesses.
+        s_specialCaseRules.ToolExtension = L".pdb";
+        break;
+
+    case SpecialProcessKind::WinDbg:
+    case SpecialProcessKind::NotSpecial:
+        // no special treatment
+        break;
+    }
+
+    s_specialCaseRules.IgnoresCodeCoverage = IgnoreCodeCoverage();
 }
 
 bool GetSpecialCaseRulesForWindows(
@@ -185,8 +216,11 @@ bool GetSpecialCaseRulesForWindows(
     assert(absolutePath);
     assert(absolutePathLength == wcslen(absolutePath));
 
-    size_t rootLength = GetRootLength(absolutePath);
-    if (HasPrefix(absolutePath + rootLength, L"$Extend\\$Deleted"))
+    // Most paths are rooted at a drive: don't scan them just to find that out
+    size_t rootLength = absolutePathLength >= 3 && absolutePath[1] == L':' && absolutePath[2] == L'\\'
+        ? 3
+        : GetRootLength(absolutePath);
+    if (absolutePath[rootLength] == L'$' && HasPrefix(absolutePath + rootLength, L"$Extend\\$Deleted"))
     {
         // Windows can have an "unlink" behavior where deleted files are not really deleted if there's an opened handle.
         // This behavior is possible because a process can open a file with FILE_SHARE_DELETE that makes other processes able to delete it.
@@ -212,76 +246,43 @@ bool GetSpecialCaseRulesForWindows(
 // In this list the tools are the CCI based set of products, csc compiler, resource compiler, build.exe trace log, etc.
 // For such tools we allow file accesses on the special file patterns and report the access to BuildXL. BuildXL filters these
 // accesses, but makes sure that there are reports for these accesses if some of them are declared as outputs.
+// Which of the patterns apply to this process is decided once, by InitSpecialCaseRules.
 bool GetSpecialCaseRulesForSpecialTools(
     __in  PCWSTR absolutePath,
     __in  size_t absolutePathLength,
+    __in  const FinalPathComponent& finalComponent,
     __out FileAccessPolicy& policy)
 {
     assert(absolutePath);
     assert(absolutePathLength == wcslen(absolutePath));
 
-    switch (GetProcessKind())
+    bool matches = false;
+    if (s_specialCaseRules.ToolExtension != nullptr)
     {
-    case SpecialProcessKind::Csc:
-    case SpecialProcessKind::Cvtres:
-    case SpecialProcessKind::Resonexe:
-        // Some tools emit temporary files into the same directory
-        // as the final output file.
-        if (HasSuffix(absolutePath, absolutePathLength, L".tmp")) {
-#if SUPER_VERBOSE
-            Dbg(L"special case: temp file: %s", absolutePath);
-#endif // SUPER_VERBOSE
-            int intPolicy = (int)policy | (int)FileAccessPolicy_AllowAll;
-            policy = (FileAccessPolicy)intPolicy;
-            return true;
-        }
-        break;
-
-    case SpecialProcessKind::RC:
-        // The native resource compiler (RC) emits temporary files into the same
-        // directory as the final output file.
-        if (StringLooksLikeRCTempFile(absolutePath, absolutePathLength)) {
-#if SUPER_VERBOSE
-            Dbg(L"special case: temp file: %s", absolutePath);
-#endif // SUPER_VERBOSE
-            int intPolicy = (int)policy | (int)FileAccessPolicy_AllowAll;
-            policy = (FileAccessPolicy)intPolicy;
-            return true;
-        }
-        break;
-
-    case SpecialProcessKind::Mt:
-        // The Mt tool emits temporary files into the same directory as the final output file.
-        if (StringLooksLikeMtTempFile(absolutePath, absolutePathLength, L".tmp")) {
-#if SUPER_VERBOSE
-            Dbg(L"special case: temp file: %s", absolutePath);
-#endif // SUPER_VERBOSE
-            int intPolicy = (int)policy | (int)FileAccessPolicy_AllowAll;
-            policy = (FileAccessPolicy)intPolicy;
-            return true;
-        }
-        break;
+        matches = finalComponent.HasExtension(absolutePath, absolutePathLength, s_specialCaseRules.ToolExtension);
+    }
+    else if (s_specialCaseRules.MatchesRCTempFiles)
+    {
+        matches = StringLooksLikeRCTempFile(absolutePath, absolutePathLength);
+    }
+    else if (s_specialCaseRules.MatchesMtTempFiles)
+    {
+        // Same as StringLooksLikeMtTempFile(absolutePath, absolutePathLength, L".tmp"), without looking for the final separator again
+        size_t start = absolutePathLength - finalComponent.Length;
+        matches = start > 0
+            && finalComponent.HasExtension(absolutePath, absolutePathLength, L".tmp")
+            && IsPathCharEqual(absolutePath[start], 'R')
+            && IsPathCharEqual(absolutePath[start + 1], 'C')
+            && IsPathCharEqual(absolutePath[start + 2], 'X');
+    }
 
-    case SpecialProcessKind::CCCheck:
-    case SpecialProcessKind::CCDocGen:
-    case SpecialProcessKind::CCRefGen:
-    case SpecialProcessKind::CCRewrite:
-        // The cc-line of tools like to find pdb files by using the pdb path embedded in a dll/exe.
-        // If the dll/exe was built with different roots, then this results in somewhat random file accesses.
-        if (HasSuffix(absolutePath, absolutePathLength, L".pdb")) {
+    if (matches) {
 #if SUPER_VERBOSE
-            Dbg(L"special case: pdb file: %s", absolutePath);
+        Dbg(L"special case: tool file: %s", absolutePath);
 #endif // SUPER_VERBOSE
-            int intPolicy = (int)policy | (int)FileAccessPolicy_AllowAll;
-            policy = (FileAccessPolicy)intPolicy;
-            return true;
-        }
-        break;
-
-    case SpecialProcessKind::WinDbg:
-    case SpecialProcessKind::NotSpecial:
-        // no special treatment
-        break;
+        int intPolicy = (int)policy | (int)FileAccessPolicy_AllowAll;
+        policy = (FileAccessPolicy)intPolicy;
+        return true;
     }
 
     // build.exe and tracelog.dll capture dependency information in temporary files in the object root called _buildc_dep_out.<pass#>
@@ -307,16 +308,17 @@ bool GetSpecialCaseRulesForCoverageAndSpecialDevices(
     __in  PCWSTR absolutePath,
     __in  size_t absolutePathLength,
     __in  PathType pathType,
+    __in  const FinalPathComponent& finalComponent,
     __out FileAccessPolicy& policy)
 {
     assert(absolutePath);
     assert(absolutePathLength == wcslen(absolutePath));
 
     // When running test cases with Code Coverage enabled, some more files are loaded that we should ignore
-    if (IgnoreCodeCoverage()) {
-        if (HasSuffix(absolutePath, absolutePathLength, L".pdb") ||
-            HasSuffix(absolutePath, absolutePathLength, L".nls") ||
-            HasSuffix(absolutePath, absolutePathLength, L".dll"))
+    if (s_specialCaseRules.IgnoresCodeCoverage) {
+        if (finalComponent.HasExtension(absolutePath, absolutePathLength, L".pdb") ||
+            finalComponent.HasExtension(absolutePath, absolutePathLength, L".nls") ||
+            finalComponent.HasExtension(absolutePath, absolutePathLength, L".dll"))
         {
 #if SUPER_VERBOSE
             Dbg(L"Ignoring possibly code coverage related path: %s", absolutePath);
@@ -356,7 +358,7 @@ bool GetSpecialCaseRulesForCoverageAndSpecialDevices(
         }
     }
 
-    if (IsPathToNamedStream(absolutePath, absolutePathLength)) {
+    if (finalComponent.IsNamedStream) {
 #if SUPER_VERBOSE
         Dbg(L"Ignoring path to a named stream: %s", absolutePath);
 #endif // SUPER_VERBOSE
@@ -604,81 +606,263 @@ static inline void SkipWriteCharsString(const byte* payloadBytes, size_t& offset
     offset += sizeof(wchar_t) * len;
 }
 
-static SubstituteProcessExecutionPluginFunc GetSubstituteProcessExecutionPluginFunc()
+/// A section of the manifest that is decoded the first time it is needed instead of when the manifest is parsed.
+///
+/// Most processes never create a child process nor access a translated path, so they should not pay for decoding
+/// those sections at startup. ParseFileAccessManifest only skips over them, recording where their entries start.
+struct LazyManifestSection
 {
-    assert(g_SubstituteProcessExecutionPluginDllHandle != nullptr);
-
-    // Different compiler or different compiler settings can result in different function name variants.
-    //
-    // X64 version typically has:
-    //     ordinal hint RVA      name
-    //
-    //     1    0 00011069 CommandMatches = @ILT + 100(CommandMatches)
-    //
-    // X86 version can have:
-    //     ordinal hint RVA      name
-    //
-    //     1    0 00011276 _CommandMatches@24 = @ILT + 625(_CommandMatches@24)
+    LPCBYTE PayloadBytes = nullptr;
+    size_t Offset = 0;
+    uint32_t EntryCount = 0;
+    std::once_flag Decoded;
+};
+
+static LazyManifestSection s_breakawayChildProcessesSection;
+static LazyManifestSection s_translatePathsSection;
+static LazyManifestSection s_shimProcessMatchesSection;
+static LazyManifestSection s_knownReparsePointsSection;
+
+// Number of translations with both a source and a target path
+static uint32_t s_translatePathCount = 0;
+
+typedef std::unordered_multimap<std::wstring, size_t, CaseInsensitiveStringHasher, CaseInsensitiveStringComparer> BreakawayChildProcessIndex;
+
+// Indices of g_breakawayChildProcesses by image name, built when they are decoded, so the breakaway child processes of an image
+// are found with a single lookup whatever the number of breakaway child processes.
+// Created on first use: containers allocate from the private heap, which does not exist yet while static objects are constructed.
+static BreakawayChildProcessIndex& GetBreakawayChildProcessesByImageName()
+{
+    static BreakawayChildProcessIndex s_breakawayChildProcessesByImageName;
+    return s_breakawayChildProcessesByImageName;
+}
 
+static void DecodeBreakawayChildProcesses()
+{
+    LPCBYTE payloadBytes = s_breakawayChildProcessesSection.PayloadBytes;
+    size_t offset = s_breakawayChildProcessesSection.Offset;
 
-    // (1) Check for CommandMatches.
-    std::string winApiProcName("CommandMatches");
-    SubstituteProcessExecutionPluginFunc substituteProcessExecutionPluginFunc = reinterpret_cast<SubstituteProcessExecutionPluginFunc>(
-        reinterpret_cast<void*>(GetProcAddress(g_SubstituteProcessExecutionPluginDllHandle, winApiProcName.c_str())));
-    if (substituteProcessExecutionPluginFunc != nullptr)
+    for (uint32_t i = 0; i < s_breakawayChildProcessesSection.EntryCount; i++)
     {
-        return substituteProcessExecutionPluginFunc;
+        std::wstring processName(L"");
+        AppendStringFromWriteChars(payloadBytes, offset, processName);
+        if (!processName.empty())
+        {
+            std::wstring requiredCommandLineArgsSubstring(L"");
+            AppendStringFromWriteChars(payloadBytes, offset, requiredCommandLineArgsSubstring);
+            GetBreakawayChildProcessesByImageName().emplace(processName, g_breakawayChildProcesses->size());
+            g_breakawayChildProcesses->push_back(BreakawayChildProcess(processName, requiredCommandLineArgsSubstring, ParseByte(payloadBytes, offset) == 1U));
+        }
     }
+}
 
-    // (2) Check for CommandMatches@<param_size> based on platform.
-#if defined(_WIN64)
-    winApiProcName.append("@48"); // 6 64-bit parameters
-#elif defined(_WIN32)
-    winApiProcName.append("@24"); // 6 32-bit parameters
-#endif
-    substituteProcessExecutionPluginFunc = reinterpret_cast<SubstituteProcessExecutionPluginFunc>(
-        reinterpret_cast<void*>(GetProcAddress(g_SubstituteProcessExecutionPluginDllHandle, winApiProcName.c_str())));
-    if (substituteProcessExecutionPluginFunc != nullptr)
+static void DecodePathTranslations()
+{
+    LPCBYTE payloadBytes = s_translatePathsSection.PayloadBytes;
+    size_t offset = s_translatePathsSection.Offset;
+
+    for (uint32_t i = 0; i < s_translatePathsSection.EntryCount; i++)
     {
-        return substituteProcessExecutionPluginFunc;
+        std::wstring translateFrom(L"");
+        AppendStringFromWriteChars(payloadBytes, offset, translateFrom);
+
+        if (!translateFrom.empty())
+        {
+            for (basic_string<wchar_t>::iterator p = translateFrom.begin(); p != translateFrom.end(); ++p)
+            {
+                *p = towlower(*p);
+            }
+        }
+
+        std::wstring translateTo(L"");
+        AppendStringFromWriteChars(payloadBytes, offset, translateTo);
+
+        if (!translateFrom.empty() && !translateTo.empty())
+        {
+            g_pManifestTranslatePathTuples->push_back(new TranslatePathTuple(translateFrom, translateTo));
+            PathTranslator::GetInstance()->AddTranslation(translateFrom, translateTo);
+
+            if (translateFrom.back() == L'\\')
+            {
+                translateFrom.pop_back();
+            }
+
+            std::transform(translateFrom.begin(), translateFrom.end(), translateFrom.begin(), std::towupper);
+
+            if (translateTo.back() == L'\\')
+            {
+                translateTo.pop_back();
+            }
+
+            std::transform(translateTo.begin(), translateTo.end(), translateTo.begin(), std::towupper);
+
+            g_pManifestTranslatePathLookupTable->insert(translateFrom);
+            g_pManifestTranslatePathLookupTable->insert(translateTo);
+        }
     }
+}
+
+static void DecodeShimProcessMatches()
+{
+    LPCBYTE payloadBytes = s_shimProcessMatchesSection.PayloadBytes;
+    size_t offset = s_shimProcessMatchesSection.Offset;
 
-    // (3) Check for _CommandMatches@<param_size>.
-    winApiProcName.insert(0, 1, '_');
-    substituteProcessExecutionPluginFunc = reinterpret_cast<SubstituteProcessExecutionPluginFunc>(
-        reinterpret_cast<void*>(GetProcAddress(g_SubstituteProcessExecutionPluginDllHandle, winApiProcName.c_str())));
-    if (substituteProcessExecutionPluginFunc != nullptr)
+    for (uint32_t i = 0; i < s_shimProcessMatchesSection.EntryCount; i++)
     {
-        return substituteProcessExecutionPluginFunc;
+        wchar_t *processName = CreateStringFromWriteChars(payloadBytes, offset);
+        wchar_t *argumentMatch = CreateStringFromWriteChars(payloadBytes, offset);
+        g_pShimProcessMatches->push_back(new ShimProcessMatch(processName, argumentMatch));
     }
+}
+
+// Seeds the resolved path cache with the reparse points known to the build, and the paths known to be free of them,
+// so resolving paths under them doesn't need to query the file system.
+static void DecodeKnownReparsePoints()
+{
+    LPCBYTE payloadBytes = s_knownReparsePointsSection.PayloadBytes;
+    size_t offset = s_knownReparsePointsSection.Offset;
+    ResolvedPathCache& cache = ResolvedPathCache::Instance();
+
+    for (uint32_t i = 0; i < s_knownReparsePointsSection.EntryCount; i++)
+    {
+        uint32_t kind = ParseUint32(payloadBytes, offset);
+        std::wstring path(L"");
+        AppendStringFromWriteChars(payloadBytes, offset, path);
+        std::wstring target(L"");
+        AppendStringFromWriteChars(payloadBytes, offset, target);
+
+        if (path.empty())
+        {
+            continue;
+        }
 
-    Dbg(L"Unable to find 'CommandMatches', 'CommandMatches@<param_size>', or '_CommandMatches@<param_size>' functions in SubstituteProcessExecutionPluginFunc '%s', lasterr=%d", g_SubstituteProcessExecutionPluginDllPath, GetLastError());
-    return nullptr;
+        if (kind == KnownReparsePointKind_None)
+        {
+            // The ancestors of the path are free of reparse points as well
+            for (size_t length = 1; length <= path.length(); length++)
+            {
+                if (length == path.length() || IsDirectorySeparator(path[length]))
+                {
+                    std::wstring ancestor = path.substr(0, length);
+                    cache.InsertResolvingCheckResult(ancestor, false);
+                    cache.InsertPathWithoutReparsePoints(ancestor);
+                }
+            }
+        }
+        else if (!target.empty())
+        {
+            cache.InsertResolvingCheckResult(path, true);
+            cache.InsertResolvedPathWithType(path, target, kind == KnownReparsePointKind_Junction ? IO_REPARSE_TAG_MOUNT_POINT : IO_REPARSE_TAG_SYMLINK);
+        }
+    }
 }
 
-static void LoadSubstituteProcessExecutionPluginDll()
+vector<BreakawayChildProcess>* GetBreakawayChildProcesses()
 {
-    assert(g_SubstituteProcessExecutionPluginDllPath != nullptr);
+    if (g_breakawayChildProcessCount > 0)
+    {
+        std::call_once(s_breakawayChildProcessesSection.Decoded, DecodeBreakawayChildProcesses);
+    }
 
-    Dbg(L"Loading substitute process plugin DLL at '%s'", g_SubstituteProcessExecutionPluginDllPath);
+    return g_breakawayChildProcesses;
+}
+
+bool IsBreakawayChildProcess(const std::wstring& imageName, _In_opt_ LPCWSTR lpCommandLine)
+{
+    const vector<BreakawayChildProcess>* breakawayChildProcesses = GetBreakawayChildProcesses();
+    if (breakawayChildProcesses == nullptr)
+    {
+        return false;
+    }
 
-    g_SubstituteProcessExecutionPluginDllHandle = LoadLibraryW(g_SubstituteProcessExecutionPluginDllPath);
+    // The arguments, and their lowercased version, are only computed once they are needed
+    bool parsedCommandLine = false;
+    std::wstring commandArgs;
+    bool lowercasedCommandArgs = false;
+    std::wstring lowercaseCommandArgs;
 
-    if (g_SubstituteProcessExecutionPluginDllHandle != nullptr)
+    const auto range = GetBreakawayChildProcessesByImageName().equal_range(imageName);
+    for (auto it = range.first; it != range.second; ++it)
     {
-        g_SubstituteProcessExecutionPluginFunc = GetSubstituteProcessExecutionPluginFunc();
+        const BreakawayChildProcess& breakawayChildProcess = (*breakawayChildProcesses)[it->second];
+        if (breakawayChildProcess.RequiredCommandLineArgsSubstring.empty())
+        {
+#if SUPER_VERBOSE
+            Dbg(L"Allowing process to breakaway from job object. Image name: '%s'", imageName.c_str());
+#endif
+            return true;
+        }
 
-        if (g_SubstituteProcessExecutionPluginFunc == nullptr)
+        if (!parsedCommandLine)
         {
-            FreeLibrary(g_SubstituteProcessExecutionPluginDllHandle);
+            std::wstring command;
+            if (lpCommandLine != nullptr)
+            {
+                FindApplicationNameFromCommandLine(lpCommandLine, command, commandArgs);
+            }
+
+            parsedCommandLine = true;
+        }
+
+        bool contained;
+        if (breakawayChildProcess.CommandLineArgsSubstringContainmentIgnoreCase)
+        {
+            if (!lowercasedCommandArgs)
+            {
+                lowercaseCommandArgs = commandArgs;
+                for (wchar_t& c : lowercaseCommandArgs)
+                {
+                    c = (wchar_t)std::towlower(c);
+                }
+
+                lowercasedCommandArgs = true;
+            }
+
+            contained = lowercaseCommandArgs.find(breakawayChildProcess.LowercaseRequiredCommandLineArgsSubstring) != std::wstring::npos;
+        }
+        else
+        {
+            contained = commandArgs.find(breakawayChildProcess.RequiredCommandLineArgsSubstring) != std::wstring::npos;
+        }
+
+        if (contained)
+        {
+#if SUPER_VERBOSE
+            Dbg(L"Allowing process to breakaway from job object. Image name: '%s' | Command line args: '%s'.", imageName.c_str(), commandArgs.c_str());
+#endif
+            return true;
         }
     }
-    else
+
+    return false;
+}
+
+bool EnsurePathTranslationsDecoded()
+{
+    if (s_translatePathCount == 0)
+    {
+        return false;
+    }
+
+    std::call_once(s_translatePathsSection.Decoded, DecodePathTranslations);
+    return true;
+}
+
+void EnsureShimProcessMatchesDecoded()
+{
+    if (g_pShimProcessMatches != nullptr)
     {
-        Dbg(L"Failed LoadLibrary for LoadSubstituteProcessExecutionPluginDll %s, lasterr=%d", g_SubstituteProcessExecutionPluginDllPath, GetLastError());
+        std::call_once(s_shimProcessMatchesSection.Decoded, DecodeShimProcessMatches);
     }
 }
 
+void EnsureKnownReparsePointsDecoded()
+{
+    if (s_knownReparsePointsSection.EntryCount > 0)
+    {
+        std::call_once(s_knownReparsePointsSection.Decoded, DecodeKnownReparsePoints);
+    }
+}
 
 /// <summary>
 /// Gets the final full path by handle.
@@ -689,7 +873,9 @@ static void LoadSubstituteProcessExecutionPluginDll()
 static DWORD DetourGetFinalPathByHandle(_In_ HANDLE hFile, _Inout_ std::wstring& fullPath)
 {
     // First, try with a fixed-sized buffer which should be good enough for all practical cases.
-    wchar_t wszBuffer[MAX_PATH];
+    // The final path of a file under a subst drive or a mapped device is its real path, which is often longer than MAX_PATH
+    // (that is why the drive got mapped), so the buffer leaves room for those: retrying with a bigger buffer is another call into the kernel.
+    wchar_t wszBuffer[4 * MAX_PATH];
     DWORD nBufferLength = std::extent<decltype(wszBuffer)>::value;
 
     DWORD result = GetFinalPathNameByHandleW(hFile, wszBuffer, nBufferLength, FILE_NAME_NORMALIZED);
@@ -808,19 +994,25 @@ bool ParseFileAccessManifest(
 
     offset += injectionTimeoutFlag->GetSize();
 
+    // The breakaway child processes and the path translations are only decoded when first needed (see LazyManifestSection).
+    // Here we just skip over their entries, counting the ones that are going to be used once decoded.
     g_manifestChildProcessesToBreakAwayFromJob = reinterpret_cast<const PManifestChildProcessesToBreakAwayFromJob>(&payloadBytes[offset]);
     g_manifestChildProcessesToBreakAwayFromJob->AssertValid();
     offset += g_manifestChildProcessesToBreakAwayFromJob->GetSize();
 
+    s_breakawayChildProcessesSection.PayloadBytes = payloadBytes;
+    s_breakawayChildProcessesSection.Offset = offset;
+    s_breakawayChildProcessesSection.EntryCount = g_manifestChildProcessesToBreakAwayFromJob->Count;
+
     for (uint32_t i = 0; i < g_manifestChildProcessesToBreakAwayFromJob->Count; i++)
     {
-        std::wstring processName(L"");
-        AppendStringFromWriteChars(payloadBytes, offset, processName);
-        if (!processName.empty())
-        {   
-            std::wstring requiredCommandLineArgsSubstring(L"");
-            AppendStringFromWriteChars(payloadBytes, offset, requiredCommandLineArgsSubstring);
-            g_breakawayChildProcesses->push_back(BreakawayChildProcess(processName, requiredCommandLineArgsSubstring, ParseByte(payloadBytes, offset) == 1U));
+        uint32_t processNameLength = ParseUint32(payloadBytes, offset);
+        offset += sizeof(wchar_t) * processNameLength;
+        if (processNameLength != 0)
+        {
+            SkipWriteCharsString(payloadBytes, offset);
+            offset += sizeof(byte);
+            g_breakawayChildProcessCount++;
         }
     }
 
@@ -828,42 +1020,20 @@ bool ParseFileAccessManifest(
     g_manifestTranslatePathsStrings->AssertValid();
     offset += g_manifestTranslatePathsStrings->GetSize();
 
+    s_translatePathsSection.PayloadBytes = payloadBytes;
+    s_translatePathsSection.Offset = offset;
+    s_translatePathsSection.EntryCount = g_manifestTranslatePathsStrings->Count;
+
     for (uint32_t i = 0; i < g_manifestTranslatePathsStrings->Count; i++)
     {
-        std::wstring translateFrom(L"");
-        AppendStringFromWriteChars(payloadBytes, offset, translateFrom);
+        uint32_t translateFromLength = ParseUint32(payloadBytes, offset);
+        offset += sizeof(wchar_t) * translateFromLength;
+        uint32_t translateToLength = ParseUint32(payloadBytes, offset);
+        offset += sizeof(wchar_t) * translateToLength;
 
-        if (!translateFrom.empty())
+        if (translateFromLength != 0 && translateToLength != 0)
         {
-            for (basic_string<wchar_t>::iterator p = translateFrom.begin(); p != translateFrom.end(); ++p)
-            {
-                *p = towlower(*p);
-            }
-        }
-
-        std::wstring translateTo(L"");
-        AppendStringFromWriteChars(payloadBytes, offset, translateTo);
-
-        if (!translateFrom.empty() && !translateTo.empty())
-        {
-            g_pManifestTranslatePathTuples->push_back(new TranslatePathTuple(translateFrom, translateTo));
-
-            if (translateFrom.back() == L'\\')
-            {
-                translateFrom.pop_back();
-            }
-
-            std::transform(translateFrom.begin(), translateFrom.end(), translateFrom.begin(), std::towupper);
-
-            if (translateTo.back() == L'\\')
-            {
-                translateTo.pop_back();
-            }
-
-            std::transform(translateTo.begin(), translateTo.end(), translateTo.begin(), std::towupper);
-
-            g_pManifestTranslatePathLookupTable->insert(translateFrom);
-            g_pManifestTranslatePathLookupTable->insert(translateTo);
+            s_translatePathCount++;
         }
     }
 
@@ -884,6 +1054,7 @@ bool ParseFileAccessManifest(
     extraFlags->AssertValid();
     g_fileAccessManifestExtraFlags = static_cast<FileAccessManifestExtraFlag>(extraFlags->ExtraFlags);
     g_pDetouredProcessInjector->SetAlwaysRemoteInjectFromWow64Process(CheckAlwaysRemoteInjectDetoursFrom32BitProcess(g_fileAccessManifestExtraFlags));
+    g_pDetouredProcessInjector->SetSharePayloadThroughSection(EnableDetoursSharedManifestSection());
     g_pDetouredProcessInjector->SetPayload(payloadBytes, payloadSize);
     offset += extraFlags->GetSize();
 
@@ -910,9 +1081,25 @@ bool ParseFileAccessManifest(
             }
         }
 
-        g_messageCountSemaphore = OpenSemaphore(SEMAPHORE_ALL_ACCESS, FALSE, helperString);
+        // The page of the shared message counter is named after the semaphore (see SharedMessageCounter.cs). Incrementing it
+        // takes no system call, so the semaphore is only opened when the page can't be mapped.
+        std::wstring counterName(helperString);
+        counterName.append(L"_count");
+        HANDLE counterMapping = OpenFileMappingW(FILE_MAP_READ | FILE_MAP_WRITE, FALSE, counterName.c_str());
+        if (counterMapping != nullptr)
+        {
+            g_messageCounter = reinterpret_cast<volatile LONG64*>(MapViewOfFile(counterMapping, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, sizeof(LONG64)));
+
+            // The view keeps the mapping alive
+            CloseHandle(counterMapping);
+        }
+
+        if (g_messageCounter == nullptr)
+        {
+            g_messageCountSemaphore = OpenSemaphore(SEMAPHORE_ALL_ACCESS, FALSE, helperString);
+        }
 
-        if (g_messageCountSemaphore == nullptr || g_messageCountSemaphore == INVALID_HANDLE_VALUE)
+        if (g_messageCounter == nullptr && (g_messageCountSemaphore == nullptr || g_messageCountSemaphore == INVALID_HANDLE_VALUE))
         {
             DWORD error = GetLastError();
             std::wstring errorMsg = DebugStringFormat(L"ParseFileAccessManifest: Failed to open message-count tracking semaphore '%s' (error code: 0x%0X8)", helperString, (int)error);
@@ -999,22 +1186,39 @@ bool ParseFileAccessManifest(
 #endif
         uint32_t numProcessMatches = ParseUint32(payloadBytes, offset);
         g_pShimProcessMatches = new vector<ShimProcessMatch*>();
+
+        // Matches are only decoded when a child process is created (see EnsureShimProcessMatchesDecoded)
+        s_shimProcessMatchesSection.PayloadBytes = payloadBytes;
+        s_shimProcessMatchesSection.Offset = offset;
+        s_shimProcessMatchesSection.EntryCount = numProcessMatches;
         for (uint32_t i = 0; i < numProcessMatches; i++)
         {
-            wchar_t *processName = CreateStringFromWriteChars(payloadBytes, offset);
-            wchar_t *argumentMatch = CreateStringFromWriteChars(payloadBytes, offset);
-            g_pShimProcessMatches->push_back(new ShimProcessMatch(processName, argumentMatch));
+            SkipWriteCharsString(payloadBytes, offset);
+            SkipWriteCharsString(payloadBytes, offset);
         }
     }
 
-    if (g_SubstituteProcessExecutionPluginDllPath != nullptr)
+    PCManifestKnownReparsePoints knownReparsePoints = reinterpret_cast<PCManifestKnownReparsePoints>(&payloadBytes[offset]);
+    knownReparsePoints->AssertValid();
+    offset += knownReparsePoints->GetSize();
+
+    // The resolved path cache is seeded the first time it is used (see EnsureKnownReparsePointsDecoded)
+    s_knownReparsePointsSection.PayloadBytes = payloadBytes;
+    s_knownReparsePointsSection.Offset = offset;
+    s_knownReparsePointsSection.EntryCount = knownReparsePoints->Count;
+    for (uint32_t i = 0; i < knownReparsePoints->Count; i++)
     {
-        LoadSubstituteProcessExecutionPluginDll();
+        ParseUint32(payloadBytes, offset);
+        SkipWriteCharsString(payloadBytes, offset);
+        SkipWriteCharsString(payloadBytes, offset);
     }
 
     g_manifestTreeRoot = reinterpret_cast<PCManifestRecord>(&payloadBytes[offset]);
     VerifyManifestRoot(g_manifestTreeRoot);
 
+    // Walking the whole tree is O(m) in the size of the manifest: this is a no-op unless this is a debug build
+    VerifyManifestTree(g_manifestTreeRoot);
+
     //
     // Try to read module file and check permissions.
     //
@@ -1210,21 +1414,42 @@ bool EnumerateDirectory(
     bool recursive,
     bool treatReparsePointAsFile,
     _Inout_ std::vector<std::pair<std::wstring, DWORD>>& filesAndDirectories)
+{
+    filesAndDirectories.clear();
+
+    return EnumerateDirectory(
+        directoryPath,
+        filter,
+        recursive,
+        treatReparsePointAsFile,
+        [&](const std::wstring& path, DWORD attributes)
+        {
+            filesAndDirectories.push_back(std::make_pair(path, attributes));
+            return true;
+        });
+}
+
+bool EnumerateDirectory(
+    const std::wstring& directoryPath,
+    const std::wstring& filter,
+    bool recursive,
+    bool treatReparsePointAsFile,
+    const std::function<bool(const std::wstring&, DWORD)>& visitor)
 {
     HANDLE hFind = INVALID_HANDLE_VALUE;
     WIN32_FIND_DATA ffd;
     std::stack<std::wstring> directoriesToEnumerate;
 
     directoriesToEnumerate.push(directoryPath);
-    filesAndDirectories.clear();
 
     while (!directoriesToEnumerate.empty()) {
-        std::wstring directoryToEnumerate = directoriesToEnumerate.top();
-        std::wstring spec = PathCombine(directoryToEnumerate, filter.c_str());
-
+        std::wstring directoryToEnumerate = std::move(directoriesToEnumerate.top());
         directoriesToEnumerate.pop();
 
-        hFind = FindFirstFileW(NormalizePath(spec).c_str(), &ffd);
+        std::wstring spec = PathCombine(directoryToEnumerate, filter.c_str());
+
+        // Short names are not needed, and a larger buffer means fewer round trips to the file system for big directories.
+        hFind = FindFirstFileExW(NormalizePath(spec).c_str(), FindExInfoBasic, &ffd, FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
         if (hFind == INVALID_HANDLE_VALUE) {
             return false;
         }
@@ -1235,7 +1460,13 @@ bool EnumerateDirectory(
 
                 std::wstring path = PathCombine(directoryToEnumerate, ffd.cFileName);
 
-                filesAndDirectories.push_back(std::make_pair(path, ffd.dwFileAttributes));
+                if (!visitor(path, ffd.dwFileAttributes)) {
+                    // Keep the last error set by the visitor
+                    DWORD lastError = GetLastError();
+                    FindClose(hFind);
+                    SetLastError(lastError);
+                    return false;
+                }
 
                 if (recursive) {
 
@@ -1246,7 +1477,7 @@ bool EnumerateDirectory(
                     }
 
                     if (isDirectory) {
-                        directoriesToEnumerate.push(path);
+                        directoriesToEnumerate.push(std::move(path));
                     }
                 }
             }
@@ -1458,4 +1689,4 @@ CanonicalizedPath GetImagePath(_In_opt_ LPCWSTR lpApplicationName, _In_opt_ LPWS
 
         return CanonicalizedPath();
     }
-}
\ No newline at end of file
+}
\ No newline at end of file
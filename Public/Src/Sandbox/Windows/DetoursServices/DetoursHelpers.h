@@ -8,6 +8,8 @@
 #include "PolicyResult.h"
 #include "globals.h"
 
+#include <functional>
+
 // ----------------------------------------------------------------------------
 // Error codes and strings
 // ----------------------------------------------------------------------------
@@ -65,17 +67,40 @@ inline SpecialProcessKind GetProcessKind() { return g_ProcessKind; }
 
 void HandleDetoursInjectionAndCommunicationErrors(int errorCode, LPCWSTR eventLogMsgPtr, LPCWSTR eventLogMsgId);
 
+/// What the special case rules look at in the final component of a path, found in a single backward pass over it.
+struct FinalPathComponent
+{
+    FinalPathComponent(PCWSTR path, size_t pathLength);
+
+    // Number of characters after the last directory separator
+    size_t Length = 0;
+
+    // Number of characters from the last '.' of the component (included) to the end, or 0 if there is none
+    size_t ExtensionLength = 0;
+
+    // Whether the component names a stream (file:stream or file:stream:type)
+    bool IsNamedStream = false;
+
+    // Same as HasSuffix(path, pathLength, extension), for an extension starting with its '.'
+    bool HasExtension(PCWSTR path, size_t pathLength, PCWSTR extension) const;
+};
+
+// Decides which special-case rules apply to this process. Must be called once the process kind and the manifest flags are known.
+void InitSpecialCaseRules();
+
 // Indicates if the path matches a special-case rule and if so sets a policy to use.
 // Note that the given path has been canonicalized so that it does not have a prefix like \\?\, \\.\, or \??\.
 bool GetSpecialCaseRulesForCoverageAndSpecialDevices(
     __in  PCWSTR absolutePath,
     __in  size_t absolutePathLength,
     __in PathType pathType,
+    __in  const FinalPathComponent& finalComponent,
     __out FileAccessPolicy& policy);
 
 bool GetSpecialCaseRulesForSpecialTools(
     __in  PCWSTR absolutePath,
     __in  size_t absolutePathLength,
+    __in  const FinalPathComponent& finalComponent,
     __out FileAccessPolicy& policy);
 
 bool GetSpecialCaseRulesForWindows(
@@ -112,6 +137,25 @@ void InitProcessKind();
 
 void TranslateFilePath(_In_ const std::wstring& inFileName, _Out_ std::wstring& outFileName, _In_ bool debug);
 
+// Sections of the manifest that are decoded on first use rather than when the manifest is parsed. These are thread-safe.
+
+// Gets the child processes allowed to break away from the job object, decoding them if needed
+vector<BreakawayChildProcess>* GetBreakawayChildProcesses();
+
+// Whether a child process with the given image name (the last component of its path) and command line is allowed to break away
+// from the job object. Decodes the breakaway child processes if needed.
+bool IsBreakawayChildProcess(const std::wstring& imageName, _In_opt_ LPCWSTR lpCommandLine);
+
+// Decodes the path translations (g_pManifestTranslatePathTuples, g_pManifestTranslatePathLookupTable and PathTranslator) if needed.
+// Returns whether there are any.
+bool EnsurePathTranslationsDecoded();
+
+// Decodes g_pShimProcessMatches if needed
+void EnsureShimProcessMatchesDecoded();
+
+// Seeds the resolved path cache with the reparse points the manifest knows about if needed
+void EnsureKnownReparsePointsDecoded();
+
 void ReportIfNeeded(
     AccessCheckResult const& checkResult,
     FileOperationContext const& context,
@@ -127,6 +171,16 @@ bool EnumerateDirectory(
     bool treatReparsePointAsFile,
     _Inout_ std::vector<std::pair<std::wstring, DWORD>>& filesAndDirectories);
 
+// Enumerates the directory like the overload above, but hands every entry (path and attributes) to the visitor as soon
+// as it is found instead of collecting all of them first. The visitor returns false to stop the enumeration, in which
+// case this returns false as well.
+bool EnumerateDirectory(
+    const std::wstring& directoryPath,
+    const std::wstring& filter,
+    bool recursive,
+    bool treatReparsePointAsFile,
+    const std::function<bool(const std::wstring&, DWORD)>& visitor);
+
 bool ExistsAsFile(_In_ PCWSTR path);
 
 // Tries to mimic the CreateProcess logic by identifying the image path based on the application
@@ -0,0 +1,199 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include "stdafx.h"
+
+#include "DetoursPerformanceCounters.h"
+
+#define GEN_DETOURED_FUNCTION_NAME(name) L#name,
+#define GEN_DETOURED_FUNCTION_CYCLES_NAME(name) L#name L"Cycles",
+
+static const wchar_t* const s_detouredFunctionNames[] = {
+    FOR_ALL_COUNTED_DETOURED_FUNCTIONS(GEN_DETOURED_FUNCTION_NAME)
+};
+
+static const wchar_t* const s_detouredFunctionCyclesNames[] = {
+    FOR_ALL_COUNTED_DETOURED_FUNCTIONS(GEN_DETOURED_FUNCTION_CYCLES_NAME)
+};
+
+static const wchar_t* const s_hotPathNames[] = {
+    L"PolicySearchCycles",
+    L"CanonicalizationCycles",
+    L"ReparsePointResolutionCycles",
+    L"ReportingCycles",
+};
+
+static const wchar_t* const s_detoursEventNames[] = {
+    L"HandleOverlayTableGrowths",
+    L"HandleOverlaySpilledRegistrations",
+    L"HandleOverlaySharedPolicies",
+    L"ReportWriterBacklogs",
+    L"ExpectedUsnCacheHits",
+    L"ProbesAnsweredFromManifest",
+    L"FileIdPathCacheHits",
+    L"SharedPluginDecisionCacheHits",
+    L"VolumePathsAnsweredFromMountPointCache",
+    L"TrustedSystemCallerOpens",
+};
+
+#define REPORT_SIZE_BUCKET_COUNT 7
+
+// Reports are counted in the first bucket whose upper bound (exclusive, in bytes) is above their size. The last bucket has no upper bound.
+static const size_t s_reportSizeBucketBounds[REPORT_SIZE_BUCKET_COUNT - 1] = { 128, 256, 512, 1024, 2048, 4096 };
+
+static const wchar_t* const s_reportSizeBucketNames[REPORT_SIZE_BUCKET_COUNT] = {
+    L"ReportsBelow128Bytes",
+    L"ReportsBelow256Bytes",
+    L"ReportsBelow512Bytes",
+    L"ReportsBelow1024Bytes",
+    L"ReportsBelow2048Bytes",
+    L"ReportsBelow4096Bytes",
+    L"ReportsOf4096BytesOrMore",
+};
+
+static_assert(_countof(s_detouredFunctionNames) == (size_t)DetouredFunctionId::Count, "A detoured function has no name");
+static_assert(_countof(s_detouredFunctionCyclesNames) == (size_t)DetouredFunctionId::Count, "A detoured function has no cycles name");
+static_assert(_countof(s_hotPathNames) == (size_t)DetoursHotPath::Count, "A hot path has no name");
+static_assert(_countof(s_detoursEventNames) == (size_t)DetoursEvent::Count, "An event has no name");
+
+static volatile LONG64 s_detouredCallCounts[(size_t)DetouredFunctionId::Count];
+static volatile LONG64 s_detouredCallCycles[(size_t)DetouredFunctionId::Count];
+static volatile LONG64 s_hotPathCycles[(size_t)DetoursHotPath::Count];
+static volatile LONG64 s_detoursEventCounts[(size_t)DetoursEvent::Count];
+static volatile LONG64 s_reportSizeCounts[REPORT_SIZE_BUCKET_COUNT];
+
+// Depth of the hot path scopes of the current thread, so that only the outermost one is measured
+static __declspec(thread) unsigned char gt_hotPathDepth[(size_t)DetoursHotPath::Count];
+
+// Depth of the detoured calls of the current thread, so that only the outermost one is measured
+static __declspec(thread) unsigned int gt_detouredCallDepth;
+
+void CountDetouredCallSlow(DetouredFunctionId function)
+{
+    InterlockedIncrement64(&s_detouredCallCounts[(size_t)function]);
+}
+
+void CountDetoursEventSlow(DetoursEvent detoursEvent)
+{
+    InterlockedIncrement64(&s_detoursEventCounts[(size_t)detoursEvent]);
+}
+
+void CountReportSize(size_t reportSizeInBytes)
+{
+    size_t bucket = 0;
+    while (bucket < REPORT_SIZE_BUCKET_COUNT - 1 && reportSizeInBytes >= s_reportSizeBucketBounds[bucket])
+    {
+        bucket++;
+    }
+
+    InterlockedIncrement64(&s_reportSizeCounts[bucket]);
+}
+
+bool EnterDetouredCall()
+{
+    return gt_detouredCallDepth++ == 0;
+}
+
+void ExitDetouredCall(DetouredFunctionId function, unsigned __int64 cycles)
+{
+    gt_detouredCallDepth--;
+    if (cycles != 0)
+    {
+        InterlockedAdd64(&s_detouredCallCycles[(size_t)function], (LONG64)cycles);
+    }
+}
+
+bool EnterHotPath(DetoursHotPath hotPath)
+{
+    return gt_hotPathDepth[(size_t)hotPath]++ == 0;
+}
+
+void ExitHotPath(DetoursHotPath hotPath, unsigned __int64 cycles)
+{
+    gt_hotPathDepth[(size_t)hotPath]--;
+    if (cycles != 0)
+    {
+        InterlockedAdd64(&s_hotPathCycles[(size_t)hotPath], (LONG64)cycles);
+    }
+}
+
+// Appends a counter to the buffer if it is not zero and it fits. Returns false once the buffer is full.
+static bool AppendCounter(wchar_t* buffer, size_t bufferLength, size_t& length, const wchar_t* name, LONG64 value)
+{
+    if (value == 0)
+    {
+        return true;
+    }
+
+    int const written = _snwprintf_s(
+        buffer + length,
+        bufferLength - length,
+        _TRUNCATE,
+        L"%s%s=%I64u",
+        length == 0 ? L"" : L";",
+        name,
+        (ULONG64)value);
+
+    if (written < 0)
+    {
+        // Drop the truncated counter
+        buffer[length] = L'\0';
+        return false;
+    }
+
+    length += written;
+    return true;
+}
+
+size_t FormatDetoursPerformanceCounters(wchar_t* buffer, size_t bufferLength)
+{
+    size_t length = 0;
+    if (bufferLength == 0)
+    {
+        return length;
+    }
+
+    buffer[0] = L'\0';
+
+    for (size_t i = 0; i < (size_t)DetouredFunctionId::Count; i++)
+    {
+        if (!AppendCounter(buffer, bufferLength, length, s_detouredFunctionNames[i], s_detouredCallCounts[i]))
+        {
+            return length;
+        }
+    }
+
+    for (size_t i = 0; i < (size_t)DetouredFunctionId::Count; i++)
+    {
+        if (!AppendCounter(buffer, bufferLength, length, s_detouredFunctionCyclesNames[i], s_detouredCallCycles[i]))
+        {
+            return length;
+        }
+    }
+
+    for (size_t i = 0; i < (size_t)DetoursHotPath::Count; i++)
+    {
+        if (!AppendCounter(buffer, bufferLength, length, s_hotPathNames[i], s_hotPathCycles[i]))
+        {
+            return length;
+        }
+    }
+
+    for (size_t i = 0; i < (size_t)DetoursEvent::Count; i++)
+    {
+        if (!AppendCounter(buffer, bufferLength, length, s_detoursEventNames[i], s_detoursEventCounts[i]))
+        {
+            return length;
+        }
+    }
+
+    for (size_t i = 0; i < REPORT_SIZE_BUCKET_COUNT; i++)
+    {
+        if (!AppendCounter(buffer, bufferLength, length, s_reportSizeBucketNames[i], s_reportSizeCounts[i]))
+        {
+            return length;
+        }
+    }
+
+    return length;
+}
@@ -0,0 +1,235 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include "FileAccessHelpers.h"
+
+#include <intrin.h>
+
+// Performance counters of the detoured process, collected when EnableDetoursPerformanceCounters is set and sent once, with the process data report,
+// when the process exits. They tell where the time spent in Detours goes:
+// - the number of calls to each detoured function, including the calls Detours makes itself while handling another one,
+// - the time stamp counter cycles spent in each detoured function, from entry to exit, real call included. Calls Detours makes itself
+//   while handling another one count for the outer call only, so these add up to the time the process spent in detoured functions.
+//   Set against the cycles of the hot paths below, which are all sandbox overhead, they tell how much of that time Detours added,
+// - the time stamp counter cycles spent searching policies, canonicalizing paths, resolving reparse points and sending reports,
+// - the number of reports sent, by size,
+// - the number of times Detours fell back to slower paths, or its report writer thread fell behind (see DetoursEvent).
+//
+// Counters are plain interlocked counters in static storage, so collecting and formatting them doesn't allocate.
+
+// Higher-order macro that enumerates all the detoured functions whose calls are counted.
+#define FOR_ALL_COUNTED_DETOURED_FUNCTIONS(m) \
+    m(ZwSetInformationFile)             \
+    m(CreateProcessW)                   \
+    m(CreateProcessA)                   \
+    m(CreateFileW)                      \
+    m(CloseHandle)                      \
+    m(CreateFileA)                      \
+    m(GetVolumePathNameW)               \
+    m(GetFileAttributesW)               \
+    m(GetFileAttributesA)               \
+    m(GetFileAttributesExW)             \
+    m(GetFileAttributesExA)             \
+    m(CopyFileW)                        \
+    m(CopyFileA)                        \
+    m(CopyFileExW)                      \
+    m(CopyFileExA)                      \
+    m(MoveFileW)                        \
+    m(MoveFileA)                        \
+    m(MoveFileExW)                      \
+    m(MoveFileExA)                      \
+    m(MoveFileWithProgressW)            \
+    m(MoveFileWithProgressA)            \
+    m(ReplaceFileW)                     \
+    m(ReplaceFileA)                     \
+    m(DeleteFileW)                      \
+    m(DeleteFileA)                      \
+    m(CreateHardLinkW)                  \
+    m(CreateHardLinkA)                  \
+    m(CreateSymbolicLinkW)              \
+    m(CreateSymbolicLinkA)              \
+    m(FindFirstFileW)                   \
+    m(FindFirstFileA)                   \
+    m(FindFirstFileExW)                 \
+    m(FindFirstFileExA)                 \
+    m(FindNextFileW)                    \
+    m(FindNextFileA)                    \
+    m(GetFileInformationByHandleEx)     \
+    m(FindClose)                        \
+    m(GetFileInformationByHandle)       \
+    m(SetFileInformationByHandle)       \
+    m(OpenFileMappingW)                 \
+    m(OpenFileMappingA)                 \
+    m(GetTempFileNameW)                 \
+    m(GetTempFileNameA)                 \
+    m(CreateDirectoryW)                 \
+    m(CreateDirectoryA)                 \
+    m(CreateDirectoryExW)               \
+    m(CreateDirectoryExA)               \
+    m(RemoveDirectoryW)                 \
+    m(RemoveDirectoryA)                 \
+    m(SetCurrentDirectoryW)             \
+    m(SetCurrentDirectoryA)             \
+    m(DecryptFileW)                     \
+    m(DecryptFileA)                     \
+    m(EncryptFileW)                     \
+    m(EncryptFileA)                     \
+    m(OpenEncryptedFileRawW)            \
+    m(OpenEncryptedFileRawA)            \
+    m(OpenFileById)                     \
+    m(GetFinalPathNameByHandleA)        \
+    m(GetFinalPathNameByHandleW)        \
+    m(NtQueryDirectoryFile)             \
+    m(ZwQueryDirectoryFile)             \
+    m(ZwCreateFile)                     \
+    m(NtCreateFile)                     \
+    m(ZwOpenFile)                       \
+    m(NtOpenFile)                       \
+    m(NtClose)                          \
+    m(CreatePipe)                       \
+    m(DeviceIoControl)
+
+#define GEN_DETOURED_FUNCTION_ID(name) name,
+
+enum class DetouredFunctionId {
+    FOR_ALL_COUNTED_DETOURED_FUNCTIONS(GEN_DETOURED_FUNCTION_ID)
+    Count
+};
+
+// The parts of a detoured call whose cycles are measured. Time spent in a part nested in another one (e.g. canonicalizing a path while resolving
+// reparse points) counts for both.
+enum class DetoursHotPath {
+    PolicySearch,
+    Canonicalization,
+    ReparsePointResolution,
+    Reporting,
+    Count
+};
+
+// Occurrences of noteworthy slow paths of Detours
+enum class DetoursEvent {
+    // The handle overlay table chain got a new table
+    HandleOverlayTableGrowth,
+    // A handle overlay was registered in a slot past the first table of the chain, where lookups are slower
+    HandleOverlaySpilledRegistration,
+    // A handle overlay shares the policy of an overlay registered before for the same path, instead of keeping its own copy
+    HandleOverlaySharedPolicy,
+    // The reports queued for the report writer thread took more than one write to go out: the writer is falling behind
+    ReportWriterBacklog,
+    // An open found the file already checked against its expected USN, and didn't query the USN again
+    ExpectedUsnCacheHit,
+    // A probe was answered as absent from the manifest, without looking at the file system (see FileAccessPolicy_ConeIsFullyListed)
+    ProbeAnsweredFromManifest,
+    // An open by file id found the path of the file in the cache, and didn't open the file to query it
+    FileIdPathCacheHit,
+    // A decision of the substitute process execution plugin was found in the cache shared by the process tree, and the plugin wasn't called
+    SharedPluginDecisionCacheHit,
+    // GetVolumePathNameW was answered from the mount points of the volumes, without querying the mount manager
+    VolumePathAnsweredFromMountPointCache,
+    // An open came from a system module trusted with the API, and its policy was not evaluated (see SystemCallerFilter.h)
+    TrustedSystemCallerOpen,
+    Count
+};
+
+void CountDetouredCallSlow(DetouredFunctionId function);
+// Returns true when entering the outermost detoured call on the current thread
+bool EnterDetouredCall();
+// Leaves a detoured call, adding the cycles spent in it (0 for nested calls)
+void ExitDetouredCall(DetouredFunctionId function, unsigned __int64 cycles);
+void CountDetoursEventSlow(DetoursEvent detoursEvent);
+void CountReportSize(size_t reportSizeInBytes);
+// Returns true when entering the outermost scope of the hot path on the current thread
+bool EnterHotPath(DetoursHotPath hotPath);
+
+// Leaves a scope of the hot path, adding the cycles spent in it (0 for nested scopes)
+void ExitHotPath(DetoursHotPath hotPath, unsigned __int64 cycles);
+
+// Writes the counters that are not zero to the buffer, as a list of 'name=value' separated by ';'. Returns the number of characters written.
+// Formatting stops at the last counter that fits in the buffer.
+size_t FormatDetoursPerformanceCounters(_Out_writes_z_(bufferLength) wchar_t* buffer, size_t bufferLength);
+
+// Length of a buffer that fits all the formatted counters
+#define DETOURS_PERFORMANCE_COUNTERS_MAX_LENGTH 8192
+
+// Counts a call to a detoured function and measures the cycles spent in it, until the end of its scope.
+// Calls nested in another detoured call on the same thread are counted, but not measured.
+class DetouredCallTimer
+{
+public:
+    DetouredCallTimer(DetouredFunctionId function) noexcept
+        : m_function(function), m_entered(false), m_start(0)
+    {
+        if (EnableDetoursPerformanceCounters())
+        {
+            CountDetouredCallSlow(function);
+            m_entered = true;
+            if (EnterDetouredCall())
+            {
+                m_start = __rdtsc();
+            }
+        }
+    }
+
+    ~DetouredCallTimer()
+    {
+        if (m_entered)
+        {
+            ExitDetouredCall(m_function, m_start != 0 ? __rdtsc() - m_start : 0);
+        }
+    }
+
+private:
+    DetouredCallTimer(const DetouredCallTimer&) = delete;
+    DetouredCallTimer& operator=(const DetouredCallTimer&) = delete;
+
+    DetouredFunctionId m_function;
+    bool m_entered;
+    unsigned __int64 m_start;
+};
+
+// Must be the first statement of a detoured function
+#define COUNT_DETOURED_CALL(name) DetouredCallTimer detouredCallTimer(DetouredFunctionId::name)
+
+inline void CountDetoursEvent(DetoursEvent detoursEvent)
+{
+    if (EnableDetoursPerformanceCounters())
+    {
+        CountDetoursEventSlow(detoursEvent);
+    }
+}
+
+// Measures the cycles spent in its scope. Scopes nested in a scope of the same hot path on the same thread are not measured again.
+class HotPathTimer
+{
+public:
+    HotPathTimer(DetoursHotPath hotPath) noexcept
+        : m_hotPath(hotPath), m_entered(false), m_start(0)
+    {
+        if (EnableDetoursPerformanceCounters())
+        {
+            m_entered = true;
+            if (EnterHotPath(hotPath))
+            {
+                m_start = __rdtsc();
+            }
+        }
+    }
+
+    ~HotPathTimer()
+    {
+        if (m_entered)
+        {
+            ExitHotPath(m_hotPath, m_start != 0 ? __rdtsc() - m_start : 0);
+        }
+    }
+
+private:
+    HotPathTimer(const HotPathTimer&) = delete;
+    HotPathTimer& operator=(const HotPathTimer&) = delete;
+
+    DetoursHotPath m_hotPath;
+    bool m_entered;
+    unsigned __int64 m_start;
+};
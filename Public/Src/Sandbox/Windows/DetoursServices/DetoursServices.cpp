@@ -27,8 +27,11 @@
 #include "DetouredScope.h"
 #include "StringOperations.h"
 #include "HandleOverlay.h"
+#include "ResolvedPathCache.h"
 #include "DetouredProcessInjector.h"
+#include "SharedReparsePointCache.h"
 #include "SendReport.h"
+#include "SystemCallerFilter.h"
 #include <Psapi.h>
 #include "FilesCheckedForAccess.h"
 #include "locale.h"
@@ -69,16 +72,14 @@ extern "C" {
 }
 
 #if MEASURE_DETOURED_NT_CLOSE_IMPACT
-volatile LONG g_msTimeToPopulatePoolList = 0;
 volatile ULONGLONG g_pipExecutionStart = 0;
 volatile LONG g_ntCloseHandeCount = 0;
-volatile LONG g_maxClosedListCount = 0;
-volatile LONG g_msTimeInAddClosedList = 0;
-volatile LONG g_msTimeInRemoveClosedList = 0;
 #endif // #if MEASURE_DETOURED_NT_CLOSE_IMPACT
 
 #if MEASURE_REPARSEPOINT_RESOLVING_IMPACT
 volatile ULONGLONG g_shouldResolveReparsePointCacheHitCount;
+volatile ULONGLONG g_shouldResolveReparsePointCacheMissCount;
+volatile ULONGLONG g_shouldResolveReparsePointCacheDroppedInsertCount;
 volatile ULONGLONG g_reparsePointTargetCacheHitCount;
 volatile ULONGLONG g_resolvedPathsCacheHitCout;
 #endif // MEASURE_REPARSEPOINT_RESOLVING_IMPACT
@@ -200,6 +201,9 @@ This allows multiple processes to write to the same file object concurrently; th
 that the contents (the individual bytes) of the writes will not interleave, and when append-mode writes are used,
 that none of the appends will be lost.
 
+When EnableDetoursBinaryReports is set, each report is instead a length-prefixed binary frame (see BinaryReports.h),
+still written in a single WriteFile() call.
+
 */
 
 using std::string;
@@ -229,6 +233,7 @@ PCManifestRecord g_manifestTreeRoot;
 
 PManifestChildProcessesToBreakAwayFromJob g_manifestChildProcessesToBreakAwayFromJob;
 vector<BreakawayChildProcess>* g_breakawayChildProcesses = nullptr;
+uint32_t g_breakawayChildProcessCount = 0;
 PManifestTranslatePathsStrings g_manifestTranslatePathsStrings;
 vector<TranslatePathTuple*>* g_pManifestTranslatePathTuples = nullptr;
 unordered_set<std::wstring>* g_pManifestTranslatePathLookupTable = nullptr;
@@ -237,6 +242,7 @@ PManifestInternalDetoursErrorNotificationFileString g_manifestInternalDetoursErr
 LPCTSTR g_internalDetoursErrorNotificationFile = nullptr;
 
 HANDLE g_messageCountSemaphore = INVALID_HANDLE_VALUE;
+volatile LONG64* g_messageCounter = nullptr;
 
 HANDLE g_reportFileHandle;
 
@@ -255,7 +261,8 @@ volatile LONG64 g_detoursMaxAllocatedMemoryInBytes = 0;
 // Running allocated memory by Detours in its private heap.
 volatile LONG64 g_detoursHeapAllocatedMemoryInBytes = 0;
 
-// The number of entries allocated in the no-lock, concurrent list for use by NtClose.
+// The number of slots allocated in the lock-free handle overlay tables. It used to count the entries of the no-lock, concurrent list
+// that deferred NtClose overlay removals, hence its name in the process data report.
 volatile LONG g_detoursAllocatedNoLockConcurentPoolEntries = 0;
 
 // The max number of entries in the HandleHeapMap hash table. Allocated in private heap.
@@ -264,6 +271,10 @@ volatile LONG64 g_detoursMaxHandleHeapEntries = 0;
 // Currently allocated entries in the HandleHeapMap hash table. Allocated in private heap.
 volatile LONG64 g_detoursHandleHeapEntries = 0;
 
+// Policy searches answered by the policy search cache, and policy searches that had to walk the manifest tree.
+volatile LONG64 g_policySearchCacheHitCount = 0;
+volatile LONG64 g_policySearchCacheMissCount = 0;
+
 //
 // Substitute process execution shim.
 //
@@ -334,6 +345,8 @@ CreateDirectoryExW_t Real_CreateDirectoryExW;
 CreateDirectoryExA_t Real_CreateDirectoryExA;
 RemoveDirectoryW_t Real_RemoveDirectoryW;
 RemoveDirectoryA_t Real_RemoveDirectoryA;
+SetCurrentDirectoryW_t Real_SetCurrentDirectoryW;
+SetCurrentDirectoryA_t Real_SetCurrentDirectoryA;
 DecryptFileW_t Real_DecryptFileW;
 DecryptFileA_t Real_DecryptFileA;
 EncryptFileW_t Real_EncryptFileW;
@@ -505,13 +518,14 @@ InternalCreateDetouredProcess(
     bool isCurrentWow64Process = false;
     bool isProcessWow64 = false;
     bool needsRemoteInjection = false;
+    ProcessDetouringTimings timings;
 
     // If there are configured processes that need to break away from
     // the current job object, that means the job object was configured with
     // the JOB_OBJECT_LIMIT_BREAKAWAY_OK limit. But if we reached this point
     // the process being created is not allowed to break away. So make
     // sure we don't pass CREATE_BREAKAWAY_FROM_JOB
-    if (!g_breakawayChildProcesses->empty())
+    if (g_breakawayChildProcessCount > 0)
     {
         creationFlags &= ~CREATE_BREAKAWAY_FROM_JOB;
     }
@@ -537,6 +551,7 @@ InternalCreateDetouredProcess(
 
     // It appears the AV might hold exclusive read lock while scaning and this can fail create process.
     // Inject some retries.
+    uint64_t phaseStart = ProcessDetouringTimings::Now();
     while (true)
     {
         // Create the process as requested, but make sure it's suspended
@@ -568,6 +583,8 @@ InternalCreateDetouredProcess(
         break;
     }
 
+    timings.CreateProcessMicroseconds = ProcessDetouringTimings::MicrosecondsSince(phaseStart);
+
     if (!fProcCreated)
     {
         error = GetLastError();
@@ -591,10 +608,11 @@ InternalCreateDetouredProcess(
 
         bool fullInheritHandles = bInheritHandles == TRUE && !(dwCreationFlags & EXTENDED_STARTUPINFO_PRESENT);
         nRetryCount = 0;
+        phaseStart = ProcessDetouringTimings::Now();
 
         while (!fProcDetoured && (nRetryCount < BUILDXL_DETOURS_INJECT_PROCESS_RETRY_COUNT))
         {
-            error = pInjector->InjectProcess(lpProcessInformation->hProcess, fullInheritHandles);
+            error = pInjector->InjectProcess(lpProcessInformation->hProcess, fullInheritHandles, &timings);
             fProcDetoured = error == ERROR_SUCCESS;
 
             // Retry for payload memcpy failure in process injector
@@ -607,6 +625,8 @@ InternalCreateDetouredProcess(
 
             break;
         }
+
+        timings.InjectionMicroseconds = ProcessDetouringTimings::MicrosecondsSince(phaseStart);
     }
 
     if ((fProcDetoured || !needsInjection) && fProcCreated) {
@@ -672,7 +692,8 @@ InternalCreateDetouredProcess(
             creationFlags,
             fProcDetoured,
             error,
-            status);
+            status,
+            &timings);
     }
 
     SetLastError(error);
@@ -969,6 +990,10 @@ static int __cdecl CrtDebugHook(int nReportType, wchar_t* szMsg, int* pnRet) {
 
 static bool DllProcessDetach()
 {
+    // Buffered reports go out first, so the process data report is the last one of the process
+    StopReportBatching();
+    StopReportWriter();
+
     if (ShouldLogProcessData())
     {
         FILETIME creationTime;
@@ -1008,21 +1033,21 @@ static bool DllProcessDetach()
 
 #if MEASURE_DETOURED_NT_CLOSE_IMPACT    
     // Do some statistical information logging for different measurements
-    Dbg(L"Populate NtClose pool list entries time: %d ms.", g_msTimeToPopulatePoolList);
     Dbg(L"Pip execution time: %d ms.", (LONG)(GetTickCount64() - g_pipExecutionStart));
     Dbg(L"NtCloseHandle call times: %d", g_ntCloseHandeCount);
-    Dbg(L"Maxinum closed list count: %d", g_maxClosedListCount);
-    Dbg(L"Time adding to closed list: %d ms.", g_msTimeInAddClosedList);
-    Dbg(L"Time removing from closed list: %d ms.", g_msTimeInRemoveClosedList);
 #endif // MEASURE_DETOURED_NT_CLOSE_IMPACT
 
 #if MEASURE_REPARSEPOINT_RESOLVING_IMPACT
     if (!IgnoreFullReparsePointResolving())
     {
         Dbg(L"Intial resolver result cache hit count for PID(%d) and PPID(%d): %ld", g_shouldResolveReparsePointCacheHitCount, g_currentProcessId, g_parentProcessId);
+        Dbg(L"Intial resolver result cache miss count for PID(%d) and PPID(%d): %ld", g_shouldResolveReparsePointCacheMissCount, g_currentProcessId, g_parentProcessId);
+        Dbg(L"Resolver result cache dropped insert count for PID(%d) and PPID(%d): %ld", g_shouldResolveReparsePointCacheDroppedInsertCount, g_currentProcessId, g_parentProcessId);
     }
     Dbg(L"ReparsePoint target resolver cache hit count for PID(%d) and PPID(%d): %ld", g_reparsePointTargetCacheHitCount, g_currentProcessId, g_parentProcessId);
     Dbg(L"Resolved paths cache hit count for PID(%d) and PPID(%d): %ld", g_resolvedPathsCacheHitCout, g_currentProcessId, g_parentProcessId);
+    Dbg(L"Resolved paths cache eviction count for PID(%d) and PPID(%d): %llu", g_currentProcessId, g_parentProcessId, ResolvedPathCache::Instance().GetEvictedResolvedPathsCount());
+    Dbg(L"Reparse point caches eviction count for PID(%d) and PPID(%d): %llu", g_currentProcessId, g_parentProcessId, ResolvedPathCache::Instance().GetEvictedEntriesCount());
 #endif // MEASURE_REPARSEPOINT_RESOLVING_IMPACT
 
     return TRUE;
@@ -1143,19 +1168,29 @@ static bool DllProcessAttach()
 
     g_invariantLocale = _wcreate_locale(LC_CTYPE, L"");
     InitProcessKind();
+    InitSpecialCaseRules();
     InitializeHandleOverlay();
+    InitializeSharedReparsePointCache();
+    InitializeSystemCallerFilter();
+    StartReportWriter();
 
     // If there are configured processes that will break away from the sandbox, expose
     // an environment variable with the handle pointer to the detour manifest.
     // This is the way the AugmentedManifestReporter (the API to directly talk to detours
     // internal tools can use) can actually interact with the manifest
     // Keep in sync with C# side
-    if (!g_breakawayChildProcesses->empty())
+    if (g_breakawayChildProcessCount > 0)
     {
         // CODESYNC: Keep variable name in sync with the C# side
         SetEnvironmentVariable(
             L"BUILDXL_AUGMENTED_MANIFEST_HANDLE",
             std::to_wstring(DetouredProcessInjector::HandleToUint64(g_reportFileHandle)).c_str());
+
+        // Reports sent on the handle must then be framed as well
+        // CODESYNC: Keep variable name in sync with the C# side
+        SetEnvironmentVariable(
+            L"BUILDXL_AUGMENTED_MANIFEST_BINARY_REPORTS",
+            EnableDetoursBinaryReports() ? L"1" : nullptr);
     }
 
 #define ATTACH(Name) \
@@ -1167,7 +1202,22 @@ static bool DllProcessAttach()
     }
     // end #define ATTACH
 
+    // Attaches to the function unless the manifest makes its detour a pass-through, i.e., a detour that calls the real
+    // function right away without looking at its arguments. The real function is recorded either way: other detours call it.
+    // Only detours whose every code path is gated by the flags go here; all the others (e.g., NtClose, which keeps
+    // the handle overlays up to date) always stay attached.
+#define ATTACH_UNLESS_PASS_THROUGH(Name, isPassThrough) \
+    if (isPassThrough) { \
+        Real_##Name = ::Name; \
+        skippedDetours++; \
+    } \
+    else { \
+        ATTACH(Name); \
+    }
+    // end #define ATTACH_UNLESS_PASS_THROUGH
+
     bool failed = false;
+    int skippedDetours = 0;
 
     error = DetourTransactionBegin();
     if (error != NO_ERROR) {
@@ -1180,7 +1230,8 @@ static bool DllProcessAttach()
     {
 #pragma warning( push )
 #pragma warning( disable : 5039)
-        ATTACH(CreateProcessA);
+        // CreateProcessW may inject the substitute process shim even when child processes are not monitored
+        ATTACH_UNLESS_PASS_THROUGH(CreateProcessA, !MonitorChildProcesses());
         ATTACH(CreateProcessW);
 
         if (GetProcessKind() != SpecialProcessKind::WinDbg) {
@@ -1195,7 +1246,7 @@ static bool DllProcessAttach()
 
             ATTACH(GetFileInformationByHandle);
             ATTACH(GetFileInformationByHandleEx);
-            ATTACH(SetFileInformationByHandle);
+            ATTACH_UNLESS_PASS_THROUGH(SetFileInformationByHandle, IgnoreSetFileInformationByHandle());
 
             ATTACH(CopyFileW);
             ATTACH(CopyFileA);
@@ -1233,6 +1284,8 @@ static bool DllProcessAttach()
             ATTACH(CreateDirectoryExA);
             ATTACH(RemoveDirectoryW);
             ATTACH(RemoveDirectoryA);
+            ATTACH(SetCurrentDirectoryW);
+            ATTACH(SetCurrentDirectoryA);
             ATTACH(DecryptFileW);
             ATTACH(DecryptFileA);
             ATTACH(EncryptFileW);
@@ -1253,10 +1306,10 @@ static bool DllProcessAttach()
             // on the Detoured_NtClose for more information 
             // on this function.
             ATTACH(NtClose);
-            ATTACH(ZwSetInformationFile);
+            ATTACH_UNLESS_PASS_THROUGH(ZwSetInformationFile, IgnoreZwRenameFileInformation() && IgnoreZwOtherFileInformation());
 
             ATTACH(CreatePipe);
-            ATTACH(DeviceIoControl);
+            ATTACH_UNLESS_PASS_THROUGH(DeviceIoControl, IgnoreDeviceIoControlGetReparsePoint());
 #pragma warning( pop )
         }
         else {
@@ -1278,6 +1331,10 @@ static bool DllProcessAttach()
         return false;
     }
 
+    if (skippedDetours > 0) {
+        Dbg(L"Not attached to %d functions whose detours the file access manifest makes pass-throughs.", skippedDetours);
+    }
+
     //
     // File APIs successfully detoured.
     //
@@ -1289,6 +1346,7 @@ static bool DllProcessAttach()
         g_BreakOnAccessDenied = true;
     }
 
+#undef ATTACH_UNLESS_PASS_THROUGH
 #undef ATTACH
 
     g_isAttached = true;
@@ -1427,6 +1485,15 @@ DllMain(
 #endif // DETOURS_SERVICES_NATIVES_LIBRARY
         return FALSE;
 
+    case DLL_THREAD_DETACH:
+        ReleaseThreadReportBuffer();
+#ifdef DETOURS_SERVICES_NATIVES_LIBRARY
+        CanonicalizedPath::ReleaseThreadCache();
+#endif // DETOURS_SERVICES_NATIVES_LIBRARY
+        // Last, as releasing the other thread caches frees memory
+        dd_release_thread_cache();
+        return TRUE;
+
     default:
         return TRUE;
     }
@@ -160,15 +160,26 @@ struct BreakawayChildProcess
     std::wstring ProcessName;
     std::wstring RequiredCommandLineArgsSubstring;
     bool CommandLineArgsSubstringContainmentIgnoreCase;
+    // RequiredCommandLineArgsSubstring lowercased, when the containment ignores case. Lowercased arguments contain it
+    // if and only if the arguments contain RequiredCommandLineArgsSubstring ignoring case.
+    std::wstring LowercaseRequiredCommandLineArgsSubstring;
 
     BreakawayChildProcess(std::wstring processName, std::wstring requiredCommandLineArgsSubstring, bool commandLineArgsSubstringContainmentIgnoreCase)
     {
         ProcessName = processName;
         RequiredCommandLineArgsSubstring = requiredCommandLineArgsSubstring;
         CommandLineArgsSubstringContainmentIgnoreCase = commandLineArgsSubstringContainmentIgnoreCase;
+        if (commandLineArgsSubstringContainmentIgnoreCase)
+        {
+            LowercaseRequiredCommandLineArgsSubstring = requiredCommandLineArgsSubstring;
+            for (wchar_t& c : LowercaseRequiredCommandLineArgsSubstring)
+            {
+                c = (wchar_t)std::towlower(c);
+            }
+        }
     }
 
     BreakawayChildProcess(const BreakawayChildProcess &other)
         : BreakawayChildProcess(other.ProcessName, other.RequiredCommandLineArgsSubstring, other.CommandLineArgsSubstringContainmentIgnoreCase)
     {}
-};
\ No newline at end of file
+};
\ No newline at end of file
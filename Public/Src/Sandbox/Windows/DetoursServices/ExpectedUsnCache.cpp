@@ -0,0 +1,58 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include "stdafx.h"
+
+#include "ExpectedUsnCache.h"
+
+uint64_t ExpectedUsnCache::Hash(const wchar_t* path, size_t pathLength)
+{
+    // 64-bit FNV-1a over the path
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < pathLength; i++)
+    {
+        hash = (hash ^ (uint64_t)path[i]) * 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+bool ExpectedUsnCache::IsChecked(const wchar_t* path, USN usn)
+{
+    const size_t pathLength = wcslen(path);
+    const uint64_t hash = Hash(path, pathLength);
+    Stripe& stripe = m_stripes[(hash >> 32) % StripeCount];
+
+    const std::shared_lock<std::shared_mutex> lock(stripe.Lock);
+    auto it = stripe.Entries.find(hash);
+    return it != stripe.Entries.end()
+        && it->second.Epoch == m_epoch
+        && it->second.Usn == usn
+        && it->second.Path.length() == pathLength
+        && it->second.Path.compare(0, pathLength, path, pathLength) == 0;
+}
+
+void ExpectedUsnCache::Register(const wchar_t* path, USN usn)
+{
+    const size_t pathLength = wcslen(path);
+    const uint64_t hash = Hash(path, pathLength);
+    const uint64_t epoch = m_epoch;
+    Stripe& stripe = m_stripes[(hash >> 32) % StripeCount];
+
+    const std::unique_lock<std::shared_mutex> lock(stripe.Lock);
+    if (stripe.Entries.size() >= MaxEntriesPerStripe)
+    {
+        stripe.Entries.clear();
+    }
+
+    Entry& entry = stripe.Entries[hash];
+    entry.Epoch = epoch;
+    entry.Path.assign(path, pathLength);
+    entry.Usn = usn;
+}
+
+ExpectedUsnCache* ExpectedUsnCache::GetInstance()
+{
+    static ExpectedUsnCache s_singleton;
+    return &s_singleton;
+}
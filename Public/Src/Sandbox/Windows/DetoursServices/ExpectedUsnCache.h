@@ -0,0 +1,60 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+
+// Remembers the files whose USN this process already checked against the one expected by the manifest, so opening them again
+// doesn't need another FSCTL_READ_FILE_USN_DATA. Tools like compilers open the same inputs (headers, references) over and over,
+// and each of these opens used to query the USN of the file.
+// A file is remembered with the USN it had: a later open only skips the query when the manifest still expects that same USN.
+// Deleting, renaming or linking a file, or opening a file for write, invalidates all the files remembered so far.
+//
+// The cache is split into stripes, each with its own lock, like WriteAccessReportCache. Stripes are bounded: a stripe that is full is cleared.
+// All operations are thread-safe.
+class ExpectedUsnCache {
+public:
+    static ExpectedUsnCache* GetInstance();
+
+    // Whether the file at the given path was registered with the given USN since the last invalidation
+    bool IsChecked(const wchar_t* path, USN usn);
+
+    // Registers the USN just read from the file at the given path, which matched the expected one
+    void Register(const wchar_t* path, USN usn);
+
+    // Forgets all the files registered so far
+    void Invalidate() { m_epoch++; }
+
+private:
+    ExpectedUsnCache() = default;
+    ExpectedUsnCache(const ExpectedUsnCache&) = delete;
+    ExpectedUsnCache& operator = (const ExpectedUsnCache&) = delete;
+
+    static const size_t StripeCount = 16;
+    static const size_t MaxEntriesPerStripe = 1024;
+
+    struct Entry {
+        uint64_t Epoch;
+        std::wstring Path;
+        USN Usn;
+    };
+
+    // Entries are keyed by a hash of their path. Entries with the same hash replace each other.
+    struct alignas(64) Stripe {
+        std::shared_mutex Lock;
+        std::unordered_map<uint64_t, Entry> Entries;
+    };
+
+    static uint64_t Hash(const wchar_t* path, size_t pathLength);
+
+    // Incremented by Invalidate: entries registered before are ignored from then on
+    std::atomic<uint64_t> m_epoch{ 0 };
+
+    Stripe m_stripes[StripeCount];
+};
@@ -0,0 +1,79 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include "stdafx.h"
+
+#include "FileIdPathCache.h"
+
+uint64_t FileIdPathCache::Hash(uint64_t volumeSerialNumber, const BYTE* fileId, size_t fileIdLength)
+{
+    // 64-bit FNV-1a over the serial number of the volume, then the id
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < sizeof(volumeSerialNumber); i++)
+    {
+        hash = (hash ^ ((volumeSerialNumber >> (8 * i)) & 0xFF)) * 1099511628211ULL;
+    }
+
+    for (size_t i = 0; i < fileIdLength; i++)
+    {
+        hash = (hash ^ (uint64_t)fileId[i]) * 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+bool FileIdPathCache::TryGetPath(uint64_t volumeSerialNumber, const BYTE* fileId, size_t fileIdLength, std::wstring& path)
+{
+    if (fileIdLength > MaxFileIdLength)
+    {
+        return false;
+    }
+
+    const uint64_t hash = Hash(volumeSerialNumber, fileId, fileIdLength);
+    Stripe& stripe = m_stripes[(hash >> 32) % StripeCount];
+
+    const std::shared_lock<std::shared_mutex> lock(stripe.Lock);
+    auto it = stripe.Entries.find(hash);
+    if (it == stripe.Entries.end()
+        || it->second.Epoch != m_epoch
+        || it->second.VolumeSerialNumber != volumeSerialNumber
+        || it->second.FileIdLength != fileIdLength
+        || memcmp(it->second.FileId, fileId, fileIdLength) != 0)
+    {
+        return false;
+    }
+
+    path = it->second.Path;
+    return true;
+}
+
+void FileIdPathCache::Register(uint64_t volumeSerialNumber, const BYTE* fileId, size_t fileIdLength, const std::wstring& path)
+{
+    if (fileIdLength > MaxFileIdLength)
+    {
+        return;
+    }
+
+    const uint64_t hash = Hash(volumeSerialNumber, fileId, fileIdLength);
+    const uint64_t epoch = m_epoch;
+    Stripe& stripe = m_stripes[(hash >> 32) % StripeCount];
+
+    const std::unique_lock<std::shared_mutex> lock(stripe.Lock);
+    if (stripe.Entries.size() >= MaxEntriesPerStripe)
+    {
+        stripe.Entries.clear();
+    }
+
+    Entry& entry = stripe.Entries[hash];
+    entry.Epoch = epoch;
+    entry.VolumeSerialNumber = volumeSerialNumber;
+    memcpy(entry.FileId, fileId, fileIdLength);
+    entry.FileIdLength = fileIdLength;
+    entry.Path = path;
+}
+
+FileIdPathCache* FileIdPathCache::GetInstance()
+{
+    static FileIdPathCache s_singleton;
+    return &s_singleton;
+}
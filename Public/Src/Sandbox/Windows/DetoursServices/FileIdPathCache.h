@@ -0,0 +1,64 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+
+// Remembers the paths that files opened by id were found at, so opening them by id again doesn't need to open the file and query its
+// final path before the policy can be looked up (see PathFromObjectAttributesViaId). Files are identified by the serial number of their
+// volume and the id they are opened by (64 or 128 bits).
+// Deleting, renaming or linking a file invalidates all the files remembered so far: the path of a file (or of its parents) may have changed,
+// and the id of a deleted file may be given to a new one.
+//
+// The cache is split into stripes, each with its own lock, like ExpectedUsnCache. Stripes are bounded: a stripe that is full is cleared.
+// All operations are thread-safe.
+class FileIdPathCache {
+public:
+    static const size_t MaxFileIdLength = 16;
+
+    static FileIdPathCache* GetInstance();
+
+    // Copies into 'path' the path the given file was registered with since the last invalidation. Returns whether there was one.
+    bool TryGetPath(uint64_t volumeSerialNumber, const BYTE* fileId, size_t fileIdLength, std::wstring& path);
+
+    // Registers the final path just queried from the given file
+    void Register(uint64_t volumeSerialNumber, const BYTE* fileId, size_t fileIdLength, const std::wstring& path);
+
+    // Forgets all the files registered so far
+    void Invalidate() { m_epoch++; }
+
+private:
+    FileIdPathCache() = default;
+    FileIdPathCache(const FileIdPathCache&) = delete;
+    FileIdPathCache& operator = (const FileIdPathCache&) = delete;
+
+    static const size_t StripeCount = 16;
+    static const size_t MaxEntriesPerStripe = 1024;
+
+    struct Entry {
+        uint64_t Epoch;
+        uint64_t VolumeSerialNumber;
+        BYTE FileId[MaxFileIdLength];
+        size_t FileIdLength;
+        std::wstring Path;
+    };
+
+    // Entries are keyed by a hash of their volume and id. Entries with the same hash replace each other.
+    struct alignas(64) Stripe {
+        std::shared_mutex Lock;
+        std::unordered_map<uint64_t, Entry> Entries;
+    };
+
+    static uint64_t Hash(uint64_t volumeSerialNumber, const BYTE* fileId, size_t fileIdLength);
+
+    // Incremented by Invalidate: entries registered before are ignored from then on
+    std::atomic<uint64_t> m_epoch{ 0 };
+
+    Stripe m_stripes[StripeCount];
+};
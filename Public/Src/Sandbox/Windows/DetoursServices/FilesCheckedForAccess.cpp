@@ -4,30 +4,213 @@
 #include "FilesCheckedForAccess.h"
 #include "string.h"
 
-FilesCheckedForAccess::FilesCheckedForAccess()
-{
-}
 
-bool FilesCheckedForAccess::TryRegisterPath(const CanonicalizedPathType& path) {
-    const std::unique_lock<std::shared_mutex> lock(m_lock);
+// Size of the blocks entries are allocated from
+static const size_t s_entryBlockSize = 16 * 1024;
+
+// We only want case insensitive comparisons on Windows
+static inline PathChar FoldCase(PathChar c) {
 #if _WIN32
-    auto result = m_pathSet.insert(path.GetPathString());
+    return (PathChar)towlower(c);
 #else
-    auto result = m_pathSet.insert(path);
+    return c;
 #endif
+}
 
-    return result.second;
+static inline bool IsSamePath(const PathChar* left, const PathChar* right, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        if (left[i] != right[i] && FoldCase(left[i]) != FoldCase(right[i])) {
+            return false;
+        }
+    }
+
+    return true;
 }
 
-bool FilesCheckedForAccess::IsRegistered(const CanonicalizedPathType& path) {
-    const std::shared_lock<std::shared_mutex> lock(m_lock);
+static inline const PathChar* GetChars(const CanonicalizedPathType& path) {
+#if _WIN32
+    return path.GetPathString();
+#else
+    return path.c_str();
+#endif
+}
+
+static inline size_t GetLength(const CanonicalizedPathType& path) {
 #if _WIN32
-    auto result = m_pathSet.find(path.GetPathString());
+    return path.Length();
 #else
-    auto result = m_pathSet.find(path);
+    return path.length();
 #endif
+}
+
+FilesCheckedForAccess::Table::Table() {
+    for (std::atomic<const Entry*>& slot : m_slots) {
+        slot.store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+FilesCheckedForAccess::Table::~Table() {
+    while (m_blocks != nullptr) {
+        Block* next = m_blocks->Next;
+        delete[] reinterpret_cast<char*>(m_blocks);
+        m_blocks = next;
+    }
+}
+
+void* FilesCheckedForAccess::Table::Allocate(size_t size) {
+    size = (size + 7) & ~(size_t)7;
+
+    if (m_blocks == nullptr || m_blocks->Size - m_blocks->Used < size) {
+        // Oversized requests (very long paths) get a block of their own
+        const size_t blockSize = size + sizeof(Block) > s_entryBlockSize ? size + sizeof(Block) : s_entryBlockSize;
+        Block* block = reinterpret_cast<Block*>(new char[blockSize]);
+        block->Next = m_blocks;
+        block->Size = blockSize;
+        block->Used = sizeof(Block);
+        m_blocks = block;
+    }
+
+    void* result = reinterpret_cast<char*>(m_blocks) + m_blocks->Used;
+    m_blocks->Used += size;
+    return result;
+}
+
+const FilesCheckedForAccess::Entry* FilesCheckedForAccess::Table::Find(uint64_t hash, const PathChar* path, size_t length) const {
+    // Entries are never removed from a table, so the probe sequence of a path ends at the first empty slot
+    const size_t mask = SlotsPerTable - 1;
+    for (size_t i = 0, index = hash & mask; i < SlotsPerTable; i++, index = (index + 1) & mask) {
+        const Entry* entry = m_slots[index].load(std::memory_order_acquire);
+        if (entry == nullptr) {
+            return nullptr;
+        }
+
+        if (entry->Hash == hash && entry->Length == length && IsSamePath(entry->Chars(), path, length)) {
+            return entry;
+        }
+    }
+
+    return nullptr;
+}
+
+bool FilesCheckedForAccess::Table::Insert(uint64_t hash, const PathChar* path, size_t length) {
+    if (m_count >= MaxEntriesPerTable) {
+        return false;
+    }
+
+    Entry* entry = reinterpret_cast<Entry*>(Allocate(sizeof(Entry) + length * sizeof(PathChar)));
+    entry->Hash = hash;
+    entry->Length = length;
+    memcpy(const_cast<PathChar*>(entry->Chars()), path, length * sizeof(PathChar));
+
+    const size_t mask = SlotsPerTable - 1;
+    size_t index = hash & mask;
+    while (m_slots[index].load(std::memory_order_relaxed) != nullptr) {
+        index = (index + 1) & mask;
+    }
+
+    // Publishes the entry: readers that see it also see its contents
+    m_slots[index].store(entry, std::memory_order_release);
+    m_count++;
+    return true;
+}
+
+FilesCheckedForAccess::FilesCheckedForAccess() {
+}
+
+FilesCheckedForAccess::~FilesCheckedForAccess() {
+    for (Shard& shard : m_shards) {
+        delete shard.Young.load();
+        delete shard.Old.load();
+        delete shard.Retired;
+    }
+}
+
+uint64_t FilesCheckedForAccess::Hash(const PathChar* path, size_t length) {
+    // 64-bit FNV-1a over the case folded characters
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (uint64_t)FoldCase(path[i])) * 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+void FilesCheckedForAccess::TryDeleteRetired(Shard& shard) {
+    // A reader increments the count before loading the table pointers, so once the retired table is unreachable from the shard,
+    // no reader can still see it if the count is zero
+    if (shard.Retired != nullptr && shard.Readers.load() == 0) {
+        delete shard.Retired;
+        shard.Retired = nullptr;
+    }
+}
+
+bool FilesCheckedForAccess::TryRegisterPath(const CanonicalizedPathType& path) {
+    const PathChar* chars = GetChars(path);
+    const size_t length = GetLength(path);
+    const uint64_t hash = Hash(chars, length);
+    Shard& shard = m_shards[(hash >> 32) % ShardCount];
+
+    // Most paths are registered over and over while they are recent: this is a lookup in the young table, without taking the lock
+    shard.Readers.fetch_add(1);
+    const Table* recent = shard.Young.load();
+    const bool found = recent != nullptr && recent->Find(hash, chars, length) != nullptr;
+    shard.Readers.fetch_sub(1);
+
+    if (found) {
+        return false;
+    }
+
+    const std::lock_guard<std::mutex> lock(shard.Lock);
+
+    // Tables are only dropped under the lock, so there is no need to count as a reader anymore
+    Table* young = shard.Young.load();
+    Table* old = shard.Old.load();
+    if (young != nullptr && young->Find(hash, chars, length) != nullptr) {
+        return false;
+    }
+
+    // A path found in the old table was registered before: it is moved to the young table so it is remembered a while longer
+    const bool registered = old != nullptr && old->Find(hash, chars, length) != nullptr;
+
+    if (young == nullptr) {
+        young = new Table();
+        shard.Young.store(young);
+    }
+
+    if (!young->Insert(hash, chars, length)) {
+        // The young table is full. The old table can only be dropped when the one dropped before it is not in use anymore:
+        // otherwise the path is just not remembered
+        TryDeleteRetired(shard);
+        if (shard.Retired != nullptr) {
+            return !registered;
+        }
+
+        shard.Retired = old;
+        shard.Old.store(young);
+        young = new Table();
+        shard.Young.store(young);
+        TryDeleteRetired(shard);
+
+        young->Insert(hash, chars, length);
+    }
+
+    return !registered;
+}
+
+bool FilesCheckedForAccess::IsRegistered(const CanonicalizedPathType& path) {
+    const PathChar* chars = GetChars(path);
+    const size_t length = GetLength(path);
+    const uint64_t hash = Hash(chars, length);
+    Shard& shard = m_shards[(hash >> 32) % ShardCount];
+
+    shard.Readers.fetch_add(1);
+    const Table* young = shard.Young.load();
+    const Table* old = shard.Old.load();
+    const bool result = (young != nullptr && young->Find(hash, chars, length) != nullptr)
+        || (old != nullptr && old->Find(hash, chars, length) != nullptr);
+    shard.Readers.fetch_sub(1);
 
-    return (result != m_pathSet.end());
+    return result;
 }
 
 FilesCheckedForAccess* FilesCheckedForAccess::GetInstance() {
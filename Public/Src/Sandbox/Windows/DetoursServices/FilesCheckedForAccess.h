@@ -12,6 +12,8 @@
     typedef std::string CanonicalizedPathType;
 #endif // _WIN32
 
+#include <atomic>
+#include <cstdint>
 #include <unordered_set>
 #include <cwctype>
 #include <mutex>
@@ -24,6 +26,12 @@
 
 // Keeps a set of case-insensitive paths that were checked for access 
 // All operations are thread-safe
+//
+// The set is split into shards selected by a hash of the path, each with its own lock for writers. Readers take no lock: paths are
+// kept in open addressing tables of entries that are immutable once published, allocated from an arena owned by the table.
+// Memory is bounded with an approximate LRU: each shard has a young and an old table. Paths are added to the young table, and
+// registering a path found in the old one moves it to the young one. When the young table is full, the old table is dropped and
+// the young one becomes the old one. A forgotten path is simply reported as not registered the next time it is registered.
 class FilesCheckedForAccess {
 public:
     static FilesCheckedForAccess* GetInstance();
@@ -32,19 +40,71 @@ public:
     // Returns whether the path was not registered before
     bool TryRegisterPath(const CanonicalizedPathType& path);
     
-    // Returns whether the given path is registered.
+    // Returns whether the given path is registered. Wait-free.
     bool IsRegistered(const CanonicalizedPathType& path);
 
 private:
     FilesCheckedForAccess();
+    ~FilesCheckedForAccess();
     FilesCheckedForAccess(const FilesCheckedForAccess&) = delete;
     FilesCheckedForAccess& operator = (const FilesCheckedForAccess&) = delete;
 
-// We only want case insensitive comparisons on Windows
-#if _WIN32
-    std::unordered_set<std::wstring, CaseInsensitiveStringHasher, CaseInsensitiveStringComparer> m_pathSet;
-#else
-    std::unordered_set<std::string> m_pathSet;
-#endif
-    std::shared_mutex m_lock;
+    static const size_t ShardCount = 16;
+    // Both a power of 2, and the load factor of a table is kept under 1/2 so probe sequences stay short
+    static const size_t SlotsPerTable = 2048;
+    static const size_t MaxEntriesPerTable = SlotsPerTable / 2;
+
+    // A registered path. The characters follow the structure.
+    struct Entry {
+        uint64_t Hash;
+        size_t Length;
+
+        inline const PathChar* Chars() const { return reinterpret_cast<const PathChar*>(this + 1); }
+    };
+
+    // An open addressing table of entries, which owns them. Only shard writers modify a table, under the lock of the shard.
+    class Table {
+    public:
+        Table();
+        ~Table();
+
+        Table(const Table&) = delete;
+        Table& operator = (const Table&) = delete;
+
+        const Entry* Find(uint64_t hash, const PathChar* path, size_t length) const;
+
+        // Returns false when the table is full
+        bool Insert(uint64_t hash, const PathChar* path, size_t length);
+
+    private:
+        struct Block {
+            Block* Next;
+            size_t Size;
+            size_t Used;
+        };
+
+        void* Allocate(size_t size);
+
+        std::atomic<const Entry*> m_slots[SlotsPerTable];
+        size_t m_count = 0;
+        Block* m_blocks = nullptr;
+    };
+
+    struct alignas(64) Shard {
+        // Taken by writers only
+        std::mutex Lock;
+        // Readers currently looking at the tables of the shard. A dropped table is only deleted once there is none.
+        std::atomic<uint32_t> Readers{ 0 };
+        std::atomic<Table*> Young{ nullptr };
+        std::atomic<Table*> Old{ nullptr };
+        // A dropped table that readers may still be looking at
+        Table* Retired = nullptr;
+    };
+
+    static uint64_t Hash(const PathChar* path, size_t length);
+
+    // Deletes the retired table of the shard, if no reader can still see it. Must be called under the lock of the shard.
+    static void TryDeleteRetired(Shard& shard);
+
+    Shard m_shards[ShardCount];
 };
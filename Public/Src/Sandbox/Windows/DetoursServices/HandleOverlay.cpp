@@ -3,346 +3,402 @@
 
 #include "stdafx.h"
 #include "HandleOverlay.h"
-#include <map>
+#include "DetoursPerformanceCounters.h"
 #include "buildXL_mem.h"
 
-// A pre-allocated list with entries to be used to accumulate the closed handles by NtClose.
-// During testing there were never more than 2 entries in this list on SelfHost and Office builds.
-// Allocating 1000 should be safe we are not skipping handles. If we need more than 1000,
-// a warning will be issued and the handle will not removed from the fie handle map.
-// In such case we will behave exactly as we behave now - without this change we don't remove any handles from the map.
-// If the list is full we will not remove the handle from the map. If that happens, increase the preallocated list size.
-#define CLOSED_HANDLES_POOL_ENTRIES 2000
-#define NT_CLOSE_CLEANUP_THRESHOLD 500
-#define LARGE_LIST_MULTIPLIER 20
+// The overlay map is a concurrent open-addressing hash table keyed by handle value.
+//
+// A slot is claimed by a handle value the first time that value is registered and keeps it for the lifetime of the process:
+// closing a handle only clears the overlay of its slot. Handle values are recycled by the OS, so the number of distinct keys
+// stays close to the peak number of open handles, and since keys never move, a lookup that finds an empty slot knows the key
+// is not in the table. When the probe window of a key is full, the key goes to the next (bigger) table of the chain.
+// The first table is only allocated when the first handle gets registered, so processes that never register one don't pay for it.
+// The number of slots allocated is reported as g_detoursAllocatedNoLockConcurentPoolEntries, and the registrations that spilled past
+// the first table are counted as performance counters.
+//
+// None of the operations takes a lock, and closing a handle never allocates or frees memory. This matters because NtClose is
+// called while holding the OS heap lock (e.g., by RtlFreeHeap), so taking a lock or touching a heap there is prone to deadlocks.
+//
+// The overlays removed from the table are reclaimed with epochs: a removed node is only freed once every lookup that may have
+// loaded it from its slot is known to be complete. Lookups announce themselves in the counter of the current epoch, and the epoch
+// only advances when the lookups of the previous epoch are gone. Nodes retired in epoch E are freed when the epoch advances from
+// E + 2 to E + 3. Reclamation happens on registration, which is allowed to allocate and free memory.
+
+#define HANDLE_OVERLAY_INITIAL_CAPACITY 4096
+#define HANDLE_OVERLAY_GROWTH_FACTOR 4
+#define HANDLE_OVERLAY_MAX_PROBES 64
+#define HANDLE_OVERLAY_EPOCHS 3
+#define HANDLE_POLICY_INTERN_SLOTS 4096
+#define HANDLE_POLICY_INTERN_STRIPES 64
+
+extern volatile LONG g_detoursAllocatedNoLockConcurentPoolEntries;
+extern volatile LONG64 g_detoursMaxHandleHeapEntries;
+extern volatile LONG64 g_detoursHandleHeapEntries;
+
+// Holds a reference to an overlay while it is in the table. The entry links retired nodes, so retiring a node doesn't allocate.
+typedef struct _HANDLE_OVERLAY_NODE {
+    SLIST_ENTRY RetireEntry;
+    HandleOverlayRef Overlay;
+} HANDLE_OVERLAY_NODE, *PHANDLE_OVERLAY_NODE;
+
+typedef struct _HANDLE_OVERLAY_SLOT {
+    HANDLE volatile Handle;
+    PHANDLE_OVERLAY_NODE volatile Node;
+} HANDLE_OVERLAY_SLOT, *PHANDLE_OVERLAY_SLOT;
+
+typedef struct _HANDLE_OVERLAY_TABLE {
+    struct _HANDLE_OVERLAY_TABLE* volatile Next;
+    size_t Capacity;
+    HANDLE_OVERLAY_SLOT Slots[1];
+} HANDLE_OVERLAY_TABLE, *PHANDLE_OVERLAY_TABLE;
 
 bool g_initialized;
-CRITICAL_SECTION g_handleOverlayLock;
+static PHANDLE_OVERLAY_TABLE volatile g_handleOverlayTable = nullptr;
 
-class HandleOverlayMap;
-HandleOverlayMap* g_handleOverlayMap;
-PSLIST_HEADER g_pClosedHandles = nullptr;
+static volatile LONG64 g_handleOverlayEpoch = 0;
+static volatile LONG g_handleOverlayEpochReaders[HANDLE_OVERLAY_EPOCHS];
+static PSLIST_HEADER g_retiredHandleOverlays[HANDLE_OVERLAY_EPOCHS];
+static volatile LONG g_handleOverlayReclaiming = 0;
 
-// Used to pre-create entries for closed handles in NtClose, 
-// so we can clean them from the overlay map when it is safe to get the lock.
-PSLIST_HEADER g_pClosedHandlesPool = nullptr;
+// Handles are multiples of 4, so the low bits carry no information
+static inline size_t GetSlotIndex(HANDLE handle, size_t capacity) {
+    return (size_t)((((ULONG64)(ULONG_PTR)handle >> 2) * 0x9E3779B97F4A7C15ULL) >> 32) & (capacity - 1);
+}
 
-extern volatile LONG g_detoursAllocatedNoLockConcurentPoolEntries;
-extern volatile LONG64 g_detoursMaxHandleHeapEntries;
-extern volatile LONG64 g_detoursHandleHeapEntries;
+// Tables are allocated zeroed straight from the OS and never freed: slots are claimed for the lifetime of the process.
+static PHANDLE_OVERLAY_TABLE AllocateTable(size_t capacity) {
+    size_t size = offsetof(HANDLE_OVERLAY_TABLE, Slots) + capacity * sizeof(HANDLE_OVERLAY_SLOT);
+    PHANDLE_OVERLAY_TABLE table = (PHANDLE_OVERLAY_TABLE)VirtualAlloc(nullptr, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if (table == nullptr)
+    {
+        Dbg(L"Failed to allocate a handle overlay table of %Iu entries, error: %d", capacity, GetLastError());
+        return nullptr;
+    }
 
-static volatile LONG g_usedPoolEntries = 0;
+    table->Capacity = capacity;
+    return table;
+}
+
+// Links a new table at the end of the chain, where 'link' is the head of the chain or the Next of its last table.
+// Returns the table linked there, which is the one of another thread if it linked its table first, or null when out of memory.
+static PHANDLE_OVERLAY_TABLE LinkTable(PHANDLE_OVERLAY_TABLE volatile* link, size_t capacity) {
+    PHANDLE_OVERLAY_TABLE table = AllocateTable(capacity);
+    if (table == nullptr)
+    {
+        return *link;
+    }
+
+    PHANDLE_OVERLAY_TABLE current = (PHANDLE_OVERLAY_TABLE)InterlockedCompareExchangePointer((PVOID volatile*)link, table, nullptr);
+    if (current != nullptr)
+    {
+        VirtualFree(table, 0, MEM_RELEASE);
+        return current;
+    }
 
-typedef struct _HANDLE_TO_CLOSE {
-    SLIST_ENTRY ItemEntry;
-    HANDLE Handle;
-} HANDLE_TO_CLOSE, *PHANDLE_TO_CLOSE;
+    InterlockedAdd(&g_detoursAllocatedNoLockConcurentPoolEntries, (LONG)capacity);
+    if (link != &g_handleOverlayTable)
+    {
+        CountDetoursEvent(DetoursEvent::HandleOverlayTableGrowth);
+    }
+
+    return table;
+}
+
+// Finds the slot claimed by the given handle. If there is none and claim is true, claims a slot for it (growing the table chain if needed).
+static PHANDLE_OVERLAY_SLOT FindSlot(HANDLE handle, bool claim) {
+    PHANDLE_OVERLAY_TABLE first = g_handleOverlayTable;
+    if (first == nullptr)
+    {
+        if (!claim)
+        {
+            return nullptr;
+        }
 
-class HandleOverlayMap {
-public:
-    void MapRegisterHandleOverlay(HANDLE handle, HandleOverlayRef& newRef) {
-        
-        // Now, insert (move-assign to empty) or replace (destruct then move-assign). Note that despite perhaps
-        // holding g_handleOverlayLock, we require here that shared_ptr is thread safe for refcount changes (as documented).
-        // When destructing, we need to atomically decrement the ref-count ; some other routine may still be using another ref to the same overlay.
-        m_map[handle] = std::move(newRef);
+        first = LinkTable(&g_handleOverlayTable, HANDLE_OVERLAY_INITIAL_CAPACITY);
+    }
 
-        // If we are tracking process data, track also the HandleOverlay map entries.
-        if (ShouldLogProcessData())
+    for (PHANDLE_OVERLAY_TABLE table = first; table != nullptr; table = table->Next)
+    {
+        size_t index = GetSlotIndex(handle, table->Capacity);
+        for (size_t probe = 0; probe < HANDLE_OVERLAY_MAX_PROBES; probe++, index = (index + 1) & (table->Capacity - 1))
         {
-            LONG64 entriesCount = InterlockedIncrement64(&g_detoursHandleHeapEntries);
-            LONG64 localMax = InterlockedAdd64(&g_detoursMaxHandleHeapEntries, 0);
+            PHANDLE_OVERLAY_SLOT slot = &table->Slots[index];
+            HANDLE current = slot->Handle;
+            if (current == nullptr)
+            {
+                if (!claim)
+                {
+                    return nullptr;
+                }
+
+                current = InterlockedCompareExchangePointer(&slot->Handle, handle, nullptr);
+                if (current == nullptr)
+                {
+                    if (table != first)
+                    {
+                        CountDetoursEvent(DetoursEvent::HandleOverlaySpilledRegistration);
+                    }
+
+                    return slot;
+                }
+
+                // Another thread claimed this slot first, 'current' now holds its handle
+            }
 
-            // Update the global g_detoursMaxHandleHeapEntries heap only if the current allocated entries is bigger than what is recorded max.
-            while (entriesCount > localMax)
+            if (current == handle)
             {
-                InterlockedCompareExchange64(&g_detoursMaxHandleHeapEntries, entriesCount, localMax);
-                localMax = InterlockedAdd64(&g_detoursMaxHandleHeapEntries, 0);
+                return slot;
             }
         }
-    }
 
-    HandleOverlayRef TryLookupHandleOverlay(HANDLE handle) {
-        auto iter = m_map.find(handle);
-        if (iter == m_map.end()) {
-            return HandleOverlayRef();
-        }
-        else {
-            // Create a new ref (refcount increases) via copy-construction of the existing one.
-            return HandleOverlayRef(iter->second);
+        if (table->Next == nullptr && claim)
+        {
+            if (LinkTable(&table->Next, table->Capacity * HANDLE_OVERLAY_GROWTH_FACTOR) == nullptr)
+            {
+                return nullptr;
+            }
         }
     }
 
-    void CloseHandleOverlay(HANDLE handle) {
-        size_t removed = m_map.erase(handle);
-        if (removed != 0 && ShouldLogProcessData())
+    return nullptr;
+}
+
+// Announces a lookup in the current epoch. Returns the index of the counter to pass to ExitEpoch.
+static LONG EnterEpoch() {
+    while (true)
+    {
+        LONG64 epoch = g_handleOverlayEpoch;
+        LONG index = (LONG)(epoch % HANDLE_OVERLAY_EPOCHS);
+        InterlockedIncrement(&g_handleOverlayEpochReaders[index]);
+
+        // Interlocked operations are full barriers, so if the epoch did not move, a reclaimer will see this lookup
+        if (g_handleOverlayEpoch == epoch)
         {
-            InterlockedAdd64(&g_detoursHandleHeapEntries, -((LONG64)removed));
+            return index;
         }
-    }
-
-private:
-    std::map<HANDLE, HandleOverlayRef> m_map;
-};
 
-// Holds g_handleOverlayLock
-struct HandleOverlayLockGuard {
-    HandleOverlayLockGuard() {
-        assert(g_initialized);
-        EnterCriticalSection(&g_handleOverlayLock);
+        InterlockedDecrement(&g_handleOverlayEpochReaders[index]);
     }
+}
 
-    ~HandleOverlayLockGuard() {
-        LeaveCriticalSection(&g_handleOverlayLock);
-    }
+static void ExitEpoch(LONG index) {
+    InterlockedDecrement(&g_handleOverlayEpochReaders[index]);
+}
 
-    // This is a member function to make sure we always get the map inside a lock.
-    inline HandleOverlayMap* GetGlobalOverlayMap() {
-        assert(g_handleOverlayMap != nullptr);
-        return g_handleOverlayMap;
-    }
-};
-
-static void PopulateNtCloseListPool()
-{
-#if MEASURE_DETOURED_NT_CLOSE_IMPACT
-   ULONGLONG startTime = GetTickCount64();
-#endif // MEASURE_DETOURED_NT_CLOSE_IMPACT
-    unsigned allocationSize = CLOSED_HANDLES_POOL_ENTRIES;
-    if (UseLargeNtClosePreallocatedList())
+// Hands a node removed from its slot over to the reclamation. Doesn't allocate or free memory.
+static void RetireNode(PHANDLE_OVERLAY_NODE node) {
+    // The epoch must be read after the node was removed from its slot
+    LONG64 epoch = InterlockedAdd64(&g_handleOverlayEpoch, 0);
+    InterlockedPushEntrySList(g_retiredHandleOverlays[epoch % HANDLE_OVERLAY_EPOCHS], &node->RetireEntry);
+}
+
+// Frees the nodes retired two epochs ago and advances the epoch, unless there are still lookups in the previous epoch.
+static void ReclaimRetiredNodes() {
+    // A single reclaimer at a time: a reclaimer that fell behind could otherwise free the nodes retired in the current epoch
+    if (InterlockedCompareExchange(&g_handleOverlayReclaiming, 1, 0) != 0)
     {
-        // Allocate a large list.
-        allocationSize *= LARGE_LIST_MULTIPLIER;
+        return;
     }
 
-    for (unsigned i = 0; i < allocationSize; i++)
+    LONG64 epoch = g_handleOverlayEpoch;
+    if (g_handleOverlayEpochReaders[(epoch + HANDLE_OVERLAY_EPOCHS - 1) % HANDLE_OVERLAY_EPOCHS] == 0)
     {
-        PHANDLE_TO_CLOSE pPoolHandleEntry = (PHANDLE_TO_CLOSE)_dd_aligned_malloc(sizeof(HANDLE_TO_CLOSE), MEMORY_ALLOCATION_ALIGNMENT);
-        if (pPoolHandleEntry == nullptr)
+        // The list of epoch + 1 holds the nodes retired in epoch - 2 (or before, by a slow retirer). The lookups of epoch - 2 were
+        // gone when the epoch advanced, and the ones of epoch - 1 are gone now, so nobody can still use these nodes.
+        PSLIST_ENTRY entry = InterlockedFlushSList(g_retiredHandleOverlays[(epoch + 1) % HANDLE_OVERLAY_EPOCHS]);
+        InterlockedExchange64(&g_handleOverlayEpoch, epoch + 1);
+
+        while (entry != nullptr)
         {
-            Dbg(L"Memory alloc failed for g_pClosedHandlesPool node 0x%p", g_pClosedHandlesPool);
+            PHANDLE_OVERLAY_NODE node = CONTAINING_RECORD(entry, HANDLE_OVERLAY_NODE, RetireEntry);
+            entry = entry->Next;
+            node->~HANDLE_OVERLAY_NODE();
+            _dd_aligned_free(node);
         }
-        else
-        {
-            pPoolHandleEntry->Handle = INVALID_HANDLE_VALUE;
+    }
 
-            // Populate the pool
-            InterlockedPushEntrySList(g_pClosedHandlesPool, &(pPoolHandleEntry->ItemEntry));
-            InterlockedIncrement(&g_detoursAllocatedNoLockConcurentPoolEntries);
+    InterlockedExchange(&g_handleOverlayReclaiming, 0);
+}
+
+static void TrackHandleOverlayEntries(LONG64 delta) {
+    // If we are tracking process data, track also the HandleOverlay map entries.
+    if (ShouldLogProcessData())
+    {
+        LONG64 entriesCount = InterlockedAdd64(&g_detoursHandleHeapEntries, delta);
+        LONG64 localMax = InterlockedAdd64(&g_detoursMaxHandleHeapEntries, 0);
+
+        // Update the global g_detoursMaxHandleHeapEntries heap only if the current allocated entries is bigger than what is recorded max.
+        while (entriesCount > localMax)
+        {
+            InterlockedCompareExchange64(&g_detoursMaxHandleHeapEntries, entriesCount, localMax);
+            localMax = InterlockedAdd64(&g_detoursMaxHandleHeapEntries, 0);
         }
     }
-#if MEASURE_DETOURED_NT_CLOSE_IMPACT
-    ULONGLONG endTime = GetTickCount64();
-    InterlockedExchangeAdd(&g_msTimeToPopulatePoolList, (LONG)(endTime - startTime));
-#endif // MEASURE_DETOURED_NT_CLOSE_IMPACT
-
 }
 
-// This is a routine that creates a background thread to close any NtClose accumulated handles.
-// The prebuild step of Office uses Perl and tons of pipe logging, without opening a file, so the
-// NtClose list drain logic doesn't kick in, thus creating a potential problem of having invalid 
-// handles in the map (handles that have been reused, but never cleaned up).
-DWORD WINAPI CleanupNtClosedHandles(LPVOID lpParam)
-{
-    UNREFERENCED_PARAMETER(lpParam);
-    if (UseExtraThreadToDrainNtClose())
+// Policies of the handles registered last, by hash of their path (see InternHandlePolicy). The slots only hold weak references, so
+// a policy goes away with the last overlay using it. A slot holds a single policy and is overwritten by the next path hashed to it:
+// this is a cache of the paths open, so collisions only cost a copy of the policy, as every registration did before.
+// Striped locks guard the slots: registrations are allowed to take locks, unlike closing a handle.
+static std::weak_ptr<const PolicyResult> g_internedHandlePolicies[HANDLE_POLICY_INTERN_SLOTS];
+static SRWLOCK g_internedHandlePolicyLocks[HANDLE_POLICY_INTERN_STRIPES];
+
+static size_t HashPath(CanonicalizedPath const& path) {
+    size_t hash = 14695981039346656037ULL;
+    wchar_t const* end = path.GetPathString() + path.Length();
+    for (wchar_t const* c = path.GetPathString(); c < end; c++)
     {
-        RemoveClosedHandles();
+        hash = (hash ^ *c) * 1099511628211ULL;
     }
 
-    return 0;
+    return hash;
 }
 
-void StartCleanupNtClosedHandlesThread()
-{
-    HANDLE threadHandle = CreateThread(
-        NULL,
-        0,
-        CleanupNtClosedHandles,
-        nullptr,
-        0,
-        nullptr);
-    
-    if (threadHandle == INVALID_HANDLE_VALUE)
+// Returns a policy equivalent to the given one, shared with the overlays registered before for the same path when there are some.
+static HandlePolicyRef InternHandlePolicy(PolicyResult const& policy) {
+    if (policy.GetCanonicalizedPath().IsNull())
     {
-        Dbg(L"Warning: Could not create CleanupNtClosedHandlesThread.");
+        return std::make_shared<const PolicyResult>(policy);
     }
-    else
+
+    size_t index = HashPath(policy.GetCanonicalizedPath()) & (HANDLE_POLICY_INTERN_SLOTS - 1);
+    PSRWLOCK lock = &g_internedHandlePolicyLocks[index % HANDLE_POLICY_INTERN_STRIPES];
+
+    AcquireSRWLockShared(lock);
+    HandlePolicyRef interned = g_internedHandlePolicies[index].lock();
+    ReleaseSRWLockShared(lock);
+
+    if (interned != nullptr && interned->IsEquivalentTo(policy))
     {
-        SetThreadPriority(threadHandle, THREAD_PRIORITY_HIGHEST);
+        CountDetoursEvent(DetoursEvent::HandleOverlaySharedPolicy);
+        return interned;
     }
+
+    // Copy outside of the lock. If another thread interned the same policy meanwhile, ours replaces it: both stay valid.
+    // Not allocated along with its reference count (as make_shared would), so a stale slot only keeps the count alive.
+    HandlePolicyRef copy(new PolicyResult(policy));
+
+    AcquireSRWLockExclusive(lock);
+    g_internedHandlePolicies[index] = copy;
+    ReleaseSRWLockExclusive(lock);
+
+    return copy;
 }
 
 void InitializeHandleOverlay() {
-
     assert(!g_initialized);
-    InitializeCriticalSection(&g_handleOverlayLock);
-    // Always create the OverlayMap.This is called from DllAttach, so it is inside alock already.
-    // Doing it here, we save check and creating the map inside the GetOverlayMap.
-    g_handleOverlayMap = new HandleOverlayMap();
-
-    // The NtClose(d) handles are in the g_pClosedHandles. (It is a lock free list.)
-    // Since allocation of memory is unsafe inside the NtClose execution path (there should
-    // not be locks on this path), preallocate a list of nodes to be used as a pool - g_pClosedHandlesPool.
-    g_pClosedHandles = (PSLIST_HEADER)_dd_aligned_malloc(sizeof(SLIST_HEADER), MEMORY_ALLOCATION_ALIGNMENT);
-    if (g_pClosedHandles == nullptr)
+
+    for (int i = 0; i < HANDLE_OVERLAY_EPOCHS; i++)
     {
-        Dbg(L"Allocation for g_pClosedHandles failed");
-    }
+        g_retiredHandleOverlays[i] = (PSLIST_HEADER)_dd_aligned_malloc(sizeof(SLIST_HEADER), MEMORY_ALLOCATION_ALIGNMENT);
+        if (g_retiredHandleOverlays[i] == nullptr)
+        {
+            Dbg(L"Allocation for g_retiredHandleOverlays failed");
+        }
 
-    assert(g_pClosedHandles != nullptr);
-    InitializeSListHead(g_pClosedHandles);
+        assert(g_retiredHandleOverlays[i] != nullptr);
+        InitializeSListHead(g_retiredHandleOverlays[i]);
+    }
 
-    g_pClosedHandlesPool = (PSLIST_HEADER)_dd_aligned_malloc(sizeof(SLIST_HEADER), MEMORY_ALLOCATION_ALIGNMENT);
-    if (g_pClosedHandlesPool == nullptr)
+    for (int i = 0; i < HANDLE_POLICY_INTERN_STRIPES; i++)
     {
-        Dbg(L"Allocation for g_pClosedHandlesPool failed");
+        InitializeSRWLock(&g_internedHandlePolicyLocks[i]);
     }
 
-    assert(g_pClosedHandlesPool != nullptr);
-    InitializeSListHead(g_pClosedHandlesPool);
-    PopulateNtCloseListPool();
-
     g_initialized = true;
 }
 
 void RegisterHandleOverlay(HANDLE handle, AccessCheckResult const& accessCheck, PolicyResult const& policy, HandleType type) {
-    if (UseExtraThreadToDrainNtClose())
-    {
-        RemoveClosedHandles();
-    }
+    assert(g_initialized);
 
-    // First we create a shared_ptr for a new HandleOverlay (ref count 1).
-    // Note: This must be created outside of the HandleOverlayLockGuard lock below,
-    //       because otherwise we will get a deadlock - the HandleMap lock and the RtlAllocHeap in the OS heap allocator lock.
-    //       
-    HandleOverlayRef newRef = std::make_shared<HandleOverlay>(accessCheck, policy, type);
-
-    // Get an extra reference to the handle. This way the shared_ptr is not deleted when removed from the map.
-    //
-    // The issue of destroying the object when removing from the map is that there is a potential for a deadlock.
-    // The removal from the map happens while holding the HandleOverlayLockGuard lock 
-    // (in the MapRegisterHandleOverlay method we do std::move that can call an object destruction and RtlFreeHeap).
-    // The freeing of memory happens while a heap lock is held - so if destruction happens,
-    // the order of lock aquisition is HandleMapLock--> HeapLock.
-    // RtlFreeHeap also calls NtClose, while holding the heap lock, so it is possible to try to get the locks in 
-    // order HeapLock-->HandleMapLock.
-    // These two clearly point to a deadlock due to inverted lock aquisition.
-    HandleOverlayRef overlay = TryLookupHandleOverlay(handle, false);
+    ReclaimRetiredNodes();
 
+    PHANDLE_OVERLAY_NODE node = (PHANDLE_OVERLAY_NODE)_dd_aligned_malloc(sizeof(HANDLE_OVERLAY_NODE), MEMORY_ALLOCATION_ALIGNMENT);
+    if (node == nullptr)
     {
-        HandleOverlayLockGuard lock;
-        HandleOverlayMap* map = lock.GetGlobalOverlayMap();
-        map->MapRegisterHandleOverlay(handle, newRef);
+        Dbg(L"Allocation for a handle overlay failed");
+        return;
     }
-}
 
-HandleOverlayRef TryLookupHandleOverlay(HANDLE handle, bool drain) {
-    if (drain && UseExtraThreadToDrainNtClose())
+    new (node) HANDLE_OVERLAY_NODE();
+    node->Overlay = std::make_shared<HandleOverlay>(accessCheck, InternHandlePolicy(policy), type);
+
+    PHANDLE_OVERLAY_SLOT slot = FindSlot(handle, /*claim*/ true);
+    if (slot == nullptr)
     {
-        RemoveClosedHandles();
+        // Out of memory for the table. Behave as if the handle was never registered.
+        node->~HANDLE_OVERLAY_NODE();
+        _dd_aligned_free(node);
+        return;
     }
 
-    HandleOverlayLockGuard lock;
-    HandleOverlayMap* map = lock.GetGlobalOverlayMap();
-    return map->TryLookupHandleOverlay(handle);
-}
-
-void CloseHandleOverlay(HANDLE handle, bool inRecursion) {
-    if (!inRecursion)
+    PHANDLE_OVERLAY_NODE previous = (PHANDLE_OVERLAY_NODE)InterlockedExchangePointer((PVOID volatile*)&slot->Node, node);
+    if (previous != nullptr)
     {
-        // Call this from here to relieve pressure on the pre-allocated SList entry pool.
-        if (UseExtraThreadToDrainNtClose())
-        {
-            RemoveClosedHandles();
-        }
+        // Replacing an overlay: concurrent lookups may still be copying the previous one
+        RetireNode(previous);
     }
-    
-    // Get an extra reference to the handle. This way the shared_ptr is not deleted when removed from the 
-    // map.
-    // The issue of destroying the object when removing from the map is that there is a potential for a deadlock.
-    // The removal from the map happens while holding the HandleOverlayLockGuard lock (see below).
-    // If the map holds the last ref to the shared_ptr, when removing it, the destructor of the object will be called,
-    // thus triggering deletion of the object from the OS heap - RtlFreeHeap. The freeing of memory happens
-    // while a heap lock is held - so if destruction happens, the order of lock aquisition is HandleMapLock--> HeapLock.
-    // RtlAllocateHeap also calls NtClose, while holding the heap lock, so it is possible to try to get the locks in 
-    // order HeapLock-->HandleMapLock.
-    // These two clearly point to a deadlock due to inverted lock aquisition.
-    HandleOverlayRef overlay = TryLookupHandleOverlay(handle, false);
-    
+    else
     {
-        // Extra scope here to make sure the lock is destroied before the overlay above goes out of scope
-        // and releases the last ref to the object pointer.
-        HandleOverlayLockGuard lock;
-        HandleOverlayMap* map = lock.GetGlobalOverlayMap();
-        map->CloseHandleOverlay(handle);
+        TrackHandleOverlayEntries(1);
     }
 }
 
-void AddClosedHandle(HANDLE handle) {
-    // Be safe and check all the list pointers as well since a NtClose (where this method is called from)
-    // can come very early in the execution of a process.
-#if MEASURE_DETOURED_NT_CLOSE_IMPACT
-    ULONGLONG startAdd = GetTickCount64();
-#endif // MEASURE_DETOURED_NT_CLOSE_IMPACT
-    // Cleaup any pending NtClose handles, if the remaining unused are less than NT_CLOSE_CLEANUP_THRESHOLD
-    if ((g_detoursAllocatedNoLockConcurentPoolEntries - g_usedPoolEntries) < NT_CLOSE_CLEANUP_THRESHOLD)
+HandleOverlayRef TryLookupHandleOverlay(HANDLE handle) {
+    assert(g_initialized);
+
+    PHANDLE_OVERLAY_SLOT slot = FindSlot(handle, /*claim*/ false);
+    if (slot == nullptr)
     {
-        // When below threshold start a new thread. It will be with higher priority to drain the list.
-        // The thread routine is completely thread safe and we might create multiple threads and that is just fine.
-        // The expectation is that multiple threads creation will happen very rarely.
-        StartCleanupNtClosedHandlesThread();
+        return HandleOverlayRef();
     }
 
-    if (g_initialized && g_pClosedHandles != nullptr && g_pClosedHandlesPool != nullptr) {
-        PSLIST_ENTRY pEntry = InterlockedPopEntrySList(g_pClosedHandlesPool);
+    LONG epoch = EnterEpoch();
 
-        if (pEntry == nullptr)
-        {
-            Dbg(L"Warning: No available entries in g_pClosedHandlesPool list.");
-        }
-        else
-        {
-            ((PHANDLE_TO_CLOSE)pEntry)->Handle = handle;
-            InterlockedPushEntrySList(g_pClosedHandles, &(((PHANDLE_TO_CLOSE)pEntry)->ItemEntry));
-            InterlockedIncrement(&g_usedPoolEntries);
-        }
+    // The node can't be freed before we exit the epoch, so it is safe to create a new ref (refcount increases) from its one.
+    PHANDLE_OVERLAY_NODE node = slot->Node;
+    HandleOverlayRef overlay = node != nullptr ? node->Overlay : HandleOverlayRef();
+
+    ExitEpoch(epoch);
+    return overlay;
+}
+
+bool ShouldOverrideTimestampsForHandle(HANDLE handle) {
+    assert(g_initialized);
+
+    PHANDLE_OVERLAY_SLOT slot = FindSlot(handle, /*claim*/ false);
+    if (slot == nullptr)
+    {
+        return false;
     }
-#if MEASURE_DETOURED_NT_CLOSE_IMPACT
-    InterlockedIncrement(&g_maxClosedListCount);
-    ULONGLONG endAdd = GetTickCount64();
-    InterlockedExchangeAdd(&g_msTimeInAddClosedList, (LONG)(endAdd - startAdd));
-#endif // MEASURE_DETOURED_NT_CLOSE_IMPACT
+
+    LONG epoch = EnterEpoch();
+
+    // The node can't be freed before we exit the epoch, so its overlay can be read without taking a ref
+    PHANDLE_OVERLAY_NODE node = slot->Node;
+    bool overrideTimestamps = node != nullptr && node->Overlay->OverrideTimestamps;
+
+    ExitEpoch(epoch);
+    return overrideTimestamps;
 }
 
-// Note: It is potentially possible to call these method while an entry is added to the non-locking list.
-// In such case the entry will be removed from the overlay map on the next iteration.
-void RemoveClosedHandles() {
-#if MEASURE_DETOURED_NT_CLOSE_IMPACT
-    ULONGLONG startAdd = GetTickCount64();
-#endif // MEASURE_DETOURED_NT_CLOSE_IMPACT
-    if (g_initialized && g_pClosedHandles != nullptr && g_pClosedHandlesPool != nullptr) {
-        PSLIST_ENTRY pEntry = InterlockedPopEntrySList(g_pClosedHandles);
-        while (pEntry != NULL)
-        {
-            CloseHandleOverlay(((PHANDLE_TO_CLOSE)pEntry)->Handle, true);
-            ((PHANDLE_TO_CLOSE)pEntry)->Handle = INVALID_HANDLE_VALUE;
-            InterlockedPushEntrySList(g_pClosedHandlesPool, &(((PHANDLE_TO_CLOSE)pEntry)->ItemEntry));
-            pEntry = InterlockedPopEntrySList(g_pClosedHandles);
-            InterlockedDecrement(&g_usedPoolEntries);
-#if MEASURE_DETOURED_NT_CLOSE_IMPACT
-            InterlockedDecrement(&g_maxClosedListCount);
-#endif // MEASURE_DETOURED_NT_CLOSE_IMPACT        
-        }
+void CloseHandleOverlay(HANDLE handle) {
+    // Called by NtClose (possibly while holding the OS heap lock): this must not take locks nor allocate or free memory.
+    if (!g_initialized)
+    {
+        return;
+    }
 
-        // Grow the list if needed.
-        if ((g_detoursAllocatedNoLockConcurentPoolEntries - g_usedPoolEntries) < NT_CLOSE_CLEANUP_THRESHOLD)
-        {
-            PopulateNtCloseListPool();
-        }
+    PHANDLE_OVERLAY_SLOT slot = FindSlot(handle, /*claim*/ false);
+    if (slot == nullptr || slot->Node == nullptr)
+    {
+        return;
+    }
+
+    PHANDLE_OVERLAY_NODE node = (PHANDLE_OVERLAY_NODE)InterlockedExchangePointer((PVOID volatile*)&slot->Node, nullptr);
+    if (node != nullptr)
+    {
+        RetireNode(node);
+        TrackHandleOverlayEntries(-1);
     }
-#if MEASURE_DETOURED_NT_CLOSE_IMPACT
-    ULONGLONG endAdd = GetTickCount64();
-    InterlockedExchangeAdd(&g_msTimeInRemoveClosedList, (LONG)(endAdd - startAdd));
-#endif // MEASURE_DETOURED_NT_CLOSE_IMPACT
 }
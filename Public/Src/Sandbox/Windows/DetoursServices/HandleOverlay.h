@@ -10,6 +10,7 @@
 // any missing API would reject our fake HANDLEs, or crash.
 //
 // Instead, we define a process-global HANDLE -> overlay map and return all HANDLEs unmodified.
+// The map is lock-free (see HandleOverlay.cpp), so it can be updated from NtClose.
 
 #include "FileAccessHelpers.h"
 #include "PolicyResult.h"
@@ -21,24 +22,43 @@ enum class HandleType {
     Find
 };
 
+// Immutable policy of a handle. Processes like MSBuild nodes keep tens of thousands of handles open, many of them on the same files,
+// so the overlays of the handles opened on the same path with the same policy share a single PolicyResult (see RegisterHandleOverlay),
+// instead of each keeping its own copy of the path, of its translation and of the policy search cursor.
+typedef std::shared_ptr<const PolicyResult> HandlePolicyRef;
+
 // Per-handle overlay data.
 struct HandleOverlay {
     // Constructs a handle overlay for a handle, wrapping the creating operation's policy / access check.
     // The policy represents what operations should be allowed via operations on this handle.
-    HandleOverlay(AccessCheckResult const& accessCheck, PolicyResult const& policy, HandleType type)
-        : Policy(policy), AccessCheck(accessCheck), Type(type), EnumerationHasBeenReported(false) { }
+    HandleOverlay(AccessCheckResult const& accessCheck, HandlePolicyRef const& policy, HandleType type)
+        : Policy(policy), AccessCheck(accessCheck), Type(type), EnumerationHasBeenReported(false), EnumeratedDirectoryResolved(false),
+          Renamed(false), OverrideTimestamps(policy->ShouldOverrideTimestamps(accessCheck)) { }
 
     HandleOverlay(const HandleOverlay& other) = default;
     HandleOverlay& operator=(const HandleOverlay&) = default;
 
-    PolicyResult Policy;
+    // Never null. Since it may be shared with other overlays, it is replaced rather than modified.
+    HandlePolicyRef Policy;
     AccessCheckResult AccessCheck;
     HandleType Type;
 
     // This flag is set when a directory handle enumeration is reported to BuildXL
-    // by NtQueryDirectoryFile. It prevents multiple reports for the same directory
-    // (some big enumerations require multiple calls to NtQueryDirectoryFile).
+    // by NtQueryDirectoryFile, or when the policy is such that it never will be. It prevents multiple reports for the same directory
+    // (some big enumerations require multiple calls to NtQueryDirectoryFile), and evaluating the policy again for each call.
     bool EnumerationHasBeenReported;
+
+    // This flag is set when FindNextFile has fully resolved the directory being enumerated (see Detoured_FindNextFileW).
+    // Policy is then the policy of the resolved directory, so there is no need to resolve it again for the following entries.
+    bool EnumeratedDirectoryResolved;
+
+    // This flag is set when the file or directory is renamed through this handle. Policy then no longer has the path
+    // the handle refers to, so the final path of the handle can't be taken from it (see DetourGetFinalPathByHandle).
+    bool Renamed;
+
+    // Whether metadata queries on this handle should see faked timestamps (see PolicyResult::ShouldOverrideTimestamps).
+    // Decided when the handle is opened, so querying metadata on the handle doesn't evaluate the policy again.
+    bool OverrideTimestamps;
 };
 
 // Sets up structures for recording handle overlays.
@@ -52,19 +72,19 @@ void InitializeHandleOverlay();
 typedef std::shared_ptr<HandleOverlay> HandleOverlayRef;
 
 // Creates or replaces an overlay for the given handle (intended for the time at which a handle is created).
-// The new overlays wraps the policy / access check determined for the handle so far.
+// The new overlays wraps the policy / access check determined for the handle so far. The policy is shared with the overlays of other
+// handles when it is equivalent to theirs (see PolicyResult::IsEquivalentTo), so this doesn't copy it when the path is already open.
 // The policy represents what operations should be allowed via operations on this handle.
 void RegisterHandleOverlay(HANDLE handle, AccessCheckResult const& accessCheck, PolicyResult const& policy, HandleType type);
 
 // Tries to look up an existing overlay for the given handle. The returned ref may wrap nullptr in the event that there was no overlay found.
-HandleOverlayRef TryLookupHandleOverlay(HANDLE handle, bool drain = true);
+HandleOverlayRef TryLookupHandleOverlay(HANDLE handle);
+
+// Whether metadata queries on the given handle should see faked timestamps (see HandleOverlay::OverrideTimestamps).
+// Returns false for a handle without an overlay. Unlike TryLookupHandleOverlay, this doesn't create a ref to the overlay.
+bool ShouldOverrideTimestampsForHandle(HANDLE handle);
 
 // If an overlay exists for the given handle, disassociates it from the handle. Future calls to TryLookupHandleOverlay for the handle will no
 // longer succeed. Concurrent users that already have a ref to the overlay may continue to use it safely.
-void CloseHandleOverlay(HANDLE handle, bool inRecursion = false);
-
-// Adds a closed handle to the closed handle list.
-void AddClosedHandle(HANDLE handle);
-
-// Remove all closed handlefrom the overlay map.
-void RemoveClosedHandles();
+// This function neither takes locks nor allocates or frees memory, so it is safe to call from NtClose.
+void CloseHandleOverlay(HANDLE handle);
@@ -0,0 +1,250 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include "stdafx.h"
+
+#include "DebuggingHelpers.h"
+#include "PathTranslator.h"
+#include "buildXL_mem.h"
+
+// Translations are tracked in a bitmask while translating a path, so there is no allocation per call
+static const size_t s_maxTrackedTranslations = 1024;
+
+PathTranslator::PathTranslator()
+{
+    // The root, which matches the empty prefix
+    m_nodes.push_back({ L'\0', NoIndex, NoIndex, NoIndex });
+}
+
+PathTranslator* PathTranslator::GetInstance()
+{
+    static PathTranslator s_singleton;
+    return &s_singleton;
+}
+
+void PathTranslator::AddTranslation(const std::wstring& from, const std::wstring& to)
+{
+    if (m_translations.size() >= s_maxTrackedTranslations)
+    {
+        Dbg(L"PathTranslator::AddTranslation: Too many translations, ignoring '%s' --> '%s'", from.c_str(), to.c_str());
+        return;
+    }
+
+    uint32_t node = 0;
+    for (wchar_t c : from)
+    {
+        uint32_t child = FindChild(node, c);
+        if (child == NoIndex)
+        {
+            child = (uint32_t)m_nodes.size();
+            m_nodes.push_back({ c, NoIndex, m_nodes[node].FirstChild, NoIndex });
+            m_nodes[node].FirstChild = child;
+        }
+
+        node = child;
+    }
+
+    const uint32_t translation = (uint32_t)m_translations.size();
+    m_translations.push_back({ from, to });
+    m_sameSource.push_back(NoIndex);
+
+    // Keep translations with the same source path in manifest order: the first one wins
+    uint32_t* last = &m_nodes[node].Translation;
+    while (*last != NoIndex)
+    {
+        last = &m_sameSource[*last];
+    }
+
+    *last = translation;
+}
+
+uint32_t PathTranslator::FindChild(uint32_t node, wchar_t c) const
+{
+    for (uint32_t child = m_nodes[node].FirstChild; child != NoIndex; child = m_nodes[child].NextSibling)
+    {
+        if (m_nodes[child].Char == c)
+        {
+            return child;
+        }
+    }
+
+    return NoIndex;
+}
+
+uint32_t PathTranslator::FindUnused(uint32_t node, const uint64_t* used, bool last) const
+{
+    uint32_t result = NoIndex;
+    for (uint32_t translation = m_nodes[node].Translation; translation != NoIndex; translation = m_sameSource[translation])
+    {
+        if ((used[translation / 64] & (1ULL << (translation % 64))) == 0)
+        {
+            result = translation;
+            if (!last)
+            {
+                break;
+            }
+        }
+    }
+
+    return result;
+}
+
+bool PathTranslator::Translate(const std::wstring& path, std::wstring& translatedPath, bool debug) const
+{
+    if (m_translations.empty() || path.empty())
+    {
+        return false;
+    }
+
+    uint64_t used[s_maxTrackedTranslations / 64] = {};
+    std::wstring current(path);
+    bool translated = false;
+
+    while (true)
+    {
+        // Find the longest source path that is a prefix of the current path
+        uint32_t replacement = NoIndex;
+        size_t replacedLength = 0;
+        uint32_t node = 0;
+        size_t i = 0;
+        for (; i < current.length(); i++)
+        {
+            node = FindChild(node, (wchar_t)towlower(current[i]));
+            if (node == NoIndex)
+            {
+                break;
+            }
+
+            const uint32_t candidate = FindUnused(node, used, /*last*/ false);
+            if (candidate != NoIndex)
+            {
+                replacement = candidate;
+                replacedLength = i + 1;
+            }
+        }
+
+        // The path to be translated can be a directory path that does not have trailing '\\'.
+        // Such a match always wins, and among several translations of the same directory the last one wins, as it always did.
+        if (i == current.length() && current.back() != L'\\')
+        {
+            const uint32_t directory = FindChild(node, L'\\');
+            const uint32_t candidate = directory != NoIndex ? FindUnused(directory, used, /*last*/ true) : NoIndex;
+            if (candidate != NoIndex)
+            {
+                replacement = candidate;
+                replacedLength = current.length();
+            }
+        }
+
+        if (replacement == NoIndex)
+        {
+            break;
+        }
+
+        const Translation& translation = m_translations[replacement];
+        std::wstring result(translation.To);
+        result.append(current, replacedLength, std::wstring::npos);
+
+        if (debug)
+        {
+            Dbg(
+                L"TranslateFilePath-1: from: '%s', to '%s' (used mapping: '%s' --> '%s')",
+                current.c_str(),
+                result.c_str(),
+                translation.From.c_str(),
+                translation.To.c_str());
+        }
+
+        current.swap(result);
+        used[replacement / 64] |= 1ULL << (replacement % 64);
+        translated = true;
+    }
+
+    if (translated)
+    {
+        translatedPath.swap(current);
+    }
+
+    return translated;
+}
+
+bool PathTranslator::HasTranslationsBelow(const wchar_t* directory) const
+{
+    if (m_translations.empty())
+    {
+        return false;
+    }
+
+    // Any source path that is a prefix of a path below the directory, without being a prefix of the directory, starts with the directory
+    // followed by a separator
+    uint32_t node = 0;
+    wchar_t last = L'\0';
+    for (const wchar_t* c = directory; *c != L'\0' && node != NoIndex; c++)
+    {
+        node = FindChild(node, (wchar_t)towlower(*c));
+        last = *c;
+    }
+
+    if (node != NoIndex && last != L'\\')
+    {
+        node = FindChild(node, L'\\');
+    }
+
+    return node != NoIndex;
+}
+
+uint64_t PathTranslator::Hash(const std::wstring& path)
+{
+    // 64-bit FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    for (wchar_t c : path)
+    {
+        hash = (hash ^ (uint64_t)c) * 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+bool PathTranslator::TryGetCachedTranslation(const std::wstring& path, std::wstring& translatedPath)
+{
+    const uint64_t hash = Hash(path);
+    Stripe& stripe = m_stripes[(hash >> 32) % StripeCount];
+
+    const std::shared_lock<std::shared_mutex> lock(stripe.Lock);
+    auto result = stripe.Entries.find(hash);
+    if (result == stripe.Entries.end() || result->second.Path != path)
+    {
+        return false;
+    }
+
+    if (result->second.Translated)
+    {
+        translatedPath.assign(result->second.TranslatedPath);
+    }
+
+    return true;
+}
+
+void PathTranslator::AddCachedTranslation(const std::wstring& path, bool translated, const std::wstring& translatedPath)
+{
+    const uint64_t hash = Hash(path);
+    Stripe& stripe = m_stripes[(hash >> 32) % StripeCount];
+
+    const std::unique_lock<std::shared_mutex> lock(stripe.Lock);
+    if (stripe.Entries.size() >= MaxEntriesPerStripe)
+    {
+        stripe.Entries.clear();
+    }
+
+    Entry& entry = stripe.Entries[hash];
+    entry.Path.assign(path);
+    entry.Translated = translated;
+    if (translated)
+    {
+        entry.TranslatedPath.assign(translatedPath);
+    }
+    else
+    {
+        entry.TranslatedPath.clear();
+    }
+}
@@ -0,0 +1,90 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Applies the path translations of the manifest (see TranslateFilePath).
+//
+// The source paths of all translations are compiled into a case-insensitive prefix trie while the manifest is parsed, so finding the
+// longest translation that applies to a path is a single pass over the path, regardless of the number of translations.
+// Processes translate the same paths over and over, so results are also memoized by input path, exactly like PolicySearchCache:
+// in stripes with their own lock, which are cleared when they get full.
+//
+// Translations must all be added before the first call to Translate. All the other operations are thread-safe.
+class PathTranslator {
+public:
+    static PathTranslator* GetInstance();
+
+    // Adds a translation. The source path is expected to be lowercase and canonicalized, like the ones coming from the manifest.
+    void AddTranslation(const std::wstring& from, const std::wstring& to);
+
+    // Translates a path without type prefix. Returns false, leaving the translated path untouched, if no translation applies.
+    // Like the translation loop it replaces, a translated path is translated again, but every translation is used at most once.
+    bool Translate(const std::wstring& path, std::wstring& translatedPath, bool debug) const;
+
+    // Whether a translation may apply to a path below the given directory (without type prefix), which no translation applies to itself.
+    // When this is false, translating a path below the directory leaves it untouched.
+    bool HasTranslationsBelow(const wchar_t* directory) const;
+
+    // Gets the translation memoized for the given input, if any. The output is only assigned when the input got translated.
+    bool TryGetCachedTranslation(const std::wstring& path, std::wstring& translatedPath);
+
+    // Memoizes the translation of the given input. The output is ignored when the input didn't get translated.
+    void AddCachedTranslation(const std::wstring& path, bool translated, const std::wstring& translatedPath);
+
+private:
+    PathTranslator();
+    PathTranslator(const PathTranslator&) = delete;
+    PathTranslator& operator = (const PathTranslator&) = delete;
+
+    static constexpr uint32_t NoIndex = UINT32_MAX;
+
+    // A character of a source path. Children are kept in a singly linked list of siblings: the trie is built once and
+    // nodes only have many children near the root.
+    struct Node {
+        wchar_t Char;
+        uint32_t FirstChild;
+        uint32_t NextSibling;
+        // First translation whose source path ends at this node. Others with the same source path follow in m_sameSource.
+        uint32_t Translation;
+    };
+
+    struct Translation {
+        std::wstring From;
+        std::wstring To;
+    };
+
+    uint32_t FindChild(uint32_t node, wchar_t c) const;
+
+    // Gets the first (or last) translation ending at the given node that the current call to Translate didn't use yet
+    uint32_t FindUnused(uint32_t node, const uint64_t* used, bool last) const;
+
+    std::vector<Node> m_nodes;
+    std::vector<Translation> m_translations;
+    std::vector<uint32_t> m_sameSource;
+
+    static const size_t StripeCount = 16;
+    static const size_t MaxEntriesPerStripe = 1024;
+
+    struct Entry {
+        std::wstring Path;
+        bool Translated;
+        std::wstring TranslatedPath;
+    };
+
+    struct alignas(64) Stripe {
+        std::shared_mutex Lock;
+        std::unordered_map<uint64_t, Entry> Entries;
+    };
+
+    static uint64_t Hash(const std::wstring& path);
+
+    Stripe m_stripes[StripeCount];
+};
@@ -24,9 +24,8 @@ void Dbg(PCWSTR, ...) {}
 
 PathTree::PathTree()
 {
-    m_root = new TreeNode();
     // The root is never a final path
-    m_root->intermediate = true;
+    m_root = m_arena.NewNode(/*isIntermediate*/ true);
 }
 
 #pragma warning( push )
@@ -35,7 +34,7 @@ PathTree::PathTree()
 PathTree::~PathTree()
 {
     RemoveAllDescendants(m_root);
-    delete m_root;
+    m_arena.DeleteNode(m_root);
 }
 #pragma warning( pop )
 
@@ -64,18 +63,18 @@ bool PathTree::TryInsert(const std::wstring& path)
 TreeNode* PathTree::Append(const std::wstring& atom, TreeNode* node, bool isIntermediate)
 {
     // First check if the node is already there
-    std::pair<std::wstring, TreeNode*> search;
-    if (node->children.find(atom, search))
+    const PathAtomKey key(atom);
+    TreeNodeChild search;
+    if (node->children.find(key, search))
     {
         // If the node being appended is not an intermediate, that overrides the existing node flag
-        (search.second)->intermediate &= isIntermediate;
-        return search.second;
+        search.node->intermediate &= isIntermediate;
+        return search.node;
     }
 
     // It is not there. Create it and add it as a child of the given node
-    TreeNode* newNode = new TreeNode();
-    newNode->intermediate = isIntermediate;
-    node->children.emplace(atom, newNode);
+    TreeNode* newNode = m_arena.NewNode(isIntermediate);
+    node->children.emplace(m_arena.Intern(key), newNode);
 
     return newNode;
 }
@@ -83,7 +82,7 @@ TreeNode* PathTree::Append(const std::wstring& atom, TreeNode* node, bool isInte
 void PathTree::RetrieveAndRemoveAllDescendants(const std::wstring& path, std::vector<std::wstring>& descendants)
 {
     // Find the trace in the tree that matches the path
-    std::vector<std::pair<std::wstring, TreeNode*>> nodeTrace;
+    std::vector<TreeNodeChild> nodeTrace;
     if (!TryFind(path, nodeTrace))
     {
         return;
@@ -91,32 +90,27 @@ void PathTree::RetrieveAndRemoveAllDescendants(const std::wstring& path, std::ve
 
     // Let's build the given path again based on the resulting trace so casing is preserved
     // Observe there is always at least one element (the root of the tree), which we skip
-    auto it = nodeTrace.begin();
-    it++;
-
     std::wstring normalizedPath;
-    if (it != nodeTrace.end())
+    for (auto it = nodeTrace.begin() + 1; it != nodeTrace.end(); it++)
     {
-        normalizedPath.append(it->first);
-        it++;
-    }
+        if (!normalizedPath.empty())
+        {
+            normalizedPath.append(L"\\");
+        }
 
-    for (; it != nodeTrace.end(); it++)
-    {
-        normalizedPath.append(L"\\");
-        normalizedPath.append(it->first);
+        normalizedPath.append(it->atom->chars(), it->atom->length);
     }
 
     // Pop all the descendants of the leaf node and build the descendant collection
-    RetrieveAndRemoveAllDescendants(normalizedPath, nodeTrace.back().second, descendants);
+    RetrieveAndRemoveAllDescendants(normalizedPath, nodeTrace.back().node, descendants);
 
     // Let's walk upwards, towards the root, removing all intermediates with no branching
     // The presence of these nodes won't affect future computation of descendants but it can slow
     // down searches
     while (!nodeTrace.empty())
     {
-        std::pair<std::wstring, TreeNode*> pair = nodeTrace.back();
-        TreeNode* node = pair.second;
+        const TreeNodeChild child = nodeTrace.back();
+        TreeNode* node = child.node;
 
         nodeTrace.pop_back();
 
@@ -124,9 +118,9 @@ void PathTree::RetrieveAndRemoveAllDescendants(const std::wstring& path, std::ve
         // (no children after removing the last edge)
         if (node != m_root && node->intermediate && node->children.size() == 0)
         {
-            TreeNode* predecesor = nodeTrace.back().second;
-            predecesor->children.erase(pair.first);
-            delete node;
+            TreeNode* predecesor = nodeTrace.back().node;
+            predecesor->children.erase(PathAtomKey(child.atom));
+            m_arena.DeleteNode(node);
         }
         else
         {
@@ -135,49 +129,44 @@ void PathTree::RetrieveAndRemoveAllDescendants(const std::wstring& path, std::ve
     }
 }
 
-void PathTree::RetrieveAndRemoveAllDescendants(const std::wstring& path, TreeNode* node, std::vector<std::wstring>& descendants)
+void PathTree::RetrieveAndRemoveAllDescendants(std::wstring& path, TreeNode* node, std::vector<std::wstring>& descendants)
 {
-    std::vector<TreeNode*> nodesToDelete;
+    const size_t pathLength = path.length();
 
-    const auto retrieve = [this, &path, node, &descendants, &nodesToDelete](std::pair<std::wstring, TreeNode*>* iter)
+    const auto retrieve = [this, &path, pathLength, &descendants](TreeNodeChild* child)
     {
-        // Add the path atom to the path.
-        std::wstring descendant(path);
-        if (node != m_root)
+        // Add the path atom to the path. Only final paths are materialized as strings
+        if (pathLength > 0)
         {
-            descendant.append(L"\\");
-            descendant.append(iter->first);
+            path.append(L"\\");
         }
 
+        path.append(child->atom->chars(), child->atom->length);
+
         // Add it to the collection only if it is a final path
-        if (!(iter->second->intermediate))
+        if (!(child->node->intermediate))
         {
-            descendants.push_back(descendant);
+            descendants.push_back(path);
         }
 
-        RetrieveAndRemoveAllDescendants(descendant, iter->second, descendants);
-
-        nodesToDelete.push_back(iter->second);
+        RetrieveAndRemoveAllDescendants(path, child->node, descendants);
 
+        path.resize(pathLength);
+        m_arena.DeleteNode(child->node);
     };
 
     node->children.forEach(retrieve);
-    
-    for (auto iter = nodesToDelete.begin(); iter != nodesToDelete.end(); iter++)
-    {
-        delete *iter;
-    }
 
     node->children.clear();
 }
 
 void PathTree::RemoveAllDescendants(TreeNode* node)
 {
-    const auto remove = [this](std::pair<std::wstring, TreeNode*>* iter)
+    const auto remove = [this](TreeNodeChild* child)
     {
-        RemoveAllDescendants(iter->second);
+        RemoveAllDescendants(child->node);
 
-        delete iter->second;
+        m_arena.DeleteNode(child->node);
     };
 
     node->children.forEach(remove);
@@ -185,7 +174,7 @@ void PathTree::RemoveAllDescendants(TreeNode* node)
     node->children.clear();
 }
 
-bool PathTree::TryFind(const std::wstring& path, std::vector<std::pair<std::wstring, TreeNode*>>& nodeTrace)
+bool PathTree::TryFind(const std::wstring& path, std::vector<TreeNodeChild>& nodeTrace)
 {
     std::vector<std::wstring> elements;
     const int err = TryDecomposePath(path, elements);
@@ -197,18 +186,19 @@ bool PathTree::TryFind(const std::wstring& path, std::vector<std::pair<std::wstr
 
     auto currentNode = m_root;
 
-    nodeTrace.push_back(std::make_pair(L"", m_root));
+    nodeTrace.reserve(elements.size() + 1);
+    nodeTrace.push_back({ nullptr, m_root });
 
     for (unsigned int i = 0; i < elements.size(); i++)
     {
-        std::pair<std::wstring, TreeNode*> search;
-        if (!currentNode->children.find(elements[i], search))
+        TreeNodeChild search;
+        if (!currentNode->children.find(PathAtomKey(elements[i]), search))
         {
             return false;
         }
 
         nodeTrace.push_back(search);
-        currentNode = search.second;
+        currentNode = search.node;
     }
 
     return true;
@@ -228,13 +218,13 @@ std::wstring PathTree::ToDebugString(TreeNode* node, std::wstring indent)
         node = m_root;
     }
 
-    const auto append = [&result, &indent, this](std::pair<std::wstring, TreeNode*>* iter)
+    const auto append = [&result, &indent, this](TreeNodeChild* child)
     {
-        result.append(indent + iter->first + (!iter->second->intermediate ? L"*" : L"") + L"\r\n");
-        result.append(ToDebugString(iter->second, indent + L"\t"));
+        result.append(indent + child->atom->chars() + (!child->node->intermediate ? L"*" : L"") + L"\r\n");
+        result.append(ToDebugString(child->node, indent + L"\t"));
     };
 
     node->children.forEach(append);
 
     return result;
-}
\ No newline at end of file
+}
@@ -15,6 +15,7 @@
 #include "TreeNode.h"
 
 // An n-ary tree where nodes are path atoms. Drive letters are at the root and traces in the tree represent paths.
+// Nodes and atoms are allocated from a TreeNodeArena, and each distinct atom is stored once no matter how many paths contain it.
 // This class is not thread safe
 class PathTree {
 public:
@@ -45,11 +46,12 @@ private:
     TreeNode* Append(const std::wstring& atom, TreeNode* node, bool isIntermediate);
 
     // Tries to find the provided path in the current tree. On success, returns the trace in the tree that leads to the
-    // path final atom
-    bool TryFind(const std::wstring& path, std::vector<std::pair<std::wstring, TreeNode*>>& nodeTrace);
+    // path final atom. The first element of the trace is the root, with no atom
+    bool TryFind(const std::wstring& path, std::vector<TreeNodeChild>& nodeTrace);
 
     // Removes all descendants from the given node and builds the descendants collection using the given path as a prefix
-    void RetrieveAndRemoveAllDescendants(const std::wstring& path, TreeNode* lastNode, std::vector<std::wstring>& descendants);
+    // The path is used as a scratch buffer while walking the tree, but it is left unchanged
+    void RetrieveAndRemoveAllDescendants(std::wstring& path, TreeNode* lastNode, std::vector<std::wstring>& descendants);
 
     // Removes all descendants from the given node
     void RemoveAllDescendants(TreeNode* node);
@@ -57,5 +59,7 @@ private:
     // Debugging facility
     std::wstring ToDebugString(TreeNode* node = nullptr, std::wstring ident = L"");
 
+    // Owns the nodes and the atoms of the tree. Declared first so it outlives the nodes
+    TreeNodeArena m_arena;
     TreeNode* m_root;
-};
\ No newline at end of file
+};
\ No newline at end of file
@@ -3,8 +3,14 @@
 
 #include "PolicyResult.h"
 #include "DetoursHelpers.h"
+#include "DetoursPerformanceCounters.h"
 #include "SendReport.h"
 #include "FilesCheckedForAccess.h"
+#include "PolicySearchCache.h"
+#include "PathTranslator.h"
+
+extern volatile LONG64 g_policySearchCacheHitCount;
+extern volatile LONG64 g_policySearchCacheMissCount;
 
 bool PolicyResult::Initialize(PCPathChar path)
 {
@@ -31,35 +37,81 @@ void PolicyResult::Initialize(CanonicalizedPathType const& canonicalizedPath)
     InitializeFromCursor(canonicalizedPath, g_manifestTreeRoot, nullptr);
 }
 
-void PolicyResult::InitializeFromCursor(CanonicalizedPathType const& canonicalizedPath, PolicySearchCursor const& policySearchCursor, PCPathChar const searchSuffix)
+void PolicyResult::InitializeFromCursor(CanonicalizedPathType const& canonicalizedPath, PolicySearchCursor const& policySearchCursor, PCPathChar const searchSuffix, bool isUntranslated)
 {
     assert(m_isIndeterminate);
     assert(m_canonicalizedPath.IsNull());
     assert(!canonicalizedPath.IsNull());
 
+    HotPathTimer timer(DetoursHotPath::PolicySearch);
+
     // The path is already canonicalized; now we are committed to set a policy, which doesn't fail.
     // We will do so via special-case rules (no policy search or cursor) or via the policy tree (which is searched, producing a cursor).
     m_canonicalizedPath = canonicalizedPath;
 
-    TranslateFilePath(std::wstring(canonicalizedPath.GetPathString()), m_translatedPath, false);
+    if (isUntranslated)
+    {
+        m_translatedPath.assign(canonicalizedPath.GetPathString());
+    }
+    else
+    {
+        TranslateFilePath(std::wstring(canonicalizedPath.GetPathString()), m_translatedPath, false);
+    }
     wchar_t const* translatedSearchSuffix = searchSuffix != nullptr ? searchSuffix : GetTranslatedPathWithoutTypePrefix();
     size_t searchSuffixLength = wcslen(translatedSearchSuffix);
 
-    PolicySearchCursor newCursor = FindFileAccessPolicyInTreeEx(policySearchCursor, translatedSearchSuffix, searchSuffixLength);
+    // Searches from the root of the tree (i.e., not resuming a search) only depend on the translated path, so they are cached
+    PolicySearchCursor newCursor;
+    bool const isSearchFromRoot = searchSuffix == nullptr;
+    if (isSearchFromRoot && PolicySearchCache::GetInstance()->TryGet(translatedSearchSuffix, searchSuffixLength, newCursor))
+    {
+        InterlockedIncrement64(&g_policySearchCacheHitCount);
+    }
+    else if (isSearchFromRoot)
+    {
+        InterlockedIncrement64(&g_policySearchCacheMissCount);
+
+        // Most accesses are to files in directories other files were accessed in: resume from the cursor of the directory
+        // (caching it from a search from the root as well), so only the last component of the path needs to be searched
+        size_t parentLength = GetParentPathLengthForPolicySearch(translatedSearchSuffix, searchSuffixLength);
+        PolicySearchCursor startCursor = policySearchCursor;
+        size_t searchStart = 0;
+        if (parentLength > 0)
+        {
+            if (!PolicySearchCache::GetInstance()->TryGet(translatedSearchSuffix, parentLength, startCursor))
+            {
+                startCursor = FindFileAccessPolicyInTreeEx(policySearchCursor, translatedSearchSuffix, parentLength);
+                PolicySearchCache::GetInstance()->Add(translatedSearchSuffix, parentLength, startCursor);
+            }
+
+            searchStart = parentLength + 1;
+        }
+
+        newCursor = FindFileAccessPolicyInTreeEx(startCursor, translatedSearchSuffix + searchStart, searchSuffixLength - searchStart);
+        PolicySearchCache::GetInstance()->Add(translatedSearchSuffix, searchSuffixLength, newCursor);
+    }
+    else
+    {
+        newCursor = FindFileAccessPolicyInTreeEx(policySearchCursor, translatedSearchSuffix, searchSuffixLength);
+    }
+
     Initialize(canonicalizedPath, newCursor);
 
+    // The rules after the first one only look at the final component of the path: analyze it once for all of them
+    const FinalPathComponent finalComponent(translatedSearchSuffix, searchSuffixLength);
+
     if (GetSpecialCaseRulesForWindows(translatedSearchSuffix, searchSuffixLength, /*out*/ m_policy)) 
     {
 #if SUPER_VERBOSE
         Dbg(L"match (special case rules for Windows): %s - policySearchCursor: %x, searchSuffix: %s", canonicalizedPath.GetPathString(), policySearchCursor, searchSuffix);
 #endif // SUPER_VERBOSE
     }
-    else if (GetSpecialCaseRulesForCoverageAndSpecialDevices(translatedSearchSuffix, searchSuffixLength, canonicalizedPath.Type, /*out*/ m_policy)) {
+    else if (GetSpecialCaseRulesForCoverageAndSpecialDevices(translatedSearchSuffix, searchSuffixLength, canonicalizedPath.Type, finalComponent, /*out*/ m_policy)) {
 #if SUPER_VERBOSE
         Dbg(L"match (special case rules for coverage and special devices): %s - policySearchCursor: %x, searchSuffix: %s", canonicalizedPath.GetPathString(), policySearchCursor, searchSuffix);
 #endif // SUPER_VERBOSE
     }
-    else if (GetSpecialCaseRulesForSpecialTools(translatedSearchSuffix, searchSuffixLength, /*out*/ m_policy))
+    else if (GetSpecialCaseRulesForSpecialTools(translatedSearchSuffix, searchSuffixLength, finalComponent, /*out*/ m_policy))
     {
 #if SUPER_VERBOSE
             Dbg(L"match (special case rules for special tools): %s - policySearchCursor: %x, searchSuffix: %s", canonicalizedPath.GetPathString(), policySearchCursor, searchSuffix);
@@ -76,7 +128,8 @@ PolicyResult PolicyResult::GetPolicyForSubpath(wchar_t const* pathSuffix) const
 
     PolicyResult subpolicy;
     if (m_policySearchCursor.IsValid()) {
-        subpolicy.InitializeFromCursor(extendedPath, m_policySearchCursor, &extendedPath.GetPathString()[extensionStartIndex]);
+        // Subpaths of an untranslated path usually stay untranslated: in that case there is no need to canonicalize and translate them again
+        subpolicy.InitializeFromCursor(extendedPath, m_policySearchCursor, &extendedPath.GetPathString()[extensionStartIndex], !MayTranslateSubpaths());
     }
     else {
         subpolicy.Initialize(extendedPath);
@@ -85,6 +138,42 @@ PolicyResult PolicyResult::GetPolicyForSubpath(wchar_t const* pathSuffix) const
     return subpolicy;
 }
 
+bool PolicyResult::IsKnownToBeAbsent(bool& parentExists) const {
+    if (!m_policySearchCursor.IsValid()
+        || !m_policySearchCursor.SearchWasTruncated
+        || m_policySearchCursor.Record->BucketCount == 0
+        || (m_policy & FileAccessPolicy_ConeIsFullyListed) == 0
+        || (m_policy & FileAccessPolicy_AllowWrite) != 0) {
+        return false;
+    }
+
+    // Count the components of the path the way the policy search splits it: a run of separators belongs to the component that follows it
+    PCPathChar path = GetTranslatedPathWithoutTypePrefix();
+    size_t componentCount = 0;
+    for (size_t i = 0; path[i] != L'\0'; i++) {
+        if (!IsDirectorySeparator(path[i]) && (i == 0 || IsDirectorySeparator(path[i - 1]))) {
+            componentCount++;
+        }
+    }
+
+    // The cursor points to the deepest ancestor in the manifest, whose level is its number of components
+    parentExists = componentCount == m_policySearchCursor.Level + 1;
+    return true;
+}
+
+bool PolicyResult::MayTranslateSubpaths() const {
+    if (!EnsurePathTranslationsDecoded()) {
+        return false;
+    }
+
+    // A translated path may be translated again once extended, so only untranslated paths are known to have untranslated subpaths
+    if (m_translatedPath.compare(m_canonicalizedPath.GetPathString()) != 0) {
+        return true;
+    }
+
+    return PathTranslator::GetInstance()->HasTranslationsBelow(m_canonicalizedPath.GetPathStringWithoutTypePrefix());
+}
+
 void PolicyResult::ReportIndeterminatePolicyAndSetLastError(FileOperationContext const& fileOperationContext) const
 {
     assert(IsIndeterminate());
@@ -147,4 +236,4 @@ bool PolicyResult::AllowWrite(bool basedOnlyOnPolicy) const {
     }
 
     return isWriteAllowedByPolicy;
-}
\ No newline at end of file
+}
\ No newline at end of file
@@ -64,7 +64,11 @@ private:
     /// Checks the file access manifest to determine a policy for the given already-canonicalized path.
     /// The policy search is resumed from the given cursor, applying searchSuffix. The path generating policySearchCursor combined with searchSuffix
     /// must be equivalent to canonicalizedPath (we are avoiding wasted work in re-traversing some prefix of canonicalizedPath in the policy tree).
-    void InitializeFromCursor(CanonicalizedPathType const& canonicalizedPath, PolicySearchCursor const& policySearchCursor, PCPathChar const searchSuffix);
+    /// When the caller already knows that no translation applies to canonicalizedPath, isUntranslated skips translating it.
+    void InitializeFromCursor(CanonicalizedPathType const& canonicalizedPath, PolicySearchCursor const& policySearchCursor, PCPathChar const searchSuffix, bool isUntranslated = false);
+
+    /// Whether a path below this one may be translated differently than by appending its suffix to this path
+    bool MayTranslateSubpaths() const;
 
 public:
     PolicyResult()
@@ -105,6 +109,26 @@ public:
 
     PCPathChar GetTranslatedPath() const { return m_translatedPath.c_str(); }
 
+    // Whether this policy result is interchangeable with the given one: same path, same policy, and same manifest record.
+    // The translated path is not compared, since it is a function of the path.
+    bool IsEquivalentTo(PolicyResult const& other) const {
+        return m_isIndeterminate == other.m_isIndeterminate
+            && m_policy == other.m_policy
+            && m_policySearchCursor.Record == other.m_policySearchCursor.Record
+            && m_policySearchCursor.Level == other.m_policySearchCursor.Level
+            && m_policySearchCursor.SearchWasTruncated == other.m_policySearchCursor.SearchWasTruncated
+            && m_canonicalizedPath.Type == other.m_canonicalizedPath.Type
+            && m_canonicalizedPath.Length() == other.m_canonicalizedPath.Length()
+            && (m_canonicalizedPath.GetPathString() == other.m_canonicalizedPath.GetPathString()
+                || wcscmp(m_canonicalizedPath.GetPathString(), other.m_canonicalizedPath.GetPathString()) == 0);
+    }
+
+    // Whether the path is known not to exist without looking at the file system: it is under a cone whose existing paths are all in the
+    // manifest (FileAccessPolicy_ConeIsFullyListed), where writes are not allowed, and the manifest only has some of its ancestors.
+    // 'parentExists' tells whether only the last component of the path is missing (otherwise, the missing path is an ancestor).
+    // Paths whose deepest ancestor in the manifest has nothing under it are not known to be absent: that ancestor may be a file or a directory.
+    bool IsKnownToBeAbsent(bool& parentExists) const;
+
     PCPathChar GetTranslatedPathWithoutTypePrefix() const {
         switch (m_canonicalizedPath.Type) {
             case PathType::Null:
@@ -168,6 +192,7 @@ public:
     AccessCheckResult CheckDirectoryAccess(bool enforceCreationAccess) const;
 
     // Determines a policy result for the combined path GetCanonicalizedPath() + pathSuffix.
+    // The search resumes from the cursor of this policy, so getting the policy of every entry of a directory costs one cursor step per entry.
     PolicyResult GetPolicyForSubpath(wchar_t const* pathSuffix) const;
 
     CanonicalizedPathType const& GetCanonicalizedPath() const { return m_canonicalizedPath; }
@@ -206,22 +231,14 @@ public:
         size_t first_level = 0;
         if ((m_policy & fileAccessPolicy) != 0)
         {
-            if (m_policy & fileAccessPolicy)
-            {
-                first_level = Level();
-            }
+            first_level = Level();
 
-            PolicySearchCursor::PPolicySearchCursor parent = m_policySearchCursor.Parent;
-            while (parent != nullptr)
+            size_t ancestorLevel;
+            if (m_policySearchCursor.TryGetShallowestAncestorLevel(fileAccessPolicy, ancestorLevel))
             {
-                if ((parent->Record->GetConePolicy() & fileAccessPolicy) != 0)
-                {
-                    // Level of a policy search cursor refers to the level of the remainder of the path after this policyresult.
-                    // To find the level including this policy result, we subtract 1
-                    first_level = parent->Level - 1;
-                }
-
-                parent = parent->Parent;
+                // Level of a policy search cursor refers to the level of the remainder of the path after this policyresult.
+                // To find the level including this policy result, we subtract 1
+                first_level = ancestorLevel - 1;
             }
         }
 
@@ -20,18 +20,20 @@
 /// Outputs:
 ///     absolutePath (unmodified): The partial path (as a prefix of absolutePath), with no path separator.
 ///     remainder: The remainder of the input string after the partial path has been stripped off.
+///
+/// The path ends after absolutePathLength characters, whether or not it is null-terminated there.
 static size_t GetPartialPathAndRemainder(
     __in  PCPathChar absolutePath,
     __in  size_t absolutePathLength,
     __out PCPathChar& remainder)
 {
     assert(absolutePath);
-    assert(absolutePathLength == pathlen(absolutePath));
+    assert(absolutePathLength <= pathlen(absolutePath));
     
     size_t found = 0; // look for a path separator or end of string
     // Skip all the leading PathSeparators.
     // This is needed for the case of network path ("\\foo-server\bar").
-    while (IsDirectorySeparator(absolutePath[found]))
+    while (found < absolutePathLength && IsDirectorySeparator(absolutePath[found]))
     {
         found++;
     }
@@ -45,66 +47,94 @@ static size_t GetPartialPathAndRemainder(
         // we found a path separator, and we need to increment the remainder past the path separator
         remainder++;
     }
-    else {
-        // absolutely do not increment past the null terminator
-        assert(remainder[0] == L'\0');
-    }
+    // otherwise, absolutely do not increment past the end of the path
 
     return found;
 }
 
 PolicySearchCursor FindFileAccessPolicyInTreeEx(
-    __in  PolicySearchCursor const& cursor,
+    __in  PolicySearchCursor const& startCursor,
     __in  PCPathChar absolutePath,
     __in  size_t absolutePathLength)
 {
     assert(absolutePath);
-    assert(absolutePathLength == pathlen(absolutePath));
+    assert(absolutePathLength <= pathlen(absolutePath));
 
-    assert(cursor.Record != nullptr);
+    assert(startCursor.Record != nullptr);
     assert(absolutePath != nullptr);
 
-    // For a truncated cursor, any further search should yield the same policy and remain truncated.
-    // One can imagine that below each record, there is a default record for any unmatched path
-    // which is an equivalent copy. But instead of realizing those records we just remember that
-    // we have begun traversing them.
-    if (cursor.SearchWasTruncated) {
-        return cursor;
-    }
-
-    // Terminal cases: Maybe we can't walk further down the tree, or maybe we've matched all of the path.
-    ManifestRecord::BucketCountType numBuckets = cursor.Record->BucketCount;
-    bool isLeaf = numBuckets == 0; // we found a leaf, even if there is more path, we have gone as far as we can
-    bool endOfPath = absolutePath[0] == 0; // no more path to search, wherever we ended up is the node to consider
-    if (isLeaf || endOfPath)
+    // We consume one path component per iteration (rather than recursing), so deep paths don't need deep stacks.
+    PolicySearchCursor cursor = startCursor;
+    while (true)
     {
-        return PolicySearchCursor(cursor.Record, cursor.Level, cursor.Parent, /*searchWasTruncated*/ !endOfPath);
-    }
+        // For a truncated cursor, any further search should yield the same policy and remain truncated.
+        // One can imagine that below each record, there is a default record for any unmatched path
+        // which is an equivalent copy. But instead of realizing those records we just remember that
+        // we have begun traversing them.
+        if (cursor.SearchWasTruncated) {
+            return cursor;
+        }
+
+        // Terminal cases: Maybe we can't walk further down the tree, or maybe we've matched all of the path.
+        ManifestRecord::BucketCountType numBuckets = cursor.Record->BucketCount;
+        bool isLeaf = numBuckets == 0; // we found a leaf, even if there is more path, we have gone as far as we can
+        bool endOfPath = absolutePathLength == 0; // no more path to search, wherever we ended up is the node to consider
+        if (isLeaf || endOfPath)
+        {
+            return PolicySearchCursor(cursor, /*searchWasTruncated*/ !endOfPath);
+        }
+
+        // We're now committed to tokenizing a further path component, and trying to find a matching child.
+
+        PCPathChar remainder = NULL;
+        size_t partialPathLength = GetPartialPathAndRemainder(absolutePath, absolutePathLength, /*out*/ remainder);
+        assert(absolutePath + partialPathLength <= remainder);
+        assert(remainder >= absolutePath);
+        assert(remainder <= absolutePath + absolutePathLength);
+
+        PCManifestRecord childRecord = NULL;
+        bool childFound = cursor.Record->FindChild(absolutePath, partialPathLength, /*out*/ childRecord);
+        if (!childFound || childRecord == NULL)
+        {
+            // There was path to consume, and a chance of finding a child record, but that didn't work.
+            // So, this is a third terminal case (but we had to do a bit of work to determine so).
+            return PolicySearchCursor(cursor, /*searchWasTruncated*/ true);
+        }
+
+        assert(childRecord != NULL);
 
-    // We're now committed to tokenizing a further path component, and trying to find a matching child.
+        // childRecord's partialPath is a prefix of remainder.
+        size_t remainderLength = absolutePathLength - (remainder - absolutePath);
+        assert(remainderLength <= pathlen(remainder));
+
+        // Iterative step: Consume some more of the path, if any. Note that we always continue with a non-truncated cursor due to the terminal cases above.
+        cursor = PolicySearchCursor(childRecord, cursor);
+        absolutePath = remainder;
+        absolutePathLength = remainderLength;
+    }
+}
 
-    PCPathChar remainder = NULL;
-    size_t partialPathLength = GetPartialPathAndRemainder(absolutePath, absolutePathLength, /*out*/ remainder);
-    assert(absolutePath + partialPathLength <= remainder);
-    assert(remainder >= absolutePath);
-    assert(remainder <= absolutePath + absolutePathLength);
+size_t GetParentPathLengthForPolicySearch(
+    __in  PCPathChar absolutePath,
+    __in  size_t absolutePathLength)
+{
+    assert(absolutePath);
+    assert(absolutePathLength <= pathlen(absolutePath));
 
-    PCManifestRecord childRecord = NULL;
-    bool childFound = cursor.Record->FindChild(absolutePath, partialPathLength, /*out*/ childRecord);
-    if (!childFound || childRecord == NULL)
+    size_t separator = absolutePathLength;
+    while (separator > 0 && !IsDirectorySeparator(absolutePath[separator - 1]))
     {
-        // There was path to consume, and a chance of finding a child record, but that didn't work.
-        // So, this is a third terminal case (but we had to do a bit of work to determine so).
-        return PolicySearchCursor(cursor.Record, cursor.Level, cursor.Parent, /*searchWasTruncated*/ true);
+        separator--;
     }
 
-    assert(childRecord != NULL);
+    // The search splits the path on every separator, so the parent ends at the last separator as long as there is a last component
+    // and it is not preceded by another separator: a run of separators is consumed along with the component that follows it
+    if (separator < 2 || separator == absolutePathLength || IsDirectorySeparator(absolutePath[separator - 2]))
+    {
+        return 0;
+    }
 
-    // childRecord's partialPath is a prefix of remainder.
-    size_t remainderLength = absolutePathLength - (remainder - absolutePath);
-    assert(remainderLength == pathlen(remainder));
-    // Recursive step: Consume some more of the path, if any. Note that we always recurse with a non-truncated cursor due to the terminal cases above.
-    return FindFileAccessPolicyInTreeEx(PolicySearchCursor(childRecord, cursor.Level + 1, MakePPolicySearchCursor(cursor)), remainder, remainderLength);
+    return separator - 1;
 }
 
 #ifdef BUILDXL_NATIVES_LIBRARY
@@ -121,7 +151,7 @@ BOOL WINAPI FindFileAccessPolicyInTree(
         return false;
     }
 
-    PolicySearchCursor newCursor = FindFileAccessPolicyInTreeEx(PolicySearchCursor(record, 0, 0), absolutePath, absolutePathLength);
+    PolicySearchCursor newCursor = FindFileAccessPolicyInTreeEx(PolicySearchCursor(record), absolutePath, absolutePathLength);
 	conePolicy = newCursor.Record->GetConePolicy();
 	nodePolicy = newCursor.Record->GetNodePolicy();
     expectedUsn = newCursor.GetExpectedUsn();
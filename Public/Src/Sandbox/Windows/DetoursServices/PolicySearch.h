@@ -15,37 +15,45 @@
 // already-found policy - i.e., Find(<root cursor>, "C:\foo") -> Cursor ; Find(Cursor, "bar") is
 // equivalent to Find("C:\foo\bar"); but repeated work is saved and the original path is not needed.
 struct PolicySearchCursor {
-#if _WIN32
-    typedef std::shared_ptr<PolicySearchCursor> PPolicySearchCursor;
-#define MakePPolicySearchCursor(cursor) std::make_shared<PolicySearchCursor>(cursor)
-#else
-    typedef PolicySearchCursor* PPolicySearchCursor;
-#define MakePPolicySearchCursor(cursor) nullptr
-#endif
-
     PolicySearchCursor()
-        : Record(nullptr), Level(0), Parent(nullptr), SearchWasTruncated(true)
+        : Record(nullptr), Level(0), SearchWasTruncated(true)
     {
+        InitializeAncestorLevels();
         assert(!IsValid());
     };
 
     // Implicit conversion constructor to start a search from a manifest record.
     PolicySearchCursor(ManifestRecord const* record)
-        : Record(record), Level(0), Parent(nullptr), SearchWasTruncated(false)
+        : Record(record), Level(0), SearchWasTruncated(false)
     {
         assert(record != nullptr);
+        InitializeAncestorLevels();
     }
 
-    PolicySearchCursor(ManifestRecord const* record, size_t level, PPolicySearchCursor parent)
-        : Record(record), Level(level), Parent(parent), SearchWasTruncated(false)
+    // Cursor for a child record of the record the parent cursor points to.
+    PolicySearchCursor(ManifestRecord const* record, PolicySearchCursor const& parent)
+        : Record(record), Level(parent.Level + 1), SearchWasTruncated(false)
     { 
         assert(record != nullptr);
+        assert(parent.IsValid());
+
+#if _WIN32
+        // The parent record becomes an ancestor: it is the shallowest one for the bits of its cone policy no other ancestor has
+        FileAccessPolicy parentConePolicy = parent.Record->GetConePolicy();
+        for (size_t bit = 0; bit < PolicyBitCount; bit++)
+        {
+            bool isShallowest = parent.AncestorLevels[bit] == NoAncestorLevel && (parentConePolicy & (1 << bit)) != 0 && parent.Level < NoAncestorLevel;
+            AncestorLevels[bit] = isShallowest ? (uint16_t)parent.Level : parent.AncestorLevels[bit];
+        }
+#endif
     }
 
-    PolicySearchCursor(ManifestRecord const* record, size_t level, PPolicySearchCursor parent, bool searchWasTruncated)
-        : Record(record), Level(level), Parent(parent), SearchWasTruncated(searchWasTruncated)
+    // Cursor pointing to the same record as the given one, with the given truncation state.
+    PolicySearchCursor(PolicySearchCursor const& cursor, bool searchWasTruncated)
+        : PolicySearchCursor(cursor)
     { 
-        assert(record != nullptr);
+        assert(cursor.IsValid());
+        SearchWasTruncated = searchWasTruncated;
     }
 
     // Gets the expected USN corresponding to this match. Returns -1 if this match was not for the complete
@@ -70,23 +78,70 @@ struct PolicySearchCursor {
     // d: is level 1, d:\a is level 2, d:\a\b is level 3, etc...
     size_t Level;
 
-    PPolicySearchCursor Parent;
+    // Finds the level of the shallowest ancestor of the record this cursor points to (the record itself excluded) whose
+    // cone policy has any of the given policy bits. Returns false if no ancestor has them.
+    // Ancestors are only tracked on Windows, elsewhere this always returns false.
+    bool TryGetShallowestAncestorLevel(FileAccessPolicy policy, size_t& level) const {
+        bool found = false;
+#if _WIN32
+        for (size_t bit = 0; bit < PolicyBitCount; bit++)
+        {
+            if ((policy & (1 << bit)) != 0 && AncestorLevels[bit] != NoAncestorLevel && (!found || AncestorLevels[bit] < level))
+            {
+                level = AncestorLevels[bit];
+                found = true;
+            }
+        }
+#endif
+
+        return found;
+    }
 
     // Indicates if the search generating this cursor was truncated due to reaching the bottom of the tree.
     // A search for "C:\foo\A" in a tree containing only the leaf C:\foo\B will point to the C:\foo record, but will
     // be marked truncated. Resuming a search for "B" should still return C:\foo (for a hypothetical C:\foo\A\B) rather
     // than matching to C:\foo\B.
     bool SearchWasTruncated;
+
+private:
+#if _WIN32
+    static const size_t PolicyBitCount = 16;
+    static const uint16_t NoAncestorLevel = 0xFFFF;
+    static_assert(FileAccessPolicy_ConeIsFullyListed < (1 << PolicyBitCount), "FileAccessPolicy doesn't fit in PolicyBitCount bits");
+
+    // For every bit of FileAccessPolicy, the level of the shallowest ancestor whose cone policy has it (or NoAncestorLevel).
+    // This is all that queries over the ancestors need, so we don't keep the ancestor chain itself: cursors are created
+    // for every path component of every detoured access, and keeping the chain would mean a heap allocation per component.
+    uint16_t AncestorLevels[PolicyBitCount];
+#endif
+
+    void InitializeAncestorLevels() {
+#if _WIN32
+        for (size_t bit = 0; bit < PolicyBitCount; bit++)
+        {
+            AncestorLevels[bit] = NoAncestorLevel;
+        }
+#endif
+    }
 };
 
 // Given a start cursor (which may be the root of a policy tree),
 // finds the closest matching policy node for absolutePath.
 // The returned cursor allows resuming the search, as if absolutePath had further path components.
+// absolutePath ends after absolutePathLength characters, so the search can be limited to a prefix of a path.
 PolicySearchCursor FindFileAccessPolicyInTreeEx(
     __in  PolicySearchCursor const& startCursor,
     __in  PCPathChar absolutePath,
     __in  size_t absolutePathLength);
 
+// Gets the length of the parent directory of absolutePath such that searching the parent from a cursor, then resuming the search with the
+// last component of absolutePath (which follows the parent and a separator), is equivalent to searching absolutePath from that cursor.
+// This lets callers keep the cursors of directories and only search the last component of the paths under them.
+// Returns 0 if absolutePath has no such parent: it has a single component, ends with a separator, or its last separator is doubled.
+size_t GetParentPathLengthForPolicySearch(
+    __in  PCPathChar absolutePath,
+    __in  size_t absolutePathLength);
+
 // This is equivalent to FindFileAccessPolicyInTreeEx, but taking just a start record
 // rather than a full cursor, and returning only the matched record details rather than a cursor.
 // This is a simplified variant for easier C#-side testing.
@@ -0,0 +1,53 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include "stdafx.h"
+#include "PolicySearchCache.h"
+
+uint64_t PolicySearchCache::Hash(PCPathChar path, size_t pathLength)
+{
+    // 64-bit FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < pathLength; i++) {
+        hash = (hash ^ (uint64_t)path[i]) * 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+bool PolicySearchCache::TryGet(PCPathChar path, size_t pathLength, PolicySearchCursor& cursor) {
+    uint64_t hash = Hash(path, pathLength);
+    Stripe& stripe = m_stripes[(hash >> 32) % StripeCount];
+
+    const std::shared_lock<std::shared_mutex> lock(stripe.Lock);
+    auto result = stripe.Entries.find(hash);
+    if (result == stripe.Entries.end()
+        || result->second.Path.length() != pathLength
+        || result->second.Path.compare(0, pathLength, path, pathLength) != 0) {
+        return false;
+    }
+
+    cursor = result->second.Cursor;
+    return true;
+}
+
+void PolicySearchCache::Add(PCPathChar path, size_t pathLength, PolicySearchCursor const& cursor) {
+    assert(cursor.IsValid());
+
+    uint64_t hash = Hash(path, pathLength);
+    Stripe& stripe = m_stripes[(hash >> 32) % StripeCount];
+
+    const std::unique_lock<std::shared_mutex> lock(stripe.Lock);
+    if (stripe.Entries.size() >= MaxEntriesPerStripe) {
+        stripe.Entries.clear();
+    }
+
+    Entry& entry = stripe.Entries[hash];
+    entry.Path.assign(path, pathLength);
+    entry.Cursor = cursor;
+}
+
+PolicySearchCache* PolicySearchCache::GetInstance() {
+    static PolicySearchCache s_singleton;
+    return &s_singleton;
+}
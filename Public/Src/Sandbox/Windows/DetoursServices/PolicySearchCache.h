@@ -0,0 +1,56 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include "PolicySearch.h"
+
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+
+// Caches the cursors resulting from policy searches that start at the root of the manifest tree, keyed by the searched path.
+// Processes tend to look up the policy of the same path over and over (e.g., GetFileAttributesW, CreateFileW and FindFirstFileExW
+// on the same path), and the manifest tree doesn't change during the lifetime of a process, so each path only needs to be searched once.
+// The directories of the searched paths are cached as well, so the search of a path not cached yet resumes from its directory.
+// Paths are compared exactly: a path that only differs in casing from a cached one is just searched again.
+//
+// The cache is split into stripes, each with its own lock, so threads looking up different paths rarely contend.
+// Stripes are bounded: a stripe that is full is cleared.
+// All operations are thread-safe.
+class PolicySearchCache {
+public:
+    static PolicySearchCache* GetInstance();
+
+    // Gets the cursor resulting from searching the given path from the root of the manifest tree, if it was cached
+    bool TryGet(PCPathChar path, size_t pathLength, PolicySearchCursor& cursor);
+
+    // Caches the cursor resulting from searching the given path from the root of the manifest tree
+    void Add(PCPathChar path, size_t pathLength, PolicySearchCursor const& cursor);
+
+private:
+    PolicySearchCache() = default;
+    PolicySearchCache(const PolicySearchCache&) = delete;
+    PolicySearchCache& operator = (const PolicySearchCache&) = delete;
+
+    static const size_t StripeCount = 16;
+    static const size_t MaxEntriesPerStripe = 4096;
+
+    struct Entry {
+        std::basic_string<PathChar> Path;
+        PolicySearchCursor Cursor;
+    };
+
+    // Entries are keyed by a hash of their path, and looked up without building a string.
+    // Entries whose paths have the same hash replace each other.
+    struct alignas(64) Stripe {
+        std::shared_mutex Lock;
+        std::unordered_map<uint64_t, Entry> Entries;
+    };
+
+    static uint64_t Hash(PCPathChar path, size_t pathLength);
+
+    Stripe m_stripes[StripeCount];
+};
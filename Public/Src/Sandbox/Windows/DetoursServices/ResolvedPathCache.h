@@ -3,10 +3,13 @@
 
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <map>
 #include <set>
 #include <memory>
 #include <shared_mutex>
+#include <unordered_map>
 #include <vector>
 
 #include "PathTree.h"
@@ -33,6 +36,46 @@ typedef std::pair<std::shared_ptr<std::vector<std::wstring>>, std::shared_ptr<st
 
 static CaseInsensitiveStringLessThan caseInsensitiveLessThan = CaseInsensitiveStringLessThan();
 
+// Last use of a cache entry, as a tick of the clock of the cache (see ResolvedPathCache::m_clock).
+// Lookups only hold a read lock, so they update it atomically.
+struct CacheEntryUse
+{
+    explicit CacheEntryUse(uint64_t tick) : Tick(tick) { }
+    CacheEntryUse(const CacheEntryUse& other) : Tick(other.Tick.load(std::memory_order_relaxed)) { }
+    CacheEntryUse& operator=(const CacheEntryUse&) = delete;
+
+    // Skips the store when the entry was already used at this tick, so hot entries don't keep bouncing between cores
+    void Touch(uint64_t now) const
+    {
+        if (Tick.load(std::memory_order_relaxed) != now)
+        {
+            Tick.store(now, std::memory_order_relaxed);
+        }
+    }
+
+    mutable std::atomic<uint64_t> Tick;
+};
+
+// A cached value along with its last use
+template<typename V> struct CachedValue
+{
+    CachedValue(const V& value, uint64_t tick) : Value(value), Use(tick) { }
+
+    V Value;
+    CacheEntryUse Use;
+};
+
+// An entry of the resolved paths (see ResolvedPathCache::m_paths). The id is what the reverse index refers to the entry by,
+// and the size is the estimate accounted for in the budget of the resolved paths when the entry was inserted.
+struct ResolvedPathsEntry : CachedValue<ResolvedPathCacheEntries>
+{
+    ResolvedPathsEntry(const ResolvedPathCacheEntries& entries, uint32_t id, size_t size, uint64_t tick)
+        : CachedValue<ResolvedPathCacheEntries>(entries, tick), Id(id), Size(size) { }
+
+    uint32_t Id;
+    size_t Size;
+};
+
 // Case insensitive comparer for the target cache to handle pairs (wstring, bool). Delegates the wstrings to
 // the CaseInsensitiveStringLessThan class.
 struct CaseInsensitiveTargetCacheLessThan {
@@ -53,54 +96,109 @@ struct CaseInsensitiveTargetCacheLessThan {
 // differences, but the resolved path cache should treat those as equivalent paths (e.g C:\foo, C:\FOO and C:\foo\ should be considered equivalent directories).
 // All cache related structures use a case insensitive comparer for paths. Observe this doesn't change any user-facing paths (i.e. 
 // paths reported or used for real accesses)
+//
+// The per-path caches (resolver and target caches) are split in shards, each with its own lock and path tree. A path goes to the shard of
+// its first two atoms (e.g. C:\foo for C:\foo\bar\baz), so all the descendants of a directory live in the shard of the directory, unless the
+// directory is a root. Threads accessing different parts of the file system don't contend, and inserts wait for the lock of their shard
+// instead of being dropped. The resolved paths (m_paths) relate paths across shards and are kept under a separate lock. When both are
+// needed, m_pathsLock is always acquired before any shard lock, and shard locks are acquired in the order of the shards.
+//
+// The cache lives as long as the process, which for compiler servers and the like can be the whole build, so its memory is bounded.
+// Half of the budget goes to the resolved paths (and their reverse index), the other half to the entries of the per-path caches.
+// Sizes are estimated from the length of the paths. When a half goes over its budget, its least recently used entries are evicted
+// in a batch, down to three quarters of the budget. Evicting never makes the cache wrong, it only makes it forget: an evicted path
+// is resolved again the next time it is accessed. The path trees only need the paths that still have an entry, so they are rebuilt
+// when the entries of the per-path caches are evicted, which keeps them bounded too.
 class ResolvedPathCache {
 public:
     inline bool InsertResolvingCheckResult(const std::wstring& path, bool result)
     {
-        // Using the cache is best effort, as this is faster than waiting on locks.  It is not incorrect to not have a value in the cache, just might result in more I/O when the file is not found in the cache.
-        ResolvedPathCacheWriteLock w_lock(m_lock, std::try_to_lock);
-        if (!w_lock.owns_lock())
-        {
-            return false;
-        }
-
         const std::wstring normalizedPath = Normalize(path);
-        if (!m_pathTree.TryInsert(normalizedPath))
+        Shard& shard = GetShard(normalizedPath);
+        bool inserted;
+
         {
-            return false;
+            ResolvedPathCacheWriteLock w_lock(shard.Lock);
+
+            if (!shard.Paths->TryInsert(normalizedPath))
+            {
+                return false;
+            }
+
+            inserted = InsertCachedValue(shard.ResolverCache, normalizedPath, result);
         }
 
-        return m_resolverCache.emplace(normalizedPath, result).second;
+        TrimIfOverBudget();
+        return inserted;
     }
 
     inline const Possible<bool> GetResolvingCheckResult(const std::wstring& path)
     {
-        // The resolver cache is essentially caching GetFileAttributesW when trying to discover reparse points. This is a very frequent IO operation and a relatively cheap
-        // one, so use best effort basis.
-        return Find(m_resolverCache, Normalize(path), true);
+        // The resolver cache is essentially caching GetFileAttributesW when trying to discover reparse points. This is a very frequent IO operation,
+        // sharding keeps the lock of the cache from becoming a bottleneck.
+        const std::wstring normalizedPath = Normalize(path);
+        Shard& shard = GetShard(normalizedPath);
+        ResolvedPathCacheReadLock r_lock(shard.Lock);
+        return Find(shard.ResolverCache, normalizedPath);
     }
 
-    inline bool InsertResolvedPathWithType(const std::wstring& path, std::wstring& resolved, DWORD type)
+    // Remembers that none of the atoms of a path is a reparse point
+    inline bool InsertPathWithoutReparsePoints(const std::wstring& path)
     {
-        ResolvedPathCacheWriteLock w_lock(m_lock, std::try_to_lock);
-        if (!w_lock.owns_lock())
+        const std::wstring normalizedPath = Normalize(path);
+        Shard& shard = GetShard(normalizedPath);
+        bool inserted;
+
         {
-            return false;
+            ResolvedPathCacheWriteLock w_lock(shard.Lock);
+
+            if (!shard.Paths->TryInsert(normalizedPath))
+            {
+                return false;
+            }
+
+            inserted = InsertCachedValue(shard.PathsWithoutReparsePoints, normalizedPath, true);
         }
 
+        TrimIfOverBudget();
+        return inserted;
+    }
+
+    inline bool IsPathWithoutReparsePoints(const std::wstring& path)
+    {
         const std::wstring normalizedPath = Normalize(path);
-        if (!m_pathTree.TryInsert(normalizedPath))
+        Shard& shard = GetShard(normalizedPath);
+        ResolvedPathCacheReadLock r_lock(shard.Lock);
+        return Find(shard.PathsWithoutReparsePoints, normalizedPath).Found;
+    }
+
+    inline bool InsertResolvedPathWithType(const std::wstring& path, std::wstring& resolved, DWORD type)
+    {
+        const std::wstring normalizedPath = Normalize(path);
+        Shard& shard = GetShard(normalizedPath);
+        bool inserted;
+
         {
-            return false;
+            ResolvedPathCacheWriteLock w_lock(shard.Lock);
+
+            if (!shard.Paths->TryInsert(normalizedPath))
+            {
+                return false;
+            }
+
+            inserted = InsertCachedValue(shard.TargetCache, normalizedPath, std::make_pair(resolved, type));
         }
 
-        return m_targetCache.emplace(normalizedPath, std::make_pair(resolved, type)).second;
+        TrimIfOverBudget();
+        return inserted;
     }
 
     inline const Possible<std::pair<std::wstring, DWORD>> GetResolvedPathAndType(const std::wstring& path)
     {
-        // This cache is only accessed on the case of reparse points, so we don't expect high contention on the lock. Not using best effort basis should be fine.
-        return Find(m_targetCache, Normalize(path), false);
+        const std::wstring normalizedPath = Normalize(path);
+        Shard& shard = GetShard(normalizedPath);
+        ResolvedPathCacheReadLock r_lock(shard.Lock);
+        return Find(shard.TargetCache, normalizedPath);
     }
 
     inline bool InsertResolvedPaths(
@@ -109,71 +207,100 @@ public:
         std::shared_ptr<std::vector<std::wstring>>& insertion_order,
         std::shared_ptr<std::map<std::wstring, ResolvedPathType, CaseInsensitiveStringLessThan>>& resolved_paths)
     {
-        ResolvedPathCacheWriteLock w_lock(m_lock, std::try_to_lock);
-        if (!w_lock.owns_lock())
-        {
-            return false;
-        }
+        ResolvedPathCacheWriteLock w_lock(m_pathsLock);
 
         std::wstring normalizedPath = Normalize(path);
 
-        if (!m_pathTree.TryInsert(normalizedPath))
+        if (!TryInsertInPathTree(normalizedPath))
         {
             return false;
         }
 
+        size_t size = EstimateSize(normalizedPath);
         for (auto iter = resolved_paths->begin(); iter != resolved_paths->end(); ++iter)
         {
-            if (!m_pathTree.TryInsert(Normalize(iter->first)))
+            if (!TryInsertInPathTree(Normalize(iter->first)))
             {
                 return false;
             }
+
+            size += EstimateSize(iter->first);
         }
 
+        // Threads racing to resolve the same path come up with the same resolution: the first one to insert it wins
+        std::pair<std::wstring, bool> key = std::make_pair(normalizedPath, preserveLastReparsePointInPath);
+        if (m_paths.find(key) != m_paths.end())
+        {
+            return false;
+        }
+
+        uint32_t id = NewResolvedPathsId();
         for (auto iter = insertion_order->begin(); iter != insertion_order->end(); ++iter)
         {
-            auto reverseLookup = m_paths_reverse.find(*iter);
-            if (reverseLookup != m_paths_reverse.end())
-            {
-                reverseLookup->second.insert(normalizedPath);
-            }
-            else
-            {
-                std::set<std::wstring, CaseInsensitiveStringLessThan> set = { normalizedPath };
-                m_paths_reverse.emplace(std::make_pair(*iter, set));
-            }
+            AddToReverseIndex(*iter, id);
+            size += EstimateSize(*iter);
+        }
+
+        auto entry = m_paths.emplace(key, ResolvedPathsEntry(std::make_pair(insertion_order, resolved_paths), id, size, NextTick())).first;
+        m_pathsById.emplace(id, entry);
+        m_pathsSize += size;
+
+        if (m_pathsSize > m_pathsBudget)
+        {
+            EvictLeastRecentlyUsedResolvedPaths();
         }
 
-        return m_paths.emplace(std::make_pair(normalizedPath, preserveLastReparsePointInPath), std::make_pair(insertion_order, resolved_paths)).second;
+        if (IsOverBudget())
+        {
+            TrimLocked();
+        }
+
+        return true;
     }
 
     inline const Possible<ResolvedPathCacheEntries> GetResolvedPaths(const std::wstring& path, bool preserveLastReparsePointInPath)
     {
-        // A hit in m_paths involves many IO operations. Let's not make the search best effort basis since waiting for a read lock is worth it
-        return Find(m_paths, std::make_pair(Normalize(path), preserveLastReparsePointInPath), false);
+        // A hit in m_paths saves many IO operations, so waiting for a read lock is worth it
+        ResolvedPathCacheReadLock r_lock(m_pathsLock);
+        return Find(m_paths, std::make_pair(Normalize(path), preserveLastReparsePointInPath));
     }
 
     void Invalidate(const std::wstring& path, bool isDirectory)
     {
-        ResolvedPathCacheWriteLock w_lock(m_lock);
+        ResolvedPathCacheWriteLock w_lock(m_pathsLock);
 
         const std::wstring normalizedPath = Normalize(path);
+        std::vector<std::wstring> descendants;
 
-        // Invalidating the back references to this normalized path is important only because by deleting or creating this link other links type (intermediate/fully resolved) may be out of date.
-        InvalidateThisPath(normalizedPath);
+        {
+            Shard& shard = GetShard(normalizedPath);
+            ResolvedPathCacheWriteLock w_shardLock(shard.Lock);
+            EraseCachedValues(shard, normalizedPath);
+        }
 
         if (isDirectory)
         {
-
             // Invalidate all its descendants
             // This is for absent path probes, if something probes a\b\c and suddently a\b changes, a\b\c might point somewhere different.  The same is not true for file symlinks
-            std::vector<std::wstring> descendants;
-            m_pathTree.RetrieveAndRemoveAllDescendants(normalizedPath, descendants);
-            for (auto iter = descendants.begin(); iter != descendants.end(); ++iter)
+            if (AreDescendantsInSameShard(normalizedPath))
+            {
+                RetrieveAndInvalidateAllDescendants(GetShard(normalizedPath), normalizedPath, descendants);
+            }
+            else
             {
-                InvalidateThisPath(*iter);
+                for (size_t i = 0; i < ShardCount; i++)
+                {
+                    RetrieveAndInvalidateAllDescendants(m_shards[i], normalizedPath, descendants);
+                }
             }
         }
+
+        // Invalidating the back references to this normalized path is important only because by deleting or creating this link other links type (intermediate/fully resolved) may be out of date.
+        InvalidateResolvedPaths(normalizedPath);
+        for (auto iter = descendants.begin(); iter != descendants.end(); ++iter)
+        {
+            InvalidateResolvedPaths(*iter);
+        }
     }
 
     /*
@@ -186,112 +313,422 @@ public:
      * B -> [A]      (4)
      * 
      * To invalidate B, we:
-     * Iterate  through (2), and remove B from (3) from m_paths_reverse
-     * Remove (2) from m_paths
-     * Iterate through (4), and remove (1) from m_paths
-     * Remove (4) from m_paths_reverse
+     * Remove (2) from m_paths, which removes B from (3) in m_paths_reverse
+     * Iterate through (4), and remove (1) from m_paths, which removes A from (4)
      *
      * Having the back pointers avoids O(n^2) search to remove the right value from m_paths
+     *
+     * Must be called while holding m_pathsLock.
      */
-    void InvalidateThisPath(const std::wstring& path)
+    void InvalidateResolvedPaths(const std::wstring& path)
     {
-        m_resolverCache.erase(path);
-        m_targetCache.erase(path);
+        // Erase (2), and B from (3)
+        EraseResolvedPaths(std::make_pair(path, true));
+        EraseResolvedPaths(std::make_pair(path, false));
 
-        // Erase B from (3)
-        // This must go before 'Erase B from (2)' because it needs to be able to find [C]
-        ErasePathFromReversePaths(path, false);
-        ErasePathFromReversePaths(path, true);
+        // Erase (1), and (4) along with its last back reference
+        auto reverseLookup = m_paths_reverse.find(path);
+        if (reverseLookup != m_paths_reverse.end())
+        {
+            // Erasing the entries removes them from (4), so iterate over a copy
+            std::vector<uint32_t> ids = reverseLookup->second;
+            for (auto it = ids.begin(); it != ids.end(); ++it)
+            {
+                auto entry = m_pathsById.find(*it);
+                if (entry != m_pathsById.end())
+                {
+                    EraseResolvedPaths(entry->second);
+                }
+            }
+        }
+    }
+
+    // Number of entries evicted to stay within the memory budget, from the resolved paths and from the per-path caches respectively
+    uint64_t GetEvictedResolvedPathsCount() const { return m_evictedResolvedPathsCount.load(std::memory_order_relaxed); }
+    uint64_t GetEvictedEntriesCount() const { return m_evictedEntriesCount.load(std::memory_order_relaxed); }
 
-        // Erase B from (2)
-        m_paths.erase(std::make_pair(path, true));
-        m_paths.erase(std::make_pair(path, false));
+    explicit ResolvedPathCache(size_t memoryBudget = DefaultMemoryBudget)
+        : m_pathsBudget(memoryBudget / 2), m_entriesBudget(memoryBudget - memoryBudget / 2)
+    { }
 
-        // Erase B from (1)
-        // This must go before 'Erase B from (4)' because it needs to be able to find [A]
-        EraseReversePathFromPaths(path);
+    ~ResolvedPathCache() = default;
+    ResolvedPathCache(const ResolvedPathCache&) = delete;
+    ResolvedPathCache& operator=(const ResolvedPathCache&) = delete;
 
-        // Erase B from (4)
-        m_paths_reverse.erase(path);
+    static ResolvedPathCache& Instance()
+    {
+        static ResolvedPathCache instance;
+        return instance;
     }
 
-    /// <summary>
-    /// Given a path, remove the pointers to that path in m_paths_reverse
-    /// </summary>
-    void ErasePathFromReversePaths(const std::wstring& path, bool preserveLastReparsePointInPath)
+private:
+    static const size_t ShardCount = 16;
+
+    // Estimated memory of the whole cache
+    static const size_t DefaultMemoryBudget = 64 * 1024 * 1024;
+
+    // Estimated memory of an entry besides its path: map and tree nodes, allocation headers, and the reverse index
+    static const size_t EntryOverhead = 128;
+
+    typedef std::map<std::pair<std::wstring, bool>, ResolvedPathsEntry, CaseInsensitiveTargetCacheLessThan> ResolvedPathsMap;
+
+    struct Shard
     {
-        // Find (B) in (2)
-        auto lookup = m_paths.find(std::make_pair(path, preserveLastReparsePointInPath));
-        if (lookup != m_paths.end())
+        ResolvedPathCacheLock Lock;
+
+        // A mapping used to cache if base paths need to be resolved (no entry) or have previously been fully resolved
+        std::map<std::wstring, CachedValue<bool>, CaseInsensitiveStringLessThan> ResolverCache;
+
+        // A mapping used to cache DeviceControl calls when querying targets of reparse points, used to avoid unnecessary I/O
+        std::map<std::wstring, CachedValue<std::pair<std::wstring, DWORD>>, CaseInsensitiveStringLessThan> TargetCache;
+
+        // Paths none of whose atoms is a reparse point, so checking the paths under one of them only needs to look at the atoms below it
+        std::map<std::wstring, CachedValue<bool>, CaseInsensitiveStringLessThan> PathsWithoutReparsePoints;
+
+        // All the paths of this shard the cache is aware of (see m_shards). Replaced when the shard is trimmed (see TrimLocked)
+        std::unique_ptr<PathTree> Paths = std::make_unique<PathTree>();
+    };
+
+    // Hashes the first two atoms of a normalized path, case-insensitively
+    inline Shard& GetShard(const std::wstring& normalizedPath)
+    {
+        size_t hash = 0;
+        int separators = 0;
+        for (auto c : normalizedPath)
         {
-            // Iterate through [C] in (2)
-            for (auto it = lookup->second.first->begin(), it_next = it; it != lookup->second.first->end(); it = it_next)
+            if (IsDirectorySeparator(c) && ++separators == 2)
             {
-                ++it_next;
-                // Find C in (3)
-                auto reverseLookup = m_paths_reverse.find(*it);
-                if (reverseLookup != m_paths_reverse.end())
+                break;
+            }
+
+            hash = hash * 31 + towlower(c);
+        }
+
+        return m_shards[hash % ShardCount];
+    }
+
+    // Descendants of a path are in its shard as long as the path has two atoms (a root followed by at least one more atom)
+    inline bool AreDescendantsInSameShard(const std::wstring& normalizedPath)
+    {
+        return std::any_of(normalizedPath.begin(), normalizedPath.end(), [](wchar_t c) { return IsDirectorySeparator(c); });
+    }
+
+    inline bool TryInsertInPathTree(const std::wstring& normalizedPath)
+    {
+        Shard& shard = GetShard(normalizedPath);
+        ResolvedPathCacheWriteLock w_lock(shard.Lock);
+        return shard.Paths->TryInsert(normalizedPath);
+    }
+
+    // Removes the descendants of a path that live in the given shard from its path tree and its caches, and adds them to 'descendants'
+    void RetrieveAndInvalidateAllDescendants(Shard& shard, const std::wstring& normalizedPath, std::vector<std::wstring>& descendants)
+    {
+        ResolvedPathCacheWriteLock w_lock(shard.Lock);
+
+        size_t first = descendants.size();
+        shard.Paths->RetrieveAndRemoveAllDescendants(normalizedPath, descendants);
+        for (size_t i = first; i < descendants.size(); i++)
+        {
+            EraseCachedValues(shard, descendants[i]);
+        }
+    }
+
+    // Find should not return a pointer, as that memory can become invalid if a different thread adds/removes from the map.
+    // Instead, the value store in the map should be a pointer so that the memory isn't copied.
+    // Must be called while holding (at least a read lock on) the lock that guards the map.
+    template<typename K, typename E, typename C>
+    const Possible<decltype(E::Value)> Find(std::map<K, E, C>& map, const K& path)
+    {
+        Possible<decltype(E::Value)> p;
+        auto iter = map.find(path);
+        p.Found = iter != map.end();
+        if (p.Found)
+        {
+            iter->second.Use.Touch(Now());
+            p.Value = iter->second.Value;
+        }
+
+        return p;
+    }
+
+    // The clock only advances on inserts, so lookups don't write to a location all threads share. Lookups tag the entries they
+    // find with the tick of the last insert: this is as precise as the eviction needs to be.
+    inline uint64_t NextTick() { return m_clock.fetch_add(1, std::memory_order_relaxed) + 1; }
+    inline uint64_t Now() const { return m_clock.load(std::memory_order_relaxed); }
+
+    static inline size_t EstimateSize(const std::wstring& path) { return EntryOverhead + path.size() * sizeof(wchar_t); }
+    static inline size_t EstimateSize(const std::wstring& path, bool) { return EstimateSize(path); }
+    static inline size_t EstimateSize(const std::wstring& path, const std::pair<std::wstring, DWORD>& target) { return EstimateSize(path) + target.first.size() * sizeof(wchar_t); }
+
+    // Must be called while holding the lock of the shard of the map
+    template<typename V, typename C>
+    bool InsertCachedValue(std::map<std::wstring, CachedValue<V>, C>& map, const std::wstring& normalizedPath, const V& value)
+    {
+        if (!map.emplace(normalizedPath, CachedValue<V>(value, NextTick())).second)
+        {
+            return false;
+        }
+
+        m_entriesSize.fetch_add(EstimateSize(normalizedPath, value), std::memory_order_relaxed);
+        return true;
+    }
+
+    // Must be called while holding the lock of the shard of the map
+    template<typename E, typename C>
+    void EraseCachedValue(std::map<std::wstring, E, C>& map, const std::wstring& normalizedPath)
+    {
+        auto iter = map.find(normalizedPath);
+        if (iter != map.end())
+        {
+            m_entriesSize.fetch_sub(EstimateSize(iter->first, iter->second.Value), std::memory_order_relaxed);
+            map.erase(iter);
+        }
+    }
+
+    // Must be called while holding the lock of the shard
+    void EraseCachedValues(Shard& shard, const std::wstring& normalizedPath)
+    {
+        EraseCachedValue(shard.ResolverCache, normalizedPath);
+        EraseCachedValue(shard.TargetCache, normalizedPath);
+        EraseCachedValue(shard.PathsWithoutReparsePoints, normalizedPath);
+    }
+
+    // Ids are only compared for equality, so they can wrap around as long as they skip the ones still in use.
+    // Must be called while holding m_pathsLock exclusively.
+    uint32_t NewResolvedPathsId()
+    {
+        while (m_pathsById.find(++m_nextPathsId) != m_pathsById.end())
+        {
+        }
+
+        return m_nextPathsId;
+    }
+
+    // Must be called while holding m_pathsLock exclusively
+    void AddToReverseIndex(const std::wstring& path, uint32_t id)
+    {
+        auto reverseLookup = m_paths_reverse.find(path);
+        if (reverseLookup == m_paths_reverse.end())
+        {
+            reverseLookup = m_paths_reverse.emplace(path, std::vector<uint32_t>()).first;
+            m_pathsSize += EstimateSize(path);
+        }
+
+        reverseLookup->second.push_back(id);
+        m_pathsSize += sizeof(uint32_t);
+    }
+
+    // Must be called while holding m_pathsLock exclusively
+    void RemoveFromReverseIndex(const std::wstring& path, uint32_t id)
+    {
+        auto reverseLookup = m_paths_reverse.find(path);
+        if (reverseLookup == m_paths_reverse.end())
+        {
+            return;
+        }
+
+        std::vector<uint32_t>& ids = reverseLookup->second;
+        auto it = std::find(ids.begin(), ids.end(), id);
+        if (it != ids.end())
+        {
+            *it = ids.back();
+            ids.pop_back();
+            m_pathsSize -= sizeof(uint32_t);
+        }
+
+        if (ids.empty())
+        {
+            m_pathsSize -= EstimateSize(reverseLookup->first);
+            m_paths_reverse.erase(reverseLookup);
+        }
+    }
+
+    // Removes an entry of m_paths, and its id from the reverse index of the paths it depends on.
+    // Must be called while holding m_pathsLock exclusively.
+    void EraseResolvedPaths(ResolvedPathsMap::iterator entry)
+    {
+        const std::vector<std::wstring>& insertionOrder = *entry->second.Value.first;
+        for (auto it = insertionOrder.begin(); it != insertionOrder.end(); ++it)
+        {
+            RemoveFromReverseIndex(*it, entry->second.Id);
+        }
+
+        m_pathsSize -= entry->second.Size;
+        m_pathsById.erase(entry->second.Id);
+        m_paths.erase(entry);
+    }
+
+    void EraseResolvedPaths(const std::pair<std::wstring, bool>& key)
+    {
+        auto entry = m_paths.find(key);
+        if (entry != m_paths.end())
+        {
+            EraseResolvedPaths(entry);
+        }
+    }
+
+    // Evicts the least recently used resolved paths, down to three quarters of their budget. Their paths stay in the path trees until
+    // the next trim, so they are accounted as stale tree paths meanwhile. Must be called while holding m_pathsLock exclusively.
+    void EvictLeastRecentlyUsedResolvedPaths()
+    {
+        size_t target = m_pathsBudget / 4 * 3;
+        while (m_pathsSize > target && !m_paths.empty())
+        {
+            std::vector<uint64_t> ticks;
+            ticks.reserve(m_paths.size());
+            for (auto iter = m_paths.begin(); iter != m_paths.end(); ++iter)
+            {
+                ticks.push_back(iter->second.Use.Tick.load(std::memory_order_relaxed));
+            }
+
+            uint64_t threshold = GetEvictionThreshold(ticks);
+            for (auto iter = m_paths.begin(), next = iter; iter != m_paths.end(); iter = next)
+            {
+                ++next;
+                if (iter->second.Use.Tick.load(std::memory_order_relaxed) <= threshold)
                 {
-                    // Remove B from (3)
-                    reverseLookup->second.erase(path);
+                    m_staleTreeSize.fetch_add(iter->second.Size, std::memory_order_relaxed);
+                    m_evictedResolvedPathsCount.fetch_add(1, std::memory_order_relaxed);
+
+                    // 'next' can't be invalidated: an entry only erases itself
+                    EraseResolvedPaths(iter);
                 }
             }
         }
     }
 
-    /// <summary>
-    /// Given a path, remove pointers to that path in m_paths
-    /// </summary>
-    void EraseReversePathFromPaths(const std::wstring& path)
+    // Returns the tick at or before which a quarter of the given entries were last used, so a batch of evictions doesn't leave too little
+    // room for the next inserts. Reorders the ticks.
+    static uint64_t GetEvictionThreshold(std::vector<uint64_t>& ticks)
     {
-        // Find (B) in (4)
-        auto reverseLookup = m_paths_reverse.find(path);
-        if (reverseLookup != m_paths_reverse.end())
+        size_t count = std::max<size_t>(ticks.size() / 4, 1);
+        std::nth_element(ticks.begin(), ticks.begin() + (count - 1), ticks.end());
+        return ticks[count - 1];
+    }
+
+    // Must be called while holding the lock of the shard of the map
+    template<typename E, typename C>
+    void EvictUsedUntil(std::map<std::wstring, E, C>& map, uint64_t threshold)
+    {
+        for (auto iter = map.begin(); iter != map.end();)
         {
-            // Iterate through [A] in (4)
-            for (auto it = reverseLookup->second.begin(), it_next = it; it != reverseLookup->second.end(); it = it_next)
+            if (iter->second.Use.Tick.load(std::memory_order_relaxed) <= threshold)
             {
-                ++it_next;
-                // Remove (A) from (1)
-                m_paths.erase(std::make_pair(*it, true));
-                m_paths.erase(std::make_pair(*it, false));
+                m_entriesSize.fetch_sub(EstimateSize(iter->first, iter->second.Value), std::memory_order_relaxed);
+                m_evictedEntriesCount.fetch_add(1, std::memory_order_relaxed);
+                iter = map.erase(iter);
+            }
+            else
+            {
+                ++iter;
             }
         }
     }
 
-    ResolvedPathCache() = default;
-    ~ResolvedPathCache() = default;
-    ResolvedPathCache(const ResolvedPathCache&) = delete;
-    ResolvedPathCache& operator=(const ResolvedPathCache&) = delete;
+    template<typename E, typename C>
+    static void AddTicks(const std::map<std::wstring, E, C>& map, std::vector<uint64_t>& ticks)
+    {
+        for (auto iter = map.begin(); iter != map.end(); ++iter)
+        {
+            ticks.push_back(iter->second.Use.Tick.load(std::memory_order_relaxed));
+        }
+    }
 
-    static ResolvedPathCache& Instance()
+    template<typename E, typename C>
+    static void InsertPaths(const std::map<std::wstring, E, C>& map, PathTree& paths)
     {
-        static ResolvedPathCache instance;
-        return instance;
+        for (auto iter = map.begin(); iter != map.end(); ++iter)
+        {
+            paths.TryInsert(iter->first);
+        }
     }
 
-private:
-    // Find should not return a pointer, as that memory can become invalid if a different thread adds/removes from the map.
-    // Instead, the value store in the map should be a pointer so that the memory isn't copied.
-    template<typename K, typename V, typename C>
-    const Possible<V> Find(std::map<K, V, C>& map, const K& path, bool bestEffortBasis)
+    inline bool IsOverBudget() const
     {
-        Possible<V> p;
-        ResolvedPathCacheReadLock r_lock = bestEffortBasis? ResolvedPathCacheReadLock(m_lock, std::try_to_lock) : ResolvedPathCacheReadLock(m_lock);
-        if (bestEffortBasis && !r_lock.owns_lock())
+        return m_entriesSize.load(std::memory_order_relaxed) + m_staleTreeSize.load(std::memory_order_relaxed) > m_entriesBudget;
+    }
+
+    // Trims the per-path caches when they are over their budget. Must be called without holding any lock of the cache.
+    void TrimIfOverBudget()
+    {
+        if (IsOverBudget())
         {
-            p.Found = false;
-            return p;
+            ResolvedPathCacheReadLock r_lock(m_pathsLock);
+            TrimLocked();
         }
+    }
 
-        auto iter = map.find(path);
-        p.Found = iter != map.end();
-        if (p.Found)
+    // Evicts the least recently used entries of the per-path caches (across all shards) down to three quarters of their budget, and
+    // rebuilds the path trees with the paths that still have an entry, so they let go of the paths evicted or no longer used.
+    // Must be called while holding m_pathsLock (the resolved paths still in the cache must stay in the trees).
+    void TrimLocked()
+    {
+        std::vector<ResolvedPathCacheWriteLock> shardLocks;
+        shardLocks.reserve(ShardCount);
+        for (size_t i = 0; i < ShardCount; i++)
         {
-            p.Value = iter->second;
+            shardLocks.emplace_back(m_shards[i].Lock);
         }
 
-        return p;
+        // Another thread may have trimmed while we were waiting for the locks
+        if (!IsOverBudget())
+        {
+            return;
+        }
+
+        size_t target = m_entriesBudget / 4 * 3;
+        while (m_entriesSize.load(std::memory_order_relaxed) > target)
+        {
+            std::vector<uint64_t> ticks;
+            for (size_t i = 0; i < ShardCount; i++)
+            {
+                AddTicks(m_shards[i].ResolverCache, ticks);
+                AddTicks(m_shards[i].TargetCache, ticks);
+                AddTicks(m_shards[i].PathsWithoutReparsePoints, ticks);
+            }
+
+            if (ticks.empty())
+            {
+                break;
+            }
+
+            uint64_t threshold = GetEvictionThreshold(ticks);
+            for (size_t i = 0; i < ShardCount; i++)
+            {
+                EvictUsedUntil(m_shards[i].ResolverCache, threshold);
+                EvictUsedUntil(m_shards[i].TargetCache, threshold);
+                EvictUsedUntil(m_shards[i].PathsWithoutReparsePoints, threshold);
+            }
+        }
+
+        std::unique_ptr<PathTree> paths[ShardCount];
+        for (size_t i = 0; i < ShardCount; i++)
+        {
+            paths[i] = std::make_unique<PathTree>();
+            InsertPaths(m_shards[i].ResolverCache, *paths[i]);
+            InsertPaths(m_shards[i].TargetCache, *paths[i]);
+            InsertPaths(m_shards[i].PathsWithoutReparsePoints, *paths[i]);
+        }
+
+        for (auto iter = m_paths.begin(); iter != m_paths.end(); ++iter)
+        {
+            const std::wstring& normalizedPath = iter->first.first;
+            paths[&GetShard(normalizedPath) - m_shards]->TryInsert(normalizedPath);
+
+            const auto& resolvedPaths = *iter->second.Value.second;
+            for (auto resolved = resolvedPaths.begin(); resolved != resolvedPaths.end(); ++resolved)
+            {
+                const std::wstring normalizedResolvedPath = Normalize(resolved->first);
+                paths[&GetShard(normalizedResolvedPath) - m_shards]->TryInsert(normalizedResolvedPath);
+            }
+        }
+
+        for (size_t i = 0; i < ShardCount; i++)
+        {
+            m_shards[i].Paths = std::move(paths[i]);
+        }
+
+        m_staleTreeSize.store(0, std::memory_order_relaxed);
     }
 
     // CanonicalPath does not canonicalize trailing slashes for directories
@@ -309,27 +746,42 @@ private:
         return GetPathWithoutPrefix(path.c_str());
     }
 
-    ResolvedPathCacheLock m_lock;
-
-    // A mapping used to cache if base paths need to be resolved (no entry) or have previously been fully resolved
-    std::map<std::wstring, bool, CaseInsensitiveStringLessThan> m_resolverCache;
-
-    // A mapping used to cache DeviceControl calls when querying targets of reparse points, used to avoid unnecessary I/O
-    std::map<std::wstring, std::pair<std::wstring, DWORD>, CaseInsensitiveStringLessThan> m_targetCache;
+    // Guards m_paths, m_paths_reverse and m_pathsById
+    ResolvedPathCacheLock m_pathsLock;
 
     // A mapping used to cache all intermediate paths and the final fully resolved path (value) of an unresolved base 
     // path where its last segment has to be resolved or not(key)
-    std::map<std::pair<std::wstring, bool>, ResolvedPathCacheEntries, CaseInsensitiveTargetCacheLessThan> m_paths;
+    ResolvedPathsMap m_paths;
+
+    // The entries of m_paths by id. Map iterators stay valid until their entry is erased.
+    std::unordered_map<uint32_t, ResolvedPathsMap::iterator> m_pathsById;
+    uint32_t m_nextPathsId = 0;
 
     // Reverse pointers of m_paths.  If m_paths has A -> B, then m_paths_reverse has B -> A
-    // Used to make removing values faster.
-    std::map<std::wstring, std::set<std::wstring, CaseInsensitiveStringLessThan>, CaseInsensitiveStringLessThan> m_paths_reverse;
+    // Used to make removing values faster. Entries are referred to by id, which is much smaller than their path.
+    std::map<std::wstring, std::vector<uint32_t>, CaseInsensitiveStringLessThan> m_paths_reverse;
+
+    // Estimated memory of m_paths and m_paths_reverse (guarded by m_pathsLock), and its budget
+    size_t m_pathsSize = 0;
+    const size_t m_pathsBudget;
+
+    // Estimated memory of the per-path caches across all shards, and of the paths of evicted resolved paths still in the path trees.
+    // Both count against the budget of the per-path caches.
+    std::atomic<size_t> m_entriesSize { 0 };
+    std::atomic<size_t> m_staleTreeSize { 0 };
+    const size_t m_entriesBudget;
+
+    // Ticks of the last uses of the entries (see NextTick)
+    std::atomic<uint64_t> m_clock { 0 };
+
+    std::atomic<uint64_t> m_evictedResolvedPathsCount { 0 };
+    std::atomic<uint64_t> m_evictedEntriesCount { 0 };
 
-    // All the paths the cache is aware of.
+    // All the paths the cache is aware of, split in the path trees of the shards (a path is in the tree of its shard).
     //
-    // This path tree is used for cache invalidation. Suppose that a process accesses D1 and D1\E1 where both D1 and E1 are
+    // These path trees are used for cache invalidation. Suppose that a process accesses D1 and D1\E1 where both D1 and E1 are
     // symlinks. The cache will have entries for both D1 and D1\E1. If D1 is removed (e.g., by calling RemoveDirectory), then
     // the entry for D1\E1 in the cache needs to be removed as well. Otherwise, if subsequently the process decides to create
     // D1\E1 again but D1 points to a different target, then any access of D1\E1 will get the wrong entry from the cache.
-    PathTree m_pathTree;
+    Shard m_shards[ShardCount];
 };
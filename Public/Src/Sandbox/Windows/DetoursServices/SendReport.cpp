@@ -6,9 +6,11 @@
 #include <algorithm>
 #include <memory>
 
+#include "BinaryReports.h"
 #include "DataTypes.h"
 #include "DebuggingHelpers.h"
 #include "DetoursHelpers.h"
+#include "DetoursPerformanceCounters.h"
 #include "FileAccessHelpers.h"
 #include "SendReport.h"
 #include "PolicyResult.h"
@@ -19,21 +21,74 @@ using std::unique_ptr;
 extern volatile LONG g_detoursAllocatedNoLockConcurentPoolEntries;
 extern volatile LONG64 g_detoursMaxHandleHeapEntries;
 extern volatile LONG64 g_detoursHandleHeapEntries;
+extern volatile LONG64 g_policySearchCacheHitCount;
+extern volatile LONG64 g_policySearchCacheMissCount;
 
 // ----------------------------------------------------------------------------
 // HELPER FUNCTION DEFINITIONS
 // ----------------------------------------------------------------------------
 
-void SendReportString(_In_z_ wchar_t const* dataString)
+// Capacity, in bytes, of a per-thread report buffer. Reports that don't fit in an empty buffer are written directly.
+#define REPORT_BUFFER_CAPACITY 16384
+
+// Period of the timer that flushes the report buffers of threads that stopped reporting, in milliseconds
+#define REPORT_BUFFER_FLUSH_PERIOD_MS 100
+
+// Reports buffered by a thread when EnableDetoursReportBatching is set. Buffers are never freed: when a thread
+// exits its buffer is flushed and released (OwnerThreadId is reset), and the next thread that needs one picks it up.
+struct ReportBuffer
 {
-    if (g_reportFileHandle == NULL || g_reportFileHandle == INVALID_HANDLE_VALUE) {
-        return;
-    }
+    SRWLOCK Lock;
+    ReportBuffer* Next;
+    volatile LONG OwnerThreadId;
+    LONG MessageCount;
+    size_t Length;
+    BYTE Data[REPORT_BUFFER_CAPACITY];
+};
+
+static ReportBuffer* volatile s_reportBuffers = nullptr;
+static PTP_TIMER volatile s_reportBuffersFlushTimer = nullptr;
+static volatile LONG s_reportBatchingStopped = 0;
+static __declspec(thread) ReportBuffer* gt_reportBuffer = nullptr;
+
+// Capacity, in bytes, of the buffer the report writer thread gathers queued reports in, so that they go out with few writes
+#define REPORT_WRITER_BUFFER_CAPACITY 65536
+
+// Reports waiting for the report writer thread when EnableDetoursAsyncReporting is set. The queue is a lock-free stack
+// any thread can push to; the writer takes all of it at once, and puts the reports back in the order they were queued.
+struct QueuedReport
+{
+    SLIST_ENTRY Entry;
+    QueuedReport* Next;
+    LONG MessageCount;
+    size_t Size;
+    BYTE Data[ANYSIZE_ARRAY];
+};
+
+static SLIST_HEADER s_queuedReports;
+static HANDLE s_reportsQueuedEvent = nullptr;
+static HANDLE s_reportWriterThread = nullptr;
+static volatile LONG s_reportWriterStopped = 0;
+
+// Serializes the writes of queued reports, so that the reports taken from the queue by a thread never go out after the ones
+// taken later by another. Guards s_reportWriterBuffer.
+static SRWLOCK s_queuedReportsWriteLock = SRWLOCK_INIT;
+static BYTE* s_reportWriterBuffer = nullptr;
+static __declspec(thread) bool gt_isWritingQueuedReports = false;
+
+// Writes 'size' bytes holding 'messageCount' reports to the report file with a single WriteFile.
+static void WriteReportDataToFile(_In_reads_bytes_(size) void const* data, size_t size, LONG messageCount)
+{
+    DWORD lastError = GetLastError();
 
     // Increment the message sent counter.
-    if (g_messageCountSemaphore != INVALID_HANDLE_VALUE)
+    if (g_messageCounter != nullptr)
+    {
+        InterlockedAdd64(g_messageCounter, messageCount);
+    }
+    else if (g_messageCountSemaphore != INVALID_HANDLE_VALUE)
     {
-        ReleaseSemaphore(g_messageCountSemaphore, 1, nullptr);
+        ReleaseSemaphore(g_messageCountSemaphore, messageCount, nullptr);
     }
 
     OVERLAPPED overlapped;
@@ -42,13 +97,11 @@ void SendReportString(_In_z_ wchar_t const* dataString)
     overlapped.Offset = 0xFFFFFFFF;
     overlapped.OffsetHigh = 0xFFFFFFFF;
 
-    size_t reportLineLength = sizeof(wchar_t) * wcslen(dataString);
     DWORD bytesWritten;
-    DWORD lastError = GetLastError();
-    if (!WriteFile(g_reportFileHandle, dataString, (DWORD)reportLineLength, &bytesWritten, &overlapped))
+    if (!WriteFile(g_reportFileHandle, data, (DWORD)size, &bytesWritten, &overlapped))
     {
         DWORD error = GetLastError();
-        std::wstring errorMsg = DebugStringFormat(L"SendReportString: Failed to write file access report line '%s' (error code: 0x%08X)", dataString, (int)error);
+        std::wstring errorMsg = DebugStringFormat(L"SendReportString: Failed to write %d report(s) of %d bytes in total (error code: 0x%08X)", (int)messageCount, (int)size, (int)error);
         Dbg(errorMsg.c_str());
         HandleDetoursInjectionAndCommunicationErrors(DETOURS_PIPE_WRITE_ERROR_4, errorMsg.c_str(), DETOURS_WINDOWS_LOG_MESSAGE_4);
     }
@@ -56,6 +109,388 @@ void SendReportString(_In_z_ wchar_t const* dataString)
     SetLastError(lastError);
 }
 
+// Writes out the reports queued so far, in the order they were queued. s_queuedReportsWriteLock must be held, unless all the other threads are gone.
+static void WriteQueuedReportsLocked()
+{
+    QueuedReport* first = nullptr;
+    for (PSLIST_ENTRY entry = InterlockedFlushSList(&s_queuedReports); entry != nullptr; entry = entry->Next)
+    {
+        QueuedReport* report = CONTAINING_RECORD(entry, QueuedReport, Entry);
+        report->Next = first;
+        first = report;
+    }
+
+    gt_isWritingQueuedReports = true;
+
+    size_t length = 0;
+    LONG messageCount = 0;
+    bool backlogCounted = false;
+    while (first != nullptr)
+    {
+        QueuedReport* report = first;
+        first = report->Next;
+
+        if (length > 0 && length + report->Size > REPORT_WRITER_BUFFER_CAPACITY)
+        {
+            if (!backlogCounted)
+            {
+                CountDetoursEvent(DetoursEvent::ReportWriterBacklog);
+                backlogCounted = true;
+            }
+
+            WriteReportDataToFile(s_reportWriterBuffer, length, messageCount);
+            length = 0;
+            messageCount = 0;
+        }
+
+        if (report->Size > REPORT_WRITER_BUFFER_CAPACITY)
+        {
+            WriteReportDataToFile(report->Data, report->Size, report->MessageCount);
+        }
+        else
+        {
+            memcpy(&s_reportWriterBuffer[length], report->Data, report->Size);
+            length += report->Size;
+            messageCount += report->MessageCount;
+        }
+
+        _dd_aligned_free(report);
+    }
+
+    if (length > 0)
+    {
+        WriteReportDataToFile(s_reportWriterBuffer, length, messageCount);
+    }
+
+    gt_isWritingQueuedReports = false;
+}
+
+static DWORD WINAPI ReportWriterThreadProc(LPVOID)
+{
+    while (WaitForSingleObject(s_reportsQueuedEvent, INFINITE) == WAIT_OBJECT_0)
+    {
+        AcquireSRWLockExclusive(&s_queuedReportsWriteLock);
+        WriteQueuedReportsLocked();
+        ReleaseSRWLockExclusive(&s_queuedReportsWriteLock);
+    }
+
+    return 0;
+}
+
+// Queues reports for the report writer thread. Returns false if the reports must be written by the calling thread instead.
+static bool TryQueueReportData(_In_reads_bytes_(size) void const* data, size_t size, LONG messageCount)
+{
+    if (s_reportWriterThread == nullptr || s_reportWriterStopped != 0 || gt_isWritingQueuedReports)
+    {
+        return false;
+    }
+
+    DWORD lastError = GetLastError();
+    QueuedReport* report = (QueuedReport*)_dd_aligned_malloc(offsetof(QueuedReport, Data) + size, MEMORY_ALLOCATION_ALIGNMENT);
+    if (report == nullptr)
+    {
+        SetLastError(lastError);
+        return false;
+    }
+
+    report->MessageCount = messageCount;
+    report->Size = size;
+    memcpy(report->Data, data, size);
+
+    // Only the first report queued since the writer last took the queue needs to wake it up
+    if (InterlockedPushEntrySList(&s_queuedReports, &report->Entry) == nullptr)
+    {
+        SetEvent(s_reportsQueuedEvent);
+    }
+
+    SetLastError(lastError);
+    return true;
+}
+
+// Writes 'size' bytes holding 'messageCount' reports to the report file with a single WriteFile, or queues them for the report writer thread.
+static void WriteReportData(_In_reads_bytes_(size) void const* data, size_t size, LONG messageCount)
+{
+    if (!TryQueueReportData(data, size, messageCount))
+    {
+        WriteReportDataToFile(data, size, messageCount);
+    }
+}
+
+// Writes out the lines buffered so far. The lock of the buffer must be held.
+static void FlushReportBufferLocked(ReportBuffer* buffer)
+{
+    if (buffer->Length > 0)
+    {
+        WriteReportData(buffer->Data, buffer->Length, buffer->MessageCount);
+        buffer->Length = 0;
+        buffer->MessageCount = 0;
+    }
+}
+
+static VOID CALLBACK FlushReportBuffersTimerCallback(PTP_CALLBACK_INSTANCE, PVOID, PTP_TIMER)
+{
+    FlushReportBuffers();
+}
+
+// Starts the periodic flush of the report buffers, the first time a buffer is created.
+static void EnsureReportBuffersFlushTimer()
+{
+    if (s_reportBuffersFlushTimer != nullptr)
+    {
+        return;
+    }
+
+    PTP_TIMER timer = CreateThreadpoolTimer(FlushReportBuffersTimerCallback, nullptr, nullptr);
+    if (timer == nullptr)
+    {
+        // Buffers are still flushed when they fill up, when threads exit and when processes are created.
+        return;
+    }
+
+    if (InterlockedCompareExchangePointer((PVOID volatile*)&s_reportBuffersFlushTimer, timer, nullptr) != nullptr)
+    {
+        // Another thread started the timer first
+        CloseThreadpoolTimer(timer);
+        return;
+    }
+
+    // A negative due time is relative, in 100ns units
+    ULARGE_INTEGER dueTime;
+    dueTime.QuadPart = (ULONGLONG)(-(LONGLONG)REPORT_BUFFER_FLUSH_PERIOD_MS * 10000);
+    FILETIME fileDueTime;
+    fileDueTime.dwLowDateTime = dueTime.LowPart;
+    fileDueTime.dwHighDateTime = dueTime.HighPart;
+    SetThreadpoolTimer(timer, &fileDueTime, REPORT_BUFFER_FLUSH_PERIOD_MS, REPORT_BUFFER_FLUSH_PERIOD_MS / 2);
+}
+
+// Gets the report buffer of the current thread, reusing a released buffer if there is one. Returns nullptr if no buffer can be allocated.
+static ReportBuffer* GetThreadReportBuffer()
+{
+    if (gt_reportBuffer != nullptr)
+    {
+        return gt_reportBuffer;
+    }
+
+    LONG threadId = (LONG)GetCurrentThreadId();
+    for (ReportBuffer* buffer = s_reportBuffers; buffer != nullptr; buffer = buffer->Next)
+    {
+        if (InterlockedCompareExchange(&buffer->OwnerThreadId, threadId, 0) == 0)
+        {
+            gt_reportBuffer = buffer;
+            return buffer;
+        }
+    }
+
+    ReportBuffer* buffer = (ReportBuffer*)dd_malloc(sizeof(ReportBuffer));
+    if (buffer == nullptr)
+    {
+        return nullptr;
+    }
+
+    InitializeSRWLock(&buffer->Lock);
+    buffer->OwnerThreadId = threadId;
+    buffer->MessageCount = 0;
+    buffer->Length = 0;
+
+    ReportBuffer* head;
+    do
+    {
+        head = s_reportBuffers;
+        buffer->Next = head;
+    } while (InterlockedCompareExchangePointer((PVOID volatile*)&s_reportBuffers, buffer, head) != head);
+
+    EnsureReportBuffersFlushTimer();
+
+    gt_reportBuffer = buffer;
+    return buffer;
+}
+
+// Sends a report made of 'prefix' (which may be empty) followed by 'data'.
+static void SendReportData(
+    _In_reads_bytes_(prefixSize) void const* prefix,
+    size_t prefixSize,
+    _In_reads_bytes_(dataSize) void const* data,
+    size_t dataSize)
+{
+    size_t reportSize = prefixSize + dataSize;
+
+    if (EnableDetoursPerformanceCounters())
+    {
+        CountReportSize(reportSize);
+    }
+
+    if (EnableDetoursReportBatching() && s_reportBatchingStopped == 0 && reportSize <= REPORT_BUFFER_CAPACITY)
+    {
+        DWORD lastError = GetLastError();
+        ReportBuffer* buffer = GetThreadReportBuffer();
+        if (buffer != nullptr)
+        {
+            AcquireSRWLockExclusive(&buffer->Lock);
+
+            if (buffer->Length + reportSize > REPORT_BUFFER_CAPACITY)
+            {
+                FlushReportBufferLocked(buffer);
+            }
+
+            if (prefixSize > 0)
+            {
+                memcpy(&buffer->Data[buffer->Length], prefix, prefixSize);
+            }
+
+            memcpy(&buffer->Data[buffer->Length + prefixSize], data, dataSize);
+            buffer->Length += reportSize;
+            buffer->MessageCount++;
+
+            ReleaseSRWLockExclusive(&buffer->Lock);
+            SetLastError(lastError);
+            return;
+        }
+
+        SetLastError(lastError);
+    }
+
+    if (prefixSize == 0)
+    {
+        WriteReportData(data, dataSize, 1);
+        return;
+    }
+
+    // A report must go out in a single write, so that it doesn't interleave with reports from other threads and processes
+    unique_ptr<BYTE[]> report(new BYTE[reportSize]);
+    memcpy(report.get(), prefix, prefixSize);
+    memcpy(report.get() + prefixSize, data, dataSize);
+    WriteReportData(report.get(), reportSize, 1);
+}
+
+void SendReportString(_In_z_ wchar_t const* dataString)
+{
+    if (g_reportFileHandle == NULL || g_reportFileHandle == INVALID_HANDLE_VALUE) {
+        return;
+    }
+
+    HotPathTimer timer(DetoursHotPath::Reporting);
+
+    size_t reportLineSize = sizeof(wchar_t) * wcslen(dataString); // in bytes
+
+    if (EnableDetoursBinaryReports())
+    {
+        ReportFrameHeader header;
+        header.Length = (uint32_t)(sizeof(header.Kind) + reportLineSize);
+        header.Kind = ReportFrameKind_TextLine;
+        SendReportData(&header, sizeof(header), dataString, reportLineSize);
+    }
+    else
+    {
+        SendReportData(nullptr, 0, dataString, reportLineSize);
+    }
+}
+
+void FlushReportBuffers()
+{
+    for (ReportBuffer* buffer = s_reportBuffers; buffer != nullptr; buffer = buffer->Next)
+    {
+        AcquireSRWLockExclusive(&buffer->Lock);
+        FlushReportBufferLocked(buffer);
+        ReleaseSRWLockExclusive(&buffer->Lock);
+    }
+}
+
+void ReleaseThreadReportBuffer()
+{
+    ReportBuffer* buffer = gt_reportBuffer;
+    if (buffer == nullptr)
+    {
+        return;
+    }
+
+    gt_reportBuffer = nullptr;
+
+    AcquireSRWLockExclusive(&buffer->Lock);
+    FlushReportBufferLocked(buffer);
+    InterlockedExchange(&buffer->OwnerThreadId, 0);
+    ReleaseSRWLockExclusive(&buffer->Lock);
+}
+
+void StopReportBatching()
+{
+    InterlockedExchange(&s_reportBatchingStopped, 1);
+
+    // By the time the process detaches, the other threads are gone, and some may have been terminated while holding
+    // the lock of a buffer. The content of such a buffer may be partially written: drop it rather than blocking forever.
+    // The flush timer is left alone: the thread pool is being torn down as well.
+    for (ReportBuffer* buffer = s_reportBuffers; buffer != nullptr; buffer = buffer->Next)
+    {
+        if (TryAcquireSRWLockExclusive(&buffer->Lock))
+        {
+            FlushReportBufferLocked(buffer);
+            ReleaseSRWLockExclusive(&buffer->Lock);
+        }
+    }
+}
+
+void StartReportWriter()
+{
+    if (!EnableDetoursAsyncReporting() || g_reportFileHandle == NULL || g_reportFileHandle == INVALID_HANDLE_VALUE)
+    {
+        return;
+    }
+
+    InitializeSListHead(&s_queuedReports);
+
+    s_reportWriterBuffer = (BYTE*)dd_malloc(REPORT_WRITER_BUFFER_CAPACITY);
+    s_reportsQueuedEvent = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+    if (s_reportWriterBuffer == nullptr || s_reportsQueuedEvent == nullptr)
+    {
+        // Reports are written by the threads sending them
+        Dbg(L"StartReportWriter: Failed to set up the report writer (error code: 0x%08X), reports are written synchronously", (int)GetLastError());
+        return;
+    }
+
+    // The thread starts running once the loader lock is released. Until then, flushes write the queued reports themselves.
+    s_reportWriterThread = CreateThread(nullptr, 0, ReportWriterThreadProc, nullptr, 0, nullptr);
+    if (s_reportWriterThread == nullptr)
+    {
+        Dbg(L"StartReportWriter: Failed to create the report writer thread (error code: 0x%08X), reports are written synchronously", (int)GetLastError());
+    }
+    else if (RaiseSandboxHelperThreadPriority() && !SetThreadPriority(s_reportWriterThread, THREAD_PRIORITY_ABOVE_NORMAL))
+    {
+        // The writer still runs, just at the priority of the threads it serves
+        Dbg(L"StartReportWriter: Failed to raise the priority of the report writer thread (error code: 0x%08X)", (int)GetLastError());
+    }
+}
+
+void FlushQueuedReports()
+{
+    // A write of queued reports that fails ends up here: the lock is already held by the current thread
+    if (s_reportWriterThread == nullptr || gt_isWritingQueuedReports)
+    {
+        return;
+    }
+
+    AcquireSRWLockExclusive(&s_queuedReportsWriteLock);
+    WriteQueuedReportsLocked();
+    ReleaseSRWLockExclusive(&s_queuedReportsWriteLock);
+}
+
+void StopReportWriter()
+{
+    if (s_reportWriterThread == nullptr)
+    {
+        return;
+    }
+
+    InterlockedExchange(&s_reportWriterStopped, 1);
+
+    // As in StopReportBatching, the writer thread is gone by now, and it may have been terminated while holding the lock.
+    // Nothing else can be writing queued reports then, so the queue is written out regardless.
+    bool locked = TryAcquireSRWLockExclusive(&s_queuedReportsWriteLock) != FALSE;
+    WriteQueuedReportsLocked();
+    if (locked)
+    {
+        ReleaseSRWLockExclusive(&s_queuedReportsWriteLock);
+    }
+}
+
 /**
  ** Escapes new line characters from filenames by replacing the \ with \\
  ** Returns true if the filename needed to be escaped, with the escaped name set in escapedFileName.
@@ -95,6 +530,72 @@ bool EscapeFileName(PCWSTR fileName, size_t fileNameLength, std::wstring &escape
     return false;
 }
 
+// Sends a file access as a ReportFrameKind_FileAccess frame (see BinaryReports.h)
+static void SendBinaryFileAccessReport(
+    FileOperationContext const& fileOperationContext,
+    FileAccessStatus status,
+    PolicyResult const& policyResult,
+    AccessCheckResult const& accessCheckResult,
+    DWORD error,
+    USN usn,
+    PCWSTR fileName,
+    size_t fileNameLength,
+    wchar_t const* filter)
+{
+    PCWSTR filterStr = filter == nullptr || accessCheckResult.Access != RequestedAccess::Enumerate ? L"" : filter;
+
+    // As with text reports, the command line is only sent with the "Process" operation, so it goes out once per process.
+    // Lengths are explicit, so unlike text reports there is no need to get rid of the newline characters it may contain.
+    PCWSTR processArgs = L"";
+    if (ReportProcessArgs() && g_currentProcessCommandLine != nullptr && !_wcsicmp(fileOperationContext.Operation, L"Process")) {
+        processArgs = g_currentProcessCommandLine;
+    }
+
+    BinaryFileAccessReport record;
+    record.Usn = (uint64_t)usn;
+    record.ProcessId = g_currentProcessId;
+    record.Id = fileOperationContext.Id;
+    record.CorrelationId = fileOperationContext.CorrelationId;
+    record.RequestedAccess = (uint32_t)accessCheckResult.Access;
+    record.Status = (uint32_t)status;
+    record.ExplicitlyReported = accessCheckResult.Level == ReportLevel::ReportExplicit ? 1 : 0;
+    record.Error = error;
+    record.DesiredAccess = fileOperationContext.DesiredAccess;
+    record.ShareMode = fileOperationContext.ShareMode;
+    record.CreationDisposition = fileOperationContext.CreationDisposition;
+    record.FlagsAndAttributes = fileOperationContext.FlagsAndAttributes;
+    record.OpenedFileOrDirectoryAttributes = fileOperationContext.OpenedFileOrDirectoryAttributes;
+    record.PathId = policyResult.IsIndeterminate() ? 0 : policyResult.GetPathId();
+    record.OperationLength = (uint32_t)wcslen(fileOperationContext.Operation);
+    record.PathLength = (uint32_t)fileNameLength;
+    record.FilterLength = (uint32_t)wcslen(filterStr);
+    record.ProcessArgsLength = (uint32_t)wcslen(processArgs);
+
+    size_t stringsLength = (size_t)record.OperationLength + record.PathLength + record.FilterLength + record.ProcessArgsLength; // in characters
+    size_t reportSize = sizeof(ReportFrameHeader) + sizeof(BinaryFileAccessReport) + sizeof(wchar_t) * stringsLength;
+
+    ReportFrameHeader header;
+    header.Length = (uint32_t)(reportSize - sizeof(header.Length));
+    header.Kind = ReportFrameKind_FileAccess;
+
+    unique_ptr<BYTE[]> report(new BYTE[reportSize]);
+    BYTE* cursor = report.get();
+    auto append = [&cursor](void const* source, size_t size) {
+        memcpy(cursor, source, size);
+        cursor += size;
+    };
+
+    append(&header, sizeof(header));
+    append(&record, sizeof(record));
+    append(fileOperationContext.Operation, sizeof(wchar_t) * record.OperationLength);
+    append(fileName, sizeof(wchar_t) * record.PathLength);
+    append(filterStr, sizeof(wchar_t) * record.FilterLength);
+    append(processArgs, sizeof(wchar_t) * record.ProcessArgsLength);
+    assert(cursor == report.get() + reportSize);
+
+    SendReportData(nullptr, 0, report.get(), reportSize);
+}
+
 // ----------------------------------------------------------------------------
 // FUNCTION DEFINITIONS
 // ----------------------------------------------------------------------------
@@ -112,6 +613,8 @@ void ReportFileAccess(
         return;
     }
 
+    HotPathTimer timer(DetoursHotPath::Reporting);
+
     PCWSTR fileName, filterStr;
     std::wstring escapedFileName;
 
@@ -128,6 +631,12 @@ void ReportFileAccess(
 
     size_t fileNameLength = wcslen(fileName); // in characters
 
+    if (EnableDetoursBinaryReports())
+    {
+        SendBinaryFileAccessReport(fileOperationContext, status, policyResult, accessCheckResult, error, usn, fileName, fileNameLength, filter);
+        return;
+    }
+
     if (EscapeFileName(fileName, fileNameLength, escapedFileName))
     {
         fileName = escapedFileName.c_str();
@@ -262,7 +771,8 @@ void ReportProcessDetouringStatus(
     const DWORD dwCreationFlags,
     const BOOL detoured,
     const DWORD error,
-    const CreateDetouredProcessStatus createProcessStatus)
+    const CreateDetouredProcessStatus createProcessStatus,
+    const ProcessDetouringTimings* timings)
 {
     if (g_reportFileHandle == NULL || g_reportFileHandle == INVALID_HANDLE_VALUE || !ShouldLogProcessDetouringStatus()) {
         return;
@@ -307,7 +817,8 @@ void ReportProcessDetouringStatus(
         30 /*Report ID type*/ +
         30 /*Process ID*/ +
         (30 * 14) /*4-byte int values*/ +
-        16 /*Separators*/ +
+        (30 * 5) /*Phase durations*/ +
+        21 /*Separators*/ +
         (processName != nullptr ? wcslen(processName.get()) : 10) /*processName*/ +
         (lpApplicationName != nullptr ? wcslen(lpApplicationName) : 10) /*lpApplicationName*/ +
         (lpCommandLine != nullptr ? wcslen(lpCommandLine) : 10) /*lpCommandLine*/ +
@@ -321,8 +832,12 @@ void ReportProcessDetouringStatus(
 
     unique_ptr<wchar_t[]> report(new wchar_t[reportBufferSize]);
 
+    // Phase durations are only known once the process is created
+    const ProcessDetouringTimings noTimings;
+    const ProcessDetouringTimings& durations = timings != nullptr ? *timings : noTimings;
+
 #pragma warning(suppress: 4826)
-    int const constructReportResult = swprintf_s(report.get(), reportBufferSize, L"%u,%lu|%u|%s|%s|%u|%u|%u|%u|%u|%llu|%u|%u|%u|%u|%u|%s\r\n",
+    int const constructReportResult = swprintf_s(report.get(), reportBufferSize, L"%u,%lu|%u|%s|%s|%u|%u|%u|%u|%u|%llu|%u|%u|%u|%u|%u|%llu|%llu|%llu|%llu|%llu|%s\r\n",
         ReportType::ReportType_ProcessDetouringStatus,
         GetCurrentProcessId(),
         status,
@@ -339,6 +854,11 @@ void ReportProcessDetouringStatus(
         detoured ? 1 : 0,
         (unsigned)error,
         (unsigned)createProcessStatus,
+        (unsigned long long)durations.CreateProcessMicroseconds,
+        (unsigned long long)durations.InjectionMicroseconds,
+        (unsigned long long)durations.DllInjectionMicroseconds,
+        (unsigned long long)durations.DriveMappingMicroseconds,
+        (unsigned long long)durations.PayloadCopyMicroseconds,
         commandLine.c_str());
 
     assert(constructReportResult > 0);
@@ -379,9 +899,11 @@ void ReportProcessData(
     // exit time, and the kernel and user mode execution times. They have a high and low DWORD value.
     // There is 1 32 bit process exit code.
     // There is 1 32 bit parent process id.
-    // There are 29 separators for the "," and "|" characters. (30 values total gives us 29 separators)
+    // There are 32 separators for the "," and "|" characters. (33 values total gives us 32 separators)
     // There are 5 * 64 bit and 2 * 32 bit for detours max memory heap size * and payload size, final heap allocated, max and final HandleHeapEntries, allocated pool entries for the non-locking list.
     // There are 6 * 64 bit for the max allocated/reallocated, virtual allocated data, max realloc chunck, final and max app used heap space
+    // There are 2 * 64 bit for the policy search cache hits and misses.
+    // And the Detours performance counters, which are empty unless EnableDetoursPerformanceCounters is set.
     // And the length of the module file name.
     // 3 characters for "\r\n" and null.
     size_t const reportBufferSize = 
@@ -389,16 +911,25 @@ void ReportProcessData(
         10 /*Process ID*/ +
         (20 * 6) /*IO Counters*/ +
         (10 * 7) /*Creation, exit, kernel, user times*/ +
-        29 /*Separators*/ +
+        32 /*Separators*/ +
         MAX_PATH + /*Module file name*/ +
         10 /*Process exit code*/ +
         10 /*Parent process id*/ +
         120 /*Detours max memory heap size * and payload size, final heap allocated, max and final HandleHeapEntries, allocated pool entries for the non-locking list. */ +
+        (20 * 2) /*Policy search cache hits and misses*/ +
+        DETOURS_PERFORMANCE_COUNTERS_MAX_LENGTH /*Performance counters*/ +
         3; /*\r\n null*/
 
+    wchar_t performanceCounters[DETOURS_PERFORMANCE_COUNTERS_MAX_LENGTH];
+    performanceCounters[0] = L'\0';
+    if (EnableDetoursPerformanceCounters())
+    {
+        FormatDetoursPerformanceCounters(performanceCounters, _countof(performanceCounters));
+    }
+
     wchar_t report[reportBufferSize];
 
-    int const constructReportResult = swprintf_s(report, reportBufferSize, L"%u,%lu|%I64u|%I64u|%I64u|%I64u|%I64u|%I64u|%lu|%lu|%lu|%lu|%lu|%lu|%lu|%lu|%s|%lu|%lu|%I64u|%lu|%I64u|%lu|%I64u|%I64u\r\n",
+    int const constructReportResult = swprintf_s(report, reportBufferSize, L"%u,%lu|%I64u|%I64u|%I64u|%I64u|%I64u|%I64u|%lu|%lu|%lu|%lu|%lu|%lu|%lu|%lu|%s|%lu|%lu|%I64u|%lu|%I64u|%lu|%I64u|%I64u|%I64u|%I64u|%s\r\n",
         ReportType::ReportType_ProcessData,
         GetCurrentProcessId(),
         ioCounters.ReadOperationCount,
@@ -423,7 +954,10 @@ void ReportProcessData(
         (ULONG64)g_detoursHeapAllocatedMemoryInBytes,
         (ULONG)g_detoursAllocatedNoLockConcurentPoolEntries,
         (ULONG64)g_detoursMaxHandleHeapEntries,
-        (ULONG64)g_detoursHandleHeapEntries);
+        (ULONG64)g_detoursHandleHeapEntries,
+        (ULONG64)g_policySearchCacheHitCount,
+        (ULONG64)g_policySearchCacheMissCount,
+        performanceCounters);
 
     assert(constructReportResult > 0);
 
@@ -46,4 +46,23 @@ void ReportProcessDetouringStatus(
     const DWORD dwCreationFlags,
     const BOOL detoured,
     const DWORD error,
-    const CreateDetouredProcessStatus createProcessStatus);
+    const CreateDetouredProcessStatus createProcessStatus,
+    const ProcessDetouringTimings* timings = nullptr);
+
+// Writes out the report lines buffered by all threads (see EnableDetoursReportBatching).
+void FlushReportBuffers();
+
+// Writes out the report lines buffered by the current thread and releases its buffer. Called when the thread exits.
+void ReleaseThreadReportBuffer();
+
+// Writes out all the buffered report lines, and makes later reports bypass the buffers. Called when the process detaches.
+void StopReportBatching();
+
+// Starts the thread writing the reports to the report file when EnableDetoursAsyncReporting is set. Called when the process attaches.
+void StartReportWriter();
+
+// Writes out the reports queued for the report writer thread, and waits for the ones it is writing (see EnableDetoursAsyncReporting).
+void FlushQueuedReports();
+
+// Writes out the reports queued for the report writer thread, and makes later reports bypass the queue. Called when the process detaches.
+void StopReportWriter();
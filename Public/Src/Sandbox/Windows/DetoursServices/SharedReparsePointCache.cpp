@@ -0,0 +1,336 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include "stdafx.h"
+
+#include "DetoursHelpers.h"
+#include "DetouredProcessInjector.h"
+#include "FileAccessHelpers.h"
+#include "SharedReparsePointCache.h"
+#include "StringOperations.h"
+#include "buildXL_mem.h"
+
+SharedReparsePointCache* g_pSharedReparsePointCache = nullptr;
+
+extern DetouredProcessInjector* g_pDetouredProcessInjector;
+
+// Finalizer from splitmix64, spreads the bits of the running hashes over the whole word
+static inline uint64_t Mix(uint64_t h)
+{
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}
+
+bool SharedReparsePointCache::Create()
+{
+    SECURITY_ATTRIBUTES attributes = { sizeof(SECURITY_ATTRIBUTES), nullptr, TRUE };
+    ULONGLONG size = GetSize();
+    HANDLE section = CreateFileMappingW(INVALID_HANDLE_VALUE, &attributes, PAGE_READWRITE, (DWORD)(size >> 32), (DWORD)size, nullptr);
+    if (section == nullptr)
+    {
+        Dbg(L"SharedReparsePointCache::Create: Failed to create the section (error code: 0x%08x)", (int)GetLastError());
+        return false;
+    }
+
+    if (!Map(section))
+    {
+        CloseHandle(section);
+        return false;
+    }
+
+    // The section is zero-filled: all entries are empty
+    m_header->VerdictCapacity = VerdictCapacity;
+    m_header->TargetCapacity = TargetCapacity;
+    m_header->Magic = Magic;
+    return true;
+}
+
+bool SharedReparsePointCache::Open(HANDLE section)
+{
+    if (!Map(section))
+    {
+        return false;
+    }
+
+    if (m_header->Magic != Magic || m_header->VerdictCapacity != VerdictCapacity || m_header->TargetCapacity != TargetCapacity)
+    {
+        Dbg(L"SharedReparsePointCache::Open: The section doesn't hold a shared reparse point cache");
+        UnmapViewOfFile(m_header);
+        m_header = nullptr;
+        m_section = nullptr;
+        return false;
+    }
+
+    return true;
+}
+
+bool SharedReparsePointCache::Map(HANDLE section)
+{
+    void* view = MapViewOfFile(section, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, GetSize());
+    if (view == nullptr)
+    {
+        Dbg(L"SharedReparsePointCache::Map: Failed to map the section (error code: 0x%08x)", (int)GetLastError());
+        return false;
+    }
+
+    m_section = section;
+    m_header = (Header*)view;
+    m_verdicts = (VerdictEntry*)(m_header + 1);
+    m_targets = (TargetEntry*)(m_verdicts + VerdictCapacity);
+    return true;
+}
+
+void SharedReparsePointCache::Fingerprint(const std::wstring& path, uint64_t& primary, uint64_t& secondary)
+{
+    // Two independent hashes computed in a single pass: FNV-1a and a multiply-rotate hash.
+    // A false positive would resolve a path wrongly, so we deliberately use more than 64 bits.
+    PCPathChar start = GetPathWithoutPrefix(path.c_str());
+    size_t length = wcslen(start);
+    if (length > 0 && IsDirectorySeparator(start[length - 1]))
+    {
+        length--;
+    }
+
+    uint64_t h1 = 0xcbf29ce484222325ULL;
+    uint64_t h2 = 0x9e3779b97f4a7c15ULL;
+    for (size_t i = 0; i < length; i++)
+    {
+        uint64_t c = (uint64_t)towlower(start[i]);
+        h1 = (h1 ^ c) * 0x100000001b3ULL;
+        h2 = (h2 + c) * 0xff51afd7ed558ccdULL;
+        h2 = (h2 << 31) | (h2 >> 33);
+    }
+
+    primary = Mix(h1);
+    secondary = Mix(h2 ^ length);
+
+    // zero is reserved for empty entries
+    primary = primary == 0 ? 1 : primary;
+}
+
+template<typename TEntry>
+intptr_t SharedReparsePointCache::FindEntry(TEntry* entries, size_t capacity, uint64_t primary, uint64_t secondary, LONG& sequence)
+{
+    LONG generation = m_header->Generation;
+    size_t index = primary & (capacity - 1);
+    for (size_t probe = 0; probe < MaxProbes; probe++, index = (index + 1) & (capacity - 1))
+    {
+        EntryKey& key = entries[index].Key;
+        sequence = key.Sequence;
+        MemoryBarrier();
+        if ((sequence & 1) == 0 && key.Primary == primary && key.Secondary == secondary && key.Generation == generation)
+        {
+            return (intptr_t)index;
+        }
+    }
+
+    return -1;
+}
+
+template<typename TEntry>
+TEntry* SharedReparsePointCache::AcquireEntry(TEntry* entries, size_t capacity, uint64_t primary, uint64_t secondary, LONG generation)
+{
+    // Prefer the entry already holding the fingerprint, then the first empty or stale entry of the probe window
+    intptr_t candidate = -1;
+    size_t index = primary & (capacity - 1);
+    for (size_t probe = 0; probe < MaxProbes; probe++, index = (index + 1) & (capacity - 1))
+    {
+        EntryKey& key = entries[index].Key;
+        if (key.Primary == primary && key.Secondary == secondary)
+        {
+            candidate = (intptr_t)index;
+            break;
+        }
+
+        if (candidate == -1 && (key.Primary == 0 || key.Generation != generation))
+        {
+            candidate = (intptr_t)index;
+        }
+    }
+
+    if (candidate == -1)
+    {
+        return nullptr;
+    }
+
+    EntryKey& key = entries[candidate].Key;
+    LONG sequence = key.Sequence;
+    if ((sequence & 1) != 0 || InterlockedCompareExchange(&key.Sequence, sequence + 1, sequence) != sequence)
+    {
+        // Another writer is updating this entry
+        return nullptr;
+    }
+
+    key.Primary = primary;
+    key.Secondary = secondary;
+    key.Generation = generation;
+    return &entries[candidate];
+}
+
+template<typename TEntry>
+bool SharedReparsePointCache::DropEntry(TEntry* entries, size_t capacity, uint64_t primary, uint64_t secondary)
+{
+    size_t index = primary & (capacity - 1);
+    for (size_t probe = 0; probe < MaxProbes; probe++, index = (index + 1) & (capacity - 1))
+    {
+        EntryKey& key = entries[index].Key;
+        LONG sequence = key.Sequence;
+        if ((sequence & 1) != 0)
+        {
+            // This entry may be getting the fingerprint right now
+            return false;
+        }
+
+        if (key.Primary == primary && key.Secondary == secondary)
+        {
+            if (InterlockedCompareExchange(&key.Sequence, sequence + 1, sequence) != sequence)
+            {
+                return false;
+            }
+
+            // Racing writers may have stored the fingerprint more than once, keep looking
+            key.Primary = 0;
+            ReleaseEntry(key);
+        }
+    }
+
+    return true;
+}
+
+void SharedReparsePointCache::ReleaseEntry(EntryKey& key)
+{
+    // Interlocked operations are full barriers: the entry is written before it is published
+    InterlockedIncrement(&key.Sequence);
+}
+
+bool SharedReparsePointCache::TryGetResolvingCheckResult(const std::wstring& path, bool& isReparsePoint)
+{
+    uint64_t primary, secondary;
+    Fingerprint(path, primary, secondary);
+
+    LONG sequence;
+    intptr_t index = FindEntry(m_verdicts, VerdictCapacity, primary, secondary, sequence);
+    if (index < 0)
+    {
+        return false;
+    }
+
+    isReparsePoint = m_verdicts[index].IsReparsePoint != 0;
+    MemoryBarrier();
+    return m_verdicts[index].Key.Sequence == sequence;
+}
+
+void SharedReparsePointCache::InsertResolvingCheckResult(const std::wstring& path, bool isReparsePoint)
+{
+    uint64_t primary, secondary;
+    Fingerprint(path, primary, secondary);
+
+    VerdictEntry* entry = AcquireEntry(m_verdicts, VerdictCapacity, primary, secondary, m_header->Generation);
+    if (entry != nullptr)
+    {
+        entry->IsReparsePoint = isReparsePoint ? 1 : 0;
+        ReleaseEntry(entry->Key);
+    }
+}
+
+bool SharedReparsePointCache::TryGetResolvedPathAndType(const std::wstring& path, std::wstring& target, DWORD& type)
+{
+    uint64_t primary, secondary;
+    Fingerprint(path, primary, secondary);
+
+    LONG sequence;
+    intptr_t index = FindEntry(m_targets, TargetCapacity, primary, secondary, sequence);
+    if (index < 0)
+    {
+        return false;
+    }
+
+    // The fields may be torn by a concurrent writer, which the sequence check below detects
+    TargetEntry& entry = m_targets[index];
+    DWORD length = entry.TargetLength;
+    type = entry.Type;
+    if (length > MaxTargetLength)
+    {
+        return false;
+    }
+
+    target.assign(entry.Target, length);
+    MemoryBarrier();
+    return entry.Key.Sequence == sequence;
+}
+
+void SharedReparsePointCache::InsertResolvedPathWithType(const std::wstring& path, const std::wstring& target, DWORD type)
+{
+    if (target.length() > MaxTargetLength)
+    {
+        return;
+    }
+
+    uint64_t primary, secondary;
+    Fingerprint(path, primary, secondary);
+
+    TargetEntry* entry = AcquireEntry(m_targets, TargetCapacity, primary, secondary, m_header->Generation);
+    if (entry != nullptr)
+    {
+        entry->Type = type;
+        entry->TargetLength = (DWORD)target.length();
+        memcpy(entry->Target, target.c_str(), target.length() * sizeof(wchar_t));
+        ReleaseEntry(entry->Key);
+    }
+}
+
+void SharedReparsePointCache::Invalidate(const std::wstring& path, bool isDirectory)
+{
+    if (isDirectory)
+    {
+        InterlockedIncrement(&m_header->Generation);
+        return;
+    }
+
+    uint64_t primary, secondary;
+    Fingerprint(path, primary, secondary);
+
+    // Dropping an entry only fails when another writer is updating it, in which case we can't tell whether that writer
+    // stores a result from before or after the change. Be conservative and drop everything.
+    if (!DropEntry(m_verdicts, VerdictCapacity, primary, secondary) || !DropEntry(m_targets, TargetCapacity, primary, secondary))
+    {
+        InterlockedIncrement(&m_header->Generation);
+    }
+}
+
+void InitializeSharedReparsePointCache()
+{
+    if (!EnableDetoursSharedReparsePointCache() || IgnoreReparsePoints())
+    {
+        return;
+    }
+
+    SharedReparsePointCache* cache = new SharedReparsePointCache();
+    HANDLE section = g_pDetouredProcessInjector->SharedReparsePointCacheSection();
+    bool initialized;
+    if (section != INVALID_HANDLE_VALUE && section != nullptr)
+    {
+        initialized = cache->Open(section);
+    }
+    else
+    {
+        // This is the root detoured process of the tree: create the cache and pass it down to child processes
+        initialized = cache->Create();
+        if (initialized)
+        {
+            g_pDetouredProcessInjector->SetSharedReparsePointCacheSection(cache->Section());
+        }
+    }
+
+    if (!initialized)
+    {
+        delete cache;
+        return;
+    }
+
+    g_pSharedReparsePointCache = cache;
+}
@@ -0,0 +1,112 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include <string>
+
+// Reparse point resolution results shared by all the detoured processes of a process tree (see EnableDetoursSharedReparsePointCache).
+//
+// ResolvedPathCache is per process, so every process of a pip would otherwise rediscover the same reparse points (typically symlinked or
+// junctioned SDK directories) with GetFileAttributesW and DeviceIoControl(FSCTL_GET_REPARSE_POINT). This cache holds the two results that
+// are worth sharing: whether a path is a reparse point, and the target and type of a reparse point.
+//
+// The cache lives in a pagefile-backed section created by the root detoured process of the tree. The section handle is passed down to child
+// processes by the DetouredProcessInjector payload, so children share it without any name to agree on. Child processes injected remotely
+// (from a WOW64 process) don't get the handle and create a cache of their own for their subtree.
+//
+// Entries are fixed-size, keyed by a 128-bit fingerprint of the normalized path and guarded by a sequence number (a seqlock), so no
+// operation blocks: writers that race on an entry give up, and readers treat a concurrent update as a miss. Invalidating a file drops its
+// entries. Invalidating a directory advances the generation of the cache, which drops all the entries: descendants of the directory may
+// resolve differently now, and a hash table can't find them.
+class SharedReparsePointCache
+{
+public:
+    // Creates a new cache. The section handle is inheritable, so it can be passed to child processes.
+    bool Create();
+
+    // Maps the cache created by an ancestor process, given its section handle.
+    bool Open(HANDLE section);
+
+    HANDLE Section() const { return m_section; }
+
+    bool TryGetResolvingCheckResult(const std::wstring& path, bool& isReparsePoint);
+    void InsertResolvingCheckResult(const std::wstring& path, bool isReparsePoint);
+
+    bool TryGetResolvedPathAndType(const std::wstring& path, std::wstring& target, DWORD& type);
+    void InsertResolvedPathWithType(const std::wstring& path, const std::wstring& target, DWORD type);
+
+    void Invalidate(const std::wstring& path, bool isDirectory);
+
+private:
+    static const uint64_t Magic = 0x5043524c5842ULL; // "BXLRCP"
+    static const size_t VerdictCapacity = 1 << 16;
+    static const size_t TargetCapacity = 1 << 11;
+    static const size_t MaxProbes = 16;
+    static const size_t MaxTargetLength = 512;
+
+    struct Header
+    {
+        uint64_t Magic;
+        uint64_t VerdictCapacity;
+        uint64_t TargetCapacity;
+        volatile LONG Generation;
+    };
+
+    // Fields common to all entries. 'Sequence' is odd while the entry is being written, and 'Primary' is 0 for empty entries.
+    struct EntryKey
+    {
+        volatile LONG Sequence;
+        LONG Generation;
+        uint64_t Primary;
+        uint64_t Secondary;
+    };
+
+    struct VerdictEntry
+    {
+        EntryKey Key;
+        LONG IsReparsePoint;
+    };
+
+    struct TargetEntry
+    {
+        EntryKey Key;
+        DWORD Type;
+        DWORD TargetLength;
+        wchar_t Target[MaxTargetLength];
+    };
+
+    static size_t GetSize() { return sizeof(Header) + VerdictCapacity * sizeof(VerdictEntry) + TargetCapacity * sizeof(TargetEntry); }
+
+    bool Map(HANDLE section);
+
+    // Computes the fingerprint of a path, normalized like in ResolvedPathCache: case insensitive, without prefix nor trailing separator
+    static void Fingerprint(const std::wstring& path, uint64_t& primary, uint64_t& secondary);
+
+    // Finds the entry with the given fingerprint in the current generation. Returns its index or -1.
+    template<typename TEntry>
+    intptr_t FindEntry(TEntry* entries, size_t capacity, uint64_t primary, uint64_t secondary, LONG& sequence);
+
+    // Locks an entry to write the given fingerprint: the entry already holding it, or an empty or stale one. Returns nullptr if there is none
+    // or if another writer is updating it. Release with ReleaseEntry.
+    template<typename TEntry>
+    TEntry* AcquireEntry(TEntry* entries, size_t capacity, uint64_t primary, uint64_t secondary, LONG generation);
+
+    // Empties the entries holding the given fingerprint, if any. Returns false if an entry of the probe window is being updated by another writer.
+    template<typename TEntry>
+    bool DropEntry(TEntry* entries, size_t capacity, uint64_t primary, uint64_t secondary);
+
+    static void ReleaseEntry(EntryKey& key);
+
+    HANDLE m_section = nullptr;
+    Header* m_header = nullptr;
+    VerdictEntry* m_verdicts = nullptr;
+    TargetEntry* m_targets = nullptr;
+};
+
+// The cache shared by the process tree, or nullptr if EnableDetoursSharedReparsePointCache is not set or the cache couldn't be set up.
+extern SharedReparsePointCache* g_pSharedReparsePointCache;
+
+// Creates the shared cache or maps the one passed down by the parent process.
+// This function is suitable for DllMain - it does not assume that CRT memory allocation is available.
+void InitializeSharedReparsePointCache();
@@ -14,6 +14,12 @@
 #include <pathcch.h>
 #endif
 
+// SSE2 is part of the baseline of every Windows x86/x64 target, so there is no need for a runtime check
+#if _WIN32 && (defined(_M_X64) || defined(_M_IX86))
+#include <emmintrin.h>
+#define VECTORIZED_PATH_NORMALIZATION 1
+#endif
+
 #define _MAX_EXTENDED_DIR_LENGTH (_MAX_EXTENDED_PATH_LENGTH - _MAX_DRIVE - _MAX_FNAME - _MAX_EXT - 4)
 #define _MAX_EXTENDED_PATH_LENGTH 32768 // see https://docs.microsoft.com/en-us/cpp/c-runtime-library/path-field-limits?view=vs-2019
 
@@ -41,6 +47,92 @@ constexpr inline static DWORD Fold(DWORD hash, WORD value) noexcept
     return _Fold(_Fold(hash, (BYTE)value), (BYTE)(((WORD)value) >> 8));
 }
 
+constexpr inline static DWORD FoldPathChars(DWORD hash, PCPathChar pNormalizedPath, size_t nLength) noexcept
+{
+    for (size_t i = 0; i < nLength; i++) {
+        hash = Fold(hash, pNormalizedPath[i]);
+    }
+
+    return hash;
+}
+
+#if VECTORIZED_PATH_NORMALIZATION
+
+constexpr size_t PathCharsPerVector = sizeof(__m128i) / sizeof(PathChar);
+constexpr size_t PageSize = 4096;
+
+// The vectorized normalization only uppercases a-z, and leaves any vector with non-ASCII characters to NormalizePathChar.
+// This agrees with NormalizePathChar as long as the current locale doesn't map ASCII characters differently, which we check once.
+static bool IsAsciiNormalizationVectorizable() noexcept
+{
+    static const bool s_isVectorizable = []() noexcept
+    {
+        for (PathChar c = 0; c < 0x80; c++) {
+            const PathChar expected = (c >= L'a' && c <= L'z') ? (PathChar)(c - L'a' + L'A') : c;
+            if (NormalizePathChar(c) != expected) {
+                return false;
+            }
+        }
+
+        return true;
+    }();
+
+    return s_isVectorizable;
+}
+
+// Applies NormalizePathChar to a vector of path characters. Returns false if any character is not ASCII.
+static inline bool TryNormalizeAsciiVector(__m128i chars, __m128i& normalized) noexcept
+{
+    const __m128i nonAsciiBits = _mm_and_si128(chars, _mm_set1_epi16((short)0xFF80));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi16(nonAsciiBits, _mm_setzero_si128())) != 0xFFFF) {
+        return false;
+    }
+
+    // All characters are below 0x80, so the signed comparisons are fine
+    const __m128i isLowercase = _mm_and_si128(
+        _mm_cmpgt_epi16(chars, _mm_set1_epi16(L'a' - 1)),
+        _mm_cmplt_epi16(chars, _mm_set1_epi16(L'z' + 1)));
+    normalized = _mm_sub_epi16(chars, _mm_and_si128(isLowercase, _mm_set1_epi16(L'a' - L'A')));
+    return true;
+}
+
+// Whether a vector load at the given address stays in the memory page of its first character.
+// Such a load can't fault when the first character is readable, even if the string ends before the end of the vector.
+static inline bool IsVectorLoadWithinPage(PCPathChar p) noexcept
+{
+    return ((uintptr_t)p % PageSize) <= PageSize - sizeof(__m128i);
+}
+
+#endif // VECTORIZED_PATH_NORMALIZATION
+
+// Applies NormalizePathChar to the first nLength characters of pPath, storing them in pBuffer
+static void NormalizePathChars(
+    __in_ecount(nLength)        PCPathChar pPath,
+    __out_ecount(nLength)       PPathChar pBuffer,
+    __in                        size_t nLength) noexcept
+{
+    size_t i = 0;
+#if VECTORIZED_PATH_NORMALIZATION
+    if (IsAsciiNormalizationVectorizable()) {
+        for (; i + PathCharsPerVector <= nLength; i += PathCharsPerVector) {
+            __m128i normalized;
+            if (TryNormalizeAsciiVector(_mm_loadu_si128((const __m128i*)(pPath + i)), normalized)) {
+                _mm_storeu_si128((__m128i*)(pBuffer + i), normalized);
+            }
+            else {
+                for (size_t j = i; j < i + PathCharsPerVector; j++) {
+                    pBuffer[j] = NormalizePathChar(pPath[j]);
+                }
+            }
+        }
+    }
+#endif // VECTORIZED_PATH_NORMALIZATION
+
+    for (; i < nLength; i++) {
+        pBuffer[i] = NormalizePathChar(pPath[i]);
+    }
+}
+
 #pragma warning( push )
 #pragma warning( disable : 4100) // 'nBufferLength' : unreferenced formal parameter // in Release builds
 DWORD WINAPI NormalizeAndHashPath(
@@ -52,16 +144,13 @@ DWORD WINAPI NormalizeAndHashPath(
     assert(pBuffer != nullptr);
     assert((pathlen(pPath) + 1)*sizeof(PathChar) == nBufferLength);
 
-    // not the fastest hashing implementation, but gives awesome distribution
-    DWORD hash = Fnv1Basis32;
-    size_t i;
-    for (i = 0; pPath[i]; i++) {
-        const PathChar c = NormalizePathChar(pPath[i]);
-        ((PPathChar)pBuffer)[i] = c;
-        hash = Fold(hash, c);
-    }
-
+    // FNV-1 is not the fastest hash, but gives awesome distribution. Most of the time used to go into normalizing
+    // the characters though, which is vectorized: the hash is then computed over the normalized characters.
+    const size_t i = pathlen(pPath);
+    NormalizePathChars(pPath, (PPathChar)pBuffer, i);
     ((PPathChar)pBuffer)[i] = 0;
+    const DWORD hash = FoldPathChars(Fnv1Basis32, (PCPathChar)pBuffer, i);
+
     assert((i + 1)*sizeof(PathChar) == nBufferLength);
     assert(hash == HashPath(pPath, i));
     return hash;
@@ -74,12 +163,15 @@ DWORD WINAPI HashPath(
 {
     assert(pPath != nullptr);
 
-    // not the fastest hashing implementation, but gives awesome distribution
+    // Same as NormalizeAndHashPath, normalizing a chunk of characters at a time into a local buffer
+    constexpr size_t ChunkLength = 64;
+    PathChar normalized[ChunkLength];
+
     DWORD hash = Fnv1Basis32;
-    size_t i;
-    for (i = 0; i < nLength; i++) {
-        const PathChar c = NormalizePathChar(pPath[i]);
-        hash = Fold(hash, c);
+    for (size_t i = 0; i < nLength; i += ChunkLength) {
+        const size_t chunkLength = nLength - i < ChunkLength ? nLength - i : ChunkLength;
+        NormalizePathChars(pPath + i, normalized, chunkLength);
+        hash = FoldPathChars(hash, normalized, chunkLength);
     }
 
     return hash;
@@ -101,8 +193,31 @@ BOOL WINAPI ArePathsEqual(
     assert(pPath != nullptr);
     assert(pNormalizedPath != nullptr);
 
-    size_t i;
-    for (i = 0; i < nLength; i++) {
+    size_t i = 0;
+#if VECTORIZED_PATH_NORMALIZATION
+    // pNormalizedPath may be shorter than nLength (e.g., on a hash collision), so we only load vectors of it that can't fault.
+    // Vectors that are not all ASCII, or that cross into another page, are compared one character at a time.
+    if (IsAsciiNormalizationVectorizable()) {
+        for (; i + PathCharsPerVector <= nLength; i += PathCharsPerVector) {
+            __m128i normalized;
+            if (IsVectorLoadWithinPage(pNormalizedPath + i) && TryNormalizeAsciiVector(_mm_loadu_si128((const __m128i*)(pPath + i)), normalized)) {
+                const __m128i expected = _mm_loadu_si128((const __m128i*)(pNormalizedPath + i));
+                if (_mm_movemask_epi8(_mm_cmpeq_epi16(normalized, expected)) != 0xFFFF) {
+                    return false;
+                }
+            }
+            else {
+                for (size_t j = i; j < i + PathCharsPerVector; j++) {
+                    if (NormalizePathChar(pPath[j]) != pNormalizedPath[j]) {
+                        return false;
+                    }
+                }
+            }
+        }
+    }
+#endif // VECTORIZED_PATH_NORMALIZATION
+
+    for (; i < nLength; i++) {
         const PathChar c = NormalizePathChar(pPath[i]);
         if (c != pNormalizedPath[i]) {
             return false;
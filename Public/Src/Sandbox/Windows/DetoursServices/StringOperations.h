@@ -30,10 +30,6 @@ typedef char PathChar;
 
 #endif
 
-#if MAC_OS_LIBRARY || MAC_OS_SANDBOX
-#include "utf8proc.h"
-#endif // MAC_OS_LIBRARY || MAC_OS_SANDBOX
-
 typedef PathChar* PPathChar;
 typedef const PathChar* PCPathChar;
 
@@ -72,6 +68,15 @@ extern _locale_t g_invariantLocale;
 ///
 /// Thus, there is no way to accurately model the case insensitive behavior of the file system.
 /// However, what we do here, should be good enough in practice.
+///
+/// On macOS, path characters are UTF-8 bytes. Mapping them one by one through the Unicode case tables
+/// (e.g., with utf8proc_toupper) only ever changes the ASCII lowercase letters, since all the other bytes
+/// are negative code points or ASCII characters without an uppercase form. The range check below maps
+/// bytes exactly the same way, without any table lookup in the policy search hot path.
+
+#if MAC_OS_LIBRARY || MAC_OS_SANDBOX
+static_assert((char)-1 < 0, "Path characters are expected to be signed bytes, bytes above 0x7F would be Latin-1 code points otherwise");
+#endif // MAC_OS_LIBRARY || MAC_OS_SANDBOX
 
 inline PathChar NormalizePathChar(PathChar c) noexcept
 {
@@ -85,7 +90,7 @@ inline PathChar NormalizePathChar(PathChar c) noexcept
 #if !defined(MAC_OS_LIBRARY)
     return (PathChar)_towupper_l(c, g_invariantLocale);
 #elif  MAC_OS_LIBRARY || MAC_OS_SANDBOX
-    return utf8proc_toupper(c);
+    return (PathChar)(c - (((unsigned char)(c - 'a') < 26) << 5));
 #endif
     
 #endif
@@ -201,12 +206,21 @@ inline bool IsUncPathName(PCPathChar path) noexcept
 // FUNCTION DECLARATIONS
 // ----------------------------------------------------------------------------
 
+// The test natives export the path hashing and comparison functions, so the unit tests can exercise them
+#if _WIN32 && defined(TEST)
+#define STRING_OPERATIONS_TEST_EXPORT __declspec(dllexport)
+#else
+#define STRING_OPERATIONS_TEST_EXPORT
+#endif
+
 // HashPath computes a hash code of a string after applying NormalizePathChar to all characters
+STRING_OPERATIONS_TEST_EXPORT
 DWORD WINAPI HashPath(
     __in_ecount(nLength)        PCPathChar pPath,
     __in                        size_t nLength) noexcept;
 
 // NormalizeAndHashPath applies NormalizePathChar to all characters, storing the result in a buffer, and computes a hash code of the path in the same way as HashPath
+STRING_OPERATIONS_TEST_EXPORT
 DWORD WINAPI NormalizeAndHashPath(
     __in                            PCPathChar pPath,
     __out_ecount(nBufferLength)     PBYTE pBuffer,
@@ -219,6 +233,7 @@ BOOL WINAPI AreBuffersEqual(
     __in                          DWORD nBufferLength) noexcept;
 
 // Check if a path is equal to a normalized path, after applying NormalizePathChar to all characters of the un-normalized path
+STRING_OPERATIONS_TEST_EXPORT
 BOOL WINAPI ArePathsEqual(
     __in_ecount(nLength)        PCPathChar pPath,
     __in_ecount(nLength + 1)    PCPathChar pNormalizedPath,
@@ -4,10 +4,14 @@
 #include "stdafx.h"
 
 #include <cwctype>
+#include <mutex>
+#include <unordered_map>
 
 #include "DebuggingHelpers.h"
 #include "DetouredFunctions.h"
+#include "DetouredScope.h"
 #include "DetoursHelpers.h"
+#include "DetoursPerformanceCounters.h"
 #include "DetoursServices.h"
 #include "FileAccessHelpers.h"
 #include "StringOperations.h"
@@ -93,57 +97,80 @@ static inline void trim_inplace(std::wstring& s) {
     rtrim_inplace(s);
 }
 
+// Narrows the given range of characters to exclude leading and trailing whitespace
+static inline void TrimRange(const wchar_t* begin, size_t& start, size_t& end)
+{
+    while (start < end && std::iswspace(begin[start]))
+    {
+        start++;
+    }
+
+    while (end > start && std::iswspace(begin[end - 1]))
+    {
+        end--;
+    }
+}
+
 // Returns in 'command' the command from lpCommandLine without quotes, and in commandArgs the arguments from the remainder of the string.
+// The command line is scanned in place: the outputs are the only strings built, except for a command with quotes in the middle.
 void FindApplicationNameFromCommandLine(const wchar_t *lpCommandLine, _Out_ std::wstring &command, _Out_ std::wstring &commandArgs)
 {
-    wstring fullCommandLine(lpCommandLine);
-    if (fullCommandLine.length() == 0)
+    const size_t fullCommandLineLength = wcslen(lpCommandLine);
+    if (fullCommandLineLength == 0)
     {
-        command = wstring();
-        commandArgs = wstring();
+        command.clear();
+        commandArgs.clear();
         return;
     }
 
+    // The command is lpCommandLine[commandStart, commandEnd), unless it already got built from several parts.
+    bool commandBuilt = false;
+    size_t commandStart = 0;
+    size_t commandEnd;
     size_t argStartIndex;
-    const size_t fullCommandLineLength = fullCommandLine.length();
 
-    if (fullCommandLine[0] == L'"')
+    if (lpCommandLine[0] == L'"')
     {
         // Find the close quote. Might not be present which means the command
         // is the full command line minus the initial quote.
-        size_t closeQuoteIndex = fullCommandLine.find(L'"', 1);
-        if (closeQuoteIndex == wstring::npos)
+        const wchar_t* closeQuote = wcschr(lpCommandLine + 1, L'"');
+        if (closeQuote == nullptr)
         {
             // No close quote. Take everything through the end of the command line as the command.
-            command = fullCommandLine.substr(1);
-            trim_inplace(command);
-            commandArgs = wstring();
+            commandStart = 1;
+            commandEnd = fullCommandLineLength;
             argStartIndex = fullCommandLineLength;
         }
         else
         {
-            if (closeQuoteIndex == fullCommandLine.length() - 1)
+            const size_t closeQuoteIndex = closeQuote - lpCommandLine;
+            if (closeQuoteIndex == fullCommandLineLength - 1)
             {
                 // Quotes cover entire command line.
-                command = fullCommandLine.substr(1, fullCommandLine.length() - 2);
+                commandStart = 1;
+                commandEnd = closeQuoteIndex;
                 argStartIndex = fullCommandLineLength;
             }
             else
             {
-                wstring noQuoteCommand = fullCommandLine.substr(1, closeQuoteIndex - 1);
-
                 // Find the next delimiting space after the close double-quote.
                 // For example a command like "c:\program files"\foo we need to
                 // keep \foo and cut the quotes to produce c:\program files\foo
-                size_t spaceDelimiterIndex = fullCommandLine.find(L' ', closeQuoteIndex + 1);
-                if (spaceDelimiterIndex == wstring::npos)
-                {
+                const wchar_t* spaceDelimiter = wcschr(closeQuote + 1, L' ');
+                const size_t spaceDelimiterIndex = spaceDelimiter == nullptr
                     // No space, take everything through the end of the command line.
-                    spaceDelimiterIndex = fullCommandLineLength;
-                }
+                    ? fullCommandLineLength
+                    : spaceDelimiter - lpCommandLine;
 
-                command = (noQuoteCommand +
-                    fullCommandLine.substr(closeQuoteIndex + 1, spaceDelimiterIndex - closeQuoteIndex - 1));
+                commandStart = 1;
+                commandEnd = closeQuoteIndex;
+                if (spaceDelimiterIndex > closeQuoteIndex + 1)
+                {
+                    command.assign(lpCommandLine + 1, closeQuoteIndex - 1);
+                    command.append(lpCommandLine + closeQuoteIndex + 1, spaceDelimiterIndex - closeQuoteIndex - 1);
+                    trim_inplace(command);
+                    commandBuilt = true;
+                }
 
                 argStartIndex = spaceDelimiterIndex + 1;
             }
@@ -152,91 +179,921 @@ void FindApplicationNameFromCommandLine(const wchar_t *lpCommandLine, _Out_ std:
     else
     {
         // No open quote, pure space delimiter.
-        size_t spaceDelimiterIndex = fullCommandLine.find(L' ');
-        if (spaceDelimiterIndex == wstring::npos)
+        const wchar_t* spaceDelimiter = wcschr(lpCommandLine, L' ');
+
+        // No space, take everything through the end of the command line.
+        commandEnd = spaceDelimiter == nullptr ? fullCommandLineLength : spaceDelimiter - lpCommandLine;
+        argStartIndex = commandEnd + 1;
+    }
+
+    if (!commandBuilt)
+    {
+        TrimRange(lpCommandLine, commandStart, commandEnd);
+        command.assign(lpCommandLine + commandStart, commandEnd - commandStart);
+    }
+
+    if (argStartIndex < fullCommandLineLength)
+    {
+        size_t argEndIndex = fullCommandLineLength;
+        TrimRange(lpCommandLine, argStartIndex, argEndIndex);
+        commandArgs.assign(lpCommandLine + argStartIndex, argEndIndex - argStartIndex);
+    }
+    else
+    {
+        commandArgs.clear();
+    }
+}
+
+static const uint64_t s_fnvOffsetBasis = 14695981039346656037ULL;
+static const uint64_t s_fnvPrime = 1099511628211ULL;
+
+// The shim process matches, compiled when the first child process is created, so that finding whether a command matches
+// does not depend on the number of matches:
+// - Matches are indexed by a case-insensitive hash of their process name. The hash is computed from the end of the name, so the hashes
+//   of all the parts of a command that a process name can match (the whole command, or what follows any '\') come from a single
+//   backwards pass over the command.
+// - The argument substrings are compiled into an Aho-Corasick automaton, which finds any of them with a single pass over the arguments.
+// Matches are not modified after they are decoded, so the compiled matches are never invalidated.
+class ShimProcessMatcher
+{
+public:
+    explicit ShimProcessMatcher(const vector<ShimProcessMatch*>& matches);
+
+    // Whether some match applies to the given command and arguments
+    bool Matches(const wstring& command, const wstring& commandArgs) const;
+
+private:
+    static const uint32_t NoIndex = UINT32_MAX;
+
+    struct Match
+    {
+        const wchar_t* ProcessName;
+        size_t ProcessNameLength;
+        // Argument substring the match requires, or NoIndex when the match applies to any arguments
+        uint32_t Pattern;
+    };
+
+    // A state of the automaton: the characters from the root. Children are kept in a singly linked list of siblings, like the trie of
+    // PathTranslator: the automaton is built once and states only have many children near the root.
+    struct Node
+    {
+        wchar_t Char;
+        uint32_t FirstChild;
+        uint32_t NextSibling;
+        // State of the longest proper suffix of this state
+        uint32_t Failure;
+        // Argument substring ending at this state, or NoIndex
+        uint32_t Pattern;
+        // Closest state along the failure links where an argument substring ends, or NoIndex
+        uint32_t Output;
+    };
+
+    static uint64_t HashFromEnd(const wchar_t* chars, size_t length);
+
+    uint32_t FindChild(uint32_t node, wchar_t c) const;
+    uint32_t AddPattern(const wchar_t* pattern);
+    void BuildFailureLinks();
+
+    // Whether one of the given argument substrings occurs in the arguments
+    bool ContainsAnyPattern(const wstring& commandArgs, const vector<uint32_t>& patterns) const;
+
+    vector<Match> m_matches;
+    std::unordered_multimap<uint64_t, uint32_t> m_matchesByProcessName;
+    vector<Node> m_nodes;
+    uint32_t m_patternCount = 0;
+};
+
+ShimProcessMatcher::ShimProcessMatcher(const vector<ShimProcessMatch*>& matches)
+{
+    // The root, which is the empty string
+    m_nodes.push_back({ L'\0', NoIndex, NoIndex, 0, NoIndex, NoIndex });
+
+    for (const ShimProcessMatch* match : matches)
+    {
+        const wchar_t* processName = match->ProcessName.get();
+        if (processName == nullptr)
         {
-            // No space, take everything through the end of the command line.
-            spaceDelimiterIndex = fullCommandLineLength;
+            continue;
         }
 
-        command = fullCommandLine.substr(0, spaceDelimiterIndex);
-        argStartIndex = spaceDelimiterIndex + 1;
+        // An empty argument substring is contained in any arguments
+        const wchar_t* argumentMatch = match->ArgumentMatch.get();
+        const uint32_t pattern = argumentMatch == nullptr || argumentMatch[0] == L'\0' ? NoIndex : AddPattern(argumentMatch);
+
+        const size_t processNameLength = wcslen(processName);
+        m_matchesByProcessName.emplace(HashFromEnd(processName, processNameLength), (uint32_t)m_matches.size());
+        m_matches.push_back({ processName, processNameLength, pattern });
     }
 
-    trim_inplace(command);
+    BuildFailureLinks();
+}
 
-    if (argStartIndex < fullCommandLineLength)
+uint64_t ShimProcessMatcher::HashFromEnd(const wchar_t* chars, size_t length)
+{
+    // 64-bit FNV-1a over the lowercased characters, last one first
+    uint64_t hash = s_fnvOffsetBasis;
+    for (size_t i = length; i > 0; i--)
+    {
+        hash = (hash ^ (uint64_t)towlower(chars[i - 1])) * s_fnvPrime;
+    }
+
+    return hash;
+}
+
+uint32_t ShimProcessMatcher::FindChild(uint32_t node, wchar_t c) const
+{
+    for (uint32_t child = m_nodes[node].FirstChild; child != NoIndex; child = m_nodes[child].NextSibling)
+    {
+        if (m_nodes[child].Char == c)
+        {
+            return child;
+        }
+    }
+
+    return NoIndex;
+}
+
+uint32_t ShimProcessMatcher::AddPattern(const wchar_t* pattern)
+{
+    uint32_t node = 0;
+    for (const wchar_t* c = pattern; *c != L'\0'; c++)
+    {
+        uint32_t child = FindChild(node, *c);
+        if (child == NoIndex)
+        {
+            child = (uint32_t)m_nodes.size();
+            m_nodes.push_back({ *c, NoIndex, m_nodes[node].FirstChild, 0, NoIndex, NoIndex });
+            m_nodes[node].FirstChild = child;
+        }
+
+        node = child;
+    }
+
+    // Matches that require the same argument substring share it
+    if (m_nodes[node].Pattern == NoIndex)
+    {
+        m_nodes[node].Pattern = m_patternCount++;
+    }
+
+    return m_nodes[node].Pattern;
+}
+
+void ShimProcessMatcher::BuildFailureLinks()
+{
+    // States are visited by increasing length, so the failure links of shorter states are known when they are needed
+    vector<uint32_t> queue;
+    for (uint32_t child = m_nodes[0].FirstChild; child != NoIndex; child = m_nodes[child].NextSibling)
+    {
+        queue.push_back(child);
+    }
+
+    for (size_t i = 0; i < queue.size(); i++)
+    {
+        const uint32_t node = queue[i];
+        for (uint32_t child = m_nodes[node].FirstChild; child != NoIndex; child = m_nodes[child].NextSibling)
+        {
+            const wchar_t c = m_nodes[child].Char;
+            uint32_t failure = m_nodes[node].Failure;
+            uint32_t next = FindChild(failure, c);
+            while (next == NoIndex && failure != 0)
+            {
+                failure = m_nodes[failure].Failure;
+                next = FindChild(failure, c);
+            }
+
+            const uint32_t childFailure = next == NoIndex ? 0 : next;
+            m_nodes[child].Failure = childFailure;
+            m_nodes[child].Output = m_nodes[childFailure].Pattern != NoIndex ? childFailure : m_nodes[childFailure].Output;
+            queue.push_back(child);
+        }
+    }
+}
+
+bool ShimProcessMatcher::ContainsAnyPattern(const wstring& commandArgs, const vector<uint32_t>& patterns) const
+{
+    uint32_t node = 0;
+    for (wchar_t c : commandArgs)
+    {
+        uint32_t next = FindChild(node, c);
+        while (next == NoIndex && node != 0)
+        {
+            node = m_nodes[node].Failure;
+            next = FindChild(node, c);
+        }
+
+        node = next == NoIndex ? 0 : next;
+
+        // Every argument substring that ends here
+        const uint32_t first = m_nodes[node].Pattern != NoIndex ? node : m_nodes[node].Output;
+        for (uint32_t output = first; output != NoIndex; output = m_nodes[output].Output)
+        {
+            for (uint32_t pattern : patterns)
+            {
+                if (pattern == m_nodes[output].Pattern)
+                {
+                    return true;
+                }
+            }
+        }
+    }
+
+    return false;
+}
+
+bool ShimProcessMatcher::Matches(const wstring& command, const wstring& commandArgs) const
+{
+    // Argument substrings required by the matches of the process
+    vector<uint32_t> patterns;
+
+    const wchar_t* chars = command.c_str();
+    const size_t commandLen = command.length();
+    uint64_t hash = s_fnvOffsetBasis;
+    size_t start = commandLen;
+    while (true)
+    {
+        // The command ends with e.g. "\cmd.exe", or is e.g. "cmd.exe"
+        if (start == 0 || chars[start - 1] == L'\\')
+        {
+            const size_t processLen = commandLen - start;
+            const auto range = m_matchesByProcessName.equal_range(hash);
+            for (auto it = range.first; it != range.second; ++it)
+            {
+                const Match& match = m_matches[it->second];
+                if (match.ProcessNameLength == processLen && _wcsnicmp(match.ProcessName, chars + start, processLen) == 0)
+                {
+                    if (match.Pattern == NoIndex)
+                    {
+                        return true;
+                    }
+
+                    patterns.push_back(match.Pattern);
+                }
+            }
+        }
+
+        if (start == 0)
+        {
+            break;
+        }
+
+        start--;
+        hash = (hash ^ (uint64_t)towlower(chars[start])) * s_fnvPrime;
+    }
+
+    return !patterns.empty() && ContainsAnyPattern(commandArgs, patterns);
+}
+
+static const ShimProcessMatcher* GetShimProcessMatcher()
+{
+    static std::once_flag s_compiled;
+    static const ShimProcessMatcher* s_matcher = nullptr;
+
+    std::call_once(s_compiled, []() { s_matcher = new ShimProcessMatcher(*g_pShimProcessMatches); });
+    return s_matcher;
+}
+
+static void WINAPI FreeModifiedArguments(LPWSTR modifiedArguments)
+{
+    if (modifiedArguments == nullptr)
+    {
+        return;
+    }
+
+    HANDLE hDefaultProcessHeap = GetProcessHeap();
+
+    if (hDefaultProcessHeap == NULL)
+    {
+        Dbg(L"Shim: Failed to retrieve the default process heap with LastError %d", GetLastError());
+    }
+    else if (HeapFree(hDefaultProcessHeap, 0, (LPVOID)modifiedArguments) == FALSE)
+    {
+        Dbg(L"Shim: Failed to free allocation of modified arguments from default process heap");
+    }
+}
+
+// The outcome of a plugin call: whether the command matches, and the arguments to pass to the shim instead of the original ones, if any
+struct PluginDecision
+{
+    bool FilterMatch;
+    bool HasModifiedArguments;
+    wstring ModifiedArguments;
+};
+
+// Plugin decisions, memoized because builds launch the same commands over and over and a plugin call can be expensive.
+// Plugins are expected to decide based on their inputs only: the command, the arguments, the working directory and the environment,
+// which is only kept as a hash. Like the memoization of PathTranslator, the entries are dropped when the cache gets full.
+class PluginDecisionCache
+{
+public:
+    bool TryGet(
+        uint64_t environmentHash,
+        const wstring& command,
+        const wstring& commandArgs,
+        LPCWSTR workingDirectory,
+        PluginDecision& decision);
+
+    void Add(
+        uint64_t environmentHash,
+        const wstring& command,
+        const wstring& commandArgs,
+        LPCWSTR workingDirectory,
+        const PluginDecision& decision);
+
+private:
+    static const size_t MaxEntries = 256;
+
+    struct Entry
+    {
+        uint64_t EnvironmentHash;
+        wstring Command;
+        wstring Arguments;
+        wstring WorkingDirectory;
+        PluginDecision Decision;
+    };
+
+    static uint64_t Hash(uint64_t environmentHash, const wstring& command, const wstring& commandArgs, LPCWSTR workingDirectory);
+
+    std::mutex m_lock;
+    std::unordered_map<uint64_t, Entry> m_entries;
+};
+
+uint64_t PluginDecisionCache::Hash(uint64_t environmentHash, const wstring& command, const wstring& commandArgs, LPCWSTR workingDirectory)
+{
+    // 64-bit FNV-1a over the inputs, each one followed by a null character
+    uint64_t hash = environmentHash;
+    for (const wchar_t* part : { command.c_str(), commandArgs.c_str(), workingDirectory })
+    {
+        for (const wchar_t* c = part; *c != L'\0'; c++)
+        {
+            hash = (hash ^ (uint64_t)*c) * s_fnvPrime;
+        }
+
+        hash *= s_fnvPrime;
+    }
+
+    return hash;
+}
+
+bool PluginDecisionCache::TryGet(
+    uint64_t environmentHash,
+    const wstring& command,
+    const wstring& commandArgs,
+    LPCWSTR workingDirectory,
+    PluginDecision& decision)
+{
+    const uint64_t hash = Hash(environmentHash, command, commandArgs, workingDirectory);
+
+    const std::lock_guard<std::mutex> lock(m_lock);
+    auto result = m_entries.find(hash);
+    if (result == m_entries.end()
+        || result->second.EnvironmentHash != environmentHash
+        || result->second.Command != command
+        || result->second.Arguments != commandArgs
+        || result->second.WorkingDirectory.compare(workingDirectory) != 0)
+    {
+        return false;
+    }
+
+    decision = result->second.Decision;
+    return true;
+}
+
+void PluginDecisionCache::Add(
+    uint64_t environmentHash,
+    const wstring& command,
+    const wstring& commandArgs,
+    LPCWSTR workingDirectory,
+    const PluginDecision& decision)
+{
+    const uint64_t hash = Hash(environmentHash, command, commandArgs, workingDirectory);
+
+    const std::lock_guard<std::mutex> lock(m_lock);
+    if (m_entries.size() >= MaxEntries)
+    {
+        m_entries.clear();
+    }
+
+    Entry& entry = m_entries[hash];
+    entry.EnvironmentHash = environmentHash;
+    entry.Command.assign(command);
+    entry.Arguments.assign(commandArgs);
+    entry.WorkingDirectory.assign(workingDirectory);
+    entry.Decision = decision;
+}
+
+// Created on first use and never destroyed: this file is also part of the natives library, which destroys the private heap
+// the cache allocates from when it is unloaded, and does not have it yet while static objects are constructed.
+static PluginDecisionCache* GetPluginDecisionCache()
+{
+    static PluginDecisionCache* s_pluginDecisionCache = new PluginDecisionCache();
+    return s_pluginDecisionCache;
+}
+
+static SubstituteProcessExecutionPluginFunc GetSubstituteProcessExecutionPluginFunc()
+{
+    assert(g_SubstituteProcessExecutionPluginDllHandle != nullptr);
+
+    // Different compiler or different compiler settings can result in different function name variants.
+    //
+    // X64 version typically has:
+    //     ordinal hint RVA      name
+    //
+    //     1    0 00011069 CommandMatches = @ILT + 100(CommandMatches)
+    //
+    // X86 version can have:
+    //     ordinal hint RVA      name
+    //
+    //     1    0 00011276 _CommandMatches@24 = @ILT + 625(_CommandMatches@24)
+
+
+    // (1) Check for CommandMatches.
+    std::string winApiProcName("CommandMatches");
+    SubstituteProcessExecutionPluginFunc substituteProcessExecutionPluginFunc = reinterpret_cast<SubstituteProcessExecutionPluginFunc>(
+        reinterpret_cast<void*>(GetProcAddress(g_SubstituteProcessExecutionPluginDllHandle, winApiProcName.c_str())));
+    if (substituteProcessExecutionPluginFunc != nullptr)
+    {
+        return substituteProcessExecutionPluginFunc;
+    }
+
+    // (2) Check for CommandMatches@<param_size> based on platform.
+#if defined(_WIN64)
+    winApiProcName.append("@48"); // 6 64-bit parameters
+#elif defined(_WIN32)
+    winApiProcName.append("@24"); // 6 32-bit parameters
+#endif
+    substituteProcessExecutionPluginFunc = reinterpret_cast<SubstituteProcessExecutionPluginFunc>(
+        reinterpret_cast<void*>(GetProcAddress(g_SubstituteProcessExecutionPluginDllHandle, winApiProcName.c_str())));
+    if (substituteProcessExecutionPluginFunc != nullptr)
+    {
+        return substituteProcessExecutionPluginFunc;
+    }
+
+    // (3) Check for _CommandMatches@<param_size>.
+    winApiProcName.insert(0, 1, '_');
+    substituteProcessExecutionPluginFunc = reinterpret_cast<SubstituteProcessExecutionPluginFunc>(
+        reinterpret_cast<void*>(GetProcAddress(g_SubstituteProcessExecutionPluginDllHandle, winApiProcName.c_str())));
+    if (substituteProcessExecutionPluginFunc != nullptr)
+    {
+        return substituteProcessExecutionPluginFunc;
+    }
+
+    Dbg(L"Unable to find 'CommandMatches', 'CommandMatches@<param_size>', or '_CommandMatches@<param_size>' functions in SubstituteProcessExecutionPluginFunc '%s', lasterr=%d", g_SubstituteProcessExecutionPluginDllPath, GetLastError());
+    return nullptr;
+}
+
+static void LoadSubstituteProcessExecutionPluginDll()
+{
+    assert(g_SubstituteProcessExecutionPluginDllPath != nullptr);
+
+    Dbg(L"Loading substitute process plugin DLL at '%s'", g_SubstituteProcessExecutionPluginDllPath);
+
+    g_SubstituteProcessExecutionPluginDllHandle = LoadLibraryW(g_SubstituteProcessExecutionPluginDllPath);
+
+    if (g_SubstituteProcessExecutionPluginDllHandle != nullptr)
     {
-        commandArgs = fullCommandLine.substr(argStartIndex);
-        trim_inplace(commandArgs);
+        g_SubstituteProcessExecutionPluginFunc = GetSubstituteProcessExecutionPluginFunc();
+
+        if (g_SubstituteProcessExecutionPluginFunc == nullptr)
+        {
+            FreeLibrary(g_SubstituteProcessExecutionPluginDllHandle);
+        }
     }
     else
     {
-        commandArgs = wstring();
+        Dbg(L"Failed LoadLibrary for LoadSubstituteProcessExecutionPluginDll %s, lasterr=%d", g_SubstituteProcessExecutionPluginDllPath, GetLastError());
     }
 }
 
-static bool CommandArgsContainMatch(const wchar_t *commandArgs, const wchar_t *argMatch)
+// The plugin is only loaded by the first process creation that needs a decision the caches don't have:
+// most detoured processes never create a child, and those that do mostly launch commands that were decided on already.
+static std::once_flag s_substituteProcessExecutionPluginLoaded;
+
+// Returns whether the plugin can be called
+static bool EnsureSubstituteProcessExecutionPluginLoaded()
 {
-    if (argMatch == nullptr)
+    std::call_once(s_substituteProcessExecutionPluginLoaded, []()
     {
-        // No optional match, meaning always match.
-        return true;
+        // Loading the plugin is not an access of the pip
+        DetouredScope scope;
+        LoadSubstituteProcessExecutionPluginDll();
+    });
+
+    return g_SubstituteProcessExecutionPluginFunc != nullptr;
+}
+
+// Plugin decisions shared by all the detoured processes of a process tree (see EnableDetoursSharedPluginDecisionCache).
+//
+// PluginDecisionCache is per process, so without this cache every process of a pip loads the plugin and calls it again for the
+// commands its ancestors already decided on (e.g., a build driver whose children all launch the same compiler).
+//
+// Like SharedReparsePointCache, the cache lives in a pagefile-backed section whose handle is passed down to child processes by the
+// DetouredProcessInjector payload. It is created by the first process of the tree that needs a decision. Entries are fixed-size, keyed by a
+// 128-bit fingerprint of the inputs of the plugin and guarded by a sequence number, so no operation blocks. Decisions whose modified arguments
+// don't fit in an entry are not shared.
+class SharedPluginDecisionCache
+{
+public:
+    // Creates a new cache. The section handle is inheritable, so it can be passed to child processes.
+    bool Create();
+
+    // Maps the cache created by an ancestor process, given its section handle.
+    bool Open(HANDLE section);
+
+    HANDLE Section() const { return m_section; }
+
+    bool TryGet(uint64_t primary, uint64_t secondary, PluginDecision& decision);
+    void Add(uint64_t primary, uint64_t secondary, const PluginDecision& decision);
+
+    // Computes the fingerprint of the inputs of a plugin call
+    static void Fingerprint(
+        uint64_t environmentHash,
+        const wstring& command,
+        const wstring& commandArgs,
+        LPCWSTR workingDirectory,
+        uint64_t& primary,
+        uint64_t& secondary);
+
+private:
+    static const uint64_t Magic = 0x434450504c5842ULL; // "BXLPPDC"
+    static const size_t Capacity = 1 << 10;
+    static const size_t MaxProbes = 8;
+    static const size_t MaxModifiedArgumentsLength = 1000;
+
+    struct Header
+    {
+        uint64_t Magic;
+        uint64_t Capacity;
+    };
+
+    // 'Sequence' is odd while the entry is being written, and 'Primary' is 0 for empty entries
+    struct Entry
+    {
+        volatile LONG Sequence;
+        LONG FilterMatch;
+        uint64_t Primary;
+        uint64_t Secondary;
+        LONG HasModifiedArguments;
+        DWORD ModifiedArgumentsLength;
+        wchar_t ModifiedArguments[MaxModifiedArgumentsLength];
+    };
+
+    static size_t GetSize() { return sizeof(Header) + Capacity * sizeof(Entry); }
+
+    bool Map(HANDLE section);
+
+    HANDLE m_section = nullptr;
+    Header* m_header = nullptr;
+    Entry* m_entries = nullptr;
+};
+
+bool SharedPluginDecisionCache::Create()
+{
+    SECURITY_ATTRIBUTES attributes = { sizeof(SECURITY_ATTRIBUTES), nullptr, TRUE };
+    ULONGLONG size = GetSize();
+    HANDLE section = CreateFileMappingW(INVALID_HANDLE_VALUE, &attributes, PAGE_READWRITE, (DWORD)(size >> 32), (DWORD)size, nullptr);
+    if (section == nullptr)
+    {
+        Dbg(L"SharedPluginDecisionCache::Create: Failed to create the section (error code: 0x%08x)", (int)GetLastError());
+        return false;
+    }
+
+    if (!Map(section))
+    {
+        CloseHandle(section);
+        return false;
+    }
+
+    // The section is zero-filled: all entries are empty
+    m_header->Capacity = Capacity;
+    m_header->Magic = Magic;
+    return true;
+}
+
+bool SharedPluginDecisionCache::Open(HANDLE section)
+{
+    if (!Map(section))
+    {
+        return false;
+    }
+
+    if (m_header->Magic != Magic || m_header->Capacity != Capacity)
+    {
+        Dbg(L"SharedPluginDecisionCache::Open: The section doesn't hold a shared plugin decision cache");
+        UnmapViewOfFile(m_header);
+        m_header = nullptr;
+        m_section = nullptr;
+        return false;
+    }
+
+    return true;
+}
+
+bool SharedPluginDecisionCache::Map(HANDLE section)
+{
+    void* view = MapViewOfFile(section, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, GetSize());
+    if (view == nullptr)
+    {
+        Dbg(L"SharedPluginDecisionCache::Map: Failed to map the section (error code: 0x%08x)", (int)GetLastError());
+        return false;
     }
 
-    return wcsstr(commandArgs, argMatch) != nullptr;
+    m_section = section;
+    m_header = (Header*)view;
+    m_entries = (Entry*)(m_header + 1);
+    return true;
+}
+
+void SharedPluginDecisionCache::Fingerprint(
+    uint64_t environmentHash,
+    const wstring& command,
+    const wstring& commandArgs,
+    LPCWSTR workingDirectory,
+    uint64_t& primary,
+    uint64_t& secondary)
+{
+    // A false positive would run the wrong process, so we deliberately use more than 64 bits: FNV-1a and a multiply-rotate hash,
+    // both over the inputs, each one followed by a null character
+    uint64_t h1 = environmentHash;
+    uint64_t h2 = environmentHash ^ 0x9e3779b97f4a7c15ULL;
+    for (const wchar_t* part : { command.c_str(), commandArgs.c_str(), workingDirectory })
+    {
+        const wchar_t* c = part;
+        for (; *c != L'\0'; c++)
+        {
+            h1 = (h1 ^ (uint64_t)*c) * s_fnvPrime;
+            h2 = (h2 + (uint64_t)*c) * 0xff51afd7ed558ccdULL;
+            h2 = (h2 << 31) | (h2 >> 33);
+        }
+
+        h1 *= s_fnvPrime;
+        h2 = (h2 ^ (uint64_t)(c - part)) * 0xc4ceb9fe1a85ec53ULL;
+    }
+
+    // zero is reserved for empty entries
+    primary = h1 == 0 ? 1 : h1;
+    secondary = h2;
+}
+
+bool SharedPluginDecisionCache::TryGet(uint64_t primary, uint64_t secondary, PluginDecision& decision)
+{
+    size_t index = primary & (Capacity - 1);
+    for (size_t probe = 0; probe < MaxProbes; probe++, index = (index + 1) & (Capacity - 1))
+    {
+        Entry& entry = m_entries[index];
+        LONG sequence = entry.Sequence;
+        MemoryBarrier();
+        if ((sequence & 1) != 0 || entry.Primary != primary || entry.Secondary != secondary)
+        {
+            continue;
+        }
+
+        // The fields may be torn by a concurrent writer, which the sequence check below detects
+        DWORD length = entry.ModifiedArgumentsLength;
+        if (length > MaxModifiedArgumentsLength)
+        {
+            return false;
+        }
+
+        decision.FilterMatch = entry.FilterMatch != 0;
+        decision.HasModifiedArguments = entry.HasModifiedArguments != 0;
+        decision.ModifiedArguments.assign(entry.ModifiedArguments, length);
+        MemoryBarrier();
+        return entry.Sequence == sequence;
+    }
+
+    return false;
+}
+
+void SharedPluginDecisionCache::Add(uint64_t primary, uint64_t secondary, const PluginDecision& decision)
+{
+    if (decision.ModifiedArguments.length() > MaxModifiedArgumentsLength)
+    {
+        return;
+    }
+
+    // Prefer the entry already holding the fingerprint, then the first empty entry of the probe window, then the first entry of the window
+    size_t start = primary & (Capacity - 1);
+    size_t candidate = start;
+    bool foundEmpty = false;
+    size_t index = start;
+    for (size_t probe = 0; probe < MaxProbes; probe++, index = (index + 1) & (Capacity - 1))
+    {
+        Entry& entry = m_entries[index];
+        if (entry.Primary == primary && entry.Secondary == secondary)
+        {
+            candidate = index;
+            break;
+        }
+
+        if (!foundEmpty && entry.Primary == 0)
+        {
+            candidate = index;
+            foundEmpty = true;
+        }
+    }
+
+    Entry& entry = m_entries[candidate];
+    LONG sequence = entry.Sequence;
+    if ((sequence & 1) != 0 || InterlockedCompareExchange(&entry.Sequence, sequence + 1, sequence) != sequence)
+    {
+        // Another writer is updating this entry
+        return;
+    }
+
+    entry.Primary = primary;
+    entry.Secondary = secondary;
+    entry.FilterMatch = decision.FilterMatch ? 1 : 0;
+    entry.HasModifiedArguments = decision.HasModifiedArguments ? 1 : 0;
+    entry.ModifiedArgumentsLength = (DWORD)decision.ModifiedArguments.length();
+    memcpy(entry.ModifiedArguments, decision.ModifiedArguments.c_str(), decision.ModifiedArguments.length() * sizeof(wchar_t));
+
+    // Interlocked operations are full barriers: the entry is written before it is published
+    InterlockedIncrement(&entry.Sequence);
+}
+
+// Maps the cache passed down by the parent process, or creates it for the process tree, on first use.
+// Returns nullptr if EnableDetoursSharedPluginDecisionCache is not set or the cache couldn't be set up.
+static SharedPluginDecisionCache* GetSharedPluginDecisionCache()
+{
+    static std::once_flag s_initialized;
+    static SharedPluginDecisionCache* s_sharedPluginDecisionCache = nullptr;
+
+    std::call_once(s_initialized, []()
+    {
+        if (!EnableDetoursSharedPluginDecisionCache())
+        {
+            return;
+        }
+
+        SharedPluginDecisionCache* cache = new SharedPluginDecisionCache();
+        HANDLE section = g_pDetouredProcessInjector->SharedPluginDecisionCacheSection();
+        bool initialized;
+        if (section != INVALID_HANDLE_VALUE && section != nullptr)
+        {
+            initialized = cache->Open(section);
+        }
+        else
+        {
+            // No ancestor needed a decision yet: create the cache and pass it down to child processes
+            initialized = cache->Create();
+            if (initialized)
+            {
+                g_pDetouredProcessInjector->SetSharedPluginDecisionCacheSection(cache->Section());
+            }
+        }
+
+        if (!initialized)
+        {
+            delete cache;
+            return;
+        }
+
+        s_sharedPluginDecisionCache = cache;
+    });
+
+    return s_sharedPluginDecisionCache;
+}
+
+// Hashes an environment block: a sequence of null terminated strings, ended by an empty string
+template <typename TChar>
+static uint64_t HashEnvironmentBlock(const TChar* environment)
+{
+    uint64_t hash = s_fnvOffsetBasis;
+    const TChar* c = environment;
+    do
+    {
+        for (; *c != 0; c++)
+        {
+            hash = (hash ^ (uint64_t)*c) * s_fnvPrime;
+        }
+
+        hash *= s_fnvPrime;
+        c++;
+    } while (*c != 0);
+
+    return hash;
 }
 
+// Decides whether the command matches, from the caches or else by calling the plugin, which is loaded on first use.
+// Returns false if there is no decision because the plugin couldn't be loaded.
 static bool CallPluginFunc(
     const wstring& command,
     const wstring& commandArgs,
     LPVOID lpEnvironment,
+    DWORD dwCreationFlags,
     LPCWSTR lpWorkingDirectory,
-    LPWSTR* modifiedArguments)
+    _Out_ PluginDecision& decision)
 {
-    assert(g_SubstituteProcessExecutionPluginFunc != nullptr);
+    assert(g_SubstituteProcessExecutionPluginDllPath != nullptr);
 
+    LPTCH inheritedEnvironment = nullptr;
+    uint64_t environmentHash;
     if (lpEnvironment == nullptr)
     {
-        lpEnvironment = GetEnvironmentStrings();
+        inheritedEnvironment = GetEnvironmentStrings();
+        lpEnvironment = inheritedEnvironment;
+        environmentHash = HashEnvironmentBlock(inheritedEnvironment);
+    }
+    else
+    {
+        environmentHash = (dwCreationFlags & CREATE_UNICODE_ENVIRONMENT) != 0
+            ? HashEnvironmentBlock(reinterpret_cast<const wchar_t*>(lpEnvironment))
+            : HashEnvironmentBlock(reinterpret_cast<const char*>(lpEnvironment));
     }
 
     wchar_t curDir[MAX_PATH];
     if (lpWorkingDirectory == nullptr)
     {
+        curDir[0] = L'\0';
         GetCurrentDirectory(ARRAYSIZE(curDir), curDir);
         lpWorkingDirectory = curDir;
     }
 
-    return g_SubstituteProcessExecutionPluginFunc(
-        command.c_str(),
-        commandArgs.c_str(),
-        lpEnvironment,
-        lpWorkingDirectory,
-        modifiedArguments,
-        Dbg) != 0;
+    bool decided = true;
+    PluginDecisionCache* cache = GetPluginDecisionCache();
+    if (!cache->TryGet(environmentHash, command, commandArgs, lpWorkingDirectory, decision))
+    {
+        SharedPluginDecisionCache* sharedCache = GetSharedPluginDecisionCache();
+        uint64_t primary = 0, secondary = 0;
+        if (sharedCache != nullptr)
+        {
+            SharedPluginDecisionCache::Fingerprint(environmentHash, command, commandArgs, lpWorkingDirectory, primary, secondary);
+        }
+
+        if (sharedCache != nullptr && sharedCache->TryGet(primary, secondary, decision))
+        {
+            CountDetoursEvent(DetoursEvent::SharedPluginDecisionCacheHit);
+            cache->Add(environmentHash, command, commandArgs, lpWorkingDirectory, decision);
+        }
+        else if (EnsureSubstituteProcessExecutionPluginLoaded())
+        {
+            LPWSTR modifiedArguments = nullptr;
+            decision.FilterMatch = g_SubstituteProcessExecutionPluginFunc(
+                command.c_str(),
+                commandArgs.c_str(),
+                lpEnvironment,
+                lpWorkingDirectory,
+                &modifiedArguments,
+                Dbg) != 0;
+
+            decision.HasModifiedArguments = modifiedArguments != nullptr;
+            if (modifiedArguments != nullptr)
+            {
+                decision.ModifiedArguments.assign(modifiedArguments);
+                FreeModifiedArguments(modifiedArguments);
+            }
+            else
+            {
+                decision.ModifiedArguments.clear();
+            }
+
+            cache->Add(environmentHash, command, commandArgs, lpWorkingDirectory, decision);
+            if (sharedCache != nullptr)
+            {
+                sharedCache->Add(primary, secondary, decision);
+            }
+        }
+        else
+        {
+            decided = false;
+        }
+    }
+
+    if (inheritedEnvironment != nullptr)
+    {
+        FreeEnvironmentStrings(inheritedEnvironment);
+    }
+
+    return decided;
 }
 
 static bool ShouldSubstituteShim(
     const wstring &command,
     const wstring& commandArgs,
     LPVOID lpEnvironment,
+    DWORD dwCreationFlags,
     LPCWSTR lpWorkingDirectory,
-    LPWSTR* modifiedArguments)
+    _Out_ bool& hasModifiedArguments,
+    _Out_ wstring& modifiedArguments)
 {
     assert(g_SubstituteProcessExecutionShimPath != nullptr);
 
+    hasModifiedArguments = false;
+    PluginDecision decision;
+
     // Easy cases.
     if (g_pShimProcessMatches == nullptr || g_pShimProcessMatches->empty())
     {
-        if (g_SubstituteProcessExecutionPluginFunc != nullptr)
+        // Filter meaning is exclusive if we're shimming all processes, inclusive otherwise.
+        if (g_SubstituteProcessExecutionPluginDllPath != nullptr
+            && CallPluginFunc(command, commandArgs, lpEnvironment, dwCreationFlags, lpWorkingDirectory, decision))
         {
-            // Filter meaning is exclusive if we're shimming all processes, inclusive otherwise.
-            bool filterMatch = CallPluginFunc(command, commandArgs, lpEnvironment, lpWorkingDirectory, modifiedArguments);
+            hasModifiedArguments = decision.HasModifiedArguments;
+            modifiedArguments.swap(decision.ModifiedArguments);
 
-            Dbg(L"Shim: Empty matches command='%s', args='%s', filterMatch=%d, g_ProcessExecutionShimAllProcesses=%d", command.c_str(), commandArgs.c_str(), filterMatch, g_ProcessExecutionShimAllProcesses);
+            Dbg(L"Shim: Empty matches command='%s', args='%s', filterMatch=%d, g_ProcessExecutionShimAllProcesses=%d", command.c_str(), commandArgs.c_str(), decision.FilterMatch, g_ProcessExecutionShimAllProcesses);
 
-            return filterMatch != g_ProcessExecutionShimAllProcesses;
+            return decision.FilterMatch != g_ProcessExecutionShimAllProcesses;
         }
 
         Dbg(L"Shim: Empty matches command='%s', args='%s', g_ProcessExecutionShimAllProcesses=%d", command.c_str(), commandArgs.c_str(), g_ProcessExecutionShimAllProcesses);
@@ -245,45 +1102,7 @@ static bool ShouldSubstituteShim(
         return g_ProcessExecutionShimAllProcesses;
     }
 
-    size_t commandLen = command.length();
-
-    bool foundMatch = false;
-
-    for (std::vector<ShimProcessMatch*>::iterator it = g_pShimProcessMatches->begin(); it != g_pShimProcessMatches->end(); ++it)
-    {
-        ShimProcessMatch* pMatch = *it;
-
-        const wchar_t* processName = pMatch->ProcessName.get();
-        size_t processLen = wcslen(processName);
-
-        // lpAppName is longer than e.g. "cmd.exe", see if lpAppName ends with e.g. "\cmd.exe"
-        if (processLen < commandLen)
-        {
-            if (command[commandLen - processLen - 1] == L'\\' &&
-                _wcsicmp(command.c_str() + commandLen - processLen, processName) == 0)
-            {
-                if (CommandArgsContainMatch(commandArgs.c_str(), pMatch->ArgumentMatch.get()))
-                {
-                    foundMatch = true;
-                    break;
-                }
-            }
-
-            continue;
-        }
-
-        if (processLen == commandLen)
-        {
-            if (_wcsicmp(processName, command.c_str()) == 0)
-            {
-                if (CommandArgsContainMatch(commandArgs.c_str(), pMatch->ArgumentMatch.get()))
-                {
-                    foundMatch = true;
-                    break;
-                }
-            }
-        }
-    }
+    bool foundMatch = GetShimProcessMatcher()->Matches(command, commandArgs);
 
     // Filter meaning is exclusive if we're shimming all processes, inclusive otherwise.
     bool filterMatch = !g_ProcessExecutionShimAllProcesses;
@@ -291,9 +1110,12 @@ static bool ShouldSubstituteShim(
     if (foundMatch)
     {
         // Refine match by calling plugin.
-        if (g_SubstituteProcessExecutionPluginFunc != nullptr)
+        if (g_SubstituteProcessExecutionPluginDllPath != nullptr
+            && CallPluginFunc(command, commandArgs, lpEnvironment, dwCreationFlags, lpWorkingDirectory, decision))
         {
-            filterMatch = CallPluginFunc(command, commandArgs, lpEnvironment, lpWorkingDirectory, modifiedArguments) != 0;
+            filterMatch = decision.FilterMatch;
+            hasModifiedArguments = decision.HasModifiedArguments;
+            modifiedArguments.swap(decision.ModifiedArguments);
         }
     }
 
@@ -313,25 +1135,6 @@ static bool ShouldSubstituteShim(
         : !foundMatch || !filterMatch;
  }
 
-void WINAPI FreeModifiedArguments(LPWSTR modifiedArguments)
-{
-    if (modifiedArguments == nullptr)
-    {
-        return;
-    }
-
-    HANDLE hDefaultProcessHeap = GetProcessHeap();
-
-    if (hDefaultProcessHeap == NULL)
-    {
-        Dbg(L"Shim: Failed to retrieve the default process heap with LastError %d", GetLastError());
-    }
-    else if (HeapFree(hDefaultProcessHeap, 0, (LPVOID)modifiedArguments) == FALSE)
-    {
-        Dbg(L"Shim: Failed to free allocation of modified arguments from default process heap");
-    }
-}
-
 BOOL WINAPI MaybeInjectSubstituteProcessShim(
     _In_opt_    LPCWSTR               lpApplicationName,
     _In_opt_    LPCWSTR               lpCommandLine,
@@ -365,19 +1168,19 @@ BOOL WINAPI MaybeInjectSubstituteProcessShim(
     FindApplicationNameFromCommandLine(cmdLine, command, commandArgs);
     Dbg(L"Shim: Found command='%s', args='%s' from lpApplicationName='%s', lpCommandLine='%s'", command.c_str(), commandArgs.c_str(), lpApplicationName, lpCommandLine);
 
-    LPWSTR modifiedArguments = nullptr;
-    
-    if (ShouldSubstituteShim(command, commandArgs, lpEnvironment, lpCurrentDirectory, &modifiedArguments))
+    bool hasModifiedArguments;
+    wstring modifiedArguments;
+
+    if (ShouldSubstituteShim(command, commandArgs, lpEnvironment, dwCreationFlags, lpCurrentDirectory, hasModifiedArguments, modifiedArguments))
     {
         // Instead of Detouring the child, run the requested shim
         // passing the original command line, but only for appropriate commands.
 
-        if (modifiedArguments != nullptr)
+        if (hasModifiedArguments)
         {
-            Dbg(L"Shim: Modified arguments command='%s', args='%s', modifedArgs:'%s'", command.c_str(), commandArgs.c_str(), modifiedArguments);
+            Dbg(L"Shim: Modified arguments command='%s', args='%s', modifedArgs:'%s'", command.c_str(), commandArgs.c_str(), modifiedArguments.c_str());
 
-            commandArgs.assign(modifiedArguments);
-            FreeModifiedArguments(modifiedArguments);
+            commandArgs.swap(modifiedArguments);
         }
 
         Dbg(L"Shim: Inject shim command='%s', args='%s'", command.c_str(), commandArgs.c_str());
@@ -396,10 +1199,8 @@ BOOL WINAPI MaybeInjectSubstituteProcessShim(
             lpProcessInformation);
     }
 
-    FreeModifiedArguments(modifiedArguments);
-
     Dbg(L"Shim: Not substitute command='%s', args='%s'", command.c_str(), commandArgs.c_str());
-    
+
     injectedShim = false;
     return FALSE;
 }
@@ -0,0 +1,174 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include "stdafx.h"
+
+#include "DebuggingHelpers.h"
+#include "FileAccessHelpers.h"
+#include "SystemCallerFilter.h"
+
+// A configured system module, trusted with a set of APIs. 'Base' and 'End' delimit its image while it is loaded, and are both 0 otherwise.
+struct SystemCallerModule
+{
+    const wchar_t* Name;
+    uint32_t Apis;
+
+    // When not null, only the names under this NT path (opened without a root directory) are trusted
+    const wchar_t* NtPathPrefix;
+
+    PVOID volatile Base;
+    PVOID volatile End;
+};
+
+static SystemCallerModule s_systemCallerModules[] =
+{
+    // Console setup opens the console driver (\Device\ConDrv\Connect, \Device\ConDrv\Reference, ...)
+    { L"kernelbase.dll",       (uint32_t)SystemCallerApi::AllOpens, L"\\Device\\ConDrv", nullptr, nullptr },
+    // Key stores and certificate stores of the crypto providers
+    { L"crypt32.dll",          (uint32_t)SystemCallerApi::AllOpens, nullptr, nullptr, nullptr },
+    { L"rsaenh.dll",           (uint32_t)SystemCallerApi::AllOpens, nullptr, nullptr, nullptr },
+    { L"ncrypt.dll",           (uint32_t)SystemCallerApi::AllOpens, nullptr, nullptr, nullptr },
+    // COM initialization
+    { L"combase.dll",          (uint32_t)SystemCallerApi::AllOpens, nullptr, nullptr, nullptr },
+    // Shell folders and their settings (e.g., desktop.ini)
+    { L"shell32.dll",          (uint32_t)SystemCallerApi::AllOpens, nullptr, nullptr, nullptr },
+    { L"windows.storage.dll",  (uint32_t)SystemCallerApi::AllOpens, nullptr, nullptr, nullptr },
+};
+
+// The loader notification API is documented but not declared by the SDK headers
+// See: https://learn.microsoft.com/en-us/windows/win32/devnotes/ldrregisterdllnotification
+#define DLL_NOTIFICATION_REASON_LOADED   1
+#define DLL_NOTIFICATION_REASON_UNLOADED 2
+
+typedef struct
+{
+    ULONG Flags;
+    PCUNICODE_STRING FullDllName;
+    PCUNICODE_STRING BaseDllName;
+    PVOID DllBase;
+    ULONG SizeOfImage;
+} DllNotificationData;
+
+typedef VOID (CALLBACK *DllNotificationFunction)(ULONG reason, const DllNotificationData* data, PVOID context);
+typedef NTSTATUS (NTAPI *LdrRegisterDllNotification_t)(ULONG flags, DllNotificationFunction notificationFunction, PVOID context, PVOID* cookie);
+
+static bool s_systemCallerFilterEnabled = false;
+
+static bool IsModuleNamed(const SystemCallerModule& module, const wchar_t* name, size_t length)
+{
+    return wcslen(module.Name) == length && _wcsnicmp(module.Name, name, length) == 0;
+}
+
+static void SetModuleRange(SystemCallerModule& module, PVOID base, ULONG size)
+{
+    // Readers check 'Base <= address < End', so the range grows from empty and shrinks to empty
+    InterlockedExchangePointer(&module.End, nullptr);
+    InterlockedExchangePointer(&module.Base, base);
+    InterlockedExchangePointer(&module.End, reinterpret_cast<BYTE*>(base) + size);
+}
+
+static void ClearModuleRange(SystemCallerModule& module)
+{
+    InterlockedExchangePointer(&module.End, nullptr);
+    InterlockedExchangePointer(&module.Base, nullptr);
+}
+
+// Runs with the loader lock held: only touches the table
+static VOID CALLBACK OnDllNotification(ULONG reason, const DllNotificationData* data, PVOID context)
+{
+    if (data == nullptr || data->BaseDllName == nullptr || data->BaseDllName->Buffer == nullptr)
+    {
+        return;
+    }
+
+    const size_t length = data->BaseDllName->Length / sizeof(wchar_t);
+    for (SystemCallerModule& module : s_systemCallerModules)
+    {
+        if (!IsModuleNamed(module, data->BaseDllName->Buffer, length))
+        {
+            continue;
+        }
+
+        if (reason == DLL_NOTIFICATION_REASON_LOADED)
+        {
+            SetModuleRange(module, data->DllBase, data->SizeOfImage);
+        }
+        else if (reason == DLL_NOTIFICATION_REASON_UNLOADED)
+        {
+            ClearModuleRange(module);
+        }
+    }
+}
+
+void InitializeSystemCallerFilter()
+{
+    if (!EnableDetoursSystemCallerFilter())
+    {
+        return;
+    }
+
+    LdrRegisterDllNotification_t ldrRegisterDllNotification = reinterpret_cast<LdrRegisterDllNotification_t>(
+        reinterpret_cast<void*>(GetProcAddress(GetModuleHandleW(L"ntdll.dll"), "LdrRegisterDllNotification")));
+    PVOID cookie;
+    if (ldrRegisterDllNotification == nullptr || !NT_SUCCESS(ldrRegisterDllNotification(0, OnDllNotification, nullptr, &cookie)))
+    {
+        // Without notifications, the ranges of modules loaded later would be missing and those of unloaded modules stale
+        Dbg(L"InitializeSystemCallerFilter: Failed to register for loader notifications");
+        return;
+    }
+
+    // The modules loaded before registering, taking their size from their image headers
+    for (SystemCallerModule& module : s_systemCallerModules)
+    {
+        HMODULE handle = GetModuleHandleW(module.Name);
+        if (handle == nullptr)
+        {
+            continue;
+        }
+
+        const IMAGE_DOS_HEADER* dosHeader = reinterpret_cast<const IMAGE_DOS_HEADER*>(handle);
+        const IMAGE_NT_HEADERS* ntHeaders = reinterpret_cast<const IMAGE_NT_HEADERS*>(reinterpret_cast<const BYTE*>(handle) + dosHeader->e_lfanew);
+        if (dosHeader->e_magic == IMAGE_DOS_SIGNATURE && ntHeaders->Signature == IMAGE_NT_SIGNATURE && module.End == nullptr)
+        {
+            SetModuleRange(module, handle, ntHeaders->OptionalHeader.SizeOfImage);
+        }
+    }
+
+    s_systemCallerFilterEnabled = true;
+}
+
+static bool IsUnderNtPath(PCUNICODE_STRING objectName, const wchar_t* prefix)
+{
+    if (objectName == nullptr || objectName->Buffer == nullptr)
+    {
+        return false;
+    }
+
+    const size_t nameLength = objectName->Length / sizeof(wchar_t);
+    const size_t prefixLength = wcslen(prefix);
+    return nameLength >= prefixLength
+        && _wcsnicmp(objectName->Buffer, prefix, prefixLength) == 0
+        && (nameLength == prefixLength || objectName->Buffer[prefixLength] == L'\\');
+}
+
+bool IsTrustedSystemCaller(const void* returnAddress, SystemCallerApi api, PCUNICODE_STRING objectName, HANDLE rootDirectory)
+{
+    if (!s_systemCallerFilterEnabled)
+    {
+        return false;
+    }
+
+    const ULONG_PTR address = (ULONG_PTR)returnAddress;
+    for (const SystemCallerModule& module : s_systemCallerModules)
+    {
+        if (address < (ULONG_PTR)module.Base || address >= (ULONG_PTR)module.End)
+        {
+            continue;
+        }
+
+        return (module.Apis & (uint32_t)api) != 0
+            && (module.NtPathPrefix == nullptr || (rootDirectory == nullptr && IsUnderNtPath(objectName, module.NtPathPrefix)));
+    }
+
+    return false;
+}
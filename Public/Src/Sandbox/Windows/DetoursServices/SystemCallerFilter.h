@@ -0,0 +1,35 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include <cstdint>
+#include <winternl.h>
+
+// The detoured APIs that system modules may be trusted with (see EnableDetoursSystemCallerFilter).
+// Only opens are listed: the APIs that enforce a policy by themselves (writes, deletes, renames, process creation) are never filtered.
+enum class SystemCallerApi : uint32_t {
+    NtCreateFile = 0x1,
+    NtOpenFile   = 0x2,
+    ZwCreateFile = 0x4,
+    ZwOpenFile   = 0x8,
+    AllOpens     = 0xF,
+};
+
+// Recognizes the calls that system DLLs make internally to detoured APIs, on files no pip needs reported: the console driver
+// when kernelbase sets up the console, the key stores of the crypto providers, the files COM and the shell read to initialize, etc.
+// DetouredScope only recognizes the calls nested in another detoured call; these ones come straight from the system DLL.
+//
+// The caller is recognized by the return address of the detoured call, which is looked up in the address ranges of the configured
+// system modules (see s_systemCallerModules). The ranges are kept up to date by loader notifications, so the lookup takes no lock
+// and no system call. A module is trusted with a set of APIs, optionally only for the names under a given NT path.
+//
+// Detours still evaluates the policy of opens that may write, create or delete: only read-only opens of existing files are filtered.
+
+// Looks up the modules that are already loaded and registers for loader notifications, when EnableDetoursSystemCallerFilter is set.
+// This function is suitable for DllMain - it does not assume that CRT memory allocation is available.
+void InitializeSystemCallerFilter();
+
+// Whether the detoured call that returns to 'returnAddress' comes from a configured system module that is trusted with the given API
+// (and with the given object name, for modules trusted with the names under an NT path only).
+bool IsTrustedSystemCaller(const void* returnAddress, SystemCallerApi api, PCUNICODE_STRING objectName, HANDLE rootDirectory);
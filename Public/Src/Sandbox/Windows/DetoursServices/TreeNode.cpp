@@ -1,102 +1,330 @@
 // Copyright (c) Microsoft. All rights reserved.
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
+#include <cwchar>
+#include <new>
 #include "TreeNode.h"
 #include "UtilityHelpers.h"
 
-CaseInsensitiveStringComparer TreeNodeChildren::s_comparer;
+// If we are building this for tests, we don't want to use the builxl private heap that only exists when running under detours
+#ifndef TEST
+    #include "stdafx.h"
+    #include "buildXL_mem.h"
+#endif
 
-void TreeNodeChildren::forEach(std::function<void(std::pair<std::wstring, TreeNode*>*)> function)
+// warning C26409: Avoid calling new and delete explicitly, use std::make_unique<T> instead (r.11).
+// warning C26481: Don't use pointer arithmetic. Use span instead (bounds.1).
+#pragma warning( disable : 26409 26481 )
+
+// Size of the blocks nodes and atoms are allocated from
+static const size_t s_arenaBlockSize = 64 * 1024;
+
+static inline bool AreAtomsEqual(const PathAtomKey& key, const PathAtom* atom) noexcept
 {
-    if (m_map != NULL)
+    if (key.hash != atom->hash || key.length != atom->length)
     {
-        for (auto it = m_map->begin(); it != m_map->end(); it++)
+        return false;
+    }
+
+    const wchar_t* chars = atom->chars();
+    for (size_t i = 0; i < key.length; i++)
+    {
+        if (key.chars[i] != chars[i] && towlower(key.chars[i]) != towlower(chars[i]))
         {
-            std::pair<std::wstring, TreeNode*> pair = *it;
-            function(&pair);
+            return false;
         }
     }
-    else
+
+    return true;
+}
+
+PathAtomKey::PathAtomKey(const wchar_t* atom, size_t atomLength)
+    : chars(atom), length(atomLength)
+{
+    // FNV-1a over the lowercased characters
+    size_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; i++)
+    {
+        h = (h ^ (size_t)towlower(chars[i])) * 1099511628211ULL;
+    }
+
+    hash = h;
+}
+
+TreeNodeChildren::~TreeNodeChildren()
+{
+}
+
+size_t TreeNodeChildren::lowerBound(size_t hash) noexcept
+{
+    const TreeNodeChild* children = sortedChildren();
+    size_t low = 0;
+    size_t high = m_count;
+    while (low < high)
     {
-        for (auto it = m_vector->begin(); it != m_vector->end(); it++)
+        const size_t middle = low + (high - low) / 2;
+        if (children[middle].atom->hash < hash)
+        {
+            low = middle + 1;
+        }
+        else
         {
-            function(it.operator->());
+            high = middle;
         }
     }
+
+    return low;
 }
 
-void TreeNodeChildren::erase(const std::wstring& key)
+void TreeNodeChildren::forEach(std::function<void(TreeNodeChild*)> function)
 {
-    if (m_map != NULL)
+    if (m_map != nullptr)
     {
-        m_map->erase(key);
+        for (auto it = m_map->begin(); it != m_map->end(); it++)
+        {
+            function(&it->second);
+        }
     }
     else
     {
+        TreeNodeChild* children = sortedChildren();
+        for (size_t i = 0; i < m_count; i++)
+        {
+            function(&children[i]);
+        }
+    }
+}
 
-        for (auto it = m_vector->begin(); it != m_vector->end(); it++)
+void TreeNodeChildren::erase(const PathAtomKey& key)
+{
+    if (m_map != nullptr)
+    {
+        const auto range = m_map->equal_range(key.hash);
+        for (auto it = range.first; it != range.second; it++)
         {
-            if (s_comparer(key, it->first))
+            if (AreAtomsEqual(key, it->second.atom))
             {
-                m_vector->erase(it);
+                m_map->erase(it);
                 return;
             }
         }
+
+        return;
     }
-}
 
-void TreeNodeChildren::emplace(const std::wstring& key, TreeNode*& value)
-{
-    // If the vector is in use an we haven't reached the capacity threshold, add it
-    // to the vector
-    if (m_vector != NULL && m_vector->size() <= TREE_NODE_CHILDREN_THRESHOLD)
+    TreeNodeChild* children = sortedChildren();
+    for (size_t i = lowerBound(key.hash); i < m_count && children[i].atom->hash == key.hash; i++)
     {
-        std::pair<const std::wstring&, TreeNode*&> pair(key, value);
-        m_vector->emplace(m_vector->begin(), pair);
+        if (AreAtomsEqual(key, children[i].atom))
+        {
+            std::move(children + i + 1, children + m_count, children + i);
+            m_count--;
+            if (m_vector != nullptr)
+            {
+                m_vector->pop_back();
+            }
+
+            return;
+        }
     }
+}
+
+void TreeNodeChildren::emplace(const PathAtom* key, TreeNode* value)
+{
+    const TreeNodeChild child = { key, value };
+
     // If the map is in use that means we already reached the threshold and we are using the map
-    else if (m_map != NULL)
+    if (m_map != nullptr)
     {
-        m_map->emplace(key, value);
+        m_map->emplace(key->hash, child);
+        return;
     }
-    else
+
+    if (m_count >= TREE_NODE_CHILDREN_THRESHOLD)
     {
-        // Otherwise, we reached the threshold. Create the map, copy the vector content over to the map and delete the vector
-        m_map = std::make_unique<std::unordered_map<std::wstring, TreeNode*, CaseInsensitiveStringHasher, CaseInsensitiveStringComparer>>();
-        for (auto it = m_vector->begin(); it != m_vector->end(); it++)
+        // We reached the threshold. Create the map, copy the sorted array over to the map and release it
+        m_map = std::make_unique<std::unordered_multimap<size_t, TreeNodeChild>>();
+        m_map->reserve(m_count * 2);
+        TreeNodeChild* children = sortedChildren();
+        for (size_t i = 0; i < m_count; i++)
         {
-            (*m_map)[it->first] = it->second;
+            m_map->emplace(children[i].atom->hash, children[i]);
         }
 
-        m_map->emplace(key, value);
-
+        m_map->emplace(key->hash, child);
         m_vector.reset();
-        m_vector = NULL;
+        m_count = 0;
+        return;
+    }
+
+    const size_t index = lowerBound(key->hash);
+    if (m_vector != nullptr)
+    {
+        m_vector->insert(m_vector->begin() + index, child);
+    }
+    else if (m_count < TREE_NODE_INLINE_CHILDREN)
+    {
+        std::move_backward(m_inline + index, m_inline + m_count, m_inline + m_count + 1);
+        m_inline[index] = child;
     }
+    else
+    {
+        // The inline array is full, move to the vector
+        m_vector = std::make_unique<std::vector<TreeNodeChild>>();
+        m_vector->reserve(TREE_NODE_INLINE_CHILDREN * 4);
+        m_vector->insert(m_vector->end(), m_inline, m_inline + m_count);
+        m_vector->insert(m_vector->begin() + index, child);
+    }
+
+    m_count++;
 }
 
-bool TreeNodeChildren::find(const std::wstring& key, std::pair<std::wstring, TreeNode*>& value)
+bool TreeNodeChildren::find(const PathAtomKey& key, TreeNodeChild& value)
 {
-    if (m_vector != NULL)
+    if (m_map != nullptr)
     {
-        for (auto it = m_vector->begin(); it != m_vector->end(); it++)
+        const auto range = m_map->equal_range(key.hash);
+        for (auto it = range.first; it != range.second; it++)
         {
-            if (s_comparer(key, it->first))
+            if (AreAtomsEqual(key, it->second.atom))
             {
-                value = std::make_pair(it->first, it->second);
+                value = it->second;
                 return true;
             }
         }
+
+        return false;
     }
-    else
+
+    const TreeNodeChild* children = sortedChildren();
+    for (size_t i = lowerBound(key.hash); i < m_count && children[i].atom->hash == key.hash; i++)
     {
-        const auto it = m_map->find(key);
-        if (it != m_map->end())
+        if (AreAtomsEqual(key, children[i].atom))
         {
-            value = std::make_pair(it->first, it->second);
+            value = children[i];
             return true;
         }
     }
 
     return false;
-}
\ No newline at end of file
+}
+
+void TreeNodeChildren::clear() noexcept
+{
+    m_map.reset();
+    m_vector.reset();
+    m_count = 0;
+}
+
+TreeNodeArena::~TreeNodeArena()
+{
+    // Nodes are expected to be deleted by their owner, so there are no destructors left to run
+    while (m_blocks != nullptr)
+    {
+        Block* next = m_blocks->next;
+        delete[] reinterpret_cast<char*>(m_blocks);
+        m_blocks = next;
+    }
+}
+
+void* TreeNodeArena::Allocate(size_t size)
+{
+    size = (size + 7) & ~(size_t)7;
+
+    if (m_blocks == nullptr || m_blocks->size - m_blocks->used < size)
+    {
+        // Oversized requests (very long atoms) get a block of their own
+        const size_t blockSize = std::max(s_arenaBlockSize, size + sizeof(Block));
+        Block* block = reinterpret_cast<Block*>(new char[blockSize]);
+        block->next = m_blocks;
+        block->size = blockSize;
+        block->used = sizeof(Block);
+        m_blocks = block;
+    }
+
+    void* result = reinterpret_cast<char*>(m_blocks) + m_blocks->used;
+    m_blocks->used += size;
+    return result;
+}
+
+TreeNode* TreeNodeArena::NewNode(bool isIntermediate)
+{
+    void* memory;
+    if (m_freeNodes != nullptr)
+    {
+        memory = m_freeNodes;
+        m_freeNodes = m_freeNodes->next;
+    }
+    else
+    {
+        static_assert(sizeof(TreeNode) >= sizeof(FreeNode), "Removed nodes are kept in a free list");
+        memory = Allocate(sizeof(TreeNode));
+    }
+
+    TreeNode* node = new (memory) TreeNode();
+    node->intermediate = isIntermediate;
+    return node;
+}
+
+void TreeNodeArena::DeleteNode(TreeNode* node) noexcept
+{
+    node->~TreeNode();
+
+    FreeNode* freeNode = reinterpret_cast<FreeNode*>(node);
+    freeNode->next = m_freeNodes;
+    m_freeNodes = freeNode;
+}
+
+const PathAtom* TreeNodeArena::Intern(const PathAtomKey& atom)
+{
+    if ((m_atomCount + 1) * 2 > m_atoms.size())
+    {
+        GrowAtoms();
+    }
+
+    // Interning is case sensitive: atoms that only differ in casing are different atoms, so each node keeps the casing it was inserted with
+    const size_t mask = m_atoms.size() - 1;
+    size_t index = atom.hash & mask;
+    while (m_atoms[index] != nullptr)
+    {
+        const PathAtom* candidate = m_atoms[index];
+        if (candidate->hash == atom.hash && candidate->length == atom.length && wmemcmp(candidate->chars(), atom.chars, atom.length) == 0)
+        {
+            return candidate;
+        }
+
+        index = (index + 1) & mask;
+    }
+
+    PathAtom* result = reinterpret_cast<PathAtom*>(Allocate(sizeof(PathAtom) + (atom.length + 1) * sizeof(wchar_t)));
+    result->hash = atom.hash;
+    result->length = atom.length;
+    wchar_t* chars = const_cast<wchar_t*>(result->chars());
+    wmemcpy(chars, atom.chars, atom.length);
+    chars[atom.length] = L'\0';
+
+    m_atoms[index] = result;
+    m_atomCount++;
+    return result;
+}
+
+void TreeNodeArena::GrowAtoms()
+{
+    std::vector<const PathAtom*> atoms(m_atoms.empty() ? 256 : m_atoms.size() * 2, nullptr);
+    const size_t mask = atoms.size() - 1;
+    for (const PathAtom* atom : m_atoms)
+    {
+        if (atom != nullptr)
+        {
+            size_t index = atom->hash & mask;
+            while (atoms[index] != nullptr)
+            {
+                index = (index + 1) & mask;
+            }
+
+            atoms[index] = atom;
+        }
+    }
+
+    m_atoms.swap(atoms);
+}
@@ -6,7 +6,7 @@
 #pragma warning(disable: 4710 5045)
 
 #if defined(_DO_NOT_EXPORT)
-#define EXPORT  
+#define EXPORT
 #else
 #define EXPORT __declspec(dllexport)
 #endif
@@ -21,6 +21,9 @@ struct TreeNode;
 // The threshold is defined based on profiling sessions
 #define TREE_NODE_CHILDREN_THRESHOLD 100U
 
+// Number of children a TreeNode holds without any allocation. Most nodes of a path tree have very few children
+#define TREE_NODE_INLINE_CHILDREN 4U
+
 // warning C4625: 'TreeNodeChildren': copy constructor was implicitly defined as deleted
 // warning C4626: 'TreeNodeChildren': assignment operator was implicitly defined as deleted
 // warning C5026: 'TreeNode': move constructor was implicitly defined as deleted
@@ -29,56 +32,89 @@ struct TreeNode;
 // warning C26432: If you define or delete any default operation in the type 'class TreeNodeChildren', define or delete them all (c.21).
 #pragma warning( disable : 4625 4626 5026 5027 26455 26432 )
 
-// The children of a TreeNode. Exposes a mutable associative collection of wstring to TreeNode*.
+// A path atom interned by a TreeNodeArena: there is a single copy of each distinct (case sensitive) atom per arena.
+// The characters follow the structure and are null terminated.
+struct PathAtom {
+    // Case insensitive hash of the atom
+    size_t hash;
+    size_t length;
+
+    inline const wchar_t* chars() const noexcept { return reinterpret_cast<const wchar_t*>(this + 1); }
+};
+
+// A path atom to look up, which doesn't need to be interned
+struct PathAtomKey {
+    const wchar_t* chars;
+    size_t length;
+    size_t hash;
+
+    EXPORT PathAtomKey(const wchar_t* atom, size_t atomLength);
+
+    inline PathAtomKey(const std::wstring& atom) : PathAtomKey(atom.c_str(), atom.length()) { }
+    inline PathAtomKey(const PathAtom* atom) noexcept : chars(atom->chars()), length(atom->length), hash(atom->hash) { }
+};
+
+// An edge to a child, with the path atom that leads to it
+struct TreeNodeChild {
+    const PathAtom* atom;
+    TreeNode* node;
+};
+
+// The children of a TreeNode. Exposes a mutable associative collection of path atoms to TreeNode*.
 // In most cases a TreeNode do not have too many children, so the class is optimized to deal with the case of a lower
 // number of children.
-// The implementation uses a vector as the underlying initial container and switches to an unordered map after the threshold capacity is met. The rationale
-// is that a vector behaves better (and has lower footprint) than a map for a low number of elements
-// The class assumes a relatively low number of deletions: once the threshold is reached the map is used for the remainding lifetime of the instance
+// Children are kept in an array sorted by atom hash: first a small inline array, then a vector once it overflows. After the threshold
+// capacity is met the implementation switches to a hash map. The rationale is that a sorted array behaves better (and has lower footprint)
+// than a map for a low number of elements
+// The class assumes a relatively low number of deletions: once the threshold is reached the map is used until the collection is cleared
 // All comparisons againt the key are case insensitive, following the functionality of PathTree
 // This class is not thread safe
 class TreeNodeChildren
 {
 public:
-    EXPORT inline TreeNodeChildren() :
-        m_vector(std::make_unique<std::vector<std::pair<std::wstring, TreeNode*>>>())
-    { 
-    }
+    EXPORT inline TreeNodeChildren() noexcept { }
 
-    EXPORT inline ~TreeNodeChildren() { }
+    EXPORT ~TreeNodeChildren();
 
-    TreeNodeChildren(const TreeNodeChildren& obj) = default;
-    TreeNodeChildren& operator=(const TreeNodeChildren&) = default;
+    TreeNodeChildren(const TreeNodeChildren&) = delete;
+    TreeNodeChildren& operator=(const TreeNodeChildren&) = delete;
 
     // Finds a key in the collection. Returns whether it was found
     // The given out value is populated with the result.
-    EXPORT bool find(const std::wstring& key, std::pair<std::wstring, TreeNode*>& value);
+    EXPORT bool find(const PathAtomKey& key, TreeNodeChild& value);
+
+    // Emplaces a key value association in the collection. The key is assumed not to be present already
+    EXPORT void emplace(const PathAtom* key, TreeNode* value);
 
-    // Emplaces a key value association in the collection
-    EXPORT void emplace(const std::wstring& key, TreeNode*& value);
-    
     // Erases the given key, if present, from the collection
-    EXPORT void erase(const std::wstring& key);
+    EXPORT void erase(const PathAtomKey& key);
 
     // The current size of the collection
     EXPORT inline size_t size() noexcept
     {
-        return m_map != NULL ? (size_t)m_map->size() : (size_t)m_vector->size();
+        return m_map != nullptr ? m_map->size() : m_count;
     }
 
     // Removes all elements from the collection
-    EXPORT inline void clear() noexcept
-    {
-        m_map != NULL ? m_map->clear() : m_vector->clear();
-    }
+    EXPORT void clear() noexcept;
 
     // Applies the given function to each element of the collection
-    EXPORT void forEach(std::function<void(std::pair<std::wstring, TreeNode*>*)> function);
+    EXPORT void forEach(std::function<void(TreeNodeChild*)> function);
 
 private:
-    std::unique_ptr<std::unordered_map<std::wstring, TreeNode*, CaseInsensitiveStringHasher, CaseInsensitiveStringComparer>> m_map;
-    std::unique_ptr<std::vector<std::pair<std::wstring, TreeNode*>>> m_vector;
-    static CaseInsensitiveStringComparer s_comparer;
+    // The sorted array in use: the inline one or the vector
+    inline TreeNodeChild* sortedChildren() noexcept
+    {
+        return m_vector != nullptr ? m_vector->data() : m_inline;
+    }
+
+    // Index of the first element of the sorted array whose hash is not lower than the given one
+    size_t lowerBound(size_t hash) noexcept;
+
+    size_t m_count = 0;
+    TreeNodeChild m_inline[TREE_NODE_INLINE_CHILDREN] = {};
+    std::unique_ptr<std::vector<TreeNodeChild>> m_vector;
+    std::unique_ptr<std::unordered_multimap<size_t, TreeNodeChild>> m_map;
 };
 
 // A node in a PathTree
@@ -87,4 +123,50 @@ struct TreeNode {
     TreeNodeChildren children;
     // Whether the node is an intermediate node or it represents a path that was explicitly inserted
     bool intermediate = false;
-};
\ No newline at end of file
+};
+
+// Owns the nodes and the atoms of a PathTree.
+// Nodes and atoms are bump allocated from large blocks. Removed nodes are recycled for subsequent insertions, while atoms are kept
+// until the arena is destroyed: the set of distinct atoms a process sees is small compared to the number of paths built from them.
+// This class is not thread safe
+class TreeNodeArena
+{
+public:
+    EXPORT inline TreeNodeArena() noexcept { }
+    EXPORT ~TreeNodeArena();
+
+    TreeNodeArena(const TreeNodeArena&) = delete;
+    TreeNodeArena& operator=(const TreeNodeArena&) = delete;
+
+    // Creates a node with no children
+    EXPORT TreeNode* NewNode(bool isIntermediate);
+
+    // Destroys a node. Its children are not affected
+    EXPORT void DeleteNode(TreeNode* node) noexcept;
+
+    // Returns the single copy of the given atom, creating it if this is the first time the arena sees it
+    EXPORT const PathAtom* Intern(const PathAtomKey& atom);
+
+private:
+    struct Block {
+        Block* next;
+        size_t size;
+        size_t used;
+    };
+
+    struct FreeNode {
+        FreeNode* next;
+    };
+
+    // Allocates memory from the current block, 8 bytes aligned
+    void* Allocate(size_t size);
+
+    void GrowAtoms();
+
+    Block* m_blocks = nullptr;
+    FreeNode* m_freeNodes = nullptr;
+
+    // Open addressing table of the interned atoms, of a power of 2 size
+    std::vector<const PathAtom*> m_atoms;
+    size_t m_atomCount = 0;
+};
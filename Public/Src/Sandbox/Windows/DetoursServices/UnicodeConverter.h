@@ -10,10 +10,13 @@
 // CLASSES
 // ----------------------------------------------------------------------------
 
+// Converts the strings passed to the ANSI detours. Strings that fit in MAX_PATH characters, i.e., almost all the paths,
+// are converted with a single MultiByteToWideChar into a buffer of the converter itself, without allocating.
 class UnicodeConverter
 {
 private:
     wchar_t *m_str;
+    wchar_t m_inlineStr[MAX_PATH];
 
 public:
     UnicodeConverter(PCSTR s)
@@ -24,6 +27,16 @@ public:
         }
         else
         {
+            DWORD lastError = GetLastError();
+            if (MultiByteToWideChar(CP_ACP, 0, s, -1, m_inlineStr, _countof(m_inlineStr)) > 0)
+            {
+                m_str = m_inlineStr;
+                return;
+            }
+
+            // The string is too long for the inline buffer: the first attempt must not leak its error to the detour
+            SetLastError(lastError);
+
             int charsRequired = MultiByteToWideChar(CP_ACP, 0, s, -1, NULL, 0);
             if (charsRequired <= 0) {
                 PCWSTR errorMsg = L"UnicodeConverter::UnicodeConverter: Failed to convert string:2";
@@ -52,7 +65,10 @@ public:
 
     ~UnicodeConverter()
     {
-        delete[] m_str;
+        if (m_str != m_inlineStr)
+        {
+            delete[] m_str;
+        }
     }
 
     PWSTR GetMutableString()
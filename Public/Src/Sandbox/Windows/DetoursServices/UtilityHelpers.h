@@ -70,12 +70,16 @@ struct CaseInsensitiveStringLessThan {
     }
 };
 
-// Case-insensitive hasher for wstrings
+// Case-insensitive hasher for wstrings, consistent with CaseInsensitiveStringComparer
 struct CaseInsensitiveStringHasher {
     size_t operator()(const std::wstring& str) const {
-        std::wstring lowerstr(str);
-        std::transform(lowerstr.begin(), lowerstr.end(), lowerstr.begin(), towlower);
+        // FNV-1a over the lowercased characters, so hashing doesn't need a lowercased copy
+        uint64_t hash = 14695981039346656037ULL;
+        for (const wchar_t c : str)
+        {
+            hash = (hash ^ (uint64_t)towlower(c)) * 1099511628211ULL;
+        }
 
-        return std::hash<std::wstring>()(lowerstr);
+        return (size_t)hash;
     }
 };
@@ -0,0 +1,216 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include "stdafx.h"
+
+#include <algorithm>
+#include <cwctype>
+#include <string_view>
+#include <winioctl.h>
+#include <mountmgr.h>
+
+#include "DebuggingHelpers.h"
+#include "DetouredScope.h"
+#include "StringOperations.h"
+#include "VolumeMountPointCache.h"
+
+static void NormalizeMountPoint(std::wstring& mountPoint)
+{
+    if (!mountPoint.empty() && IsDirectorySeparator(mountPoint.back()))
+    {
+        mountPoint.pop_back();
+    }
+
+    std::transform(mountPoint.begin(), mountPoint.end(), mountPoint.begin(), [](wchar_t c) { return (wchar_t)towupper(c); });
+}
+
+void VolumeMountPointCache::Initialize()
+{
+    // Querying the mount manager is not an access of the pip
+    DetouredScope scope;
+
+    m_mountManager = CreateFileW(
+        MOUNTMGR_DOS_DEVICE_NAME,
+        GENERIC_READ,
+        FILE_SHARE_READ | FILE_SHARE_WRITE,
+        nullptr,
+        OPEN_EXISTING,
+        FILE_FLAG_OVERLAPPED,
+        nullptr);
+    if (m_mountManager == INVALID_HANDLE_VALUE)
+    {
+        Dbg(L"VolumeMountPointCache::Initialize: Failed to open the mount manager (error code: 0x%08x)", (int)GetLastError());
+        return;
+    }
+
+    // Arm the notification before enumerating, so a change made during the enumeration triggers another one
+    if (!ArmChangeNotification())
+    {
+        CloseHandle(m_mountManager);
+        m_mountManager = INVALID_HANDLE_VALUE;
+        return;
+    }
+
+    Rebuild();
+    m_enabled = true;
+}
+
+bool VolumeMountPointCache::ArmChangeNotification()
+{
+    for (int attempt = 0; attempt < MaxArmAttempts; attempt++)
+    {
+        // The request completes as soon as the epoch of the mount manager differs from the one it is given, returning the current one
+        m_notifyEpoch = m_epoch;
+        ZeroMemory(&m_overlapped, sizeof(m_overlapped));
+        if (DeviceIoControl(
+                m_mountManager,
+                IOCTL_MOUNTMGR_CHANGE_NOTIFY,
+                &m_notifyEpoch,
+                sizeof(MOUNTMGR_CHANGE_NOTIFY_INFO),
+                &m_notifyEpoch,
+                sizeof(MOUNTMGR_CHANGE_NOTIFY_INFO),
+                nullptr,
+                &m_overlapped))
+        {
+            m_epoch = m_notifyEpoch;
+            continue;
+        }
+
+        if (GetLastError() == ERROR_IO_PENDING)
+        {
+            return true;
+        }
+
+        Dbg(L"VolumeMountPointCache::ArmChangeNotification: Failed to request the notification (error code: 0x%08x)", (int)GetLastError());
+        return false;
+    }
+
+    Dbg(L"VolumeMountPointCache::ArmChangeNotification: The mount points keep changing, giving up");
+    return false;
+}
+
+void VolumeMountPointCache::Rebuild()
+{
+    m_mountPoints.clear();
+
+    wchar_t volumeName[MAX_PATH];
+    HANDLE find = FindFirstVolumeW(volumeName, ARRAYSIZE(volumeName));
+    if (find == INVALID_HANDLE_VALUE)
+    {
+        return;
+    }
+
+    std::vector<wchar_t> paths(MAX_PATH);
+    do
+    {
+        DWORD length = 0;
+        if (!GetVolumePathNamesForVolumeNameW(volumeName, paths.data(), (DWORD)paths.size(), &length))
+        {
+            if (GetLastError() != ERROR_MORE_DATA)
+            {
+                continue;
+            }
+
+            paths.resize(length);
+            if (!GetVolumePathNamesForVolumeNameW(volumeName, paths.data(), (DWORD)paths.size(), &length))
+            {
+                continue;
+            }
+        }
+
+        // A sequence of null terminated paths, ended by an empty string
+        for (const wchar_t* path = paths.data(); *path != L'\0'; path += wcslen(path) + 1)
+        {
+            std::wstring mountPoint(path);
+            NormalizeMountPoint(mountPoint);
+            if (!mountPoint.empty())
+            {
+                m_mountPoints.push_back(std::move(mountPoint));
+            }
+        }
+    } while (FindNextVolumeW(find, volumeName, ARRAYSIZE(volumeName)));
+
+    FindVolumeClose(find);
+    std::sort(m_mountPoints.begin(), m_mountPoints.end());
+}
+
+void VolumeMountPointCache::Refresh()
+{
+    DetouredScope scope;
+
+    const std::unique_lock<std::shared_mutex> lock(m_lock);
+    if (!m_enabled || !HasOverlappedIoCompleted(&m_overlapped))
+    {
+        // Another thread refreshed the table already
+        return;
+    }
+
+    DWORD bytesReturned;
+    if (GetOverlappedResult(m_mountManager, &m_overlapped, &bytesReturned, FALSE))
+    {
+        m_epoch = m_notifyEpoch;
+    }
+
+    if (!ArmChangeNotification())
+    {
+        m_enabled = false;
+        m_mountPoints.clear();
+        return;
+    }
+
+    Rebuild();
+}
+
+bool VolumeMountPointCache::TryGetMountPoint(const std::wstring& fullPath, size_t& mountPointLength)
+{
+    std::call_once(m_initialized, [this]() { Initialize(); });
+    if (!m_enabled)
+    {
+        return false;
+    }
+
+    if (HasOverlappedIoCompleted(&m_overlapped))
+    {
+        Refresh();
+    }
+
+    std::wstring path(fullPath);
+    NormalizeMountPoint(path);
+
+    const std::shared_lock<std::shared_mutex> lock(m_lock);
+    if (!m_enabled || m_mountPoints.empty())
+    {
+        return false;
+    }
+
+    // Candidates are the prefixes of the path that end at a separator (or at its end), from the longest one
+    size_t length = path.length();
+    while (length > 0)
+    {
+        std::wstring_view prefix(path.c_str(), length);
+        auto it = std::lower_bound(
+            m_mountPoints.begin(),
+            m_mountPoints.end(),
+            prefix,
+            [](const std::wstring& mountPoint, std::wstring_view value) { return std::wstring_view(mountPoint) < value; });
+        if (it != m_mountPoints.end() && std::wstring_view(*it) == prefix)
+        {
+            mountPointLength = length;
+            return true;
+        }
+
+        length = path.find_last_of(L"\\", length - 1);
+        if (length == std::wstring::npos)
+        {
+            break;
+        }
+    }
+
+    return false;
+}
+
+VolumeMountPointCache* VolumeMountPointCache::GetInstance()
+{
+    static VolumeMountPointCache s_singleton;
+    return &s_singleton;
+}
@@ -0,0 +1,59 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+// The mount points of the volumes of the machine, drive letters and mounted folders, so that Detoured_GetVolumePathNameW finds the mount point
+// a path is under with a longest-prefix match (see EnableDetoursVolumeMountPointCache). GetVolumePathNameW queries the mount manager for
+// every parent of the path, which adds up on machines with many mounted VHDs and mounted folders in the output trees.
+//
+// The table is built from the volume enumeration the first time it is used, and built again only when the mount manager signals that
+// the mount points changed (IOCTL_MOUNTMGR_CHANGE_NOTIFY). The notification is requested asynchronously and checked without a system call.
+// When it can't be requested (e.g., the mount manager can't be opened for reading), the cache stays disabled.
+// All operations are thread-safe.
+class VolumeMountPointCache {
+public:
+    static VolumeMountPointCache* GetInstance();
+
+    // Finds the deepest mount point the given full path (e.g. 'C:\mnt\vhd\out\a.obj') is under, and sets 'mountPointLength' to its
+    // length in the path, without the trailing separator (e.g. 'C:\mnt\vhd'). Returns false if the path is not under a known mount point,
+    // or if the cache is disabled.
+    bool TryGetMountPoint(const std::wstring& fullPath, size_t& mountPointLength);
+
+private:
+    VolumeMountPointCache() = default;
+    VolumeMountPointCache(const VolumeMountPointCache&) = delete;
+    VolumeMountPointCache& operator = (const VolumeMountPointCache&) = delete;
+
+    static const int MaxArmAttempts = 4;
+
+    void Initialize();
+
+    // Builds the table again if the mount points changed since it was built
+    void Refresh();
+
+    // Requests a notification for the next change of the mount points. Returns false if it can't be requested.
+    // Must be called with the lock held exclusively (or before the cache is enabled).
+    bool ArmChangeNotification();
+
+    // Must be called with the lock held exclusively (or before the cache is enabled)
+    void Rebuild();
+
+    std::once_flag m_initialized;
+    std::atomic<bool> m_enabled{ false };
+
+    HANDLE m_mountManager = INVALID_HANDLE_VALUE;
+    OVERLAPPED m_overlapped = { 0 };
+    ULONG m_epoch = 0;
+    ULONG m_notifyEpoch = 0;
+
+    // Mount points in upper case and without trailing separator (e.g. 'C:', 'C:\MNT\VHD'), sorted
+    std::shared_mutex m_lock;
+    std::vector<std::wstring> m_mountPoints;
+};
@@ -0,0 +1,120 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include "stdafx.h"
+
+#include "WriteAccessReportCache.h"
+#include "buildXL_mem.h"
+
+bool WriteAccessReportCache::ReportFields::operator==(const ReportFields& other) const
+{
+    return Access == other.Access
+        && Result == other.Result
+        && Level == other.Level
+        && Validity == other.Validity
+        && Error == other.Error
+        && Usn == other.Usn
+        && DesiredAccess == other.DesiredAccess
+        && ShareMode == other.ShareMode
+        && CreationDisposition == other.CreationDisposition
+        && FlagsAndAttributes == other.FlagsAndAttributes
+        && OpenedFileOrDirectoryAttributes == other.OpenedFileOrDirectoryAttributes
+        && PathId == other.PathId
+        && wcscmp(Operation, other.Operation) == 0;
+}
+
+uint64_t WriteAccessReportCache::Hash(const wchar_t* path, size_t pathLength, const ReportFields& report)
+{
+    // 64-bit FNV-1a over the path, then the fields the reports of the same path are most likely to differ in
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < pathLength; i++)
+    {
+        hash = (hash ^ (uint64_t)path[i]) * 1099511628211ULL;
+    }
+
+    const uint64_t fields[] = {
+        (uint64_t)report.Access,
+        (uint64_t)report.Error,
+        (uint64_t)report.Usn,
+        (uint64_t)report.DesiredAccess,
+        (uint64_t)report.CreationDisposition,
+        (uint64_t)report.FlagsAndAttributes,
+    };
+
+    for (uint64_t field : fields)
+    {
+        hash = (hash ^ field) * 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+bool WriteAccessReportCache::TryRegister(
+    AccessCheckResult const& accessCheck,
+    FileOperationContext const& context,
+    PolicyResult const& policyResult,
+    DWORD error,
+    USN usn)
+{
+    const ReportFields report = {
+        context.Operation,
+        accessCheck.Access,
+        accessCheck.Result,
+        accessCheck.Level,
+        accessCheck.Validity,
+        error,
+        usn,
+        context.DesiredAccess,
+        context.ShareMode,
+        context.CreationDisposition,
+        context.FlagsAndAttributes,
+        context.OpenedFileOrDirectoryAttributes,
+        policyResult.GetPathId(),
+    };
+
+    const wchar_t* path = policyResult.GetCanonicalizedPath().GetPathString();
+    const size_t pathLength = wcslen(path);
+    const uint64_t hash = Hash(path, pathLength, report);
+    const uint64_t epoch = m_epoch;
+    Stripe& stripe = m_stripes[(hash >> 32) % StripeCount];
+
+    auto isRegistered = [&](const std::unordered_map<uint64_t, Entry>::const_iterator& it)
+    {
+        return it != stripe.Entries.end()
+            && it->second.Epoch == epoch
+            && it->second.Report == report
+            && it->second.Path.length() == pathLength
+            && it->second.Path.compare(0, pathLength, path, pathLength) == 0;
+    };
+
+    {
+        const std::shared_lock<std::shared_mutex> lock(stripe.Lock);
+        if (isRegistered(stripe.Entries.find(hash)))
+        {
+            return false;
+        }
+    }
+
+    const std::unique_lock<std::shared_mutex> lock(stripe.Lock);
+    if (isRegistered(stripe.Entries.find(hash)))
+    {
+        return false;
+    }
+
+    if (stripe.Entries.size() >= MaxEntriesPerStripe)
+    {
+        stripe.Entries.clear();
+    }
+
+    Entry& entry = stripe.Entries[hash];
+    entry.Epoch = epoch;
+    entry.Path.assign(path, pathLength);
+    entry.Report = report;
+    return true;
+}
+
+WriteAccessReportCache* WriteAccessReportCache::GetInstance()
+{
+    static WriteAccessReportCache s_singleton;
+    return &s_singleton;
+}
@@ -0,0 +1,80 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include "FileAccessHelpers.h"
+#include "PolicyResult.h"
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+
+// Remembers the reports of allowed opens for write access sent by this process, so an open reporting exactly the same as an earlier one
+// doesn't need to be reported again. Tools like linkers reopen the same outputs for write over and over, and the reports of these
+// opens are all the same: the receiving end keeps one of them anyway.
+// Deleting, renaming or linking a file invalidates all the reports remembered so far, so the first open following such an operation
+// is always reported, keeping the order of these operations and of the writes around them.
+//
+// The cache is split into stripes, each with its own lock, like PolicySearchCache. Stripes are bounded: a stripe that is full is cleared.
+// All operations are thread-safe.
+class WriteAccessReportCache {
+public:
+    static WriteAccessReportCache* GetInstance();
+
+    // Registers a report about to be sent. Returns false if the same report was already registered since the last invalidation,
+    // in which case it doesn't need to be sent again.
+    bool TryRegister(AccessCheckResult const& accessCheck, FileOperationContext const& context, PolicyResult const& policyResult, DWORD error, USN usn);
+
+    // Forgets all the reports registered so far
+    void Invalidate() { m_epoch++; }
+
+private:
+    WriteAccessReportCache() = default;
+    WriteAccessReportCache(const WriteAccessReportCache&) = delete;
+    WriteAccessReportCache& operator = (const WriteAccessReportCache&) = delete;
+
+    static const size_t StripeCount = 16;
+    static const size_t MaxEntriesPerStripe = 1024;
+
+    // Everything a file access report is made of, besides the path and the identifiers of the operation
+    struct ReportFields {
+        const wchar_t* Operation;
+        RequestedAccess Access;
+        ResultAction Result;
+        ReportLevel Level;
+        PathValidity Validity;
+        DWORD Error;
+        USN Usn;
+        DWORD DesiredAccess;
+        DWORD ShareMode;
+        DWORD CreationDisposition;
+        DWORD FlagsAndAttributes;
+        DWORD OpenedFileOrDirectoryAttributes;
+        DWORD PathId;
+
+        bool operator==(const ReportFields& other) const;
+    };
+
+    struct Entry {
+        uint64_t Epoch;
+        std::wstring Path;
+        ReportFields Report;
+    };
+
+    // Entries are keyed by a hash of their path and report. Entries with the same hash replace each other.
+    struct alignas(64) Stripe {
+        std::shared_mutex Lock;
+        std::unordered_map<uint64_t, Entry> Entries;
+    };
+
+    static uint64_t Hash(const wchar_t* path, size_t pathLength, const ReportFields& report);
+
+    // Incremented by Invalidate: entries registered before are ignored from then on
+    std::atomic<uint64_t> m_epoch{ 0 };
+
+    Stripe m_stripes[StripeCount];
+};
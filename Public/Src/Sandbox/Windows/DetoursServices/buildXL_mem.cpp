@@ -0,0 +1,519 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include "stdafx.h"
+
+#include "FileAccessHelpers.h"
+#include "buildXL_mem.h"
+
+// ----------------------------------------------------------------------------
+// Small allocations are served from thread-local slabs of fixed size blocks, carved from the private heap.
+//
+// Every block is preceded by a header pointing to the slab it belongs to (or null for blocks allocated directly from the
+// private heap), so it can be freed from any thread. The thread owning the slab frees its blocks to a local free list, without
+// any synchronization. Other threads push them onto the remote free list of the slab, which the owner collects at once when it
+// runs out of blocks. When a thread exits, its empty slabs are returned to the private heap and the others are abandoned, to be
+// adopted by the next thread that needs a slab of the same size class.
+//
+// The memory accounting of the process data reports is done per slab: allocating from an existing slab does not touch
+// the global counters.
+// ----------------------------------------------------------------------------
+
+// Blocks are 16 byte aligned, like the ones of the private heap, so the header keeps the alignment of the memory that follows it
+struct DECLSPEC_ALIGN(16) DD_BLOCK_HEADER
+{
+    struct DD_SLAB* Slab;
+
+    // For blocks allocated directly from the private heap: the size accounted for the block, if any
+    LONG64 AccountedSize;
+};
+
+// A free block, linked through the memory following its header
+struct DD_FREE_BLOCK
+{
+    DD_FREE_BLOCK* Next;
+};
+
+struct DECLSPEC_ALIGN(16) DD_SLAB
+{
+    // Thread cache of the thread owning the slab, or null when the slab is abandoned. Only ever written by the owning thread.
+    struct DD_THREAD_CACHE* volatile Owner;
+
+    // Links in the slab list of the owning thread, or in the list of abandoned slabs
+    DD_SLAB* Prev;
+    DD_SLAB* Next;
+
+    size_t SizeClass;
+    size_t BlockSize;
+
+    // Blocks allocated from the slab and not freed to the local free list, including the ones waiting in the remote free list
+    size_t UsedBlocks;
+    bool IsFull;
+
+    // Size accounted for the slab in the process data, if any
+    LONG64 AccountedSize;
+
+    // Memory of the slab that was never allocated from
+    char* Bump;
+    char* End;
+
+    DD_FREE_BLOCK* LocalFree;
+    DD_FREE_BLOCK* volatile RemoteFree;
+};
+
+// Size of the memory chunks slabs are allocated as, including the slab itself
+static const size_t s_slabSize = 64 * 1024;
+
+// Block sizes, including the block header. Bigger allocations go straight to the private heap.
+static const size_t s_sizeClasses[] = { 32, 48, 64, 80, 96, 128, 160, 192, 256, 384, 512, 768, 1024 };
+static const size_t s_sizeClassCount = ARRAYSIZE(s_sizeClasses);
+static const size_t s_noSizeClass = s_sizeClassCount;
+
+struct DD_SIZE_CLASS_SLABS
+{
+    // Slabs that may still have blocks to allocate. The first one is the one allocations come from.
+    DD_SLAB* Available;
+
+    // Slabs that ran out of blocks. They come back to the available list as their blocks get freed.
+    DD_SLAB* Full;
+};
+
+struct DD_THREAD_CACHE
+{
+    DD_SIZE_CLASS_SLABS Classes[s_sizeClassCount];
+    LONG64 AccountedSize;
+};
+
+// Slabs of exited threads, by size class
+struct DD_ABANDONED_SLABS
+{
+    SRWLOCK Lock;
+    DD_SLAB* Head;
+};
+
+static DD_ABANDONED_SLABS s_abandonedSlabs[s_sizeClassCount] = {};
+
+// The cache of a thread that already released it. Allocations made later on that thread (e.g., by the thread detach
+// notifications of other libraries) go straight to the private heap.
+#define DD_RELEASED_THREAD_CACHE (reinterpret_cast<DD_THREAD_CACHE*>(1))
+
+static __declspec(thread) DD_THREAD_CACHE* gt_ddThreadCache = nullptr;
+
+// Accounts for memory taken from, or given back to, the private heap
+static void AccountHeapMemory(LONG64 size)
+{
+    LONG64 allocatedSize = InterlockedAdd64(&g_detoursHeapAllocatedMemoryInBytes, size);
+    if (size <= 0)
+    {
+        return;
+    }
+
+    LONG64 localMax = InterlockedAdd64(&g_detoursMaxAllocatedMemoryInBytes, 0);
+
+    // Update the global MaxAllocated heap only if the current allocated heap is bigger than what is recorded.
+    while (allocatedSize > localMax)
+    {
+        InterlockedCompareExchange64(&g_detoursMaxAllocatedMemoryInBytes, allocatedSize, localMax);
+        localMax = InterlockedAdd64(&g_detoursMaxAllocatedMemoryInBytes, 0);
+    }
+}
+
+// Allocates memory from the private heap, returning the size accounted for it in accountedSize
+static void* AllocateFromHeap(size_t size, LONG64& accountedSize)
+{
+    assert(g_hPrivateHeap != nullptr);
+    void* memory = HeapAlloc(g_hPrivateHeap, BUILDXL_DETOURS_MEMORY_ALLOC_FLAGS, size);
+
+    accountedSize = 0;
+    if (memory != nullptr && ShouldLogProcessData())
+    {
+        // Get the size since alignment matters and the actual allocated bytes can be a bit more than size.
+        accountedSize = (LONG64)HeapSize(g_hPrivateHeap, BUILDXL_DETOURS_MEMORY_ALLOC_FLAGS, memory);
+        AccountHeapMemory(accountedSize);
+    }
+
+    return memory;
+}
+
+static void FreeToHeap(void* memory, LONG64 accountedSize)
+{
+    assert(g_hPrivateHeap != nullptr);
+    if (accountedSize != 0)
+    {
+        AccountHeapMemory(-accountedSize);
+    }
+
+    HeapFree(g_hPrivateHeap, 0, memory);
+}
+
+static inline size_t GetSizeClass(size_t blockSize)
+{
+    for (size_t i = 0; i < s_sizeClassCount; i++)
+    {
+        if (blockSize <= s_sizeClasses[i])
+        {
+            return i;
+        }
+    }
+
+    return s_noSizeClass;
+}
+
+static DD_THREAD_CACHE* GetThreadCache()
+{
+    DD_THREAD_CACHE* cache = gt_ddThreadCache;
+    if (cache != nullptr)
+    {
+        return cache != DD_RELEASED_THREAD_CACHE ? cache : nullptr;
+    }
+
+    LONG64 accountedSize;
+    cache = static_cast<DD_THREAD_CACHE*>(AllocateFromHeap(sizeof(DD_THREAD_CACHE), accountedSize));
+    if (cache == nullptr)
+    {
+        return nullptr;
+    }
+
+    cache->AccountedSize = accountedSize;
+    gt_ddThreadCache = cache;
+    return cache;
+}
+
+static void LinkSlab(DD_SLAB*& head, DD_SLAB* slab)
+{
+    slab->Prev = nullptr;
+    slab->Next = head;
+    if (head != nullptr)
+    {
+        head->Prev = slab;
+    }
+
+    head = slab;
+}
+
+// Links a slab right after the current one, so it does not replace it
+static void LinkSlabAfterHead(DD_SLAB*& head, DD_SLAB* slab)
+{
+    if (head == nullptr)
+    {
+        LinkSlab(head, slab);
+        return;
+    }
+
+    slab->Prev = head;
+    slab->Next = head->Next;
+    if (head->Next != nullptr)
+    {
+        head->Next->Prev = slab;
+    }
+
+    head->Next = slab;
+}
+
+static void UnlinkSlab(DD_SLAB*& head, DD_SLAB* slab)
+{
+    if (slab->Prev != nullptr)
+    {
+        slab->Prev->Next = slab->Next;
+    }
+    else
+    {
+        head = slab->Next;
+    }
+
+    if (slab->Next != nullptr)
+    {
+        slab->Next->Prev = slab->Prev;
+    }
+
+    slab->Prev = nullptr;
+    slab->Next = nullptr;
+}
+
+// Moves the blocks other threads freed to the local free list. Only called by the owner of the slab.
+static void CollectRemoteFrees(DD_SLAB* slab)
+{
+    DD_FREE_BLOCK* block = static_cast<DD_FREE_BLOCK*>(InterlockedExchangePointer(reinterpret_cast<PVOID volatile*>(&slab->RemoteFree), nullptr));
+    while (block != nullptr)
+    {
+        DD_FREE_BLOCK* next = block->Next;
+        block->Next = slab->LocalFree;
+        slab->LocalFree = block;
+        slab->UsedBlocks--;
+        block = next;
+    }
+}
+
+// Allocates a block from a slab owned by the current thread, or returns null if the slab has none left
+static inline void* AllocateFromSlab(DD_SLAB* slab, size_t size)
+{
+    if (slab->LocalFree == nullptr && slab->Bump == slab->End && slab->RemoteFree != nullptr)
+    {
+        CollectRemoteFrees(slab);
+    }
+
+    if (slab->LocalFree != nullptr)
+    {
+        // Freed blocks are dirty: clear them like the private heap would
+        DD_FREE_BLOCK* block = slab->LocalFree;
+        slab->LocalFree = block->Next;
+        slab->UsedBlocks++;
+        memset(block, 0, size);
+        return block;
+    }
+
+    if (slab->Bump != slab->End)
+    {
+        // Memory never allocated from is still zeroed
+        DD_BLOCK_HEADER* header = reinterpret_cast<DD_BLOCK_HEADER*>(slab->Bump);
+        header->Slab = slab;
+        slab->Bump += slab->BlockSize;
+        slab->UsedBlocks++;
+        return header + 1;
+    }
+
+    return nullptr;
+}
+
+static DD_SLAB* CreateSlab(DD_THREAD_CACHE* cache, size_t sizeClass)
+{
+    LONG64 accountedSize;
+    DD_SLAB* slab = static_cast<DD_SLAB*>(AllocateFromHeap(s_slabSize, accountedSize));
+    if (slab == nullptr)
+    {
+        return nullptr;
+    }
+
+    const size_t blockSize = s_sizeClasses[sizeClass];
+    char* blocks = reinterpret_cast<char*>(slab + 1);
+
+    slab->Owner = cache;
+    slab->SizeClass = sizeClass;
+    slab->BlockSize = blockSize;
+    slab->AccountedSize = accountedSize;
+    slab->Bump = blocks;
+    slab->End = blocks + ((s_slabSize - sizeof(DD_SLAB)) / blockSize) * blockSize;
+    return slab;
+}
+
+// Takes an abandoned slab that has blocks left, moving the full ones found on the way to the full list of the thread
+static DD_SLAB* AdoptSlab(DD_THREAD_CACHE* cache, size_t sizeClass)
+{
+    DD_ABANDONED_SLABS& abandoned = s_abandonedSlabs[sizeClass];
+    DD_SIZE_CLASS_SLABS& slabs = cache->Classes[sizeClass];
+
+    while (true)
+    {
+        AcquireSRWLockExclusive(&abandoned.Lock);
+        DD_SLAB* slab = abandoned.Head;
+        if (slab != nullptr)
+        {
+            UnlinkSlab(abandoned.Head, slab);
+        }
+
+        ReleaseSRWLockExclusive(&abandoned.Lock);
+
+        if (slab == nullptr)
+        {
+            return nullptr;
+        }
+
+        InterlockedExchangePointer(reinterpret_cast<PVOID volatile*>(&slab->Owner), cache);
+        CollectRemoteFrees(slab);
+        if (slab->LocalFree != nullptr || slab->Bump != slab->End)
+        {
+            return slab;
+        }
+
+        slab->IsFull = true;
+        LinkSlab(slabs.Full, slab);
+    }
+}
+
+static void ReleaseSlab(DD_SLAB* slab)
+{
+    FreeToHeap(slab, slab->AccountedSize);
+}
+
+// Makes the current slab of a size class one that has blocks left, and allocates from it
+static void* AllocateFromNewSlab(DD_THREAD_CACHE* cache, size_t sizeClass, size_t size)
+{
+    DD_SIZE_CLASS_SLABS& slabs = cache->Classes[sizeClass];
+
+    // The current slab is exhausted
+    DD_SLAB* slab = slabs.Available;
+    if (slab != nullptr)
+    {
+        UnlinkSlab(slabs.Available, slab);
+        slab->IsFull = true;
+        LinkSlab(slabs.Full, slab);
+    }
+
+    // Other available slabs, then full slabs that got blocks back from other threads
+    slab = slabs.Available;
+    if (slab == nullptr)
+    {
+        for (DD_SLAB* full = slabs.Full; full != nullptr; full = full->Next)
+        {
+            if (full->RemoteFree != nullptr)
+            {
+                slab = full;
+                UnlinkSlab(slabs.Full, slab);
+                slab->IsFull = false;
+                LinkSlab(slabs.Available, slab);
+                break;
+            }
+        }
+    }
+
+    if (slab == nullptr)
+    {
+        slab = AdoptSlab(cache, sizeClass);
+        if (slab == nullptr)
+        {
+            slab = CreateSlab(cache, sizeClass);
+            if (slab == nullptr)
+            {
+                return nullptr;
+            }
+        }
+
+        slab->IsFull = false;
+        LinkSlab(slabs.Available, slab);
+    }
+
+    return AllocateFromSlab(slab, size);
+}
+
+static void* AllocateLargeBlock(size_t size)
+{
+    if (size > SIZE_MAX - sizeof(DD_BLOCK_HEADER))
+    {
+        return nullptr;
+    }
+
+    LONG64 accountedSize;
+    DD_BLOCK_HEADER* header = static_cast<DD_BLOCK_HEADER*>(AllocateFromHeap(size + sizeof(DD_BLOCK_HEADER), accountedSize));
+    if (header == nullptr)
+    {
+        return nullptr;
+    }
+
+    header->Slab = nullptr;
+    header->AccountedSize = accountedSize;
+    return header + 1;
+}
+
+void* dd_malloc(size_t size)
+{
+    assert(g_hPrivateHeap != nullptr);
+
+    const size_t sizeClass = size <= s_sizeClasses[s_sizeClassCount - 1] - sizeof(DD_BLOCK_HEADER)
+        ? GetSizeClass(size + sizeof(DD_BLOCK_HEADER))
+        : s_noSizeClass;
+
+    DD_THREAD_CACHE* cache = sizeClass != s_noSizeClass ? GetThreadCache() : nullptr;
+    if (cache == nullptr)
+    {
+        return AllocateLargeBlock(size);
+    }
+
+    DD_SLAB* slab = cache->Classes[sizeClass].Available;
+    void* block = slab != nullptr ? AllocateFromSlab(slab, size) : nullptr;
+    return block != nullptr ? block : AllocateFromNewSlab(cache, sizeClass, size);
+}
+
+void dd_free(void* pMem)
+{
+    assert(g_hPrivateHeap != nullptr);
+    if (pMem == nullptr)
+    {
+        return;
+    }
+
+    DD_BLOCK_HEADER* header = static_cast<DD_BLOCK_HEADER*>(pMem) - 1;
+    DD_SLAB* slab = header->Slab;
+    if (slab == nullptr)
+    {
+        FreeToHeap(header, header->AccountedSize);
+        return;
+    }
+
+    DD_FREE_BLOCK* block = static_cast<DD_FREE_BLOCK*>(pMem);
+    DD_THREAD_CACHE* cache = gt_ddThreadCache;
+    if (slab->Owner != cache || cache == nullptr)
+    {
+        // The block belongs to another thread. Only its owner takes blocks off the remote free list, all at once, so
+        // pushing one cannot run into ABA.
+        DD_FREE_BLOCK* head;
+        do
+        {
+            head = slab->RemoteFree;
+            block->Next = head;
+        } while (InterlockedCompareExchangePointer(reinterpret_cast<PVOID volatile*>(&slab->RemoteFree), block, head) != head);
+
+        return;
+    }
+
+    block->Next = slab->LocalFree;
+    slab->LocalFree = block;
+    slab->UsedBlocks--;
+
+    DD_SIZE_CLASS_SLABS& slabs = cache->Classes[slab->SizeClass];
+    if (slab->IsFull)
+    {
+        UnlinkSlab(slabs.Full, slab);
+        slab->IsFull = false;
+        LinkSlabAfterHead(slabs.Available, slab);
+    }
+    else if (slab->UsedBlocks == 0 && slabs.Available != slab)
+    {
+        // Keep the current slab even when it gets empty, so a thread allocating and freeing a single block does not
+        // create and release a slab every time
+        UnlinkSlab(slabs.Available, slab);
+        ReleaseSlab(slab);
+    }
+}
+
+// Releases the empty slabs of a list of an exiting thread and abandons the others
+static void AbandonSlabs(DD_SLAB*& list, DD_ABANDONED_SLABS& abandoned)
+{
+    while (list != nullptr)
+    {
+        DD_SLAB* slab = list;
+        UnlinkSlab(list, slab);
+        CollectRemoteFrees(slab);
+
+        if (slab->UsedBlocks == 0)
+        {
+            ReleaseSlab(slab);
+            continue;
+        }
+
+        // Blocks freed from now on, including by this thread, go to the remote free list until the slab is adopted
+        InterlockedExchangePointer(reinterpret_cast<PVOID volatile*>(&slab->Owner), nullptr);
+
+        AcquireSRWLockExclusive(&abandoned.Lock);
+        LinkSlab(abandoned.Head, slab);
+        ReleaseSRWLockExclusive(&abandoned.Lock);
+    }
+}
+
+void dd_release_thread_cache()
+{
+    DD_THREAD_CACHE* cache = gt_ddThreadCache;
+    if (cache == nullptr || cache == DD_RELEASED_THREAD_CACHE)
+    {
+        return;
+    }
+
+    gt_ddThreadCache = DD_RELEASED_THREAD_CACHE;
+
+    for (size_t sizeClass = 0; sizeClass < s_sizeClassCount; sizeClass++)
+    {
+        AbandonSlabs(cache->Classes[sizeClass].Available, s_abandonedSlabs[sizeClass]);
+        AbandonSlabs(cache->Classes[sizeClass].Full, s_abandonedSlabs[sizeClass]);
+    }
+
+    FreeToHeap(cache, cache->AccountedSize);
+}
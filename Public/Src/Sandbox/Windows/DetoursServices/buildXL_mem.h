@@ -15,46 +15,15 @@ extern volatile LONG64 g_detoursHeapAllocatedMemoryInBytes;
 // The memory allocation done from the BuildXL Detours library happens on a private heap.
 
 // malloc and free versions for this DLL.
-inline void* dd_malloc(size_t size)
-{
-    assert(g_hPrivateHeap != nullptr);
-    void* ret = HeapAlloc(g_hPrivateHeap, BUILDXL_DETOURS_MEMORY_ALLOC_FLAGS, size);
-
-     if (ret != nullptr && ShouldLogProcessData())
-     {
-         // Get the size since alignment matters and the actual allocated bytes can be a bit moe than size.
-         LONG64 allocatedSize = (LONG64)HeapSize(g_hPrivateHeap, BUILDXL_DETOURS_MEMORY_ALLOC_FLAGS, ret);
-         allocatedSize = InterlockedAdd64(&g_detoursHeapAllocatedMemoryInBytes, allocatedSize);
-         LONG64 localMax = InterlockedAdd64(&g_detoursMaxAllocatedMemoryInBytes, 0);
-       
-         // Update the global MaxAllocated heap only if the current allocated heap is bigger than what is recorded.
-         while (allocatedSize > localMax)
-         {
-             InterlockedCompareExchange64(&g_detoursMaxAllocatedMemoryInBytes, allocatedSize, localMax);
-             localMax = InterlockedAdd64(&g_detoursMaxAllocatedMemoryInBytes, 0);
-         }
-     }
-
-    return ret;
-}
+// Small allocations come from thread-local slabs carved from the private heap (see buildXL_mem.cpp), bigger ones straight
+// from the private heap. Memory is zeroed, and can be freed from any thread.
+void* dd_malloc(size_t size);
 
-inline void dd_free(void* pMem)
-{
-    assert(g_hPrivateHeap != nullptr);
-    if (pMem == nullptr)
-    {
-        return;
-    }
-
-     if (ShouldLogProcessData())
-     {
-         // Get the size since alignment matters and the actual allocated bytes can be a bit moe than size.
-         LONG64 deallocatedSize = (LONG64)HeapSize(g_hPrivateHeap, BUILDXL_DETOURS_MEMORY_ALLOC_FLAGS, pMem);
-         InterlockedAdd64(&g_detoursHeapAllocatedMemoryInBytes, -(deallocatedSize));
-     }
+void dd_free(void* pMem);
 
-    HeapFree(g_hPrivateHeap, HEAP_ZERO_MEMORY, pMem);
-}
+// Returns the slabs of the current thread to the private heap, or hands them over to other threads if they still have
+// blocks in use. Called when the thread exits.
+void dd_release_thread_cache();
 
 // New news and deletes operators that call the private heap.
 inline void* operator new(size_t count)
@@ -47,6 +47,8 @@ extern PCManifestRecord g_manifestTreeRoot;
 
 extern PManifestChildProcessesToBreakAwayFromJob g_manifestChildProcessesToBreakAwayFromJob;
 extern vector<BreakawayChildProcess>* g_breakawayChildProcesses;
+// Number of breakaway child processes, known before g_breakawayChildProcesses is decoded (see GetBreakawayChildProcesses)
+extern uint32_t g_breakawayChildProcessCount;
 extern PManifestTranslatePathsStrings g_manifestTranslatePathsStrings;
 extern vector<TranslatePathTuple*>* g_pManifestTranslatePathTuples;
 extern std::unordered_set<std::wstring>* g_pManifestTranslatePathLookupTable;
@@ -56,6 +58,9 @@ extern LPCTSTR g_internalDetoursErrorNotificationFile;
 
 extern HANDLE g_messageCountSemaphore;
 
+// Shared counter of the messages sent, incremented instead of releasing g_messageCountSemaphore when the page is available
+extern volatile LONG64* g_messageCounter;
+
 extern HANDLE g_reportFileHandle;
 
 extern unsigned long g_injectionTimeoutInMinutes;
@@ -176,6 +181,8 @@ extern CreateDirectoryExW_t Real_CreateDirectoryExW;
 extern CreateDirectoryExA_t Real_CreateDirectoryExA;
 extern RemoveDirectoryW_t Real_RemoveDirectoryW;
 extern RemoveDirectoryA_t Real_RemoveDirectoryA;
+extern SetCurrentDirectoryW_t Real_SetCurrentDirectoryW;
+extern SetCurrentDirectoryA_t Real_SetCurrentDirectoryA;
 extern DecryptFileW_t Real_DecryptFileW;
 extern DecryptFileA_t Real_DecryptFileA;
 extern EncryptFileW_t Real_EncryptFileW;
@@ -199,16 +206,14 @@ extern CreatePipe_t Real_CreatePipe;
 extern DeviceIoControl_t Real_DeviceIoControl;
 
 #if MEASURE_DETOURED_NT_CLOSE_IMPACT
-extern volatile LONG g_msTimeToPopulatePoolList;
 extern volatile ULONGLONG g_pipExecutionStart;
 extern volatile LONG g_ntCloseHandeCount;
-extern volatile LONG g_maxClosedListCount;
-extern volatile LONG g_msTimeInAddClosedList;
-extern volatile LONG g_msTimeInRemoveClosedList;
 #endif // MEASURE_DETOURED_NT_CLOSE_IMPACT
 
 #if MEASURE_REPARSEPOINT_RESOLVING_IMPACT
 extern volatile ULONGLONG g_shouldResolveReparsePointCacheHitCount;
+extern volatile ULONGLONG g_shouldResolveReparsePointCacheMissCount;
+extern volatile ULONGLONG g_shouldResolveReparsePointCacheDroppedInsertCount;
 extern volatile ULONGLONG g_reparsePointTargetCacheHitCount;
 extern volatile ULONGLONG g_resolvedPathsCacheHitCout;
 #endif // MEASURE_REPARSEPOINT_RESOLVING_IMPACT
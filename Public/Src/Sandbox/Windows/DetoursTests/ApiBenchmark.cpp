@@ -0,0 +1,161 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// ApiBenchmark.cpp : Measures the throughput of detoured APIs.
+//
+// Each API is called in a tight loop and a line per API is written to the standard output:
+//   ApiBenchmark,<api>,<iterations>,<calls per second>,<ns per call>
+// Running the command with and without Detours (or with different manifests) gives the overhead of the sandbox per call.
+// The timings are informational: the test only fails if a call fails.
+
+#include "stdafx.h"
+
+#include <windows.h>
+#include <stdio.h>
+#include <string>
+
+#include "ApiBenchmark.h"
+
+// warning C26485: Expression 'modulePath': No array to pointer decay (bounds.3).
+// warning C26490: Don't use reinterpret_cast (type.1).
+#pragma warning( disable : 26485 26490 )
+
+#define STATUS_NO_MORE_FILES ((NTSTATUS)0x80000006L)
+
+typedef NTSTATUS(NTAPI *NtQueryDirectoryFile_t)(
+    HANDLE FileHandle,
+    HANDLE Event,
+    PIO_APC_ROUTINE ApcRoutine,
+    PVOID ApcContext,
+    PIO_STATUS_BLOCK IoStatusBlock,
+    PVOID FileInformation,
+    ULONG Length,
+    FILE_INFORMATION_CLASS FileInformationClass,
+    BOOLEAN ReturnSingleEntry,
+    PUNICODE_STRING FileName,
+    BOOLEAN RestartScan);
+
+static const int s_apiBenchmarkIterations = 10000;
+static const int s_apiBenchmarkCopyIterations = 1000;
+static const int s_apiBenchmarkProcessIterations = 20;
+
+// Calls the given API repeatedly and writes its throughput to the standard output. Returns whether all the calls succeeded.
+template <typename TCall>
+static bool RunApiBenchmark(wchar_t const* api, int iterations, TCall call) {
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER start;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&start);
+
+    for (int i = 0; i < iterations; i++) {
+        if (!call()) {
+            wprintf(L"%s failed (error %08lx)\n", api, GetLastError());
+            return false;
+        }
+    }
+
+    LARGE_INTEGER end;
+    QueryPerformanceCounter(&end);
+
+    const double elapsedNs = (double)(end.QuadPart - start.QuadPart) * 1000000000.0 / (double)frequency.QuadPart;
+    const double nsPerCall = elapsedNs / iterations;
+    wprintf(L"ApiBenchmark,%s,%d,%.0f,%.1f\n", api, iterations, nsPerCall > 0 ? 1000000000.0 / nsPerCall : 0.0, nsPerCall);
+    return true;
+}
+
+static bool OpenAndCloseFile(wchar_t const* path) {
+    HANDLE handle = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (handle == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    CloseHandle(handle);
+    return true;
+}
+
+static bool EnumerateWithFindFirstFileEx(wchar_t const* pattern) {
+    WIN32_FIND_DATAW findData{};
+    HANDLE findHandle = FindFirstFileExW(pattern, FindExInfoBasic, &findData, FindExSearchNameMatch, NULL, 0);
+    if (findHandle == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    while (FindNextFileW(findHandle, &findData)) {}
+
+    const DWORD error = GetLastError();
+    FindClose(findHandle);
+    SetLastError(error);
+    return error == ERROR_NO_MORE_FILES;
+}
+
+static bool EnumerateWithNtQueryDirectoryFile(NtQueryDirectoryFile_t queryDirectoryFile, HANDLE directory, void* buffer, ULONG bufferSize) {
+    for (BOOLEAN restartScan = TRUE; ; restartScan = FALSE) {
+        IO_STATUS_BLOCK iosb{};
+        const NTSTATUS status = queryDirectoryFile(directory, NULL, NULL, NULL, &iosb, buffer, bufferSize, FileDirectoryInformation, FALSE, NULL, restartScan);
+        if (!NT_SUCCESS(status)) {
+            return status == STATUS_NO_MORE_FILES;
+        }
+    }
+}
+
+static bool StartNoopProcess(wchar_t const* modulePath) {
+    // CreateProcessW may modify the command line, so it must be writable
+    std::wstring commandLine = std::wstring(L"\"") + modulePath + L"\" ProcessStartupNoop";
+
+    STARTUPINFOW si;
+    ZeroMemory(&si, sizeof(STARTUPINFOW));
+    si.cb = sizeof(STARTUPINFOW);
+
+    PROCESS_INFORMATION pi;
+    ZeroMemory(&pi, sizeof(PROCESS_INFORMATION));
+
+    if (!CreateProcessW(modulePath, &commandLine[0], NULL, NULL, FALSE, 0, NULL, NULL, &si, &pi)) {
+        return false;
+    }
+
+    WaitForSingleObject(pi.hProcess, INFINITE);
+
+    DWORD exitCode = ERROR_SUCCESS;
+    GetExitCodeProcess(pi.hProcess, &exitCode);
+    CloseHandle(pi.hThread);
+    CloseHandle(pi.hProcess);
+    return exitCode == ERROR_SUCCESS;
+}
+
+// Expects the file 'input' in the working directory, and writes the file 'ApiBenchmarkCopy' next to it.
+int ApiBenchmark() {
+    wchar_t const * const InputFile = L"input";
+    wchar_t const * const CopyDestination = L"ApiBenchmarkCopy";
+
+    wchar_t modulePath[MAX_PATH];
+    DWORD modulePathLength = GetModuleFileNameW(NULL, modulePath, MAX_PATH);
+    if (modulePathLength == 0 || modulePathLength == MAX_PATH) {
+        return (int)GetLastError();
+    }
+
+    NtQueryDirectoryFile_t queryDirectoryFile = reinterpret_cast<NtQueryDirectoryFile_t>(GetProcAddress(GetModuleHandleW(L"ntdll.dll"), "NtQueryDirectoryFile"));
+    if (queryDirectoryFile == nullptr) {
+        return (int)GetLastError();
+    }
+
+    HANDLE directory = CreateFileW(L".", FILE_LIST_DIRECTORY | SYNCHRONIZE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+    if (directory == INVALID_HANDLE_VALUE) {
+        return (int)GetLastError();
+    }
+
+    const ULONG BufferSize = 4096;
+    void* buffer = _aligned_malloc(BufferSize, 8);
+
+    const bool succeeded =
+        RunApiBenchmark(L"CreateFileW", s_apiBenchmarkIterations, [&]() { return OpenAndCloseFile(InputFile); }) &&
+        RunApiBenchmark(L"GetFileAttributesW", s_apiBenchmarkIterations, [&]() { return GetFileAttributesW(InputFile) != INVALID_FILE_ATTRIBUTES; }) &&
+        RunApiBenchmark(L"FindFirstFileExW", s_apiBenchmarkIterations, [&]() { return EnumerateWithFindFirstFileEx(L"*"); }) &&
+        RunApiBenchmark(L"NtQueryDirectoryFile", s_apiBenchmarkIterations, [&]() { return EnumerateWithNtQueryDirectoryFile(queryDirectoryFile, directory, buffer, BufferSize); }) &&
+        RunApiBenchmark(L"CopyFileExW", s_apiBenchmarkCopyIterations, [&]() { return CopyFileExW(InputFile, CopyDestination, NULL, NULL, NULL, 0) != FALSE; }) &&
+        RunApiBenchmark(L"CreateProcessW", s_apiBenchmarkProcessIterations, [&]() { return StartNoopProcess(modulePath); });
+
+    _aligned_free(buffer);
+    CloseHandle(directory);
+
+    return succeeded ? ERROR_SUCCESS : 1;
+}
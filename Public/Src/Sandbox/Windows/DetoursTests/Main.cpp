@@ -9,6 +9,7 @@
 
 using namespace std;
 
+#include "ApiBenchmark.h"
 #include "Logging.h"
 #include "ReadExclusive.h"
 #include "ShortNames.h"
@@ -17,6 +18,7 @@ using namespace std;
 #include "Tests.h"
 #include "Timestamps.h"
 #include "CorrelationCalls.h"
+#include "ProcessStartup.h"
 #include "Utils.h"
 
 // ----------------------------------------------------------------------------
@@ -1444,7 +1446,11 @@ int main(int argc, char **argv)
     IF_COMMAND(ReadExclusive);
     IF_COMMAND(TimestampsNoNormalize);
     IF_COMMAND(TimestampsNormalize);
+    IF_COMMAND(TimestampsBenchmark);
     IF_COMMAND(ShortNames);
+    IF_COMMAND(ProcessStartupNoop);
+    IF_COMMAND(CallProcessStartupTest);
+    IF_COMMAND(ApiBenchmark);
 
     LoggingTests(verb);
     SymlinkTests(verb);
@@ -386,3 +386,65 @@ int TimestampsNoNormalize(void)
 {
     return Timestamps(false);
 }
+
+static const int s_timestampsBenchmarkIterations = 10000;
+
+// Runs the given metadata query repeatedly and writes the time per call to the standard output. Returns whether all the calls succeeded.
+template <typename TQuery>
+static bool RunTimestampsBenchmark(wchar_t const* name, TQuery query) {
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER start;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&start);
+
+    for (int i = 0; i < s_timestampsBenchmarkIterations; i++) {
+        if (!query()) {
+            wprintf(L"%s failed (error %08lx)\n", name, GetLastError());
+            return false;
+        }
+    }
+
+    LARGE_INTEGER end;
+    QueryPerformanceCounter(&end);
+
+    const double elapsedNs = (double)(end.QuadPart - start.QuadPart) * 1000000000.0 / (double)frequency.QuadPart;
+    wprintf(L"TimestampsBenchmark: %s, %.1f ns per call\n", name, elapsedNs / s_timestampsBenchmarkIterations);
+    return true;
+}
+
+// Times the metadata queries whose timestamps are faked for an input file (expects the file 'input').
+// The timings are informational: the test only fails if a query fails or doesn't see the faked timestamps.
+int TimestampsBenchmark(void)
+{
+    wchar_t const * const InputFile = L"input";
+
+    HANDLE handle = CreateFileW(InputFile, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, INVALID_HANDLE_VALUE);
+    if (handle == INVALID_HANDLE_VALUE) {
+        wprintf(L"CreateFileW failed for %s (error %08lx)\n", InputFile, GetLastError());
+        return 1;
+    }
+
+    BY_HANDLE_FILE_INFORMATION byHandleInfo{};
+    FILE_BASIC_INFO basicInfo{};
+    WIN32_FILE_ATTRIBUTE_DATA attributeData{};
+
+    const bool succeeded =
+        RunTimestampsBenchmark(L"GetFileInformationByHandle", [&]() { return GetFileInformationByHandle(handle, &byHandleInfo) != FALSE; }) &&
+        RunTimestampsBenchmark(L"GetFileInformationByHandleEx", [&]() { return GetFileInformationByHandleEx(handle, FileBasicInfo, &basicInfo, sizeof(basicInfo)) != FALSE; }) &&
+        RunTimestampsBenchmark(L"GetFileAttributesEx", [&]() { return GetFileAttributesExW(InputFile, GET_FILEEX_INFO_LEVELS::GetFileExInfoStandard, &attributeData) != FALSE; });
+
+    CloseHandle(handle);
+
+    if (!succeeded) {
+        return 1;
+    }
+
+    // The queries must still see the faked timestamps (the test runs with NormalizeReadTimestamps)
+    const FILETIME expectedInputTime = GetExpectedInputTime();
+    VerificationResult result;
+    result.Combine(VerifyTimestamp(expectedInputTime, byHandleInfo.ftLastWriteTime, L"GetFileInformationByHandle() -> ftLastWriteTime", InputFile, false));
+    result.Combine(VerifyTimestamp(expectedInputTime, basicInfo.LastWriteTime, L"GetFileInformationByHandleEx() -> LastWriteTime", InputFile, false));
+    result.Combine(VerifyTimestamp(expectedInputTime, attributeData.ftLastWriteTime, L"GetFileAttributesEx() -> ftLastWriteTime", InputFile, false));
+
+    return result.Succeeded ? 0 : 2;
+}
@@ -5,3 +5,4 @@
 
 int TimestampsNoNormalize();
 int TimestampsNormalize();
+int TimestampsBenchmark();
@@ -14,6 +14,8 @@
 //   LINK : fatal error LNK1104: cannot open file 'libboost_unit_test_framework-vc141-mt-gd-x64-1_71.lib'
 // The below includes basically make all the separated test suites into a single translation unit.
 #include "PathTreeTests.h"
+#include "PathTreeBenchmarks.h"
 #include "StringOperationsTests.h"
+#include "StringOperationsBenchmarks.h"
 #include "ResolvedPathCacheTests.h"
 #include "TreeNodeTests.h"
\ No newline at end of file
@@ -0,0 +1,105 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <PathTree.h>
+
+// Times the PathTree operations ResolvedPathCache does for every resolved path and every invalidation.
+// These are not checks: the timings are written to the test log (run with --log_level=message to see them).
+BOOST_AUTO_TEST_SUITE(PathTreeBenchmarks)
+
+static const size_t s_pathTreeBenchmarkRounds = 20;
+
+// Paths shaped like the ones of a build: a few deep shared prefixes, a wide directory and many repeated atoms
+static std::vector<std::wstring> CreateBenchmarkPaths()
+{
+    std::vector<std::wstring> paths;
+    for (int project = 0; project < 20; project++)
+    {
+        for (int file = 0; file < 200; file++)
+        {
+            paths.push_back(L"C:\\src\\BuildXL\\Out\\Objects\\project" + std::to_wstring(project) + L"\\obj\\debug\\file" + std::to_wstring(file) + L".cs");
+        }
+    }
+
+    return paths;
+}
+
+template <typename TAction>
+static void RunPathTreeBenchmark(const char* name, size_t operationsPerRound, TAction action)
+{
+    size_t checksum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < s_pathTreeBenchmarkRounds; i++)
+    {
+        checksum += action();
+    }
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    BOOST_TEST_MESSAGE(name << ": " << (double)elapsed / (s_pathTreeBenchmarkRounds * operationsPerRound) << " ns/op (checksum " << checksum << ")");
+}
+
+BOOST_AUTO_TEST_CASE(BenchmarkTryInsert)
+{
+    const std::vector<std::wstring> paths = CreateBenchmarkPaths();
+    RunPathTreeBenchmark("TryInsert", paths.size(), [&paths]()
+    {
+        PathTree t;
+        size_t inserted = 0;
+        for (const std::wstring& path : paths)
+        {
+            inserted += t.TryInsert(path) ? 1 : 0;
+        }
+
+        return inserted;
+    });
+}
+
+BOOST_AUTO_TEST_CASE(BenchmarkRetrieveAndRemoveAllDescendants)
+{
+    const std::vector<std::wstring> paths = CreateBenchmarkPaths();
+    RunPathTreeBenchmark("TryInsert + RetrieveAndRemoveAllDescendants", paths.size(), [&paths]()
+    {
+        PathTree t;
+        for (const std::wstring& path : paths)
+        {
+            t.TryInsert(path);
+        }
+
+        // One invalidation per project, then one for the whole tree, which finds nothing left
+        std::vector<std::wstring> descendants;
+        for (int project = 0; project < 20; project++)
+        {
+            t.RetrieveAndRemoveAllDescendants(L"C:\\src\\BuildXL\\Out\\Objects\\project" + std::to_wstring(project), descendants);
+        }
+
+        t.RetrieveAndRemoveAllDescendants(L"C:\\src", descendants);
+        return descendants.size();
+    });
+}
+
+BOOST_AUTO_TEST_CASE(BenchmarkFailedLookups)
+{
+    const std::vector<std::wstring> paths = CreateBenchmarkPaths();
+    PathTree t;
+    for (const std::wstring& path : paths)
+    {
+        t.TryInsert(path);
+    }
+
+    // Invalidating paths that are not in the tree is the common case: it walks the tree without removing anything
+    RunPathTreeBenchmark("RetrieveAndRemoveAllDescendants (not found)", paths.size(), [&paths, &t]()
+    {
+        std::vector<std::wstring> descendants;
+        for (const std::wstring& path : paths)
+        {
+            t.RetrieveAndRemoveAllDescendants(path + L".missing", descendants);
+        }
+
+        return descendants.size();
+    });
+}
+
+BOOST_AUTO_TEST_SUITE_END()
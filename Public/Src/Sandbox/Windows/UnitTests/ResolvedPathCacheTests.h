@@ -34,4 +34,86 @@ BOOST_AUTO_TEST_CASE( TryInsertPath )
     BOOST_CHECK(!findResult.Found);
 }
 
+BOOST_AUTO_TEST_CASE( InvalidateDirectoryDescendants )
+{
+    ResolvedPathCache cache;
+
+    BOOST_CHECK(cache.InsertResolvingCheckResult(L"C:\\a\\path\\to\\file.txt", true));
+    BOOST_CHECK(cache.InsertResolvingCheckResult(L"C:\\b\\path", false));
+
+    // Lookups are case insensitive and ignore trailing slashes
+    auto findResult = cache.GetResolvingCheckResult(L"c:\\A\\path\\to\\file.txt\\");
+    BOOST_CHECK(findResult.Found);
+    BOOST_CHECK(findResult.Value);
+
+    cache.Invalidate(L"C:\\A\\path", true);
+    BOOST_CHECK(!cache.GetResolvingCheckResult(L"C:\\a\\path\\to\\file.txt").Found);
+    BOOST_CHECK(cache.GetResolvingCheckResult(L"C:\\b\\path").Found);
+}
+
+BOOST_AUTO_TEST_CASE( InvalidateRootDescendants )
+{
+    ResolvedPathCache cache;
+
+    // Descendants of a root are spread across shards
+    std::wstring target = L"D:\\target";
+    BOOST_CHECK(cache.InsertResolvingCheckResult(L"C:\\a\\path", true));
+    BOOST_CHECK(cache.InsertResolvingCheckResult(L"C:\\b\\path", true));
+    BOOST_CHECK(cache.InsertResolvedPathWithType(L"C:\\c", target, IO_REPARSE_TAG_SYMLINK));
+    BOOST_CHECK(cache.InsertResolvingCheckResult(L"D:\\a\\path", true));
+
+    cache.Invalidate(L"C:\\", true);
+    BOOST_CHECK(!cache.GetResolvingCheckResult(L"C:\\a\\path").Found);
+    BOOST_CHECK(!cache.GetResolvingCheckResult(L"C:\\b\\path").Found);
+    BOOST_CHECK(!cache.GetResolvedPathAndType(L"C:\\c").Found);
+    BOOST_CHECK(cache.GetResolvingCheckResult(L"D:\\a\\path").Found);
+}
+
+BOOST_AUTO_TEST_CASE( EvictLeastRecentlyUsedEntries )
+{
+    ResolvedPathCache cache(16 * 1024);
+
+    BOOST_CHECK(cache.InsertResolvingCheckResult(L"C:\\keep\\file", true));
+    for (int i = 0; i < 200; i++)
+    {
+        BOOST_CHECK(cache.InsertResolvingCheckResult(L"C:\\evict\\file" + std::to_wstring(i), true));
+        BOOST_CHECK(cache.GetResolvingCheckResult(L"C:\\keep\\file").Found);
+    }
+
+    // The entry looked up all along is the most recently used one
+    BOOST_CHECK(cache.GetEvictedEntriesCount() > 0);
+    BOOST_CHECK(cache.GetResolvingCheckResult(L"C:\\keep\\file").Found);
+    BOOST_CHECK(!cache.GetResolvingCheckResult(L"C:\\evict\\file0").Found);
+    BOOST_CHECK(cache.GetResolvingCheckResult(L"C:\\evict\\file199").Found);
+
+    // Evicting rebuilds the path trees, which still know about the entries left
+    cache.Invalidate(L"C:\\evict", true);
+    BOOST_CHECK(!cache.GetResolvingCheckResult(L"C:\\evict\\file199").Found);
+    BOOST_CHECK(cache.GetResolvingCheckResult(L"C:\\keep\\file").Found);
+}
+
+BOOST_AUTO_TEST_CASE( EvictLeastRecentlyUsedResolvedPaths )
+{
+    ResolvedPathCache cache(16 * 1024);
+
+    for (int i = 0; i < 100; i++)
+    {
+        std::wstring target = L"C:\\b\\target" + std::to_wstring(i);
+        std::shared_ptr<std::vector<std::wstring>> order = std::make_shared<std::vector<std::wstring>>();
+        std::shared_ptr<std::map<std::wstring, ResolvedPathType, CaseInsensitiveStringLessThan>> resolvedPaths = std::make_shared<std::map<std::wstring, ResolvedPathType, CaseInsensitiveStringLessThan>>();
+        order->push_back(target);
+        resolvedPaths->emplace(target, ResolvedPathType::FullyResolved);
+
+        BOOST_CHECK(cache.InsertResolvedPaths(L"C:\\a\\link" + std::to_wstring(i), true, order, resolvedPaths));
+    }
+
+    BOOST_CHECK(cache.GetEvictedResolvedPathsCount() > 0);
+    BOOST_CHECK(!cache.GetResolvedPaths(L"C:\\a\\link0", true).Found);
+    BOOST_CHECK(cache.GetResolvedPaths(L"C:\\a\\link99", true).Found);
+
+    // The back references of the entries left still work
+    cache.Invalidate(L"C:\\b\\target99", false);
+    BOOST_CHECK(!cache.GetResolvedPaths(L"C:\\a\\link99", true).Found);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
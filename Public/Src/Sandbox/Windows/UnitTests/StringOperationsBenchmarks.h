@@ -0,0 +1,74 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <StringOperations.h>
+
+// Times the path hashing and comparison done for every path component of every policy lookup (see ManifestRecord::FindChild).
+// These are not checks: the timings are written to the test log (run with --log_level=message to see them).
+BOOST_AUTO_TEST_SUITE(StringOperationsBenchmarks)
+
+static const size_t s_benchmarkIterations = 200000;
+
+// Path components as they typically show up in a build: short, mostly ASCII, some with mixed case
+static const std::vector<std::wstring> s_benchmarkComponents = {
+    L"C:",
+    L"src",
+    L"BuildXL",
+    L"Out",
+    L"Objects",
+    L"Microsoft.NET.Sdk.targets",
+    L"System.Runtime.CompilerServices.Unsafe.dll",
+    L"caf\u00e9",
+    L"VeryLongDirectoryNameThatGoesOnAndOnForSeveralVectors",
+};
+
+template <typename TAction>
+static void RunBenchmark(const char* name, TAction action)
+{
+    size_t checksum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < s_benchmarkIterations; i++)
+    {
+        checksum += action(s_benchmarkComponents[i % s_benchmarkComponents.size()]);
+    }
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    BOOST_TEST_MESSAGE(name << ": " << (double)elapsed / s_benchmarkIterations << " ns/op (checksum " << checksum << ")");
+}
+
+BOOST_AUTO_TEST_CASE(BenchmarkHashPath)
+{
+    RunBenchmark("HashPath", [](const std::wstring& component) { return (size_t)HashPath(component.c_str(), component.length()); });
+}
+
+BOOST_AUTO_TEST_CASE(BenchmarkNormalizeAndHashPath)
+{
+    std::vector<wchar_t> buffer;
+    RunBenchmark("NormalizeAndHashPath", [&buffer](const std::wstring& component)
+    {
+        buffer.resize(component.length() + 1);
+        return (size_t)NormalizeAndHashPath(component.c_str(), (PBYTE)buffer.data(), (DWORD)(buffer.size() * sizeof(wchar_t)));
+    });
+}
+
+BOOST_AUTO_TEST_CASE(BenchmarkArePathsEqual)
+{
+    std::vector<std::vector<wchar_t>> normalizedComponents;
+    for (const std::wstring& component : s_benchmarkComponents)
+    {
+        std::vector<wchar_t> normalized(component.length() + 1);
+        NormalizeAndHashPath(component.c_str(), (PBYTE)normalized.data(), (DWORD)(normalized.size() * sizeof(wchar_t)));
+        normalizedComponents.push_back(normalized);
+    }
+
+    size_t index = 0;
+    RunBenchmark("ArePathsEqual", [&normalizedComponents, &index](const std::wstring& component)
+    {
+        return (size_t)ArePathsEqual(component.c_str(), normalizedComponents[index++ % normalizedComponents.size()].data(), component.length());
+    });
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -1,6 +1,8 @@
 // Copyright (c) Microsoft. All rights reserved.
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
+#include <algorithm>
+#include <vector>
 #include <StringOperations.h>
 
 BOOST_AUTO_TEST_SUITE(StringOperationsTests)
@@ -161,4 +163,67 @@ BOOST_AUTO_TEST_CASE(NormalizeLongUncPathWithUncPrefixDottedSegment)
     BOOST_CHECK_EQUAL(expected.c_str(), result.c_str());
 }
 
+// Paths long enough to go through the vectorized normalization, with non-ASCII characters in some of the vectors
+static const std::wstring s_pathsToHash[] = {
+    L"",
+    L"c:\\",
+    L"C:\\Windows\\System32\\kernel32.dll",
+    L"c:\\src\\BuildXL\\Public\\Src\\Sandbox\\Windows\\DetoursServices\\StringOperations.cpp",
+    L"c:\\src\\caf\u00e9\\na\u00efve\\\u00c5ngstr\u00f6m\\out.obj",
+    L"D:\\[x]\\{y}\\`z`\\@a^b_c\\0123456789",
+};
+
+BOOST_AUTO_TEST_CASE(HashPathIgnoresCase)
+{
+    for (const std::wstring& path : s_pathsToHash)
+    {
+        std::wstring upper(path);
+        std::transform(upper.begin(), upper.end(), upper.begin(), towupper);
+        BOOST_CHECK_EQUAL(HashPath(path.c_str(), path.length()), HashPath(upper.c_str(), upper.length()));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(NormalizeAndHashPathMatchesHashPath)
+{
+    for (const std::wstring& path : s_pathsToHash)
+    {
+        std::vector<wchar_t> normalized(path.length() + 1);
+        DWORD hash = NormalizeAndHashPath(path.c_str(), (PBYTE)normalized.data(), (DWORD)(normalized.size() * sizeof(wchar_t)));
+        BOOST_CHECK_EQUAL(HashPath(path.c_str(), path.length()), hash);
+
+        for (size_t i = 0; i < path.length(); i++)
+        {
+            BOOST_CHECK_EQUAL(towupper(path[i]), normalized[i]);
+        }
+
+        BOOST_CHECK_EQUAL(L'\0', normalized[path.length()]);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(ArePathsEqualComparesNormalizedPaths)
+{
+    for (const std::wstring& path : s_pathsToHash)
+    {
+        std::vector<wchar_t> normalized(path.length() + 1);
+        NormalizeAndHashPath(path.c_str(), (PBYTE)normalized.data(), (DWORD)(normalized.size() * sizeof(wchar_t)));
+        BOOST_CHECK(ArePathsEqual(path.c_str(), normalized.data(), path.length()));
+
+        // A difference in any position is found, whether it falls in a vector or in the remainder
+        for (size_t i = 0; i < path.length(); i++)
+        {
+            std::vector<wchar_t> different(normalized);
+            different[i] = different[i] == L'X' ? L'Y' : L'X';
+            BOOST_CHECK(!ArePathsEqual(path.c_str(), different.data(), path.length()));
+        }
+
+        // A normalized path that is a proper prefix is not equal
+        if (!path.empty())
+        {
+            std::vector<wchar_t> prefix(normalized.begin(), normalized.end() - 2);
+            prefix.push_back(L'\0');
+            BOOST_CHECK(!ArePathsEqual(path.c_str(), prefix.data(), path.length()));
+        }
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
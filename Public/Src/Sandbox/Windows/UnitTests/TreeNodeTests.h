@@ -8,37 +8,44 @@ BOOST_AUTO_TEST_SUITE(TreeNodeTests)
 
 void TestBasicFunctionality(std::vector<std::wstring>& elementsToEmplace)
 {
+    TreeNodeArena arena;
     TreeNodeChildren children;
     TreeNode* dummy = NULL;
     for (auto it = elementsToEmplace.begin(); it != elementsToEmplace.end(); it++)
     {
-        children.emplace(*it, dummy);
+        children.emplace(arena.Intern(PathAtomKey(*it)), dummy);
     }
 
     BOOST_CHECK_EQUAL(elementsToEmplace.size(), children.size());
 
-    std::pair<std::wstring, TreeNode*> result;
+    TreeNodeChild result;
     
-    bool t1 = children.find(std::wstring(L"test1"), result);
+    bool t1 = children.find(PathAtomKey(L"test1"), result);
     BOOST_CHECK(t1);
-    BOOST_CHECK_EQUAL(L"test1", result.first.c_str());
+    BOOST_CHECK_EQUAL(L"test1", result.atom->chars());
 
     // Search should be case insensitive
-    t1 = children.find(std::wstring(L"TEST1"), result);
+    t1 = children.find(PathAtomKey(L"TEST1"), result);
     BOOST_CHECK(t1);
-    BOOST_CHECK_EQUAL(L"test1", result.first.c_str());
+    BOOST_CHECK_EQUAL(L"test1", result.atom->chars());
+
+    // All the other elements should still be found
+    for (auto it = elementsToEmplace.begin(); it != elementsToEmplace.end(); it++)
+    {
+        BOOST_CHECK(children.find(PathAtomKey(*it), result));
+    }
 
     // Validate that erase actually removes the element
-    children.erase(std::wstring(L"test1"));
+    children.erase(PathAtomKey(L"test1"));
     BOOST_CHECK_EQUAL(elementsToEmplace.size() - 1, children.size());
-    t1 = children.find(std::wstring(L"test1"), result);
+    t1 = children.find(PathAtomKey(L"test1"), result);
     BOOST_CHECK(!t1);
 
     // Validate for each
     std::vector<std::wstring> collection;
-    auto testForEach = [&collection](std::pair<std::wstring, TreeNode*>* iter)
+    auto testForEach = [&collection](TreeNodeChild* iter)
     {
-        std::wstring elem(iter->first);
+        std::wstring elem(iter->atom->chars());
         collection.emplace(collection.begin(), elem);
     };
     children.forEach(testForEach);
@@ -59,6 +66,17 @@ BOOST_AUTO_TEST_CASE( TreeNodeUnderThreshold )
     TestBasicFunctionality(elements);
 }
 
+BOOST_AUTO_TEST_CASE( TreeNodeBeyondInlineCapacity )
+{
+    std::vector<std::wstring> elements;
+    for (unsigned int i = 0; i < TREE_NODE_INLINE_CHILDREN * 2; i++)
+    {
+        elements.emplace(elements.begin(), std::wstring(L"test" + std::to_wstring(i)));
+    }
+
+    TestBasicFunctionality(elements);
+}
+
 BOOST_AUTO_TEST_CASE( TreeNodeBeyondThreshold )
 {
     
@@ -72,4 +90,16 @@ BOOST_AUTO_TEST_CASE( TreeNodeBeyondThreshold )
     TestBasicFunctionality(elements);
 }
 
+BOOST_AUTO_TEST_CASE( AtomsAreInterned )
+{
+    TreeNodeArena arena;
+    const PathAtom* atom = arena.Intern(PathAtomKey(L"test"));
+
+    // The same atom is returned for the same string, but interning is case sensitive
+    BOOST_CHECK(atom == arena.Intern(PathAtomKey(std::wstring(L"test"))));
+    BOOST_CHECK(atom != arena.Intern(PathAtomKey(L"TEST")));
+    BOOST_CHECK_EQUAL(L"test", atom->chars());
+    BOOST_CHECK_EQUAL(4, atom->length);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -400,7 +400,12 @@ namespace BuildXL.Execution.Analyzer
                 m_html.CreateRow("CreationFlags", data.CreationFlags.ToString(CultureInfo.InvariantCulture)),
                 m_html.CreateRow("Detoured", data.Detoured),
                 m_html.CreateRow("Error", data.Error.ToString(CultureInfo.InvariantCulture)),
-                m_html.CreateRow("CreateProcessStatusReturn", data.CreateProcessStatusReturn.ToString(CultureInfo.InvariantCulture)));
+                m_html.CreateRow("CreateProcessStatusReturn", data.CreateProcessStatusReturn.ToString(CultureInfo.InvariantCulture)),
+                m_html.CreateRow("CreateProcessMicroseconds", data.CreateProcessMicroseconds.ToString(CultureInfo.InvariantCulture)),
+                m_html.CreateRow("InjectionMicroseconds", data.InjectionMicroseconds.ToString(CultureInfo.InvariantCulture)),
+                m_html.CreateRow("DllInjectionMicroseconds", data.DllInjectionMicroseconds.ToString(CultureInfo.InvariantCulture)),
+                m_html.CreateRow("DriveMappingMicroseconds", data.DriveMappingMicroseconds.ToString(CultureInfo.InvariantCulture)),
+                m_html.CreateRow("PayloadCopyMicroseconds", data.PayloadCopyMicroseconds.ToString(CultureInfo.InvariantCulture)));
         }
 
         private string PrintIoTypeCounters(IOTypeCounters counters)
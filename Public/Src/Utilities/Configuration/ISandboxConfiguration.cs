@@ -186,6 +186,11 @@ namespace BuildXL.Utilities.Configuration
         /// </summary>
         bool KextEnableReportBatching { get; }
 
+        /// <summary>
+        /// When not 0, the sandbox kernel extension holds the reports of a pip for up to this many milliseconds and sends them together.
+        /// </summary>
+        uint KextReportCoalescingWindowMs { get; }
+
         /// <summary>
         /// Throttling can be triggered when CPU usage is above this value.
         /// </summary>
@@ -314,6 +319,16 @@ namespace BuildXL.Utilities.Configuration
         /// </remarks>
         public bool AlwaysRemoteInjectDetoursFrom32BitProcess { get; }
 
+        /// <summary>
+        /// When enabled, Detours answers probes for paths that are not members of a fully sealed input directory of a pip from the file access manifest,
+        /// as absent, without looking at the file system.
+        /// </summary>
+        /// <remarks>
+        /// The members of the fully sealed directories are then added to the manifest. A directory under a fully sealed directory that has no member
+        /// under it is reported as absent to the pip, even if it exists on disk. Paths under scopes where the pip may write are always probed.
+        /// </remarks>
+        public bool AnswerProbesUnderFullSealsFromManifest { get; }
+
         /// <summary>
         /// Unconditionally enable the PTrace sandbox On Linux. <see cref="EnableLinuxPTraceSandbox"/>
         /// </summary>
@@ -39,6 +39,7 @@ namespace BuildXL.Utilities.Configuration.Mutable
             MeasureProcessCpuTimes = true;                  // always measure process times + ram consumption
             KextReportQueueSizeMb = 0;                      // let the sandbox kernel extension apply defaults
             KextEnableReportBatching = true;                // use lock-free queue for batching access reports
+            KextReportCoalescingWindowMs = 0;               // send every access report right away
             KextThrottleCpuUsageBlockThresholdPercent = 0;  // no throttling by default
             KextThrottleCpuUsageWakeupThresholdPercent = 0; // no throttling by default
             KextThrottleMinAvailableRamMB = 0;              // no throttling by default
@@ -55,6 +56,7 @@ namespace BuildXL.Utilities.Configuration.Mutable
             PreserveFileSharingBehaviour = false;
             EnableLinuxPTraceSandbox = true;
             AlwaysRemoteInjectDetoursFrom32BitProcess = true;
+            AnswerProbesUnderFullSealsFromManifest = false;
             UnconditionallyEnableLinuxPTraceSandbox = false;
             // TODO: flip the default once we have verified this is not a breaking change
             IgnoreDeviceIoControlGetReparsePoint = true;
@@ -96,6 +98,7 @@ namespace BuildXL.Utilities.Configuration.Mutable
             MeasureProcessCpuTimes = template.MeasureProcessCpuTimes;
             KextReportQueueSizeMb = template.KextReportQueueSizeMb;
             KextEnableReportBatching = template.KextEnableReportBatching;
+            KextReportCoalescingWindowMs = template.KextReportCoalescingWindowMs;
             KextThrottleCpuUsageBlockThresholdPercent = template.KextThrottleCpuUsageBlockThresholdPercent;
             KextThrottleCpuUsageWakeupThresholdPercent = template.KextThrottleCpuUsageWakeupThresholdPercent;
             KextThrottleMinAvailableRamMB = template.KextThrottleMinAvailableRamMB;
@@ -112,6 +115,7 @@ namespace BuildXL.Utilities.Configuration.Mutable
             PreserveFileSharingBehaviour = template.PreserveFileSharingBehaviour;
             EnableLinuxPTraceSandbox = template.EnableLinuxPTraceSandbox;
             AlwaysRemoteInjectDetoursFrom32BitProcess = template.AlwaysRemoteInjectDetoursFrom32BitProcess;
+            AnswerProbesUnderFullSealsFromManifest = template.AnswerProbesUnderFullSealsFromManifest;
             UnconditionallyEnableLinuxPTraceSandbox = template.UnconditionallyEnableLinuxPTraceSandbox;
             IgnoreDeviceIoControlGetReparsePoint = template.IgnoreDeviceIoControlGetReparsePoint;
             ForceAddExecutionPermission = template.ForceAddExecutionPermission;
@@ -232,6 +236,9 @@ namespace BuildXL.Utilities.Configuration.Mutable
         /// <inheritdoc />
         public bool KextEnableReportBatching { get; set; }
 
+        /// <inheritdoc />
+        public uint KextReportCoalescingWindowMs { get; set; }
+
         /// <inheritdoc />
         public uint KextThrottleCpuUsageBlockThresholdPercent { get; set; }
 
@@ -289,6 +296,9 @@ namespace BuildXL.Utilities.Configuration.Mutable
         /// <inheritdoc />
         public bool AlwaysRemoteInjectDetoursFrom32BitProcess { get; set; }
 
+        /// <inheritdoc />
+        public bool AnswerProbesUnderFullSealsFromManifest { get; set; }
+
         /// <inheritdoc />
         public bool UnconditionallyEnableLinuxPTraceSandbox { get; set; }
 
@@ -10,6 +10,7 @@
 //// Aria logger class definition
 
 AriaLogger::AriaLogger(const char* token, const char *dbPath, int teardownTimeoutInSeconds)
+    : stagedEvents_(nullptr), stopping_(false)
 {
     token_ = token;
     dbPath_ = dbPath;
@@ -20,6 +21,9 @@ AriaLogger::AriaLogger(const char* token, const char *dbPath, int teardownTimeou
 
     logger_ = LogManager::Initialize(token);
     LogManager::SetTransmitProfile(TransmitProfile_NearRealTime);
+
+    stagedEventsAvailable_ = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+    flushThread_ = std::thread(&AriaLogger::FlushStagedEvents, this);
 }
 
 #pragma warning( push )
@@ -32,6 +36,12 @@ AriaLogger::~AriaLogger()
 // The function is declared 'noexcept' but calls function 'FlushAndTeardown()' which may throw exceptions
 // This destructor is not declared as noexcept, not sure why we get warning, but we can ignore it.
 #pragma warning( disable : 26447 )
+    // Log whatever is still staged before tearing down
+    stopping_ = true;
+    SetEvent(stagedEventsAvailable_);
+    flushThread_.join();
+    CloseHandle(stagedEventsAvailable_);
+
     LogManager::FlushAndTeardown();
 #pragma warning( pop )
 }
@@ -42,6 +52,152 @@ ILogger *AriaLogger::GetLogger() const noexcept
     return logger_;
 };
 
+#pragma warning( push )
+// Avoid calling new and delete explicitly, use std::make_unique<T> instead
+// Staged events are owned by the staging queue until the flushing thread logs them
+#pragma warning( disable : 26409 )
+AriaLogger::StagedEvent *AriaLogger::Stage(const char *eventName, int eventPropertiesLength, const AriaEventProperty *eventProperties)
+{
+    StagedEvent *event = new StagedEvent();
+    auto append = [event](const char *str)
+    {
+        const size_t offset = event->text.size();
+        event->text.insert(event->text.end(), str, str + strlen(str) + 1);
+        return offset;
+    };
+
+    append(eventName);
+    event->properties.reserve(eventPropertiesLength > 0 ? eventPropertiesLength : 0);
+    for (int i = 0; i < eventPropertiesLength; i++)
+    {
+#pragma warning( push )
+// Don't use pointer arithmetic. Use span instead
+#pragma warning( disable : 26481 )
+        const AriaEventProperty &property = eventProperties[i];
+#pragma warning( pop )
+
+        const size_t nameOffset = append(property.name);
+        const size_t valueOffset = property.value == nullptr ? NoValue : append(property.value);
+        event->properties.push_back({ nameOffset, valueOffset, property.piiOrLongValue });
+    }
+
+    return event;
+}
+
+void AriaLogger::Enqueue(StagedEvent *first, StagedEvent *last) noexcept
+{
+    // 'first' to 'last' are linked most recent first, like the queue itself
+    last->next = stagedEvents_.load(std::memory_order_relaxed);
+    while (!stagedEvents_.compare_exchange_weak(last->next, first, std::memory_order_release, std::memory_order_relaxed))
+    {
+    }
+
+    // The flushing thread only needs waking up when the queue goes from empty to non-empty
+    if (last->next == nullptr)
+    {
+        SetEvent(stagedEventsAvailable_);
+    }
+}
+
+void AriaLogger::FlushStagedEvents()
+{
+    while (true)
+    {
+        WaitForSingleObject(stagedEventsAvailable_, INFINITE);
+        const bool stopping = stopping_;
+
+        // Take the whole queue and reverse it, so events are logged in the order they were staged
+        StagedEvent *events = nullptr;
+        StagedEvent *staged = stagedEvents_.exchange(nullptr, std::memory_order_acquire);
+        while (staged != nullptr)
+        {
+            StagedEvent *next = staged->next;
+            staged->next = events;
+            events = staged;
+            staged = next;
+        }
+
+        while (events != nullptr)
+        {
+            StagedEvent *next = events->next;
+            LogStagedEvent(*events);
+            delete events;
+            events = next;
+        }
+
+        if (stopping)
+        {
+            return;
+        }
+    }
+}
+#pragma warning( pop )
+
+void AriaLogger::LogStagedEvent(const StagedEvent &event) const
+{
+    if (logger_ == nullptr)
+    {
+        return;
+    }
+
+    EventProperties props;
+    props.SetName(event.text.data());
+    for (const StagedProperty &property : event.properties)
+    {
+        const char *propName = &event.text[property.nameOffset];
+        if (property.valueOffset == NoValue)
+        {
+            props.SetProperty(propName, property.piiOrLongValue);
+        }
+        else if (property.piiOrLongValue == (int)PiiKind::PiiKind_None)
+        {
+            props.SetProperty(propName, &event.text[property.valueOffset]);
+        }
+        else
+        {
+            props.SetProperty(propName, &event.text[property.valueOffset], static_cast<PiiKind>(property.piiOrLongValue));
+        }
+    }
+
+    logger_->LogEvent(props);
+}
+
+void AriaLogger::Log(const char *eventName, int eventPropertiesLength, const AriaEventProperty *eventProperties)
+{
+    StagedEvent *event = Stage(eventName, eventPropertiesLength, eventProperties);
+    Enqueue(event, event);
+}
+
+void AriaLogger::Log(int eventsLength, const char **eventNames, const int *eventPropertiesLengths, const AriaEventProperty *eventProperties)
+{
+    if (eventsLength <= 0)
+    {
+        return;
+    }
+
+    // Link the batch most recent first, so it is enqueued at once
+    StagedEvent *first = nullptr;
+    StagedEvent *last = nullptr;
+    for (int i = 0; i < eventsLength; i++)
+    {
+#pragma warning( push )
+// Don't use pointer arithmetic. Use span instead
+#pragma warning( disable : 26481 )
+        StagedEvent *event = Stage(eventNames[i], eventPropertiesLengths[i], eventProperties);
+        eventProperties += eventPropertiesLengths[i];
+#pragma warning( pop )
+
+        event->next = first;
+        first = event;
+        if (last == nullptr)
+        {
+            last = event;
+        }
+    }
+
+    Enqueue(first, last);
+}
+
 //// External Interface
 #pragma warning( push )
 // Avoid calling new and delete explicitly, use std::make_unique<T> instead
@@ -61,42 +217,19 @@ void WINAPI DisposeAriaLogger(const AriaLogger *logger) noexcept
     }
 }
 
-void WINAPI LogEvent(const AriaLogger *logger, const char *eventName, int eventPropertiesLength, const AriaEventProperty *eventProperties)
+void WINAPI LogEvent(AriaLogger *logger, const char *eventName, int eventPropertiesLength, const AriaEventProperty *eventProperties)
 {
     if (logger != nullptr && eventProperties != nullptr)
     {
-        EventProperties props;
-        props.SetName(eventName);
-        for (int i = 0; i < eventPropertiesLength; i++)
-        {
-#pragma warning( push )
-// Don't use pointer arithmetic. Use span instead
-// No need to use spans for these since they are just being passed into props
-#pragma warning( disable : 26481 )
-            const char *propName = eventProperties[i].name;
-            const char *propValue = eventProperties[i].value;
-            const int64_t piiOrValue = eventProperties[i].piiOrLongValue;
-#pragma warning( pop )
-
-            if (propValue == nullptr)
-            {
-                props.SetProperty(propName, piiOrValue);
-            }
-            else if (piiOrValue == (int)PiiKind::PiiKind_None)
-            {
-                props.SetProperty(propName, propValue);
-            }
-            else
-            {
-                props.SetProperty(propName, propValue, static_cast<PiiKind>(piiOrValue));
-            }
-        }
+        logger->Log(eventName, eventPropertiesLength, eventProperties);
+    }
+}
 
-        ILogger *log = logger->GetLogger();
-        if (log != nullptr)
-        {
-            log->LogEvent(props);
-        }
+void WINAPI LogEvents(AriaLogger *logger, int eventsLength, const char **eventNames, const int *eventPropertiesLengths, const AriaEventProperty *eventProperties)
+{
+    if (logger != nullptr && eventNames != nullptr && eventPropertiesLengths != nullptr && eventProperties != nullptr)
+    {
+        logger->Log(eventsLength, eventNames, eventPropertiesLengths, eventProperties);
     }
 }
 
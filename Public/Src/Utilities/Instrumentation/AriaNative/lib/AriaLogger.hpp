@@ -8,20 +8,64 @@
 
 #include <LogManager.hpp>
 
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
 #include <Windows.h>
 
 using namespace MAT;
 
+struct AriaEventProperty
+{
+    const char *name;
+    const char *value;
+    int64_t piiOrLongValue;
+};
+
 class AriaLogger
 {
 
 private:
 
+    // A property of a staged event: its name and value are null-terminated strings in the text of the event
+    struct StagedProperty
+    {
+        size_t nameOffset;
+        size_t valueOffset; // NoValue when the property is a long
+        int64_t piiOrLongValue;
+    };
+
+    // An event copied from the caller, waiting in the staging queue to be logged by the flushing thread
+    struct StagedEvent
+    {
+        StagedEvent *next;
+        std::vector<char> text; // The event name, followed by the names and values of the properties
+        std::vector<StagedProperty> properties;
+    };
+
+    static constexpr size_t NoValue = SIZE_MAX;
+
     std::string token_;
     std::string dbPath_;
 
     ILogger *logger_;
 
+    // Staged events, most recent first. Callers push onto it without taking any lock,
+    // the flushing thread takes all of it at once.
+    std::atomic<StagedEvent *> stagedEvents_;
+    std::atomic<bool> stopping_;
+    HANDLE stagedEventsAvailable_;
+    std::thread flushThread_;
+
+    static StagedEvent *Stage(const char *eventName, int eventPropertiesLength, const AriaEventProperty *eventProperties);
+    void Enqueue(StagedEvent *first, StagedEvent *last) noexcept;
+    void FlushStagedEvents();
+    void LogStagedEvent(const StagedEvent &event) const;
+
 public:
 
     AriaLogger() = delete;
@@ -30,19 +74,22 @@ public:
     ~AriaLogger();
 
     ILogger *GetLogger() const noexcept;
-};
 
-struct AriaEventProperty
-{
-    const char *name;
-    const char *value;
-    int64_t piiOrLongValue;
+    // Copies an event, to be logged by the flushing thread.
+    void Log(const char *eventName, int eventPropertiesLength, const AriaEventProperty *eventProperties);
+
+    // Copies a batch of events, to be logged by the flushing thread in order.
+    void Log(int eventsLength, const char **eventNames, const int *eventPropertiesLengths, const AriaEventProperty *eventProperties);
 };
 
 AriaLogger* WINAPI CreateAriaLogger(const char *token, const char *dbPath, int teardownTimeoutInSeconds);
 void WINAPI DisposeAriaLogger(const AriaLogger *) noexcept;
 
-void WINAPI LogEvent(const AriaLogger *logger, const char *eventName, int eventPropertiesLength, const AriaEventProperty *eventProperties);
+// Events are copied and logged asynchronously, by a background thread of the logger.
+void WINAPI LogEvent(AriaLogger *logger, const char *eventName, int eventPropertiesLength, const AriaEventProperty *eventProperties);
+
+// Logs a batch of events. The properties of all the events follow each other in eventProperties, in the order of the events.
+void WINAPI LogEvents(AriaLogger *logger, int eventsLength, const char **eventNames, const int *eventPropertiesLengths, const AriaEventProperty *eventProperties);
 
 #endif
 #endif
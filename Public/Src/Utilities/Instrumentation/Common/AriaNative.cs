@@ -2,6 +2,7 @@
 // Licensed under the MIT License.
 
 using System;
+using System.Collections.Generic;
 using System.Runtime.InteropServices;
 
 namespace BuildXL.Utilities.Instrumentation.Common
@@ -51,11 +52,40 @@ namespace BuildXL.Utilities.Instrumentation.Common
             ExternLogEvent(logger, eventName, eventProperties.Length, eventProperties);
         }
 
+        /// <summary>
+        /// Logs a batch of events with a single call into the native logger.
+        /// </summary>
+        /// <remarks>
+        /// Like <see cref="LogEvent"/>, this only copies the events: they are logged by a background thread of the native logger.
+        /// </remarks>
+        public static void LogEvents(IntPtr logger, IReadOnlyList<(string Name, EventProperty[] Properties)> events)
+        {
+            var eventNames = new string[events.Count];
+            var eventPropertiesLengths = new int[events.Count];
+            var eventProperties = new List<EventProperty>();
+            for (int i = 0; i < events.Count; i++)
+            {
+                eventNames[i] = events[i].Name;
+                eventPropertiesLengths[i] = events[i].Properties.Length;
+                eventProperties.AddRange(events[i].Properties);
+            }
+
+            ExternLogEvents(logger, eventNames.Length, eventNames, eventPropertiesLengths, eventProperties.ToArray());
+        }
+
         [DllImport(AriaLibName, EntryPoint = "LogEvent")]
         private static extern void ExternLogEvent(
             IntPtr logger,
             [MarshalAs(UnmanagedType.LPStr)] string eventName,
             int eventPropertiesLength,
             [MarshalAs(UnmanagedType.LPArray)] EventProperty[] eventProperties);
+
+        [DllImport(AriaLibName, EntryPoint = "LogEvents")]
+        private static extern void ExternLogEvents(
+            IntPtr logger,
+            int eventsLength,
+            [MarshalAs(UnmanagedType.LPArray, ArraySubType = UnmanagedType.LPStr)] string[] eventNames,
+            [MarshalAs(UnmanagedType.LPArray)] int[] eventPropertiesLengths,
+            [MarshalAs(UnmanagedType.LPArray)] EventProperty[] eventProperties);
     }
 }
@@ -281,25 +281,38 @@ namespace BuildXL.Native.IO.Unix
         {
             try
             {
-                var directoryEntries = Directory.GetFileSystemEntries(directoryPath);
-                Array.Sort(directoryEntries, StringComparer.InvariantCulture);
+                var directoryEntries = new List<(string name, FileAttributes attributes)>();
+                if (OperatingSystemHelper.IsMacOS)
+                {
+                    if (!TryGetDirectoryEntriesWithAttributes(directoryPath, directoryEntries, out var errorResult))
+                    {
+                        accumulators.Current.Succeeded = false;
+                        return errorResult;
+                    }
+                }
+                else
+                {
+                    foreach (var entry in Directory.GetFileSystemEntries(directoryPath))
+                    {
+                        directoryEntries.Add((entry.Split(Path.DirectorySeparatorChar).Last(), File.GetAttributes(entry)));
+                    }
+                }
+
+                directoryEntries.Sort((x, y) => StringComparer.InvariantCulture.Compare(x.name, y.name));
 
-                var enumerator = directoryEntries.GetEnumerator();
                 var accumulator = accumulators.Current;
 
                 var patternRegex = GetRegex(pattern);
 
-                while (enumerator.MoveNext())
+                foreach (var (filename, attributes) in directoryEntries)
                 {
-                    var entry = enumerator.Current as string;
-                    var filename = entry.Split(Path.DirectorySeparatorChar).Last();
+                    var entry = Path.Combine(directoryPath, filename);
 
                     if (!isEnumerationForDirectoryDeletion && filename.Equals(DsStoreMetaFileName))
                     {
                         continue;
                     }
 
-                    FileAttributes attributes = File.GetAttributes(entry);
                     var isDirectory = (attributes & FileAttributes.Directory) == FileAttributes.Directory;
 
                     if (patternRegex.Match(filename).Success)
@@ -345,6 +358,71 @@ namespace BuildXL.Native.IO.Unix
                 (int)NativeIOConstants.ErrorNoMoreFiles);
         }
 
+        /// <summary>
+        /// Adds the entries of a directory along with their attributes to <paramref name="entries"/>, getting the attributes of
+        /// all the entries of the directory in a few system calls instead of with a stat per entry.
+        /// </summary>
+        private static bool TryGetDirectoryEntriesWithAttributes(string directoryPath, List<(string name, FileAttributes attributes)> entries, out EnumerateDirectoryResult errorResult)
+        {
+            int result = EnumerateDirectoryWithAttributes(directoryPath, (in DirectoryEntry entry) =>
+            {
+                string name = entry.GetName();
+
+                // The attributes of a symlink depend on its target, which was not looked at
+                var fileType = (FilePermissions)entry.Mode & FilePermissions.S_IFMT;
+                entries.Add((name, entry.Error != 0 || fileType == FilePermissions.S_IFLNK
+                    ? File.GetAttributes(Path.Combine(directoryPath, name))
+                    : ToFileAttributes(name, (FilePermissions)entry.Mode)));
+
+                return true;
+            });
+
+            if (result != 0)
+            {
+                int error = Marshal.GetLastWin32Error();
+                var status = error switch
+                {
+                    (int)Errno.ENOENT  => EnumerateDirectoryStatus.SearchDirectoryNotFound,
+                    (int)Errno.ENOTDIR => EnumerateDirectoryStatus.CannotEnumerateFile,
+                    (int)Errno.EACCES  => EnumerateDirectoryStatus.AccessDenied,
+                    (int)Errno.EPERM   => EnumerateDirectoryStatus.AccessDenied,
+                    _                  => EnumerateDirectoryStatus.UnknownError,
+                };
+
+                errorResult = new EnumerateDirectoryResult(directoryPath, status, error);
+                return false;
+            }
+
+            errorResult = default;
+            return true;
+        }
+
+        /// <summary>
+        /// The attributes <see cref="File.GetAttributes(string)"/> returns for a file named <paramref name="name"/> with the given mode
+        /// (assuming the current user owns it), which must not be the mode of a symlink.
+        /// </summary>
+        private static FileAttributes ToFileAttributes(string name, FilePermissions mode)
+        {
+            FileAttributes attributes = 0;
+
+            if ((mode & FilePermissions.S_IFMT) == FilePermissions.S_IFDIR)
+            {
+                attributes |= FileAttributes.Directory;
+            }
+
+            if ((mode & FilePermissions.S_IWUSR) == 0)
+            {
+                attributes |= FileAttributes.ReadOnly;
+            }
+
+            if (name.StartsWith(".", StringComparison.Ordinal))
+            {
+                attributes |= FileAttributes.Hidden;
+            }
+
+            return attributes == 0 ? FileAttributes.Normal : attributes;
+        }
+
         /// <inheritdoc />
         public string GetFinalPathNameByHandle(SafeFileHandle handle, bool volumeGuidPath = false) => throw new NotImplementedException();
 
@@ -440,14 +440,27 @@ namespace BuildXL.Native.IO.Unix
                             }
                         }
 
-                        using (var destinationStream = CreateReplacementFile(destination, FileShare.Delete, openAsync: true))
+                        if (OperatingSystemHelper.IsMacOS)
                         {
-                            await sourceStream.CopyToAsync(destinationStream);
-                            var mode = GetFilePermissionsForFilePath(source, followSymlink: false);
-                            var result = SetFilePermissionsForFilePath(destination, checked((FilePermissions)mode), followSymlink: false);
-                            if (result < 0)
+                            // Clones (or copies) the permissions and the timestamps along with the content, in one call
+                            DeleteFile(destination, retryOnFailure: true);
+                            m_fileSystem.CreateDirectory(Path.GetDirectoryName(destination));
+                            if (CloneOrCopyFile(source, destination, followSymlink: true) != 0)
                             {
-                                throw new BuildXLException($"Failed to set permissions for file copy at '{destination}' - error: {Marshal.GetLastWin32Error()}");
+                                throw new BuildXLException($"Failed to clone or copy file to '{destination}' - error: {Marshal.GetLastWin32Error()}");
+                            }
+                        }
+                        else
+                        {
+                            using (var destinationStream = CreateReplacementFile(destination, FileShare.Delete, openAsync: true))
+                            {
+                                await sourceStream.CopyToAsync(destinationStream);
+                                var mode = GetFilePermissionsForFilePath(source, followSymlink: false);
+                                var result = SetFilePermissionsForFilePath(destination, checked((FilePermissions)mode), followSymlink: false);
+                                if (result < 0)
+                                {
+                                    throw new BuildXLException($"Failed to set permissions for file copy at '{destination}' - error: {Marshal.GetLastWin32Error()}");
+                                }
                             }
                         }
 
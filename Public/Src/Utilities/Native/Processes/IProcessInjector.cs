@@ -16,5 +16,10 @@ namespace BuildXL.Native.Processes
 
         /// <nodoc />
         uint Inject(uint processId, bool inheritedHandles);
+
+        /// <summary>
+        /// Writes the completion of the pipelined injection request <paramref name="requestId"/> to the reply pipe of the process that sent it.
+        /// </summary>
+        uint CompleteRemoteInjection(uint requesterProcessId, ulong replyPipe, ulong requestId, uint error);
     }
 }
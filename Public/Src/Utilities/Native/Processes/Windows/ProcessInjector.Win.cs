@@ -52,6 +52,13 @@ namespace BuildXL.Native.Processes.Windows
             return DetouredProcessInjector_Inject64(m_injector, processId, inheritedHandles);
         }
 
+        /// <inheritdoc />
+        public uint CompleteRemoteInjection(uint requesterProcessId, ulong replyPipe, ulong requestId, uint error)
+        {
+            Assert64Process();
+            return DetouredProcessInjector_CompleteRemoteInjection64(m_injector, requesterProcessId, replyPipe, requestId, error);
+        }
+
         /// <nodoc />
         public void Dispose()
         {
@@ -104,6 +111,17 @@ namespace BuildXL.Native.Processes.Windows
             uint processId,
             [MarshalAs(UnmanagedType.Bool)]
             bool inheritedHandles);
+
+        [DllImport(ExternDll.BuildXLNatives64, EntryPoint = "DetouredProcessInjector_CompleteRemoteInjection", SetLastError = true)]
+        [return: MarshalAs(UnmanagedType.U4)]
+        private static extern uint DetouredProcessInjector_CompleteRemoteInjection64(
+            IntPtr injector,
+            [MarshalAs(UnmanagedType.U4)]
+            uint requesterProcessId,
+            ulong replyPipe,
+            ulong requestId,
+            [MarshalAs(UnmanagedType.U4)]
+            uint error);
     }
 }
 
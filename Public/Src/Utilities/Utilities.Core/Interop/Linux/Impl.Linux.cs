@@ -116,6 +116,20 @@ namespace BuildXL.Interop.Unix
             return StatFile(AT_FDCWD, path, followSymlink, ref statBuf);
         }
 
+        /// <summary>
+        /// Linux specific implementation of <see cref="IO.StatFiles"/>
+        /// </summary>
+        internal static int StatFiles(string[] paths, bool followSymlink, StatBuffer[] statBufs, int[] errors)
+        {
+            Contract.Requires(statBufs.Length >= paths.Length && errors.Length >= paths.Length);
+            for (int i = 0; i < paths.Length; i++)
+            {
+                errors[i] = StatFile(paths[i], followSymlink, ref statBufs[i]) == 0 ? 0 : Marshal.GetLastWin32Error();
+            }
+
+            return 0;
+        }
+
         private static int StatFile(int fd, string path, bool followSymlink, ref StatBuffer statBuf)
         {
             // If statx is supported, we prefer it since it gives us back the file creation time as well
@@ -456,6 +470,18 @@ namespace BuildXL.Interop.Unix
             return 0;
         }
 
+        /// <summary>
+        /// Linux specific implementation of <see cref="Memory.GetSystemResourceSnapshot"/>
+        /// </summary>
+        internal static int GetSystemResourceSnapshot(ref CpuLoadInfo cpuLoad, ref RamUsageInfo ramUsage, ref PressureLevel pressureLevel)
+        {
+            return GetCpuLoadInfo(ref cpuLoad, Marshal.SizeOf(cpuLoad)) == 0 &&
+                   GetRamUsageInfo(ref ramUsage) == 0 &&
+                   GetMemoryPressureLevel(ref pressureLevel) == 0
+                ? 0
+                : ERROR;
+        }
+
         /// <summary>
         /// Linux specific implementation of <see cref="Processor.GetCpuLoadInfo"/>
         /// </summary>
@@ -134,6 +134,46 @@ namespace BuildXL.Interop.Unix
             public DateTime ToUtcDateTime(long sec, long nsec) => new Timespec { Tv_sec = sec, Tv_nsec = nsec }.ToUtcTime();
         }
 
+        /// <summary>
+        /// An entry of a directory along with some of its attributes (see <see cref="EnumerateDirectoryWithAttributes"/>).
+        /// </summary>
+        [StructLayout(LayoutKind.Sequential)]
+        public unsafe struct DirectoryEntry
+        {
+            /// <summary>
+            /// Size of the entry name buffer (MAXNAMLEN + 1)
+            /// </summary>
+            public const int NameBufferSize = 256;
+
+            public ulong InodeNumber;
+            public ushort Mode;
+            public ushort NameLength;
+
+            /// <summary>
+            /// Error the attributes of this entry could not be retrieved with (0 if none), in which case only the name is valid
+            /// </summary>
+            public int Error;
+            public long Size;
+            public long TimeLastModification;
+            public long TimeNSecLastModification;
+            public fixed byte Name[NameBufferSize];
+
+            public string GetName()
+            {
+                fixed (byte* name = Name)
+                {
+                    return Encoding.UTF8.GetString(name, NameLength);
+                }
+            }
+
+            public DateTime GetLastModificationUtcTime() => new Timespec { Tv_sec = TimeLastModification, Tv_nsec = TimeNSecLastModification }.ToUtcTime();
+        }
+
+        /// <summary>
+        /// Receives an entry of a directory enumeration, only valid during the call, and returns whether the enumeration should go on.
+        /// </summary>
+        public delegate bool DirectoryEntryHandler(in DirectoryEntry entry);
+
         public enum FilePermissions : int
         {
             S_ISUID = 0x0800, // Set user ID on execution
@@ -180,6 +220,30 @@ namespace BuildXL.Interop.Unix
             ? Impl_Mac.StatFile(path, followSymlink, ref statBuf)
             : Impl_Linux.StatFile(path, followSymlink, ref statBuf);
 
+        /// <summary>
+        /// Same as <see cref="StatFile" /> for every path of <paramref name="paths"/>, in one call and possibly concurrently.
+        /// </summary>
+        /// <returns>
+        /// A value of 0 once every path was stat-ed, in which case the result for <c>paths[i]</c> is stored in <c>statBufs[i]</c>
+        /// when <c>errors[i]</c> is 0, and <c>errors[i]</c> is otherwise the error the call for that path failed with.
+        /// A value of -1 is returned if the paths could not be stat-ed at all.
+        /// </returns>
+        public static int StatFiles(string[] paths, bool followSymlink, StatBuffer[] statBufs, int[] errors) => IsMacOS
+            ? Impl_Mac.StatFiles(paths, followSymlink, statBufs, errors)
+            : Impl_Linux.StatFiles(paths, followSymlink, statBufs, errors);
+
+        /// <summary>
+        /// Enumerates the entries of directory <paramref name="path"/> along with their types, sizes, modification times and
+        /// inode numbers, without stat-ing every entry. Entries are handed to <paramref name="handleEntry"/> in no particular order.
+        /// </summary>
+        /// <returns>
+        /// A value of 0 if the whole directory was enumerated (or <paramref name="handleEntry"/> stopped the enumeration);
+        /// otherwise, a value of -1 is returned and <see cref="Marshal.GetLastWin32Error"/> is set to indicate the error.
+        /// </returns>
+        public static int EnumerateDirectoryWithAttributes(string path, DirectoryEntryHandler handleEntry) => IsMacOS
+            ? Impl_Mac.EnumerateDirectoryWithAttributes(path, handleEntry)
+            : throw new NotImplementedException();
+
         /// <summary>
         /// Same as <see cref="StatFile" /> except that the target file is given as a file descriptor (<paramref name="fd" />).
         /// </summary>
@@ -409,6 +473,18 @@ namespace BuildXL.Interop.Unix
         [DllImport(Libraries.LibC, SetLastError = true, EntryPoint = "clonefile")]
         public static extern int CloneFile(string source, string destination, CloneFileFlags flags);
 
+        /// <summary>
+        /// Makes <paramref name="destination"/> (which must not exist) a copy of <paramref name="source"/> in a single call, including
+        /// its timestamps and permissions: the copy is a clone sharing the data blocks of the source when both are on the same APFS volume.
+        /// </summary>
+        /// <returns>
+        /// Upon successful completion a value of 0 is returned; otherwise, a value of -1 is returned and
+        /// <see cref="Marshal.GetLastWin32Error"/> is set to indicate the error.
+        /// </returns>
+        public static int CloneOrCopyFile(string source, string destination, bool followSymlink) => IsMacOS
+            ? Impl_Mac.CloneOrCopyFile(source, destination, followSymlink)
+            : throw new NotImplementedException();
+
         /// <summary>
         /// Copies a file using 'copy_file_range' using in-kernel file descriptors.
         /// </summary>
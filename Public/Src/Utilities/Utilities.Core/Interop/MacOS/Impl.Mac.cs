@@ -2,6 +2,7 @@
 // Licensed under the MIT License.
 
 using System;
+using System.Diagnostics.ContractsLight;
 using System.Runtime.InteropServices;
 using System.Text;
 using Microsoft.Win32.SafeHandles;
@@ -24,11 +25,28 @@ namespace BuildXL.Interop.Unix
             var buf = new MacRamUsageInfo();
             var ret = GetRamUsageInfo(ref buf, Marshal.SizeOf(buf));
             if (ret != 0) return ERROR;
-            buffer.TotalBytes = s_totalMemoryBytes.Value;
-            buffer.FreeBytes = s_totalMemoryBytes.Value - (buf.AppMemory + buf.Wired + buf.Compressed);
+            ToRamUsageInfo(buf, ref buffer);
             return 0;
         }
 
+        /// <summary>OSX specific implementation of <see cref="Memory.GetSystemResourceSnapshot"/> </summary>
+        internal static int GetSystemResourceSnapshot(ref CpuLoadInfo cpuLoad, ref RamUsageInfo ramUsage, ref PressureLevel pressureLevel)
+        {
+            var buf = new MacSystemResourceSnapshot();
+            var ret = GetSystemResourceSnapshot(ref buf, Marshal.SizeOf(buf));
+            if (ret != 0) return ERROR;
+            cpuLoad = buf.CpuLoad;
+            ToRamUsageInfo(buf.RamUsage, ref ramUsage);
+            pressureLevel = buf.MemoryPressureLevel;
+            return 0;
+        }
+
+        private static void ToRamUsageInfo(in MacRamUsageInfo macRamUsage, ref RamUsageInfo buffer)
+        {
+            buffer.TotalBytes = s_totalMemoryBytes.Value;
+            buffer.FreeBytes = s_totalMemoryBytes.Value - (macRamUsage.AppMemory + macRamUsage.Wired + macRamUsage.Compressed);
+        }
+
         internal static string GetMountNameForPath(string path)
         {
             var statFsBuffer = new StatFsBuffer();
@@ -77,6 +95,16 @@ namespace BuildXL.Interop.Unix
             public ulong AppMemory => Internal - Purgable;
         }
 
+        [StructLayout(LayoutKind.Sequential)]
+        internal struct MacSystemResourceSnapshot
+        {
+            #pragma warning disable CS1591 // Missing XML comment for publicly visible type or member
+            public CpuLoadInfo CpuLoad;
+            public MacRamUsageInfo RamUsage;
+            public PressureLevel MemoryPressureLevel;
+            #pragma warning restore CS1591 // Missing XML comment for publicly visible type or member
+        }
+
         /// <summary>
         /// C# representation of the native struct statfs64
         ///
@@ -145,6 +173,16 @@ namespace BuildXL.Interop.Unix
         [DllImport(Libraries.BuildXLInteropLibMacOS, SetLastError = true)]
         private static extern int StatFile(string path, bool followSymlink, ref StatBuffer statBuf, long statBufferSize);
 
+        [DllImport(Libraries.BuildXLInteropLibMacOS, SetLastError = true)]
+        private static extern int StatFiles(string[] paths, int count, bool followSymlink, [Out] StatBuffer[] statBufs, [Out] int[] errors, long statBufferSize);
+
+        [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
+        [return: MarshalAs(UnmanagedType.I1)]
+        private unsafe delegate bool DirectoryEntriesHandler(DirectoryEntry* entries, int count);
+
+        [DllImport(Libraries.BuildXLInteropLibMacOS, SetLastError = true, CharSet = CharSet.Ansi)]
+        private static extern int EnumerateDirectoryWithAttributes(string path, DirectoryEntriesHandler handler, long entrySize);
+
         /// <summary>OSX specific implementation of <see cref="IO.GetFileSystemType"/> </summary>
         [DllImport(Libraries.BuildXLInteropLibMacOS, SetLastError = true, CharSet = CharSet.Ansi)]
         internal static extern int GetFileSystemType(SafeFileHandle fd, StringBuilder fsTypeName, long bufferSize);
@@ -157,6 +195,54 @@ namespace BuildXL.Interop.Unix
         internal unsafe static int StatFile(string path, bool followSymlink, ref StatBuffer statBuf)
             => StatFile(path, followSymlink, ref statBuf, sizeof(StatBuffer));
 
+        /// <summary>OSX specific implementation of <see cref="IO.StatFiles"/> </summary>
+        internal unsafe static int StatFiles(string[] paths, bool followSymlink, StatBuffer[] statBufs, int[] errors)
+        {
+            Contract.Requires(statBufs.Length >= paths.Length && errors.Length >= paths.Length);
+            return StatFiles(paths, paths.Length, followSymlink, statBufs, errors, sizeof(StatBuffer));
+        }
+
+        /// <summary>OSX specific implementation of <see cref="IO.EnumerateDirectoryWithAttributes"/> </summary>
+        internal unsafe static int EnumerateDirectoryWithAttributes(string path, DirectoryEntryHandler handleEntry)
+        {
+            // Exceptions must not unwind through the native frames of the enumeration: they are rethrown once it returns
+            Exception handlerException = null;
+            DirectoryEntriesHandler handler = (entries, count) =>
+            {
+                try
+                {
+                    for (int i = 0; i < count; i++)
+                    {
+                        if (!handleEntry(in entries[i]))
+                        {
+                            return false;
+                        }
+                    }
+
+                    return true;
+                }
+                catch (Exception e)
+                {
+                    handlerException = e;
+                    return false;
+                }
+            };
+
+            int result = EnumerateDirectoryWithAttributes(path, handler, sizeof(DirectoryEntry));
+            GC.KeepAlive(handler);
+
+            if (handlerException != null)
+            {
+                System.Runtime.ExceptionServices.ExceptionDispatchInfo.Capture(handlerException).Throw();
+            }
+
+            return result;
+        }
+
+        /// <summary>OSX specific implementation of <see cref="IO.CloneOrCopyFile"/> </summary>
+        [DllImport(Libraries.BuildXLInteropLibMacOS, SetLastError = true)]
+        internal static extern int CloneOrCopyFile(string source, string destination, bool followSymlink);
+
         /// <summary>OSX specific implementation of <see cref="IO.SafeReadLink"/> </summary>
         [DllImport(Libraries.BuildXLInteropLibMacOS, SetLastError = true, CharSet = CharSet.Ansi)]
         internal static extern long SafeReadLink(string link, StringBuilder buffer, long length);
@@ -201,6 +287,9 @@ namespace BuildXL.Interop.Unix
         [DllImport(Libraries.BuildXLInteropLibMacOS)]
         internal static extern int GetCpuLoadInfo(ref CpuLoadInfo buffer, long bufferSize);
 
+        [DllImport(Libraries.BuildXLInteropLibMacOS)]
+        private static extern int GetSystemResourceSnapshot(ref MacSystemResourceSnapshot buffer, long bufferSize);
+
         #region Sandbox
         [DllImport(Libraries.BuildXLInteropLibMacOS)]
         internal static extern unsafe int NormalizePathAndReturnHash(byte[] pPath, byte* buffer, int bufferLength);
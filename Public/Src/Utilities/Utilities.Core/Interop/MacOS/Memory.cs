@@ -3,6 +3,7 @@
 
 using System.Runtime.InteropServices;
 using static BuildXL.Interop.Dispatch;
+using static BuildXL.Interop.Unix.Processor;
 
 namespace BuildXL.Interop.Unix
 {
@@ -50,5 +51,13 @@ namespace BuildXL.Interop.Unix
         public static int GetMemoryPressureLevel(ref PressureLevel level) => IsMacOS
             ? Impl_Mac.GetMemoryPressureLevel(ref level)
             : Impl_Linux.GetMemoryPressureLevel(ref level);
+
+        /// <summary>
+        /// Returns what <see cref="Processor.GetCpuLoadInfo"/>, <see cref="GetRamUsageInfo"/> and <see cref="GetMemoryPressureLevel"/>
+        /// return, in a single call
+        /// </summary>
+        public static int GetSystemResourceSnapshot(ref CpuLoadInfo cpuLoad, ref RamUsageInfo ramUsage, ref PressureLevel pressureLevel) => IsMacOS
+            ? Impl_Mac.GetSystemResourceSnapshot(ref cpuLoad, ref ramUsage, ref pressureLevel)
+            : Impl_Linux.GetSystemResourceSnapshot(ref cpuLoad, ref ramUsage, ref pressureLevel);
     }
 }
@@ -88,6 +88,11 @@ namespace BuildXL.Interop.Unix
             public int Error;
             public ulong Address;
             public uint Port;
+
+            /// <summary>
+            /// Address of the queue of process lifecycle reports, which are handed over ahead of the file accesses queued before them
+            /// </summary>
+            public ulong PriorityAddress;
         }
 
         [DllImport(Libraries.BuildXLInteropLibMacOS, CallingConvention = CallingConvention.Cdecl)]
@@ -164,6 +169,7 @@ namespace BuildXL.Interop.Unix
             public bool EnableReportBatching;
             public ResourceThresholds ResourceThresholds;
             public bool EnableCatalinaDataPartitionFiltering;
+            public uint ReportCoalescingWindowMs;
         }
 
         [DllImport(Libraries.BuildXLInteropLibMacOS, EntryPoint = "Configure")]
@@ -266,10 +272,14 @@ namespace BuildXL.Interop.Unix
             /// <summary>
             /// Interprets <see cref="PathOrPipStats"/> as a 0-terminated UTF8-encoded string.
             /// </summary>
+            /// <remarks>
+            /// The sandbox doesn't clear what follows the terminator, so only the bytes up to it are decoded.
+            /// </remarks>
             public string DecodePath()
             {
                 Contract.Requires(PathOrPipStats != null);
-                return s_accessReportStringEncoding.GetString(PathOrPipStats).TrimEnd('\0');
+                int length = Array.IndexOf(PathOrPipStats, (byte)0);
+                return s_accessReportStringEncoding.GetString(PathOrPipStats, 0, length < 0 ? PathOrPipStats.Length : length);
             }
 
             /// <summary>
@@ -302,11 +312,21 @@ namespace BuildXL.Interop.Unix
         [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
         public delegate void AccessReportCallback(AccessReport report, int error);
 
+        /// <summary>
+        /// Receives the reports the kernel extension queue had available during one wakeup of the listener.
+        /// </summary>
+        /// <param name="reports">Pointer to <paramref name="count"/> contiguous <see cref="AccessReport"/> structures, only valid during the call</param>
+        /// <param name="count">Number of reports; 0 when <paramref name="error"/> is not <see cref="ReportQueueSuccessCode"/></param>
+        /// <param name="error">Error code of the report queue</param>
+        [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
+        public delegate void AccessReportBatchCallback(IntPtr reports, int count, int error);
+
         [DllImport(Libraries.BuildXLInteropLibMacOS, CallingConvention=CallingConvention.Cdecl, CharSet = CharSet.Ansi)]
         public static extern void ListenForFileAccessReports(
-            [MarshalAs(UnmanagedType.FunctionPtr)] AccessReportCallback callbackPointer,
+            [MarshalAs(UnmanagedType.FunctionPtr)] AccessReportBatchCallback callbackPointer,
             long accessReportSize,
             ulong address,
+            ulong priorityAddress,
             uint port);
 
         /// <summary>
@@ -336,4 +356,4 @@ namespace BuildXL.Interop.Unix
     }
 }
 
-#pragma warning restore CS1591
\ No newline at end of file
+#pragma warning restore CS1591
\ No newline at end of file
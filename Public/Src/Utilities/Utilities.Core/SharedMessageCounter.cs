@@ -0,0 +1,111 @@
+﻿// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+using System;
+using System.IO;
+using System.IO.MemoryMappedFiles;
+using System.Threading;
+
+#nullable enable
+
+namespace BuildXL.Utilities.Core
+{
+    /// <summary>
+    /// Page of shared memory holding the count of the messages sent by the sandboxed processes of a pip, next to the semaphore
+    /// that counts them otherwise (see <see cref="INamedSemaphore"/>).
+    /// </summary>
+    /// <remarks>
+    /// Releasing the semaphore takes a system call per report. The sandbox increments the counter with an atomic add instead,
+    /// and only falls back to the semaphore when it can't map the page. The messages received are counted here rather than
+    /// by waiting on the semaphore, and the two are compared when the pip ends.
+    /// The page is named after the semaphore: the file mapping '&lt;name&gt;_count' on Windows (see DetoursHelpers.cpp) and
+    /// the file '/dev/shm&lt;name&gt;.count' on Linux (see bxl_observer.cpp).
+    /// </remarks>
+    public sealed class SharedMessageCounter : IDisposable
+    {
+        private const int CounterSize = sizeof(long);
+
+        private readonly MemoryMappedFile m_file;
+        private readonly MemoryMappedViewAccessor m_view;
+        private readonly string? m_path;
+        private long m_received;
+        private bool m_disposed;
+
+        private SharedMessageCounter(MemoryMappedFile file, string? path)
+        {
+            m_file = file;
+            m_view = file.CreateViewAccessor(0, CounterSize);
+            m_path = path;
+        }
+
+        /// <summary>
+        /// Creates the counter of the message count semaphore <paramref name="semaphoreName"/>.
+        /// </summary>
+        public static Possible<SharedMessageCounter> CreateNew(string semaphoreName)
+        {
+            try
+            {
+                if (OperatingSystemHelper.IsWindowsOS)
+                {
+                    return new SharedMessageCounter(MemoryMappedFile.CreateNew(semaphoreName + "_count", CounterSize), path: null);
+                }
+                else if (OperatingSystemHelper.IsLinuxOS)
+                {
+                    string path = "/dev/shm" + semaphoreName + ".count";
+                    return new SharedMessageCounter(MemoryMappedFile.CreateFromFile(path, FileMode.CreateNew, mapName: null, CounterSize), path);
+                }
+                else
+                {
+                    return new Failure<PlatformNotSupportedException>(new PlatformNotSupportedException("Shared message counters are not supported on current OS."));
+                }
+            }
+            catch (Exception e)
+            {
+                return new Failure<string>(e.ToString());
+            }
+        }
+
+        /// <summary>
+        /// Number of messages sent so far.
+        /// </summary>
+        public long Sent => m_view.ReadInt64(0);
+
+        /// <summary>
+        /// Number of messages received so far.
+        /// </summary>
+        public long Received => Interlocked.Read(ref m_received);
+
+        /// <summary>
+        /// Counts a message received.
+        /// </summary>
+        public void CountReceived()
+        {
+            Interlocked.Increment(ref m_received);
+        }
+
+        /// <inheritdoc/>
+        public void Dispose()
+        {
+            if (m_disposed)
+            {
+                return;
+            }
+
+            m_disposed = true;
+            m_view.Dispose();
+            m_file.Dispose();
+
+            if (m_path != null)
+            {
+                try
+                {
+                    File.Delete(m_path);
+                }
+                catch (Exception e) when (e is IOException || e is UnauthorizedAccessException)
+                {
+                    // Best effort: the page is only a few bytes of /dev/shm
+                }
+            }
+        }
+    }
+}
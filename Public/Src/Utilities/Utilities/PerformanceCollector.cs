@@ -315,11 +315,13 @@ namespace BuildXL.Utilities
                 else
                 {
                     diskStats = GetDiskCountersUnix();
-                    machineCpu = GetMachineCpuUnix();
 
+                    CpuLoadInfo cpuLoadInfo = new CpuLoadInfo();
                     RamUsageInfo ramUsageInfo = new RamUsageInfo();
-                    if (GetRamUsageInfo(ref ramUsageInfo) == MACOS_INTEROP_SUCCESS)
+                    PressureLevel pressureLevel = PressureLevel.Normal;
+                    if (GetSystemResourceSnapshot(ref cpuLoadInfo, ref ramUsageInfo, ref pressureLevel) == MACOS_INTEROP_SUCCESS)
                     {
+                        machineCpu = GetMachineCpuUnix(cpuLoadInfo);
                         machineAvailablePhysicalBytes = ramUsageInfo.FreeBytes;
                         machineTotalPhysicalBytes = ramUsageInfo.TotalBytes;
                     }
@@ -772,28 +774,20 @@ namespace BuildXL.Utilities
             return machineCpu;
         }
 
-        private double? GetMachineCpuUnix()
+        private double? GetMachineCpuUnix(CpuLoadInfo buffer)
         {
             double? machineCpu = null;
 
-            var buffer = new CpuLoadInfo();
-
-            // Initialize the CPU load info
-            if (m_lastCpuLoadInfo.SystemTime == 0 && m_lastCpuLoadInfo.UserTime == 0 && m_lastCpuLoadInfo.IdleTime == 0)
-            {
-                GetCpuLoadInfo(ref buffer);
-                m_lastCpuLoadInfo = buffer;
-            }
-
-            buffer = new CpuLoadInfo();
-            if (GetCpuLoadInfo(ref buffer) == MACOS_INTEROP_SUCCESS)
+            // The CPU usage is only known from the second sample on
+            bool isFirstSample = m_lastCpuLoadInfo.SystemTime == 0 && m_lastCpuLoadInfo.UserTime == 0 && m_lastCpuLoadInfo.IdleTime == 0;
+            if (!isFirstSample)
             {
                 double systemTicks = buffer.SystemTime - m_lastCpuLoadInfo.SystemTime;
                 double userTicks = buffer.UserTime - m_lastCpuLoadInfo.UserTime;
                 double idleTicks = buffer.IdleTime - m_lastCpuLoadInfo.IdleTime;
                 double totalTicks = systemTicks + userTicks + idleTicks;
 
-                machineCpu = 100.0 * ((systemTicks + userTicks) / totalTicks);
+                machineCpu = totalTicks > 0 ? 100.0 * ((systemTicks + userTicks) / totalTicks) : 0;
             }
 
             m_lastCpuLoadInfo = buffer;